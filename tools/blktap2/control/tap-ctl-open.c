@@ -36,7 +36,8 @@
 #include "blktaplib.h"
 
 int
-tap_ctl_open(const int id, const int minor, const char *params)
+tap_ctl_open_flags(const int id, const int minor, const char *params,
+		   int flags, int domid)
 {
 	int err;
 	tapdisk_message_t message;
@@ -46,6 +47,8 @@ tap_ctl_open(const int id, const int minor, const char *params)
 	message.cookie = minor;
 	message.u.params.storage = TAPDISK_STORAGE_TYPE_DEFAULT;
 	message.u.params.devnum = minor;
+	message.u.params.flags = flags;
+	message.u.params.domid = domid;
 
 	err = snprintf(message.u.params.path,
 		       sizeof(message.u.params.path) - 1, "%s", params);
@@ -73,3 +76,9 @@ tap_ctl_open(const int id, const int minor, const char *params)
 
 	return err;
 }
+
+int
+tap_ctl_open(const int id, const int minor, const char *params)
+{
+	return tap_ctl_open_flags(id, minor, params, 0, 0);
+}
@@ -31,6 +31,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <inttypes.h>
 
 #include "tap-ctl.h"
 
@@ -536,6 +537,156 @@ usage:
 	return EINVAL;
 }
 
+static void
+tap_cli_stats_usage(FILE *stream)
+{
+	fprintf(stream, "usage: stats <-p pid> <-m minor>\n");
+}
+
+static int
+tap_cli_stats(int argc, char **argv)
+{
+	tapdisk_message_stats_t stats;
+	int c, pid, minor, err;
+
+	pid   = -1;
+	minor = -1;
+
+	optind = 0;
+	while ((c = getopt(argc, argv, "p:m:h")) != -1) {
+		switch (c) {
+		case 'p':
+			pid = atoi(optarg);
+			break;
+		case 'm':
+			minor = atoi(optarg);
+			break;
+		case '?':
+			goto usage;
+		case 'h':
+			tap_cli_stats_usage(stdout);
+			return 0;
+		}
+	}
+
+	if (pid == -1 || minor == -1)
+		goto usage;
+
+	err = tap_ctl_stats(pid, minor, &stats);
+	if (err)
+		return err;
+
+	printf("received=%"PRIu64" returned=%"PRIu64" kicked=%"PRIu64" "
+	       "errors=%"PRIu64" retries=%"PRIu64" secs_pending=%"PRIu64"\n",
+	       stats.received, stats.returned, stats.kicked,
+	       stats.errors, stats.retries, stats.secs_pending);
+	printf("queue=%s size=%u pending=%u deferred=%u queued=%"PRIu64" "
+	       "completed=%"PRIu64" errors=%"PRIu64" deferrals=%"PRIu64"\n",
+	       stats.shared ? "server" : "vbd", stats.size,
+	       stats.tiocbs_pending, stats.tiocbs_deferred,
+	       stats.tiocbs_queued, stats.tiocbs_completed,
+	       stats.tiocbs_errors, stats.deferrals);
+	printf("merge_in=%"PRIu64" merge_out=%"PRIu64" ratio=%.2f "
+	       "vectored=%"PRIu64" holds=%"PRIu64"\n",
+	       stats.merge_in, stats.merge_out,
+	       stats.merge_out ?
+	       (double)stats.merge_in / stats.merge_out : 0.0,
+	       stats.merge_vectored, stats.holds);
+
+	return 0;
+
+usage:
+	tap_cli_stats_usage(stderr);
+	return EINVAL;
+}
+
+static void
+tap_cli_mirror_usage(FILE *stream)
+{
+	fprintf(stream, "usage: mirror <-p pid> <-m minor> "
+		"[-a type:/path/to/mirror | -c]\n");
+}
+
+static const char *
+tap_cli_mirror_state(uint32_t state)
+{
+	switch (state) {
+	case TAPDISK_MIRROR_IDLE:
+		return "idle";
+	case TAPDISK_MIRROR_COPY:
+		return "copy";
+	case TAPDISK_MIRROR_SYNC:
+		return "sync";
+	case TAPDISK_MIRROR_DONE:
+		return "done";
+	case TAPDISK_MIRROR_FAILED:
+		return "failed";
+	default:
+		return "unknown";
+	}
+}
+
+static int
+tap_cli_mirror(int argc, char **argv)
+{
+	tapdisk_message_mirror_t status;
+	int c, pid, minor, cancel, err;
+	const char *params;
+
+	pid    = -1;
+	minor  = -1;
+	cancel = 0;
+	params = NULL;
+
+	optind = 0;
+	while ((c = getopt(argc, argv, "p:m:a:ch")) != -1) {
+		switch (c) {
+		case 'p':
+			pid = atoi(optarg);
+			break;
+		case 'm':
+			minor = atoi(optarg);
+			break;
+		case 'a':
+			params = optarg;
+			break;
+		case 'c':
+			cancel = 1;
+			break;
+		case '?':
+			goto usage;
+		case 'h':
+			tap_cli_mirror_usage(stdout);
+			return 0;
+		}
+	}
+
+	if (pid == -1 || minor == -1 || (params && cancel))
+		goto usage;
+
+	if (params)
+		return tap_ctl_mirror(pid, minor, params);
+
+	if (cancel)
+		return tap_ctl_mirror_cancel(pid, minor);
+
+	err = tap_ctl_mirror_status(pid, minor, &status);
+	if (err)
+		return err;
+
+	printf("state=%s error=%d block_secs=%u blocks=%"PRIu64" "
+	       "dirty=%"PRIu64" inflight=%"PRIu64" copied=%"PRIu64" "
+	       "zero=%"PRIu64"\n", tap_cli_mirror_state(status.state),
+	       status.error, status.block_secs, status.blocks, status.dirty,
+	       status.inflight, status.copied, status.zero);
+
+	return 0;
+
+usage:
+	tap_cli_mirror_usage(stderr);
+	return EINVAL;
+}
+
 static void
 tap_cli_unpause_usage(FILE *stream)
 {
@@ -633,22 +784,29 @@ usage:
 static void
 tap_cli_open_usage(FILE *stream)
 {
-	fprintf(stream, "usage: open <-p pid> <-m minor> <-a args>\n");
+	fprintf(stream, "usage: open <-p pid> <-m minor> <-a args> "
+		"[-d domid (grant copy data path)]\n");
 }
 
 static int
 tap_cli_open(int argc, char **argv)
 {
 	const char *args;
-	int c, pid, minor;
+	int c, pid, minor, flags, domid;
 
 	pid   = -1;
 	minor = -1;
 	args  = NULL;
+	flags = 0;
+	domid = 0;
 
 	optind = 0;
-	while ((c = getopt(argc, argv, "a:m:p:h")) != -1) {
+	while ((c = getopt(argc, argv, "a:m:p:d:h")) != -1) {
 		switch (c) {
+		case 'd':
+			flags |= TAPDISK_MESSAGE_FLAG_GNTCOPY;
+			domid  = atoi(optarg);
+			break;
 		case 'p':
 			pid = atoi(optarg);
 			break;
@@ -669,7 +827,7 @@ tap_cli_open(int argc, char **argv)
 	if (pid == -1 || minor == -1 || !args)
 		goto usage;
 
-	return tap_ctl_open(pid, minor, args);
+	return tap_ctl_open_flags(pid, minor, args, flags, domid);
 
 usage:
 	tap_cli_open_usage(stderr);
@@ -715,6 +873,8 @@ struct command commands[] = {
 	{ .name = "close",        .func = tap_cli_close         },
 	{ .name = "pause",        .func = tap_cli_pause         },
 	{ .name = "unpause",      .func = tap_cli_unpause       },
+	{ .name = "stats",        .func = tap_cli_stats         },
+	{ .name = "mirror",       .func = tap_cli_mirror        },
 	{ .name = "major",        .func = tap_cli_major         },
 	{ .name = "check",        .func = tap_cli_check         },
 };
@@ -91,11 +91,21 @@ int tap_ctl_attach(const int id, const int minor);
 int tap_ctl_detach(const int id, const int minor);
 
 int tap_ctl_open(const int id, const int minor, const char *params);
+int tap_ctl_open_flags(const int id, const int minor, const char *params,
+		       int flags, int domid);
 int tap_ctl_close(const int id, const int minor, const int force);
 
 int tap_ctl_pause(const int id, const int minor);
 int tap_ctl_unpause(const int id, const int minor, const char *params);
 
+int tap_ctl_stats(const int id, const int minor,
+		  tapdisk_message_stats_t *stats);
+
+int tap_ctl_mirror(const int id, const int minor, const char *params);
+int tap_ctl_mirror_status(const int id, const int minor,
+			  tapdisk_message_mirror_t *status);
+int tap_ctl_mirror_cancel(const int id, const int minor);
+
 int tap_ctl_blk_major(void);
 
 #endif
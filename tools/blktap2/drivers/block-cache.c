@@ -29,7 +29,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
 #include "tapdisk.h"
 #include "tapdisk-utils.h"
@@ -58,6 +61,16 @@
 #define BLOCK_CACHE_REQUESTS            (TAPDISK_DATA_REQUESTS << 3)
 #define BLOCK_CACHE_PAGE_IDLETIME       60
 
+/*
+ * host-wide cache, shared by every tapdisk reading the same image.
+ * 4K pages in a set-associative table, evicted per set by clock.
+ */
+#define BLOCK_CACHE_SHM_MAGIC           0x746462637368316dULL
+#define BLOCK_CACHE_SHM_SIZE            (64 << 20)
+#define BLOCK_CACHE_SHM_SIZE_ENV        "TAPDISK_SHARED_CACHE_MB"
+#define BLOCK_CACHE_SHM_WAYS            8
+#define BLOCK_CACHE_SECS_PER_PAGE       BLOCK_CACHE_NODES_PER_PAGE
+
 typedef struct radix_tree               radix_tree_t;
 typedef struct radix_tree_node          radix_tree_node_t;
 typedef struct radix_tree_link          radix_tree_link_t;
@@ -67,6 +80,9 @@ typedef struct radix_tree_page          radix_tree_page_t;
 typedef struct block_cache              block_cache_t;
 typedef struct block_cache_request      block_cache_request_t;
 typedef struct block_cache_stats        block_cache_stats_t;
+typedef struct block_cache_shm          block_cache_shm_t;
+typedef struct block_cache_shm_header   block_cache_shm_header_t;
+typedef struct block_cache_shm_slot     block_cache_shm_slot_t;
 
 struct radix_tree_page {
 	char                           *buf;
@@ -117,6 +133,41 @@ struct block_cache_stats {
 	uint64_t                        prunes;
 };
 
+struct block_cache_shm_header {
+	uint64_t                        magic;
+	uint64_t                        dev;
+	uint64_t                        ino;
+	uint64_t                        size;
+	uint64_t                        mtime;
+	uint32_t                        slots;
+	uint32_t                        users;
+
+	/* host-wide counters, updated atomically */
+	uint64_t                        hits;
+	uint64_t                        misses;
+	uint64_t                        evictions;
+};
+
+struct block_cache_shm_slot {
+	uint32_t                        seq;   /* odd while being written */
+	uint32_t                        ref;   /* clock reference bit */
+	uint32_t                        valid; /* cached sectors of the page */
+	uint32_t                        pad;
+	uint64_t                        page;  /* page number + 1, 0 if free */
+};
+
+struct block_cache_shm {
+	int                             fd;
+	char                           *name;
+	void                           *base;
+	size_t                          size;
+	uint32_t                        sets;
+	uint32_t                        hand;
+	block_cache_shm_header_t       *hdr;
+	block_cache_shm_slot_t         *slots;
+	char                           *data;
+};
+
 struct block_cache {
 	int                             ptype;
 	char                           *name;
@@ -130,6 +181,7 @@ struct block_cache {
 	event_id_t                      timeout_id;
 
 	radix_tree_t                    tree;
+	block_cache_shm_t              *shm;
 
 	block_cache_stats_t             stats;
 };
@@ -488,6 +540,404 @@ radix_tree_free(radix_tree_t *tree)
 	radix_tree_destroy(tree);
 }
 
+static inline size_t
+block_cache_shm_align(size_t size)
+{
+	return (size + RADIX_TREE_PAGE_SIZE - 1) & ~(RADIX_TREE_PAGE_SIZE - 1);
+}
+
+static size_t
+block_cache_shm_size(void)
+{
+	long mb;
+	char *env, *end;
+
+	env = getenv(BLOCK_CACHE_SHM_SIZE_ENV);
+	if (!env)
+		return BLOCK_CACHE_SHM_SIZE;
+
+	mb = strtol(env, &end, 0);
+	if (*env == '\0' || *end != '\0' || mb <= 0) {
+		EPRINTF("ignoring %s=%s\n", BLOCK_CACHE_SHM_SIZE_ENV, env);
+		return BLOCK_CACHE_SHM_SIZE;
+	}
+
+	return (size_t)mb << 20;
+}
+
+static inline size_t
+block_cache_shm_table_size(uint32_t slots)
+{
+	return block_cache_shm_align(slots * sizeof(block_cache_shm_slot_t));
+}
+
+static inline size_t
+block_cache_shm_bytes(uint32_t slots)
+{
+	return RADIX_TREE_PAGE_SIZE + block_cache_shm_table_size(slots) +
+		(size_t)slots * RADIX_TREE_PAGE_SIZE;
+}
+
+static void
+block_cache_shm_detach(block_cache_t *cache)
+{
+	block_cache_shm_t *shm = cache->shm;
+
+	if (!shm)
+		return;
+
+	flock(shm->fd, LOCK_EX);
+	if (--shm->hdr->users == 0)
+		shm_unlink(shm->name);
+	flock(shm->fd, LOCK_UN);
+
+	munmap(shm->base, shm->size);
+	close(shm->fd);
+	free(shm->name);
+	free(shm);
+
+	cache->shm = NULL;
+}
+
+/*
+ * Returns the number of slots of an initialised segment, or 0 if the
+ * segment is new (or was left half-built by a tapdisk that died).
+ */
+static int64_t
+block_cache_shm_probe(int fd, off_t size)
+{
+	int64_t slots;
+	block_cache_shm_header_t *hdr;
+
+	if (size < RADIX_TREE_PAGE_SIZE)
+		return 0;
+
+	hdr = mmap(NULL, RADIX_TREE_PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		return -errno;
+
+	slots = hdr->slots;
+	if (hdr->magic != BLOCK_CACHE_SHM_MAGIC ||
+	    !slots || slots % BLOCK_CACHE_SHM_WAYS ||
+	    size < block_cache_shm_bytes(slots))
+		slots = 0;
+
+	munmap(hdr, RADIX_TREE_PAGE_SIZE);
+	return slots;
+}
+
+/*
+ * The segment is named after the identity of the image file; golden
+ * images are read-only, so a changed file gets a fresh segment.
+ * Attach and detach are serialised by flock on the segment itself.
+ */
+static int
+block_cache_shm_attach(block_cache_t *cache)
+{
+	int err, fresh;
+	int64_t slots;
+	struct stat img, st;
+	block_cache_shm_t *shm;
+	block_cache_shm_header_t *hdr;
+
+	if (stat(cache->name, &img))
+		return -errno;
+
+	shm = calloc(1, sizeof(*shm));
+	if (!shm)
+		return -ENOMEM;
+
+	shm->fd = -1;
+
+	err = asprintf(&shm->name, "/tapdisk-cache-%llx-%llx-%llx-%llx",
+		       (unsigned long long)img.st_dev,
+		       (unsigned long long)img.st_ino,
+		       (unsigned long long)img.st_size,
+		       (unsigned long long)img.st_mtime);
+	if (err == -1) {
+		shm->name = NULL;
+		err = -ENOMEM;
+		goto fail;
+	}
+
+	shm->fd = shm_open(shm->name, O_RDWR | O_CREAT, 0600);
+	if (shm->fd == -1) {
+		err = -errno;
+		goto fail;
+	}
+
+	if (flock(shm->fd, LOCK_EX)) {
+		err = -errno;
+		goto fail;
+	}
+
+	if (fstat(shm->fd, &st)) {
+		err = -errno;
+		goto fail_unlock;
+	}
+
+	slots = block_cache_shm_probe(shm->fd, st.st_size);
+	if (slots < 0) {
+		err = slots;
+		goto fail_unlock;
+	}
+
+	fresh = !slots;
+
+	if (fresh) {
+		slots = block_cache_shm_size() / RADIX_TREE_PAGE_SIZE;
+		slots = slots / BLOCK_CACHE_SHM_WAYS * BLOCK_CACHE_SHM_WAYS;
+		if (!slots) {
+			err = -EINVAL;
+			goto fail_unlock;
+		}
+
+		/* reserve tmpfs space now rather than fault on it later */
+		if (ftruncate(shm->fd, 0)) {
+			err = -errno;
+			goto fail_unlock;
+		}
+
+		err = posix_fallocate(shm->fd, 0, block_cache_shm_bytes(slots));
+		if (err) {
+			err = -err;
+			goto fail_unlock;
+		}
+	}
+
+	shm->size = block_cache_shm_bytes(slots);
+	shm->base = mmap(NULL, shm->size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, shm->fd, 0);
+	if (shm->base == MAP_FAILED) {
+		shm->base = NULL;
+		err = -errno;
+		goto fail_unlock;
+	}
+
+	shm->hdr   = shm->base;
+	shm->slots = (block_cache_shm_slot_t *)
+		((char *)shm->base + RADIX_TREE_PAGE_SIZE);
+	shm->data  = (char *)shm->slots + block_cache_shm_table_size(slots);
+	shm->sets  = slots / BLOCK_CACHE_SHM_WAYS;
+
+	hdr = shm->hdr;
+	if (fresh) {
+		hdr->dev   = img.st_dev;
+		hdr->ino   = img.st_ino;
+		hdr->size  = img.st_size;
+		hdr->mtime = img.st_mtime;
+		hdr->slots = slots;
+		hdr->magic = BLOCK_CACHE_SHM_MAGIC;
+	}
+	hdr->users++;
+
+	flock(shm->fd, LOCK_UN);
+
+	DPRINTF("%s: attached to shared cache %s (%u pages, %u users)\n",
+		cache->name, shm->name, hdr->slots, hdr->users);
+
+	cache->shm = shm;
+	return 0;
+
+fail_unlock:
+	flock(shm->fd, LOCK_UN);
+fail:
+	if (shm->base)
+		munmap(shm->base, shm->size);
+	if (shm->fd != -1)
+		close(shm->fd);
+	free(shm->name);
+	free(shm);
+	return err;
+}
+
+static inline block_cache_shm_slot_t *
+block_cache_shm_set(block_cache_shm_t *shm, uint64_t page)
+{
+	uint64_t hash = page * 0x9e3779b97f4a7c15ULL;
+
+	return shm->slots + (hash >> 32) % shm->sets * BLOCK_CACHE_SHM_WAYS;
+}
+
+static inline char *
+block_cache_shm_page(block_cache_shm_t *shm, block_cache_shm_slot_t *slot)
+{
+	return shm->data + (size_t)(slot - shm->slots) * RADIX_TREE_PAGE_SIZE;
+}
+
+/*
+ * Readers never lock: a slot is copied out and the copy is discarded
+ * if a writer got in between (seqlock).
+ */
+static int
+block_cache_shm_read_page(block_cache_shm_t *shm, uint64_t page,
+			  uint32_t mask, int first, char *buf)
+{
+	int i;
+	uint32_t seq;
+	block_cache_shm_slot_t *set, *slot;
+
+	set = block_cache_shm_set(shm, page);
+
+	for (i = 0; i < BLOCK_CACHE_SHM_WAYS; i++) {
+		slot = set + i;
+
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		if (__atomic_load_n(&slot->page, __ATOMIC_RELAXED) != page + 1)
+			continue;
+
+		if ((__atomic_load_n(&slot->valid, __ATOMIC_RELAXED) & mask) !=
+		    mask)
+			return -ENOENT;
+
+		memcpy(buf, block_cache_shm_page(shm, slot) +
+		       (first << RADIX_TREE_NODE_SHIFT),
+		       __builtin_popcount(mask) << RADIX_TREE_NODE_SHIFT);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+			return -EAGAIN;
+
+		__atomic_store_n(&slot->ref, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+static block_cache_shm_slot_t *
+block_cache_shm_victim(block_cache_shm_t *shm, block_cache_shm_slot_t *set,
+		       uint64_t page)
+{
+	int i, n;
+	block_cache_shm_slot_t *slot;
+
+	for (i = 0; i < BLOCK_CACHE_SHM_WAYS; i++) {
+		slot = set + i;
+		if (__atomic_load_n(&slot->page, __ATOMIC_RELAXED) == page + 1)
+			return slot;
+	}
+
+	for (i = 0; i < BLOCK_CACHE_SHM_WAYS; i++) {
+		slot = set + i;
+		if (!__atomic_load_n(&slot->page, __ATOMIC_RELAXED))
+			return slot;
+	}
+
+	/* second chance, starting where the last eviction left off */
+	for (n = 0; n < 2 * BLOCK_CACHE_SHM_WAYS; n++) {
+		slot = set + (shm->hand++ % BLOCK_CACHE_SHM_WAYS);
+		if (!__atomic_exchange_n(&slot->ref, 0, __ATOMIC_RELAXED))
+			return slot;
+	}
+
+	return slot;
+}
+
+static void
+block_cache_shm_write_page(block_cache_shm_t *shm, uint64_t page,
+			   uint32_t mask, int first, const char *buf)
+{
+	uint32_t seq;
+	block_cache_shm_slot_t *slot;
+
+	slot = block_cache_shm_victim(shm, block_cache_shm_set(shm, page),
+				      page);
+
+	seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	if (seq & 1)
+		return;
+
+	/* another tapdisk is filling this slot; it is only a cache */
+	if (!__atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, 0,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+
+	if (slot->page != page + 1) {
+		if (slot->page)
+			__atomic_fetch_add(&shm->hdr->evictions, 1,
+					   __ATOMIC_RELAXED);
+		slot->page  = page + 1;
+		slot->valid = 0;
+	}
+
+	memcpy(block_cache_shm_page(shm, slot) +
+	       (first << RADIX_TREE_NODE_SHIFT), buf,
+	       __builtin_popcount(mask) << RADIX_TREE_NODE_SHIFT);
+
+	slot->valid |= mask;
+	slot->ref    = 1;
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t
+block_cache_shm_mask(int first, int secs)
+{
+	return ((1U << secs) - 1) << first;
+}
+
+static int
+block_cache_shm_read(block_cache_t *cache, td_request_t treq)
+{
+	int first, n, err;
+	uint64_t sec, end;
+	char *buf;
+
+	sec = treq.sec;
+	end = treq.sec + treq.secs;
+	buf = treq.buf;
+
+	while (sec < end) {
+		first = sec % BLOCK_CACHE_SECS_PER_PAGE;
+		n     = BLOCK_CACHE_SECS_PER_PAGE - first;
+		if (n > end - sec)
+			n = end - sec;
+
+		err = block_cache_shm_read_page(cache->shm,
+						sec / BLOCK_CACHE_SECS_PER_PAGE,
+						block_cache_shm_mask(first, n),
+						first, buf);
+		if (err) {
+			__atomic_fetch_add(&cache->shm->hdr->misses, 1,
+					   __ATOMIC_RELAXED);
+			return err;
+		}
+
+		sec += n;
+		buf += n << RADIX_TREE_NODE_SHIFT;
+	}
+
+	__atomic_fetch_add(&cache->shm->hdr->hits, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void
+block_cache_shm_populate(block_cache_t *cache, const char *buf,
+			 uint64_t sec, int secs)
+{
+	int first, n;
+	uint64_t end = sec + secs;
+
+	while (sec < end) {
+		first = sec % BLOCK_CACHE_SECS_PER_PAGE;
+		n     = BLOCK_CACHE_SECS_PER_PAGE - first;
+		if (n > end - sec)
+			n = end - sec;
+
+		block_cache_shm_write_page(cache->shm,
+					   sec / BLOCK_CACHE_SECS_PER_PAGE,
+					   block_cache_shm_mask(first, n),
+					   first, buf);
+
+		sec += n;
+		buf += n << RADIX_TREE_NODE_SHIFT;
+	}
+}
+
 static void
 block_cache_prune_event(event_id_t id, char mode, void *private)
 {
@@ -543,6 +993,12 @@ block_cache_open(td_driver_t *driver, const char *name, td_flag_t flags)
 
 	tree->cache = cache;
 	cache->requests_free = BLOCK_CACHE_REQUESTS;
+
+	err = block_cache_shm_attach(cache);
+	if (err)
+		DPRINTF("%s: no shared cache, using a private one: %d\n",
+			cache->name, err);
+
 	for (i = 0; i < BLOCK_CACHE_REQUESTS; i++)
 		cache->request_free_list[i] = cache->requests + i;
 
@@ -551,8 +1007,10 @@ block_cache_open(td_driver_t *driver, const char *name, td_flag_t flags)
 							  BLOCK_CACHE_PAGE_IDLETIME << 1,
 							  block_cache_prune_event,
 							  cache);
-	if (cache->timeout_id < 0)
+	if (cache->timeout_id < 0) {
+		err = cache->timeout_id;
 		goto fail;
+	}
 
 	DPRINTF("opening cache for %s, sectors: %"PRIu64", "
 		"tree: %p, height: %d\n",
@@ -564,6 +1022,7 @@ block_cache_open(td_driver_t *driver, const char *name, td_flag_t flags)
 	return 0;
 
 fail:
+	block_cache_shm_detach(cache);
 	free(cache->name);
 	radix_tree_free(&cache->tree);
 	return err;
@@ -581,6 +1040,7 @@ block_cache_close(td_driver_t *driver)
 	DPRINTF("closing cache for %s\n", cache->name);
 
 	tapdisk_server_unregister_event(cache->timeout_id);
+	block_cache_shm_detach(cache);
 	radix_tree_free(tree);
 	free(cache->name);
 
@@ -654,8 +1114,12 @@ block_cache_populate_cache(td_request_t clone, int err)
 		       breq->buf + off, RADIX_TREE_NODE_SIZE);
 	}
 
-	if (radix_tree_add_leaves(tree, breq->buf,
-				  breq->treq.sec, breq->treq.secs))
+	if (cache->shm) {
+		block_cache_shm_populate(cache, breq->buf,
+					 breq->treq.sec, breq->treq.secs);
+		free(breq->buf);
+	} else if (radix_tree_add_leaves(tree, breq->buf,
+					 breq->treq.sec, breq->treq.secs))
 		free(breq->buf);
 
 out:
@@ -680,7 +1144,8 @@ block_cache_miss(block_cache_t *cache, td_request_t treq)
 
 	cache->stats.misses += treq.secs;
 
-	if (radix_tree_size(tree) + size >= BLOCK_CACHE_MAX_SIZE)
+	if (!cache->shm &&
+	    radix_tree_size(tree) + size >= BLOCK_CACHE_MAX_SIZE)
 		goto out;
 
 	breq = block_cache_get_request(cache);
@@ -719,6 +1184,14 @@ block_cache_queue_read(td_driver_t *driver, td_request_t treq)
 
 	cache->stats.reads += treq.secs;
 
+	if (cache->shm) {
+		if (block_cache_shm_read(cache, treq))
+			return block_cache_miss(cache, treq);
+
+		cache->stats.hits += treq.secs;
+		return td_complete_request(treq, 0);
+	}
+
 	if (treq.secs > BLOCK_CACHE_NODES_PER_PAGE)
 		return td_forward_request(treq);
 
@@ -771,6 +1244,15 @@ block_cache_debug(td_driver_t *driver)
 	WARN("BLOCK CACHE %s\n", cache->name);
 	WARN("reads: %"PRIu64", hits: %"PRIu64", misses: %"PRIu64", prunes: %"PRIu64"\n",
 	     stats->reads, stats->hits, stats->misses, stats->prunes);
+
+	if (cache->shm) {
+		block_cache_shm_header_t *hdr = cache->shm->hdr;
+
+		WARN("shared %s: pages: %u, users: %u, hits: %"PRIu64", "
+		     "misses: %"PRIu64", evictions: %"PRIu64"\n",
+		     cache->shm->name, hdr->slots, hdr->users,
+		     hdr->hits, hdr->misses, hdr->evictions);
+	}
 }
 
 struct tap_disk tapdisk_block_cache = {
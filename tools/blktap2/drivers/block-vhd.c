@@ -110,6 +110,8 @@ unsigned int SPB;
 
 /******VHD DEFINES******/
 #define VHD_CACHE_SIZE               32
+#define VHD_CACHE_SIZE_MAX           65536
+#define VHD_CACHE_SIZE_ENV           "TAPDISK_VHD_BITMAP_CACHE"
 
 #define VHD_REQS_DATA                TAPDISK_DATA_REQUESTS
 #define VHD_REQS_META                (VHD_CACHE_SIZE + 2)
@@ -197,6 +199,7 @@ struct vhd_bitmap {
 	u32                       blk;
 	u64                       seqno;       /* lru sequence number */
 	vhd_flag_t                status;
+	struct vhd_bitmap        *hnext;       /* bitmap hash chain */
 
 	char                     *map;         /* map should only be modified
 					        * in finish_bitmap_write */
@@ -229,11 +232,17 @@ struct vhd_state {
 
 	u64                       bm_lru;      /* lru sequence number */
 	u32                       bm_secs;     /* size of bitmap, in sectors */
-	struct vhd_bitmap        *bitmap[VHD_CACHE_SIZE];
+	uint8_t                  *bm_full;     /* blocks known to be fully
+						* allocated, batmap or not */
+
+	int                       bm_cache_size;
+	u32                       bm_hash_mask;
+	struct vhd_bitmap       **bm_hash;     /* cached bitmaps, by block */
+	struct vhd_bitmap       **bitmap;      /* cached bitmaps, lru slots */
 
 	int                       bm_free_count;
-	struct vhd_bitmap        *bitmap_free[VHD_CACHE_SIZE];
-	struct vhd_bitmap         bitmap_list[VHD_CACHE_SIZE];
+	struct vhd_bitmap       **bitmap_free;
+	struct vhd_bitmap        *bitmap_list;
 
 	int                       vreq_free_count;
 	struct vhd_request       *vreq_free[VHD_REQS_DATA];
@@ -329,6 +338,27 @@ test_batmap(struct vhd_state *s, uint32_t blk)
 	return vhd_batmap_test(&s->vhd, &s->bat.batmap, blk);
 }
 
+/*
+ * Blocks never become less allocated, so once a bitmap has been seen
+ * full the block can be served without its bitmap from then on. This
+ * covers images without a batmap, and parents which we never write.
+ */
+static inline void
+set_block_full(struct vhd_state *s, uint32_t blk)
+{
+	if (s->bm_full && blk < s->bat.bat.entries)
+		s->bm_full[blk >> 3] |= (1 << (blk & 7));
+}
+
+static inline int
+test_block_full(struct vhd_state *s, uint32_t blk)
+{
+	if (s->bm_full && blk < s->bat.bat.entries &&
+	    (s->bm_full[blk >> 3] & (1 << (blk & 7))))
+		return 1;
+	return test_batmap(s, blk);
+}
+
 static int
 vhd_kill_footer(struct vhd_state *s)
 {
@@ -393,6 +423,9 @@ vhd_free_bat(struct vhd_state *s)
 	free(s->bat.batmap.map);
 	free(s->bat.bat_buf);
 	memset(&s->bat, 0, sizeof(struct vhd_bat));
+
+	free(s->bm_full);
+	s->bm_full = NULL;
 }
 
 static int
@@ -443,6 +476,12 @@ vhd_initialize_bat(struct vhd_state *s)
 		goto fail;
 	}
 
+	s->bm_full = calloc((s->bat.bat.entries + 7) >> 3, 1);
+	if (!s->bm_full) {
+		err = -ENOMEM;
+		goto fail;
+	}
+
 	return 0;
 
 fail:
@@ -456,29 +495,81 @@ vhd_free_bitmap_cache(struct vhd_state *s)
 	int i;
 	struct vhd_bitmap *bm;
 
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
-		bm = s->bitmap_list + i;
-		free(bm->map);
-		free(bm->shadow);
-		s->bitmap_free[i] = NULL;
+	if (s->bitmap_list)
+		for (i = 0; i < s->bm_cache_size; i++) {
+			bm = s->bitmap_list + i;
+			free(bm->map);
+			free(bm->shadow);
+		}
+
+	free(s->bitmap_list);
+	free(s->bitmap_free);
+	free(s->bitmap);
+	free(s->bm_hash);
+
+	s->bitmap_list   = NULL;
+	s->bitmap_free   = NULL;
+	s->bitmap        = NULL;
+	s->bm_hash       = NULL;
+	s->bm_free_count = 0;
+	s->bm_cache_size = 0;
+}
+
+/*
+ * The default cache covers 64MB of a disk with 2MB blocks. Large thin
+ * images with deep chains want more; the size can be raised per
+ * tapdisk through the environment.
+ */
+static int
+vhd_bitmap_cache_size(void)
+{
+	long n;
+	char *env, *end;
+
+	env = getenv(VHD_CACHE_SIZE_ENV);
+	if (!env)
+		return VHD_CACHE_SIZE;
+
+	n = strtol(env, &end, 0);
+	if (*env == '\0' || *end != '\0' || n < VHD_CACHE_SIZE) {
+		EPRINTF("ignoring %s=%s\n", VHD_CACHE_SIZE_ENV, env);
+		return VHD_CACHE_SIZE;
 	}
 
-	memset(s->bitmap_list, 0, sizeof(struct vhd_bitmap) * VHD_CACHE_SIZE);
+	return MIN(n, VHD_CACHE_SIZE_MAX);
 }
 
 static int
 vhd_initialize_bitmap_cache(struct vhd_state *s)
 {
-	int i, err, map_size;
+	int i, err, map_size, size;
+	u32 hash_size;
 	struct vhd_bitmap *bm;
 
-	memset(s->bitmap_list, 0, sizeof(struct vhd_bitmap) * VHD_CACHE_SIZE);
+	size = vhd_bitmap_cache_size();
+
+	hash_size = 1;
+	while (hash_size < size)
+		hash_size <<= 1;
+
+	s->bitmap_list = calloc(size, sizeof(struct vhd_bitmap));
+	s->bitmap_free = calloc(size, sizeof(struct vhd_bitmap *));
+	s->bitmap      = calloc(size, sizeof(struct vhd_bitmap *));
+	s->bm_hash     = calloc(hash_size, sizeof(struct vhd_bitmap *));
+	s->bm_cache_size = size;
+	s->bm_hash_mask  = hash_size - 1;
+
+	if (!s->bitmap_list || !s->bitmap_free ||
+	    !s->bitmap || !s->bm_hash) {
+		err = -ENOMEM;
+		goto fail;
+	}
 
 	s->bm_lru        = 0;
 	map_size         = vhd_sectors_to_bytes(s->bm_secs);
-	s->bm_free_count = VHD_CACHE_SIZE;
+	s->bm_free_count = size;
 
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+	for (i = 0; i < size; i++) {
 		bm = s->bitmap_list + i;
 
 		err = posix_memalign((void **)&bm->map, 512, map_size);
@@ -968,17 +1059,46 @@ init_vhd_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
 	init_vhd_request(s, &bm->req);
 }
 
+static inline struct vhd_bitmap **
+bitmap_hash_slot(struct vhd_state *s, uint32_t block)
+{
+	return &s->bm_hash[block & s->bm_hash_mask];
+}
+
+static inline void
+hash_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
+{
+	struct vhd_bitmap **slot = bitmap_hash_slot(s, bm->blk);
+
+	bm->hnext = *slot;
+	*slot     = bm;
+}
+
+static inline void
+unhash_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
+{
+	struct vhd_bitmap **pp;
+
+	for (pp = bitmap_hash_slot(s, bm->blk); *pp; pp = &(*pp)->hnext)
+		if (*pp == bm) {
+			*pp = bm->hnext;
+			break;
+		}
+
+	bm->hnext = NULL;
+}
+
 static inline struct vhd_bitmap *
 get_bitmap(struct vhd_state *s, uint32_t block)
 {
-	int i;
 	struct vhd_bitmap *bm;
 
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
-		bm = s->bitmap[i];
-		if (bm && bm->blk == block)
+	if (!s->bm_hash)
+		return NULL;
+
+	for (bm = *bitmap_hash_slot(s, block); bm; bm = bm->hnext)
+		if (bm->blk == block)
 			return bm;
-	}
 
 	return NULL;
 }
@@ -1037,7 +1157,7 @@ remove_lru_bitmap(struct vhd_state *s)
 	u64 seq = s->bm_lru;
 	struct vhd_bitmap *bm, *lru = NULL;
 
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+	for (i = 0; i < s->bm_cache_size; i++) {
 		bm = s->bitmap[i];
 		if (bm && bm->seqno < seq && !bitmap_locked(bm)) {
 			idx = i;
@@ -1048,6 +1168,7 @@ remove_lru_bitmap(struct vhd_state *s)
 
 	if (lru) {
 		s->bitmap[idx] = NULL;
+		unhash_bitmap(s, lru);
 		ASSERT(!bitmap_in_use(lru));
 	}
 
@@ -1084,7 +1205,7 @@ __bitmap_lru_seqno(struct vhd_state *s)
 
 	if (s->bm_lru == 0xffffffff) {
 		s->bm_lru = 0;
-		for (i = 0; i < VHD_CACHE_SIZE; i++) {
+		for (i = 0; i < s->bm_cache_size; i++) {
 			bm = s->bitmap[i];
 			if (bm) {
 				bm->seqno >>= 1;
@@ -1107,10 +1228,11 @@ static inline void
 install_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
 {
 	int i;
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+	for (i = 0; i < s->bm_cache_size; i++) {
 		if (!s->bitmap[i]) {
 			touch_bitmap(s, bm);
 			s->bitmap[i] = bm;
+			hash_bitmap(s, bm);
 			return;
 		}
 	}
@@ -1123,15 +1245,16 @@ free_vhd_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
 {
 	int i;
 
-	for (i = 0; i < VHD_CACHE_SIZE; i++)
+	for (i = 0; i < s->bm_cache_size; i++)
 		if (s->bitmap[i] == bm)
 			break;
 
 	ASSERT(!bitmap_locked(bm));
 	ASSERT(!bitmap_in_use(bm));
-	ASSERT(i < VHD_CACHE_SIZE);
+	ASSERT(i < s->bm_cache_size);
 
 	s->bitmap[i] = NULL;
+	unhash_bitmap(s, bm);
 	s->bitmap_free[s->bm_free_count++] = bm;
 }
 
@@ -1162,8 +1285,8 @@ read_bitmap_cache(struct vhd_state *s, uint64_t sector, uint8_t op)
 		return VHD_BM_BAT_CLEAR;
 	}
 
-	if (test_batmap(s, blk)) {
-		DBG(TLOG_DBG, "batmap set for 0x%04x\n", blk);
+	if (test_block_full(s, blk)) {
+		DBG(TLOG_DBG, "block 0x%04x full\n", blk);
 		return VHD_BM_BIT_SET;
 	}
 
@@ -1196,7 +1319,7 @@ read_bitmap_cache_span(struct vhd_state *s,
 	sec = sector % s->spb;
 	blk = sector / s->spb;
 
-	if (test_batmap(s, blk))
+	if (test_block_full(s, blk))
 		return MIN(nr_secs, s->spb - sec);
 
 	bm  = get_bitmap(s, blk);
@@ -1461,7 +1584,7 @@ schedule_data_read(struct vhd_state *s, td_request_t treq, vhd_flag_t flags)
 	offset = bat_entry(s, blk);
 
 	ASSERT(offset != DD_BLK_UNUSED);
-	ASSERT(test_batmap(s, blk) || (bm && bitmap_valid(bm)));
+	ASSERT(test_block_full(s, blk) || (bm && bitmap_valid(bm)));
 
 	offset += s->bm_secs + sec;
 	offset  = vhd_sectors_to_bytes(offset);
@@ -1953,8 +2076,10 @@ finish_bitmap_transaction(struct vhd_state *s,
 	} else {
 		/* complete atomic write */
 		memcpy(bm->map, bm->shadow, map_size);
-		if (!test_batmap(s, bm->blk) && bitmap_full(s, bm))
+		if (!test_batmap(s, bm->blk) && bitmap_full(s, bm)) {
 			set_batmap(s, bm->blk);
+			set_block_full(s, bm->blk);
+		}
 	}
 
 	/* transaction done; signal completions */
@@ -2081,6 +2206,8 @@ finish_bitmap_read(struct vhd_request *req)
 
 	if (!req->error) {
 		memcpy(bm->shadow, bm->map, vhd_sectors_to_bytes(s->bm_secs));
+		if (bitmap_full(s, bm))
+			set_block_full(s, blk);
 
 		while (r) {
 			struct vhd_request tmp;
@@ -2261,8 +2388,8 @@ vhd_debug(td_driver_t *driver)
 			    t->sec, r->flags, r, r->next, r->tx);
 	}
 
-	DBG(TLOG_WARN, "BITMAP CACHE:\n");
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+	DBG(TLOG_WARN, "BITMAP CACHE: (%d entries)\n", s->bm_cache_size);
+	for (i = 0; i < s->bm_cache_size; i++) {
 		int qnum = 0, wnum = 0, rnum = 0;
 		struct vhd_bitmap *bm = s->bitmap[i];
 		struct vhd_transaction *tx;
@@ -2308,6 +2435,33 @@ vhd_debug(td_driver_t *driver)
 */
 }
 
+static int
+vhd_get_allocated(td_driver_t *driver, uint32_t secs,
+		  uint8_t *map, uint64_t count)
+{
+	u32 blk;
+	uint64_t n, last;
+	struct vhd_state *s = (struct vhd_state *)driver->data;
+
+	if (!s->bat.bat.bat)
+		return -ENOSYS;
+
+	for (blk = 0; blk < s->bat.bat.entries; blk++) {
+		if (bat_entry(s, blk) == DD_BLK_UNUSED)
+			continue;
+
+		n    = ((uint64_t)blk * s->spb) / secs;
+		last = ((uint64_t)(blk + 1) * s->spb - 1) / secs;
+		if (last >= count)
+			last = count - 1;
+
+		for (; n <= last; n++)
+			map[n >> 3] |= 1 << (n & 7);
+	}
+
+	return 0;
+}
+
 struct tap_disk tapdisk_vhd = {
 	.disk_type          = "tapdisk_vhd",
 	.flags              = 0,
@@ -2319,4 +2473,5 @@ struct tap_disk tapdisk_vhd = {
 	.td_get_parent_id   = vhd_get_parent_id,
 	.td_validate_parent = vhd_validate_parent,
 	.td_debug           = vhd_debug,
+	.td_get_allocated   = vhd_get_allocated,
 };
@@ -61,6 +61,9 @@ opio_free(struct opioctx *ctx)
 
 	free(ctx->event_queue);
 	ctx->event_queue = NULL;
+
+	free(ctx->iovecs);
+	ctx->iovecs = NULL;
 }
 
 int
@@ -76,9 +79,11 @@ opio_init(struct opioctx *ctx, int num_iocbs)
 	ctx->free_opios    = calloc(1, sizeof(struct opio *) * num_iocbs);
 	ctx->iocb_queue    = calloc(1, sizeof(struct iocb *) * num_iocbs);
 	ctx->event_queue   = calloc(1, sizeof(struct io_event) * num_iocbs);
+	ctx->iovecs        = calloc(1, sizeof(struct iovec) *
+				    num_iocbs * OPIO_MAX_IOVS);
 
 	if (!ctx->opios || !ctx->free_opios ||
-	    !ctx->iocb_queue || !ctx->event_queue)
+	    !ctx->iocb_queue || !ctx->event_queue || !ctx->iovecs)
 		goto fail;
 
 	for (i = 0; i < num_iocbs; i++)
@@ -111,9 +116,10 @@ restore_iocb(struct opio *op)
 {
 	struct iocb *io = op->iocb;
 
-	io->data        = op->data;
-	io->u.c.buf     = op->buf;
-	io->u.c.nbytes  = op->nbytes;
+	io->data           = op->data;
+	io->aio_lio_opcode = op->opcode;
+	io->u.c.buf        = op->buf;
+	io->u.c.nbytes     = op->nbytes;
 }
 
 static inline int
@@ -142,8 +148,20 @@ static inline int
 contiguous_iocbs(struct iocb *l, struct iocb *r)
 {
 	return ((l->aio_fildes == r->aio_fildes) &&
-		contiguous_sectors(l, r) &&
-		contiguous_buffers(l, r));
+		contiguous_sectors(l, r));
+}
+
+static inline int
+mergeable_opcode(struct iocb *io)
+{
+	return (io->aio_lio_opcode == IO_CMD_PREAD ||
+		io->aio_lio_opcode == IO_CMD_PWRITE);
+}
+
+static inline struct iovec *
+opio_iovecs(struct opioctx *ctx, struct opio *op)
+{
+	return ctx->iovecs + (op - ctx->opios) * OPIO_MAX_IOVS;
 }
 
 static inline void
@@ -165,6 +183,8 @@ opio_iocb_init(struct opioctx *ctx, struct iocb *io)
 	op->nbytes = io->u.c.nbytes;
 	op->offset = io->u.c.offset;
 	op->data   = io->data;
+	op->opcode = io->aio_lio_opcode;
+	op->iovcnt = 1;
 	op->iocb   = io;
 	io->data   = op;
 
@@ -173,6 +193,16 @@ opio_iocb_init(struct opioctx *ctx, struct iocb *io)
 	return op;
 }
 
+/* the last iocb merged into head; its buffer is where the next one
+ * has to start for the merge to stay a plain (non-vectored) iocb */
+static inline struct iocb *
+tail_iocb(struct opioctx *ctx, struct iocb *head)
+{
+	if (!iocb_optimized(ctx, head))
+		return head;
+	return ((struct opio *)head->data)->list.tail->iocb;
+}
+
 static inline struct opio *
 opio_get(struct opioctx *ctx, struct iocb *io)
 {
@@ -186,15 +216,22 @@ static int
 merge_tail(struct opioctx *ctx, struct iocb *head, struct iocb *io)
 {
 	struct opio *ophead, *opio;
+	int vector;
+
+	vector = !contiguous_buffers(tail_iocb(ctx, head), io);
 
 	ophead = opio_get(ctx, head);
 	if (!ophead)
 		return -ENOMEM;
 
+	if (vector && ophead->iovcnt >= OPIO_MAX_IOVS)
+		return -EINVAL;
+
 	opio = opio_get(ctx, io);
 	if (!opio)
 		return -ENOMEM;
 
+	ophead->iovcnt   += vector;
 	opio->head        = ophead;
 	head->u.c.nbytes += io->u.c.nbytes;
 	ophead->list.tail = ophead->list.tail->next = opio;
@@ -208,18 +245,83 @@ merge(struct opioctx *ctx, struct iocb *head, struct iocb *io)
 	if (head->aio_lio_opcode != io->aio_lio_opcode)
 		return -EINVAL;
 
+	if (!mergeable_opcode(io))
+		return -EINVAL;
+
 	if (!contiguous_iocbs(head, io))
 		return -EINVAL;
 
 	return merge_tail(ctx, head, io);		
 }
 
+static inline int
+iocb_before(struct iocb *l, struct iocb *r)
+{
+	if (l->aio_fildes != r->aio_fildes)
+		return l->aio_fildes < r->aio_fildes;
+	return l->u.c.offset < r->u.c.offset;
+}
+
+/*
+ * a batch holds requests from every ring serviced in this round;
+ * a stable sort by (fd, offset) lets sequential streams that were
+ * interleaved, or split across ring batches, merge.  the aio layer
+ * gives no ordering guarantees between queued iocbs, so this only
+ * changes the order in which independent requests are issued.
+ */
+static void
+sort_iocbs(struct iocb **q, int num)
+{
+	int i, j;
+	struct iocb *io;
+
+	for (i = 1; i < num; i++) {
+		io = q[i];
+		for (j = i; j > 0 && iocb_before(io, q[j - 1]); j--)
+			q[j] = q[j - 1];
+		q[j] = io;
+	}
+}
+
+/*
+ * turn a head whose buffers are not contiguous into a
+ * preadv/pwritev of its (coalesced) segments
+ */
+static void
+vectorize_iocb(struct opioctx *ctx, struct iocb *io)
+{
+	int cnt;
+	struct opio *ophead, *op;
+	struct iovec *iov;
+
+	ophead = (struct opio *)io->data;
+	iov    = opio_iovecs(ctx, ophead);
+	cnt    = 0;
+
+	for (op = ophead; op; op = op->next) {
+		if (cnt && (char *)iov[cnt - 1].iov_base +
+		    iov[cnt - 1].iov_len == op->buf) {
+			iov[cnt - 1].iov_len += op->nbytes;
+			continue;
+		}
+
+		iov[cnt].iov_base = op->buf;
+		iov[cnt].iov_len  = op->nbytes;
+		cnt++;
+	}
+
+	io->aio_lio_opcode = (ophead->opcode == IO_CMD_PWRITE ?
+			      IO_CMD_PWRITEV : IO_CMD_PREADV);
+	io->u.v.vec        = iov;
+	io->u.v.nr         = cnt;
+	ctx->merge_vectored++;
+}
+
 int
 io_merge(struct opioctx *ctx, struct iocb **queue, int num)
 {
 	int i, on_queue;
 	struct iocb *io, **q;
-	struct opio *ophead;
 	
 	if (!num)
 		return 0;
@@ -227,18 +329,32 @@ io_merge(struct opioctx *ctx, struct iocb **queue, int num)
 	on_queue = 0;
 	q = ctx->iocb_queue;
 	memcpy(q, queue, num * sizeof(struct iocb *));
+	sort_iocbs(q, num);
 
+	queue[0] = q[0];
 	for (i = 1; i < num; i++) {
 		io = q[i];
 		if (merge(ctx, queue[on_queue], io) != 0)
 			queue[++on_queue] = io;
 	}
 
+	on_queue++;
+
+	for (i = 0; i < on_queue; i++) {
+		io = queue[i];
+		if (iocb_optimized(ctx, io) &&
+		    ((struct opio *)io->data)->iovcnt > 1)
+			vectorize_iocb(ctx, io);
+	}
+
+	ctx->merge_in  += num;
+	ctx->merge_out += on_queue;
+
 #if (defined(TEST) || defined(DEBUG))
-	print_merged_iocbs(ctx, queue, on_queue + 1);
+	print_merged_iocbs(ctx, queue, on_queue);
 #endif
 
-	return ++on_queue;
+	return on_queue;
 }
 
 static int
@@ -292,12 +408,17 @@ expand_event(struct opioctx *ctx,
 	struct iocb *io;
 	struct io_event *ep;
 	struct opio *ophead, *op, *next;
+	unsigned long nbytes;
 
 	io     = event->obj;
 	ophead = (struct opio *)io->data;
+
+	for (nbytes = 0, op = ophead; op; op = op->next)
+		nbytes += op->nbytes;
+
 	op     = ophead;
 
-	if (event->res == io->u.c.nbytes)
+	if (event->res == nbytes)
 		err = 0;
 	else if ((int)event->res < 0)
 		err = (int)event->res;
@@ -350,7 +471,8 @@ __print_iocb(struct opioctx *ctx, struct iocb *io, char *prefix)
 {
 	char *type;
 
-	type = (io->aio_lio_opcode == IO_CMD_PREAD ? "read" : "write");
+	type = (io->aio_lio_opcode == IO_CMD_PREAD ||
+		io->aio_lio_opcode == IO_CMD_PREADV ? "read" : "write");
 
 	DBG(ctx, "%soff: %08llx, nbytes: %04lx, buf: %p, type: %s, data: %08lx,"
 	    " optimized: %d\n", prefix, io->u.c.offset, io->u.c.nbytes, 
@@ -30,6 +30,11 @@
 #define __IO_OPTIMIZE_H__
 
 #include <libaio.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* upper bound on discontiguous buffers merged into one vectored iocb */
+#define OPIO_MAX_IOVS      32
 
 struct opio;
 
@@ -43,6 +48,8 @@ struct opio {
 	unsigned long       nbytes;
 	long long           offset;
 	void               *data;
+	short               opcode;
+	int                 iovcnt;
 	struct iocb        *iocb;
 	struct io_event     event;
 	struct opio        *head;
@@ -57,6 +64,13 @@ struct opioctx {
 	struct opio       **free_opios;
 	struct iocb       **iocb_queue;
 	struct io_event    *event_queue;
+	struct iovec       *iovecs;
+
+	/* iocbs handed to io_merge, iocbs it returned,
+	 * and how many of those were vectored */
+	uint64_t            merge_in;
+	uint64_t            merge_out;
+	uint64_t            merge_vectored;
 };
 
 int opio_init(struct opioctx *ctx, int num_iocbs);
@@ -456,6 +456,12 @@ tapdisk_control_open_image(struct tapdisk_control_connection *connection,
 	if (err)
 		goto out;
 
+	if (request->u.params.flags & TAPDISK_MESSAGE_FLAG_GNTCOPY) {
+		err = tapdisk_vbd_enable_gntcopy(vbd, request->u.params.domid);
+		if (err)
+			goto fail_close;
+	}
+
 	err = tapdisk_vbd_get_image_info(vbd, &image);
 	if (err)
 		goto fail_close;
@@ -494,6 +500,7 @@ out:
 
 fail_close:
 	tapdisk_vbd_close_vdi(vbd);
+	tapdisk_vbd_disable_gntcopy(vbd);
 	free(vbd->name);
 	vbd->name = NULL;
 	goto out;
@@ -519,6 +526,7 @@ tapdisk_control_close_image(struct tapdisk_control_connection *connection,
 	}
 
 	tapdisk_vbd_close_vdi(vbd);
+	tapdisk_vbd_disable_gntcopy(vbd);
 
 	/* NB. vbd->name free should probably belong into close_vdi,
 	   but the current blktap1 reopen-stuff likely depends on a
@@ -627,6 +635,165 @@ out:
 	tapdisk_control_close_connection(connection);
 }
 
+static void
+tapdisk_control_stats_vbd(struct tapdisk_control_connection *connection,
+			  tapdisk_message_t *request)
+{
+	int err;
+	td_vbd_t *vbd;
+	struct tqueue *queue;
+	tapdisk_message_t response;
+	tapdisk_message_stats_t *stats;
+
+	memset(&response, 0, sizeof(response));
+
+	response.type = TAPDISK_MESSAGE_STATS_RSP;
+
+	vbd = tapdisk_server_get_vbd(request->cookie);
+	if (!vbd) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	stats = &response.u.stats;
+
+	stats->received        = vbd->received;
+	stats->returned        = vbd->returned;
+	stats->kicked          = vbd->kicked;
+	stats->errors          = vbd->errors;
+	stats->retries         = vbd->retries;
+	stats->secs_pending    = vbd->secs_pending;
+
+	queue = &vbd->queue;
+	if (!queue->size) {
+		queue = tapdisk_server_get_queue();
+		stats->shared = 1;
+	}
+
+	stats->size             = queue->size;
+	stats->tiocbs_pending   = queue->tiocbs_pending;
+	stats->tiocbs_deferred  = queue->tiocbs_deferred;
+	stats->tiocbs_queued    = queue->tiocbs_queued;
+	stats->tiocbs_completed = queue->tiocbs_completed;
+	stats->tiocbs_errors    = queue->tiocbs_errors;
+	stats->deferrals        = queue->deferrals;
+	stats->merge_in         = queue->opioctx.merge_in;
+	stats->merge_out        = queue->opioctx.merge_out;
+	stats->merge_vectored   = queue->opioctx.merge_vectored;
+	stats->holds            = queue->holds;
+
+	err = 0;
+out:
+	if (err) {
+		response.type = TAPDISK_MESSAGE_ERROR;
+		response.u.response.error = -err;
+	}
+	response.cookie = request->cookie;
+	tapdisk_control_write_message(connection->socket, &response, 2);
+	tapdisk_control_close_connection(connection);
+}
+
+static void
+tapdisk_control_mirror_vbd(struct tapdisk_control_connection *connection,
+			   tapdisk_message_t *request)
+{
+	int err;
+	td_vbd_t *vbd;
+	char *params;
+	tapdisk_message_t response;
+
+	memset(&response, 0, sizeof(response));
+
+	response.type = TAPDISK_MESSAGE_MIRROR_RSP;
+	params = NULL;
+
+	vbd = tapdisk_server_get_vbd(request->cookie);
+	if (!vbd || !request->u.params.path[0]) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	params = strndup(request->u.params.path,
+			 sizeof(request->u.params.path));
+	if (!params) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	err = tapdisk_mirror_start(vbd, params);
+
+out:
+	free(params);
+	response.cookie = request->cookie;
+	response.u.response.error = -err;
+	tapdisk_control_write_message(connection->socket, &response, 2);
+	tapdisk_control_close_connection(connection);
+}
+
+static void
+tapdisk_control_mirror_status(struct tapdisk_control_connection *connection,
+			      tapdisk_message_t *request)
+{
+	int err;
+	td_vbd_t *vbd;
+	tapdisk_message_t response;
+
+	memset(&response, 0, sizeof(response));
+
+	response.type = TAPDISK_MESSAGE_MIRROR_STATUS_RSP;
+
+	vbd = tapdisk_server_get_vbd(request->cookie);
+	if (!vbd) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	tapdisk_mirror_status(&vbd->mirror, &response.u.mirror);
+
+	err = 0;
+out:
+	if (err) {
+		response.type = TAPDISK_MESSAGE_ERROR;
+		response.u.response.error = -err;
+	}
+	response.cookie = request->cookie;
+	tapdisk_control_write_message(connection->socket, &response, 2);
+	tapdisk_control_close_connection(connection);
+}
+
+static void
+tapdisk_control_mirror_cancel(struct tapdisk_control_connection *connection,
+			      tapdisk_message_t *request)
+{
+	int err;
+	td_vbd_t *vbd;
+	tapdisk_message_t response;
+
+	memset(&response, 0, sizeof(response));
+
+	response.type = TAPDISK_MESSAGE_MIRROR_CANCEL_RSP;
+
+	vbd = tapdisk_server_get_vbd(request->cookie);
+	if (!vbd) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	if (!tapdisk_mirror_active(&vbd->mirror)) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	tapdisk_mirror_cancel(&vbd->mirror, -ECANCELED);
+
+	err = 0;
+out:
+	response.cookie = request->cookie;
+	response.u.response.error = -err;
+	tapdisk_control_write_message(connection->socket, &response, 2);
+	tapdisk_control_close_connection(connection);
+}
+
 static void
 tapdisk_control_handle_request(event_id_t id, char mode, void *private)
 {
@@ -664,6 +831,14 @@ tapdisk_control_handle_request(event_id_t id, char mode, void *private)
 		return tapdisk_control_resume_vbd(connection, &message);
 	case TAPDISK_MESSAGE_CLOSE:
 		return tapdisk_control_close_image(connection, &message);
+	case TAPDISK_MESSAGE_STATS:
+		return tapdisk_control_stats_vbd(connection, &message);
+	case TAPDISK_MESSAGE_MIRROR:
+		return tapdisk_control_mirror_vbd(connection, &message);
+	case TAPDISK_MESSAGE_MIRROR_STATUS:
+		return tapdisk_control_mirror_status(connection, &message);
+	case TAPDISK_MESSAGE_MIRROR_CANCEL:
+		return tapdisk_control_mirror_cancel(connection, &message);
 	default: {
 		tapdisk_message_t response;
 	fail:
@@ -90,7 +90,10 @@ tapdisk_driver_free(td_driver_t *driver)
 void
 tapdisk_driver_queue_tiocb(td_driver_t *driver, struct tiocb *tiocb)
 {
-	tapdisk_server_queue_tiocb(tiocb);
+	if (driver->queue)
+		tapdisk_queue_tiocb(driver->queue, tiocb);
+	else
+		tapdisk_server_queue_tiocb(tiocb);
 }
 
 void
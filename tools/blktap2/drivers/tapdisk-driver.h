@@ -49,6 +49,9 @@ struct td_driver_handle {
 	void                        *data;
 	const struct tap_disk       *ops;
 
+	/* per-vbd queue for unshared images, NULL for the server queue */
+	struct tqueue               *queue;
+
 	struct list_head             next;
 };
 
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2008, XenSource Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of XenSource Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "tapdisk.h"
+#include "tapdisk-log.h"
+#include "tapdisk-gntcopy.h"
+
+#define DBG(_level, _f, _a...) tlog_write(_level, _f, ##_a)
+#define ERR(_err, _f, _a...) tlog_error(_err, _f, ##_a)
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+#define TD_GNTCOPY_HUGEPAGE_SIZE     (2 << 20)
+
+/*
+ * back the pool with huge pages where the host has them reserved, so
+ * the whole pool sits behind a single TLB entry; otherwise fall back
+ * to ordinary pages.  either way, pin it so io never faults it in.
+ */
+static int
+tapdisk_gntcopy_alloc_pool(td_gntcopy_t *gc, size_t size)
+{
+	void *pool;
+	size_t hsize;
+
+	hsize = (size + TD_GNTCOPY_HUGEPAGE_SIZE - 1) &
+		~((size_t)TD_GNTCOPY_HUGEPAGE_SIZE - 1);
+
+	pool = mmap(NULL, hsize, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (pool != MAP_FAILED) {
+		gc->hugepages = 1;
+		size = hsize;
+	} else {
+		pool = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if (pool == MAP_FAILED)
+			return -errno;
+	}
+
+	if (mlock(pool, size))
+		DBG(TLOG_WARN, "grant copy pool of %zu bytes not locked: %d\n",
+		    size, -errno);
+
+	gc->pool      = pool;
+	gc->pool_size = size;
+
+	return 0;
+}
+
+void
+tapdisk_gntcopy_close(td_gntcopy_t *gc)
+{
+	if (gc->xgt) {
+		xengnttab_close(gc->xgt);
+		gc->xgt = NULL;
+	}
+
+	if (gc->pool) {
+		munmap(gc->pool, gc->pool_size);
+		gc->pool = NULL;
+	}
+
+	free(gc->segs);
+	gc->segs = NULL;
+
+	free(gc->owners);
+	gc->owners = NULL;
+}
+
+int
+tapdisk_gntcopy_open(td_gntcopy_t *gc, uint16_t domid, int nr_reqs)
+{
+	int err;
+
+	memset(gc, 0, sizeof(*gc));
+
+	gc->domid    = domid;
+	gc->nr_reqs  = nr_reqs;
+	gc->max_segs = nr_reqs * BLKIF_MAX_SEGMENTS_PER_REQUEST;
+
+	gc->segs   = calloc(gc->max_segs, sizeof(*gc->segs));
+	gc->owners = calloc(gc->max_segs, sizeof(*gc->owners));
+	if (!gc->segs || !gc->owners) {
+		err = -ENOMEM;
+		goto fail;
+	}
+
+	err = tapdisk_gntcopy_alloc_pool(gc,
+					 (size_t)gc->max_segs * getpagesize());
+	if (err)
+		goto fail;
+
+	gc->xgt = xengnttab_open(NULL, 0);
+	if (!gc->xgt) {
+		err = -errno;
+		goto fail;
+	}
+
+	DBG(TLOG_INFO, "grant copy for domain %u: %zu byte pool%s\n",
+	    domid, gc->pool_size, gc->hugepages ? " (huge pages)" : "");
+
+	return 0;
+
+fail:
+	ERR(err, "grant copy setup for domain %u failed", domid);
+	tapdisk_gntcopy_close(gc);
+	return err;
+}
+
+char *
+tapdisk_gntcopy_page(td_gntcopy_t *gc, int req, int seg)
+{
+	return gc->pool + ((size_t)req * BLKIF_MAX_SEGMENTS_PER_REQUEST + seg) *
+		getpagesize();
+}
+
+/*
+ * queue the segments of @req for the next flush.  the pool page of a
+ * segment is at the same offset the blktap mapping would have used.
+ */
+int
+tapdisk_gntcopy_add(td_gntcopy_t *gc, const blkif_request_t *req,
+		    void *owner, int dir)
+{
+	int i, offset, len;
+	char *page;
+	xengnttab_grant_copy_segment_t *seg;
+
+	if (req->id >= gc->nr_reqs ||
+	    req->nr_segments > BLKIF_MAX_SEGMENTS_PER_REQUEST)
+		return -EINVAL;
+
+	if (gc->nr_segs + req->nr_segments > gc->max_segs)
+		return -EBUSY;
+
+	for (i = 0; i < req->nr_segments; i++) {
+		offset = req->seg[i].first_sect << SECTOR_SHIFT;
+		len    = (req->seg[i].last_sect - req->seg[i].first_sect + 1)
+			<< SECTOR_SHIFT;
+		page   = tapdisk_gntcopy_page(gc, req->id, i) + offset;
+
+		seg = &gc->segs[gc->nr_segs];
+		memset(seg, 0, sizeof(*seg));
+
+		if (dir == TD_GNTCOPY_FROM_GUEST) {
+			seg->source.foreign.ref    = req->seg[i].gref;
+			seg->source.foreign.offset = offset;
+			seg->source.foreign.domid  = gc->domid;
+			seg->dest.virt             = page;
+			seg->flags                 = GNTCOPY_source_gref;
+		} else {
+			seg->source.virt           = page;
+			seg->dest.foreign.ref      = req->seg[i].gref;
+			seg->dest.foreign.offset   = offset;
+			seg->dest.foreign.domid    = gc->domid;
+			seg->flags                 = GNTCOPY_dest_gref;
+		}
+		seg->len = len;
+
+		gc->owners[gc->nr_segs++] = owner;
+	}
+
+	return 0;
+}
+
+/*
+ * issue every queued segment in one copy.  @cb is called once for
+ * each owner with a failed segment; owners are added contiguously,
+ * so runs of the same owner are reported once.
+ */
+int
+tapdisk_gntcopy_flush(td_gntcopy_t *gc, td_gntcopy_cb_t cb)
+{
+	int i, err, nr_segs;
+	void *failed;
+
+	nr_segs = gc->nr_segs;
+	if (!nr_segs)
+		return 0;
+
+	gc->nr_segs = 0;
+	gc->copies++;
+	gc->segments += nr_segs;
+
+	err = xengnttab_grant_copy(gc->xgt, nr_segs, gc->segs);
+	if (err) {
+		err = -errno;
+		ERR(err, "grant copy of %d segments failed", nr_segs);
+	}
+
+	failed = NULL;
+	for (i = 0; i < nr_segs; i++) {
+		if (!err && gc->segs[i].status == GNTST_okay)
+			continue;
+
+		gc->errors++;
+		if (gc->owners[i] == failed)
+			continue;
+
+		failed = gc->owners[i];
+		cb(failed, err ? : -EIO);
+	}
+
+	return err;
+}
+
+void
+tapdisk_gntcopy_debug(td_gntcopy_t *gc)
+{
+	DBG(TLOG_WARN, "gntcopy: domid: %u, pool: %zu%s, copies: %"PRIu64", "
+	    "segments: %"PRIu64", errors: %"PRIu64"\n", gc->domid,
+	    gc->pool_size, gc->hugepages ? " (huge)" : "", gc->copies,
+	    gc->segments, gc->errors);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2008, XenSource Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of XenSource Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _TAPDISK_GNTCOPY_H_
+#define _TAPDISK_GNTCOPY_H_
+
+#include <inttypes.h>
+#include <xengnttab.h>
+#include <xen/io/blkif.h>
+
+/*
+ * Grant copy data path.  Instead of doing io on the pages the blktap
+ * device maps in for each request, a vbd in grant copy mode owns a
+ * pool of buffers, one page per ring segment, and moves data between
+ * guest grants and the pool with GNTTABOP_copy.  Segments are batched
+ * so that each ring pass costs one copy hypercall in each direction.
+ */
+
+#define TD_GNTCOPY_FROM_GUEST        0  /* write request: guest -> pool */
+#define TD_GNTCOPY_TO_GUEST          1  /* read response: pool -> guest */
+
+typedef void (*td_gntcopy_cb_t)     (void *owner, int err);
+
+typedef struct td_gntcopy {
+	xengnttab_handle               *xgt;
+	uint16_t                        domid;
+
+	char                           *pool;
+	size_t                          pool_size;
+	int                             hugepages;
+	int                             nr_reqs;
+
+	int                             nr_segs;
+	int                             max_segs;
+	xengnttab_grant_copy_segment_t *segs;
+	void                          **owners;
+
+	uint64_t                        copies;
+	uint64_t                        segments;
+	uint64_t                        errors;
+} td_gntcopy_t;
+
+#define tapdisk_gntcopy_enabled(gc) ((gc)->xgt != NULL)
+
+int tapdisk_gntcopy_open(td_gntcopy_t *, uint16_t domid, int nr_reqs);
+void tapdisk_gntcopy_close(td_gntcopy_t *);
+char *tapdisk_gntcopy_page(td_gntcopy_t *, int req, int seg);
+int tapdisk_gntcopy_add(td_gntcopy_t *, const blkif_request_t *,
+			void *owner, int dir);
+int tapdisk_gntcopy_flush(td_gntcopy_t *, td_gntcopy_cb_t);
+void tapdisk_gntcopy_debug(td_gntcopy_t *);
+
+#endif
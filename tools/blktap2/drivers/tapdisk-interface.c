@@ -49,6 +49,8 @@ td_load(td_image_t *image)
 	if (!driver)
 		return -EBADF;
 
+	/* shared drivers complete on the server queue */
+	driver->queue = NULL;
 	driver->refcnt++;
 	image->driver = driver;
 	image->info   = driver->info;
@@ -157,6 +159,25 @@ td_validate_parent(td_image_t *image, td_image_t *parent)
 	return driver->ops->td_validate_parent(driver, pdriver, 0);
 }
 
+int
+td_get_allocated(td_image_t *image, uint32_t secs,
+		 uint8_t *map, uint64_t count)
+{
+	td_driver_t *driver;
+
+	driver = image->driver;
+	if (!driver)
+		return -ENODEV;
+
+	if (!td_flag_test(driver->state, TD_DRIVER_OPEN))
+		return -EBADF;
+
+	if (!driver->ops->td_get_allocated)
+		return -ENOSYS;
+
+	return driver->ops->td_get_allocated(driver, secs, map, count);
+}
+
 void
 td_queue_write(td_image_t *image, td_request_t treq)
 {
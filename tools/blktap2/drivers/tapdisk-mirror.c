@@ -0,0 +1,586 @@
+/*
+ * Copyright (c) 2008, XenSource Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of XenSource Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xc_bitops.h"
+#include "tapdisk.h"
+#include "tapdisk-vbd.h"
+#include "tapdisk-log.h"
+#include "tapdisk-image.h"
+#include "tapdisk-driver.h"
+#include "tapdisk-mirror.h"
+#include "tapdisk-disktype.h"
+#include "tapdisk-interface.h"
+
+#define DBG(_level, _f, _a...) tlog_write(_level, _f, ##_a)
+#define ERR(_err, _f, _a...) tlog_error(_err, _f, ##_a)
+
+#define MIN(a, b)                    ((a) < (b) ? (a) : (b))
+
+struct td_mirror_request {
+	td_vbd_request_t             vreq;    /* first: read from the chain */
+	td_vbd_t                    *vbd;
+	uint64_t                     blk;
+	int                          secs;
+	int                          secs_pending;
+	int                          error;
+	char                        *buf;
+	struct list_head             next;
+};
+
+static void
+tapdisk_mirror_close_image(td_mirror_t *m)
+{
+	if (m->image) {
+		td_close(m->image);
+		tapdisk_image_free(m->image);
+		m->image = NULL;
+	}
+}
+
+/*
+ * drop everything but the counters, which stay readable until the next
+ * mirror is started.  only safe with no requests in flight.
+ */
+void
+tapdisk_mirror_release(td_mirror_t *m)
+{
+	int i;
+
+	tapdisk_mirror_close_image(m);
+
+	if (m->requests) {
+		for (i = 0; i < TD_MIRROR_MAX_INFLIGHT; i++)
+			free(m->requests[i].buf);
+		free(m->requests);
+		m->requests = NULL;
+	}
+
+	free(m->dirty_map);
+	m->dirty_map = NULL;
+
+	free(m->copied_map);
+	m->copied_map = NULL;
+
+	free(m->params);
+	m->params = NULL;
+}
+
+static void
+tapdisk_mirror_fail(td_mirror_t *m, int err)
+{
+	if (!tapdisk_mirror_active(m))
+		return;
+
+	ERR(err, "mirror to %s failed", m->params);
+
+	m->state = TAPDISK_MIRROR_FAILED;
+	m->error = err;
+}
+
+void
+tapdisk_mirror_cancel(td_mirror_t *m, int err)
+{
+	tapdisk_mirror_fail(m, err);
+
+	if (!m->inflight)
+		tapdisk_mirror_release(m);
+}
+
+static int
+tapdisk_mirror_open_image(td_mirror_t *m, td_vbd_t *vbd, const char *params)
+{
+	int err, type;
+	const char *path;
+	td_flag_t flags;
+	td_image_t *image, *source, *tmp;
+
+	err = tapdisk_parse_disk_type(params, &path, &type);
+	if (err)
+		return err;
+
+	/* the mirror may not be an image the vbd already has open */
+	tapdisk_vbd_for_each_image(vbd, image, tmp)
+		if (!strcmp(image->name, path))
+			return -EBUSY;
+
+	flags = vbd->flags & ~(TD_OPEN_SHAREABLE | TD_OPEN_RDONLY);
+
+	image = tapdisk_image_allocate(path, type, vbd->storage, flags, vbd);
+	if (!image)
+		return -ENOMEM;
+
+	err = td_open(image);
+	if (err) {
+		tapdisk_image_free(image);
+		return err;
+	}
+
+	m->image = image;
+
+	source = tapdisk_vbd_first_image(vbd);
+	if (image->info.size < source->info.size ||
+	    image->info.sector_size != source->info.sector_size)
+		return -EINVAL;
+
+	if (vbd->queue.size)
+		image->driver->queue = &vbd->queue;
+
+	return 0;
+}
+
+/*
+ * start with every block the chain may hold data in dirty.  a single
+ * image that cannot tell what it has allocated makes all blocks dirty.
+ */
+static int
+tapdisk_mirror_init_maps(td_mirror_t *m, td_vbd_t *vbd)
+{
+	int err;
+	uint64_t blk;
+	td_image_t *image, *tmp;
+
+	m->dirty_map  = bitmap_alloc(m->blocks);
+	m->copied_map = bitmap_alloc(m->blocks);
+	if (!m->dirty_map || !m->copied_map)
+		return -ENOMEM;
+
+	tapdisk_vbd_for_each_image(vbd, image, tmp) {
+		err = td_get_allocated(image, TD_MIRROR_BLOCK_SECS,
+				       m->dirty_map, m->blocks);
+		if (err) {
+			DPRINTF("%s: no allocation map for %s (%d), copying "
+				"all blocks\n", vbd->name, image->name, err);
+			for (blk = 0; blk < m->blocks; blk++)
+				set_bit(blk, m->dirty_map);
+			break;
+		}
+	}
+
+	for (blk = 0; blk < m->blocks; blk++)
+		if (test_bit(blk, m->dirty_map))
+			m->dirty++;
+
+	return 0;
+}
+
+static int
+tapdisk_mirror_init_requests(td_mirror_t *m)
+{
+	int i, err;
+	td_mirror_request_t *mreq;
+
+	m->requests = calloc(TD_MIRROR_MAX_INFLIGHT, sizeof(*m->requests));
+	if (!m->requests)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&m->free_list);
+
+	for (i = 0; i < TD_MIRROR_MAX_INFLIGHT; i++) {
+		mreq = &m->requests[i];
+
+		err = posix_memalign((void **)&mreq->buf, getpagesize(),
+				     TD_MIRROR_BLOCK_SECS << SECTOR_SHIFT);
+		if (err) {
+			mreq->buf = NULL;
+			return -err;
+		}
+
+		list_add_tail(&mreq->next, &m->free_list);
+	}
+
+	return 0;
+}
+
+int
+tapdisk_mirror_start(td_vbd_t *vbd, const char *params)
+{
+	int err;
+	td_mirror_t *m;
+	td_image_t *source;
+
+	m = &vbd->mirror;
+
+	if (tapdisk_mirror_active(m) || tapdisk_mirror_busy(m))
+		return -EBUSY;
+
+	if (list_empty(&vbd->images) ||
+	    !tapdisk_vbd_queue_ready(vbd) ||
+	    td_flag_test(vbd->state, TD_VBD_PAUSED) ||
+	    td_flag_test(vbd->state, TD_VBD_PAUSE_REQUESTED) ||
+	    td_flag_test(vbd->state, TD_VBD_SHUTDOWN_REQUESTED))
+		return -EINVAL;
+
+	tapdisk_mirror_release(m);
+	memset(m, 0, sizeof(*m));
+
+	m->params = strdup(params);
+	if (!m->params) {
+		err = -ENOMEM;
+		goto fail;
+	}
+
+	err = tapdisk_mirror_open_image(m, vbd, params);
+	if (err)
+		goto fail;
+
+	source    = tapdisk_vbd_first_image(vbd);
+	m->blocks = (source->info.size + TD_MIRROR_BLOCK_SECS - 1) >>
+		TD_MIRROR_BLOCK_SHIFT;
+
+	err = tapdisk_mirror_init_maps(m, vbd);
+	if (err)
+		goto fail;
+
+	err = tapdisk_mirror_init_requests(m);
+	if (err)
+		goto fail;
+
+	m->state = TAPDISK_MIRROR_COPY;
+
+	DPRINTF("%s: mirroring to %s, %"PRIu64" of %"PRIu64" blocks "
+		"allocated\n", vbd->name, params, m->dirty, m->blocks);
+
+	return 0;
+
+fail:
+	EPRINTF("%s: mirror to %s: %d\n", vbd->name, params, err);
+	tapdisk_mirror_release(m);
+	return err;
+}
+
+void
+tapdisk_mirror_dirty(td_mirror_t *m, td_sector_t sec, int secs)
+{
+	uint64_t blk, last;
+
+	if (!tapdisk_mirror_active(m) || !secs)
+		return;
+
+	blk  = sec >> TD_MIRROR_BLOCK_SHIFT;
+	last = (sec + secs - 1) >> TD_MIRROR_BLOCK_SHIFT;
+
+	for (; blk <= last && blk < m->blocks; blk++)
+		if (!test_and_set_bit(blk, m->dirty_map))
+			m->dirty++;
+}
+
+static void
+tapdisk_mirror_put_request(td_mirror_t *m, td_mirror_request_t *mreq)
+{
+	list_add(&mreq->next, &m->free_list);
+	m->inflight--;
+}
+
+/*
+ * a failed copy leaves its block dirty.  -EBUSY only means the block
+ * was locked, so it is simply copied again later.
+ */
+static void
+tapdisk_mirror_finish(td_mirror_t *m, td_mirror_request_t *mreq, int err)
+{
+	if (tapdisk_mirror_active(m)) {
+		if (err) {
+			if (!test_and_set_bit(mreq->blk, m->dirty_map))
+				m->dirty++;
+			if (err != -EBUSY)
+				tapdisk_mirror_fail(m, err);
+		} else {
+			set_bit(mreq->blk, m->copied_map);
+			m->copied++;
+		}
+	}
+
+	tapdisk_mirror_put_request(m, mreq);
+}
+
+static void
+tapdisk_mirror_write_done(td_request_t treq, int res)
+{
+	td_mirror_request_t *mreq = treq.private;
+	int err = (res <= 0 ? res : -res);
+
+	mreq->secs_pending -= treq.secs;
+	mreq->error = (mreq->error ? : err);
+
+	if (!mreq->secs_pending)
+		tapdisk_mirror_finish(&mreq->vbd->mirror, mreq, mreq->error);
+}
+
+static void
+tapdisk_mirror_read_done(td_request_t treq, int res)
+{
+	td_vbd_request_t *vreq = treq.private;
+	int err = (res <= 0 ? res : -res);
+
+	vreq->vbd->secs_pending -= treq.secs;
+	vreq->secs_pending      -= treq.secs;
+	vreq->error = (vreq->error ? : err);
+
+	tapdisk_vbd_complete_vbd_request(vreq->vbd, vreq);
+}
+
+static int
+tapdisk_mirror_zero_block(const char *buf, int secs)
+{
+	const uint64_t *p = (const uint64_t *)buf;
+	size_t i, n = (secs << SECTOR_SHIFT) / sizeof(*p);
+
+	for (i = 0; i < n; i++)
+		if (p[i])
+			return 0;
+
+	return 1;
+}
+
+/*
+ * the block is in the buffer: pass it on to the mirror.  zeros need not
+ * be written the first time round, the mirror reads them back anyway.
+ */
+void
+tapdisk_mirror_complete_read(td_vbd_t *vbd, td_vbd_request_t *vreq)
+{
+	td_request_t treq;
+	td_mirror_t *m = &vbd->mirror;
+	td_mirror_request_t *mreq = (td_mirror_request_t *)vreq;
+
+	if (vreq->error || !tapdisk_mirror_active(m)) {
+		tapdisk_mirror_finish(m, mreq, vreq->error);
+		return;
+	}
+
+	if (!test_bit(mreq->blk, m->copied_map) &&
+	    tapdisk_mirror_zero_block(mreq->buf, mreq->secs)) {
+		m->zero++;
+		tapdisk_mirror_finish(m, mreq, 0);
+		return;
+	}
+
+	memset(&treq, 0, sizeof(treq));
+	treq.op      = TD_OP_WRITE;
+	treq.buf     = mreq->buf;
+	treq.sec     = mreq->blk << TD_MIRROR_BLOCK_SHIFT;
+	treq.secs    = mreq->secs;
+	treq.image   = m->image;
+	treq.cb      = tapdisk_mirror_write_done;
+	treq.id      = mreq->blk;
+	treq.private = mreq;
+
+	mreq->secs_pending = mreq->secs;
+	mreq->error        = 0;
+
+	td_queue_write(m->image, treq);
+}
+
+static void
+tapdisk_mirror_issue(td_vbd_t *vbd, td_mirror_request_t *mreq, uint64_t blk)
+{
+	td_request_t treq;
+	td_image_t *image;
+	td_vbd_request_t *vreq;
+	td_mirror_t *m = &vbd->mirror;
+
+	image = tapdisk_vbd_first_image(vbd);
+	vreq  = &mreq->vreq;
+
+	memset(vreq, 0, sizeof(*vreq));
+	INIT_LIST_HEAD(&vreq->next);
+	vreq->vbd    = vbd;
+	vreq->mirror = 1;
+
+	mreq->vbd  = vbd;
+	mreq->blk  = blk;
+	mreq->secs = MIN(TD_MIRROR_BLOCK_SECS,
+			 image->info.size - (blk << TD_MIRROR_BLOCK_SHIFT));
+
+	vreq->req.operation     = BLKIF_OP_READ;
+	vreq->req.sector_number = blk << TD_MIRROR_BLOCK_SHIFT;
+
+	memset(&treq, 0, sizeof(treq));
+	treq.op      = TD_OP_READ;
+	treq.buf     = mreq->buf;
+	treq.sec     = vreq->req.sector_number;
+	treq.secs    = mreq->secs;
+	treq.image   = image;
+	treq.cb      = tapdisk_mirror_read_done;
+	treq.id      = blk;
+	treq.private = vreq;
+
+	list_del_init(&mreq->next);
+	m->inflight++;
+
+	vreq->submitting   = 1;
+	vreq->secs_pending = mreq->secs;
+	vbd->secs_pending += mreq->secs;
+	gettimeofday(&vreq->last_try, NULL);
+
+	td_queue_read(image, treq);
+
+	vreq->submitting--;
+	tapdisk_vbd_complete_vbd_request(vbd, vreq);
+}
+
+static int
+tapdisk_mirror_next_dirty(td_mirror_t *m, uint64_t *blk)
+{
+	uint64_t i, n;
+
+	if (!m->dirty)
+		return 0;
+
+	for (i = 0, n = m->cursor; i < m->blocks; i++, n++) {
+		if (n == m->blocks)
+			n = 0;
+
+		if (!(n & 7) && !m->dirty_map[n >> 3] && n + 8 <= m->blocks) {
+			i += 7;
+			n += 7;
+			continue;
+		}
+
+		if (test_bit(n, m->dirty_map)) {
+			*blk = n;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * move the vbd onto the mirror, exactly as a pause followed by a resume
+ * with the mirror's params would.  if the mirror cannot be opened, go
+ * back to the original chain.
+ */
+static void
+tapdisk_mirror_pivot(td_vbd_t *vbd)
+{
+	int err;
+	char *name, *params;
+	td_mirror_t *m = &vbd->mirror;
+
+	name = strdup(vbd->name);
+	if (!name) {
+		tapdisk_mirror_cancel(m, -ENOMEM);
+		return;
+	}
+
+	params    = m->params;
+	m->params = NULL;
+	m->state  = TAPDISK_MIRROR_DONE;
+	tapdisk_mirror_release(m);
+
+	err = tapdisk_vbd_pause(vbd);
+	if (err)
+		goto out;
+
+	err = tapdisk_vbd_parse_stack(vbd, params);
+	if (!err)
+		err = tapdisk_vbd_resume(vbd, params, -1);
+	if (err) {
+		EPRINTF("%s: opening mirror %s: %d\n", name, params, err);
+		if (!tapdisk_vbd_parse_stack(vbd, name))
+			tapdisk_vbd_resume(vbd, name, -1);
+		goto out;
+	}
+
+	DPRINTF("%s: moved to mirror %s, %"PRIu64" blocks copied, "
+		"%"PRIu64" zero\n", name, params, m->copied, m->zero);
+
+out:
+	if (err) {
+		m->state = TAPDISK_MIRROR_FAILED;
+		m->error = err;
+	}
+	free(params);
+	free(name);
+}
+
+void
+tapdisk_mirror_kick(td_vbd_t *vbd)
+{
+	uint64_t blk;
+	td_mirror_t *m = &vbd->mirror;
+	td_mirror_request_t *mreq;
+
+	if (!tapdisk_mirror_active(m)) {
+		if (!m->inflight)
+			tapdisk_mirror_release(m);
+		return;
+	}
+
+	if (m->state == TAPDISK_MIRROR_COPY &&
+	    m->dirty + m->inflight <= TD_MIRROR_SYNC_BLOCKS) {
+		DPRINTF("%s: mirror %s: %"PRIu64" blocks left, holding vbd\n",
+			vbd->name, m->params, m->dirty + m->inflight);
+		m->state = TAPDISK_MIRROR_SYNC;
+	}
+
+	while (!list_empty(&m->free_list) &&
+	       tapdisk_mirror_active(m) &&
+	       tapdisk_mirror_next_dirty(m, &blk)) {
+		clear_bit(blk, m->dirty_map);
+		m->dirty--;
+		m->cursor = blk + 1;
+
+		mreq = list_entry(m->free_list.next, td_mirror_request_t, next);
+		tapdisk_mirror_issue(vbd, mreq, blk);
+	}
+
+	if (tapdisk_mirror_holding(m) &&
+	    !m->dirty && !m->inflight &&
+	    list_empty(&vbd->pending_requests))
+		tapdisk_mirror_pivot(vbd);
+}
+
+void
+tapdisk_mirror_status(td_mirror_t *m, tapdisk_message_mirror_t *status)
+{
+	memset(status, 0, sizeof(*status));
+
+	status->state      = m->state;
+	status->error      = m->error;
+	status->block_secs = TD_MIRROR_BLOCK_SECS;
+	status->blocks     = m->blocks;
+	status->dirty      = m->dirty;
+	status->inflight   = m->inflight;
+	status->copied     = m->copied;
+	status->zero       = m->zero;
+}
+
+void
+tapdisk_mirror_debug(td_mirror_t *m)
+{
+	DBG(TLOG_WARN, "mirror %s: state: %d, error: %d, blocks: %"PRIu64", "
+	    "dirty: %"PRIu64", inflight: %d, copied: %"PRIu64", "
+	    "zero: %"PRIu64"\n", m->params ? : "(none)", m->state, m->error,
+	    m->blocks, m->dirty, m->inflight, m->copied, m->zero);
+}
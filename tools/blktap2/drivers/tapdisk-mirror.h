@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2008, XenSource Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of XenSource Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _TAPDISK_MIRROR_H_
+#define _TAPDISK_MIRROR_H_
+
+#include <inttypes.h>
+
+#include "list.h"
+#include "tapdisk.h"
+#include "tapdisk-message.h"
+
+/*
+ * Live mirroring of a vbd onto a new image, for storage migration.
+ * The vbd's image chain is copied to the mirror in blocks, several at
+ * a time, while the guest keeps running.  Only blocks the chain has
+ * allocated are copied, and a block is copied again whenever a guest
+ * write to it completes.  Once few enough blocks are left, new guest
+ * requests are held, the rest is copied, and the vbd is reopened on
+ * the mirror.  The mirror must read back zeros wherever it is not
+ * written, e.g. a freshly created sparse vhd of at least the same size.
+ */
+
+#define TD_MIRROR_BLOCK_SHIFT        12   /* 2MB, one vhd block */
+#define TD_MIRROR_BLOCK_SECS         (1 << TD_MIRROR_BLOCK_SHIFT)
+#define TD_MIRROR_MAX_INFLIGHT       16
+#define TD_MIRROR_SYNC_BLOCKS        16   /* left to copy with the vbd held */
+
+struct td_vbd_handle;
+struct td_vbd_request;
+typedef struct td_mirror_request     td_mirror_request_t;
+
+typedef struct td_mirror {
+	int                          state;
+	int                          error;
+
+	char                        *params;
+	td_image_t                  *image;
+
+	uint64_t                     blocks;
+	uint8_t                     *dirty_map;
+	uint8_t                     *copied_map;
+	uint64_t                     cursor;
+
+	int                          inflight;
+	td_mirror_request_t         *requests;
+	struct list_head             free_list;
+
+	uint64_t                     dirty;
+	uint64_t                     copied;
+	uint64_t                     zero;
+} td_mirror_t;
+
+#define tapdisk_mirror_active(m)                                        \
+	((m)->state == TAPDISK_MIRROR_COPY ||				\
+	 (m)->state == TAPDISK_MIRROR_SYNC)
+#define tapdisk_mirror_holding(m)   ((m)->state == TAPDISK_MIRROR_SYNC)
+#define tapdisk_mirror_busy(m)      ((m)->inflight != 0)
+
+int tapdisk_mirror_start(struct td_vbd_handle *, const char *params);
+void tapdisk_mirror_cancel(td_mirror_t *, int err);
+void tapdisk_mirror_release(td_mirror_t *);
+void tapdisk_mirror_kick(struct td_vbd_handle *);
+void tapdisk_mirror_dirty(td_mirror_t *, td_sector_t, int);
+void tapdisk_mirror_complete_read(struct td_vbd_handle *,
+				  struct td_vbd_request *);
+void tapdisk_mirror_status(td_mirror_t *, tapdisk_message_mirror_t *);
+void tapdisk_mirror_debug(td_mirror_t *);
+
+#endif
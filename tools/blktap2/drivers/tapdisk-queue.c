@@ -28,11 +28,18 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <libaio.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
 #ifdef __linux__
 #include <linux/version.h>
 #endif
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
 
 #include "tapdisk.h"
 #include "tapdisk-log.h"
@@ -55,6 +62,25 @@
  */
 #define REQUEST_ASYNC_FD ((io_context_t)1)
 
+/*
+ * adaptive coalescing defaults, overridden by the environment.
+ * only iocbs up to TIO_HOLD_MAX_BYTES count as small.
+ */
+#define TIO_HOLD_USECS_ENV      "TAPDISK_COALESCE_USECS"
+#define TIO_HOLD_DEPTH_ENV      "TAPDISK_COALESCE_DEPTH"
+#define TIO_HOLD_USECS          50
+#define TIO_HOLD_DEPTH          16
+#define TIO_HOLD_MAX_BYTES      (64 << 10)
+
+static inline int
+sequential_iocbs(struct iocb *prev, struct iocb *iocb)
+{
+	return (prev->aio_fildes == iocb->aio_fildes &&
+		prev->aio_lio_opcode == iocb->aio_lio_opcode &&
+		prev->u.c.offset + prev->u.c.nbytes == iocb->u.c.offset &&
+		iocb->u.c.nbytes <= TIO_HOLD_MAX_BYTES);
+}
+
 static inline void
 queue_tiocb(struct tqueue *queue, struct tiocb *tiocb)
 {
@@ -64,8 +90,15 @@ queue_tiocb(struct tqueue *queue, struct tiocb *tiocb)
 		struct tiocb *prev = (struct tiocb *)
 			queue->iocbs[queue->queued - 1]->data;
 		prev->next = tiocb;
+
+		if (queue->hold_usecs)
+			queue->hold_seq = sequential_iocbs(&prev->iocb, iocb);
+	} else if (queue->hold_usecs) {
+		queue->hold_seq = 0;
+		gettimeofday(&queue->hold_start, NULL);
 	}
 
+	tiocb->next = NULL;
 	queue->iocbs[queue->queued++] = iocb;
 }
 
@@ -129,13 +162,17 @@ complete_tiocb(struct tqueue *queue, struct tiocb *tiocb, unsigned long res)
 	else
 		err = -EIO;
 
+	queue->tiocbs_completed++;
+	if (err)
+		queue->tiocbs_errors++;
+
 	tiocb->cb(tiocb->arg, tiocb, err);
 }
 
 static int
 cancel_tiocbs(struct tqueue *queue, int err)
 {
-	int queued;
+	int i, queued;
 	struct tiocb *tiocb;
 
 	if (!queue->queued)
@@ -145,10 +182,15 @@ cancel_tiocbs(struct tqueue *queue, int err)
 	 * td_complete may queue more tiocbs, which
 	 * will overwrite the contents of queue->iocbs.
 	 * use a private linked list to keep track
-	 * of the tiocbs we're cancelling. 
+	 * of the tiocbs we're cancelling.  io_merge
+	 * reorders the queue, so relink it first.
 	 */
-	tiocb  = queue->iocbs[0]->data;
 	queued = queue->queued;
+	for (i = queued - 1, tiocb = NULL; i >= 0; i--) {
+		struct tiocb *prev = queue->iocbs[i]->data;
+		prev->next = tiocb;
+		tiocb      = prev;
+	}
 	queue->queued = 0;
 
 	for (; tiocb != NULL; tiocb = tiocb->next)
@@ -157,6 +199,34 @@ cancel_tiocbs(struct tqueue *queue, int err)
 	return queued;
 }
 
+/*
+ * complete a batch of aio events, which may queue more tiocbs
+ */
+static void
+complete_events(struct tqueue *queue, struct io_event *events, int n)
+{
+	int i, split;
+	struct iocb *iocb;
+	struct tiocb *tiocb;
+	struct io_event *ep;
+
+	split = io_split(&queue->opioctx, events, n);
+	tapdisk_filter_events(queue->filter, events, split);
+
+	DBG("events: %d, tiocbs: %d\n", n, split);
+
+	queue->iocbs_pending  -= n;
+	queue->tiocbs_pending -= split;
+
+	for (i = split, ep = events; i-- > 0; ep++) {
+		iocb  = ep->obj;
+		tiocb = iocb->data;
+		complete_tiocb(queue, tiocb, ep->res);
+	}
+
+	queue_deferred_tiocbs(queue);
+}
+
 static int
 fail_tiocbs(struct tqueue *queue, int succeeded, int total, int err)
 {
@@ -222,6 +292,45 @@ tapdisk_rwio_rw(const struct iocb *iocb)
 	return size;
 }
 
+static ssize_t
+tapdisk_rwio_rwv(const struct iocb *iocb)
+{
+	int fd        = iocb->aio_fildes;
+	struct iovec *iov = (struct iovec *)iocb->u.v.vec;
+	int cnt       = iocb->u.v.nr;
+	long long off = iocb->u.v.offset;
+	ssize_t n, done = 0;
+
+	/* the iovecs are scratch space in the opio context */
+	while (cnt) {
+		if (iocb->aio_lio_opcode == IO_CMD_PWRITEV)
+			n = pwritev(fd, iov, cnt, off);
+		else
+			n = preadv(fd, iov, cnt, off);
+
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -errno;
+		}
+		if (!n)
+			return -EIO;
+
+		done += n;
+		off  += n;
+
+		for (; cnt && (size_t)n >= iov->iov_len; iov++, cnt--)
+			n -= iov->iov_len;
+
+		if (cnt) {
+			iov->iov_base  = (char *)iov->iov_base + n;
+			iov->iov_len  -= n;
+		}
+	}
+
+	return done;
+}
+
 static int
 tapdisk_rwio_submit(struct tqueue *queue)
 {
@@ -243,7 +352,11 @@ tapdisk_rwio_submit(struct tqueue *queue)
 		ep      = rwio->aio_events + i;
 		iocb    = queue->iocbs[i];
 		ep->obj = iocb;
-		ep->res = tapdisk_rwio_rw(iocb);
+		if (iocb->aio_lio_opcode == IO_CMD_PREADV ||
+		    iocb->aio_lio_opcode == IO_CMD_PWRITEV)
+			ep->res = tapdisk_rwio_rwv(iocb);
+		else
+			ep->res = tapdisk_rwio_rw(iocb);
 	}
 
 	split = io_split(&queue->opioctx, rwio->aio_events, merged);
@@ -443,31 +556,15 @@ tapdisk_lio_event(event_id_t id, char mode, void *private)
 {
 	struct tqueue *queue = private;
 	struct lio *lio;
-	int i, ret, split;
-	struct iocb *iocb;
-	struct tiocb *tiocb;
-	struct io_event *ep;
+	int ret;
 
 	tapdisk_lio_ack_event(queue);
 
-	lio   = queue->tio_data;
-	ret   = io_getevents(lio->aio_ctx, 0,
-			     queue->size, lio->aio_events, NULL);
-	split = io_split(&queue->opioctx, lio->aio_events, ret);
-	tapdisk_filter_events(queue->filter, lio->aio_events, split);
+	lio = queue->tio_data;
+	ret = io_getevents(lio->aio_ctx, 0,
+			   queue->size, lio->aio_events, NULL);
 
-	DBG("events: %d, tiocbs: %d\n", ret, split);
-
-	queue->iocbs_pending  -= ret;
-	queue->tiocbs_pending -= split;
-
-	for (i = split, ep = lio->aio_events; i-- > 0; ep++) {
-		iocb  = ep->obj;
-		tiocb = iocb->data;
-		complete_tiocb(queue, tiocb, ep->res);
-	}
-
-	queue_deferred_tiocbs(queue);
+	complete_events(queue, lio->aio_events, ret);
 }
 
 static int
@@ -547,6 +644,395 @@ static const struct tio td_tio_lio = {
 	.tio_submit  = tapdisk_lio_submit,
 };
 
+/*
+ * io_uring
+ *
+ * Each queue run costs one io_uring_enter(2), or none at all if a kernel
+ * thread polls the submission ring (SQPOLL).  Completions are reaped off
+ * the shared completion ring; an eventfd signals them to the scheduler,
+ * like for lio.
+ */
+
+#ifdef __NR_io_uring_setup
+
+struct uring {
+	int                   ring_fd;
+	int                   event_fd;
+	int                   event_id;
+	unsigned              flags;
+
+	void                 *sq_ring;
+	size_t                sq_ring_size;
+	unsigned             *sq_head;
+	unsigned             *sq_tail;
+	unsigned             *sq_mask;
+	unsigned             *sq_flags;
+	unsigned              sq_entries;
+	struct io_uring_sqe  *sqes;
+	size_t                sqes_size;
+	struct iovec         *iovecs;
+
+	void                 *cq_ring;
+	size_t                cq_ring_size;
+	unsigned             *cq_head;
+	unsigned             *cq_tail;
+	unsigned             *cq_mask;
+	struct io_uring_cqe  *cqes;
+
+	struct io_event      *aio_events;
+};
+
+#define URING_PTR(_ring, _off) ((void *)((char *)(_ring) + (_off)))
+
+static inline int
+__io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int
+__io_uring_enter(int fd, unsigned to_submit, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, 0, flags, NULL, 0);
+}
+
+static inline int
+__io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void
+tapdisk_uring_destroy(struct tqueue *queue)
+{
+	struct uring *ur = queue->tio_data;
+
+	if (!ur)
+		return;
+
+	if (ur->event_id >= 0) {
+		tapdisk_server_unregister_event(ur->event_id);
+		ur->event_id = -1;
+	}
+
+	if (ur->sqes) {
+		munmap(ur->sqes, ur->sqes_size);
+		ur->sqes = NULL;
+	}
+
+	if (ur->cq_ring) {
+		if (ur->cq_ring != ur->sq_ring)
+			munmap(ur->cq_ring, ur->cq_ring_size);
+		ur->cq_ring = NULL;
+	}
+
+	if (ur->sq_ring) {
+		munmap(ur->sq_ring, ur->sq_ring_size);
+		ur->sq_ring = NULL;
+	}
+
+	if (ur->ring_fd >= 0) {
+		close(ur->ring_fd);
+		ur->ring_fd = -1;
+	}
+
+	if (ur->event_fd >= 0) {
+		close(ur->event_fd);
+		ur->event_fd = -1;
+	}
+
+	free(ur->iovecs);
+	ur->iovecs = NULL;
+
+	free(ur->aio_events);
+	ur->aio_events = NULL;
+}
+
+static void *
+tapdisk_uring_map(struct uring *ur, size_t size, off_t offset)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, size, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_POPULATE, ur->ring_fd, offset);
+
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static int
+tapdisk_uring_setup_rings(struct tqueue *queue, int qlen, unsigned flags)
+{
+	struct uring *ur = queue->tio_data;
+	struct io_uring_params p;
+	unsigned i;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = flags;
+
+	ur->ring_fd = __io_uring_setup(qlen, &p);
+	if (ur->ring_fd < 0)
+		return -errno;
+
+	ur->flags        = flags;
+	ur->sq_entries   = p.sq_entries;
+	ur->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	ur->sqes_size    = p.sq_entries * sizeof(struct io_uring_sqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cq_ring_size > ur->sq_ring_size)
+			ur->sq_ring_size = ur->cq_ring_size;
+		ur->cq_ring_size = ur->sq_ring_size;
+	}
+#endif
+
+	ur->sq_ring = tapdisk_uring_map(ur, ur->sq_ring_size,
+					IORING_OFF_SQ_RING);
+	if (!ur->sq_ring)
+		return -errno;
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ur->cq_ring = ur->sq_ring;
+	else
+#endif
+		ur->cq_ring = tapdisk_uring_map(ur, ur->cq_ring_size,
+						IORING_OFF_CQ_RING);
+	if (!ur->cq_ring)
+		return -errno;
+
+	ur->sqes = tapdisk_uring_map(ur, ur->sqes_size, IORING_OFF_SQES);
+	if (!ur->sqes)
+		return -errno;
+
+	ur->sq_head  = URING_PTR(ur->sq_ring, p.sq_off.head);
+	ur->sq_tail  = URING_PTR(ur->sq_ring, p.sq_off.tail);
+	ur->sq_mask  = URING_PTR(ur->sq_ring, p.sq_off.ring_mask);
+	ur->sq_flags = URING_PTR(ur->sq_ring, p.sq_off.flags);
+	ur->cq_head  = URING_PTR(ur->cq_ring, p.cq_off.head);
+	ur->cq_tail  = URING_PTR(ur->cq_ring, p.cq_off.tail);
+	ur->cq_mask  = URING_PTR(ur->cq_ring, p.cq_off.ring_mask);
+	ur->cqes     = URING_PTR(ur->cq_ring, p.cq_off.cqes);
+
+	/* slot i of the submission ring always holds sqe i */
+	for (i = 0; i < p.sq_entries; i++)
+		((unsigned *)URING_PTR(ur->sq_ring, p.sq_off.array))[i] = i;
+
+	return 0;
+}
+
+static void
+tapdisk_uring_event(event_id_t id, char mode, void *private)
+{
+	struct tqueue *queue = private;
+	struct uring *ur = queue->tio_data;
+	struct io_uring_cqe *cqe;
+	struct io_event *ep;
+	unsigned head, tail;
+	uint64_t val;
+	int n;
+
+	read_exact(ur->event_fd, &val, sizeof(val));
+
+	do {
+		head = *ur->cq_head;
+		tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+		for (n = 0, ep = ur->aio_events;
+		     head != tail && n < queue->size; head++, n++, ep++) {
+			cqe     = &ur->cqes[head & *ur->cq_mask];
+			ep->obj = (struct iocb *)(unsigned long)cqe->user_data;
+			ep->res = cqe->res;
+		}
+
+		__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+
+		complete_events(queue, ur->aio_events, n);
+	} while (head != tail);
+}
+
+static int
+__tapdisk_uring_setup(struct tqueue *queue, int qlen, unsigned flags)
+{
+	struct uring *ur = queue->tio_data;
+	int err;
+
+	ur->ring_fd  = -1;
+	ur->event_fd = -1;
+	ur->event_id = -1;
+
+	err = tapdisk_uring_setup_rings(queue, qlen, flags);
+	if (err)
+		goto fail;
+
+	ur->iovecs = calloc(ur->sq_entries, sizeof(struct iovec));
+	if (!ur->iovecs) {
+		err = -errno;
+		goto fail;
+	}
+
+	ur->aio_events = calloc(qlen, sizeof(struct io_event));
+	if (!ur->aio_events) {
+		err = -errno;
+		goto fail;
+	}
+
+	ur->event_fd = tapdisk_sys_eventfd(0);
+	if (ur->event_fd < 0) {
+		err = -errno;
+		goto fail;
+	}
+
+	err = __io_uring_register(ur->ring_fd, IORING_REGISTER_EVENTFD,
+				  &ur->event_fd, 1);
+	if (err) {
+		err = -errno;
+		goto fail;
+	}
+
+	ur->event_id =
+		tapdisk_server_register_event(SCHEDULER_POLL_READ_FD,
+					      ur->event_fd, 0,
+					      tapdisk_uring_event,
+					      queue);
+	err = ur->event_id;
+	if (err < 0)
+		goto fail;
+
+	return 0;
+
+fail:
+	tapdisk_uring_destroy(queue);
+	return err;
+}
+
+static int
+tapdisk_uring_setup(struct tqueue *queue, int qlen)
+{
+	return __tapdisk_uring_setup(queue, qlen, 0);
+}
+
+static int
+tapdisk_uring_setup_sqpoll(struct tqueue *queue, int qlen)
+{
+	return __tapdisk_uring_setup(queue, qlen, IORING_SETUP_SQPOLL);
+}
+
+static void
+tapdisk_uring_prep_sqe(struct uring *ur, unsigned idx, struct iocb *iocb)
+{
+	struct io_uring_sqe *sqe = &ur->sqes[idx];
+	struct iovec *iov = &ur->iovecs[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+
+	switch (iocb->aio_lio_opcode) {
+	case IO_CMD_PREADV:
+	case IO_CMD_PWRITEV:
+		/* merged by io_merge; the vector lives in the opio context */
+		sqe->opcode = (iocb->aio_lio_opcode == IO_CMD_PWRITEV ?
+			       IORING_OP_WRITEV : IORING_OP_READV);
+		sqe->addr   = (unsigned long)iocb->u.v.vec;
+		sqe->len    = iocb->u.v.nr;
+		break;
+	default:
+		iov->iov_base = iocb->u.c.buf;
+		iov->iov_len  = iocb->u.c.nbytes;
+
+		sqe->opcode = (iocb->aio_lio_opcode == IO_CMD_PWRITE ?
+			       IORING_OP_WRITEV : IORING_OP_READV);
+		sqe->addr   = (unsigned long)iov;
+		sqe->len    = 1;
+		break;
+	}
+
+	sqe->fd        = iocb->aio_fildes;
+	sqe->off       = iocb->u.c.offset;
+	sqe->user_data = (unsigned long)iocb;
+}
+
+static int
+tapdisk_uring_submit(struct tqueue *queue)
+{
+	struct uring *ur = queue->tio_data;
+	int i, merged, submitted, ret, err = 0;
+	unsigned head, tail;
+
+	if (!queue->queued)
+		return 0;
+
+	tapdisk_filter_iocbs(queue->filter, queue->iocbs, queue->queued);
+	merged = io_merge(&queue->opioctx, queue->iocbs, queue->queued);
+
+	head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+	tail = *ur->sq_tail;
+
+	/* the ring only fills up if the sq thread falls behind */
+	for (i = 0; i < merged && tail - head < ur->sq_entries; i++, tail++)
+		tapdisk_uring_prep_sqe(ur, tail & *ur->sq_mask,
+				       queue->iocbs[i]);
+
+	submitted = i;
+	__atomic_store_n(ur->sq_tail, tail, __ATOMIC_RELEASE);
+
+	if (ur->flags & IORING_SETUP_SQPOLL) {
+		if (__atomic_load_n(ur->sq_flags, __ATOMIC_ACQUIRE) &
+		    IORING_SQ_NEED_WAKEUP)
+			__io_uring_enter(ur->ring_fd, 0,
+					 IORING_ENTER_SQ_WAKEUP);
+	} else if (submitted) {
+		ret = __io_uring_enter(ur->ring_fd, submitted, 0);
+		if (ret < 0) {
+			err = -errno;
+			ret = 0;
+		}
+
+		/* take back what the kernel did not consume */
+		if (ret < submitted) {
+			__atomic_store_n(ur->sq_tail,
+					 tail - (submitted - ret),
+					 __ATOMIC_RELEASE);
+			submitted = ret;
+		}
+	}
+
+	DBG("queued: %d, merged: %d, submitted: %d\n",
+	    queue->queued, merged, submitted);
+
+	if (submitted < merged && !err)
+		err = -EIO;
+
+	queue->iocbs_pending  += submitted;
+	queue->tiocbs_pending += queue->queued;
+	queue->queued          = 0;
+
+	if (err)
+		queue->tiocbs_pending -=
+			fail_tiocbs(queue, submitted, merged, err);
+
+	return submitted;
+}
+
+static const struct tio td_tio_uring = {
+	.name        = "uring",
+	.data_size   = sizeof(struct uring),
+	.tio_setup   = tapdisk_uring_setup,
+	.tio_destroy = tapdisk_uring_destroy,
+	.tio_submit  = tapdisk_uring_submit,
+};
+
+static const struct tio td_tio_uring_sqpoll = {
+	.name        = "uring-sqpoll",
+	.data_size   = sizeof(struct uring),
+	.tio_setup   = tapdisk_uring_setup_sqpoll,
+	.tio_destroy = tapdisk_uring_destroy,
+	.tio_submit  = tapdisk_uring_submit,
+};
+
+#endif /* __NR_io_uring_setup */
+
 static void
 tapdisk_queue_free_io(struct tqueue *queue)
 {
@@ -575,6 +1061,19 @@ tapdisk_queue_init_io(struct tqueue *queue, int drv)
 	case TIO_DRV_RWIO:
 		tio = &td_tio_rwio;
 		break;
+#ifdef __NR_io_uring_setup
+	case TIO_DRV_URING:
+		tio = &td_tio_uring;
+		break;
+	case TIO_DRV_URING_SQPOLL:
+		tio = &td_tio_uring_sqpoll;
+		break;
+#else
+	case TIO_DRV_URING:
+	case TIO_DRV_URING_SQPOLL:
+		err = -ENOSYS;
+		goto fail;
+#endif
 	default:
 		err = -EINVAL;
 		goto fail;
@@ -601,9 +1100,53 @@ tapdisk_queue_init_io(struct tqueue *queue, int drv)
 
 fail:
 	tapdisk_queue_free_io(queue);
+
+	/* io_uring needs a recent kernel, which may not be running */
+	if (drv == TIO_DRV_URING || drv == TIO_DRV_URING_SQPOLL) {
+		DPRINTF("Couldn't set up io_uring (%d), using lio\n", err);
+		return tapdisk_queue_init_io(queue, TIO_DRV_LIO);
+	}
+
 	return err;
 }
 
+int
+tapdisk_queue_driver(const char *name)
+{
+	if (!strcmp(name, "lio"))
+		return TIO_DRV_LIO;
+	if (!strcmp(name, "rwio"))
+		return TIO_DRV_RWIO;
+	if (!strcmp(name, "uring"))
+		return TIO_DRV_URING;
+	if (!strcmp(name, "uring-sqpoll"))
+		return TIO_DRV_URING_SQPOLL;
+
+	return -EINVAL;
+}
+
+static void
+tapdisk_queue_init_hold(struct tqueue *queue)
+{
+	char *env;
+
+	queue->hold_usecs = TIO_HOLD_USECS;
+	queue->hold_depth = TIO_HOLD_DEPTH;
+
+	env = getenv(TIO_HOLD_USECS_ENV);
+	if (env)
+		queue->hold_usecs = strtol(env, NULL, 0);
+
+	env = getenv(TIO_HOLD_DEPTH_ENV);
+	if (env)
+		queue->hold_depth = strtol(env, NULL, 0);
+
+	if (queue->hold_usecs < 0)
+		queue->hold_usecs = 0;
+	if (queue->hold_depth < 1)
+		queue->hold_depth = 1;
+}
+
 int
 tapdisk_init_queue(struct tqueue *queue, int size,
 		   int drv, struct tfilter *filter)
@@ -632,6 +1175,8 @@ tapdisk_init_queue(struct tqueue *queue, int size,
 	if (err)
 		goto fail;
 
+	tapdisk_queue_init_hold(queue);
+
 	return 0;
 
  fail:
@@ -660,6 +1205,11 @@ tapdisk_debug_queue(struct tqueue *queue)
 	     "tiocbs_pending: %d, tiocbs_deferred: %d, deferrals: %"PRIx64"\n",
 	     queue->size, queue->tio->name, queue->queued, queue->iocbs_pending,
 	     queue->tiocbs_pending, queue->tiocbs_deferred, queue->deferrals);
+	WARN("merge_in: %"PRIu64", merge_out: %"PRIu64", vectored: %"PRIu64", "
+	     "holds: %"PRIu64" (%dus at depth %d)\n",
+	     queue->opioctx.merge_in, queue->opioctx.merge_out,
+	     queue->opioctx.merge_vectored, queue->holds,
+	     queue->hold_usecs, queue->hold_depth);
 
 	if (tiocb) {
 		WARN("deferred:\n");
@@ -693,6 +1243,8 @@ tapdisk_prep_tiocb(struct tiocb *tiocb, int fd, int rw, char *buf, size_t size,
 void
 tapdisk_queue_tiocb(struct tqueue *queue, struct tiocb *tiocb)
 {
+	queue->tiocbs_queued++;
+
 	if (!tapdisk_queue_full(queue))
 		queue_tiocb(queue, tiocb);
 	else
@@ -700,6 +1252,37 @@ tapdisk_queue_tiocb(struct tqueue *queue, struct tiocb *tiocb)
 }
 
 
+/*
+ * hold the queued batch back if it ends in a sequential stream and
+ * enough io is in flight that a completion will bring us back here
+ * soon.  the hold ends after hold_usecs, or earlier once the queue
+ * fills up or the io in flight drains below hold_depth.
+ */
+int
+tapdisk_queue_hold(struct tqueue *queue)
+{
+	struct timeval now;
+	long usecs;
+
+	if (!queue->hold_usecs || !queue->hold_seq)
+		return 0;
+
+	if (queue->iocbs_pending < queue->hold_depth)
+		return 0;
+
+	if (tapdisk_queue_full(queue) || deferred_tiocbs(queue))
+		return 0;
+
+	gettimeofday(&now, NULL);
+	usecs = (now.tv_sec - queue->hold_start.tv_sec) * 1000000L +
+		(now.tv_usec - queue->hold_start.tv_usec);
+	if (usecs >= queue->hold_usecs)
+		return 0;
+
+	queue->holds++;
+	return 1;
+}
+
 /*
  * fail_tiocbs may queue more tiocbs
  */
@@ -714,6 +1297,9 @@ tapdisk_submit_all_tiocbs(struct tqueue *queue)
 {
 	int submitted = 0;
 
+	if (tapdisk_queue_hold(queue))
+		return 0;
+
 	do {
 		submitted += tapdisk_submit_tiocbs(queue);
 	} while (!tapdisk_queue_empty(queue));
@@ -30,6 +30,7 @@
 #define TAPDISK_QUEUE_H
 
 #include <libaio.h>
+#include <sys/time.h>
 
 #include "io-optimize.h"
 #include "scheduler.h"
@@ -82,6 +83,21 @@ struct tqueue {
 	struct tfilter       *filter;
 
 	uint64_t              deferrals;
+
+	/* adaptive coalescing: while at least hold_depth iocbs are in
+	 * flight, a batch ending in a small sequential iocb is held for
+	 * up to hold_usecs so the stream can grow before io_merge runs.
+	 * completions of the iocbs in flight guarantee a wakeup. */
+	int                   hold_usecs;
+	int                   hold_depth;
+	int                   hold_seq;
+	struct timeval        hold_start;
+	uint64_t              holds;
+
+	/* lifetime counters, reported through tapdisk-control */
+	uint64_t              tiocbs_queued;
+	uint64_t              tiocbs_completed;
+	uint64_t              tiocbs_errors;
 };
 
 struct tio {
@@ -94,8 +110,10 @@ struct tio {
 };
 
 enum {
-	TIO_DRV_LIO     = 1,
-	TIO_DRV_RWIO    = 2,
+	TIO_DRV_LIO          = 1,
+	TIO_DRV_RWIO         = 2,
+	TIO_DRV_URING        = 3,
+	TIO_DRV_URING_SQPOLL = 4,
 };
 
 /*
@@ -111,10 +129,12 @@ enum {
 #define tapdisk_queue_empty(q) ((q)->queued == 0)
 #define tapdisk_queue_full(q)  \
 	(((q)->tiocbs_pending + (q)->queued) >= (q)->size)
+int tapdisk_queue_driver(const char *name);
 int tapdisk_init_queue(struct tqueue *, int size, int drv, struct tfilter *);
 void tapdisk_free_queue(struct tqueue *);
 void tapdisk_debug_queue(struct tqueue *);
 void tapdisk_queue_tiocb(struct tqueue *, struct tiocb *);
+int tapdisk_queue_hold(struct tqueue *);
 int tapdisk_submit_tiocbs(struct tqueue *);
 int tapdisk_submit_all_tiocbs(struct tqueue *);
 int tapdisk_cancel_tiocbs(struct tqueue *);
@@ -101,6 +101,19 @@ tapdisk_server_queue_tiocb(struct tiocb *tiocb)
 	tapdisk_queue_tiocb(&server.aio_queue, tiocb);
 }
 
+int
+tapdisk_server_init_queue(struct tqueue *queue)
+{
+	return tapdisk_init_queue(queue, TAPDISK_TIOCBS,
+				  server.aio_drv, NULL);
+}
+
+struct tqueue *
+tapdisk_server_get_queue(void)
+{
+	return &server.aio_queue;
+}
+
 void
 tapdisk_server_debug(void)
 {
@@ -174,6 +187,12 @@ tapdisk_server_check_progress(void)
 static void
 tapdisk_server_submit_tiocbs(void)
 {
+	td_vbd_t *vbd, *tmp;
+
+	tapdisk_server_for_each_vbd(vbd, tmp)
+		if (vbd->queue.size)
+			tapdisk_submit_all_tiocbs(&vbd->queue);
+
 	tapdisk_submit_all_tiocbs(&server.aio_queue);
 }
 
@@ -208,8 +227,7 @@ tapdisk_server_stop_vbds(void)
 static int
 tapdisk_server_init_aio(void)
 {
-	return tapdisk_init_queue(&server.aio_queue, TAPDISK_TIOCBS,
-				  TIO_DRV_LIO, NULL);
+	return tapdisk_server_init_queue(&server.aio_queue);
 }
 
 static void
@@ -282,12 +300,19 @@ tapdisk_server_init(void)
 {
 	memset(&server, 0, sizeof(server));
 	INIT_LIST_HEAD(&server.vbds);
+	server.aio_drv = TIO_DRV_LIO;
 
 	scheduler_initialize(&server.scheduler);
 
 	return 0;
 }
 
+void
+tapdisk_server_set_aio_driver(int drv)
+{
+	server.aio_drv = drv;
+}
+
 int
 tapdisk_server_complete(void)
 {
@@ -42,6 +42,8 @@ void tapdisk_server_add_vbd(td_vbd_t *);
 void tapdisk_server_remove_vbd(td_vbd_t *);
 
 void tapdisk_server_queue_tiocb(struct tiocb *);
+int tapdisk_server_init_queue(struct tqueue *);
+struct tqueue *tapdisk_server_get_queue(void);
 
 void tapdisk_server_check_state(void);
 
@@ -49,6 +51,8 @@ event_id_t tapdisk_server_register_event(char, int, int, event_cb_t, void *);
 void tapdisk_server_unregister_event(event_id_t);
 void tapdisk_server_set_max_timeout(int);
 
+void tapdisk_server_set_aio_driver(int);
+
 int tapdisk_server_init(void);
 int tapdisk_server_initialize(void);
 int tapdisk_server_complete(void);
@@ -62,6 +66,7 @@ typedef struct tapdisk_server {
 	struct list_head             vbds;
 	scheduler_t                  scheduler;
 	struct tqueue                aio_queue;
+	int                          aio_drv;
 } tapdisk_server_t;
 
 #endif
@@ -31,6 +31,7 @@
 #include <regex.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <libgen.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
@@ -86,6 +87,8 @@ tapdisk_vbd_free(td_vbd_t *vbd)
 {
 	if (vbd) {
 		tapdisk_vbd_free_stack(vbd);
+		tapdisk_vbd_disable_gntcopy(vbd);
+		tapdisk_mirror_release(&vbd->mirror);
 		list_del_init(&vbd->next);
 		free(vbd->name);
 		free(vbd);
@@ -179,6 +182,42 @@ tapdisk_vbd_validate_chain(td_vbd_t *vbd)
 	return 0;
 }
 
+/*
+ * Give the vbd its own tio queue, so that one busy vbd cannot fill the
+ * server queue and defer everybody else's I/O. Shared images stay on
+ * the server queue: they outlive any single vbd.
+ */
+static void
+tapdisk_vbd_bind_queue(td_vbd_t *vbd)
+{
+	int err;
+	td_image_t *image, *tmp;
+
+	if (!vbd->queue.size) {
+		err = tapdisk_server_init_queue(&vbd->queue);
+		if (err) {
+			memset(&vbd->queue, 0, sizeof(vbd->queue));
+			DPRINTF("%s: using server queue: %d\n", vbd->name, err);
+			return;
+		}
+	}
+
+	tapdisk_vbd_for_each_image(vbd, image, tmp)
+		if (!td_flag_test(image->flags, TD_OPEN_SHAREABLE) &&
+		    image->driver->refcnt == 1)
+			image->driver->queue = &vbd->queue;
+}
+
+static void
+tapdisk_vbd_unbind_queue(td_vbd_t *vbd)
+{
+	if (!vbd->queue.size)
+		return;
+
+	tapdisk_free_queue(&vbd->queue);
+	memset(&vbd->queue, 0, sizeof(vbd->queue));
+}
+
 void
 tapdisk_vbd_close_vdi(td_vbd_t *vbd)
 {
@@ -190,6 +229,7 @@ tapdisk_vbd_close_vdi(td_vbd_t *vbd)
 	}
 
 	INIT_LIST_HEAD(&vbd->images);
+	tapdisk_vbd_unbind_queue(vbd);
 	td_flag_set(vbd->state, TD_VBD_CLOSED);
 
 	tapdisk_vbd_free_stack(vbd);
@@ -432,6 +472,7 @@ __tapdisk_vbd_open_vdi(td_vbd_t *vbd, td_flag_t extra_flags)
 	if (err)
 		goto fail;
 
+	tapdisk_vbd_bind_queue(vbd);
 	td_flag_clear(vbd->state, TD_VBD_CLOSED);
 
 	return 0;
@@ -668,6 +709,37 @@ tapdisk_vbd_detach(td_vbd_t *vbd)
 }
 
 
+/*
+ * in grant copy mode, data moves between the guest's grants and a
+ * private pool with GNTTABOP_copy; the pages the blktap device maps
+ * in for each request are left untouched.
+ */
+int
+tapdisk_vbd_enable_gntcopy(td_vbd_t *vbd, uint16_t domid)
+{
+	if (!list_empty(&vbd->pending_requests))
+		return -EBUSY;
+
+	tapdisk_vbd_disable_gntcopy(vbd);
+
+	return tapdisk_gntcopy_open(&vbd->gntcopy, domid, MAX_REQUESTS);
+}
+
+void
+tapdisk_vbd_disable_gntcopy(td_vbd_t *vbd)
+{
+	tapdisk_gntcopy_close(&vbd->gntcopy);
+}
+
+static void
+tapdisk_vbd_gntcopy_error(void *owner, int err)
+{
+	td_vbd_request_t *vreq = owner;
+
+	vreq->status = BLKIF_RSP_ERROR;
+	vreq->error  = err;
+}
+
 int
 tapdisk_vbd_attach(td_vbd_t *vbd, const char *devname, int minor)
 {
@@ -750,7 +822,8 @@ tapdisk_vbd_shutdown(td_vbd_t *vbd)
 {
 	int new, pending, failed, completed;
 
-	if (!list_empty(&vbd->pending_requests))
+	if (!list_empty(&vbd->pending_requests) ||
+	    tapdisk_mirror_busy(&vbd->mirror))
 		return -EAGAIN;
 
 	tapdisk_vbd_kick(vbd);
@@ -779,10 +852,13 @@ tapdisk_vbd_shutdown(td_vbd_t *vbd)
 int
 tapdisk_vbd_close(td_vbd_t *vbd)
 {
+	tapdisk_mirror_cancel(&vbd->mirror, -EINTR);
+
 	/*
 	 * don't close if any requests are pending in the aio layer
 	 */
-	if (!list_empty(&vbd->pending_requests))
+	if (!list_empty(&vbd->pending_requests) ||
+	    tapdisk_mirror_busy(&vbd->mirror))
 		goto fail;
 
 	/* 
@@ -824,6 +900,15 @@ tapdisk_vbd_debug(td_vbd_t *vbd)
 	    vbd->errors, vbd->retries,
 	    vbd->received, vbd->returned, vbd->kicked);
 
+	if (vbd->queue.size)
+		tapdisk_debug_queue(&vbd->queue);
+
+	if (tapdisk_gntcopy_enabled(&vbd->gntcopy))
+		tapdisk_gntcopy_debug(&vbd->gntcopy);
+
+	if (vbd->mirror.state != TAPDISK_MIRROR_IDLE)
+		tapdisk_mirror_debug(&vbd->mirror);
+
 	tapdisk_vbd_for_each_image(vbd, image, tmp)
 		td_debug(image);
 }
@@ -881,7 +966,8 @@ tapdisk_vbd_lock(td_vbd_t *vbd)
 int
 tapdisk_vbd_quiesce_queue(td_vbd_t *vbd)
 {
-	if (!list_empty(&vbd->pending_requests)) {
+	if (!list_empty(&vbd->pending_requests) ||
+	    tapdisk_mirror_busy(&vbd->mirror)) {
 		td_flag_set(vbd->state, TD_VBD_QUIESCE_REQUESTED);
 		return -EAGAIN;
 	}
@@ -902,6 +988,7 @@ tapdisk_vbd_start_queue(td_vbd_t *vbd)
 int
 tapdisk_vbd_kill_queue(td_vbd_t *vbd)
 {
+	tapdisk_mirror_cancel(&vbd->mirror, -EINTR);
 	tapdisk_vbd_quiesce_queue(vbd);
 	td_flag_set(vbd->state, TD_VBD_DEAD);
 	return 0;
@@ -956,6 +1043,7 @@ tapdisk_vbd_pause(td_vbd_t *vbd)
 	int err;
 
 	td_flag_set(vbd->state, TD_VBD_PAUSE_REQUESTED);
+	tapdisk_mirror_cancel(&vbd->mirror, -EINTR);
 
 	err = tapdisk_vbd_quiesce_queue(vbd);
 	if (err)
@@ -1075,11 +1163,35 @@ tapdisk_vbd_make_response(td_vbd_t *vbd, td_vbd_request_t *vreq)
 	vbd->callback(vbd->argument, rsp);
 }
 
+/*
+ * copy the data of all completed reads out to the guest in one batch
+ * before their responses go on the ring
+ */
+static void
+tapdisk_vbd_gntcopy_responses(td_vbd_t *vbd)
+{
+	td_vbd_request_t *vreq, *tmp;
+
+	tapdisk_vbd_for_each_request(vreq, tmp, &vbd->completed_requests) {
+		if (vreq->req.operation != BLKIF_OP_READ ||
+		    vreq->status != BLKIF_RSP_OKAY)
+			continue;
+
+		if (tapdisk_gntcopy_add(&vbd->gntcopy, &vreq->req, vreq,
+					TD_GNTCOPY_TO_GUEST))
+			vreq->status = BLKIF_RSP_ERROR;
+	}
+
+	tapdisk_gntcopy_flush(&vbd->gntcopy, tapdisk_vbd_gntcopy_error);
+}
+
 void
 tapdisk_vbd_check_state(td_vbd_t *vbd)
 {
 	td_vbd_request_t *vreq, *tmp;
 
+	tapdisk_mirror_kick(vbd);
+
 	tapdisk_vbd_for_each_request(vreq, tmp, &vbd->failed_requests)
 		if (vreq->num_retries >= TD_VBD_MAX_RETRIES)
 			tapdisk_vbd_complete_vbd_request(vbd, vreq);
@@ -1088,6 +1200,9 @@ tapdisk_vbd_check_state(td_vbd_t *vbd)
 	    !list_empty(&vbd->failed_requests))
 		tapdisk_vbd_issue_requests(vbd);
 
+	if (tapdisk_gntcopy_enabled(&vbd->gntcopy))
+		tapdisk_vbd_gntcopy_responses(vbd);
+
 	tapdisk_vbd_for_each_request(vreq, tmp, &vbd->completed_requests) {
 		tapdisk_vbd_make_response(vbd, vreq);
 		list_del(&vreq->next);
@@ -1167,7 +1282,9 @@ void
 tapdisk_vbd_complete_vbd_request(td_vbd_t *vbd, td_vbd_request_t *vreq)
 {
 	if (!vreq->submitting && !vreq->secs_pending) {
-		if (vreq->status == BLKIF_RSP_ERROR &&
+		if (vreq->mirror)
+			tapdisk_mirror_complete_read(vbd, vreq);
+		else if (vreq->status == BLKIF_RSP_ERROR &&
 		    vreq->num_retries < TD_VBD_MAX_RETRIES &&
 		    !td_flag_test(vbd->state, TD_VBD_DEAD) &&
 		    !td_flag_test(vbd->state, TD_VBD_SHUTDOWN_REQUESTED))
@@ -1204,6 +1321,10 @@ __tapdisk_vbd_complete_td_request(td_vbd_t *vbd, td_vbd_request_t *vreq,
 
 	vreq->blocked = treq.blocked;
 
+	/* the write may have landed after the mirror copied its block */
+	if (treq.op == TD_OP_WRITE)
+		tapdisk_mirror_dirty(&vbd->mirror, treq.sec, treq.secs);
+
 	if (err) {
 		vreq->status = BLKIF_RSP_ERROR;
 		vreq->error  = (vreq->error ? : err);
@@ -1386,8 +1507,11 @@ tapdisk_vbd_issue_request(td_vbd_t *vbd, td_vbd_request_t *vreq)
 
 	for (i = 0; i < req->nr_segments; i++) {
 		nsects = req->seg[i].last_sect - req->seg[i].first_sect + 1;
-		page   = (char *)MMAP_VADDR(ring->vstart, 
-					   (unsigned long)req->id, i);
+		if (tapdisk_gntcopy_enabled(&vbd->gntcopy))
+			page = tapdisk_gntcopy_page(&vbd->gntcopy, req->id, i);
+		else
+			page = (char *)MMAP_VADDR(ring->vstart,
+						  (unsigned long)req->id, i);
 		page  += (req->seg[i].first_sect << SECTOR_SHIFT);
 
 		treq.id             = id;
@@ -1498,12 +1622,42 @@ tapdisk_vbd_reissue_failed_requests(td_vbd_t *vbd)
 	return err;
 }
 
+/*
+ * pull the data of all new writes in from the guest in one batch.
+ * a request whose copy failed is completed without being issued.
+ */
+static void
+tapdisk_vbd_gntcopy_new_requests(td_vbd_t *vbd)
+{
+	td_vbd_request_t *vreq, *tmp;
+
+	tapdisk_vbd_for_each_request(vreq, tmp, &vbd->new_requests) {
+		if (vreq->req.operation != BLKIF_OP_WRITE || vreq->gntcopied)
+			continue;
+
+		vreq->gntcopied = 1;
+		if (tapdisk_gntcopy_add(&vbd->gntcopy, &vreq->req, vreq,
+					TD_GNTCOPY_FROM_GUEST))
+			vreq->status = BLKIF_RSP_ERROR;
+	}
+
+	tapdisk_gntcopy_flush(&vbd->gntcopy, tapdisk_vbd_gntcopy_error);
+
+	tapdisk_vbd_for_each_request(vreq, tmp, &vbd->new_requests)
+		if (vreq->status == BLKIF_RSP_ERROR)
+			tapdisk_vbd_move_request(vreq,
+						 &vbd->completed_requests);
+}
+
 static int
 tapdisk_vbd_issue_new_requests(td_vbd_t *vbd)
 {
 	int err;
 	td_vbd_request_t *vreq, *tmp;
 
+	if (tapdisk_gntcopy_enabled(&vbd->gntcopy))
+		tapdisk_vbd_gntcopy_new_requests(vbd);
+
 	tapdisk_vbd_for_each_request(vreq, tmp, &vbd->new_requests) {
 		err = tapdisk_vbd_issue_request(vbd, vreq);
 		if (err)
@@ -1542,6 +1696,10 @@ tapdisk_vbd_issue_requests(td_vbd_t *vbd)
 	if (!tapdisk_vbd_queue_ready(vbd))
 		return -EAGAIN;
 
+	/* the mirror is copying the last few blocks */
+	if (tapdisk_mirror_holding(&vbd->mirror))
+		return -EAGAIN;
+
 	err = tapdisk_vbd_reissue_failed_requests(vbd);
 	if (err)
 		return err;
@@ -1594,6 +1752,7 @@ tapdisk_vbd_pause_ring(td_vbd_t *vbd)
 		return 0;
 
 	td_flag_set(vbd->state, TD_VBD_PAUSE_REQUESTED);
+	tapdisk_mirror_cancel(&vbd->mirror, -EINTR);
 
 	err = tapdisk_vbd_quiesce_queue(vbd);
 	if (err) {
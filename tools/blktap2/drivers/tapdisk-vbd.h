@@ -35,6 +35,9 @@
 #include "tapdisk.h"
 #include "scheduler.h"
 #include "tapdisk-image.h"
+#include "tapdisk-queue.h"
+#include "tapdisk-gntcopy.h"
+#include "tapdisk-mirror.h"
 
 #define TD_VBD_MAX_RETRIES          100
 #define TD_VBD_RETRY_INTERVAL       1
@@ -73,6 +76,8 @@ struct td_vbd_request {
 	int                         submitting;
 	int                         secs_pending;
 	int                         num_retries;
+	int                         gntcopied;
+	int                         mirror;  /* a tapdisk_mirror copy read */
 	struct timeval              last_try;
 
 	td_vbd_t                   *vbd;
@@ -112,6 +117,15 @@ struct td_vbd_handle {
 	td_ring_t                   ring;
 	event_id_t                  ring_event_id;
 
+	/* tio queue for the unshared images of this vbd */
+	struct tqueue               queue;
+
+	/* optional grant copy data path, bypassing the blktap mappings */
+	td_gntcopy_t                gntcopy;
+
+	/* live copy of the vbd onto another image */
+	td_mirror_t                 mirror;
+
 	td_vbd_cb_t                 callback;
 	void                       *argument;
 
@@ -186,6 +200,9 @@ void tapdisk_vbd_close_vdi(td_vbd_t *);
 int tapdisk_vbd_attach(td_vbd_t *, const char *, int);
 void tapdisk_vbd_detach(td_vbd_t *);
 
+int tapdisk_vbd_enable_gntcopy(td_vbd_t *, uint16_t domid);
+void tapdisk_vbd_disable_gntcopy(td_vbd_t *);
+
 void tapdisk_vbd_forward_request(td_request_t);
 
 int tapdisk_vbd_get_image_info(td_vbd_t *, image_t *);
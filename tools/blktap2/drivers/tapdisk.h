@@ -51,6 +51,11 @@
  *     0 if parent id successfully retrieved
  *     TD_NO_PARENT if no parent exists
  *     -errno on error
+ *
+ * td_get_allocated is optional.  It sets bit n (LSB first within each
+ * byte) of the given map for every n below the given count such that the
+ * n-th run of the given number of sectors may hold data in this image, and
+ * returns 0; or -ENOSYS if the driver cannot tell.
  */
 
 #ifndef _TAPDISK_H_
@@ -164,6 +169,8 @@ struct tap_disk {
 	void (*td_queue_read)        (td_driver_t *, td_request_t);
 	void (*td_queue_write)       (td_driver_t *, td_request_t);
 	void (*td_debug)             (td_driver_t *);
+	int (*td_get_allocated)      (td_driver_t *, uint32_t,
+				      uint8_t *, uint64_t);
 };
 
 #endif
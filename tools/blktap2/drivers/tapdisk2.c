@@ -42,7 +42,8 @@
 static void
 usage(const char *app, int err)
 {
-	fprintf(stderr, "usage: %s [-D] <-u uuid> <-c control socket>\n", app);
+	fprintf(stderr, "usage: %s [-D] [-a lio|uring|uring-sqpoll] "
+		"<-u uuid> <-c control socket>\n", app);
 	exit(err);
 }
 
@@ -50,13 +51,19 @@ int
 main(int argc, char *argv[])
 {
 	char *control;
-	int c, err, nodaemon;
+	int c, err, nodaemon, aio_drv;
 
 	control  = NULL;
 	nodaemon = 0;
+	aio_drv  = TIO_DRV_LIO;
 
-	while ((c = getopt(argc, argv, "s:Dh")) != -1) {
+	while ((c = getopt(argc, argv, "a:s:Dh")) != -1) {
 		switch (c) {
+		case 'a':
+			aio_drv = tapdisk_queue_driver(optarg);
+			if (aio_drv < 0)
+				usage(argv[0], EINVAL);
+			break;
 		case 'D':
 			nodaemon = 1;
 			break;
@@ -93,6 +100,8 @@ main(int argc, char *argv[])
 		goto out;
 	}
 
+	tapdisk_server_set_aio_driver(aio_drv);
+
 	if (!nodaemon) {
 		err = daemon(0, 1);
 		if (err) {
@@ -41,6 +41,7 @@
 #define TAPDISK_MESSAGE_FLAG_ADD_CACHE   0x04
 #define TAPDISK_MESSAGE_FLAG_VHD_INDEX   0x08
 #define TAPDISK_MESSAGE_FLAG_LOG_DIRTY   0x10
+#define TAPDISK_MESSAGE_FLAG_GNTCOPY     0x20
 
 typedef struct tapdisk_message           tapdisk_message_t;
 typedef uint8_t                          tapdisk_message_flag_t;
@@ -50,6 +51,8 @@ typedef struct tapdisk_message_string    tapdisk_message_string_t;
 typedef struct tapdisk_message_response  tapdisk_message_response_t;
 typedef struct tapdisk_message_minors    tapdisk_message_minors_t;
 typedef struct tapdisk_message_list      tapdisk_message_list_t;
+typedef struct tapdisk_message_stats     tapdisk_message_stats_t;
+typedef struct tapdisk_message_mirror    tapdisk_message_mirror_t;
 
 struct tapdisk_message_params {
 	tapdisk_message_flag_t           flags;
@@ -88,6 +91,51 @@ struct tapdisk_message_list {
 	char                             path[TAPDISK_MESSAGE_MAX_PATH_LENGTH];
 };
 
+struct tapdisk_message_stats {
+	/* vbd ring */
+	uint64_t                         received;
+	uint64_t                         returned;
+	uint64_t                         kicked;
+	uint64_t                         errors;
+	uint64_t                         retries;
+	uint64_t                         secs_pending;
+
+	/* tio queue serving the vbd; shared if it is the server queue */
+	uint32_t                         shared;
+	uint32_t                         size;
+	uint32_t                         tiocbs_pending;
+	uint32_t                         tiocbs_deferred;
+	uint64_t                         tiocbs_queued;
+	uint64_t                         tiocbs_completed;
+	uint64_t                         tiocbs_errors;
+	uint64_t                         deferrals;
+
+	/* request coalescing */
+	uint64_t                         merge_in;
+	uint64_t                         merge_out;
+	uint64_t                         merge_vectored;
+	uint64_t                         holds;
+};
+
+#define TAPDISK_MIRROR_IDLE              0
+#define TAPDISK_MIRROR_COPY              1  /* copying in the background */
+#define TAPDISK_MIRROR_SYNC              2  /* vbd held, copying the rest */
+#define TAPDISK_MIRROR_DONE              3  /* vbd moved to the mirror */
+#define TAPDISK_MIRROR_FAILED            4
+
+struct tapdisk_message_mirror {
+	uint32_t                         state;
+	int32_t                          error;
+
+	/* the counts below are in blocks of block_secs sectors */
+	uint32_t                         block_secs;
+	uint64_t                         blocks;
+	uint64_t                         dirty;
+	uint64_t                         inflight;
+	uint64_t                         copied;
+	uint64_t                         zero;
+};
+
 struct tapdisk_message {
 	uint16_t                         type;
 	uint16_t                         cookie;
@@ -100,6 +148,8 @@ struct tapdisk_message {
 		tapdisk_message_minors_t minors;
 		tapdisk_message_response_t response;
 		tapdisk_message_list_t   list;
+		tapdisk_message_stats_t  stats;
+		tapdisk_message_mirror_t mirror;
 	} u;
 };
 
@@ -126,6 +176,14 @@ enum tapdisk_message_id {
 	TAPDISK_MESSAGE_LIST_RSP,
 	TAPDISK_MESSAGE_FORCE_SHUTDOWN,
 	TAPDISK_MESSAGE_EXIT,
+	TAPDISK_MESSAGE_STATS,
+	TAPDISK_MESSAGE_STATS_RSP,
+	TAPDISK_MESSAGE_MIRROR,
+	TAPDISK_MESSAGE_MIRROR_RSP,
+	TAPDISK_MESSAGE_MIRROR_STATUS,
+	TAPDISK_MESSAGE_MIRROR_STATUS_RSP,
+	TAPDISK_MESSAGE_MIRROR_CANCEL,
+	TAPDISK_MESSAGE_MIRROR_CANCEL_RSP,
 };
 
 static inline char *
@@ -195,6 +253,30 @@ tapdisk_message_name(enum tapdisk_message_id id)
 	case TAPDISK_MESSAGE_EXIT:
 		return "exit";
 
+	case TAPDISK_MESSAGE_STATS:
+		return "stats";
+
+	case TAPDISK_MESSAGE_STATS_RSP:
+		return "stats response";
+
+	case TAPDISK_MESSAGE_MIRROR:
+		return "mirror";
+
+	case TAPDISK_MESSAGE_MIRROR_RSP:
+		return "mirror response";
+
+	case TAPDISK_MESSAGE_MIRROR_STATUS:
+		return "mirror status";
+
+	case TAPDISK_MESSAGE_MIRROR_STATUS_RSP:
+		return "mirror status response";
+
+	case TAPDISK_MESSAGE_MIRROR_CANCEL:
+		return "mirror cancel";
+
+	case TAPDISK_MESSAGE_MIRROR_CANCEL_RSP:
+		return "mirror cancel response";
+
 	default:
 		return "unknown";
 	}
@@ -26,8 +26,10 @@
 */
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "libvhd.h"
@@ -55,71 +57,291 @@ __raw_io_write(int fd, char* buf, uint64_t sec, uint32_t secs)
 	return (errno ? -errno : -EIO);
 }
 
+/*
+ * Blocks are read from the child by a few reader threads, up to
+ * COALESCE_DEPTH of them at a time, while the calling thread writes
+ * completed blocks into the parent.  The readers only pread() the child's
+ * own data at known offsets, so they share its fd without touching the
+ * context's file position; all writes, which may allocate blocks and
+ * update metadata in a VHD parent, stay on the calling thread.  Blocks
+ * complete out of order, which is harmless as they do not overlap.
+ */
+#define COALESCE_READERS	4
+#define COALESCE_DEPTH		16
+
+struct coalesce_slot {
+	uint64_t		block;
+	char		       *map;	/* NULL if the whole block is in use */
+	char		       *bitmap;
+	char		       *buf;
+	uint32_t		first;	/* first and last sectors to copy */
+	uint32_t		last;
+	struct coalesce_slot   *next;
+};
+
+struct coalesce {
+	vhd_context_t	       *vhd;
+	vhd_context_t	       *parent;
+	int			parent_fd;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	uint64_t		next_block;
+	struct coalesce_slot   *free;
+	struct coalesce_slot   *ready;
+	int			readers;
+	int			err;
+};
+
+static int
+coalesce_pread(vhd_context_t *vhd, char *buf, uint64_t sec, uint32_t secs)
+{
+	ssize_t ret;
+	size_t done, size;
+
+	size = vhd_sectors_to_bytes(secs);
+	for (done = 0; done < size; done += ret) {
+		ret = pread(vhd->fd, buf + done, size - done,
+			    vhd_sectors_to_bytes(sec) + done);
+		if (ret == 0)
+			return -EIO;
+		if (ret < 0) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			return -errno;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Fill @slot with the sectors of @block present in the child, or return
+ * 1 if the block's bitmap shows none, so it need not be read at all.
+ */
+static int
+coalesce_read_block(struct coalesce *c, struct coalesce_slot *slot,
+		    uint64_t block)
+{
+	vhd_context_t *vhd = c->vhd;
+	uint64_t off;
+	int i, err;
+
+	off         = vhd->bat.bat[block];
+	slot->block = block;
+	slot->first = 0;
+	slot->last  = vhd->spb - 1;
+
+	if (vhd_has_batmap(vhd) && vhd_batmap_test(vhd, &vhd->batmap, block)) {
+		slot->map = NULL;
+	} else {
+		slot->map = slot->bitmap;
+		err = coalesce_pread(vhd, slot->map, off, vhd->bm_secs);
+		if (err)
+			return err;
+
+		for (i = 0; i < vhd->spb; i++)
+			if (vhd_bitmap_test(vhd, slot->map, i))
+				break;
+		if (i == vhd->spb)
+			return 1;
+		slot->first = i;
+
+		for (i = vhd->spb - 1; i > slot->first; i--)
+			if (vhd_bitmap_test(vhd, slot->map, i))
+				break;
+		slot->last = i;
+	}
+
+	return coalesce_pread(vhd,
+			      slot->buf + vhd_sectors_to_bytes(slot->first),
+			      off + vhd->bm_secs + slot->first,
+			      slot->last - slot->first + 1);
+}
+
+static int
+coalesce_write(struct coalesce *c, char *buf, uint64_t sec, uint32_t secs)
+{
+	if (c->parent->file)
+		return vhd_io_write(c->parent, buf, sec, secs);
+	else
+		return __raw_io_write(c->parent_fd, buf, sec, secs);
+}
+
 /*
  * Use 'parent' if the parent is VHD, and 'parent_fd' if the parent is raw
  */
 static int
-vhd_util_coalesce_block(vhd_context_t *vhd, vhd_context_t *parent,
-		int parent_fd, uint64_t block)
+vhd_util_coalesce_block(struct coalesce *c, struct coalesce_slot *slot)
 {
 	int i, err;
-	char *buf, *map;
 	uint64_t sec, secs;
+	vhd_context_t *vhd = c->vhd;
 
-	buf = NULL;
-	map = NULL;
-	sec = block * vhd->spb;
+	sec = slot->block * vhd->spb;
 
-	if (vhd->bat.bat[block] == DD_BLK_UNUSED)
-		return 0;
+	if (!slot->map)
+		return coalesce_write(c, slot->buf, sec, vhd->spb);
 
-	err = posix_memalign((void **)&buf, 4096, vhd->header.block_size);
-	if (err)
-		return -err;
+	for (i = slot->first; i <= slot->last; i++) {
+		if (!vhd_bitmap_test(vhd, slot->map, i))
+			continue;
 
-	err = vhd_io_read(vhd, buf, sec, vhd->spb);
-	if (err)
-		goto done;
+		for (secs = 0; i + secs <= slot->last; secs++)
+			if (!vhd_bitmap_test(vhd, slot->map, i + secs))
+				break;
 
-	if (vhd_has_batmap(vhd) && vhd_batmap_test(vhd, &vhd->batmap, block)) {
-		if (parent->file)
-			err = vhd_io_write(parent, buf, sec, vhd->spb);
-		else
-			err = __raw_io_write(parent_fd, buf, sec, vhd->spb);
-		goto done;
+		err = coalesce_write(c, slot->buf + vhd_sectors_to_bytes(i),
+				     sec + i, secs);
+		if (err)
+			return err;
+
+		i += secs;
 	}
 
-	err = vhd_read_bitmap(vhd, block, &map);
-	if (err)
-		goto done;
+	return 0;
+}
+
+static void *
+coalesce_reader(void *arg)
+{
+	struct coalesce *c = arg;
+	struct coalesce_slot *slot;
+	uint64_t block;
+	int err;
+
+	pthread_mutex_lock(&c->lock);
+
+	for (;;) {
+		while (!c->err && !c->free &&
+		       c->next_block < c->vhd->bat.entries)
+			pthread_cond_wait(&c->cond, &c->lock);
 
-	for (i = 0; i < vhd->spb; i++) {
-		if (!vhd_bitmap_test(vhd, map, i))
+		if (c->err || c->next_block >= c->vhd->bat.entries)
+			break;
+
+		block = c->next_block++;
+		if (c->vhd->bat.bat[block] == DD_BLK_UNUSED)
 			continue;
 
-		for (secs = 0; i + secs < vhd->spb; secs++)
-			if (!vhd_bitmap_test(vhd, map, i + secs))
-				break;
+		slot    = c->free;
+		c->free = slot->next;
+		pthread_mutex_unlock(&c->lock);
+
+		err = coalesce_read_block(c, slot, block);
+
+		pthread_mutex_lock(&c->lock);
+		if (err) {
+			slot->next = c->free;
+			c->free    = slot;
+			if (err < 0 && !c->err)
+				c->err = err;
+		} else {
+			slot->next = c->ready;
+			c->ready   = slot;
+		}
+		pthread_cond_broadcast(&c->cond);
+	}
+
+	c->readers--;
+	pthread_cond_broadcast(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+
+	return NULL;
+}
+
+static int
+vhd_util_coalesce_blocks(vhd_context_t *vhd, vhd_context_t *parent,
+			 int parent_fd)
+{
+	struct coalesce c;
+	struct coalesce_slot *slot, *slots[COALESCE_DEPTH];
+	pthread_t readers[COALESCE_READERS];
+	size_t map_size;
+	int i, err, started;
+
+	memset(&c, 0, sizeof(c));
+	memset(slots, 0, sizeof(slots));
+	c.vhd       = vhd;
+	c.parent    = parent;
+	c.parent_fd = parent_fd;
+	pthread_mutex_init(&c.lock, NULL);
+	pthread_cond_init(&c.cond, NULL);
+
+	/* The bitmap follows the slot, padded out for O_DIRECT reads. */
+	map_size = vhd_sectors_to_bytes(vhd->bm_secs);
+	for (i = 0; i < COALESCE_DEPTH; i++) {
+		err = posix_memalign((void **)&slots[i], 4096,
+				     4096 + map_size);
+		if (err) {
+			slots[i] = NULL;
+			err = -err;
+			goto out;
+		}
+		memset(slots[i], 0, sizeof(*slots[i]));
+		slots[i]->bitmap = (char *)slots[i] + 4096;
+
+		err = posix_memalign((void **)&slots[i]->buf, 4096,
+				     vhd->header.block_size);
+		if (err) {
+			err = -err;
+			goto out;
+		}
+
+		slots[i]->next = c.free;
+		c.free = slots[i];
+	}
 
-		if (parent->file)
-			err = vhd_io_write(parent,
-					   buf + vhd_sectors_to_bytes(i),
-					   sec + i, secs);
-		else
-			err = __raw_io_write(parent_fd,
-					     buf + vhd_sectors_to_bytes(i),
-					     sec + i, secs);
+	for (started = 0; started < COALESCE_READERS; started++) {
+		err = pthread_create(&readers[started], NULL,
+				     coalesce_reader, &c);
 		if (err)
-			goto done;
+			break;
+		c.readers++;
+	}
 
-		i += secs;
+	pthread_mutex_lock(&c.lock);
+
+	if (!started)
+		c.err = -err;
+
+	for (;;) {
+		while (!c.err && !c.ready && c.readers)
+			pthread_cond_wait(&c.cond, &c.lock);
+
+		slot = c.ready;
+		if (c.err || !slot)
+			break;
+		c.ready = slot->next;
+		pthread_mutex_unlock(&c.lock);
+
+		err = vhd_util_coalesce_block(&c, slot);
+
+		pthread_mutex_lock(&c.lock);
+		if (err && !c.err)
+			c.err = err;
+		slot->next = c.free;
+		c.free     = slot;
+		pthread_cond_broadcast(&c.cond);
 	}
 
-	err = 0;
+	pthread_mutex_unlock(&c.lock);
+
+	for (i = 0; i < started; i++)
+		pthread_join(readers[i], NULL);
 
-done:
-	free(buf);
-	free(map);
+	err = c.err;
+
+out:
+	for (i = 0; i < COALESCE_DEPTH; i++)
+		if (slots[i]) {
+			free(slots[i]->buf);
+			free(slots[i]);
+		}
+	pthread_cond_destroy(&c.cond);
+	pthread_mutex_destroy(&c.lock);
 	return err;
 }
 
@@ -127,7 +349,6 @@ int
 vhd_util_coalesce(int argc, char **argv)
 {
 	int err, c;
-	uint64_t i;
 	char *name, *pname;
 	vhd_context_t vhd, parent;
 	int parent_fd = -1;
@@ -195,13 +416,9 @@ vhd_util_coalesce(int argc, char **argv)
 			goto done;
 	}
 
-	for (i = 0; i < vhd.bat.entries; i++) {
-		err = vhd_util_coalesce_block(&vhd, &parent, parent_fd, i);
-		if (err)
-			goto done;
-	}
-
-	err = 0;
+	err = vhd_util_coalesce_blocks(&vhd, &parent, parent_fd);
+	if (err)
+		goto done;
 
  done:
 	free(pname);
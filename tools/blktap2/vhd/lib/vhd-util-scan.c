@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fnmatch.h>
+#include <pthread.h>
 #include <libgen.h>	/* for basename() */
 #include <sys/stat.h>
 
@@ -47,6 +48,16 @@
 #define VHD_SCAN_VERBOSE     0x10
 #define VHD_SCAN_PARENTS     0x20
 
+/*
+ * Targets are opened and their headers, footers and parent locators read
+ * by a pool of threads, a batch at a time: with many images the scan is
+ * dominated by the latency of these small reads.  Results are reported,
+ * and parents queued, in order on the calling thread, so the output is
+ * as before.
+ */
+#define VHD_SCAN_BATCH       64
+#define VHD_SCAN_THREADS     8
+
 #define VHD_TYPE_RAW_FILE    0x01
 #define VHD_TYPE_VHD_FILE    0x02
 #define VHD_TYPE_RAW_VOLUME  0x04
@@ -929,77 +940,174 @@ vhd_util_scan_add_parent(struct iterator *itr,
 		vhd_util_scan_error(image->parent, err);
 }
 
+struct vhd_scan_job {
+	struct target        target;
+	vhd_context_t        vhd;
+	struct vhd_image     image;
+	int                  err;
+};
+
+struct vhd_scan_batch {
+	pthread_mutex_t      lock;
+	int                  next;
+	int                  cnt;
+	struct vhd_scan_job *jobs;
+};
+
+static int
+vhd_util_scan_probe(vhd_context_t *vhd, struct vhd_image *image)
+{
+	int err;
+
+	err = vhd_util_scan_open(vhd, image);
+	if (err)
+		return err;
+
+	err = vhd_util_scan_get_size(vhd, image);
+	if (err) {
+		image->message = "getting physical size";
+		image->error   = err;
+		return err;
+	}
+
+	err = vhd_util_scan_get_hidden(vhd, image);
+	if (err) {
+		image->message = "checking 'hidden' field";
+		image->error   = err;
+		return err;
+	}
+
+	if (vhd->footer.type == HD_TYPE_DIFF) {
+		err = vhd_util_scan_get_parent(vhd, image);
+		if (err) {
+			image->message = "getting parent";
+			image->error   = err;
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static void *
+vhd_util_scan_worker(void *arg)
+{
+	struct vhd_scan_batch *batch = arg;
+	struct vhd_scan_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&batch->lock);
+		job = NULL;
+		if (batch->next < batch->cnt)
+			job = batch->jobs + batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+
+		if (!job)
+			break;
+
+		job->err = vhd_util_scan_probe(&job->vhd, &job->image);
+	}
+
+	return NULL;
+}
+
+static void
+vhd_util_scan_run_batch(struct vhd_scan_job *jobs, int cnt)
+{
+	int i, started;
+	struct vhd_scan_batch batch;
+	pthread_t threads[VHD_SCAN_THREADS - 1];
+
+	memset(&batch, 0, sizeof(batch));
+	pthread_mutex_init(&batch.lock, NULL);
+	batch.cnt  = cnt;
+	batch.jobs = jobs;
+
+	/* The calling thread works too, and on its own if need be. */
+	for (started = 0;
+	     started < VHD_SCAN_THREADS - 1 && started < cnt - 1;
+	     started++)
+		if (pthread_create(&threads[started], NULL,
+				   vhd_util_scan_worker, &batch))
+			break;
+
+	vhd_util_scan_worker(&batch);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&batch.lock);
+}
+
 static int
 vhd_util_scan_targets(int cnt, struct target *targets)
 {
-	int ret, err;
-	vhd_context_t vhd;
+	int i, n, ret, err, stop;
 	struct iterator itr;
 	struct target *target;
-	struct vhd_image image;
+	struct vhd_scan_job *jobs, *job;
+
+	ret  = 0;
+	err  = 0;
+	stop = 0;
 
-	ret = 0;
-	err = 0;
+	jobs = calloc(VHD_SCAN_BATCH, sizeof(*jobs));
+	if (!jobs)
+		return -ENOMEM;
 
 	err = iterator_init(&itr, cnt, targets);
-	if (err)
+	if (err) {
+		free(jobs);
 		return err;
+	}
 
-	while ((target = iterator_next(&itr))) {
-		memset(&vhd, 0, sizeof(vhd));
-		memset(&image, 0, sizeof(image));
-
-		image.target = target;
+	while (!stop) {
+		for (n = 0; n < VHD_SCAN_BATCH; n++) {
+			target = iterator_next(&itr);
+			if (!target)
+				break;
 
-		err = vhd_util_scan_open(&vhd, &image);
-		if (err) {
-			ret = -EAGAIN;
-			goto end;
+			job = jobs + n;
+			memset(job, 0, sizeof(*job));
+			job->target       = *target;
+			job->image.target = &job->target;
 		}
 
-		err = vhd_util_scan_get_size(&vhd, &image);
-		if (err) {
-			ret           = -EAGAIN;
-			image.message = "getting physical size";
-			image.error   = err;
-			goto end;
-		}
+		if (!n)
+			break;
 
-		err = vhd_util_scan_get_hidden(&vhd, &image);
-		if (err) {
-			ret           = -EAGAIN;
-			image.message = "checking 'hidden' field";
-			image.error   = err;
-			goto end;
-		}
+		vhd_util_scan_run_batch(jobs, n);
 
-		if (vhd.footer.type == HD_TYPE_DIFF) {
-			err = vhd_util_scan_get_parent(&vhd, &image);
-			if (err) {
-				ret           = -EAGAIN;
-				image.message = "getting parent";
-				image.error   = err;
-				goto end;
-			}
-		}
+		for (i = 0; i < n; i++) {
+			job = jobs + i;
 
-	end:
-		vhd_util_scan_print_image(&image);
+			if (!stop) {
+				err = job->err;
+				if (err)
+					ret = -EAGAIN;
 
-		if (flags & VHD_SCAN_PARENTS && image.parent)
-			vhd_util_scan_add_parent(&itr, &vhd, &image);
+				vhd_util_scan_print_image(&job->image);
 
-		if (vhd.file)
-			vhd_close(&vhd);
-		if (image.name != target->name)
-			free(image.name);
-		free(image.parent);
+				if (flags & VHD_SCAN_PARENTS &&
+				    job->image.parent)
+					vhd_util_scan_add_parent(&itr,
+								 &job->vhd,
+								 &job->image);
 
-		if (err && !(flags & VHD_SCAN_NOFAIL))
-			break;
+				if (err && !(flags & VHD_SCAN_NOFAIL))
+					stop = 1;
+			}
+
+			if (job->vhd.file)
+				vhd_close(&job->vhd);
+			if (job->image.name != job->target.name)
+				free(job->image.name);
+			free(job->image.parent);
+		}
 	}
 
 	iterator_free(&itr);
+	free(jobs);
 
 	if (flags & VHD_SCAN_NOFAIL)
 		return ret;
@@ -36,9 +36,14 @@
 #include <termios.h>
 #include <stdarg.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <assert.h>
 #include <sys/types.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define USE_EPOLL
+#endif
 #if defined(__NetBSD__) || defined(__OpenBSD__)
 #include <util.h>
 #elif defined(__linux__)
@@ -61,6 +66,13 @@
 /* Duration of each time period in ms */
 #define RATE_LIMIT_PERIOD 200
 
+/* Passes over a console ring per event, before yielding to other consoles */
+#define RING_DRAIN_PASSES 4
+/* Log fragments gathered into each writev() */
+#define LOG_IOV_MAX 64
+/* Ready fds collected per wait */
+#define MAX_READY 256
+
 extern int log_reload;
 extern int log_guest;
 extern int log_hv;
@@ -75,11 +87,42 @@ static int log_hv_fd = -1;
 
 static xengnttab_handle *xgt_handle = NULL;
 
-static struct pollfd  *fds;
-static unsigned int current_array_size;
-static unsigned int nr_fds;
+/*
+ * Each fd of interest is described by a persistent watch, registered once
+ * and only updated when the events wanted on it change, so that a loop
+ * iteration costs in proportion to the fds which are ready rather than to
+ * the number of domains.
+ */
+enum watch_type {
+	WATCH_XS,
+	WATCH_HV,
+	WATCH_RING,
+	WATCH_TTY,
+};
+
+struct io_watch {
+	enum watch_type type;
+	int fd;			/* registered fd, -1 if none */
+	short events;		/* POLLIN/POLLOUT/POLLPRI wanted */
+	short revents;		/* returned by io_wait() */
+	struct console *con;
+#ifndef USE_EPOLL
+	int idx;		/* index in watches[] */
+#endif
+};
+
+#ifdef USE_EPOLL
+static int epoll_fd = -1;
+#else
+static struct io_watch **watches;
+static struct pollfd *fds;
+static unsigned int nr_watches, watches_size;
+#endif
 
-#define ROUNDUP(_x,_w) (((unsigned long)(_x)+(1UL<<(_w))-1) & ~((1UL<<(_w))-1))
+static struct io_watch *ready[MAX_READY];
+
+/* Current time in ms, as of the last wait */
+static long long io_now;
 
 struct buffer {
 	char *data;
@@ -92,7 +135,7 @@ struct buffer {
 struct console {
 	char *ttyname;
 	int master_fd;
-	int master_pollfd_idx;
+	struct io_watch master_watch;
 	int slave_fd;
 	int log_fd;
 	struct buffer buffer;
@@ -100,9 +143,11 @@ struct console {
 	char *log_suffix;
 	int ring_ref;
 	xenevtchn_handle *xce_handle;
-	int xce_pollfd_idx;
+	struct io_watch xce_watch;
 	int event_count;
 	long long next_period;
+	struct console *next_limited;	/* on the rate limited list */
+	bool limited;
 	xenevtchn_port_or_error_t local_port;
 	xenevtchn_port_or_error_t remote_port;
 	struct xencons_interface *interface;
@@ -150,6 +195,12 @@ struct domain {
 
 static struct domain *dom_head;
 
+/* Consoles whose event channel is masked until their period expires */
+static struct console *limited_head;
+
+/* Set when some domain may need shutting down or cleaning up */
+static bool reap_needed;
+
 typedef void (*VOID_ITER_FUNC_ARG1)(struct console *);
 typedef int (*INT_ITER_FUNC_ARG1)(struct console *);
 typedef void (*VOID_ITER_FUNC_ARG2)(struct console *,  void *);
@@ -242,6 +293,28 @@ static int write_all(int fd, const char* buf, size_t len)
 	return 0;
 }
 
+static int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt) {
+		ssize_t ret = writev(fd, iov, iovcnt);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		while (iovcnt && ret >= (ssize_t)iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
 static int write_with_timestamp(int fd, const char *data, size_t sz,
 				int *needts)
 {
@@ -250,16 +323,27 @@ static int write_with_timestamp(int fd, const char *data, size_t sz,
 	const struct tm *tmnow = localtime(&now);
 	size_t tslen = strftime(ts, sizeof(ts), "[%Y-%m-%d %H:%M:%S] ", tmnow);
 	const char *last_byte = data + sz - 1;
+	struct iovec iov[LOG_IOV_MAX];
+	int n = 0;
 
+	/* Gather the timestamps and lines, so that they go out together. */
 	while (data <= last_byte) {
 		const char *nl = memchr(data, '\n', last_byte + 1 - data);
 		int found_nl = (nl != NULL);
 		if (!found_nl)
 			nl = last_byte;
 
-		if ((*needts && write_all(fd, ts, tslen))
-		    || write_all(fd, data, nl + 1 - data))
-			return -1;
+		if (n + 2 > LOG_IOV_MAX) {
+			if (writev_all(fd, iov, n))
+				return -1;
+			n = 0;
+		}
+		if (*needts) {
+			iov[n].iov_base = ts;
+			iov[n++].iov_len = tslen;
+		}
+		iov[n].iov_base = (char *)data;
+		iov[n++].iov_len = nl + 1 - data;
 
 		*needts = found_nl;
 		data = nl + 1;
@@ -270,7 +354,7 @@ static int write_with_timestamp(int fd, const char *data, size_t sz,
 		}
 	}
 
-	return 0;
+	return n ? writev_all(fd, iov, n) : 0;
 }
 
 static inline bool buffer_available(struct console *con)
@@ -289,30 +373,43 @@ static void buffer_append(struct console *con)
 	struct domain *dom = con->d;
 	XENCONS_RING_IDX cons, prod, size;
 	struct xencons_interface *intf = con->interface;
+	size_t start = buffer->size;
+	unsigned int pass;
 
-	cons = intf->out_cons;
-	prod = intf->out_prod;
-	xen_mb();
+	/*
+	 * Keep draining while the guest keeps producing, so that one
+	 * notification and one log write cover everything it sent.
+	 */
+	for (pass = 0; pass < RING_DRAIN_PASSES; pass++) {
+		cons = intf->out_cons;
+		prod = intf->out_prod;
+		xen_mb();
 
-	size = prod - cons;
-	if ((size == 0) || (size > sizeof(intf->out)))
-		return;
+		size = prod - cons;
+		if ((size == 0) || (size > sizeof(intf->out)))
+			break;
 
-	if ((buffer->capacity - buffer->size) < size) {
-		buffer->capacity += (size + 1024);
-		buffer->data = realloc(buffer->data, buffer->capacity);
-		if (buffer->data == NULL) {
-			dolog(LOG_ERR, "Memory allocation failed");
-			exit(ENOMEM);
+		if ((buffer->capacity - buffer->size) < size) {
+			buffer->capacity += (size + 1024);
+			buffer->data = realloc(buffer->data, buffer->capacity);
+			if (buffer->data == NULL) {
+				dolog(LOG_ERR, "Memory allocation failed");
+				exit(ENOMEM);
+			}
 		}
+
+		while (cons != prod)
+			buffer->data[buffer->size++] = intf->out[
+				MASK_XENCONS_IDX(cons++, intf->out)];
+
+		xen_mb();
+		intf->out_cons = cons;
 	}
 
-	while (cons != prod)
-		buffer->data[buffer->size++] = intf->out[
-			MASK_XENCONS_IDX(cons++, intf->out)];
+	size = buffer->size - start;
+	if (size == 0)
+		return;
 
-	xen_mb();
-	intf->out_cons = cons;
 	xenevtchn_notify(con->xce_handle, con->local_port);
 
 	/* Get the data to the logfile as early as possible because if
@@ -465,9 +562,15 @@ static int create_console_log(struct console *con)
 	return fd;
 }
 
+static void watch_init(struct io_watch *w, enum watch_type type,
+		       struct console *con);
+static void watch_set(struct io_watch *w, int fd, short events);
+static void console_update_watches(struct console *con);
+
 static void console_close_tty(struct console *con)
 {
 	if (con->master_fd != -1) {
+		watch_set(&con->master_watch, -1, 0);
 		close(con->master_fd);
 		con->master_fd = -1;
 	}
@@ -725,8 +828,10 @@ static int console_create_ring(struct console *con)
 
 	con->local_port = -1;
 	con->remote_port = -1;
-	if (con->xce_handle != NULL)
+	if (con->xce_handle != NULL) {
+		watch_set(&con->xce_watch, -1, 0);
 		xenevtchn_close(con->xce_handle);
+	}
 
 	/* Opening evtchn independently for each console is a bit
 	 * wasteful, but that's how the code is structured... */
@@ -763,6 +868,7 @@ static int console_create_ring(struct console *con)
 		con->log_fd = create_console_log(con);
 
  out:
+	console_update_watches(con);
 	return err;
 }
 
@@ -801,13 +907,13 @@ static int console_init(struct console *con, struct domain *dom, void **data)
 	}
 
 	con->master_fd = -1;
-	con->master_pollfd_idx = -1;
+	watch_init(&con->master_watch, WATCH_TTY, con);
 	con->slave_fd = -1;
 	con->log_fd = -1;
 	con->ring_ref = -1;
 	con->local_port = -1;
 	con->remote_port = -1;
-	con->xce_pollfd_idx = -1;
+	watch_init(&con->xce_watch, WATCH_RING, con);
 	con->next_period = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000) + RATE_LIMIT_PERIOD;
 	con->d = dom;
 	con->ttyname = (*con_type)->ttyname;
@@ -895,6 +1001,15 @@ static void remove_domain(struct domain *dom)
 
 static void console_cleanup(struct console *con)
 {
+	struct console **pp;
+
+	for (pp = &limited_head; *pp; pp = &(*pp)->next_limited) {
+		if (*pp == con) {
+			*pp = con->next_limited;
+			break;
+		}
+	}
+
 	if (con->log_fd != -1) {
 		close(con->log_fd);
 		con->log_fd = -1;
@@ -918,8 +1033,10 @@ static void cleanup_domain(struct domain *d)
 
 static void console_close_evtchn(struct console *con)
 {
-	if (con->xce_handle != NULL)
+	if (con->xce_handle != NULL) {
+		watch_set(&con->xce_watch, -1, 0);
 		xenevtchn_close(con->xce_handle);
+	}
 
 	con->xce_handle = NULL;
 }
@@ -927,6 +1044,7 @@ static void console_close_evtchn(struct console *con)
 static void shutdown_domain(struct domain *d)
 {
 	d->is_dead = true;
+	reap_needed = true;
 	watch_domain(d, false);
 	console_iter_void_arg1(d, console_unmap_interface);
 	console_iter_void_arg1(d, console_close_evtchn);
@@ -941,6 +1059,7 @@ static void enum_domains(void)
 	struct domain *dom;
 
 	enum_pass++;
+	reap_needed = true;
 
 	while (xc_domain_getinfo(xc, domid, 1, &dominfo) == 1) {
 		dom = lookup_domain(dominfo.domid);
@@ -1045,25 +1164,51 @@ static void handle_tty_write(struct console *con)
 	}
 }
 
-static void console_evtchn_unmask(struct console *con, void *data)
+/*
+ * Start a new rate limiting period if the current one has expired.
+ *
+ * CS 16257:955ee4fa1345 introduces a 5ms fuzz
+ * for select(), it is not clear poll() has
+ * similar behavior (returning a couple of ms
+ * sooner than requested) as well. Just leave
+ * the fuzz here. Remove it with a separate
+ * patch if necessary
+ */
+static bool console_period_expired(struct console *con)
 {
-	long long now = *(long long *)data;
+	if ((io_now + 5) <= con->next_period)
+		return false;
 
-	if (!console_enabled(con))
-		return;
+	con->next_period = io_now + RATE_LIMIT_PERIOD;
+	con->event_count = 0;
+	return true;
+}
 
-	/* CS 16257:955ee4fa1345 introduces a 5ms fuzz
-	 * for select(), it is not clear poll() has
-	 * similar behavior (returning a couple of ms
-	 * sooner than requested) as well. Just leave
-	 * the fuzz here. Remove it with a separate
-	 * patch if necessary */
-	if ((now+5) > con->next_period) {
-		con->next_period = now + RATE_LIMIT_PERIOD;
-		if (con->event_count >= RATE_LIMIT_ALLOWANCE)
-			(void)xenevtchn_unmask(con->xce_handle, con->local_port);
-		con->event_count = 0;
+/*
+ * Unmask the consoles whose rate limiting period has expired, and return
+ * the time at which the next one will, or 0 if none is limited.
+ */
+static long long console_unmask_limited(void)
+{
+	struct console **pp = &limited_head, *con;
+	long long next_timeout = 0;
+
+	while ((con = *pp) != NULL) {
+		if (console_period_expired(con)) {
+			*pp = con->next_limited;
+			con->limited = false;
+			if (console_enabled(con))
+				(void)xenevtchn_unmask(con->xce_handle,
+						       con->local_port);
+			console_update_watches(con);
+			continue;
+		}
+		if (!next_timeout || con->next_period < next_timeout)
+			next_timeout = con->next_period;
+		pp = &con->next_limited;
 	}
+
+	return next_timeout;
 }
 
 static void handle_ring_read(struct console *con)
@@ -1083,27 +1228,27 @@ static void handle_ring_read(struct console *con)
 		return;
 	}
 
+	console_period_expired(con);
 	con->event_count++;
 
 	buffer_append(con);
 
 	if (con->event_count < RATE_LIMIT_ALLOWANCE)
 		(void)xenevtchn_unmask(con->xce_handle, port);
+	else if (!con->limited) {
+		con->limited = true;
+		con->next_limited = limited_head;
+		limited_head = con;
+	}
 }
 
-static void handle_console_ring(struct console *con)
+static void handle_console_ring(struct console *con, short revents)
 {
-	if (con->event_count < RATE_LIMIT_ALLOWANCE) {
-		if (con->xce_handle != NULL &&
-		    con->xce_pollfd_idx != -1 &&
-		    !(fds[con->xce_pollfd_idx].revents &
-		      ~(POLLIN|POLLOUT|POLLPRI)) &&
-		    (fds[con->xce_pollfd_idx].revents &
-		     POLLIN))
-			handle_ring_read(con);
-	}
-
-	con->xce_pollfd_idx = -1;
+	if (con->event_count < RATE_LIMIT_ALLOWANCE &&
+	    con->xce_handle != NULL &&
+	    !(revents & ~(POLLIN|POLLOUT|POLLPRI)) &&
+	    (revents & POLLIN))
+		handle_ring_read(con);
 }
 
 static void handle_xs(void)
@@ -1190,107 +1335,219 @@ static void handle_log_reload(void)
 	}
 }
 
-/* Returns index inside fds array if succees, -1 if fail */
-static int set_fds(int fd, short events)
+static void watch_init(struct io_watch *w, enum watch_type type,
+		       struct console *con)
 {
-	int ret;
-	if (current_array_size < nr_fds + 1) {
-		struct pollfd  *new_fds = NULL;
-		unsigned long newsize;
+	w->type = type;
+	w->fd = -1;
+	w->events = 0;
+	w->revents = 0;
+	w->con = con;
+#ifndef USE_EPOLL
+	w->idx = -1;
+#endif
+}
 
-		/* Round up to 2^8 boundary, in practice this just
-		 * make newsize larger than current_array_size.
-		 */
-		newsize = ROUNDUP(nr_fds + 1, 8);
+#ifdef USE_EPOLL
 
-		new_fds = realloc(fds, sizeof(struct pollfd)*newsize);
-		if (!new_fds)
-			goto fail;
-		fds = new_fds;
+static int io_init(void)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		dolog(LOG_ERR, "Failed to create epoll instance: %d (%s)",
+		      errno, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
 
-		memset(&fds[0] + current_array_size, 0,
-		       sizeof(struct pollfd) * (newsize-current_array_size));
-		current_array_size = newsize;
+static void io_fini(void)
+{
+	if (epoll_fd != -1)
+		close(epoll_fd);
+	epoll_fd = -1;
+}
+
+/* Register @fd for @events on @w, or unregister it if either is unset. */
+static void watch_set(struct io_watch *w, int fd, short events)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = w };
+
+	if (fd == -1 || !events) {
+		if (w->fd != -1)
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->fd, NULL);
+		w->fd = -1;
+		w->events = 0;
+		w->revents = 0;
+		return;
+	}
+
+	if (w->fd == fd) {
+		if (w->events == events)
+			return;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0) {
+			w->events = events;
+			return;
+		}
 	}
 
-	fds[nr_fds].fd = fd;
-	fds[nr_fds].events = events;
-	ret = nr_fds;
-	nr_fds++;
+	if (w->fd != -1)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->fd, NULL);
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		dolog(LOG_ERR, "epoll_ctl failed, ignoring fd %d: %d (%s)",
+		      fd, errno, strerror(errno));
+		w->fd = -1;
+		w->events = 0;
+		return;
+	}
+	w->fd = fd;
+	w->events = events;
+}
+
+/* Wait for watches to become ready, and collect them in ready[]. */
+static int io_wait(int timeout)
+{
+	struct epoll_event evs[MAX_READY];
+	int i, ret;
+
+	ret = epoll_wait(epoll_fd, evs, MAX_READY, timeout);
+	for (i = 0; i < ret; i++) {
+		ready[i] = evs[i].data.ptr;
+		ready[i]->revents = evs[i].events;
+	}
 
 	return ret;
-fail:
-	dolog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
-	return -1;
 }
 
-static void reset_fds(void)
+#else /* !USE_EPOLL */
+
+static int io_init(void)
 {
-	nr_fds = 0;
-	if (fds)
-		memset(fds, 0, sizeof(struct pollfd) * current_array_size);
+	return 0;
 }
 
-static void maybe_add_console_evtchn_fd(struct console *con, void *data)
+static void io_fini(void)
 {
-	long long next_timeout = *((long long *)data);
+	free(watches);
+	free(fds);
+	watches = NULL;
+	fds = NULL;
+	nr_watches = watches_size = 0;
+}
 
-	if (con->event_count >= RATE_LIMIT_ALLOWANCE) {
-		/* Determine if we're going to be the next time slice to expire */
-		if (!next_timeout ||
-		    con->next_period < next_timeout)
-			next_timeout = con->next_period;
-	} else if (con->xce_handle != NULL) {
-		if (buffer_available(con)) {
-			int evtchn_fd = xenevtchn_fd(con->xce_handle);
-			con->xce_pollfd_idx = set_fds(evtchn_fd,
-						      POLLIN|POLLPRI);
+static void watch_set(struct io_watch *w, int fd, short events)
+{
+	if (fd == -1 || !events) {
+		if (w->idx != -1) {
+			watches[w->idx] = watches[--nr_watches];
+			watches[w->idx]->idx = w->idx;
+			w->idx = -1;
+		}
+		w->fd = -1;
+		w->events = 0;
+		w->revents = 0;
+		return;
+	}
+
+	if (w->idx == -1) {
+		if (nr_watches == watches_size) {
+			unsigned int newsize = watches_size ? watches_size * 2 : 64;
+			struct io_watch **new_watches;
+			struct pollfd *new_fds;
+
+			new_watches = realloc(watches,
+					      sizeof(*watches) * newsize);
+			if (new_watches)
+				watches = new_watches;
+			new_fds = realloc(fds, sizeof(*fds) * newsize);
+			if (new_fds)
+				fds = new_fds;
+			if (!new_watches || !new_fds) {
+				dolog(LOG_ERR, "realloc failed, ignoring fd %d\n",
+				      fd);
+				return;
+			}
+			watches_size = newsize;
 		}
+		w->idx = nr_watches++;
+		watches[w->idx] = w;
+	}
+	w->fd = fd;
+	w->events = events;
+}
+
+static int io_wait(int timeout)
+{
+	unsigned int i;
+	int ret, n = 0;
+
+	for (i = 0; i < nr_watches; i++) {
+		fds[i].fd = watches[i]->fd;
+		fds[i].events = watches[i]->events;
+		fds[i].revents = 0;
 	}
 
-	*((long long *)data) = next_timeout;
+	ret = poll(fds, nr_watches, timeout);
+	if (ret <= 0)
+		return ret;
+
+	for (i = 0; i < nr_watches && n < MAX_READY; i++) {
+		if (!fds[i].revents)
+			continue;
+		watches[i]->revents = fds[i].revents;
+		ready[n++] = watches[i];
+	}
+
+	return n;
 }
 
-static void maybe_add_console_tty_fd(struct console *con)
+#endif /* USE_EPOLL */
+
+/* Bring a console's registrations in line with what it can handle now. */
+static void console_update_watches(struct console *con)
 {
+	short events = 0;
+
+	if (con->xce_handle != NULL && !con->d->is_dead &&
+	    con->event_count < RATE_LIMIT_ALLOWANCE && buffer_available(con))
+		events = POLLIN|POLLPRI;
+	watch_set(&con->xce_watch,
+		  con->xce_handle ? xenevtchn_fd(con->xce_handle) : -1,
+		  events);
+
+	events = 0;
 	if (con->master_fd != -1) {
-		short events = 0;
-		if (!con->d->is_dead && ring_free_bytes(con))
+		if (!con->d->is_dead && con->interface &&
+		    ring_free_bytes(con))
 			events |= POLLIN;
 
 		if (!buffer_empty(&con->buffer))
 			events |= POLLOUT;
-
-		if (events)
-			con->master_pollfd_idx =
-				set_fds(con->master_fd, events|POLLPRI);
 	}
+	watch_set(&con->master_watch, con->master_fd,
+		  events ? events|POLLPRI : 0);
 }
 
-static void handle_console_tty(struct console *con)
+static void handle_console_tty(struct console *con, short revents)
 {
-	if (con->master_fd != -1 && con->master_pollfd_idx != -1) {
-		if (fds[con->master_pollfd_idx].revents &
-		    ~(POLLIN|POLLOUT|POLLPRI))
-			console_handle_broken_tty(con, domain_is_valid(con->d->domid));
-		else {
-			if (fds[con->master_pollfd_idx].revents &
-			    POLLIN)
-				handle_tty_read(con);
-			if (fds[con->master_pollfd_idx].revents &
-			    POLLOUT)
-				handle_tty_write(con);
-		}
+	if (con->master_fd == -1)
+		return;
+
+	if (revents & ~(POLLIN|POLLOUT|POLLPRI))
+		console_handle_broken_tty(con, domain_is_valid(con->d->domid));
+	else {
+		if (revents & POLLIN)
+			handle_tty_read(con);
+		if ((revents & POLLOUT) && con->master_fd != -1)
+			handle_tty_write(con);
 	}
-	con->master_pollfd_idx = -1;
 }
 
 void handle_io(void)
 {
 	int ret;
 	xenevtchn_port_or_error_t log_hv_evtchn = -1;
-	int xce_pollfd_idx = -1;
-	int xs_pollfd_idx = -1;
+	struct io_watch xs_watch, hv_watch;
 	xenevtchn_handle *xce_handle = NULL;
 
 	if (log_hv) {
@@ -1319,48 +1576,41 @@ void handle_io(void)
 		      errno, strerror(errno));
 	}
 
+	if (io_init())
+		goto out;
+
+	watch_init(&xs_watch, WATCH_XS, NULL);
+	watch_set(&xs_watch, xs_fileno(xs), POLLIN|POLLPRI);
+	if (log_hv) {
+		watch_init(&hv_watch, WATCH_HV, NULL);
+		watch_set(&hv_watch, xenevtchn_fd(xce_handle), POLLIN|POLLPRI);
+	}
+
 	enum_domains();
 
 	for (;;) {
 		struct domain *d, *n;
-		int poll_timeout; /* timeout in milliseconds */
+		int i, poll_timeout = -1; /* timeout in milliseconds */
 		struct timespec ts;
-		long long now, next_timeout = 0;
-
-		reset_fds();
-
-		xs_pollfd_idx = set_fds(xs_fileno(xs), POLLIN|POLLPRI);
-
-		if (log_hv)
-			xce_pollfd_idx = set_fds(xenevtchn_fd(xce_handle),
-						 POLLIN|POLLPRI);
+		long long next_timeout;
 
 		if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
 			break;
-		now = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
-
-		/* Re-calculate any event counter allowances & unblock
-		   domains with new allowance */
-		for (d = dom_head; d; d = d->next) {
+		io_now = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
 
-			console_iter_void_arg2(d, console_evtchn_unmask, (void *)&now);
-
-			console_iter_void_arg2(d, maybe_add_console_evtchn_fd, 
-					       (void *)&next_timeout);
-
-			console_iter_void_arg1(d, maybe_add_console_tty_fd);
-		}
+		/* Unblock rate limited consoles with a new allowance. */
+		next_timeout = console_unmask_limited();
 
 		/* If any domain has been rate limited, we need to work
 		   out what timeout to supply to poll */
 		if (next_timeout) {
-			long long duration = (next_timeout - now);
+			long long duration = (next_timeout - io_now);
 			if (duration <= 0) /* sanity check */
 				duration = 1;
 			poll_timeout = (int)duration;
 		}
 
-		ret = poll(fds, nr_fds, next_timeout ? poll_timeout : -1);
+		ret = io_wait(poll_timeout);
 
 		if (log_reload) {
 			int saved_errno = errno;
@@ -1381,41 +1631,64 @@ void handle_io(void)
 			break;
 		}
 
-		if (log_hv && xce_pollfd_idx != -1) {
-			if (fds[xce_pollfd_idx].revents & ~(POLLIN|POLLOUT|POLLPRI)) {
-				dolog(LOG_ERR,
-				      "Failure in poll xce_handle: %d (%s)",
-				      errno, strerror(errno));
-				break;
-			} else if (fds[xce_pollfd_idx].revents & POLLIN)
-				handle_hv_logs(xce_handle, false);
+		if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+			break;
+		io_now = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
 
-			xce_pollfd_idx = -1;
-		}
+		/*
+		 * Domains are only freed below, once every ready watch has
+		 * been handled, so the watches in ready[] stay valid.  A
+		 * watch unregistered by an earlier handler has no revents.
+		 */
+		for (i = 0; i < ret; i++) {
+			struct io_watch *w = ready[i];
+			short revents = w->revents;
 
-		if (ret <= 0)
-			continue;
+			w->revents = 0;
+			if (!revents)
+				continue;
+
+			switch (w->type) {
+			case WATCH_HV:
+				if (revents & ~(POLLIN|POLLOUT|POLLPRI)) {
+					dolog(LOG_ERR,
+					      "Failure in poll xce_handle: %d (%s)",
+					      errno, strerror(errno));
+					goto fail;
+				} else if (revents & POLLIN)
+					handle_hv_logs(xce_handle, false);
+				break;
+
+			case WATCH_XS:
+				if (revents & ~(POLLIN|POLLOUT|POLLPRI)) {
+					dolog(LOG_ERR,
+					      "Failure in poll xs_handle: %d (%s)",
+					      errno, strerror(errno));
+					goto fail;
+				} else if (revents & POLLIN)
+					handle_xs();
+				break;
 
-		if (xs_pollfd_idx != -1) {
-			if (fds[xs_pollfd_idx].revents & ~(POLLIN|POLLOUT|POLLPRI)) {
-				dolog(LOG_ERR,
-				      "Failure in poll xs_handle: %d (%s)",
-				      errno, strerror(errno));
+			case WATCH_RING:
+				handle_console_ring(w->con, revents);
+				console_update_watches(w->con);
 				break;
-			} else if (fds[xs_pollfd_idx].revents & POLLIN)
-				handle_xs();
 
-			xs_pollfd_idx = -1;
+			case WATCH_TTY:
+				handle_console_tty(w->con, revents);
+				console_update_watches(w->con);
+				break;
+			}
 		}
 
+		if (!reap_needed)
+			continue;
+		reap_needed = false;
+
 		for (d = dom_head; d; d = n) {
 
 			n = d->next;
 
-			console_iter_void_arg1(d, handle_console_ring);
-
-			console_iter_void_arg1(d, handle_console_tty);
-
 			if (d->last_seen != enum_pass)
 				shutdown_domain(d);
 
@@ -1424,8 +1697,8 @@ void handle_io(void)
 		}
 	}
 
-	free(fds);
-	current_array_size = 0;
+ fail:
+	io_fini();
 
  out:
 	if (log_hv_fd != -1) {
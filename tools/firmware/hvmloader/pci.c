@@ -37,6 +37,9 @@ uint64_t pci_hi_mem_start = 0, pci_hi_mem_end = 0;
 enum virtual_vga virtual_vga = VGA_none;
 unsigned long igd_opregion_pgbase = 0;
 
+/* Functions found by pci_setup(); later bus scans only look at these. */
+uint32_t pci_devfn_map[256 / 32];
+
 /* Check if the specified range conflicts with any reserved device memory. */
 static bool check_overlap_all(uint64_t start, uint64_t size)
 {
@@ -84,6 +87,7 @@ void pci_setup(void)
     uint32_t vga_devfn = 256;
     uint16_t class, vendor_id, device_id;
     unsigned int bar, pin, link, isa_irq;
+    bool single_function;
 
     /* Resources assignable to PCI devices via BARs. */
     struct resource {
@@ -144,14 +148,28 @@ void pci_setup(void)
     outb(0x4d0, (uint8_t)(PCI_ISA_IRQ_MASK >> 0));
     outb(0x4d1, (uint8_t)(PCI_ISA_IRQ_MASK >> 8));
 
-    /* Scan the PCI bus and map resources. */
+    /*
+     * Scan the PCI bus and map resources.  Every config space access traps
+     * to the device model, so follow the usual enumeration rules: a slot
+     * without function 0 is empty (libxl always places single passed
+     * through functions at function 0), and functions 1-7 are only probed
+     * if function 0 has the multi-function bit set in its header type.
+     */
     for ( devfn = 0; devfn < 256; devfn++ )
     {
-        class     = pci_readw(devfn, PCI_CLASS_DEVICE);
         vendor_id = pci_readw(devfn, PCI_VENDOR_ID);
-        device_id = pci_readw(devfn, PCI_DEVICE_ID);
-        if ( (vendor_id == 0xffff) && (device_id == 0xffff) )
+        if ( vendor_id == 0xffff )
+        {
+            if ( !(devfn & 7) )
+                devfn |= 7;
             continue;
+        }
+        device_id = pci_readw(devfn, PCI_DEVICE_ID);
+        class     = pci_readw(devfn, PCI_CLASS_DEVICE);
+
+        single_function = !(devfn & 7) &&
+                          !(pci_readb(devfn, PCI_HEADER_TYPE) & 0x80);
+        pci_devfn_map[devfn / 32] |= 1u << (devfn % 32);
 
         ASSERT((devfn != PCI_ISA_DEVFN) ||
                ((vendor_id == 0x8086) && (device_id == 0x7000)));
@@ -293,6 +311,9 @@ void pci_setup(void)
         cmd = pci_readw(devfn, PCI_COMMAND);
         cmd |= PCI_COMMAND_MASTER;
         pci_writew(devfn, PCI_COMMAND, cmd);
+
+        if ( single_function )
+            devfn |= 7;
     }
 
     if ( mmio_hole_size )
@@ -239,6 +239,13 @@ int hvm_param_set(uint32_t index, uint64_t value);
 /* Setup PCI bus */
 void pci_setup(void);
 
+/* Functions found by pci_setup(). */
+extern uint32_t pci_devfn_map[256 / 32];
+static inline bool pci_devfn_present(unsigned int devfn)
+{
+    return pci_devfn_map[devfn / 32] & (1u << (devfn % 32));
+}
+
 /* Setup memory map  */
 void memory_map_setup(void);
 
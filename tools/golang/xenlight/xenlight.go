@@ -19,7 +19,109 @@ package xenlight
 /*
 #cgo LDFLAGS: -lxenlight -lyajl -lxentoollog
 #include <stdlib.h>
+#include <stdint.h>
+#include <poll.h>
 #include <libxl.h>
+
+// Event loop glue.  libxl's osevent and ao completion callbacks are
+// bounced through these trampolines so that the Go side only ever
+// sees libxl's opaque pointers as integers (see osevents below).
+extern int xenlightFdRegister(uintptr_t user, int fd, uintptr_t *reg,
+                              short events, uintptr_t for_libxl);
+extern int xenlightFdModify(uintptr_t user, int fd, uintptr_t reg,
+                            short events);
+extern void xenlightFdDeregister(uintptr_t user, int fd, uintptr_t reg);
+extern int xenlightTimeoutRegister(uintptr_t user, uintptr_t *reg,
+                                   long sec, long usec, uintptr_t for_libxl);
+extern int xenlightTimeoutModify(uintptr_t user, uintptr_t reg);
+extern void xenlightAoComplete(uintptr_t ctx, int rc, uintptr_t for_callback);
+
+static inline int xenlight_fd_register(void *user, int fd, void **reg_out,
+                                       short events, void *for_libxl)
+{
+    uintptr_t reg = 0;
+    int rc = xenlightFdRegister((uintptr_t)user, fd, &reg, events,
+                                (uintptr_t)for_libxl);
+    if (!rc) *reg_out = (void *)reg;
+    return rc;
+}
+
+static inline int xenlight_fd_modify(void *user, int fd, void **reg_update,
+                                     short events)
+{
+    return xenlightFdModify((uintptr_t)user, fd, (uintptr_t)*reg_update,
+                            events);
+}
+
+static inline void xenlight_fd_deregister(void *user, int fd, void *reg)
+{
+    xenlightFdDeregister((uintptr_t)user, fd, (uintptr_t)reg);
+}
+
+static inline int xenlight_timeout_register(void *user, void **reg_out,
+                                            struct timeval abs,
+                                            void *for_libxl)
+{
+    uintptr_t reg = 0;
+    int rc = xenlightTimeoutRegister((uintptr_t)user, &reg,
+                                     abs.tv_sec, abs.tv_usec,
+                                     (uintptr_t)for_libxl);
+    if (!rc) *reg_out = (void *)reg;
+    return rc;
+}
+
+static inline int xenlight_timeout_modify(void *user, void **reg_update,
+                                          struct timeval abs)
+{
+    return xenlightTimeoutModify((uintptr_t)user, (uintptr_t)*reg_update);
+}
+
+static inline void xenlight_register_osevent_hooks(libxl_ctx *ctx)
+{
+    static const libxl_osevent_hooks hooks = {
+        .fd_register = xenlight_fd_register,
+        .fd_modify = xenlight_fd_modify,
+        .fd_deregister = xenlight_fd_deregister,
+        .timeout_register = xenlight_timeout_register,
+        .timeout_modify = xenlight_timeout_modify,
+    };
+
+    libxl_osevent_register_hooks(ctx, &hooks, ctx);
+}
+
+static inline void xenlight_osevent_occurred_fd(uintptr_t ctx,
+                                                uintptr_t for_libxl, int fd,
+                                                short events, short revents)
+{
+    libxl_osevent_occurred_fd((libxl_ctx *)ctx, (void *)for_libxl, fd,
+                              events, revents);
+}
+
+static inline void xenlight_osevent_occurred_timeout(uintptr_t ctx,
+                                                     uintptr_t for_libxl)
+{
+    libxl_osevent_occurred_timeout((libxl_ctx *)ctx, (void *)for_libxl);
+}
+
+static inline short xenlight_poll_fd(int fd, short events, int timeout)
+{
+    struct pollfd pfd = { .fd = fd, .events = events };
+
+    if (poll(&pfd, 1, timeout) <= 0)
+        return 0;
+    return pfd.revents;
+}
+
+static inline void xenlight_ao_callback(libxl_ctx *ctx, int rc, void *for_callback)
+{
+    xenlightAoComplete((uintptr_t)ctx, rc, (uintptr_t)for_callback);
+}
+
+static inline void xenlight_ao_how_init(libxl_asyncop_how *how, uintptr_t id)
+{
+    how->callback = xenlight_ao_callback;
+    how->u.for_callback = (void *)id;
+}
 */
 import "C"
 
@@ -33,6 +135,10 @@ import "C"
 
 import (
 	"fmt"
+	"os"
+	"sync"
+	"sync/atomic"
+	"syscall"
 	"time"
 	"unsafe"
 )
@@ -858,12 +964,19 @@ func (Ctx *Context) Open() (err error) {
 
 	if ret != 0 {
 		err = Error(-ret)
+		return
 	}
+
+	// Hand libxl's fds and timeouts to the Go runtime, so that
+	// in-flight asynchronous operations are driven by goroutines
+	// parked in the netpoller rather than by a thread per call.
+	C.xenlight_register_osevent_hooks(Ctx.ctx)
 	return
 }
 
 func (Ctx *Context) Close() (err error) {
 	ret := C.libxl_ctx_free(Ctx.ctx)
+	oseventsRelease(Ctx.ctx)
 	Ctx.ctx = nil
 
 	if ret != 0 {
@@ -880,6 +993,319 @@ func (Ctx *Context) CheckOpen() (err error) {
 	return
 }
 
+/*
+ * Event loop integration
+ *
+ * libxl's osevent hooks tell us which fds and timeouts it is
+ * interested in; each fd is watched by a goroutine blocked in the
+ * netpoller and each timeout is a runtime timer, and both call back
+ * into libxl_osevent_occurred_* when they fire.  Registrations and
+ * pending ao completions are handed to C as small integer ids, never
+ * as Go pointers.
+ *
+ * The registry lock is a "caller register lock" in the sense of
+ * libxl_event.h, rule (a): no libxl function is called with it held.
+ */
+
+type oseventRegistry struct {
+	sync.Mutex
+	next C.uintptr_t
+	m    map[C.uintptr_t]oseventEntry
+}
+
+type oseventEntry interface {
+	owner() C.uintptr_t
+	stop()
+}
+
+var osevents = oseventRegistry{m: make(map[C.uintptr_t]oseventEntry)}
+
+func (r *oseventRegistry) addLocked(e oseventEntry) (id C.uintptr_t) {
+	r.next++
+	if r.next == 0 {
+		r.next++
+	}
+	id = r.next
+	r.m[id] = e
+	return
+}
+
+func (r *oseventRegistry) add(e oseventEntry) C.uintptr_t {
+	r.Lock()
+	defer r.Unlock()
+
+	return r.addLocked(e)
+}
+
+func (r *oseventRegistry) get(id C.uintptr_t) oseventEntry {
+	r.Lock()
+	defer r.Unlock()
+
+	return r.m[id]
+}
+
+func (r *oseventRegistry) set(id C.uintptr_t, e oseventEntry) {
+	r.Lock()
+	defer r.Unlock()
+
+	r.m[id] = e
+}
+
+func (r *oseventRegistry) remove(id C.uintptr_t) oseventEntry {
+	r.Lock()
+	defer r.Unlock()
+
+	e := r.m[id]
+	delete(r.m, id)
+	return e
+}
+
+// oseventsRelease drops everything still registered against ctx once
+// libxl has let go of it.  Nothing may be in flight on ctx by then.
+func oseventsRelease(ctx *C.libxl_ctx) {
+	owner := C.uintptr_t(uintptr(unsafe.Pointer(ctx)))
+	var stale []oseventEntry
+
+	osevents.Lock()
+	for id, e := range osevents.m {
+		if e.owner() == owner {
+			stale = append(stale, e)
+			delete(osevents.m, id)
+		}
+	}
+	osevents.Unlock()
+
+	for _, e := range stale {
+		e.stop()
+	}
+}
+
+type fdWatcher struct {
+	ctx      C.uintptr_t
+	forLibxl C.uintptr_t
+	fd       int
+	events   C.short
+	file     *os.File
+	stopped  int32
+}
+
+func (w *fdWatcher) owner() C.uintptr_t { return w.ctx }
+
+func (w *fdWatcher) stop() {
+	if atomic.CompareAndSwapInt32(&w.stopped, 0, 1) {
+		w.file.Close()
+	}
+}
+
+func (w *fdWatcher) isStopped() bool {
+	return atomic.LoadInt32(&w.stopped) != 0
+}
+
+func newFdWatcher(ctx C.uintptr_t, fd int, events C.short,
+	forLibxl C.uintptr_t) (w *fdWatcher, err error) {
+	// Watch a duplicate so that closing our side to stop the
+	// goroutine never touches the descriptor libxl owns.
+	nfd, err := syscall.Dup(fd)
+	if err != nil {
+		return
+	}
+	syscall.CloseOnExec(nfd)
+
+	w = &fdWatcher{
+		ctx:      ctx,
+		forLibxl: forLibxl,
+		fd:       fd,
+		events:   events,
+		file:     os.NewFile(uintptr(nfd), "libxl-osevent"),
+	}
+	go w.run()
+	return
+}
+
+func (w *fdWatcher) run() {
+	rc, err := w.file.SyscallConn()
+	if err != nil {
+		w.runBlocking()
+		return
+	}
+
+	wait := rc.Read
+	if w.events&(C.POLLIN|C.POLLPRI) == 0 && w.events&C.POLLOUT != 0 {
+		wait = rc.Write
+	}
+
+	for !w.isStopped() {
+		var revents C.short
+		err := wait(func(fd uintptr) bool {
+			if w.isStopped() {
+				return true
+			}
+			revents = C.xenlight_poll_fd(C.int(fd), w.events, 0)
+			return revents != 0
+		})
+		if w.isStopped() {
+			return
+		}
+		if err != nil {
+			// Descriptors that are not in non-blocking mode
+			// cannot be parked in the netpoller.
+			w.runBlocking()
+			return
+		}
+		C.xenlight_osevent_occurred_fd(w.ctx, w.forLibxl, C.int(w.fd),
+			w.events, revents)
+	}
+}
+
+// runBlocking is the fallback for fds the netpoller refuses; it costs
+// a thread per fd while blocked, and wakes periodically to notice
+// deregistration.
+func (w *fdWatcher) runBlocking() {
+	for !w.isStopped() {
+		revents := C.xenlight_poll_fd(C.int(w.fd), w.events, 100)
+		if revents == 0 || w.isStopped() {
+			continue
+		}
+		C.xenlight_osevent_occurred_fd(w.ctx, w.forLibxl, C.int(w.fd),
+			w.events, revents)
+	}
+}
+
+type timeoutWatcher struct {
+	ctx      C.uintptr_t
+	forLibxl C.uintptr_t
+	id       C.uintptr_t
+	timer    *time.Timer
+	fired    int32
+}
+
+func (t *timeoutWatcher) owner() C.uintptr_t { return t.ctx }
+
+func (t *timeoutWatcher) stop() {
+	if atomic.CompareAndSwapInt32(&t.fired, 0, 1) {
+		t.timer.Stop()
+	}
+}
+
+// fire may race with timeout_modify asking for the timeout to occur
+// now; whichever gets there first reports it, exactly once.
+func (t *timeoutWatcher) fire() {
+	if !atomic.CompareAndSwapInt32(&t.fired, 0, 1) {
+		return
+	}
+	osevents.remove(t.id)
+	C.xenlight_osevent_occurred_timeout(t.ctx, t.forLibxl)
+}
+
+type aoWaiter struct {
+	ctx  C.uintptr_t
+	done chan error
+}
+
+func (a *aoWaiter) owner() C.uintptr_t { return a.ctx }
+
+func (a *aoWaiter) stop() {}
+
+//export xenlightFdRegister
+func xenlightFdRegister(user C.uintptr_t, fd C.int, reg *C.uintptr_t,
+	events C.short, forLibxl C.uintptr_t) C.int {
+	w, err := newFdWatcher(user, int(fd), events, forLibxl)
+	if err != nil {
+		return C.ERROR_OSEVENT_REG_FAIL
+	}
+	*reg = osevents.add(w)
+	return 0
+}
+
+//export xenlightFdModify
+func xenlightFdModify(user C.uintptr_t, fd C.int, reg C.uintptr_t,
+	events C.short) C.int {
+	old, ok := osevents.get(reg).(*fdWatcher)
+	if !ok {
+		return C.ERROR_OSEVENT_REG_FAIL
+	}
+
+	w, err := newFdWatcher(user, int(fd), events, old.forLibxl)
+	if err != nil {
+		return C.ERROR_OSEVENT_REG_FAIL
+	}
+	osevents.set(reg, w)
+	old.stop()
+	return 0
+}
+
+//export xenlightFdDeregister
+func xenlightFdDeregister(user C.uintptr_t, fd C.int, reg C.uintptr_t) {
+	if e := osevents.remove(reg); e != nil {
+		e.stop()
+	}
+}
+
+//export xenlightTimeoutRegister
+func xenlightTimeoutRegister(user C.uintptr_t, reg *C.uintptr_t,
+	sec C.long, usec C.long, forLibxl C.uintptr_t) C.int {
+	t := &timeoutWatcher{ctx: user, forLibxl: forLibxl}
+	abs := time.Unix(int64(sec), int64(usec)*int64(time.Microsecond))
+
+	// Hold the lock until the timer exists, so an early fire cannot
+	// find the registration half made.
+	osevents.Lock()
+	t.id = osevents.addLocked(t)
+	t.timer = time.AfterFunc(time.Until(abs), t.fire)
+	osevents.Unlock()
+
+	*reg = t.id
+	return 0
+}
+
+//export xenlightTimeoutModify
+func xenlightTimeoutModify(user C.uintptr_t, reg C.uintptr_t) C.int {
+	// libxl only ever modifies a timeout to make it occur now.
+	if t, ok := osevents.get(reg).(*timeoutWatcher); ok {
+		t.timer.Reset(0)
+	}
+	return 0
+}
+
+//export xenlightAoComplete
+func xenlightAoComplete(ctx C.uintptr_t, rc C.int, forCallback C.uintptr_t) {
+	a, ok := osevents.remove(forCallback).(*aoWaiter)
+	if !ok {
+		return
+	}
+	if rc != 0 {
+		a.done <- Error(-rc)
+	} else {
+		a.done <- nil
+	}
+}
+
+// aoStart runs a libxl long-running operation asynchronously.  The
+// returned channel yields exactly one value, the operation's result,
+// once libxl reports completion.
+func (Ctx *Context) aoStart(start func(how *C.libxl_asyncop_how) C.int) <-chan error {
+	done := make(chan error, 1)
+
+	if err := Ctx.CheckOpen(); err != nil {
+		done <- err
+		return done
+	}
+
+	ctx := C.uintptr_t(uintptr(unsafe.Pointer(Ctx.ctx)))
+	id := osevents.add(&aoWaiter{ctx: ctx, done: done})
+
+	var how C.libxl_asyncop_how
+	C.xenlight_ao_how_init(&how, id)
+
+	// The callback may already have run by the time start returns.
+	ret := start(&how)
+	if ret != 0 {
+		osevents.remove(id)
+		done <- Error(-ret)
+	}
+	return done
+}
+
 //int libxl_get_max_cpus(libxl_ctx *ctx);
 func (Ctx *Context) GetMaxCpus() (maxCpus int, err error) {
 	err = Ctx.CheckOpen()
@@ -1064,6 +1490,52 @@ func (Ctx *Context) DomainReboot(id Domid) (err error) {
 	return
 }
 
+//int libxl_domain_destroy(libxl_ctx *ctx, uint32_t domid,
+//                         const libxl_asyncop_how *ao_how);
+func (Ctx *Context) DomainDestroy(id Domid) (err error) {
+	return <-Ctx.DomainDestroyAsync(id)
+}
+
+func (Ctx *Context) DomainDestroyAsync(id Domid) <-chan error {
+	return Ctx.aoStart(func(how *C.libxl_asyncop_how) C.int {
+		return C.libxl_domain_destroy(Ctx.ctx, C.uint32_t(id), how)
+	})
+}
+
+//int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd,
+//                         int flags, const libxl_asyncop_how *ao_how);
+func (Ctx *Context) DomainSuspendAsync(id Domid, fd *os.File, flags int) <-chan error {
+	return Ctx.aoStart(func(how *C.libxl_asyncop_how) C.int {
+		return C.libxl_domain_suspend(Ctx.ctx, C.uint32_t(id),
+			C.int(fd.Fd()), C.int(flags), how)
+	})
+}
+
+//int libxl_domain_resume(libxl_ctx *ctx, uint32_t domid, int suspend_cancel,
+//                        const libxl_asyncop_how *ao_how);
+func (Ctx *Context) DomainResumeAsync(id Domid, suspendCancel bool) <-chan error {
+	var cancel C.int
+	if suspendCancel {
+		cancel = 1
+	}
+	return Ctx.aoStart(func(how *C.libxl_asyncop_how) C.int {
+		return C.libxl_domain_resume(Ctx.ctx, C.uint32_t(id), cancel, how)
+	})
+}
+
+//int libxl_domain_core_dump(libxl_ctx *ctx, uint32_t domid,
+//                           const char *filename,
+//                           const libxl_asyncop_how *ao_how);
+func (Ctx *Context) DomainCoreDumpAsync(id Domid, filename string) <-chan error {
+	return Ctx.aoStart(func(how *C.libxl_asyncop_how) C.int {
+		// libxl copies what it needs before returning.
+		cfilename := C.CString(filename)
+		defer C.free(unsafe.Pointer(cfilename))
+		return C.libxl_domain_core_dump(Ctx.ctx, C.uint32_t(id),
+			cfilename, how)
+	})
+}
+
 //libxl_dominfo * libxl_list_domain(libxl_ctx*, int *nb_domain_out);
 //void libxl_dominfo_list_free(libxl_dominfo *list, int nb_domain);
 func (Ctx *Context) ListDomain() (glist []Dominfo) {
@@ -52,6 +52,9 @@ fsi_t *fsi_open_fsimage(const char *path, uint64_t off, const char *options)
 	fsi->f_off = off;
 	fsi->f_data = NULL;
 	fsi->f_bootstring = NULL;
+	fsi->f_ra_buf = NULL;
+	fsi->f_ra_off = 0;
+	fsi->f_ra_len = 0;
 
 	pthread_mutex_lock(&fsi_lock);
 	err = find_plugin(fsi, path, options);
@@ -75,6 +78,7 @@ void fsi_close_fsimage(fsi_t *fsi)
 	pthread_mutex_lock(&fsi_lock);
         fsi->f_plugin->fp_ops->fpo_umount(fsi);
         (void) close(fsi->f_fd);
+	free(fsi->f_ra_buf);
 	free(fsi);
 	pthread_mutex_unlock(&fsi_lock);
 }
@@ -142,6 +146,26 @@ ssize_t fsi_pread_file(fsi_file_t *ffi, void *buf, size_t nbytes, uint64_t off)
 	return (ret);
 }
 
+int fsi_stat_file(fsi_file_t *ffi, fsi_stat_t *st)
+{
+	fsi_plugin_ops_t *ops;
+	int err;
+
+	bzero(st, sizeof (*st));
+
+	pthread_mutex_lock(&fsi_lock);
+	ops = ffi->ff_fsi->f_plugin->fp_ops;
+	if (ops->fpo_version < 2 || ops->fpo_stat == NULL) {
+		errno = ENOTSUP;
+		err = -1;
+	} else {
+		err = ops->fpo_stat(ffi, st);
+	}
+	pthread_mutex_unlock(&fsi_lock);
+
+	return (err);
+}
+
 char *
 fsi_bootstring_alloc(fsi_t *fsi, size_t len)
 {
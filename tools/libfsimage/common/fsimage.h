@@ -35,6 +35,18 @@ extern C {
 typedef struct fsi fsi_t;
 typedef struct fsi_file fsi_file_t;
 
+/*
+ * Identity of a file within the image.  Plugins that cannot supply a
+ * field leave it zero; fs_size is always valid.
+ */
+typedef struct fsi_stat {
+	uint64_t fs_size;
+	uint64_t fs_ino;
+	uint32_t fs_gen;
+	int64_t fs_mtime;
+	int64_t fs_ctime;
+} fsi_stat_t;
+
 fsi_t *fsi_open_fsimage(const char *, uint64_t, const char *);
 void fsi_close_fsimage(fsi_t *);
 
@@ -44,6 +56,7 @@ int fsi_close_file(fsi_file_t *);
 
 ssize_t fsi_read_file(fsi_file_t *, void *, size_t);
 ssize_t fsi_pread_file(fsi_file_t *, void *, size_t, uint64_t);
+int fsi_stat_file(fsi_file_t *, fsi_stat_t *);
 
 char *fsi_bootstring_alloc(fsi_t *, size_t);
 void fsi_bootstring_free(fsi_t *);
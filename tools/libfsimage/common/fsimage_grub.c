@@ -33,6 +33,14 @@
 
 static char *disk_read_junk;
 
+/*
+ * The grub filesystem code reads the image a block or a sector at a time.
+ * Small reads are served from a per-image window of FSIG_RA_SIZE bytes so
+ * that walking a kernel's block lists turns into a few large sequential
+ * preads instead of thousands of small ones.
+ */
+#define	FSIG_RA_SIZE	(256 * 1024)
+
 typedef struct fsig_data {
 	char fd_buf[FSYS_BUFLEN];
 } fsig_data_t;
@@ -154,6 +162,40 @@ fsig_log2 (unsigned long word)
 }
 #endif
 
+static int
+fsig_devread_ra(fsi_t *fsi, off_t off, unsigned int bufsize, char *buf)
+{
+	off_t start;
+	ssize_t ret;
+
+	if (fsi->f_ra_buf != NULL && off >= fsi->f_ra_off &&
+	    off + bufsize <= fsi->f_ra_off + fsi->f_ra_len) {
+		memcpy(buf, fsi->f_ra_buf + (off - fsi->f_ra_off), bufsize);
+		return (1);
+	}
+
+	if (fsi->f_ra_buf == NULL &&
+	    (fsi->f_ra_buf = malloc(FSIG_RA_SIZE)) == NULL)
+		return (0);
+
+	/* Keep the window sector-aligned, as below. */
+	start = off & ~(off_t)(SECTOR_SIZE - 1);
+	ret = pread(fsi->f_fd, fsi->f_ra_buf, FSIG_RA_SIZE, start);
+	if (ret < 0) {
+		fsi->f_ra_len = 0;
+		return (0);
+	}
+
+	fsi->f_ra_off = start;
+	fsi->f_ra_len = ret;
+
+	if (off + bufsize > start + ret)
+		return (0);
+
+	memcpy(buf, fsi->f_ra_buf + (off - start), bufsize);
+	return (1);
+}
+
 int
 fsig_devread(fsi_file_t *ffi, unsigned int sector, unsigned int offset,
     unsigned int bufsize, char *buf)
@@ -165,6 +207,9 @@ fsig_devread(fsi_file_t *ffi, unsigned int sector, unsigned int offset,
 
 	off = ffi->ff_fsi->f_off + ((off_t)sector * SECTOR_SIZE) + offset;
 
+	if (bufsize < FSIG_RA_SIZE)
+		return (fsig_devread_ra(ffi->ff_fsi, off, bufsize, buf));
+
 	/*
 	 * Make reads from a raw disk sector-aligned. This is a requirement
 	 * for NetBSD. Split the read up into to three parts to meet this
@@ -310,6 +355,16 @@ fsig_read(fsi_file_t *ffi, void *buf, size_t nbytes)
 	return (ret);
 }
 
+static int
+fsig_stat(fsi_file_t *ffi, fsi_stat_t *st)
+{
+	fsig_file_data_t *data = fsip_file_data(ffi);
+
+	/* The grub filesystem code only tells us the size. */
+	st->fs_size = data->ffd_filemax;
+	return (0);
+}
+
 static int
 fsig_close(fsi_file_t *ffi)
 {
@@ -325,7 +380,8 @@ static fsi_plugin_ops_t fsig_grub_ops = {
 	.fpo_open = fsig_open,
 	.fpo_read = fsig_read,
 	.fpo_pread = fsig_pread,
-	.fpo_close = fsig_close
+	.fpo_close = fsig_close,
+	.fpo_stat = fsig_stat
 };
 
 fsi_plugin_ops_t *
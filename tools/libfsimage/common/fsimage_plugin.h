@@ -32,7 +32,7 @@ extern C {
 
 #include "fsimage.h"
 
-#define	FSIMAGE_PLUGIN_VERSION 1
+#define	FSIMAGE_PLUGIN_VERSION 2
 
 typedef struct fsi_plugin fsi_plugin_t;
 
@@ -44,6 +44,8 @@ typedef struct fsi_plugin_ops {
 	ssize_t (*fpo_read)(fsi_file_t *, void *, size_t);
 	ssize_t (*fpo_pread)(fsi_file_t *, void *, size_t, uint64_t);
 	int (*fpo_close)(fsi_file_t *);
+	/* Version 2 and later; may be NULL. */
+	int (*fpo_stat)(fsi_file_t *, fsi_stat_t *);
 } fsi_plugin_ops_t;
 
 typedef fsi_plugin_ops_t *
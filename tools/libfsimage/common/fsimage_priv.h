@@ -47,6 +47,10 @@ struct fsi {
 	void *f_data;
 	fsi_plugin_t *f_plugin;
 	char *f_bootstring;
+	/* Readahead window over the underlying image, see fsig_devread(). */
+	char *f_ra_buf;
+	uint64_t f_ra_off;
+	size_t f_ra_len;
 };
 
 struct fsi_file {
@@ -26,6 +26,15 @@
 #include <errno.h>
 #include <inttypes.h>
 
+/*
+ * Per-file data; the ext2_file_t comes first so the read paths can keep
+ * treating fsip_file_data() as an ext2_file_t *.
+ */
+typedef struct ext2lib_file {
+	ext2_file_t ef_file;
+	ext2_ino_t ef_ino;
+} ext2lib_file_t;
+
 static int
 ext2lib_mount(fsi_t *fsi, const char *name, const char *options)
 {
@@ -71,6 +80,7 @@ ext2lib_open(fsi_t *fsi, const char *path)
 {
 	ext2_ino_t ino;
 	ext2_filsys *fs = fsip_fs_data(fsi);
+	ext2lib_file_t *ef;
 	ext2_file_t *f;
 	fsi_file_t *file;
 	int err;
@@ -83,21 +93,23 @@ ext2lib_open(fsi_t *fsi, const char *path)
 		return (NULL);
 	}
 
-	f = malloc(sizeof (*f));
-	if (f == NULL)
+	ef = malloc(sizeof (*ef));
+	if (ef == NULL)
 		return (NULL);
+	ef->ef_ino = ino;
+	f = &ef->ef_file;
 
 	err = ext2fs_file_open(*fs, ino, 0, f);
 
 	if (err != 0) {
-		free(f);
+		free(ef);
 		errno = EINVAL;
 		return (NULL);
 	}
 
-	file = fsip_file_alloc(fsi, f);
+	file = fsip_file_alloc(fsi, ef);
 	if (file == NULL)
-		free(f);
+		free(ef);
 	return (file);
 }
 
@@ -147,12 +159,26 @@ ext2lib_pread(fsi_file_t *file, void *buf, size_t nbytes, uint64_t off)
 	return (n);
 }
 
+int
+ext2lib_stat(fsi_file_t *file, fsi_stat_t *st)
+{
+	ext2lib_file_t *ef = fsip_file_data(file);
+	struct ext2_inode *inode = ext2fs_file_get_inode(ef->ef_file);
+
+	st->fs_size = EXT2_I_SIZE(inode);
+	st->fs_ino = ef->ef_ino;
+	st->fs_gen = inode->i_generation;
+	st->fs_mtime = inode->i_mtime;
+	st->fs_ctime = inode->i_ctime;
+	return (0);
+}
+
 int
 ext2lib_close(fsi_file_t *file)
 {
-	ext2_file_t *f = fsip_file_data(file);
-	ext2fs_file_close(*f);
-	free(f);
+	ext2lib_file_t *ef = fsip_file_data(file);
+	ext2fs_file_close(ef->ef_file);
+	free(ef);
 	return (0);
 }
 
@@ -166,7 +192,8 @@ fsi_init_plugin(int version, fsi_plugin_t *fp, const char **name)
 		.fpo_open = ext2lib_open,
 		.fpo_read = ext2lib_read,
 		.fpo_pread = ext2lib_pread,
-		.fpo_close = ext2lib_close
+		.fpo_close = ext2lib_close,
+		.fpo_stat = ext2lib_stat
 	};
 
 	*name = "ext2fs-lib";
@@ -49,6 +49,7 @@ static void cache_unlock(xencall_handle *xcall)
 static void *cache_alloc(xencall_handle *xcall, size_t nr_pages)
 {
     void *p = NULL;
+    int i;
 
     cache_lock(xcall);
 
@@ -57,13 +58,22 @@ static void *cache_alloc(xencall_handle *xcall, size_t nr_pages)
     if ( xcall->buffer_current_allocations > xcall->buffer_maximum_allocations )
         xcall->buffer_maximum_allocations = xcall->buffer_current_allocations;
 
-    if ( nr_pages > 1 )
+    if ( nr_pages > BUFFER_CACHE_MAX_PAGES )
     {
         xcall->buffer_cache_toobig++;
+        goto out;
     }
-    else if ( xcall->buffer_cache_nr > 0 )
+
+    for ( i = xcall->buffer_cache_nr - 1; i >= 0; i-- )
+        if ( xcall->buffer_cache[i].nr_pages == nr_pages )
+            break;
+
+    if ( i >= 0 )
     {
-        p = xcall->buffer_cache[--xcall->buffer_cache_nr];
+        p = xcall->buffer_cache[i].p;
+        xcall->buffer_cache_pages -= nr_pages;
+        memmove(&xcall->buffer_cache[i], &xcall->buffer_cache[i + 1],
+                (--xcall->buffer_cache_nr - i) * sizeof(xcall->buffer_cache[0]));
         xcall->buffer_cache_hits++;
     }
     else
@@ -71,6 +81,7 @@ static void *cache_alloc(xencall_handle *xcall, size_t nr_pages)
         xcall->buffer_cache_misses++;
     }
 
+ out:
     cache_unlock(xcall);
 
     return p;
@@ -85,13 +96,28 @@ static int cache_free(xencall_handle *xcall, void *p, size_t nr_pages)
     xcall->buffer_total_releases++;
     xcall->buffer_current_allocations--;
 
-    if ( nr_pages == 1 &&
-         xcall->buffer_cache_nr < BUFFER_CACHE_SIZE )
+    if ( nr_pages > BUFFER_CACHE_MAX_PAGES )
+        goto out;
+
+    /* Make room by dropping the least recently freed buffers. */
+    while ( xcall->buffer_cache_nr == BUFFER_CACHE_SIZE ||
+            (xcall->buffer_cache_nr &&
+             xcall->buffer_cache_pages + nr_pages > BUFFER_CACHE_MAX_PAGES) )
     {
-        xcall->buffer_cache[xcall->buffer_cache_nr++] = p;
-        rc = 1;
+        osdep_free_pages(xcall, xcall->buffer_cache[0].p,
+                         xcall->buffer_cache[0].nr_pages);
+        xcall->buffer_cache_pages -= xcall->buffer_cache[0].nr_pages;
+        memmove(&xcall->buffer_cache[0], &xcall->buffer_cache[1],
+                --xcall->buffer_cache_nr * sizeof(xcall->buffer_cache[0]));
     }
 
+    xcall->buffer_cache[xcall->buffer_cache_nr].p = p;
+    xcall->buffer_cache[xcall->buffer_cache_nr].nr_pages = nr_pages;
+    xcall->buffer_cache_nr++;
+    xcall->buffer_cache_pages += nr_pages;
+    rc = 1;
+
+ out:
     cache_unlock(xcall);
 
     return rc;
@@ -99,8 +125,6 @@ static int cache_free(xencall_handle *xcall, void *p, size_t nr_pages)
 
 void buffer_release_cache(xencall_handle *xcall)
 {
-    void *p;
-
     cache_lock(xcall);
 
     DBGPRINTF("total allocations:%d total releases:%d",
@@ -109,8 +133,8 @@ void buffer_release_cache(xencall_handle *xcall)
     DBGPRINTF("current allocations:%d maximum allocations:%d",
               xcall->buffer_current_allocations,
               xcall->buffer_maximum_allocations);
-    DBGPRINTF("cache current size:%d",
-              xcall->buffer_cache_nr);
+    DBGPRINTF("cache current size:%d (%zu pages)",
+              xcall->buffer_cache_nr, xcall->buffer_cache_pages);
     DBGPRINTF("cache hits:%d misses:%d toobig:%d",
               xcall->buffer_cache_hits,
               xcall->buffer_cache_misses,
@@ -118,9 +142,11 @@ void buffer_release_cache(xencall_handle *xcall)
 
     while ( xcall->buffer_cache_nr > 0 )
     {
-        p = xcall->buffer_cache[--xcall->buffer_cache_nr];
-        osdep_free_pages(xcall, p, 1);
+        --xcall->buffer_cache_nr;
+        osdep_free_pages(xcall, xcall->buffer_cache[xcall->buffer_cache_nr].p,
+                         xcall->buffer_cache[xcall->buffer_cache_nr].nr_pages);
     }
+    xcall->buffer_cache_pages = 0;
 
     cache_unlock(xcall);
 }
@@ -35,6 +35,7 @@ xencall_handle *xencall_open(xentoollog_logger *logger, unsigned open_flags)
 
     xcall->flags = open_flags;
     xcall->buffer_cache_nr = 0;
+    xcall->buffer_cache_pages = 0;
 
     xcall->buffer_total_allocations = 0;
     xcall->buffer_total_releases = 0;
@@ -24,13 +24,22 @@ struct xencall_handle {
     Xentoolcore__Active_Handle tc_ah;
 
     /*
-     * A simple cache of unused, single page, hypercall buffers
+     * A cache of unused hypercall buffers, reused for allocations of the
+     * same size: callers like log-dirty bitmap fetches and domain list
+     * sweeps allocate the same large buffers over and over, and each
+     * fresh one costs an mmap(), madvise() and faulting in of every page.
+     * Most recently freed first.
      *
      * Protected by a global lock.
      */
-#define BUFFER_CACHE_SIZE 4
+#define BUFFER_CACHE_SIZE      16
+#define BUFFER_CACHE_MAX_PAGES 1024   /* 4MiB */
     int buffer_cache_nr;
-    void *buffer_cache[BUFFER_CACHE_SIZE];
+    size_t buffer_cache_pages;
+    struct {
+        void *p;
+        size_t nr_pages;
+    } buffer_cache[BUFFER_CACHE_SIZE];
 
     /*
      * Hypercall buffer statistics. All protected by the global
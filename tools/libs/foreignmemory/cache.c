@@ -0,0 +1,205 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Mapping cache: guest memory mapped in 2MiB chunks, kept mapped across
+ * accesses.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "private.h"
+
+#define CHUNK_SHIFT     9                       /* 2MiB of 4kB frames */
+#define CHUNK_FRAMES    (1UL << CHUNK_SHIFT)
+#define NO_CHUNK        (-1L)
+
+struct cache_chunk {
+    xen_pfn_t idx;              /* gfn >> CHUNK_SHIFT */
+    void *addr;                 /* NULL: slot free */
+    long next;                  /* hash chain */
+    unsigned long last_used;
+    int err[CHUNK_FRAMES];
+};
+
+struct xenforeignmemory_cache {
+    xenforeignmemory_handle *fmem;
+    uint32_t dom;
+    int prot;
+    size_t nr_chunks;
+    size_t hash_mask;
+    unsigned long clock;
+    long *hash;                 /* chunk heads, by idx & hash_mask */
+    struct cache_chunk chunks[];
+};
+
+xenforeignmemory_cache *xenforeignmemory_cache_create(
+    xenforeignmemory_handle *fmem, uint32_t dom, int prot, size_t max_chunks)
+{
+    xenforeignmemory_cache *cache;
+    size_t i, hash_size = 1;
+
+    if ( !max_chunks )
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    while ( hash_size < max_chunks * 2 )
+        hash_size <<= 1;
+
+    cache = calloc(1, sizeof(*cache) + max_chunks * sizeof(cache->chunks[0]));
+    if ( !cache )
+        return NULL;
+
+    cache->hash = malloc(hash_size * sizeof(*cache->hash));
+    if ( !cache->hash )
+    {
+        free(cache);
+        return NULL;
+    }
+
+    cache->fmem = fmem;
+    cache->dom = dom;
+    cache->prot = prot;
+    cache->nr_chunks = max_chunks;
+    cache->hash_mask = hash_size - 1;
+    for ( i = 0; i < hash_size; i++ )
+        cache->hash[i] = NO_CHUNK;
+
+    return cache;
+}
+
+static void chunk_drop(xenforeignmemory_cache *cache, long c)
+{
+    struct cache_chunk *chunk = &cache->chunks[c];
+    long *pp = &cache->hash[chunk->idx & cache->hash_mask];
+
+    while ( *pp != c )
+        pp = &cache->chunks[*pp].next;
+    *pp = chunk->next;
+
+    (void)osdep_xenforeignmemory_unmap(cache->fmem, chunk->addr,
+                                       CHUNK_FRAMES);
+    chunk->addr = NULL;
+}
+
+void xenforeignmemory_cache_destroy(xenforeignmemory_cache *cache)
+{
+    size_t c;
+
+    if ( !cache )
+        return;
+
+    for ( c = 0; c < cache->nr_chunks; c++ )
+        if ( cache->chunks[c].addr )
+            chunk_drop(cache, c);
+
+    free(cache->hash);
+    free(cache);
+}
+
+/* Map the chunk @idx into a free slot, evicting the least recently used. */
+static long chunk_map(xenforeignmemory_cache *cache, xen_pfn_t idx)
+{
+    struct cache_chunk *chunk;
+    long c, victim = 0;
+    void *addr;
+
+    for ( c = 0; c < cache->nr_chunks; c++ )
+    {
+        if ( !cache->chunks[c].addr )
+        {
+            victim = c;
+            break;
+        }
+        if ( cache->chunks[c].last_used < cache->chunks[victim].last_used )
+            victim = c;
+    }
+
+    chunk = &cache->chunks[victim];
+    if ( chunk->addr )
+        chunk_drop(cache, victim);
+
+    addr = xenforeignmemory_map_range(cache->fmem, cache->dom, cache->prot,
+                                      idx << CHUNK_SHIFT, CHUNK_FRAMES,
+                                      chunk->err);
+    if ( !addr )
+        return NO_CHUNK;
+
+    chunk->idx = idx;
+    chunk->addr = addr;
+    chunk->next = cache->hash[idx & cache->hash_mask];
+    cache->hash[idx & cache->hash_mask] = victim;
+
+    return victim;
+}
+
+void *xenforeignmemory_cache_get(xenforeignmemory_cache *cache,
+                                 xen_pfn_t gfn)
+{
+    xen_pfn_t idx = gfn >> CHUNK_SHIFT;
+    unsigned int off = gfn & (CHUNK_FRAMES - 1);
+    struct cache_chunk *chunk;
+    long c;
+
+    for ( c = cache->hash[idx & cache->hash_mask]; c != NO_CHUNK;
+          c = cache->chunks[c].next )
+        if ( cache->chunks[c].idx == idx )
+            break;
+
+    if ( c == NO_CHUNK )
+    {
+        c = chunk_map(cache, idx);
+        if ( c == NO_CHUNK )
+            return NULL;
+    }
+
+    chunk = &cache->chunks[c];
+    chunk->last_used = ++cache->clock;
+
+    if ( chunk->err[off] )
+    {
+        errno = -chunk->err[off];
+        return NULL;
+    }
+
+    return (char *)chunk->addr + ((size_t)off << PAGE_SHIFT);
+}
+
+void xenforeignmemory_cache_invalidate(xenforeignmemory_cache *cache,
+                                       xen_pfn_t gfn, size_t nr)
+{
+    xen_pfn_t first = gfn >> CHUNK_SHIFT;
+    xen_pfn_t last = (gfn + nr - 1) >> CHUNK_SHIFT;
+    size_t c;
+
+    if ( !nr )
+        return;
+
+    for ( c = 0; c < cache->nr_chunks; c++ )
+        if ( cache->chunks[c].addr &&
+             cache->chunks[c].idx >= first && cache->chunks[c].idx <= last )
+            chunk_drop(cache, c);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -123,6 +123,27 @@ void *xenforeignmemory_map(xenforeignmemory_handle *fmem,
     return xenforeignmemory_map2(fmem, dom, NULL, prot, 0, num, arr, err);
 }
 
+void *xenforeignmemory_map_range(xenforeignmemory_handle *fmem,
+                                 uint32_t dom, int prot,
+                                 xen_pfn_t gfn, size_t num,
+                                 int err[/*num*/])
+{
+    xen_pfn_t *arr = malloc(num * sizeof(*arr));
+    void *ret;
+    size_t i;
+
+    if ( arr == NULL )
+        return NULL;
+
+    for ( i = 0; i < num; i++ )
+        arr[i] = gfn + i;
+
+    ret = xenforeignmemory_map(fmem, dom, prot, num, arr, err);
+    free(arr);
+
+    return ret;
+}
+
 int xenforeignmemory_unmap(xenforeignmemory_handle *fmem,
                            void *addr, size_t num)
 {
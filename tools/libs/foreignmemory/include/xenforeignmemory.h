@@ -127,6 +127,54 @@ void *xenforeignmemory_map2(xenforeignmemory_handle *fmem, uint32_t dom,
 int xenforeignmemory_unmap(xenforeignmemory_handle *fmem,
                            void *addr, size_t pages);
 
+/*
+ * Maps @pages contiguous gfns of domain @dom, starting at @gfn, as by
+ * xenforeignmemory_map() with the gfn array filled in.
+ */
+void *xenforeignmemory_map_range(xenforeignmemory_handle *fmem, uint32_t dom,
+                                 int prot, xen_pfn_t gfn, size_t pages,
+                                 int err[/*pages*/]);
+
+/*
+ * A cache of mappings of one domain's memory, for callers that access
+ * scattered guest frames again and again (device models, introspection,
+ * save/restore).  Frames are mapped in 2MiB-sized, 2MiB-aligned chunks of
+ * guest physical address space, one batch per chunk, and stay mapped until
+ * invalidated or evicted, least recently used first.  A cache hit costs a
+ * hash lookup and no system call.
+ *
+ * A cache is not thread safe, and belongs to the handle it was created
+ * from; destroy it before closing the handle.
+ */
+typedef struct xenforeignmemory_cache xenforeignmemory_cache;
+
+/*
+ * Create a cache of @dom's memory, mapped with @prot (as for mmap(2)),
+ * keeping at most @max_chunks chunks (i.e. 2MiB of address space each)
+ * mapped.  Returns NULL and sets errno on failure.
+ */
+xenforeignmemory_cache *xenforeignmemory_cache_create(
+    xenforeignmemory_handle *fmem, uint32_t dom, int prot, size_t max_chunks);
+
+/* Unmap everything and free the cache. */
+void xenforeignmemory_cache_destroy(xenforeignmemory_cache *cache);
+
+/*
+ * Return a pointer to @gfn's page, mapping its chunk if needed.  Returns
+ * NULL and sets errno if the frame couldn't be mapped.  The pointer stays
+ * valid until the chunk is evicted, i.e. until @max_chunks other chunks
+ * have been used since, or invalidated.
+ */
+void *xenforeignmemory_cache_get(xenforeignmemory_cache *cache,
+                                 xen_pfn_t gfn);
+
+/*
+ * Drop the mappings of @nr frames from @gfn on, e.g. after the guest's
+ * physmap changed there.  Later gets map them afresh.
+ */
+void xenforeignmemory_cache_invalidate(xenforeignmemory_cache *cache,
+                                       xen_pfn_t gfn, size_t nr);
+
 /**
  * This function restricts the use of this handle to the specified
  * domain.
@@ -62,8 +62,9 @@
 #define MAX_LARGE_RING (1 << LARGE_RING_SHIFT)
 #define LARGE_RING_OFFSET 2048
 
-// if you go over this size, you'll have too many grants to fit in the shared page.
-#define MAX_RING_SHIFT 20
+// the largest single ring whose grants fit in the shared page; whether the
+// grants of both rings fit is checked by grants_fit()
+#define MAX_RING_SHIFT 21
 #define MAX_RING_SIZE (1 << MAX_RING_SHIFT)
 
 #ifndef offsetof
@@ -72,6 +73,29 @@
 
 #define max(a,b) ((a > b) ? a : b)
 
+/*
+ * Check that the grant list for rings of the given orders fits in the
+ * shared page, in front of any ring that lives in the page itself.
+ */
+static int grants_fit(int left_order, int right_order)
+{
+	int orders[2] = { left_order, right_order };
+	size_t end = PAGE_SIZE, nr_grants = 0;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (orders[i] == SMALL_RING_SHIFT)
+			end = SMALL_RING_OFFSET;
+		else if (orders[i] == LARGE_RING_SHIFT && end > LARGE_RING_OFFSET)
+			end = LARGE_RING_OFFSET;
+		else if (orders[i] >= PAGE_SHIFT)
+			nr_grants += 1 << (orders[i] - PAGE_SHIFT);
+	}
+
+	return offsetof(struct vchan_interface, grants) +
+	       nr_grants * sizeof(uint32_t) <= end;
+}
+
 static int init_gnt_srv(struct libxenvchan *ctrl, int domain)
 {
 	int pages_left = ctrl->read.order >= PAGE_SHIFT ? 1 << (ctrl->read.order - PAGE_SHIFT) : 0;
@@ -160,6 +184,8 @@ static int init_gnt_cli(struct libxenvchan *ctrl, int domain, uint32_t ring_ref)
 		goto out_unmap_ring;
 	if (ctrl->read.order == ctrl->write.order && ctrl->read.order < PAGE_SHIFT)
 		goto out_unmap_ring;
+	if (!grants_fit(ctrl->write.order, ctrl->read.order))
+		goto out_unmap_ring;
 
 	grants = ctrl->ring->grants;
 
@@ -312,6 +338,7 @@ struct libxenvchan *libxenvchan_server_init(struct xentoollog_logger *logger,
 	ctrl->event = NULL;
 	ctrl->is_server = 1;
 	ctrl->server_persist = 0;
+	ctrl->unnotified = ctrl->notify_watermark = 0;
 
 	ctrl->read.order = min_order(left_min);
 	ctrl->write.order = min_order(right_min);
@@ -329,6 +356,11 @@ struct libxenvchan *libxenvchan_server_init(struct xentoollog_logger *logger,
 		ctrl->write.order = LARGE_RING_SHIFT;
 	}
 
+	if (!grants_fit(ctrl->read.order, ctrl->write.order)) {
+		free(ctrl);
+		return 0;
+	}
+
 	ctrl->gntshr = xengntshr_open(logger, 0);
 	if (!ctrl->gntshr) {
 		free(ctrl);
@@ -396,6 +428,7 @@ struct libxenvchan *libxenvchan_client_init(struct xentoollog_logger *logger,
 	ctrl->gnttab = NULL;
 	ctrl->write.order = ctrl->read.order = 0;
 	ctrl->is_server = 0;
+	ctrl->unnotified = ctrl->notify_watermark = 0;
 
 	xs = xs_daemon_open();
 	if (!xs)
@@ -177,6 +177,8 @@ static inline int fast_get_buffer_space(struct libxenvchan *ctrl, size_t request
 		return ready;
 	/* We plan to fill the buffer; please tell us when you've read it */
 	request_notify(ctrl, VCHAN_NOTIFY_READ);
+	/* and make sure you know there is something to read */
+	libxenvchan_flush(ctrl);
 	/*
 	 * If the reader moved wr_cons after our read but before request, we
 	 * will not get notified even though the actual amount of buffer space
@@ -194,52 +196,162 @@ int libxenvchan_buffer_space(struct libxenvchan *ctrl)
 	return raw_get_buffer_space(ctrl);
 }
 
+int libxenvchan_flush(struct libxenvchan *ctrl)
+{
+	if (!ctrl->unnotified)
+		return 0;
+	ctrl->unnotified = 0;
+	return send_notify(ctrl, VCHAN_NOTIFY_WRITE);
+}
+
+int libxenvchan_set_notify_watermark(struct libxenvchan *ctrl, size_t bytes)
+{
+	if (bytes > wr_ring_size(ctrl))
+		return -1;
+	ctrl->notify_watermark = bytes;
+	if (ctrl->unnotified >= bytes)
+		return libxenvchan_flush(ctrl);
+	return 0;
+}
+
 int libxenvchan_wait(struct libxenvchan *ctrl)
 {
-	int ret = xenevtchn_pending(ctrl->event);
+	int ret;
+	/* The peer may be waiting for what we wrote to make space */
+	if (libxenvchan_flush(ctrl))
+		return -1;
+	ret = xenevtchn_pending(ctrl->event);
 	if (ret < 0)
 		return -1;
 	xenevtchn_unmask(ctrl->event, ret);
 	return 0;
 }
 
+static size_t iov_size(const struct iovec *iov, int iovcnt)
+{
+	size_t size = 0;
+	int i;
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
+	return size;
+}
+
 /**
- * returns -1 on error, or size on success
- *
- * caller must have checked that enough space is available
+ * Describe size bytes of a ring starting at index pos by up to two segments.
  */
-static int do_send(struct libxenvchan *ctrl, const void *data, size_t size)
+static void ring_segments(void *ring, uint32_t ring_size, uint32_t pos,
+                          size_t size, struct iovec iov[2])
 {
-	int real_idx = wr_prod(ctrl) & (wr_ring_size(ctrl) - 1);
-	int avail_contig = wr_ring_size(ctrl) - real_idx;
+	uint32_t real_idx = pos & (ring_size - 1);
+	size_t avail_contig = ring_size - real_idx;
 	if (avail_contig > size)
 		avail_contig = size;
-	xen_mb(); /* read indexes /then/ write data */
-	memcpy(wr_ring(ctrl) + real_idx, data, avail_contig);
-	if (avail_contig < size)
-	{
+	iov[0].iov_base = ring + real_idx;
+	iov[0].iov_len = avail_contig;
+	iov[1].iov_base = ring;
+	iov[1].iov_len = size - avail_contig;
+}
+
+/**
+ * Copy data into the write ring at index pos, without publishing it
+ */
+static void ring_write(struct libxenvchan *ctrl, uint32_t pos,
+                       const void *data, size_t size)
+{
+	struct iovec seg[2];
+	ring_segments(wr_ring(ctrl), wr_ring_size(ctrl), pos, size, seg);
+	memcpy(seg[0].iov_base, data, seg[0].iov_len);
+	if (seg[1].iov_len)
 		// we rolled across the end of the ring
-		memcpy(wr_ring(ctrl), data + avail_contig, size - avail_contig);
-	}
+		memcpy(seg[1].iov_base, data + seg[0].iov_len, seg[1].iov_len);
+}
+
+/**
+ * Copy data out of the read ring at index pos, without consuming it
+ */
+static void ring_read(struct libxenvchan *ctrl, uint32_t pos,
+                      void *data, size_t size)
+{
+	struct iovec seg[2];
+	ring_segments((void *)rd_ring(ctrl), rd_ring_size(ctrl), pos, size, seg);
+	memcpy(data, seg[0].iov_base, seg[0].iov_len);
+	if (seg[1].iov_len)
+		// we rolled across the end of the ring
+		memcpy(data + seg[0].iov_len, seg[1].iov_base, seg[1].iov_len);
+}
+
+/**
+ * Publish size bytes written to the ring, notifying the peer unless
+ * notifications are being coalesced and the watermark isn't reached yet.
+ * returns -1 on error, or size on success
+ */
+static int commit_send(struct libxenvchan *ctrl, size_t size)
+{
 	xen_wmb(); /* write data /then/ notify */
 	wr_prod(ctrl) += size;
-	if (send_notify(ctrl, VCHAN_NOTIFY_WRITE))
+	ctrl->unnotified += size;
+	if (ctrl->unnotified >= ctrl->notify_watermark &&
+	    libxenvchan_flush(ctrl))
 		return -1;
 	return size;
 }
 
+/**
+ * Release size bytes read from the ring to the peer.
+ * returns -1 on error, or size on success
+ */
+static int commit_recv(struct libxenvchan *ctrl, size_t size)
+{
+	xen_mb(); /* consume /then/ notify */
+	rd_cons(ctrl) += size;
+	if (send_notify(ctrl, VCHAN_NOTIFY_READ))
+		return -1;
+	return size;
+}
+
+/**
+ * Send size bytes of the buffers, after skipping the first skip bytes.
+ * returns -1 on error, or size on success
+ *
+ * caller must have checked that enough space is available
+ */
+static int do_send(struct libxenvchan *ctrl, const struct iovec *iov,
+                   int iovcnt, size_t skip, size_t size)
+{
+	uint32_t pos = wr_prod(ctrl);
+	size_t left = size;
+	int i;
+	xen_mb(); /* read indexes /then/ write data */
+	for (i = 0; left && i < iovcnt; i++) {
+		size_t len = iov[i].iov_len;
+		if (skip >= len) {
+			skip -= len;
+			continue;
+		}
+		len -= skip;
+		if (len > left)
+			len = left;
+		ring_write(ctrl, pos, iov[i].iov_base + skip, len);
+		pos += len;
+		left -= len;
+		skip = 0;
+	}
+	return commit_send(ctrl, size);
+}
+
 /**
  * returns 0 if no buffer space is available, -1 on error, or size on success
  */
-int libxenvchan_send(struct libxenvchan *ctrl, const void *data, size_t size)
+int libxenvchan_sendv(struct libxenvchan *ctrl, const struct iovec *iov, int iovcnt)
 {
+	size_t size = iov_size(iov, iovcnt);
 	int avail;
 	while (1) {
 		if (!libxenvchan_is_open(ctrl))
 			return -1;
 		avail = fast_get_buffer_space(ctrl, size);
 		if (size <= avail)
-			return do_send(ctrl, data, size);
+			return do_send(ctrl, iov, iovcnt, 0, size);
 		if (!ctrl->blocking)
 			return 0;
 		if (size > wr_ring_size(ctrl))
@@ -249,9 +361,16 @@ int libxenvchan_send(struct libxenvchan *ctrl, const void *data, size_t size)
 	}
 }
 
-int libxenvchan_write(struct libxenvchan *ctrl, const void *data, size_t size)
+int libxenvchan_send(struct libxenvchan *ctrl, const void *data, size_t size)
 {
-	int avail;
+	struct iovec iov = { .iov_base = (void *)data, .iov_len = size };
+	return libxenvchan_sendv(ctrl, &iov, 1);
+}
+
+int libxenvchan_writev(struct libxenvchan *ctrl, const struct iovec *iov, int iovcnt)
+{
+	size_t size = iov_size(iov, iovcnt);
+	int avail, ret;
 	if (!libxenvchan_is_open(ctrl))
 		return -1;
 	if (ctrl->blocking) {
@@ -260,8 +379,12 @@ int libxenvchan_write(struct libxenvchan *ctrl, const void *data, size_t size)
 			avail = fast_get_buffer_space(ctrl, size - pos);
 			if (pos + avail > size)
 				avail = size - pos;
-			if (avail)
-				pos += do_send(ctrl, data + pos, avail);
+			if (avail) {
+				ret = do_send(ctrl, iov, iovcnt, pos, avail);
+				if (ret < 0)
+					return -1;
+				pos += ret;
+			}
 			if (pos == size)
 				return pos;
 			if (libxenvchan_wait(ctrl))
@@ -275,45 +398,83 @@ int libxenvchan_write(struct libxenvchan *ctrl, const void *data, size_t size)
 			size = avail;
 		if (size == 0)
 			return 0;
-		return do_send(ctrl, data, size);
+		return do_send(ctrl, iov, iovcnt, 0, size);
+	}
+}
+
+int libxenvchan_write(struct libxenvchan *ctrl, const void *data, size_t size)
+{
+	struct iovec iov = { .iov_base = (void *)data, .iov_len = size };
+	return libxenvchan_writev(ctrl, &iov, 1);
+}
+
+int libxenvchan_write_reserve(struct libxenvchan *ctrl, struct iovec iov[2], size_t size)
+{
+	int avail;
+	while (1) {
+		if (!libxenvchan_is_open(ctrl))
+			return -1;
+		avail = fast_get_buffer_space(ctrl, size);
+		if (avail || !size || !ctrl->blocking)
+			break;
+		if (libxenvchan_wait(ctrl))
+			return -1;
 	}
+	if (avail > size)
+		avail = size;
+	xen_mb(); /* read indexes /then/ caller writes data */
+	ring_segments(wr_ring(ctrl), wr_ring_size(ctrl), wr_prod(ctrl), avail, iov);
+	return avail;
+}
+
+int libxenvchan_write_commit(struct libxenvchan *ctrl, size_t size)
+{
+	if (size > raw_get_buffer_space(ctrl))
+		return -1;
+	return commit_send(ctrl, size);
 }
 
 /**
+ * Receive size bytes into the buffers, after skipping the first skip bytes.
  * returns -1 on error, or size on success
  *
  * caller must have checked that enough data is available
  */
-static int do_recv(struct libxenvchan *ctrl, void *data, size_t size)
+static int do_recv(struct libxenvchan *ctrl, const struct iovec *iov,
+                   int iovcnt, size_t skip, size_t size)
 {
-	int real_idx = rd_cons(ctrl) & (rd_ring_size(ctrl) - 1);
-	int avail_contig = rd_ring_size(ctrl) - real_idx;
-	if (avail_contig > size)
-		avail_contig = size;
+	uint32_t pos = rd_cons(ctrl);
+	size_t left = size;
+	int i;
 	xen_rmb(); /* data read must happen /after/ rd_cons read */
-	memcpy(data, rd_ring(ctrl) + real_idx, avail_contig);
-	if (avail_contig < size)
-	{
-		// we rolled across the end of the ring
-		memcpy(data + avail_contig, rd_ring(ctrl), size - avail_contig);
+	for (i = 0; left && i < iovcnt; i++) {
+		size_t len = iov[i].iov_len;
+		if (skip >= len) {
+			skip -= len;
+			continue;
+		}
+		len -= skip;
+		if (len > left)
+			len = left;
+		ring_read(ctrl, pos, iov[i].iov_base + skip, len);
+		pos += len;
+		left -= len;
+		skip = 0;
 	}
-	xen_mb(); /* consume /then/ notify */
-	rd_cons(ctrl) += size;
-	if (send_notify(ctrl, VCHAN_NOTIFY_READ))
-		return -1;
-	return size;
+	return commit_recv(ctrl, size);
 }
 
 /**
- * reads exactly size bytes from the vchan.
+ * reads exactly the size of the buffers from the vchan.
  * returns 0 if insufficient data is available, -1 on error, or size on success
  */
-int libxenvchan_recv(struct libxenvchan *ctrl, void *data, size_t size)
+int libxenvchan_recvv(struct libxenvchan *ctrl, const struct iovec *iov, int iovcnt)
 {
+	size_t size = iov_size(iov, iovcnt);
 	while (1) {
 		int avail = fast_get_data_ready(ctrl, size);
 		if (size <= avail)
-			return do_recv(ctrl, data, size);
+			return do_recv(ctrl, iov, iovcnt, 0, size);
 		if (!libxenvchan_is_open(ctrl))
 			return -1;
 		if (!ctrl->blocking)
@@ -325,14 +486,21 @@ int libxenvchan_recv(struct libxenvchan *ctrl, void *data, size_t size)
 	}
 }
 
-int libxenvchan_read(struct libxenvchan *ctrl, void *data, size_t size)
+int libxenvchan_recv(struct libxenvchan *ctrl, void *data, size_t size)
 {
+	struct iovec iov = { .iov_base = data, .iov_len = size };
+	return libxenvchan_recvv(ctrl, &iov, 1);
+}
+
+int libxenvchan_readv(struct libxenvchan *ctrl, const struct iovec *iov, int iovcnt)
+{
+	size_t size = iov_size(iov, iovcnt);
 	while (1) {
 		int avail = fast_get_data_ready(ctrl, size);
 		if (avail && size > avail)
 			size = avail;
 		if (avail)
-			return do_recv(ctrl, data, size);
+			return do_recv(ctrl, iov, iovcnt, 0, size);
 		if (!libxenvchan_is_open(ctrl))
 			return -1;
 		if (!ctrl->blocking)
@@ -342,6 +510,41 @@ int libxenvchan_read(struct libxenvchan *ctrl, void *data, size_t size)
 	}
 }
 
+int libxenvchan_read(struct libxenvchan *ctrl, void *data, size_t size)
+{
+	struct iovec iov = { .iov_base = data, .iov_len = size };
+	return libxenvchan_readv(ctrl, &iov, 1);
+}
+
+int libxenvchan_read_peek(struct libxenvchan *ctrl, struct iovec iov[2], size_t size)
+{
+	int avail;
+	while (1) {
+		avail = fast_get_data_ready(ctrl, size);
+		if (avail || !size)
+			break;
+		if (!libxenvchan_is_open(ctrl))
+			return -1;
+		if (!ctrl->blocking)
+			break;
+		if (libxenvchan_wait(ctrl))
+			return -1;
+	}
+	if (avail > size)
+		avail = size;
+	xen_rmb(); /* caller's data read must happen /after/ rd_cons read */
+	ring_segments((void *)rd_ring(ctrl), rd_ring_size(ctrl), rd_cons(ctrl),
+	              avail, iov);
+	return avail;
+}
+
+int libxenvchan_read_consume(struct libxenvchan *ctrl, size_t size)
+{
+	if (size > raw_get_data_ready(ctrl))
+		return -1;
+	return commit_recv(ctrl, size);
+}
+
 int libxenvchan_is_open(struct libxenvchan* ctrl)
 {
 	if (ctrl->is_server)
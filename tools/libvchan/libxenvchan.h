@@ -42,6 +42,7 @@
  *  compile time, so the macros in ring.h cannot be used to access the rings.
  */
 
+#include <sys/uio.h>
 #include <xen/io/libxenvchan.h>
 #include <xen/xen.h>
 #include <xen/sys/evtchn.h>
@@ -86,6 +87,11 @@ struct libxenvchan {
 	int blocking:1;
 	/* communication rings */
 	struct libxenvchan_ring read, write;
+	/**
+	 * Bytes written since the peer was last notified, and how many may be
+	 * written before it is; see libxenvchan_set_notify_watermark().
+	 */
+	uint32_t unnotified, notify_watermark;
 };
 
 /**
@@ -154,7 +160,86 @@ int libxenvchan_send(struct libxenvchan *ctrl, const void *data, size_t size);
  */
 int libxenvchan_write(struct libxenvchan *ctrl, const void *data, size_t size);
 /**
- * Waits for reads or writes to unblock, or for a close
+ * Packet-based receive into a scatter list: always reads exactly the total
+ * size of the buffers.
+ * @return -1 on error, 0 if nonblocking and insufficient data is available, or
+ *         the total size
+ */
+int libxenvchan_recvv(struct libxenvchan *ctrl, const struct iovec *iov, int iovcnt);
+/**
+ * Stream-based receive into a scatter list: reads as much data as possible,
+ * filling the buffers in order.
+ * @return -1 on error, otherwise the amount of data read (which may be zero if
+ *         the vchan is nonblocking)
+ */
+int libxenvchan_readv(struct libxenvchan *ctrl, const struct iovec *iov, int iovcnt);
+/**
+ * Packet-based send from a gather list: send all buffers if possible.
+ * @return -1 on error, 0 if nonblocking and insufficient space is available, or
+ *         the total size
+ */
+int libxenvchan_sendv(struct libxenvchan *ctrl, const struct iovec *iov, int iovcnt);
+/**
+ * Stream-based send from a gather list: send as much data as possible, taking
+ * the buffers in order.
+ * @return -1 on error, otherwise the amount of data sent (which may be zero if
+ *         the vchan is nonblocking)
+ */
+int libxenvchan_writev(struct libxenvchan *ctrl, const struct iovec *iov, int iovcnt);
+/**
+ * Zero-copy send: get pointers to free space in the ring, to be filled in
+ * and then handed to the peer with libxenvchan_write_commit().  The space is
+ * described by up to two segments, the second one being empty unless the
+ * space wraps around the end of the ring.  Blocks until some space is
+ * available if the vchan is blocking.
+ * @param ctrl The vchan control structure
+ * @param iov Filled in with the free space
+ * @param size The most space to return
+ * @return -1 on error, otherwise the amount of space returned (which may be
+ *         zero if the vchan is nonblocking)
+ */
+int libxenvchan_write_reserve(struct libxenvchan *ctrl, struct iovec iov[2], size_t size);
+/**
+ * Send the first $size bytes of the space returned by
+ * libxenvchan_write_reserve().
+ * @return -1 on error, or $size
+ */
+int libxenvchan_write_commit(struct libxenvchan *ctrl, size_t size);
+/**
+ * Zero-copy receive: get pointers to the data in the ring, to be released
+ * with libxenvchan_read_consume().  The data is described by up to two
+ * segments, as for libxenvchan_write_reserve(), and blocks until some data is
+ * available if the vchan is blocking.  The peer can still modify the data
+ * in place, so it must be copied before being validated.
+ * @param ctrl The vchan control structure
+ * @param iov Filled in with the data
+ * @param size The most data to return
+ * @return -1 on error, otherwise the amount of data returned (which may be
+ *         zero if the vchan is nonblocking)
+ */
+int libxenvchan_read_peek(struct libxenvchan *ctrl, struct iovec iov[2], size_t size);
+/**
+ * Release the first $size bytes of the data returned by
+ * libxenvchan_read_peek() back to the peer.
+ * @return -1 on error, or $size
+ */
+int libxenvchan_read_consume(struct libxenvchan *ctrl, size_t size);
+/**
+ * Coalesce notifications: only notify the peer of written data once at least
+ * $bytes have been written since it was last notified, or when this side
+ * runs out of space, waits, or calls libxenvchan_flush().  Callers that stop
+ * writing without waiting must call libxenvchan_flush(), or the peer may
+ * never see the data.  Zero (the default) notifies on every write.
+ * @return -1 if $bytes is larger than the send ring, otherwise 0
+ */
+int libxenvchan_set_notify_watermark(struct libxenvchan *ctrl, size_t bytes);
+/**
+ * Notify the peer of any data written since it was last notified.
+ */
+int libxenvchan_flush(struct libxenvchan *ctrl);
+/**
+ * Waits for reads or writes to unblock, or for a close.  Notifies the peer of
+ * any data written since it was last notified first.
  */
 int libxenvchan_wait(struct libxenvchan *ctrl);
 /**
@@ -69,6 +69,13 @@ struct xc_dom_image {
     size_t max_ramdisk_size;
     size_t max_devicetree_size;
 
+    /* identity of the kernel file, for the decompressed kernel cache */
+    struct xc_dom_file_id {
+        uint64_t dev, ino, size;
+        int64_t mtime_sec, mtime_nsec;
+    } kernel_id;
+    void *kernel_file_blob;     /* as mapped from the file, if cacheable */
+
     /* arguments and parameters */
     char *cmdline;
     size_t cmdline_size;
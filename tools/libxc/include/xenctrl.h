@@ -929,6 +929,85 @@ int xc_vcpu_getinfo(xc_interface *xch,
                     uint32_t vcpu,
                     xc_vcpuinfo_t *info);
 
+/**
+ * This function returns the runtime state of the vCPUs of all domains,
+ * from vCPU @first_vcpu of domain @first_domain on, in domain then vCPU
+ * order: what xc_vcpu_getinfo() would return for each, in one hypercall.
+ * To continue a listing that filled @info, pass the last entry's domid
+ * and vcpu + 1.
+ *
+ * @return the number of vCPUs enumerated or -1 on error
+ */
+typedef xen_sysctl_vcpuinfo_t xc_vcpuinfolist_t;
+int xc_vcpu_getinfolist(xc_interface *xch,
+                        uint32_t first_domain,
+                        uint32_t first_vcpu,
+                        unsigned int max_vcpus,
+                        xc_vcpuinfolist_t *info);
+
+/**
+ * This function returns the scheduling aggregates of the domains from
+ * @first_domain on: runstate times and scheduling event counts, summed
+ * over each domain's vCPUs.  @now, if not NULL, receives the system time
+ * of the snapshot, so that rates can be computed from two of them.
+ *
+ * @return the number of domains enumerated or -1 on error
+ */
+typedef xen_sysctl_domschedstats_t xc_domschedstats_t;
+int xc_domain_schedstats_list(xc_interface *xch,
+                              uint32_t first_domain,
+                              unsigned int max_domains,
+                              xc_domschedstats_t *stats,
+                              uint64_t *now);
+
+typedef struct xen_domctl_exit_stats xc_exit_stats_t;
+typedef struct xen_domctl_exit_reason xc_exit_reason_t;
+/*
+ * Retrieve the VM exit cost accounting of an HVM domain.  If reasons is
+ * not NULL, it has room for *nr_reasons entries, and on success
+ * *nr_reasons is set to the number of exit reasons Xen tracks
+ * (XEN_DOMCTL_EXIT_STATS_REASONS).  Fails with EOPNOTSUPP for PV domains.
+ */
+int xc_domain_exit_stats(xc_interface *xch,
+                         uint32_t domid,
+                         xc_exit_stats_t *stats,
+                         uint32_t *nr_reasons,
+                         xc_exit_reason_t *reasons);
+
+typedef struct xen_domctl_exit_msr xc_exit_msr_t;
+/*
+ * Retrieve the RDMSR/WRMSR exit counts of an HVM domain by MSR.  msrs has
+ * room for *nr_msrs entries; on success *nr_msrs is set to the number of
+ * distinct MSRs Xen recorded (which may exceed the room given), and, if
+ * other is not NULL, *other to the exits for MSRs Xen could not track.
+ */
+int xc_domain_exit_msr_stats(xc_interface *xch,
+                             uint32_t domid,
+                             uint32_t *nr_msrs,
+                             xc_exit_msr_t *msrs,
+                             uint64_t *other);
+
+typedef struct xen_domctl_numa_balance xc_numa_balance_t;
+/*
+ * Set the maximum number of pages per second Xen moves to the node the
+ * vCPUs of an HVM domain run on, 0 to stop.  Fails with EOPNOTSUPP if
+ * the domain or the hardware can't track accesses.
+ */
+int xc_domain_numa_balance_set(xc_interface *xch,
+                               uint32_t domid,
+                               uint32_t rate);
+/*
+ * Retrieve the NUMA balancing rate and statistics of a domain.  If
+ * node_pages is not NULL, it has room for *num_nodes entries and receives
+ * the number of pages of the domain on each node; on success *num_nodes
+ * is set to the number of nodes of the host.
+ */
+int xc_domain_numa_balance_get(xc_interface *xch,
+                               uint32_t domid,
+                               xc_numa_balance_t *stats,
+                               uint32_t *num_nodes,
+                               uint64_t *node_pages);
+
 long long xc_domain_get_cpu_usage(xc_interface *xch,
                                   uint32_t domid,
                                   int vcpu);
@@ -946,6 +1025,32 @@ int xc_shadow_control(xc_interface *xch,
                       uint32_t mode,
                       xc_shadow_op_stats_t *stats);
 
+/*
+ * Retrieve the hypervisor's estimate of the rate, in pages per second, at
+ * which a domain in log-dirty mode is dirtying memory.
+ */
+/*
+ * Sparse log-dirty retrieval, for XEN_DOMCTL_SHADOW_OP_{PEEK,CLEAN}_SPARSE.
+ * Covers *nr_pfns pfns from start_pfn, writing up to *nr_chunks chunk
+ * bitmaps to chunks and their first pfns to chunk_pfns.  On success,
+ * *nr_pfns and *nr_chunks are updated with the pfns covered and the chunks
+ * written.
+ */
+int xc_logdirty_sparse(xc_interface *xch,
+                       uint32_t domid,
+                       unsigned int sop,
+                       uint64_t start_pfn,
+                       uint64_t *nr_pfns,
+                       xc_hypercall_buffer_t *chunk_pfns,
+                       xc_hypercall_buffer_t *chunks,
+                       uint32_t *nr_chunks,
+                       uint32_t mode,
+                       xc_shadow_op_stats_t *stats);
+
+int xc_logdirty_get_rate(xc_interface *xch,
+                         uint32_t domid,
+                         unsigned long *rate);
+
 int xc_sched_credit_domain_set(xc_interface *xch,
                                uint32_t domid,
                                struct xen_domctl_sched_credit *sdom);
@@ -1265,6 +1370,40 @@ int xc_numainfo(xc_interface *xch, unsigned *max_nodes,
                 xc_meminfo_t *meminfo, uint32_t *distance);
 int xc_pcitopoinfo(xc_interface *xch, unsigned num_devs,
                    physdev_pci_device_t *devs, uint32_t *nodes);
+/*
+ * Retrieve the number of free pages waiting to be scrubbed on each node.
+ * With pending == NULL, only *max_nodes is set.
+ */
+int xc_scrubinfo(xc_interface *xch, unsigned *max_nodes, uint64_t *pending);
+/*
+ * Retrieve (and, with XEN_SYSCTL_SCHED_HIST_RESET in flags, reset) the
+ * scheduler latency histograms of cpu, or of all cpus with
+ * XEN_SYSCTL_SCHED_HIST_ALL_CPUS. data, if not NULL, must have room for
+ * XEN_SYSCTL_SCHED_HIST_NR * XEN_SYSCTL_SCHED_HIST_BUCKETS counters.
+ */
+int xc_sched_hist(xc_interface *xch, uint32_t cpu, uint32_t flags,
+                  uint64_t *data);
+/*
+ * Retrieve (and, with XEN_SYSCTL_LAT_HIST_RESET in flags, reset) the hot
+ * path latency histograms of one XEN_SYSCTL_LAT_HIST_* set, for cpu or all
+ * cpus. On entry *nr_hists is the number of histograms data has room for;
+ * on return it is the size of the set (also with data == NULL, or when
+ * the call fails with ENOBUFS).
+ */
+int xc_lat_hist(xc_interface *xch, uint32_t set, uint32_t cpu,
+                uint32_t flags, uint32_t *nr_hists, uint64_t *data);
+
+/*
+ * Host-wide PMU sampling (x86).  Start samples every pcpu each period
+ * occurrences of event (0: unhalted cycles); read drains up to
+ * *nr_samples records of one pcpu's ring, returning the number read in
+ * *nr_samples and the number dropped since the last read in *lost.
+ */
+int xc_pmu_sample_start(xc_interface *xch, uint64_t event, uint64_t period);
+int xc_pmu_sample_stop(xc_interface *xch);
+int xc_pmu_sample_read(xc_interface *xch, uint32_t cpu,
+                       xen_sysctl_pmu_sample_rec_t *samples,
+                       uint32_t *nr_samples, uint32_t *lost);
 
 int xc_sched_id(xc_interface *xch,
                 int *sched_id);
@@ -1500,6 +1639,23 @@ int xc_lockprof_query(xc_interface *xch,
                       uint64_t *time,
                       xc_hypercall_buffer_t *data);
 
+/*
+ * Lock contention profile.  Enabling with sample 0 disables sampling.
+ * xc_lockcont_query() returns up to *n_elems records in data, and sets
+ * *n_elems to the number available.  time, sample and dropped may be NULL.
+ */
+typedef xen_sysctl_lockcont_data_t xc_lockcont_data_t;
+int xc_lockcont_enable(xc_interface *xch, uint32_t sample);
+int xc_lockcont_reset(xc_interface *xch);
+int xc_lockcont_query_number(xc_interface *xch,
+                             uint32_t *n_elems);
+int xc_lockcont_query(xc_interface *xch,
+                      uint32_t *n_elems,
+                      uint64_t *time,
+                      uint32_t *sample,
+                      uint32_t *dropped,
+                      xc_hypercall_buffer_t *data);
+
 void *xc_memalign(xc_interface *xch, size_t alignment, size_t size);
 
 /**
@@ -1611,6 +1767,16 @@ int xc_tbuf_set_cpu_mask(xc_interface *xch, xc_cpumap_t mask);
 
 int xc_tbuf_set_evt_mask(xc_interface *xch, uint32_t mask);
 
+/**
+ * Restrict tracing to events where (id & mask[i]) == event[i] for one of
+ * @nr pairs (at most XEN_SYSCTL_TBUF_NR_EVT_FILTERS); @nr == 0 lifts it.
+ */
+int xc_tbuf_set_evt_filter(xc_interface *xch, unsigned int nr,
+                           const uint32_t *event, const uint32_t *mask);
+
+/* Restrict tracing to events raised while @domid runs; DOMID_INVALID: all. */
+int xc_tbuf_set_dom_filter(xc_interface *xch, uint32_t domid);
+
 int xc_domctl(xc_interface *xch, struct xen_domctl *domctl);
 int xc_sysctl(xc_interface *xch, struct xen_sysctl *sysctl);
 
@@ -1934,6 +2100,13 @@ int xc_get_vcpu_migration_delay(xc_interface *xch, uint32_t *value);
 int xc_get_cpuidle_max_cstate(xc_interface *xch, uint32_t *value);
 int xc_set_cpuidle_max_cstate(xc_interface *xch, uint32_t value);
 
+/*
+ * Limit the exit latency (in us) of the C-states CPU @cpuid may enter.
+ * 0 removes the limit.
+ */
+int xc_get_cpuidle_max_latency(xc_interface *xch, int cpuid, uint32_t *value);
+int xc_set_cpuidle_max_latency(xc_interface *xch, int cpuid, uint32_t value);
+
 int xc_enable_turbo(xc_interface *xch, int cpuid);
 int xc_disable_turbo(xc_interface *xch, int cpuid);
 /**
@@ -1990,6 +2163,15 @@ int xc_mem_paging_evict(xc_interface *xch, uint32_t domain_id, uint64_t gfn);
 int xc_mem_paging_prep(xc_interface *xch, uint32_t domain_id, uint64_t gfn);
 int xc_mem_paging_load(xc_interface *xch, uint32_t domain_id,
                        uint64_t gfn, void *buffer);
+/*
+ * Test and clear the accessed bits of [gfn, gfn + nr), setting the bits of
+ * the accessed gfns in the bitmap.  nr is at most XENMEM_PAGING_HARVEST_MAX.
+ * The first call starts tracking accesses, so finds none.  Fails with
+ * EOPNOTSUPP if the hardware doesn't keep accessed bits.
+ */
+int xc_mem_paging_harvest_accessed(xc_interface *xch, uint32_t domain_id,
+                                   uint64_t gfn, uint32_t nr,
+                                   unsigned long *bitmap);
 
 /** 
  * Access tracking operations.
@@ -2020,6 +2202,14 @@ int xc_set_mem_access_multi(xc_interface *xch, uint32_t domain_id,
 int xc_get_mem_access(xc_interface *xch, uint32_t domain_id,
                       uint64_t pfn, xenmem_access_t *access);
 
+/*
+ * Allows writes to the 128-byte sub-pages of pfn set in write_mask (bit n
+ * for bytes [128n, 128n + 127]), while its access type denies writes to the
+ * rest of the page.  A write_mask of ~0 removes the sub-page permissions.
+ */
+int xc_set_mem_access_subpage(xc_interface *xch, uint32_t domain_id,
+                              uint64_t pfn, uint32_t write_mask);
+
 /***
  * Monitor control operations.
  *
@@ -2031,6 +2221,15 @@ int xc_get_mem_access(xc_interface *xch, uint32_t domain_id,
  * Caller has to unmap this page when done.
  */
 void *xc_monitor_enable(xc_interface *xch, uint32_t domain_id, uint32_t *port);
+/*
+ * As xc_monitor_enable(), but sets up nr_rings rings (at most one per vCPU)
+ * to spread the events over: vCPU n posts to ring (n % nr_rings).  The
+ * rings are mapped at consecutive pages and the event channel of each is
+ * returned in ports[], so that each ring can be served by its own thread.
+ * Caller has to unmap the nr_rings pages when done.
+ */
+void *xc_monitor_enable_rings(xc_interface *xch, uint32_t domain_id,
+                              unsigned int nr_rings, uint32_t *ports);
 int xc_monitor_disable(xc_interface *xch, uint32_t domain_id);
 int xc_monitor_resume(xc_interface *xch, uint32_t domain_id);
 /*
@@ -2075,6 +2274,22 @@ int xc_monitor_emul_unimplemented(xc_interface *xch, uint32_t domain_id,
 int xc_monitor_emulate_each_rep(xc_interface *xch, uint32_t domain_id,
                                 bool enable);
 
+/**
+ * Have mem_access violations of type @access (MEM_ACCESS_R/W/X) on gfns
+ * [@gfn_start, @gfn_end] handled in the hypervisor as per @action
+ * (XEN_DOMCTL_MONITOR_FILTER_*), rather than sent to the monitor ring.
+ * Filters are tried in order; an @access of 0 disables @filter.
+ *
+ * @parm xch a handle to an open hypervisor interface.
+ * @parm domain_id the domain id.
+ * @parm filter the filter to set, below XEN_DOMCTL_MONITOR_ACCESS_FILTERS.
+ * @return 0 on success, -1 on failure.
+ */
+int xc_monitor_access_filter(xc_interface *xch, uint32_t domain_id,
+                             unsigned int filter, uint8_t access,
+                             uint8_t action, uint64_t gfn_start,
+                             uint64_t gfn_end);
+
 /***
  * Memory sharing operations.
  *
@@ -2213,6 +2428,26 @@ int xc_memshr_share_grefs(xc_interface *xch,
                     grant_ref_t client_gref,
                     uint64_t client_handle);
 
+/* Batched versions of the above, taking a list of pages and setting the
+ * status of each entry to what the single-page call would have returned
+ * (0, a negative errno value or -XENMEM_SHARING_OP_[SC]_HANDLE_INVALID).
+ * xc_memshr_nominate_gfns() nominates the source_gfn of each entry and sets
+ * its source_handle; xc_memshr_share_gfns_batch() shares the pages of each
+ * entry, the sources in source_domain and the clients in client_domain.
+ * Grant references aren't supported.
+ *
+ * Only fail if the list can't be accessed or the domains are unsuitable.
+ */
+int xc_memshr_nominate_gfns(xc_interface *xch,
+                            uint32_t domid,
+                            xen_mem_sharing_batch_entry_t *entries,
+                            uint32_t nr);
+int xc_memshr_share_gfns_batch(xc_interface *xch,
+                               uint32_t source_domain,
+                               uint32_t client_domain,
+                               xen_mem_sharing_batch_entry_t *entries,
+                               uint32_t nr);
+
 /* Allows to add to the guest physmap of the client domain a shared frame
  * directly.
  *
@@ -2244,6 +2479,33 @@ int xc_memshr_range_share(xc_interface *xch,
                           uint64_t first_gfn,
                           uint64_t last_gfn);
 
+/* Make a paused HVM domain a fork of another domain.  The fork gets the
+ * parent's vCPU and platform state, and its memory is populated from the
+ * parent as it gets accessed: reads share the parent's pages, writes copy
+ * them.  Memory sharing must be enabled on both domains, which need the
+ * same number of vCPUs.  The parent is kept paused until the fork is
+ * destroyed.
+ *
+ * The caller still has to set up the fork's event channels and grant table.
+ */
+int xc_memshr_fork(xc_interface *xch,
+                   uint32_t parent_domid,
+                   uint32_t domid);
+
+/* Make a new HVM domain a copy-on-write clone of a built template domain.
+ * All memory of the template is shared into the clone, whose physmap must
+ * still be empty, and the template's vCPU and platform state (HVM context)
+ * and the locations of its special pages are copied.  Both domains must
+ * be paused and have the same number of vCPUs.  The template is best kept
+ * paused: whatever it writes is unshared again.
+ *
+ * The caller still has to set up the clone's event channels, grant table
+ * and memory map.  Memory sharing gets enabled on both domains.
+ */
+int xc_domain_clone(xc_interface *xch,
+                    uint32_t template_domid,
+                    uint32_t clone_domid);
+
 /* Debug calls: return the number of pages referencing the shared frame backing
  * the input argument. Should be one or greater. 
  *
@@ -2327,6 +2589,7 @@ int xc_flask_access(xc_interface *xc_handle, const char *scon, const char *tcon,
                   uint32_t *auditallow, uint32_t *auditdeny,
                   uint32_t *seqno);
 int xc_flask_avc_cachestats(xc_interface *xc_handle, char *buf, int size);
+int xc_flask_avc_classstats(xc_interface *xc_handle, char *buf, int size);
 int xc_flask_policyvers(xc_interface *xc_handle);
 int xc_flask_avc_hashstats(xc_interface *xc_handle, char *buf, int size);
 int xc_flask_getavc_threshold(xc_interface *xc_handle);
@@ -2362,6 +2625,16 @@ void xc_compression_free_context(xc_interface *xch, comp_ctx *ctx);
 int xc_compression_add_page(xc_interface *xch, comp_ctx *ctx, char *page,
 			    unsigned long pfn, int israw);
 
+/**
+ * Drop any cached copy of a page, so the next time it is added it will be
+ * sent in full.  Used when the page is conveyed to the receiver by some
+ * other means.
+ *
+ * returns 0 on success, or -2 if the pfn is out of bounds.
+ */
+int xc_compression_forget_page(xc_interface *xch, comp_ctx *ctx,
+			       unsigned long pfn);
+
 /**
  * Delta compress pages in the compression buffer and inserts the
  * compressed data into the supplied compression buffer compbuf, whose
@@ -2478,6 +2751,18 @@ struct xc_resource_op {
 typedef struct xc_resource_op xc_resource_op_t;
 int xc_resource_op(xc_interface *xch, uint32_t nr_ops, xc_resource_op_t *ops);
 
+/*
+ * Issue the multicall in @call_list.  With XC_MULTICALL_UNORDERED the
+ * caller asserts that the entries don't depend on each other's effects or
+ * order; large batches are then split up and issued from several threads
+ * concurrently, so they run on several CPUs.  Each entry's result is in
+ * its result field on return, as for an ordinary multicall.  Returns 0, or
+ * -1 with errno set if (any part of) the multicall itself failed.
+ */
+#define XC_MULTICALL_UNORDERED (1U << 0)
+int xc_multicall(xc_interface *xch, xc_hypercall_buffer_t *call_list,
+                 uint32_t nr_calls, unsigned int flags);
+
 #if defined(__i386__) || defined(__x86_64__)
 enum xc_psr_cmt_type {
     XC_PSR_CMT_L3_OCCUPANCY,
@@ -2508,6 +2793,14 @@ int xc_psr_cmt_get_data(xc_interface *xch, uint32_t rmid, uint32_t cpu,
                         uint32_t psr_cmt_type, uint64_t *monitor_data,
                         uint64_t *tsc);
 int xc_psr_cmt_enabled(xc_interface *xch);
+typedef xen_sysctl_psr_cmt_sample_t xc_psr_cmt_sample_t;
+/*
+ * Read the monitoring data of all domains attached to CMT on @socket in one
+ * go.  On input *@num is the size of @samples, on output the number of
+ * attached domains (which may be larger).
+ */
+int xc_psr_cmt_get_samples(xc_interface *xch, uint32_t socket, uint32_t *num,
+                           xc_psr_cmt_sample_t *samples, uint64_t *tsc);
 
 int xc_psr_cat_set_domain_data(xc_interface *xch, uint32_t domid,
                                xc_psr_cat_type type, uint32_t target,
@@ -2536,6 +2829,21 @@ enum xc_static_cpu_featuremask {
 const uint32_t *xc_get_static_cpu_featuremask(enum xc_static_cpu_featuremask);
 const uint32_t *xc_get_feature_deep_deps(uint32_t feature);
 
+/* Load a microcode blob on each online CPU in turn. */
+int xc_microcode_update(xc_interface *xch, const void *buf, size_t len);
+
+typedef struct xenpf_ucode_cpu_stat xc_ucode_cpu_stat_t;
+/*
+ * Load a microcode blob on all cores at once, in a single rendezvous.
+ * stats has room for *nr_cpus entries, indexed by CPU id; on return
+ * *nr_cpus holds the number of CPU ids Xen has.  Per-CPU results are
+ * filled in even if the update fails.
+ */
+int xc_microcode_update_parallel(xc_interface *xch, const void *buf,
+                                 size_t len, uint32_t *nr_cpus,
+                                 xc_ucode_cpu_stat_t *stats,
+                                 uint64_t *total_ns);
+
 #endif
 
 int xc_livepatch_upload(xc_interface *xch,
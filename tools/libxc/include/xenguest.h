@@ -29,6 +29,12 @@
 #define XCFLAGS_HVM       (1 << 2)
 #define XCFLAGS_STDVGA    (1 << 3)
 #define XCFLAGS_CHECKPOINT_COMPRESS    (1 << 4)
+#define XCFLAGS_PIPELINE  (1 << 5)
+#define XCFLAGS_COMPRESS  (1 << 6)
+#define XCFLAGS_POSTCOPY  (1 << 7)
+#define XCFLAGS_AUTO_CONVERGE (1 << 8)
+#define XCFLAGS_DIRECT    (1 << 9) /* restore: read pages into the guest */
+#define XCFLAGS_IMAGE     (1 << 10) /* save: pfn-indexed pages in the file */
 
 #define X86_64_B_SIZE   64 
 #define X86_32_B_SIZE   32
@@ -72,6 +78,10 @@ struct save_callbacks {
 #define XGS_POLICY_CONTINUE_PRECOPY 0  /* Remain in the precopy phase. */
 #define XGS_POLICY_STOP_AND_COPY    1  /* Immediately suspend and transmit the
                                         * remaining dirty pages. */
+#define XGS_POLICY_POSTCOPY         2  /* Suspend, and let the guest resume
+                                        * on the destination before the
+                                        * remaining dirty pages are sent.
+                                        * Requires XCFLAGS_POSTCOPY. */
     precopy_policy_t precopy_policy;
 
     /*
@@ -130,6 +140,11 @@ typedef enum {
  * @param stream_type XC_MIG_STREAM_NONE if the far end of the stream
  *        doesn't use checkpointing
  * @return 0 on success, -1 on failure
+ *
+ * With XCFLAGS_IMAGE (HVM only), @fd must be a regular file: page contents
+ * are written at pfn-indexed offsets well beyond the stream itself, leaving
+ * holes for zero pages, and only the pfn lists go into the stream.  The
+ * image is restored from the same file by xc_domain_restore().
  */
 int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
                    uint32_t flags /* XCFLAGS_xxx */,
@@ -172,6 +187,17 @@ struct restore_callbacks {
     void (*restore_results)(xen_pfn_t store_gfn, xen_pfn_t console_gfn,
                             void *data);
 
+    /*
+     * Called during a post-copy migration, once all state other than the
+     * outstanding memory has been restored, and after restore_results().
+     * The callback may complete the domain's setup and unpause it; pages
+     * it touches will be fetched on demand.  If NULL, the domain remains
+     * paused until the restore completes.
+     *
+     * returns 1 on success, 0 on failure.
+     */
+    int (*postcopy_transition)(void *data);
+
     /* to be provided as the last argument to each callback function */
     void* data;
 };
@@ -189,6 +215,9 @@ struct restore_callbacks {
  * @parm hvm non-zero if this is a HVM restore
  * @parm pae non-zero if this HVM domain has PAE support enabled
  * @parm stream_type non-zero if the far end of the stream is using checkpointing
+ * @parm flags XCFLAGS_DIRECT to read page data from the stream straight into
+ *       guest memory, rather than reading ahead on a separate thread and
+ *       copying.  Only honoured for plain (non-checkpointed) streams.
  * @parm callbacks non-NULL to receive a callback to restore toolstack
  *       specific data
  * @return 0 on success, -1 on failure
@@ -198,7 +227,7 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
                       uint32_t store_domid, unsigned int console_evtchn,
                       unsigned long *console_mfn, uint32_t console_domid,
                       unsigned int hvm, unsigned int pae,
-                      xc_migration_stream_t stream_type,
+                      xc_migration_stream_t stream_type, uint32_t flags,
                       struct restore_callbacks *callbacks, int send_back_fd);
 
 /**
@@ -280,6 +309,18 @@ int xc_query_page_offline_status(xc_interface *xch, unsigned long start,
 
 int xc_exchange_page(xc_interface *xch, uint32_t domid, xen_pfn_t mfn);
 
+/*
+ * Move the offline pending pages @mfns of HVM guest @domid to new frames,
+ * so that their offlining completes: the guest is paused, and the pages
+ * are copied and remapped at the same gfns in batches.  Pages without a
+ * gfn or which are granted are skipped.
+ *
+ * Returns the number of pages moved, -1 if the guest was left intact, or
+ * -2 if the guest lost memory on the way.
+ */
+int xc_exchange_hvm_pages(xc_interface *xch, uint32_t domid,
+                          const xen_pfn_t *mfns, unsigned int nr);
+
 
 /**
  * Memory related information, such as PFN types, the P2M table,
@@ -38,6 +38,36 @@
 
 #ifndef __MINIOS__
 
+#if defined(HAVE_BZLIB) || defined(HAVE_LZMA) || defined(HAVE_LZO1X)
+/*
+ * Linux appends the size of the decompressed kernel to the compressed
+ * payload of a bzImage, as the LZ4 decoder relies on.  Use it to size the
+ * output buffer up-front rather than growing (and copying) it repeatedly
+ * while decompressing.  It is only a hint: if it doesn't look sane the
+ * size of the input is used instead, and the buffer is still grown if it
+ * turns out to be too small.  The bit of slack lets the decoder see the
+ * end of the stream without the buffer ever filling up.
+ */
+static size_t output_size_hint(struct xc_dom_image *dom)
+{
+    const unsigned char *tail;
+    size_t hint;
+
+    if ( dom->kernel_size < 4 )
+        return dom->kernel_size;
+
+    tail = (const unsigned char *)dom->kernel_blob + dom->kernel_size - 4;
+    hint = tail[0] | (tail[1] << 8) | (tail[2] << 16) |
+           ((size_t)tail[3] << 24);
+
+    if ( hint < dom->kernel_size ||
+         (dom->max_kernel_size && hint > dom->max_kernel_size) )
+        return dom->kernel_size;
+
+    return hint + XC_PAGE_SIZE;
+}
+#endif
+
 #if defined(HAVE_BZLIB)
 
 #include <bzlib.h>
@@ -51,6 +81,7 @@ static int xc_try_bzip2_decode(
     char *tmp_buf;
     int retval = -1;
     unsigned int outsize;
+    size_t hint;
     uint64_t total;
 
     stream.bzalloc = NULL;
@@ -70,22 +101,21 @@ static int xc_try_bzip2_decode(
         return -1;
     }
 
-    /* sigh.  We don't know up-front how much memory we are going to need
-     * for the output buffer.  Allocate the output buffer to be equal
-     * the input buffer to start, and we'll realloc as needed.
-     */
-    outsize = dom->kernel_size;
-
     /*
      * stream.avail_in and outsize are unsigned int, while kernel_size
      * is a size_t. Check we aren't overflowing.
      */
-    if ( outsize != dom->kernel_size )
+    if ( (unsigned int)dom->kernel_size != dom->kernel_size )
     {
         DOMPRINTF("BZIP2: Input too large");
         goto bzip2_cleanup;
     }
 
+    hint = output_size_hint(dom);
+    outsize = hint;
+    if ( outsize != hint )
+        outsize = dom->kernel_size;
+
     out_buf = malloc(outsize);
     if ( out_buf == NULL )
     {
@@ -97,7 +127,7 @@ static int xc_try_bzip2_decode(
     stream.avail_in = dom->kernel_size;
 
     stream.next_out = out_buf;
-    stream.avail_out = dom->kernel_size;
+    stream.avail_out = outsize;
 
     for ( ; ; )
     {
@@ -216,11 +246,7 @@ static int _xc_try_lzma_decode(
         return -1;
     }
 
-    /* sigh.  We don't know up-front how much memory we are going to need
-     * for the output buffer.  Allocate the output buffer to be equal
-     * the input buffer to start, and we'll realloc as needed.
-     */
-    outsize = dom->kernel_size;
+    outsize = output_size_hint(dom);
     out_buf = malloc(outsize);
     if ( out_buf == NULL )
     {
@@ -232,7 +258,7 @@ static int _xc_try_lzma_decode(
     stream->avail_in = dom->kernel_size;
 
     stream->next_out = out_buf;
-    stream->avail_out = dom->kernel_size;
+    stream->avail_out = outsize;
 
     for ( ; ; )
     {
@@ -409,7 +435,7 @@ static int xc_try_lzo1x_decode(
     int ret;
     const unsigned char *cur = dom->kernel_blob;
     unsigned char *out_buf = NULL;
-    size_t left = dom->kernel_size;
+    size_t left = dom->kernel_size, out_size = 0;
     const char *msg;
     unsigned version;
     static const unsigned char magic[] = {
@@ -515,12 +541,17 @@ static int xc_try_lzo1x_decode(
         if ( xc_dom_kernel_check_size(dom, *size + dst_len) )
             break;
 
-        msg = "Failed to (re)alloc memory";
-        tmp_buf = realloc(out_buf, *size + dst_len);
-        if ( tmp_buf == NULL )
-            break;
+        /* Most of the time the first allocation is large enough. */
+        if ( *size + dst_len > out_size )
+        {
+            out_size = max(*size + dst_len, output_size_hint(dom));
+            msg = "Failed to (re)alloc memory";
+            tmp_buf = realloc(out_buf, out_size);
+            if ( tmp_buf == NULL )
+                break;
+            out_buf = tmp_buf;
+        }
 
-        out_buf = tmp_buf;
         out_len = dst_len;
 
         ret = lzo1x_decompress_safe(cur, src_len,
@@ -30,6 +30,8 @@
 #include <inttypes.h>
 #include <zlib.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "xg_private.h"
 #include "xc_dom.h"
@@ -330,6 +332,131 @@ int xc_dom_ramdisk_check_size(struct xc_dom_image *dom, size_t sz)
     return 0;
 }
 
+/* ------------------------------------------------------------------------ */
+/* decompressed kernel cache                                                */
+
+/*
+ * Every build of a guest from the same compressed kernel decompresses it
+ * again, which for xz or lzma images takes longer than the rest of the
+ * build.  Processes which build many domains keep the most recently used
+ * decompressed images here, keyed by the identity of the file they came
+ * from, and copy them instead.
+ */
+#define KERNEL_CACHE_MAX_BYTES  (64 << 20)
+
+struct kernel_cache_entry {
+    struct kernel_cache_entry *next;
+    struct xc_dom_file_id id;
+    size_t size;
+    unsigned char blob[];
+};
+
+static pthread_mutex_t kernel_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct kernel_cache_entry *kernel_cache; /* most recently used first */
+static size_t kernel_cache_bytes;
+
+static int kernel_cache_id(const char *filename, struct xc_dom_file_id *id)
+{
+    struct stat st;
+
+    if ( stat(filename, &st) != 0 || !S_ISREG(st.st_mode) )
+        return -1;
+
+    memset(id, 0, sizeof(*id));
+    id->dev = st.st_dev;
+    id->ino = st.st_ino;
+    id->size = st.st_size;
+    id->mtime_sec = st.st_mtim.tv_sec;
+    id->mtime_nsec = st.st_mtim.tv_nsec;
+
+    return 0;
+}
+
+/* Copy a cached image into dom->kernel_blob.  Returns 0 on a hit. */
+static int kernel_cache_get(struct xc_dom_image *dom)
+{
+    struct kernel_cache_entry **pe, *e;
+    int rc = -1;
+
+    pthread_mutex_lock(&kernel_cache_lock);
+
+    for ( pe = &kernel_cache; (e = *pe) != NULL; pe = &e->next )
+    {
+        if ( memcmp(&e->id, &dom->kernel_id, sizeof(e->id)) )
+            continue;
+
+        if ( xc_dom_kernel_check_size(dom, e->size) )
+            break;
+
+        dom->kernel_blob = xc_dom_malloc(dom, e->size);
+        if ( dom->kernel_blob == NULL )
+            break;
+
+        memcpy(dom->kernel_blob, e->blob, e->size);
+        dom->kernel_size = e->size;
+
+        *pe = e->next;
+        e->next = kernel_cache;
+        kernel_cache = e;
+        rc = 0;
+        break;
+    }
+
+    pthread_mutex_unlock(&kernel_cache_lock);
+
+    return rc;
+}
+
+static void kernel_cache_put(struct xc_dom_image *dom)
+{
+    struct kernel_cache_entry **pe, *e;
+
+    if ( dom->kernel_size > KERNEL_CACHE_MAX_BYTES )
+        return;
+
+    e = malloc(sizeof(*e) + dom->kernel_size);
+    if ( e == NULL )
+        return;
+
+    e->id = dom->kernel_id;
+    e->size = dom->kernel_size;
+    memcpy(e->blob, dom->kernel_blob, e->size);
+
+    pthread_mutex_lock(&kernel_cache_lock);
+
+    /* Drop an older copy, which another thread may have added meanwhile. */
+    for ( pe = &kernel_cache; *pe != NULL; pe = &(*pe)->next )
+    {
+        if ( !memcmp(&(*pe)->id, &e->id, sizeof(e->id)) )
+        {
+            struct kernel_cache_entry *old = *pe;
+
+            *pe = old->next;
+            kernel_cache_bytes -= old->size;
+            free(old);
+            break;
+        }
+    }
+
+    e->next = kernel_cache;
+    kernel_cache = e;
+    kernel_cache_bytes += e->size;
+
+    /* Evict the least recently used images until under the limit. */
+    while ( kernel_cache_bytes > KERNEL_CACHE_MAX_BYTES )
+    {
+        for ( pe = &kernel_cache; (*pe)->next != NULL; pe = &(*pe)->next )
+            ;
+        kernel_cache_bytes -= (*pe)->size;
+        free(*pe);
+        *pe = NULL;
+    }
+
+    pthread_mutex_unlock(&kernel_cache_lock);
+
+    DOMPRINTF("%s: cached %zu byte kernel", __FUNCTION__, dom->kernel_size);
+}
+
 /* ------------------------------------------------------------------------ */
 /* read files, copy memory blocks, with transparent gunzip                  */
 
@@ -813,11 +940,23 @@ int xc_dom_devicetree_max_size(struct xc_dom_image *dom, size_t sz)
 
 int xc_dom_kernel_file(struct xc_dom_image *dom, const char *filename)
 {
+    bool cacheable;
+
     DOMPRINTF("%s: filename=\"%s\"", __FUNCTION__, filename);
+
+    cacheable = !kernel_cache_id(filename, &dom->kernel_id);
+    if ( cacheable && !kernel_cache_get(dom) )
+    {
+        DOMPRINTF("%s: using cached decompressed kernel", __FUNCTION__);
+        return 0;
+    }
+
     dom->kernel_blob = xc_dom_malloc_filemap(dom, filename, &dom->kernel_size,
                                              dom->max_kernel_size);
     if ( dom->kernel_blob == NULL )
         return -1;
+    if ( cacheable )
+        dom->kernel_file_blob = dom->kernel_blob;
     return xc_dom_try_gunzip(dom, &dom->kernel_blob, &dom->kernel_size);
 }
 
@@ -890,6 +1029,10 @@ int xc_dom_parse_image(struct xc_dom_image *dom)
         goto err;
     if ( dom->kernel_loader->parser(dom) != 0 )
         goto err;
+
+    /* Remember the result if gunzip or a loader unpacked the file. */
+    if ( dom->kernel_file_blob && dom->kernel_blob != dom->kernel_file_blob )
+        kernel_cache_put(dom);
     if ( dom->guest_type == NULL )
     {
         xc_dom_panic(dom->xch, XC_INTERNAL_ERROR,
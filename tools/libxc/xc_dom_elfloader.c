@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "xg_private.h"
 #include "xc_dom.h"
@@ -207,9 +209,161 @@ out:
     return rc;
 }
 
+/*
+ * Loadable segments are collected by elf_load_binary() and copied
+ * afterwards in chunks of ELF_LOAD_CHUNK bytes.  Kernels of at least
+ * ELF_LOAD_PARALLEL_MIN bytes are copied, and their BSS cleared, by up to
+ * ELF_LOAD_MAX_THREADS threads, which matters for large unikernels and
+ * debug kernels.  Segments which overlap are copied in order by a single
+ * thread, so that such images load exactly as before.
+ */
+#define ELF_LOAD_CHUNK        (4UL << 20)
+#define ELF_LOAD_PARALLEL_MIN (32UL << 20)
+#define ELF_LOAD_MAX_THREADS  4
+
+struct elf_load_job {
+    void *dst;
+    const void *src;            /* NULL: clear dst. */
+    size_t len;
+};
+
+struct elf_load {
+    struct elf_load_job *jobs;
+    unsigned int nr_jobs, max_jobs;
+    size_t total;
+    bool overlap;
+    bool nomem;
+
+    /* Destinations of the segments seen so far. */
+    struct {
+        char *start, *end;
+    } *segs;
+    unsigned int nr_segs;
+
+    pthread_mutex_t lock;
+    unsigned int next;
+};
+
+static void elf_load_add_job(struct elf_load *ld, void *dst, const void *src,
+                             uint64_t len)
+{
+    while ( len )
+    {
+        size_t chunk = len < ELF_LOAD_CHUNK ? len : ELF_LOAD_CHUNK;
+
+        if ( ld->nr_jobs == ld->max_jobs )
+        {
+            unsigned int max = ld->max_jobs ? ld->max_jobs * 2 : 64;
+            struct elf_load_job *jobs = realloc(ld->jobs, max * sizeof(*jobs));
+
+            if ( !jobs )
+            {
+                ld->nomem = true;
+                return;
+            }
+            ld->jobs = jobs;
+            ld->max_jobs = max;
+        }
+
+        ld->jobs[ld->nr_jobs].dst = dst;
+        ld->jobs[ld->nr_jobs].src = src;
+        ld->jobs[ld->nr_jobs].len = chunk;
+        ld->nr_jobs++;
+        ld->total += chunk;
+
+        dst += chunk;
+        if ( src )
+            src += chunk;
+        len -= chunk;
+    }
+}
+
+static void elf_load_segment_cb(struct elf_binary *elf, void *caller_data,
+                                void *dst, const void *src,
+                                uint64_t filesz, uint64_t memsz)
+{
+    struct elf_load *ld = caller_data;
+    char *start = dst, *end = start + memsz;
+    unsigned int i;
+    void *segs;
+
+    for ( i = 0; i < ld->nr_segs; i++ )
+        if ( start < ld->segs[i].end && ld->segs[i].start < end )
+            ld->overlap = true;
+
+    segs = realloc(ld->segs, (ld->nr_segs + 1) * sizeof(*ld->segs));
+    if ( !segs )
+    {
+        ld->nomem = true;
+        return;
+    }
+    ld->segs = segs;
+    ld->segs[ld->nr_segs].start = start;
+    ld->segs[ld->nr_segs].end = end;
+    ld->nr_segs++;
+
+    elf_load_add_job(ld, dst, src, filesz);
+    elf_load_add_job(ld, start + filesz, NULL, memsz - filesz);
+}
+
+static void *elf_load_worker(void *arg)
+{
+    struct elf_load *ld = arg;
+    const struct elf_load_job *job;
+
+    for ( ; ; )
+    {
+        pthread_mutex_lock(&ld->lock);
+        job = ld->next < ld->nr_jobs ? &ld->jobs[ld->next++] : NULL;
+        pthread_mutex_unlock(&ld->lock);
+
+        if ( !job )
+            break;
+
+        if ( job->src )
+            memcpy(job->dst, job->src, job->len);
+        else
+            memset(job->dst, 0, job->len);
+    }
+
+    return NULL;
+}
+
+static void elf_load_run(struct xc_dom_image *dom, struct elf_load *ld)
+{
+    pthread_t threads[ELF_LOAD_MAX_THREADS];
+    long i, nr_threads = 1;
+
+    if ( !ld->overlap && ld->total >= ELF_LOAD_PARALLEL_MIN )
+    {
+        nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if ( nr_threads > ELF_LOAD_MAX_THREADS )
+            nr_threads = ELF_LOAD_MAX_THREADS;
+        if ( nr_threads > ld->nr_jobs )
+            nr_threads = ld->nr_jobs;
+        if ( nr_threads < 1 )
+            nr_threads = 1;
+    }
+
+    pthread_mutex_init(&ld->lock, NULL);
+    ld->next = 0;
+    for ( i = 1; i < nr_threads; i++ )
+        if ( pthread_create(&threads[i], NULL, elf_load_worker, ld) )
+            break;
+    nr_threads = i;
+    elf_load_worker(ld);
+    for ( i = 1; i < nr_threads; i++ )
+        pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&ld->lock);
+
+    DOMPRINTF("%s: %zu bytes in %u chunks, %ld thread(s)", __FUNCTION__,
+              ld->total, ld->nr_jobs, nr_threads);
+}
+
 static elf_errorstatus xc_dom_load_elf_kernel(struct xc_dom_image *dom)
 {
     struct elf_binary *elf = dom->private_loader;
+    struct elf_load ld = { 0 };
     elf_errorstatus rc;
     xen_pfn_t pages;
 
@@ -222,13 +376,32 @@ static elf_errorstatus xc_dom_load_elf_kernel(struct xc_dom_image *dom)
     }
     elf->dest_size = pages * XC_DOM_PAGE_SIZE(dom);
 
+    /*
+     * The kernel is already mmap()ed (unless it had to be decompressed),
+     * so segments are copied straight from the file into guest memory.
+     */
+    elf_set_load_segment(elf, elf_load_segment_cb, &ld);
     rc = elf_load_binary(elf);
+    elf_set_load_segment(elf, NULL, NULL);
     if ( rc < 0 )
     {
         DOMPRINTF("%s: failed to load elf binary", __FUNCTION__);
-        return rc;
+        goto out;
     }
-    return 0;
+
+    if ( ld.nomem )
+    {
+        DOMPRINTF("%s: out of memory queueing elf segments", __FUNCTION__);
+        rc = -1;
+        goto out;
+    }
+
+    elf_load_run(dom, &ld);
+
+ out:
+    free(ld.segs);
+    free(ld.jobs);
+    return rc;
 }
 
 /* ------------------------------------------------------------------------ */
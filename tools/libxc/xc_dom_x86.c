@@ -27,6 +27,7 @@
 #include <string.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <xen/xen.h>
 #include <xen/foreign/x86_32.h>
@@ -1226,15 +1227,244 @@ static int check_mmio_hole(uint64_t start, uint64_t memsize,
         return 1;
 }
 
+struct populate_hvm_stats {
+    unsigned long normal_pages, pages_2mb, pages_1gb;
+};
+
+struct populate_hvm {
+    struct xc_dom_image *dom;
+    const xen_vmemrange_t *vmemranges;
+    const unsigned int *vnode_to_pnode;
+    unsigned int nr_vmemranges;
+    unsigned int memflags;
+
+    pthread_mutex_t lock;
+    /* Work not handed out yet: from page next of vmemranges[vmemid] on. */
+    unsigned int vmemid;
+    unsigned long next;
+    /* Progress and result. */
+    unsigned long done_pages, total_pages;
+    struct populate_hvm_stats stats;
+    int rc;
+};
+
+/*
+ * Guest memory is populated in chunks of this many pages by up to
+ * POPULATE_HVM_MAX_THREADS threads, so that page scrubbing and p2m updates
+ * for large guests proceed on several CPUs at once.  Chunks are 1GB
+ * aligned and so never split a superpage.
+ */
+#define POPULATE_HVM_CHUNK_PAGES (8 * SUPERPAGE_1GB_NR_PFNS)
+#define POPULATE_HVM_MAX_THREADS 8
+
+/*
+ * Populate [cur_pages, end_pages), trying 1GB, then 2MB, then 4kB extents.
+ * Returns 0 or -1.
+ */
+static int populate_hvm_range(struct populate_hvm *ph,
+                              unsigned long cur_pages, unsigned long end_pages,
+                              unsigned int memflags,
+                              struct populate_hvm_stats *stats)
+{
+    struct xc_dom_image *dom = ph->dom;
+    xc_interface *xch = dom->xch;
+    uint32_t domid = dom->guest_domid;
+    unsigned long i, cur_pfn;
+    int rc = 0;
+
+    while ( (rc == 0) && (end_pages > cur_pages) )
+    {
+        /* Clip count to maximum 1GB extent. */
+        unsigned long count = end_pages - cur_pages;
+        unsigned long max_pages = SUPERPAGE_1GB_NR_PFNS;
+
+        if ( count > max_pages )
+            count = max_pages;
+
+        cur_pfn = dom->p2m_host[cur_pages];
+
+        /* Take care the corner cases of super page tails */
+        if ( ((cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
+             (count > (-cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1))) )
+            count = -cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1);
+        else if ( ((count & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
+                  (count > SUPERPAGE_1GB_NR_PFNS) )
+            count &= ~(SUPERPAGE_1GB_NR_PFNS - 1);
+
+        /* Attemp to allocate 1GB super page. Because in each pass
+         * we only allocate at most 1GB, we don't have to clip
+         * super page boundaries.
+         */
+        if ( ((count | cur_pfn) & (SUPERPAGE_1GB_NR_PFNS - 1)) == 0 &&
+             /* Check if there exists MMIO hole in the 1GB memory
+              * range */
+             !check_mmio_hole(cur_pfn << PAGE_SHIFT,
+                              SUPERPAGE_1GB_NR_PFNS << PAGE_SHIFT,
+                              dom->mmio_start, dom->mmio_size) )
+        {
+            long done;
+            unsigned long nr_extents = count >> SUPERPAGE_1GB_SHIFT;
+            xen_pfn_t sp_extents[nr_extents];
+
+            for ( i = 0; i < nr_extents; i++ )
+                sp_extents[i] =
+                    dom->p2m_host[cur_pages+(i<<SUPERPAGE_1GB_SHIFT)];
+
+            done = xc_domain_populate_physmap(xch, domid, nr_extents,
+                                              SUPERPAGE_1GB_SHIFT,
+                                              memflags, sp_extents);
+
+            if ( done > 0 )
+            {
+                stats->pages_1gb += done;
+                done <<= SUPERPAGE_1GB_SHIFT;
+                cur_pages += done;
+                count -= done;
+            }
+        }
+
+        if ( count != 0 )
+        {
+            /* Clip count to maximum 8MB extent. */
+            max_pages = SUPERPAGE_2MB_NR_PFNS * 4;
+            if ( count > max_pages )
+                count = max_pages;
+
+            /* Clip partial superpage extents to superpage
+             * boundaries. */
+            if ( ((cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
+                 (count > (-cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1))) )
+                count = -cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1);
+            else if ( ((count & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
+                      (count > SUPERPAGE_2MB_NR_PFNS) )
+                count &= ~(SUPERPAGE_2MB_NR_PFNS - 1); /* clip non-s.p. tail */
+
+            /* Attempt to allocate superpage extents. */
+            if ( ((count | cur_pfn) & (SUPERPAGE_2MB_NR_PFNS - 1)) == 0 )
+            {
+                long done;
+                unsigned long nr_extents = count >> SUPERPAGE_2MB_SHIFT;
+                xen_pfn_t sp_extents[nr_extents];
+
+                for ( i = 0; i < nr_extents; i++ )
+                    sp_extents[i] =
+                        dom->p2m_host[cur_pages+(i<<SUPERPAGE_2MB_SHIFT)];
+
+                done = xc_domain_populate_physmap(xch, domid, nr_extents,
+                                                  SUPERPAGE_2MB_SHIFT,
+                                                  memflags, sp_extents);
+
+                if ( done > 0 )
+                {
+                    stats->pages_2mb += done;
+                    done <<= SUPERPAGE_2MB_SHIFT;
+                    cur_pages += done;
+                    count -= done;
+                }
+            }
+        }
+
+        /* Fall back to 4kB extents. */
+        if ( count != 0 )
+        {
+            rc = xc_domain_populate_physmap_exact(
+                xch, domid, count, 0, memflags, &dom->p2m_host[cur_pages]);
+            cur_pages += count;
+            stats->normal_pages += count;
+        }
+    }
+
+    return rc;
+}
+
+/* Start handing out vmemranges[ph->vmemid]; called with ph->lock held. */
+static void populate_hvm_start(struct populate_hvm *ph)
+{
+    ph->next = ph->vmemranges[ph->vmemid].start >> PAGE_SHIFT;
+
+    /*
+     * Consider vga hole belongs to the vmemrange that covers
+     * 0xA0000-0xC0000. Note that 0x00000-0xA0000 is populated before
+     * any of this.
+     */
+    if ( ph->next == 0 && ph->dom->device_model )
+    {
+        ph->next = 0xc0;
+        ph->done_pages += 0xc0;
+        ph->stats.normal_pages += 0xc0;
+    }
+}
+
+/* Hand out the next chunk; called with ph->lock held. */
+static bool populate_hvm_next(struct populate_hvm *ph, unsigned long *start,
+                              unsigned long *end, unsigned int *memflags)
+{
+    const xen_vmemrange_t *range;
+    unsigned int pnode;
+
+    while ( ph->vmemid < ph->nr_vmemranges )
+    {
+        range = &ph->vmemranges[ph->vmemid];
+        if ( ph->next < (range->end >> PAGE_SHIFT) )
+            break;
+        if ( ++ph->vmemid < ph->nr_vmemranges )
+            populate_hvm_start(ph);
+    }
+
+    if ( ph->rc || ph->vmemid >= ph->nr_vmemranges )
+        return false;
+
+    range = &ph->vmemranges[ph->vmemid];
+    *start = ph->next;
+    *end = min((unsigned long)(range->end >> PAGE_SHIFT),
+               (*start + POPULATE_HVM_CHUNK_PAGES) &
+               ~(POPULATE_HVM_CHUNK_PAGES - 1));
+    ph->next = *end;
+
+    *memflags = ph->memflags;
+    pnode = ph->vnode_to_pnode[range->nid];
+    if ( pnode != XC_NUMA_NO_NODE )
+        *memflags |= XENMEMF_exact_node(pnode);
+
+    return true;
+}
+
+static void *populate_hvm_worker(void *arg)
+{
+    struct populate_hvm *ph = arg;
+    struct populate_hvm_stats stats;
+    unsigned long start, end;
+    unsigned int memflags;
+    int rc;
+
+    pthread_mutex_lock(&ph->lock);
+    while ( populate_hvm_next(ph, &start, &end, &memflags) )
+    {
+        pthread_mutex_unlock(&ph->lock);
+
+        memset(&stats, 0, sizeof(stats));
+        rc = populate_hvm_range(ph, start, end, memflags, &stats);
+
+        pthread_mutex_lock(&ph->lock);
+        if ( rc && !ph->rc )
+            ph->rc = rc;
+        ph->stats.normal_pages += stats.normal_pages;
+        ph->stats.pages_2mb += stats.pages_2mb;
+        ph->stats.pages_1gb += stats.pages_1gb;
+        ph->done_pages += end - start;
+        xc_report_progress_step(ph->dom->xch, ph->done_pages, ph->total_pages);
+    }
+    pthread_mutex_unlock(&ph->lock);
+
+    return NULL;
+}
+
 static int meminit_hvm(struct xc_dom_image *dom)
 {
     unsigned long i, vmemid, nr_pages = dom->total_pages;
     unsigned long p2m_size;
     unsigned long target_pages = dom->target_pages;
-    unsigned long cur_pages, cur_pfn;
     int rc;
-    unsigned long stat_normal_pages = 0, stat_2mb_pages = 0, 
-        stat_1gb_pages = 0;
     unsigned int memflags = 0;
     int claim_enabled = dom->claim_enabled;
     uint64_t total_pages;
@@ -1245,6 +1475,9 @@ static int meminit_hvm(struct xc_dom_image *dom)
     unsigned int nr_vmemranges, nr_vnodes;
     xc_interface *xch = dom->xch;
     uint32_t domid = dom->guest_domid;
+    struct populate_hvm ph;
+    pthread_t threads[POPULATE_HVM_MAX_THREADS];
+    long nr_threads;
 
     if ( nr_pages > target_pages )
         memflags |= XENMEMF_populate_on_demand;
@@ -1388,145 +1621,48 @@ static int meminit_hvm(struct xc_dom_image *dom)
         }
     }
 
-    stat_normal_pages = 0;
-    for ( vmemid = 0; vmemid < nr_vmemranges; vmemid++ )
+    ph.dom = dom;
+    ph.vmemranges = vmemranges;
+    ph.vnode_to_pnode = vnode_to_pnode;
+    ph.nr_vmemranges = nr_vmemranges;
+    ph.memflags = memflags;
+    ph.vmemid = 0;
+    ph.done_pages = 0;
+    ph.total_pages = nr_pages;
+    memset(&ph.stats, 0, sizeof(ph.stats));
+    ph.rc = 0;
+    populate_hvm_start(&ph);
+    pthread_mutex_init(&ph.lock, NULL);
+
+    nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( nr_threads > POPULATE_HVM_MAX_THREADS )
+        nr_threads = POPULATE_HVM_MAX_THREADS;
+    if ( nr_threads > nr_pages / POPULATE_HVM_CHUNK_PAGES )
+        nr_threads = nr_pages / POPULATE_HVM_CHUNK_PAGES;
+    if ( nr_threads < 1 )
+        nr_threads = 1;
+
+    xc_set_progress_prefix(xch, "Populating guest memory");
+    for ( i = 1; i < nr_threads; i++ )
+        if ( pthread_create(&threads[i], NULL, populate_hvm_worker, &ph) )
+            break;
+    nr_threads = i;
+    populate_hvm_worker(&ph);
+    for ( i = 1; i < nr_threads; i++ )
+        pthread_join(threads[i], NULL);
+    xc_set_progress_prefix(xch, NULL);
+    pthread_mutex_destroy(&ph.lock);
+
+    if ( ph.rc != 0 )
     {
-        unsigned int new_memflags = memflags;
-        uint64_t end_pages;
-        unsigned int vnode = vmemranges[vmemid].nid;
-        unsigned int pnode = vnode_to_pnode[vnode];
-
-        if ( pnode != XC_NUMA_NO_NODE )
-            new_memflags |= XENMEMF_exact_node(pnode);
-
-        end_pages = vmemranges[vmemid].end >> PAGE_SHIFT;
-        /*
-         * Consider vga hole belongs to the vmemrange that covers
-         * 0xA0000-0xC0000. Note that 0x00000-0xA0000 is populated just
-         * before this loop.
-         */
-        if ( vmemranges[vmemid].start == 0 && dom->device_model )
-        {
-            cur_pages = 0xc0;
-            stat_normal_pages += 0xc0;
-        }
-        else
-            cur_pages = vmemranges[vmemid].start >> PAGE_SHIFT;
-
-        rc = 0;
-        while ( (rc == 0) && (end_pages > cur_pages) )
-        {
-            /* Clip count to maximum 1GB extent. */
-            unsigned long count = end_pages - cur_pages;
-            unsigned long max_pages = SUPERPAGE_1GB_NR_PFNS;
-
-            if ( count > max_pages )
-                count = max_pages;
-
-            cur_pfn = dom->p2m_host[cur_pages];
-
-            /* Take care the corner cases of super page tails */
-            if ( ((cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
-                 (count > (-cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1))) )
-                count = -cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1);
-            else if ( ((count & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
-                      (count > SUPERPAGE_1GB_NR_PFNS) )
-                count &= ~(SUPERPAGE_1GB_NR_PFNS - 1);
-
-            /* Attemp to allocate 1GB super page. Because in each pass
-             * we only allocate at most 1GB, we don't have to clip
-             * super page boundaries.
-             */
-            if ( ((count | cur_pfn) & (SUPERPAGE_1GB_NR_PFNS - 1)) == 0 &&
-                 /* Check if there exists MMIO hole in the 1GB memory
-                  * range */
-                 !check_mmio_hole(cur_pfn << PAGE_SHIFT,
-                                  SUPERPAGE_1GB_NR_PFNS << PAGE_SHIFT,
-                                  dom->mmio_start, dom->mmio_size) )
-            {
-                long done;
-                unsigned long nr_extents = count >> SUPERPAGE_1GB_SHIFT;
-                xen_pfn_t sp_extents[nr_extents];
-
-                for ( i = 0; i < nr_extents; i++ )
-                    sp_extents[i] =
-                        dom->p2m_host[cur_pages+(i<<SUPERPAGE_1GB_SHIFT)];
-
-                done = xc_domain_populate_physmap(xch, domid, nr_extents,
-                                                  SUPERPAGE_1GB_SHIFT,
-                                                  new_memflags, sp_extents);
-
-                if ( done > 0 )
-                {
-                    stat_1gb_pages += done;
-                    done <<= SUPERPAGE_1GB_SHIFT;
-                    cur_pages += done;
-                    count -= done;
-                }
-            }
-
-            if ( count != 0 )
-            {
-                /* Clip count to maximum 8MB extent. */
-                max_pages = SUPERPAGE_2MB_NR_PFNS * 4;
-                if ( count > max_pages )
-                    count = max_pages;
-
-                /* Clip partial superpage extents to superpage
-                 * boundaries. */
-                if ( ((cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
-                     (count > (-cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1))) )
-                    count = -cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1);
-                else if ( ((count & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
-                          (count > SUPERPAGE_2MB_NR_PFNS) )
-                    count &= ~(SUPERPAGE_2MB_NR_PFNS - 1); /* clip non-s.p. tail */
-
-                /* Attempt to allocate superpage extents. */
-                if ( ((count | cur_pfn) & (SUPERPAGE_2MB_NR_PFNS - 1)) == 0 )
-                {
-                    long done;
-                    unsigned long nr_extents = count >> SUPERPAGE_2MB_SHIFT;
-                    xen_pfn_t sp_extents[nr_extents];
-
-                    for ( i = 0; i < nr_extents; i++ )
-                        sp_extents[i] =
-                            dom->p2m_host[cur_pages+(i<<SUPERPAGE_2MB_SHIFT)];
-
-                    done = xc_domain_populate_physmap(xch, domid, nr_extents,
-                                                      SUPERPAGE_2MB_SHIFT,
-                                                      new_memflags, sp_extents);
-
-                    if ( done > 0 )
-                    {
-                        stat_2mb_pages += done;
-                        done <<= SUPERPAGE_2MB_SHIFT;
-                        cur_pages += done;
-                        count -= done;
-                    }
-                }
-            }
-
-            /* Fall back to 4kB extents. */
-            if ( count != 0 )
-            {
-                rc = xc_domain_populate_physmap_exact(
-                    xch, domid, count, 0, new_memflags, &dom->p2m_host[cur_pages]);
-                cur_pages += count;
-                stat_normal_pages += count;
-            }
-        }
-
-        if ( rc != 0 )
-        {
-            DOMPRINTF("Could not allocate memory for HVM guest.");
-            goto error_out;
-        }
+        DOMPRINTF("Could not allocate memory for HVM guest.");
+        goto error_out;
     }
 
     DPRINTF("PHYSICAL MEMORY ALLOCATION:\n");
-    DPRINTF("  4KB PAGES: 0x%016lx\n", stat_normal_pages);
-    DPRINTF("  2MB PAGES: 0x%016lx\n", stat_2mb_pages);
-    DPRINTF("  1GB PAGES: 0x%016lx\n", stat_1gb_pages);
+    DPRINTF("  4KB PAGES: 0x%016lx\n", ph.stats.normal_pages);
+    DPRINTF("  2MB PAGES: 0x%016lx\n", ph.stats.pages_2mb);
+    DPRINTF("  1GB PAGES: 0x%016lx\n", ph.stats.pages_1gb);
 
     rc = 0;
     goto out;
@@ -462,6 +462,67 @@ int xc_domain_getinfolist(xc_interface *xch,
     return ret;
 }
 
+int xc_vcpu_getinfolist(xc_interface *xch,
+                        uint32_t first_domain,
+                        uint32_t first_vcpu,
+                        unsigned int max_vcpus,
+                        xc_vcpuinfolist_t *info)
+{
+    int ret = 0;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(info, max_vcpus*sizeof(*info), XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, info) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_vcpuinfolist;
+    sysctl.u.vcpuinfolist.first_domain = first_domain;
+    sysctl.u.vcpuinfolist.first_vcpu   = first_vcpu;
+    sysctl.u.vcpuinfolist.max_vcpus    = max_vcpus;
+    set_xen_guest_handle(sysctl.u.vcpuinfolist.buffer, info);
+
+    if ( xc_sysctl(xch, &sysctl) < 0 )
+        ret = -1;
+    else
+        ret = sysctl.u.vcpuinfolist.num_vcpus;
+
+    xc_hypercall_bounce_post(xch, info);
+
+    return ret;
+}
+
+int xc_domain_schedstats_list(xc_interface *xch,
+                              uint32_t first_domain,
+                              unsigned int max_domains,
+                              xc_domschedstats_t *stats,
+                              uint64_t *now)
+{
+    int ret = 0;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(stats, max_domains*sizeof(*stats), XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, stats) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_domschedstats;
+    sysctl.u.domschedstats.first_domain = first_domain;
+    sysctl.u.domschedstats.max_domains  = max_domains;
+    set_xen_guest_handle(sysctl.u.domschedstats.buffer, stats);
+
+    if ( xc_sysctl(xch, &sysctl) < 0 )
+        ret = -1;
+    else
+    {
+        ret = sysctl.u.domschedstats.num_domains;
+        if ( now )
+            *now = sysctl.u.domschedstats.now;
+    }
+
+    xc_hypercall_bounce_post(xch, stats);
+
+    return ret;
+}
+
 /* set broken page p2m */
 int xc_set_broken_page_p2m(xc_interface *xch,
                            uint32_t domid,
@@ -708,6 +769,68 @@ int xc_shadow_control(xc_interface *xch,
     return (rc == 0) ? domctl.u.shadow_op.pages : rc;
 }
 
+int xc_logdirty_sparse(xc_interface *xch,
+                       uint32_t domid,
+                       unsigned int sop,
+                       uint64_t start_pfn,
+                       uint64_t *nr_pfns,
+                       xc_hypercall_buffer_t *chunk_pfns,
+                       xc_hypercall_buffer_t *chunks,
+                       uint32_t *nr_chunks,
+                       uint32_t mode,
+                       xc_shadow_op_stats_t *stats)
+{
+    int rc;
+    DECLARE_DOMCTL;
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(chunk_pfns);
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(chunks);
+
+    memset(&domctl, 0, sizeof(domctl));
+
+    domctl.cmd = XEN_DOMCTL_shadow_op;
+    domctl.domain = domid;
+    domctl.u.shadow_op.op        = sop;
+    domctl.u.shadow_op.mode      = mode;
+    domctl.u.shadow_op.start_pfn = start_pfn;
+    domctl.u.shadow_op.pages     = *nr_pfns;
+    domctl.u.shadow_op.nr_chunks = *nr_chunks;
+    set_xen_guest_handle(domctl.u.shadow_op.chunk_pfns, chunk_pfns);
+    set_xen_guest_handle(domctl.u.shadow_op.dirty_bitmap, chunks);
+
+    rc = do_domctl(xch, &domctl);
+    if ( rc )
+        return rc;
+
+    if ( stats )
+        memcpy(stats, &domctl.u.shadow_op.stats,
+               sizeof(xc_shadow_op_stats_t));
+
+    *nr_pfns = domctl.u.shadow_op.pages;
+    *nr_chunks = domctl.u.shadow_op.nr_chunks;
+
+    return 0;
+}
+
+int xc_logdirty_get_rate(xc_interface *xch,
+                         uint32_t domid,
+                         unsigned long *rate)
+{
+    int rc;
+    DECLARE_DOMCTL;
+
+    memset(&domctl, 0, sizeof(domctl));
+
+    domctl.cmd = XEN_DOMCTL_shadow_op;
+    domctl.domain = domid;
+    domctl.u.shadow_op.op = XEN_DOMCTL_SHADOW_OP_GET_DIRTY_RATE;
+
+    rc = do_domctl(xch, &domctl);
+    if ( rc == 0 )
+        *rate = domctl.u.shadow_op.pages;
+
+    return rc;
+}
+
 int xc_domain_setmaxmem(xc_interface *xch,
                         uint32_t domid,
                         uint64_t max_memkb)
@@ -1357,6 +1480,126 @@ int xc_vcpu_getinfo(xc_interface *xch,
     return rc;
 }
 
+int xc_domain_exit_stats(xc_interface *xch,
+                         uint32_t domid,
+                         xc_exit_stats_t *stats,
+                         uint32_t *nr_reasons,
+                         xc_exit_reason_t *reasons)
+{
+    int rc;
+    DECLARE_DOMCTL;
+    DECLARE_HYPERCALL_BOUNCE(reasons, reasons ? *nr_reasons *
+                             sizeof(*reasons) : 0,
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, reasons) )
+        return -1;
+
+    domctl.cmd = XEN_DOMCTL_get_exit_stats;
+    domctl.domain = domid;
+    domctl.u.exit_stats.nr_reasons = reasons ? *nr_reasons : 0;
+    set_xen_guest_handle(domctl.u.exit_stats.reasons, reasons);
+    domctl.u.exit_stats.nr_msrs = 0;
+    set_xen_guest_handle(domctl.u.exit_stats.msrs, HYPERCALL_BUFFER_NULL);
+
+    rc = do_domctl(xch, &domctl);
+
+    xc_hypercall_bounce_post(xch, reasons);
+
+    if ( !rc )
+    {
+        memcpy(stats, &domctl.u.exit_stats, sizeof(*stats));
+        if ( nr_reasons )
+            *nr_reasons = domctl.u.exit_stats.nr_reasons;
+    }
+
+    return rc;
+}
+
+int xc_domain_exit_msr_stats(xc_interface *xch,
+                             uint32_t domid,
+                             uint32_t *nr_msrs,
+                             xc_exit_msr_t *msrs,
+                             uint64_t *other)
+{
+    int rc;
+    DECLARE_DOMCTL;
+    DECLARE_HYPERCALL_BOUNCE(msrs, *nr_msrs * sizeof(*msrs),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, msrs) )
+        return -1;
+
+    domctl.cmd = XEN_DOMCTL_get_exit_stats;
+    domctl.domain = domid;
+    domctl.u.exit_stats.nr_reasons = 0;
+    set_xen_guest_handle(domctl.u.exit_stats.reasons, HYPERCALL_BUFFER_NULL);
+    domctl.u.exit_stats.nr_msrs = *nr_msrs;
+    set_xen_guest_handle(domctl.u.exit_stats.msrs, msrs);
+
+    rc = do_domctl(xch, &domctl);
+
+    xc_hypercall_bounce_post(xch, msrs);
+
+    if ( !rc )
+    {
+        *nr_msrs = domctl.u.exit_stats.nr_msrs;
+        if ( other )
+            *other = domctl.u.exit_stats.msr_other;
+    }
+
+    return rc;
+}
+
+int xc_domain_numa_balance_set(xc_interface *xch,
+                               uint32_t domid,
+                               uint32_t rate)
+{
+    DECLARE_DOMCTL;
+
+    domctl.cmd = XEN_DOMCTL_numa_balance;
+    domctl.domain = domid;
+    domctl.u.numa_balance.op = XEN_DOMCTL_NUMA_BALANCE_SET;
+    domctl.u.numa_balance.rate = rate;
+
+    return do_domctl(xch, &domctl);
+}
+
+int xc_domain_numa_balance_get(xc_interface *xch,
+                               uint32_t domid,
+                               xc_numa_balance_t *stats,
+                               uint32_t *num_nodes,
+                               uint64_t *node_pages)
+{
+    int rc;
+    DECLARE_DOMCTL;
+    DECLARE_HYPERCALL_BOUNCE(node_pages, node_pages ? *num_nodes *
+                             sizeof(*node_pages) : 0,
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, node_pages) )
+        return -1;
+
+    domctl.cmd = XEN_DOMCTL_numa_balance;
+    domctl.domain = domid;
+    domctl.u.numa_balance.op = XEN_DOMCTL_NUMA_BALANCE_GET;
+    domctl.u.numa_balance.num_nodes = node_pages ? *num_nodes : 0;
+    set_xen_guest_handle(domctl.u.numa_balance.node_pages, node_pages);
+
+    rc = do_domctl(xch, &domctl);
+
+    xc_hypercall_bounce_post(xch, node_pages);
+
+    if ( !rc )
+    {
+        memcpy(stats, &domctl.u.numa_balance, sizeof(*stats));
+        if ( num_nodes )
+            *num_nodes = domctl.u.numa_balance.num_nodes;
+    }
+
+    return rc;
+}
+
 int xc_domain_ioport_permission(xc_interface *xch,
                                 uint32_t domid,
                                 uint32_t first_port,
@@ -379,7 +379,8 @@ int xc_flask_avc_cachestats(xc_interface *xch, char *buf, int size)
     int i = 0;
     DECLARE_FLASK_OP;
 
-    n = snprintf(buf, size, "lookups hits misses allocations reclaims frees\n");
+    n = snprintf(buf, size,
+                 "lookups hits misses allocations reclaims frees pcpu_hits\n");
     buf += n;
     size -= n;
   
@@ -392,10 +393,11 @@ int xc_flask_avc_cachestats(xc_interface *xch, char *buf, int size)
             return 0;
         if ( err )
             return err;
-        n = snprintf(buf, size, "%u %u %u %u %u %u\n",
+        n = snprintf(buf, size, "%u %u %u %u %u %u %u\n",
                      op.u.cache_stats.lookups, op.u.cache_stats.hits,
                      op.u.cache_stats.misses, op.u.cache_stats.allocations,
-                     op.u.cache_stats.reclaims, op.u.cache_stats.frees);
+                     op.u.cache_stats.reclaims, op.u.cache_stats.frees,
+                     op.u.cache_stats.pcpu_hits);
         buf += n;
         size -= n;
         i++;
@@ -404,6 +406,50 @@ int xc_flask_avc_cachestats(xc_interface *xch, char *buf, int size)
     return 0;
 }
 
+int xc_flask_avc_classstats(xc_interface *xch, char *buf, int size)
+{
+    int err, n, cpu;
+    uint32_t tclass;
+    uint32_t lookups, hits, pcpu_hits, misses;
+    DECLARE_FLASK_OP;
+
+    n = snprintf(buf, size, "class lookups hits pcpu_hits misses\n");
+    buf += n;
+    size -= n;
+
+    op.cmd = FLASK_AVC_CLASSSTATS;
+    for ( tclass = 1; size > 0; tclass++ )
+    {
+        lookups = hits = pcpu_hits = misses = 0;
+
+        /* Sum over all online CPUs; the first CPU tells if the class exists. */
+        for ( cpu = 0; ; cpu++ )
+        {
+            op.u.class_stats.cpu = cpu;
+            op.u.class_stats.tclass = tclass;
+            err = xc_flask_op(xch, &op);
+            if ( err && errno == ENOENT )
+                break;
+            if ( err )
+                return err;
+            lookups += op.u.class_stats.lookups;
+            hits += op.u.class_stats.hits;
+            pcpu_hits += op.u.class_stats.pcpu_hits;
+            misses += op.u.class_stats.misses;
+        }
+
+        if ( !cpu )
+            break;
+
+        n = snprintf(buf, size, "%u %u %u %u %u\n",
+                     tclass, lookups, hits, pcpu_hits, misses);
+        buf += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
 int xc_flask_policyvers(xc_interface *xch)
 {
     DECLARE_FLASK_OP;
@@ -100,6 +100,22 @@ int xc_get_mem_access(xc_interface *xch,
     return rc;
 }
 
+int xc_set_mem_access_subpage(xc_interface *xch,
+                              uint32_t domain_id,
+                              uint64_t pfn,
+                              uint32_t write_mask)
+{
+    xen_mem_access_op_t mao =
+    {
+        .op    = XENMEM_access_op_set_subpage_write,
+        .domid = domain_id,
+        .nr    = write_mask,
+        .pfn   = pfn
+    };
+
+    return do_memory_op(xch, XENMEM_access_op, &mao, sizeof(mao));
+}
+
 /*
  * Local variables:
  * mode: C
@@ -21,6 +21,7 @@
  */
 
 #include "xc_private.h"
+#include "xc_bitops.h"
 
 static int xc_mem_paging_memop(xc_interface *xch, uint32_t domain_id,
                                unsigned int op, uint64_t gfn, void *buffer)
@@ -116,6 +117,33 @@ int xc_mem_paging_load(xc_interface *xch, uint32_t domain_id,
     return rc;
 }
 
+int xc_mem_paging_harvest_accessed(xc_interface *xch, uint32_t domain_id,
+                                   uint64_t gfn, uint32_t nr,
+                                   unsigned long *bitmap)
+{
+    xen_mem_paging_op_t mpo;
+    int rc;
+    DECLARE_HYPERCALL_BOUNCE(bitmap, bitmap_size(nr),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, bitmap) )
+        return -1;
+
+    memset(&mpo, 0, sizeof(mpo));
+
+    mpo.op      = XENMEM_paging_op_harvest_accessed;
+    mpo.domain  = domain_id;
+    mpo.gfn     = gfn;
+    mpo.nr      = nr;
+    mpo.buffer  = HYPERCALL_BUFFER_AS_ARG(bitmap);
+
+    rc = do_memory_op(xch, XENMEM_paging_op, &mpo, sizeof(mpo));
+
+    xc_hypercall_bounce_post(xch, bitmap);
+
+    return rc;
+}
+
 
 /*
  * Local variables:
@@ -181,11 +181,12 @@ int xc_memshr_add_to_physmap(xc_interface *xch,
     return xc_memshr_memop(xch, source_domain, &mso);
 }
 
-int xc_memshr_range_share(xc_interface *xch,
-                          uint32_t source_domain,
-                          uint32_t client_domain,
-                          uint64_t first_gfn,
-                          uint64_t last_gfn)
+static int memshr_range(xc_interface *xch,
+                        uint32_t source_domain,
+                        uint32_t client_domain,
+                        uint64_t first_gfn,
+                        uint64_t last_gfn,
+                        uint16_t flags)
 {
     xen_mem_sharing_op_t mso;
 
@@ -196,10 +197,170 @@ int xc_memshr_range_share(xc_interface *xch,
     mso.u.range.client_domain = client_domain;
     mso.u.range.first_gfn = first_gfn;
     mso.u.range.last_gfn = last_gfn;
+    mso.u.range.flags = flags;
 
     return xc_memshr_memop(xch, source_domain, &mso);
 }
 
+int xc_memshr_range_share(xc_interface *xch,
+                          uint32_t source_domain,
+                          uint32_t client_domain,
+                          uint64_t first_gfn,
+                          uint64_t last_gfn)
+{
+    return memshr_range(xch, source_domain, client_domain,
+                        first_gfn, last_gfn, 0);
+}
+
+static int memshr_batch(xc_interface *xch, uint32_t domid, unsigned int op,
+                        uint32_t client_domain,
+                        xen_mem_sharing_batch_entry_t *entries, uint32_t nr)
+{
+    int rc;
+    xen_mem_sharing_op_t mso;
+    DECLARE_HYPERCALL_BOUNCE(entries, nr * sizeof(*entries),
+                             XC_HYPERCALL_BUFFER_BOUNCE_BOTH);
+
+    if ( xc_hypercall_bounce_pre(xch, entries) )
+        return -1;
+
+    memset(&mso, 0, sizeof(mso));
+
+    mso.op = op;
+    mso.u.batch.nr = nr;
+    mso.u.batch.client_domain = client_domain;
+    set_xen_guest_handle(mso.u.batch.entries, entries);
+
+    rc = xc_memshr_memop(xch, domid, &mso);
+
+    xc_hypercall_bounce_post(xch, entries);
+
+    return rc;
+}
+
+int xc_memshr_nominate_gfns(xc_interface *xch,
+                            uint32_t domid,
+                            xen_mem_sharing_batch_entry_t *entries,
+                            uint32_t nr)
+{
+    return memshr_batch(xch, domid, XENMEM_sharing_op_nominate_batch, 0,
+                        entries, nr);
+}
+
+int xc_memshr_share_gfns_batch(xc_interface *xch,
+                               uint32_t source_domain,
+                               uint32_t client_domain,
+                               xen_mem_sharing_batch_entry_t *entries,
+                               uint32_t nr)
+{
+    return memshr_batch(xch, source_domain, XENMEM_sharing_op_share_batch,
+                        client_domain, entries, nr);
+}
+
+int xc_memshr_fork(xc_interface *xch,
+                   uint32_t parent_domid,
+                   uint32_t domid)
+{
+    xen_mem_sharing_op_t mso;
+
+    memset(&mso, 0, sizeof(mso));
+
+    mso.op = XENMEM_sharing_op_fork;
+    mso.u.fork.parent_domain = parent_domid;
+
+    return xc_memshr_memop(xch, domid, &mso);
+}
+
+/* HVM params giving the location of special pages, which clones share. */
+static const uint32_t clone_params[] = {
+    HVM_PARAM_STORE_PFN,
+    HVM_PARAM_CONSOLE_PFN,
+    HVM_PARAM_IDENT_PT,
+    HVM_PARAM_PAGING_RING_PFN,
+    HVM_PARAM_MONITOR_RING_PFN,
+    HVM_PARAM_SHARING_RING_PFN,
+    HVM_PARAM_IOREQ_PFN,
+    HVM_PARAM_BUFIOREQ_PFN,
+    HVM_PARAM_IOREQ_SERVER_PFN,
+    HVM_PARAM_NR_IOREQ_SERVER_PAGES,
+    HVM_PARAM_VM86_TSS_SIZED,
+};
+
+int xc_domain_clone(xc_interface *xch,
+                    uint32_t template_domid,
+                    uint32_t clone_domid)
+{
+    xen_pfn_t max_gpfn;
+    uint8_t *hvm_ctx = NULL;
+    uint64_t val;
+    unsigned int i;
+    int size, rc = -1;
+
+    if ( xc_domain_maximum_gpfn(xch, template_domid, &max_gpfn) < 0 )
+    {
+        PERROR("Could not get maximum gpfn of template d%u", template_domid);
+        goto out;
+    }
+
+    if ( xc_memshr_control(xch, template_domid, 1) ||
+         xc_memshr_control(xch, clone_domid, 1) )
+    {
+        PERROR("Could not enable memory sharing");
+        goto out;
+    }
+
+    if ( memshr_range(xch, template_domid, clone_domid, 0, max_gpfn,
+                      XENMEM_SHARING_RANGE_POPULATE) )
+    {
+        PERROR("Could not share memory of template d%u", template_domid);
+        goto out;
+    }
+
+    size = xc_domain_hvm_getcontext(xch, template_domid, NULL, 0);
+    if ( size <= 0 )
+    {
+        PERROR("Could not get HVM context size of template d%u",
+               template_domid);
+        goto out;
+    }
+
+    hvm_ctx = malloc(size);
+    if ( !hvm_ctx )
+    {
+        ERROR("Could not allocate %d bytes of HVM context", size);
+        goto out;
+    }
+
+    size = xc_domain_hvm_getcontext(xch, template_domid, hvm_ctx, size);
+    if ( size <= 0 ||
+         xc_domain_hvm_setcontext(xch, clone_domid, hvm_ctx, size) )
+    {
+        PERROR("Could not copy HVM context of template d%u", template_domid);
+        goto out;
+    }
+
+    for ( i = 0; i < ARRAY_SIZE(clone_params); i++ )
+    {
+        if ( xc_hvm_param_get(xch, template_domid, clone_params[i], &val) )
+        {
+            PERROR("Could not get HVM param %u of template d%u",
+                   clone_params[i], template_domid);
+            goto out;
+        }
+        if ( val && xc_hvm_param_set(xch, clone_domid, clone_params[i], val) )
+        {
+            PERROR("Could not set HVM param %u", clone_params[i]);
+            goto out;
+        }
+    }
+
+    rc = 0;
+
+ out:
+    free(hvm_ctx);
+    return rc;
+}
+
 int xc_memshr_domain_resume(xc_interface *xch,
                             uint32_t domid)
 {
@@ -287,6 +287,140 @@ out:
     return ret;
 }
 
+int xc_scrubinfo(xc_interface *xch, unsigned *max_nodes, uint64_t *pending)
+{
+    int ret;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(pending, *max_nodes * sizeof(*pending),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( (ret = xc_hypercall_bounce_pre(xch, pending)) )
+        goto out;
+
+    sysctl.u.scrubinfo.num_nodes = *max_nodes;
+    set_xen_guest_handle(sysctl.u.scrubinfo.pending, pending);
+
+    sysctl.cmd = XEN_SYSCTL_scrubinfo;
+
+    if ( (ret = do_sysctl(xch, &sysctl)) != 0 )
+        goto out;
+
+    *max_nodes = sysctl.u.scrubinfo.num_nodes;
+
+out:
+    xc_hypercall_bounce_post(xch, pending);
+
+    return ret;
+}
+
+int xc_sched_hist(xc_interface *xch, uint32_t cpu, uint32_t flags,
+                  uint64_t *data)
+{
+    int ret;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(data, data ? XEN_SYSCTL_SCHED_HIST_NR *
+                             XEN_SYSCTL_SCHED_HIST_BUCKETS * sizeof(*data) : 0,
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( (ret = xc_hypercall_bounce_pre(xch, data)) )
+        goto out;
+
+    sysctl.cmd = XEN_SYSCTL_sched_hist;
+    sysctl.u.sched_hist.cpu = cpu;
+    sysctl.u.sched_hist.flags = flags;
+    set_xen_guest_handle(sysctl.u.sched_hist.data, data);
+
+    ret = do_sysctl(xch, &sysctl);
+
+out:
+    xc_hypercall_bounce_post(xch, data);
+
+    return ret;
+}
+
+int xc_lat_hist(xc_interface *xch, uint32_t set, uint32_t cpu,
+                uint32_t flags, uint32_t *nr_hists, uint64_t *data)
+{
+    int ret;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(data, data ? *nr_hists *
+                             XEN_SYSCTL_LAT_HIST_BUCKETS * sizeof(*data) : 0,
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( (ret = xc_hypercall_bounce_pre(xch, data)) )
+        goto out;
+
+    sysctl.cmd = XEN_SYSCTL_lat_hist;
+    sysctl.u.lat_hist.set = set;
+    sysctl.u.lat_hist.cpu = cpu;
+    sysctl.u.lat_hist.flags = flags;
+    sysctl.u.lat_hist.nr_hists = data ? *nr_hists : 0;
+    set_xen_guest_handle(sysctl.u.lat_hist.data, data);
+
+    ret = do_sysctl(xch, &sysctl);
+
+    *nr_hists = sysctl.u.lat_hist.nr_hists;
+
+out:
+    xc_hypercall_bounce_post(xch, data);
+
+    return ret;
+}
+
+int xc_pmu_sample_start(xc_interface *xch, uint64_t event, uint64_t period)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_pmu_sample;
+    sysctl.u.pmu_sample.cmd = XEN_SYSCTL_PMU_SAMPLE_start;
+    sysctl.u.pmu_sample.event = event;
+    sysctl.u.pmu_sample.period = period;
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_pmu_sample_stop(xc_interface *xch)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_pmu_sample;
+    sysctl.u.pmu_sample.cmd = XEN_SYSCTL_PMU_SAMPLE_stop;
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_pmu_sample_read(xc_interface *xch, uint32_t cpu,
+                       xen_sysctl_pmu_sample_rec_t *samples,
+                       uint32_t *nr_samples, uint32_t *lost)
+{
+    int ret;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(samples, *nr_samples * sizeof(*samples),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( (ret = xc_hypercall_bounce_pre(xch, samples)) )
+        return ret;
+
+    sysctl.cmd = XEN_SYSCTL_pmu_sample;
+    sysctl.u.pmu_sample.cmd = XEN_SYSCTL_PMU_SAMPLE_read;
+    sysctl.u.pmu_sample.cpu = cpu;
+    sysctl.u.pmu_sample.nr_samples = *nr_samples;
+    set_xen_guest_handle(sysctl.u.pmu_sample.samples, samples);
+
+    ret = do_sysctl(xch, &sysctl);
+
+    xc_hypercall_bounce_post(xch, samples);
+
+    if ( !ret )
+    {
+        *nr_samples = sysctl.u.pmu_sample.nr_samples;
+        if ( lost )
+            *lost = sysctl.u.pmu_sample.lost;
+    }
+
+    return ret;
+}
+
 int xc_pcitopoinfo(xc_interface *xch, unsigned num_devs,
                    physdev_pci_device_t *devs,
                    uint32_t *nodes)
@@ -514,6 +648,76 @@ int xc_lockprof_query(xc_interface *xch,
     return rc;
 }
 
+int xc_lockcont_enable(xc_interface *xch, uint32_t sample)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_lockcont_op;
+    sysctl.u.lockcont_op.cmd = XEN_SYSCTL_LOCKCONT_enable;
+    sysctl.u.lockcont_op.sample = sample;
+    set_xen_guest_handle(sysctl.u.lockcont_op.data, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_lockcont_reset(xc_interface *xch)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_lockcont_op;
+    sysctl.u.lockcont_op.cmd = XEN_SYSCTL_LOCKCONT_reset;
+    set_xen_guest_handle(sysctl.u.lockcont_op.data, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_lockcont_query_number(xc_interface *xch,
+                             uint32_t *n_elems)
+{
+    int rc;
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_lockcont_op;
+    sysctl.u.lockcont_op.max_elem = 0;
+    sysctl.u.lockcont_op.cmd = XEN_SYSCTL_LOCKCONT_query;
+    set_xen_guest_handle(sysctl.u.lockcont_op.data, HYPERCALL_BUFFER_NULL);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *n_elems = sysctl.u.lockcont_op.nr_elem;
+
+    return rc;
+}
+
+int xc_lockcont_query(xc_interface *xch,
+                      uint32_t *n_elems,
+                      uint64_t *time,
+                      uint32_t *sample,
+                      uint32_t *dropped,
+                      struct xc_hypercall_buffer *data)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(data);
+
+    sysctl.cmd = XEN_SYSCTL_lockcont_op;
+    sysctl.u.lockcont_op.cmd = XEN_SYSCTL_LOCKCONT_query;
+    sysctl.u.lockcont_op.max_elem = *n_elems;
+    set_xen_guest_handle(sysctl.u.lockcont_op.data, data);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *n_elems = sysctl.u.lockcont_op.nr_elem;
+    if ( time )
+        *time = sysctl.u.lockcont_op.time;
+    if ( sample )
+        *sample = sysctl.u.lockcont_op.sample;
+    if ( dropped )
+        *dropped = sysctl.u.lockcont_op.dropped;
+
+    return rc;
+}
+
 int xc_getcpuinfo(xc_interface *xch, int max_cpus,
                   xc_cpuinfo_t *info, int *nr_cpus)
 {
@@ -538,6 +742,85 @@ int xc_getcpuinfo(xc_interface *xch, int max_cpus,
     return rc;
 }
 
+#if defined(__i386__) || defined(__x86_64__)
+int xc_microcode_update(xc_interface *xch, const void *buf, size_t len)
+{
+    int rc;
+    DECLARE_PLATFORM_OP;
+    DECLARE_HYPERCALL_BUFFER(void, uc);
+
+    if ( len != (uint32_t)len )
+    {
+        errno = E2BIG;
+        return -1;
+    }
+
+    uc = xc_hypercall_buffer_alloc(xch, uc, len);
+    if ( uc == NULL )
+        return -1;
+
+    memcpy(uc, buf, len);
+
+    platform_op.cmd = XENPF_microcode_update;
+    platform_op.u.microcode.length = len;
+    set_xen_guest_handle(platform_op.u.microcode.data, uc);
+
+    rc = do_platform_op(xch, &platform_op);
+
+    xc_hypercall_buffer_free(xch, uc);
+
+    return rc;
+}
+
+int xc_microcode_update_parallel(xc_interface *xch, const void *buf,
+                                 size_t len, uint32_t *nr_cpus,
+                                 xc_ucode_cpu_stat_t *stats,
+                                 uint64_t *total_ns)
+{
+    int rc = -1;
+    DECLARE_PLATFORM_OP;
+    DECLARE_HYPERCALL_BUFFER(void, uc);
+    DECLARE_HYPERCALL_BOUNCE(stats, *nr_cpus * sizeof(*stats),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( len != (uint32_t)len )
+    {
+        errno = E2BIG;
+        return -1;
+    }
+
+    uc = xc_hypercall_buffer_alloc(xch, uc, len);
+    if ( uc == NULL )
+        return -1;
+
+    memcpy(uc, buf, len);
+
+    if ( xc_hypercall_bounce_pre(xch, stats) )
+        goto out;
+
+    platform_op.cmd = XENPF_microcode_update2;
+    platform_op.u.microcode2.length = len;
+    platform_op.u.microcode2.flags = 0;
+    platform_op.u.microcode2.nr_cpus = *nr_cpus;
+    platform_op.u.microcode2.pad = 0;
+    set_xen_guest_handle(platform_op.u.microcode2.data, uc);
+    set_xen_guest_handle(platform_op.u.microcode2.stats, stats);
+
+    rc = do_platform_op(xch, &platform_op);
+
+    xc_hypercall_bounce_post(xch, stats);
+
+    *nr_cpus = platform_op.u.microcode2.nr_cpus;
+    if ( total_ns )
+        *total_ns = platform_op.u.microcode2.total_ns;
+
+ out:
+    xc_hypercall_buffer_free(xch, uc);
+
+    return rc;
+}
+#endif
+
 int xc_livepatch_upload(xc_interface *xch,
                         char *name,
                         unsigned char *payload,
@@ -28,6 +28,13 @@ void *xc_monitor_enable(xc_interface *xch, uint32_t domain_id, uint32_t *port)
                               port);
 }
 
+void *xc_monitor_enable_rings(xc_interface *xch, uint32_t domain_id,
+                              unsigned int nr_rings, uint32_t *ports)
+{
+    return xc_vm_event_enable_rings(xch, domain_id, HVM_PARAM_MONITOR_RING_PFN,
+                                    nr_rings, ports);
+}
+
 int xc_monitor_disable(xc_interface *xch, uint32_t domain_id)
 {
     return xc_vm_event_control(xch, domain_id,
@@ -175,6 +182,25 @@ int xc_monitor_emulate_each_rep(xc_interface *xch, uint32_t domain_id,
     return do_domctl(xch, &domctl);
 }
 
+int xc_monitor_access_filter(xc_interface *xch, uint32_t domain_id,
+                             unsigned int filter, uint8_t access,
+                             uint8_t action, uint64_t gfn_start,
+                             uint64_t gfn_end)
+{
+    DECLARE_DOMCTL;
+
+    domctl.cmd = XEN_DOMCTL_monitor_op;
+    domctl.domain = domain_id;
+    domctl.u.monitor_op.op = XEN_DOMCTL_MONITOR_OP_SET_ACCESS_FILTER;
+    domctl.u.monitor_op.event = filter;
+    domctl.u.monitor_op.u.access_filter.access = access;
+    domctl.u.monitor_op.u.access_filter.action = action;
+    domctl.u.monitor_op.u.access_filter.gfn_start = gfn_start;
+    domctl.u.monitor_op.u.access_filter.gfn_end = gfn_end;
+
+    return do_domctl(xch, &domctl);
+}
+
 int xc_monitor_debug_exceptions(xc_interface *xch, uint32_t domain_id,
                                 bool enable, bool sync)
 {
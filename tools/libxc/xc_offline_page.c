@@ -706,3 +706,218 @@ failed:
 
     return result;
 }
+
+/* Pages of an HVM guest copied and remapped per batch. */
+#define EXCHANGE_HVM_BATCH 256
+
+static int cmp_pfn(const void *a, const void *b)
+{
+    xen_pfn_t x = *(const xen_pfn_t *)a, y = *(const xen_pfn_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Sorted list of the frames domid currently grants, to be looked up for
+ * many pages at once.  Returns the number of entries in *frames, or -1.
+ */
+static int get_granted_frames(xc_interface *xch, uint32_t domid,
+                              xen_pfn_t **frames)
+{
+    grant_entry_v1_t *gnttab_v1 = NULL;
+    grant_entry_v2_t *gnttab_v2;
+    int gnt_num, nr_ents, i, n = 0;
+
+    gnttab_v2 = xc_gnttab_map_table_v2(xch, domid, &gnt_num);
+    if ( !gnttab_v2 )
+    {
+        gnttab_v1 = xc_gnttab_map_table_v1(xch, domid, &gnt_num);
+        if ( !gnttab_v1 )
+        {
+            ERROR("Failed to map grant table\n");
+            return -1;
+        }
+    }
+
+    /* gnt_num counts v1 sized entries of the mapped frames. */
+    nr_ents = gnttab_v1 ? gnt_num : gnt_num * sizeof(grant_entry_v1_t) /
+                                    sizeof(grant_entry_v2_t);
+
+    *frames = malloc(nr_ents * sizeof(**frames));
+    if ( *frames )
+    {
+        for ( i = 0; i < nr_ents; i++ )
+        {
+            if ( gnttab_v1 )
+            {
+                if ( (gnttab_v1[i].flags & GTF_type_mask) != GTF_invalid )
+                    (*frames)[n++] = gnttab_v1[i].frame;
+            }
+            else
+            {
+                uint16_t flags = gnttab_v2[i].hdr.flags;
+
+                if ( (flags & GTF_type_mask) == GTF_invalid ||
+                     (flags & GTF_type_mask) == GTF_transitive )
+                    continue;
+                (*frames)[n++] = (flags & GTF_sub_page)
+                                 ? gnttab_v2[i].sub_page.frame
+                                 : gnttab_v2[i].full_page.frame;
+            }
+        }
+        qsort(*frames, n, sizeof(**frames), cmp_pfn);
+    }
+    else
+    {
+        ERROR("Failed to allocate the granted frame list\n");
+        n = -1;
+    }
+
+    munmap(gnttab_v1 ? (void *)gnttab_v1 : (void *)gnttab_v2,
+           gnt_num * sizeof(grant_entry_v1_t));
+
+    return n;
+}
+
+int xc_exchange_hvm_pages(xc_interface *xch, uint32_t domid,
+                          const xen_pfn_t *mfns, unsigned int nr)
+{
+    xc_dominfo_t info;
+    xen_pfn_t *granted = NULL;
+    xen_pfn_t *m2p_table = NULL, gfns[EXCHANGE_HVM_BATCH];
+    xen_pfn_t extents[EXCHANGE_HVM_BATCH], max_gpfn;
+    unsigned long max_mfn;
+    unsigned int n, done = 0, moved = 0;
+    void *backup = NULL, *p;
+    int nr_granted, paused = 0, result = -1;
+
+    if ( xc_domain_getinfo(xch, domid, 1, &info) != 1 ||
+         info.domid != domid )
+    {
+        ERROR("Could not get domain info");
+        return -1;
+    }
+
+    if ( !info.hvm || !domid )
+    {
+        errno = EINVAL;
+        ERROR("Can only remap the pages of an HVM guest other than dom0\n");
+        return -1;
+    }
+
+    if ( xc_maximum_ram_page(xch, &max_mfn) ||
+         !(m2p_table = xc_map_m2p(xch, max_mfn, PROT_READ, NULL)) )
+    {
+        PERROR("Failed to map live M2P table");
+        return -1;
+    }
+
+    backup = malloc(EXCHANGE_HVM_BATCH * PAGE_SIZE);
+    if ( !backup )
+    {
+        ERROR("Failed to allocate backup pages\n");
+        goto out;
+    }
+
+    if ( xc_domain_pause(xch, domid) )
+    {
+        PERROR("Failed to pause domain %u", domid);
+        goto out;
+    }
+    paused = 1;
+
+    /* Only look at the guest's memory once it can't change any more. */
+    if ( xc_domain_maximum_gpfn(xch, domid, &max_gpfn) < 0 )
+    {
+        PERROR("Failed to get the maximum gpfn of domain %u", domid);
+        goto out;
+    }
+
+    nr_granted = get_granted_frames(xch, domid, &granted);
+    if ( nr_granted < 0 )
+        goto out;
+
+    /*
+     * Copy each batch out, give the old frames back (which completes their
+     * offlining), repopulate the same gfns and copy the contents back in.
+     * Xen has emulators drop their mappings of the old frames when the
+     * reservation is decreased.
+     */
+    while ( done < nr )
+    {
+        for ( n = 0; done < nr && n < EXCHANGE_HVM_BATCH; done++ )
+        {
+            xen_pfn_t mfn = mfns[done], gfn;
+
+            if ( mfn > max_mfn )
+                continue;
+
+            gfn = m2p_table[mfn];
+            if ( gfn > max_gpfn )
+            {
+                DPRINTF("Page %lx has no gfn in domain %u\n", mfn, domid);
+                continue;
+            }
+
+            if ( bsearch(&gfn, granted, nr_granted, sizeof(*granted),
+                         cmp_pfn) )
+            {
+                ERROR("Page %lx (gfn %lx) is granted now\n", mfn, gfn);
+                continue;
+            }
+
+            gfns[n++] = gfn;
+        }
+
+        if ( !n )
+            continue;
+
+        p = xc_map_foreign_pages(xch, domid, PROT_READ, gfns, n);
+        if ( !p )
+        {
+            PERROR("Failed to map %u pages of domain %u", n, domid);
+            goto out;
+        }
+        memcpy(backup, p, n * PAGE_SIZE);
+        munmap(p, n * PAGE_SIZE);
+
+        memcpy(extents, gfns, n * sizeof(*gfns));
+        if ( xc_domain_decrease_reservation_exact(xch, domid, n, 0, extents) )
+        {
+            PERROR("Failed to release %u pages of domain %u", n, domid);
+            goto out;
+        }
+
+        memcpy(extents, gfns, n * sizeof(*gfns));
+        if ( xc_domain_populate_physmap_exact(xch, domid, n, 0, 0, extents) )
+        {
+            PERROR("Failed to repopulate %u pages, domain %u is broken now",
+                   n, domid);
+            result = -2;
+            goto out;
+        }
+
+        p = xc_map_foreign_pages(xch, domid, PROT_READ | PROT_WRITE, gfns, n);
+        if ( !p )
+        {
+            PERROR("Failed to map new pages, domain %u is broken now", domid);
+            result = -2;
+            goto out;
+        }
+        memcpy(p, backup, n * PAGE_SIZE);
+        munmap(p, n * PAGE_SIZE);
+
+        moved += n;
+    }
+
+    result = moved;
+
+ out:
+    if ( paused )
+        xc_domain_unpause(xch, domid);
+    free(granted);
+    free(backup);
+    munmap(m2p_table, M2P_SIZE(max_mfn));
+
+    return result;
+}
@@ -434,6 +434,43 @@ int xc_set_cpuidle_max_cstate(xc_interface *xch, uint32_t value)
     return do_sysctl(xch, &sysctl);
 }
 
+int xc_get_cpuidle_max_latency(xc_interface *xch, int cpuid, uint32_t *value)
+{
+    int rc;
+    DECLARE_SYSCTL;
+
+    if ( !xch || !value )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    sysctl.cmd = XEN_SYSCTL_pm_op;
+    sysctl.u.pm_op.cmd = XEN_SYSCTL_pm_op_get_max_latency;
+    sysctl.u.pm_op.cpuid = cpuid;
+    sysctl.u.pm_op.u.get_max_latency = 0;
+    rc = do_sysctl(xch, &sysctl);
+    *value = sysctl.u.pm_op.u.get_max_latency;
+
+    return rc;
+}
+
+int xc_set_cpuidle_max_latency(xc_interface *xch, int cpuid, uint32_t value)
+{
+    DECLARE_SYSCTL;
+
+    if ( !xch )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    sysctl.cmd = XEN_SYSCTL_pm_op;
+    sysctl.u.pm_op.cmd = XEN_SYSCTL_pm_op_set_max_latency;
+    sysctl.u.pm_op.cpuid = cpuid;
+    sysctl.u.pm_op.u.set_max_latency = value;
+
+    return do_sysctl(xch, &sysctl);
+}
+
 int xc_enable_turbo(xc_interface *xch, int cpuid)
 {
     DECLARE_SYSCTL;
@@ -332,6 +332,97 @@ long do_memory_op(xc_interface *xch, int cmd, void *arg, size_t len)
     return ret;
 }
 
+/*
+ * Unordered multicalls are split into chunks of at least this many entries,
+ * each issued from its own thread, so that dom0's vCPUs (and thus Xen's
+ * pCPUs) work on them in parallel.
+ */
+#define MULTICALL_MIN_CHUNK   16
+#define MULTICALL_MAX_THREADS 16
+
+struct multicall_chunk {
+    xc_interface *xch;
+    pthread_t thread;
+    multicall_entry_t *calls;
+    uint32_t nr;
+    int rc;
+    int err;
+};
+
+static void *multicall_chunk_run(void *arg)
+{
+    struct multicall_chunk *c = arg;
+
+    c->rc = xencall2(c->xch->xcall, __HYPERVISOR_multicall,
+                     (unsigned long)c->calls, c->nr);
+    c->err = errno;
+
+    return NULL;
+}
+
+int xc_multicall(xc_interface *xch, xc_hypercall_buffer_t *call_list,
+                 uint32_t nr_calls, unsigned int flags)
+{
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(call_list);
+    multicall_entry_t *calls;
+    struct multicall_chunk chunks[MULTICALL_MAX_THREADS];
+    unsigned int nr_chunks = 1, i;
+    long nr_cpus;
+    uint32_t per_chunk, done = 0;
+    int rc = 0, err = 0;
+
+    if ( flags & XC_MULTICALL_UNORDERED )
+    {
+        nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nr_chunks = nr_calls / MULTICALL_MIN_CHUNK;
+        if ( nr_cpus > 0 && nr_chunks > nr_cpus )
+            nr_chunks = nr_cpus;
+        if ( nr_chunks > MULTICALL_MAX_THREADS )
+            nr_chunks = MULTICALL_MAX_THREADS;
+    }
+
+    if ( nr_chunks <= 1 )
+        return do_multicall_op(xch, HYPERCALL_BUFFER(call_list), nr_calls);
+
+    calls = (multicall_entry_t *)HYPERCALL_BUFFER_AS_ARG(call_list);
+    per_chunk = (nr_calls + nr_chunks - 1) / nr_chunks;
+    for ( i = 0; i < nr_chunks; i++ )
+    {
+        chunks[i].xch = xch;
+        chunks[i].calls = calls + done;
+        chunks[i].nr = min(per_chunk, nr_calls - done);
+        done += chunks[i].nr;
+
+        /* The first chunk runs on this thread, as does any we can't spawn. */
+        if ( i == 0 ||
+             pthread_create(&chunks[i].thread, NULL, multicall_chunk_run,
+                            &chunks[i]) )
+            chunks[i].thread = pthread_self();
+    }
+
+    for ( i = 0; i < nr_chunks; i++ )
+    {
+        if ( pthread_equal(chunks[i].thread, pthread_self()) )
+            multicall_chunk_run(&chunks[i]);
+        else
+            pthread_join(chunks[i].thread, NULL);
+
+        if ( chunks[i].rc < 0 && !rc )
+        {
+            rc = chunks[i].rc;
+            err = chunks[i].err;
+        }
+    }
+
+    if ( rc < 0 )
+    {
+        errno = err;
+        PERROR("Unordered multicall of %u entries failed", nr_calls);
+    }
+
+    return rc;
+}
+
 int xc_maximum_ram_page(xc_interface *xch, unsigned long *max_mfn)
 {
     long rc = do_memory_op(xch, XENMEM_maximum_ram_page, NULL, 0);
@@ -422,6 +422,12 @@ int xc_vm_event_control(xc_interface *xch, uint32_t domain_id, unsigned int op,
  */
 void *xc_vm_event_enable(xc_interface *xch, uint32_t domain_id, int param,
                          uint32_t *port);
+/*
+ * As xc_vm_event_enable(), with nr_rings rings mapped at consecutive pages
+ * and the event channel of each returned in ports.
+ */
+void *xc_vm_event_enable_rings(xc_interface *xch, uint32_t domain_id, int param,
+                               unsigned int nr_rings, uint32_t *ports);
 
 int do_dm_op(xc_interface *xch, uint32_t domid, unsigned int nr_bufs, ...);
 
@@ -248,6 +248,37 @@ int xc_psr_cmt_enabled(xc_interface *xch)
 
     return 0;
 }
+
+int xc_psr_cmt_get_samples(xc_interface *xch, uint32_t socket, uint32_t *num,
+                           xc_psr_cmt_sample_t *samples, uint64_t *tsc)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(samples, *num * sizeof(*samples),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, samples) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_psr_cmt_op;
+    sysctl.u.psr_cmt_op.cmd = XEN_SYSCTL_PSR_CMT_get_samples;
+    sysctl.u.psr_cmt_op.flags = 0;
+    sysctl.u.psr_cmt_op.u.samples.socket = socket;
+    sysctl.u.psr_cmt_op.u.samples.num = *num;
+    set_xen_guest_handle(sysctl.u.psr_cmt_op.u.samples.samples, samples);
+
+    rc = do_sysctl(xch, &sysctl);
+    if ( !rc )
+    {
+        *num = sysctl.u.psr_cmt_op.u.samples.num;
+        if ( tsc )
+            *tsc = sysctl.u.psr_cmt_op.u.samples.tsc;
+    }
+
+    xc_hypercall_bounce_post(xch, samples);
+
+    return rc;
+}
 int xc_psr_cat_set_domain_data(xc_interface *xch, uint32_t domid,
                                xc_psr_cat_type type, uint32_t target,
                                uint64_t data)
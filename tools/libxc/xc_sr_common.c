@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <time.h>
 
 #include "xc_sr_common.h"
 
@@ -38,6 +39,13 @@ static const char *mandatory_rec_types[] =
     [REC_TYPE_VERIFY]                       = "Verify",
     [REC_TYPE_CHECKPOINT]                   = "Checkpoint",
     [REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST]    = "Checkpoint dirty pfn list",
+    [REC_TYPE_COMPRESSED_PAGE_DATA]         = "Compressed page data",
+    [REC_TYPE_POSTCOPY_BEGIN]               = "Postcopy begin",
+    [REC_TYPE_POSTCOPY_PFNS]                = "Postcopy pfns",
+    [REC_TYPE_POSTCOPY_TRANSITION]          = "Postcopy transition",
+    [REC_TYPE_POSTCOPY_FAULT]               = "Postcopy fault",
+    [REC_TYPE_PAGE_IMAGE]                   = "Page image",
+    [REC_TYPE_CHECKPOINT_DIRTY_PFN_RANGES]  = "Checkpoint dirty pfn ranges",
 };
 
 const char *rec_type_to_str(uint32_t type)
@@ -95,14 +103,24 @@ int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec)
 {
     xc_interface *xch = ctx->xch;
     struct xc_sr_rhdr rhdr;
-    size_t datasz;
 
     if ( read_exact(fd, &rhdr, sizeof(rhdr)) )
     {
         PERROR("Failed to read Record Header from stream");
         return -1;
     }
-    else if ( rhdr.length > REC_LENGTH_MAX )
+
+    return read_record_data(ctx, fd, &rhdr, rec);
+}
+
+int read_record_data(struct xc_sr_context *ctx, int fd,
+                     const struct xc_sr_rhdr *hdr, struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rhdr rhdr = *hdr;
+    size_t datasz;
+
+    if ( rhdr.length > REC_LENGTH_MAX )
     {
         ERROR("Record (0x%08x, %s) length %#x exceeds max (%#x)", rhdr.type,
               rec_type_to_str(rhdr.type), rhdr.length, REC_LENGTH_MAX);
@@ -138,7 +156,128 @@ int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec)
     rec->length = rhdr.length;
 
     return 0;
-};
+}
+
+int sr_queue_init(struct xc_sr_queue *q, unsigned int size)
+{
+    int rc;
+
+    q->items = malloc(size * sizeof(*q->items));
+    if ( !q->items )
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    q->size = size;
+    q->head = q->count = 0;
+    q->closed = false;
+
+    rc = pthread_mutex_init(&q->lock, NULL);
+    if ( rc )
+        goto err_free;
+
+    rc = pthread_cond_init(&q->cond, NULL);
+    if ( rc )
+        goto err_mutex;
+
+    return 0;
+
+ err_mutex:
+    pthread_mutex_destroy(&q->lock);
+ err_free:
+    free(q->items);
+    q->items = NULL;
+    errno = rc;
+    return -1;
+}
+
+void sr_queue_destroy(struct xc_sr_queue *q)
+{
+    if ( !q->items )
+        return;
+
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+    free(q->items);
+    q->items = NULL;
+}
+
+int sr_queue_push(struct xc_sr_queue *q, void *item)
+{
+    int rc = -1;
+
+    pthread_mutex_lock(&q->lock);
+
+    while ( !q->closed && q->count == q->size )
+        pthread_cond_wait(&q->cond, &q->lock);
+
+    if ( !q->closed )
+    {
+        q->items[(q->head + q->count) % q->size] = item;
+        q->count++;
+        rc = 0;
+        pthread_cond_broadcast(&q->cond);
+    }
+
+    pthread_mutex_unlock(&q->lock);
+
+    return rc;
+}
+
+void *sr_queue_pop(struct xc_sr_queue *q)
+{
+    void *item = NULL;
+
+    pthread_mutex_lock(&q->lock);
+
+    while ( !q->closed && q->count == 0 )
+        pthread_cond_wait(&q->cond, &q->lock);
+
+    if ( q->count )
+    {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->size;
+        q->count--;
+        pthread_cond_broadcast(&q->cond);
+    }
+
+    pthread_mutex_unlock(&q->lock);
+
+    return item;
+}
+
+void sr_queue_close(struct xc_sr_queue *q)
+{
+    if ( !q->items )
+        return;
+
+    pthread_mutex_lock(&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+uint64_t sr_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void sr_report_stages(struct xc_sr_context *ctx, const char *what,
+                      const char *const names[],
+                      const struct xc_sr_stage *stages, unsigned int nr)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned int i;
+
+    for ( i = 0; i < nr; ++i )
+        IPRINTF("%s %-9s: %10"PRIu64" pages in %10"PRIu64" us, %10"PRIu64" pages/s",
+                what, names[i], stages[i].pages, stages[i].us,
+                stages[i].us ? stages[i].pages * 1000000 / stages[i].us : 0);
+}
 
 static void __attribute__((unused)) build_assertions(void)
 {
@@ -147,6 +286,7 @@ static void __attribute__((unused)) build_assertions(void)
     BUILD_BUG_ON(sizeof(struct xc_sr_rhdr) != 8);
 
     BUILD_BUG_ON(sizeof(struct xc_sr_rec_page_data_header)  != 8);
+    BUILD_BUG_ON(sizeof(struct xc_sr_rec_compressed_page_data_header) != 16);
     BUILD_BUG_ON(sizeof(struct xc_sr_rec_x86_pv_info)       != 8);
     BUILD_BUG_ON(sizeof(struct xc_sr_rec_x86_pv_p2m_frames) != 8);
     BUILD_BUG_ON(sizeof(struct xc_sr_rec_x86_pv_vcpu_hdr)   != 8);
@@ -2,6 +2,7 @@
 #define __COMMON__H
 
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "xg_private.h"
 #include "xg_save_restore.h"
@@ -18,6 +19,83 @@ const char *rec_type_to_str(uint32_t type);
 
 struct xc_sr_context;
 struct xc_sr_record;
+struct xc_sr_save_pipeline;
+struct xc_sr_restore_prefetch;
+struct xc_sr_restore_copier;
+struct xc_sr_restore_postcopy;
+
+/*
+ * A bounded, blocking FIFO of opaque items, used to hand work between the
+ * threads of a pipelined save or restore.
+ */
+struct xc_sr_queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    void **items;
+    unsigned int size, head, count;
+    bool closed;
+};
+
+/* Returns 0 on success and -1 (with errno set) on failure. */
+int sr_queue_init(struct xc_sr_queue *q, unsigned int size);
+void sr_queue_destroy(struct xc_sr_queue *q);
+
+/*
+ * Append an item, blocking while the queue is full.  Returns 0 on success, or
+ * -1 if the queue has been closed.
+ */
+int sr_queue_push(struct xc_sr_queue *q, void *item);
+
+/*
+ * Remove the oldest item, blocking while the queue is empty.  Returns NULL
+ * once the queue has been closed and all remaining items consumed.
+ */
+void *sr_queue_pop(struct xc_sr_queue *q);
+
+/* Refuse further pushes, and wake all waiters. */
+void sr_queue_close(struct xc_sr_queue *q);
+
+/*
+ * Time spent, and pages handled, by one stage of the stream.  Each stage is
+ * only ever accounted by a single thread.
+ */
+struct xc_sr_stage
+{
+    uint64_t us;
+    uint64_t pages;
+};
+
+enum
+{
+    SAVE_STAGE_LOGDIRTY,      /* Fetching and cleaning the log-dirty bitmap. */
+    SAVE_STAGE_MAP,           /* Mapping and normalising batches. */
+    SAVE_STAGE_WRITE,         /* Writing batches to the stream. */
+    SAVE_STAGE_NR,
+};
+
+enum
+{
+    RESTORE_STAGE_POPULATE,   /* Populating the guest physmap. */
+    RESTORE_STAGE_MAP,        /* Mapping guest frames. */
+    RESTORE_STAGE_COPY,       /* Copying page data into the guest. */
+    RESTORE_STAGE_NR,
+};
+
+/* Monotonic time in microseconds. */
+uint64_t sr_now_us(void);
+
+static inline void sr_stage_add(struct xc_sr_stage *stage, uint64_t start,
+                                uint64_t pages)
+{
+    stage->us += sr_now_us() - start;
+    stage->pages += pages;
+}
+
+/* Log the throughput of each stage. */
+void sr_report_stages(struct xc_sr_context *ctx, const char *what,
+                      const char *const names[],
+                      const struct xc_sr_stage *stages, unsigned int nr);
 
 /**
  * Save operations.  To be implemented for each type of guest, for use by the
@@ -198,6 +276,44 @@ struct xc_sr_context
             /* Further debugging information in the stream. */
             bool debug;
 
+            /* Map and write batches on worker threads. */
+            bool pipelined;
+
+            /*
+             * Write page contents at image_offset + pfn * PAGE_SIZE in the
+             * (regular file) fd, and PAGE_IMAGE records into the stream.
+             */
+            bool image;
+            uint64_t image_offset;
+            /* Pfns written to the image so far. */
+            unsigned long *image_written;
+
+            /* Send COMPRESSED_PAGE_DATA rather than PAGE_DATA records. */
+            bool compress;
+            comp_ctx *compress_ctx;
+            uint8_t *compress_enc;
+            char *compress_buf, *deflate_buf;
+            unsigned long deflate_buf_size;
+
+            /* Post-copy permitted, and in progress. */
+            bool postcopy, postcopy_active;
+            /* Pages still to be sent after the postcopy transition. */
+            unsigned long *postcopy_pfns;
+            unsigned long nr_postcopy_pfns;
+
+            /*
+             * Throttle the guest's vcpus, using the scheduler cap, while it
+             * dirties memory faster than the precopy rounds can send it.
+             */
+            bool auto_converge;
+            struct
+            {
+                bool credit2;         /* Scheduler which owns the cap. */
+                bool capped;          /* Cap changed from orig_cap. */
+                unsigned int orig_cap;
+                unsigned int throttle; /* Percentage of vcpu time removed. */
+            } ac;
+
             unsigned long p2m_size;
 
             struct precopy_stats stats;
@@ -207,6 +323,13 @@ struct xc_sr_context
             unsigned long *deferred_pages;
             unsigned long nr_deferred_pages;
             xc_hypercall_buffer_t dirty_bitmap_hbuf;
+            /* Buffers for sparse log-dirty retrieval. */
+            xc_hypercall_buffer_t chunk_pfns_hbuf, chunks_hbuf;
+
+            /* Worker threads and queues, if pipelined. */
+            struct xc_sr_save_pipeline *pipeline;
+
+            struct xc_sr_stage stages[SAVE_STAGE_NR];
         } save;
 
         struct /* Restore data. */
@@ -258,6 +381,24 @@ struct xc_sr_context
 
             /* Sender has invoked verify mode on the stream. */
             bool verify;
+
+            /* Records read ahead of processing on a separate thread. */
+            struct xc_sr_restore_prefetch *prefetch;
+
+            /* Page data copied into the guest on a separate thread. */
+            struct xc_sr_restore_copier *copier;
+
+            /* Page data read straight into guest memory (XCFLAGS_DIRECT). */
+            bool direct;
+
+            /* Pfns whose contents are to be read from the image file. */
+            unsigned long *image_pfns;
+            uint64_t image_offset;
+
+            /* Post-copy state, from a POSTCOPY_BEGIN record onwards. */
+            struct xc_sr_restore_postcopy *postcopy;
+
+            struct xc_sr_stage stages[RESTORE_STAGE_NR];
         } restore;
     };
 
@@ -389,6 +530,12 @@ static inline int write_record(struct xc_sr_context *ctx,
  */
 int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec);
 
+/*
+ * As read_record(), for a record whose header has already been read.
+ */
+int read_record_data(struct xc_sr_context *ctx, int fd,
+                     const struct xc_sr_rhdr *hdr, struct xc_sr_record *rec);
+
 /*
  * This would ideally be private in restore.c, but is needed by
  * x86_pv_localise_page() if we receive pagetables frames ahead of the
@@ -1,6 +1,11 @@
 #include <arpa/inet.h>
 
 #include <assert.h>
+#include <poll.h>
+#include <zlib.h>
+
+#include <xenevtchn.h>
+#include <xen/vm_event.h>
 
 #include "xc_sr_common.h"
 
@@ -126,6 +131,72 @@ static int pfn_set_populated(struct xc_sr_context *ctx, xen_pfn_t pfn)
     return 0;
 }
 
+#define SUPERPAGE_2MB_SHIFT   9
+#define SUPERPAGE_2MB_NR_PFNS (1U << SUPERPAGE_2MB_SHIFT)
+
+/*
+ * For HVM guests, populate each naturally aligned 2MiB run in a list of pfns
+ * as a single superpage.  This is much cheaper in Xen than 512 separate
+ * pages, and leaves the guest with large pages in its p2m.  Pfns populated
+ * this way are removed from the list.  Runs for which Xen has no superpage
+ * left stay in the list, to be populated with 4k pages.
+ */
+static int populate_superpages(struct xc_sr_context *ctx, xen_pfn_t *pfns,
+                               unsigned *nr_pfns)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t *extents;
+    unsigned i, j, k, nr_extents = 0;
+    int done;
+
+    if ( *nr_pfns < SUPERPAGE_2MB_NR_PFNS )
+        return 0;
+
+    extents = malloc((*nr_pfns / SUPERPAGE_2MB_NR_PFNS) * sizeof(*extents));
+    if ( !extents )
+    {
+        ERROR("Failed to allocate memory for superpage extents");
+        return -1;
+    }
+
+    for ( i = 0, j = 0; i < *nr_pfns; )
+    {
+        if ( !(pfns[i] & (SUPERPAGE_2MB_NR_PFNS - 1)) &&
+             i + SUPERPAGE_2MB_NR_PFNS <= *nr_pfns )
+        {
+            for ( k = 1; k < SUPERPAGE_2MB_NR_PFNS; ++k )
+                if ( pfns[i + k] != pfns[i] + k )
+                    break;
+
+            if ( k == SUPERPAGE_2MB_NR_PFNS )
+            {
+                extents[nr_extents++] = pfns[i];
+                i += SUPERPAGE_2MB_NR_PFNS;
+                continue;
+            }
+        }
+        pfns[j++] = pfns[i++];
+    }
+
+    if ( nr_extents )
+    {
+        done = xc_domain_populate_physmap(xch, ctx->domid, nr_extents,
+                                          SUPERPAGE_2MB_SHIFT, 0, extents);
+        if ( done < 0 )
+            done = 0;
+
+        /* Give the remainder back to the caller. */
+        for ( i = done; i < nr_extents; ++i )
+            for ( k = 0; k < SUPERPAGE_2MB_NR_PFNS; ++k )
+                pfns[j++] = extents[i] + k;
+    }
+
+    *nr_pfns = j;
+    free(extents);
+
+    return 0;
+}
+
 /*
  * Given a set of pfns, obtain memory from Xen to fill the physmap for the
  * unpopulated subset.  If types is NULL, no page type checking is performed
@@ -162,6 +233,14 @@ int populate_pfns(struct xc_sr_context *ctx, unsigned count,
         }
     }
 
+    if ( ctx->dominfo.hvm )
+    {
+        rc = populate_superpages(ctx, pfns, &nr_pfns);
+        if ( rc )
+            goto err;
+        memcpy(mfns, pfns, nr_pfns * sizeof(*mfns));
+    }
+
     if ( nr_pfns )
     {
         rc = xc_domain_populate_physmap_exact(
@@ -194,32 +273,283 @@ int populate_pfns(struct xc_sr_context *ctx, unsigned count,
     return rc;
 }
 
+/*
+ * State for decoding the page data of a COMPRESSED_PAGE_DATA record.
+ */
+struct xc_sr_page_decoder
+{
+    const uint8_t *enc;     /* Per-pfn COMPRESSED_PAGE_ENC_* */
+    char *data;             /* Delta encoded page data... */
+    unsigned long len, pos; /* ... its length and read position. */
+    void *page;             /* Scratch buffer for the decoded page. */
+};
+
+/*
+ * Decode page 'idx' of a compressed record into dec->page.  Deltas apply
+ * against the previous contents of the guest page.
+ */
+static int decode_page(struct xc_sr_context *ctx,
+                       struct xc_sr_page_decoder *dec, unsigned idx,
+                       const void *guest_page)
+{
+    xc_interface *xch = ctx->xch;
+
+    switch ( dec->enc[idx] )
+    {
+    case COMPRESSED_PAGE_ENC_ZERO:
+        memset(dec->page, 0, PAGE_SIZE);
+        return 0;
+
+    case COMPRESSED_PAGE_ENC_DELTA:
+        memcpy(dec->page, guest_page, PAGE_SIZE);
+        return xc_compression_uncompress_page(xch, dec->data, dec->len,
+                                              &dec->pos, dec->page);
+
+    default:
+        ERROR("Invalid page encoding %#x at index %u", dec->enc[idx], idx);
+        return -1;
+    }
+}
+
+static bool page_is_zero(const void *page)
+{
+    const unsigned long *p = page;
+    unsigned i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); ++i )
+        if ( p[i] )
+            return false;
+
+    return true;
+}
+
+/*
+ * Page copying.
+ *
+ * For HVM guests, copying a batch of plain page data into the guest is
+ * handed to a separate thread once the batch has been populated and mapped.
+ * The copy then overlaps with populating and mapping the next batch, while
+ * the prefetch thread reads the one after that.  Jobs complete in order, and
+ * the queue is drained before any other kind of record is processed, so
+ * nothing else looks at guest memory before earlier page data has landed.
+ */
+#define COPIER_DEPTH 4
+
+struct xc_sr_copy_job
+{
+    void *mapping;          /* nr_pages frames, unmapped when done */
+    unsigned nr_pages;
+    const void *page_data;  /* nr_pages pages, within ... */
+    void *rec_data;         /* ... the record's data, freed when done */
+    bool *fresh;            /* Populated by this batch, so already zero */
+};
+
+struct xc_sr_restore_copier
+{
+    struct xc_sr_context *ctx;
+    struct xc_sr_queue queue;
+    pthread_t thread;
+    /* Jobs pushed but not yet completed, protected by queue.lock. */
+    unsigned int outstanding;
+    pthread_cond_t idle;
+    /* Folded into the restore's copy stage when the thread is stopped. */
+    struct xc_sr_stage copy;
+};
+
+static void copy_pages(void *guest_page, const void *page_data,
+                       unsigned nr_pages, const bool *fresh)
+{
+    unsigned j;
+
+    for ( j = 0; j < nr_pages; ++j )
+    {
+        if ( !fresh[j] || !page_is_zero(page_data) )
+            memcpy(guest_page, page_data, PAGE_SIZE);
+
+        guest_page += PAGE_SIZE;
+        page_data += PAGE_SIZE;
+    }
+}
+
+static void *copier_worker(void *arg)
+{
+    struct xc_sr_restore_copier *cp = arg;
+    xc_interface *xch = cp->ctx->xch;
+    struct xc_sr_copy_job *job;
+    uint64_t start;
+
+    while ( (job = sr_queue_pop(&cp->queue)) != NULL )
+    {
+        start = sr_now_us();
+        copy_pages(job->mapping, job->page_data, job->nr_pages, job->fresh);
+        sr_stage_add(&cp->copy, start, job->nr_pages);
+
+        xenforeignmemory_unmap(xch->fmem, job->mapping, job->nr_pages);
+        free(job->rec_data);
+        free(job->fresh);
+        free(job);
+
+        pthread_mutex_lock(&cp->queue.lock);
+        if ( --cp->outstanding == 0 )
+            pthread_cond_broadcast(&cp->idle);
+        pthread_mutex_unlock(&cp->queue.lock);
+    }
+
+    return NULL;
+}
+
+static int copier_start(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_copier *cp;
+    int rc;
+
+    cp = calloc(1, sizeof(*cp));
+    if ( !cp )
+    {
+        ERROR("Unable to allocate memory for page copying");
+        errno = ENOMEM;
+        return -1;
+    }
+
+    cp->ctx = ctx;
+    pthread_cond_init(&cp->idle, NULL);
+
+    if ( sr_queue_init(&cp->queue, COPIER_DEPTH) )
+    {
+        PERROR("Unable to initialise page copy queue");
+        pthread_cond_destroy(&cp->idle);
+        free(cp);
+        return -1;
+    }
+
+    rc = pthread_create(&cp->thread, NULL, copier_worker, cp);
+    if ( rc )
+    {
+        errno = rc;
+        PERROR("Unable to create page copy thread");
+        sr_queue_destroy(&cp->queue);
+        pthread_cond_destroy(&cp->idle);
+        free(cp);
+        return -1;
+    }
+
+    ctx->restore.copier = cp;
+
+    return 0;
+}
+
+/* Wait for all queued copies to complete. */
+static void copier_drain(struct xc_sr_context *ctx)
+{
+    struct xc_sr_restore_copier *cp = ctx->restore.copier;
+
+    if ( !cp )
+        return;
+
+    pthread_mutex_lock(&cp->queue.lock);
+    while ( cp->outstanding )
+        pthread_cond_wait(&cp->idle, &cp->queue.lock);
+    pthread_mutex_unlock(&cp->queue.lock);
+}
+
+static void copier_stop(struct xc_sr_context *ctx)
+{
+    struct xc_sr_restore_copier *cp = ctx->restore.copier;
+
+    if ( !cp )
+        return;
+
+    /* The worker finishes any remaining jobs before exiting. */
+    sr_queue_close(&cp->queue);
+    pthread_join(cp->thread, NULL);
+
+    ctx->restore.stages[RESTORE_STAGE_COPY].us += cp->copy.us;
+    ctx->restore.stages[RESTORE_STAGE_COPY].pages += cp->copy.pages;
+
+    sr_queue_destroy(&cp->queue);
+    pthread_cond_destroy(&cp->idle);
+    free(cp);
+    ctx->restore.copier = NULL;
+}
+
+static int copier_push(struct xc_sr_context *ctx, void *mapping,
+                       unsigned nr_pages, const void *page_data,
+                       void *rec_data, bool *fresh)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_copier *cp = ctx->restore.copier;
+    struct xc_sr_copy_job *job = malloc(sizeof(*job));
+
+    if ( !job )
+    {
+        ERROR("Unable to allocate memory for page copy job");
+        return -1;
+    }
+
+    job->mapping = mapping;
+    job->nr_pages = nr_pages;
+    job->page_data = page_data;
+    job->rec_data = rec_data;
+    job->fresh = fresh;
+
+    pthread_mutex_lock(&cp->queue.lock);
+    cp->outstanding++;
+    pthread_mutex_unlock(&cp->queue.lock);
+
+    if ( sr_queue_push(&cp->queue, job) )
+    {
+        pthread_mutex_lock(&cp->queue.lock);
+        cp->outstanding--;
+        pthread_mutex_unlock(&cp->queue.lock);
+        free(job);
+        ERROR("Page copy queue closed");
+        return -1;
+    }
+
+    return 0;
+}
+
 /*
  * Given a list of pfns, their types, and a block of page data from the
  * stream, populate and record their types, map the relevant subset and copy
- * the data into the guest.
+ * the data into the guest.  If 'dec' is provided, the page data is
+ * obtained from it instead of 'page_data'.  If 'rec_data' is provided, and
+ * the copy can be done on the copier thread, the buffer holding page_data is
+ * taken over and *rec_data set to NULL.
+ *
+ * Pages which this batch populates come zeroed from Xen, so zero pages
+ * arriving for them are not written.
  */
 static int process_page_data(struct xc_sr_context *ctx, unsigned count,
-                             xen_pfn_t *pfns, uint32_t *types, void *page_data)
+                             xen_pfn_t *pfns, uint32_t *types, void *page_data,
+                             struct xc_sr_page_decoder *dec, void **rec_data)
 {
     xc_interface *xch = ctx->xch;
     xen_pfn_t *mfns = malloc(count * sizeof(*mfns));
     int *map_errs = malloc(count * sizeof(*map_errs));
+    bool *fresh = malloc(count * sizeof(*fresh));
     int rc;
     void *mapping = NULL, *guest_page = NULL;
     unsigned i,    /* i indexes the pfns from the record. */
         j,         /* j indexes the subset of pfns we decide to map. */
         nr_pages = 0;
+    uint64_t start;
 
-    if ( !mfns || !map_errs )
+    if ( !mfns || !map_errs || !fresh )
     {
         rc = -1;
         ERROR("Failed to allocate %zu bytes to process page data",
-              count * (sizeof(*mfns) + sizeof(*map_errs)));
+              count * (sizeof(*mfns) + sizeof(*map_errs) + sizeof(*fresh)));
         goto err;
     }
 
+    for ( i = 0; i < count; ++i )
+        fresh[i] = !pfn_is_populated(ctx, pfns[i]);
+
+    start = sr_now_us();
     rc = populate_pfns(ctx, count, pfns, types);
+    sr_stage_add(&ctx->restore.stages[RESTORE_STAGE_POPULATE], start, count);
     if ( rc )
     {
         ERROR("Failed to populate pfns for batch of %u pages", count);
@@ -246,6 +576,7 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned count,
         case XEN_DOMCTL_PFINFO_L4TAB:
         case XEN_DOMCTL_PFINFO_L4TAB | XEN_DOMCTL_PFINFO_LPINTAB:
 
+            fresh[nr_pages] = fresh[i] && !ctx->restore.verify;
             mfns[nr_pages++] = ctx->restore.ops.pfn_to_gfn(ctx, pfns[i]);
             break;
         }
@@ -255,9 +586,11 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned count,
     if ( nr_pages == 0 )
         goto done;
 
+    start = sr_now_us();
     mapping = guest_page = xenforeignmemory_map(xch->fmem,
         ctx->domid, PROT_READ | PROT_WRITE,
         nr_pages, mfns, map_errs);
+    sr_stage_add(&ctx->restore.stages[RESTORE_STAGE_MAP], start, nr_pages);
     if ( !mapping )
     {
         rc = -1;
@@ -266,6 +599,32 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned count,
         goto err;
     }
 
+    if ( ctx->restore.copier && !dec && !ctx->restore.verify &&
+         rec_data && *rec_data )
+    {
+        /* HVM: every page with data is mapped, and needs no localising. */
+        for ( j = 0; j < nr_pages; ++j )
+        {
+            if ( map_errs[j] )
+            {
+                rc = -1;
+                ERROR("Mapping mfn %#"PRIpfn" failed with %d",
+                      mfns[j], map_errs[j]);
+                goto err;
+            }
+        }
+
+        rc = copier_push(ctx, mapping, nr_pages, page_data, *rec_data, fresh);
+        if ( rc )
+            goto err;
+
+        *rec_data = NULL;
+        mapping = NULL;
+        fresh = NULL;
+        goto done;
+    }
+
+    start = sr_now_us();
     for ( i = 0, j = 0; i < count; ++i )
     {
         switch ( types[i] )
@@ -285,6 +644,23 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned count,
             goto err;
         }
 
+        if ( dec && fresh[j] && dec->enc[i] == COMPRESSED_PAGE_ENC_ZERO )
+            goto next;
+
+        if ( dec )
+        {
+            rc = decode_page(ctx, dec, i, guest_page);
+            if ( rc )
+            {
+                ERROR("Failed to decode pfn %#"PRIpfn" (type %#"PRIx32")",
+                      pfns[i], types[i] >> XEN_DOMCTL_PFINFO_LTAB_SHIFT);
+                goto err;
+            }
+            page_data = dec->page;
+        }
+        else if ( fresh[j] && page_is_zero(page_data) )
+            goto next;
+
         /* Undo page normalisation done by the saver. */
         rc = ctx->restore.ops.localise_page(ctx, types[i], page_data);
         if ( rc )
@@ -307,9 +683,21 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned count,
             memcpy(guest_page, page_data, PAGE_SIZE);
         }
 
+    next:
         ++j;
         guest_page += PAGE_SIZE;
-        page_data += PAGE_SIZE;
+        if ( !dec )
+            page_data += PAGE_SIZE;
+    }
+
+    sr_stage_add(&ctx->restore.stages[RESTORE_STAGE_COPY], start, nr_pages);
+
+    if ( dec && dec->pos != dec->len )
+    {
+        rc = -1;
+        ERROR("Compressed page data has %lu trailing bytes",
+              dec->len - dec->pos);
+        goto err;
     }
 
  done:
@@ -319,12 +707,57 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned count,
     if ( mapping )
         xenforeignmemory_unmap(xch->fmem, mapping, nr_pages);
 
+    free(fresh);
     free(map_errs);
     free(mfns);
 
     return rc;
 }
 
+/*
+ * Validate and split the pfn array of a PAGE_DATA or COMPRESSED_PAGE_DATA
+ * record into pfns and types, counting how many carry page data.
+ */
+static int decode_pfns(struct xc_sr_context *ctx, unsigned count,
+                       const uint64_t *rec_pfns, xen_pfn_t *pfns,
+                       uint32_t *types, unsigned *pages_of_data)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned i;
+    xen_pfn_t pfn;
+    uint32_t type;
+
+    *pages_of_data = 0;
+
+    for ( i = 0; i < count; ++i )
+    {
+        pfn = rec_pfns[i] & PAGE_DATA_PFN_MASK;
+        if ( !ctx->restore.ops.pfn_is_valid(ctx, pfn) )
+        {
+            ERROR("pfn %#"PRIpfn" (index %u) outside domain maximum", pfn, i);
+            return -1;
+        }
+
+        type = (rec_pfns[i] & PAGE_DATA_TYPE_MASK) >> 32;
+        if ( ((type >> XEN_DOMCTL_PFINFO_LTAB_SHIFT) >= 5) &&
+             ((type >> XEN_DOMCTL_PFINFO_LTAB_SHIFT) <= 8) )
+        {
+            ERROR("Invalid type %#"PRIx32" for pfn %#"PRIpfn" (index %u)",
+                  type, pfn, i);
+            return -1;
+        }
+        else if ( type < XEN_DOMCTL_PFINFO_BROKEN )
+            /* NOTAB and all L1 through L4 tables (including pinned) should
+             * have a page worth of data in the record. */
+            (*pages_of_data)++;
+
+        pfns[i] = pfn;
+        types[i] = type;
+    }
+
+    return 0;
+}
+
 /*
  * Validate a PAGE_DATA record from the stream, and pass the results to
  * process_page_data() to actually perform the legwork.
@@ -333,11 +766,11 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
 {
     xc_interface *xch = ctx->xch;
     struct xc_sr_rec_page_data_header *pages = rec->data;
-    unsigned i, pages_of_data = 0;
+    unsigned pages_of_data = 0;
     int rc = -1;
 
-    xen_pfn_t *pfns = NULL, pfn;
-    uint32_t *types = NULL, type;
+    xen_pfn_t *pfns = NULL;
+    uint32_t *types = NULL;
 
     if ( rec->length < sizeof(*pages) )
     {
@@ -366,31 +799,9 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
         goto err;
     }
 
-    for ( i = 0; i < pages->count; ++i )
-    {
-        pfn = pages->pfn[i] & PAGE_DATA_PFN_MASK;
-        if ( !ctx->restore.ops.pfn_is_valid(ctx, pfn) )
-        {
-            ERROR("pfn %#"PRIpfn" (index %u) outside domain maximum", pfn, i);
-            goto err;
-        }
-
-        type = (pages->pfn[i] & PAGE_DATA_TYPE_MASK) >> 32;
-        if ( ((type >> XEN_DOMCTL_PFINFO_LTAB_SHIFT) >= 5) &&
-             ((type >> XEN_DOMCTL_PFINFO_LTAB_SHIFT) <= 8) )
-        {
-            ERROR("Invalid type %#"PRIx32" for pfn %#"PRIpfn" (index %u)",
-                  type, pfn, i);
-            goto err;
-        }
-        else if ( type < XEN_DOMCTL_PFINFO_BROKEN )
-            /* NOTAB and all L1 through L4 tables (including pinned) should
-             * have a page worth of data in the record. */
-            pages_of_data++;
-
-        pfns[i] = pfn;
-        types[i] = type;
-    }
+    if ( decode_pfns(ctx, pages->count, pages->pfn, pfns, types,
+                     &pages_of_data) )
+        goto err;
 
     if ( rec->length != (sizeof(*pages) +
                          (sizeof(uint64_t) * pages->count) +
@@ -403,7 +814,7 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
     }
 
     rc = process_page_data(ctx, pages->count, pfns, types,
-                           &pages->pfn[pages->count]);
+                           &pages->pfn[pages->count], NULL, &rec->data);
  err:
     free(types);
     free(pfns);
@@ -412,70 +823,1133 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
 }
 
 /*
- * Send checkpoint dirty pfn list to primary.
+ * Validate a COMPRESSED_PAGE_DATA record from the stream, inflate its page
+ * data if necessary, and pass the results to process_page_data() to decode
+ * the individual pages into place.
  */
-static int send_checkpoint_dirty_pfn_list(struct xc_sr_context *ctx)
+static int handle_compressed_page_data(struct xc_sr_context *ctx,
+                                       struct xc_sr_record *rec)
 {
     xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_compressed_page_data_header *pages = rec->data;
+    struct xc_sr_page_decoder dec = { 0 };
+    unsigned i, pages_of_data = 0;
+    size_t enc_len, hdr_len;
+    uLongf raw_len;
     int rc = -1;
-    unsigned count, written;
-    uint64_t i, *pfns = NULL;
-    struct iovec *iov = NULL;
-    xc_shadow_op_stats_t stats = { 0, ctx->restore.p2m_size };
-    struct xc_sr_record rec =
-    {
-        .type = REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST,
-    };
-    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
-                                    &ctx->restore.dirty_bitmap_hbuf);
 
-    if ( xc_shadow_control(
-             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-             HYPERCALL_BUFFER(dirty_bitmap), ctx->restore.p2m_size,
-             NULL, 0, &stats) != ctx->restore.p2m_size )
+    xen_pfn_t *pfns = NULL;
+    uint32_t *types = NULL;
+    void *raw = NULL;
+
+    if ( rec->length < sizeof(*pages) )
     {
-        PERROR("Failed to retrieve logdirty bitmap");
+        ERROR("COMPRESSED_PAGE_DATA record truncated: length %u, min %zu",
+              rec->length, sizeof(*pages));
         goto err;
     }
-
-    for ( i = 0, count = 0; i < ctx->restore.p2m_size; i++ )
+    else if ( pages->count < 1 || pages->count > MAX_BATCH_SIZE )
     {
-        if ( test_bit(i, dirty_bitmap) )
-            count++;
+        ERROR("Expected between 1 and %u pfns in COMPRESSED_PAGE_DATA "
+              "record, got %u", MAX_BATCH_SIZE, pages->count);
+        goto err;
     }
 
+    enc_len = ROUNDUP(pages->count, REC_ALIGN_ORDER);
+    hdr_len = sizeof(*pages) + (pages->count * sizeof(uint64_t)) + enc_len;
 
-    pfns = malloc(count * sizeof(*pfns));
-    if ( !pfns )
+    if ( rec->length != hdr_len + pages->data_length )
     {
-        ERROR("Unable to allocate %zu bytes of memory for dirty pfn list",
-              count * sizeof(*pfns));
+        ERROR("COMPRESSED_PAGE_DATA record wrong size: length %u, expected "
+              "%zu + %u", rec->length, hdr_len, pages->data_length);
         goto err;
     }
 
-    for ( i = 0, written = 0; i < ctx->restore.p2m_size; ++i )
+    pfns = malloc(pages->count * sizeof(*pfns));
+    types = malloc(pages->count * sizeof(*types));
+    dec.page = malloc(PAGE_SIZE);
+    if ( !pfns || !types || !dec.page )
     {
-        if ( !test_bit(i, dirty_bitmap) )
-            continue;
+        ERROR("Unable to allocate enough memory for %u pfns",
+              pages->count);
+        goto err;
+    }
 
-        if ( written > count )
+    if ( decode_pfns(ctx, pages->count, pages->pfn, pfns, types,
+                     &pages_of_data) )
+        goto err;
+
+    dec.enc = (const uint8_t *)&pages->pfn[pages->count];
+    for ( i = 0; i < pages->count; ++i )
+    {
+        bool has_data = types[i] < XEN_DOMCTL_PFINFO_BROKEN;
+
+        if ( has_data != (dec.enc[i] != COMPRESSED_PAGE_ENC_NONE) )
         {
-            ERROR("Dirty pfn list exceed");
+            ERROR("Page encoding %#x inconsistent with type %#"PRIx32
+                  " for pfn %#"PRIpfn, dec.enc[i], types[i], pfns[i]);
             goto err;
         }
-
-        pfns[written++] = i;
     }
 
-    /* iovec[] for writev(). */
-    iov = malloc(3 * sizeof(*iov));
-    if ( !iov )
+    dec.data = (char *)rec->data + hdr_len;
+    dec.len = pages->data_length;
+
+    switch ( pages->codec )
     {
-        ERROR("Unable to allocate memory for sending dirty bitmap");
-        goto err;
+    case COMPRESSED_PAGE_CODEC_NONE:
+        if ( pages->raw_length != pages->data_length )
+        {
+            ERROR("Uncompressed page data length mismatch: %u != %u",
+                  pages->raw_length, pages->data_length);
+            goto err;
+        }
+        break;
+
+    case COMPRESSED_PAGE_CODEC_DEFLATE:
+        /* Each page expands to at most a full page plus its run header. */
+        if ( pages->raw_length > pages_of_data * (PAGE_SIZE + 16) )
+        {
+            ERROR("Implausible raw length %u for %u pages of data",
+                  pages->raw_length, pages_of_data);
+            goto err;
+        }
+
+        raw_len = pages->raw_length;
+        raw = malloc(raw_len ?: 1);
+        if ( !raw )
+        {
+            ERROR("Unable to allocate %u bytes for inflated page data",
+                  pages->raw_length);
+            goto err;
+        }
+
+        if ( uncompress(raw, &raw_len, (const Bytef *)dec.data,
+                        pages->data_length) != Z_OK ||
+             raw_len != pages->raw_length )
+        {
+            ERROR("Failed to inflate %u bytes of page data",
+                  pages->data_length);
+            goto err;
+        }
+
+        dec.data = raw;
+        dec.len = raw_len;
+        break;
+
+    default:
+        ERROR("Unknown page data codec %#x", pages->codec);
+        goto err;
+    }
+
+    rc = process_page_data(ctx, pages->count, pfns, types, NULL, &dec, NULL);
+ err:
+    free(raw);
+    free(dec.page);
+    free(types);
+    free(pfns);
+
+    return rc;
+}
+
+/*
+ * Validate a PAGE_IMAGE record from the stream.  Its pfns are populated now,
+ * and their contents read from the page image once the stream has ended.
+ */
+static int handle_page_image(struct xc_sr_context *ctx,
+                             struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_image_header *hdr = rec->data;
+    unsigned i, pages_of_data;
+    int rc = -1;
+
+    xen_pfn_t *pfns = NULL;
+    uint32_t *types = NULL;
+
+    if ( rec->length < sizeof(*hdr) ||
+         rec->length != sizeof(*hdr) + hdr->count * sizeof(uint64_t) ||
+         hdr->count < 1 )
+    {
+        ERROR("PAGE_IMAGE record wrong size: length %u", rec->length);
+        goto err;
+    }
+
+    if ( !ctx->restore.image_pfns )
+    {
+        ctx->restore.image_pfns = bitmap_alloc(ctx->restore.p2m_size);
+        if ( !ctx->restore.image_pfns )
+        {
+            ERROR("Unable to allocate memory for image pfns bitmap");
+            goto err;
+        }
+        ctx->restore.image_offset = hdr->image_offset;
+    }
+    else if ( hdr->image_offset != ctx->restore.image_offset )
+    {
+        ERROR("PAGE_IMAGE offset %#"PRIx64" differs from %#"PRIx64,
+              hdr->image_offset, ctx->restore.image_offset);
+        goto err;
+    }
+
+    pfns = malloc(hdr->count * sizeof(*pfns));
+    types = malloc(hdr->count * sizeof(*types));
+    if ( !pfns || !types )
+    {
+        ERROR("Unable to allocate enough memory for %u pfns", hdr->count);
+        goto err;
+    }
+
+    if ( decode_pfns(ctx, hdr->count, hdr->pfn, pfns, types, &pages_of_data) )
+        goto err;
+
+    rc = populate_pfns(ctx, hdr->count, pfns, types);
+    if ( rc )
+    {
+        ERROR("Failed to populate pfns for batch of %u pages", hdr->count);
+        goto err;
+    }
+
+    for ( i = 0; i < hdr->count; ++i )
+    {
+        ctx->restore.ops.set_page_type(ctx, pfns[i], types[i]);
+
+        if ( types[i] >= XEN_DOMCTL_PFINFO_BROKEN )
+            continue;
+
+        if ( pfns[i] >= ctx->restore.p2m_size )
+        {
+            ERROR("pfn %#"PRIpfn" beyond the page image", pfns[i]);
+            rc = -1;
+            goto err;
+        }
+        set_bit(pfns[i], ctx->restore.image_pfns);
+    }
+
+ err:
+    free(types);
+    free(pfns);
+
+    return rc;
+}
+
+/* Largest run of pfns read from the page image in one go. */
+#define IMAGE_RUN_MAX 1024
+
+/*
+ * Read [pfn, pfn + nr) from the page image into the guest.  Holes in the
+ * file are zero pages, already zero in the freshly populated guest.
+ */
+static int load_image_run(struct xc_sr_context *ctx, xen_pfn_t pfn,
+                          unsigned nr)
+{
+    xc_interface *xch = ctx->xch;
+    off_t base = ctx->restore.image_offset + ((uint64_t)pfn << PAGE_SHIFT);
+    off_t start = base, end = base + ((off_t)nr << PAGE_SHIFT);
+    off_t data, hole;
+    int errs[IMAGE_RUN_MAX];
+    unsigned i, count;
+    size_t done;
+    ssize_t len;
+    void *mapping;
+
+    while ( start < end )
+    {
+        data = lseek(ctx->fd, start, SEEK_DATA);
+        if ( data == -1 && errno == ENXIO )
+            break; /* Nothing but holes from here on. */
+
+        if ( data == -1 )
+        {
+            /* Filesystem can't report holes: read everything. */
+            data = start;
+            hole = end;
+        }
+        else
+        {
+            if ( data >= end )
+                break;
+            data &= ~(off_t)(PAGE_SIZE - 1);
+            hole = lseek(ctx->fd, data, SEEK_HOLE);
+            if ( hole == -1 || hole > end )
+                hole = end;
+            hole = (hole + PAGE_SIZE - 1) & ~(off_t)(PAGE_SIZE - 1);
+        }
+
+        count = (hole - data) >> PAGE_SHIFT;
+        mapping = xenforeignmemory_map_range(
+            xch->fmem, ctx->domid, PROT_READ | PROT_WRITE,
+            pfn + ((data - base) >> PAGE_SHIFT), count, errs);
+        if ( !mapping )
+        {
+            PERROR("Unable to map %u pages for the page image", count);
+            return -1;
+        }
+
+        for ( i = 0; i < count; ++i )
+        {
+            if ( errs[i] )
+            {
+                ERROR("Mapping pfn %#"PRIpfn" failed: %d",
+                      pfn + ((data - base) >> PAGE_SHIFT) + i, errs[i]);
+                xenforeignmemory_unmap(xch->fmem, mapping, count);
+                return -1;
+            }
+        }
+
+        for ( done = 0; done < (size_t)count << PAGE_SHIFT; done += len )
+        {
+            len = pread(ctx->fd, mapping + done,
+                        ((size_t)count << PAGE_SHIFT) - done, data + done);
+            if ( len == -1 && errno == EINTR )
+            {
+                len = 0;
+                continue;
+            }
+            if ( len == -1 )
+            {
+                PERROR("Failed to read the page image at %#"PRIx64,
+                       (uint64_t)(data + done));
+                xenforeignmemory_unmap(xch->fmem, mapping, count);
+                return -1;
+            }
+            if ( len == 0 )
+                break; /* End of file: the rest are zero pages. */
+        }
+
+        xenforeignmemory_unmap(xch->fmem, mapping, count);
+        start = hole;
+    }
+
+    return 0;
+}
+
+/*
+ * At the end of the stream, read the contents of every pfn named in a
+ * PAGE_IMAGE record from the page image, in runs of consecutive pfns.
+ */
+static int load_image(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t pfn = 0, run;
+
+    while ( pfn < ctx->restore.p2m_size )
+    {
+        if ( !test_bit(pfn, ctx->restore.image_pfns) )
+        {
+            ++pfn;
+            continue;
+        }
+
+        for ( run = 1; run < IMAGE_RUN_MAX &&
+                  pfn + run < ctx->restore.p2m_size &&
+                  test_bit(pfn + run, ctx->restore.image_pfns); ++run )
+            ;
+
+        if ( load_image_run(ctx, pfn, run) )
+            return -1;
+        pfn += run;
+    }
+
+    DPRINTF("Page image loaded");
+
+    return 0;
+}
+
+/*
+ * Post-copy migration.
+ *
+ * Pages listed in POSTCOPY_PFNS records are populated as they are found.
+ * At the POSTCOPY_TRANSITION record, the rest of the domain state has been
+ * restored, so those pages are evicted using mem_paging, and the guest may
+ * be resumed.  A fault thread consumes paging requests as the guest touches
+ * evicted pages, and asks the sender for them on the back channel.  Page
+ * data is loaded back into the guest as it arrives on the stream, resuming
+ * any vcpus waiting on it.
+ *
+ * Pages which can't be evicted (e.g. because they are referenced, or are
+ * special pages which other dom0 components will map) are instead requested
+ * straight away, and the guest isn't resumed until they have all arrived.
+ */
+struct xc_sr_restore_postcopy
+{
+    /* Pages yet to arrive, and the subset of those which are paged out. */
+    unsigned long *outstanding, *evicted;
+    unsigned long nr_outstanding;
+    /* Outstanding pages which must arrive before the guest can run. */
+    unsigned long nr_sync;
+    /* Pages already requested from the sender. */
+    unsigned long *requested;
+
+    bool transitioned; /* POSTCOPY_TRANSITION record processed. */
+    bool resumed;      /* postcopy_transition() callback made. */
+
+    /* The mem_paging ring, and its event channel. */
+    void *ring_page;
+    vm_event_back_ring_t back_ring;
+    xenevtchn_handle *xce;
+    uint32_t remote_port;
+    int local_port;
+
+    /*
+     * The lock protects the ring, the outstanding/evicted bitmaps and the
+     * pending requests, once the fault thread is running.
+     */
+    pthread_mutex_t lock;
+    pthread_t thread;
+    bool thread_running, stop, failed;
+
+    /* Requests which have paused a vcpu until their page arrives. */
+    vm_event_request_t *pending;
+    unsigned nr_pending, max_pending;
+
+    /* Page aligned buffer for xc_mem_paging_load(). */
+    void *buffer;
+};
+
+/* Queue a response on the paging ring.  Called with the lock held. */
+static void postcopy_put_response(struct xc_sr_restore_postcopy *pc,
+                                  const vm_event_request_t *req)
+{
+    vm_event_response_t rsp =
+    {
+        .version = VM_EVENT_INTERFACE_VERSION,
+        .vcpu_id = req->vcpu_id,
+        .flags = req->flags,
+        .reason = req->reason,
+        .u.mem_paging.gfn = req->u.mem_paging.gfn,
+    };
+    RING_IDX rsp_prod = pc->back_ring.rsp_prod_pvt;
+
+    memcpy(RING_GET_RESPONSE(&pc->back_ring, rsp_prod), &rsp, sizeof(rsp));
+    pc->back_ring.rsp_prod_pvt = rsp_prod + 1;
+    RING_PUSH_RESPONSES(&pc->back_ring);
+}
+
+/*
+ * A page is no longer outstanding.  Resume any vcpus waiting on it.
+ * Called with the lock held.  Returns true if Xen needs notifying.
+ */
+static bool postcopy_page_done(struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    struct xc_sr_restore_postcopy *pc = ctx->restore.postcopy;
+    unsigned i = 0;
+    bool notify = false;
+
+    clear_bit(pfn, pc->outstanding);
+    clear_bit(pfn, pc->evicted);
+    pc->nr_outstanding--;
+
+    while ( i < pc->nr_pending )
+    {
+        if ( pc->pending[i].u.mem_paging.gfn != pfn )
+        {
+            ++i;
+            continue;
+        }
+
+        postcopy_put_response(pc, &pc->pending[i]);
+        pc->pending[i] = pc->pending[--pc->nr_pending];
+        notify = true;
+    }
+
+    return notify;
+}
+
+/* Ask the sender for a set of pages, on the back channel. */
+static int postcopy_send_fault(struct xc_sr_context *ctx, uint64_t *pfns,
+                               unsigned count)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_record rec =
+    {
+        .type = REC_TYPE_POSTCOPY_FAULT,
+        .length = count * sizeof(*pfns),
+    };
+    struct iovec iov[] =
+    {
+        { &rec.type,   sizeof(rec.type) },
+        { &rec.length, sizeof(rec.length) },
+        { pfns,        rec.length },
+    };
+
+    if ( ctx->restore.send_back_fd < 0 || !count )
+        return 0;
+
+    if ( writev_exact(ctx->restore.send_back_fd, iov, ARRAY_SIZE(iov)) )
+    {
+        PERROR("Failed to write postcopy fault record");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void *postcopy_fault_worker(void *arg)
+{
+    struct xc_sr_context *ctx = arg;
+    struct xc_sr_restore_postcopy *pc = ctx->restore.postcopy;
+    xc_interface *xch = ctx->xch;
+    struct pollfd pfd =
+    {
+        .fd = xenevtchn_fd(pc->xce),
+        .events = POLLIN,
+    };
+    vm_event_request_t req;
+    RING_IDX req_cons;
+    uint64_t *faults;
+    unsigned nr_faults;
+    xen_pfn_t gfn;
+    bool notify;
+    int rc, port;
+
+    faults = malloc(RING_SIZE(&pc->back_ring) * sizeof(*faults));
+    if ( !faults )
+    {
+        ERROR("Unable to allocate memory for postcopy faults");
+        goto err;
+    }
+
+    for ( ; ; )
+    {
+        rc = poll(&pfd, 1, 100);
+        if ( rc < 0 && errno != EINTR )
+        {
+            PERROR("Failed to poll the paging event channel");
+            goto err;
+        }
+
+        if ( rc > 0 )
+        {
+            port = xenevtchn_pending(pc->xce);
+            if ( port < 0 || xenevtchn_unmask(pc->xce, port) )
+            {
+                PERROR("Failed to handle the paging event channel");
+                goto err;
+            }
+        }
+
+        nr_faults = 0;
+        notify = false;
+
+        pthread_mutex_lock(&pc->lock);
+
+        if ( pc->stop )
+        {
+            pthread_mutex_unlock(&pc->lock);
+            break;
+        }
+
+        while ( RING_HAS_UNCONSUMED_REQUESTS(&pc->back_ring) )
+        {
+            req_cons = pc->back_ring.req_cons;
+            memcpy(&req, RING_GET_REQUEST(&pc->back_ring, req_cons),
+                   sizeof(req));
+            pc->back_ring.req_cons = ++req_cons;
+            pc->back_ring.sring->req_event = req_cons + 1;
+
+            gfn = req.u.mem_paging.gfn;
+
+            if ( gfn >= ctx->restore.p2m_size ||
+                 !test_bit(gfn, pc->evicted) )
+            {
+                /* Already loaded, or never paged out. */
+                if ( (req.flags & VM_EVENT_FLAG_VCPU_PAUSED) ||
+                     (req.u.mem_paging.flags & MEM_PAGING_EVICT_FAIL) )
+                {
+                    postcopy_put_response(pc, &req);
+                    notify = true;
+                }
+            }
+            else if ( req.u.mem_paging.flags & MEM_PAGING_DROP_PAGE )
+            {
+                /* Ballooned out by the guest.  Its data is no longer needed. */
+                notify |= postcopy_page_done(ctx, gfn);
+                if ( req.flags & VM_EVENT_FLAG_VCPU_PAUSED )
+                {
+                    postcopy_put_response(pc, &req);
+                    notify = true;
+                }
+            }
+            else
+            {
+                if ( pc->nr_pending == pc->max_pending )
+                {
+                    unsigned max = pc->max_pending ? pc->max_pending * 2 : 16;
+                    vm_event_request_t *p =
+                        realloc(pc->pending, max * sizeof(*p));
+
+                    if ( !p )
+                    {
+                        pthread_mutex_unlock(&pc->lock);
+                        ERROR("Unable to allocate memory for paging requests");
+                        goto err;
+                    }
+
+                    pc->pending = p;
+                    pc->max_pending = max;
+                }
+
+                pc->pending[pc->nr_pending++] = req;
+
+                if ( !test_and_set_bit(gfn, pc->requested) )
+                    faults[nr_faults++] = gfn;
+            }
+        }
+
+        pthread_mutex_unlock(&pc->lock);
+
+        if ( notify && xenevtchn_notify(pc->xce, pc->local_port) )
+        {
+            PERROR("Failed to notify the paging event channel");
+            goto err;
+        }
+
+        if ( postcopy_send_fault(ctx, faults, nr_faults) )
+            goto err;
+    }
+
+    free(faults);
+    return NULL;
+
+ err:
+    free(faults);
+    pthread_mutex_lock(&pc->lock);
+    pc->failed = true;
+    pthread_mutex_unlock(&pc->lock);
+    return NULL;
+}
+
+/*
+ * Make the postcopy_transition() callback once every page which couldn't be
+ * evicted has arrived.
+ */
+static int postcopy_try_resume(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_postcopy *pc = ctx->restore.postcopy;
+    struct restore_callbacks *cbs = ctx->restore.callbacks;
+
+    if ( pc->resumed || pc->nr_sync )
+        return 0;
+
+    pc->resumed = true;
+
+    if ( !cbs || !cbs->postcopy_transition )
+        return 0;
+
+    if ( cbs->restore_results )
+        cbs->restore_results(ctx->restore.xenstore_gfn,
+                             ctx->restore.console_gfn, cbs->data);
+
+    IPRINTF("Postcopy transition: %lu pages outstanding",
+            pc->nr_outstanding);
+
+    if ( cbs->postcopy_transition(cbs->data) != 1 )
+    {
+        ERROR("Postcopy transition callback failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int handle_postcopy_begin(struct xc_sr_context *ctx,
+                                 struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_postcopy *pc;
+
+    if ( ctx->restore.postcopy )
+    {
+        ERROR("Duplicate POSTCOPY_BEGIN record");
+        return -1;
+    }
+
+    if ( ctx->restore.checkpointed != XC_MIG_STREAM_NONE ||
+         ctx->restore.guest_type != DHDR_TYPE_X86_HVM )
+    {
+        ERROR("Post-copy is only supported for plain HVM streams");
+        return -1;
+    }
+
+    if ( rec->length )
+    {
+        ERROR("POSTCOPY_BEGIN record with non-zero length %u", rec->length);
+        return -1;
+    }
+
+    pc = calloc(1, sizeof(*pc));
+    if ( !pc )
+        goto nomem;
+    ctx->restore.postcopy = pc;
+
+    pc->outstanding = bitmap_alloc(ctx->restore.p2m_size);
+    pc->evicted = bitmap_alloc(ctx->restore.p2m_size);
+    pc->requested = bitmap_alloc(ctx->restore.p2m_size);
+    if ( !pc->outstanding || !pc->evicted || !pc->requested ||
+         posix_memalign(&pc->buffer, PAGE_SIZE, PAGE_SIZE) )
+        goto nomem;
+
+    pthread_mutex_init(&pc->lock, NULL);
+    pc->local_port = -1;
+
+    return 0;
+
+ nomem:
+    ERROR("Unable to allocate memory for post-copy state");
+    errno = ENOMEM;
+    return -1;
+}
+
+static int handle_postcopy_pfns(struct xc_sr_context *ctx,
+                                struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_postcopy *pc = ctx->restore.postcopy;
+    uint64_t *rec_pfns = rec->data;
+    unsigned i, count = rec->length / sizeof(*rec_pfns);
+    xen_pfn_t *pfns;
+    int rc;
+
+    if ( !pc || pc->transitioned )
+    {
+        ERROR("Unexpected POSTCOPY_PFNS record");
+        return -1;
+    }
+
+    if ( rec->length % sizeof(*rec_pfns) )
+    {
+        ERROR("Invalid POSTCOPY_PFNS record length %u", rec->length);
+        return -1;
+    }
+
+    pfns = malloc(count * sizeof(*pfns));
+    if ( !pfns )
+    {
+        ERROR("Unable to allocate memory for %u postcopy pfns", count);
+        return -1;
+    }
+
+    for ( i = 0; i < count; ++i )
+    {
+        pfns[i] = rec_pfns[i];
+
+        if ( pfns[i] >= ctx->restore.p2m_size ||
+             !ctx->restore.ops.pfn_is_valid(ctx, pfns[i]) )
+        {
+            ERROR("pfn %#"PRIpfn" (index %u) outside domain maximum",
+                  pfns[i], i);
+            rc = -1;
+            goto out;
+        }
+
+        if ( !test_and_set_bit(pfns[i], pc->outstanding) )
+            pc->nr_outstanding++;
+    }
+
+    rc = populate_pfns(ctx, count, pfns, NULL);
+
+ out:
+    free(pfns);
+    return rc;
+}
+
+static int handle_postcopy_transition(struct xc_sr_context *ctx,
+                                      struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_postcopy *pc = ctx->restore.postcopy;
+    uint64_t special[4], *sync = NULL;
+    unsigned i, nr_special = 0, nr_sync = 0;
+    xen_pfn_t pfn;
+    int rc;
+
+    if ( !pc || pc->transitioned )
+    {
+        ERROR("Unexpected POSTCOPY_TRANSITION record");
+        return -1;
+    }
+
+    /* All remaining records carry page data, so finish off everything else. */
+    rc = ctx->restore.ops.stream_complete(ctx);
+    if ( rc )
+        return rc;
+
+    pc->ring_page = xc_vm_event_enable(xch, ctx->domid,
+                                       HVM_PARAM_PAGING_RING_PFN,
+                                       &pc->remote_port);
+    if ( !pc->ring_page )
+    {
+        PERROR("Failed to enable paging for post-copy");
+        return -1;
+    }
+
+    pc->xce = xenevtchn_open(NULL, 0);
+    if ( !pc->xce )
+    {
+        PERROR("Failed to open event channel handle");
+        return -1;
+    }
+
+    pc->local_port = xenevtchn_bind_interdomain(pc->xce, ctx->domid,
+                                                pc->remote_port);
+    if ( pc->local_port < 0 )
+    {
+        PERROR("Failed to bind paging event channel");
+        return -1;
+    }
+
+    SHARED_RING_INIT((vm_event_sring_t *)pc->ring_page);
+    BACK_RING_INIT(&pc->back_ring, (vm_event_sring_t *)pc->ring_page,
+                   PAGE_SIZE);
+
+    /* Pages which other dom0 components map are never paged out. */
+    special[nr_special++] = ctx->restore.xenstore_gfn;
+    special[nr_special++] = ctx->restore.console_gfn;
+    if ( !xc_hvm_param_get(xch, ctx->domid, HVM_PARAM_IOREQ_PFN,
+                           &special[nr_special]) )
+        nr_special++;
+    if ( !xc_hvm_param_get(xch, ctx->domid, HVM_PARAM_BUFIOREQ_PFN,
+                           &special[nr_special]) )
+        nr_special++;
+
+    sync = malloc(MAX_BATCH_SIZE * sizeof(*sync));
+    if ( !sync )
+    {
+        ERROR("Unable to allocate memory for postcopy sync pages");
+        return -1;
+    }
+
+    for ( pfn = 0; pfn < ctx->restore.p2m_size; ++pfn )
+    {
+        if ( !test_bit(pfn, pc->outstanding) )
+            continue;
+
+        for ( i = 0; i < nr_special; ++i )
+            if ( special[i] == pfn )
+                break;
+
+        if ( i == nr_special && !xc_mem_paging_nominate(xch, ctx->domid, pfn) )
+        {
+            if ( xc_mem_paging_evict(xch, ctx->domid, pfn) )
+            {
+                PERROR("Failed to evict nominated pfn %#"PRIpfn, pfn);
+                goto err;
+            }
+
+            set_bit(pfn, pc->evicted);
+            continue;
+        }
+
+        /* Can't page this one out.  Fetch it before the guest runs. */
+        pc->nr_sync++;
+        set_bit(pfn, pc->requested);
+        sync[nr_sync++] = pfn;
+
+        if ( nr_sync == MAX_BATCH_SIZE )
+        {
+            if ( postcopy_send_fault(ctx, sync, nr_sync) )
+                goto err;
+            nr_sync = 0;
+        }
+    }
+
+    if ( postcopy_send_fault(ctx, sync, nr_sync) )
+        goto err;
+
+    DPRINTF("Postcopy: %lu pages outstanding, %lu needed before resume",
+            pc->nr_outstanding, pc->nr_sync);
+
+    rc = pthread_create(&pc->thread, NULL, postcopy_fault_worker, ctx);
+    if ( rc )
+    {
+        errno = rc;
+        PERROR("Unable to create postcopy fault thread");
+        goto err;
+    }
+    pc->thread_running = true;
+    pc->transitioned = true;
+
+    free(sync);
+    return postcopy_try_resume(ctx);
+
+ err:
+    free(sync);
+    return -1;
+}
+
+/*
+ * Load the contents of a PAGE_DATA record received after the postcopy
+ * transition.  Pages which were evicted are loaded back via mem_paging, and
+ * the rest are written into the guest as usual.
+ */
+static int handle_postcopy_page_data(struct xc_sr_context *ctx,
+                                     struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_postcopy *pc = ctx->restore.postcopy;
+    struct xc_sr_rec_page_data_header *pages = rec->data;
+    unsigned i, pages_of_data = 0;
+    char *page_data;
+    xen_pfn_t *pfns = NULL;
+    uint32_t *types = NULL;
+    bool evicted, notify;
+    int rc = -1;
+
+    if ( rec->length < sizeof(*pages) || pages->count < 1 ||
+         rec->length < sizeof(*pages) + pages->count * sizeof(uint64_t) )
+    {
+        ERROR("Malformed postcopy PAGE_DATA record: length %u",
+              rec->length);
+        goto err;
+    }
+
+    pfns = malloc(pages->count * sizeof(*pfns));
+    types = malloc(pages->count * sizeof(*types));
+    if ( !pfns || !types )
+    {
+        ERROR("Unable to allocate enough memory for %u pfns",
+              pages->count);
+        goto err;
+    }
+
+    if ( decode_pfns(ctx, pages->count, pages->pfn, pfns, types,
+                     &pages_of_data) )
+        goto err;
+
+    if ( rec->length != (sizeof(*pages) +
+                         (sizeof(uint64_t) * pages->count) +
+                         (PAGE_SIZE * pages_of_data)) )
+    {
+        ERROR("Postcopy PAGE_DATA record wrong size: length %u",
+              rec->length);
+        goto err;
+    }
+
+    page_data = (char *)&pages->pfn[pages->count];
+
+    for ( i = 0; i < pages->count; ++i )
+    {
+        bool has_data = types[i] < XEN_DOMCTL_PFINFO_BROKEN;
+        char *data = has_data ? page_data : NULL;
+
+        if ( has_data )
+            page_data += PAGE_SIZE;
+
+        if ( pfns[i] >= ctx->restore.p2m_size )
+        {
+            ERROR("Postcopy pfn %#"PRIpfn" out of range", pfns[i]);
+            goto err;
+        }
+
+        pthread_mutex_lock(&pc->lock);
+        if ( !test_bit(pfns[i], pc->outstanding) )
+        {
+            /* Dropped by the guest in the meantime. */
+            pthread_mutex_unlock(&pc->lock);
+            continue;
+        }
+        evicted = test_bit(pfns[i], pc->evicted);
+        pthread_mutex_unlock(&pc->lock);
+
+        if ( !evicted )
+        {
+            /* Not paged out, so the guest hasn't been resumed yet. */
+            rc = process_page_data(ctx, 1, &pfns[i], &types[i], data, NULL,
+                                   NULL);
+            if ( rc )
+                goto err;
+
+            pthread_mutex_lock(&pc->lock);
+            notify = postcopy_page_done(ctx, pfns[i]);
+            pc->nr_sync--;
+            pthread_mutex_unlock(&pc->lock);
+        }
+        else
+        {
+            if ( data )
+                memcpy(pc->buffer, data, PAGE_SIZE);
+            else
+                memset(pc->buffer, 0, PAGE_SIZE);
+
+            pthread_mutex_lock(&pc->lock);
+            rc = -1;
+            if ( test_bit(pfns[i], pc->outstanding) )
+            {
+                rc = xc_mem_paging_load(xch, ctx->domid, pfns[i], pc->buffer);
+                notify = !rc && postcopy_page_done(ctx, pfns[i]);
+            }
+            else
+            {
+                rc = 0;
+                notify = false;
+            }
+            pthread_mutex_unlock(&pc->lock);
+
+            if ( rc )
+            {
+                PERROR("Failed to load postcopy pfn %#"PRIpfn, pfns[i]);
+                goto err;
+            }
+        }
+
+        if ( notify && xenevtchn_notify(pc->xce, pc->local_port) )
+        {
+            PERROR("Failed to notify the paging event channel");
+            rc = -1;
+            goto err;
+        }
+    }
+
+    pthread_mutex_lock(&pc->lock);
+    rc = pc->failed ? -1 : 0;
+    pthread_mutex_unlock(&pc->lock);
+
+    if ( rc )
+    {
+        ERROR("Postcopy fault handling failed");
+        goto err;
+    }
+
+    rc = postcopy_try_resume(ctx);
+
+ err:
+    free(types);
+    free(pfns);
+
+    return rc;
+}
+
+/*
+ * Check that a post-copy stream has delivered everything at the END record.
+ */
+static int postcopy_end(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_postcopy *pc = ctx->restore.postcopy;
+
+    if ( !pc->transitioned )
+    {
+        ERROR("Stream ended before the postcopy transition");
+        return -1;
+    }
+
+    if ( pc->nr_outstanding )
+    {
+        ERROR("Stream ended with %lu postcopy pages outstanding",
+              pc->nr_outstanding);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void postcopy_stop(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_postcopy *pc = ctx->restore.postcopy;
+
+    if ( !pc )
+        return;
+
+    if ( pc->thread_running )
+    {
+        pthread_mutex_lock(&pc->lock);
+        pc->stop = true;
+        pthread_mutex_unlock(&pc->lock);
+        pthread_join(pc->thread, NULL);
+    }
+
+    if ( pc->ring_page )
+    {
+        if ( xc_mem_paging_disable(xch, ctx->domid) )
+            PERROR("Failed to disable paging");
+        xenforeignmemory_unmap(xch->fmem, pc->ring_page, 1);
+    }
+
+    if ( pc->xce )
+    {
+        if ( pc->local_port >= 0 )
+            xenevtchn_unbind(pc->xce, pc->local_port);
+        xenevtchn_close(pc->xce);
+    }
+
+    pthread_mutex_destroy(&pc->lock);
+    free(pc->pending);
+    free(pc->buffer);
+    free(pc->requested);
+    free(pc->evicted);
+    free(pc->outstanding);
+    free(pc);
+    ctx->restore.postcopy = NULL;
+}
+
+/*
+ * Send the pfns dirtied by the secondary since the last checkpoint to the
+ * primary, as runs of consecutive pfns.
+ */
+static int send_checkpoint_dirty_pfn_list(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    int rc = -1;
+    unsigned count, written;
+    uint64_t i;
+    struct xc_sr_rec_pfn_range *ranges = NULL;
+    struct iovec iov[3];
+    xc_shadow_op_stats_t stats = { 0, ctx->restore.p2m_size };
+    struct xc_sr_record rec =
+    {
+        .type = REC_TYPE_CHECKPOINT_DIRTY_PFN_RANGES,
+    };
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->restore.dirty_bitmap_hbuf);
+
+    if ( xc_shadow_control(
+             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
+             HYPERCALL_BUFFER(dirty_bitmap), ctx->restore.p2m_size,
+             NULL, 0, &stats) != ctx->restore.p2m_size )
+    {
+        PERROR("Failed to retrieve logdirty bitmap");
+        goto err;
+    }
+
+    for ( i = 0, count = 0; i < ctx->restore.p2m_size; i++ )
+    {
+        if ( test_bit(i, dirty_bitmap) &&
+             (i == 0 || !test_bit(i - 1, dirty_bitmap)) )
+            count++;
+    }
+
+    ranges = malloc(count * sizeof(*ranges));
+    if ( count && !ranges )
+    {
+        ERROR("Unable to allocate %zu bytes of memory for dirty pfn ranges",
+              count * sizeof(*ranges));
+        goto err;
+    }
+
+    for ( i = 0, written = 0; i < ctx->restore.p2m_size; ++i )
+    {
+        if ( !test_bit(i, dirty_bitmap) )
+            continue;
+
+        if ( i == 0 || !test_bit(i - 1, dirty_bitmap) )
+        {
+            if ( written == count )
+            {
+                ERROR("Dirty pfn ranges exceed");
+                goto err;
+            }
+
+            ranges[written].pfn = i;
+            ranges[written++].count = 0;
+        }
+
+        ranges[written - 1].count++;
     }
 
-    rec.length = count * sizeof(*pfns);
+    rec.length = count * sizeof(*ranges);
 
     iov[0].iov_base = &rec.type;
     iov[0].iov_len = sizeof(rec.type);
@@ -483,19 +1957,18 @@ static int send_checkpoint_dirty_pfn_list(struct xc_sr_context *ctx)
     iov[1].iov_base = &rec.length;
     iov[1].iov_len = sizeof(rec.length);
 
-    iov[2].iov_base = pfns;
-    iov[2].iov_len = count * sizeof(*pfns);
+    iov[2].iov_base = ranges;
+    iov[2].iov_len = count * sizeof(*ranges);
 
     if ( writev_exact(ctx->restore.send_back_fd, iov, 3) )
     {
-        PERROR("Failed to write dirty bitmap to stream");
+        PERROR("Failed to write dirty pfn ranges to stream");
         goto err;
     }
 
     rc = 0;
  err:
-    free(pfns);
-    free(iov);
+    free(ranges);
     return rc;
 }
 
@@ -631,13 +2104,37 @@ static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
     xc_interface *xch = ctx->xch;
     int rc = 0;
 
+    if ( rec->type != REC_TYPE_PAGE_DATA )
+        copier_drain(ctx);
+
     switch ( rec->type )
     {
     case REC_TYPE_END:
+        if ( ctx->restore.postcopy )
+            rc = postcopy_end(ctx);
+        else if ( ctx->restore.image_pfns )
+            rc = load_image(ctx);
         break;
 
     case REC_TYPE_PAGE_DATA:
-        rc = handle_page_data(ctx, rec);
+        if ( ctx->restore.postcopy && ctx->restore.postcopy->transitioned )
+            rc = handle_postcopy_page_data(ctx, rec);
+        else
+            rc = handle_page_data(ctx, rec);
+        break;
+
+    case REC_TYPE_COMPRESSED_PAGE_DATA:
+        if ( ctx->restore.postcopy && ctx->restore.postcopy->transitioned )
+        {
+            ERROR("Compressed page data after the postcopy transition");
+            rc = -1;
+        }
+        else
+            rc = handle_compressed_page_data(ctx, rec);
+        break;
+
+    case REC_TYPE_PAGE_IMAGE:
+        rc = handle_page_image(ctx, rec);
         break;
 
     case REC_TYPE_VERIFY:
@@ -649,6 +2146,18 @@ static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
         rc = handle_checkpoint(ctx);
         break;
 
+    case REC_TYPE_POSTCOPY_BEGIN:
+        rc = handle_postcopy_begin(ctx, rec);
+        break;
+
+    case REC_TYPE_POSTCOPY_PFNS:
+        rc = handle_postcopy_pfns(ctx, rec);
+        break;
+
+    case REC_TYPE_POSTCOPY_TRANSITION:
+        rc = handle_postcopy_transition(ctx, rec);
+        break;
+
     default:
         rc = ctx->restore.ops.process_record(ctx, rec);
         break;
@@ -660,6 +2169,396 @@ static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
     return rc;
 }
 
+/*
+ * Record prefetching.
+ *
+ * For plain (non-checkpointed) streams, records are read by a separate thread
+ * into a bounded queue, so that the next batch of page data is coming off the
+ * wire while process_page_data() populates and copies the current one.  The
+ * reader stops after the END record or the first error, so never consumes
+ * anything beyond the end of the libxc stream.
+ */
+#define PREFETCH_DEPTH 8
+
+struct xc_sr_restore_prefetch
+{
+    struct xc_sr_context *ctx;
+    struct xc_sr_queue queue;
+    pthread_t thread;
+    /* errno from the reader, valid once the queue has been closed. */
+    int err;
+};
+
+static void *prefetch_worker(void *arg)
+{
+    struct xc_sr_restore_prefetch *pf = arg;
+    struct xc_sr_record *rec;
+    uint32_t type;
+    int rc;
+
+    /*
+     * Cancellation is only permitted while blocked reading the stream, and
+     * is only used to tear down the reader when the restore has failed.
+     */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    for ( ; ; )
+    {
+        rec = malloc(sizeof(*rec));
+        if ( !rec )
+        {
+            pf->err = ENOMEM;
+            break;
+        }
+
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        rc = read_record(pf->ctx, pf->ctx->fd, rec);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        if ( rc )
+        {
+            pf->err = errno ?: EIO;
+            free(rec);
+            break;
+        }
+
+        type = rec->type;
+        if ( sr_queue_push(&pf->queue, rec) )
+        {
+            free(rec->data);
+            free(rec);
+            break;
+        }
+
+        if ( type == REC_TYPE_END )
+            break;
+    }
+
+    sr_queue_close(&pf->queue);
+
+    return NULL;
+}
+
+static int prefetch_start(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_prefetch *pf;
+    int rc;
+
+    pf = calloc(1, sizeof(*pf));
+    if ( !pf )
+    {
+        ERROR("Unable to allocate memory for record prefetching");
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pf->ctx = ctx;
+
+    if ( sr_queue_init(&pf->queue, PREFETCH_DEPTH) )
+    {
+        PERROR("Unable to initialise record prefetch queue");
+        free(pf);
+        return -1;
+    }
+
+    rc = pthread_create(&pf->thread, NULL, prefetch_worker, pf);
+    if ( rc )
+    {
+        errno = rc;
+        PERROR("Unable to create record prefetch thread");
+        sr_queue_destroy(&pf->queue);
+        free(pf);
+        return -1;
+    }
+
+    ctx->restore.prefetch = pf;
+
+    return 0;
+}
+
+static void prefetch_stop(struct xc_sr_context *ctx)
+{
+    struct xc_sr_restore_prefetch *pf = ctx->restore.prefetch;
+    struct xc_sr_record *rec;
+    bool running;
+
+    if ( !pf )
+        return;
+
+    pthread_mutex_lock(&pf->queue.lock);
+    running = !pf->queue.closed;
+    pthread_mutex_unlock(&pf->queue.lock);
+
+    /*
+     * A reader which is still running means the restore has failed before
+     * reaching the END record.  It may be blocked in read(), so cancel it.
+     */
+    if ( running )
+    {
+        sr_queue_close(&pf->queue);
+        pthread_cancel(pf->thread);
+    }
+    pthread_join(pf->thread, NULL);
+
+    while ( (rec = sr_queue_pop(&pf->queue)) != NULL )
+    {
+        free(rec->data);
+        free(rec);
+    }
+
+    sr_queue_destroy(&pf->queue);
+    free(pf);
+    ctx->restore.prefetch = NULL;
+}
+
+/*
+ * Direct page data placement.
+ *
+ * With XCFLAGS_DIRECT, a PAGE_DATA record is not read into a buffer and
+ * copied page by page into the guest.  Instead, once its pfn array has been
+ * read, the frames are populated and mapped, and the page data is read from
+ * the stream straight into the mapping.  Only pagetables, which need
+ * localising, go through a bounce page.  This saves a copy of all guest
+ * memory on the receiving side, at the cost of not overlapping the stream
+ * reads with populating and mapping as prefetching does.
+ */
+static int read_page_data_direct(struct xc_sr_context *ctx,
+                                 const struct xc_sr_rhdr *rhdr)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_data_header pages;
+    uint64_t *rec_pfns = NULL;
+    xen_pfn_t *pfns = NULL, *mfns = NULL;
+    uint32_t *types = NULL;
+    int *map_errs = NULL;
+    void *mapping = NULL, *guest_page, *bounce = NULL;
+    unsigned i, j, run, nr_pages = 0, pages_of_data;
+    int rc = -1;
+
+    if ( rhdr->length > REC_LENGTH_MAX )
+    {
+        ERROR("PAGE_DATA record length %#x exceeds max (%#x)",
+              rhdr->length, REC_LENGTH_MAX);
+        return -1;
+    }
+    else if ( rhdr->length < sizeof(pages) )
+    {
+        ERROR("PAGE_DATA record truncated: length %u, min %zu",
+              rhdr->length, sizeof(pages));
+        return -1;
+    }
+
+    if ( read_exact(ctx->fd, &pages, sizeof(pages)) )
+    {
+        PERROR("Failed to read PAGE_DATA header");
+        return -1;
+    }
+
+    if ( pages.count < 1 )
+    {
+        ERROR("Expected at least 1 pfn in PAGE_DATA record");
+        return -1;
+    }
+    else if ( rhdr->length < sizeof(pages) + (pages.count * sizeof(uint64_t)) )
+    {
+        ERROR("PAGE_DATA record (length %u) too short to contain %u"
+              " pfns worth of information", rhdr->length, pages.count);
+        return -1;
+    }
+
+    rec_pfns = malloc(pages.count * sizeof(*rec_pfns));
+    pfns = malloc(pages.count * sizeof(*pfns));
+    mfns = malloc(pages.count * sizeof(*mfns));
+    types = malloc(pages.count * sizeof(*types));
+    map_errs = malloc(pages.count * sizeof(*map_errs));
+    bounce = malloc(PAGE_SIZE);
+    if ( !rec_pfns || !pfns || !mfns || !types || !map_errs || !bounce )
+    {
+        ERROR("Unable to allocate enough memory for %u pfns", pages.count);
+        goto err;
+    }
+
+    if ( read_exact(ctx->fd, rec_pfns, pages.count * sizeof(*rec_pfns)) )
+    {
+        PERROR("Failed to read PAGE_DATA pfns");
+        goto err;
+    }
+
+    if ( decode_pfns(ctx, pages.count, rec_pfns, pfns, types,
+                     &pages_of_data) )
+        goto err;
+
+    /* No padding is possible: the header and pfns are 8-byte multiples. */
+    if ( rhdr->length != (sizeof(pages) +
+                          (sizeof(uint64_t) * pages.count) +
+                          (PAGE_SIZE * pages_of_data)) )
+    {
+        ERROR("PAGE_DATA record wrong size: length %u, expected "
+              "%zu + %zu + %lu", rhdr->length, sizeof(pages),
+              (sizeof(uint64_t) * pages.count), (PAGE_SIZE * pages_of_data));
+        goto err;
+    }
+
+    if ( populate_pfns(ctx, pages.count, pfns, types) )
+    {
+        ERROR("Failed to populate pfns for batch of %u pages", pages.count);
+        goto err;
+    }
+
+    for ( i = 0; i < pages.count; ++i )
+    {
+        ctx->restore.ops.set_page_type(ctx, pfns[i], types[i]);
+
+        /* Pages carrying data, as counted by decode_pfns(). */
+        if ( types[i] < XEN_DOMCTL_PFINFO_BROKEN )
+        {
+            pfns[nr_pages] = pfns[i];
+            types[nr_pages] = types[i];
+            mfns[nr_pages++] = ctx->restore.ops.pfn_to_gfn(ctx, pfns[i]);
+        }
+    }
+
+    if ( nr_pages == 0 )
+    {
+        rc = 0;
+        goto err;
+    }
+
+    mapping = xenforeignmemory_map(xch->fmem, ctx->domid,
+                                   PROT_READ | PROT_WRITE,
+                                   nr_pages, mfns, map_errs);
+    if ( !mapping )
+    {
+        PERROR("Unable to map %u mfns for %u pages of data",
+               nr_pages, pages.count);
+        goto err;
+    }
+
+    for ( j = 0; j < nr_pages; ++j )
+    {
+        if ( map_errs[j] )
+        {
+            ERROR("Mapping pfn %#"PRIpfn" (mfn %#"PRIpfn", type %#"PRIx32
+                  ") failed with %d", pfns[j], mfns[j], types[j],
+                  map_errs[j]);
+            goto err;
+        }
+    }
+
+    for ( j = 0; j < nr_pages; j += run )
+    {
+        guest_page = mapping + ((size_t)j << PAGE_SHIFT);
+
+        if ( (types[j] & XEN_DOMCTL_PFINFO_LTABTYPE_MASK) ==
+             XEN_DOMCTL_PFINFO_NOTAB )
+        {
+            /* A run of ordinary pages needs no localising: read it whole. */
+            for ( run = 1; j + run < nr_pages; ++run )
+                if ( (types[j + run] & XEN_DOMCTL_PFINFO_LTABTYPE_MASK) !=
+                     XEN_DOMCTL_PFINFO_NOTAB )
+                    break;
+
+            if ( read_exact(ctx->fd, guest_page, (size_t)run << PAGE_SHIFT) )
+            {
+                PERROR("Failed to read %u pages of data into pfn %#"PRIpfn,
+                       run, pfns[j]);
+                goto err;
+            }
+            continue;
+        }
+
+        run = 1;
+        if ( read_exact(ctx->fd, bounce, PAGE_SIZE) )
+        {
+            PERROR("Failed to read data for pfn %#"PRIpfn, pfns[j]);
+            goto err;
+        }
+
+        if ( ctx->restore.ops.localise_page(ctx, types[j], bounce) )
+        {
+            ERROR("Failed to localise pfn %#"PRIpfn" (type %#"PRIx32")",
+                  pfns[j], types[j] >> XEN_DOMCTL_PFINFO_LTAB_SHIFT);
+            goto err;
+        }
+
+        memcpy(guest_page, bounce, PAGE_SIZE);
+    }
+
+    rc = 0;
+
+ err:
+    if ( mapping )
+        xenforeignmemory_unmap(xch->fmem, mapping, nr_pages);
+
+    free(bounce);
+    free(map_errs);
+    free(types);
+    free(mfns);
+    free(pfns);
+    free(rec_pfns);
+
+    return rc;
+}
+
+/*
+ * Read the next record in direct mode.  PAGE_DATA records are dealt with
+ * entirely here, and reported as RECORD_PLACED.
+ */
+#define RECORD_PLACED 3
+static int read_record_direct(struct xc_sr_context *ctx,
+                              struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rhdr rhdr;
+
+    if ( read_exact(ctx->fd, &rhdr, sizeof(rhdr)) )
+    {
+        PERROR("Failed to read Record Header from stream");
+        return -1;
+    }
+
+    /* Verify mode and post-copy need the page data in a buffer. */
+    if ( rhdr.type != REC_TYPE_PAGE_DATA || ctx->restore.verify ||
+         ctx->restore.postcopy )
+        return read_record_data(ctx, ctx->fd, &rhdr, rec);
+
+    rec->type = rhdr.type;
+    rec->length = rhdr.length;
+    rec->data = NULL;
+
+    return read_page_data_direct(ctx, &rhdr) ?: RECORD_PLACED;
+}
+
+/*
+ * Obtain the next record from the stream, either directly or from the
+ * prefetch queue.  Semantics as per read_record(), except that direct mode
+ * may return RECORD_PLACED for a record which needs no further processing.
+ */
+static int next_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
+{
+    struct xc_sr_restore_prefetch *pf = ctx->restore.prefetch;
+    struct xc_sr_record *next;
+
+    if ( ctx->restore.direct )
+        return read_record_direct(ctx, rec);
+
+    if ( !pf )
+        return read_record(ctx, ctx->fd, rec);
+
+    next = sr_queue_pop(&pf->queue);
+    if ( !next )
+    {
+        errno = pf->err ?: EIO;
+        return -1;
+    }
+
+    *rec = *next;
+    free(next);
+
+    return 0;
+}
+
 static int setup(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
@@ -704,6 +2603,22 @@ static int setup(struct xc_sr_context *ctx)
     }
     ctx->restore.allocated_rec_num = DEFAULT_BUF_RECORDS;
 
+    if ( ctx->restore.checkpointed != XC_MIG_STREAM_NONE )
+        ctx->restore.direct = false;
+    else if ( !ctx->restore.direct )
+    {
+        rc = prefetch_start(ctx);
+        if ( rc )
+            goto err;
+
+        if ( ctx->dominfo.hvm )
+        {
+            rc = copier_start(ctx);
+            if ( rc )
+                goto err;
+        }
+    }
+
  err:
     return rc;
 }
@@ -715,6 +2630,10 @@ static void cleanup(struct xc_sr_context *ctx)
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->restore.dirty_bitmap_hbuf);
 
+    prefetch_stop(ctx);
+    copier_stop(ctx);
+    postcopy_stop(ctx);
+
     for ( i = 0; i < ctx->restore.buffered_rec_num; i++ )
         free(ctx->restore.buffered_records[i].data);
 
@@ -723,10 +2642,18 @@ static void cleanup(struct xc_sr_context *ctx)
                                    NRPAGES(bitmap_size(ctx->restore.p2m_size)));
     free(ctx->restore.buffered_records);
     free(ctx->restore.populated_pfns);
+    free(ctx->restore.image_pfns);
     if ( ctx->restore.ops.cleanup(ctx) )
         PERROR("Failed to clean up");
 }
 
+static const char *const restore_stage_names[RESTORE_STAGE_NR] =
+{
+    [RESTORE_STAGE_POPULATE] = "populate",
+    [RESTORE_STAGE_MAP]      = "map",
+    [RESTORE_STAGE_COPY]     = "copy",
+};
+
 /*
  * Restore a domain.
  */
@@ -744,7 +2671,9 @@ static int restore(struct xc_sr_context *ctx)
 
     do
     {
-        rc = read_record(ctx, ctx->fd, &rec);
+        rc = next_record(ctx, &rec);
+        if ( rc == RECORD_PLACED )
+            continue;
         if ( rc )
         {
             if ( ctx->restore.buffer_all_records )
@@ -797,11 +2726,15 @@ static int restore(struct xc_sr_context *ctx)
 
     /*
      * With Remus, if we reach here, there must be some error on primary,
-     * failover from the last checkpoint state.
+     * failover from the last checkpoint state.  With post-copy, the stream
+     * was completed at the transition.
      */
-    rc = ctx->restore.ops.stream_complete(ctx);
-    if ( rc )
-        goto err;
+    if ( !ctx->restore.postcopy )
+    {
+        rc = ctx->restore.ops.stream_complete(ctx);
+        if ( rc )
+            goto err;
+    }
 
     IPRINTF("Restore successful");
     goto done;
@@ -814,6 +2747,9 @@ static int restore(struct xc_sr_context *ctx)
  done:
     cleanup(ctx);
 
+    sr_report_stages(ctx, "Restore", restore_stage_names,
+                     ctx->restore.stages, RESTORE_STAGE_NR);
+
     if ( saved_rc )
     {
         rc = saved_rc;
@@ -828,7 +2764,7 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
                       uint32_t store_domid, unsigned int console_evtchn,
                       unsigned long *console_gfn, uint32_t console_domid,
                       unsigned int hvm, unsigned int pae,
-                      xc_migration_stream_t stream_type,
+                      xc_migration_stream_t stream_type, uint32_t flags,
                       struct restore_callbacks *callbacks, int send_back_fd)
 {
     xen_pfn_t nr_pfns;
@@ -846,6 +2782,7 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     ctx.restore.checkpointed = stream_type;
     ctx.restore.callbacks = callbacks;
     ctx.restore.send_back_fd = send_back_fd;
+    ctx.restore.direct = flags & XCFLAGS_DIRECT;
 
     /* Sanity checks for callbacks. */
     if ( stream_type )
@@ -860,8 +2797,8 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
                callbacks->restore_results);
     }
 
-    DPRINTF("fd %d, dom %u, hvm %u, pae %u, stream_type %d",
-            io_fd, dom, hvm, pae, stream_type);
+    DPRINTF("fd %d, dom %u, hvm %u, pae %u, stream_type %d, flags %#x",
+            io_fd, dom, hvm, pae, stream_type, flags);
 
     if ( xc_domain_getinfo(xch, dom, 1, &ctx.dominfo) != 1 )
     {
@@ -1,5 +1,9 @@
 #include <assert.h>
+#include <poll.h>
+#include <time.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
+#include <zlib.h>
 
 #include "xc_sr_common.h"
 
@@ -67,48 +71,88 @@ static int write_checkpoint_record(struct xc_sr_context *ctx)
 }
 
 /*
- * Writes a batch of memory as a PAGE_DATA record into the stream.  The batch
- * is constructed in ctx->save.batch_pfns.
+ * A batch of pages, from the pfns chosen for sending through to the iovec[]
+ * describing the PAGE_DATA record.  Owns the guest mapping and any locally
+ * normalised pages until released.
+ */
+struct xc_sr_batch
+{
+    xen_pfn_t *pfns;
+    unsigned nr_pfns;
+
+    xen_pfn_t *mfns, *types;
+    int *errors;
+    void *guest_mapping;
+    unsigned nr_pages, nr_pages_mapped;
+    void **guest_data;
+    void **local_pages;
+
+    uint64_t *rec_pfns;
+    struct iovec *iov;
+    int iovcnt;
+    struct xc_sr_rec_page_data_header hdr;
+    struct xc_sr_record rec;
+};
+
+/*
+ * Releases everything held by a batch, other than its pfn array.  Safe to
+ * call on a partially constructed batch.
+ */
+static void release_batch(struct xc_sr_context *ctx,
+                          struct xc_sr_batch *batch)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned i;
+
+    free(batch->rec_pfns);
+    if ( batch->guest_mapping )
+        xenforeignmemory_unmap(xch->fmem, batch->guest_mapping,
+                               batch->nr_pages_mapped);
+    for ( i = 0; batch->local_pages && i < batch->nr_pfns; ++i )
+        free(batch->local_pages[i]);
+    free(batch->iov);
+    free(batch->local_pages);
+    free(batch->guest_data);
+    free(batch->errors);
+    free(batch->types);
+    free(batch->mfns);
+}
+
+/*
+ * Prepares a batch of memory for sending as a PAGE_DATA record.
  *
  * This function:
  * - gets the types for each pfn in the batch.
  * - for each pfn with real data:
  *   - maps and attempts to localise the pages.
- * - construct and writes a PAGE_DATA record into the stream.
+ * - constructs the iovec[] for the PAGE_DATA record.
  */
-static int write_batch(struct xc_sr_context *ctx)
+static int map_batch(struct xc_sr_context *ctx, struct xc_sr_batch *batch)
 {
     xc_interface *xch = ctx->xch;
-    xen_pfn_t *mfns = NULL, *types = NULL;
-    void *guest_mapping = NULL;
-    void **guest_data = NULL;
-    void **local_pages = NULL;
-    int *errors = NULL, rc = -1;
-    unsigned i, p, nr_pages = 0, nr_pages_mapped = 0;
-    unsigned nr_pfns = ctx->save.nr_batch_pfns;
+    xen_pfn_t *mfns, *types;
+    void **guest_data, **local_pages;
+    int *errors, rc = -1;
+    unsigned i, p, nr_pages = 0;
+    unsigned nr_pfns = batch->nr_pfns;
     void *page, *orig_page;
-    uint64_t *rec_pfns = NULL;
-    struct iovec *iov = NULL; int iovcnt = 0;
-    struct xc_sr_rec_page_data_header hdr = { 0 };
-    struct xc_sr_record rec =
-    {
-        .type = REC_TYPE_PAGE_DATA,
-    };
+    struct iovec *iov;
+    int iovcnt;
 
     assert(nr_pfns != 0);
 
     /* Mfns of the batch pfns. */
-    mfns = malloc(nr_pfns * sizeof(*mfns));
+    mfns = batch->mfns = malloc(nr_pfns * sizeof(*mfns));
     /* Types of the batch pfns. */
-    types = malloc(nr_pfns * sizeof(*types));
+    types = batch->types = malloc(nr_pfns * sizeof(*types));
     /* Errors from attempting to map the gfns. */
-    errors = malloc(nr_pfns * sizeof(*errors));
+    errors = batch->errors = malloc(nr_pfns * sizeof(*errors));
     /* Pointers to page data to send.  Mapped gfns or local allocations. */
-    guest_data = calloc(nr_pfns, sizeof(*guest_data));
+    guest_data = batch->guest_data = calloc(nr_pfns, sizeof(*guest_data));
     /* Pointers to locally allocated pages.  Need freeing. */
-    local_pages = calloc(nr_pfns, sizeof(*local_pages));
+    local_pages = batch->local_pages = calloc(nr_pfns, sizeof(*local_pages));
     /* iovec[] for writev(). */
-    iov = malloc((nr_pfns + 4) * sizeof(*iov));
+    iov = batch->iov = malloc((nr_pfns + 4) * sizeof(*iov));
 
     if ( !mfns || !types || !errors || !guest_data || !local_pages || !iov )
     {
@@ -119,13 +163,12 @@ static int write_batch(struct xc_sr_context *ctx)
 
     for ( i = 0; i < nr_pfns; ++i )
     {
-        types[i] = mfns[i] = ctx->save.ops.pfn_to_gfn(ctx,
-                                                      ctx->save.batch_pfns[i]);
+        types[i] = mfns[i] = ctx->save.ops.pfn_to_gfn(ctx, batch->pfns[i]);
 
         /* Likely a ballooned page. */
         if ( mfns[i] == INVALID_MFN )
         {
-            set_bit(ctx->save.batch_pfns[i], ctx->save.deferred_pages);
+            set_bit(batch->pfns[i], ctx->save.deferred_pages);
             ++ctx->save.nr_deferred_pages;
         }
     }
@@ -153,14 +196,14 @@ static int write_batch(struct xc_sr_context *ctx)
 
     if ( nr_pages > 0 )
     {
-        guest_mapping = xenforeignmemory_map(xch->fmem,
+        batch->guest_mapping = xenforeignmemory_map(xch->fmem,
             ctx->domid, PROT_READ, nr_pages, mfns, errors);
-        if ( !guest_mapping )
+        if ( !batch->guest_mapping )
         {
             PERROR("Failed to map guest pages");
             goto err;
         }
-        nr_pages_mapped = nr_pages;
+        batch->nr_pages_mapped = nr_pages;
 
         for ( i = 0, p = 0; i < nr_pfns; ++i )
         {
@@ -175,11 +218,11 @@ static int write_batch(struct xc_sr_context *ctx)
             if ( errors[p] )
             {
                 ERROR("Mapping of pfn %#"PRIpfn" (mfn %#"PRIpfn") failed %d",
-                      ctx->save.batch_pfns[i], mfns[p], errors[p]);
+                      batch->pfns[i], mfns[p], errors[p]);
                 goto err;
             }
 
-            orig_page = page = guest_mapping + (p * PAGE_SIZE);
+            orig_page = page = batch->guest_mapping + (p * PAGE_SIZE);
             rc = ctx->save.ops.normalise_page(ctx, types[i], &page);
 
             if ( orig_page != page )
@@ -189,7 +232,7 @@ static int write_batch(struct xc_sr_context *ctx)
             {
                 if ( rc == -1 && errno == EAGAIN )
                 {
-                    set_bit(ctx->save.batch_pfns[i], ctx->save.deferred_pages);
+                    set_bit(batch->pfns[i], ctx->save.deferred_pages);
                     ++ctx->save.nr_deferred_pages;
                     types[i] = XEN_DOMCTL_PFINFO_XTAB;
                     --nr_pages;
@@ -205,34 +248,36 @@ static int write_batch(struct xc_sr_context *ctx)
         }
     }
 
-    rec_pfns = malloc(nr_pfns * sizeof(*rec_pfns));
-    if ( !rec_pfns )
+    batch->rec_pfns = malloc(nr_pfns * sizeof(*batch->rec_pfns));
+    if ( !batch->rec_pfns )
     {
         ERROR("Unable to allocate %zu bytes of memory for page data pfn list",
-              nr_pfns * sizeof(*rec_pfns));
+              nr_pfns * sizeof(*batch->rec_pfns));
         goto err;
     }
 
-    hdr.count = nr_pfns;
+    batch->nr_pages = nr_pages;
+    batch->hdr.count = nr_pfns;
 
-    rec.length = sizeof(hdr);
-    rec.length += nr_pfns * sizeof(*rec_pfns);
-    rec.length += nr_pages * PAGE_SIZE;
+    batch->rec.type = REC_TYPE_PAGE_DATA;
+    batch->rec.length = sizeof(batch->hdr);
+    batch->rec.length += nr_pfns * sizeof(*batch->rec_pfns);
+    batch->rec.length += nr_pages * PAGE_SIZE;
 
     for ( i = 0; i < nr_pfns; ++i )
-        rec_pfns[i] = ((uint64_t)(types[i]) << 32) | ctx->save.batch_pfns[i];
+        batch->rec_pfns[i] = ((uint64_t)(types[i]) << 32) | batch->pfns[i];
 
-    iov[0].iov_base = &rec.type;
-    iov[0].iov_len = sizeof(rec.type);
+    iov[0].iov_base = &batch->rec.type;
+    iov[0].iov_len = sizeof(batch->rec.type);
 
-    iov[1].iov_base = &rec.length;
-    iov[1].iov_len = sizeof(rec.length);
+    iov[1].iov_base = &batch->rec.length;
+    iov[1].iov_len = sizeof(batch->rec.length);
 
-    iov[2].iov_base = &hdr;
-    iov[2].iov_len = sizeof(hdr);
+    iov[2].iov_base = &batch->hdr;
+    iov[2].iov_len = sizeof(batch->hdr);
 
-    iov[3].iov_base = rec_pfns;
-    iov[3].iov_len = nr_pfns * sizeof(*rec_pfns);
+    iov[3].iov_base = batch->rec_pfns;
+    iov[3].iov_len = nr_pfns * sizeof(*batch->rec_pfns);
 
     iovcnt = 4;
 
@@ -250,32 +295,555 @@ static int write_batch(struct xc_sr_context *ctx)
         }
     }
 
-    if ( writev_exact(ctx->fd, iov, iovcnt) )
+    /* Sanity check we have found all the pages we expected to. */
+    assert(nr_pages == 0);
+    batch->iovcnt = iovcnt;
+    rc = 0;
+
+ err:
+    return rc;
+}
+
+/* Worst case size of one page in the xc_compression delta format. */
+#define COMPRESS_PAGE_MAX (PAGE_SIZE + 16)
+#define COMPRESS_BUF_SIZE (MAX_BATCH_SIZE * COMPRESS_PAGE_MAX)
+
+static bool page_is_zero(const void *page)
+{
+    const uint64_t *p = page;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); ++i )
+        if ( p[i] )
+            return false;
+
+    return true;
+}
+
+/*
+ * Writes a batch, previously prepared by map_batch(), as a
+ * COMPRESSED_PAGE_DATA record.  All-zero pages are elided, and the rest are
+ * XOR-delta encoded against the copy last sent (if still cached).  The
+ * result is deflated as a whole, if doing so makes it any smaller.
+ */
+static int write_compressed_batch(struct xc_sr_context *ctx,
+                                  struct xc_sr_batch *batch)
+{
+    static const char zeroes[(1u << REC_ALIGN_ORDER) - 1] = { 0 };
+
+    xc_interface *xch = ctx->xch;
+    comp_ctx *comp = ctx->save.compress_ctx;
+    uint8_t *enc = ctx->save.compress_enc;
+    unsigned i, nr_pfns = batch->nr_pfns;
+    size_t enc_len = ROUNDUP(nr_pfns, REC_ALIGN_ORDER);
+    size_t record_length;
+    unsigned long raw_len = 0;
+    uLongf deflate_len = ctx->save.deflate_buf_size;
+    char *data = ctx->save.compress_buf;
+    bool israw;
+    int rc;
+    struct xc_sr_rec_compressed_page_data_header hdr =
+    {
+        .count = nr_pfns,
+        .codec = COMPRESSED_PAGE_CODEC_NONE,
+    };
+    struct xc_sr_record rec =
+    {
+        .type = REC_TYPE_COMPRESSED_PAGE_DATA,
+    };
+    struct iovec iov[7];
+
+    memset(enc, 0, enc_len);
+    xc_compression_reset_pagebuf(xch, comp);
+
+    for ( i = 0; i < nr_pfns; ++i )
+    {
+        if ( !batch->guest_data[i] )
+            continue;
+
+        if ( page_is_zero(batch->guest_data[i]) )
+        {
+            enc[i] = COMPRESSED_PAGE_ENC_ZERO;
+            rc = xc_compression_forget_page(xch, comp, batch->pfns[i]);
+        }
+        else
+        {
+            /* Pagetables have been normalised.  Never delta against them. */
+            israw = !!(batch->types[i] & XEN_DOMCTL_PFINFO_LTABTYPE_MASK);
+            enc[i] = COMPRESSED_PAGE_ENC_DELTA;
+            rc = xc_compression_add_page(xch, comp, batch->guest_data[i],
+                                         batch->pfns[i], israw);
+        }
+
+        if ( rc )
+        {
+            ERROR("Failed to compress pfn %#"PRIpfn, batch->pfns[i]);
+            return -1;
+        }
+    }
+
+    if ( xc_compression_compress_pages(xch, comp, data, COMPRESS_BUF_SIZE,
+                                       &raw_len) < 0 )
+    {
+        ERROR("Compression buffer overflow for a batch of %u pages",
+              nr_pfns);
+        return -1;
+    }
+
+    hdr.raw_length = hdr.data_length = raw_len;
+
+    if ( raw_len &&
+         compress2((Bytef *)ctx->save.deflate_buf, &deflate_len,
+                   (const Bytef *)data, raw_len, Z_BEST_SPEED) == Z_OK &&
+         deflate_len < raw_len )
+    {
+        hdr.codec = COMPRESSED_PAGE_CODEC_DEFLATE;
+        hdr.data_length = deflate_len;
+        data = ctx->save.deflate_buf;
+    }
+
+    rec.length = sizeof(hdr);
+    rec.length += nr_pfns * sizeof(*batch->rec_pfns);
+    rec.length += enc_len + hdr.data_length;
+    record_length = ROUNDUP(rec.length, REC_ALIGN_ORDER);
+
+    iov[0].iov_base = &rec.type;
+    iov[0].iov_len = sizeof(rec.type);
+
+    iov[1].iov_base = &rec.length;
+    iov[1].iov_len = sizeof(rec.length);
+
+    iov[2].iov_base = &hdr;
+    iov[2].iov_len = sizeof(hdr);
+
+    iov[3].iov_base = batch->rec_pfns;
+    iov[3].iov_len = nr_pfns * sizeof(*batch->rec_pfns);
+
+    iov[4].iov_base = enc;
+    iov[4].iov_len = enc_len;
+
+    iov[5].iov_base = data;
+    iov[5].iov_len = hdr.data_length;
+
+    iov[6].iov_base = (void *)zeroes;
+    iov[6].iov_len = record_length - rec.length;
+
+    if ( writev_exact(ctx->fd, iov, ARRAY_SIZE(iov)) )
+    {
+        PERROR("Failed to write compressed page data to stream");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Room left for the stream itself before the page image, which is therefore
+ * written to a sparse region of the file starting at least this far beyond
+ * where the stream started.
+ */
+#define IMAGE_STREAM_RESERVE (64ULL << 30)
+
+static int pwrite_exact(int fd, const void *data, size_t size, off_t offset)
+{
+    size_t done = 0;
+    ssize_t len;
+
+    while ( done < size )
+    {
+        len = pwrite(fd, data + done, size - done, offset + done);
+        if ( len == -1 && errno == EINTR )
+            continue;
+        if ( len <= 0 )
+            return -1;
+        done += len;
+    }
+
+    return 0;
+}
+
+/*
+ * Writes a batch, previously prepared by map_batch(), into the page image
+ * and its pfns as a PAGE_IMAGE record into the stream.  Zero pages not
+ * written before are skipped, leaving holes in the file.
+ */
+static int write_image_batch(struct xc_sr_context *ctx,
+                             struct xc_sr_batch *batch)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_image_header hdr =
+    {
+        .count = batch->nr_pfns,
+        .image_offset = ctx->save.image_offset,
+    };
+    struct xc_sr_record rec =
+    {
+        .type = REC_TYPE_PAGE_IMAGE,
+        .length = sizeof(hdr),
+        .data = &hdr,
+    };
+    xen_pfn_t pfn;
+    off_t pos;
+    unsigned i;
+
+    for ( i = 0; i < batch->nr_pfns; ++i )
+    {
+        pfn = batch->pfns[i];
+
+        if ( !batch->guest_data[i] ||
+             (!test_bit(pfn, ctx->save.image_written) &&
+              page_is_zero(batch->guest_data[i])) )
+            continue;
+
+        if ( pwrite_exact(ctx->fd, batch->guest_data[i], PAGE_SIZE,
+                          ctx->save.image_offset +
+                          ((uint64_t)pfn << PAGE_SHIFT)) )
+        {
+            PERROR("Failed to write pfn %#"PRIpfn" to the page image", pfn);
+            return -1;
+        }
+        set_bit(pfn, ctx->save.image_written);
+    }
+
+    pos = lseek(ctx->fd, 0, SEEK_CUR);
+    if ( pos == -1 ||
+         pos + sizeof(rec.type) + sizeof(rec.length) + rec.length +
+         batch->nr_pfns * sizeof(*batch->rec_pfns) > ctx->save.image_offset )
+    {
+        ERROR("Stream would overrun the page image at %#"PRIx64,
+              ctx->save.image_offset);
+        return -1;
+    }
+
+    return write_split_record(ctx, &rec, batch->rec_pfns,
+                              batch->nr_pfns * sizeof(*batch->rec_pfns));
+}
+
+/*
+ * Writes a batch, previously prepared by map_batch(), as a PAGE_DATA (or
+ * COMPRESSED_PAGE_DATA) record into the stream.
+ */
+static int write_mapped_batch(struct xc_sr_context *ctx,
+                              struct xc_sr_batch *batch)
+{
+    xc_interface *xch = ctx->xch;
+
+    if ( ctx->save.image )
+        return write_image_batch(ctx, batch);
+
+    if ( ctx->save.compress )
+        return write_compressed_batch(ctx, batch);
+
+    if ( writev_exact(ctx->fd, batch->iov, batch->iovcnt) )
     {
         PERROR("Failed to write page data to stream");
-        goto err;
+        return -1;
     }
 
-    /* Sanity check we have sent all the pages we expected to. */
-    assert(nr_pages == 0);
-    rc = ctx->save.nr_batch_pfns = 0;
+    return 0;
+}
 
- err:
-    free(rec_pfns);
-    if ( guest_mapping )
-        xenforeignmemory_unmap(xch->fmem, guest_mapping, nr_pages_mapped);
-    for ( i = 0; local_pages && i < nr_pfns; ++i )
-        free(local_pages[i]);
-    free(iov);
-    free(local_pages);
-    free(guest_data);
-    free(errors);
-    free(types);
-    free(mfns);
+/*
+ * Writes a batch of memory as a PAGE_DATA record into the stream.  The batch
+ * is constructed in ctx->save.batch_pfns.
+ */
+static int write_batch(struct xc_sr_context *ctx)
+{
+    struct xc_sr_batch batch =
+    {
+        .pfns = ctx->save.batch_pfns,
+        .nr_pfns = ctx->save.nr_batch_pfns,
+    };
+    uint64_t start = sr_now_us();
+    int rc;
+
+    rc = map_batch(ctx, &batch);
+    sr_stage_add(&ctx->save.stages[SAVE_STAGE_MAP], start, batch.nr_pfns);
+    if ( !rc )
+    {
+        start = sr_now_us();
+        rc = write_mapped_batch(ctx, &batch);
+        sr_stage_add(&ctx->save.stages[SAVE_STAGE_WRITE], start,
+                     batch.nr_pfns);
+    }
+    if ( !rc )
+        ctx->save.nr_batch_pfns = 0;
+
+    release_batch(ctx, &batch);
 
     return rc;
 }
 
+/*
+ * Pipelined page transmission.
+ *
+ * With XCFLAGS_PIPELINE, batches are handed from the main thread to a map
+ * worker (pfn types, foreign mapping and normalisation) and from there to a
+ * write worker, via bounded queues.  Mapping of one batch therefore overlaps
+ * with the stream write of the previous ones, while the main thread carries
+ * on scanning the dirty bitmap.
+ *
+ * Batches are strictly ordered, and pipeline_drain() is used to ensure that
+ * all page data is in the stream before anything else gets written, or the
+ * deferred pages are inspected.
+ */
+#define PIPELINE_DEPTH 4
+
+struct xc_sr_save_pipeline
+{
+    struct xc_sr_context *ctx;
+
+    struct xc_sr_queue map_queue, write_queue;
+    pthread_t map_thread, write_thread;
+    bool map_started, write_started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    /* Batches submitted but not yet written or discarded. */
+    unsigned int in_flight;
+    /* First error encountered by a worker, and its errno. */
+    int rc, err;
+};
+
+static bool pipeline_failed(struct xc_sr_save_pipeline *pl)
+{
+    bool failed;
+
+    pthread_mutex_lock(&pl->lock);
+    failed = pl->rc != 0;
+    pthread_mutex_unlock(&pl->lock);
+
+    return failed;
+}
+
+/*
+ * Retire a batch, which has either been written or is being discarded
+ * because of an earlier error.
+ */
+static void pipeline_retire(struct xc_sr_save_pipeline *pl,
+                            struct xc_sr_batch *batch, int rc)
+{
+    int err = errno;
+
+    release_batch(pl->ctx, batch);
+    free(batch->pfns);
+    free(batch);
+
+    pthread_mutex_lock(&pl->lock);
+    if ( rc && !pl->rc )
+    {
+        pl->rc = rc;
+        pl->err = err;
+    }
+    if ( --pl->in_flight == 0 )
+        pthread_cond_broadcast(&pl->idle);
+    pthread_mutex_unlock(&pl->lock);
+}
+
+static void *pipeline_map_worker(void *arg)
+{
+    struct xc_sr_save_pipeline *pl = arg;
+    struct xc_sr_batch *batch;
+    uint64_t start;
+    int rc;
+
+    while ( (batch = sr_queue_pop(&pl->map_queue)) != NULL )
+    {
+        if ( pipeline_failed(pl) )
+        {
+            pipeline_retire(pl, batch, 0);
+            continue;
+        }
+
+        start = sr_now_us();
+        rc = map_batch(pl->ctx, batch);
+        sr_stage_add(&pl->ctx->save.stages[SAVE_STAGE_MAP], start,
+                     batch->nr_pfns);
+        if ( !rc )
+            rc = sr_queue_push(&pl->write_queue, batch);
+
+        if ( rc )
+            pipeline_retire(pl, batch, rc);
+    }
+
+    sr_queue_close(&pl->write_queue);
+
+    return NULL;
+}
+
+static void *pipeline_write_worker(void *arg)
+{
+    struct xc_sr_save_pipeline *pl = arg;
+    struct xc_sr_batch *batch;
+    uint64_t start;
+    int rc;
+
+    while ( (batch = sr_queue_pop(&pl->write_queue)) != NULL )
+    {
+        if ( pipeline_failed(pl) )
+            rc = 0;
+        else
+        {
+            start = sr_now_us();
+            rc = write_mapped_batch(pl->ctx, batch);
+            sr_stage_add(&pl->ctx->save.stages[SAVE_STAGE_WRITE], start,
+                         batch->nr_pfns);
+        }
+
+        pipeline_retire(pl, batch, rc);
+    }
+
+    return NULL;
+}
+
+/*
+ * Wait for all submitted batches to be written.  Returns the first error
+ * encountered by a worker, with errno restored.
+ */
+static int pipeline_drain(struct xc_sr_save_pipeline *pl)
+{
+    int rc;
+
+    pthread_mutex_lock(&pl->lock);
+    while ( pl->in_flight )
+        pthread_cond_wait(&pl->idle, &pl->lock);
+    rc = pl->rc;
+    if ( rc )
+        errno = pl->err;
+    pthread_mutex_unlock(&pl->lock);
+
+    return rc;
+}
+
+/*
+ * Hand the batch in ctx->save.batch_pfns to the pipeline.  The pfn array is
+ * passed along with it, and a fresh one allocated for the next batch.
+ */
+static int pipeline_submit(struct xc_sr_save_pipeline *pl)
+{
+    struct xc_sr_context *ctx = pl->ctx;
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_batch *batch;
+    xen_pfn_t *pfns;
+
+    if ( pipeline_failed(pl) )
+        return pipeline_drain(pl);
+
+    batch = calloc(1, sizeof(*batch));
+    pfns = malloc(MAX_BATCH_SIZE * sizeof(*pfns));
+    if ( !batch || !pfns )
+    {
+        ERROR("Unable to allocate memory for a pipelined batch");
+        free(pfns);
+        free(batch);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    batch->pfns = ctx->save.batch_pfns;
+    batch->nr_pfns = ctx->save.nr_batch_pfns;
+    ctx->save.batch_pfns = pfns;
+    ctx->save.nr_batch_pfns = 0;
+
+    pthread_mutex_lock(&pl->lock);
+    pl->in_flight++;
+    pthread_mutex_unlock(&pl->lock);
+
+    if ( sr_queue_push(&pl->map_queue, batch) )
+    {
+        pipeline_retire(pl, batch, -1);
+        return pipeline_drain(pl);
+    }
+
+    return 0;
+}
+
+static void pipeline_destroy(struct xc_sr_context *ctx)
+{
+    struct xc_sr_save_pipeline *pl = ctx->save.pipeline;
+
+    if ( !pl )
+        return;
+
+    /* Anything still queued at this point is discarded, not written. */
+    pthread_mutex_lock(&pl->lock);
+    if ( !pl->rc )
+    {
+        pl->rc = -1;
+        pl->err = ECANCELED;
+    }
+    pthread_mutex_unlock(&pl->lock);
+
+    sr_queue_close(&pl->map_queue);
+    if ( pl->map_started )
+        pthread_join(pl->map_thread, NULL);
+    else
+        sr_queue_close(&pl->write_queue);
+    if ( pl->write_started )
+        pthread_join(pl->write_thread, NULL);
+
+    sr_queue_destroy(&pl->write_queue);
+    sr_queue_destroy(&pl->map_queue);
+    pthread_cond_destroy(&pl->idle);
+    pthread_mutex_destroy(&pl->lock);
+
+    free(pl);
+    ctx->save.pipeline = NULL;
+}
+
+static int pipeline_create(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_save_pipeline *pl;
+    int rc;
+
+    pl = calloc(1, sizeof(*pl));
+    if ( !pl )
+    {
+        ERROR("Unable to allocate memory for save pipeline");
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pl->ctx = ctx;
+    pthread_mutex_init(&pl->lock, NULL);
+    pthread_cond_init(&pl->idle, NULL);
+    ctx->save.pipeline = pl;
+
+    if ( sr_queue_init(&pl->map_queue, PIPELINE_DEPTH) ||
+         sr_queue_init(&pl->write_queue, PIPELINE_DEPTH) )
+    {
+        PERROR("Unable to initialise save pipeline queues");
+        goto err;
+    }
+
+    rc = pthread_create(&pl->map_thread, NULL, pipeline_map_worker, pl);
+    if ( rc )
+    {
+        errno = rc;
+        PERROR("Unable to create save pipeline map thread");
+        goto err;
+    }
+    pl->map_started = true;
+
+    rc = pthread_create(&pl->write_thread, NULL, pipeline_write_worker, pl);
+    if ( rc )
+    {
+        errno = rc;
+        PERROR("Unable to create save pipeline write thread");
+        goto err;
+    }
+    pl->write_started = true;
+
+    DPRINTF("Pipelined save enabled, depth %u", PIPELINE_DEPTH);
+
+    return 0;
+
+ err:
+    pipeline_destroy(ctx);
+    return -1;
+}
+
 /*
  * Flush a batch of pfns into the stream.
  */
@@ -286,6 +854,9 @@ static int flush_batch(struct xc_sr_context *ctx)
     if ( ctx->save.nr_batch_pfns == 0 )
         return rc;
 
+    if ( ctx->save.pipeline )
+        return pipeline_submit(ctx->save.pipeline);
+
     rc = write_batch(ctx);
 
     if ( !rc )
@@ -390,6 +961,16 @@ static int send_dirty_pages(struct xc_sr_context *ctx,
     if ( rc )
         return rc;
 
+    if ( ctx->save.pipeline )
+    {
+        rc = pipeline_drain(ctx->save.pipeline);
+        if ( rc )
+        {
+            PERROR("Pipelined save failed");
+            return rc;
+        }
+    }
+
     if ( written > entries )
         DPRINTF("Bitmap contained more entries than expected...");
 
@@ -487,6 +1068,203 @@ static int simple_precopy_policy(struct precopy_stats stats, void *user)
         : XGS_POLICY_CONTINUE_PRECOPY;
 }
 
+/*
+ * As simple_precopy_policy(), but used with XCFLAGS_POSTCOPY.  A guest which
+ * hasn't converged after the maximum number of precopy rounds proceeds to
+ * post-copy rather than stop-and-copy.
+ */
+static int simple_postcopy_policy(struct precopy_stats stats, void *user)
+{
+    if ( stats.dirty_count >= 0 && stats.dirty_count < SPP_TARGET_DIRTY_COUNT )
+        return XGS_POLICY_STOP_AND_COPY;
+
+    return stats.iteration >= SPP_MAX_ITERATIONS
+        ? XGS_POLICY_POSTCOPY
+        : XGS_POLICY_CONTINUE_PRECOPY;
+}
+
+/*
+ * Auto-converge: a guest which dirties memory faster than it can be sent
+ * will never converge, however many precopy rounds are permitted.  After
+ * each round, compare the hypervisor's estimate of the dirty rate with the
+ * rate at which the round was sent, and if the guest dirtied more than half
+ * as fast as we sent, take a further slice of its vcpu time away by
+ * lowering its scheduler cap.
+ */
+#define AC_THROTTLE_INITIAL 20
+#define AC_THROTTLE_STEP    10
+#define AC_THROTTLE_MAX     90
+
+static int auto_converge_setup(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xen_domctl_sched_credit2 c2;
+    struct xen_domctl_sched_credit c1;
+
+    if ( xc_sched_credit2_domain_get(xch, ctx->domid, &c2) == 0 )
+    {
+        ctx->save.ac.credit2 = true;
+        ctx->save.ac.orig_cap = c2.cap;
+    }
+    else if ( xc_sched_credit_domain_get(xch, ctx->domid, &c1) == 0 )
+        ctx->save.ac.orig_cap = c1.cap;
+    else
+    {
+        IPRINTF("Domain's scheduler has no cap: auto-converge disabled");
+        ctx->save.auto_converge = false;
+    }
+
+    return 0;
+}
+
+static int auto_converge_set_cap(struct xc_sr_context *ctx, unsigned int cap)
+{
+    xc_interface *xch = ctx->xch;
+    int rc;
+
+    if ( ctx->save.ac.credit2 )
+    {
+        struct xen_domctl_sched_credit2 c2;
+
+        rc = xc_sched_credit2_domain_get(xch, ctx->domid, &c2);
+        if ( !rc )
+        {
+            c2.cap = cap;
+            rc = xc_sched_credit2_domain_set(xch, ctx->domid, &c2);
+        }
+    }
+    else
+    {
+        struct xen_domctl_sched_credit c1;
+
+        rc = xc_sched_credit_domain_get(xch, ctx->domid, &c1);
+        if ( !rc )
+        {
+            c1.cap = cap;
+            rc = xc_sched_credit_domain_set(xch, ctx->domid, &c1);
+        }
+    }
+
+    if ( rc )
+        PERROR("Failed to set scheduler cap %u", cap);
+
+    return rc;
+}
+
+static int auto_converge_update(struct xc_sr_context *ctx,
+                                unsigned long sent, uint64_t elapsed_us)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned long dirty_rate, send_rate;
+    unsigned int full, cap;
+
+    if ( !sent || !elapsed_us )
+        return 0;
+
+    if ( xc_logdirty_get_rate(xch, ctx->domid, &dirty_rate) )
+    {
+        PERROR("Failed to get dirty rate");
+        return -1;
+    }
+
+    send_rate = (sent * 1000000ULL) / elapsed_us;
+
+    DPRINTF("Dirty rate %lu pages/s, send rate %lu pages/s, throttle %u%%",
+            dirty_rate, send_rate, ctx->save.ac.throttle);
+
+    if ( dirty_rate <= send_rate / 2 ||
+         ctx->save.ac.throttle >= AC_THROTTLE_MAX )
+        return 0;
+
+    ctx->save.ac.throttle = ctx->save.ac.throttle
+        ? min_t(unsigned int, ctx->save.ac.throttle + AC_THROTTLE_STEP,
+                AC_THROTTLE_MAX)
+        : AC_THROTTLE_INITIAL;
+
+    /* A cap of 0 means uncapped: 100% of a pcpu for each vcpu. */
+    full = ctx->save.ac.orig_cap ?:
+        (ctx->dominfo.max_vcpu_id + 1) * 100;
+    cap = max(full * (100 - ctx->save.ac.throttle) / 100, 1U);
+
+    IPRINTF("Auto-converge: throttling by %u%% (cap %u)",
+            ctx->save.ac.throttle, cap);
+
+    ctx->save.ac.capped = true;
+    return auto_converge_set_cap(ctx, cap);
+}
+
+static void auto_converge_cleanup(struct xc_sr_context *ctx)
+{
+    if ( ctx->save.ac.capped )
+    {
+        auto_converge_set_cap(ctx, ctx->save.ac.orig_cap);
+        ctx->save.ac.capped = false;
+    }
+}
+
+/*
+ * Fill the dirty bitmap from the log-dirty bitmap in Xen, and clean it.  Only
+ * the chunks with dirty pages are copied out, so a guest dirtying little of
+ * a large address space costs little to scan.
+ */
+#define SPARSE_CHUNKS 128
+
+static int clean_dirty_bitmap(struct xc_sr_context *ctx, uint32_t mode,
+                              xc_shadow_op_stats_t *stats)
+{
+    xc_interface *xch = ctx->xch;
+    uint64_t pfn = 0, end = ROUNDUP(ctx->save.p2m_size, 3), nr, base;
+    uint32_t i, nr_chunks;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, chunk_pfns,
+                                    &ctx->save.chunk_pfns_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint8_t, chunks,
+                                    &ctx->save.chunks_hbuf);
+    uint64_t start = sr_now_us();
+
+    bitmap_clear(dirty_bitmap, ctx->save.p2m_size);
+
+    while ( pfn < end )
+    {
+        nr = end - pfn;
+        nr_chunks = SPARSE_CHUNKS;
+
+        /* Cleaning resets the stats, so only the first call's are wanted. */
+        if ( xc_logdirty_sparse(xch, ctx->domid,
+                                XEN_DOMCTL_SHADOW_OP_CLEAN_SPARSE, pfn, &nr,
+                                HYPERCALL_BUFFER(chunk_pfns),
+                                HYPERCALL_BUFFER(chunks), &nr_chunks, mode,
+                                pfn ? NULL : stats) )
+        {
+            PERROR("Failed to retrieve logdirty bitmap");
+            return -1;
+        }
+
+        for ( i = 0; i < nr_chunks; ++i )
+        {
+            base = chunk_pfns[i];
+            if ( base >= ctx->save.p2m_size || base % 8 )
+            {
+                ERROR("Bad logdirty chunk pfn %#"PRIx64, base);
+                return -1;
+            }
+
+            memcpy((uint8_t *)dirty_bitmap + base / 8,
+                   chunks + (size_t)i * XEN_DOMCTL_SHADOW_CHUNK_BYTES,
+                   min_t(uint64_t, XEN_DOMCTL_SHADOW_CHUNK_BYTES,
+                         (ctx->save.p2m_size - base + 7) / 8));
+        }
+
+        pfn += nr;
+    }
+
+    sr_stage_add(&ctx->save.stages[SAVE_STAGE_LOGDIRTY], start,
+                 stats->dirty_count);
+
+    return 0;
+}
+
 /*
  * Send memory while guest is running.
  */
@@ -498,6 +1276,7 @@ static int send_memory_live(struct xc_sr_context *ctx)
     unsigned int x = 0;
     int rc;
     int policy_decision;
+    uint64_t start = 0;
 
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
@@ -516,16 +1295,29 @@ static int send_memory_live(struct xc_sr_context *ctx)
     policy_stats = &ctx->save.stats;
 
     if ( precopy_policy == NULL )
-         precopy_policy = simple_precopy_policy;
+         precopy_policy = ctx->save.postcopy ? simple_postcopy_policy
+                                             : simple_precopy_policy;
 
     bitmap_set(dirty_bitmap, ctx->save.p2m_size);
 
+    if ( ctx->save.auto_converge )
+    {
+        rc = auto_converge_setup(ctx);
+        if ( rc )
+            goto out;
+    }
+
     for ( ; ; )
     {
         policy_decision = precopy_policy(*policy_stats, data);
         x++;
 
-        if ( stats.dirty_count > 0 && policy_decision != XGS_POLICY_ABORT )
+        if ( ctx->save.auto_converge )
+            start = sr_now_us();
+
+        /* With post-copy, the pending dirty pages are sent later. */
+        if ( stats.dirty_count > 0 && policy_decision != XGS_POLICY_ABORT &&
+             policy_decision != XGS_POLICY_POSTCOPY )
         {
             rc = update_progress_string(ctx, &progress_str);
             if ( rc )
@@ -546,34 +1338,60 @@ static int send_memory_live(struct xc_sr_context *ctx)
         policy_decision = precopy_policy(*policy_stats, data);
 
         if ( policy_decision != XGS_POLICY_CONTINUE_PRECOPY )
-           break;
+        {
+            /* Everything in the bitmap has just been sent. */
+            bitmap_clear(dirty_bitmap, ctx->save.p2m_size);
+            break;
+        }
 
-        if ( xc_shadow_control(
-                 xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-                 &ctx->save.dirty_bitmap_hbuf, ctx->save.p2m_size,
-                 NULL, 0, &stats) != ctx->save.p2m_size )
+        if ( ctx->save.auto_converge )
         {
-            PERROR("Failed to retrieve logdirty bitmap");
+            rc = auto_converge_update(ctx, stats.dirty_count,
+                                      sr_now_us() - start);
+            if ( rc )
+                goto out;
+        }
+
+        rc = clean_dirty_bitmap(ctx, 0, &stats);
+        if ( rc )
+            goto out;
+
+        policy_stats->dirty_count = stats.dirty_count;
+
+    }
+
+    if ( policy_decision == XGS_POLICY_POSTCOPY )
+    {
+        if ( !ctx->save.postcopy )
+        {
+            ERROR("Precopy policy requested post-copy, which isn't enabled");
+            errno = EINVAL;
             rc = -1;
             goto out;
         }
 
-        policy_stats->dirty_count = stats.dirty_count;
-
+        ctx->save.postcopy_active = true;
     }
 
  out:
+    /* The guest is about to be suspended, or the migration abandoned. */
+    auto_converge_cleanup(ctx);
     xc_set_progress_prefix(xch, NULL);
     free(progress_str);
     return rc;
 }
 
+/*
+ * Merge the pfns dirtied by the COLO secondary into the dirty bitmap.  The
+ * secondary's copies of these pages no longer match what was last sent, so
+ * they must not be delta compressed against the cached copies.
+ */
 static int colo_merge_secondary_dirty_bitmap(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
     struct xc_sr_record rec = { 0, 0, NULL };
-    uint64_t *pfns = NULL;
-    uint64_t pfn;
+    struct xc_sr_rec_pfn_range *ranges;
+    uint64_t *pfns, pfn;
     unsigned count, i;
     int rc;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
@@ -583,34 +1401,72 @@ static int colo_merge_secondary_dirty_bitmap(struct xc_sr_context *ctx)
     if ( rc )
         goto err;
 
-    if ( rec.type != REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST )
+    switch ( rec.type )
     {
-        PERROR("Expect dirty bitmap record, but received %u", rec.type );
-        rc = -1;
-        goto err;
-    }
+    case REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST:
+        if ( rec.length % sizeof(*pfns) )
+        {
+            PERROR("Invalid dirty pfn list record length %u", rec.length );
+            rc = -1;
+            goto err;
+        }
 
-    if ( rec.length % sizeof(*pfns) )
-    {
-        PERROR("Invalid dirty pfn list record length %u", rec.length );
-        rc = -1;
-        goto err;
-    }
+        count = rec.length / sizeof(*pfns);
+        pfns = rec.data;
 
-    count = rec.length / sizeof(*pfns);
-    pfns = rec.data;
+        for ( i = 0; i < count; i++ )
+        {
+            pfn = pfns[i];
+            if ( pfn >= ctx->save.p2m_size )
+            {
+                PERROR("Invalid pfn 0x%" PRIx64, pfn);
+                rc = -1;
+                goto err;
+            }
 
-    for ( i = 0; i < count; i++ )
-    {
-        pfn = pfns[i];
-        if (pfn > ctx->save.p2m_size)
+            set_bit(pfn, dirty_bitmap);
+            if ( ctx->save.compress )
+                xc_compression_forget_page(xch, ctx->save.compress_ctx, pfn);
+        }
+        break;
+
+    case REC_TYPE_CHECKPOINT_DIRTY_PFN_RANGES:
+        if ( rec.length % sizeof(*ranges) )
         {
-            PERROR("Invalid pfn 0x%" PRIx64, pfn);
+            PERROR("Invalid dirty pfn ranges record length %u", rec.length );
             rc = -1;
             goto err;
         }
 
-        set_bit(pfn, dirty_bitmap);
+        count = rec.length / sizeof(*ranges);
+        ranges = rec.data;
+
+        for ( i = 0; i < count; i++ )
+        {
+            if ( ranges[i].pfn >= ctx->save.p2m_size ||
+                 ranges[i].count > ctx->save.p2m_size - ranges[i].pfn )
+            {
+                PERROR("Invalid pfn range 0x%" PRIx64 "+0x%" PRIx64,
+                       ranges[i].pfn, ranges[i].count);
+                rc = -1;
+                goto err;
+            }
+
+            for ( pfn = ranges[i].pfn;
+                  pfn < ranges[i].pfn + ranges[i].count; pfn++ )
+            {
+                set_bit(pfn, dirty_bitmap);
+                if ( ctx->save.compress )
+                    xc_compression_forget_page(xch, ctx->save.compress_ctx,
+                                               pfn);
+            }
+        }
+        break;
+
+    default:
+        PERROR("Expect dirty bitmap record, but received %u", rec.type );
+        rc = -1;
+        goto err;
     }
 
     rc = 0;
@@ -638,16 +1494,9 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
     if ( rc )
         goto out;
 
-    if ( xc_shadow_control(
-             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-             HYPERCALL_BUFFER(dirty_bitmap), ctx->save.p2m_size,
-             NULL, XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL, &stats) !=
-         ctx->save.p2m_size )
-    {
-        PERROR("Failed to retrieve logdirty bitmap");
-        rc = -1;
+    rc = clean_dirty_bitmap(ctx, XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL, &stats);
+    if ( rc )
         goto out;
-    }
 
     if ( ctx->save.live )
     {
@@ -683,6 +1532,280 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
     return rc;
 }
 
+/*
+ * Post-copy migration.
+ *
+ * If the precopy policy elects to, the pages still dirty when the domain is
+ * suspended are not sent straight away.  Instead their pfns are listed in
+ * POSTCOPY_PFNS records, the rest of the domain state follows, and after a
+ * POSTCOPY_TRANSITION record the restorer may resume the guest.  The
+ * outstanding pages are then sent in the background, with preference given
+ * to those the restorer requests via POSTCOPY_FAULT records on the back
+ * channel, as the guest touches them.
+ */
+#define POSTCOPY_PFNS_PER_REC (512U * 1024)
+
+/*
+ * Suspend the domain, and describe the pages which will be sent after the
+ * postcopy transition.  Pages in the dirty bitmap on entry were never sent
+ * during the final precopy iteration.
+ */
+static int postcopy_begin(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    xc_shadow_op_stats_t stats = { 0, ctx->save.p2m_size };
+    struct xc_sr_record rec =
+    {
+        .type = REC_TYPE_POSTCOPY_BEGIN,
+    };
+    uint64_t *pfns = NULL;
+    unsigned long *postcopy_pfns;
+    xen_pfn_t p, *types = NULL, *batch = NULL;
+    unsigned i, nr = 0, nr_types = 0;
+    int rc = -1;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+
+    postcopy_pfns = ctx->save.postcopy_pfns =
+        calloc(1, bitmap_size(ctx->save.p2m_size));
+    pfns = malloc(POSTCOPY_PFNS_PER_REC * sizeof(*pfns));
+    types = malloc(MAX_BATCH_SIZE * sizeof(*types));
+    batch = malloc(MAX_BATCH_SIZE * sizeof(*batch));
+    if ( !postcopy_pfns || !pfns || !types || !batch )
+    {
+        ERROR("Unable to allocate memory for the postcopy pfn list");
+        errno = ENOMEM;
+        goto out;
+    }
+
+    bitmap_or(postcopy_pfns, dirty_bitmap, ctx->save.p2m_size);
+
+    rc = suspend_domain(ctx);
+    if ( rc )
+        goto out;
+    rc = -1;
+
+    if ( clean_dirty_bitmap(ctx, XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL, &stats) )
+        goto out;
+
+    bitmap_or(postcopy_pfns, dirty_bitmap, ctx->save.p2m_size);
+    bitmap_or(postcopy_pfns, ctx->save.deferred_pages, ctx->save.p2m_size);
+    bitmap_clear(ctx->save.deferred_pages, ctx->save.p2m_size);
+    ctx->save.nr_deferred_pages = 0;
+
+    rc = write_record(ctx, &rec);
+    if ( rc )
+        goto out;
+
+    rec.type = REC_TYPE_POSTCOPY_PFNS;
+    rec.data = pfns;
+
+    for ( p = 0; p < ctx->save.p2m_size; ++p )
+    {
+        if ( test_bit(p, postcopy_pfns) )
+            types[nr_types++] = p;
+
+        if ( nr_types == MAX_BATCH_SIZE ||
+             (nr_types && p == ctx->save.p2m_size - 1) )
+        {
+            /* Holes in the physmap have no contents to send later. */
+            for ( i = 0; i < nr_types; ++i )
+            {
+                batch[i] = types[i];
+                types[i] = ctx->save.ops.pfn_to_gfn(ctx, batch[i]);
+            }
+
+            if ( xc_get_pfn_type_batch(xch, ctx->domid, nr_types, types) )
+            {
+                PERROR("Failed to get types for postcopy pfns");
+                goto out;
+            }
+
+            for ( i = 0; i < nr_types; ++i )
+            {
+                if ( types[i] == XEN_DOMCTL_PFINFO_XTAB ||
+                     types[i] == XEN_DOMCTL_PFINFO_BROKEN )
+                {
+                    clear_bit(batch[i], postcopy_pfns);
+                    continue;
+                }
+
+                pfns[nr++] = batch[i];
+                ctx->save.nr_postcopy_pfns++;
+            }
+            nr_types = 0;
+        }
+
+        if ( nr > POSTCOPY_PFNS_PER_REC - MAX_BATCH_SIZE ||
+             (nr && p == ctx->save.p2m_size - 1) )
+        {
+            rec.length = nr * sizeof(*pfns);
+            rc = write_record(ctx, &rec);
+            if ( rc )
+                goto out;
+            rc = -1;
+            nr = 0;
+        }
+    }
+
+    DPRINTF("Postcopy: %lu pages outstanding", ctx->save.nr_postcopy_pfns);
+
+    /*
+     * The restorer loads postcopy pages into the guest without reference to
+     * previous contents, so deltas can't be used from here on.
+     */
+    ctx->save.compress = false;
+    rc = 0;
+
+ out:
+    free(batch);
+    free(types);
+    free(pfns);
+    return rc;
+}
+
+/*
+ * Add an outstanding postcopy pfn to the batch, writing the batch if full.
+ */
+static int postcopy_add_to_batch(struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    int rc = 0;
+
+    if ( !test_and_clear_bit(pfn, ctx->save.postcopy_pfns) )
+        return 0;
+
+    ctx->save.nr_postcopy_pfns--;
+
+    if ( ctx->save.nr_batch_pfns == MAX_BATCH_SIZE )
+        rc = write_batch(ctx);
+
+    if ( rc == 0 )
+        ctx->save.batch_pfns[ctx->save.nr_batch_pfns++] = pfn;
+
+    return rc;
+}
+
+/*
+ * Read a POSTCOPY_FAULT record from the back channel, and send the requested
+ * pages which are still outstanding.
+ */
+static int postcopy_handle_fault(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_record rec = { 0, 0, NULL };
+    uint64_t *pfns;
+    unsigned i, count;
+    int rc;
+
+    rc = read_record(ctx, ctx->save.recv_fd, &rec);
+    if ( rc )
+        goto out;
+
+    rc = -1;
+    if ( rec.type != REC_TYPE_POSTCOPY_FAULT )
+    {
+        ERROR("Expected postcopy fault record, but received %#x (%s)",
+              rec.type, rec_type_to_str(rec.type));
+        goto out;
+    }
+
+    if ( rec.length % sizeof(*pfns) )
+    {
+        ERROR("Invalid postcopy fault record length %u", rec.length);
+        goto out;
+    }
+
+    count = rec.length / sizeof(*pfns);
+    pfns = rec.data;
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( pfns[i] >= ctx->save.p2m_size )
+        {
+            ERROR("Invalid pfn %#"PRIx64" in postcopy fault record", pfns[i]);
+            goto out;
+        }
+
+        rc = postcopy_add_to_batch(ctx, pfns[i]);
+        if ( rc )
+            goto out;
+    }
+
+    rc = ctx->save.nr_batch_pfns ? write_batch(ctx) : 0;
+
+ out:
+    free(rec.data);
+    return rc;
+}
+
+/*
+ * Signal the postcopy transition, then send all outstanding pages.
+ */
+static int postcopy_send_pages(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_record rec =
+    {
+        .type = REC_TYPE_POSTCOPY_TRANSITION,
+    };
+    struct pollfd pfd =
+    {
+        .fd = ctx->save.recv_fd,
+        .events = POLLIN,
+    };
+    unsigned long total = ctx->save.nr_postcopy_pfns;
+    xen_pfn_t p = 0;
+    int rc;
+
+    rc = write_record(ctx, &rec);
+    if ( rc )
+        return rc;
+
+    xc_set_progress_prefix(xch, "Postcopy");
+
+    while ( ctx->save.nr_postcopy_pfns )
+    {
+        xc_report_progress_step(xch, total - ctx->save.nr_postcopy_pfns,
+                                total);
+
+        if ( pfd.fd >= 0 && poll(&pfd, 1, 0) > 0 )
+        {
+            if ( pfd.revents & POLLIN )
+            {
+                rc = postcopy_handle_fault(ctx);
+                if ( rc )
+                    goto out;
+                continue;
+            }
+
+            /* No more faults will be forthcoming.  Carry on regardless. */
+            DPRINTF("Postcopy back channel closed");
+            pfd.fd = -1;
+        }
+
+        for ( ; p < ctx->save.p2m_size &&
+                  ctx->save.nr_batch_pfns < MAX_BATCH_SIZE; ++p )
+        {
+            rc = postcopy_add_to_batch(ctx, p);
+            if ( rc )
+                goto out;
+        }
+
+        if ( ctx->save.nr_batch_pfns )
+        {
+            rc = write_batch(ctx);
+            if ( rc )
+                goto out;
+        }
+    }
+
+    xc_report_progress_step(xch, total, total);
+
+ out:
+    xc_set_progress_prefix(xch, NULL);
+    return rc;
+}
+
 static int verify_frames(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
@@ -737,7 +1860,10 @@ static int send_domain_memory_live(struct xc_sr_context *ctx)
     if ( rc )
         goto out;
 
-    rc = suspend_and_send_dirty(ctx);
+    if ( ctx->save.postcopy_active )
+        rc = postcopy_begin(ctx);
+    else
+        rc = suspend_and_send_dirty(ctx);
     if ( rc )
         goto out;
 
@@ -789,6 +1915,10 @@ static int setup(struct xc_sr_context *ctx)
     int rc;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, chunk_pfns,
+                                    &ctx->save.chunk_pfns_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint8_t, chunks,
+                                    &ctx->save.chunks_hbuf);
 
     rc = ctx->save.ops.setup(ctx);
     if ( rc )
@@ -796,11 +1926,17 @@ static int setup(struct xc_sr_context *ctx)
 
     dirty_bitmap = xc_hypercall_buffer_alloc_pages(
                    xch, dirty_bitmap, NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    chunk_pfns = xc_hypercall_buffer_alloc_pages(
+                 xch, chunk_pfns, NRPAGES(SPARSE_CHUNKS * sizeof(*chunk_pfns)));
+    chunks = xc_hypercall_buffer_alloc_pages(
+             xch, chunks,
+             NRPAGES(SPARSE_CHUNKS * XEN_DOMCTL_SHADOW_CHUNK_BYTES));
     ctx->save.batch_pfns = malloc(MAX_BATCH_SIZE *
                                   sizeof(*ctx->save.batch_pfns));
     ctx->save.deferred_pages = calloc(1, bitmap_size(ctx->save.p2m_size));
 
-    if ( !ctx->save.batch_pfns || !dirty_bitmap || !ctx->save.deferred_pages )
+    if ( !ctx->save.batch_pfns || !dirty_bitmap || !ctx->save.deferred_pages ||
+         !chunk_pfns || !chunks )
     {
         ERROR("Unable to allocate memory for dirty bitmaps, batch pfns and"
               " deferred pages");
@@ -809,6 +1945,50 @@ static int setup(struct xc_sr_context *ctx)
         goto err;
     }
 
+    if ( ctx->save.image )
+    {
+        off_t pos = lseek(ctx->fd, 0, SEEK_CUR);
+
+        ctx->save.image_written = bitmap_alloc(ctx->save.p2m_size);
+        if ( pos == -1 || !ctx->save.image_written )
+        {
+            PERROR("Unable to set up the page image");
+            rc = -1;
+            goto err;
+        }
+        /* 2MiB aligned, so that superpage runs are extent aligned. */
+        ctx->save.image_offset = (pos + IMAGE_STREAM_RESERVE +
+                                  (1ULL << 21) - 1) & ~((1ULL << 21) - 1);
+        DPRINTF("Page image at offset %#"PRIx64, ctx->save.image_offset);
+    }
+
+    if ( ctx->save.compress )
+    {
+        ctx->save.compress_ctx = xc_compression_create_context(
+            xch, ctx->save.p2m_size);
+        ctx->save.compress_enc = malloc(ROUNDUP(MAX_BATCH_SIZE,
+                                                REC_ALIGN_ORDER));
+        ctx->save.compress_buf = malloc(COMPRESS_BUF_SIZE);
+        ctx->save.deflate_buf_size = compressBound(COMPRESS_BUF_SIZE);
+        ctx->save.deflate_buf = malloc(ctx->save.deflate_buf_size);
+
+        if ( !ctx->save.compress_ctx || !ctx->save.compress_enc ||
+             !ctx->save.compress_buf || !ctx->save.deflate_buf )
+        {
+            ERROR("Unable to allocate memory for page compression");
+            rc = -1;
+            errno = ENOMEM;
+            goto err;
+        }
+    }
+
+    if ( ctx->save.pipelined )
+    {
+        rc = pipeline_create(ctx);
+        if ( rc )
+            goto err;
+    }
+
     rc = 0;
 
  err:
@@ -820,7 +2000,12 @@ static void cleanup(struct xc_sr_context *ctx)
     xc_interface *xch = ctx->xch;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, chunk_pfns,
+                                    &ctx->save.chunk_pfns_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint8_t, chunks,
+                                    &ctx->save.chunks_hbuf);
 
+    pipeline_destroy(ctx);
 
     xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_OFF,
                       NULL, 0, NULL, 0, NULL);
@@ -830,10 +2015,27 @@ static void cleanup(struct xc_sr_context *ctx)
 
     xc_hypercall_buffer_free_pages(xch, dirty_bitmap,
                                    NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    xc_hypercall_buffer_free_pages(
+        xch, chunk_pfns, NRPAGES(SPARSE_CHUNKS * sizeof(*chunk_pfns)));
+    xc_hypercall_buffer_free_pages(
+        xch, chunks, NRPAGES(SPARSE_CHUNKS * XEN_DOMCTL_SHADOW_CHUNK_BYTES));
     free(ctx->save.deferred_pages);
+    free(ctx->save.postcopy_pfns);
+    free(ctx->save.image_written);
     free(ctx->save.batch_pfns);
+    xc_compression_free_context(xch, ctx->save.compress_ctx);
+    free(ctx->save.compress_enc);
+    free(ctx->save.compress_buf);
+    free(ctx->save.deflate_buf);
 }
 
+static const char *const save_stage_names[SAVE_STAGE_NR] =
+{
+    [SAVE_STAGE_LOGDIRTY] = "log-dirty",
+    [SAVE_STAGE_MAP]      = "map",
+    [SAVE_STAGE_WRITE]    = "write",
+};
+
 /*
  * Save a domain.
  */
@@ -890,6 +2092,13 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
         if ( rc )
             goto err;
 
+        if ( ctx->save.postcopy_active )
+        {
+            rc = postcopy_send_pages(ctx);
+            if ( rc )
+                goto err;
+        }
+
         if ( ctx->save.checkpointed != XC_MIG_STREAM_NONE )
         {
             /*
@@ -956,6 +2165,10 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
  done:
     cleanup(ctx);
 
+    /* The pipeline workers are gone, so the stages can be read. */
+    sr_report_stages(ctx, "Save", save_stage_names, ctx->save.stages,
+                     SAVE_STAGE_NR);
+
     if ( saved_rc )
     {
         rc = saved_rc;
@@ -979,6 +2192,14 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
     ctx.save.callbacks = callbacks;
     ctx.save.live  = !!(flags & XCFLAGS_LIVE);
     ctx.save.debug = !!(flags & XCFLAGS_DEBUG);
+    ctx.save.pipelined = !!(flags & XCFLAGS_PIPELINE);
+    ctx.save.compress = !!(flags & XCFLAGS_COMPRESS) ||
+        (stream_type != XC_MIG_STREAM_NONE &&
+         (flags & XCFLAGS_CHECKPOINT_COMPRESS));
+    ctx.save.postcopy = !!(flags & XCFLAGS_POSTCOPY);
+    ctx.save.auto_converge = !!(flags & XCFLAGS_AUTO_CONVERGE) &&
+        ctx.save.live;
+    ctx.save.image = !!(flags & XCFLAGS_IMAGE);
     ctx.save.checkpointed = stream_type;
     ctx.save.recv_fd = recv_fd;
 
@@ -995,6 +2216,42 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
     if ( ctx.save.checkpointed == XC_MIG_STREAM_COLO )
         assert(callbacks->wait_checkpoint);
 
+    /*
+     * Post-copy relies on mem_paging in the restored domain, which is only
+     * available to HVM guests, and makes no sense for a checkpointed stream.
+     */
+    if ( ctx.save.postcopy &&
+         (!hvm || !ctx.save.live || stream_type != XC_MIG_STREAM_NONE) )
+    {
+        ERROR("Post-copy is only supported for live migration of HVM guests");
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*
+     * A page image is written at fixed offsets of a regular file, and its
+     * restore assumes HVM pages need no localisation.
+     */
+    if ( ctx.save.image )
+    {
+        struct stat st;
+
+        if ( !hvm || stream_type != XC_MIG_STREAM_NONE ||
+             ctx.save.compress || ctx.save.postcopy )
+        {
+            ERROR("Page images are only supported for plain HVM saves");
+            errno = EINVAL;
+            return -1;
+        }
+
+        if ( fstat(io_fd, &st) || !S_ISREG(st.st_mode) )
+        {
+            ERROR("Page images need a regular file to save to");
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
     DPRINTF("fd %d, dom %u, flags %u, hvm %d", io_fd, dom, flags, hvm);
 
     if ( xc_domain_getinfo(xch, dom, 1, &ctx.dominfo) != 1 )
@@ -76,6 +76,13 @@ struct xc_sr_rhdr
 #define REC_TYPE_VERIFY                     0x0000000dU
 #define REC_TYPE_CHECKPOINT                 0x0000000eU
 #define REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST  0x0000000fU
+#define REC_TYPE_COMPRESSED_PAGE_DATA       0x00000010U
+#define REC_TYPE_POSTCOPY_BEGIN             0x00000011U
+#define REC_TYPE_POSTCOPY_PFNS              0x00000012U
+#define REC_TYPE_POSTCOPY_TRANSITION        0x00000013U
+#define REC_TYPE_POSTCOPY_FAULT             0x00000014U
+#define REC_TYPE_PAGE_IMAGE                 0x00000015U
+#define REC_TYPE_CHECKPOINT_DIRTY_PFN_RANGES 0x00000016U
 
 #define REC_TYPE_OPTIONAL             0x80000000U
 
@@ -90,6 +97,41 @@ struct xc_sr_rec_page_data_header
 #define PAGE_DATA_PFN_MASK  0x000fffffffffffffULL
 #define PAGE_DATA_TYPE_MASK 0xf000000000000000ULL
 
+/* COMPRESSED_PAGE_DATA */
+struct xc_sr_rec_compressed_page_data_header
+{
+    uint32_t count;
+    uint32_t codec;
+    uint32_t raw_length;
+    uint32_t data_length;
+    uint64_t pfn[0];
+    /* uint8_t encoding[count], padded to 8 octets, then data_length octets
+     * of page data. */
+};
+
+#define COMPRESSED_PAGE_CODEC_NONE    0x00000000U
+#define COMPRESSED_PAGE_CODEC_DEFLATE 0x00000001U
+
+#define COMPRESSED_PAGE_ENC_NONE      0x00
+#define COMPRESSED_PAGE_ENC_ZERO      0x01
+#define COMPRESSED_PAGE_ENC_DELTA     0x02
+
+/* PAGE_IMAGE */
+struct xc_sr_rec_page_image_header
+{
+    uint32_t count;
+    uint32_t _res1;
+    uint64_t image_offset;
+    uint64_t pfn[0];
+};
+
+/* CHECKPOINT_DIRTY_PFN_RANGES */
+struct xc_sr_rec_pfn_range
+{
+    uint64_t pfn;
+    uint64_t count;
+};
+
 /* X86_PV_INFO */
 struct xc_sr_rec_x86_pv_info
 {
@@ -170,3 +170,40 @@ int xc_tbuf_set_evt_mask(xc_interface *xch, uint32_t mask)
     return do_sysctl(xch, &sysctl);
 }
 
+int xc_tbuf_set_evt_filter(xc_interface *xch, unsigned int nr,
+                           const uint32_t *event, const uint32_t *mask)
+{
+    DECLARE_SYSCTL;
+    unsigned int i;
+
+    if ( nr > XEN_SYSCTL_TBUF_NR_EVT_FILTERS )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sysctl.cmd = XEN_SYSCTL_tbuf_op;
+    sysctl.interface_version = XEN_SYSCTL_INTERFACE_VERSION;
+    sysctl.u.tbuf_op.cmd  = XEN_SYSCTL_TBUFOP_set_evt_filter;
+    sysctl.u.tbuf_op.nr_evt_filters = nr;
+    for ( i = 0; i < nr; i++ )
+    {
+        sysctl.u.tbuf_op.filter_event[i] = event[i];
+        sysctl.u.tbuf_op.filter_mask[i] = mask[i];
+    }
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_tbuf_set_dom_filter(xc_interface *xch, uint32_t domid)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_tbuf_op;
+    sysctl.interface_version = XEN_SYSCTL_INTERFACE_VERSION;
+    sysctl.u.tbuf_op.cmd  = XEN_SYSCTL_TBUFOP_set_dom_filter;
+    sysctl.u.tbuf_op.domid = domid;
+
+    return do_sysctl(xch, &sysctl);
+}
+
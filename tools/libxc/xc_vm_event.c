@@ -32,6 +32,9 @@ int xc_vm_event_control(xc_interface *xch, uint32_t domain_id, unsigned int op,
     domctl.domain = domain_id;
     domctl.u.vm_event_op.op = op;
     domctl.u.vm_event_op.mode = mode;
+    domctl.u.vm_event_op.nr_rings = 0;
+    set_xen_guest_handle(domctl.u.vm_event_op.ring_gfns, HYPERCALL_BUFFER_NULL);
+    set_xen_guest_handle(domctl.u.vm_event_op.ports, HYPERCALL_BUFFER_NULL);
 
     rc = do_domctl(xch, &domctl);
     if ( !rc && port )
@@ -39,55 +42,123 @@ int xc_vm_event_control(xc_interface *xch, uint32_t domain_id, unsigned int op,
     return rc;
 }
 
-void *xc_vm_event_enable(xc_interface *xch, uint32_t domain_id, int param,
-                         uint32_t *port)
+static int vm_event_enable_rings(xc_interface *xch, uint32_t domain_id,
+                                 unsigned int mode, unsigned int nr_rings,
+                                 xen_pfn_t *ring_pfns, uint32_t *ports)
+{
+    DECLARE_DOMCTL;
+    DECLARE_HYPERCALL_BOUNCE(ring_pfns, nr_rings * sizeof(*ring_pfns),
+                             XC_HYPERCALL_BUFFER_BOUNCE_IN);
+    DECLARE_HYPERCALL_BOUNCE(ports, nr_rings * sizeof(*ports),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+    int rc = -1;
+
+    if ( xc_hypercall_bounce_pre(xch, ring_pfns) ||
+         xc_hypercall_bounce_pre(xch, ports) )
+    {
+        PERROR("Could not bounce buffers for vm_event rings");
+        goto out;
+    }
+
+    domctl.cmd = XEN_DOMCTL_vm_event_op;
+    domctl.domain = domain_id;
+    domctl.u.vm_event_op.op = XEN_VM_EVENT_ENABLE;
+    domctl.u.vm_event_op.mode = mode;
+    domctl.u.vm_event_op.nr_rings = nr_rings;
+    set_xen_guest_handle(domctl.u.vm_event_op.ring_gfns, ring_pfns);
+    set_xen_guest_handle(domctl.u.vm_event_op.ports, ports);
+
+    rc = do_domctl(xch, &domctl);
+
+ out:
+    xc_hypercall_bounce_post(xch, ring_pfns);
+    xc_hypercall_bounce_post(xch, ports);
+    return rc;
+}
+
+void *xc_vm_event_enable_rings(xc_interface *xch, uint32_t domain_id, int param,
+                               unsigned int nr_rings, uint32_t *ports)
 {
     void *ring_page = NULL;
     uint64_t pfn;
-    xen_pfn_t ring_pfn, mmap_pfn;
-    unsigned int op, mode;
+    xen_pfn_t *ring_pfns, *mmap_pfns, max_gpfn;
+    unsigned int i, op, mode;
     int rc1, rc2, saved_errno;
 
-    if ( !port )
+    if ( !ports || !nr_rings )
     {
         errno = EINVAL;
         return NULL;
     }
 
+    ring_pfns = malloc(nr_rings * sizeof(*ring_pfns));
+    mmap_pfns = malloc(nr_rings * sizeof(*mmap_pfns));
+    if ( !ring_pfns || !mmap_pfns )
+    {
+        PERROR("Could not allocate ring pfn arrays\n");
+        free(ring_pfns);
+        free(mmap_pfns);
+        return NULL;
+    }
+
     /* Pause the domain for ring page setup */
     rc1 = xc_domain_pause(xch, domain_id);
     if ( rc1 != 0 )
     {
         PERROR("Unable to pause domain\n");
+        free(ring_pfns);
+        free(mmap_pfns);
         return NULL;
     }
 
-    /* Get the pfn of the ring page */
-    rc1 = xc_hvm_param_get(xch, domain_id, param, &pfn);
-    if ( rc1 != 0 )
+    if ( nr_rings == 1 )
     {
-        PERROR("Failed to get pfn of ring page\n");
-        goto out;
+        /* Get the pfn of the ring page */
+        rc1 = xc_hvm_param_get(xch, domain_id, param, &pfn);
+        if ( rc1 != 0 )
+        {
+            PERROR("Failed to get pfn of ring page\n");
+            goto out;
+        }
+        ring_pfns[0] = pfn;
     }
-
-    ring_pfn = pfn;
-    mmap_pfn = pfn;
-    rc1 = xc_get_pfn_type_batch(xch, domain_id, 1, &mmap_pfn);
-    if ( rc1 || mmap_pfn & XEN_DOMCTL_PFINFO_XTAB )
+    else
     {
-        /* Page not in the physmap, try to populate it */
-        rc1 = xc_domain_populate_physmap_exact(xch, domain_id, 1, 0, 0,
-                                              &ring_pfn);
+        /*
+         * Only one ring page is set aside in the guest's physmap.  Put the
+         * rings just past the end of its memory instead, they are taken
+         * out of the physmap again once set up.
+         */
+        rc1 = xc_domain_maximum_gpfn(xch, domain_id, &max_gpfn);
         if ( rc1 != 0 )
         {
-            PERROR("Failed to populate ring pfn\n");
+            PERROR("Failed to get max gpfn\n");
             goto out;
         }
+        for ( i = 0; i < nr_rings; i++ )
+            ring_pfns[i] = max_gpfn + 1 + i;
+    }
+
+    for ( i = 0; i < nr_rings; i++ )
+    {
+        mmap_pfns[i] = ring_pfns[i];
+        rc1 = xc_get_pfn_type_batch(xch, domain_id, 1, &mmap_pfns[i]);
+        if ( rc1 || mmap_pfns[i] & XEN_DOMCTL_PFINFO_XTAB )
+        {
+            /* Page not in the physmap, try to populate it */
+            rc1 = xc_domain_populate_physmap_exact(xch, domain_id, 1, 0, 0,
+                                                   &ring_pfns[i]);
+            if ( rc1 != 0 )
+            {
+                PERROR("Failed to populate ring pfn\n");
+                goto out;
+            }
+        }
+        mmap_pfns[i] = ring_pfns[i];
     }
 
-    mmap_pfn = ring_pfn;
     ring_page = xc_map_foreign_pages(xch, domain_id, PROT_READ | PROT_WRITE,
-                                         &mmap_pfn, 1);
+                                     mmap_pfns, nr_rings);
     if ( !ring_page )
     {
         PERROR("Could not map the ring page\n");
@@ -121,15 +192,20 @@ void *xc_vm_event_enable(xc_interface *xch, uint32_t domain_id, int param,
         goto out;
     }
 
-    rc1 = xc_vm_event_control(xch, domain_id, op, mode, port);
+    if ( nr_rings == 1 )
+        rc1 = xc_vm_event_control(xch, domain_id, op, mode, ports);
+    else
+        rc1 = vm_event_enable_rings(xch, domain_id, mode, nr_rings,
+                                    ring_pfns, ports);
     if ( rc1 != 0 )
     {
         PERROR("Failed to enable vm_event\n");
         goto out;
     }
 
-    /* Remove the ring_pfn from the guest's physmap */
-    rc1 = xc_domain_decrease_reservation_exact(xch, domain_id, 1, 0, &ring_pfn);
+    /* Remove the ring_pfns from the guest's physmap */
+    rc1 = xc_domain_decrease_reservation_exact(xch, domain_id, nr_rings, 0,
+                                               ring_pfns);
     if ( rc1 != 0 )
         PERROR("Failed to remove ring page from guest physmap");
 
@@ -147,15 +223,24 @@ void *xc_vm_event_enable(xc_interface *xch, uint32_t domain_id, int param,
         }
 
         if ( ring_page )
-            xenforeignmemory_unmap(xch->fmem, ring_page, 1);
+            xenforeignmemory_unmap(xch->fmem, ring_page, nr_rings);
         ring_page = NULL;
 
         errno = saved_errno;
     }
 
+    free(ring_pfns);
+    free(mmap_pfns);
+
     return ring_page;
 }
 
+void *xc_vm_event_enable(xc_interface *xch, uint32_t domain_id, int param,
+                         uint32_t *port)
+{
+    return xc_vm_event_enable_rings(xch, domain_id, param, 1, port);
+}
+
 /*
  * Local variables:
  * mode: C
@@ -49,6 +49,7 @@ int libxl_ctx_alloc(libxl_ctx **pctx, int version,
     LIBXL_LIST_INIT(&ctx->pollers_event);
     LIBXL_LIST_INIT(&ctx->pollers_idle);
     LIBXL_LIST_INIT(&ctx->pollers_fds_changed);
+    ctx->poller_leader = NULL;
 
     LIBXL_LIST_INIT(&ctx->efds);
     LIBXL_TAILQ_INIT(&ctx->etimes);
@@ -66,6 +67,8 @@ int libxl_ctx_alloc(libxl_ctx **pctx, int version,
     LIBXL_TAILQ_INIT(&ctx->death_list);
     libxl__ev_xswatch_init(&ctx->death_watch);
 
+    LIBXL_LIST_INIT(&ctx->create_phase_evgens);
+
     ctx->childproc_hooks = &libxl__childproc_default_hooks;
     ctx->childproc_user = 0;
 
@@ -73,6 +76,9 @@ int libxl_ctx_alloc(libxl_ctx **pctx, int version,
     ctx->sigchld_selfpipe[1] = -1;
     libxl__ev_fd_init(&ctx->sigchld_selfpipe_efd);
 
+    LIBXL_TAILQ_INIT(&ctx->dconfig_cache);
+    LIBXL_LIST_INIT(&ctx->qmp_pool);
+
     /* The mutex is special because we can't idempotently destroy it */
 
     if (libxl__init_recursive_mutex(ctx, &ctx->lock) < 0) {
@@ -103,7 +109,7 @@ int libxl_ctx_alloc(libxl_ctx **pctx, int version,
         rc = ERROR_FAIL; goto out;
     }
 
-    ctx->xsh = xs_daemon_open();
+    ctx->xsh = xs_open(XS_OPEN_SHMEM);
     if (!ctx->xsh)
         ctx->xsh = xs_domain_open();
     if (!ctx->xsh) {
@@ -155,6 +161,10 @@ int libxl_ctx_free(libxl_ctx *ctx)
     while ((eject = LIBXL_LIST_FIRST(&CTX->disk_eject_evgens)))
         libxl__evdisable_disk_eject(gc, eject);
 
+    libxl_evgen_domain_create_phase *phase;
+    while ((phase = LIBXL_LIST_FIRST(&CTX->create_phase_evgens)))
+        libxl__evdisable_domain_create_phase(gc, phase);
+
     libxl_childproc_setmode(CTX,0,0);
     for (i = 0; i < ctx->watch_nslots; i++)
         assert(!libxl__watch_slot_contents(gc, i));
@@ -186,6 +196,10 @@ int libxl_ctx_free(libxl_ctx *ctx)
 
     free(ctx->watch_slots);
 
+    libxl__domain_config_cache_drop(ctx, INVALID_DOMID);
+    libxl__qmp_pool_flush(ctx, INVALID_DOMID);
+    libxl__domname_cache_free(ctx);
+
     discard_events(&ctx->occurred);
 
     /* If we have outstanding children, then the application inherits
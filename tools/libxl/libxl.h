@@ -305,6 +305,14 @@
  */
 #define LIBXL_HAVE_VIRIDIAN_CRASH_CTL 1
 
+/*
+ * LIBXL_HAVE_VIRIDIAN_SYNIC and LIBXL_HAVE_VIRIDIAN_STIMER indicate that
+ * the 'synic' and 'stimer' values are present in the viridian
+ * enlightenment enumeration.
+ */
+#define LIBXL_HAVE_VIRIDIAN_SYNIC 1
+#define LIBXL_HAVE_VIRIDIAN_STIMER 1
+
 /*
  * LIBXL_HAVE_BUILDINFO_HVM_ACPI_LAPTOP_SLATE indicates that
  * libxl_domain_build_info has the u.hvm.acpi_laptop_slate field.
@@ -981,6 +989,14 @@ void libxl_mac_copy(libxl_ctx *ctx, libxl_mac *dst, const libxl_mac *src);
  */
 #define LIBXL_HAVE_PSR_L2_CAT 1
 
+/*
+ * LIBXL_HAVE_PSR_CAT_PROTECT
+ *
+ * If this is defined, libxl_psr_cat_protect() is available to adjust L3 CAT
+ * masks based on CMT/MBM feedback.
+ */
+#define LIBXL_HAVE_PSR_CAT_PROTECT 1
+
 /*
  * LIBXL_HAVE_MCA_CAPS
  *
@@ -1101,6 +1117,99 @@ void libxl_mac_copy(libxl_ctx *ctx, libxl_mac *dst, const libxl_mac *src);
  */
 #define LIBXL_HAVE_SET_PARAMETERS 1
 
+/*
+ * LIBXL_HAVE_SUSPEND_PIPELINE
+ *
+ * If this is defined, libxl_domain_suspend() accepts LIBXL_SUSPEND_PIPELINE,
+ * which maps and writes guest memory on separate threads.
+ */
+#define LIBXL_HAVE_SUSPEND_PIPELINE 1
+
+/*
+ * LIBXL_HAVE_SUSPEND_COMPRESS
+ *
+ * If this is defined, libxl_domain_suspend() accepts LIBXL_SUSPEND_COMPRESS,
+ * which sends guest memory as compressed page data.  The receiving side must
+ * be running a libxc which understands COMPRESSED_PAGE_DATA records.
+ */
+#define LIBXL_HAVE_SUSPEND_COMPRESS 1
+
+/*
+ * LIBXL_HAVE_SUSPEND_AUTO_CONVERGE
+ *
+ * If this is defined, libxl_domain_suspend() accepts
+ * LIBXL_SUSPEND_AUTO_CONVERGE, which lowers the domain's scheduler cap
+ * during a live migration while it dirties memory faster than it is sent.
+ */
+#define LIBXL_HAVE_SUSPEND_AUTO_CONVERGE 1
+
+/*
+ * LIBXL_HAVE_RESTORE_DIRECT_PAGE_DATA
+ *
+ * If this is defined, libxl_domain_restore_params has a 'direct_page_data'
+ * field.  When true, page data from a plain (non-checkpointed) stream is
+ * read straight into guest memory instead of being read ahead into buffers
+ * and copied.
+ */
+#define LIBXL_HAVE_RESTORE_DIRECT_PAGE_DATA 1
+
+/*
+ * LIBXL_HAVE_SUSPEND_IMAGE
+ *
+ * If this is defined, libxl_domain_suspend() accepts LIBXL_SUSPEND_IMAGE,
+ * which writes an HVM domain's memory at pfn-indexed offsets of the
+ * (regular file) fd, as a sparse page image, rather than into the stream.
+ * The file is restored as usual.
+ */
+#define LIBXL_HAVE_SUSPEND_IMAGE 1
+
+/*
+ * LIBXL_HAVE_COLO_CHECKPOINT_COMPRESSION
+ *
+ * If this is defined, libxl_domain_remus_info.compression may be (and
+ * defaults to) true in COLO mode too.  Pages the secondary has dirtied are
+ * then sent whole, and the rest as deltas against the previous checkpoint.
+ */
+#define LIBXL_HAVE_COLO_CHECKPOINT_COMPRESSION 1
+
+/*
+ * LIBXL_HAVE_VCPUINFO_WAITING
+ *
+ * If this is defined, libxl_vcpuinfo has a 'waiting' field, which is true
+ * when the vcpu is online but its scheduler has no pcpu to run it on (e.g.,
+ * it is in the null scheduler's waitqueue).
+ */
+#define LIBXL_HAVE_VCPUINFO_WAITING 1
+
+/*
+ * LIBXL_HAVE_DOMAIN_CREATE_PHASE_EVENT
+ *
+ * If this is defined, libxl_evenable_domain_create_phase() is available
+ * and asks for LIBXL_EVENT_TYPE_DOMAIN_CREATE_PHASE events, which report
+ * how long each phase of domain creation took.
+ */
+#define LIBXL_HAVE_DOMAIN_CREATE_PHASE_EVENT 1
+
+/*
+ * LIBXL_HAVE_BUILDINFO_TEMPLATE_DOMID
+ *
+ * If this is defined, libxl_domain_build_info has a 'template_domid'
+ * field.  When it is non-zero a PVH domain is built as a copy-on-write
+ * clone of that paused domain, which must have been created by libxl with
+ * the same configuration, instead of loading its kernel.
+ */
+#define LIBXL_HAVE_BUILDINFO_TEMPLATE_DOMID 1
+
+/*
+ * LIBXL_HAVE_LIST_DOMAIN_NAMED
+ *
+ * If this is defined, libxl_list_domain_named() is available and returns
+ * every domain's libxl_dominfo together with its name in one call.  Names
+ * are cached per libxl_ctx and kept coherent with xenstore watches, so
+ * repeated calls on a long lived ctx do not read xenstore per domain.
+ */
+#define LIBXL_HAVE_LIST_DOMAIN_NAMED 1
+
 typedef char **libxl_string_list;
 void libxl_string_list_dispose(libxl_string_list *sl);
 int libxl_string_list_length(const libxl_string_list *sl);
@@ -1450,6 +1559,10 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd,
                          LIBXL_EXTERNAL_CALLERS_ONLY;
 #define LIBXL_SUSPEND_DEBUG 1
 #define LIBXL_SUSPEND_LIVE 2
+#define LIBXL_SUSPEND_PIPELINE 4
+#define LIBXL_SUSPEND_COMPRESS 8
+#define LIBXL_SUSPEND_AUTO_CONVERGE 16
+#define LIBXL_SUSPEND_IMAGE 32
 
 /* @param suspend_cancel [from xenctrl.h:xc_domain_resume( @param fast )]
  *   If this parameter is true, use co-operative resume. The guest
@@ -1622,6 +1735,11 @@ int libxl_domain_info(libxl_ctx*, libxl_dominfo *info_r,
 libxl_dominfo * libxl_list_domain(libxl_ctx*, int *nb_domain_out);
 void libxl_dominfo_list_free(libxl_dominfo *list, int nb_domain);
 
+/* As libxl_list_domain, with names.  name is NULL for a domain whose
+ * name could not be found. */
+libxl_domnameinfo * libxl_list_domain_named(libxl_ctx*, int *nb_domain_out);
+void libxl_domnameinfo_list_free(libxl_domnameinfo *list, int nb_domain);
+
 libxl_cpupoolinfo * libxl_list_cpupool(libxl_ctx*, int *nb_pool_out);
 void libxl_cpupoolinfo_list_free(libxl_cpupoolinfo *list, int nb_pool);
 
@@ -2302,6 +2420,19 @@ int libxl_psr_cat_get_info(libxl_ctx *ctx, libxl_psr_cat_info **info,
 int libxl_psr_cat_get_l3_info(libxl_ctx *ctx, libxl_psr_cat_info **info,
                               int *nr);
 void libxl_psr_cat_info_list_free(libxl_psr_cat_info *list, int nr);
+
+/*
+ * One step of a feedback loop that shields the L3 cache share of 'domids'
+ * on socket 'socketid' from all other domains.  The domains are attached
+ * to CMT if they aren't yet, their cache occupancy and the other domains'
+ * memory bandwidth are sampled over 'interval_ms', and the L3 ways are
+ * split between them accordingly: the protected domains get the top
+ * '*ways' ways, everybody else the remaining ones.  On input '*ways' is the
+ * current split (0 for none yet), on output the new one.  Call repeatedly.
+ */
+int libxl_psr_cat_protect(libxl_ctx *ctx, uint32_t socketid,
+                          const uint32_t *domids, int nr_domids,
+                          unsigned int interval_ms, unsigned int *ways);
 #endif
 
 /* misc */
@@ -52,11 +52,10 @@ char *libxl__blktap_devpath(libxl__gc *gc,
 }
 
 
-int libxl__device_destroy_tapdisk(libxl__gc *gc, const char *params)
+static int blktap_find(libxl__gc *gc, const char *params, tap_list_t *tap)
 {
     char *type, *disk;
     int err;
-    tap_list_t tap;
 
     type = libxl__strdup(gc, params);
 
@@ -68,13 +67,25 @@ int libxl__device_destroy_tapdisk(libxl__gc *gc, const char *params)
 
     *disk++ = '\0';
 
-    err = tap_ctl_find(type, disk, &tap);
+    err = tap_ctl_find(type, disk, tap);
     if (err < 0) {
         /* returns -errno */
         LOGEV(ERROR, -err, "Unable to find type %s disk %s", type, disk);
         return ERROR_FAIL;
     }
 
+    return 0;
+}
+
+int libxl__device_destroy_tapdisk(libxl__gc *gc, const char *params)
+{
+    int rc, err;
+    tap_list_t tap;
+
+    rc = blktap_find(gc, params, &tap);
+    if (rc)
+        return rc;
+
     err = tap_ctl_destroy(tap.id, tap.minor);
     if (err < 0) {
         LOGEV(ERROR, -err, "Failed to destroy tap device id %d minor %d",
@@ -85,6 +96,63 @@ int libxl__device_destroy_tapdisk(libxl__gc *gc, const char *params)
     return 0;
 }
 
+int libxl__device_mirror_tapdisk(libxl__gc *gc, const char *params,
+                                 const char *mirror)
+{
+    int rc, err;
+    tap_list_t tap;
+
+    rc = blktap_find(gc, params, &tap);
+    if (rc)
+        return rc;
+
+    err = tap_ctl_mirror(tap.id, tap.minor, mirror);
+    if (err) {
+        LOGEV(ERROR, err, "Failed to mirror tap device id %d minor %d to %s",
+              tap.id, tap.minor, mirror);
+        return ERROR_FAIL;
+    }
+
+    return 0;
+}
+
+int libxl__device_mirror_tapdisk_status(libxl__gc *gc, const char *params,
+                                        int *done)
+{
+    int rc, err;
+    tap_list_t tap;
+    tapdisk_message_mirror_t status;
+
+    rc = blktap_find(gc, params, &tap);
+    if (rc)
+        return rc;
+
+    err = tap_ctl_mirror_status(tap.id, tap.minor, &status);
+    if (err) {
+        LOGEV(ERROR, err, "Failed to get mirror status of tap device "
+              "id %d minor %d", tap.id, tap.minor);
+        return ERROR_FAIL;
+    }
+
+    switch (status.state) {
+    case TAPDISK_MIRROR_COPY:
+    case TAPDISK_MIRROR_SYNC:
+        *done = 0;
+        return 0;
+    case TAPDISK_MIRROR_DONE:
+        *done = 1;
+        return 0;
+    case TAPDISK_MIRROR_FAILED:
+        LOGEV(ERROR, -status.error, "Mirror of tap device id %d minor %d "
+              "failed", tap.id, tap.minor);
+        return ERROR_FAIL;
+    default:
+        LOG(ERROR, "No mirror on tap device id %d minor %d",
+            tap.id, tap.minor);
+        return ERROR_INVAL;
+    }
+}
+
 /*
  * Local variables:
  * mode: C
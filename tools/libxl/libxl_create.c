@@ -781,6 +781,21 @@ static void domcreate_rebuild_done(libxl__egc *egc,
                                    libxl__domain_create_state *dcs,
                                    int ret);
 
+/*
+ * The device model is started while the devices which do not depend on
+ * it are attached.  Each of the two, and domcreate_launch_dm itself,
+ * calls domcreate_devices_stage_done when finished; the last one goes
+ * on to attach the devices which need the device model.
+ */
+static void domcreate_attach_early_devices(libxl__egc *egc,
+                                           libxl__domain_create_state *dcs);
+static void domcreate_devices_stage_done(libxl__egc *egc,
+                                         libxl__domain_create_state *dcs,
+                                         int rc);
+static void domcreate_attach_devices(libxl__egc *egc,
+                                     libxl__multidev *multidev,
+                                     int ret);
+
 /* Our own function to clean up and call the user's callback.
  * The final call in the sequence. */
 static void domcreate_complete(libxl__egc *egc,
@@ -793,6 +808,45 @@ static void domcreate_destruction_cb(libxl__egc *egc,
                                      libxl__domain_destroy_state *dds,
                                      int rc);
 
+/* Timing of the phases, reported by DOMAIN_CREATE_PHASE events. */
+static void domcreate_phase_begin(libxl__domain_create_state *dcs,
+                                  libxl_domain_create_phase phase)
+{
+    gettimeofday(&dcs->phase_start[phase], NULL);
+}
+
+static void domcreate_phase_end(libxl__egc *egc,
+                                libxl__domain_create_state *dcs,
+                                libxl_domain_create_phase phase, int rc)
+{
+    EGC_GC;
+    struct timeval *start = &dcs->phase_start[phase], now, took;
+    libxl_evgen_domain_create_phase *evg;
+    libxl_event *ev;
+    uint64_t usec = 0;
+
+    if (!timerisset(start))
+        return;
+
+    gettimeofday(&now, NULL);
+    if (timercmp(&now, start, >)) {
+        timersub(&now, start, &took);
+        usec = (uint64_t)took.tv_sec * 1000000 + took.tv_usec;
+    }
+    timerclear(start);
+
+    LOGD(DEBUG, dcs->guest_domid, "%s phase took %"PRIu64"us, rc=%d",
+         libxl_domain_create_phase_to_string(phase), usec, rc);
+
+    LIBXL_LIST_FOREACH(evg, &CTX->create_phase_evgens, entry) {
+        ev = NEW_EVENT(egc, DOMAIN_CREATE_PHASE, dcs->guest_domid, evg->user);
+        ev->u.domain_create_phase.phase = phase;
+        ev->u.domain_create_phase.usec = usec;
+        ev->u.domain_create_phase.rc = rc;
+        libxl__event_occurred(egc, ev);
+    }
+}
+
 static void initiate_domain_create(libxl__egc *egc,
                                    libxl__domain_create_state *dcs)
 {
@@ -808,6 +862,7 @@ static void initiate_domain_create(libxl__egc *egc,
     const int restore_fd = dcs->restore_fd;
 
     domid = dcs->domid_soft_reset;
+    memset(dcs->phase_start, 0, sizeof(dcs->phase_start));
 
     if (d_config->c_info.ssid_label) {
         char *s = d_config->c_info.ssid_label;
@@ -994,6 +1049,7 @@ static void initiate_domain_create(libxl__egc *egc,
         dcs->bl.kernel = &dcs->build_state.pv_kernel;
         dcs->bl.ramdisk = &dcs->build_state.pv_ramdisk;
 
+        domcreate_phase_begin(dcs, LIBXL_DOMAIN_CREATE_PHASE_BOOTLOADER);
         libxl__bootloader_run(egc, &dcs->bl);
     }
     return;
@@ -1054,11 +1110,14 @@ static void domcreate_bootloader_done(libxl__egc *egc,
     libxl__srm_restore_autogen_callbacks *const callbacks =
         &dcs->srs.shs.callbacks.restore.a;
 
+    domcreate_phase_end(egc, dcs, LIBXL_DOMAIN_CREATE_PHASE_BOOTLOADER, rc);
     if (rc) {
         domcreate_rebuild_done(egc, dcs, rc);
         return;
     }
 
+    domcreate_phase_begin(dcs, LIBXL_DOMAIN_CREATE_PHASE_BUILD);
+
     /* consume bootloader outputs. state->pv_{kernel,ramdisk} have
      * been initialised by the bootloader already.
      */
@@ -1242,6 +1301,7 @@ static void domcreate_rebuild_done(libxl__egc *egc,
     const uint32_t domid = dcs->guest_domid;
     libxl_domain_config *const d_config = dcs->guest_config;
 
+    domcreate_phase_end(egc, dcs, LIBXL_DOMAIN_CREATE_PHASE_BUILD, ret);
     if (ret) {
         LOGD(ERROR, domid, "cannot (re-)build domain: %d", ret);
         ret = ERROR_FAIL;
@@ -1250,6 +1310,7 @@ static void domcreate_rebuild_done(libxl__egc *egc,
 
     store_libxl_entry(gc, domid, &d_config->b_info);
 
+    domcreate_phase_begin(dcs, LIBXL_DOMAIN_CREATE_PHASE_DISKS);
     libxl__multidev_begin(ao, &dcs->multidev);
     dcs->multidev.callback = domcreate_launch_dm;
     libxl__add_disks(egc, ao, domid, d_config, &dcs->multidev);
@@ -1274,6 +1335,7 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
     libxl_domain_config *const d_config = dcs->guest_config;
     libxl__domain_build_state *const state = &dcs->build_state;
 
+    domcreate_phase_end(egc, dcs, LIBXL_DOMAIN_CREATE_PHASE_DISKS, ret);
     if (ret) {
         LOGD(ERROR, domid, "unable to add disk devices");
         goto error_out;
@@ -1372,7 +1434,10 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
         libxl__device_add(gc, domid, &libxl__vkb_devtype, &vkb);
         libxl_device_vkb_dispose(&vkb);
 
+        domcreate_attach_early_devices(egc, dcs);
+
         dcs->sdss.dm.guest_domid = domid;
+        domcreate_phase_begin(dcs, LIBXL_DOMAIN_CREATE_PHASE_DEVICE_MODEL);
         if (libxl_defbool_val(d_config->b_info.device_model_stubdomain))
             libxl__spawn_stub_dm(egc, &dcs->sdss);
         else
@@ -1383,9 +1448,7 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
          * the VGA framebuffer.
          */
         ret = libxl__grant_vga_iomem_permission(gc, domid, d_config);
-        if ( ret )
-            goto error_out;
-
+        domcreate_devices_stage_done(egc, dcs, ret);
         return;
     }
     case LIBXL_DOMAIN_TYPE_PV:
@@ -1416,15 +1479,20 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
         ret = libxl__need_xenpv_qemu(gc, d_config);
         if (ret < 0)
             goto error_out;
+
+        domcreate_attach_early_devices(egc, dcs);
+
         if (ret) {
             dcs->sdss.dm.guest_domid = domid;
+            domcreate_phase_begin(dcs,
+                                  LIBXL_DOMAIN_CREATE_PHASE_DEVICE_MODEL);
             libxl__spawn_local_dm(egc, &dcs->sdss.dm);
-            return;
         } else {
             assert(!dcs->sdss.dm.guest_domid);
             domcreate_devmodel_started(egc, &dcs->sdss.dm, 0);
-            return;
         }
+        domcreate_devices_stage_done(egc, dcs, 0);
+        return;
     }
     default:
         ret = ERROR_INVAL;
@@ -1480,6 +1548,80 @@ const struct libxl_device_type *device_type_tbl[] = {
     NULL
 };
 
+/*
+ * Can devices of type dt be attached while the device model starts?  The
+ * hotplug script of an HVM guest's nic also has to set up the tap device
+ * of the emulated nic, which only exists once qemu runs.
+ */
+static bool device_type_attach_early(const struct libxl_device_type *dt,
+                                     const libxl_domain_config *d_config)
+{
+    if (dt->attach_late)
+        return false;
+    if (dt == &libxl__nic_devtype &&
+        d_config->c_info.type == LIBXL_DOMAIN_TYPE_HVM)
+        return false;
+    return true;
+}
+
+static void domcreate_early_devices_attached(libxl__egc *egc,
+                                             libxl__multidev *multidev,
+                                             int ret)
+{
+    libxl__domain_create_state *dcs = CONTAINER_OF(multidev, *dcs, multidev);
+    STATE_AO_GC(dcs->ao);
+
+    if (ret)
+        LOGD(ERROR, dcs->guest_domid, "unable to add devices");
+
+    domcreate_phase_end(egc, dcs, LIBXL_DOMAIN_CREATE_PHASE_DEVICES, ret);
+    domcreate_devices_stage_done(egc, dcs, ret);
+}
+
+static void domcreate_attach_early_devices(libxl__egc *egc,
+                                           libxl__domain_create_state *dcs)
+{
+    STATE_AO_GC(dcs->ao);
+    libxl_domain_config *const d_config = dcs->guest_config;
+    const struct libxl_device_type *dt;
+    int i;
+
+    /* The device model, these devices and domcreate_launch_dm. */
+    dcs->devices_pending = 3;
+    dcs->devices_rc = 0;
+
+    domcreate_phase_begin(dcs, LIBXL_DOMAIN_CREATE_PHASE_DEVICES);
+    libxl__multidev_begin(ao, &dcs->multidev);
+    dcs->multidev.callback = domcreate_early_devices_attached;
+    for (i = 0; (dt = device_type_tbl[i]); i++) {
+        if (*libxl__device_type_get_num(dt, d_config) > 0 &&
+            !dt->skip_attach && device_type_attach_early(dt, d_config))
+            dt->add(egc, ao, dcs->guest_domid, d_config, &dcs->multidev);
+    }
+    libxl__multidev_prepared(egc, &dcs->multidev, 0);
+}
+
+static void domcreate_devices_stage_done(libxl__egc *egc,
+                                         libxl__domain_create_state *dcs,
+                                         int rc)
+{
+    assert(dcs->devices_pending > 0);
+
+    if (rc && !dcs->devices_rc)
+        dcs->devices_rc = rc;
+    if (--dcs->devices_pending)
+        return;
+
+    if (dcs->devices_rc) {
+        domcreate_complete(egc, dcs, dcs->devices_rc);
+        return;
+    }
+
+    domcreate_phase_begin(dcs, LIBXL_DOMAIN_CREATE_PHASE_DM_DEVICES);
+    dcs->device_type_idx = -1;
+    domcreate_attach_devices(egc, &dcs->multidev, 0);
+}
+
 static void domcreate_attach_devices(libxl__egc *egc,
                                      libxl__multidev *multidev,
                                      int ret)
@@ -1499,7 +1641,8 @@ static void domcreate_attach_devices(libxl__egc *egc,
     dcs->device_type_idx++;
     dt = device_type_tbl[dcs->device_type_idx];
     if (dt) {
-        if (*libxl__device_type_get_num(dt, d_config) > 0 && !dt->skip_attach) {
+        if (*libxl__device_type_get_num(dt, d_config) > 0 &&
+            !dt->skip_attach && !device_type_attach_early(dt, d_config)) {
             /* Attach devices */
             libxl__multidev_begin(ao, &dcs->multidev);
             dcs->multidev.callback = domcreate_attach_devices;
@@ -1512,6 +1655,8 @@ static void domcreate_attach_devices(libxl__egc *egc,
         return;
     }
 
+    domcreate_phase_end(egc, dcs, LIBXL_DOMAIN_CREATE_PHASE_DM_DEVICES, 0);
+
     domcreate_console_available(egc, dcs);
 
     domcreate_complete(egc, dcs, 0);
@@ -1520,6 +1665,7 @@ static void domcreate_attach_devices(libxl__egc *egc,
 
 error_out:
     assert(ret);
+    domcreate_phase_end(egc, dcs, LIBXL_DOMAIN_CREATE_PHASE_DM_DEVICES, ret);
     domcreate_complete(egc, dcs, ret);
 }
 
@@ -1534,9 +1680,10 @@ static void domcreate_devmodel_started(libxl__egc *egc,
     /* convenience aliases */
     libxl_domain_config *const d_config = dcs->guest_config;
 
+    domcreate_phase_end(egc, dcs, LIBXL_DOMAIN_CREATE_PHASE_DEVICE_MODEL, ret);
     if (ret) {
         LOGD(ERROR, domid, "device model did not start: %d", ret);
-        goto error_out;
+        goto out;
     }
 
     if (dcs->sdss.dm.guest_domid) {
@@ -1546,13 +1693,8 @@ static void domcreate_devmodel_started(libxl__egc *egc,
         }
     }
 
-    dcs->device_type_idx = -1;
-    domcreate_attach_devices(egc, &dcs->multidev, 0);
-    return;
-
-error_out:
-    assert(ret);
-    domcreate_complete(egc, dcs, ret);
+out:
+    domcreate_devices_stage_done(egc, dcs, ret);
 }
 
 static void domcreate_complete(libxl__egc *egc,
@@ -1620,6 +1762,46 @@ static void domcreate_destruction_cb(libxl__egc *egc,
 
 /*----- application-facing domain creation interface -----*/
 
+int libxl_evenable_domain_create_phase(libxl_ctx *ctx, libxl_ev_user user,
+                        libxl_evgen_domain_create_phase **evgen_out)
+{
+    GC_INIT(ctx);
+    libxl_evgen_domain_create_phase *evg;
+    int rc;
+
+    CTX_LOCK;
+
+    evg = malloc(sizeof(*evg));  if (!evg) { rc = ERROR_NOMEM; goto out; }
+    memset(evg, 0, sizeof(*evg));
+    evg->user = user;
+    LIBXL_LIST_INSERT_HEAD(&CTX->create_phase_evgens, evg, entry);
+
+    *evgen_out = evg;
+    rc = 0;
+
+ out:
+    CTX_UNLOCK;
+    GC_FREE;
+    return rc;
+}
+
+void libxl__evdisable_domain_create_phase(libxl__gc *gc,
+                                     libxl_evgen_domain_create_phase *evg)
+{
+    CTX_LOCK;
+    LIBXL_LIST_REMOVE(evg, entry);
+    free(evg);
+    CTX_UNLOCK;
+}
+
+void libxl_evdisable_domain_create_phase(libxl_ctx *ctx,
+                                         libxl_evgen_domain_create_phase *evg)
+{
+    GC_INIT(ctx);
+    libxl__evdisable_domain_create_phase(gc, evg);
+    GC_FREE;
+}
+
 typedef struct {
     libxl__domain_create_state dcs;
     uint32_t *domid_out;
@@ -1656,6 +1838,8 @@ static int do_domain_create(libxl_ctx *ctx, libxl_domain_config *d_config,
     cdcs->dcs.send_back_fd = send_back_fd;
     if (restore_fd > -1) {
         cdcs->dcs.restore_params = *params;
+        libxl_defbool_setdefault(&cdcs->dcs.restore_params.direct_page_data,
+                                 false);
         rc = libxl__fd_flags_modify_save(gc, cdcs->dcs.restore_fd,
                                          ~(O_NONBLOCK|O_NDELAY), 0,
                                          &cdcs->dcs.restore_fdfl);
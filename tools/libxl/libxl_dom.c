@@ -111,9 +111,16 @@ out:
  * Two NUMA placement candidates are compared by means of the following
  * heuristics:
 
+ *  - how busy the cpus of the candidates are right now is considered, in
+ *    steps of NUMA_BUSY_STEP percent (so that noise does not matter), and
+ *    the less busy candidate is preferred. If two candidates are as busy,
  *  - the number of vcpus runnable on the candidates is considered, and
  *    candidates with fewer of them are preferred. If two candidate have
  *    the same number of runnable vcpus,
+ *  - the memory bandwidth and then the LLC occupancy of the domains
+ *    running on the candidates, when platform QoS monitoring provides
+ *    them, are considered, and the candidate with less of them is
+ *    preferred. If they are the same (e.g., because not available),
  *  - the amount of free memory in the candidates is considered, and the
  *    candidate with greater amount of it is preferred.
  *
@@ -127,12 +134,23 @@ out:
  * as the fact that fewer nodes is better is already accounted for in the
  * algorithm.
  */
+#define NUMA_BUSY_STEP 20
+
 static int numa_cmpf(const libxl__numa_candidate *c1,
                      const libxl__numa_candidate *c2)
 {
+    if (c1->busy_pct / NUMA_BUSY_STEP != c2->busy_pct / NUMA_BUSY_STEP)
+        return c1->busy_pct / NUMA_BUSY_STEP - c2->busy_pct / NUMA_BUSY_STEP;
+
     if (c1->nr_vcpus != c2->nr_vcpus)
         return c1->nr_vcpus - c2->nr_vcpus;
 
+    if (c1->membw_kbps != c2->membw_kbps)
+        return c1->membw_kbps < c2->membw_kbps ? -1 : 1;
+
+    if (c1->llc_kb != c2->llc_kb)
+        return c1->llc_kb < c2->llc_kb ? -1 : 1;
+
     return c2->free_memkb - c1->free_memkb;
 }
 
@@ -260,6 +278,14 @@ static int hvm_set_viridian_features(libxl__gc *gc, uint32_t domid,
         goto err;
     }
 
+    /* Synthetic timers are delivered via SynIC and count reference time */
+    if (libxl_bitmap_test(&enlightenments, LIBXL_VIRIDIAN_ENLIGHTENMENT_STIMER) &&
+        (!libxl_bitmap_test(&enlightenments, LIBXL_VIRIDIAN_ENLIGHTENMENT_SYNIC) ||
+         !libxl_bitmap_test(&enlightenments, LIBXL_VIRIDIAN_ENLIGHTENMENT_TIME_REF_COUNT))) {
+        LOG(ERROR, "stimer group requires synic and time_ref_count groups");
+        goto err;
+    }
+
     libxl_for_each_set_bit(v, enlightenments)
         LOG(DETAIL, "%s group enabled", libxl_viridian_enlightenment_to_string(v));
 
@@ -285,6 +311,12 @@ static int hvm_set_viridian_features(libxl__gc *gc, uint32_t domid,
     if (libxl_bitmap_test(&enlightenments, LIBXL_VIRIDIAN_ENLIGHTENMENT_CRASH_CTL))
         mask |= HVMPV_crash_ctl;
 
+    if (libxl_bitmap_test(&enlightenments, LIBXL_VIRIDIAN_ENLIGHTENMENT_SYNIC))
+        mask |= HVMPV_synic;
+
+    if (libxl_bitmap_test(&enlightenments, LIBXL_VIRIDIAN_ENLIGHTENMENT_STIMER))
+        mask |= HVMPV_stimer;
+
     if (mask != 0 &&
         xc_hvm_param_set(CTX->xch,
                          domid,
@@ -1141,6 +1173,59 @@ out:
     return rc;
 }
 
+/*
+ * Build a PVH domain as a copy-on-write clone of a paused template built
+ * with the same configuration: no kernel is loaded, memory is shared and
+ * vCPU state copied.  The memory map comes from the template's userdata.
+ */
+static int hvm_build_clone(libxl__gc *gc, uint32_t domid,
+                           libxl_domain_config *d_config,
+                           libxl__domain_build_state *state)
+{
+    libxl_domain_build_info *const info = &d_config->b_info;
+    const uint32_t template = info->template_domid;
+    uint8_t *e820;
+    int e820_len, rc;
+
+    if (info->type != LIBXL_DOMAIN_TYPE_PVH) {
+        LOGD(ERROR, domid, "only PVH domains can be built from a template");
+        return ERROR_INVAL;
+    }
+
+    rc = libxl__userdata_retrieve(gc, template, "e820", &e820, &e820_len);
+    if (rc)
+        return rc;
+    if (!e820_len) {
+        LOGD(ERROR, domid, "domain %u is not a PVH template", template);
+        return ERROR_INVAL;
+    }
+
+    if (xc_domain_clone(CTX->xch, template, domid)) {
+        LOGED(ERROR, domid, "cloning domain %u failed", template);
+        return ERROR_FAIL;
+    }
+
+    if (xc_domain_set_memory_map(CTX->xch, domid, (struct e820entry *)e820,
+                                 e820_len / sizeof(struct e820entry))) {
+        LOGED(ERROR, domid, "setting domain memory map failed");
+        return ERROR_FAIL;
+    }
+
+    /* A clone can serve as a template in turn. */
+    rc = libxl__userdata_store(gc, domid, "e820", e820, e820_len);
+    if (rc)
+        return rc;
+
+    rc = hvm_build_set_params(CTX->xch, domid, info, state->store_port,
+                              &state->store_mfn, state->console_port,
+                              &state->console_mfn, state->store_domid,
+                              state->console_domid);
+    if (rc)
+        LOGD(ERROR, domid, "hvm build set params failed");
+
+    return rc;
+}
+
 int libxl__build_hvm(libxl__gc *gc, uint32_t domid,
               libxl_domain_config *d_config,
               libxl__domain_build_state *state)
@@ -1152,6 +1237,9 @@ int libxl__build_hvm(libxl__gc *gc, uint32_t domid,
     struct xc_dom_image *dom = NULL;
     bool device_model = info->type == LIBXL_DOMAIN_TYPE_HVM ? true : false;
 
+    if (info->template_domid)
+        return hvm_build_clone(gc, domid, d_config, state);
+
     xc_dom_loginit(ctx->xch);
 
     dom = xc_dom_allocate(ctx->xch, info->type == LIBXL_DOMAIN_TYPE_PVH ?
@@ -1351,6 +1439,8 @@ void libxl__userdata_destroyall(libxl__gc *gc, uint32_t domid)
     glob_t gl;
     int r, i;
 
+    libxl__domain_config_cache_drop(CTX, domid);
+
     pattern = libxl__userdata_path(gc, domid, "*", "?");
     if (!pattern)
         goto out;
@@ -379,6 +379,10 @@ void libxl__domain_save(libxl__egc *egc, libxl__domain_save_state *dss)
 
     dss->xcflags = (live ? XCFLAGS_LIVE : 0)
           | (debug ? XCFLAGS_DEBUG : 0)
+          | (dss->pipeline ? XCFLAGS_PIPELINE : 0)
+          | (dss->compress ? XCFLAGS_COMPRESS : 0)
+          | (dss->auto_converge ? XCFLAGS_AUTO_CONVERGE : 0)
+          | (dss->image ? XCFLAGS_IMAGE : 0)
           | (dss->hvm ? XCFLAGS_HVM : 0);
 
     /* Disallow saving a guest with vNUMA configured because migration
@@ -396,7 +400,7 @@ void libxl__domain_save(libxl__egc *egc, libxl__domain_save_state *dss)
         goto out;
     }
 
-    if (dss->checkpointed_stream == LIBXL_CHECKPOINTED_STREAM_REMUS) {
+    if (dss->checkpointed_stream != LIBXL_CHECKPOINTED_STREAM_NONE) {
         if (libxl_defbool_val(r_info->compression))
             dss->xcflags |= XCFLAGS_CHECKPOINT_COMPRESS;
     }
@@ -408,19 +408,10 @@ int libxl_domain_remus_start(libxl_ctx *ctx, libxl_domain_remus_info *info,
 
     libxl_defbool_setdefault(&info->allow_unsafe, false);
     libxl_defbool_setdefault(&info->blackhole, false);
-    libxl_defbool_setdefault(&info->compression,
-                             !libxl_defbool_val(info->colo));
+    libxl_defbool_setdefault(&info->compression, true);
     libxl_defbool_setdefault(&info->netbuf, true);
     libxl_defbool_setdefault(&info->diskbuf, true);
 
-    if (libxl_defbool_val(info->colo) &&
-        libxl_defbool_val(info->compression)) {
-            LOGD(ERROR, domid, "Cannot use memory checkpoint "
-                        "compression in COLO mode");
-            rc = ERROR_FAIL;
-            goto out;
-    }
-
     if (!libxl_defbool_val(info->allow_unsafe) &&
         (libxl_defbool_val(info->blackhole) ||
          !libxl_defbool_val(info->netbuf) ||
@@ -509,6 +500,10 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
     dss->type = type;
     dss->live = flags & LIBXL_SUSPEND_LIVE;
     dss->debug = flags & LIBXL_SUSPEND_DEBUG;
+    dss->pipeline = flags & LIBXL_SUSPEND_PIPELINE;
+    dss->compress = flags & LIBXL_SUSPEND_COMPRESS;
+    dss->auto_converge = flags & LIBXL_SUSPEND_AUTO_CONVERGE;
+    dss->image = flags & LIBXL_SUSPEND_IMAGE;
     dss->checkpointed_stream = LIBXL_CHECKPOINTED_STREAM_NONE;
 
     rc = libxl__fd_flags_modify_save(gc, dss->fd,
@@ -1243,6 +1238,7 @@ libxl_vcpuinfo *libxl_list_vcpu(libxl_ctx *ctx, uint32_t domid,
         ptr->online = !!vcpuinfo.online;
         ptr->blocked = !!vcpuinfo.blocked;
         ptr->running = !!vcpuinfo.running;
+        ptr->waiting = !!vcpuinfo.waiting;
         ptr->vcpu_time = vcpuinfo.cpu_time;
     }
     GC_FREE;
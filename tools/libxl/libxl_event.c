@@ -169,6 +169,23 @@ static void osevent_hook_failed_noop(libxl__gc *gc, void *ev,
                                      libxl__osevent_hook_nexus **nexus) { }
 
 
+/*
+ * The leader poller, if any, is the only one of the event loop
+ * threads waiting for efds and etimes, so it needs a kick when they
+ * change under it.
+ */
+static void poller_leader_poke(libxl__gc *gc)
+{
+    libxl__poller *leader = CTX->poller_leader;
+    int e;
+
+    if (!leader || !leader->in_poll)
+        return;
+
+    e = libxl__self_pipe_wakeup(leader->wakeup_pipe[1]);
+    if (e) LOGEV(ERROR, e, "cannot poke event loop leader");
+}
+
 /*
  * fd events
  */
@@ -194,6 +211,7 @@ int libxl__ev_fd_register(libxl__gc *gc, libxl__ev_fd *ev,
     ev->func = func;
 
     LIBXL_LIST_INSERT_HEAD(&CTX->efds, ev, entry);
+    poller_leader_poke(gc);
 
     rc = 0;
 
@@ -215,6 +233,7 @@ int libxl__ev_fd_modify(libxl__gc *gc, libxl__ev_fd *ev, short events)
     if (rc) goto out;
 
     ev->events = events;
+    poller_leader_poke(gc);
 
     rc = 0;
  out:
@@ -313,6 +332,8 @@ static int time_register_finite(libxl__gc *gc, libxl__ev_time *ev,
     ev->abs = absolute;
     LIBXL_TAILQ_INSERT_SORTED(&CTX->etimes, entry, ev, evsearch, /*empty*/,
                               timercmp(&ev->abs, &evsearch->abs, >));
+    if (LIBXL_TAILQ_FIRST(&CTX->etimes) == ev)
+        poller_leader_poke(gc);
 
     return 0;
 }
@@ -1010,6 +1031,8 @@ static int beforepoll_internal(libxl__gc *gc, libxl__poller *poller,
 {
     libxl__ev_fd *efd;
     int rc;
+    bool follower = CTX->poller_leader && poller != CTX->poller_leader &&
+                    poller != CTX->poller_app;
 
     /*
      * We need to look at the fds we want twice: firstly, to count
@@ -1034,8 +1057,9 @@ static int beforepoll_internal(libxl__gc *gc, libxl__poller *poller,
 
 #define REQUIRE_FDS(BODY) do{                                          \
                                                                        \
-        LIBXL_LIST_FOREACH(efd, &CTX->efds, entry)                     \
-            REQUIRE_FD(efd->fd, efd->events, BODY);                    \
+        if (!follower)                                                 \
+            LIBXL_LIST_FOREACH(efd, &CTX->efds, entry)                 \
+                REQUIRE_FD(efd->fd, efd->events, BODY);                \
                                                                        \
         REQUIRE_FD(poller->wakeup_pipe[0], POLLIN, BODY);              \
                                                                        \
@@ -1110,7 +1134,7 @@ static int beforepoll_internal(libxl__gc *gc, libxl__poller *poller,
 
     poller->fds_changed = 0;
 
-    libxl__ev_time *etime = LIBXL_TAILQ_FIRST(&CTX->etimes);
+    libxl__ev_time *etime = follower ? NULL : LIBXL_TAILQ_FIRST(&CTX->etimes);
     if (etime) {
         int our_timeout;
         struct timeval rel;
@@ -1603,6 +1627,7 @@ int libxl__poller_init(libxl__gc *gc, libxl__poller *p)
     p->fd_polls = 0;
     p->fd_rindices = 0;
     p->fds_changed = 0;
+    p->in_poll = 0;
 
     rc = libxl__pipe_nonblock(CTX, p->wakeup_pipe);
     if (rc) goto out;
@@ -1649,6 +1674,22 @@ void libxl__poller_put(libxl_ctx *ctx, libxl__poller *p)
     if (!p) return;
     LIBXL_LIST_REMOVE(p, fds_changed_entry);
     LIBXL_LIST_INSERT_HEAD(&ctx->pollers_idle, p, entry);
+
+    if (p == ctx->poller_leader) {
+        /* Hand over to a follower, which takes the lead when it
+         * next goes round eventloop_iteration. */
+        libxl__poller *follower;
+
+        ctx->poller_leader = NULL;
+        LIBXL_LIST_FOREACH(follower, &ctx->pollers_fds_changed,
+                           fds_changed_entry) {
+            if (!follower->in_poll)
+                continue;
+            if (libxl__self_pipe_wakeup(follower->wakeup_pipe[1]))
+                continue;
+            break;
+        }
+    }
 }
 
 void libxl__poller_wakeup(libxl__egc *egc, libxl__poller *p)
@@ -1664,11 +1705,23 @@ void libxl__poller_wakeup(libxl__egc *egc, libxl__poller *p)
 static int eventloop_iteration(libxl__egc *egc, libxl__poller *poller) {
     /* The CTX must be locked EXACTLY ONCE so that this function
      * can unlock it when it polls.
+     *
+     * When several threads are in here at once, only one of them, the
+     * leader, polls the efds and runs the etimes.  Otherwise every
+     * thread would wake for every fd event, and all but one would then
+     * find nothing to do after fighting for the ctx lock.  The others
+     * wait on their wakeup pipes only, which are poked when their ao
+     * completes or (for libxl_event_wait) when an event occurs.  The
+     * first thread to come through here with no leader takes the lead,
+     * and keeps it until its poller is put.
      */
     EGC_GC;
     int rc, nfds;
     struct timeval now;
-    
+
+    if (!CTX->poller_leader)
+        CTX->poller_leader = poller;
+
     rc = libxl__gettimeofday(gc, &now);
     if (rc) goto out;
 
@@ -1692,9 +1745,11 @@ static int eventloop_iteration(libxl__egc *egc, libxl__poller *poller) {
         poller->fd_polls_allocd = nfds;
     }
 
+    poller->in_poll = 1;
     CTX_UNLOCK;
     rc = poll(poller->fd_polls, nfds, timeout);
     CTX_LOCK;
+    poller->in_poll = 0;
 
     if (rc < 0) {
         if (errno == EINTR)
@@ -1727,6 +1782,7 @@ int libxl_event_wait(libxl_ctx *ctx, libxl_event **event_r,
 
     poller = libxl__poller_get(gc);
     if (!poller) { rc = ERROR_FAIL; goto out; }
+    LIBXL_LIST_INSERT_HEAD(&CTX->pollers_event, poller, entry);
 
     for (;;) {
         rc = event_check_internal(egc, event_r, typemask, pred, pred_user);
@@ -1746,7 +1802,10 @@ int libxl_event_wait(libxl_ctx *ctx, libxl_event **event_r,
     }
 
  out:
-    libxl__poller_put(ctx, poller);
+    if (poller) {
+        LIBXL_LIST_REMOVE(poller, entry);
+        libxl__poller_put(ctx, poller);
+    }
 
     CTX_UNLOCK;
     EGC_FREE;
@@ -194,6 +194,20 @@ void libxl_evdisable_disk_eject(libxl_ctx *ctx, libxl_evgen_disk_eject*);
    * member of event.u.
    */
 
+typedef struct libxl__evgen_domain_create_phase
+    libxl_evgen_domain_create_phase;
+int libxl_evenable_domain_create_phase(libxl_ctx *ctx, libxl_ev_user,
+                        libxl_evgen_domain_create_phase **evgen_out);
+void libxl_evdisable_domain_create_phase(libxl_ctx *ctx,
+                                         libxl_evgen_domain_create_phase*);
+  /* Arranges for the generation of DOMAIN_CREATE_PHASE events.  One is
+   * generated whenever a phase of creating a domain with this ctx
+   * finishes, giving the time the phase took in microseconds and its
+   * result.  The device model is started while the devices which do not
+   * depend on it are attached, so the DEVICE_MODEL and DEVICES phases
+   * overlap.
+   */
+
 
 /*======================================================================*/
 
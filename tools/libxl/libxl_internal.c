@@ -493,12 +493,113 @@ void libxl__unlock_domain_userdata(libxl__domain_userdata_lock *lock)
     free(lock);
 }
 
+/* Bound on the number of parsed configurations kept per ctx. */
+#define DOMAIN_CONFIG_CACHE_MAX 1024
+
+static void domain_config_cache_free(libxl_ctx *ctx,
+                                     libxl__domain_config_cache_entry *e)
+{
+    LIBXL_TAILQ_REMOVE(&ctx->dconfig_cache, e, entry);
+    ctx->dconfig_cache_count--;
+    libxl_domain_config_dispose(&e->d_config);
+    free(e);
+}
+
+void libxl__domain_config_cache_drop(libxl_ctx *ctx, uint32_t domid)
+{
+    libxl__domain_config_cache_entry *e, *tmp;
+
+    libxl__ctx_lock(ctx);
+    LIBXL_TAILQ_FOREACH_SAFE(e, &ctx->dconfig_cache, entry, tmp)
+        if (domid == INVALID_DOMID || e->domid == domid)
+            domain_config_cache_free(ctx, e);
+    libxl__ctx_unlock(ctx);
+}
+
+static bool domain_config_cache_matches(libxl__domain_config_cache_entry *e,
+                                        uint32_t domid,
+                                        const struct stat *st)
+{
+    return e->domid == domid &&
+           e->dev == st->st_dev && e->ino == st->st_ino &&
+           e->size == st->st_size &&
+           e->mtime.tv_sec == st->st_mtim.tv_sec &&
+           e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/*
+ * The userdata store replaces "libxl-json" by renaming a new file over
+ * it, so a change by any process shows up as a new inode; the size and
+ * mtime are compared as well in case an inode number is recycled.
+ */
+static bool domain_config_cache_get(libxl__gc *gc, uint32_t domid,
+                                    const struct stat *st,
+                                    libxl_domain_config *d_config)
+{
+    libxl__domain_config_cache_entry *e;
+    bool hit = false;
+
+    CTX_LOCK;
+    LIBXL_TAILQ_FOREACH(e, &CTX->dconfig_cache, entry) {
+        if (e->domid != domid)
+            continue;
+        if (!domain_config_cache_matches(e, domid, st)) {
+            domain_config_cache_free(CTX, e);
+            break;
+        }
+        libxl_domain_config_copy(CTX, d_config, &e->d_config);
+        LIBXL_TAILQ_REMOVE(&CTX->dconfig_cache, e, entry);
+        LIBXL_TAILQ_INSERT_HEAD(&CTX->dconfig_cache, e, entry);
+        hit = true;
+        break;
+    }
+    CTX_UNLOCK;
+
+    return hit;
+}
+
+static void domain_config_cache_put(libxl__gc *gc, uint32_t domid,
+                                    const struct stat *st,
+                                    const libxl_domain_config *d_config)
+{
+    libxl__domain_config_cache_entry *e;
+
+    e = libxl__zalloc(NOGC, sizeof(*e));
+    e->domid = domid;
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->size = st->st_size;
+    e->mtime = st->st_mtim;
+    libxl_domain_config_init(&e->d_config);
+    libxl_domain_config_copy(CTX, &e->d_config, d_config);
+
+    CTX_LOCK;
+    libxl__domain_config_cache_drop(CTX, domid);
+    LIBXL_TAILQ_INSERT_HEAD(&CTX->dconfig_cache, e, entry);
+    if (++CTX->dconfig_cache_count > DOMAIN_CONFIG_CACHE_MAX)
+        domain_config_cache_free(CTX,
+            LIBXL_TAILQ_LAST(&CTX->dconfig_cache, libxl__dconfig_cache));
+    CTX_UNLOCK;
+}
+
 int libxl__get_domain_configuration(libxl__gc *gc, uint32_t domid,
                                     libxl_domain_config *d_config)
 {
     uint8_t *data = NULL;
+    const char *path;
+    struct stat st;
+    bool cacheable;
     int rc, len;
 
+    /*
+     * Stat before reading: if the file is replaced in between, the entry
+     * we add is keyed on the old identity and simply never matches.
+     */
+    path = libxl__userdata_path(gc, domid, "libxl-json", "d");
+    cacheable = path && !stat(path, &st);
+    if (cacheable && domain_config_cache_get(gc, domid, &st, d_config))
+        return 0;
+
     rc = libxl__userdata_retrieve(gc, domid, "libxl-json", &data, &len);
     if (rc) {
         LOGEVD(ERROR, rc, domid,
@@ -513,6 +614,8 @@ int libxl__get_domain_configuration(libxl__gc *gc, uint32_t domid,
         goto out;
     }
     rc = libxl_domain_config_from_json(CTX, d_config, (const char *)data);
+    if (!rc && cacheable)
+        domain_config_cache_put(gc, domid, &st, d_config);
 
 out:
     free(data);
@@ -533,6 +636,8 @@ int libxl__set_domain_configuration(libxl__gc *gc, uint32_t domid,
         goto out;
     }
 
+    libxl__domain_config_cache_drop(CTX, domid);
+
     rc = libxl__userdata_store(gc, domid, "libxl-json",
                                (const uint8_t *)d_config_json,
                                strlen(d_config_json) + 1 /* include '\0' */);
@@ -383,6 +383,14 @@ struct libxl__evgen_disk_eject {
 _hidden void
 libxl__evdisable_disk_eject(libxl__gc*, libxl_evgen_disk_eject*);
 
+struct libxl__evgen_domain_create_phase {
+    LIBXL_LIST_ENTRY(libxl_evgen_domain_create_phase) entry;
+    libxl_ev_user user;
+};
+_hidden void
+libxl__evdisable_domain_create_phase(libxl__gc*,
+                                     libxl_evgen_domain_create_phase*);
+
 typedef struct libxl__poller libxl__poller;
 struct libxl__poller {
     /*
@@ -425,6 +433,8 @@ struct libxl__poller {
      */
     LIBXL_LIST_ENTRY(libxl__poller) fds_changed_entry;
     bool fds_changed;
+
+    bool in_poll; /* between eventloop_iteration's unlock and relock */
 };
 
 struct libxl__gc {
@@ -434,6 +444,38 @@ struct libxl__gc {
     libxl_ctx *owner;
 };
 
+/*
+ * Parsed "libxl-json" userdata, kept so that repeated retrievals of a
+ * domain's configuration need not reparse it.  An entry is only used
+ * while the identity of the file it was parsed from is unchanged; see
+ * libxl__get_domain_configuration.
+ */
+typedef struct libxl__domain_config_cache_entry
+    libxl__domain_config_cache_entry;
+struct libxl__domain_config_cache_entry {
+    LIBXL_TAILQ_ENTRY(libxl__domain_config_cache_entry) entry;
+    uint32_t domid;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    libxl_domain_config d_config;
+};
+
+/* Cached domain name; see libxl_utils.c:domname_get */
+typedef struct libxl__domname_entry libxl__domname_entry;
+struct libxl__domname_entry {
+    LIBXL_SLIST_ENTRY(libxl__domname_entry) next;
+    uint32_t domid;
+    char token[24];
+    char *name;
+    libxl_uuid uuid;
+    bool have_uuid;
+    bool armed; /* xenstore's initial event for the watch has arrived */
+    bool stale;
+};
+#define LIBXL__DOMNAME_CACHE_BUCKETS 256
+
 struct libxl__ctx {
     xentoollog_logger *lg;
     xc_interface *xch;
@@ -467,6 +509,10 @@ struct libxl__ctx {
     libxl__poller *poller_app; /* libxl_osevent_beforepoll and _afterpoll */
     LIBXL_LIST_HEAD(, libxl__poller) pollers_event, pollers_idle;
     LIBXL_LIST_HEAD(, libxl__poller) pollers_fds_changed;
+    libxl__poller *poller_leader;
+      /* Of the pollers used by eventloop_iteration, only the leader
+       * waits for efds and etimes; the others wait just for their
+       * wakeup pipes.  See libxl_event.c:eventloop_iteration. */
 
     LIBXL_SLIST_HEAD(libxl__osevent_hook_nexi, libxl__osevent_hook_nexus)
         hook_fd_nexi_idle, hook_timeout_nexi_idle;
@@ -492,6 +538,8 @@ struct libxl__ctx {
     
     LIBXL_LIST_HEAD(, libxl_evgen_disk_eject) disk_eject_evgens;
 
+    LIBXL_LIST_HEAD(, libxl_evgen_domain_create_phase) create_phase_evgens;
+
     const libxl_childproc_hooks *childproc_hooks;
     void *childproc_user;
     int sigchld_selfpipe[2]; /* [0]==-1 means handler not installed */
@@ -501,6 +549,21 @@ struct libxl__ctx {
     LIBXL_LIST_ENTRY(libxl_ctx) sigchld_users_entry;
 
     libxl_version_info version_info;
+
+    LIBXL_TAILQ_HEAD(libxl__dconfig_cache, libxl__domain_config_cache_entry)
+        dconfig_cache;
+    int dconfig_cache_count;
+
+    struct xs_handle *domname_xsh;
+    bool domname_cache_failed;
+    unsigned long *domname_asked; /* bitmap, see domname_asked_before */
+    unsigned int domname_serial;
+    LIBXL_SLIST_HEAD(, libxl__domname_entry)
+        domname_cache[LIBXL__DOMNAME_CACHE_BUCKETS];
+
+    /* Idle QMP connections, see libxl_qmp.c:qmp_pool_get */
+    LIBXL_LIST_HEAD(, struct libxl__qmp_handler) qmp_pool;
+    int qmp_pool_count;
 };
 
 /*
@@ -1709,6 +1772,7 @@ _hidden char *libxl__abs_path(libxl__gc *gc, const char *s, const char *path);
 #define LIBXL__LOG_ERROR   XTL_ERROR
 
 _hidden char *libxl__domid_to_name(libxl__gc *gc, uint32_t domid);
+_hidden void libxl__domname_cache_free(libxl_ctx *ctx);
 _hidden char *libxl__cpupoolid_to_name(libxl__gc *gc, uint32_t poolid);
 
 _hidden int libxl__enum_from_string(const libxl_enum_string_table *t,
@@ -1758,6 +1822,24 @@ _hidden char *libxl__blktap_devpath(libxl__gc *gc,
  */
 _hidden int libxl__device_destroy_tapdisk(libxl__gc *gc, const char *params);
 
+/* libxl__device_mirror_tapdisk:
+ *   Starts copying the disk served by the tapdisk for params onto mirror
+ *   (type:/path, e.g. vhd:/new/disk.vhd) while the guest keeps running.
+ *   The tapdisk switches over to mirror by itself once the copy is
+ *   complete.  Always logs on failure.
+ */
+_hidden int libxl__device_mirror_tapdisk(libxl__gc *gc, const char *params,
+                                         const char *mirror);
+
+/* libxl__device_mirror_tapdisk_status:
+ *   Sets *done once the tapdisk for params has switched over to its
+ *   mirror.  Fails if the mirror failed or none was started.
+ *   Always logs on failure.
+ */
+_hidden int libxl__device_mirror_tapdisk_status(libxl__gc *gc,
+                                                const char *params,
+                                                int *done);
+
 /* Calls poll() again - useful to check whether a signaled condition
  * is still true.  Cannot fail.  Returns currently-true revents. */
 _hidden short libxl__fd_poll_recheck(libxl__egc *egc, int fd, short events);
@@ -1851,6 +1933,9 @@ _hidden void libxl__qmp_close(libxl__qmp_handler *qmp);
 /* remove the socket file, if the file has already been removed,
  * nothing happen */
 _hidden void libxl__qmp_cleanup(libxl__gc *gc, uint32_t domid);
+/* close the idle pooled QMP connections to domid, or to every domain
+ * if domid is INVALID_DOMID */
+_hidden void libxl__qmp_pool_flush(libxl_ctx *ctx, uint32_t domid);
 
 /* this helper calls qmp_initialize, query_serial and qmp_close */
 _hidden int libxl__qmp_initializations(libxl__gc *gc, uint32_t domid,
@@ -1899,6 +1984,9 @@ typedef struct libxl__json_object {
         flexarray_t *map;
     } u;
     struct libxl__json_object *parent;
+    /* JSON_MAP only: index just past the last node matched by
+     * libxl__json_map_get, where the next lookup starts. */
+    int map_cursor;
 } libxl__json_object;
 
 typedef int (*libxl__json_parse_callback)(libxl__gc *gc,
@@ -3055,6 +3143,18 @@ struct libxl__remus_state {
     char *netbufscript;
     struct nl_sock *nlsock;
     struct nl_cache *qdisc_cache;
+    /*
+     * postsuspend/commit ops on the nics are collected here and sent to
+     * the kernel as one netlink batch once all netbuf_nics have arrived.
+     */
+    int netbuf_nics;
+    int netbuf_batch_len;
+    struct libxl__remus_device_nic *netbuf_batch;
+    /* buffered-packet latency statistics, reported at cleanup */
+    struct timeval netbuf_epoch_start;
+    uint64_t netbuf_epochs;
+    uint64_t netbuf_hold_us_total, netbuf_hold_us_max;
+    uint64_t netbuf_op_us_total;
 
     /* private for drbd disk subkind ops */
     char *drbd_probe_script;
@@ -3284,6 +3384,10 @@ struct libxl__domain_save_state {
     libxl_domain_type type;
     int live;
     int debug;
+    int pipeline;
+    int compress;
+    int auto_converge;
+    int image;
     int checkpointed_stream;
     const libxl_domain_remus_info *remus;
     /* private */
@@ -3512,6 +3616,7 @@ struct libxl_device_type {
     char *type;
     char *entry;
     int skip_attach;   /* Skip entry in domcreate_attach_devices() if 1 */
+    int attach_late;   /* Attach only once the device model runs if 1 */
     int ptr_offset;    /* Offset of device array ptr in libxl_domain_config */
     int num_offset;    /* Offset of # of devices in libxl_domain_config */
     int dev_elem_size; /* Size of one device element in array */
@@ -3752,6 +3857,10 @@ struct libxl__domain_create_state {
     /* private to domain_create */
     int guest_domid;
     int device_type_idx;
+    /* device model and devices attached meanwhile still pending */
+    int devices_pending;
+    int devices_rc;
+    struct timeval phase_start[LIBXL_DOMAIN_CREATE_PHASE_DM_DEVICES + 1];
     const char *colo_proxy_script;
     libxl__domain_build_state build_state;
     libxl__colo_restore_state crs;
@@ -4009,6 +4118,9 @@ typedef struct {
     int nr_cpus, nr_nodes;
     int nr_vcpus;
     uint64_t free_memkb;
+    /* Live load, sampled right before placement (0 when unknown) */
+    int busy_pct;
+    uint64_t llc_kb, membw_kbps;
     libxl_bitmap nodemap;
 } libxl__numa_candidate;
 
@@ -4060,6 +4172,8 @@ static inline void libxl__numa_candidate_init(libxl__numa_candidate *cndt)
 {
     cndt->free_memkb = 0;
     cndt->nr_cpus = cndt->nr_nodes = cndt->nr_vcpus = 0;
+    cndt->busy_pct = 0;
+    cndt->llc_kb = cndt->membw_kbps = 0;
     libxl_bitmap_init(&cndt->nodemap);
 }
 
@@ -4254,6 +4368,9 @@ int libxl__get_domain_configuration(libxl__gc *gc, uint32_t domid,
                                     libxl_domain_config *d_config);
 int libxl__set_domain_configuration(libxl__gc *gc, uint32_t domid,
                                     libxl_domain_config *d_config);
+/* Drop any cached configuration for domid, or for all domains if
+ * domid is INVALID_DOMID.  Takes the CTX_LOCK. */
+void libxl__domain_config_cache_drop(libxl_ctx *ctx, uint32_t domid);
 
 /* ------ Things related to updating domain configurations ----- */
 void libxl__update_domain_configuration(libxl__gc *gc,
@@ -588,16 +588,27 @@ const libxl__json_object *libxl__json_map_get(const char *key,
                                           libxl__json_node_type expected_type)
 {
     flexarray_t *maps = NULL;
-    int idx = 0;
+    int idx = 0, n;
 
     if (libxl__json_object_is_map(o)) {
         libxl__json_map_node *node = NULL;
 
+        /*
+         * The generated parsers ask for the fields of a struct in the
+         * same order as the generators emit them, so searching on from
+         * the previous match normally finds the key at once rather than
+         * after a scan of the whole map.  The cursor is only a hint, hence
+         * writing it through a const object.
+         */
         maps = o->u.map;
-        for (idx = 0; idx < maps->count; idx++) {
+        idx = o->map_cursor;
+        for (n = 0; n < maps->count; n++, idx++) {
+            if (idx >= maps->count)
+                idx = 0;
             if (flexarray_get(maps, idx, (void**)&node) != 0)
                 return NULL;
             if (strcmp(key, node->map_key) == 0) {
+                ((libxl__json_object *)o)->map_cursor = idx + 1;
                 if (expected_type == JSON_ANY
                     || (node->obj && (node->obj->type & expected_type))) {
                     return node->obj;
@@ -31,6 +31,10 @@ typedef struct libxl__remus_device_nic {
     const char *vif;
     const char *ifb;
     struct rtnl_qdisc *qdisc;
+
+    libxl__checkpoint_device *dev;
+    /* next nic waiting in rs->netbuf_batch */
+    struct libxl__remus_device_nic *batch_next;
 } libxl__remus_device_nic;
 
 int libxl__netbuffer_enabled(libxl__gc *gc)
@@ -46,6 +50,13 @@ int init_subkind_nic(libxl__checkpoint_devices_state *cds)
 
     STATE_AO_GC(cds->ao);
 
+    rs->netbuf_nics = 0;
+    rs->netbuf_batch_len = 0;
+    rs->netbuf_batch = NULL;
+    rs->netbuf_epochs = 0;
+    rs->netbuf_hold_us_total = rs->netbuf_hold_us_max = 0;
+    rs->netbuf_op_us_total = 0;
+
     rs->nlsock = nl_socket_alloc();
     if (!rs->nlsock) {
         LOGD(ERROR, dss->domid, "cannot allocate nl socket");
@@ -89,6 +100,15 @@ void cleanup_subkind_nic(libxl__checkpoint_devices_state *cds)
 
     STATE_AO_GC(cds->ao);
 
+    if (rs->netbuf_epochs)
+        LOGD(DEBUG, cds->domid,
+             "Remus: %"PRIu64" epochs released on %d vifs, buffered packets"
+             " held avg %"PRIu64"us max %"PRIu64"us, netlink avg %"PRIu64"us",
+             rs->netbuf_epochs, rs->netbuf_nics,
+             rs->netbuf_hold_us_total / rs->netbuf_epochs,
+             rs->netbuf_hold_us_max,
+             rs->netbuf_op_us_total / rs->netbuf_epochs);
+
     /* free qdisc cache */
     if (rs->qdisc_cache) {
         nl_cache_clear(rs->qdisc_cache);
@@ -301,6 +321,7 @@ static void nic_setup(libxl__egc *egc, libxl__checkpoint_device *dev)
     int rc;
     libxl__remus_device_nic *remus_nic;
     const libxl_device_nic *nic = dev->backend_dev;
+    libxl__remus_state *rs = dev->cds->concrete_data;
 
     STATE_AO_GC(dev->cds->ao);
 
@@ -309,9 +330,11 @@ static void nic_setup(libxl__egc *egc, libxl__checkpoint_device *dev)
      * with nic devices
      */
     dev->matched = true;
+    rs->netbuf_nics++;
 
     GCNEW(remus_nic);
     dev->concrete_data = remus_nic;
+    remus_nic->dev = dev;
     remus_nic->devid = nic->devid;
     remus_nic->vif = get_vifname(dev, nic);
     if (!remus_nic->vif) {
@@ -451,66 +474,129 @@ enum {
 
 /* API implementations */
 
-static int remus_netbuf_op(libxl__remus_device_nic *remus_nic,
+static uint64_t tv_delta_us(const struct timeval *from,
+                            const struct timeval *to)
+{
+    return (uint64_t)(to->tv_sec - from->tv_sec) * 1000000 +
+           to->tv_usec - from->tv_usec;
+}
+
+/*
+ * Apply buffer_op to every nic in the batch. All the qdisc change
+ * requests are written to the netlink socket back to back, and only then
+ * are their acks collected, so the kernel round trip is paid once per
+ * checkpoint rather than once per vif.
+ */
+static int remus_netbuf_op(libxl__remus_device_nic *batch,
                            libxl__checkpoint_devices_state *cds,
                            int buffer_op)
 {
-    int rc, ret;
+    int rc = 0, ret = 0, sent = 0;
     libxl__remus_state *rs = cds->concrete_data;
+    libxl__remus_device_nic *remus_nic, *failed = NULL;
+    struct nl_msg *msg;
 
     STATE_AO_GC(cds->ao);
 
-    if (buffer_op == tc_buffer_start)
-        ret = rtnl_qdisc_plug_buffer(remus_nic->qdisc);
-    else
-        ret = rtnl_qdisc_plug_release_one(remus_nic->qdisc);
-
-    if (ret) {
-        rc = ERROR_FAIL;
-        goto out;
+    for (remus_nic = batch; remus_nic; remus_nic = remus_nic->batch_next) {
+        if (buffer_op == tc_buffer_start)
+            ret = rtnl_qdisc_plug_buffer(remus_nic->qdisc);
+        else
+            ret = rtnl_qdisc_plug_release_one(remus_nic->qdisc);
+        if (!ret)
+            ret = rtnl_qdisc_build_add_request(remus_nic->qdisc,
+                                               NLM_F_REQUEST, &msg);
+        if (!ret) {
+            /* returns the number of bytes sent on success */
+            ret = nl_send_auto(rs->nlsock, msg);
+            nlmsg_free(msg);
+        }
+        if (ret < 0) {
+            rc = ERROR_FAIL;
+            failed = remus_nic;
+            break;
+        }
+        sent++;
     }
 
-    ret = rtnl_qdisc_add(rs->nlsock, remus_nic->qdisc, NLM_F_REQUEST);
-    if (ret) {
-        rc = ERROR_FAIL;
-        goto out;
-    }
+    /* Acks arrive in request order; drain all of them even on error. */
+    for (remus_nic = batch; sent; remus_nic = remus_nic->batch_next, sent--) {
+        int ack = nl_wait_for_ack(rs->nlsock);
 
-    rc = 0;
+        if (ack && !rc) {
+            rc = ERROR_FAIL;
+            failed = remus_nic;
+            ret = ack;
+        }
+    }
 
-out:
     if (rc)
         LOGD(ERROR, cds-> domid, "Remus: cannot do netbuf op %s on %s:%s",
              ((buffer_op == tc_buffer_start) ?
              "start_new_epoch" : "release_prev_epoch"),
-             remus_nic->ifb, nl_geterror(ret));
+             failed->ifb, nl_geterror(ret));
     return rc;
 }
 
-static void nic_postsuspend(libxl__egc *egc, libxl__checkpoint_device *dev)
+/*
+ * Queue dev for buffer_op; once every nic has checked in, run the whole
+ * batch and complete all of the queued devices.
+ */
+static void nic_batch_op(libxl__egc *egc, libxl__checkpoint_device *dev,
+                         int buffer_op)
 {
     int rc;
-    libxl__remus_device_nic *remus_nic = dev->concrete_data;
+    libxl__remus_device_nic *remus_nic = dev->concrete_data, *next;
+    libxl__checkpoint_devices_state *cds = dev->cds;
+    libxl__remus_state *rs = cds->concrete_data;
+    struct timeval start, now;
 
-    STATE_AO_GC(dev->cds->ao);
+    STATE_AO_GC(cds->ao);
 
-    rc = remus_netbuf_op(remus_nic, dev->cds, tc_buffer_start);
+    remus_nic->batch_next = rs->netbuf_batch;
+    rs->netbuf_batch = remus_nic;
+    if (++rs->netbuf_batch_len < rs->netbuf_nics)
+        return;
 
-    dev->aodev.rc = rc;
-    dev->aodev.callback(egc, &dev->aodev);
+    remus_nic = rs->netbuf_batch;
+    rs->netbuf_batch = NULL;
+    rs->netbuf_batch_len = 0;
+
+    rc = libxl__gettimeofday(gc, &start);
+    if (!rc)
+        rc = remus_netbuf_op(remus_nic, cds, buffer_op);
+    if (!rc && !libxl__gettimeofday(gc, &now)) {
+        if (buffer_op == tc_buffer_start) {
+            /* packets sent from now on are held until the next commit */
+            rs->netbuf_epoch_start = now;
+        } else if (rs->netbuf_epoch_start.tv_sec) {
+            uint64_t hold = tv_delta_us(&rs->netbuf_epoch_start, &now);
+
+            rs->netbuf_epochs++;
+            rs->netbuf_hold_us_total += hold;
+            if (hold > rs->netbuf_hold_us_max)
+                rs->netbuf_hold_us_max = hold;
+            rs->netbuf_op_us_total += tv_delta_us(&start, &now);
+        }
+    }
+
+    /* the last callback may complete the multidev, so fetch next first */
+    for (; remus_nic; remus_nic = next) {
+        next = remus_nic->batch_next;
+        remus_nic->batch_next = NULL;
+        remus_nic->dev->aodev.rc = rc;
+        remus_nic->dev->aodev.callback(egc, &remus_nic->dev->aodev);
+    }
 }
 
-static void nic_commit(libxl__egc *egc, libxl__checkpoint_device *dev)
+static void nic_postsuspend(libxl__egc *egc, libxl__checkpoint_device *dev)
 {
-    int rc;
-    libxl__remus_device_nic *remus_nic = dev->concrete_data;
-
-    STATE_AO_GC(dev->cds->ao);
-
-    rc = remus_netbuf_op(remus_nic, dev->cds, tc_buffer_release);
+    nic_batch_op(egc, dev, tc_buffer_start);
+}
 
-    dev->aodev.rc = rc;
-    dev->aodev.callback(egc, &dev->aodev);
+static void nic_commit(libxl__egc *egc, libxl__checkpoint_device *dev)
+{
+    nic_batch_op(egc, dev, tc_buffer_release);
 }
 
 const libxl__checkpoint_device_instance_ops remus_device_nic = {
@@ -33,6 +33,18 @@ int libxl__device_destroy_tapdisk(libxl__gc *gc, const char *params)
     return 0;
 }
 
+int libxl__device_mirror_tapdisk(libxl__gc *gc, const char *params,
+                                 const char *mirror)
+{
+    return ERROR_NI;
+}
+
+int libxl__device_mirror_tapdisk_status(libxl__gc *gc, const char *params,
+                                        int *done)
+{
+    return ERROR_NI;
+}
+
 /*
  * Local variables:
  * mode: C
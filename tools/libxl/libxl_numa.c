@@ -104,6 +104,16 @@ static int comb_next(comb_iter_t it, int n, int k)
 
 /* NUMA automatic placement (see libxl_internal.h for details) */
 
+/*
+ * Up to this many suitable nodes, all the combinations of them are tried.
+ * Beyond, the number of combinations explodes, and candidates are instead
+ * grown around each node in turn, adding the closest nodes first.
+ */
+#define NUMA_EXHAUSTIVE_NODES   6
+
+/* How long the live load of the nodes is sampled for */
+#define NUMA_LOAD_SAMPLE_MS     100
+
 /*
  * This function turns a k-combination iterator into a node map,
  * given another map, telling us which nodes should be considered.
@@ -136,6 +146,224 @@ static void comb_get_nodemap(comb_iter_t it, libxl_bitmap *suitable_nodemap,
     }
 }
 
+/*
+ * For each suitable node (the seed), the suitable nodes ordered by their
+ * distance from it, the seed first.  Ties go to the node with more free
+ * memory.  order[] has room for n * n entries, n being the number of
+ * suitable nodes.
+ */
+static void nodes_by_distance(libxl_numainfo *ninfo,
+                              const libxl_bitmap *suitable_nodemap,
+                              int n, int order[])
+{
+    int snodes[n];
+    int s, i, j, m = 0;
+
+    libxl_for_each_set_bit(i, *suitable_nodemap)
+        snodes[m++] = i;
+
+    for (s = 0; s < n; s++) {
+        const libxl_numainfo *seed = &ninfo[snodes[s]];
+        int *o = &order[s * n];
+
+        o[0] = snodes[s];
+        for (m = 1, i = 0; i < n; i++) {
+            int node = snodes[i];
+            uint32_t dist;
+
+            if (i == s)
+                continue;
+
+            /* Insertion sort, n is small enough. */
+            dist = node < seed->num_dists ? seed->dists[node] : 0;
+            for (j = m; j > 1; j--) {
+                int prev = o[j - 1];
+                uint32_t pdist = prev < seed->num_dists ?
+                                 seed->dists[prev] : 0;
+
+                if (pdist < dist ||
+                    (pdist == dist && ninfo[prev].free >= ninfo[node].free))
+                    break;
+                o[j] = prev;
+            }
+            o[j] = node;
+            m++;
+        }
+    }
+}
+
+/*
+ * Candidate generation: either all the k-combinations of the suitable
+ * nodes, or, per seed node, the seed and its k - 1 closest nodes.
+ */
+typedef struct {
+    bool exhaustive;
+    comb_iter_t comb;
+    int seed;
+    int *order;
+} cndt_iter_t;
+
+static void seed_get_nodemap(cndt_iter_t *it, int n, libxl_bitmap *nodemap,
+                             int k)
+{
+    int i;
+
+    libxl_bitmap_set_none(nodemap);
+    for (i = 0; i < k; i++)
+        libxl_bitmap_set(nodemap, it->order[it->seed * n + i]);
+}
+
+static int cndt_init(libxl__gc *gc, cndt_iter_t *it,
+                     libxl_bitmap *suitable_nodemap, libxl_bitmap *nodemap,
+                     int n, int k)
+{
+    if (it->exhaustive) {
+        if (!comb_init(gc, &it->comb, n, k))
+            return 0;
+        comb_get_nodemap(it->comb, suitable_nodemap, nodemap, k);
+        return 1;
+    }
+
+    if (n < k)
+        return 0;
+    it->seed = 0;
+    seed_get_nodemap(it, n, nodemap, k);
+    return 1;
+}
+
+static int cndt_next(cndt_iter_t *it, libxl_bitmap *suitable_nodemap,
+                     libxl_bitmap *nodemap, int n, int k)
+{
+    if (it->exhaustive) {
+        if (!comb_next(it->comb, n, k))
+            return 0;
+        comb_get_nodemap(it->comb, suitable_nodemap, nodemap, k);
+        return 1;
+    }
+
+    if (++it->seed >= n)
+        return 0;
+    seed_get_nodemap(it, n, nodemap, k);
+    return 1;
+}
+
+/*
+ * Live load of a node, sampled over NUMA_LOAD_SAMPLE_MS: how busy its cpus
+ * are and, as far as the domains attached to platform QoS monitoring tell,
+ * how much of its LLC they occupy and how much memory bandwidth they use.
+ */
+struct node_load {
+    int cpus;
+    int busy_pct;
+    uint64_t llc_kb;
+    uint64_t membw_kbps;
+};
+
+static void nodes_live_load(libxl__gc *gc, libxl_cputopology *tinfo,
+                            int nr_cpus, int nr_nodes,
+                            struct node_load load[])
+{
+    xc_cpuinfo_t *before, *after;
+    int nr_before = 0, nr_after = 0;
+    libxl_dominfo *dinfo = NULL;
+    int nr_doms = 0, nr_sockets = 0, i, s;
+    int *socket_node = NULL;
+    uint64_t *mbm = NULL, *busy_ns, wall_ns;
+    struct timeval t0, t1;
+    bool cmt, mbm_ok = false;
+
+    GCNEW_ARRAY(before, nr_cpus);
+    GCNEW_ARRAY(after, nr_cpus);
+    GCNEW_ARRAY(busy_ns, nr_nodes);
+
+    /* Sockets hold the LLC and memory controller; map them to nodes. */
+    for (i = 0; i < nr_cpus; i++)
+        if (tinfo[i].socket != LIBXL_CPUTOPOLOGY_INVALID_ENTRY &&
+            tinfo[i].socket >= nr_sockets)
+            nr_sockets = tinfo[i].socket + 1;
+    GCNEW_ARRAY(socket_node, nr_sockets);
+    for (s = 0; s < nr_sockets; s++)
+        socket_node[s] = -1;
+    for (i = 0; i < nr_cpus; i++)
+        if (tinfo[i].socket != LIBXL_CPUTOPOLOGY_INVALID_ENTRY &&
+            tinfo[i].node < nr_nodes && socket_node[tinfo[i].socket] < 0)
+            socket_node[tinfo[i].socket] = tinfo[i].node;
+
+    cmt = libxl_psr_cmt_enabled(CTX);
+    if (cmt) {
+        dinfo = libxl_list_domain(CTX, &nr_doms);
+        if (!dinfo)
+            cmt = false;
+    }
+    if (cmt &&
+        libxl_psr_cmt_type_supported(CTX, LIBXL_PSR_CMT_TYPE_TOTAL_MEM_COUNT)) {
+        mbm_ok = true;
+        GCNEW_ARRAY(mbm, nr_doms * nr_sockets);
+        for (i = 0; i < nr_doms; i++) {
+            if (!libxl_psr_cmt_domain_attached(CTX, dinfo[i].domid))
+                continue;
+            for (s = 0; s < nr_sockets; s++)
+                if (socket_node[s] >= 0)
+                    libxl_psr_cmt_get_sample(CTX, dinfo[i].domid,
+                                    LIBXL_PSR_CMT_TYPE_TOTAL_MEM_COUNT, s,
+                                    &mbm[i * nr_sockets + s], NULL);
+        }
+    }
+
+    if (xc_getcpuinfo(CTX->xch, nr_cpus, before, &nr_before) ||
+        libxl__gettimeofday(gc, &t0))
+        goto psr;
+    usleep(NUMA_LOAD_SAMPLE_MS * 1000);
+    if (xc_getcpuinfo(CTX->xch, nr_cpus, after, &nr_after) ||
+        libxl__gettimeofday(gc, &t1))
+        goto psr;
+
+    wall_ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL +
+              (t1.tv_usec - t0.tv_usec) * 1000LL;
+    if (!wall_ns)
+        goto psr;
+
+    for (i = 0; i < nr_before && i < nr_after; i++) {
+        uint64_t idle = after[i].idletime - before[i].idletime;
+        int node = tinfo[i].node;
+
+        if (node >= nr_nodes)
+            continue;
+        busy_ns[node] += wall_ns - (idle < wall_ns ? idle : wall_ns);
+        load[node].cpus++;
+    }
+    for (i = 0; i < nr_nodes; i++)
+        if (load[i].cpus)
+            load[i].busy_pct = busy_ns[i] * 100 / (load[i].cpus * wall_ns);
+
+ psr:
+    for (i = 0; cmt && i < nr_doms; i++) {
+        if (!libxl_psr_cmt_domain_attached(CTX, dinfo[i].domid))
+            continue;
+        for (s = 0; s < nr_sockets; s++) {
+            uint64_t sample;
+            int node = socket_node[s];
+
+            if (node < 0)
+                continue;
+            if (!libxl_psr_cmt_get_sample(CTX, dinfo[i].domid,
+                                          LIBXL_PSR_CMT_TYPE_CACHE_OCCUPANCY,
+                                          s, &sample, NULL))
+                load[node].llc_kb += sample / 1024;
+            if (mbm_ok &&
+                !libxl_psr_cmt_get_sample(CTX, dinfo[i].domid,
+                                          LIBXL_PSR_CMT_TYPE_TOTAL_MEM_COUNT,
+                                          s, &sample, NULL) &&
+                sample > mbm[i * nr_sockets + s])
+                load[node].membw_kbps += (sample - mbm[i * nr_sockets + s]) /
+                                         1024 * 1000 / NUMA_LOAD_SAMPLE_MS;
+        }
+    }
+
+    if (dinfo)
+        libxl_dominfo_list_free(dinfo, nr_doms);
+}
+
 /* Retrieve the number of cpus that the nodes that are part of the nodemap
  * span and are also set in suitable_cpumap. */
 static int nodemap_to_nr_cpus(libxl_cputopology *tinfo, int nr_cpus,
@@ -165,6 +393,23 @@ static uint32_t nodemap_to_free_memkb(libxl_numainfo *ninfo,
     return free_memkb;
 }
 
+/* Accumulate the live load of the nodes in nodemap into cndt */
+static void nodemap_to_load(const struct node_load load[],
+                            const libxl_bitmap *nodemap,
+                            libxl__numa_candidate *cndt)
+{
+    int i, cpus = 0, busy = 0;
+
+    cndt->llc_kb = cndt->membw_kbps = 0;
+    libxl_for_each_set_bit(i, *nodemap) {
+        cpus += load[i].cpus;
+        busy += load[i].busy_pct * load[i].cpus;
+        cndt->llc_kb += load[i].llc_kb;
+        cndt->membw_kbps += load[i].membw_kbps;
+    }
+    cndt->busy_pct = cpus ? busy / cpus : 0;
+}
+
 /* Retrieve the number of vcpus able to run on the nodes in nodemap */
 static int nodemap_to_nr_vcpus(libxl__gc *gc, int vcpus_on_node[],
                                const libxl_bitmap *nodemap)
@@ -316,6 +561,8 @@ int libxl__get_numa_candidate(libxl__gc *gc,
     libxl_numainfo *ninfo = NULL;
     int nr_nodes = 0, nr_suit_nodes, nr_cpus = 0;
     libxl_bitmap suitable_nodemap, nodemap;
+    struct node_load *load;
+    cndt_iter_t cndt_iter = { .order = NULL };
     int *vcpus_on_node, rc = 0;
 
     libxl_bitmap_init(&nodemap);
@@ -333,32 +580,7 @@ int libxl__get_numa_candidate(libxl__gc *gc,
     }
 
     GCNEW_ARRAY(vcpus_on_node, nr_nodes);
-
-    /*
-     * The good thing about this solution is that it is based on heuristics
-     * (implemented in numa_cmpf() ), but we at least can evaluate it on
-     * all the possible placement candidates. That can happen because the
-     * number of nodes present in current NUMA systems is quite small.
-     * In fact, even if a sum of binomials is involved, if the system has
-     * up to 16 nodes it "only" takes 65535 steps. This is fine, as the
-     * number of nodes the biggest NUMA systems provide at the time of this
-     * writing is 8 (and it will probably continue to be so for a while).
-     * However, computanional complexity would explode on systems bigger
-     * than that, and it's really important we avoid trying to run this
-     * on monsters with 32, 64 or more nodes (if they ever pop into being).
-     * Therefore, here it comes a safety catch that disables the algorithm
-     * for the cases when it wouldn't work well.
-     */
-    if (nr_nodes > 16) {
-        /* Log we did nothing and return 0, as no real error occurred */
-        LOG(WARN, "System has %d NUMA nodes, which is too big for the "
-                  "placement algorithm to work effectively: skipping it. "
-                  "Consider manually pinning the vCPUs and/or looking at "
-                  "cpupools for manually partitioning the system.",
-                  nr_nodes);
-        *cndt_found = 0;
-        goto out;
-    }
+    GCNEW_ARRAY(load, nr_nodes);
 
     tinfo = libxl_get_cpu_topology(CTX, &nr_cpus);
     if (tinfo == NULL) {
@@ -395,6 +617,12 @@ int libxl__get_numa_candidate(libxl__gc *gc,
     if (rc)
         goto out;
 
+    /*
+     * Same for the live load of the nodes. This is only a hint for
+     * numa_cmpf(), so failing to get (part of) it is not an error.
+     */
+    nodes_live_load(gc, tinfo, nr_cpus, nr_nodes, load);
+
     /*
      * If the minimum number of NUMA nodes is not explicitly specified
      * (i.e., min_nodes == 0), we try to figure out a sensible number of nodes
@@ -432,8 +660,25 @@ int libxl__get_numa_candidate(libxl__gc *gc,
         goto out;
 
     /*
-     * Consider all the combinations with sizes in [min_nodes, max_nodes]
-     * (see comb_init() and comb_next()). Note that, since the fewer the
+     * The good thing about this solution is that it is based on heuristics
+     * (implemented in numa_cmpf() ), but we at least can evaluate it on
+     * all the possible placement candidates, as long as there are only a
+     * few suitable nodes. On bigger systems the sum of binomials explodes,
+     * so candidates are built around each suitable node instead, by
+     * adding its closest nodes first (see nodes_by_distance()). That is
+     * O(n^2) candidates in total, and the ones made of nodes far apart,
+     * that the exhaustive search would have considered, would lose anyway.
+     */
+    cndt_iter.exhaustive = nr_suit_nodes <= NUMA_EXHAUSTIVE_NODES;
+    if (!cndt_iter.exhaustive) {
+        GCNEW_ARRAY(cndt_iter.order, nr_suit_nodes * nr_suit_nodes);
+        nodes_by_distance(ninfo, &suitable_nodemap, nr_suit_nodes,
+                          cndt_iter.order);
+    }
+
+    /*
+     * Consider the candidates with sizes in [min_nodes, max_nodes]
+     * (see cndt_init() and cndt_next()). Note that, since the fewer the
      * number of nodes the better, it is guaranteed that any candidate
      * found during the i-eth step will be better than any other one we
      * could find during the (i+1)-eth and all the subsequent steps (they
@@ -442,8 +687,7 @@ int libxl__get_numa_candidate(libxl__gc *gc,
      */
     *cndt_found = 0;
     while (min_nodes <= max_nodes && *cndt_found == 0) {
-        comb_iter_t comb_iter;
-        int comb_ok;
+        int cndt_ok;
 
         /*
          * And here it is. Each step of this cycle generates a combination of
@@ -452,17 +696,14 @@ int libxl__get_numa_candidate(libxl__gc *gc,
          * amount of free memory and number of cpus) and it can concur to
          * become our best placement iff it passes the check.
          */
-        for (comb_ok = comb_init(gc, &comb_iter, nr_suit_nodes, min_nodes);
-             comb_ok;
-             comb_ok = comb_next(comb_iter, nr_suit_nodes, min_nodes)) {
+        for (cndt_ok = cndt_init(gc, &cndt_iter, &suitable_nodemap, &nodemap,
+                                 nr_suit_nodes, min_nodes);
+             cndt_ok;
+             cndt_ok = cndt_next(&cndt_iter, &suitable_nodemap, &nodemap,
+                                 nr_suit_nodes, min_nodes)) {
             uint64_t nodes_free_memkb;
             int nodes_cpus;
 
-            /* Get the nodemap for the combination, only considering
-             * suitable nodes. */
-            comb_get_nodemap(comb_iter, &suitable_nodemap,
-                             &nodemap, min_nodes);
-
             /* If there is not enough memory in this combination, skip it
              * and go generating the next one... */
             nodes_free_memkb = nodemap_to_free_memkb(ninfo, &nodemap);
@@ -485,6 +726,7 @@ int libxl__get_numa_candidate(libxl__gc *gc,
             new_cndt.free_memkb = nodes_free_memkb;
             new_cndt.nr_nodes = libxl_bitmap_count_set(&nodemap);
             new_cndt.nr_cpus = nodes_cpus;
+            nodemap_to_load(load, &nodemap, &new_cndt);
 
             /*
              * Check if the new candidate we is better the what we found up
@@ -497,15 +739,21 @@ int libxl__get_numa_candidate(libxl__gc *gc,
 
                 LOG(DEBUG, "New best NUMA placement candidate found: "
                            "nr_nodes=%d, nr_cpus=%d, nr_vcpus=%d, "
-                           "free_memkb=%"PRIu64"", new_cndt.nr_nodes,
-                           new_cndt.nr_cpus, new_cndt.nr_vcpus,
-                           new_cndt.free_memkb / 1024);
+                           "free_memkb=%"PRIu64", busy=%d%%, "
+                           "llc_kb=%"PRIu64", membw_kbps=%"PRIu64"",
+                           new_cndt.nr_nodes, new_cndt.nr_cpus,
+                           new_cndt.nr_vcpus, new_cndt.free_memkb / 1024,
+                           new_cndt.busy_pct, new_cndt.llc_kb,
+                           new_cndt.membw_kbps);
 
                 libxl__numa_candidate_put_nodemap(gc, cndt_out, &nodemap);
                 cndt_out->nr_vcpus = new_cndt.nr_vcpus;
                 cndt_out->free_memkb = new_cndt.free_memkb;
                 cndt_out->nr_nodes = new_cndt.nr_nodes;
                 cndt_out->nr_cpus = new_cndt.nr_cpus;
+                cndt_out->busy_pct = new_cndt.busy_pct;
+                cndt_out->llc_kb = new_cndt.llc_kb;
+                cndt_out->membw_kbps = new_cndt.membw_kbps;
 
                 if (numa_cmpf == NULL)
                     break;
@@ -428,6 +428,190 @@ void libxl_psr_cat_info_list_free(libxl_psr_cat_info *list, int nr)
     free(list);
 }
 
+/*
+ * The protected domains get more ways when they fill this much of their
+ * partition, and give one back when they would still fit in this much of
+ * the partition one way smaller.
+ */
+#define PSR_PROTECT_GROW_PCT    90
+#define PSR_PROTECT_SHRINK_PCT  50
+
+static bool libxl__psr_domid_in(uint32_t domid, const uint32_t *domids,
+                                int nr_domids)
+{
+    int i;
+
+    for (i = 0; i < nr_domids; i++)
+        if (domids[i] == domid)
+            return true;
+
+    return false;
+}
+
+static const xc_psr_cmt_sample_t *libxl__psr_find_sample(
+    uint32_t domid, const xc_psr_cmt_sample_t *samples, uint32_t num)
+{
+    uint32_t i;
+
+    for (i = 0; i < num; i++)
+        if (samples[i].domid == domid)
+            return &samples[i];
+
+    return NULL;
+}
+
+/* Set the L3 CBM of 'domid' on 'socketid', unless it already is 'cbm'. */
+static int libxl__psr_cat_update(libxl__gc *gc, uint32_t domid,
+                                 uint32_t socketid, uint64_t cbm)
+{
+    uint64_t cur;
+
+    if (!xc_psr_cat_get_domain_data(CTX->xch, domid, XC_PSR_CAT_L3_CBM,
+                                    socketid, &cur) && cur == cbm)
+        return 0;
+
+    if (xc_psr_cat_set_domain_data(CTX->xch, domid, XC_PSR_CAT_L3_CBM,
+                                   socketid, cbm)) {
+        /* The domain may have gone away meanwhile. */
+        if (errno == ESRCH)
+            return 0;
+        libxl__psr_cat_log_err_msg(gc, errno);
+        return ERROR_FAIL;
+    }
+
+    return 0;
+}
+
+int libxl_psr_cat_protect(libxl_ctx *ctx, uint32_t socketid,
+                          const uint32_t *domids, int nr_domids,
+                          unsigned int interval_ms, unsigned int *ways)
+{
+    GC_INIT(ctx);
+    uint32_t cos_max, cbm_len, l3_kb, total_rmid, n0, n1;
+    bool cdp_enabled;
+    xc_psr_cmt_sample_t *s0, *s1;
+    const xc_psr_cmt_sample_t *p0, *p1;
+    uint64_t tsc0, tsc1, occupancy = 0, other_bw = 0;
+    uint64_t way_bytes, prot_cbm, other_cbm;
+    unsigned int new_ways;
+    libxl_dominfo *dominfo = NULL;
+    int i, nr_doms = 0, rc;
+
+    if (nr_domids <= 0 || !interval_ms) {
+        rc = ERROR_INVAL;
+        goto out;
+    }
+
+    if (xc_psr_cat_get_info(ctx->xch, socketid, 3, &cos_max, &cbm_len,
+                            &cdp_enabled)) {
+        libxl__psr_cat_log_err_msg(gc, errno);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+    if (cdp_enabled || cbm_len < 2) {
+        LOG(ERROR, "L3 CAT on socket %u can't be split", socketid);
+        rc = ERROR_INVAL;
+        goto out;
+    }
+
+    for (i = 0; i < nr_domids; i++) {
+        if (libxl_psr_cmt_domain_attached(ctx, domids[i]))
+            continue;
+        rc = libxl_psr_cmt_attach(ctx, domids[i]);
+        if (rc)
+            goto out;
+    }
+
+    rc = libxl_psr_cmt_get_l3_cache_size(ctx, socketid, &l3_kb);
+    if (rc)
+        goto out;
+    way_bytes = (uint64_t)l3_kb * 1024 / cbm_len;
+
+    rc = libxl_psr_cmt_get_total_rmid(ctx, &total_rmid);
+    if (rc)
+        goto out;
+    s0 = libxl__calloc(gc, total_rmid, sizeof(*s0));
+    s1 = libxl__calloc(gc, total_rmid, sizeof(*s1));
+
+    /* Bandwidth is the difference of two samples 'interval_ms' apart. */
+    n0 = total_rmid;
+    if (xc_psr_cmt_get_samples(ctx->xch, socketid, &n0, s0, &tsc0)) {
+        libxl__psr_cmt_log_err_msg(gc, errno);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+    usleep(interval_ms * 1000);
+    n1 = total_rmid;
+    if (xc_psr_cmt_get_samples(ctx->xch, socketid, &n1, s1, &tsc1)) {
+        libxl__psr_cmt_log_err_msg(gc, errno);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+    n0 = min(n0, total_rmid);
+    n1 = min(n1, total_rmid);
+
+    for (i = 0; i < n1; i++) {
+        p1 = &s1[i];
+        if (libxl__psr_domid_in(p1->domid, domids, nr_domids)) {
+            if (p1->l3_occupancy != XEN_SYSCTL_PSR_CMT_SAMPLE_INVALID)
+                occupancy += p1->l3_occupancy;
+            continue;
+        }
+
+        p0 = libxl__psr_find_sample(p1->domid, s0, n0);
+        if (p0 &&
+            p0->total_mem_count != XEN_SYSCTL_PSR_CMT_SAMPLE_INVALID &&
+            p1->total_mem_count != XEN_SYSCTL_PSR_CMT_SAMPLE_INVALID &&
+            p1->total_mem_count > p0->total_mem_count)
+            other_bw += p1->total_mem_count - p0->total_mem_count;
+    }
+
+    /*
+     * Start from an even split.  Grow the protected partition while the
+     * protected domains fill it and other domains miss in the cache at the
+     * same time (if they aren't monitored, assume they do); shrink it when
+     * the protected domains would comfortably fit in one way less.
+     */
+    new_ways = *ways ? *ways : cbm_len / 2;
+    if (occupancy * 100 >= PSR_PROTECT_GROW_PCT * new_ways * way_bytes &&
+        (other_bw || n1 <= nr_domids))
+        new_ways++;
+    else if (new_ways > 1 &&
+             occupancy * 100 < PSR_PROTECT_SHRINK_PCT * (new_ways - 1) *
+                               way_bytes)
+        new_ways--;
+    new_ways = max(1U, min(new_ways, cbm_len - 1));
+
+    /* The protected domains get the high ways, everybody else the rest. */
+    prot_cbm = ((1ULL << new_ways) - 1) << (cbm_len - new_ways);
+    other_cbm = (1ULL << (cbm_len - new_ways)) - 1;
+
+    dominfo = libxl_list_domain(ctx, &nr_doms);
+    if (!dominfo) {
+        LOG(ERROR, "failed to list domains");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    for (i = 0; i < nr_doms; i++) {
+        bool prot = libxl__psr_domid_in(dominfo[i].domid, domids, nr_domids);
+
+        rc = libxl__psr_cat_update(gc, dominfo[i].domid, socketid,
+                                   prot ? prot_cbm : other_cbm);
+        if (rc)
+            goto out;
+    }
+
+    *ways = new_ways;
+    rc = 0;
+
+out:
+    if (dominfo)
+        libxl_dominfo_list_free(dominfo, nr_doms);
+    GC_FREE;
+    return rc;
+}
+
 /*
  * Local variables:
  * mode: C
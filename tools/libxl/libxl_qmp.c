@@ -41,6 +41,13 @@
  */
 
 #define QMP_RECEIVE_BUFFER_SIZE 4096
+/*
+ * QEMU serves one client at a time on a QMP socket, so an idle pooled
+ * connection holds off every other libxl user of that domain.  Keep
+ * connections only long enough to cover bursts of commands.
+ */
+#define QMP_POOL_MAX 16
+#define QMP_POOL_IDLE_SECS 2
 #define PCI_PT_QDEV_ID "pci-pt-%02x_%02x.%01x"
 
 typedef int (*qmp_callback_t)(libxl__qmp_handler *qmp,
@@ -75,6 +82,12 @@ struct libxl__qmp_handler {
 
     int last_id_used;
     LIBXL_STAILQ_HEAD(callback_list, callback_id_pair) callback_list;
+
+    /* set when the connection can no longer be trusted (I/O error,
+     * timeout, unparsable data); such handlers are never pooled */
+    bool broken;
+    time_t idle_since;
+    LIBXL_LIST_ENTRY(struct libxl__qmp_handler) pool_entry;
 };
 
 static int qmp_send(libxl__qmp_handler *qmp,
@@ -269,12 +282,10 @@ static void qmp_handle_error_response(libxl__gc *gc, libxl__qmp_handler *qmp,
     resp = libxl__json_map_get("desc", resp, JSON_STRING);
 
     if (pp) {
-        if (pp->callback) {
-            int rc = pp->callback(qmp, NULL, pp->opaque);
-            if (pp->context) {
-                pp->context->rc = rc;
-            }
-        }
+        if (pp->callback)
+            pp->callback(qmp, NULL, pp->opaque);
+        if (pp->context)
+            pp->context->rc = -1;
         if (pp->id == qmp->wait_for_id) {
             /* tell that the id have been processed */
             qmp->wait_for_id = 0;
@@ -441,20 +452,26 @@ static int qmp_next(libxl__gc *gc, libxl__qmp_handler *qmp)
         ret = select(qmp->qmp_fd + 1, &rfds, NULL, NULL, &timeout);
         if (ret == 0) {
             LOGD(ERROR, qmp->domid, "timeout");
+            qmp->broken = true;
             return -1;
         } else if (ret < 0) {
             if (errno == EINTR)
                 continue;
             LOGED(ERROR, qmp->domid, "Select error");
+            qmp->broken = true;
             return -1;
         }
 
         rd = read(qmp->qmp_fd, qmp->buffer, QMP_RECEIVE_BUFFER_SIZE);
         if (rd == 0) {
             LOGD(ERROR, qmp->domid, "Unexpected end of socket");
+            qmp->broken = true;
             return -1;
         } else if (rd < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
             LOGED(ERROR, qmp->domid, "Socket read error");
+            qmp->broken = true;
             return rd;
         }
         qmp->buffer[rd] = '\0';
@@ -491,6 +508,7 @@ static int qmp_next(libxl__gc *gc, libxl__qmp_handler *qmp)
                     rc = qmp_handle_response(gc, qmp, o);
                 } else {
                     LOGD(ERROR, qmp->domid, "Parse error of : %s", s);
+                    qmp->broken = true;
                     return -1;
                 }
 
@@ -575,12 +593,12 @@ static int qmp_send(libxl__qmp_handler *qmp,
         goto out;
     }
 
-    if (libxl_write_exactly(qmp->ctx, qmp->qmp_fd, buf, strlen(buf),
-                            "QMP command", "QMP socket"))
-        goto out;
-    if (libxl_write_exactly(qmp->ctx, qmp->qmp_fd, "\r\n", 2,
-                            "CRLF", "QMP socket"))
+    if (libxl_write_exactly(qmp->ctx, qmp->qmp_fd,
+                            GCSPRINTF("%s\r\n", buf), strlen(buf) + 2,
+                            "QMP command", "QMP socket")) {
+        qmp->broken = true;
         goto out;
+    }
 
     rc = qmp->last_id_used;
 out:
@@ -619,11 +637,136 @@ static int qmp_synchronous_send(libxl__qmp_handler *qmp, const char *cmd,
     return ret;
 }
 
+/*
+ * Wait for the replies to every command sent so far.  Commands are
+ * executed by QEMU in the order they are received, so callers may send
+ * several back to back with qmp_send and collect the results in one go,
+ * each in its own qmp_request_context.
+ */
+static int qmp_wait_all(libxl__gc *gc, libxl__qmp_handler *qmp)
+{
+    while (!LIBXL_STAILQ_EMPTY(&qmp->callback_list)) {
+        qmp_next(gc, qmp);
+        if (qmp->broken)
+            return -1;
+    }
+
+    return 0;
+}
+
 static void qmp_free_handler(libxl__qmp_handler *qmp)
 {
     free(qmp);
 }
 
+/*
+ * Connection pool
+ *
+ * Rather than connecting and negotiating capabilities for every command,
+ * the connection is returned to a per-ctx pool when a command completes
+ * cleanly and taken from there by the next command for the same domain.
+ */
+
+/*
+ * QEMU may have sent events while the connection sat in the pool.  Read
+ * and discard them; a closed socket, or a read stopping part way through
+ * a message, means the connection cannot be reused.
+ */
+static bool qmp_pool_drain(libxl__qmp_handler *qmp)
+{
+    ssize_t rd;
+    char last = '\n';
+
+    for (;;) {
+        rd = read(qmp->qmp_fd, qmp->buffer, QMP_RECEIVE_BUFFER_SIZE);
+        if (rd > 0) {
+            last = qmp->buffer[rd - 1];
+            continue;
+        }
+        if (rd < 0 && errno == EINTR)
+            continue;
+        return rd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+               last == '\n';
+    }
+}
+
+static libxl__qmp_handler *qmp_pool_get(libxl__gc *gc, uint32_t domid)
+{
+    libxl__qmp_handler *qmp, *tmp, *found = NULL;
+    LIBXL_LIST_HEAD(, struct libxl__qmp_handler) stale;
+    time_t now = time(NULL);
+
+    LIBXL_LIST_INIT(&stale);
+
+    CTX_LOCK;
+    LIBXL_LIST_FOREACH_SAFE(qmp, &CTX->qmp_pool, pool_entry, tmp) {
+        if (!found && qmp->domid == domid) {
+            found = qmp;
+        } else if (now - qmp->idle_since > QMP_POOL_IDLE_SECS) {
+            LIBXL_LIST_INSERT_HEAD(&stale, qmp, pool_entry);
+        } else {
+            continue;
+        }
+        LIBXL_LIST_REMOVE(qmp, pool_entry);
+        CTX->qmp_pool_count--;
+    }
+    CTX_UNLOCK;
+
+    LIBXL_LIST_FOREACH_SAFE(qmp, &stale, pool_entry, tmp)
+        libxl__qmp_close(qmp);
+
+    if (found && !qmp_pool_drain(found)) {
+        libxl__qmp_close(found);
+        found = NULL;
+    }
+    if (!found)
+        found = libxl__qmp_initialize(gc, domid);
+
+    return found;
+}
+
+static void qmp_pool_put(libxl__gc *gc, libxl__qmp_handler *qmp)
+{
+    if (!qmp)
+        return;
+
+    if (!qmp->broken && LIBXL_STAILQ_EMPTY(&qmp->callback_list)) {
+        qmp->wait_for_id = 0;
+        qmp->idle_since = time(NULL);
+
+        CTX_LOCK;
+        if (CTX->qmp_pool_count < QMP_POOL_MAX) {
+            LIBXL_LIST_INSERT_HEAD(&CTX->qmp_pool, qmp, pool_entry);
+            CTX->qmp_pool_count++;
+            qmp = NULL;
+        }
+        CTX_UNLOCK;
+    }
+
+    libxl__qmp_close(qmp);
+}
+
+void libxl__qmp_pool_flush(libxl_ctx *ctx, uint32_t domid)
+{
+    libxl__qmp_handler *qmp, *tmp;
+    LIBXL_LIST_HEAD(, struct libxl__qmp_handler) stale;
+
+    LIBXL_LIST_INIT(&stale);
+
+    libxl__ctx_lock(ctx);
+    LIBXL_LIST_FOREACH_SAFE(qmp, &ctx->qmp_pool, pool_entry, tmp) {
+        if (domid != INVALID_DOMID && qmp->domid != domid)
+            continue;
+        LIBXL_LIST_REMOVE(qmp, pool_entry);
+        ctx->qmp_pool_count--;
+        LIBXL_LIST_INSERT_HEAD(&stale, qmp, pool_entry);
+    }
+    libxl__ctx_unlock(ctx);
+
+    LIBXL_LIST_FOREACH_SAFE(qmp, &stale, pool_entry, tmp)
+        libxl__qmp_close(qmp);
+}
+
 /*
  * QMP Parameters Helpers
  */
@@ -733,6 +876,8 @@ void libxl__qmp_cleanup(libxl__gc *gc, uint32_t domid)
 {
     char *qmp_socket;
 
+    libxl__qmp_pool_flush(CTX, domid);
+
     qmp_socket = GCSPRINTF("%s/qmp-libxl-%d", libxl__run_dir_path(), domid);
     if (unlink(qmp_socket) == -1) {
         if (errno != ENOENT) {
@@ -755,13 +900,6 @@ int libxl__qmp_query_serial(libxl__qmp_handler *qmp)
                                 NULL, qmp->timeout);
 }
 
-static int qmp_query_vnc(libxl__qmp_handler *qmp)
-{
-    return qmp_synchronous_send(qmp, "query-vnc", NULL,
-                                qmp_register_vnc_callback,
-                                NULL, qmp->timeout);
-}
-
 static int pci_add_callback(libxl__qmp_handler *qmp,
                             const libxl__json_object *response, void *opaque)
 {
@@ -817,13 +955,13 @@ static int qmp_run_command(libxl__gc *gc, int domid,
     libxl__qmp_handler *qmp = NULL;
     int rc = 0;
 
-    qmp = libxl__qmp_initialize(gc, domid);
+    qmp = qmp_pool_get(gc, domid);
     if (!qmp)
         return ERROR_FAIL;
 
     rc = qmp_synchronous_send(qmp, cmd, args, callback, opaque, qmp->timeout);
 
-    libxl__qmp_close(qmp);
+    qmp_pool_put(gc, qmp);
     return rc;
 }
 
@@ -848,9 +986,10 @@ int libxl__qmp_pci_add(libxl__gc *gc, int domid, libxl_device_pci *pcidev)
     libxl__qmp_handler *qmp = NULL;
     libxl__json_object *args = NULL;
     char *hostaddr = NULL;
+    qmp_request_context add = { .rc = 0 }, query = { .rc = 0 };
     int rc = 0;
 
-    qmp = libxl__qmp_initialize(gc, domid);
+    qmp = qmp_pool_get(gc, domid);
     if (!qmp)
         return -1;
 
@@ -880,14 +1019,17 @@ int libxl__qmp_pci_add(libxl__gc *gc, int domid, libxl_device_pci *pcidev)
     if (pcidev->permissive)
         qmp_parameters_add_bool(gc, &args, "permissive", true);
 
-    rc = qmp_synchronous_send(qmp, "device_add", args,
-                              NULL, NULL, qmp->timeout);
-    if (rc == 0) {
-        rc = qmp_synchronous_send(qmp, "query-pci", NULL,
-                                  pci_add_callback, pcidev, qmp->timeout);
-    }
-
-    libxl__qmp_close(qmp);
+    /* query-pci is only run once device_add has completed, so there is
+     * no need to wait for the one before sending the other. */
+    if (qmp_send(qmp, "device_add", args, NULL, NULL, &add) < 0 ||
+        qmp_send(qmp, "query-pci", NULL, pci_add_callback, pcidev,
+                 &query) < 0 ||
+        qmp_wait_all(gc, qmp))
+        rc = -1;
+    else
+        rc = add.rc ? add.rc : query.rc;
+
+    qmp_pool_put(gc, qmp);
     return rc;
 }
 
@@ -932,24 +1074,6 @@ int libxl__qmp_restore(libxl__gc *gc, int domid, const char *state_file)
                            NULL, NULL);
 }
 
-static int qmp_change(libxl__gc *gc, libxl__qmp_handler *qmp,
-                      char *device, char *target, char *arg)
-{
-    libxl__json_object *args = NULL;
-    int rc = 0;
-
-    qmp_parameters_add_string(gc, &args, "device", device);
-    qmp_parameters_add_string(gc, &args, "target", target);
-    if (arg) {
-        qmp_parameters_add_string(gc, &args, "arg", arg);
-    }
-
-    rc = qmp_synchronous_send(qmp, "change", args,
-                              NULL, NULL, qmp->timeout);
-
-    return rc;
-}
-
 int libxl__qmp_stop(libxl__gc *gc, int domid)
 {
     return qmp_run_command(gc, domid, "stop", NULL, NULL, NULL);
@@ -1175,21 +1299,42 @@ int libxl__qmp_initializations(libxl__gc *gc, uint32_t domid,
 {
     const libxl_vnc_info *vnc = libxl__dm_vnc(guest_config);
     libxl__qmp_handler *qmp = NULL;
+    qmp_request_context serial = { .rc = 0 }, change = { .rc = 0 },
+                        query_vnc = { .rc = 0 };
+    libxl__json_object *args = NULL;
     int ret = 0;
 
-    qmp = libxl__qmp_initialize(gc, domid);
+    qmp = qmp_pool_get(gc, domid);
     if (!qmp)
         return -1;
-    ret = libxl__qmp_query_serial(qmp);
-    if (!ret && vnc && vnc->passwd) {
-        ret = qmp_change(gc, qmp, "vnc", "password", vnc->passwd);
-        qmp_write_domain_console_item(gc, domid, "vnc-pass", vnc->passwd);
-    }
-    if (!ret) {
-        ret = qmp_query_vnc(qmp);
+
+    /* The three commands are independent: send them together and wait
+     * for all the replies at once. */
+    if (qmp_send(qmp, "query-chardev", NULL,
+                 register_serials_chardev_callback, NULL, &serial) < 0)
+        goto fail;
+    if (vnc && vnc->passwd) {
+        qmp_parameters_add_string(gc, &args, "device", "vnc");
+        qmp_parameters_add_string(gc, &args, "target", "password");
+        qmp_parameters_add_string(gc, &args, "arg", vnc->passwd);
+        if (qmp_send(qmp, "change", args, NULL, NULL, &change) < 0)
+            goto fail;
     }
-    libxl__qmp_close(qmp);
+    if (qmp_send(qmp, "query-vnc", NULL,
+                 qmp_register_vnc_callback, NULL, &query_vnc) < 0 ||
+        qmp_wait_all(gc, qmp))
+        goto fail;
+
+    if (vnc && vnc->passwd && !serial.rc)
+        qmp_write_domain_console_item(gc, domid, "vnc-pass", vnc->passwd);
+    ret = serial.rc ? serial.rc : change.rc ? change.rc : query_vnc.rc;
+
+    qmp_pool_put(gc, qmp);
     return ret;
+
+fail:
+    libxl__qmp_close(qmp);
+    return -1;
 }
 
 /*
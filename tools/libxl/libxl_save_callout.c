@@ -63,6 +63,8 @@ void libxl__xc_domain_restore(libxl__egc *egc, libxl__domain_create_state *dcs,
         state->console_domid,
         hvm, pae,
         cbflags, dcs->restore_params.checkpointed_stream,
+        libxl_defbool_val(dcs->restore_params.direct_page_data)
+            ? XCFLAGS_DIRECT : 0,
     };
 
     shs->ao = ao;
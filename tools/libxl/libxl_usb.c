@@ -1963,13 +1963,16 @@ void libxl_device_usbdev_list_free(libxl_device_usbdev *list, int nr)
 #define libxl__device_usbctrl_update_devid NULL
 
 DEFINE_DEVICE_TYPE_STRUCT(usbctrl,
-    .dm_needed = libxl_device_usbctrl_dm_needed
+    .dm_needed = libxl_device_usbctrl_dm_needed,
+    .attach_late = 1,
 );
 
 #define libxl__device_from_usbdev NULL
 #define libxl__device_usbdev_update_devid NULL
 
-DEFINE_DEVICE_TYPE_STRUCT(usbdev);
+DEFINE_DEVICE_TYPE_STRUCT(usbdev,
+    .attach_late = 1,
+);
 
 /*
  * Local variables:
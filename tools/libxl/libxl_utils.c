@@ -48,17 +48,270 @@ unsigned long libxl_get_required_shadow_memory(unsigned long maxmem_kb, unsigned
     return 4 * (256 * smp_cpus + 2 * (maxmem_kb / 1024));
 }
 
-char *libxl_domid_to_name(libxl_ctx *ctx, uint32_t domid)
+/*
+ * Domain name cache
+ *
+ * Names are read from xenstore once and then served from the ctx.  Each
+ * cached name has a watch on its xenstore node, on a connection of its
+ * own so that watch events can be polled for without the libxl event
+ * loop: any write or removal of the node, including the removal of the
+ * whole domain directory on destruction, marks the entry stale.  A
+ * @releaseDomain watch prompts freeing stale entries.
+ *
+ * xenstore fires every watch once when it is set up; that first event
+ * carries no information and only arms the entry.  Each entry uses a
+ * token of its own, so events for a watch that has been replaced are
+ * not mistaken for events on its successor.
+ *
+ * Setting up a watch costs more than the read it saves, so nothing is
+ * cached until some name has been asked for twice: short lived callers
+ * which look each domain up once see no difference.  If the connection
+ * cannot be set up or fails, lookups go straight to xenstore as before.
+ */
+
+#define DOMNAME_RELEASE_TOKEN "release"
+
+static unsigned int domname_bucket(uint32_t domid)
+{
+    return domid % LIBXL__DOMNAME_CACHE_BUCKETS;
+}
+
+static libxl__domname_entry *domname_find(libxl_ctx *ctx, uint32_t domid)
+{
+    libxl__domname_entry *e;
+
+    LIBXL_SLIST_FOREACH(e, &ctx->domname_cache[domname_bucket(domid)], next)
+        if (e->domid == domid)
+            return e;
+
+    return NULL;
+}
+
+static void domname_remove(libxl_ctx *ctx, libxl__domname_entry *e)
+{
+    char path[strlen("/local/domain") + 17];
+
+    LIBXL_SLIST_REMOVE(&ctx->domname_cache[domname_bucket(e->domid)], e,
+                       libxl__domname_entry, next);
+    if (ctx->domname_xsh) {
+        snprintf(path, sizeof(path), "/local/domain/%u/name", e->domid);
+        xs_unwatch(ctx->domname_xsh, path, e->token);
+    }
+    free(e->name);
+    free(e);
+}
+
+void libxl__domname_cache_free(libxl_ctx *ctx)
+{
+    libxl__domname_entry *e;
+    int i;
+
+    for (i = 0; i < LIBXL__DOMNAME_CACHE_BUCKETS; i++)
+        while ((e = LIBXL_SLIST_FIRST(&ctx->domname_cache[i])))
+            domname_remove(ctx, e);
+
+    if (ctx->domname_xsh) {
+        xs_close(ctx->domname_xsh);
+        ctx->domname_xsh = NULL;
+    }
+    free(ctx->domname_asked);
+    ctx->domname_asked = NULL;
+}
+
+/* Note that domid's name has been asked for, returning whether it had
+ * been already.  CTX_LOCK must be held. */
+static bool domname_asked_before(libxl_ctx *ctx, uint32_t domid)
+{
+    unsigned long bit = 1UL << (domid % (8 * sizeof(unsigned long)));
+    unsigned long *word;
+    bool ret;
+
+    if (domid >= DOMID_FIRST_RESERVED)
+        return false;
+    if (!ctx->domname_asked) {
+        ctx->domname_asked =
+            calloc(DOMID_FIRST_RESERVED / (8 * sizeof(unsigned long)) + 1,
+                   sizeof(unsigned long));
+        if (!ctx->domname_asked)
+            return false;
+    }
+
+    word = &ctx->domname_asked[domid / (8 * sizeof(unsigned long))];
+    ret = *word & bit;
+    *word |= bit;
+
+    return ret;
+}
+
+/* Set up the watch connection if need be.  CTX_LOCK must be held. */
+static bool domname_cache_open(libxl_ctx *ctx)
 {
+    struct xs_handle *xsh;
+
+    if (ctx->domname_xsh)
+        return true;
+    if (ctx->domname_cache_failed)
+        return false;
+
+    xsh = xs_open(0);
+    if (!xsh || xs_fileno(xsh) < 0 ||
+        !xs_watch(xsh, "@releaseDomain", DOMNAME_RELEASE_TOKEN)) {
+        if (xsh)
+            xs_close(xsh);
+        ctx->domname_cache_failed = true;
+        return false;
+    }
+
+    ctx->domname_xsh = xsh;
+    return true;
+}
+
+/* Apply pending watch events.  CTX_LOCK must be held. */
+static bool domname_cache_update(libxl_ctx *ctx)
+{
+    libxl__domname_entry *e, *tmp;
+    bool release = false;
+    char **ev;
+    uint32_t domid;
+    int i;
+
+    while ((ev = xs_check_watch(ctx->domname_xsh))) {
+        if (!strcmp(ev[XS_WATCH_TOKEN], DOMNAME_RELEASE_TOKEN)) {
+            release = true;
+        } else {
+            domid = strtoul(ev[XS_WATCH_TOKEN], NULL, 10);
+            e = domname_find(ctx, domid);
+            if (e && !strcmp(e->token, ev[XS_WATCH_TOKEN])) {
+                if (!e->armed)
+                    e->armed = true;
+                else
+                    e->stale = true;
+            }
+        }
+        free(ev);
+    }
+
+    if (errno != EAGAIN) {
+        /* Events may have been lost: nothing cached can be trusted. */
+        libxl__domname_cache_free(ctx);
+        ctx->domname_cache_failed = true;
+        return false;
+    }
+
+    if (release)
+        for (i = 0; i < LIBXL__DOMNAME_CACHE_BUCKETS; i++)
+            LIBXL_SLIST_FOREACH_SAFE(e, &ctx->domname_cache[i], next, tmp)
+                if (e->stale)
+                    domname_remove(ctx, e);
+
+    return true;
+}
+
+/*
+ * Return the name of domid, from malloc, or NULL.  If uuid is non-NULL
+ * it is checked against the uuid the name was cached for.
+ */
+static char *domname_get(libxl_ctx *ctx, uint32_t domid,
+                         const libxl_uuid *uuid)
+{
+    char path[strlen("/local/domain") + 17];
+    libxl__domname_entry *e;
     unsigned int len;
-    char path[strlen("/local/domain") + 12];
-    char *s;
+    char *s = NULL;
 
-    snprintf(path, sizeof(path), "/local/domain/%d/name", domid);
+    snprintf(path, sizeof(path), "/local/domain/%u/name", domid);
+
+    libxl__ctx_lock(ctx);
+
+    if ((!ctx->domname_xsh && !domname_asked_before(ctx, domid)) ||
+        !domname_cache_open(ctx) || !domname_cache_update(ctx)) {
+        s = xs_read(ctx->xsh, XBT_NULL, path, &len);
+        goto out;
+    }
+
+    e = domname_find(ctx, domid);
+    if (e && uuid) {
+        if (!e->have_uuid) {
+            e->uuid = *uuid;
+            e->have_uuid = true;
+        } else if (libxl_uuid_compare(&e->uuid, uuid)) {
+            e->stale = true;
+        }
+    }
+    if (e && !e->stale) {
+        s = strdup(e->name);
+        goto out;
+    }
+    if (e)
+        domname_remove(ctx, e);
+
+    e = calloc(1, sizeof(*e));
+    if (!e)
+        goto read;
+    e->domid = domid;
+    snprintf(e->token, sizeof(e->token), "%u/%u", domid,
+             ctx->domname_serial++);
+
+    /* Watch before reading, so that no change can go unnoticed. */
+    if (!xs_watch(ctx->domname_xsh, path, e->token)) {
+        free(e);
+        goto read;
+    }
+    e->name = xs_read(ctx->xsh, XBT_NULL, path, &len);
+    if (!e->name) {
+        xs_unwatch(ctx->domname_xsh, path, e->token);
+        free(e);
+        goto out;
+    }
+    if (uuid) {
+        e->uuid = *uuid;
+        e->have_uuid = true;
+    }
+    LIBXL_SLIST_INSERT_HEAD(&ctx->domname_cache[domname_bucket(domid)], e,
+                            next);
+    s = strdup(e->name);
+    goto out;
+
+ read:
     s = xs_read(ctx->xsh, XBT_NULL, path, &len);
+ out:
+    libxl__ctx_unlock(ctx);
     return s;
 }
 
+char *libxl_domid_to_name(libxl_ctx *ctx, uint32_t domid)
+{
+    return domname_get(ctx, domid, NULL);
+}
+
+libxl_domnameinfo *libxl_list_domain_named(libxl_ctx *ctx, int *nb_domain_out)
+{
+    libxl_domnameinfo *list;
+    libxl_dominfo *info;
+    int i, nb;
+
+    info = libxl_list_domain(ctx, &nb);
+    if (!info)
+        return NULL;
+
+    list = calloc(nb ? nb : 1, sizeof(*list));
+    if (!list) {
+        libxl_dominfo_list_free(info, nb);
+        return NULL;
+    }
+
+    for (i = 0; i < nb; i++) {
+        libxl_domnameinfo_init(&list[i]);
+        /* Ownership of the dominfo's allocations moves to list[i]. */
+        list[i].info = info[i];
+        list[i].name = domname_get(ctx, info[i].domid, &info[i].uuid);
+    }
+    free(info);
+
+    *nb_domain_out = nb;
+    return list;
+}
+
 char *libxl__domid_to_name(libxl__gc *gc, uint32_t domid)
 {
     char *s = libxl_domid_to_name(CTX, domid);
@@ -1172,6 +1425,14 @@ void libxl_dominfo_list_free(libxl_dominfo *list, int nr)
     free(list);
 }
 
+void libxl_domnameinfo_list_free(libxl_domnameinfo *list, int nr)
+{
+    int i;
+    for (i = 0; i < nr; i++)
+        libxl_domnameinfo_dispose(&list[i]);
+    free(list);
+}
+
 void libxl_vminfo_list_free(libxl_vminfo *list, int nr)
 {
     int i;
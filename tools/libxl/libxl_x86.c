@@ -586,6 +586,11 @@ int libxl__arch_domain_construct_memmap(libxl__gc *gc,
         goto out;
     }
 
+    /* There is no call to read it back, keep it for clones of PVH guests. */
+    if (d_config->c_info.type == LIBXL_DOMAIN_TYPE_PVH)
+        rc = libxl__userdata_store(gc, domid, "e820", (uint8_t *)e820,
+                                   e820_entries * sizeof(*e820));
+
 out:
     return rc;
 }
@@ -51,20 +51,38 @@ int libxl__xs_writev_perms(libxl__gc *gc, xs_transaction_t t,
                            unsigned int num_perms)
 {
     libxl_ctx *ctx = libxl__gc_owner(gc);
-    char *path;
+    const char **paths;
+    const void **values;
+    unsigned int *lens, num = 0;
     int i;
 
     if (!kvs)
         return 0;
 
+    for (i = 0; kvs[i] != NULL; i += 2)
+        ;
+    paths = libxl__calloc(gc, i / 2 + 1, sizeof(*paths));
+    values = libxl__calloc(gc, i / 2 + 1, sizeof(*values));
+    lens = libxl__calloc(gc, i / 2 + 1, sizeof(*lens));
+
     for (i = 0; kvs[i] != NULL; i += 2) {
-        path = GCSPRINTF("%s/%s", dir, kvs[i]);
-        if (path && kvs[i + 1]) {
-            int length = strlen(kvs[i + 1]);
-            xs_write(ctx->xsh, t, path, kvs[i + 1], length);
-            if (perms)
-                xs_set_permissions(ctx->xsh, t, path, perms, num_perms);
-        }
+        if (!kvs[i + 1])
+            continue;
+        paths[num] = GCSPRINTF("%s/%s", dir, kvs[i]);
+        values[num] = kvs[i + 1];
+        lens[num] = strlen(kvs[i + 1]);
+        num++;
+    }
+
+    /* Batch the writes; if one fails, still try all the others. */
+    if (!xs_write_multiple(ctx->xsh, t, paths, values, lens, num)) {
+        for (i = 0; i < num; i++)
+            xs_write(ctx->xsh, t, paths[i], values[i], lens[i]);
+    }
+
+    if (perms) {
+        for (i = 0; i < num; i++)
+            xs_set_permissions(ctx->xsh, t, paths[i], perms, num_perms);
     }
     return 0;
 }
@@ -152,8 +152,9 @@ static const char *str_7d0[32] =
     [0 ... 1] = "REZ",
 
     [ 2] = "avx512_4vnniw", [ 3] = "avx512_4fmaps",
+    [ 4] = "fsrm",
 
-    [4 ... 31] = "REZ",
+    [5 ... 31] = "REZ",
 };
 
 static struct {
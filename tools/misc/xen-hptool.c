@@ -20,7 +20,9 @@ void show_help(void)
             "  cpu-online    <cpuid>    online CPU <cpuid>\n"
             "  cpu-offline   <cpuid>    offline CPU <cpuid>\n"
             "  mem-online    <mfn>      online MEMORY <mfn>\n"
-            "  mem-offline   <mfn>      offline MEMORY <mfn>\n"
+            "  mem-offline   <mfn> [<end-mfn>]\n"
+            "                           offline MEMORY <mfn>, or <mfn> to <end-mfn>\n"
+            "                           moving the owning guests' pages away\n"
             "  mem-status    <mfn>      query Memory status<mfn>\n"
            );
 }
@@ -145,12 +147,229 @@ failed:
     return -1;
 }
 
+/* Pages marked offline per call when offlining a range. */
+#define MEM_OFFLINE_CHUNK (1UL << 16)
+
+struct pending_page {
+    uint32_t domid;
+    xen_pfn_t mfn;
+};
+
+static int cmp_pending(const void *a, const void *b)
+{
+    const struct pending_page *x = a, *y = b;
+
+    if (x->domid != y->domid)
+        return x->domid < y->domid ? -1 : 1;
+    return x->mfn < y->mfn ? -1 : x->mfn > y->mfn;
+}
+
+/* Move @nr pending pages of PV guest @domid, suspending it once for all. */
+static unsigned int exchange_pv_pages(uint32_t domid, const xen_pfn_t *mfns,
+                                      unsigned int nr)
+{
+    int suspend_evtchn = -1, suspend_lockfd = -1;
+    xenevtchn_handle *xce;
+    unsigned int i, moved = 0;
+
+    xce = xenevtchn_open(NULL, 0);
+    if (xce == NULL)
+    {
+        fprintf(stderr, "When exchange page, fail to open evtchn\n");
+        return 0;
+    }
+
+    if (suspend_guest(xch, xce, domid, &suspend_evtchn, &suspend_lockfd))
+    {
+        fprintf(stderr, "Failed to suspend guest %d\n", domid);
+        xenevtchn_close(xce);
+        return 0;
+    }
+
+    for (i = 0; i < nr; i++)
+    {
+        if (xc_exchange_page(xch, domid, mfns[i]) == 0)
+            moved++;
+        else
+            fprintf(stderr, "Memory mfn %lx of DOM%d failed to be "
+                    "exchanged\n", (unsigned long)mfns[i], domid);
+    }
+
+    xc_domain_resume(xch, domid, 1);
+    xc_suspend_evtchn_release(xch, xce, domid,
+                              suspend_evtchn, &suspend_lockfd);
+    xenevtchn_close(xce);
+
+    return moved;
+}
+
+/*
+ * Offline [start, end] in large chunks, then move the pages still in use
+ * by guests one guest at a time: HVM guests are remapped in bulk while
+ * paused, PV guests are suspended once for all of their pages.
+ */
+static int hp_mem_offline_range(unsigned long start, unsigned long end)
+{
+    unsigned long mfn, nr, i, total = end - start + 1;
+    unsigned long offlined = 0, xenpages = 0, failed = 0;
+    unsigned long nr_pending = 0, max_pending = 0, moved = 0;
+    struct pending_page *pending = NULL;
+    xen_pfn_t *mfns = NULL;
+    uint32_t *status;
+    int ret = 0;
+
+    status = malloc(MEM_OFFLINE_CHUNK * sizeof(*status));
+    if (!status)
+    {
+        fprintf(stderr, "Failed to allocate status buffer\n");
+        return -1;
+    }
+
+    printf("Prepare to offline MEMORY mfn %lx to %lx\n", start, end);
+
+    for (mfn = start; mfn <= end; mfn += nr)
+    {
+        nr = end - mfn + 1;
+        if (nr > MEM_OFFLINE_CHUNK)
+            nr = MEM_OFFLINE_CHUNK;
+
+        memset(status, 0, nr * sizeof(*status));
+        ret = xc_mark_page_offline(xch, mfn, mfn + nr - 1, status);
+
+        for (i = 0; i < nr && status[i]; i++)
+        {
+            switch (status[i] & PG_OFFLINE_STATUS_MASK)
+            {
+            case PG_OFFLINE_OFFLINED:
+                offlined++;
+                break;
+            case PG_OFFLINE_PENDING:
+                if (!(status[i] & PG_OFFLINE_OWNED))
+                {
+                    xenpages++;
+                    break;
+                }
+                if (nr_pending == max_pending)
+                {
+                    struct pending_page *p;
+
+                    max_pending = max_pending ? max_pending * 2 : 1024;
+                    p = realloc(pending, max_pending * sizeof(*pending));
+                    if (!p)
+                    {
+                        fprintf(stderr, "Failed to allocate pending list\n");
+                        ret = -1;
+                        goto out;
+                    }
+                    pending = p;
+                }
+                pending[nr_pending].domid =
+                    status[i] >> PG_OFFLINE_OWNER_SHIFT;
+                pending[nr_pending++].mfn = mfn + i;
+                break;
+            default:
+                failed++;
+                fprintf(stderr, "Memory mfn %lx offline failed, status %x\n",
+                        mfn + i, status[i]);
+                break;
+            }
+        }
+
+        if (ret < 0)
+        {
+            fprintf(stderr, "\nOfflining stopped at mfn %lx, error %x\n",
+                    mfn + (i ? i - 1 : 0), errno);
+            goto out;
+        }
+
+        printf("\r%lu/%lu pages marked offline (%lu%%)",
+               mfn + nr - start, total, (mfn + nr - start) * 100 / total);
+        fflush(stdout);
+    }
+    printf("\n");
+
+    qsort(pending, nr_pending, sizeof(*pending), cmp_pending);
+    mfns = malloc(nr_pending * sizeof(*mfns));
+    if (nr_pending && !mfns)
+    {
+        fprintf(stderr, "Failed to allocate mfn list\n");
+        ret = -1;
+        goto out;
+    }
+
+    for (i = 0; i < nr_pending; )
+    {
+        uint32_t domid = pending[i].domid;
+        unsigned long n = 0;
+        xc_dominfo_t info;
+        int rc;
+
+        for (; i < nr_pending && pending[i].domid == domid; i++)
+            mfns[n++] = pending[i].mfn;
+
+        printf("Moving %lu pages of DOM%d\n", n, domid);
+
+        if (xc_domain_getinfo(xch, domid, 1, &info) != 1 ||
+            info.domid != domid)
+        {
+            fprintf(stderr, "Failed to get info of DOM%d\n", domid);
+            ret = -1;
+            continue;
+        }
+
+        if (info.hvm)
+        {
+            rc = xc_exchange_hvm_pages(xch, domid, mfns, n);
+            if (rc < 0)
+            {
+                fprintf(stderr, "Failed to move the pages of DOM%d%s\n",
+                        domid, rc == -2 ? ", guest may be broken" : "");
+                ret = -1;
+                continue;
+            }
+        }
+        else
+            rc = exchange_pv_pages(domid, mfns, n);
+
+        moved += rc;
+        if (rc != n)
+            ret = -1;
+    }
+
+    printf("%lu pages offlined, %lu of %lu guest pages moved, "
+           "%lu Xen pages pending, %lu failed\n",
+           offlined + moved, moved, nr_pending, xenpages, failed);
+    if (failed)
+        ret = -1;
+
+out:
+    free(mfns);
+    free(pending);
+    free(status);
+
+    return ret;
+}
+
 static int hp_mem_offline_func(int argc, char *argv[])
 {
     uint32_t status, domid;
     int ret;
     unsigned long mfn;
 
+    if (argc == 2)
+    {
+        unsigned long end;
+
+        sscanf(argv[0], "%lx", &mfn);
+        sscanf(argv[1], "%lx", &end);
+        if (end < mfn)
+        {
+            show_help();
+            return -1;
+        }
+        return hp_mem_offline_range(mfn, end);
+    }
+
     if (argc != 1)
     {
         show_help();
@@ -0,0 +1,470 @@
+/*
+ * xen-memshrd: share identical pages between (and within) HVM guests.
+ *
+ * Guests opt in by having "1" written to /local/domain/<domid>/memory/dedup.
+ * Every pass maps their memory a batch at a time, hashes each page, and
+ * looks the hash up in a table of the pages seen earlier in the pass.  On a
+ * hit both pages are nominated, compared (a nominated page can't change
+ * without its handle becoming invalid, so the comparison can't be raced),
+ * and shared.  The number of pages hashed per second is limited, so that a
+ * pass costs a bounded amount of CPU and memory bandwidth.
+ *
+ * Sharing is undone by the guest writing to a page, which needs a free page
+ * to unshare into.  No ENOMEM ring is set up, so a guest unsharing when the
+ * host is out of memory gets crashed: don't hand out all the memory
+ * sharing frees.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <xenctrl.h>
+#include <xenforeignmemory.h>
+#include <xenstore.h>
+
+#define BATCH           256
+#define MAX_DOMS        1024
+#define DEDUP_KEY       "memory/dedup"
+
+/* A page seen earlier in the pass; the first one with its hash. */
+struct entry {
+    uint64_t hash;
+    uint64_t gfn;
+    uint32_t domid;
+    bool used;
+};
+
+struct candidate {
+    const struct entry *source;
+    uint64_t gfn;
+};
+
+static xc_interface *xch;
+static xenforeignmemory_handle *fmem;
+static struct xs_handle *xsh;
+static volatile sig_atomic_t interrupted;
+static bool verbose;
+
+static unsigned long rate = 25600;      /* pages hashed per second */
+static unsigned int interval = 60;      /* seconds between passes */
+
+static struct entry *table;
+static size_t table_size, table_used;   /* table_size is a power of two */
+
+static unsigned long scanned, shared;
+/* Pages hashed since budget_start. */
+static unsigned long budget_pages;
+static struct timespec budget_start;
+
+static void show_help(void)
+{
+    fprintf(stderr,
+            "xen-memshrd: share identical pages of HVM guests\n"
+            "Usage: xen-memshrd [-r pages/s] [-i seconds] [-1] [-v]\n"
+            "  -r  pages to hash per second (default: %lu)\n"
+            "  -i  seconds between passes (default: %u)\n"
+            "  -1  do a single pass and exit\n"
+            "  -v  print statistics after each pass\n"
+            "Guests opt in with: xenstore-write /local/domain/<domid>/"
+            DEDUP_KEY " 1\n", rate, interval);
+}
+
+static void sigint(int sig)
+{
+    interrupted = 1;
+}
+
+/*
+ * 64-bit hash of a page.  Four independent lanes let the compiler keep
+ * several multiplies in flight (or vectorise them); the lanes are combined
+ * at the end.  Only used to find candidates, which are compared in full.
+ */
+static uint64_t page_hash(const void *page)
+{
+    const uint64_t *p = page;
+    uint64_t lane[4] = {
+        0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+        0x165667b19e3779f9ULL, 0x27d4eb2f165667c5ULL,
+    };
+    uint64_t h;
+    unsigned int i, j;
+
+    for ( i = 0; i < XC_PAGE_SIZE / sizeof(*p); i += 4 )
+        for ( j = 0; j < 4; j++ )
+        {
+            lane[j] ^= p[i + j];
+            lane[j] *= 0xff51afd7ed558ccdULL;
+            lane[j] ^= lane[j] >> 29;
+        }
+
+    h = lane[0] ^ (lane[1] << 17 | lane[1] >> 47) ^
+        (lane[2] << 31 | lane[2] >> 33) ^ (lane[3] << 47 | lane[3] >> 17);
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+}
+
+static void table_reset(size_t min_entries)
+{
+    size_t size = 1024;
+
+    while ( size < 2 * min_entries )
+        size *= 2;
+
+    if ( size != table_size )
+    {
+        free(table);
+        table = malloc(size * sizeof(*table));
+        if ( !table )
+            err(1, "allocating a table of %zu pages", size);
+        table_size = size;
+    }
+    memset(table, 0, table_size * sizeof(*table));
+    table_used = 0;
+}
+
+/* Find the entry for hash, or the free one to put it in. */
+static struct entry *table_lookup(uint64_t hash)
+{
+    size_t i;
+
+    for ( i = hash & (table_size - 1); table[i].used;
+          i = (i + 1) & (table_size - 1) )
+        if ( table[i].hash == hash )
+            break;
+
+    return &table[i];
+}
+
+/* Sleep as needed to hash no more than rate pages per second. */
+static void throttle(unsigned int pages)
+{
+    struct timespec now, ts;
+    double due, elapsed;
+
+    budget_pages += pages;
+    due = (double)budget_pages / rate;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - budget_start.tv_sec) +
+              (now.tv_nsec - budget_start.tv_nsec) / 1e9;
+
+    if ( elapsed > due + 1 )
+    {
+        /* Fell behind (or were idle): don't make up for it in a burst. */
+        budget_start = now;
+        budget_pages = 0;
+    }
+    else if ( due > elapsed )
+    {
+        ts.tv_sec = due - elapsed;
+        ts.tv_nsec = (due - elapsed - ts.tv_sec) * 1e9;
+        nanosleep(&ts, NULL);
+    }
+}
+
+static bool same_contents(uint32_t sdom, uint64_t sgfn,
+                          uint32_t cdom, uint64_t cgfn)
+{
+    xen_pfn_t spfn = sgfn, cpfn = cgfn;
+    void *spage, *cpage;
+    bool same = false;
+
+    spage = xenforeignmemory_map(fmem, sdom, PROT_READ, 1, &spfn, NULL);
+    if ( !spage )
+        return false;
+    cpage = xenforeignmemory_map(fmem, cdom, PROT_READ, 1, &cpfn, NULL);
+    if ( cpage )
+    {
+        same = !memcmp(spage, cpage, XC_PAGE_SIZE);
+        xenforeignmemory_unmap(fmem, cpage, 1);
+    }
+    xenforeignmemory_unmap(fmem, spage, 1);
+
+    return same;
+}
+
+/* Take the candidates left in todo of the next source domain. */
+static unsigned int next_source(const struct candidate *cand, unsigned int nr,
+                                bool *todo, unsigned int *idx, uint32_t *sdom)
+{
+    unsigned int i, n = 0;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( !todo[i] )
+            continue;
+        if ( !n )
+            *sdom = cand[i].source->domid;
+        else if ( cand[i].source->domid != *sdom )
+            continue;
+        todo[i] = false;
+        idx[n++] = i;
+    }
+
+    return n;
+}
+
+/*
+ * Nominate the candidates, compare them and share those still identical,
+ * with a batched call per domain for each step.  Nominating makes the pages
+ * read-only to the guest: from then on a write invalidates the handle, and
+ * sharing fails.  The pages must not be mapped while nominated, so they get
+ * compared afterwards.
+ */
+static void share_candidates(const struct candidate *cand, unsigned int nr,
+                             uint32_t cdom)
+{
+    xen_mem_sharing_batch_entry_t ent[BATCH], batch[BATCH];
+    bool ok[BATCH], todo[BATCH];
+    unsigned int i, n, idx[BATCH];
+    uint32_t sdom;
+
+    if ( !nr )
+        return;
+
+    memset(ent, 0, sizeof(ent));
+    for ( i = 0; i < nr; i++ )
+        ent[i].source_gfn = cand[i].gfn;
+    if ( xc_memshr_nominate_gfns(xch, cdom, ent, nr) )
+        return;
+    for ( i = 0; i < nr; i++ )
+    {
+        ent[i].client_gfn = cand[i].gfn;
+        ent[i].client_handle = ent[i].source_handle;
+        ok[i] = todo[i] = !ent[i].status;
+    }
+
+    while ( (n = next_source(cand, nr, todo, idx, &sdom)) )
+    {
+        memset(batch, 0, n * sizeof(*batch));
+        for ( i = 0; i < n; i++ )
+            batch[i].source_gfn = cand[idx[i]].source->gfn;
+        if ( xc_memshr_nominate_gfns(xch, sdom, batch, n) )
+            memset(batch, 0xff, n * sizeof(*batch));
+        for ( i = 0; i < n; i++ )
+        {
+            ent[idx[i]].source_gfn = batch[i].source_gfn;
+            ent[idx[i]].source_handle = batch[i].source_handle;
+            ok[idx[i]] = !batch[i].status;
+        }
+    }
+
+    for ( i = 0; i < nr; i++ )
+    {
+        /* Already backed by the same frame? */
+        if ( ok[i] && (ent[i].source_handle == ent[i].client_handle ||
+                       !same_contents(cand[i].source->domid,
+                                      ent[i].source_gfn, cdom,
+                                      ent[i].client_gfn)) )
+            ok[i] = false;
+        todo[i] = ok[i];
+    }
+
+    while ( (n = next_source(cand, nr, todo, idx, &sdom)) )
+    {
+        for ( i = 0; i < n; i++ )
+            batch[i] = ent[idx[i]];
+        if ( xc_memshr_share_gfns_batch(xch, sdom, cdom, batch, n) )
+            continue;
+        for ( i = 0; i < n; i++ )
+            if ( !batch[i].status )
+                shared++;
+    }
+}
+
+static void scan_domain(uint32_t domid, xen_pfn_t max_gpfn)
+{
+    struct candidate cand[BATCH];
+    xen_pfn_t pfns[BATCH];
+    int errs[BATCH];
+    uint64_t gfn;
+    unsigned int i, n, nr_cand;
+    void *pages;
+
+    for ( gfn = 0; gfn <= max_gpfn && !interrupted; gfn += n )
+    {
+        n = max_gpfn - gfn + 1 < BATCH ? max_gpfn - gfn + 1 : BATCH;
+        for ( i = 0; i < n; i++ )
+            pfns[i] = gfn + i;
+
+        pages = xenforeignmemory_map(fmem, domid, PROT_READ, n, pfns, errs);
+        if ( !pages )
+        {
+            /* The domain went away. */
+            if ( errno == ESRCH )
+                return;
+            continue;
+        }
+
+        nr_cand = 0;
+        for ( i = 0; i < n; i++ )
+        {
+            struct entry *e;
+            uint64_t hash;
+
+            /* Holes, MMIO, paged out pages... */
+            if ( errs[i] )
+                continue;
+
+            hash = page_hash(pages + i * XC_PAGE_SIZE);
+            e = table_lookup(hash);
+            if ( e->used )
+            {
+                cand[nr_cand].source = e;
+                cand[nr_cand].gfn = gfn + i;
+                nr_cand++;
+            }
+            else if ( table_used < table_size / 2 )
+            {
+                e->used = true;
+                e->hash = hash;
+                e->gfn = gfn + i;
+                e->domid = domid;
+                table_used++;
+            }
+        }
+
+        /* Nominating fails for pages mapped here. */
+        xenforeignmemory_unmap(fmem, pages, n);
+
+        share_candidates(cand, nr_cand, domid);
+
+        scanned += n;
+        throttle(n);
+    }
+}
+
+static bool opted_in(uint32_t domid)
+{
+    char path[64];
+    unsigned int len;
+    char *val;
+    bool on;
+
+    snprintf(path, sizeof(path), "/local/domain/%u/" DEDUP_KEY, domid);
+    val = xs_read(xsh, XBT_NULL, path, &len);
+    on = val && !strcmp(val, "1");
+    free(val);
+
+    return on;
+}
+
+static void scan(void)
+{
+    static xc_dominfo_t info[MAX_DOMS];
+    xen_pfn_t max_gpfn[MAX_DOMS];
+    size_t total = 0;
+    int i, nr;
+
+    nr = xc_domain_getinfo(xch, 1, MAX_DOMS, info);
+    if ( nr < 0 )
+        err(1, "listing domains");
+
+    for ( i = 0; i < nr; i++ )
+    {
+        max_gpfn[i] = 0;
+        if ( !info[i].hvm || info[i].dying || !opted_in(info[i].domid) )
+            continue;
+        if ( xc_memshr_control(xch, info[i].domid, 1) )
+        {
+            if ( verbose )
+                warn("d%u: can't enable sharing", info[i].domid);
+            continue;
+        }
+        if ( xc_domain_maximum_gpfn(xch, info[i].domid, &max_gpfn[i]) )
+            continue;
+        total += max_gpfn[i] + 1;
+    }
+
+    table_reset(total);
+    scanned = shared = 0;
+
+    for ( i = 0; i < nr && !interrupted; i++ )
+        if ( max_gpfn[i] )
+            scan_domain(info[i].domid, max_gpfn[i]);
+
+    if ( verbose )
+        printf("scanned %lu pages, shared %lu\n", scanned, shared);
+}
+
+int main(int argc, char *argv[])
+{
+    bool once = false;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "r:i:1vh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'r':
+            rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            interval = strtoul(optarg, NULL, 0);
+            break;
+        case '1':
+            once = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            show_help();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if ( optind != argc || !rate )
+    {
+        show_help();
+        return 1;
+    }
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+        err(1, "xc_interface_open");
+    fmem = xenforeignmemory_open(NULL, 0);
+    if ( !fmem )
+        err(1, "xenforeignmemory_open");
+    xsh = xs_open(0);
+    if ( !xsh )
+        err(1, "xs_open");
+
+    signal(SIGINT, sigint);
+    signal(SIGTERM, sigint);
+
+    while ( !interrupted )
+    {
+        clock_gettime(CLOCK_MONOTONIC, &budget_start);
+        budget_pages = 0;
+        scan();
+        if ( once )
+            break;
+        sleep(interval);
+    }
+
+    free(table);
+    xs_close(xsh);
+    xenforeignmemory_close(fmem);
+    xc_interface_close(xch);
+
+    return 0;
+}
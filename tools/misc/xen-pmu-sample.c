@@ -0,0 +1,556 @@
+/*
+ * xen-pmu-sample: host-wide sampling profiler for Xen and its guests.
+ *
+ * 'record' drives XEN_SYSCTL_pmu_sample and stores the samples of every
+ * pcpu in a file.  'report' resolves them against the Xen symbol table
+ * (xen-syms) and guest kernel System.map files, and prints them either in
+ * the format of 'perf script' or as folded stacks for flamegraph.pl.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include <elf.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <xenctrl.h>
+
+#include <xen-tools/libs.h>
+
+#define SAMPLE_MAGIC    "XENPMUS1"
+#define BATCH           1024
+#define POLL_MS         100
+
+#define ARRAY_SIZE(a) (sizeof (a) / sizeof ((a)[0]))
+
+/* On-disk: SAMPLE_MAGIC, then any number of chunks. */
+struct chunk {
+    uint32_t cpu;
+    uint32_t nr;
+    /* xen_sysctl_pmu_sample_rec_t rec[nr]; */
+};
+
+struct sym {
+    uint64_t addr;
+    char *name;
+};
+
+struct symtab {
+    unsigned int domid;
+    unsigned int nr, max;
+    struct sym *syms;
+};
+
+static xc_interface *xch;
+static volatile sig_atomic_t interrupted;
+
+static void show_help(void)
+{
+    fprintf(stderr,
+            "xen-pmu-sample: host-wide PMU sampling of Xen and guests\n"
+            "Usage:\n"
+            "  xen-pmu-sample record [-e event] [-p period] [-d seconds] [-o file]\n"
+            "      sample every pcpu until interrupted or for <seconds>\n"
+            "      -e  raw event select, umask << 8 | event (default: cycles)\n"
+            "      -p  events per sample (default: 1000000)\n"
+            "      -o  output file (default: xen-pmu.data)\n"
+            "  xen-pmu-sample report [-x xen-syms] [-s domid:System.map]...\n"
+            "                        [-f perf|folded] [file]\n"
+            "      resolve samples and print them as 'perf script' output, or\n"
+            "      as folded stacks for flamegraph.pl\n");
+}
+
+static void sigint(int sig)
+{
+    interrupted = 1;
+}
+
+static int do_record(int argc, char *argv[])
+{
+    uint64_t event = 0, period = 1000000;
+    unsigned int duration = 0, cpu, nr_cpus;
+    const char *output = "xen-pmu.data";
+    xen_sysctl_pmu_sample_rec_t *buf;
+    struct timespec start, now;
+    unsigned long total = 0, lost_total = 0;
+    xc_physinfo_t info = { 0 };
+    FILE *f;
+    int opt, rc = 1, more;
+
+    while ( (opt = getopt(argc, argv, "e:p:d:o:")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'e':
+            event = strtoull(optarg, NULL, 0);
+            break;
+        case 'p':
+            period = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            duration = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            show_help();
+            return 1;
+        }
+    }
+
+    if ( xc_physinfo(xch, &info) )
+        err(1, "xc_physinfo");
+    nr_cpus = info.max_cpu_id + 1;
+
+    buf = calloc(BATCH, sizeof(*buf));
+    if ( !buf )
+        err(1, "calloc");
+
+    f = fopen(output, "w");
+    if ( !f )
+        err(1, "%s", output);
+    fwrite(SAMPLE_MAGIC, 1, strlen(SAMPLE_MAGIC), f);
+
+    if ( xc_pmu_sample_start(xch, event, period) )
+    {
+        warn("starting sampling");
+        goto out;
+    }
+
+    signal(SIGINT, sigint);
+    signal(SIGTERM, sigint);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for ( ; ; )
+    {
+        bool stopping = interrupted;
+
+        if ( duration )
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            stopping |= now.tv_sec - start.tv_sec >= duration;
+        }
+
+        /* Drain every ring, completely on the last pass. */
+        do {
+            more = 0;
+            for ( cpu = 0; cpu < nr_cpus; cpu++ )
+            {
+                struct chunk c = { .cpu = cpu, .nr = BATCH };
+                uint32_t lost = 0;
+
+                if ( xc_pmu_sample_read(xch, cpu, buf, &c.nr, &lost) )
+                {
+                    /* Offline pcpus have no ring. */
+                    if ( errno == EINVAL )
+                        continue;
+                    warn("reading samples of cpu%u", cpu);
+                    goto stop;
+                }
+
+                lost_total += lost;
+                if ( !c.nr )
+                    continue;
+
+                if ( fwrite(&c, sizeof(c), 1, f) != 1 ||
+                     fwrite(buf, sizeof(*buf), c.nr, f) != c.nr )
+                {
+                    warn("%s", output);
+                    goto stop;
+                }
+                total += c.nr;
+                more |= c.nr == BATCH;
+            }
+        } while ( more );
+
+        if ( stopping )
+            break;
+
+        usleep(POLL_MS * 1000);
+    }
+
+    rc = 0;
+    fprintf(stderr, "%lu samples written to %s, %lu lost\n",
+            total, output, lost_total);
+
+ stop:
+    if ( xc_pmu_sample_stop(xch) )
+    {
+        warn("stopping sampling");
+        rc = 1;
+    }
+ out:
+    if ( fclose(f) )
+    {
+        warn("%s", output);
+        rc = 1;
+    }
+    free(buf);
+
+    return rc;
+}
+
+static void sym_add(struct symtab *t, uint64_t addr, const char *name)
+{
+    if ( t->nr == t->max )
+    {
+        t->max = t->max ? t->max * 2 : 1024;
+        t->syms = realloc(t->syms, t->max * sizeof(*t->syms));
+        if ( !t->syms )
+            err(1, "realloc");
+    }
+
+    t->syms[t->nr].addr = addr;
+    t->syms[t->nr].name = strdup(name);
+    if ( !t->syms[t->nr].name )
+        err(1, "strdup");
+    t->nr++;
+}
+
+static int sym_cmp(const void *a, const void *b)
+{
+    const struct sym *x = a, *y = b;
+
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static void sym_sort(struct symtab *t)
+{
+    qsort(t->syms, t->nr, sizeof(*t->syms), sym_cmp);
+}
+
+static const struct sym *sym_lookup(const struct symtab *t, uint64_t addr)
+{
+    unsigned int lo = 0, hi = t->nr;
+
+    /* Last symbol at or below addr. */
+    while ( lo < hi )
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if ( t->syms[mid].addr <= addr )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo ? &t->syms[lo - 1] : NULL;
+}
+
+/* Function symbols of the xen-syms ELF image. */
+static void load_xen_syms(struct symtab *t, const char *path)
+{
+    const Elf64_Ehdr *eh;
+    const Elf64_Shdr *sh;
+    struct stat st;
+    unsigned int i, j;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if ( fd < 0 || fstat(fd, &st) )
+        err(1, "%s", path);
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if ( map == MAP_FAILED )
+        err(1, "%s", path);
+    close(fd);
+
+    eh = map;
+    if ( st.st_size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+         eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+         eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(*sh) > st.st_size )
+        errx(1, "%s: not a 64-bit ELF image", path);
+    sh = map + eh->e_shoff;
+
+    for ( i = 0; i < eh->e_shnum; i++ )
+    {
+        const Elf64_Sym *sym;
+        const char *str;
+
+        if ( sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum )
+            continue;
+
+        sym = map + sh[i].sh_offset;
+        str = map + sh[sh[i].sh_link].sh_offset;
+        for ( j = 0; j < sh[i].sh_size / sizeof(*sym); j++ )
+            if ( ELF64_ST_TYPE(sym[j].st_info) == STT_FUNC && sym[j].st_value )
+                sym_add(t, sym[j].st_value, str + sym[j].st_name);
+    }
+
+    munmap(map, st.st_size);
+    sym_sort(t);
+}
+
+/* Text symbols of a guest kernel System.map. */
+static void load_system_map(struct symtab *t, const char *path)
+{
+    char line[512], type, name[256];
+    unsigned long long addr;
+    FILE *f = fopen(path, "r");
+
+    if ( !f )
+        err(1, "%s", path);
+
+    while ( fgets(line, sizeof(line), f) )
+        if ( sscanf(line, "%llx %c %255s", &addr, &type, name) == 3 &&
+             strchr("tTwW", type) )
+            sym_add(t, addr, name);
+
+    fclose(f);
+    sym_sort(t);
+}
+
+static const struct symtab *find_symtab(const struct symtab *maps,
+                                        unsigned int nr_maps,
+                                        unsigned int domid)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_maps; i++ )
+        if ( maps[i].domid == domid )
+            return &maps[i];
+
+    return NULL;
+}
+
+static void domain_name(char *buf, size_t len, unsigned int domid)
+{
+    if ( domid == DOMID_IDLE )
+        snprintf(buf, len, "idle");
+    else
+        snprintf(buf, len, "d%u", domid);
+}
+
+/* Folded stacks are summed through a small open-addressed hash. */
+struct folded {
+    char *key;
+    unsigned long count;
+};
+
+static struct folded *folded;
+static unsigned int folded_nr, folded_max;
+
+static struct folded *folded_slot(const char *key)
+{
+    unsigned int h = 5381, i;
+    const char *p;
+
+    for ( p = key; *p; p++ )
+        h = h * 33 + (unsigned char)*p;
+
+    for ( i = h & (folded_max - 1); folded[i].key;
+          i = (i + 1) & (folded_max - 1) )
+        if ( !strcmp(folded[i].key, key) )
+            break;
+
+    return &folded[i];
+}
+
+static void folded_add(const char *key)
+{
+    struct folded *e;
+
+    if ( folded_nr * 2 >= folded_max )
+    {
+        struct folded *old = folded;
+        unsigned int i, old_max = folded_max;
+
+        folded_max = folded_max ? folded_max * 2 : 4096;
+        folded = calloc(folded_max, sizeof(*folded));
+        if ( !folded )
+            err(1, "calloc");
+        for ( i = 0; i < old_max; i++ )
+            if ( old[i].key )
+                *folded_slot(old[i].key) = old[i];
+        free(old);
+    }
+
+    e = folded_slot(key);
+    if ( !e->key )
+    {
+        e->key = strdup(key);
+        if ( !e->key )
+            err(1, "strdup");
+        folded_nr++;
+    }
+    e->count++;
+}
+
+static int do_report(int argc, char *argv[])
+{
+    static const char *const modes[] = { "xen", "kernel", "user" };
+    struct symtab xen = { .domid = DOMID_XEN }, *maps = NULL;
+    const char *input = "xen-pmu.data", *xen_syms = NULL;
+    xen_sysctl_pmu_sample_rec_t *buf;
+    unsigned int nr_maps = 0, i;
+    char magic[sizeof(SAMPLE_MAGIC) - 1];
+    bool folded_out = false;
+    struct chunk c;
+    FILE *f;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "x:s:f:")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'x':
+            xen_syms = optarg;
+            break;
+        case 's':
+        {
+            char *colon = strchr(optarg, ':');
+
+            if ( !colon )
+                errx(1, "-s expects domid:System.map");
+            maps = realloc(maps, (nr_maps + 1) * sizeof(*maps));
+            if ( !maps )
+                err(1, "realloc");
+            memset(&maps[nr_maps], 0, sizeof(*maps));
+            maps[nr_maps].domid = strtoul(optarg, NULL, 0);
+            load_system_map(&maps[nr_maps], colon + 1);
+            nr_maps++;
+            break;
+        }
+        case 'f':
+            if ( !strcmp(optarg, "folded") )
+                folded_out = true;
+            else if ( strcmp(optarg, "perf") )
+                errx(1, "unknown format '%s'", optarg);
+            break;
+        default:
+            show_help();
+            return 1;
+        }
+    }
+
+    if ( optind < argc )
+        input = argv[optind];
+    if ( xen_syms )
+        load_xen_syms(&xen, xen_syms);
+
+    f = fopen(input, "r");
+    if ( !f )
+        err(1, "%s", input);
+    if ( fread(magic, sizeof(magic), 1, f) != 1 ||
+         memcmp(magic, SAMPLE_MAGIC, sizeof(magic)) )
+        errx(1, "%s: not a xen-pmu-sample file", input);
+
+    buf = calloc(BATCH, sizeof(*buf));
+    if ( !buf )
+        err(1, "calloc");
+
+    while ( fread(&c, sizeof(c), 1, f) == 1 )
+    {
+        if ( c.nr > BATCH || fread(buf, sizeof(*buf), c.nr, f) != c.nr )
+            errx(1, "%s: truncated", input);
+
+        for ( i = 0; i < c.nr; i++ )
+        {
+            const xen_sysctl_pmu_sample_rec_t *r = &buf[i];
+            const struct symtab *t = NULL;
+            const struct sym *s = NULL;
+            const char *mode = r->mode < ARRAY_SIZE(modes) ? modes[r->mode]
+                                                           : "unknown";
+            char dom[16], sym[320];
+
+            if ( r->mode == XEN_SYSCTL_PMU_SAMPLE_xen )
+                t = &xen;
+            else if ( r->mode == XEN_SYSCTL_PMU_SAMPLE_kernel )
+                t = find_symtab(maps, nr_maps, r->domid);
+            if ( t )
+                s = sym_lookup(t, r->rip);
+
+            domain_name(dom, sizeof(dom), r->domid);
+
+            if ( folded_out )
+            {
+                if ( s )
+                    snprintf(sym, sizeof(sym), "%s;%s;%s", dom, mode, s->name);
+                else
+                    snprintf(sym, sizeof(sym), "%s;%s;[unknown]", dom, mode);
+                folded_add(sym);
+                continue;
+            }
+
+            if ( s )
+                snprintf(sym, sizeof(sym), "%s+0x%"PRIx64, s->name,
+                         r->rip - s->addr);
+            else
+                snprintf(sym, sizeof(sym), "[unknown]");
+
+            printf("%sv%u %u/%u [%03u] %"PRIu64".%09"PRIu64": 1 cycles:\n"
+                   "\t%16"PRIx64" %s (%s)\n\n",
+                   dom, r->vcpu, r->domid, r->vcpu, c.cpu,
+                   r->time / 1000000000, r->time % 1000000000,
+                   r->rip, sym, r->mode == XEN_SYSCTL_PMU_SAMPLE_xen
+                                ? "[xen]" : mode);
+        }
+    }
+
+    for ( i = 0; i < folded_max; i++ )
+        if ( folded[i].key )
+            printf("%s %lu\n", folded[i].key, folded[i].count);
+
+    fclose(f);
+    free(buf);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int rc;
+
+    if ( argc < 2 )
+    {
+        show_help();
+        return 1;
+    }
+
+    if ( !strcmp(argv[1], "report") )
+        return do_report(argc - 1, argv + 1);
+
+    if ( strcmp(argv[1], "record") )
+    {
+        show_help();
+        return !!strcmp(argv[1], "help");
+    }
+
+    xch = xc_interface_open(0, 0, 0);
+    if ( !xch )
+        err(1, "xc_interface_open");
+
+    rc = do_record(argc - 1, argv + 1);
+
+    xc_interface_close(xch);
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
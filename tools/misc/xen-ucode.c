@@ -0,0 +1,152 @@
+/*
+ * xen-ucode: late-load a microcode blob into all CPUs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <xenctrl.h>
+
+static void show_help(void)
+{
+    fprintf(stderr,
+            "xen-ucode: Xen microcode updating tool\n"
+            "Usage: xen-ucode [-s] [-v] <microcode blob>\n"
+            "  -s  update one CPU after the other (legacy behaviour)\n"
+            "  -v  print per-CPU results of a parallel update\n");
+}
+
+static int update_parallel(xc_interface *xch, const void *buf, size_t len,
+                           int verbose)
+{
+    xc_ucode_cpu_stat_t *stats;
+    uint32_t nr_cpus, i, online = 0, loaders = 0;
+    uint64_t total_ns, max_ns = 0;
+    int rc, saved_errno, max_cpus = xc_get_max_cpus(xch);
+
+    if ( max_cpus <= 0 )
+        err(1, "xc_get_max_cpus");
+
+    nr_cpus = max_cpus;
+    stats = calloc(nr_cpus, sizeof(*stats));
+    if ( !stats )
+        err(1, "calloc");
+
+    /* Per-CPU results are reported even when the update fails. */
+    rc = xc_microcode_update_parallel(xch, buf, len, &nr_cpus, stats,
+                                      &total_ns);
+    saved_errno = errno;
+
+    if ( nr_cpus > (uint32_t)max_cpus )
+        nr_cpus = max_cpus;
+
+    for ( i = 0; i < nr_cpus; i++ )
+    {
+        const xc_ucode_cpu_stat_t *st = &stats[i];
+
+        if ( !(st->flags & XENPF_UCODE_CPU_ONLINE) )
+            continue;
+
+        online++;
+        if ( st->flags & XENPF_UCODE_CPU_LOADER )
+            loaders++;
+        if ( st->ns > max_ns )
+            max_ns = st->ns;
+
+        if ( verbose || st->rc )
+            printf("CPU%-4u %-7s rev %#010x %8"PRIu64"us rc %d\n", i,
+                   (st->flags & XENPF_UCODE_CPU_LOADER) ? "loader" : "sibling",
+                   st->rev, st->ns / 1000, st->rc);
+    }
+
+    if ( online )
+        printf("Updated %u cores in %"PRIu64"us (slowest CPU %"PRIu64"us)\n",
+               loaders, total_ns / 1000, max_ns / 1000);
+
+    free(stats);
+    errno = saved_errno;
+
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd, opt, ret, serial = 0, verbose = 0;
+    char *filename, *buf;
+    size_t len;
+    struct stat st;
+    xc_interface *xch;
+
+    while ( (opt = getopt(argc, argv, "svh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 's':
+            serial = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            show_help();
+            exit(opt == 'h' ? 0 : 2);
+        }
+    }
+
+    if ( optind != argc - 1 )
+    {
+        show_help();
+        exit(2);
+    }
+
+    filename = argv[optind];
+    fd = open(filename, O_RDONLY);
+    if ( fd < 0 )
+        err(1, "Could not open %s", filename);
+
+    if ( fstat(fd, &st) != 0 )
+        err(1, "Could not get the size of %s", filename);
+
+    len = st.st_size;
+    buf = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if ( buf == MAP_FAILED )
+        err(1, "mmap");
+
+    xch = xc_interface_open(0, 0, 0);
+    if ( xch == NULL )
+        err(1, "xc_interface_open");
+
+    if ( serial )
+        ret = xc_microcode_update(xch, buf, len);
+    else
+        ret = update_parallel(xch, buf, len, verbose);
+
+    if ( ret )
+        fprintf(stderr, "Failed to update microcode: %d (%s)\n",
+                errno, strerror(errno));
+
+    xc_interface_close(xch);
+
+    if ( munmap(buf, len) )
+        err(1, "munmap");
+    close(fd);
+
+    return ret ? 1 : 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
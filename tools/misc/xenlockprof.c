@@ -18,6 +18,161 @@
 #include <string.h>
 #include <inttypes.h>
 
+static const char *const lockcont_type_name[] = {
+    [LOCKCONT_TYPE_SPIN_WAIT]   = "spin",
+    [LOCKCONT_TYPE_SPIN_HOLDER] = "holder",
+    [LOCKCONT_TYPE_READ_WAIT]   = "read",
+    [LOCKCONT_TYPE_WRITE_WAIT]  = "write",
+};
+
+static unsigned long long lockcont_pct(const uint64_t *h, uint64_t total,
+                                       double frac)
+{
+    uint64_t seen = 0, want = total * frac;
+    unsigned int b;
+
+    for ( b = 0; b < XEN_SYSCTL_LAT_HIST_BUCKETS - 1; b++ )
+    {
+        seen += h[b];
+        if ( seen > want )
+            break;
+    }
+
+    return 1ULL << (b + 6);
+}
+
+/* Group the per-cpu records of a call site together. */
+static int lockcont_cmp_site(const void *a, const void *b)
+{
+    const xc_lockcont_data_t *x = a, *y = b;
+
+    if ( x->type != y->type )
+        return x->type < y->type ? -1 : 1;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/* Waits by time waited, holders by contended releases, largest first. */
+static int lockcont_cmp_cost(const void *a, const void *b)
+{
+    const xc_lockcont_data_t *x = a, *y = b;
+    uint64_t cx = x->type == LOCKCONT_TYPE_SPIN_HOLDER ? x->count : x->total;
+    uint64_t cy = y->type == LOCKCONT_TYPE_SPIN_HOLDER ? y->count : y->total;
+
+    if ( (x->type == LOCKCONT_TYPE_SPIN_HOLDER) !=
+         (y->type == LOCKCONT_TYPE_SPIN_HOLDER) )
+        return x->type == LOCKCONT_TYPE_SPIN_HOLDER ? 1 : -1;
+    return cx > cy ? -1 : cx < cy;
+}
+
+static int lockcont(xc_interface *xc_handle, int reset, long sample)
+{
+    uint32_t i, j, n, m, rate, dropped;
+    uint64_t time;
+    unsigned int b;
+    DECLARE_HYPERCALL_BUFFER(xc_lockcont_data_t, data);
+
+    if ( sample >= 0 )
+    {
+        if ( xc_lockcont_enable(xc_handle, sample) != 0 )
+        {
+            fprintf(stderr, "Error setting contention sampling: %d (%s)\n",
+                    errno, strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
+    if ( reset )
+    {
+        if ( xc_lockcont_reset(xc_handle) != 0 )
+        {
+            fprintf(stderr, "Error reseting contention profile: %d (%s)\n",
+                    errno, strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
+    n = 0;
+    if ( xc_lockcont_query_number(xc_handle, &n) != 0 )
+    {
+        fprintf(stderr, "Error getting number of contention records: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    n += 64;    /* sites keep being added */
+    data = xc_hypercall_buffer_alloc(xc_handle, data, sizeof(*data) * n);
+    if ( data == NULL )
+    {
+        fprintf(stderr, "Could not allocate buffers: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    m = n;
+    if ( xc_lockcont_query(xc_handle, &m, &time, &rate, &dropped,
+                           HYPERCALL_BUFFER(data)) != 0 )
+    {
+        fprintf(stderr, "Error getting contention records: %d (%s)\n",
+                errno, strerror(errno));
+        xc_hypercall_buffer_free(xc_handle, data);
+        return 1;
+    }
+
+    if ( m > n )
+    {
+        printf("data incomplete, %d records are missing!\n\n", m - n);
+        m = n;
+    }
+
+    /* Fold the records of each call site into its first one. */
+    qsort(data, m, sizeof(*data), lockcont_cmp_site);
+    for ( i = 0, j = 0; i < m; i++ )
+    {
+        if ( j && !lockcont_cmp_site(&data[j - 1], &data[i]) )
+        {
+            data[j - 1].count += data[i].count;
+            data[j - 1].total += data[i].total;
+            if ( data[i].max > data[j - 1].max )
+                data[j - 1].max = data[i].max;
+            for ( b = 0; b < XEN_SYSCTL_LAT_HIST_BUCKETS; b++ )
+                data[j - 1].hist[b] += data[i].hist[b];
+        }
+        else
+            data[j++] = data[i];
+    }
+    m = j;
+    qsort(data, m, sizeof(*data), lockcont_cmp_cost);
+
+    if ( rate )
+        printf("sampling 1 in %u contended acquisitions\n", rate);
+    else
+        printf("sampling disabled\n");
+    printf("profiling time: %20.9fs, %u events dropped\n\n",
+           (double)time / 1E+09, dropped);
+
+    printf("%-50s %-6s %10s %12s %10s %10s %10s\n", "waiter", "type",
+           "count", "wait(us)", "max(us)", "p50(ns)", "p99(ns)");
+    for ( i = 0; i < m && data[i].type != LOCKCONT_TYPE_SPIN_HOLDER; i++ )
+        printf("%-50s %-6s %10"PRIu64" %12"PRIu64" %10"PRIu64" %10llu %10llu\n",
+               data[i].site, lockcont_type_name[data[i].type], data[i].count,
+               data[i].total / 1000, data[i].max / 1000,
+               lockcont_pct(data[i].hist, data[i].count, 0.5),
+               lockcont_pct(data[i].hist, data[i].count, 0.99));
+
+    printf("\n%-50s %10s %12s %10s\n", "holder", "releases", "avg waiters",
+           "max");
+    for ( ; i < m; i++ )
+        printf("%-50s %10"PRIu64" %12.2f %10"PRIu64"\n",
+               data[i].site, data[i].count,
+               (double)data[i].total / data[i].count, data[i].max);
+
+    xc_hypercall_buffer_free(xc_handle, data);
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     xc_interface      *xc_handle;
@@ -25,13 +180,30 @@ int main(int argc, char *argv[])
     uint64_t           time;
     double             l, b, sl, sb;
     char               name[100];
+    int                a, reset = 0, cont = 0, rc;
+    long               sample = -1;
     DECLARE_HYPERCALL_BUFFER(xc_lockprof_data_t, data);
 
-    if ( (argc > 2) || ((argc == 2) && (strcmp(argv[1], "-r") != 0)) )
+    for ( a = 1; a < argc; a++ )
     {
-        printf("%s: [-r]\n", argv[0]);
-        printf("no args: print lock profile data\n");
+        if ( !strcmp(argv[a], "-r") )
+            reset = 1;
+        else if ( !strcmp(argv[a], "-c") )
+            cont = 1;
+        else if ( !strcmp(argv[a], "-C") && a + 1 < argc )
+            sample = strtol(argv[++a], NULL, 0);
+        else
+            break;
+    }
+
+    if ( a < argc || (sample >= 0 && (reset || cont)) )
+    {
+        printf("%s: [-c] [-r] | -C <n>\n", argv[0]);
+        printf("no args: print lock profile data (lock profiling builds)\n");
         printf("    -r : reset profile data\n");
+        printf("    -c : print (with -r: reset) the lock contention profile\n");
+        printf("    -C : sample every <n>th contended lock acquisition,\n"
+               "         0 to stop contention sampling\n");
         return 1;
     }
 
@@ -42,7 +214,14 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if ( argc > 1 )
+    if ( cont || sample >= 0 )
+    {
+        rc = lockcont(xc_handle, reset, sample);
+        xc_interface_close(xc_handle);
+        return rc;
+    }
+
+    if ( reset )
     {
         if ( xc_lockprof_reset(xc_handle) != 0 )
         {
@@ -68,6 +68,122 @@ const char *hypercall_name_table[64] =
 };
 #undef X
 
+static const char *const lat_hist_set_name[XEN_SYSCTL_LAT_HIST_NR] = {
+    [XEN_SYSCTL_LAT_HIST_vmexit]      = "vmexit",
+    [XEN_SYSCTL_LAT_HIST_hypercall]   = "hypercall",
+    [XEN_SYSCTL_LAT_HIST_grant_op]    = "grant_op",
+    [XEN_SYSCTL_LAT_HIST_evtchn_send] = "evtchn_send",
+};
+
+#define X(name) [GNTTABOP_##name] = #name
+static const char *const grant_op_name_table[] =
+{
+    X(map_grant_ref),
+    X(unmap_grant_ref),
+    X(setup_table),
+    X(dump_table),
+    X(transfer),
+    X(copy),
+    X(query_size),
+    X(unmap_and_replace),
+    X(set_version),
+    X(get_status_frames),
+    X(get_version),
+    X(swap_grant_ref),
+    X(cache_flush),
+};
+#undef X
+
+/* Upper bound, in ns, of the bucket holding the given fraction of samples. */
+static unsigned long long lat_hist_pct(const uint64_t *h, uint64_t total,
+                                       double frac)
+{
+    uint64_t seen = 0, want = total * frac;
+    unsigned int b;
+
+    for ( b = 0; b < XEN_SYSCTL_LAT_HIST_BUCKETS - 1; b++ )
+    {
+        seen += h[b];
+        if ( seen > want )
+            break;
+    }
+
+    return 1ULL << (b + 6);
+}
+
+static int lat_hist_print(xc_interface *xc_handle, int reset)
+{
+    uint32_t set, i, b, nr;
+    uint64_t *data, total;
+    const char *name;
+    char buf[32];
+
+    for ( set = 0; set < XEN_SYSCTL_LAT_HIST_NR; set++ )
+    {
+        nr = 0;
+        if ( xc_lat_hist(xc_handle, set, XEN_SYSCTL_LAT_HIST_ALL_CPUS, 0,
+                         &nr, NULL) )
+            goto fail;
+
+        data = calloc(nr, XEN_SYSCTL_LAT_HIST_BUCKETS * sizeof(*data));
+        if ( !data )
+            goto fail;
+
+        if ( xc_lat_hist(xc_handle, set, XEN_SYSCTL_LAT_HIST_ALL_CPUS,
+                         reset ? XEN_SYSCTL_LAT_HIST_RESET : 0, &nr, data) )
+        {
+            free(data);
+            goto fail;
+        }
+
+        printf("%s:\n", lat_hist_set_name[set]);
+        printf("  %-28s %12s %10s %10s %10s\n",
+               "", "count", "p50(ns)", "p99(ns)", "p99.9(ns)");
+
+        for ( i = 0; i < nr; i++ )
+        {
+            const uint64_t *h = &data[i * XEN_SYSCTL_LAT_HIST_BUCKETS];
+
+            for ( total = 0, b = 0; b < XEN_SYSCTL_LAT_HIST_BUCKETS; b++ )
+                total += h[b];
+            if ( !total )
+                continue;
+
+            name = NULL;
+            if ( set == XEN_SYSCTL_LAT_HIST_hypercall && i < 64 )
+                name = hypercall_name_table[i];
+            else if ( set == XEN_SYSCTL_LAT_HIST_grant_op &&
+                      i < sizeof(grant_op_name_table) /
+                          sizeof(*grant_op_name_table) )
+                name = grant_op_name_table[i];
+            else if ( set == XEN_SYSCTL_LAT_HIST_evtchn_send )
+                name = "send";
+            if ( !name )
+            {
+                snprintf(buf, sizeof(buf), "%s %u",
+                         set == XEN_SYSCTL_LAT_HIST_vmexit ? "reason" : "nr",
+                         i);
+                name = buf;
+            }
+
+            printf("  %-28s %12llu %10llu %10llu %10llu\n", name,
+                   (unsigned long long)total,
+                   lat_hist_pct(h, total, 0.5),
+                   lat_hist_pct(h, total, 0.99),
+                   lat_hist_pct(h, total, 0.999));
+        }
+
+        free(data);
+    }
+
+    return 0;
+
+ fail:
+    fprintf(stderr, "Error %s latency histograms: %d (%s)\n",
+            reset ? "resetting" : "getting", errno, strerror(errno));
+    return 1;
+}
+
 int main(int argc, char *argv[])
 {
     int              i, j;
@@ -76,7 +192,7 @@ int main(int argc, char *argv[])
     DECLARE_HYPERCALL_BUFFER(xc_perfc_val_t, pcv);
     xc_perfc_val_t  *val;
     int num_desc, num_val;
-    unsigned int    sum, reset = 0, full = 0, pretty = 0;
+    unsigned int    sum, reset = 0, full = 0, pretty = 0, lat = 0;
     char hypercall_name[36];
 
     if ( argc > 1 )
@@ -96,6 +212,13 @@ int main(int argc, char *argv[])
             case 'r':
                 reset = 1;
                 break;
+            case 'l':
+                lat = 1;
+                break;
+            case 'L':
+                lat = 1;
+                reset = 1;
+                break;
             default:
                 goto error;
             }
@@ -103,11 +226,13 @@ int main(int argc, char *argv[])
         else
         {
         error:
-            printf("%s: [-r]\n", argv[0]);
+            printf("%s: [-r|-l|-L]\n", argv[0]);
             printf("no args: print digested counters\n");
             printf("    -f : print full arrays/histograms\n");
             printf("    -p : print full arrays/histograms in pretty format\n");
             printf("    -r : reset counters\n");
+            printf("    -l : print hot path latency histogram summaries\n");
+            printf("    -L : print and reset latency histograms\n");
             return 0;
         }
     }   
@@ -118,6 +243,9 @@ int main(int argc, char *argv[])
                 errno, strerror(errno));
         return 1;
     }
+
+    if ( lat )
+        return lat_hist_print(xc_handle, reset);
     
     if ( reset )
     {
@@ -65,10 +65,20 @@ void show_help(void)
             " set-vcpu-migration-delay      <num> set scheduler vcpu migration delay in us\n"
             " get-vcpu-migration-delay            get scheduler vcpu migration delay\n"
             " set-max-cstate        <num>         set the C-State limitation (<num> >= 0)\n"
+            " get-max-latency       [cpuid]       list C-state exit latency limit of CPU <cpuid>\n"
+            "                                     or all\n"
+            " set-max-latency       [cpuid|pool:<poolid>] <us>\n"
+            "                                     limit the exit latency of the C-states\n"
+            "                                     CPU <cpuid>, the CPUs of a cpupool or all\n"
+            "                                     CPUs may enter (0 for no limit)\n"
             " start [seconds]                     start collect Cx/Px statistics,\n"
             "                                     output after CTRL-C or SIGINT or several seconds.\n"
             " enable-turbo-mode     [cpuid]       enable Turbo Mode for processors that support it.\n"
             " disable-turbo-mode    [cpuid]       disable Turbo Mode for processors that support it.\n"
+            " get-sched-hist        [cpuid]       list scheduler latency histograms of CPU <cpuid>\n"
+            "                                     or of all CPUs\n"
+            " reset-sched-hist      [cpuid]       reset scheduler latency histograms of CPU <cpuid>\n"
+            "                                     or of all CPUs\n"
             );
 }
 /* wrapper function */
@@ -1117,6 +1127,76 @@ void set_max_cstate_func(int argc, char *argv[])
                 value, errno, strerror(errno));
 }
 
+void get_max_latency_func(int argc, char *argv[])
+{
+    int cpuid = -1, i;
+    uint32_t value;
+
+    if ( argc > 0 )
+        parse_cpuid(argv[0], &cpuid);
+
+    for ( i = 0; i < max_cpu_nr; i++ )
+    {
+        if ( cpuid >= 0 && i != cpuid )
+            continue;
+
+        if ( xc_get_cpuidle_max_latency(xc_handle, i, &value) )
+            fprintf(stderr,
+                    "[CPU%d] failed to get C-state latency limit (%d - %s)\n",
+                    i, errno, strerror(errno));
+        else if ( value )
+            printf("CPU%d: C-state exit latency limited to %uus\n", i, value);
+        else
+            printf("CPU%d: no C-state exit latency limit\n", i);
+    }
+}
+
+void set_max_latency_func(int argc, char *argv[])
+{
+    int cpuid = -1, poolid, value, i;
+    xc_cpupoolinfo_t *info = NULL;
+
+    if ( argc > 1 && !strncmp(argv[0], "pool:", 5) )
+    {
+        if ( sscanf(argv[0] + 5, "%d", &poolid) != 1 || poolid < 0 )
+        {
+            fprintf(stderr, "Invalid cpupool identifier: '%s'\n", argv[0]);
+            exit(EINVAL);
+        }
+
+        info = xc_cpupool_getinfo(xc_handle, poolid);
+        if ( !info || info->cpupool_id != poolid )
+        {
+            fprintf(stderr, "No cpupool %d\n", poolid);
+            exit(ENOENT);
+        }
+        argc--;
+        argv++;
+    }
+
+    parse_cpuid_and_int(argc, argv, &cpuid, &value, "latency");
+    if ( value < 0 )
+    {
+        fprintf(stderr, "Invalid latency '%d'\n", value);
+        exit(EINVAL);
+    }
+
+    for ( i = 0; i < max_cpu_nr; i++ )
+    {
+        if ( info ? !(info->cpumap[i / 8] & (1 << (i % 8)))
+                  : cpuid >= 0 && i != cpuid )
+            continue;
+
+        if ( xc_set_cpuidle_max_latency(xc_handle, i, value) )
+            fprintf(stderr,
+                    "[CPU%d] failed to set C-state latency limit (%d - %s)\n",
+                    i, errno, strerror(errno));
+    }
+
+    if ( info )
+        xc_cpupool_infofree(xc_handle, info);
+}
+
 void enable_turbo_mode(int argc, char *argv[])
 {
     int cpuid = -1;
@@ -1163,6 +1243,71 @@ void disable_turbo_mode(int argc, char *argv[])
                 errno, strerror(errno));
 }
 
+void get_sched_hist_func(int argc, char *argv[])
+{
+    static const char *const names[XEN_SYSCTL_SCHED_HIST_NR] = {
+        [XEN_SYSCTL_SCHED_HIST_wakeup]    = "wakeup",
+        [XEN_SYSCTL_SCHED_HIST_runq_wait] = "runq-wait",
+        [XEN_SYSCTL_SCHED_HIST_ctxsw]     = "ctx-switch",
+        [XEN_SYSCTL_SCHED_HIST_slice_req] = "slice-req",
+        [XEN_SYSCTL_SCHED_HIST_slice_run] = "slice-run",
+    };
+    uint64_t data[XEN_SYSCTL_SCHED_HIST_NR * XEN_SYSCTL_SCHED_HIST_BUCKETS];
+    int cpuid = -1;
+    unsigned int h, b;
+    char label[32];
+
+    if ( argc > 0 )
+        parse_cpuid(argv[0], &cpuid);
+
+    if ( xc_sched_hist(xc_handle, cpuid < 0 ? XEN_SYSCTL_SCHED_HIST_ALL_CPUS
+                                            : cpuid, 0, data) )
+    {
+        fprintf(stderr, "failed to get scheduler histograms (%d - %s)\n",
+                errno, strerror(errno));
+        exit(errno);
+    }
+
+    if ( cpuid < 0 )
+        printf("Scheduler latency histograms, all CPUs:\n");
+    else
+        printf("Scheduler latency histograms, CPU%d:\n", cpuid);
+
+    printf("%-20s", "bucket");
+    for ( h = 0; h < XEN_SYSCTL_SCHED_HIST_NR; h++ )
+        printf(" %12s", names[h]);
+    printf("\n");
+
+    for ( b = 0; b < XEN_SYSCTL_SCHED_HIST_BUCKETS; b++ )
+    {
+        if ( b == 0 )
+            snprintf(label, sizeof(label), "<1us");
+        else if ( b == XEN_SYSCTL_SCHED_HIST_BUCKETS - 1 )
+            snprintf(label, sizeof(label), ">=%uus", 1U << (b - 1));
+        else
+            snprintf(label, sizeof(label), "%u-%uus", 1U << (b - 1), 1U << b);
+
+        printf("%-20s", label);
+        for ( h = 0; h < XEN_SYSCTL_SCHED_HIST_NR; h++ )
+            printf(" %12"PRIu64, data[h * XEN_SYSCTL_SCHED_HIST_BUCKETS + b]);
+        printf("\n");
+    }
+}
+
+void reset_sched_hist_func(int argc, char *argv[])
+{
+    int cpuid = -1;
+
+    if ( argc > 0 )
+        parse_cpuid(argv[0], &cpuid);
+
+    if ( xc_sched_hist(xc_handle, cpuid < 0 ? XEN_SYSCTL_SCHED_HIST_ALL_CPUS
+                                            : cpuid,
+                       XEN_SYSCTL_SCHED_HIST_RESET, NULL) )
+        fprintf(stderr, "failed to reset scheduler histograms (%d - %s)\n",
+                errno, strerror(errno));
+}
+
 struct {
     const char *name;
     void (*function)(int argc, char *argv[]);
@@ -1184,8 +1329,12 @@ struct {
     { "get-vcpu-migration-delay", get_vcpu_migration_delay_func},
     { "set-vcpu-migration-delay", set_vcpu_migration_delay_func},
     { "set-max-cstate", set_max_cstate_func},
+    { "get-max-latency", get_max_latency_func },
+    { "set-max-latency", set_max_latency_func },
     { "enable-turbo-mode", enable_turbo_mode },
     { "disable-turbo-mode", disable_turbo_mode },
+    { "get-sched-hist", get_sched_hist_func },
+    { "reset-sched-hist", reset_sched_hist_func },
 };
 
 int main(int argc, char *argv[])
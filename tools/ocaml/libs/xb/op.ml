@@ -20,6 +20,7 @@ type operation = Debug | Directory | Read | Getperms |
                  Getdomainpath | Write | Mkdir | Rm |
                  Setperms | Watchevent | Error | Isintroduced |
                  Resume | Set_target | Reset_watches |
+                 Directory_recursive | Read_multiple | Write_multiple |
                  Invalid
 
 let operation_c_mapping =
@@ -28,7 +29,9 @@ let operation_c_mapping =
            Transaction_end; Introduce; Release;
            Getdomainpath; Write; Mkdir; Rm;
            Setperms; Watchevent; Error; Isintroduced;
-           Resume; Set_target; Reset_watches |]
+           Resume; Set_target; Invalid (* was Restrict *); Reset_watches;
+           Invalid (* Directory_part *); Directory_recursive;
+           Read_multiple; Write_multiple |]
 let size = Array.length operation_c_mapping
 
 let array_search el a =
@@ -69,4 +72,7 @@ let to_string ty =
 	| Resume		-> "RESUME"
 	| Set_target		-> "SET_TARGET"
 	| Reset_watches         -> "RESET_WATCHES"
+	| Directory_recursive	-> "DIRECTORY_RECURSIVE"
+	| Read_multiple		-> "READ_MULTIPLE"
+	| Write_multiple	-> "WRITE_MULTIPLE"
 	| Invalid		-> "INVALID"
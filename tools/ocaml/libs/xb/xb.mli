@@ -23,6 +23,9 @@ module Op :
       | Resume
       | Set_target
       | Reset_watches
+      | Directory_recursive
+      | Read_multiple
+      | Write_multiple
       | Invalid
     val operation_c_mapping : operation array
     val size : int
@@ -50,8 +50,19 @@ type t =
 	acl: (Xenctrl.domid * permty) list;
 }
 
+(* Permissions are hash-consed: equal ones are one shared value, so that they
+   are compared by address and aren't stored once per node. *)
+module Table = Weak.Make(struct
+	type perms = t
+	type t = perms
+	let equal (a : t) (b : t) = a = b
+	let hash = Hashtbl.hash
+end)
+
+let table = Table.create 64
+
 let create owner other acl =
-	{ owner = owner; other = other; acl = acl }
+	Table.merge table { owner = owner; other = other; acl = acl }
 
 let get_other perms = perms.other
 let get_acl perms = perms.acl
@@ -136,9 +147,8 @@ let check_owner (connection:Connection.t) (node:Node.t) =
 let check (connection:Connection.t) request (node:Node.t) =
 	let check_acl domainid =
 		let perm =
-			if List.mem_assoc domainid (Node.get_acl node)
-			then List.assoc domainid (Node.get_acl node)
-			else Node.get_other node
+			try List.assoc domainid (Node.get_acl node)
+			with Not_found -> Node.get_other node
 		in
 		match perm, request with
 		| NONE, _ ->
@@ -160,5 +170,6 @@ let check (connection:Connection.t) request (node:Node.t) =
 	&& not (List.exists check_acl (Connection.get_owners connection))
 	then raise Define.Permission_denied
 
-let equiv perm1 perm2 =
-	(Node.to_string perm1) = (Node.to_string perm2)
+(* Node permissions are hash-consed, see Node.create. *)
+let equiv (perm1:Node.t) (perm2:Node.t) =
+	perm1 == perm2
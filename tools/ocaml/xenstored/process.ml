@@ -116,6 +116,52 @@ let do_read con t domains cons data =
 	let path = split_one_path data con in
 	Transaction.read t (Connection.get_perm con) path
 
+(* path+: for each path either <len>|<value> or <error>| *)
+let do_read_multiple con t domains cons data =
+	let len = String.length data in
+	if len = 0 || data.[len - 1] <> '\000' then
+		raise Invalid_Cmd_Args;
+	let buf = Buffer.create 256 in
+	List.iter (fun path ->
+		(try
+			let path = Store.Path.create path (Connection.get_path con) in
+			let value = Transaction.read t (Connection.get_perm con) path in
+			bprintf buf "%d\000%s" (String.length value) value
+		with
+		| Define.Permission_denied ->
+			Buffer.add_string buf "EACCES\000"
+		| Define.Invalid_path | Invalid_argument _ ->
+			Buffer.add_string buf "EINVAL\000"
+		| Define.Doesnt_exist | Define.Lookup_Doesnt_exist _ | Not_found ->
+			Buffer.add_string buf "ENOENT\000");
+		if Buffer.length buf > Connection.xenstore_payload_max then
+			raise Quota.Data_too_big
+	) (split (Some (-1)) '\000' (String.sub data 0 (len - 1)));
+	Buffer.contents buf
+
+(* All the descendants of a node relative to it, parents before their
+   children.  The descendants of nodes which can't be read are left out. *)
+let do_directory_recursive con t domains cons data =
+	let path = split_one_path data con in
+	let perm = Connection.get_perm con in
+	let buf = Buffer.create 256 in
+	let rec add path prefix names =
+		List.iter (fun name ->
+			let rel = if prefix = "" then name else prefix ^ "/" ^ name in
+			Buffer.add_string buf rel;
+			Buffer.add_char buf '\000';
+			if Buffer.length buf > Connection.xenstore_payload_max then
+				raise Quota.Data_too_big;
+			let cpath = Store.Path.of_path_and_name path name in
+			match (try Some (Transaction.ls t perm cpath)
+			       with Define.Permission_denied -> None) with
+			| Some names -> add cpath rel names
+			| None       -> ()
+		) names
+		in
+	add path "" (Transaction.ls t perm path);
+	Buffer.contents buf
+
 let do_getperms con t domains cons data =
 	let path = split_one_path data con in
 	let perms = Transaction.getperms t (Connection.get_perm con) path in
@@ -138,6 +184,48 @@ let do_write con t domains cons data =
 	create_implicit_path t (Connection.get_perm con) path;
 	Transaction.write t (Connection.get_perm con) path value
 
+let is_decimal s =
+	s <> "" && String.fold_left (fun acc c -> acc && c >= '0' && c <= '9') true s
+
+(* (path, length, value)+: the whole request is checked before any of the
+   writes are done, in order.  The first failing write fails the request,
+   leaving the earlier ones done, as in C xenstored. *)
+let do_write_multiple con t domains cons data =
+	let len = String.length data in
+	let next_null off =
+		try String.index_from data off '\000'
+		with Not_found | Invalid_argument _ -> raise Invalid_Cmd_Args
+		in
+	let rec parse off =
+		if off >= len then []
+		else begin
+			let path_end = next_null off in
+			let len_end = next_null (path_end + 1) in
+			let path = String.sub data off (path_end - off)
+			and vlen = String.sub data (path_end + 1) (len_end - path_end - 1) in
+			if path = "" || not (is_decimal vlen) then
+				raise Invalid_Cmd_Args;
+			let vlen = try int_of_string vlen with Failure _ -> raise Invalid_Cmd_Args in
+			if vlen > len - len_end - 1 then
+				raise Invalid_Cmd_Args;
+			(path, String.sub data (len_end + 1) vlen) :: parse (len_end + 1 + vlen)
+		end
+		in
+	if len = 0 then
+		raise Invalid_Cmd_Args;
+	let writes = parse 0 in
+	try
+		List.iter (fun (path, value) ->
+			let path = Store.Path.create path (Connection.get_path con) in
+			create_implicit_path t (Connection.get_perm con) path;
+			Transaction.write t (Connection.get_perm con) path value
+		) writes
+	with e ->
+		(* The writes done so far stay, so their watches have to fire. *)
+		if Transaction.get_id t = Transaction.none then
+			process_watch (Transaction.get_paths t) cons;
+		raise e
+
 let do_mkdir con t domains cons data =
 	let path = split_one_path data con in
 	create_implicit_path t (Connection.get_perm con) path;
@@ -243,6 +331,9 @@ let function_of_type_simple_op ty =
 	| Xenbus.Xb.Op.Mkdir             -> reply_ack do_mkdir
 	| Xenbus.Xb.Op.Rm                -> reply_ack do_rm
 	| Xenbus.Xb.Op.Setperms          -> reply_ack do_setperms
+	| Xenbus.Xb.Op.Directory_recursive -> reply_data do_directory_recursive
+	| Xenbus.Xb.Op.Read_multiple     -> reply_data do_read_multiple
+	| Xenbus.Xb.Op.Write_multiple    -> reply_ack do_write_multiple
 	| _                              -> reply_ack do_error
 
 let input_handle_error ~cons ~doms ~fct ~con ~t ~req =
@@ -473,10 +564,13 @@ let retain_op_in_history ty =
 	| Xenbus.Xb.Op.Write
 	| Xenbus.Xb.Op.Mkdir
 	| Xenbus.Xb.Op.Rm
-	| Xenbus.Xb.Op.Setperms          -> true
+	| Xenbus.Xb.Op.Setperms
+	| Xenbus.Xb.Op.Write_multiple    -> true
 	| Xenbus.Xb.Op.Debug
 	| Xenbus.Xb.Op.Directory
+	| Xenbus.Xb.Op.Directory_recursive
 	| Xenbus.Xb.Op.Read
+	| Xenbus.Xb.Op.Read_multiple
 	| Xenbus.Xb.Op.Getperms
 	| Xenbus.Xb.Op.Watch
 	| Xenbus.Xb.Op.Unwatch
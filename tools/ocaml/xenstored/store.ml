@@ -53,6 +53,7 @@ let find node childname =
 	List.find (fun n -> n.name = childname) node.children
 
 let replace_child node child nchild =
+	if nchild == child then node else
 	(* this is the on-steroid version of the filter one-replace one *)
 	let rec replace_one_in_list l =
 		match l with
@@ -157,13 +158,11 @@ let rec lookup_modify node path fct =
 	| []      -> raise (Define.Invalid_path)
 	| h :: [] -> fct node h
 	| h :: l  ->
-		let (n, c) =
-			if not (Node.exists node h) then
-				raise (Define.Lookup_Doesnt_exist h)
-			else
-				(node, Node.find node h) in
+		let c =
+			try Node.find node h
+			with Not_found -> raise (Define.Lookup_Doesnt_exist h) in
 		let nc = lookup_modify c l fct in
-		Node.replace_child n c nc
+		Node.replace_child node c nc
 
 let apply_modify rnode path fct =
 	lookup_modify rnode path fct
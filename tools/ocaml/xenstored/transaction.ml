@@ -22,18 +22,19 @@ let none = 0
 let test_eagain = ref false
 let do_coalesce = ref true
 
+(* Walk down both trees at once: below a node they share, everything is
+   identical, so there is no need to look further. *)
 let check_parents_perms_identical root1 root2 path =
-	let hierarch = Store.Path.get_hierarchy path in
-	let permdiff = List.fold_left (fun acc path ->
-		let n1 = Store.Path.get_node root1 path
-		and n2 = Store.Path.get_node root2 path in
-		match n1, n2 with
-		| Some n1, Some n2 ->
-			not (Perms.equiv (Store.Node.get_perms n1) (Store.Node.get_perms n2)) || acc
-		| _ ->
-			true || acc
-	) false hierarch in
-	(not permdiff)
+	let rec check n1 n2 path =
+		n1 == n2 ||
+		(Perms.equiv (Store.Node.get_perms n1) (Store.Node.get_perms n2) &&
+		 match path with
+		 | []      -> true
+		 | h :: tl ->
+			(try check (Store.Node.find n1 h) (Store.Node.find n2 h) tl
+			 with Not_found -> false))
+		in
+	check root1 root2 path
 
 let get_lowest path1 path2 =
 	match path2 with
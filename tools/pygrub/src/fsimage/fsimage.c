@@ -107,9 +107,38 @@ PyDoc_STRVAR(fsimage_file_read__doc__,
    "file. If offset is specified as well, read from the given "
    "offset.\n");
 
+static PyObject *
+fsimage_file_stat(fsimage_file_t *file, PyObject *args)
+{
+	fsi_stat_t st;
+
+	if (!PyArg_ParseTuple(args, ""))
+		return (NULL);
+
+	if (fsi_stat_file(file->file, &st) == -1) {
+		PyErr_SetFromErrno(PyExc_IOError);
+		return (NULL);
+	}
+
+	return (Py_BuildValue("{s:K,s:K,s:k,s:L,s:L}",
+	    "size", (unsigned PY_LONG_LONG)st.fs_size,
+	    "ino", (unsigned PY_LONG_LONG)st.fs_ino,
+	    "generation", (unsigned long)st.fs_gen,
+	    "mtime", (PY_LONG_LONG)st.fs_mtime,
+	    "ctime", (PY_LONG_LONG)st.fs_ctime));
+}
+
+PyDoc_STRVAR(fsimage_file_stat__doc__,
+   "stat(file)\n"
+   "\n"
+   "Return a dict with the size, ino, generation, mtime and ctime "
+   "of the given file. Fields the filesystem cannot supply are 0.\n");
+
 static struct PyMethodDef fsimage_file_methods[] = {
 	{ "read", (PyCFunction) fsimage_file_read,
 	    METH_VARARGS|METH_KEYWORDS, fsimage_file_read__doc__ },
+	{ "stat", (PyCFunction) fsimage_file_stat,
+	    METH_VARARGS, fsimage_file_stat__doc__ },
 	{ NULL, NULL, 0, NULL }	
 };
 
@@ -18,6 +18,7 @@
 
 #include <xen/elfnote.h>
 #include <xen/tmem.h>
+#include <xen/vcpu.h>
 #include "xc_dom.h"
 #include <xen/hvm/hvm_info_table.h>
 #include <xen/hvm/params.h>
@@ -332,7 +333,9 @@ static PyObject *pyxc_domain_getinfo(XcObject *self,
     if (info == NULL)
         return PyErr_NoMemory();
 
+    Py_BEGIN_ALLOW_THREADS
     nr_doms = xc_domain_getinfo(self->xc_handle, first_dom, max_doms, info);
+    Py_END_ALLOW_THREADS
 
     if (nr_doms < 0)
     {
@@ -383,6 +386,74 @@ static PyObject *pyxc_domain_getinfo(XcObject *self,
     return list;
 }
 
+/*
+ * Layout of one xc_domaininfo_t (struct xen_domctl_getdomaininfo) for
+ * Python's struct module, as returned by domain_getinfo_bulk().
+ */
+#define DOMAININFO_FORMAT "=H2xI7Q3I16sI"
+
+/* Domains fetched per hypercall by domain_getinfo_bulk(). */
+#define GETINFO_BULK_CHUNK 1024
+
+static PyObject *pyxc_domain_getinfo_bulk(XcObject *self,
+                                          PyObject *args,
+                                          PyObject *kwds)
+{
+    PyObject *buf;
+    uint32_t first_dom = 0;
+    xc_domaininfo_t *info = NULL, *tmp;
+    unsigned int nr = 0, max = 0;
+    int rc = 0;
+
+    static char *kwd_list[] = { "first_dom", NULL };
+
+    if ( !PyArg_ParseTupleAndKeywords(args, kwds, "|i", kwd_list,
+                                      &first_dom) )
+        return NULL;
+
+    /* No Python objects are touched until all domains have been read. */
+    Py_BEGIN_ALLOW_THREADS
+    for ( ; ; )
+    {
+        if ( max - nr < GETINFO_BULK_CHUNK )
+        {
+            max += GETINFO_BULK_CHUNK;
+            tmp = realloc(info, max * sizeof(*info));
+            if ( !tmp )
+            {
+                errno = ENOMEM;
+                rc = -1;
+                break;
+            }
+            info = tmp;
+        }
+
+        rc = xc_domain_getinfolist(self->xc_handle, first_dom,
+                                   GETINFO_BULK_CHUNK, &info[nr]);
+        if ( rc <= 0 )
+            break;
+
+        nr += rc;
+        first_dom = info[nr - 1].domain + 1;
+        if ( rc < GETINFO_BULK_CHUNK || first_dom >= DOMID_FIRST_RESERVED )
+            break;
+    }
+    Py_END_ALLOW_THREADS
+
+    if ( rc < 0 )
+    {
+        free(info);
+        return errno == ENOMEM ? PyErr_NoMemory()
+                               : pyxc_error_to_exception(self->xc_handle);
+    }
+
+    buf = PyByteArray_FromStringAndSize((const char *)info,
+                                        nr * sizeof(*info));
+    free(info);
+
+    return buf;
+}
+
 static PyObject *pyxc_vcpu_getinfo(XcObject *self,
                                    PyObject *args,
                                    PyObject *kwds)
@@ -443,6 +514,65 @@ static PyObject *pyxc_vcpu_getinfo(XcObject *self,
     return info_dict;
 }
 
+static PyObject *pyxc_domain_sched_stats(XcObject *self,
+                                         PyObject *args,
+                                         PyObject *kwds)
+{
+    PyObject *list, *info_dict;
+
+    uint32_t first_dom = 0;
+    int max_doms = 1024, nr_doms, i;
+    uint64_t now;
+    xc_domschedstats_t *stats;
+
+    static char *kwd_list[] = { "first_dom", "max_doms", NULL };
+
+    if ( !PyArg_ParseTupleAndKeywords(args, kwds, "|ii", kwd_list,
+                                      &first_dom, &max_doms) )
+        return NULL;
+
+    stats = calloc(max_doms, sizeof(*stats));
+    if (stats == NULL)
+        return PyErr_NoMemory();
+
+    nr_doms = xc_domain_schedstats_list(self->xc_handle, first_dom, max_doms,
+                                        stats, &now);
+    if (nr_doms < 0)
+    {
+        free(stats);
+        return pyxc_error_to_exception(self->xc_handle);
+    }
+
+    list = PyList_New(nr_doms);
+    for ( i = 0 ; i < nr_doms; i++ )
+    {
+        info_dict = Py_BuildValue(
+            "{s:i,s:i,s:L,s:L,s:L,s:L,s:L,s:L,s:L,s:L}",
+            "domid",        (int)stats[i].domid,
+            "vcpus",        (int)stats[i].nr_vcpus,
+            "running_ns",   (long long)stats[i].time[RUNSTATE_running],
+            "runnable_ns",  (long long)stats[i].time[RUNSTATE_runnable],
+            "blocked_ns",   (long long)stats[i].time[RUNSTATE_blocked],
+            "offline_ns",   (long long)stats[i].time[RUNSTATE_offline],
+            "switches",     (long long)stats[i].switches,
+            "preemptions",  (long long)stats[i].preemptions,
+            "blocks",       (long long)stats[i].blocks,
+            "wakeups",      (long long)stats[i].wakeups);
+        if ( info_dict == NULL )
+        {
+            Py_DECREF(list);
+            free(stats);
+            return NULL;
+        }
+        PyList_SetItem(list, i, info_dict);
+    }
+
+    free(stats);
+
+    return Py_BuildValue("{s:L,s:N}", "now", (long long)now,
+                         "domains", list);
+}
+
 static PyObject *pyxc_hvm_param_get(XcObject *self,
                                     PyObject *args,
                                     PyObject *kwds)
@@ -2137,6 +2267,19 @@ static PyMethodDef pyxc_methods[] = {
       "reason why it shut itself down.\n"
       " cpupool  [int]   Id of cpupool domain is bound to.\n" },
 
+    { "domain_getinfo_bulk",
+      (PyCFunction)pyxc_domain_getinfo_bulk,
+      METH_VARARGS | METH_KEYWORDS, "\n"
+      "Get the raw information of all domains from first_dom on, in\n"
+      "increasing id order, without building an object per domain.\n"
+      " first_dom [int, 0]: First domain to retrieve info about.\n\n"
+      "Returns: [bytearray] DOMAININFO_SIZE bytes per domain, to be\n"
+      "         decoded with struct.unpack_from(DOMAININFO_FORMAT, ...):\n"
+      "         domid, flags, tot_pages, max_pages, outstanding_pages,\n"
+      "         shr_pages, paged_pages, shared_info_frame, cpu_time,\n"
+      "         online_vcpus, max_vcpu_id, ssidref, handle, cpupool.\n"
+      "         The interpreter lock is released while reading.\n" },
+
     { "vcpu_getinfo", 
       (PyCFunction)pyxc_vcpu_getinfo, 
       METH_VARARGS | METH_KEYWORDS, "\n"
@@ -2151,6 +2294,28 @@ static PyMethodDef pyxc_methods[] = {
       " cpumap   [int]:  Bitmap of CPUs this VCPU can run on\n"
       " cpu      [int]:  CPU that this VCPU is currently bound to\n" },
 
+    { "domain_sched_stats",
+      (PyCFunction)pyxc_domain_sched_stats,
+      METH_VARARGS | METH_KEYWORDS, "\n"
+      "Get the scheduling aggregates of a set of domains, in increasing id\n"
+      "order, summed over each domain's VCPUs.\n"
+      " first_dom [int, 0]:    First domain to retrieve stats about.\n"
+      " max_doms  [int, 1024]: Maximum number of domains to retrieve stats"
+      " about.\n\n"
+      "Returns: [dict]\n"
+      " now     [long]: System time of the snapshot, in nanoseconds\n"
+      " domains [list of dicts]:\n"
+      "  domid       [int]:  Identifier of domain\n"
+      "  vcpus       [int]:  Number of VCPUs\n"
+      "  running_ns  [long]: Time spent running\n"
+      "  runnable_ns [long]: Time spent runnable, waiting for a CPU\n"
+      "  blocked_ns  [long]: Time spent blocked\n"
+      "  offline_ns  [long]: Time spent offline\n"
+      "  switches    [long]: Times a VCPU was scheduled in\n"
+      "  preemptions [long]: Times a running VCPU was descheduled\n"
+      "  blocks      [long]: Times a running VCPU blocked\n"
+      "  wakeups     [long]: Times a blocked VCPU was woken up\n" },
+
     { "gnttab_hvm_seed",
       (PyCFunction)pyxc_gnttab_hvm_seed,
       METH_KEYWORDS, "\n"
@@ -2726,6 +2891,8 @@ PyMODINIT_FUNC initxc(void)
     /* Expose some libxc constants to Python */
     PyModule_AddIntConstant(m, "XEN_SCHEDULER_CREDIT", XEN_SCHEDULER_CREDIT);
     PyModule_AddIntConstant(m, "XEN_SCHEDULER_CREDIT2", XEN_SCHEDULER_CREDIT2);
+    PyModule_AddStringConstant(m, "DOMAININFO_FORMAT", DOMAININFO_FORMAT);
+    PyModule_AddIntConstant(m, "DOMAININFO_SIZE", sizeof(xc_domaininfo_t));
 
 #if PY_MAJOR_VERSION >= 3
     return m;
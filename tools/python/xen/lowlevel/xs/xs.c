@@ -203,6 +203,217 @@ static PyObject *xspy_ls(XsHandle *self, PyObject *args)
 }
 
 
+/* The C string of a path or value given as str or bytes, or NULL. */
+static const char *string_of(PyObject *o, Py_ssize_t *len)
+{
+#if PY_MAJOR_VERSION >= 3
+    if (PyUnicode_Check(o))
+        return len ? PyUnicode_AsUTF8AndSize(o, len) : PyUnicode_AsUTF8(o);
+#endif
+    if (PyBytes_Check(o)) {
+        if (len)
+            *len = PyBytes_GET_SIZE(o);
+        return PyBytes_AS_STRING(o);
+    }
+    PyErr_SetString(PyExc_TypeError, "expected a string");
+    return NULL;
+}
+
+
+#define xspy_read_multiple_doc "\n"				\
+	"Read data from several paths, in as few requests as possible.\n" \
+	" transaction [string]: transaction handle\n"		\
+	" paths [list of string]: xenstore paths\n"		\
+	"\n"							\
+	"Returns: [list] the data read from each path, or None for\n" \
+	"         paths which couldn't be read.\n"		\
+	"Raises xen.lowlevel.xs.Error on error.\n"		\
+	"\n"
+
+static PyObject *xspy_read_multiple(XsHandle *self, PyObject *args)
+{
+    struct xs_handle *xh = xshandle(self);
+    xs_transaction_t th;
+    char *thstr;
+    PyObject *paths, *seq, *val = NULL;
+    const char **cpaths = NULL;
+    unsigned int *lens = NULL;
+    void **xsval;
+    Py_ssize_t i, n;
+
+    if (!xh)
+        return NULL;
+    if (!PyArg_ParseTuple(args, "sO", &thstr, &paths))
+        return NULL;
+
+    th = strtoul(thstr, NULL, 16);
+
+    seq = PySequence_Fast(paths, "paths must be a sequence");
+    if (!seq)
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(seq);
+
+    cpaths = malloc((n ? n : 1) * sizeof(*cpaths));
+    lens = malloc((n ? n : 1) * sizeof(*lens));
+    if (!cpaths || !lens) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    /* The strings stay valid while seq holds references to them. */
+    for (i = 0; i < n; i++) {
+        cpaths[i] = string_of(PySequence_Fast_GET_ITEM(seq, i), NULL);
+        if (!cpaths[i])
+            goto out;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    xsval = xs_read_multiple(xh, th, cpaths, n, lens);
+    Py_END_ALLOW_THREADS
+
+    if (!xsval) {
+        PyErr_SetFromErrno(xs_error);
+        goto out;
+    }
+
+    val = PyList_New(n);
+    for (i = 0; val && i < n; i++) {
+        if (xsval[i])
+            PyList_SetItem(val, i,
+                           PyBytes_FromStringAndSize(xsval[i], lens[i]));
+        else {
+            Py_INCREF(Py_None);
+            PyList_SetItem(val, i, Py_None);
+        }
+    }
+    free(xsval);
+
+ out:
+    free(lens);
+    free(cpaths);
+    Py_DECREF(seq);
+    return val;
+}
+
+
+#define xspy_write_multiple_doc "\n"				\
+	"Write data to several paths, in as few requests as possible.\n" \
+	"The writes are done in order and stop at the first failure;\n" \
+	"use a transaction to make them atomic.\n"		\
+	" transaction [string]: transaction handle\n"		\
+	" items [list of (path, data)]: paths and data to write\n" \
+	"\n"							\
+	"Returns None on success.\n"				\
+	"Raises xen.lowlevel.xs.Error on error.\n"		\
+	"\n"
+
+static PyObject *xspy_write_multiple(XsHandle *self, PyObject *args)
+{
+    struct xs_handle *xh = xshandle(self);
+    xs_transaction_t th;
+    char *thstr;
+    PyObject *items, *seq, *val = NULL;
+    const char **cpaths = NULL;
+    const void **data = NULL;
+    unsigned int *lens = NULL;
+    Py_ssize_t i, n, len;
+    bool result;
+
+    if (!xh)
+        return NULL;
+    if (!PyArg_ParseTuple(args, "sO", &thstr, &items))
+        return NULL;
+
+    th = strtoul(thstr, NULL, 16);
+
+    seq = PySequence_Fast(items, "items must be a sequence");
+    if (!seq)
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(seq);
+
+    cpaths = malloc((n ? n : 1) * sizeof(*cpaths));
+    data = malloc((n ? n : 1) * sizeof(*data));
+    lens = malloc((n ? n : 1) * sizeof(*lens));
+    if (!cpaths || !data || !lens) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    for (i = 0; i < n; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+
+        if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 2) {
+            PyErr_SetString(PyExc_TypeError,
+                            "items must be (path, data) tuples");
+            goto out;
+        }
+        cpaths[i] = string_of(PyTuple_GET_ITEM(item, 0), NULL);
+        data[i] = string_of(PyTuple_GET_ITEM(item, 1), &len);
+        if (!cpaths[i] || !data[i])
+            goto out;
+        lens[i] = len;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    result = xs_write_multiple(xh, th, cpaths, data, lens, n);
+    Py_END_ALLOW_THREADS
+
+    val = none(result);
+
+ out:
+    free(lens);
+    free(data);
+    free(cpaths);
+    Py_DECREF(seq);
+    return val;
+}
+
+
+#define xspy_ls_recursive_doc "\n"				\
+	"List all the descendants of a directory.\n"		\
+	" transaction [string]: transaction handle\n"		\
+	" path [string]:        path to list.\n"		\
+	"\n"							\
+	"Returns: [string array] paths of all descendants, relative\n" \
+	"         to path.\n"					\
+	"         None if key doesn't exist.\n"			\
+	"Raises xen.lowlevel.xs.Error on error.\n"		\
+	"\n"
+
+static PyObject *xspy_ls_recursive(XsHandle *self, PyObject *args)
+{
+    struct xs_handle *xh;
+    xs_transaction_t th;
+    char *path;
+
+    char **xsval;
+    unsigned int xsval_n;
+
+    if (!parse_transaction_path(self, args, &xh, &th, &path))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    xsval = xs_directory_recursive(xh, th, path, &xsval_n);
+    Py_END_ALLOW_THREADS
+
+    if (xsval) {
+        int i;
+        PyObject *val = PyList_New(xsval_n);
+        for (i = 0; i < xsval_n; i++)
+#if PY_MAJOR_VERSION >= 3
+            PyList_SetItem(val, i, PyUnicode_FromString(xsval[i]));
+#else
+            PyList_SetItem(val, i, PyBytes_FromString(xsval[i]));
+#endif
+        free(xsval);
+        return val;
+    }
+    else {
+        return none(errno == ENOENT);
+    }
+}
+
+
 #define xspy_mkdir_doc "\n"					\
 	"Make a directory.\n"					\
 	" transaction [string]: transaction handle.\n"		\
@@ -932,6 +1143,9 @@ static PyMethodDef xshandle_methods[] = {
     XSPY_METH(read,              METH_VARARGS),
     XSPY_METH(write,             METH_VARARGS),
     XSPY_METH(ls,                METH_VARARGS),
+    XSPY_METH(ls_recursive,      METH_VARARGS),
+    XSPY_METH(read_multiple,     METH_VARARGS),
+    XSPY_METH(write_multiple,    METH_VARARGS),
     XSPY_METH(mkdir,             METH_VARARGS),
     XSPY_METH(rm,                METH_VARARGS),
     XSPY_METH(get_permissions,   METH_VARARGS),
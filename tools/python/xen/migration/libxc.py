@@ -65,6 +65,13 @@ REC_TYPE_x86_pv_vcpu_msrs           = 0x0000000c
 REC_TYPE_verify                     = 0x0000000d
 REC_TYPE_checkpoint                 = 0x0000000e
 REC_TYPE_checkpoint_dirty_pfn_list  = 0x0000000f
+REC_TYPE_compressed_page_data       = 0x00000010
+REC_TYPE_postcopy_begin             = 0x00000011
+REC_TYPE_postcopy_pfns              = 0x00000012
+REC_TYPE_postcopy_transition        = 0x00000013
+REC_TYPE_postcopy_fault             = 0x00000014
+REC_TYPE_page_image                 = 0x00000015
+REC_TYPE_checkpoint_dirty_pfn_ranges = 0x00000016
 
 rec_type_to_str = {
     REC_TYPE_end                        : "End",
@@ -82,7 +89,14 @@ rec_type_to_str = {
     REC_TYPE_x86_pv_vcpu_msrs           : "x86 PV vcpu msrs",
     REC_TYPE_verify                     : "Verify",
     REC_TYPE_checkpoint                 : "Checkpoint",
-    REC_TYPE_checkpoint_dirty_pfn_list  : "Checkpoint dirty pfn list"
+    REC_TYPE_checkpoint_dirty_pfn_list  : "Checkpoint dirty pfn list",
+    REC_TYPE_compressed_page_data       : "Compressed page data",
+    REC_TYPE_postcopy_begin             : "Postcopy begin",
+    REC_TYPE_postcopy_pfns              : "Postcopy pfns",
+    REC_TYPE_postcopy_transition        : "Postcopy transition",
+    REC_TYPE_postcopy_fault             : "Postcopy fault",
+    REC_TYPE_page_image                 : "Page image",
+    REC_TYPE_checkpoint_dirty_pfn_ranges : "Checkpoint dirty pfn ranges",
 }
 
 # page_data
@@ -105,6 +119,17 @@ PAGE_DATA_TYPE_BROKEN        = (long(0xd) << PAGE_DATA_TYPE_SHIFT) # Broken
 PAGE_DATA_TYPE_XALLOC        = (long(0xe) << PAGE_DATA_TYPE_SHIFT) # Allocate-only
 PAGE_DATA_TYPE_XTAB          = (long(0xf) << PAGE_DATA_TYPE_SHIFT) # Invalid
 
+# page_image
+PAGE_IMAGE_FORMAT            = "IIQ"
+
+# compressed_page_data
+COMPRESSED_PAGE_DATA_FORMAT  = "IIII"
+COMPRESSED_PAGE_CODEC_NONE    = 0
+COMPRESSED_PAGE_CODEC_DEFLATE = 1
+COMPRESSED_PAGE_ENC_NONE     = 0x00
+COMPRESSED_PAGE_ENC_ZERO     = 0x01
+COMPRESSED_PAGE_ENC_DELTA    = 0x02
+
 # x86_pv_info
 X86_PV_INFO_FORMAT        = "BBHI"
 
@@ -209,7 +234,7 @@ class VerifyLibxc(VerifyBase):
         contentsz = (length + 7) & ~7
         content = self.rdexact(contentsz)
 
-        if rtype != REC_TYPE_page_data:
+        if rtype not in (REC_TYPE_page_data, REC_TYPE_compressed_page_data):
 
             if self.squashed_pagedata_records > 0:
                 self.info("Squashed %d Page Data records together"
@@ -285,6 +310,64 @@ class VerifyLibxc(VerifyBase):
                               % (minsz, pfnsz, pagesz, len(content)))
 
 
+    def verify_record_compressed_page_data(self, content):
+        """ Compressed Page Data record """
+        minsz = calcsize(COMPRESSED_PAGE_DATA_FORMAT)
+
+        if len(content) <= minsz:
+            raise RecordError("COMPRESSED_PAGE_DATA record must be at least %d "
+                              "bytes long" % (minsz, ))
+
+        count, codec, raw_length, data_length = \
+            unpack(COMPRESSED_PAGE_DATA_FORMAT, content[:minsz])
+
+        if count == 0:
+            raise RecordError("COMPRESSED_PAGE_DATA record with no pfns")
+
+        if codec not in (COMPRESSED_PAGE_CODEC_NONE,
+                         COMPRESSED_PAGE_CODEC_DEFLATE):
+            raise RecordError("Unknown codec %d in COMPRESSED_PAGE_DATA record"
+                              % (codec, ))
+
+        pfnsz = count * 8
+        encsz = (count + 7) & ~7
+        if len(content) != minsz + pfnsz + encsz + data_length:
+            raise RecordError("Expected %u + %u + %u + %u, got %u"
+                              % (minsz, pfnsz, encsz, data_length,
+                                 len(content)))
+
+        pfns = list(unpack("=%dQ" % (count,), content[minsz:minsz + pfnsz]))
+        encs = list(unpack("=%dB" % (count,),
+                           content[minsz + pfnsz:minsz + pfnsz + count]))
+
+        for idx, pfn in enumerate(pfns):
+
+            if pfn & PAGE_DATA_PFN_RESZ_MASK:
+                raise RecordError("Reserved bits set in pfn[%d]: 0x%016x",
+                                  idx, pfn & PAGE_DATA_PFN_RESZ_MASK)
+
+            if pfn >> PAGE_DATA_TYPE_SHIFT in (5, 6, 7, 8):
+                raise RecordError("Invalid type value in pfn[%d]: 0x%016x",
+                                  idx, pfn & PAGE_DATA_TYPE_LTAB_MASK)
+
+            has_data = PAGE_DATA_TYPE_NOTAB <= \
+                (pfn & PAGE_DATA_TYPE_LTABTYPE_MASK) <= PAGE_DATA_TYPE_L4TAB
+
+            if has_data != (encs[idx] != COMPRESSED_PAGE_ENC_NONE):
+                raise RecordError("Encoding 0x%02x inconsistent with pfn[%d]: "
+                                  "0x%016x" % (encs[idx], idx, pfn))
+
+            if encs[idx] not in (COMPRESSED_PAGE_ENC_NONE,
+                                 COMPRESSED_PAGE_ENC_ZERO,
+                                 COMPRESSED_PAGE_ENC_DELTA):
+                raise RecordError("Unknown encoding 0x%02x for pfn[%d]"
+                                  % (encs[idx], idx))
+
+        if codec == COMPRESSED_PAGE_CODEC_NONE and raw_length != data_length:
+            raise RecordError("Uncompressed data length mismatch: %u != %u"
+                              % (raw_length, data_length))
+
+
     def verify_record_x86_pv_info(self, content):
         """ x86 PV Info record """
 
@@ -424,12 +507,67 @@ class VerifyLibxc(VerifyBase):
         """ checkpoint dirty pfn list """
         raise RecordError("Found checkpoint dirty pfn list record in stream")
 
+    def verify_record_checkpoint_dirty_pfn_ranges(self, content):
+        """ checkpoint dirty pfn ranges """
+        raise RecordError("Found checkpoint dirty pfn ranges record in stream")
+
+
+    def verify_record_postcopy_begin(self, content):
+        """ postcopy begin record """
+
+        if len(content) != 0:
+            raise RecordError("Postcopy begin record with non-zero length")
+
+
+    def verify_record_postcopy_pfns(self, content):
+        """ postcopy pfns record """
+
+        if len(content) % 8 != 0:
+            raise RecordError("Length expected to be a multiple of 8, not %d"
+                              % (len(content), ))
+
+
+    def verify_record_postcopy_transition(self, content):
+        """ postcopy transition record """
+
+        if len(content) != 0:
+            raise RecordError("Postcopy transition record with non-zero "
+                              "length")
+
+
+    def verify_record_postcopy_fault(self, content):
+        """ postcopy fault """
+        raise RecordError("Found postcopy fault record in stream")
+
+
+    def verify_record_page_image(self, content):
+        """ page image record """
+        minsz = calcsize(PAGE_IMAGE_FORMAT)
+
+        if len(content) <= minsz:
+            raise RecordError("PAGE_IMAGE record must be at least %d bytes "
+                              "long" % (minsz, ))
+
+        count, res1, offset = unpack(PAGE_IMAGE_FORMAT, content[:minsz])
+
+        if res1 != 0:
+            raise StreamError("Reserved bits set in PAGE_IMAGE record 0x%04x"
+                              % (res1, ))
+
+        if len(content) != minsz + count * 8:
+            raise RecordError("Expected %u + %u, got %u"
+                              % (minsz, count * 8, len(content)))
+
+        self.info("  %u pfns, image at 0x%x" % (count, offset))
+
 
 record_verifiers = {
     REC_TYPE_end:
         VerifyLibxc.verify_record_end,
     REC_TYPE_page_data:
         VerifyLibxc.verify_record_page_data,
+    REC_TYPE_compressed_page_data:
+        VerifyLibxc.verify_record_compressed_page_data,
 
     REC_TYPE_x86_pv_info:
         VerifyLibxc.verify_record_x86_pv_info,
@@ -466,4 +604,16 @@ record_verifiers = {
         VerifyLibxc.verify_record_checkpoint,
     REC_TYPE_checkpoint_dirty_pfn_list:
         VerifyLibxc.verify_record_checkpoint_dirty_pfn_list,
+    REC_TYPE_checkpoint_dirty_pfn_ranges:
+        VerifyLibxc.verify_record_checkpoint_dirty_pfn_ranges,
+    REC_TYPE_postcopy_begin:
+        VerifyLibxc.verify_record_postcopy_begin,
+    REC_TYPE_postcopy_pfns:
+        VerifyLibxc.verify_record_postcopy_pfns,
+    REC_TYPE_postcopy_transition:
+        VerifyLibxc.verify_record_postcopy_transition,
+    REC_TYPE_postcopy_fault:
+        VerifyLibxc.verify_record_postcopy_fault,
+    REC_TYPE_page_image:
+        VerifyLibxc.verify_record_page_image,
     }
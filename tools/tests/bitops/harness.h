@@ -0,0 +1,46 @@
+/*
+ * Userspace environment for building xen/arch/x86/bitops.c and
+ * xen/arch/x86/string.c, so that the scan and string primitives can be
+ * checked and timed without booting Xen.  The string functions are
+ * renamed xen_mem*() to stay clear of the C library's.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BITS_PER_LONG 64
+#define BYTES_PER_LONG 8
+#define BITS_TO_LONGS(bits) (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define __OS "q"
+
+#define always_inline inline __attribute__((__always_inline__))
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define ASSERT(p) assert(p)
+
+/* Set by the harness to select a string op path, as CPUID would. */
+extern bool harness_erms, harness_fsrm;
+#define cpu_has_erms harness_erms
+#define cpu_has_fsrm harness_fsrm
+
+static always_inline unsigned int __scanbit(unsigned long val, unsigned int max)
+{
+    return val ? __builtin_ctzl(val) : max;
+}
+
+unsigned int __find_first_bit(const unsigned long *addr, unsigned int size);
+unsigned int __find_next_bit(const unsigned long *addr, unsigned int size,
+                             unsigned int offset);
+unsigned int __find_first_zero_bit(const unsigned long *addr,
+                                   unsigned int size);
+unsigned int __find_next_zero_bit(const unsigned long *addr,
+                                  unsigned int size, unsigned int offset);
+
+void *xen_memcpy(void *dest, const void *src, size_t n);
+void *xen_memset(void *s, int c, size_t n);
+void *xen_memmove(void *dest, const void *src, size_t n);
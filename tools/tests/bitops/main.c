@@ -0,0 +1,264 @@
+/*
+ * Bit scan and string primitive checks and microbenchmarks.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ */
+
+/*
+ * Usage: test_bitops [iterations]
+ *
+ * Each primitive is first checked against a simple reference over a
+ * range of sizes and alignments, then timed.  find_first_bit and
+ * find_first_zero_bit are compared with the REPE SCAS loop they
+ * replaced, over bitmaps the size of the 2-level event channel pending
+ * array with a single bit set at varying depths.  memcpy and memset
+ * are timed on the word-sized and the ERMS path at several lengths.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "harness.h"
+
+bool harness_erms, harness_fsrm;
+
+#define MAX_BITS 4096
+#define MAX_LONGS (MAX_BITS / BITS_PER_LONG)
+#define MAX_LEN  65536
+
+static unsigned long iterations = 1000000;
+
+/* The previous implementation, kept as the baseline. */
+static unsigned int legacy_find_first_bit(
+    const unsigned long *addr, unsigned int size)
+{
+    unsigned long d0, d1, res;
+
+    asm volatile (
+        "1: xor %%eax,%%eax\n\t"
+        "   repe; scasq\n\t"
+        "   je 2f\n\t"
+        "   bsf -8(%2),%0\n\t"
+        "   jz 1b\n\t"
+        "   lea -8(%2),%2\n\t"
+        "2: sub %%ebx,%%edi\n\t"
+        "   shl $3,%%edi\n\t"
+        "   add %%edi,%%eax"
+        : "=&a" (res), "=&c" (d0), "=&D" (d1)
+        : "1" (BITS_TO_LONGS(size)), "2" (addr), "b" ((int)(long)addr)
+        : "memory" );
+
+    return res;
+}
+
+static unsigned int ref_find_first(const unsigned long *addr,
+                                   unsigned int size, bool want)
+{
+    unsigned int i;
+
+    for ( i = 0; i < BITS_TO_LONGS(size) * BITS_PER_LONG; i++ )
+        if ( !!(addr[i / BITS_PER_LONG] & (1UL << (i % BITS_PER_LONG))) ==
+             want )
+            return i;
+
+    return BITS_TO_LONGS(size) * BITS_PER_LONG;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int failures;
+
+#define CHECK(cond, fmt, ...) do {                                  \
+    if ( !(cond) )                                                  \
+    {                                                               \
+        printf("FAIL: " fmt "\n", ##__VA_ARGS__);                   \
+        failures++;                                                 \
+    }                                                               \
+} while ( 0 )
+
+static void check_scans(void)
+{
+    static unsigned long map[MAX_LONGS];
+    unsigned int size, bit;
+
+    for ( size = 1; size <= MAX_BITS; size = size < 256 ? size + 1 : size * 2 )
+    {
+        memset(map, 0, sizeof(map));
+        CHECK(__find_first_bit(map, size) == ref_find_first(map, size, 1),
+              "find_first_bit empty size %u", size);
+
+        for ( bit = 0; bit < size; bit += 1 + bit / 8 )
+        {
+            memset(map, 0, sizeof(map));
+            map[bit / BITS_PER_LONG] |= 1UL << (bit % BITS_PER_LONG);
+            CHECK(__find_first_bit(map, size) == bit,
+                  "find_first_bit size %u bit %u", size, bit);
+            CHECK(__find_next_bit(map, size, bit / 2) == bit,
+                  "find_next_bit size %u bit %u", size, bit);
+
+            memset(map, 0xff, sizeof(map));
+            map[bit / BITS_PER_LONG] &= ~(1UL << (bit % BITS_PER_LONG));
+            CHECK(__find_first_zero_bit(map, size) == bit,
+                  "find_first_zero_bit size %u bit %u", size, bit);
+            CHECK(__find_next_zero_bit(map, size, bit / 2) == bit,
+                  "find_next_zero_bit size %u bit %u", size, bit);
+        }
+    }
+}
+
+static void check_strings(void)
+{
+    static unsigned char src[MAX_LEN + 64], dst[MAX_LEN + 64];
+    static unsigned char ref[MAX_LEN + 64];
+    unsigned int path, len, off, i;
+
+    for ( i = 0; i < sizeof(src); i++ )
+        src[i] = i * 7 + 3;
+
+    for ( path = 0; path < 2; path++ )
+    {
+        harness_erms = path;
+
+        for ( len = 0; len <= 4096; len = len < 64 ? len + 1 : len * 2 )
+            for ( off = 0; off < 8; off++ )
+            {
+                memset(dst, 0x5a, sizeof(dst));
+                memcpy(ref, dst, sizeof(ref));
+                memcpy(ref + off, src + 3, len);
+                xen_memcpy(dst + off, src + 3, len);
+                CHECK(!memcmp(dst, ref, sizeof(ref)),
+                      "memcpy erms %u len %u off %u", path, len, off);
+
+                memset(ref + off, 0xc3, len);
+                xen_memset(dst + off, 0xc3, len);
+                CHECK(!memcmp(dst, ref, sizeof(ref)),
+                      "memset erms %u len %u off %u", path, len, off);
+
+                memmove(ref + off + 1, ref + off, len);
+                xen_memmove(dst + off + 1, dst + off, len);
+                CHECK(!memcmp(dst, ref, sizeof(ref)),
+                      "memmove erms %u len %u off %u", path, len, off);
+            }
+    }
+
+    harness_erms = false;
+}
+
+static void bench_scans(void)
+{
+    /* 4096 bits: the 2-level event channel pending array on 64-bit. */
+    static unsigned long map[MAX_LONGS];
+    static const unsigned int depths[] = { 0, 63, 511, 2047, 4095 };
+    volatile unsigned int sink;
+    unsigned int d;
+    unsigned long i;
+    double t;
+
+    printf("%-24s %8s %12s %12s\n", "scan (4096 bits)", "bit",
+           "legacy ns", "new ns");
+
+    for ( d = 0; d < sizeof(depths) / sizeof(depths[0]); d++ )
+    {
+        double legacy, scan;
+
+        memset(map, 0, sizeof(map));
+        map[depths[d] / BITS_PER_LONG] = 1UL << (depths[d] % BITS_PER_LONG);
+
+        t = now_ns();
+        for ( i = 0; i < iterations; i++ )
+            sink = legacy_find_first_bit(map, MAX_BITS);
+        legacy = (now_ns() - t) / iterations;
+
+        t = now_ns();
+        for ( i = 0; i < iterations; i++ )
+            sink = __find_first_bit(map, MAX_BITS);
+        scan = (now_ns() - t) / iterations;
+
+        printf("%-24s %8u %12.1f %12.1f\n", "find_first_bit",
+               depths[d], legacy, scan);
+    }
+
+    memset(map, 0xff, sizeof(map));
+    map[MAX_LONGS - 1] = 0;
+    t = now_ns();
+    for ( i = 0; i < iterations; i++ )
+        sink = __find_first_zero_bit(map, MAX_BITS);
+    printf("%-24s %8u %12s %12.1f\n", "find_first_zero_bit",
+           MAX_BITS - BITS_PER_LONG, "-", (now_ns() - t) / iterations);
+
+    (void)sink;
+}
+
+static void bench_strings(void)
+{
+    static unsigned char src[MAX_LEN], dst[MAX_LEN];
+    static const unsigned int lens[] = { 8, 64, 256, 4096, 65536 };
+    unsigned int l, path;
+    unsigned long i, n;
+    double t, res[2][2];
+
+    printf("\n%-24s %8s %12s %12s\n", "string op", "len",
+           "words ns", "erms ns");
+
+    for ( l = 0; l < sizeof(lens) / sizeof(lens[0]); l++ )
+    {
+        n = iterations / (1 + lens[l] / 256);
+
+        for ( path = 0; path < 2; path++ )
+        {
+            harness_erms = path;
+
+            t = now_ns();
+            for ( i = 0; i < n; i++ )
+            {
+                xen_memcpy(dst, src, lens[l]);
+                asm volatile ( "" ::: "memory" );
+            }
+            res[0][path] = (now_ns() - t) / n;
+
+            t = now_ns();
+            for ( i = 0; i < n; i++ )
+            {
+                xen_memset(dst, i, lens[l]);
+                asm volatile ( "" ::: "memory" );
+            }
+            res[1][path] = (now_ns() - t) / n;
+        }
+
+        printf("%-24s %8u %12.1f %12.1f\n", "memcpy", lens[l],
+               res[0][0], res[0][1]);
+        printf("%-24s %8u %12.1f %12.1f\n", "memset", lens[l],
+               res[1][0], res[1][1]);
+    }
+
+    harness_erms = false;
+}
+
+int main(int argc, char **argv)
+{
+    if ( argc > 1 )
+        iterations = strtoul(argv[1], NULL, 0) ?: 1;
+
+    check_scans();
+    check_strings();
+    if ( failures )
+    {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+
+    bench_scans();
+    bench_strings();
+
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * dirty-load.c
+ *
+ * Synthetic memory dirtying workload, to be run inside a guest while it is
+ * migrated.  A working set of the given size is allocated and touched, then
+ * pages within it are written at a controlled rate, in order or at random,
+ * so that the cost of live migration can be measured against a known dirty
+ * rate and working-set size.
+ *
+ * Once a second, one line of JSON reports the rate actually achieved:
+ *
+ *   {"elapsed_s":3,"pages":30000,"pages_per_s":10000}
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Pages are dirtied in bursts, this many times a second. */
+#define TICKS_PER_SEC 100
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline)
+{
+    struct timespec ts = {
+        .tv_sec = deadline / 1000000000ull,
+        .tv_nsec = deadline % 1000000000ull,
+    };
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-s <MiB>] [-r <pages/s>] [-t <seconds>] [-R]\n"
+            "  -s  working set size in MiB (default 256)\n"
+            "  -r  pages to dirty per second, 0 for as fast as possible\n"
+            "      (default 10000)\n"
+            "  -t  run for this many seconds, 0 for ever (default 0)\n"
+            "  -R  dirty pages in random order rather than sequentially\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long size_mib = 256, rate = 10000, duration = 0;
+    bool random_order = false;
+    size_t page_size = sysconf(_SC_PAGESIZE), nr_pages, next = 0, i;
+    uint64_t start, tick, report, done = 0, last_done = 0, budget;
+    unsigned long elapsed = 0;
+    unsigned int seed = 1;
+    char *mem;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "s:r:t:Rh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 's':
+            size_mib = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rate = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            duration = strtoul(optarg, NULL, 0);
+            break;
+        case 'R':
+            random_order = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    nr_pages = (size_mib << 20) / page_size;
+    if ( !nr_pages )
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    mem = mmap(NULL, nr_pages * page_size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if ( mem == MAP_FAILED )
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    /* Fault in the whole working set, with non-zero data, before timing. */
+    for ( i = 0; i < nr_pages; i++ )
+        memset(mem + i * page_size, 0xff, page_size);
+
+    start = tick = now_ns();
+    report = start + 1000000000ull;
+
+    for ( ; ; )
+    {
+        /* Pages due this tick, or a full pass of the working set if unpaced. */
+        budget = rate ? rate / TICKS_PER_SEC + (elapsed % TICKS_PER_SEC <
+                                                 rate % TICKS_PER_SEC)
+                      : nr_pages;
+
+        for ( ; budget; budget--, done++ )
+        {
+            if ( random_order )
+                next = rand_r(&seed) % nr_pages;
+            else if ( ++next == nr_pages )
+                next = 0;
+
+            /* One word is enough to dirty the page. */
+            ((volatile uint64_t *)(mem + next * page_size))[0] = done;
+        }
+
+        if ( rate )
+        {
+            tick += 1000000000ull / TICKS_PER_SEC;
+            sleep_until(tick);
+            elapsed++;
+        }
+
+        if ( now_ns() >= report )
+        {
+            printf("{\"elapsed_s\":%"PRIu64",\"pages\":%"PRIu64
+                   ",\"pages_per_s\":%"PRIu64"}\n",
+                   (report - start) / 1000000000, done, done - last_done);
+            fflush(stdout);
+            last_done = done;
+            report += 1000000000ull;
+
+            if ( duration && (report - start) / 1000000000 > duration )
+                break;
+        }
+    }
+
+    munmap(mem, nr_pages * page_size);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
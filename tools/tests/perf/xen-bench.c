@@ -0,0 +1,497 @@
+/*
+ * xen-bench.c
+ *
+ * Microbenchmarks for hypervisor hot paths, as seen from the domain it runs
+ * in: hypercalls, event channels, grant tables, xenstore, foreign mappings
+ * and, on x86, CPUID (a VM exit in HVM and PVH guests).
+ *
+ * Every benchmark prints one line of JSON, so that results can be collected
+ * and compared between Xen versions:
+ *
+ *   {"test":"hypercall","ops":100000,"ns_per_op":250.3}
+ *
+ * Throughput benchmarks add "mib_per_s".  Benchmarks which can't run in the
+ * current environment print "error" with the reason instead.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <xenctrl.h>
+#include <xenevtchn.h>
+#include <xengnttab.h>
+#include <xenforeignmemory.h>
+#include <xenstore.h>
+
+#define GRANT_COPY_BATCH 16
+#define FOREIGN_BATCH    64
+
+static unsigned long iterations = 10000;
+static unsigned int self_domid;
+static int target_domid = -1;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *test, unsigned long ops, uint64_t ns,
+                   uint64_t bytes)
+{
+    printf("{\"test\":\"%s\",\"ops\":%lu,\"ns_per_op\":%.1f",
+           test, ops, ops ? (double)ns / ops : 0.0);
+    if ( bytes )
+        printf(",\"mib_per_s\":%.1f",
+               ns ? bytes / (1024.0 * 1024.0) / (ns / 1e9) : 0.0);
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void report_error(const char *test, const char *what)
+{
+    printf("{\"test\":\"%s\",\"error\":\"%s: %s\"}\n",
+           test, what, errno ? strerror(errno) : "not available");
+    fflush(stdout);
+}
+
+static void bench_hypercall(void)
+{
+    xc_interface *xch = xc_interface_open(NULL, NULL, 0);
+    unsigned long i;
+    uint64_t start;
+
+    if ( !xch )
+    {
+        report_error("hypercall", "xc_interface_open");
+        return;
+    }
+
+    start = now_ns();
+    for ( i = 0; i < iterations; i++ )
+        xc_version(xch, XENVER_version, NULL);
+    report("hypercall", iterations, now_ns() - start, 0);
+
+    xc_interface_close(xch);
+}
+
+struct evtchn_peer {
+    xenevtchn_handle *xce;
+    evtchn_port_t port;
+};
+
+/* Wait for an event on a port, and unmask it again. */
+static int evtchn_wait(xenevtchn_handle *xce)
+{
+    xenevtchn_port_or_error_t port = xenevtchn_pending(xce);
+
+    if ( port < 0 )
+        return -1;
+
+    return xenevtchn_unmask(xce, port);
+}
+
+static void *evtchn_echo(void *arg)
+{
+    struct evtchn_peer *peer = arg;
+    unsigned long i;
+
+    for ( i = 0; i < iterations; i++ )
+        if ( evtchn_wait(peer->xce) || xenevtchn_notify(peer->xce, peer->port) )
+            break;
+
+    return NULL;
+}
+
+static void bench_evtchn(void)
+{
+    struct evtchn_peer a = { NULL }, b = { NULL };
+    xenevtchn_port_or_error_t port;
+    pthread_t thread;
+    unsigned long i;
+    uint64_t start;
+
+    a.xce = xenevtchn_open(NULL, 0);
+    b.xce = xenevtchn_open(NULL, 0);
+    if ( !a.xce || !b.xce )
+    {
+        report_error("evtchn", "xenevtchn_open");
+        goto out;
+    }
+
+    /* Loop an interdomain channel back to ourselves. */
+    port = xenevtchn_bind_unbound_port(a.xce, self_domid);
+    if ( port < 0 )
+    {
+        report_error("evtchn", "xenevtchn_bind_unbound_port");
+        goto out;
+    }
+    a.port = port;
+    port = xenevtchn_bind_interdomain(b.xce, self_domid, a.port);
+    if ( port < 0 )
+    {
+        report_error("evtchn", "xenevtchn_bind_interdomain");
+        goto out;
+    }
+    b.port = port;
+
+    if ( pthread_create(&thread, NULL, evtchn_echo, &b) )
+    {
+        report_error("evtchn", "pthread_create");
+        goto out;
+    }
+
+    start = now_ns();
+    for ( i = 0; i < iterations; i++ )
+        if ( xenevtchn_notify(a.xce, a.port) || evtchn_wait(a.xce) )
+            break;
+    report("evtchn_ping_pong", i, now_ns() - start, 0);
+
+    if ( i < iterations )
+        pthread_cancel(thread);
+    pthread_join(thread, NULL);
+
+ out:
+    if ( b.xce )
+        xenevtchn_close(b.xce);
+    if ( a.xce )
+        xenevtchn_close(a.xce);
+}
+
+static void bench_grant(void)
+{
+    xengntshr_handle *xgs = xengntshr_open(NULL, 0);
+    xengnttab_handle *xgt = xengnttab_open(NULL, 0);
+    xengnttab_grant_copy_segment_t segs[GRANT_COPY_BATCH];
+    void *shared = NULL, *map, *buf = NULL;
+    unsigned long i;
+    unsigned int j;
+    uint32_t ref;
+    uint64_t start;
+
+    if ( !xgs || !xgt )
+    {
+        report_error("grant", "xengntshr_open/xengnttab_open");
+        goto out;
+    }
+
+    /* Grant a page to ourselves, and map or copy from it. */
+    shared = xengntshr_share_pages(xgs, self_domid, 1, &ref, 1);
+    if ( !shared )
+    {
+        report_error("grant", "xengntshr_share_pages");
+        goto out;
+    }
+    memset(shared, 0x5a, XC_PAGE_SIZE);
+
+    start = now_ns();
+    for ( i = 0; i < iterations; i++ )
+    {
+        map = xengnttab_map_grant_ref(xgt, self_domid, ref,
+                                      PROT_READ | PROT_WRITE);
+        if ( !map )
+        {
+            report_error("grant_map_unmap", "xengnttab_map_grant_ref");
+            goto out;
+        }
+        xengnttab_unmap(xgt, map, 1);
+    }
+    report("grant_map_unmap", iterations, now_ns() - start, 0);
+
+    buf = malloc(GRANT_COPY_BATCH * XC_PAGE_SIZE);
+    if ( !buf )
+    {
+        report_error("grant_copy", "malloc");
+        goto out;
+    }
+
+    for ( j = 0; j < GRANT_COPY_BATCH; j++ )
+    {
+        segs[j].source.foreign.ref = ref;
+        segs[j].source.foreign.offset = 0;
+        segs[j].source.foreign.domid = self_domid;
+        segs[j].dest.virt = buf + j * XC_PAGE_SIZE;
+        segs[j].len = XC_PAGE_SIZE;
+        segs[j].flags = GNTCOPY_source_gref;
+    }
+
+    start = now_ns();
+    for ( i = 0; i < iterations; i++ )
+        if ( xengnttab_grant_copy(xgt, GRANT_COPY_BATCH, segs) ||
+             segs[0].status != GNTST_okay )
+        {
+            report_error("grant_copy", "xengnttab_grant_copy");
+            goto out;
+        }
+    report("grant_copy", iterations, now_ns() - start,
+           (uint64_t)iterations * GRANT_COPY_BATCH * XC_PAGE_SIZE);
+
+ out:
+    free(buf);
+    if ( shared )
+        xengntshr_unshare(xgs, shared, 1);
+    if ( xgt )
+        xengnttab_close(xgt);
+    if ( xgs )
+        xengntshr_close(xgs);
+}
+
+static void bench_xenstore(void)
+{
+    struct xs_handle *xsh = xs_open(0);
+    char path[64], *val;
+    unsigned long i;
+    unsigned int len;
+    xs_transaction_t t;
+    uint64_t start;
+
+    if ( !xsh )
+    {
+        report_error("xenstore", "xs_open");
+        return;
+    }
+
+    snprintf(path, sizeof(path), "/local/domain/%u/data/xen-bench",
+             self_domid);
+
+    start = now_ns();
+    for ( i = 0; i < iterations; i++ )
+        if ( !xs_write(xsh, XBT_NULL, path, "0123456789abcdef", 16) )
+        {
+            report_error("xenstore_write", "xs_write");
+            goto out;
+        }
+    report("xenstore_write", iterations, now_ns() - start, 0);
+
+    start = now_ns();
+    for ( i = 0; i < iterations; i++ )
+    {
+        val = xs_read(xsh, XBT_NULL, path, &len);
+        if ( !val )
+        {
+            report_error("xenstore_read", "xs_read");
+            goto out;
+        }
+        free(val);
+    }
+    report("xenstore_read", iterations, now_ns() - start, 0);
+
+    start = now_ns();
+    for ( i = 0; i < iterations; i++ )
+    {
+        t = xs_transaction_start(xsh);
+        if ( t == XBT_NULL ||
+             !xs_write(xsh, t, path, "fedcba9876543210", 16) ||
+             (!xs_transaction_end(xsh, t, false) && errno != EAGAIN) )
+        {
+            report_error("xenstore_transaction", "xs_transaction");
+            goto out;
+        }
+    }
+    report("xenstore_transaction", iterations, now_ns() - start, 0);
+
+ out:
+    xs_rm(xsh, XBT_NULL, path);
+    xs_close(xsh);
+}
+
+static void bench_foreign(void)
+{
+    xenforeignmemory_handle *fmem;
+    xen_pfn_t pfns[FOREIGN_BATCH];
+    int err[FOREIGN_BATCH];
+    unsigned long i;
+    unsigned int j;
+    uint64_t start;
+    void *map;
+
+    if ( target_domid < 0 )
+    {
+        errno = 0;
+        report_error("foreign_map", "needs a target domain (-d)");
+        return;
+    }
+
+    fmem = xenforeignmemory_open(NULL, 0);
+    if ( !fmem )
+    {
+        report_error("foreign_map", "xenforeignmemory_open");
+        return;
+    }
+
+    for ( j = 0; j < FOREIGN_BATCH; j++ )
+        pfns[j] = j;
+
+    start = now_ns();
+    for ( i = 0; i < iterations; i++ )
+    {
+        map = xenforeignmemory_map(fmem, target_domid, PROT_READ,
+                                   FOREIGN_BATCH, pfns, err);
+        if ( !map )
+        {
+            report_error("foreign_map", "xenforeignmemory_map");
+            goto out;
+        }
+        xenforeignmemory_unmap(fmem, map, FOREIGN_BATCH);
+    }
+    report("foreign_map", iterations, now_ns() - start,
+           (uint64_t)iterations * FOREIGN_BATCH * XC_PAGE_SIZE);
+
+ out:
+    xenforeignmemory_close(fmem);
+}
+
+static void bench_cpuid(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    unsigned long i;
+    uint64_t start;
+
+    start = now_ns();
+    for ( i = 0; i < iterations; i++ )
+    {
+        eax = 0;
+        ecx = 0;
+        asm volatile ( "cpuid"
+                       : "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx) );
+    }
+    report("cpuid", iterations, now_ns() - start, 0);
+#else
+    errno = 0;
+    report_error("cpuid", "x86 only");
+#endif
+}
+
+static const struct {
+    const char *name;
+    void (*fn)(void);
+} benches[] = {
+    { "hypercall", bench_hypercall },
+    { "evtchn",    bench_evtchn },
+    { "grant",     bench_grant },
+    { "xenstore",  bench_xenstore },
+    { "foreign",   bench_foreign },
+    { "cpuid",     bench_cpuid },
+};
+
+#define NR_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static unsigned int get_self_domid(void)
+{
+    struct xs_handle *xsh = xs_open(XS_OPEN_READONLY);
+    unsigned int domid = 0;
+    char *val;
+
+    if ( !xsh )
+        return 0;
+
+    /* Not present in dom0's own directory. */
+    val = xs_read(xsh, XBT_NULL, "domid", NULL);
+    if ( val )
+        domid = strtoul(val, NULL, 0);
+    free(val);
+    xs_close(xsh);
+
+    return domid;
+}
+
+static void usage(const char *prog)
+{
+    unsigned int i;
+
+    fprintf(stderr,
+            "Usage: %s [-n <iterations>] [-d <domid>] [<benchmark>...]\n"
+            "  -n  iterations per benchmark (default 10000)\n"
+            "  -d  domain to map memory of for the foreign benchmark\n"
+            "Benchmarks (default all):", prog);
+    for ( i = 0; i < NR_BENCHES; i++ )
+        fprintf(stderr, " %s", benches[i].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int i;
+    int opt, arg;
+
+    while ( (opt = getopt(argc, argv, "n:d:h")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            target_domid = strtol(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if ( !iterations )
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    self_domid = get_self_domid();
+
+    if ( optind == argc )
+    {
+        for ( i = 0; i < NR_BENCHES; i++ )
+            benches[i].fn();
+        return 0;
+    }
+
+    for ( arg = optind; arg < argc; arg++ )
+    {
+        for ( i = 0; i < NR_BENCHES; i++ )
+            if ( !strcmp(argv[arg], benches[i].name) )
+                break;
+        if ( i == NR_BENCHES )
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        benches[i].fn();
+    }
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,66 @@
+/*
+ * Userspace environment for building xen/common/qspinlock.c, so that queued
+ * and ticket locks can be compared under contention without booting Xen.
+ * Each pthread plays the part of one CPU.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sched.h>
+
+#define NR_CPUS 256
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+typedef union {
+    u32 head_tail;
+    struct {
+        u16 head;
+        u16 tail;
+    };
+    struct {
+        u8 locked;
+        u8 pad;
+        u16 qtail;
+    };
+} spinlock_tickets_t;
+
+void queued_spin_lock_slowpath(spinlock_tickets_t *t,
+                               void (*cb)(void *), void *data);
+
+extern __thread unsigned int harness_cpu;
+extern bool harness_yield;
+
+#define smp_processor_id() harness_cpu
+
+#define DEFINE_PER_CPU(type, name) __typeof__(type) per_cpu__##name[NR_CPUS]
+#define per_cpu(var, cpu) (per_cpu__##var[cpu])
+#define this_cpu(var) per_cpu(var, smp_processor_id())
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define smp_mb()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#define read_atomic(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define write_atomic(p, x) __atomic_store_n(p, x, __ATOMIC_RELAXED)
+#define cmpxchg(p, o, n) __sync_val_compare_and_swap(p, o, n)
+
+/* With more threads than CPUs, spinning without yielding never ends. */
+static inline void cpu_relax(void)
+{
+    if ( harness_yield )
+        sched_yield();
+    else
+        __builtin_ia32_pause();
+}
+#define arch_lock_relax() cpu_relax()
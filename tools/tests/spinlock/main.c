@@ -0,0 +1,193 @@
+/*
+ * Ticket vs queued spinlock scaling test.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ */
+
+/*
+ * Usage: test_spinlock [max-threads [msec-per-run [hold-loops]]]
+ *
+ * For 1, 2, 4, ... max-threads threads (default: the number of online
+ * CPUs), each lock type is hammered for msec-per-run milliseconds, each
+ * thread pinned to its own CPU, and the total acquisitions per second
+ * are printed.  Both lock paths mirror xen/common/spinlock.c; the queued
+ * slow path is xen/common/qspinlock.c itself.  A shared counter updated
+ * non-atomically under the lock checks mutual exclusion.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+__thread unsigned int harness_cpu;
+bool harness_yield;
+
+static spinlock_tickets_t lock;
+static unsigned long counter;
+static volatile bool stop;
+static unsigned int hold_loops = 20;
+static unsigned int nr_online;
+
+struct worker {
+    pthread_t thread;
+    unsigned int cpu;
+    bool queued;
+    unsigned long acquired;
+};
+
+static void ticket_lock(spinlock_tickets_t *t)
+{
+    u16 me = __atomic_fetch_add(&t->tail, 1, __ATOMIC_ACQUIRE);
+
+    while ( read_atomic(&t->head) != me )
+        cpu_relax();
+    smp_mb();
+}
+
+static void ticket_unlock(spinlock_tickets_t *t)
+{
+    smp_mb();
+    __atomic_fetch_add(&t->head, 1, __ATOMIC_RELEASE);
+}
+
+static void queued_lock(spinlock_tickets_t *t)
+{
+    if ( read_atomic(&t->head_tail) || cmpxchg(&t->head_tail, 0, 1) != 0 )
+        queued_spin_lock_slowpath(t, NULL, NULL);
+    smp_mb();
+}
+
+static void queued_unlock(spinlock_tickets_t *t)
+{
+    smp_mb();
+    write_atomic(&t->locked, 0);
+}
+
+static void *worker_fn(void *arg)
+{
+    struct worker *w = arg;
+    cpu_set_t set;
+    unsigned int i;
+
+    harness_cpu = w->cpu;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu % nr_online, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    while ( !stop )
+    {
+        if ( w->queued )
+            queued_lock(&lock);
+        else
+            ticket_lock(&lock);
+
+        counter++;
+        for ( i = 0; i < hold_loops; i++ )
+            __asm__ __volatile__ ( "" ::: "memory" );
+
+        if ( w->queued )
+            queued_unlock(&lock);
+        else
+            ticket_unlock(&lock);
+
+        w->acquired++;
+    }
+
+    return NULL;
+}
+
+static double run(unsigned int nr, bool queued, unsigned int msec)
+{
+    struct worker *w = calloc(nr, sizeof(*w));
+    struct timespec ts = { msec / 1000, (msec % 1000) * 1000000L };
+    unsigned long total = 0;
+    unsigned int i;
+
+    if ( !w )
+    {
+        perror("calloc");
+        exit(1);
+    }
+
+    lock.head_tail = 0;
+    counter = 0;
+    stop = false;
+    harness_yield = nr > nr_online;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        w[i].cpu = i;
+        w[i].queued = queued;
+        if ( pthread_create(&w[i].thread, NULL, worker_fn, &w[i]) )
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    nanosleep(&ts, NULL);
+    stop = true;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        pthread_join(w[i].thread, NULL);
+        total += w[i].acquired;
+    }
+    free(w);
+
+    if ( total != counter )
+    {
+        printf("FAIL: %s lock: %lu acquisitions, counter %lu\n",
+               queued ? "queued" : "ticket", total, counter);
+        exit(1);
+    }
+
+    return total * 1000.0 / msec;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int max, msec = 500, nr;
+
+    nr_online = sysconf(_SC_NPROCESSORS_ONLN);
+    max = nr_online;
+
+    if ( argc > 1 )
+        max = strtoul(argv[1], NULL, 0);
+    if ( argc > 2 )
+        msec = strtoul(argv[2], NULL, 0);
+    if ( argc > 3 )
+        hold_loops = strtoul(argv[3], NULL, 0);
+
+    if ( !max || max > NR_CPUS || !msec )
+    {
+        fprintf(stderr, "Usage: %s [max-threads [msec-per-run [hold-loops]]]\n",
+                argv[0]);
+        return 1;
+    }
+
+    printf("%u online CPUs, %u ms per run, %u hold loops\n",
+           nr_online, msec, hold_loops);
+    printf("%8s %16s %16s %8s\n", "threads", "ticket/s", "queued/s", "ratio");
+
+    for ( nr = 1; ; nr = nr * 2 > max && nr < max ? max : nr * 2 )
+    {
+        double ticket = run(nr, false, msec);
+        double queued = run(nr, true, msec);
+
+        printf("%8u %16.0f %16.0f %8.2f\n", nr, ticket, queued,
+               ticket ? queued / ticket : 0);
+
+        if ( nr >= max )
+            break;
+    }
+
+    return 0;
+}
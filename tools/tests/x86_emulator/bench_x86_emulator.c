@@ -0,0 +1,444 @@
+/*
+ * bench_x86_emulator.c
+ *
+ * Replay instructions recorded by the hypervisor's TRC_HVM_EMULATE_INSN
+ * trace event through x86_emulate(), against memory and I/O callbacks which
+ * do no work of their own, and report the cost of emulation in cycles per
+ * instruction, by opcode class.  This allows changes to the emulator's fast
+ * paths to be measured outside of a running guest.
+ *
+ * Record a trace with e.g.
+ *
+ *   xentrace -D -e 0x00082000 trace.bin
+ *
+ * then replay it with
+ *
+ *   bench_x86_emulator [-r <repeats>] [-n] trace.bin
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <x86intrin.h>
+
+#include "x86-emulate.h"
+
+#include <xen/trace.h>
+
+#define MAX_INSNS (1u << 20)
+
+/* Where replayed instructions are deemed to execute. */
+#define INSN_BASE 0x1000
+
+struct insn {
+    uint8_t len, addr_size, sp_size, lma;
+    uint8_t bytes[16];
+    uint64_t rip;
+} __attribute__((__packed__));
+
+enum {
+    CLASS_MOV,
+    CLASS_ALU,
+    CLASS_STRING,
+    CLASS_IO,
+    CLASS_STACK,
+    CLASS_TWOBYTE,
+    CLASS_VEX,
+    CLASS_OTHER,
+    NR_CLASSES
+};
+
+static const char *const class_names[NR_CLASSES] = {
+    [CLASS_MOV]     = "mov",
+    [CLASS_ALU]     = "alu",
+    [CLASS_STRING]  = "string",
+    [CLASS_IO]      = "io",
+    [CLASS_STACK]   = "stack",
+    [CLASS_TWOBYTE] = "0f",
+    [CLASS_VEX]     = "vex/evex",
+    [CLASS_OTHER]   = "other",
+};
+
+static struct {
+    unsigned long insns, failed;
+    uint64_t cycles;
+} stats[NR_CLASSES];
+
+static struct insn *insns;
+static unsigned int nr_insns;
+static const struct insn *cur;
+
+/* Backing for all data accesses: reads see zeroes, writes are discarded. */
+static uint8_t scratch[64];
+
+static unsigned int classify(const struct insn *in)
+{
+    unsigned int i;
+    uint8_t b;
+
+    for ( i = 0; i < in->len; i++ )
+    {
+        b = in->bytes[i];
+        switch ( b )
+        {
+        case 0x26: case 0x2e: case 0x36: case 0x3e: /* Segment overrides. */
+        case 0x64: case 0x65: case 0x66: case 0x67:
+        case 0xf0: case 0xf2: case 0xf3:
+            continue;
+        }
+        if ( in->lma && in->addr_size == 64 && (b & 0xf0) == 0x40 )
+            continue; /* REX */
+        break;
+    }
+
+    if ( i == in->len )
+        return CLASS_OTHER;
+
+    switch ( b )
+    {
+    case 0x88 ... 0x8c: case 0x8e:
+    case 0xa0 ... 0xa3:
+    case 0xb0 ... 0xbf:
+    case 0xc6: case 0xc7:
+        return CLASS_MOV;
+
+    case 0x00 ... 0x05: case 0x08 ... 0x0d:
+    case 0x10 ... 0x15: case 0x18 ... 0x1d:
+    case 0x20 ... 0x25: case 0x28 ... 0x2d:
+    case 0x30 ... 0x35: case 0x38 ... 0x3d:
+    case 0x80 ... 0x87:
+    case 0xa8: case 0xa9:
+    case 0xd0 ... 0xd3:
+    case 0xf6: case 0xf7: case 0xfe: case 0xff:
+        return CLASS_ALU;
+
+    case 0x6c ... 0x6f:
+    case 0xa4 ... 0xa7:
+    case 0xaa ... 0xaf:
+        return CLASS_STRING;
+
+    case 0xe4 ... 0xe7:
+    case 0xec ... 0xef:
+        return CLASS_IO;
+
+    case 0x50 ... 0x5f:
+    case 0x68: case 0x6a:
+    case 0x8f:
+    case 0x9c: case 0x9d:
+        return CLASS_STACK;
+
+    case 0x0f:
+        return CLASS_TWOBYTE;
+
+    case 0xc4: case 0xc5: case 0x62:
+        /* Only VEX/EVEX in 64-bit mode, or with ModRM.mod == 3. */
+        if ( (in->lma && in->addr_size == 64) ||
+             (i + 1 < in->len && (in->bytes[i + 1] & 0xc0) == 0xc0) )
+            return CLASS_VEX;
+        break;
+    }
+
+    return CLASS_OTHER;
+}
+
+static int read(
+    enum x86_segment seg,
+    unsigned long offset,
+    void *p_data,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    while ( bytes > sizeof(scratch) )
+    {
+        memcpy(p_data, scratch, sizeof(scratch));
+        p_data += sizeof(scratch);
+        bytes -= sizeof(scratch);
+    }
+    memcpy(p_data, scratch, bytes);
+    return X86EMUL_OKAY;
+}
+
+static int fetch(
+    enum x86_segment seg,
+    unsigned long offset,
+    void *p_data,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    offset -= INSN_BASE;
+    if ( offset > cur->len || bytes > cur->len - offset )
+        return X86EMUL_UNHANDLEABLE;
+    memcpy(p_data, cur->bytes + offset, bytes);
+    return X86EMUL_OKAY;
+}
+
+static int write(
+    enum x86_segment seg,
+    unsigned long offset,
+    void *p_data,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    return X86EMUL_OKAY;
+}
+
+static int cmpxchg(
+    enum x86_segment seg,
+    unsigned long offset,
+    void *old,
+    void *new,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    return X86EMUL_OKAY;
+}
+
+static int rep_ins(
+    uint16_t src_port,
+    enum x86_segment dst_seg,
+    unsigned long dst_offset,
+    unsigned int bytes_per_rep,
+    unsigned long *reps,
+    struct x86_emulate_ctxt *ctxt)
+{
+    return X86EMUL_OKAY;
+}
+
+static int rep_outs(
+    enum x86_segment src_seg,
+    unsigned long src_offset,
+    uint16_t dst_port,
+    unsigned int bytes_per_rep,
+    unsigned long *reps,
+    struct x86_emulate_ctxt *ctxt)
+{
+    return X86EMUL_OKAY;
+}
+
+static int rep_movs(
+    enum x86_segment src_seg,
+    unsigned long src_offset,
+    enum x86_segment dst_seg,
+    unsigned long dst_offset,
+    unsigned int bytes_per_rep,
+    unsigned long *reps,
+    struct x86_emulate_ctxt *ctxt)
+{
+    return X86EMUL_OKAY;
+}
+
+static int rep_stos(
+    void *p_data,
+    enum x86_segment seg,
+    unsigned long offset,
+    unsigned int bytes_per_rep,
+    unsigned long *reps,
+    struct x86_emulate_ctxt *ctxt)
+{
+    return X86EMUL_OKAY;
+}
+
+static int read_io(
+    unsigned int port,
+    unsigned int bytes,
+    unsigned long *val,
+    struct x86_emulate_ctxt *ctxt)
+{
+    *val = ~0UL;
+    return X86EMUL_OKAY;
+}
+
+static int write_io(
+    unsigned int port,
+    unsigned int bytes,
+    unsigned long val,
+    struct x86_emulate_ctxt *ctxt)
+{
+    return X86EMUL_OKAY;
+}
+
+static int read_segment(
+    enum x86_segment seg,
+    struct segment_register *reg,
+    struct x86_emulate_ctxt *ctxt)
+{
+    memset(reg, 0, sizeof(*reg));
+    reg->limit = ~0U;
+    reg->p = 1;
+    reg->s = 1;
+    reg->type = seg == x86_seg_cs ? 0xb : 0x3;
+    reg->db = ctxt->addr_size == 32;
+    reg->l = ctxt->addr_size == 64;
+    return X86EMUL_OKAY;
+}
+
+static struct x86_emulate_ops emulops = {
+    .read       = read,
+    .insn_fetch = fetch,
+    .write      = write,
+    .cmpxchg    = cmpxchg,
+    .rep_ins    = rep_ins,
+    .rep_outs   = rep_outs,
+    .rep_movs   = rep_movs,
+    .rep_stos   = rep_stos,
+    .read_io    = read_io,
+    .write_io   = write_io,
+    .read_segment = read_segment,
+    .cpuid      = emul_test_cpuid,
+    .read_cr    = emul_test_read_cr,
+    .get_fpu    = emul_test_get_fpu,
+    .put_fpu    = emul_test_put_fpu,
+};
+
+/*
+ * Pick the TRC_HVM_EMULATE_INSN records out of a trace file.  Each record is
+ * a header word (event in bits 0-27, number of extra words in bits 28-30,
+ * TSC present in bit 31), the optional TSC, and the extra words.
+ */
+static int load_trace(const char *name)
+{
+    FILE *f = fopen(name, "rb");
+    uint32_t hdr, extra[7], tsc[2];
+    unsigned int n;
+
+    if ( !f )
+    {
+        perror(name);
+        return -1;
+    }
+
+    insns = calloc(MAX_INSNS, sizeof(*insns));
+    if ( !insns )
+    {
+        fclose(f);
+        return -1;
+    }
+
+    while ( nr_insns < MAX_INSNS && fread(&hdr, sizeof(hdr), 1, f) == 1 )
+    {
+        n = (hdr >> 28) & 7;
+        if ( ((hdr >> 31) && fread(tsc, sizeof(tsc), 1, f) != 1) ||
+             (n && fread(extra, sizeof(*extra), n, f) != n) )
+            break;
+
+        if ( (hdr & 0x0fffffff) != TRC_HVM_EMULATE_INSN ||
+             n * sizeof(*extra) != sizeof(*insns) )
+            continue;
+
+        memcpy(&insns[nr_insns], extra, sizeof(*insns));
+        if ( !insns[nr_insns].len || insns[nr_insns].len > 16 )
+            continue;
+        nr_insns++;
+    }
+
+    fclose(f);
+
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-r <repeats>] [-n] <trace file>\n"
+            "  -r  replay the trace this many times (default 10)\n"
+            "  -n  emulate string instructions one repetition at a time\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct x86_emulate_ctxt ctxt = {
+        .vendor = X86_VENDOR_UNKNOWN,
+    };
+    struct cpu_user_regs regs;
+    unsigned long repeats = 10, r, total = 0;
+    unsigned int i, c;
+    uint64_t start, cycles;
+    int opt, rc;
+
+    while ( (opt = getopt(argc, argv, "r:nh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'r':
+            repeats = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            emulops.rep_ins = NULL;
+            emulops.rep_outs = NULL;
+            emulops.rep_movs = NULL;
+            emulops.rep_stos = NULL;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if ( optind + 1 != argc )
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ( load_trace(argv[optind]) )
+        return 1;
+    if ( !nr_insns )
+    {
+        fprintf(stderr, "No emulated instructions in %s\n", argv[optind]);
+        return 1;
+    }
+
+    if ( !emul_test_init() )
+        fprintf(stderr, "Warning: Stack could not be made executable (%d).\n",
+                errno);
+
+    ctxt.regs = &regs;
+
+    for ( r = 0; r < repeats; r++ )
+    {
+        for ( i = 0; i < nr_insns; i++ )
+        {
+            cur = &insns[i];
+            c = classify(cur);
+
+            memset(&regs, 0, sizeof(regs));
+            regs.rip = INSN_BASE;
+            regs.eflags = X86_EFLAGS_MBS | X86_EFLAGS_IF;
+            regs.rcx = 16;
+            ctxt.lma = cur->lma;
+            ctxt.addr_size = cur->addr_size;
+            ctxt.sp_size = cur->sp_size;
+
+            /*
+             * Without the rep_* hooks, a string instruction is emulated one
+             * repetition per call, leaving rIP in place until it is done.
+             */
+            start = __rdtsc();
+            do {
+                rc = x86_emulate(&ctxt, &emulops);
+            } while ( rc == X86EMUL_OKAY && regs.rip == INSN_BASE &&
+                      regs.rcx );
+            cycles = __rdtsc() - start;
+
+            stats[c].insns++;
+            stats[c].cycles += cycles;
+            if ( rc != X86EMUL_OKAY )
+                stats[c].failed++;
+        }
+    }
+
+    printf("%-10s %12s %10s %12s\n", "class", "insns", "failed", "cycles/insn");
+    for ( c = 0; c < NR_CLASSES; c++ )
+    {
+        if ( !stats[c].insns )
+            continue;
+        total += stats[c].insns;
+        printf("%-10s %12lu %10lu %12lu\n", class_names[c], stats[c].insns,
+               stats[c].failed, (unsigned long)(stats[c].cycles /
+                                                stats[c].insns));
+    }
+    printf("%u recorded instructions, %lu emulated\n", nr_insns, total);
+
+    return 0;
+}
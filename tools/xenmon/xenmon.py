@@ -2,6 +2,7 @@
 
 #####################################################################
 # xenmon is a front-end for xenbaked.
+# With --poll it instead prints the per-domain aggregates Xen keeps itself.
 # There is a curses interface for live monitoring. XenMon also allows
 # logging to a file. For options, run python xenmon.py -h
 #
@@ -112,6 +113,9 @@ def setup_cmdline_parser():
     parser.add_option("--noiocount", dest="iocount", action="store_false",
                       default=False, help="Don't display I/O count for each domain")
 
+    parser.add_option("--poll", dest="poll", action="store_true",
+                      default=False, help="print per-domain aggregates kept by Xen every interval, without running xenbaked")
+
     return parser
 
 # encapsulate information about a domain
@@ -649,6 +653,46 @@ def writelog():
     for dom in range(0, NDOMAINS):
         outfiles[dom].close()
 
+# print per-domain scheduling aggregates maintained by Xen itself, as the
+# difference between two snapshots taken an interval apart; this needs no
+# trace buffers and no xenbaked
+def poll_schedstats():
+    import xen.lowlevel.xc
+    xc = xen.lowlevel.xc.xc()
+
+    def snapshot():
+        stats = xc.domain_sched_stats()
+        return stats['now'], dict([(d['domid'], d) for d in stats['domains']])
+
+    start = time.time()
+    last_now, last = snapshot()
+    while options.duration == 0 or time.time() - start < options.duration:
+        time.sleep(options.interval / 1000.0)
+        now, curr = snapshot()
+        elapsed = float(now - last_now)
+        if elapsed <= 0:
+            continue
+
+        print "%5s %5s %8s %8s %8s %10s %10s %10s" % \
+              ("Dom", "VCPUs", GOTTEN, WAITED, BLOCKED,
+               "Switch/s", "Preempt/s", "Wakeup/s")
+        for domid in sorted(curr.keys()):
+            if not last.has_key(domid):
+                continue
+            c, l = curr[domid], last[domid]
+            # percentages are of one CPU, as in the live frontend
+            print "%5d %5d %7.2f%% %7.2f%% %7.2f%% %10.1f %10.1f %10.1f" % \
+                  (domid, c['vcpus'],
+                   100 * (c['running_ns'] - l['running_ns']) / elapsed,
+                   100 * (c['runnable_ns'] - l['runnable_ns']) / elapsed,
+                   100 * (c['blocked_ns'] - l['blocked_ns']) / elapsed,
+                   (c['switches'] - l['switches']) * 1e9 / elapsed,
+                   (c['preemptions'] - l['preemptions']) * 1e9 / elapsed,
+                   (c['wakeups'] - l['wakeups']) * 1e9 / elapsed)
+        print
+        sys.stdout.flush()
+        last_now, last = now, curr
+
 # start xenbaked
 def start_xenbaked():
     global options
@@ -697,6 +741,13 @@ def main():
         parser.error("option --ms_per_sample: too large (> %d ms)" %
                      (options.duration * 1000))
     
+    if options.poll:
+        try:
+            poll_schedstats()
+        except KeyboardInterrupt:
+            pass
+        return
+
     start_xenbaked()
     if options.live:
         show_livestats(options.cpu)
@@ -19,12 +19,22 @@
  */
 
 
+#include <time.h>
 #include "xc_bitops.h"
 #include "policy.h"
 
 
 #define DEFAULT_MRU_SIZE (1024 * 16)
 
+/*
+ * Guest accesses are sampled at most once per SAMPLE_INTERVAL seconds.  A
+ * gfn's age is the number of samples it went unaccessed in, victims are
+ * taken from gfns at least COLD_AGE old first.
+ */
+#define SAMPLE_INTERVAL 1
+#define COLD_AGE        2
+#define MAX_AGE         255
+
 
 static unsigned long *mru;
 static unsigned int i_mru;
@@ -34,6 +44,9 @@ static unsigned long *unconsumed;
 static unsigned int unconsumed_cleared;
 static unsigned long current_gfn;
 static unsigned long max_pages;
+static unsigned char *age;
+static unsigned long *accessed;
+static time_t last_sample;
 
 
 int policy_init(struct xenpaging *paging)
@@ -65,6 +78,25 @@ int policy_init(struct xenpaging *paging)
     for ( i = 0; i < mru_size; i++ )
         mru[i] = INVALID_MFN;
 
+    /* Until sampled, all gfns are equally cold */
+    age = malloc(max_pages);
+    accessed = bitmap_alloc(XENMEM_PAGING_HARVEST_MAX);
+    if ( !age || !accessed )
+        goto out;
+    memset(age, MAX_AGE, max_pages);
+
+    /* Start tracking accesses, if the hardware can */
+    if ( xc_mem_paging_harvest_accessed(paging->xc_handle,
+                                        paging->vm_event.domain_id, 0,
+                                        min_t(unsigned long, max_pages,
+                                              XENMEM_PAGING_HARVEST_MAX),
+                                        accessed) )
+    {
+        free(accessed);
+        accessed = NULL;
+    }
+    last_sample = time(NULL);
+
     /* Don't page out page 0 */
     set_bit(0, bitmap);
 
@@ -76,9 +108,40 @@ int policy_init(struct xenpaging *paging)
     return rc;
 }
 
-unsigned long policy_choose_victim(struct xenpaging *paging)
+/* Age all gfns, restarting the ones accessed since the previous sample */
+static void policy_sample(struct xenpaging *paging)
 {
     xc_interface *xch = paging->xc_handle;
+    unsigned long gfn, i;
+    unsigned int nr;
+    time_t now = time(NULL);
+
+    if ( !accessed || now - last_sample < SAMPLE_INTERVAL )
+        return;
+    last_sample = now;
+
+    for ( gfn = 0; gfn < max_pages; gfn += nr )
+    {
+        nr = min_t(unsigned long, max_pages - gfn, XENMEM_PAGING_HARVEST_MAX);
+        if ( xc_mem_paging_harvest_accessed(xch, paging->vm_event.domain_id,
+                                            gfn, nr, accessed) )
+        {
+            PERROR("Error sampling accesses of gfns %lx+%x", gfn, nr);
+            return;
+        }
+
+        for ( i = 0; i < nr; i++ )
+        {
+            if ( test_bit(i, accessed) )
+                age[gfn + i] = 0;
+            else if ( age[gfn + i] < MAX_AGE )
+                age[gfn + i]++;
+        }
+    }
+}
+
+static unsigned long choose_victim(int cold_only)
+{
     unsigned long i;
 
     /* One iteration over all possible gfns */
@@ -110,12 +173,31 @@ unsigned long policy_choose_victim(struct xenpaging *paging)
         if ( test_bit(current_gfn, unconsumed) )
             continue;
 
+        /* gfn still in use */
+        if ( cold_only && age[current_gfn] < COLD_AGE )
+            continue;
+
         /* gfn found */
         break;
     }
 
+    return i < max_pages ? current_gfn : INVALID_MFN;
+}
+
+unsigned long policy_choose_victim(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    unsigned long gfn;
+
+    policy_sample(paging);
+
+    /* Prefer gfns the guest hasn't used lately, but take any if needed */
+    gfn = choose_victim(1);
+    if ( gfn == INVALID_MFN )
+        gfn = choose_victim(0);
+
     /* Could not nominate any gfn */
-    if ( i >= max_pages )
+    if ( gfn == INVALID_MFN )
     {
         /* No more pages, wait in poll */
         paging->use_poll_timeout = 1;
@@ -132,8 +214,8 @@ unsigned long policy_choose_victim(struct xenpaging *paging)
         return INVALID_MFN;
     }
 
-    set_bit(current_gfn, unconsumed);
-    return current_gfn;
+    set_bit(gfn, unconsumed);
+    return gfn;
 }
 
 void policy_notify_paged_out(unsigned long gfn)
@@ -146,6 +228,9 @@ static void policy_handle_paged_in(unsigned long gfn, int do_mru)
 {
     unsigned long old_gfn = mru[i_mru & (mru_size - 1)];
 
+    /* The guest just asked for it */
+    age[gfn] = 0;
+
     if ( old_gfn != INVALID_MFN )
         clear_bit(old_gfn, bitmap);
     
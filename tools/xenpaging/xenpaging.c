@@ -753,6 +753,38 @@ static void resume_pages(struct xenpaging *paging, int num_pages)
         page_in_trigger();
 }
 
+/*
+ * Guests tend to touch neighbouring gfns together: after paging gfn in, page
+ * in the paged out gfns following it as well, through the page-in thread,
+ * and have the paging file start reading them meanwhile.
+ */
+static void readahead_pages(struct xenpaging *paging, unsigned long gfn)
+{
+    unsigned long next;
+    int i = 0, num = 0;
+
+    for ( next = gfn + 1;
+          next <= gfn + XENPAGING_READAHEAD && next < paging->max_pages;
+          next++ )
+    {
+        if ( !test_bit(next, paging->bitmap) )
+            continue;
+
+        /* Find a free entry in the queue */
+        while ( i < XENPAGING_PAGEIN_QUEUE_SIZE && paging->pagein_queue[i] )
+            i++;
+        if ( i == XENPAGING_PAGEIN_QUEUE_SIZE )
+            break;
+
+        readahead_page(paging->fd, paging->gfn_to_slot[next]);
+        paging->pagein_queue[i] = next;
+        num++;
+    }
+
+    if ( num )
+        page_in_trigger();
+}
+
 /* Evict one gfn and write it to the given slot
  * Returns < 0 on fatal error
  * Returns 0 on successful evict
@@ -942,6 +974,14 @@ int main(int argc, char *argv[])
                         ERROR("Error populating page %"PRIx64"", req.u.mem_paging.gfn);
                         goto out;
                     }
+
+                    /*
+                     * Only for the guest's own accesses, not for those of
+                     * the page-in thread, or readahead would cascade.
+                     */
+                    if ( (req.flags & VM_EVENT_FLAG_VCPU_PAUSED) &&
+                         !interrupted && paging->target_tot_pages )
+                        readahead_pages(paging, req.u.mem_paging.gfn);
                 }
 
                 /* Prepare the response */
@@ -32,6 +32,8 @@
 #include <xen/vm_event.h>
 
 #define XENPAGING_PAGEIN_QUEUE_SIZE 64
+/* Paged out gfns following a paged in one to page in as well */
+#define XENPAGING_READAHEAD 8
 
 struct vm_event {
     domid_t domain_id;
@@ -54,13 +54,19 @@ typedef struct xenstat_collector {
 
 static int  xenstat_collect_vcpus(xenstat_node * node);
 static int  xenstat_collect_xen_version(xenstat_node * node);
+static int  xenstat_collect_exits(xenstat_node * node);
 static void xenstat_free_vcpus(xenstat_node * node);
 static void xenstat_free_networks(xenstat_node * node);
 static void xenstat_free_xen_version(xenstat_node * node);
 static void xenstat_free_vbds(xenstat_node * node);
+static void xenstat_free_exits(xenstat_node * node);
 static void xenstat_uninit_vcpus(xenstat_handle * handle);
 static void xenstat_uninit_xen_version(xenstat_handle * handle);
-static char *xenstat_get_domain_name(xenstat_handle * handle, unsigned int domain_id);
+static void xenstat_uninit_exits(xenstat_handle * handle);
+static char *xenstat_get_domain_name(xenstat_handle * handle,
+				     const xc_domaininfo_t *info);
+static void xenstat_update_names(xenstat_handle * handle);
+static void xenstat_free_names(xenstat_handle * handle);
 static void xenstat_prune_domain(xenstat_node *node, unsigned int entry);
 
 static xenstat_collector collectors[] = {
@@ -71,7 +77,9 @@ static xenstat_collector collectors[] = {
 	{ XENSTAT_XEN_VERSION, xenstat_collect_xen_version,
 	  xenstat_free_xen_version, xenstat_uninit_xen_version },
 	{ XENSTAT_VBD, xenstat_collect_vbds,
-	  xenstat_free_vbds, xenstat_uninit_vbds }
+	  xenstat_free_vbds, xenstat_uninit_vbds },
+	{ XENSTAT_EXITS, xenstat_collect_exits,
+	  xenstat_free_exits, xenstat_uninit_exits }
 };
 
 #define NUM_COLLECTORS (sizeof(collectors)/sizeof(xenstat_collector))
@@ -124,6 +132,7 @@ void xenstat_uninit(xenstat_handle * handle)
 	if (handle) {
 		for (i = 0; i < NUM_COLLECTORS; i++)
 			collectors[i].uninit(handle);
+		xenstat_free_names(handle);
 		xc_interface_close(handle->xc_handle);
 		xs_daemon_close(handle->xshandle);
 		free(handle->priv);
@@ -201,6 +210,8 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 		return NULL;
 	}
 
+	xenstat_update_names(handle);
+
 	node->num_domains = 0;
 	do {
 		xenstat_domain *domain, *tmp;
@@ -228,8 +239,8 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 		for (i = 0; i < new_domains; i++) {
 			/* Fill in domain using domaininfo[i] */
 			domain->id = domaininfo[i].domain;
-			domain->name = xenstat_get_domain_name(handle, 
-							       domain->id);
+			domain->name = xenstat_get_domain_name(handle,
+							       &domaininfo[i]);
 			if (domain->name == NULL) {
 				if (errno == ENOMEM) {
 					/* fatal error */
@@ -483,44 +494,78 @@ xenstat_vbd *xenstat_domain_vbd(xenstat_domain * domain,
 /* Collect information about VCPUs */
 static int xenstat_collect_vcpus(xenstat_node * node)
 {
-	unsigned int i, vcpu, inc_index;
+#define VCPU_CHUNK_SIZE 1024
+	xc_vcpuinfolist_t *info;
+	unsigned int *seen;
+	unsigned int i, j, first_domain = 0, first_vcpu = 0;
+	int n;
 
-	/* Fill in VCPU information */
-	for (i = 0; i < node->num_domains; i+=inc_index) {
-		inc_index = 1; /* default is to increment to next domain */
+	info = malloc(VCPU_CHUNK_SIZE * sizeof(*info));
+	seen = calloc(node->num_domains + 1, sizeof(*seen));
+	if (info == NULL || seen == NULL)
+		goto err;
 
-		node->domains[i].vcpus = malloc(node->domains[i].num_vcpus
-						* sizeof(xenstat_vcpu));
+	for (i = 0; i < node->num_domains; i++) {
+		node->domains[i].vcpus = calloc(node->domains[i].num_vcpus,
+						sizeof(xenstat_vcpu));
 		if (node->domains[i].vcpus == NULL)
-			return 0;
-	
-		for (vcpu = 0; vcpu < node->domains[i].num_vcpus; vcpu++) {
-			/* FIXME: need to be using a more efficient mechanism*/
-			xc_vcpuinfo_t info;
+			goto err;
+	}
 
-			if (xc_vcpu_getinfo(node->handle->xc_handle,
-					    node->domains[i].id, vcpu, &info) != 0) {
-				if (errno == ENOMEM) {
-					/* fatal error */ 
-					return 0;
-				}
-				else {
-					/* domain is in transition - remove
-					   from list */
-					xenstat_prune_domain(node, i);
+	/*
+	 * Fetch all vCPUs of all domains in a few hypercalls.  Both lists
+	 * are in domain ID order, so a cursor into node->domains suffices.
+	 */
+	i = 0;
+	do {
+		n = xc_vcpu_getinfolist(node->handle->xc_handle, first_domain,
+					first_vcpu, VCPU_CHUNK_SIZE, info);
+		if (n < 0)
+			goto err;
 
-					/* remember not to increment index! */
-					inc_index = 0;
-					break;
-				}
-			}
-			else {
-				node->domains[i].vcpus[vcpu].online = info.online;
-				node->domains[i].vcpus[vcpu].ns = info.cpu_time;
-			}
+		for (j = 0; j < n; j++) {
+			while (i < node->num_domains &&
+			       node->domains[i].id < info[j].domid)
+				i++;
+			if (i == node->num_domains)
+				break;
+			if (node->domains[i].id != info[j].domid ||
+			    info[j].vcpu >= node->domains[i].num_vcpus)
+				continue;
+
+			node->domains[i].vcpus[info[j].vcpu].online =
+				info[j].online;
+			node->domains[i].vcpus[info[j].vcpu].ns =
+				info[j].cpu_time;
+			seen[i]++;
 		}
+
+		if (n > 0) {
+			first_domain = info[n - 1].domid;
+			first_vcpu = info[n - 1].vcpu + 1;
+		}
+	} while (n == VCPU_CHUNK_SIZE);
+
+	/*
+	 * Domains none of whose vCPUs were listed are being destroyed -
+	 * remove them from the list.
+	 */
+	for (i = node->num_domains; i-- > 0; ) {
+		if (seen[i])
+			continue;
+		free(node->domains[i].vcpus);
+		free(node->domains[i].name);
+		xenstat_prune_domain(node, i);
 	}
+
+	free(seen);
+	free(info);
 	return 1;
+
+err:
+	free(seen);
+	free(info);
+	return 0;
 }
 
 /* Free VCPU information */
@@ -762,14 +807,230 @@ unsigned long long xenstat_tmem_succ_pers_gets(xenstat_tmem *tmem)
 	return tmem->succ_pers_gets;
 }
 
+/*
+ * VM exit functions
+ */
+
+/* Collect VM exit accounting; PV domains have none and are left zeroed */
+static int xenstat_collect_exits(xenstat_node * node)
+{
+	unsigned int i, inc_index;
+	uint32_t nr;
+
+	for (i = 0; i < node->num_domains; i += inc_index) {
+		xenstat_exits *exits = &node->domains[i].exit_stats;
+		xc_exit_stats_t stats;
+
+		inc_index = 1;
+
+		nr = XEN_DOMCTL_EXIT_STATS_REASONS;
+		exits->reasons = calloc(nr, sizeof(*exits->reasons));
+		if (exits->reasons == NULL)
+			return 0;
+
+		if (xc_domain_exit_stats(node->handle->xc_handle,
+					 node->domains[i].id, &stats,
+					 &nr, exits->reasons) != 0) {
+			free(exits->reasons);
+			exits->reasons = NULL;
+			if (errno == ENOMEM)
+				return 0;
+			if (errno == ESRCH) {
+				/* domain is in transition - remove from list */
+				xenstat_prune_domain(node, i);
+				inc_index = 0;
+			}
+			continue;
+		}
+
+		exits->exits = stats.exits;
+		exits->exit_ns = stats.exit_ns;
+		exits->emulations = stats.emulations;
+		exits->emulation_ns = stats.emulation_ns;
+		exits->ioreqs = stats.ioreqs;
+		exits->ioreq_ns = stats.ioreq_ns;
+		exits->num_reasons = nr < XEN_DOMCTL_EXIT_STATS_REASONS ?
+			nr : XEN_DOMCTL_EXIT_STATS_REASONS;
+	}
+
+	return 1;
+}
+
+/* Free VM exit information */
+static void xenstat_free_exits(xenstat_node * node)
+{
+	unsigned int i;
+	for (i = 0; i < node->num_domains; i++)
+		free(node->domains[i].exit_stats.reasons);
+}
+
+/* Free VM exit information in handle - nothing to do */
+static void xenstat_uninit_exits(xenstat_handle * handle)
+{
+}
+
+xenstat_exits *xenstat_domain_exits(xenstat_domain * domain)
+{
+	return &domain->exit_stats;
+}
+
+/* Get the number of VM exits */
+unsigned long long xenstat_exits_count(xenstat_exits *exits)
+{
+	return exits->exits;
+}
 
-static char *xenstat_get_domain_name(xenstat_handle *handle, unsigned int domain_id)
+/* Get the time spent handling VM exits */
+unsigned long long xenstat_exits_ns(xenstat_exits *exits)
 {
+	return exits->exit_ns;
+}
+
+/* Get the number of emulated instructions */
+unsigned long long xenstat_exits_emulations(xenstat_exits *exits)
+{
+	return exits->emulations;
+}
+
+/* Get the time spent emulating instructions */
+unsigned long long xenstat_exits_emulation_ns(xenstat_exits *exits)
+{
+	return exits->emulation_ns;
+}
+
+/* Get the number of ioreqs sent to device models */
+unsigned long long xenstat_exits_ioreqs(xenstat_exits *exits)
+{
+	return exits->ioreqs;
+}
+
+/* Get the time spent waiting for device models */
+unsigned long long xenstat_exits_ioreq_ns(xenstat_exits *exits)
+{
+	return exits->ioreq_ns;
+}
+
+/* Get the number of exit reasons */
+unsigned int xenstat_exits_num_reasons(xenstat_exits *exits)
+{
+	return exits->num_reasons;
+}
+
+/* Get the number of exits for a reason */
+unsigned long long xenstat_exits_reason_count(xenstat_exits *exits,
+					      unsigned int reason)
+{
+	if (reason < exits->num_reasons)
+		return exits->reasons[reason].count;
+	return 0;
+}
+
+/* Get the time spent handling exits for a reason */
+unsigned long long xenstat_exits_reason_ns(xenstat_exits *exits,
+					   unsigned int reason)
+{
+	if (reason < exits->num_reasons)
+		return exits->reasons[reason].ns;
+	return 0;
+}
+
+#define NAMES_WATCH_TOKEN "xenstat-names"
+
+/*
+ * Domain names are cached in the handle, so that a refresh costs no
+ * xenstore reads for domains already seen.  A watch on /local/domain
+ * tells which names to forget: a domain's directory (on destruction) or
+ * its name (on rename) changing.  Without the watch, every refresh
+ * reads every name.
+ */
+static void xenstat_forget_name(xenstat_handle *handle, unsigned int domid)
+{
+	unsigned int i;
+
+	for (i = 0; i < handle->num_names; i++) {
+		if (handle->names[i].domid != domid)
+			continue;
+		free(handle->names[i].name);
+		handle->names[i] = handle->names[--handle->num_names];
+		return;
+	}
+}
+
+static void xenstat_update_names(xenstat_handle *handle)
+{
+	char **event;
+	unsigned int domid;
+	int len;
+
+	if (handle->names_watch == 0)
+		handle->names_watch = xs_watch(handle->xshandle, "/local/domain",
+					       NAMES_WATCH_TOKEN) ? 1 : -1;
+	if (handle->names_watch < 0)
+		return;
+
+	while ((event = xs_check_watch(handle->xshandle)) != NULL) {
+		const char *path = event[XS_WATCH_PATH];
+
+		if (strcmp(event[XS_WATCH_TOKEN], NAMES_WATCH_TOKEN) == 0) {
+			if (sscanf(path, "/local/domain/%u%n", &domid, &len) != 1)
+				xenstat_free_names(handle);
+			else if (path[len] == '\0' ||
+				 strcmp(path + len, "/name") == 0)
+				xenstat_forget_name(handle, domid);
+		}
+		free(event);
+	}
+}
+
+static void xenstat_free_names(xenstat_handle *handle)
+{
+	unsigned int i;
+
+	for (i = 0; i < handle->num_names; i++)
+		free(handle->names[i].name);
+	free(handle->names);
+	handle->names = NULL;
+	handle->num_names = 0;
+}
+
+static char *xenstat_get_domain_name(xenstat_handle *handle,
+				     const xc_domaininfo_t *info)
+{
+	struct xenstat_name *tmp;
 	char path[80];
+	char *name;
+	unsigned int i;
 
-	snprintf(path, sizeof(path),"/local/domain/%i/name", domain_id);
+	for (i = 0; i < handle->num_names; i++) {
+		if (handle->names[i].domid != info->domain)
+			continue;
+		if (memcmp(handle->names[i].uuid, info->handle,
+			   sizeof(info->handle)) == 0)
+			return strdup(handle->names[i].name);
+		xenstat_forget_name(handle, info->domain);
+		break;
+	}
 
-	return xs_read(handle->xshandle, XBT_NULL, path, NULL);
+	snprintf(path, sizeof(path),"/local/domain/%i/name", info->domain);
+
+	name = xs_read(handle->xshandle, XBT_NULL, path, NULL);
+	if (name == NULL || handle->names_watch <= 0)
+		return name;
+
+	tmp = realloc(handle->names,
+		      (handle->num_names + 1) * sizeof(*handle->names));
+	if (tmp == NULL)
+		return name;
+	handle->names = tmp;
+	tmp = &handle->names[handle->num_names];
+	tmp->name = strdup(name);
+	if (tmp->name == NULL)
+		return name;
+	tmp->domid = info->domain;
+	memcpy(tmp->uuid, info->handle, sizeof(tmp->uuid));
+	handle->num_names++;
+
+	return name;
 }
 
 /* Remove specified entry from list of domains */
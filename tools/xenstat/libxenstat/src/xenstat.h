@@ -28,6 +28,7 @@ typedef struct xenstat_vcpu xenstat_vcpu;
 typedef struct xenstat_network xenstat_network;
 typedef struct xenstat_vbd xenstat_vbd;
 typedef struct xenstat_tmem xenstat_tmem;
+typedef struct xenstat_exits xenstat_exits;
 
 /* Initialize the xenstat library.  Returns a handle to be used with
  * subsequent calls to the xenstat library, or NULL if an error occurs. */
@@ -41,7 +42,8 @@ void xenstat_uninit(xenstat_handle * handle);
 #define XENSTAT_NETWORK 0x2
 #define XENSTAT_XEN_VERSION 0x4
 #define XENSTAT_VBD 0x8
-#define XENSTAT_ALL (XENSTAT_VCPU|XENSTAT_NETWORK|XENSTAT_XEN_VERSION|XENSTAT_VBD)
+#define XENSTAT_EXITS 0x10
+#define XENSTAT_ALL (XENSTAT_VCPU|XENSTAT_NETWORK|XENSTAT_XEN_VERSION|XENSTAT_VBD|XENSTAT_EXITS)
 
 /* Get all available information about a node */
 xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags);
@@ -136,6 +138,9 @@ xenstat_vbd *xenstat_domain_vbd(xenstat_domain * domain,
 /* Get the tmem information for a given domain */
 xenstat_tmem *xenstat_domain_tmem(xenstat_domain * domain);
 
+/* Get the VM exit accounting for a given domain (all zero unless HVM) */
+xenstat_exits *xenstat_domain_exits(xenstat_domain * domain);
+
 /*
  * VCPU functions - extract information from a xenstat_vcpu
  */
@@ -201,4 +206,29 @@ unsigned long long xenstat_tmem_succ_eph_gets(xenstat_tmem *tmem);
 unsigned long long xenstat_tmem_succ_pers_puts(xenstat_tmem *tmem);
 unsigned long long xenstat_tmem_succ_pers_gets(xenstat_tmem *tmem);
 
+/*
+ * VM exit functions - extract VM exit accounting information
+ */
+
+/* Get the number of VM exits and the time spent handling them, in ns */
+unsigned long long xenstat_exits_count(xenstat_exits *exits);
+unsigned long long xenstat_exits_ns(xenstat_exits *exits);
+
+/* Get the number of emulated instructions and the time spent, in ns */
+unsigned long long xenstat_exits_emulations(xenstat_exits *exits);
+unsigned long long xenstat_exits_emulation_ns(xenstat_exits *exits);
+
+/* Get the number of ioreqs sent to device models and the time waited, in ns */
+unsigned long long xenstat_exits_ioreqs(xenstat_exits *exits);
+unsigned long long xenstat_exits_ioreq_ns(xenstat_exits *exits);
+
+/* Get the number of exit reasons, and the exits and time of each one; the
+ * reason is the VMX basic exit reason or SVM exit code, with nested page
+ * faults reported as XEN_DOMCTL_EXIT_STATS_NPF */
+unsigned int xenstat_exits_num_reasons(xenstat_exits *exits);
+unsigned long long xenstat_exits_reason_count(xenstat_exits *exits,
+					      unsigned int reason);
+unsigned long long xenstat_exits_reason_ns(xenstat_exits *exits,
+					   unsigned int reason);
+
 #endif /* XENSTAT_H */
@@ -32,12 +32,22 @@
 #define SHORT_ASC_LEN 5                 /* length of 65535 */
 #define VERSION_SIZE (2 * SHORT_ASC_LEN + 1 + sizeof(xen_extraversion_t) + 1)
 
+struct xenstat_name {
+	unsigned int domid;
+	xen_domain_handle_t uuid;	/* tells apart reuses of domid */
+	char *name;
+};
+
 struct xenstat_handle {
 	xc_interface *xc_handle;
 	struct xs_handle *xshandle; /* xenstore handle */
 	int page_size;
 	void *priv;
 	char xen_version[VERSION_SIZE]; /* xen version running on this node */
+	/* Domain names, kept until a xenstore watch reports a change */
+	int names_watch;		/* 1: watching, 0: not yet, -1: failed */
+	unsigned int num_names;
+	struct xenstat_name *names;	/* Array of length num_names */
 };
 
 struct xenstat_node {
@@ -59,6 +69,17 @@ struct xenstat_tmem {
 	unsigned long long succ_pers_gets;
 };
 
+struct xenstat_exits {
+	unsigned long long exits;
+	unsigned long long exit_ns;
+	unsigned long long emulations;
+	unsigned long long emulation_ns;
+	unsigned long long ioreqs;
+	unsigned long long ioreq_ns;
+	unsigned int num_reasons;
+	xc_exit_reason_t *reasons;	/* Array of length num_reasons */
+};
+
 struct xenstat_domain {
 	unsigned int id;
 	char *name;
@@ -74,6 +95,7 @@ struct xenstat_domain {
 	unsigned int num_vbds;
 	xenstat_vbd *vbds;
 	xenstat_tmem tmem_stats;
+	xenstat_exits exit_stats;
 };
 
 struct xenstat_vcpu {
@@ -126,6 +126,14 @@ static int compare_vbd_rsect(xenstat_domain *domain1, xenstat_domain *domain2);
 static void print_vbd_rsect(xenstat_domain *domain);
 static int compare_vbd_wsect(xenstat_domain *domain1, xenstat_domain *domain2);
 static void print_vbd_wsect(xenstat_domain *domain);
+static int compare_exits(xenstat_domain *domain1, xenstat_domain *domain2);
+static void print_exits(xenstat_domain *domain);
+static int compare_exit_pct(xenstat_domain *domain1, xenstat_domain *domain2);
+static void print_exit_pct(xenstat_domain *domain);
+static int compare_emul_pct(xenstat_domain *domain1, xenstat_domain *domain2);
+static void print_emul_pct(xenstat_domain *domain);
+static int compare_ioreq_pct(xenstat_domain *domain1, xenstat_domain *domain2);
+static void print_ioreq_pct(xenstat_domain *domain);
 static void reset_field_widths(void);
 static void adjust_field_widths(xenstat_domain *domain);
 
@@ -137,6 +145,7 @@ static void do_domain(xenstat_domain *);
 static void do_vcpu(xenstat_domain *);
 static void do_network(xenstat_domain *);
 static void do_vbd(xenstat_domain *);
+static void do_exits(xenstat_domain *);
 static void top(void);
 
 /* Field types */
@@ -160,7 +169,11 @@ typedef enum field_id {
 	FIELD_VBD_WR,
 	FIELD_VBD_RSECT,
 	FIELD_VBD_WSECT,
-	FIELD_SSID
+	FIELD_SSID,
+	FIELD_EXITS,
+	FIELD_EXIT_PCT,
+	FIELD_EMUL_PCT,
+	FIELD_IOREQ_PCT
 } field_id;
 
 typedef struct field {
@@ -190,7 +203,11 @@ field fields[] = {
 	{ FIELD_VBD_WR,    "VBD_WR",     8, compare_vbd_wr,    print_vbd_wr  },
 	{ FIELD_VBD_RSECT, "VBD_RSECT", 10, compare_vbd_rsect, print_vbd_rsect  },
 	{ FIELD_VBD_WSECT, "VBD_WSECT", 10, compare_vbd_wsect, print_vbd_wsect  },
-	{ FIELD_SSID,      "SSID",       4, compare_ssid,      print_ssid    }
+	{ FIELD_SSID,      "SSID",       4, compare_ssid,      print_ssid    },
+	{ FIELD_EXITS,     "EXITS",     10, compare_exits,     print_exits   },
+	{ FIELD_EXIT_PCT,  "EXIT(%)",    7, compare_exit_pct,  print_exit_pct },
+	{ FIELD_EMUL_PCT,  "EMUL(%)",    7, compare_emul_pct,  print_emul_pct },
+	{ FIELD_IOREQ_PCT, "IOREQ(%)",   8, compare_ioreq_pct, print_ioreq_pct }
 };
 
 const unsigned int NUM_FIELDS = sizeof(fields)/sizeof(field);
@@ -210,6 +227,7 @@ int show_vcpus = 0;
 int show_networks = 0;
 int show_vbds = 0;
 int show_tmem = 0;
+int show_exits = 0;
 int repeat_header = 0;
 int show_full_name = 0;
 #define PROMPT_VAL_LEN 80
@@ -238,6 +256,7 @@ static void usage(const char *program)
 	       "-x, --vbds           output vbd block device data\n"
 	       "-r, --repeat-header  repeat table header before each domain\n"
 	       "-v, --vcpus          output vcpu data\n"
+	       "-e, --exits          output VM exit data\n"
 	       "-b, --batch	     output in batch mode, no user input accepted\n"
 	       "-i, --iterations     number of iterations before exiting\n"
 	       "-f, --full-name      output the full domain name (not truncated)\n"
@@ -374,6 +393,9 @@ static int handle_key(int ch)
 		case 'v': case 'V':
 			show_vcpus ^= 1;
 			break;
+		case 'e': case 'E':
+			show_exits ^= 1;
+			break;
 		case KEY_DOWN:
 			first_domain_index++;
 			break;
@@ -807,6 +829,78 @@ static void print_ssid(xenstat_domain *domain)
 	print("%4u", xenstat_domain_ssid(domain));
 }
 
+/* Compares number of VM exits of two domains, returning -1,0,1 for <,=,> */
+static int compare_exits(xenstat_domain *domain1, xenstat_domain *domain2)
+{
+	return -compare(xenstat_exits_count(xenstat_domain_exits(domain1)),
+			xenstat_exits_count(xenstat_domain_exits(domain2)));
+}
+
+/* Prints number of VM exits */
+static void print_exits(xenstat_domain *domain)
+{
+	print("%*llu", fields[FIELD_EXITS-1].default_width,
+	      xenstat_exits_count(xenstat_domain_exits(domain)));
+}
+
+/* Computes the percentage of the last interval a domain spent in one of
+ * its VM exit accounting buckets, in the same way as get_cpu_pct() */
+static double get_exits_pct(xenstat_domain *domain,
+			    unsigned long long (*get)(xenstat_exits *))
+{
+	xenstat_domain *old_domain;
+	double us_elapsed;
+
+	if(prev_node == NULL)
+		return 0.0;
+
+	old_domain = xenstat_node_domain(prev_node, xenstat_domain_id(domain));
+	if(old_domain == NULL)
+		return 0.0;
+
+	us_elapsed = ((curtime.tv_sec-oldtime.tv_sec)*1000000.0
+		      +(curtime.tv_usec - oldtime.tv_usec));
+
+	return ((get(xenstat_domain_exits(domain))
+		 -get(xenstat_domain_exits(old_domain)))/10.0)/us_elapsed;
+}
+
+static int compare_exit_pct(xenstat_domain *domain1, xenstat_domain *domain2)
+{
+	return -compare(get_exits_pct(domain1, xenstat_exits_ns),
+			get_exits_pct(domain2, xenstat_exits_ns));
+}
+
+/* Prints percentage of time spent handling VM exits */
+static void print_exit_pct(xenstat_domain *domain)
+{
+	print("%7.1f", get_exits_pct(domain, xenstat_exits_ns));
+}
+
+static int compare_emul_pct(xenstat_domain *domain1, xenstat_domain *domain2)
+{
+	return -compare(get_exits_pct(domain1, xenstat_exits_emulation_ns),
+			get_exits_pct(domain2, xenstat_exits_emulation_ns));
+}
+
+/* Prints percentage of time spent emulating instructions */
+static void print_emul_pct(xenstat_domain *domain)
+{
+	print("%7.1f", get_exits_pct(domain, xenstat_exits_emulation_ns));
+}
+
+static int compare_ioreq_pct(xenstat_domain *domain1, xenstat_domain *domain2)
+{
+	return -compare(get_exits_pct(domain1, xenstat_exits_ioreq_ns),
+			get_exits_pct(domain2, xenstat_exits_ioreq_ns));
+}
+
+/* Prints percentage of time spent waiting for device models */
+static void print_ioreq_pct(xenstat_domain *domain)
+{
+	print("%8.1f", get_exits_pct(domain, xenstat_exits_ioreq_ns));
+}
+
 /* Resets default_width for fields with potentially large numbers */
 void reset_field_widths(void)
 {
@@ -816,6 +910,7 @@ void reset_field_widths(void)
 	fields[FIELD_VBD_WR-1].default_width = 8;
 	fields[FIELD_VBD_RSECT-1].default_width = 10;
 	fields[FIELD_VBD_WSECT-1].default_width = 10;
+	fields[FIELD_EXITS-1].default_width = 10;
 }
 
 /* Adjusts default_width for fields with potentially large numbers */
@@ -852,6 +947,11 @@ void adjust_field_widths(xenstat_domain *domain)
 	length = INT_FIELD_WIDTH((tot_vbd_reqs(domain, FIELD_VBD_WSECT)) + 1);
 	if (length > fields[FIELD_VBD_WSECT-1].default_width)
 		fields[FIELD_VBD_WSECT-1].default_width = length;
+
+	length = INT_FIELD_WIDTH(xenstat_exits_count(
+			xenstat_domain_exits(domain)) + 1);
+	if (length > fields[FIELD_EXITS-1].default_width)
+		fields[FIELD_EXITS-1].default_width = length;
 }
 
 
@@ -963,6 +1063,11 @@ void do_bottom_line(void)
 		attr_addstr(show_vcpus ? COLOR_PAIR(1) : 0, "CPUs");
 		addstr("  ");
 
+		/* VM exits */
+		addch(A_REVERSE | 'E');
+		attr_addstr(show_exits ? COLOR_PAIR(1) : 0, "xits");
+		addstr("  ");
+
 		/* repeat */
 		addch(A_REVERSE | 'R');
 		attr_addstr(repeat_header ? COLOR_PAIR(1) : 0, "epeat header");
@@ -1103,6 +1208,54 @@ void do_tmem(xenstat_domain *domain)
 
 }
 
+/* Output VM exit information, with the reasons costing the most time */
+#define TOP_EXIT_REASONS 5
+void do_exits(xenstat_domain *domain)
+{
+	xenstat_exits *exits = xenstat_domain_exits(domain);
+	unsigned int top[TOP_EXIT_REASONS];
+	unsigned int i, j, n = 0, num_reasons;
+	unsigned long long ns;
+
+	if (!xenstat_exits_count(exits))
+		return;
+
+	print("Exits: %10llu %8llums   Emul: %10llu %8llums   "
+	      "Ioreq: %10llu %8llums\n",
+	      xenstat_exits_count(exits), xenstat_exits_ns(exits)/1000000,
+	      xenstat_exits_emulations(exits),
+	      xenstat_exits_emulation_ns(exits)/1000000,
+	      xenstat_exits_ioreqs(exits),
+	      xenstat_exits_ioreq_ns(exits)/1000000);
+
+	/* Insertion sort of the most expensive reasons */
+	num_reasons = xenstat_exits_num_reasons(exits);
+	for (i = 0; i < num_reasons; i++) {
+		ns = xenstat_exits_reason_ns(exits, i);
+		if (!ns)
+			continue;
+		for (j = n; j > 0 &&
+		     ns > xenstat_exits_reason_ns(exits, top[j-1]); j--)
+			if (j < TOP_EXIT_REASONS)
+				top[j] = top[j-1];
+		if (j < TOP_EXIT_REASONS) {
+			top[j] = i;
+			if (n < TOP_EXIT_REASONS)
+				n++;
+		}
+	}
+
+	if (!n)
+		return;
+
+	print("  Top reasons:");
+	for (i = 0; i < n; i++)
+		print("  %3u: %llu/%llums", top[i],
+		      xenstat_exits_reason_count(exits, top[i]),
+		      xenstat_exits_reason_ns(exits, top[i])/1000000);
+	print("\n");
+}
+
 static void top(void)
 {
 	xenstat_domain **domains;
@@ -1157,6 +1310,8 @@ static void top(void)
 			do_vbd(domains[i]);
 		if (show_tmem)
 			do_tmem(domains[i]);
+		if (show_exits)
+			do_exits(domains[i]);
 	}
 
 	if (!batch)
@@ -1184,13 +1339,14 @@ int main(int argc, char **argv)
 		{ "vbds",          no_argument,       NULL, 'x' },
 		{ "repeat-header", no_argument,       NULL, 'r' },
 		{ "vcpus",         no_argument,       NULL, 'v' },
+		{ "exits",         no_argument,       NULL, 'e' },
 		{ "delay",         required_argument, NULL, 'd' },
 		{ "batch",	   no_argument,	      NULL, 'b' },
 		{ "iterations",	   required_argument, NULL, 'i' },
 		{ "full-name",     no_argument,       NULL, 'f' },
 		{ 0, 0, 0, 0 },
 	};
-	const char *sopts = "hVnxrvd:bi:f";
+	const char *sopts = "hVnxrved:bi:f";
 
 	if (atexit(cleanup) != 0)
 		fail("Failed to install cleanup handler.\n");
@@ -1219,6 +1375,9 @@ int main(int argc, char **argv)
 		case 'v':
 			show_vcpus = 1;
 			break;
+		case 'e':
+			show_exits = 1;
+			break;
 		case 'd':
 			delay = atoi(optarg);
 			break;
@@ -47,6 +47,14 @@
  */
 #define XS_UNWATCH_FILTER     1UL<<2
 
+/*
+ * Setting XS_OPEN_SHMEM moves the connection to a ring in memory shared
+ * with a local xenstored, if the daemon supports that, saving the system
+ * calls and copies of the socket.  Otherwise the socket is used as usual.
+ * As with sockets, such a connection is only for the process opening it.
+ */
+#define XS_OPEN_SHMEM         1UL<<3
+
 struct xs_handle;
 typedef uint32_t xs_transaction_t;
 
@@ -120,6 +128,32 @@ void *xs_read(struct xs_handle *h, xs_transaction_t t,
 bool xs_write(struct xs_handle *h, xs_transaction_t t,
 	      const char *path, const void *data, unsigned int len);
 
+/* Get the paths of all the nodes below path, relative to it, parents before
+ * their children.  Nodes below one which cannot be read are left out.
+ * Returns a malloced array: call free() on it after use.
+ * Num indicates size.
+ */
+char **xs_directory_recursive(struct xs_handle *h, xs_transaction_t t,
+			      const char *path, unsigned int *num);
+
+/* Get the values of several files, using as few requests as possible.
+ * Returns a malloced array of num values: call free() on it after use.
+ * An entry is NULL if that file could not be read, otherwise it is the
+ * nul terminated value and lens[i] is its length, not including terminator.
+ */
+void **xs_read_multiple(struct xs_handle *h, xs_transaction_t t,
+			const char *const *paths, unsigned int num,
+			unsigned int *lens);
+
+/* Write the values of several files, using as few requests as possible.
+ * The writes are done in order and stop at the first failure; use a
+ * transaction to make them atomic.
+ * Returns false on failure.
+ */
+bool xs_write_multiple(struct xs_handle *h, xs_transaction_t t,
+		       const char *const *paths, const void *const *data,
+		       const unsigned int *lens, unsigned int num);
+
 /* Create a new directory.
  * Returns false on failure, or success if it already exists.
  */
@@ -25,6 +25,9 @@
 #include "talloc.h"
 #include "xenstored_core.h"
 #include "xenstored_control.h"
+#include "xenstored_domain.h"
+#include "xenstored_shmem.h"
+#include "xenstored_slab.h"
 
 struct cmd_s {
 	char *cmd;
@@ -115,6 +118,24 @@ static int do_control_memreport(void *ctx, struct connection *conn,
 	return 0;
 }
 
+static int do_control_memory(void *ctx, struct connection *conn,
+			     char **vec, int num)
+{
+	char *resp;
+
+	if (num)
+		return EINVAL;
+
+	resp = talloc_strdup(ctx, "");
+	resp = slab_report(resp);
+	resp = domain_memory_report(resp);
+	if (!resp)
+		return ENOMEM;
+
+	send_reply(conn, XS_CONTROL, resp, strlen(resp) + 1);
+	return 0;
+}
+
 static int do_control_print(void *ctx, struct connection *conn,
 			    char **vec, int num)
 {
@@ -127,14 +148,65 @@ static int do_control_print(void *ctx, struct connection *conn,
 	return 0;
 }
 
+static int do_control_watches(void *ctx, struct connection *conn,
+			      char **vec, int num)
+{
+	struct connection *i;
+	struct list_head *w;
+	unsigned int nr;
+	char *resp;
+
+	if (num)
+		return EINVAL;
+
+	resp = talloc_strdup(ctx, "");
+	list_for_each_entry(i, &connections, list) {
+		if (!resp)
+			return ENOMEM;
+		nr = 0;
+		list_for_each(w, &i->watches)
+			nr++;
+		if (!nr && !i->watch_events_dropped)
+			continue;
+		resp = talloc_asprintf_append(resp,
+			"domain %u: %u watches, %u events queued, %lu dropped\n",
+			i->id, nr, i->watch_events, i->watch_events_dropped);
+	}
+	if (!resp)
+		return ENOMEM;
+
+	send_reply(conn, XS_CONTROL, resp, strlen(resp) + 1);
+	return 0;
+}
+
+static int do_control_shmem(void *ctx, struct connection *conn,
+			    char **vec, int num)
+{
+	int ret;
+
+	if (num)
+		return EINVAL;
+
+	ret = shmem_connect(conn);
+	if (ret)
+		return ret;
+
+	/* Already goes over the ring. */
+	send_ack(conn, XS_CONTROL);
+	return 0;
+}
+
 static int do_control_help(void *, struct connection *, char **, int);
 
 static struct cmd_s cmds[] = {
 	{ "check", do_control_check, "" },
 	{ "log", do_control_log, "on|off" },
 	{ "logfile", do_control_logfile, "<file>" },
+	{ "memory", do_control_memory, "" },
 	{ "memreport", do_control_memreport, "[<file>]" },
 	{ "print", do_control_print, "<string>" },
+	{ "watches", do_control_watches, "" },
+	{ "shmem", do_control_shmem, "" },
 	{ "help", do_control_help, "" },
 };
 
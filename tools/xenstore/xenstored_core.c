@@ -29,6 +29,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -49,9 +50,12 @@
 #include "xenstore_lib.h"
 #include "xenstored_core.h"
 #include "xenstored_watch.h"
+#include "xenstored_store.h"
 #include "xenstored_transaction.h"
 #include "xenstored_domain.h"
 #include "xenstored_control.h"
+#include "xenstored_journal.h"
+#include "xenstored_shmem.h"
 #include "tdb.h"
 
 #ifndef NO_SOCKETS
@@ -76,10 +80,11 @@ static bool verbose = false;
 LIST_HEAD(connections);
 int tracefd = -1;
 static bool recovery = true;
+static bool journal = false;
 static int reopen_log_pipe[2];
 static int reopen_log_pipe0_pollfd_idx = -1;
 char *tracefile = NULL;
-TDB_CONTEXT *tdb_ctx = NULL;
+static TDB_CONTEXT *tdb_ctx = NULL;
 
 static const char *sockmsg_string(enum xsd_sockmsg_type type);
 
@@ -101,6 +106,8 @@ int quota_nb_entry_per_domain = 1000;
 int quota_nb_watch_per_domain = 128;
 int quota_max_entry_size = 2048; /* 2K */
 int quota_max_transaction = 10;
+int quota_nb_watch_events = 1024;
+size_t quota_memory_per_domain = 2 * 1024 * 1024; /* 2M */
 
 void trace(const char *fmt, ...)
 {
@@ -232,7 +239,7 @@ static bool write_messages(struct connection *conn)
 		out->used = 0;
 
 		/* Second write might block if non-zero. */
-		if (out->hdr.msg.len && !conn->domain)
+		if (out->hdr.msg.len && !conn->domain && !conn->shmem)
 			return true;
 	}
 
@@ -247,6 +254,8 @@ static bool write_messages(struct connection *conn)
 
 	trace_io(conn, out, 1);
 
+	if (out->hdr.msg.type == XS_WATCH_EVENT)
+		conn->watch_events--;
 	list_del(&out->list);
 	talloc_free(out);
 
@@ -256,9 +265,10 @@ static bool write_messages(struct connection *conn)
 static int destroy_conn(void *_conn)
 {
 	struct connection *conn = _conn;
+	unsigned int i;
 
 	/* Flush outgoing if possible, but don't block. */
-	if (!conn->domain) {
+	if (!conn->domain && !conn->shmem) {
 		struct pollfd pfd;
 		pfd.fd = conn->fd;
 		pfd.events = POLLOUT;
@@ -267,8 +277,11 @@ static int destroy_conn(void *_conn)
 		       && poll(&pfd, 1, 0) == 1)
 			if (!write_messages(conn))
 				break;
-		close(conn->fd);
 	}
+	if (!conn->domain)
+		close(conn->fd);
+	for (i = 0; i < conn->nr_passed_fds; i++)
+		close(conn->passed_fds[i]);
         if (conn->target)
                 talloc_unlink(conn, conn->target);
 	list_del(&conn->list);
@@ -345,6 +358,15 @@ static void initialize_fds(int sock, int *p_sock_pollfd_idx,
 			    (domain_can_write(conn) &&
 			     !list_empty(&conn->out_list)))
 				*ptimeout = 0;
+		} else if (conn->shmem) {
+			/* The socket only tells us about the client leaving. */
+			conn->pollfd_idx = set_fd(conn->fd, POLLIN|POLLPRI);
+			conn->shmem_pollfd_idx = set_fd(shmem_kick_fd(conn),
+							POLLIN);
+			if (shmem_can_read(conn) ||
+			    (shmem_can_write(conn) &&
+			     !list_empty(&conn->out_list)))
+				*ptimeout = 0;
 		} else {
 			short events = POLLIN|POLLPRI;
 			if (!list_empty(&conn->out_list))
@@ -380,23 +402,19 @@ static struct node *read_node(struct connection *conn, const void *ctx,
 	if (transaction_prepend(conn, name, &key))
 		return NULL;
 
-	data = tdb_fetch(tdb_ctx, key);
+	data = store_fetch_at(node, key, transaction_snapshot(conn));
 
 	if (data.dptr == NULL) {
-		if (tdb_error(tdb_ctx) == TDB_ERR_NOEXIST) {
+		if (errno == ENOENT) {
 			node->generation = NO_GENERATION;
 			access_node(conn, node, NODE_ACCESS_READ, NULL);
 			errno = ENOENT;
-		} else {
-			log("TDB error on read: %s", tdb_errorstr(tdb_ctx));
-			errno = EIO;
 		}
 		talloc_free(node);
 		return NULL;
 	}
 
 	node->parent = NULL;
-	talloc_steal(node, data.dptr);
 
 	/* Datalen, childlen, number of permissions */
 	hdr = (void *)data.dptr;
@@ -433,6 +451,15 @@ int write_node_raw(struct connection *conn, TDB_DATA *key, struct node *node)
 		return errno;
 	}
 
+	/* Records a domain owns count against its memory quota. */
+	if (domain_is_unprivileged(conn) && node->num_perms &&
+	    node->perms[0].id == conn->id &&
+	    store_usage(conn->id) + data.dsize >
+	    store_record_size(*key) + quota_memory_per_domain) {
+		errno = ENOSPC;
+		return errno;
+	}
+
 	data.dptr = talloc_size(node, data.dsize);
 	hdr = (void *)data.dptr;
 	hdr->generation = node->generation;
@@ -446,8 +473,7 @@ int write_node_raw(struct connection *conn, TDB_DATA *key, struct node *node)
 	p += node->datalen;
 	memcpy(p, node->children, node->childlen);
 
-	/* TDB should set errno, but doesn't even set ecode AFAICT. */
-	if (tdb_store(tdb_ctx, *key, data, TDB_REPLACE) != 0) {
+	if (store_store(*key, data) != 0) {
 		corrupt(conn, "Write of %s failed", key->dptr);
 		errno = EIO;
 		return errno;
@@ -641,7 +667,7 @@ unsigned int get_strings(struct buffered_data *data,
 	return i;
 }
 
-static void send_error(struct connection *conn, int error)
+static const char *error_string(int error)
 {
 	unsigned int i;
 
@@ -652,8 +678,14 @@ static void send_error(struct connection *conn, int error)
 			break;
 		}
 	}
-	send_reply(conn, XS_ERROR, xsd_errors[i].errstring,
-			  strlen(xsd_errors[i].errstring) + 1);
+	return xsd_errors[i].errstring;
+}
+
+static void send_error(struct connection *conn, int error)
+{
+	const char *str = error_string(error);
+
+	send_reply(conn, XS_ERROR, str, strlen(str) + 1);
 }
 
 void send_reply(struct connection *conn, enum xsd_sockmsg_type type,
@@ -706,6 +738,8 @@ void send_reply(struct connection *conn, enum xsd_sockmsg_type type,
 
 	/* Queue for later transmission. */
 	list_add_tail(&bdata->list, &conn->out_list);
+	if (type == XS_WATCH_EVENT)
+		conn->watch_events++;
 
 	return;
 }
@@ -884,6 +918,124 @@ static int do_read(struct connection *conn, struct buffered_data *in)
 	return 0;
 }
 
+/* path+ */
+static int do_read_multiple(struct connection *conn, struct buffered_data *in)
+{
+	unsigned int off, len, used = 0, hdrlen;
+	struct node *node;
+	char *reply, *path;
+	const char *err;
+	char hdr[MAX_STRLEN(unsigned int) + 1];
+
+	if (in->used == 0 || in->buffer[in->used - 1])
+		return EINVAL;
+
+	reply = talloc_array(in, char, XENSTORE_PAYLOAD_MAX);
+	if (!reply)
+		return ENOMEM;
+
+	for (off = 0; off < in->used; off += strlen(path) + 1) {
+		path = in->buffer + off;
+		node = get_node_canonicalized(conn, in, path, NULL,
+					      XS_PERM_READ);
+		if (node) {
+			hdrlen = snprintf(hdr, sizeof(hdr), "%u",
+					  node->datalen) + 1;
+			len = node->datalen;
+		} else {
+			err = error_string(errno);
+			hdrlen = strlen(err) + 1;
+			memcpy(hdr, err, hdrlen);
+			len = 0;
+		}
+
+		if (used + hdrlen + len > XENSTORE_PAYLOAD_MAX)
+			return E2BIG;
+		memcpy(reply + used, hdr, hdrlen);
+		used += hdrlen;
+		if (len)
+			memcpy(reply + used, node->data, len);
+		used += len;
+	}
+
+	send_reply(conn, XS_READ_MULTIPLE, reply, used);
+
+	return 0;
+}
+
+/*
+ * Append the names of the descendants of node, each prefixed with prefix, to
+ * *list.  Subtrees which cannot be read are skipped.  Returns 0 or an errno.
+ */
+static int add_descendants(struct connection *conn, const void *ctx,
+			   struct node *node, const char *prefix,
+			   char *list, unsigned int *used)
+{
+	struct node *child;
+	char *name, *childname, *rel;
+	unsigned int off, len;
+	int ret;
+
+	for (off = 0; off < node->childlen; off += strlen(name) + 1) {
+		name = node->children + off;
+		rel = *prefix ? talloc_asprintf(ctx, "%s/%s", prefix, name)
+			      : talloc_strdup(ctx, name);
+		if (!rel)
+			return ENOMEM;
+
+		len = strlen(rel) + 1;
+		if (*used + len > XENSTORE_PAYLOAD_MAX)
+			return E2BIG;
+		memcpy(list + *used, rel, len);
+		*used += len;
+
+		childname = talloc_asprintf(ctx, "%s/%s",
+					    streq(node->name, "/") ? "" :
+					    node->name, name);
+		if (!childname)
+			return ENOMEM;
+		child = get_node(conn, ctx, childname, XS_PERM_READ);
+		if (!child) {
+			if (errno == ENOMEM)
+				return ENOMEM;
+			continue;
+		}
+
+		ret = add_descendants(conn, ctx, child, rel, list, used);
+		talloc_free(child);
+		talloc_free(childname);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int send_directory_recursive(struct connection *conn,
+				    struct buffered_data *in)
+{
+	struct node *node;
+	char *list;
+	unsigned int used = 0;
+	int ret;
+
+	node = get_node_canonicalized(conn, in, onearg(in), NULL, XS_PERM_READ);
+	if (!node)
+		return errno;
+
+	list = talloc_array(in, char, XENSTORE_PAYLOAD_MAX);
+	if (!list)
+		return ENOMEM;
+
+	ret = add_descendants(conn, in, node, "", list, &used);
+	if (ret)
+		return ret;
+
+	send_reply(conn, XS_DIRECTORY_RECURSIVE, list, used);
+
+	return 0;
+}
+
 static void delete_node_single(struct connection *conn, struct node *node)
 {
 	TDB_DATA key;
@@ -891,7 +1043,7 @@ static void delete_node_single(struct connection *conn, struct node *node)
 	if (access_node(conn, node, NODE_ACCESS_DELETE, &key))
 		return;
 
-	if (tdb_delete(tdb_ctx, key) != 0) {
+	if (store_delete(key) != 0) {
 		corrupt(conn, "Could not delete '%s'", node->name);
 		return;
 	}
@@ -979,7 +1131,7 @@ static int destroy_node(void *_node)
 	key.dptr = (void *)node->name;
 	key.dsize = strlen(node->name);
 
-	tdb_delete(tdb_ctx, key);
+	store_delete(key);
 	return 0;
 }
 
@@ -1012,43 +1164,114 @@ static struct node *create_node(struct connection *conn, const void *ctx,
 	return node;
 }
 
-/* path, data... */
-static int do_write(struct connection *conn, struct buffered_data *in)
+/* Set the value of path, creating it if needed.  Returns 0 or an errno. */
+static int write_node_data(struct connection *conn, void *ctx,
+			   const char *path, char *data, unsigned int datalen)
 {
-	unsigned int offset, datalen;
 	struct node *node;
-	char *vec[1] = { NULL }; /* gcc4 + -W + -Werror fucks code. */
 	char *name;
 
-	/* Extra "strings" can be created by binary data. */
-	if (get_strings(in, vec, ARRAY_SIZE(vec)) < ARRAY_SIZE(vec))
-		return EINVAL;
-
-	offset = strlen(vec[0]) + 1;
-	datalen = in->used - offset;
-
-	node = get_node_canonicalized(conn, in, vec[0], &name, XS_PERM_WRITE);
+	node = get_node_canonicalized(conn, ctx, path, &name, XS_PERM_WRITE);
 	if (!node) {
 		/* No permissions, invalid input? */
 		if (errno != ENOENT)
 			return errno;
-		node = create_node(conn, in, name, in->buffer + offset,
-				   datalen);
+		node = create_node(conn, ctx, name, data, datalen);
 		if (!node)
 			return errno;
 	} else {
-		node->data = in->buffer + offset;
+		node->data = data;
 		node->datalen = datalen;
 		if (write_node(conn, node))
 			return errno;
 	}
 
-	fire_watches(conn, in, name, false);
+	fire_watches(conn, ctx, name, false);
+
+	return 0;
+}
+
+/* path, data... */
+static int do_write(struct connection *conn, struct buffered_data *in)
+{
+	unsigned int offset;
+	char *vec[1] = { NULL }; /* gcc4 + -W + -Werror fucks code. */
+	int ret;
+
+	/* Extra "strings" can be created by binary data. */
+	if (get_strings(in, vec, ARRAY_SIZE(vec)) < ARRAY_SIZE(vec))
+		return EINVAL;
+
+	offset = strlen(vec[0]) + 1;
+	ret = write_node_data(conn, in, vec[0], in->buffer + offset,
+			      in->used - offset);
+	if (ret)
+		return ret;
+
 	send_ack(conn, XS_WRITE);
 
 	return 0;
 }
 
+/*
+ * Parse the write starting at *off: path, decimal length, data.  Returns
+ * false if it is malformed.
+ */
+static bool get_multiple_write(struct buffered_data *in, unsigned int *off,
+			       char **path, char **data, unsigned int *datalen)
+{
+	unsigned int len;
+	char *end;
+
+	len = get_string(in, *off);
+	if (len <= 1)
+		return false;
+	*path = in->buffer + *off;
+	*off += len;
+
+	len = get_string(in, *off);
+	if (len <= 1)
+		return false;
+	errno = 0;
+	*datalen = strtoul(in->buffer + *off, &end, 10);
+	if (errno || *end || !isdigit((unsigned char)in->buffer[*off]))
+		return false;
+	*off += len;
+
+	if (*datalen > in->used - *off)
+		return false;
+	*data = in->buffer + *off;
+	*off += *datalen;
+
+	return true;
+}
+
+/* (path, length, data)+ */
+static int do_write_multiple(struct connection *conn, struct buffered_data *in)
+{
+	unsigned int off, datalen;
+	char *path, *data;
+	int ret;
+
+	/* Check the whole request before doing any of it. */
+	if (in->used == 0)
+		return EINVAL;
+	for (off = 0; off < in->used; )
+		if (!get_multiple_write(in, &off, &path, &data, &datalen))
+			return EINVAL;
+
+	for (off = 0; off < in->used; ) {
+		get_multiple_write(in, &off, &path, &data, &datalen);
+		ret = write_node_data(conn, in, path, data, datalen);
+		if (ret)
+			return ret;
+	}
+
+	send_ack(conn, XS_WRITE_MULTIPLE);
+
+	return 0;
+}
+
 static int do_mkdir(struct connection *conn, struct buffered_data *in)
 {
 	struct node *node;
@@ -1290,6 +1513,10 @@ static struct {
 	[XS_SET_TARGET]        = { "SET_TARGET",        do_set_target },
 	[XS_RESET_WATCHES]     = { "RESET_WATCHES",     do_reset_watches },
 	[XS_DIRECTORY_PART]    = { "DIRECTORY_PART",    send_directory_part },
+	[XS_DIRECTORY_RECURSIVE] =
+			{ "DIRECTORY_RECURSIVE", send_directory_recursive },
+	[XS_READ_MULTIPLE]     = { "READ_MULTIPLE",     do_read_multiple },
+	[XS_WRITE_MULTIPLE]    = { "WRITE_MULTIPLE",    do_write_multiple },
 };
 
 static const char *sockmsg_string(enum xsd_sockmsg_type type)
@@ -1317,6 +1544,7 @@ static void process_message(struct connection *conn, struct buffered_data *in)
 
 	assert(conn->transaction == NULL);
 	conn->transaction = trans;
+	domain_request_inc(conn);
 
 	if ((unsigned)type < XS_TYPE_COUNT && wire_funcs[type].func)
 		ret = wire_funcs[type].func(conn, in);
@@ -1404,10 +1632,46 @@ bad_client:
 	talloc_free(conn);
 }
 
+/* Is there room in a ring connection for output?  Sockets always say yes. */
+static bool conn_can_write(struct connection *conn)
+{
+	if (conn->domain)
+		return domain_can_write(conn);
+	if (conn->shmem)
+		return shmem_can_write(conn);
+	return true;
+}
+
+/* Is there input in a ring connection?  Sockets always say no. */
+static bool conn_can_read(struct connection *conn)
+{
+	if (conn->domain)
+		return domain_can_read(conn);
+	if (conn->shmem)
+		return shmem_can_read(conn);
+	return false;
+}
+
 static void handle_output(struct connection *conn)
 {
-	if (!write_messages(conn))
-		talloc_free(conn);
+	struct buffered_data *out;
+
+	/*
+	 * Flush as much as the transport takes: a domain with many queued
+	 * replies or watch events shouldn't need a main loop round for each.
+	 */
+	while ((out = list_top(&conn->out_list, struct buffered_data, list))) {
+		if (!write_messages(conn)) {
+			talloc_free(conn);
+			return;
+		}
+		/* Message couldn't be written completely: try again later. */
+		if (out == list_top(&conn->out_list, struct buffered_data,
+				    list))
+			return;
+		if (!conn_can_write(conn))
+			return;
+	}
 }
 
 struct connection *new_connection(connwritefn_t *write, connreadfn_t *read)
@@ -1420,6 +1684,7 @@ struct connection *new_connection(connwritefn_t *write, connreadfn_t *read)
 
 	new->fd = -1;
 	new->pollfd_idx = -1;
+	new->shmem_pollfd_idx = -1;
 	new->write = write;
 	new->read = read;
 	new->can_write = true;
@@ -1455,11 +1720,60 @@ static int writefd(struct connection *conn, const void *data, unsigned int len)
 	return rc;
 }
 
+/* Keep file descriptors passed with a message for its handler. */
+static void got_passed_fds(struct connection *conn, struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	unsigned int i, n;
+	int *fds;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		/* Only the latest message's are of interest. */
+		for (i = 0; i < conn->nr_passed_fds; i++)
+			close(conn->passed_fds[i]);
+		conn->nr_passed_fds = 0;
+
+		fds = (int *)CMSG_DATA(cmsg);
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < n; i++) {
+			if (i < MAX_PASSED_FDS)
+				conn->passed_fds[conn->nr_passed_fds++] =
+					fds[i];
+			else
+				close(fds[i]);
+		}
+	}
+}
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
 static int readfd(struct connection *conn, void *data, unsigned int len)
 {
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+	} control;
+	struct iovec iov = { .iov_base = data, .iov_len = len };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
 	int rc;
 
-	while ((rc = read(conn->fd, data, len)) < 0) {
+	for (;;) {
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		rc = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC);
+		if (rc >= 0) {
+			got_passed_fds(conn, &msg);
+			break;
+		}
 		if (errno == EAGAIN) {
 			rc = 0;
 			break;
@@ -1497,6 +1811,9 @@ static void accept_connection(int sock, bool canwrite)
 
 static int tdb_flags;
 
+/* Input steps per domain connection and main loop round. */
+#define DOMAIN_INPUT_BATCH 8
+
 /* We create initial nodes manually. */
 static void manual_node(const char *name, const char *child)
 {
@@ -1543,17 +1860,34 @@ static void tdb_logger(TDB_CONTEXT *tdb, int level, const char * fmt, ...)
 static void setup_structure(void)
 {
 	char *tdbname;
-	tdbname = talloc_strdup(talloc_autofree_context(), xs_daemon_tdb());
-	if (!tdbname)
-		barf_perror("Could not create tdbname");
 
-	if (!(tdb_flags & TDB_INTERNAL))
+	/*
+	 * The nodes live in memory; the tdb file is only a write-through
+	 * copy for inspection with xs_tdb_dump, and is skipped entirely for
+	 * an internal database.
+	 */
+	if (!(tdb_flags & TDB_INTERNAL)) {
+		tdbname = talloc_strdup(talloc_autofree_context(),
+					xs_daemon_tdb());
+		if (!tdbname)
+			barf_perror("Could not create tdbname");
+
 		unlink(tdbname);
 
-	tdb_ctx = tdb_open_ex(tdbname, 7919, tdb_flags, O_RDWR|O_CREAT|O_EXCL,
-			      0640, &tdb_logger, NULL);
-	if (!tdb_ctx)
-		barf_perror("Could not create tdb file %s", tdbname);
+		tdb_ctx = tdb_open_ex(tdbname, 7919, tdb_flags,
+				      O_RDWR|O_CREAT|O_EXCL, 0640,
+				      &tdb_logger, NULL);
+		if (!tdb_ctx)
+			barf_perror("Could not create tdb file %s", tdbname);
+	}
+
+	store_init(tdb_ctx);
+
+	if (journal && journal_init(xs_daemon_rootdir())) {
+		/* Carry on where the previous instance left off. */
+		check_store();
+		return;
+	}
 
 	manual_node("/", "tool");
 	manual_node("/tool", "xenstored");
@@ -1709,8 +2043,7 @@ static int check_store_(const char *name, struct hashtable *reachable)
 /**
  * Helper to clean_store below.
  */
-static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
-			void *private)
+static int clean_store_(TDB_DATA key, TDB_DATA val, void *private)
 {
 	struct hashtable *reachable = private;
 	char *slash;
@@ -1729,7 +2062,7 @@ static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
 	if (!hashtable_search(reachable, name)) {
 		log("clean_store: '%s' is orphaned!", name);
 		if (recovery) {
-			tdb_delete(tdb, key);
+			store_delete(key);
 		}
 	}
 
@@ -1745,7 +2078,7 @@ static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
  */
 static void clean_store(struct hashtable *reachable)
 {
-	tdb_traverse(tdb_ctx, &clean_store_, reachable);
+	store_traverse(&clean_store_, reachable);
 }
 
 
@@ -1875,10 +2208,14 @@ static void usage(void)
 "  -E, --entry-nb <nb>     limit the number of entries per domain,\n"
 "  -S, --entry-size <size> limit the size of entry per domain, and\n"
 "  -W, --watch-nb <nb>     limit the number of watches per domain,\n"
+"  -Q, --watch-events <nb> limit the number of queued watch events per domain,\n"
 "  -t, --transaction <nb>  limit the number of transaction allowed per domain,\n"
+"  -M, --memory <size>     limit the bytes of store a domain may own,\n"
 "  -R, --no-recovery       to request that no recovery should be attempted when\n"
 "                          the store is corrupted (debug only),\n"
-"  -I, --internal-db       store database in memory, not on disk\n"
+"  -I, --internal-db       don't mirror the database to a file on disk\n"
+"  -J, --journal           keep the store in an append-only journal on disk and\n"
+"                          restore it from there on startup,\n"
 "  -V, --verbose           to request verbose execution.\n");
 }
 
@@ -1896,10 +2233,13 @@ static struct option options[] = {
 	{ "entry-size", 1, NULL, 'S' },
 	{ "trace-file", 1, NULL, 'T' },
 	{ "transaction", 1, NULL, 't' },
+	{ "memory", 1, NULL, 'M' },
 	{ "no-recovery", 0, NULL, 'R' },
 	{ "internal-db", 0, NULL, 'I' },
+	{ "journal", 0, NULL, 'J' },
 	{ "verbose", 0, NULL, 'V' },
 	{ "watch-nb", 1, NULL, 'W' },
+	{ "watch-events", 1, NULL, 'Q' },
 	{ NULL, 0, NULL, 0 } };
 
 extern void dump_conn(struct connection *conn); 
@@ -1918,7 +2258,7 @@ int main(int argc, char *argv[])
 	int timeout;
 
 
-	while ((opt = getopt_long(argc, argv, "DE:F:HNPS:t:T:RVW:", options,
+	while ((opt = getopt_long(argc, argv, "DE:F:HJM:NPQ:S:t:T:RVW:", options,
 				  NULL)) != -1) {
 		switch (opt) {
 		case 'D':
@@ -1948,18 +2288,27 @@ int main(int argc, char *argv[])
 		case 't':
 			quota_max_transaction = strtol(optarg, NULL, 10);
 			break;
+		case 'M':
+			quota_memory_per_domain = strtoul(optarg, NULL, 10);
+			break;
 		case 'T':
 			tracefile = optarg;
 			break;
 		case 'I':
 			tdb_flags = TDB_INTERNAL|TDB_NOLOCK;
 			break;
+		case 'J':
+			journal = true;
+			break;
 		case 'V':
 			verbose = true;
 			break;
 		case 'W':
 			quota_nb_watch_per_domain = strtol(optarg, NULL, 10);
 			break;
+		case 'Q':
+			quota_nb_watch_events = strtol(optarg, NULL, 10);
+			break;
 		case 'e':
 			dom0_event = strtol(optarg, NULL, 10);
 			break;
@@ -2103,18 +2452,54 @@ int main(int argc, char *argv[])
 			if (&next->list != &connections)
 				talloc_increase_ref_count(next);
 
-			if (conn->domain) {
-				if (domain_can_read(conn))
-					handle_input(conn);
+			if (conn->shmem) {
+				/* Anything on the socket means the client left. */
+				if (conn->pollfd_idx != -1 &&
+				    fds[conn->pollfd_idx].revents)
+					talloc_free(conn);
+				else if (conn->shmem_pollfd_idx != -1 &&
+					 fds[conn->shmem_pollfd_idx].revents)
+					shmem_kicked(conn);
 				if (talloc_free(conn) == 0)
 					continue;
 
 				talloc_increase_ref_count(conn);
-				if (domain_can_write(conn) &&
+				conn->pollfd_idx = -1;
+				conn->shmem_pollfd_idx = -1;
+			}
+
+			if (conn->domain || conn->shmem) {
+				unsigned int steps = 0;
+				bool gone = false;
+
+				/*
+				 * Process a bounded batch from each ring per
+				 * round: this saves poll() calls under load,
+				 * while no domain can starve the others.
+				 */
+				while (conn_can_read(conn)) {
+					handle_input(conn);
+					if (talloc_free(conn) == 0) {
+						gone = true;
+						break;
+					}
+					talloc_increase_ref_count(conn);
+					if (++steps == DOMAIN_INPUT_BATCH)
+						break;
+				}
+				if (gone || talloc_free(conn) == 0)
+					continue;
+
+				talloc_increase_ref_count(conn);
+				if (conn_can_write(conn) &&
 				    !list_empty(&conn->out_list))
 					handle_output(conn);
 				if (talloc_free(conn) == 0)
 					continue;
+
+				/* One wakeup for all of this round's work. */
+				if (conn->shmem)
+					shmem_notify(conn);
 			} else {
 				if (conn->pollfd_idx != -1) {
 					if (fds[conn->pollfd_idx].revents
@@ -2144,6 +2529,8 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		journal_maintain();
+
 		initialize_fds(*sock, &sock_pollfd_idx, *ro_sock,
 			       &ro_sock_pollfd_idx, &timeout);
 	}
@@ -39,6 +39,9 @@
 
 #define MIN(a, b) (((a) < (b))? (a) : (b))
 
+/* Most file descriptors a socket client can pass with a message. */
+#define MAX_PASSED_FDS 4
+
 typedef int32_t wrl_creditt;
 #define WRL_CREDIT_MAX (1000*1000*1000)
 /* ^ satisfies non-overflow condition for wrl_xfer_credit */
@@ -64,6 +67,7 @@ struct buffered_data
 };
 
 struct connection;
+struct shmem_conn;
 typedef int connwritefn_t(struct connection *, const void *, unsigned int);
 typedef int connreadfn_t(struct connection *, void *, unsigned int);
 
@@ -105,9 +109,21 @@ struct connection
 	/* My watches. */
 	struct list_head watches;
 
+	/* Watch events queued in out_list, and those dropped for quota. */
+	unsigned int watch_events;
+	unsigned long watch_events_dropped;
+
 	/* Methods for communicating over this connection: write can be NULL */
 	connwritefn_t *write;
 	connreadfn_t *read;
+
+	/* File descriptors a socket client passed along with its last message. */
+	int passed_fds[MAX_PASSED_FDS];
+	unsigned int nr_passed_fds;
+
+	/* Shared memory ring replacing the socket, if the client asked for it. */
+	struct shmem_conn *shmem;
+	int shmem_pollfd_idx;
 };
 extern struct list_head connections;
 
@@ -150,7 +166,7 @@ void send_ack(struct connection *conn, enum xsd_sockmsg_type type);
 /* Canonicalize this path if possible. */
 char *canonicalize(struct connection *conn, const void *ctx, const char *node);
 
-/* Write a node to the tdb data base. */
+/* Write a node to the data base. */
 int write_node_raw(struct connection *conn, TDB_DATA *key, struct node *node);
 
 /* Get this node, checking we have permissions. */
@@ -177,7 +193,6 @@ void close_log(void);
 extern char *tracefile;
 extern int tracefd;
 
-extern TDB_CONTEXT *tdb_ctx;
 extern int dom0_domid;
 extern int dom0_event;
 extern int priv_domid;
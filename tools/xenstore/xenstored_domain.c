@@ -28,6 +28,7 @@
 #include "talloc.h"
 #include "xenstored_core.h"
 #include "xenstored_domain.h"
+#include "xenstored_store.h"
 #include "xenstored_transaction.h"
 #include "xenstored_watch.h"
 
@@ -77,6 +78,10 @@ struct domain
 	/* number of watch for this domain */
 	int nbwatch;
 
+	/* number of requests from this domain, and at the last report */
+	unsigned long nbrequest;
+	unsigned long nbrequest_reported;
+
 	/* write rate limit */
 	wrl_creditt wrl_credit; /* [ -wrl_config_writecost, +_dburst ] */
 	struct wrl_timestampt wrl_timestamp;
@@ -110,12 +115,11 @@ static const void *get_input_chunk(XENSTORE_RING_IDX cons,
 	return buf + MASK_XENSTORE_IDX(cons);
 }
 
-static int writechn(struct connection *conn,
-		    const void *data, unsigned int len)
+int ring_write(struct xenstore_domain_interface *intf,
+	       const void *data, unsigned int len)
 {
 	uint32_t avail;
 	void *dest;
-	struct xenstore_domain_interface *intf = conn->domain->interface;
 	XENSTORE_RING_IDX cons, prod;
 
 	/* Must read indexes once, and before anything else, and verified. */
@@ -136,16 +140,25 @@ static int writechn(struct connection *conn,
 	xen_mb();
 	intf->rsp_prod += len;
 
-	xenevtchn_notify(xce_handle, conn->domain->port);
-
 	return len;
 }
 
-static int readchn(struct connection *conn, void *data, unsigned int len)
+static int writechn(struct connection *conn,
+		    const void *data, unsigned int len)
+{
+	int ret = ring_write(conn->domain->interface, data, len);
+
+	if (ret >= 0)
+		xenevtchn_notify(xce_handle, conn->domain->port);
+
+	return ret;
+}
+
+int ring_read(struct xenstore_domain_interface *intf,
+	      void *data, unsigned int len)
 {
 	uint32_t avail;
 	const void *src;
-	struct xenstore_domain_interface *intf = conn->domain->interface;
 	XENSTORE_RING_IDX cons, prod;
 
 	/* Must read indexes once, and before anything else, and verified. */
@@ -166,11 +179,19 @@ static int readchn(struct connection *conn, void *data, unsigned int len)
 	xen_mb();
 	intf->req_cons += len;
 
-	xenevtchn_notify(xce_handle, conn->domain->port);
-
 	return len;
 }
 
+static int readchn(struct connection *conn, void *data, unsigned int len)
+{
+	int ret = ring_read(conn->domain->interface, data, len);
+
+	if (ret >= 0)
+		xenevtchn_notify(xce_handle, conn->domain->port);
+
+	return ret;
+}
+
 static void *map_interface(domid_t domid, unsigned long mfn)
 {
 	if (*xgt_handle != NULL) {
@@ -361,6 +382,7 @@ static void domain_conn_reset(struct domain *domain)
 		list_del(&out->list);
 		talloc_free(out);
 	}
+	conn->watch_events = 0;
 
 	talloc_free(conn->in);
 
@@ -758,6 +780,49 @@ int domain_watch(struct connection *conn)
 		: 0;
 }
 
+/* Requests from connections without a domain (local sockets). */
+static unsigned long local_nbrequest, local_nbrequest_reported;
+static time_t last_report;
+
+void domain_request_inc(struct connection *conn)
+{
+	if (conn->domain)
+		conn->domain->nbrequest++;
+	else
+		local_nbrequest++;
+}
+
+char *domain_memory_report(char *resp)
+{
+	struct domain *domain;
+	time_t now = time(NULL);
+	time_t secs = last_report ? now - last_report : 0;
+
+	if (!secs)
+		secs = 1;
+
+	list_for_each_entry(domain, &domains, list) {
+		if (!resp)
+			return NULL;
+		resp = talloc_asprintf_append(resp,
+			"domain %u: %d entries, %zu bytes, %d watches, "
+			"%lu requests (%lu/s)\n",
+			domain->domid, domain->nbentry,
+			store_usage(domain->domid), domain->nbwatch,
+			domain->nbrequest,
+			(domain->nbrequest - domain->nbrequest_reported) / secs);
+		domain->nbrequest_reported = domain->nbrequest;
+	}
+	if (resp)
+		resp = talloc_asprintf_append(resp,
+			"local: %lu requests (%lu/s)\n", local_nbrequest,
+			(local_nbrequest - local_nbrequest_reported) / secs);
+	local_nbrequest_reported = local_nbrequest;
+	last_report = now;
+
+	return resp;
+}
+
 static wrl_creditt wrl_config_writecost      = WRL_FACTOR;
 static wrl_creditt wrl_config_rate           = WRL_RATE   * WRL_FACTOR;
 static wrl_creditt wrl_config_dburst         = WRL_DBURST * WRL_FACTOR;
@@ -56,6 +56,16 @@ bool domain_can_write(struct connection *conn);
 
 bool domain_is_unprivileged(struct connection *conn);
 
+/*
+ * Copy to the response ring / from the request ring of a xenstore ring page.
+ * Returns the number of bytes copied, or -1 with errno set if the indexes
+ * are corrupt.
+ */
+int ring_write(struct xenstore_domain_interface *intf,
+	       const void *data, unsigned int len);
+int ring_read(struct xenstore_domain_interface *intf,
+	      void *data, unsigned int len);
+
 /* Quota manipulation */
 void domain_entry_inc(struct connection *conn, struct node *);
 void domain_entry_dec(struct connection *conn, struct node *);
@@ -64,6 +74,13 @@ int domain_entry(struct connection *conn);
 void domain_watch_inc(struct connection *conn);
 void domain_watch_dec(struct connection *conn);
 int domain_watch(struct connection *conn);
+void domain_request_inc(struct connection *conn);
+
+/*
+ * Append per domain entries, store bytes, watches and requests (with the
+ * rate since the last report) to resp.  Returns NULL if out of memory.
+ */
+char *domain_memory_report(char *resp);
 
 /* Write rate limiting */
 
@@ -0,0 +1,354 @@
+/*
+    Append-only persistence of the node store for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The journal is a snapshot of the global tree plus a log of the
+ * modifications made since, both in the same format: a header followed by
+ * records, each a struct journal_rec followed by the key and the record as
+ * the store keeps it.  A modification costs one append to the log.  Once
+ * the log has grown larger than twice the snapshot, a new snapshot is
+ * written next to the old one, renamed over it, and the log is emptied.
+ *
+ * Replaying the log on top of the snapshot gives the state the previous
+ * instance left, and since every log record sets or removes one key
+ * entirely, replaying a log whose records the snapshot already contains
+ * (a crash between the rename and emptying the log) is harmless.  A record
+ * cut short by a crash fails its checksum and ends the replay.
+ *
+ * The log isn't synced: like the TDB file it replaces, it is meant to
+ * survive the daemon going away, not the host.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "talloc.h"
+#include "utils.h"
+#include "xenstored_core.h"
+#include "xenstored_journal.h"
+#include "xenstored_store.h"
+
+#define JOURNAL_MAGIC		0x4c4a5358	/* "XSJL" */
+#define JOURNAL_VERSION		1
+/* Don't bother compacting logs smaller than this. */
+#define JOURNAL_COMPACT_MIN	(1u << 20)
+
+enum {
+	JOURNAL_STORE = 1,
+	JOURNAL_DELETE = 2,
+};
+
+struct journal_hdr {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct journal_rec {
+	uint32_t op;
+	uint32_t keylen;
+	uint32_t datalen;
+	uint32_t csum;		/* Of the fields above, the key and the data. */
+};
+
+static int log_fd = -1;
+static char *snap_name, *tmp_name, *log_name;
+static size_t log_bytes, snap_bytes;
+/* Log size at which to compact next. */
+static size_t compact_at;
+/* Set while loading the store from the journal. */
+static bool loading;
+
+static uint32_t fnv1a(uint32_t hash, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+
+	while (len--)
+		hash = (hash ^ *p++) * 16777619u;
+
+	return hash;
+}
+
+static uint32_t journal_csum(const struct journal_rec *rec, TDB_DATA key,
+			     TDB_DATA data)
+{
+	uint32_t hash = 2166136261u;
+
+	hash = fnv1a(hash, rec, offsetof(struct journal_rec, csum));
+	hash = fnv1a(hash, key.dptr, key.dsize);
+	return fnv1a(hash, data.dptr, data.dsize);
+}
+
+static void journal_rec_init(struct journal_rec *rec, uint32_t op,
+			     TDB_DATA key, TDB_DATA data)
+{
+	rec->op = op;
+	rec->keylen = key.dsize;
+	rec->datalen = data.dsize;
+	rec->csum = journal_csum(rec, key, data);
+}
+
+static int journal_append(uint32_t op, TDB_DATA key, TDB_DATA data)
+{
+	struct journal_rec rec;
+	struct iovec iov[3];
+	ssize_t len, ret;
+
+	if (log_fd < 0 || loading)
+		return 0;
+
+	journal_rec_init(&rec, op, key, data);
+	iov[0].iov_base = &rec;
+	iov[0].iov_len = sizeof(rec);
+	iov[1].iov_base = key.dptr;
+	iov[1].iov_len = key.dsize;
+	iov[2].iov_base = data.dptr;
+	iov[2].iov_len = data.dsize;
+	len = sizeof(rec) + key.dsize + data.dsize;
+
+	ret = writev(log_fd, iov, data.dsize ? 3 : 2);
+	if (ret != len) {
+		/* Don't leave half a record for the next one to follow. */
+		if (ret > 0 && ftruncate(log_fd, log_bytes))
+			syslog(LOG_ERR, "Could not truncate %s: %m", log_name);
+		errno = EIO;
+		return -1;
+	}
+	log_bytes += len;
+
+	return 0;
+}
+
+int journal_store(TDB_DATA key, TDB_DATA data)
+{
+	return journal_append(JOURNAL_STORE, key, data);
+}
+
+int journal_delete(TDB_DATA key)
+{
+	TDB_DATA none = { NULL, 0 };
+
+	return journal_append(JOURNAL_DELETE, key, none);
+}
+
+/* Apply the records in buf to the store, returning how many bytes held valid
+ * records (0 if the header is bad). */
+static size_t journal_apply(const char *buf, size_t size)
+{
+	const struct journal_hdr *hdr = (const void *)buf;
+	struct journal_rec rec;
+	TDB_DATA key, data;
+	size_t off, left;
+
+	if (size < sizeof(*hdr) || hdr->magic != JOURNAL_MAGIC ||
+	    hdr->version != JOURNAL_VERSION)
+		return 0;
+
+	for (off = sizeof(*hdr); size - off >= sizeof(rec); ) {
+		memcpy(&rec, buf + off, sizeof(rec));
+		left = size - off - sizeof(rec);
+		if (!rec.keylen || rec.keylen > left ||
+		    rec.datalen > left - rec.keylen)
+			break;
+
+		key.dptr = (char *)buf + off + sizeof(rec);
+		key.dsize = rec.keylen;
+		data.dptr = key.dptr + key.dsize;
+		data.dsize = rec.datalen;
+		if (rec.csum != journal_csum(&rec, key, data) ||
+		    key.dptr[0] != '/')
+			break;
+
+		if (rec.op == JOURNAL_STORE) {
+			if (store_store(key, data))
+				barf_perror("Could not restore %.*s",
+					    (int)key.dsize, key.dptr);
+		} else if (rec.op == JOURNAL_DELETE) {
+			/* It may never have made it into the snapshot. */
+			store_delete(key);
+		} else
+			break;
+
+		off += sizeof(rec) + rec.keylen + rec.datalen;
+	}
+
+	return off;
+}
+
+/* Load the store from a journal file.  Returns false if there is none. */
+static bool journal_load(const char *name)
+{
+	struct stat st;
+	void *buf;
+	size_t used;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return false;
+	}
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		syslog(LOG_ERR, "Could not map %s: %m", name);
+		return false;
+	}
+
+	used = journal_apply(buf, st.st_size);
+	if (used < st.st_size)
+		syslog(LOG_WARNING, "Ignoring %zu bytes at the end of %s",
+		       (size_t)st.st_size - used, name);
+
+	munmap(buf, st.st_size);
+
+	return used > 0;
+}
+
+struct snap_write {
+	FILE *f;
+	size_t bytes;
+	bool failed;
+};
+
+static int write_snap_rec(TDB_DATA key, TDB_DATA data, void *private)
+{
+	struct snap_write *w = private;
+	struct journal_rec rec;
+
+	/* Transactions don't outlive the daemon. */
+	if (!key.dsize || key.dptr[0] != '/')
+		return 0;
+
+	journal_rec_init(&rec, JOURNAL_STORE, key, data);
+	if (fwrite(&rec, sizeof(rec), 1, w->f) != 1 ||
+	    fwrite(key.dptr, key.dsize, 1, w->f) != 1 ||
+	    (data.dsize && fwrite(data.dptr, data.dsize, 1, w->f) != 1)) {
+		w->failed = true;
+		return 1;
+	}
+	w->bytes += sizeof(rec) + key.dsize + data.dsize;
+
+	return 0;
+}
+
+/* Write a snapshot of the global tree and start a new, empty log. */
+static int journal_compact(void)
+{
+	struct journal_hdr hdr = {
+		.magic = JOURNAL_MAGIC,
+		.version = JOURNAL_VERSION,
+	};
+	struct snap_write w = { .bytes = sizeof(hdr) };
+
+	w.f = fopen(tmp_name, "w");
+	if (!w.f)
+		return -1;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, w.f) != 1)
+		w.failed = true;
+	else
+		store_traverse(write_snap_rec, &w);
+	if (fflush(w.f) || fsync(fileno(w.f)))
+		w.failed = true;
+	if (fclose(w.f))
+		w.failed = true;
+	if (w.failed || rename(tmp_name, snap_name)) {
+		unlink(tmp_name);
+		return -1;
+	}
+	snap_bytes = w.bytes;
+
+	/* The snapshot has everything the log had. */
+	if (ftruncate(log_fd, 0) ||
+	    write(log_fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		return -1;
+	log_bytes = sizeof(hdr);
+
+	return 0;
+}
+
+void journal_maintain(void)
+{
+	if (log_fd < 0 || log_bytes < compact_at)
+		return;
+
+	if (journal_compact()) {
+		syslog(LOG_ERR, "Could not compact the journal: %m");
+		/* Try again once it has grown some more. */
+		compact_at = log_bytes * 2;
+		return;
+	}
+	compact_at = snap_bytes * 2;
+	if (compact_at < JOURNAL_COMPACT_MIN)
+		compact_at = JOURNAL_COMPACT_MIN;
+}
+
+bool journal_init(const char *dir)
+{
+	bool loaded;
+
+	snap_name = talloc_asprintf(NULL, "%s/store.snapshot", dir);
+	tmp_name = talloc_asprintf(NULL, "%s/store.snapshot.tmp", dir);
+	log_name = talloc_asprintf(NULL, "%s/store.log", dir);
+	if (!snap_name || !tmp_name || !log_name)
+		barf_perror("Could not allocate journal file names");
+
+	loading = true;
+	loaded = journal_load(snap_name);
+	if (journal_load(log_name))
+		loaded = true;
+	loading = false;
+
+	log_fd = open(log_name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+		      0640);
+	if (log_fd < 0)
+		barf_perror("Could not open %s", log_name);
+
+	/* Start from a snapshot of what was loaded and an empty log. */
+	compact_at = 0;
+	journal_maintain();
+	if (log_bytes != sizeof(struct journal_hdr))
+		barf_perror("Could not write %s", snap_name);
+
+	if (loaded)
+		syslog(LOG_INFO, "Restored the store from %s", dir);
+
+	return loaded;
+}
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
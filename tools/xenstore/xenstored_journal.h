@@ -0,0 +1,42 @@
+/*
+    Append-only persistence of the node store for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _XENSTORED_JOURNAL_H
+#define _XENSTORED_JOURNAL_H
+
+#include <stdbool.h>
+
+#include "tdb.h"
+
+/*
+ * Start journaling the global tree to files in dir.  If a previous instance
+ * left a journal there, the store is loaded from it first.  Must be called
+ * after store_init().  Returns true if the store was loaded.
+ */
+bool journal_init(const char *dir);
+
+/*
+ * Append a modification of the global tree to the journal.  Nothing is done
+ * unless journaling was started.  Return 0 or -1 with errno set.
+ */
+int journal_store(TDB_DATA key, TDB_DATA data);
+int journal_delete(TDB_DATA key);
+
+/* Compact the journal if its log has grown too large.  Call when idle. */
+void journal_maintain(void);
+
+#endif /* _XENSTORED_JOURNAL_H */
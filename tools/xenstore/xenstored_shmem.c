@@ -0,0 +1,215 @@
+/*
+    Shared memory rings for local clients of Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * A local client (libxl, qemu, ...) can ask to move its traffic off its
+ * socket onto a page it shares with us, laid out like a domain's ring page.
+ * It passes the page as a sealed memfd and three eventfds with a "shmem"
+ * control request on the socket; the reply and everything after it go over
+ * the ring.  The socket stays open so we notice the client going away.
+ *
+ * Notifications are batched: the client is told about new responses once
+ * per main loop round, however many messages were written.  A side only
+ * stalls when a ring is completely full, so free space is announced only
+ * after a full ring was seen.
+ */
+
+#define _GNU_SOURCE /* For memfd seals. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "talloc.h"
+#include "xenstored_core.h"
+#include "xenstored_domain.h"
+#include "xenstored_shmem.h"
+
+enum {
+	SHMEM_FD_PAGE,	/* The ring page. */
+	SHMEM_FD_KICK,	/* Client -> us: requests written, responses read. */
+	SHMEM_FD_RSP,	/* Us -> client: responses written. */
+	SHMEM_FD_SPACE,	/* Us -> client: request space freed. */
+};
+
+struct shmem_conn {
+	struct xenstore_domain_interface *intf;
+	int fds[SHMEM_NR_FDS];
+	/* rsp_prod when the client was last told about responses. */
+	XENSTORE_RING_IDX notified_prod;
+	/* Did we read from a full request ring since the client was told? */
+	bool space_freed;
+};
+
+static void eventfd_signal(int fd)
+{
+	uint64_t one = 1;
+
+	/* Can only fail if the client misbehaves, which hurts only it. */
+	if (write(fd, &one, sizeof(one)) < 0)
+		return;
+}
+
+static int shmem_write(struct connection *conn, const void *data,
+		       unsigned int len)
+{
+	return ring_write(conn->shmem->intf, data, len);
+}
+
+static int shmem_read(struct connection *conn, void *data, unsigned int len)
+{
+	struct shmem_conn *shm = conn->shmem;
+	struct xenstore_domain_interface *intf = shm->intf;
+	bool full = intf->req_prod - intf->req_cons == XENSTORE_RING_SIZE;
+	int ret;
+
+	ret = ring_read(intf, data, len);
+	if (ret > 0 && full)
+		shm->space_freed = true;
+
+	return ret;
+}
+
+static int destroy_shmem(void *_shm)
+{
+	struct shmem_conn *shm = _shm;
+	unsigned int i;
+
+	munmap(shm->intf, sizeof(*shm->intf));
+	for (i = 0; i < SHMEM_NR_FDS; i++)
+		close(shm->fds[i]);
+
+	return 0;
+}
+
+int shmem_connect(struct connection *conn)
+{
+#ifdef F_GET_SEALS
+	struct shmem_conn *shm;
+	struct stat st;
+	unsigned int i;
+	int seals, flags;
+	void *intf;
+
+	if (conn->fd < 0 || conn->domain || conn->shmem ||
+	    conn->nr_passed_fds != SHMEM_NR_FDS)
+		return EINVAL;
+
+	/*
+	 * The page must not shrink under us, or touching it would kill us
+	 * with SIGBUS.
+	 */
+	if (fstat(conn->passed_fds[SHMEM_FD_PAGE], &st) ||
+	    !S_ISREG(st.st_mode) || st.st_size < sizeof(*shm->intf))
+		return EINVAL;
+	seals = fcntl(conn->passed_fds[SHMEM_FD_PAGE], F_GET_SEALS);
+	if (seals < 0 || !(seals & F_SEAL_SHRINK))
+		return EINVAL;
+
+	/* We must never block on the client's eventfds. */
+	for (i = SHMEM_FD_KICK; i < SHMEM_NR_FDS; i++) {
+		flags = fcntl(conn->passed_fds[i], F_GETFL);
+		if (flags < 0 ||
+		    fcntl(conn->passed_fds[i], F_SETFL, flags | O_NONBLOCK))
+			return EINVAL;
+	}
+
+	intf = mmap(NULL, sizeof(*shm->intf), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, conn->passed_fds[SHMEM_FD_PAGE], 0);
+	if (intf == MAP_FAILED)
+		return errno;
+
+	shm = talloc_zero(conn, struct shmem_conn);
+	if (!shm) {
+		munmap(intf, sizeof(*shm->intf));
+		return ENOMEM;
+	}
+	shm->intf = intf;
+	for (i = 0; i < SHMEM_NR_FDS; i++)
+		shm->fds[i] = conn->passed_fds[i];
+	conn->nr_passed_fds = 0;
+	shm->notified_prod = shm->intf->rsp_prod;
+	talloc_set_destructor(shm, destroy_shmem);
+
+	conn->shmem = shm;
+	conn->write = shmem_write;
+	conn->read = shmem_read;
+
+	return 0;
+#else
+	return ENOSYS;
+#endif
+}
+
+int shmem_kick_fd(struct connection *conn)
+{
+	return conn->shmem->fds[SHMEM_FD_KICK];
+}
+
+void shmem_kicked(struct connection *conn)
+{
+	uint64_t count;
+
+	if (read(conn->shmem->fds[SHMEM_FD_KICK], &count, sizeof(count)) < 0)
+		return;
+}
+
+bool shmem_can_read(struct connection *conn)
+{
+	struct xenstore_domain_interface *intf = conn->shmem->intf;
+
+	return intf->req_cons != intf->req_prod;
+}
+
+bool shmem_can_write(struct connection *conn)
+{
+	struct xenstore_domain_interface *intf = conn->shmem->intf;
+
+	return intf->rsp_prod - intf->rsp_cons != XENSTORE_RING_SIZE;
+}
+
+void shmem_notify(struct connection *conn)
+{
+	struct shmem_conn *shm = conn->shmem;
+
+	if (shm->intf->rsp_prod != shm->notified_prod) {
+		shm->notified_prod = shm->intf->rsp_prod;
+		eventfd_signal(shm->fds[SHMEM_FD_RSP]);
+	}
+
+	if (shm->space_freed) {
+		shm->space_freed = false;
+		eventfd_signal(shm->fds[SHMEM_FD_SPACE]);
+	}
+}
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
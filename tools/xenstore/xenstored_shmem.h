@@ -0,0 +1,54 @@
+/*
+    Shared memory rings for local clients of Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _XENSTORED_SHMEM_H
+#define _XENSTORED_SHMEM_H
+
+#include <stdbool.h>
+
+struct connection;
+
+/*
+ * File descriptors a socket client passes with its "shmem" control request:
+ * the ring page (a sealed memfd), then eventfds for kicking us, for telling
+ * it about responses and for telling it about free request space.
+ */
+#define SHMEM_NR_FDS 4
+
+/*
+ * Move a socket connection over to the ring it passed.  Afterwards the
+ * socket is only watched for the client going away.  Returns 0 or an errno.
+ */
+int shmem_connect(struct connection *conn);
+
+/* The eventfd to poll() for the client kicking us. */
+int shmem_kick_fd(struct connection *conn);
+
+/* Consume a kick. */
+void shmem_kicked(struct connection *conn);
+
+/* Can the connection read a request / write a response? */
+bool shmem_can_read(struct connection *conn);
+bool shmem_can_write(struct connection *conn);
+
+/*
+ * Tell the client about responses and free request space since the last
+ * call, once for however many messages were handled.
+ */
+void shmem_notify(struct connection *conn);
+
+#endif /* _XENSTORED_SHMEM_H */
@@ -0,0 +1,239 @@
+/*
+    Object caches for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The store holds many small, long lived objects: an entry, a name and a
+ * record for every node.  Allocating them one by one from malloc() costs a
+ * header each and scatters them over the heap, so once domains come and
+ * go the heap is too fragmented for memory to ever go back.
+ *
+ * Objects of one size are carved from slabs instead: aligned blocks of
+ * SLAB_SIZE bytes, so an object's slab is found by masking its address.
+ * A slab is handed back as soon as its last object is freed (one empty
+ * slab per cache is kept to avoid thrashing), so memory of destroyed
+ * domains really is returned.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "talloc.h"
+#include "utils.h"
+#include "xenstored_slab.h"
+
+#define SLAB_SIZE	16384
+#define SLAB_ALIGN	8
+
+#define SLAB_ROUNDUP(x)	(((x) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+
+struct slab {
+	struct list_head list;		/* In cache->partial or cache->full. */
+	void *free;			/* Free objects, linked through them. */
+	unsigned int inuse;
+};
+
+#define SLAB_HDR	SLAB_ROUNDUP(sizeof(struct slab))
+
+static LIST_HEAD(caches);
+
+/* Sizes for slab_alloc_bytes(): larger blocks come from malloc(). */
+static const size_t byte_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512
+};
+static struct slab_cache byte_caches[ARRAY_SIZE(byte_sizes)];
+static const char *byte_names[ARRAY_SIZE(byte_sizes)] = {
+	"bytes-16", "bytes-32", "bytes-48", "bytes-64", "bytes-96",
+	"bytes-128", "bytes-192", "bytes-256", "bytes-384", "bytes-512"
+};
+static unsigned long big_blocks, big_bytes;
+
+void slab_cache_init(struct slab_cache *cache, const char *name, size_t size)
+{
+	cache->name = name;
+	cache->size = SLAB_ROUNDUP(size ? size : 1);
+	cache->per_slab = (SLAB_SIZE - SLAB_HDR) / cache->size;
+	INIT_LIST_HEAD(&cache->partial);
+	INIT_LIST_HEAD(&cache->full);
+	cache->spare = NULL;
+	cache->objects = 0;
+	cache->slabs = 0;
+	list_add_tail(&cache->list, &caches);
+}
+
+static struct slab *slab_new(struct slab_cache *cache)
+{
+	struct slab *slab;
+	char *obj;
+	unsigned int i;
+
+	if (posix_memalign((void **)&slab, SLAB_SIZE, SLAB_SIZE)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	slab->inuse = 0;
+	slab->free = NULL;
+	obj = (char *)slab + SLAB_HDR;
+	for (i = 0; i < cache->per_slab; i++, obj += cache->size) {
+		*(void **)obj = slab->free;
+		slab->free = obj;
+	}
+	cache->slabs++;
+
+	return slab;
+}
+
+void *slab_alloc(struct slab_cache *cache)
+{
+	struct slab *slab;
+	void *obj;
+
+	slab = list_top(&cache->partial, struct slab, list);
+	if (!slab) {
+		slab = cache->spare;
+		cache->spare = NULL;
+		if (!slab)
+			slab = slab_new(cache);
+		if (!slab)
+			return NULL;
+		list_add(&slab->list, &cache->partial);
+	}
+
+	obj = slab->free;
+	slab->free = *(void **)obj;
+	if (++slab->inuse == cache->per_slab) {
+		list_del(&slab->list);
+		list_add(&slab->list, &cache->full);
+	}
+	cache->objects++;
+
+	return obj;
+}
+
+void slab_free(struct slab_cache *cache, void *obj)
+{
+	struct slab *slab;
+
+	slab = (void *)((uintptr_t)obj & ~(uintptr_t)(SLAB_SIZE - 1));
+
+	if (slab->inuse-- == cache->per_slab) {
+		list_del(&slab->list);
+		list_add(&slab->list, &cache->partial);
+	}
+	*(void **)obj = slab->free;
+	slab->free = obj;
+	cache->objects--;
+
+	if (slab->inuse)
+		return;
+
+	list_del(&slab->list);
+	if (!cache->spare) {
+		cache->spare = slab;
+		return;
+	}
+	free(slab);
+	cache->slabs--;
+}
+
+static struct slab_cache *byte_cache(size_t len)
+{
+	static bool initialized;
+	unsigned int i;
+
+	if (!initialized) {
+		for (i = 0; i < ARRAY_SIZE(byte_sizes); i++)
+			slab_cache_init(&byte_caches[i], byte_names[i],
+					byte_sizes[i]);
+		initialized = true;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(byte_sizes); i++)
+		if (len <= byte_sizes[i])
+			return &byte_caches[i];
+
+	return NULL;
+}
+
+void *slab_alloc_bytes(size_t len)
+{
+	struct slab_cache *cache = byte_cache(len);
+	void *p;
+
+	if (cache)
+		return slab_alloc(cache);
+
+	p = malloc(len);
+	if (!p) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	big_blocks++;
+	big_bytes += len;
+
+	return p;
+}
+
+void slab_free_bytes(void *p, size_t len)
+{
+	struct slab_cache *cache = byte_cache(len);
+
+	if (cache) {
+		slab_free(cache, p);
+		return;
+	}
+
+	free(p);
+	big_blocks--;
+	big_bytes -= len;
+}
+
+char *slab_report(char *resp)
+{
+	struct slab_cache *cache;
+
+	list_for_each_entry(cache, &caches, list) {
+		if (!resp)
+			return NULL;
+		if (!cache->slabs)
+			continue;
+		resp = talloc_asprintf_append(resp,
+			"%s: %lu objects of %zu bytes, %lu slabs (%lu KiB)\n",
+			cache->name, cache->objects, cache->size, cache->slabs,
+			cache->slabs * SLAB_SIZE / 1024);
+	}
+	if (resp && big_blocks)
+		resp = talloc_asprintf_append(resp,
+			"large blocks: %lu (%lu KiB)\n",
+			big_blocks, big_bytes / 1024);
+
+	return resp;
+}
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
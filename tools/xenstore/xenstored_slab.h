@@ -0,0 +1,58 @@
+/*
+    Object caches for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _XENSTORED_SLAB_H
+#define _XENSTORED_SLAB_H
+
+#include <stddef.h>
+
+#include "list.h"
+
+/* A cache of objects of one size, carved from aligned slabs. */
+struct slab_cache {
+	struct list_head list;		/* In the list of all caches. */
+	const char *name;
+	size_t size;
+	unsigned int per_slab;
+	struct list_head partial;	/* Slabs with free objects. */
+	struct list_head full;
+	struct slab *spare;		/* One empty slab kept back. */
+	unsigned long objects;		/* Objects in use. */
+	unsigned long slabs;
+};
+
+void slab_cache_init(struct slab_cache *cache, const char *name, size_t size);
+
+/* Returns NULL with errno set on failure. */
+void *slab_alloc(struct slab_cache *cache);
+void slab_free(struct slab_cache *cache, void *obj);
+
+/*
+ * Blocks of len bytes: small ones come from caches of a few sizes, larger
+ * ones from malloc().  They must be freed with the len they were allocated
+ * with.
+ */
+void *slab_alloc_bytes(size_t len);
+void slab_free_bytes(void *p, size_t len);
+
+/*
+ * Append a line per cache to the talloc string resp.  Returns the new
+ * string, NULL if out of memory.
+ */
+char *slab_report(char *resp);
+
+#endif /* _XENSTORED_SLAB_H */
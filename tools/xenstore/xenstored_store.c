@@ -0,0 +1,736 @@
+/*
+    In-memory node store for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The store is a trie of path components: a key like "/local/domain/1" is
+ * split at each '/', and each component is an entry below the entry for
+ * the key's prefix.  Transaction keys ("<generation>//local/domain/1") use
+ * the same scheme.  A single hash table keyed on (parent, component) finds
+ * children, so a lookup costs one probe per path component and doesn't
+ * depend on how many nodes sit next to it (think /local/domain with
+ * thousands of domains).
+ *
+ * Component names are interned and reference counted: the same few names
+ * ("device", "backend", "vif", ...) repeat below every domain.
+ *
+ * Records are kept in the on-disk TDB format (struct xs_tdb_record_hdr
+ * followed by perms, data and children), so optionally mirroring them to
+ * a TDB file for xs_tdb_dump needs no conversion.
+ *
+ * Keys of the global tree (those starting with '/') are versioned for
+ * snapshots: every modification gets a sequence number, and while a
+ * snapshot taken before it is alive the record it replaced is kept on the
+ * entry's version list instead of being freed.  Reading through a snapshot
+ * returns the newest version not younger than the snapshot.  Versions are
+ * dropped again once no snapshot can see them any more.
+ *
+ * Entries, versions, names and small records come from slab caches, and the
+ * global tree's records are accounted to the domain owning them.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "list.h"
+#include "talloc.h"
+#include "utils.h"
+#include "xenstore_lib.h"
+#include "xenstored_journal.h"
+#include "xenstored_slab.h"
+#include "xenstored_store.h"
+
+struct store_hnode {
+	struct hlist_node node;
+	unsigned int hashval;
+};
+
+struct store_table {
+	struct hlist_head *buckets;
+	unsigned int size;		/* Power of two. */
+	unsigned int count;
+};
+
+struct store_name {
+	struct store_hnode hash;	/* In names. */
+	unsigned int refs;
+	unsigned int len;
+	char str[];
+};
+
+struct store_entry {
+	struct store_hnode hash;	/* In entries, keyed on parent and name. */
+	struct list_head list;		/* In parent->children. */
+	struct list_head children;
+	struct store_entry *parent;
+	struct store_name *name;
+	/* Record stored under this key, NULL for an interior entry. */
+	void *data;
+	size_t len;
+	/* Sequence number of the last modification, 0 if not versioned. */
+	uint64_t seq;
+	/* Replaced records still visible to a snapshot, newest first. */
+	struct list_head versions;
+};
+
+struct store_version {
+	struct list_head list;		/* In entry->versions. */
+	struct list_head retired;	/* In retired, ordered by end. */
+	struct store_entry *entry;
+	void *data;			/* NULL if the key was deleted. */
+	size_t len;
+	uint64_t seq;			/* Sequence number when written. */
+	uint64_t end;			/* Sequence number when replaced. */
+};
+
+struct store_snapshot {
+	struct list_head list;		/* In snapshots, oldest first. */
+	uint64_t seq;
+};
+
+/* Bytes of records in the global tree owned by a domain. */
+struct store_owner {
+	struct store_hnode hash;	/* In owners, keyed on domid. */
+	unsigned int domid;
+	size_t bytes;
+};
+
+static struct store_table entries, names, owners;
+static struct slab_cache entry_cache, version_cache;
+static struct store_entry root;
+static TDB_CONTEXT *persist_ctx;
+/* Set while traversing: entries must not go away under the walk. */
+static bool traversing;
+/* Sequence number of the last modification of a versioned key. */
+static uint64_t store_seq;
+static LIST_HEAD(snapshots);
+static LIST_HEAD(retired);
+
+static void table_init(struct store_table *t, unsigned int size)
+{
+	t->buckets = calloc(size, sizeof(*t->buckets));
+	if (!t->buckets)
+		barf_perror("Could not allocate store hash table");
+	t->size = size;
+	t->count = 0;
+}
+
+/* Double the table size.  Failure is harmless: the chains just get longer. */
+static void table_grow(struct store_table *t)
+{
+	struct hlist_head *buckets;
+	struct hlist_node *pos, *n;
+	unsigned int i, size = t->size * 2;
+
+	buckets = calloc(size, sizeof(*buckets));
+	if (!buckets)
+		return;
+
+	for (i = 0; i < t->size; i++)
+		hlist_for_each_safe(pos, n, &t->buckets[i]) {
+			struct store_hnode *h;
+
+			h = hlist_entry(pos, struct store_hnode, node);
+			hlist_add_head(pos, &buckets[h->hashval & (size - 1)]);
+		}
+
+	free(t->buckets);
+	t->buckets = buckets;
+	t->size = size;
+}
+
+static struct hlist_head *table_bucket(struct store_table *t,
+				       unsigned int hashval)
+{
+	return &t->buckets[hashval & (t->size - 1)];
+}
+
+static void table_add(struct store_table *t, struct store_hnode *h,
+		      unsigned int hashval)
+{
+	if (t->count >= t->size)
+		table_grow(t);
+
+	h->hashval = hashval;
+	hlist_add_head(&h->node, table_bucket(t, hashval));
+	t->count++;
+}
+
+static void table_del(struct store_table *t, struct store_hnode *h)
+{
+	hlist_del(&h->node);
+	t->count--;
+}
+
+static unsigned int name_hash(const char *str, unsigned int len)
+{
+	unsigned int hash = 5381;
+
+	while (len--)
+		hash = ((hash << 5) + hash) + (unsigned char)*str++;
+
+	return hash;
+}
+
+static unsigned int entry_hash(const struct store_entry *parent,
+			       unsigned int hashval)
+{
+	return hashval ^ ((unsigned int)((uintptr_t)parent >> 4) * 2654435761U);
+}
+
+static void *record_alloc(size_t len)
+{
+	return slab_alloc_bytes(len ? len : 1);
+}
+
+static void record_free(void *rec, size_t len)
+{
+	if (rec)
+		slab_free_bytes(rec, len ? len : 1);
+}
+
+static struct store_owner *owner_find(unsigned int domid)
+{
+	struct store_owner *owner;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(owner, pos, table_bucket(&owners, domid),
+			     hash.node)
+		if (owner->domid == domid)
+			return owner;
+
+	return NULL;
+}
+
+/* Account a record of the global tree to the domain owning it. */
+static void owner_charge(const void *rec, size_t len, bool add)
+{
+	const struct xs_tdb_record_hdr *hdr = rec;
+	struct store_owner *owner;
+	unsigned int domid = 0;
+
+	if (len >= sizeof(*hdr) + sizeof(hdr->perms[0]) && hdr->num_perms)
+		domid = hdr->perms[0].id;
+
+	owner = owner_find(domid);
+	if (!owner && add) {
+		owner = malloc(sizeof(*owner));
+		if (!owner)
+			return;
+		owner->domid = domid;
+		owner->bytes = 0;
+		table_add(&owners, &owner->hash, domid);
+	}
+	if (!owner)
+		return;
+
+	if (add)
+		owner->bytes += len;
+	else
+		owner->bytes -= len < owner->bytes ? len : owner->bytes;
+
+	if (!owner->bytes) {
+		table_del(&owners, &owner->hash);
+		free(owner);
+	}
+}
+
+size_t store_usage(unsigned int domid)
+{
+	struct store_owner *owner = owner_find(domid);
+
+	return owner ? owner->bytes : 0;
+}
+
+static struct store_name *name_get(const char *str, unsigned int len,
+				   unsigned int hashval)
+{
+	struct store_name *name;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(name, pos, table_bucket(&names, hashval),
+			     hash.node)
+		if (name->hash.hashval == hashval && name->len == len &&
+		    !memcmp(name->str, str, len)) {
+			name->refs++;
+			return name;
+		}
+
+	name = slab_alloc_bytes(sizeof(*name) + len + 1);
+	if (!name)
+		return NULL;
+	name->refs = 1;
+	name->len = len;
+	memcpy(name->str, str, len);
+	name->str[len] = 0;
+	table_add(&names, &name->hash, hashval);
+
+	return name;
+}
+
+static void name_put(struct store_name *name)
+{
+	if (--name->refs)
+		return;
+
+	table_del(&names, &name->hash);
+	slab_free_bytes(name, sizeof(*name) + name->len + 1);
+}
+
+static struct store_entry *child_find(struct store_entry *parent,
+				      const char *str, unsigned int len,
+				      unsigned int hashval)
+{
+	struct store_entry *entry;
+	struct hlist_node *pos;
+	unsigned int ehash = entry_hash(parent, hashval);
+
+	hlist_for_each_entry(entry, pos, table_bucket(&entries, ehash),
+			     hash.node)
+		if (entry->hash.hashval == ehash && entry->parent == parent &&
+		    entry->name->len == len &&
+		    !memcmp(entry->name->str, str, len))
+			return entry;
+
+	return NULL;
+}
+
+static struct store_entry *child_new(struct store_entry *parent,
+				     const char *str, unsigned int len,
+				     unsigned int hashval)
+{
+	struct store_entry *entry;
+
+	entry = slab_alloc(&entry_cache);
+	if (!entry)
+		return NULL;
+
+	entry->name = name_get(str, len, hashval);
+	if (!entry->name) {
+		slab_free(&entry_cache, entry);
+		return NULL;
+	}
+
+	entry->parent = parent;
+	entry->data = NULL;
+	entry->len = 0;
+	entry->seq = 0;
+	INIT_LIST_HEAD(&entry->versions);
+	INIT_LIST_HEAD(&entry->children);
+	list_add_tail(&entry->list, &parent->children);
+	table_add(&entries, &entry->hash, entry_hash(parent, hashval));
+
+	return entry;
+}
+
+static bool entry_unused(const struct store_entry *entry)
+{
+	return entry != &root && !entry->data &&
+	       list_empty((struct list_head *)&entry->versions) &&
+	       list_empty((struct list_head *)&entry->children);
+}
+
+static void entry_free(struct store_entry *entry)
+{
+	table_del(&entries, &entry->hash);
+	list_del(&entry->list);
+	name_put(entry->name);
+	slab_free(&entry_cache, entry);
+}
+
+/* Free entry and its ancestors as long as they hold nothing. */
+static void entry_prune(struct store_entry *entry)
+{
+	struct store_entry *parent;
+
+	if (traversing)
+		return;
+
+	while (entry_unused(entry)) {
+		parent = entry->parent;
+		entry_free(entry);
+		entry = parent;
+	}
+}
+
+static struct store_entry *entry_lookup(TDB_DATA key, bool create)
+{
+	struct store_entry *entry = &root, *child;
+	const char *p = key.dptr, *end = key.dptr + key.dsize, *sep;
+	unsigned int len, hashval;
+
+	for (;;) {
+		sep = memchr(p, '/', end - p);
+		if (!sep)
+			sep = end;
+		len = sep - p;
+		hashval = name_hash(p, len);
+
+		child = child_find(entry, p, len, hashval);
+		if (!child) {
+			if (!create)
+				return NULL;
+			child = child_new(entry, p, len, hashval);
+			if (!child) {
+				entry_prune(entry);
+				return NULL;
+			}
+		}
+		entry = child;
+
+		if (sep == end)
+			return entry;
+		p = sep + 1;
+	}
+}
+
+static bool key_versioned(TDB_DATA key)
+{
+	return key.dsize && key.dptr[0] == '/';
+}
+
+/* Does a live snapshot still see the current record of entry? */
+static bool entry_in_snapshot(const struct store_entry *entry)
+{
+	const struct store_snapshot *newest;
+
+	if (list_empty(&snapshots) || (!entry->data && !entry->seq))
+		return false;
+
+	newest = list_entry(snapshots.prev, struct store_snapshot, list);
+	return newest->seq >= entry->seq;
+}
+
+/* Move the current record of entry to its version list. */
+static void entry_retire(struct store_entry *entry, struct store_version *v,
+			 uint64_t end)
+{
+	v->entry = entry;
+	v->data = entry->data;
+	v->len = entry->len;
+	v->seq = entry->seq;
+	v->end = end;
+	list_add(&v->list, &entry->versions);
+	list_add_tail(&v->retired, &retired);
+
+	entry->data = NULL;
+	entry->len = 0;
+}
+
+/* Free versions no snapshot can see any more. */
+static void store_gc(void)
+{
+	const struct store_snapshot *oldest = NULL;
+	struct store_version *v;
+
+	if (!list_empty(&snapshots))
+		oldest = list_entry(snapshots.next, struct store_snapshot,
+				    list);
+
+	while ((v = list_top(&retired, struct store_version, retired))) {
+		/* Versions retire in order, so the rest is younger still. */
+		if (oldest && oldest->seq < v->end)
+			break;
+
+		list_del(&v->retired);
+		list_del(&v->list);
+		entry_prune(v->entry);
+		record_free(v->data, v->len);
+		slab_free(&version_cache, v);
+	}
+}
+
+TDB_DATA store_fetch_at(const void *ctx, TDB_DATA key,
+			const struct store_snapshot *snap)
+{
+	struct store_entry *entry = entry_lookup(key, false);
+	TDB_DATA data = { .dptr = NULL, .dsize = 0 };
+	const struct store_version *v;
+	const void *rec = NULL;
+	size_t len = 0;
+
+	if (entry && (!snap || entry->seq <= snap->seq)) {
+		rec = entry->data;
+		len = entry->len;
+	} else if (entry) {
+		list_for_each_entry(v, &entry->versions, list)
+			if (v->seq <= snap->seq) {
+				rec = v->data;
+				len = v->len;
+				break;
+			}
+	}
+
+	if (!rec) {
+		errno = ENOENT;
+		return data;
+	}
+
+	data.dptr = talloc_memdup(ctx, rec, len);
+	if (!data.dptr) {
+		errno = ENOMEM;
+		return data;
+	}
+	data.dsize = len;
+
+	return data;
+}
+
+size_t store_record_size(TDB_DATA key)
+{
+	struct store_entry *entry = entry_lookup(key, false);
+
+	return entry ? entry->len : 0;
+}
+
+TDB_DATA store_fetch(const void *ctx, TDB_DATA key)
+{
+	return store_fetch_at(ctx, key, NULL);
+}
+
+int store_store(TDB_DATA key, TDB_DATA data)
+{
+	struct store_entry *entry;
+	struct store_version *v = NULL;
+	void *copy;
+
+	copy = record_alloc(data.dsize);
+	if (!copy) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(copy, data.dptr, data.dsize);
+
+	entry = entry_lookup(key, true);
+	if (!entry) {
+		record_free(copy, data.dsize);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (key_versioned(key) && entry_in_snapshot(entry)) {
+		v = slab_alloc(&version_cache);
+		if (!v) {
+			record_free(copy, data.dsize);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	if ((key_versioned(key) && journal_store(key, data)) ||
+	    (persist_ctx && tdb_store(persist_ctx, key, data, TDB_REPLACE))) {
+		if (v)
+			slab_free(&version_cache, v);
+		record_free(copy, data.dsize);
+		entry_prune(entry);
+		errno = EIO;
+		return -1;
+	}
+
+	if (key_versioned(key)) {
+		if (entry->data)
+			owner_charge(entry->data, entry->len, false);
+		owner_charge(copy, data.dsize, true);
+	}
+	if (v)
+		entry_retire(entry, v, store_seq + 1);
+	record_free(entry->data, entry->len);
+	entry->data = copy;
+	entry->len = data.dsize;
+	if (key_versioned(key))
+		entry->seq = ++store_seq;
+
+	return 0;
+}
+
+int store_delete(TDB_DATA key)
+{
+	struct store_entry *entry = entry_lookup(key, false);
+	struct store_version *v = NULL;
+
+	if (!entry || !entry->data) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (key_versioned(key) && entry_in_snapshot(entry)) {
+		v = slab_alloc(&version_cache);
+		if (!v) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	if ((key_versioned(key) && journal_delete(key)) ||
+	    (persist_ctx && tdb_delete(persist_ctx, key))) {
+		if (v)
+			slab_free(&version_cache, v);
+		errno = EIO;
+		return -1;
+	}
+
+	if (key_versioned(key))
+		owner_charge(entry->data, entry->len, false);
+	if (v)
+		entry_retire(entry, v, store_seq + 1);
+	record_free(entry->data, entry->len);
+	entry->data = NULL;
+	entry->len = 0;
+	if (key_versioned(key))
+		entry->seq = ++store_seq;
+	entry_prune(entry);
+
+	return 0;
+}
+
+static int destroy_snapshot(void *_snap)
+{
+	struct store_snapshot *snap = _snap;
+
+	list_del(&snap->list);
+	store_gc();
+
+	return 0;
+}
+
+struct store_snapshot *store_snapshot(const void *ctx)
+{
+	struct store_snapshot *snap;
+
+	snap = talloc(ctx, struct store_snapshot);
+	if (!snap) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	snap->seq = store_seq;
+	list_add_tail(&snap->list, &snapshots);
+	talloc_set_destructor(snap, destroy_snapshot);
+
+	return snap;
+}
+
+bool store_snapshot_current(const struct store_snapshot *snap)
+{
+	return snap->seq == store_seq;
+}
+
+struct store_walk {
+	int (*fn)(TDB_DATA key, TDB_DATA data, void *private);
+	void *private;
+	char *buf;
+	size_t size;
+	int count;
+};
+
+static bool walk_entry(struct store_walk *walk, struct store_entry *entry,
+		       size_t len)
+{
+	struct store_entry *child;
+	TDB_DATA key, data;
+
+	if (entry->data) {
+		key.dptr = walk->buf;
+		key.dsize = len;
+		data.dptr = entry->data;
+		data.dsize = entry->len;
+		walk->count++;
+		if (walk->fn(key, data, walk->private))
+			return true;
+	}
+
+	list_for_each_entry(child, &entry->children, list) {
+		size_t off = (entry == &root) ? 0 : len + 1;
+		size_t clen = off + child->name->len;
+
+		if (clen + 1 > walk->size) {
+			size_t size = (clen + 1) * 2;
+			char *buf = realloc(walk->buf, size);
+
+			if (!buf)
+				return true;
+			walk->buf = buf;
+			walk->size = size;
+		}
+
+		if (off)
+			walk->buf[len] = '/';
+		memcpy(walk->buf + off, child->name->str, child->name->len);
+		walk->buf[clen] = 0;
+
+		if (walk_entry(walk, child, clen))
+			return true;
+	}
+
+	return false;
+}
+
+/* Free whatever a traversal left empty. */
+static void prune_tree(struct store_entry *entry)
+{
+	struct store_entry *child, *tmp;
+
+	list_for_each_entry_safe(child, tmp, &entry->children, list)
+		prune_tree(child);
+
+	if (entry_unused(entry))
+		entry_free(entry);
+}
+
+int store_traverse(int (*fn)(TDB_DATA key, TDB_DATA data, void *private),
+		   void *private)
+{
+	struct store_walk walk = {
+		.fn = fn,
+		.private = private,
+	};
+
+	traversing = true;
+	walk_entry(&walk, &root, 0);
+	traversing = false;
+
+	prune_tree(&root);
+	free(walk.buf);
+
+	return walk.count;
+}
+
+void store_init(TDB_CONTEXT *persist)
+{
+	table_init(&entries, 1024);
+	table_init(&names, 256);
+	table_init(&owners, 64);
+	slab_cache_init(&entry_cache, "store entries", sizeof(struct store_entry));
+	slab_cache_init(&version_cache, "store versions",
+			sizeof(struct store_version));
+	INIT_LIST_HEAD(&root.children);
+	persist_ctx = persist;
+}
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
@@ -0,0 +1,77 @@
+/*
+    In-memory node store for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _XENSTORED_STORE_H
+#define _XENSTORED_STORE_H
+
+#include <stdbool.h>
+
+#include "tdb.h"
+
+struct store_snapshot;
+
+/*
+ * Set up the store.  If persist is not NULL every modification is written
+ * through to it, so the store can be inspected with xs_tdb_dump; it is
+ * never read back.
+ */
+void store_init(TDB_CONTEXT *persist);
+
+/*
+ * Return a copy of the record for key, allocated as a talloc child of ctx.
+ * On failure dptr is NULL and errno is set (ENOENT if there is no record).
+ */
+TDB_DATA store_fetch(const void *ctx, TDB_DATA key);
+
+/*
+ * Like store_fetch(), but return the record as it was when snap was taken.
+ * A NULL snap means the current record.
+ */
+TDB_DATA store_fetch_at(const void *ctx, TDB_DATA key,
+			const struct store_snapshot *snap);
+
+/* Size of the record for key, 0 if there is none. */
+size_t store_record_size(TDB_DATA key);
+
+/* Bytes of records in the global tree owned by domid. */
+size_t store_usage(unsigned int domid);
+
+/* Add or replace the record for key.  Returns 0 or -1 with errno set. */
+int store_store(TDB_DATA key, TDB_DATA data);
+
+/* Remove the record for key.  Returns 0 or -1 with errno set. */
+int store_delete(TDB_DATA key);
+
+/*
+ * Take a snapshot of the global tree (keys starting with '/'), allocated as
+ * a talloc child of ctx.  It lives until freed.  Returns NULL with errno
+ * set on failure.
+ */
+struct store_snapshot *store_snapshot(const void *ctx);
+
+/* Has the global tree not been modified since snap was taken? */
+bool store_snapshot_current(const struct store_snapshot *snap);
+
+/*
+ * Call fn for each record in the store, stopping if it returns non-zero.
+ * fn may delete the record it is called for.  Returns the number of
+ * records visited.
+ */
+int store_traverse(int (*fn)(TDB_DATA key, TDB_DATA data, void *private),
+		   void *private);
+
+#endif /* _XENSTORED_STORE_H */
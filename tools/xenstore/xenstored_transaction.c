@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include "talloc.h"
 #include "list.h"
+#include "xenstored_store.h"
 #include "xenstored_transaction.h"
 #include "xenstored_watch.h"
 #include "xenstored_domain.h"
@@ -57,6 +58,14 @@
  * succeeded transaction possibly overwriting another modification which may
  * have occurred concurrent to the transaction.
  *
+ * Reads in a transaction of nodes not modified by it are done from a snapshot
+ * of the data base taken when the transaction was started (see
+ * xenstored_store.c).  A transaction thus always sees a consistent state,
+ * no per-node copy has to be made for reading, and a transaction without
+ * modifications can't conflict at all: it isn't checked at its end.  If
+ * the data base wasn't modified at all since the start of the transaction
+ * the checks are skipped, too.
+ *
  * Examples:
  * ---------
  * The following notation is used:
@@ -147,6 +156,9 @@ struct transaction
 	/* Generation when transaction started. */
 	uint64_t generation;
 
+	/* Data base state when transaction started. */
+	struct store_snapshot *snapshot;
+
 	/* List of accessed nodes. */
 	struct list_head accessed;
 
@@ -191,10 +203,16 @@ static char *transaction_get_node_name(void *ctx, struct transaction *trans,
 int transaction_prepend(struct connection *conn, const char *name,
 			TDB_DATA *key)
 {
+	struct accessed_node *i;
 	char *tdb_name;
 
-	if (!conn || !conn->transaction ||
-	    !find_accessed_node(conn->transaction, name)) {
+	if (conn && conn->transaction)
+		i = find_accessed_node(conn->transaction, name);
+	else
+		i = NULL;
+
+	/* Unmodified nodes are read from the snapshot. */
+	if (!i || !i->modified) {
 		set_tdb_key(name, key);
 		return 0;
 	}
@@ -209,6 +227,14 @@ int transaction_prepend(struct connection *conn, const char *name,
 	return 0;
 }
 
+const struct store_snapshot *transaction_snapshot(struct connection *conn)
+{
+	if (!conn || !conn->transaction)
+		return NULL;
+
+	return conn->transaction->snapshot;
+}
+
 /*
  * A node has been accessed.
  *
@@ -228,7 +254,6 @@ int access_node(struct connection *conn, struct node *node,
 {
 	struct accessed_node *i = NULL;
 	struct transaction *trans;
-	TDB_DATA local_key;
 	const char *trans_name = NULL;
 	int ret;
 	bool introduce = false;
@@ -265,22 +290,13 @@ int access_node(struct connection *conn, struct node *node,
 		i->ta_node = false;
 
 		/*
-		 * Additional transaction-specific node for read type. We only
-		 * have to verify read nodes if we didn't write them.
-		 *
-		 * The node is created and written to DB here to distinguish
-		 * from the write types.
+		 * We only have to verify read nodes if we didn't write them.
+		 * Further reads are satisfied from the snapshot, so no
+		 * transaction-specific copy is needed.
 		 */
 		if (type == NODE_ACCESS_READ) {
 			i->generation = node->generation;
 			i->check_gen = true;
-			if (node->generation != NO_GENERATION) {
-				set_tdb_key(trans_name, &local_key);
-				ret = write_node_raw(conn, &local_key, node);
-				if (ret)
-					goto err;
-				i->ta_node = true;
-			}
 		}
 		list_add_tail(&i->list, &trans->accessed);
 	}
@@ -304,7 +320,6 @@ int access_node(struct connection *conn, struct node *node,
 
 nomem:
 	ret = ENOMEM;
-err:
 	talloc_free((void *)trans_name);
 	talloc_free(i);
 	trans->fail = true;
@@ -327,17 +342,29 @@ static int finalize_transaction(struct connection *conn,
 	struct xs_tdb_record_hdr *hdr;
 	uint64_t gen;
 	char *trans_name;
+	bool modified = false;
 	int ret;
 
+	list_for_each_entry(i, &trans->accessed, list)
+		modified |= i->modified;
+
+	/*
+	 * The transaction's reads came from its snapshot, so they are
+	 * consistent: there is nothing to check if it didn't modify anything,
+	 * or if nothing has been modified since it started.
+	 */
+	if (!modified || store_snapshot_current(trans->snapshot))
+		goto commit;
+
 	list_for_each_entry(i, &trans->accessed, list) {
 		if (!i->check_gen)
 			continue;
 
 		set_tdb_key(i->node, &key);
-		data = tdb_fetch(tdb_ctx, key);
+		data = store_fetch(NULL, key);
 		hdr = (void *)data.dptr;
 		if (!data.dptr) {
-			if (tdb_error(tdb_ctx) != TDB_ERR_NOEXIST)
+			if (errno != ENOENT)
 				return EIO;
 			gen = NO_GENERATION;
 		} else
@@ -347,6 +374,8 @@ static int finalize_transaction(struct connection *conn,
 			return EAGAIN;
 	}
 
+commit:
+
 	while ((i = list_top(&trans->accessed, struct accessed_node, list))) {
 		trans_name = transaction_get_node_name(i, trans, i->node);
 		if (!trans_name)
@@ -358,22 +387,21 @@ static int finalize_transaction(struct connection *conn,
 		if (i->modified) {
 			set_tdb_key(i->node, &key);
 			if (i->ta_node) {
-				data = tdb_fetch(tdb_ctx, ta_key);
+				data = store_fetch(NULL, ta_key);
 				if (!data.dptr)
 					goto err;
 				hdr = (void *)data.dptr;
 				hdr->generation = generation++;
-				ret = tdb_store(tdb_ctx, key, data,
-						TDB_REPLACE);
+				ret = store_store(key, data);
 				talloc_free(data.dptr);
 				if (ret)
 					goto err;
-			} else if (tdb_delete(tdb_ctx, key))
+			} else if (store_delete(key))
 					goto err;
 			fire_watches(conn, trans, i->node, false);
 		}
 
-		if (i->ta_node && tdb_delete(tdb_ctx, ta_key))
+		if (i->ta_node && store_delete(ta_key))
 			goto err;
 		list_del(&i->list);
 		talloc_free(i);
@@ -401,7 +429,7 @@ static int destroy_transaction(void *_transaction)
 							       i->node);
 			if (trans_name) {
 				set_tdb_key(trans_name, &key);
-				tdb_delete(tdb_ctx, key);
+				store_delete(key);
 			}
 		}
 		list_del(&i->list);
@@ -446,6 +474,9 @@ int do_transaction_start(struct connection *conn, struct buffered_data *in)
 	INIT_LIST_HEAD(&trans->changed_domains);
 	trans->fail = false;
 	trans->generation = generation++;
+	trans->snapshot = store_snapshot(trans);
+	if (!trans->snapshot)
+		return ENOMEM;
 
 	/* Pick an unused transaction identifier. */
 	do {
@@ -44,6 +44,9 @@ int access_node(struct connection *conn, struct node *node,
 int transaction_prepend(struct connection *conn, const char *name,
                         TDB_DATA *key);
 
+/* Snapshot of the global data base to read from, or NULL. */
+const struct store_snapshot *transaction_snapshot(struct connection *conn);
+
 void conn_delete_all_transactions(struct connection *conn);
 int check_transactions(struct hashtable *hash);
 
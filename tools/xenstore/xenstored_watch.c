@@ -25,18 +25,48 @@
 #include <assert.h>
 #include "talloc.h"
 #include "list.h"
+#include "hashtable.h"
 #include "xenstored_watch.h"
 #include "xenstore_lib.h"
 #include "utils.h"
 #include "xenstored_domain.h"
 
 extern int quota_nb_watch_per_domain;
+extern int quota_nb_watch_events;
+
+/*
+ * All watches are indexed by the path they watch.  The index entries form
+ * a tree: the entry for "/a/b" is a child of the one for "/a", and so on up
+ * to "/".  Event paths ("@...") are entries without a parent.  An entry
+ * exists as long as it has watches or children, so a missing entry means
+ * there are no watches below it either.
+ */
+struct watch_path
+{
+	/* Watches on exactly this path. */
+	struct list_head watches;
+
+	/* Entries one level below, and our place in the parent's list. */
+	struct list_head children;
+	struct list_head sibling;
+	struct watch_path *parent;
+
+	/* Also the key in watch_index. */
+	char *path;
+};
+
+static struct hashtable *watch_index;
 
 struct watch
 {
 	/* Watches on this connection */
 	struct list_head list;
 
+	/* Watches on this path */
+	struct list_head path_list;
+	struct watch_path *path;
+	struct connection *conn;
+
 	/* Current outstanding events applying to this watch. */
 	struct list_head events;
 
@@ -56,22 +86,95 @@ static bool check_event_node(const char *node)
 	return true;
 }
 
-/* Is child a subnode of parent, or equal? */
-static bool is_child(const char *child, const char *parent)
+static unsigned int watch_hash_fn(void *k)
 {
-	unsigned int len = strlen(parent);
+	char *str = k;
+	unsigned int hash = 5381;
+	char c;
 
-	/*
-	 * / should really be "" for this algorithm to work, but that's a
-	 * usability nightmare.
-	 */
-	if (streq(parent, "/"))
-		return true;
+	while ((c = *str++))
+		hash = ((hash << 5) + hash) + (unsigned int)c;
 
-	if (strncmp(child, parent, len) != 0)
-		return false;
+	return hash;
+}
+
+static int watch_equal_fn(void *key1, void *key2)
+{
+	return streq(key1, key2);
+}
+
+static struct watch_path *watch_path_find(const char *path)
+{
+	if (!watch_index)
+		return NULL;
+
+	return hashtable_search(watch_index, (void *)path);
+}
+
+/* Find or create the index entry for path, and those of its parents. */
+static struct watch_path *watch_path_get(const char *path)
+{
+	struct watch_path *wp, *parent = NULL;
+	char *key, *slash;
+
+	wp = watch_path_find(path);
+	if (wp)
+		return wp;
+
+	if (!watch_index) {
+		watch_index = create_hashtable(256, watch_hash_fn,
+					       watch_equal_fn);
+		if (!watch_index)
+			return NULL;
+	}
+
+	if (path[0] == '/' && path[1]) {
+		char *ppath = talloc_strdup(NULL, path);
+
+		if (!ppath)
+			return NULL;
+		slash = strrchr(ppath, '/');
+		/* The parent of "/a" is "/". */
+		slash[slash == ppath ? 1 : 0] = 0;
+		parent = watch_path_get(ppath);
+		talloc_free(ppath);
+		if (!parent)
+			return NULL;
+	}
 
-	return child[len] == '/' || child[len] == '\0';
+	wp = talloc(NULL, struct watch_path);
+	key = strdup(path);
+	if (!wp || !key ||
+	    !hashtable_insert(watch_index, key, wp)) {
+		free(key);
+		talloc_free(wp);
+		return NULL;
+	}
+
+	INIT_LIST_HEAD(&wp->watches);
+	INIT_LIST_HEAD(&wp->children);
+	wp->parent = parent;
+	wp->path = key;
+	if (parent)
+		list_add_tail(&wp->sibling, &parent->children);
+
+	return wp;
+}
+
+/* Drop index entries which are no longer needed, starting with wp. */
+static void watch_path_put(struct watch_path *wp)
+{
+	struct watch_path *parent;
+
+	while (wp && list_empty(&wp->watches) && list_empty(&wp->children)) {
+		parent = wp->parent;
+		if (parent)
+			list_del(&wp->sibling);
+		/* Frees wp->path, too. */
+		hashtable_remove(watch_index, wp->path);
+		talloc_free(wp);
+		wp = parent;
+	}
 }
 
 /*
@@ -103,6 +206,13 @@ static void add_event(struct connection *conn,
 			return;
 	}
 
+	if (domain_is_unprivileged(conn) &&
+	    conn->watch_events >= quota_nb_watch_events) {
+		/* Don't let a slow consumer make us queue events forever. */
+		conn->watch_events_dropped++;
+		return;
+	}
+
 	if (watch->relative_path) {
 		name += strlen(watch->relative_path);
 		if (*name == '/') /* Could be "" */
@@ -123,29 +233,81 @@ static void add_event(struct connection *conn,
  * Check whether any watch events are to be sent.
  * Temporary memory allocations are done with ctx.
  */
+static void fire_path(struct watch_path *wp, void *ctx, const char *name)
+{
+	struct watch *watch;
+
+	list_for_each_entry(watch, &wp->watches, path_list)
+		add_event(watch->conn, ctx, watch, name);
+}
+
+/* Fire all watches strictly below wp, passing their own path. */
+static void fire_below(struct watch_path *wp, void *ctx)
+{
+	struct watch_path *child;
+
+	list_for_each_entry(child, &wp->children, sibling) {
+		fire_path(child, ctx, child->path);
+		fire_below(child, ctx);
+	}
+}
+
 void fire_watches(struct connection *conn, void *ctx, const char *name,
 		  bool recurse)
 {
-	struct connection *i;
-	struct watch *watch;
+	struct watch_path *wp, *root;
+	char *path, *slash;
 
 	/* During transactions, don't fire watches. */
 	if (conn && conn->transaction)
 		return;
 
-	/* Create an event for each watch. */
-	list_for_each_entry(i, &connections, list) {
-		list_for_each_entry(watch, &i->watches, list) {
-			if (is_child(name, watch->node))
-				add_event(i, ctx, watch, name);
-			else if (recurse && is_child(watch->node, name))
-				add_event(i, ctx, watch, watch->node);
-		}
+	/* Watches on "/" get all events, including the special ones. */
+	root = watch_path_find("/");
+	if (root)
+		fire_path(root, ctx, name);
+
+	if (name[0] != '/') {
+		wp = watch_path_find(name);
+		if (wp)
+			fire_path(wp, ctx, name);
+		return;
+	}
+
+	if (!root)
+		return;
+
+	/* Watches on name and on each of its parents. */
+	path = talloc_strdup(ctx, name);
+	if (!path)
+		return;
+	wp = root;
+	for (slash = strchr(path + 1, '/'); wp && name[1];
+	     slash = slash ? strchr(slash + 1, '/') : NULL) {
+		if (slash)
+			*slash = 0;
+		wp = watch_path_find(path);
+		if (wp)
+			fire_path(wp, ctx, name);
+		if (!slash)
+			break;
+		*slash = '/';
 	}
+	talloc_free(path);
+
+	/* Removing a node affects everything below it. */
+	if (recurse && wp)
+		fire_below(wp, ctx);
 }
 
 static int destroy_watch(void *_watch)
 {
+	struct watch *watch = _watch;
+
+	if (watch->path) {
+		list_del(&watch->path_list);
+		watch_path_put(watch->path);
+	}
 	trace_destroy(_watch, "watch");
 	return 0;
 }
@@ -199,6 +361,14 @@ int do_watch(struct connection *conn, struct buffered_data *in)
 
 	INIT_LIST_HEAD(&watch->events);
 
+	watch->conn = conn;
+	watch->path = watch_path_get(watch->node);
+	if (!watch->path) {
+		talloc_free(watch);
+		return ENOMEM;
+	}
+	list_add_tail(&watch->path_list, &watch->path->watches);
+
 	domain_watch_inc(conn);
 	list_add_tail(&watch->list, &conn->watches);
 	trace_create(watch, "watch");
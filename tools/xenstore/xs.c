@@ -16,6 +16,8 @@
     License along with this library; If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define _GNU_SOURCE /* For memfd seals. */
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -31,12 +33,38 @@
 #include <signal.h>
 #include <stdint.h>
 #include <errno.h>
+#include <ctype.h>
 #include "xenstore.h"
 #include "list.h"
 #include "utils.h"
 
 #include <xentoolcore_internal.h>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* Shared memory rings with the local daemon need memfds and eventfds. */
+#if defined(__linux__) && defined(SYS_memfd_create) && defined(F_ADD_SEALS)
+#define XS_SHMEM
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC		0x0001U
+#define MFD_ALLOW_SEALING	0x0002U
+#endif
+#endif
+
+struct xs_ring {
+	/* Laid out like a domain's ring page. */
+	struct xenstore_domain_interface *intf;
+	/* Eventfds: we kick the daemon, it tells us about responses/space. */
+	int kick_fd;
+	int rsp_fd;
+	int space_fd;
+};
+
 struct xs_stored_msg {
 	struct list_head list;
 	struct xsd_sockmsg hdr;
@@ -52,6 +80,9 @@ struct xs_handle {
 	int fd;
 	Xentoolcore__Active_Handle tc_ah; /* for restrict */
 
+	/* Shared memory ring replacing the socket, if negotiated. */
+	struct xs_ring *ring;
+
 	/*
          * A read thread which pulls messages off the comms channel and
          * signals waiters.
@@ -86,6 +117,8 @@ struct xs_handle {
 
 	/* Lock discipline:
 	 *  Only holder of the request lock may write to h->fd.
+	 *  With h->ring, its request ring counts as h->fd for writing and
+	 *  its response ring as h->fd for reading.
 	 *  Only holder of the request lock may access read_thr_exists.
 	 *  If read_thr_exists==0, only holder of request lock may read h->fd;
 	 *  If read_thr_exists==1, only the read thread may read h->fd.
@@ -126,6 +159,7 @@ static void *read_thread(void *arg);
 struct xs_handle {
 	int fd;
 	Xentoolcore__Active_Handle tc_ah; /* for restrict */
+	struct xs_ring *ring;
 	struct list_head reply_list;
 	struct list_head watch_list;
 	/* Clients can select() on this pipe to wait for a watch to fire. */
@@ -148,6 +182,7 @@ struct xs_handle {
 #endif
 
 static int read_message(struct xs_handle *h, int nonblocking);
+static bool xs_shmem_connect(struct xs_handle *h);
 
 static bool setnonblock(int fd, int nonblock) {
 	int flags = fcntl(fd, F_GETFL);
@@ -319,6 +354,11 @@ struct xs_handle *xs_open(unsigned long flags)
 	if (xsh && (flags & XS_UNWATCH_FILTER))
 		xsh->unwatch_filter = true;
 
+	if (xsh && (flags & XS_OPEN_SHMEM) && !xs_shmem_connect(xsh)) {
+		xs_daemon_close(xsh);
+		xsh = NULL;
+	}
+
 	return xsh;
 }
 
@@ -336,12 +376,30 @@ static void close_free_msgs(struct xs_handle *h) {
 	}
 }
 
+static void xs_ring_free(struct xs_ring *ring)
+{
+#ifdef XS_SHMEM
+	if (ring->intf)
+		munmap(ring->intf, sizeof(*ring->intf));
+	if (ring->kick_fd >= 0)
+		close(ring->kick_fd);
+	if (ring->rsp_fd >= 0)
+		close(ring->rsp_fd);
+	if (ring->space_fd >= 0)
+		close(ring->space_fd);
+#endif
+	free(ring);
+}
+
 static void close_fds_free(struct xs_handle *h) {
 	if (h->watch_pipe[0] != -1) {
 		close(h->watch_pipe[0]);
 		close(h->watch_pipe[1]);
 	}
 
+	if (h->ring)
+		xs_ring_free(h->ring);
+
         close(h->fd);
 	xentoolcore__deregister_active_handle(&h->tc_ah);
         
@@ -429,6 +487,159 @@ out_false:
 #define xs_write_all write_all_choice
 #endif
 
+#ifdef XS_SHMEM
+static void ring_signal(int fd)
+{
+	uint64_t one = 1;
+
+	while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR)
+		continue;
+}
+
+/* Wait for the daemon to signal fd.  Fails if it closed the socket. */
+static bool ring_wait(struct xs_handle *h, int fd)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = fd, .events = POLLIN },
+		{ .fd = h->fd, .events = POLLIN },
+	};
+	uint64_t count;
+
+	while (poll(pfd, 2, -1) < 0) /* Cancellation point */
+		if (errno != EINTR)
+			return false;
+
+	/* The daemon never writes to the socket once the ring is up. */
+	if (pfd[1].revents) {
+		errno = EBADF;
+		return false;
+	}
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		return false;
+	return true;
+}
+
+static bool ring_write_all(struct xs_handle *h, const void *data,
+			   unsigned int len)
+{
+	struct xenstore_domain_interface *intf = h->ring->intf;
+	XENSTORE_RING_IDX cons, prod;
+	unsigned int chunk;
+
+	while (len) {
+		cons = intf->req_cons;
+		prod = intf->req_prod;
+		__sync_synchronize();
+
+		if (prod - cons > XENSTORE_RING_SIZE) {
+			errno = EIO;
+			return false;
+		}
+		if (prod - cons == XENSTORE_RING_SIZE) {
+			/* Full: make sure the daemon drains it. */
+			ring_signal(h->ring->kick_fd);
+			if (!ring_wait(h, h->ring->space_fd))
+				return false;
+			continue;
+		}
+
+		chunk = XENSTORE_RING_SIZE - MASK_XENSTORE_IDX(prod);
+		if (chunk > XENSTORE_RING_SIZE - (prod - cons))
+			chunk = XENSTORE_RING_SIZE - (prod - cons);
+		if (chunk > len)
+			chunk = len;
+
+		memcpy(intf->req + MASK_XENSTORE_IDX(prod), data, chunk);
+		__sync_synchronize();
+		intf->req_prod = prod + chunk;
+
+		data += chunk;
+		len -= chunk;
+	}
+
+	return true;
+}
+
+static bool ring_read_all(struct xs_handle *h, void *data, unsigned int len,
+			  int nonblocking)
+{
+	struct xenstore_domain_interface *intf = h->ring->intf;
+	XENSTORE_RING_IDX cons, prod;
+	unsigned int chunk;
+
+	while (len) {
+		cons = intf->rsp_cons;
+		prod = intf->rsp_prod;
+		__sync_synchronize();
+
+		if (prod - cons > XENSTORE_RING_SIZE) {
+			errno = EIO;
+			return false;
+		}
+		if (prod == cons) {
+			if (nonblocking) {
+				errno = EAGAIN;
+				return false;
+			}
+			if (!ring_wait(h, h->ring->rsp_fd))
+				return false;
+			continue;
+		}
+
+		chunk = XENSTORE_RING_SIZE - MASK_XENSTORE_IDX(cons);
+		if (chunk > prod - cons)
+			chunk = prod - cons;
+		if (chunk > len)
+			chunk = len;
+
+		memcpy(data, intf->rsp + MASK_XENSTORE_IDX(cons), chunk);
+		__sync_synchronize();
+		intf->rsp_cons = cons + chunk;
+
+		/* The daemon stalls only on a full ring: restart it. */
+		if (prod - cons == XENSTORE_RING_SIZE)
+			ring_signal(h->ring->kick_fd);
+
+		data += chunk;
+		len -= chunk;
+		nonblocking = 0;
+	}
+
+	return true;
+}
+#endif
+
+/* Write to the daemon over whichever channel we have. */
+static bool xs_chan_write(struct xs_handle *h, const void *data,
+			  unsigned int len)
+{
+#ifdef XS_SHMEM
+	if (h->ring)
+		return ring_write_all(h, data, len);
+#endif
+	return xs_write_all(h->fd, data, len);
+}
+
+/* Tell the daemon a request is complete: one kick covers the whole of it. */
+static void xs_chan_flush(struct xs_handle *h)
+{
+#ifdef XS_SHMEM
+	if (h->ring)
+		ring_signal(h->ring->kick_fd);
+#endif
+}
+
+static bool xs_chan_read(struct xs_handle *h, void *data, unsigned int len,
+			 int nonblocking)
+{
+#ifdef XS_SHMEM
+	if (h->ring)
+		return ring_read_all(h, data, len, nonblocking);
+#endif
+	return read_all(h->fd, data, len, nonblocking);
+}
+
 static int get_error(const char *errorstring)
 {
 	unsigned int i;
@@ -478,6 +689,133 @@ static void *read_reply(
 	return body;
 }
 
+/*
+ * Try to move the connection to a shared memory ring: pass the daemon the
+ * ring page and the eventfds with a "shmem" control request.  A daemon
+ * which agrees answers over the ring, any other answers over the socket
+ * and we carry on using it.  Returns false if the connection is unusable.
+ */
+static bool xs_shmem_connect(struct xs_handle *h)
+{
+#ifdef XS_SHMEM
+	static const char cmd[] = "shmem";
+	struct xsd_sockmsg hdr = {
+		.type = XS_CONTROL,
+		.len = sizeof(cmd),
+	};
+	struct iovec iov[2] = {
+		{ .iov_base = &hdr, .iov_len = sizeof(hdr) },
+		{ .iov_base = (void *)cmd, .iov_len = sizeof(cmd) },
+	};
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * 4)];
+	} control;
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = ARRAY_SIZE(iov),
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+	struct cmsghdr *cmsg;
+	struct pollfd pfd[2];
+	struct xs_ring *ring;
+	struct stat st;
+	enum xsd_sockmsg_type type;
+	char *reply;
+	int memfd, *fds;
+	ssize_t done;
+	bool ret = true;
+
+	if (fstat(h->fd, &st) || !S_ISSOCK(st.st_mode))
+		return true;
+
+	ring = malloc(sizeof(*ring));
+	if (!ring)
+		return true;
+	ring->intf = NULL;
+	ring->kick_fd = ring->rsp_fd = ring->space_fd = -1;
+
+	memfd = syscall(SYS_memfd_create, "xenstore-ring",
+			MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd < 0)
+		goto out;
+	if (ftruncate(memfd, sizeof(*ring->intf)) ||
+	    fcntl(memfd, F_ADD_SEALS,
+		  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+		goto out;
+	ring->intf = mmap(NULL, sizeof(*ring->intf), PROT_READ | PROT_WRITE,
+			  MAP_SHARED, memfd, 0);
+	if (ring->intf == MAP_FAILED) {
+		ring->intf = NULL;
+		goto out;
+	}
+
+	ring->kick_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	ring->rsp_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	ring->space_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ring->kick_fd < 0 || ring->rsp_fd < 0 || ring->space_fd < 0)
+		goto out;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 4);
+	fds = (int *)CMSG_DATA(cmsg);
+	fds[0] = memfd;
+	fds[1] = ring->kick_fd;
+	fds[2] = ring->rsp_fd;
+	fds[3] = ring->space_fd;
+
+	while ((done = sendmsg(h->fd, &msg, 0)) < 0 && errno == EINTR)
+		continue;
+	if (done < 0)
+		goto fail;
+	if (done < sizeof(hdr) + sizeof(cmd) &&
+	    !xs_write_all(h->fd, (char *)&hdr + done,
+			  sizeof(hdr) + sizeof(cmd) - done))
+		goto fail;
+
+	/* Where does the answer come from? */
+	pfd[0].fd = h->fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = ring->rsp_fd;
+	pfd[1].events = POLLIN;
+	while (poll(pfd, 2, -1) < 0)
+		if (errno != EINTR)
+			goto fail;
+
+	if (!pfd[1].revents) {
+		/* Not supported: consume the error. */
+		reply = read_reply(h, &type, NULL);
+		if (!reply)
+			goto fail;
+		free(reply);
+		goto out;
+	}
+
+	h->ring = ring;
+	ring = NULL;
+	reply = read_reply(h, &type, NULL);
+	if (!reply || type != XS_CONTROL)
+		goto fail;
+	free(reply);
+	goto out;
+
+fail:
+	/* The connection is in an unknown state now. */
+	ret = false;
+out:
+	if (memfd >= 0)
+		close(memfd);
+	if (ring)
+		xs_ring_free(ring);
+	return ret;
+#else
+	return true;
+#endif
+}
+
 /* Send message to xs, get malloc'ed reply.  NULL and set errno on error. */
 static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
 		      enum xsd_sockmsg_type type,
@@ -510,13 +848,15 @@ static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
 
 	mutex_lock(&h->request_mutex);
 
-	if (!xs_write_all(h->fd, &msg, sizeof(msg)))
+	if (!xs_chan_write(h, &msg, sizeof(msg)))
 		goto fail;
 
 	for (i = 0; i < num_vecs; i++)
-		if (!xs_write_all(h->fd, iovec[i].iov_base, iovec[i].iov_len))
+		if (!xs_chan_write(h, iovec[i].iov_base, iovec[i].iov_len))
 			goto fail;
 
+	xs_chan_flush(h);
+
 	ret = read_reply(h, &msg.type, len);
 	if (!ret)
 		goto fail;
@@ -698,6 +1038,311 @@ bool xs_write(struct xs_handle *h, xs_transaction_t t,
 				ARRAY_SIZE(iovec), NULL));
 }
 
+/* Append len bytes at data to the malloced buffer *buf holding *used bytes. */
+static bool buf_append(char **buf, unsigned int *used,
+		       const void *data, unsigned int len)
+{
+	char *n = realloc(*buf, *used + len);
+
+	if (!n)
+		return false;
+	memcpy(n + *used, data, len);
+	*buf = n;
+	*used += len;
+	return true;
+}
+
+/* Did the daemon reject a request type it does not know? */
+static bool xs_unsupported(void)
+{
+	/* C xenstored says ENOSYS, oxenstored EINVAL. */
+	return errno == ENOSYS || errno == EINVAL;
+}
+
+/* Read paths[first..last) with one request each, appending to *vals. */
+static bool xs_read_each(struct xs_handle *h, xs_transaction_t t,
+			 const char *const *paths, unsigned int first,
+			 unsigned int last, char **vals, unsigned int *used,
+			 unsigned int *offs, unsigned int *lens)
+{
+	unsigned int i;
+	char *val;
+
+	for (i = first; i < last; i++) {
+		val = xs_read(h, t, paths[i], &lens[i]);
+		if (!val) {
+			if (h->fd < 0)
+				return false;
+			offs[i] = ~0U;
+			continue;
+		}
+		offs[i] = *used;
+		if (!buf_append(vals, used, val, lens[i] + 1)) {
+			free_no_errno(val);
+			return false;
+		}
+		free(val);
+	}
+	return true;
+}
+
+/* Parse a READ_MULTIPLE reply for paths[first..last), appending to *vals. */
+static bool xs_read_multiple_reply(const char *reply, unsigned int len,
+				   unsigned int first, unsigned int last,
+				   char **vals, unsigned int *used,
+				   unsigned int *offs, unsigned int *lens)
+{
+	unsigned int i, off = 0;
+	const char *hdr, *nul;
+	char *end;
+
+	for (i = first; i < last; i++) {
+		hdr = reply + off;
+		nul = memchr(hdr, 0, len - off);
+		if (!nul)
+			goto bad;
+		off += nul - hdr + 1;
+
+		if (!isdigit((unsigned char)*hdr)) {
+			offs[i] = ~0U;
+			continue;
+		}
+		lens[i] = strtoul(hdr, &end, 10);
+		if (*end || lens[i] > len - off)
+			goto bad;
+		offs[i] = *used;
+		if (!buf_append(vals, used, reply + off, lens[i]) ||
+		    !buf_append(vals, used, "", 1))
+			return false;
+		off += lens[i];
+	}
+	if (off == len)
+		return true;
+
+bad:
+	errno = EBADMSG;
+	return false;
+}
+
+/* Read the values of several nodes, batching them into as few requests as
+ * fit.  Returns a malloced array of num values: call free() on it after
+ * use.  An entry is NULL if the node could not be read, otherwise it is
+ * its nul terminated value and lens[i] its length, not including the nul.
+ * Returns NULL on failure.
+ */
+void **xs_read_multiple(struct xs_handle *h, xs_transaction_t t,
+			const char *const *paths, unsigned int num,
+			unsigned int *lens)
+{
+	struct iovec *iovec;
+	unsigned int i, first, size, len, used = 0, *offs;
+	char *reply, *vals = NULL;
+	void **ret = NULL;
+	bool batch = true;
+
+	iovec = malloc((num + 1) * sizeof(*iovec));
+	offs = malloc((num + 1) * sizeof(*offs));
+	if (!iovec || !offs)
+		goto out;
+
+	for (first = 0; first < num; first = i) {
+		for (i = first, size = 0; i < num; i++) {
+			len = strlen(paths[i]) + 1;
+			if (i > first && size + len > XENSTORE_PAYLOAD_MAX)
+				break;
+			iovec[i].iov_base = (void *)paths[i];
+			iovec[i].iov_len = len;
+			size += len;
+		}
+
+		if (batch) {
+			reply = xs_talkv(h, t, XS_READ_MULTIPLE, &iovec[first],
+					 i - first, &len);
+			if (reply) {
+				if (!xs_read_multiple_reply(reply, len, first,
+							    i, &vals, &used,
+							    offs, lens)) {
+					free_no_errno(reply);
+					goto out;
+				}
+				free(reply);
+				continue;
+			}
+			if (h->fd < 0 ||
+			    (errno != E2BIG && !xs_unsupported()))
+				goto out;
+			/* An old daemon: stop asking. */
+			if (errno != E2BIG)
+				batch = false;
+		}
+
+		/* Values too big for one reply, or an old daemon. */
+		if (!xs_read_each(h, t, paths, first, i, &vals, &used,
+				  offs, lens))
+			goto out;
+	}
+
+	ret = malloc(num * sizeof(*ret) + used);
+	if (!ret)
+		goto out;
+	if (used)
+		memcpy(&ret[num], vals, used);
+	for (i = 0; i < num; i++) {
+		if (offs[i] == ~0U) {
+			ret[i] = NULL;
+			lens[i] = 0;
+		} else
+			ret[i] = (char *)&ret[num] + offs[i];
+	}
+
+out:
+	free_no_errno(iovec);
+	free_no_errno(offs);
+	free_no_errno(vals);
+	return ret;
+}
+
+/* Write several nodes, batching them into as few requests as fit.  The
+ * writes are done in order and stop at the first failure; use a
+ * transaction to make them atomic.  Returns false on failure.
+ */
+bool xs_write_multiple(struct xs_handle *h, xs_transaction_t t,
+		       const char *const *paths, const void *const *data,
+		       const unsigned int *lens, unsigned int num)
+{
+	char *req = NULL, lenstr[MAX_STRLEN(unsigned int) + 1];
+	unsigned int i, first, last, size, reclen;
+	struct iovec iovec;
+	bool batch = true, ret = false;
+
+	for (first = 0; first < num; first = last) {
+		free(req);
+		req = NULL;
+		for (last = first, size = 0; last < num; last++) {
+			snprintf(lenstr, sizeof(lenstr), "%u", lens[last]);
+			reclen = strlen(paths[last]) + strlen(lenstr) + 2 +
+				 lens[last];
+			if (last > first &&
+			    size + reclen > XENSTORE_PAYLOAD_MAX)
+				break;
+			if (!buf_append(&req, &size, paths[last],
+					strlen(paths[last]) + 1) ||
+			    !buf_append(&req, &size, lenstr,
+					strlen(lenstr) + 1) ||
+			    !buf_append(&req, &size, data[last], lens[last]))
+				goto out;
+		}
+
+		if (batch) {
+			iovec.iov_base = req;
+			iovec.iov_len = size;
+			if (xs_bool(xs_talkv(h, t, XS_WRITE_MULTIPLE, &iovec,
+					     1, NULL)))
+				continue;
+			if (h->fd < 0 ||
+			    (errno != E2BIG && !xs_unsupported()))
+				goto out;
+			if (errno != E2BIG)
+				batch = false;
+		}
+
+		/*
+		 * A node too big for one request, an old daemon or a bad
+		 * write in the batch: redo it one node at a time.  Writing a
+		 * node again with the same value at worst fires a spurious
+		 * watch event, which is allowed.
+		 */
+		for (i = first; i < last; i++)
+			if (!xs_write(h, t, paths[i], data[i], lens[i]))
+				goto out;
+	}
+	ret = true;
+
+out:
+	free_no_errno(req);
+	return ret;
+}
+
+/* Join a and b with a '/', leaving it out if a is "" or "/". */
+static char *xs_join_path(const char *a, const char *b)
+{
+	unsigned int alen = strcmp(a, "/") ? strlen(a) : 0;
+	char *p = malloc(alen + strlen(b) + 2);
+
+	if (!p)
+		return NULL;
+	if (alen)
+		sprintf(p, "%s/%s", a, b);
+	else
+		strcpy(p, b);
+	return p;
+}
+
+/* Append the descendants of path, named relative to it with prefix, to the
+ * malloced list *strings holding *len bytes.
+ */
+static bool xs_directory_walk(struct xs_handle *h, xs_transaction_t t,
+			      const char *path, const char *prefix,
+			      char **strings, unsigned int *len)
+{
+	char **children, *child, *rel;
+	unsigned int i, num;
+	bool ok = true;
+
+	children = xs_directory(h, t, path, &num);
+	if (!children)
+		/* Skip what we cannot read, like the daemon does. */
+		return h->fd >= 0 && errno != ENOMEM;
+
+	for (i = 0; ok && i < num; i++) {
+		rel = xs_join_path(prefix, children[i]);
+		child = rel ? xs_join_path(path, children[i]) : NULL;
+		if (!child) {
+			free(rel);
+			ok = false;
+			break;
+		}
+		ok = buf_append(strings, len, rel, strlen(rel) + 1) &&
+		     xs_directory_walk(h, t, child, rel, strings, len);
+		free_no_errno(child);
+		free_no_errno(rel);
+	}
+
+	free_no_errno(children);
+	return ok;
+}
+
+/* Get the paths of all the nodes below path, relative to it, parents before
+ * their children.  Returns a malloced array: call free() on it after use.
+ * Nodes below one which cannot be read are left out.  Num indicates size.
+ */
+char **xs_directory_recursive(struct xs_handle *h, xs_transaction_t t,
+			      const char *path, unsigned int *num)
+{
+	char *strings, **children;
+	unsigned int len;
+
+	strings = xs_single(h, t, XS_DIRECTORY_RECURSIVE, path, &len);
+	if (strings)
+		return xs_directory_common(strings, len, num);
+	if (h->fd < 0 || (errno != E2BIG && !xs_unsupported()))
+		return NULL;
+
+	/* Too many for one reply, or an old daemon: walk the tree. */
+	children = xs_directory(h, t, path, num);
+	if (!children)
+		return NULL;
+	free(children);
+
+	strings = NULL;
+	len = 0;
+	if (!xs_directory_walk(h, t, path, "", &strings, &len)) {
+		free_no_errno(strings);
+		return NULL;
+	}
+	return xs_directory_common(strings, len, num);
+}
+
 /* Create a new directory.
  * Returns false on failure, or success if it already exists.
  */
@@ -1228,7 +1873,7 @@ static int read_message(struct xs_handle *h, int nonblocking)
 	if (msg == NULL)
 		goto error;
 	cleanup_push_heap(msg);
-	if (!read_all(h->fd, &msg->hdr, sizeof(msg->hdr), nonblocking)) { /* Cancellation point */
+	if (!xs_chan_read(h, &msg->hdr, sizeof(msg->hdr), nonblocking)) { /* Cancellation point */
 		saved_errno = errno;
 		goto error_freemsg;
 	}
@@ -1244,7 +1889,7 @@ static int read_message(struct xs_handle *h, int nonblocking)
 	if (body == NULL)
 		goto error_freemsg;
 	cleanup_push_heap(body);
-	if (!read_all(h->fd, body, msg->hdr.len, 0)) { /* Cancellation point */
+	if (!xs_chan_read(h, body, msg->hdr.len, 0)) { /* Cancellation point */
 		saved_errno = errno;
 		goto error_freebody;
 	}
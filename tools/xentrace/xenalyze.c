@@ -63,6 +63,8 @@ struct array_struct {
         }                                         \
     } while(0)                                    \
 
+struct index_window;
+
 /* -- Global variables -- */
 struct {
     int fd;
@@ -72,6 +74,14 @@ struct {
     char * trace_file;
     int output_defined;
     off_t file_size;
+    struct {
+        struct index_window *w;
+        int *next;              /* Next window of the same cpu, or -1 */
+        int nr;
+        int truncated;
+        off_t last_epoch_offset;
+        tsc_t first_tsc, start_tsc, end_tsc;
+    } index;
     struct {
         off_t update_offset;
         int pipe[2];
@@ -180,6 +190,8 @@ struct {
         summary:1,
         report_pcpu:1,
         tsc_loop_fatal:1,
+        index:1,
+        time_window:1,
         summary_info;
     long long cpu_qhz, cpu_hz;
     int scatterplot_interrupt_vector;
@@ -222,6 +234,10 @@ struct {
         };
         int count;
     } interval;
+    struct {
+        /* Seconds; converted to cycles once the index is loaded */
+        double start, end;
+    } window;
 } opt = {
     .scatterplot_interrupt_eip=0,
     .scatterplot_unpin_promote=0,
@@ -253,6 +269,8 @@ struct {
     .summary = 0,
     .report_pcpu = 0,
     .tsc_loop_fatal = 0,
+    .index = 0,
+    .time_window = 0,
     .cpu_hz = DEFAULT_CPU_HZ,
     /* Pre-calculate a multiplier that makes the rest of the
      * calculations easier */
@@ -8971,6 +8989,294 @@ struct cpu_change_data {
     unsigned window_size;
 };
 
+/* -- Window index -- */
+
+/*
+ * Every buffer window xentrace writes starts with a cpu_change record
+ * giving the cpu and the window size.  Without an index each pcpu
+ * finds its next window by reading every cpu_change record in the
+ * file, so a trace from n cpus has its headers read n times over.  The
+ * index records every window once, so a pcpu can go straight from one
+ * of its windows to the next, and a time window can be started without
+ * reading what comes before it.  It is saved next to the trace and
+ * reused while the trace's size and mtime are unchanged.
+ */
+#define INDEX_MAGIC    0x78646978 /* "xidx" */
+#define INDEX_VERSION  1
+#define INDEX_SUFFIX   ".xenalyze-index"
+
+struct index_header {
+    uint32_t magic, version;
+    uint64_t file_size;
+    int64_t file_mtime;
+    uint64_t last_epoch_offset;
+    uint32_t nr_windows;
+    uint32_t truncated;
+};
+
+struct index_window {
+    uint64_t offset;    /* Of the cpu_change record */
+    uint64_t first_tsc; /* 0 if the first record has no tsc */
+    uint32_t cpu;
+    uint32_t size;      /* Bytes of records after the cpu_change record */
+};
+
+static int index_build(void)
+{
+    struct trace_record rec;
+    struct cpu_change_data *cd;
+    struct index_window *w;
+    off_t offset = 0;
+    ssize_t r;
+    int last_cpu = -1, max = 0;
+
+    fprintf(warn, "%s: indexing %s\n", __func__, G.trace_file);
+
+    while ( (r = __read_record(&rec, offset)) )
+    {
+        if ( rec.event != TRC_TRACE_CPU_CHANGE || rec.cycle_flag )
+        {
+            fprintf(warn, "%s: unexpected record event %x at offset %llx, "
+                    "indexing stopped\n", __func__, rec.event,
+                    (unsigned long long)offset);
+            G.index.truncated = 1;
+            break;
+        }
+
+        cd = (typeof(cd))rec.u.notsc.data;
+
+        if ( cd->cpu >= MAX_CPUS )
+        {
+            fprintf(stderr, "%s: cpu %d exceeds MAX_CPU %d!\n",
+                    __func__, cd->cpu, MAX_CPUS);
+            return -1;
+        }
+
+        if ( offset + r + cd->window_size > G.file_size )
+        {
+            G.index.truncated = 1;
+            break;
+        }
+
+        if ( G.index.nr == max )
+        {
+            max = max ? max * 2 : 4096;
+            w = realloc(G.index.w, max * sizeof(*w));
+            if ( !w )
+            {
+                fprintf(stderr, "%s: out of memory\n", __func__);
+                error(ERR_SYSTEM, NULL);
+            }
+            G.index.w = w;
+        }
+
+        w = G.index.w + G.index.nr++;
+        w->offset = offset;
+        w->cpu = cd->cpu;
+        w->size = cd->window_size;
+        w->first_tsc = 0;
+
+        /* Same test process_cpu_change() uses for a new epoch */
+        if ( last_cpu > cd->cpu )
+            G.index.last_epoch_offset = offset;
+        last_cpu = cd->cpu;
+
+        /* Reading the first record reuses rec, and so cd */
+        offset += r;
+        if ( w->size && __read_record(&rec, offset) && rec.cycle_flag )
+            w->first_tsc = (((tsc_t)rec.u.tsc.tsc_hi) << 32)
+                | rec.u.tsc.tsc_lo;
+        offset += w->size;
+    }
+
+    return 0;
+}
+
+static int index_load(const char *path, const struct stat *s)
+{
+    struct index_header h;
+    FILE *f;
+    int ret = -1;
+
+    if ( !(f = fopen(path, "r")) )
+        return -1;
+
+    if ( fread(&h, sizeof(h), 1, f) != 1
+         || h.magic != INDEX_MAGIC || h.version != INDEX_VERSION
+         || h.file_size != s->st_size || h.file_mtime != s->st_mtime )
+        goto out;
+
+    G.index.w = malloc(h.nr_windows * sizeof(*G.index.w));
+    if ( !G.index.w )
+        goto out;
+
+    if ( fread(G.index.w, sizeof(*G.index.w), h.nr_windows, f)
+         != h.nr_windows )
+    {
+        free(G.index.w);
+        G.index.w = NULL;
+        goto out;
+    }
+
+    G.index.nr = h.nr_windows;
+    G.index.truncated = h.truncated;
+    G.index.last_epoch_offset = h.last_epoch_offset;
+    ret = 0;
+
+ out:
+    fclose(f);
+    return ret;
+}
+
+static void index_save(const char *path, const struct stat *s)
+{
+    struct index_header h = {
+        .magic = INDEX_MAGIC,
+        .version = INDEX_VERSION,
+        .file_size = s->st_size,
+        .file_mtime = s->st_mtime,
+        .last_epoch_offset = G.index.last_epoch_offset,
+        .nr_windows = G.index.nr,
+        .truncated = G.index.truncated,
+    };
+    FILE *f;
+
+    /* The index only saves time; not being able to keep it is fine. */
+    if ( !(f = fopen(path, "w")) )
+    {
+        fprintf(warn, "%s: cannot create %s: %s\n",
+                __func__, path, strerror(errno));
+        return;
+    }
+
+    if ( fwrite(&h, sizeof(h), 1, f) != 1
+         || fwrite(G.index.w, sizeof(*G.index.w), G.index.nr, f)
+            != G.index.nr )
+    {
+        fprintf(warn, "%s: cannot write %s\n", __func__, path);
+        fclose(f);
+        unlink(path);
+        return;
+    }
+
+    fclose(f);
+}
+
+void index_init(void)
+{
+    int i, *last;
+    char *path;
+    struct stat s;
+
+    if ( fstat(G.fd, &s) )
+    {
+        perror("fstat");
+        error(ERR_SYSTEM, NULL);
+    }
+
+    path = malloc(strlen(G.trace_file) + sizeof(INDEX_SUFFIX));
+    if ( !path )
+        error(ERR_SYSTEM, NULL);
+    sprintf(path, "%s" INDEX_SUFFIX, G.trace_file);
+
+    if ( index_load(path, &s) == 0 )
+        fprintf(warn, "%s: using %s\n", __func__, path);
+    else
+    {
+        if ( index_build() )
+            error(ERR_ASSERT, NULL);
+        index_save(path, &s);
+    }
+
+    free(path);
+
+    G.index.next = malloc(G.index.nr * sizeof(*G.index.next));
+    last = malloc(MAX_CPUS * sizeof(*last));
+    if ( (G.index.nr && !G.index.next) || !last )
+        error(ERR_SYSTEM, NULL);
+
+    for ( i = 0; i < MAX_CPUS; i++ )
+        last[i] = -1;
+
+    for ( i = G.index.nr - 1; i >= 0; i-- )
+    {
+        struct index_window *w = G.index.w + i;
+
+        G.index.next[i] = last[w->cpu];
+        last[w->cpu] = i;
+
+        if ( w->first_tsc &&
+             (!G.index.first_tsc || w->first_tsc < G.index.first_tsc) )
+            G.index.first_tsc = w->first_tsc;
+    }
+
+    free(last);
+
+    if ( opt.time_window )
+    {
+        G.index.start_tsc = G.index.first_tsc
+            + (tsc_t)(opt.window.start * opt.cpu_hz);
+        if ( opt.window.end )
+            G.index.end_tsc = G.index.first_tsc
+                + (tsc_t)(opt.window.end * opt.cpu_hz);
+    }
+
+    fprintf(warn, "%s: %d windows%s\n", __func__, G.index.nr,
+            G.index.truncated ? ", trace truncated" : "");
+}
+
+/* Window starting at @offset, or -1 if it isn't one */
+static int index_find(off_t offset)
+{
+    int lo = 0, hi = G.index.nr - 1;
+
+    while ( lo <= hi )
+    {
+        int mid = lo + (hi - lo) / 2;
+
+        if ( G.index.w[mid].offset == offset )
+            return mid;
+        if ( G.index.w[mid].offset < offset )
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    return -1;
+}
+
+/*
+ * Offset of @cpu's next window after the one at @offset, or -1 if
+ * @offset is not an indexed window.  With no later window, return the
+ * offset the cpu_change walk would have ended at: end of file, or just
+ * past it if the last window is truncated so early_eof kicks in.
+ */
+off_t index_next_window(int cpu, off_t offset)
+{
+    int i = index_find(offset), j;
+
+    if ( i < 0 )
+        return -1;
+
+    /*
+     * We get here from the window just after one of our own, so the
+     * chain of our windows is normally picked up at i - 1.
+     */
+    for ( j = i - 1; j >= 0 && G.index.w[j].cpu != cpu; j-- )
+        ;
+
+    if ( j >= 0 )
+        j = G.index.next[j];
+    else
+        for ( j = i; j < G.index.nr && G.index.w[j].cpu != cpu; j++ )
+            ;
+
+    if ( j >= 0 && j < G.index.nr )
+        return G.index.w[j].offset;
+
+    return G.index.truncated ? G.file_size + 1 : G.file_size;
+}
+
 void activate_early_eof(void) {
     struct pcpu_info *p;
     int i;
@@ -9273,7 +9579,15 @@ void process_cpu_change(struct pcpu_info *p) {
     /* If this isn't the cpu we're looking for, skip the whole bunch */
     if(p->pid != r->cpu)
     {
-        p->file_offset += ri->size + r->window_size;
+        off_t next = -1;
+
+        if ( opt.index )
+            next = index_next_window(p->pid, p->file_offset);
+
+        if ( next >= 0 )
+            p->file_offset = next;
+        else
+            p->file_offset += ri->size + r->window_size;
         p->next_cpu_change_offset = p->file_offset;
 
         if(p->file_offset > G.file_size) {
@@ -9339,7 +9653,8 @@ void process_cpu_change(struct pcpu_info *p) {
 
         if(p->next_cpu_change_offset > G.file_size)
             activate_early_eof();
-        else if(p->pid == P.max_active_pcpu)
+        else if(p->pid == P.max_active_pcpu && !opt.index)
+            /* With the index every pcpu was activated up front */
             scan_for_new_pcpu(p->next_cpu_change_offset);
 
     }
@@ -9827,6 +10142,10 @@ struct pcpu_info * choose_next_record(void)
 
     min_p=record_order[0];
 
+    /* Past the end of the requested time window */
+    if(min_p && G.index.end_tsc && min_p->order_tsc > G.index.end_tsc)
+        return NULL;
+
     if(opt.progress && min_p && min_p->file_offset >= G.progress.update_offset)
         progress_update(min_p->file_offset);
 
@@ -9981,6 +10300,34 @@ void init_pcpus(void) {
 
     sched_default_domain_init();
 
+    if ( opt.index )
+    {
+        int start[MAX_CPUS];
+
+        for(i=0; i<MAX_CPUS; i++)
+            start[i] = -1;
+
+        /*
+         * Start each pcpu at its first window, or with a time window at
+         * its last window starting no later than the start time.
+         */
+        for(i=0; i<G.index.nr; i++)
+        {
+            struct index_window *w = G.index.w + i;
+
+            if ( start[w->cpu] < 0
+                 || (w->first_tsc && w->first_tsc <= G.index.start_tsc) )
+                start[w->cpu] = i;
+        }
+
+        for(i=0; i<MAX_CPUS; i++)
+            if ( start[i] >= 0 )
+                scan_for_new_pcpu(G.index.w[start[i]].offset);
+
+        P.last_epoch_offset = G.index.last_epoch_offset;
+        return;
+    }
+
     /* Scan through the cpu_change recs until we see a duplicate */
     do {
         offset = scan_for_new_pcpu(offset);
@@ -10046,6 +10393,8 @@ enum {
     OPT_PROGRESS,
     OPT_TOLERANCE,
     OPT_TSC_LOOP_FATAL,
+    OPT_INDEX,
+    OPT_TIME_WINDOW,
     /* Specific letters */
     OPT_DUMP_ALL='a',
     OPT_INTERVAL_LENGTH='i',
@@ -10526,6 +10875,39 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
         opt.tsc_loop_fatal = 1;
         break;
 
+    case OPT_INDEX:
+        opt.index = 1;
+        break;
+
+    case OPT_TIME_WINDOW:
+    {
+        char * inval;
+        double start, end = 0;
+
+        start = strtod(arg, &inval);
+        if ( inval == arg )
+            argp_usage(state);
+
+        if ( *inval == ',' )
+        {
+            char * endp = inval + 1;
+
+            end = strtod(endp, &inval);
+            if ( inval == endp || end <= start )
+                argp_usage(state);
+        }
+
+        if ( *inval != '\0' || start < 0 )
+            argp_usage(state);
+
+        opt.window.start = start;
+        opt.window.end = end;
+        opt.time_window = 1;
+        /* Seeking to the start needs the index */
+        opt.index = 1;
+    }
+    break;
+
     case ARGP_KEY_ARG:
     {
         /* FIXME - strcpy */
@@ -10815,6 +11197,19 @@ const struct argp_option cmd_opts[] =  {
       .key = OPT_TSC_LOOP_FATAL,
       .doc = "Stop processing and exit if tsc skew tracking detects a dependency loop.", },
 
+    { .name = "index",
+      .key = OPT_INDEX,
+      .doc = "Index the buffer windows of the trace, so each pcpu seeks straight to its own " \
+      "data rather than reading every other pcpu's.  The index is kept in " \
+      "[trace file]" INDEX_SUFFIX " and reused while the trace is unchanged.", },
+
+    { .name = "time-window",
+      .key = OPT_TIME_WINDOW,
+      .arg = "start[,end]",
+      .doc = "Only process the part of the trace from start to end seconds after the first " \
+      "record, seeking directly to start.  Processing begins at the buffer window " \
+      "containing start, and reported times are relative to it.  Implies --index.", },
+
     { .name = "tolerance",
       .key = OPT_TOLERANCE,
       .arg = "errlevel",
@@ -10861,6 +11256,9 @@ int main(int argc, char *argv[]) {
     if(opt.dump_all)
         warn = stdout;
 
+    if(opt.index)
+        index_init();
+
     init_pcpus();
 
     if(opt.progress)
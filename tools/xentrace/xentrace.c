@@ -25,7 +25,11 @@
 #include <assert.h>
 #include <ctype.h>
 #include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
 #include <sys/statvfs.h>
+#include <sys/uio.h>
+#include <zlib.h>
 
 #include <xen/xen.h>
 #include <xen/trace.h>
@@ -49,12 +53,20 @@ do {                                                            \
 #define POLL_SLEEP_MILLIS 100
 
 #define DEFAULT_TBUF_SIZE 32
+
+/* size of the staging buffer for compressed output */
+#define ZBUF_SIZE (64 * 1024)
 /***** The code **************************************************************/
 
 typedef struct settings_st {
     char *outfile;
+    char *sink;               /* host:port to stream to instead of a file */
     unsigned long poll_sleep; /* milliseconds to sleep between polls */
     uint32_t evt_mask;
+    unsigned int nr_evt_filters;
+    uint32_t filter_event[XEN_SYSCTL_TBUF_NR_EVT_FILTERS];
+    uint32_t filter_mask[XEN_SYSCTL_TBUF_NR_EVT_FILTERS];
+    long domid;
     char *cpu_mask_str;
     unsigned long tbuf_size;
     unsigned long disk_rsvd;
@@ -62,7 +74,8 @@ typedef struct settings_st {
     unsigned long memory_buffer;
     uint8_t discard:1,
         disable_tracing:1,
-        start_disabled:1;
+        start_disabled:1,
+        compress:1;
 } settings_t;
 
 struct t_struct {
@@ -80,11 +93,136 @@ static xenevtchn_handle *xce_handle = NULL;
 static int virq_port = -1;
 static int outfd = 1;
 
+static z_stream zout;               /* deflate state with --compress */
+static unsigned char *zbuf;
+static int out_pending;             /* data since the last out_flush() */
+
 static void close_handler(int signal)
 {
     interrupted = 1;
 }
 
+static void writev_exact(struct iovec *iov, int iovcnt)
+{
+    ssize_t n;
+
+    while ( iovcnt )
+    {
+        n = writev(outfd, iov, iovcnt);
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            PERROR("Failed to write trace data");
+            exit(EXIT_FAILURE);
+        }
+
+        /* Sockets and pipes may take less than asked for. */
+        for ( ; iovcnt && n >= iov->iov_len; iov++, iovcnt-- )
+            n -= iov->iov_len;
+        if ( iovcnt )
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+static void out_deflate(void *buf, size_t len, int flush)
+{
+    struct iovec iov;
+    int rc;
+
+    zout.next_in = buf;
+    zout.avail_in = len;
+
+    do {
+        zout.next_out = zbuf;
+        zout.avail_out = ZBUF_SIZE;
+
+        rc = deflate(&zout, flush);
+        if ( rc == Z_STREAM_ERROR )
+        {
+            fprintf(stderr, "Compression failed: %s\n",
+                    zout.msg ? : "stream error");
+            exit(EXIT_FAILURE);
+        }
+
+        iov.iov_base = zbuf;
+        iov.iov_len = ZBUF_SIZE - zout.avail_out;
+        writev_exact(&iov, 1);
+    } while ( zout.avail_out == 0 );
+}
+
+/*
+ * All trace output goes through here.  Without compression the iovecs
+ * point straight into the mapped trace buffers (or the memory buffer),
+ * so a window reaches the file or socket without being copied in user
+ * space.  With compression, deflate reads from the same place.
+ */
+static void out_writev(struct iovec *iov, int iovcnt)
+{
+    int i;
+
+    if ( !opts.compress )
+    {
+        writev_exact(iov, iovcnt);
+        return;
+    }
+
+    for ( i = 0; i < iovcnt; i++ )
+        out_deflate(iov[i].iov_base, iov[i].iov_len, Z_NO_FLUSH);
+    out_pending = 1;
+}
+
+/*
+ * Push out whatever deflate is holding back, so that a consumer on the
+ * other end of a pipe or socket sees every pass without waiting for
+ * the stream to end.
+ */
+static void out_flush(void)
+{
+    if ( opts.compress && out_pending )
+    {
+        out_deflate(NULL, 0, Z_SYNC_FLUSH);
+        out_pending = 0;
+    }
+}
+
+static void out_init(void)
+{
+    if ( !opts.compress )
+        return;
+
+    zbuf = malloc(ZBUF_SIZE);
+    if ( !zbuf )
+    {
+        fprintf(stderr, "%s: Couldn't allocate compression buffer\n",
+                __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    /* gzip framing so the output can be read back with zcat. */
+    if ( deflateInit2(&zout, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8,
+                      Z_DEFAULT_STRATEGY) != Z_OK )
+    {
+        fprintf(stderr, "%s: Couldn't initialise compression\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void out_close(void)
+{
+    if ( opts.compress )
+    {
+        out_deflate(NULL, 0, Z_FINISH);
+        deflateEnd(&zout);
+        free(zbuf);
+    }
+
+    close(outfd);
+}
+
 static struct {
     char * buf;
     unsigned long prod, cons, size;
@@ -280,93 +418,67 @@ void membuf_write(void *start, unsigned long size) {
 
 void membuf_dump(void) {
     /* Dump circular memory buffer */
-    int cons, prod, wsize, written;
-    char * wstart;
+    unsigned long cons, prod;
+    struct iovec iov[2];
 
     fprintf(stderr, "Dumping memory buffer.\n");
 
     cons = membuf.cons % membuf.size; 
     prod = membuf.prod % membuf.size;
-   
-    if(prod > cons)
-    {
-        /* Write in one go */
-        wstart = membuf.buf + cons;
-        wsize = prod - cons;
 
-        written = write(outfd, wstart, wsize);
-        if ( written != wsize )
-            goto fail;
+    /* Write in one go, or in two pieces: cons->end, beginning->prod. */
+    iov[0].iov_base = membuf.buf + cons;
+    iov[1].iov_base = membuf.buf;
+    if ( prod > cons )
+    {
+        iov[0].iov_len = prod - cons;
+        iov[1].iov_len = 0;
     }
     else
     {
-        /* Write in two pieces: cons->end, beginning->prod. */
-        wstart = membuf.buf + cons;
-        wsize = membuf.size - cons;
-
-        written = write(outfd, wstart, wsize);
-        if ( written != wsize )
-        {
-            fprintf(stderr, "Write failed! (size %d, returned %d)\n",
-                    wsize, written);
-            goto fail;
-        }
-
-        wstart = membuf.buf;
-        wsize = prod;
-
-        written = write(outfd, wstart, wsize);
-        if ( written != wsize )
-        {
-            fprintf(stderr, "Write failed! (size %d, returned %d)\n",
-                    wsize, written);
-            goto fail;
-        }
+        iov[0].iov_len = membuf.size - cons;
+        iov[1].iov_len = prod;
     }
 
+    out_writev(iov, 2);
+
     membuf.cons = membuf.prod = 0;
-    
-    return;
-fail:
-    exit(1);
-    return;
 }
 
 /**
- * write_buffer - write a section of the trace buffer
- * @cpu      - source buffer CPU ID
- * @start
- * @size     - size of write (may be less than total window size)
- * @total_size - total size of the window (0 on 2nd write of wrapped windows)
- * @out      - output stream
+ * write_window - write a window of a trace buffer
+ * @cpu       - source buffer CPU ID
+ * @start     - start of the window
+ * @size      - bytes at @start
+ * @wrap      - start of the buffer, when the window wraps
+ * @wrap_size - bytes at @wrap (0 if the window does not wrap)
  *
- * Outputs the trace buffer to a filestream, prepending the CPU and size
- * of the buffer write.
+ * Outputs the window, prepending the CPU and size of the buffer write.
+ * Record, window and wrapped tail go out in a single writev() taken
+ * directly from the mapped buffer.
  */
-static void write_buffer(unsigned int cpu, unsigned char *start, int size,
-                         int total_size)
+static void write_window(unsigned int cpu, unsigned char *start,
+                         unsigned long size, unsigned char *wrap,
+                         unsigned long wrap_size)
 {
+    unsigned long total_size = size + wrap_size;
+    struct cpu_change_record rec;
+    struct iovec iov[3];
     struct statvfs stat;
-    size_t written = 0;
-    
-    if ( opts.memory_buffer == 0 && opts.disk_rsvd != 0 )
+
+    if ( opts.memory_buffer == 0 && opts.disk_rsvd != 0 && !opts.sink )
     {
         unsigned long long freespace;
 
         /* Check that filesystem has enough space. */
         if ( fstatvfs (outfd, &stat) )
         {
-            fprintf(stderr, "Statfs failed!\n");
-            goto fail;
+            PERROR("Statfs failed");
+            exit(EXIT_FAILURE);
         }
 
         freespace = stat.f_frsize * (unsigned long long)stat.f_bfree;
-
-        if ( total_size )
-            freespace -= total_size;
-        else
-            freespace -= size;
-
+        freespace -= total_size;
         freespace >>= 20; /* Convert to MB */
 
         if ( freespace <= opts.disk_rsvd )
@@ -376,53 +488,28 @@ static void write_buffer(unsigned int cpu, unsigned char *start, int size,
         }
     }
 
-    /* Write a CPU_BUF record on each buffer "window" written.  Wrapped
-     * windows may involve two writes, so only write the record on the
-     * first write. */
-    if ( total_size != 0 )
-    {
-        if ( opts.memory_buffer )
-        {
-            membuf_reserve_window(cpu, total_size);
-        }
-        else
-        {
-            struct cpu_change_record rec;
-
-            rec.header = CPU_CHANGE_HEADER;
-            rec.data.cpu = cpu;
-            rec.data.window_size = total_size;
-
-            written = write(outfd, &rec, sizeof(rec));
-            if ( written != sizeof(rec) )
-            {
-                fprintf(stderr, "Cannot write cpu change (write returned %zd)\n",
-                        written);
-                goto fail;
-            }
-        }
-    }
-
     if ( opts.memory_buffer )
     {
+        membuf_reserve_window(cpu, total_size);
         membuf_write(start, size);
-    }
-    else
-    {
-        written = write(outfd, start, size);
-        if ( written != size )
-        {
-            fprintf(stderr, "Write failed! (size %d, returned %zd)\n",
-                    size, written);
-            goto fail;
-        }
+        if ( wrap_size )
+            membuf_write(wrap, wrap_size);
+        return;
     }
 
-    return;
+    /* Write a CPU_BUF record on each buffer "window" written. */
+    rec.header = CPU_CHANGE_HEADER;
+    rec.data.cpu = cpu;
+    rec.data.window_size = total_size;
 
-fail:
-    PERROR("Failed to write trace data");
-    exit(EXIT_FAILURE);
+    iov[0].iov_base = &rec;
+    iov[0].iov_len = sizeof(rec);
+    iov[1].iov_base = start;
+    iov[1].iov_len = size;
+    iov[2].iov_base = wrap;
+    iov[2].iov_len = wrap_size;
+
+    out_writev(iov, wrap_size ? 3 : 2);
 }
 
 static void disable_tbufs(void)
@@ -578,6 +665,27 @@ static void set_evt_mask(uint32_t mask)
     }
 }
 
+/**
+ * set_filters - set the event and domain filters in HV
+ */
+static void set_filters(void)
+{
+    if ( opts.nr_evt_filters &&
+         xc_tbuf_set_evt_filter(xc_handle, opts.nr_evt_filters,
+                                opts.filter_event, opts.filter_mask) )
+    {
+        PERROR("Failure to set the trace event filters");
+        exit(EXIT_FAILURE);
+    }
+
+    if ( opts.domid >= 0 &&
+         xc_tbuf_set_dom_filter(xc_handle, opts.domid) )
+    {
+        PERROR("Failure to set the trace domain filter");
+        exit(EXIT_FAILURE);
+    }
+}
+
 /**
  * get_num_cpus - get the number of logical CPUs
  */
@@ -737,22 +845,16 @@ static int monitor_tbufs(void)
             if ( end_offset > start_offset )
             {
                 /* If window does not wrap, write in one big chunk */
-                write_buffer(i, data[i]+start_offset,
-                             window_size,
-                             window_size);
+                write_window(i, data[i] + start_offset, window_size,
+                             NULL, 0);
             }
             else
             {
-                /* If wrapped, write in two chunks:
-                 * - first, start to the end of the buffer
-                 * - second, start of buffer to end of window
-                 */
-                write_buffer(i, data[i] + start_offset,
+                /* If wrapped, write start to the end of the buffer,
+                 * then start of buffer to end of window. */
+                write_window(i, data[i] + start_offset,
                              data_size - start_offset,
-                             window_size);
-                write_buffer(i, data[i],
-                             end_offset,
-                             0);
+                             data[i], end_offset);
             }
 
             xen_mb(); /* read buffer, then update cons. */
@@ -760,6 +862,8 @@ static int monitor_tbufs(void)
 
         }
 
+        out_flush();
+
         if ( interrupted )
         {
             if ( last_read )
@@ -784,7 +888,7 @@ static int monitor_tbufs(void)
     free(meta);
     free(data);
     /* don't need to munmap - cleanup is automatic */
-    close(outfd);
+    out_close();
 
     return 0;
 }
@@ -804,11 +908,17 @@ static void usage(void)
 {
 #define USAGE_STR \
 "Usage: xentrace [OPTION...] [output file]\n" \
+"       xentrace [OPTION...] --connect=host:port\n" \
 "Tool to capture Xen trace buffer data\n" \
 "\n" \
 "  -c, --cpu-mask=c        Set cpu-mask, using either hex, CPU ranges, or\n" \
 "                          for all CPUs\n" \
 "  -e, --evt-mask=e        Set evt-mask\n" \
+"  -f, --evt-filter=id[/m] Only trace events whose id, masked with m\n" \
+"                          (default all ones), equals id.  May be given\n" \
+"                          up to " xstr(XEN_SYSCTL_TBUF_NR_EVT_FILTERS) \
+                           " times; events matching any are traced.\n" \
+"  -d, --domid=d           Only trace events raised while domain d runs.\n" \
 "  -s, --poll-sleep=p      Set sleep time, p, in milliseconds between\n" \
 "                          polling the trace buffer for new data\n" \
 "                          (default " xstr(POLL_SLEEP_MILLIS) ").\n" \
@@ -835,6 +945,10 @@ static void usage(void)
 "  -r  --reserve-disk-space=n Before writing trace records to disk, check to see\n" \
 "                          that after the write there will be at least n space\n" \
 "                          left on the disk.\n" \
+"  -z, --compress          Write a gzip compressed stream, flushed after\n" \
+"                          every poll so it can be read while running.\n" \
+"  -N, --connect=host:port Stream trace data over TCP to host:port instead\n" \
+"                          of writing to a file.\n" \
 "\n" \
 "This tool is used to capture trace buffer data from Xen. The\n" \
 "data is output in a binary format, in the following order:\n" \
@@ -919,6 +1033,28 @@ static long argtol(const char *restrict arg, int base)
     return val;
 }
 
+static void parse_evtfilter(char *arg)
+{
+    char *slash = strchr(arg, '/');
+    unsigned int i = opts.nr_evt_filters;
+
+    if ( i == XEN_SYSCTL_TBUF_NR_EVT_FILTERS )
+    {
+        fprintf(stderr, "At most %u event filters\n\n",
+                XEN_SYSCTL_TBUF_NR_EVT_FILTERS);
+        usage();
+    }
+
+    opts.filter_mask[i] = ~0U;
+    if ( slash )
+    {
+        *slash = '\0';
+        opts.filter_mask[i] = argtol(slash + 1, 0);
+    }
+    opts.filter_event[i] = argtol(arg, 0);
+    opts.nr_evt_filters++;
+}
+
 static int parse_evtmask(char *arg)
 {
     /* search filtering class */
@@ -1076,11 +1212,15 @@ static void parse_args(int argc, char **argv)
         { "poll-sleep",     required_argument, 0, 's' },
         { "cpu-mask",       required_argument, 0, 'c' },
         { "evt-mask",       required_argument, 0, 'e' },
+        { "evt-filter",     required_argument, 0, 'f' },
+        { "domid",          required_argument, 0, 'd' },
         { "trace-buf-size", required_argument, 0, 'S' },
         { "reserve-disk-space", required_argument, 0, 'r' },
         { "time-interval",  required_argument, 0, 'T' },
         { "memory-buffer",  required_argument, 0, 'M' },
         { "discard-buffers", no_argument,      0, 'D' },
+        { "compress",       no_argument,       0, 'z' },
+        { "connect",        required_argument, 0, 'N' },
         { "dont-disable-tracing", no_argument, 0, 'x' },
         { "start-disabled", no_argument,       0, 'X' },
         { "help",           no_argument,       0, '?' },
@@ -1088,7 +1228,7 @@ static void parse_args(int argc, char **argv)
         { 0, 0, 0, 0 }
     };
 
-    while ( (option = getopt_long(argc, argv, "t:s:c:e:S:r:T:M:DxX?V",
+    while ( (option = getopt_long(argc, argv, "t:s:c:e:f:d:S:r:T:M:N:DzxX?V",
                     long_options, NULL)) != -1) 
     {
         switch ( option )
@@ -1103,6 +1243,12 @@ static void parse_args(int argc, char **argv)
         case 'e': /* set new event mask for filtering*/
             parse_evtmask(optarg);
             break;
+        case 'f': /* add an event id filter */
+            parse_evtfilter(optarg);
+            break;
+        case 'd': /* only trace while this domain runs */
+            opts.domid = argtol(optarg, 0);
+            break;
         
         case 'S': /* set tbuf size (given in pages) */
             opts.tbuf_size = argtol(optarg, 0);
@@ -1137,18 +1283,82 @@ static void parse_args(int argc, char **argv)
             opts.memory_buffer = sargtol(optarg, 0);
             break;
 
+        case 'z': /* gzip the output stream */
+            opts.compress = 1;
+            break;
+
+        case 'N': /* stream to a collector */
+            opts.sink = strdup(optarg);
+            break;
+
         default:
             usage();
         }
     }
 
-    /* get outfile (required last argument) */
+    /* get outfile (required last argument, unless streaming) */
+    if ( opts.sink )
+    {
+        if ( optind != argc )
+            usage();
+        return;
+    }
+
     if (optind != (argc-1))
         usage();
 
     opts.outfile = argv[optind];
 }
 
+/* open a TCP connection to the host:port given with --connect */
+static int open_sink(const char *spec)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC,
+                              .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res, *ai;
+    char *host, *port;
+    int fd = -1, rc;
+
+    host = strdup(spec);
+    port = host ? strrchr(host, ':') : NULL;
+    if ( !port )
+    {
+        fprintf(stderr, "Invalid sink %s, expected host:port\n", spec);
+        exit(EXIT_FAILURE);
+    }
+    *port++ = '\0';
+
+    /* Allow [addr]:port for IPv6 literals. */
+    if ( host[0] == '[' && port[-2] == ']' )
+    {
+        port[-2] = '\0';
+        memmove(host, host + 1, strlen(host));
+    }
+
+    rc = getaddrinfo(host, port, &hints, &res);
+    if ( rc )
+    {
+        fprintf(stderr, "Cannot resolve %s: %s\n", spec, gai_strerror(rc));
+        exit(EXIT_FAILURE);
+    }
+
+    for ( ai = res; ai; ai = ai->ai_next )
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if ( fd < 0 )
+            continue;
+        if ( connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 )
+            break;
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+    free(host);
+
+    return fd;
+}
+
 /* *BSD has no O_LARGEFILE */
 #ifndef O_LARGEFILE
 #define O_LARGEFILE	0
@@ -1160,8 +1370,12 @@ int main(int argc, char **argv)
     struct sigaction act;
 
     opts.outfile = 0;
+    opts.sink = NULL;
+    opts.compress = 0;
     opts.poll_sleep = POLL_SLEEP_MILLIS;
     opts.evt_mask = 0;
+    opts.nr_evt_filters = 0;
+    opts.domid = -1;
     opts.cpu_mask_str = NULL;
     opts.disk_rsvd = 0;
     opts.disable_tracing = 1;
@@ -1180,6 +1394,8 @@ int main(int argc, char **argv)
     if ( opts.evt_mask != 0 )
         set_evt_mask(opts.evt_mask);
 
+    set_filters();
+
     if ( opts.cpu_mask_str )
     {
         if ( parse_cpu_mask() )
@@ -1189,7 +1405,16 @@ int main(int argc, char **argv)
     if ( opts.timeout != 0 ) 
         alarm(opts.timeout);
 
-    if ( opts.outfile )
+    if ( opts.sink )
+    {
+        outfd = open_sink(opts.sink);
+        if ( outfd < 0 )
+        {
+            perror("Could not connect to sink");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if ( opts.outfile )
         outfd = open(opts.outfile,
                      O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE,
                      0644);
@@ -1209,6 +1434,8 @@ int main(int argc, char **argv)
     if ( opts.memory_buffer > 0 )
         membuf_alloc(opts.memory_buffer);
 
+    out_init();
+
     /* ensure that if we get a signal, we'll do cleanup, then exit */
     act.sa_handler = close_handler;
     act.sa_flags = 0;
@@ -1218,6 +1445,10 @@ int main(int argc, char **argv)
     sigaction(SIGINT,  &act, NULL);
     sigaction(SIGALRM, &act, NULL);
 
+    /* a collector going away should fail the write, not kill us */
+    act.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &act, NULL);
+
     ret = monitor_tbufs();
 
     return ret;
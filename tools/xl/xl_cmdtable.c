@@ -151,7 +151,8 @@ struct cmd_spec cmd_table[] = {
       "[options] <Domain> <CheckpointFile> [<ConfigFile>]",
       "-h  Print this help.\n"
       "-c  Leave domain running after creating the snapshot.\n"
-      "-p  Leave domain paused after creating the snapshot."
+      "-p  Leave domain paused after creating the snapshot.\n"
+      "--image  Write HVM guest memory as a sparse page image."
     },
     { "migrate",
       &main_migrate, 0, 1,
@@ -165,8 +166,26 @@ struct cmd_spec cmd_table[] = {
       "-e              Do not wait in the background (on <host>) for the death\n"
       "                of the domain.\n"
       "--debug         Print huge (!) amount of debug during the migration process.\n"
+      "--pipeline      Map and send guest memory on separate threads.\n"
+      "--compress      Send guest memory compressed (needs a recent receiver).\n"
+      "--auto-converge Throttle the domain if it dirties memory too quickly.\n"
       "-p              Do not unpause domain after migrating it."
     },
+    { "evacuate",
+      &main_evacuate, 0, 1,
+      "Migrate all domains to another host",
+      "[options] <host>",
+      "-h              Print this help.\n"
+      "-j <jobs>       Run up to <jobs> migrations at once (default 2).\n"
+      "-s <sshcommand> Use <sshcommand> instead of ssh, as for migrate.\n"
+      "-e              Do not wait in the background (on <host>) for the death\n"
+      "                of the domains.\n"
+      "--debug         Print huge (!) amount of debug during the migration process.\n"
+      "--pipeline      Map and send guest memory on separate threads.\n"
+      "--compress      Send guest memory compressed (needs a recent receiver).\n"
+      "--auto-converge Throttle domains which dirty memory too quickly.\n"
+      "-p              Do not unpause domains after migrating them."
+    },
     { "restore",
       &main_restore, 0, 1,
       "Restore a domain from a saved state",
@@ -585,6 +604,13 @@ struct cmd_spec cmd_table[] = {
       "[options] <Domain>",
       "-l <level>        Specify the cache level to process, otherwise L3 cache is processed\n"
     },
+    { "psr-cat-protect",
+      &main_psr_cat_protect, 0, 1,
+      "Keep adjusting the L3 CAT split to shield domains from the others",
+      "[options] <Domain> [<Domain> ...]",
+      "-s <socket>       Specify the socket to process, otherwise 0 is assumed\n"
+      "-i <interval>     Sampling interval in ms, 1000 by default\n"
+    },
 #endif
     { "usbctrl-attach",
       &main_usbctrl_attach, 0, 1,
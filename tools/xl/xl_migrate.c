@@ -12,6 +12,7 @@
  * GNU Lesser General Public License for more details.
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <signal.h>
@@ -19,6 +20,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/utsname.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -177,6 +179,7 @@ static void migrate_do_preamble(int send_fd, int recv_fd, pid_t child,
 }
 
 static void migrate_domain(uint32_t domid, const char *rune, int debug,
+                           int pipeline, int compress, int auto_converge,
                            const char *override_config_file)
 {
     pid_t child = -1;
@@ -205,6 +208,12 @@ static void migrate_domain(uint32_t domid, const char *rune, int debug,
 
     if (debug)
         flags |= LIBXL_SUSPEND_DEBUG;
+    if (pipeline)
+        flags |= LIBXL_SUSPEND_PIPELINE;
+    if (compress)
+        flags |= LIBXL_SUSPEND_COMPRESS;
+    if (auto_converge)
+        flags |= LIBXL_SUSPEND_AUTO_CONVERGE;
     rc = libxl_domain_suspend(ctx, domid, send_fd, flags, NULL);
     if (rc) {
         fprintf(stderr, "migration sender: libxl_domain_suspend failed"
@@ -529,6 +538,38 @@ int main_migrate_receive(int argc, char **argv)
     return EXIT_SUCCESS;
 }
 
+static char *migrate_rune(const char *ssh_command, const char *host,
+                          int daemonize, int debug, int pause_after_migration)
+{
+    char *rune;
+    bool pass_tty_arg = progress_use_cr || (isatty(2) > 0);
+
+    if (!ssh_command[0]) {
+        rune = xstrdup(host);
+    } else {
+        char verbose_buf[minmsglevel_default+3];
+        int verbose_len;
+        verbose_buf[0] = ' ';
+        verbose_buf[1] = '-';
+        memset(verbose_buf+2, 'v', minmsglevel_default);
+        verbose_buf[sizeof(verbose_buf)-1] = 0;
+        if (minmsglevel == minmsglevel_default) {
+            verbose_len = 0;
+        } else {
+            verbose_len = (minmsglevel_default - minmsglevel) + 2;
+        }
+        xasprintf(&rune, "exec %s %s xl%s%.*s migrate-receive%s%s%s",
+                  ssh_command, host,
+                  pass_tty_arg ? " -t" : "",
+                  verbose_len, verbose_buf,
+                  daemonize ? "" : " -e",
+                  debug ? " -d" : "",
+                  pause_after_migration ? " -p" : "");
+    }
+
+    return rune;
+}
+
 int main_migrate(int argc, char **argv)
 {
     uint32_t domid;
@@ -537,9 +578,13 @@ int main_migrate(int argc, char **argv)
     char *rune = NULL;
     char *host;
     int opt, daemonize = 1, monitor = 1, debug = 0, pause_after_migration = 0;
+    int pipeline = 0, compress = 0, auto_converge = 0;
     static struct option opts[] = {
         {"debug", 0, 0, 0x100},
         {"live", 0, 0, 0x200},
+        {"pipeline", 0, 0, 0x300},
+        {"compress", 0, 0, 0x400},
+        {"auto-converge", 0, 0, 0x500},
         COMMON_LONG_OPTS
     };
 
@@ -566,38 +611,183 @@ int main_migrate(int argc, char **argv)
     case 0x200: /* --live */
         /* ignored for compatibility with xm */
         break;
+    case 0x300: /* --pipeline */
+        pipeline = 1;
+        break;
+    case 0x400: /* --compress */
+        compress = 1;
+        break;
+    case 0x500: /* --auto-converge */
+        auto_converge = 1;
+        break;
     }
 
     domid = find_domain(argv[optind]);
     host = argv[optind + 1];
 
-    bool pass_tty_arg = progress_use_cr || (isatty(2) > 0);
+    rune = migrate_rune(ssh_command, host, daemonize, debug,
+                        pause_after_migration);
 
-    if (!ssh_command[0]) {
-        rune= host;
-    } else {
-        char verbose_buf[minmsglevel_default+3];
-        int verbose_len;
-        verbose_buf[0] = ' ';
-        verbose_buf[1] = '-';
-        memset(verbose_buf+2, 'v', minmsglevel_default);
-        verbose_buf[sizeof(verbose_buf)-1] = 0;
-        if (minmsglevel == minmsglevel_default) {
-            verbose_len = 0;
-        } else {
-            verbose_len = (minmsglevel_default - minmsglevel) + 2;
+    migrate_domain(domid, rune, debug, pipeline, compress, auto_converge,
+                   config_filename);
+    return EXIT_SUCCESS;
+}
+
+struct evacuee {
+    uint32_t domid;
+    char *name;
+    uint64_t memkb;
+    pid_t pid;
+};
+
+static int evacuee_cmp(const void *a, const void *b)
+{
+    const struct evacuee *x = a, *y = b;
+
+    if (x->memkb != y->memkb)
+        return x->memkb < y->memkb ? -1 : 1;
+    return x->domid < y->domid ? -1 : x->domid > y->domid;
+}
+
+int main_evacuate(int argc, char **argv)
+{
+    const char *ssh_command = "ssh";
+    char *rune = NULL;
+    char *host;
+    int opt, daemonize = 1, debug = 0, pause_after_migration = 0;
+    int pipeline = 0, compress = 0, auto_converge = 0;
+    int i, nb_domain, nr = 0, next = 0, running = 0, failed = 0, jobs = 2;
+    libxl_dominfo *info;
+    struct evacuee *ev;
+    static struct option opts[] = {
+        {"debug", 0, 0, 0x100},
+        {"pipeline", 0, 0, 0x300},
+        {"compress", 0, 0, 0x400},
+        {"auto-converge", 0, 0, 0x500},
+        COMMON_LONG_OPTS
+    };
+
+    SWITCH_FOREACH_OPT(opt, "s:epj:", opts, "evacuate", 1) {
+    case 's':
+        ssh_command = optarg;
+        break;
+    case 'e':
+        daemonize = 0;
+        break;
+    case 'p':
+        pause_after_migration = 1;
+        break;
+    case 'j':
+        jobs = atoi(optarg);
+        if (jobs < 1) {
+            fprintf(stderr, "evacuate: invalid number of jobs '%s'\n",
+                    optarg);
+            return EXIT_FAILURE;
         }
-        xasprintf(&rune, "exec %s %s xl%s%.*s migrate-receive%s%s%s",
-                  ssh_command, host,
-                  pass_tty_arg ? " -t" : "",
-                  verbose_len, verbose_buf,
-                  daemonize ? "" : " -e",
-                  debug ? " -d" : "",
-                  pause_after_migration ? " -p" : "");
+        break;
+    case 0x100: /* --debug */
+        debug = 1;
+        break;
+    case 0x300: /* --pipeline */
+        pipeline = 1;
+        break;
+    case 0x400: /* --compress */
+        compress = 1;
+        break;
+    case 0x500: /* --auto-converge */
+        auto_converge = 1;
+        break;
     }
 
-    migrate_domain(domid, rune, debug, config_filename);
-    return EXIT_SUCCESS;
+    host = argv[optind];
+    rune = migrate_rune(ssh_command, host, daemonize, debug,
+                        pause_after_migration);
+
+    info = libxl_list_domain(ctx, &nb_domain);
+    if (!info) {
+        fprintf(stderr, "libxl_list_domain failed.\n");
+        return EXIT_FAILURE;
+    }
+
+    ev = xcalloc(nb_domain, sizeof(*ev));
+    for (i = 0; i < nb_domain; i++) {
+        if (info[i].domid == 0 || info[i].dying || info[i].shutdown)
+            continue;
+        ev[nr].name = libxl_domid_to_name(ctx, info[i].domid);
+        if (!ev[nr].name)
+            continue;
+        ev[nr].domid = info[i].domid;
+        ev[nr].memkb = info[i].current_memkb;
+        nr++;
+    }
+    libxl_dominfo_list_free(info, nb_domain);
+
+    /*
+     * Smallest first: each migration then frees its share of the link
+     * as early as possible, and the most domains are off the host
+     * soonest if the evacuation has to be cut short.
+     */
+    qsort(ev, nr, sizeof(*ev), evacuee_cmp);
+
+    while (next < nr || running) {
+        int status;
+        pid_t got;
+
+        if (next < nr && running < jobs) {
+            struct evacuee *e = &ev[next++];
+
+            fprintf(stderr, "evacuate: migrating %s (domid %u, %"PRIu64
+                    " MiB)\n", e->name, e->domid, e->memkb >> 10);
+
+            e->pid = fork();
+            if (e->pid == -1) {
+                perror("fork failed");
+                exit(EXIT_FAILURE);
+            }
+            if (!e->pid) {
+                postfork();
+                common_domname = e->name;
+                migrate_domain(e->domid, rune, debug, pipeline, compress,
+                               auto_converge, NULL);
+                /* not reached: migrate_domain exits */
+            }
+            running++;
+            continue;
+        }
+
+        got = waitpid(-1, &status, 0);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("waitpid failed");
+            exit(EXIT_FAILURE);
+        }
+
+        for (i = 0; i < next; i++) {
+            if (ev[i].pid != got)
+                continue;
+            ev[i].pid = 0;
+            running--;
+            if (WIFEXITED(status) && !WEXITSTATUS(status)) {
+                fprintf(stderr, "evacuate: %s migrated\n", ev[i].name);
+            } else {
+                libxl_report_child_exitstatus(ctx, XTL_ERROR, ev[i].name,
+                                              got, status);
+                failed++;
+            }
+            break;
+        }
+    }
+
+    fprintf(stderr, "evacuate: %d of %d domains migrated\n",
+            nr - failed, nr);
+
+    for (i = 0; i < nr; i++)
+        free(ev[i].name);
+    free(ev);
+    free(rune);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 int main_remus(int argc, char **argv)
@@ -673,12 +863,6 @@ int main_remus(int argc, char **argv)
             perror("option -c is conflict with -i, -d, -n or -b");
             exit(-1);
         }
-
-        if (libxl_defbool_is_default(r_info.compression)) {
-            perror("COLO can't be used with memory compression. "
-                   "Disable memory checkpoint compression now...");
-            libxl_defbool_set(&r_info.compression, false);
-        }
     }
 
     if (!r_info.netbufscript) {
@@ -590,6 +590,55 @@ int main_psr_cat_show(int argc, char **argv)
     return psr_cat_show(domid, lvl);
 }
 
+int main_psr_cat_protect(int argc, char **argv)
+{
+    int opt, i, nr_domids, rc;
+    uint32_t socketid = 0, *domids;
+    unsigned int interval_ms = 1000, ways = 0, prev = 0;
+    static struct option opts[] = {
+        {"socket", 1, 0, 's'},
+        {"interval", 1, 0, 'i'},
+        COMMON_LONG_OPTS
+    };
+
+    SWITCH_FOREACH_OPT(opt, "s:i:", opts, "psr-cat-protect", 1) {
+    case 's':
+        socketid = strtoul(optarg, NULL, 0);
+        break;
+    case 'i':
+        interval_ms = strtoul(optarg, NULL, 0);
+        break;
+    }
+
+    if (!interval_ms) {
+        fprintf(stderr, "Invalid interval\n");
+        return EXIT_FAILURE;
+    }
+
+    nr_domids = argc - optind;
+    domids = xmalloc(nr_domids * sizeof(*domids));
+    for (i = 0; i < nr_domids; i++)
+        domids[i] = find_domain(argv[optind + i]);
+
+    for (;;) {
+        rc = libxl_psr_cat_protect(ctx, socketid, domids, nr_domids,
+                                   interval_ms, &ways);
+        if (rc) {
+            fprintf(stderr, "Failed to adjust the L3 CAT split\n");
+            break;
+        }
+        if (ways != prev) {
+            printf("Socket %u: %u way(s) for the protected domain(s)\n",
+                   socketid, ways);
+            fflush(stdout);
+            prev = ways;
+        }
+    }
+
+    free(domids);
+    return EXIT_FAILURE;
+}
+
 int main_psr_hwinfo(int argc, char **argv)
 {
     int opt, ret = 0;
@@ -120,7 +120,8 @@ void save_domain_core_writeconfig(int fd, const char *source,
 }
 
 static int save_domain(uint32_t domid, const char *filename, int checkpoint,
-                            int leavepaused, const char *override_config_file)
+                       int leavepaused, int image,
+                       const char *override_config_file)
 {
     int fd;
     uint8_t *config_data;
@@ -141,7 +142,8 @@ static int save_domain(uint32_t domid, const char *filename, int checkpoint,
 
     save_domain_core_writeconfig(fd, filename, config_data, config_len);
 
-    int rc = libxl_domain_suspend(ctx, domid, fd, 0, NULL);
+    int rc = libxl_domain_suspend(ctx, domid, fd,
+                                  image ? LIBXL_SUSPEND_IMAGE : 0, NULL);
     close(fd);
 
     if (rc < 0) {
@@ -235,15 +237,23 @@ int main_save(int argc, char **argv)
     const char *config_filename = NULL;
     int checkpoint = 0;
     int leavepaused = 0;
+    int image = 0;
     int opt;
+    static struct option opts[] = {
+        {"image", 0, 0, 0x100},
+        COMMON_LONG_OPTS
+    };
 
-    SWITCH_FOREACH_OPT(opt, "cp", NULL, "save", 2) {
+    SWITCH_FOREACH_OPT(opt, "cp", opts, "save", 2) {
     case 'c':
         checkpoint = 1;
         break;
     case 'p':
         leavepaused = 1;
         break;
+    case 0x100: /* --image */
+        image = 1;
+        break;
     }
 
     if (argc-optind > 3) {
@@ -256,7 +266,8 @@ int main_save(int argc, char **argv)
     if ( argc - optind >= 3 )
         config_filename = argv[optind + 2];
 
-    save_domain(domid, filename, checkpoint, leavepaused, config_filename);
+    save_domain(domid, filename, checkpoint, leavepaused, image,
+                config_filename);
     return EXIT_SUCCESS;
 }
 
@@ -38,9 +38,10 @@ static void print_vcpuinfo(uint32_t tdomid,
         printf("%5c %3c%cp ", '-', '-', '-');
     } else {
         /*      CPU STA */
-        printf("%5u %3c%c- ", vcpuinfo->cpu,
+        printf("%5u %3c%c%c ", vcpuinfo->cpu,
                vcpuinfo->running ? 'r' : '-',
-               vcpuinfo->blocked ? 'b' : '-');
+               vcpuinfo->blocked ? 'b' : '-',
+               vcpuinfo->waiting ? 'w' : '-');
     }
     /*      TIM */
     printf("%9.1f  ", ((float)vcpuinfo->vcpu_time / 1e9));
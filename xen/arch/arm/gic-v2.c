@@ -495,6 +495,11 @@ static void gicv2_hcr_status(uint32_t flag, bool status)
     writel_gich(hcr, GICH_HCR);
 }
 
+static uint64_t gicv2_read_elrsr(void)
+{
+    return readl_gich(GICH_ELSR0) | ((uint64_t)readl_gich(GICH_ELSR1) << 32);
+}
+
 static unsigned int gicv2_read_vmcr_priority(void)
 {
    return ((readl_gich(GICH_VMCR) >> GICH_V2_VMCR_PRIORITY_SHIFT)
@@ -1249,6 +1254,7 @@ const static struct gic_hw_operations gicv2_ops = {
     .clear_lr            = gicv2_clear_lr,
     .read_lr             = gicv2_read_lr,
     .write_lr            = gicv2_write_lr,
+    .read_elrsr          = gicv2_read_elrsr,
     .read_vmcr_priority  = gicv2_read_vmcr_priority,
     .read_apr            = gicv2_read_apr,
     .make_hwdom_dt_node  = gicv2_make_hwdom_dt_node,
@@ -67,7 +67,13 @@ bool gicv3_its_host_has_its(void)
 }
 
 #define BUFPTR_MASK                     GENMASK(19, 5)
-static int its_send_command(struct host_its *hw_its, const void *its_cmd)
+/*
+ * Queue @nr commands at once: the queue pointers are read, the commands
+ * are made visible to the ITS and GITS_CWRITER is written only once for
+ * the whole batch.
+ */
+static int its_send_commands(struct host_its *hw_its, const void *its_cmds,
+                             unsigned int nr)
 {
     /*
      * The command queue should actually never become full, if it does anyway
@@ -81,11 +87,13 @@ static int its_send_command(struct host_its *hw_its, const void *its_cmd)
      * considerations.
      */
     s_time_t deadline = NOW() + MILLISECS(1);
+    unsigned int size = nr * ITS_CMD_SIZE, first;
     uint64_t readp, writep;
     int ret = -EBUSY;
 
     /* No ITS commands from an interrupt handler (at the moment). */
     ASSERT(!in_irq());
+    ASSERT(nr && size < ITS_CMD_QUEUE_SZ);
 
     spin_lock(&hw_its->cmd_lock);
 
@@ -93,7 +101,8 @@ static int its_send_command(struct host_its *hw_its, const void *its_cmd)
         readp = readq_relaxed(hw_its->its_base + GITS_CREADR) & BUFPTR_MASK;
         writep = readq_relaxed(hw_its->its_base + GITS_CWRITER) & BUFPTR_MASK;
 
-        if ( ((writep + ITS_CMD_SIZE) % ITS_CMD_QUEUE_SZ) != readp )
+        /* One slot always stays empty to tell a full queue from an empty one. */
+        if ( ((readp - writep - ITS_CMD_SIZE) % ITS_CMD_QUEUE_SZ) >= size )
         {
             ret = 0;
             break;
@@ -117,14 +126,21 @@ static int its_send_command(struct host_its *hw_its, const void *its_cmd)
         return ret;
     }
 
-    memcpy(hw_its->cmd_buf + writep, its_cmd, ITS_CMD_SIZE);
+    /* The batch may wrap around the end of the queue. */
+    first = min_t(unsigned int, size, ITS_CMD_QUEUE_SZ - writep);
+    memcpy(hw_its->cmd_buf + writep, its_cmds, first);
+    memcpy(hw_its->cmd_buf, its_cmds + first, size - first);
     if ( hw_its->flags & HOST_ITS_FLUSH_CMD_QUEUE )
-        clean_and_invalidate_dcache_va_range(hw_its->cmd_buf + writep,
-                                             ITS_CMD_SIZE);
+    {
+        clean_and_invalidate_dcache_va_range(hw_its->cmd_buf + writep, first);
+        if ( size != first )
+            clean_and_invalidate_dcache_va_range(hw_its->cmd_buf,
+                                                 size - first);
+    }
     else
         dsb(ishst);
 
-    writep = (writep + ITS_CMD_SIZE) % ITS_CMD_QUEUE_SZ;
+    writep = (writep + size) % ITS_CMD_QUEUE_SZ;
     writeq_relaxed(writep & BUFPTR_MASK, hw_its->its_base + GITS_CWRITER);
 
     spin_unlock(&hw_its->cmd_lock);
@@ -132,6 +148,11 @@ static int its_send_command(struct host_its *hw_its, const void *its_cmd)
     return 0;
 }
 
+static int its_send_command(struct host_its *hw_its, const void *its_cmd)
+{
+    return its_send_commands(hw_its, its_cmd, 1);
+}
+
 /* Wait for an ITS to finish processing all commands. */
 static int gicv3_its_wait_commands(struct host_its *hw_its)
 {
@@ -182,18 +203,14 @@ static int its_send_cmd_sync(struct host_its *its, unsigned int cpu)
     return its_send_command(its, cmd);
 }
 
-static int its_send_cmd_mapti(struct host_its *its,
-                              uint32_t deviceid, uint32_t eventid,
-                              uint32_t pintid, uint16_t icid)
+static void its_encode_mapti(uint64_t *cmd,
+                             uint32_t deviceid, uint32_t eventid,
+                             uint32_t pintid, uint16_t icid)
 {
-    uint64_t cmd[4];
-
     cmd[0] = GITS_CMD_MAPTI | ((uint64_t)deviceid << 32);
     cmd[1] = eventid | ((uint64_t)pintid << 32);
     cmd[2] = icid;
     cmd[3] = 0x00;
-
-    return its_send_command(its, cmd);
 }
 
 static int its_send_cmd_mapc(struct host_its *its, uint32_t collection_id,
@@ -234,17 +251,12 @@ static int its_send_cmd_mapd(struct host_its *its, uint32_t deviceid,
     return its_send_command(its, cmd);
 }
 
-static int its_send_cmd_inv(struct host_its *its,
-                            uint32_t deviceid, uint32_t eventid)
+static void its_encode_inv(uint64_t *cmd, uint32_t deviceid, uint32_t eventid)
 {
-    uint64_t cmd[4];
-
     cmd[0] = GITS_CMD_INV | ((uint64_t)deviceid << 32);
     cmd[1] = eventid;
     cmd[2] = 0x00;
     cmd[3] = 0x00;
-
-    return its_send_command(its, cmd);
 }
 
 /* Set up the (1:1) collection mapping for the given host CPU. */
@@ -469,6 +481,15 @@ static int gicv3_its_init_single_its(struct host_its *hw_its)
     hw_its->itte_size = GITS_TYPER_ITT_SIZE(reg);
     if ( reg & GITS_TYPER_PTA )
         hw_its->flags |= HOST_ITS_USES_PTA;
+    /*
+     * Direct vLPI injection is not implemented yet, all LPIs still go
+     * through the emulated ITS.  Record the capability for when it is.
+     */
+    if ( reg & GITS_TYPER_VLPIS )
+    {
+        hw_its->flags |= HOST_ITS_HAS_VLPIS;
+        printk("ITS@%lx: GICv4 vLPIs supported, not used\n", hw_its->addr);
+    }
     spin_lock_init(&hw_its->cmd_lock);
 
     for ( i = 0; i < GITS_BASER_NR_REGS; i++ )
@@ -598,33 +619,36 @@ static int compare_its_guest_devices(struct its_device *dev,
  * On the host ITS @its, map @nr_events consecutive LPIs.
  * The mapping connects a device @devid and event @eventid pair to LPI @lpi,
  * increasing both @eventid and @lpi to cover the number of requested LPIs.
+ * The MAPTI/INV pairs are queued in batches; the caller has to SYNC and
+ * wait for the commands to complete.
  */
+#define MAP_EVENTS_BATCH                8U
 static int gicv3_its_map_host_events(struct host_its *its,
                                      uint32_t devid, uint32_t eventid,
                                      uint32_t lpi, uint32_t nr_events)
 {
-    uint32_t i;
+    uint64_t cmds[MAP_EVENTS_BATCH * 2][4];
+    uint32_t i, n = 0;
     int ret;
 
     for ( i = 0; i < nr_events; i++ )
     {
         /* For now we map every host LPI to host CPU 0 */
-        ret = its_send_cmd_mapti(its, devid, eventid + i, lpi + i, 0);
-        if ( ret )
-            return ret;
+        its_encode_mapti(cmds[n++], devid, eventid + i, lpi + i, 0);
+        its_encode_inv(cmds[n++], devid, eventid + i);
 
-        ret = its_send_cmd_inv(its, devid, eventid + i);
-        if ( ret )
-            return ret;
+        if ( n == ARRAY_SIZE(cmds) || i + 1 == nr_events )
+        {
+            ret = its_send_commands(its, cmds, n);
+            if ( ret )
+                return ret;
+            n = 0;
+        }
     }
 
     /* TODO: Consider using INVALL here. Didn't work on the model, though. */
 
-    ret = its_send_cmd_sync(its, 0);
-    if ( ret )
-        return ret;
-
-    return gicv3_its_wait_commands(its);
+    return 0;
 }
 
 /*
@@ -767,6 +791,16 @@ int gicv3_its_map_guest_device(struct domain *d,
             break;
     }
 
+    /* Wait only once for the whole device to be mapped. */
+    if ( !ret )
+    {
+        ret = its_send_cmd_sync(hw_its, 0);
+        if ( !ret )
+            ret = gicv3_its_wait_commands(hw_its);
+        /* Have the cleanup below cover all blocks. */
+        i--;
+    }
+
     if ( ret )
     {
         /* Clean up all allocated host LPI blocks. */
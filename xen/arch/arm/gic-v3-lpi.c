@@ -193,9 +193,18 @@ void gicv3_do_LPI(unsigned int lpi)
     if ( hlpi.virt_lpi == INVALID_LPI )
         goto out;
 
-    d = rcu_lock_domain_by_id(hlpi.dom_id);
-    if ( !d )
-        goto out;
+    /*
+     * A passed-through device mostly interrupts the domain that is running
+     * on this pCPU, which cannot go away under our feet: skip the RCU
+     * lookup of the domain list for that case.
+     */
+    d = current->domain;
+    if ( d->domain_id != hlpi.dom_id )
+    {
+        d = rcu_lock_domain_by_id(hlpi.dom_id);
+        if ( !d )
+            goto out;
+    }
 
     /*
      * TODO: Investigate what to do here for potential interrupt storms.
@@ -209,7 +218,8 @@ void gicv3_do_LPI(unsigned int lpi)
      */
     vgic_vcpu_inject_lpi(d, hlpi.virt_lpi);
 
-    rcu_unlock_domain(d);
+    if ( d != current->domain )
+        rcu_unlock_domain(d);
 
 out:
     irq_exit();
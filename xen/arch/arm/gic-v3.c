@@ -1042,6 +1042,11 @@ static unsigned int gicv3_read_vmcr_priority(void)
 }
 
 /* Only support reading GRP1 APRn registers */
+static uint64_t gicv3_read_elrsr(void)
+{
+    return READ_SYSREG32(ICH_ELSR_EL2);
+}
+
 static unsigned int gicv3_read_apr(int apr_reg)
 {
     switch ( apr_reg )
@@ -1732,6 +1737,7 @@ static const struct gic_hw_operations gicv3_ops = {
     .clear_lr            = gicv3_clear_lr,
     .read_lr             = gicv3_read_lr,
     .write_lr            = gicv3_write_lr,
+    .read_elrsr          = gicv3_read_elrsr,
     .read_vmcr_priority  = gicv3_read_vmcr_priority,
     .read_apr            = gicv3_read_apr,
     .secondary_init      = gicv3_secondary_cpu_init,
@@ -415,6 +415,8 @@ void gic_remove_irq_from_queues(struct vcpu *v, struct pending_irq *p)
 {
     ASSERT(spin_is_locked(&v->arch.vgic.lock));
 
+    if ( test_bit(GIC_IRQ_GUEST_VISIBLE, &p->status) )
+        v->arch.vgic.lr_resync = true;
     clear_bit(GIC_IRQ_GUEST_QUEUED, &p->status);
     list_del_init(&p->inflight);
     gic_remove_from_lr_pending(v, p);
@@ -438,6 +440,8 @@ void gic_raise_inflight_irq(struct vcpu *v, unsigned int virtual_irq)
     {
         if ( v == current )
             gic_update_one_lr(v, n->lr);
+        else
+            v->arch.vgic.lr_resync = true;
     }
 #ifdef GIC_DEBUG
     else
@@ -599,6 +603,7 @@ void gic_clear_lrs(struct vcpu *v)
     int i = 0;
     unsigned long flags;
     unsigned int nr_lrs = gic_hw_ops->info->nr_lrs;
+    uint64_t lrs;
 
     /* The idle domain has no LRs to be cleared. Since gic_restore_state
      * doesn't write any LR registers for the idle domain they could be
@@ -608,9 +613,28 @@ void gic_clear_lrs(struct vcpu *v)
 
     gic_hw_ops->update_hcr_status(GICH_HCR_UIE, false);
 
+    if ( !this_cpu(lr_mask) )
+        return;
+
     spin_lock_irqsave(&v->arch.vgic.lock, flags);
 
-    while ((i = find_next_bit((const unsigned long *) &this_cpu(lr_mask),
+    /*
+     * LRs still holding a pending or active interrupt only need looking at
+     * if that interrupt was raised again or removed meanwhile, which is
+     * dealt with right away if the vCPU is running here.
+     */
+    lrs = this_cpu(lr_mask);
+    if ( unlikely(v->arch.vgic.lr_resync) )
+    {
+        v->arch.vgic.lr_resync = false;
+        perfc_incr(gic_lr_resyncs);
+    }
+    else
+        lrs &= gic_hw_ops->read_elrsr();
+    perfc_add(gic_lr_syncs, hweight64(lrs));
+    perfc_add(gic_lr_sync_skips, hweight64(this_cpu(lr_mask)) - hweight64(lrs));
+
+    while ((i = find_next_bit((const unsigned long *) &lrs,
                               nr_lrs, i)) < nr_lrs ) {
         gic_update_one_lr(v, i);
         i++;
@@ -619,6 +643,19 @@ void gic_clear_lrs(struct vcpu *v)
     spin_unlock_irqrestore(&v->arch.vgic.lock, flags);
 }
 
+/*
+ * GIC_IRQ_GUEST_ACTIVE isn't kept up to date for interrupts in LRs the
+ * guest hasn't emptied yet: look at the LR itself.
+ */
+static bool gic_lr_is_active(unsigned int lr)
+{
+    struct gic_lr lr_val;
+
+    gic_hw_ops->read_lr(lr, &lr_val);
+
+    return lr_val.state & GICH_LR_ACTIVE;
+}
+
 static void gic_restore_pending_irqs(struct vcpu *v)
 {
     int lr = 0;
@@ -645,7 +682,7 @@ static void gic_restore_pending_irqs(struct vcpu *v)
                 if ( p_r->priority == p->priority )
                     goto out;
                 if ( test_bit(GIC_IRQ_GUEST_VISIBLE, &p_r->status) &&
-                     !test_bit(GIC_IRQ_GUEST_ACTIVE, &p_r->status) )
+                     !gic_lr_is_active(p_r->lr) )
                     goto found;
             }
             /* We didn't find a victim this time, and we won't next
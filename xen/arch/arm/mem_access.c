@@ -436,6 +436,12 @@ long p2m_set_mem_access_multi(struct domain *d,
     return -EOPNOTSUPP;
 }
 
+int p2m_set_mem_access_subpage(struct domain *d, gfn_t gfn, uint32_t write)
+{
+    /* No hardware support on ARM. */
+    return -EOPNOTSUPP;
+}
+
 int p2m_get_mem_access(struct domain *d, gfn_t gfn,
                        xenmem_access_t *access)
 {
@@ -52,7 +52,11 @@ static const paddr_t level_masks[] =
 static const uint8_t level_orders[] =
     { ZEROETH_ORDER, FIRST_ORDER, SECOND_ORDER, THIRD_ORDER };
 
-static void p2m_flush_tlb(struct p2m_domain *p2m);
+/* Largest number of pages a P2M TLB flush invalidates one by one. */
+#define P2M_FLUSH_RANGE_MAX 32
+
+static void p2m_flush_tlb_range(struct p2m_domain *p2m, gfn_t start,
+                                unsigned long nr);
 
 /* Unlock the flush and do a P2M TLB flush if necessary */
 void p2m_write_unlock(struct p2m_domain *p2m)
@@ -65,7 +69,8 @@ void p2m_write_unlock(struct p2m_domain *p2m)
          * to avoid someone else modify the P2M before the TLB
          * invalidation has completed.
          */
-        p2m_flush_tlb(p2m);
+        p2m_flush_tlb_range(p2m, p2m->flush_start,
+                            gfn_x(p2m->flush_end) - gfn_x(p2m->flush_start));
     }
 
     write_unlock(&p2m->lock);
@@ -131,14 +136,17 @@ void p2m_restore_state(struct vcpu *n)
     /*
      * Flush local TLB for the domain to prevent wrong TLB translation
      * when running multiple vCPU of the same domain on a single pCPU.
+     * Only the stage 1 entries (tagged by the guest's ASIDs) can be
+     * wrong for another vCPU, the stage 2 ones are shared by all of them.
      */
     if ( *last_vcpu_ran != INVALID_VCPU_ID && *last_vcpu_ran != n->vcpu_id )
-        flush_tlb_local();
+        flush_tlb_s1_local();
 
     *last_vcpu_ran = n->vcpu_id;
 }
 
-static void p2m_flush_tlb(struct p2m_domain *p2m)
+static void p2m_flush_tlb_range(struct p2m_domain *p2m, gfn_t start,
+                                unsigned long nr)
 {
     unsigned long flags = 0;
     uint64_t ovttbr;
@@ -155,7 +163,10 @@ static void p2m_flush_tlb(struct p2m_domain *p2m)
         isb();
     }
 
-    flush_tlb();
+    if ( nr <= P2M_FLUSH_RANGE_MAX )
+        flush_tlb_ipa_range(gfn_to_gaddr(start), nr << PAGE_SHIFT);
+    else
+        flush_tlb();
 
     if ( ovttbr != READ_SYSREG64(VTTBR_EL2) )
     {
@@ -165,6 +176,33 @@ static void p2m_flush_tlb(struct p2m_domain *p2m)
     }
 }
 
+static void p2m_flush_tlb(struct p2m_domain *p2m)
+{
+    p2m_flush_tlb_range(p2m, _gfn(0), ~0UL);
+}
+
+/*
+ * Record that the TLB entries for the 2^order GFNs at @gfn have to be
+ * flushed, widening the range of the pending flush if necessary.
+ */
+static void p2m_tlb_flush_add(struct p2m_domain *p2m, gfn_t gfn,
+                              unsigned int order)
+{
+    gfn_t end = gfn_add(gfn, 1UL << order);
+
+    if ( !p2m->need_flush )
+    {
+        p2m->flush_start = gfn;
+        p2m->flush_end = end;
+        p2m->need_flush = true;
+    }
+    else
+    {
+        p2m->flush_start = gfn_min(p2m->flush_start, gfn);
+        p2m->flush_end = gfn_max(p2m->flush_end, end);
+    }
+}
+
 /*
  * Force a synchronous P2M TLB flush.
  *
@@ -173,8 +211,10 @@ static void p2m_flush_tlb(struct p2m_domain *p2m)
 static void p2m_flush_tlb_sync(struct p2m_domain *p2m)
 {
     ASSERT(p2m_is_write_locked(p2m));
+    ASSERT(p2m->need_flush);
 
-    p2m_flush_tlb(p2m);
+    p2m_flush_tlb_range(p2m, p2m->flush_start,
+                        gfn_x(p2m->flush_end) - gfn_x(p2m->flush_start));
     p2m->need_flush = false;
 }
 
@@ -864,6 +904,10 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
          * For more details see (D4.7.1 in ARM DDI 0487A.j).
          */
         p2m_remove_pte(entry, p2m->clean_pte);
+        p2m_tlb_flush_add(p2m,
+                          _gfn(gfn_x(sgfn) &
+                               ~((1UL << level_orders[level]) - 1)),
+                          level_orders[level]);
         p2m_flush_tlb_sync(p2m);
 
         p2m_write_pte(entry, split_pte, p2m->clean_pte);
@@ -920,8 +964,11 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
         p2m_remove_pte(entry, p2m->clean_pte);
 
     if ( mfn_eq(smfn, INVALID_MFN) )
+    {
         /* Flush can be deferred if the entry is removed */
-        p2m->need_flush |= !!lpae_valid(orig_pte);
+        if ( lpae_valid(orig_pte) )
+            p2m_tlb_flush_add(p2m, sgfn, page_order);
+    }
     else
     {
         lpae_t pte = mfn_to_p2m_entry(smfn, t, a);
@@ -938,11 +985,10 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
          */
         if ( lpae_valid(orig_pte) )
         {
+            p2m_tlb_flush_add(p2m, sgfn, page_order);
             if ( likely(!p2m->mem_access_enabled) ||
                  P2M_CLEAR_PERM(pte) != P2M_CLEAR_PERM(orig_pte) )
                 p2m_flush_tlb_sync(p2m);
-            else
-                p2m->need_flush = true;
         }
         else /* new mapping */
             p2m->stats.mappings[level]++;
@@ -547,12 +547,22 @@ void vgic_vcpu_inject_irq(struct vcpu *v, unsigned int virq)
     if ( test_bit(GIC_IRQ_GUEST_ENABLED, &n->status) )
         gic_raise_guest_irq(v, virq, priority);
 
-    list_for_each_entry ( iter, &v->arch.vgic.inflight_irqs, inflight )
+    /*
+     * The list is sorted by priority. Interrupts mostly arrive with the
+     * same or a lower priority than the ones already in flight, so look
+     * at the tail before walking the list.
+     */
+    if ( !list_empty(&v->arch.vgic.inflight_irqs) &&
+         list_last_entry(&v->arch.vgic.inflight_irqs, struct pending_irq,
+                         inflight)->priority > priority )
     {
-        if ( iter->priority > priority )
+        list_for_each_entry ( iter, &v->arch.vgic.inflight_irqs, inflight )
         {
-            list_add_tail(&n->inflight, &iter->inflight);
-            goto out;
+            if ( iter->priority > priority )
+            {
+                list_add_tail(&n->inflight, &iter->inflight);
+                goto out;
+            }
         }
     }
     list_add_tail(&n->inflight, &v->arch.vgic.inflight_irqs);
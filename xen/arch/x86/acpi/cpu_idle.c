@@ -106,6 +106,7 @@ static uint64_t (*__read_mostly tick_to_ns)(uint64_t) = acpi_pm_tick_to_ns;
 void (*__read_mostly pm_idle_save)(void);
 unsigned int max_cstate __read_mostly = ACPI_PROCESSOR_MAX_POWER - 1;
 integer_param("max_cstate", max_cstate);
+DEFINE_PER_CPU_READ_MOSTLY(unsigned int, cpuidle_latency_limit);
 static bool __read_mostly local_apic_timer_c2_ok;
 boolean_param("lapic_timer_c2_ok", local_apic_timer_c2_ok);
 
@@ -305,6 +306,8 @@ static void print_acpi_power(uint32_t cpu, struct acpi_processor_power *power)
     last_state_idx = power->last_state ? power->last_state->idx : -1;
     printk("active state:\t\tC%d\n", last_state_idx);
     printk("max_cstate:\t\tC%d\n", max_cstate);
+    if ( per_cpu(cpuidle_latency_limit, cpu) )
+        printk("latency limit:\t\t%uus\n", per_cpu(cpuidle_latency_limit, cpu));
     printk("states:\n");
 
     spin_lock_irq(&power->stat_lock);
@@ -1351,6 +1354,16 @@ bool cpuidle_using_deep_cstate(void)
     return xen_cpuidle && max_cstate > (local_apic_timer_c2_ok ? 2 : 1);
 }
 
+unsigned int acpi_get_cstate_latency_limit(unsigned int cpu)
+{
+    return per_cpu(cpuidle_latency_limit, cpu);
+}
+
+void acpi_set_cstate_latency_limit(unsigned int cpu, unsigned int us)
+{
+    per_cpu(cpuidle_latency_limit, cpu) = us;
+}
+
 static int cpu_callback(
     struct notifier_block *nfb, unsigned long action, void *hcpu)
 {
@@ -43,7 +43,7 @@
  * state:
  * 1) Energy break even point
  * 2) Performance impact
- * 3) Latency tolerance (TBD: from guest virtual C state)
+ * 3) Latency tolerance
  * These these three factors are treated independently.
  *
  * Energy break even point
@@ -90,6 +90,13 @@
  * As an additional rule to reduce the performance impact, menu tries to
  * limit the exit latency duration to be no more than 10% of the decaying
  * measured idle time.
+ *
+ * Latency tolerance
+ * -----------------
+ * An administrator may limit the exit latency of the C states each CPU can
+ * use (xenpm set-max-latency), e.g. for the CPUs of a pool running latency
+ * sensitive guests.  Unlike max_cstate, this leaves such CPUs the states
+ * which are deeper than C1 but still quick enough to get out of.
  */
 
 struct perf_factor{
@@ -188,6 +195,7 @@ static unsigned int get_sleep_length_us(void)
 static int menu_select(struct acpi_processor_power *power)
 {
     struct menu_device *data = &__get_cpu_var(menu_devices);
+    unsigned int latency_limit = this_cpu(cpuidle_latency_limit);
     int i;
     s_time_t    io_interval;
 
@@ -229,7 +237,8 @@ static int menu_select(struct acpi_processor_power *power)
             break;
         if (s->latency * LATENCY_MULTIPLIER > data->latency_factor)
             break;
-        /* TBD: we need to check the QoS requirment in future */
+        if (latency_limit && s->latency > latency_limit)
+            break;
         data->exit_us = s->latency;
         data->last_state_idx = i;
     }
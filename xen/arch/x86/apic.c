@@ -33,6 +33,8 @@
 #include <asm/hardirq.h>
 #include <asm/apic.h>
 #include <asm/io_apic.h>
+#include <asm/pmu_sample.h>
+#include <asm/stack_sample.h>
 #include <mach_apic.h>
 #include <io_ports.h>
 #include <xen/kexec.h>
@@ -1257,6 +1259,7 @@ void apic_timer_interrupt(struct cpu_user_regs * regs)
 {
     ack_APIC_irq();
     perfc_incr(apic_timer);
+    stack_sample_tick(regs);
     raise_softirq(TIMER_SOFTIRQ);
 }
 
@@ -1335,6 +1338,8 @@ void error_interrupt(struct cpu_user_regs *regs)
 void pmu_apic_interrupt(struct cpu_user_regs *regs)
 {
     ack_APIC_irq();
+    if ( pmu_sample_interrupt(regs) )
+        return;
     vpmu_do_interrupt(regs);
 }
 
@@ -502,6 +502,18 @@ static void amd_get_topology(struct cpuinfo_x86 *c)
                 cpuid(0x8000001e, &eax, &ebx, &ecx, &edx);
                 c->compute_unit_id = ebx & 0xFF;
                 c->x86_num_siblings = ((ebx >> 8) & 0x3) + 1;
+
+                /*
+                 * From Fam17h onwards the L3 is shared per core complex,
+                 * rather than per node: derive its ID from the number of
+                 * threads sharing it (cache properties leaf, L3 subleaf).
+                 */
+                if (c->x86 >= 0x17 && c->extended_cpuid_level >= 0x8000001d) {
+                        cpuid_count(0x8000001d, 3, &eax, &ebx, &ecx, &edx);
+                        if ((eax & 0x1f) && ((eax >> 5) & 7) == 3)
+                                c->cpu_llc_id = c->apicid >>
+                                        get_count_order(((eax >> 14) & 0xfff) + 1);
+                }
         }
         
         if (opt_cpu_info)
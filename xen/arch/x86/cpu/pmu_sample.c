@@ -0,0 +1,355 @@
+/*
+ * pmu_sample.c: host-wide sampling profiler on the hardware PMU.
+ *
+ * One general purpose counter per pCPU is programmed to interrupt every
+ * 'period' events.  Each interrupt records what the pCPU was running (Xen,
+ * or a guest vCPU in kernel or user mode, and where) into a per-pCPU ring,
+ * which the toolstack drains with XEN_SYSCTL_pmu_sample.
+ *
+ * Each ring has a single producer, the PMU interrupt on the owning pCPU,
+ * and a single consumer, the sysctl, so it needs no lock.  Starting,
+ * stopping and reading are serialised by the sysctl lock.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <xen/cpumask.h>
+#include <xen/guest_access.h>
+#include <xen/sched.h>
+#include <xen/smp.h>
+#include <xen/xmalloc.h>
+#include <asm/apic.h>
+#include <asm/hvm/hvm.h>
+#include <asm/msr.h>
+#include <asm/pmu_sample.h>
+#include <asm/regs.h>
+#include <asm/vpmu.h>
+#include <public/sysctl.h>
+
+/* Records per pCPU; a power of 2. */
+#define PMU_SAMPLE_RING_SIZE    4096
+
+#define EVNTSEL_USR             (1ULL << 16)
+#define EVNTSEL_OS              (1ULL << 17)
+#define EVNTSEL_INT             (1ULL << 20)
+#define EVNTSEL_EN              (1ULL << 22)
+
+/* Unhalted core cycles. */
+#define INTEL_EVENT_CYCLES      0x3c
+#define AMD_EVENT_CYCLES        0x76
+
+struct pmu_sample_ring {
+    unsigned int prod;          /* written by the owning pCPU only */
+    unsigned int cons;          /* written by the reader only */
+    unsigned int lost;          /* written by the owning pCPU only */
+    unsigned int lost_read;     /* written by the reader only */
+    uint32_t saved_lvtpc;
+    uint64_t saved_global_ctrl;
+    xen_sysctl_pmu_sample_rec_t rec[PMU_SAMPLE_RING_SIZE];
+};
+
+static DEFINE_PER_CPU(struct pmu_sample_ring *, pmu_sample_ring);
+
+static bool __read_mostly pmu_sampling;
+static cpumask_t pmu_sample_cpus;
+static unsigned int __read_mostly pmu_sample_evntsel_msr;
+static unsigned int __read_mostly pmu_sample_ctr_msr;
+static bool __read_mostly pmu_sample_global_ctrl;
+static uint64_t __read_mostly pmu_sample_evntsel;
+static uint64_t __read_mostly pmu_sample_period;
+
+extern char svm_stgi_label[];
+
+static uint8_t pmu_sample_mode(struct vcpu *v,
+                               const struct cpu_user_regs *regs)
+{
+    if ( !is_hvm_vcpu(v) )
+        return guest_kernel_mode(v, regs) ? XEN_SYSCTL_PMU_SAMPLE_kernel
+                                          : XEN_SYSCTL_PMU_SAMPLE_user;
+
+    switch ( hvm_guest_x86_mode(v) )
+    {
+    case 0: /* real mode */
+        return XEN_SYSCTL_PMU_SAMPLE_kernel;
+    case 1: /* vm86 mode */
+        return XEN_SYSCTL_PMU_SAMPLE_user;
+    default:
+        return hvm_get_cpl(v) != 3 ? XEN_SYSCTL_PMU_SAMPLE_kernel
+                                   : XEN_SYSCTL_PMU_SAMPLE_user;
+    }
+}
+
+static void pmu_sample_record(struct pmu_sample_ring *ring,
+                              const struct cpu_user_regs *regs)
+{
+    struct vcpu *curr = current;
+    xen_sysctl_pmu_sample_rec_t *rec;
+    unsigned int prod = ring->prod;
+
+    if ( prod - read_atomic(&ring->cons) >= PMU_SAMPLE_RING_SIZE )
+    {
+        ring->lost++;
+        return;
+    }
+
+    rec = &ring->rec[prod & (PMU_SAMPLE_RING_SIZE - 1)];
+    rec->time = NOW();
+    rec->domid = curr->domain->domain_id;
+    rec->vcpu = curr->vcpu_id;
+
+    /*
+     * An SVM guest interrupted by the PMI exits to Xen, which takes the
+     * interrupt on STGI: attribute it to the guest, as xenoprof does.
+     */
+    if ( !guest_mode(regs) && regs->rip == (unsigned long)svm_stgi_label )
+        regs = guest_cpu_user_regs();
+
+    if ( guest_mode(regs) )
+        rec->mode = pmu_sample_mode(curr, regs);
+    else
+        rec->mode = XEN_SYSCTL_PMU_SAMPLE_xen;
+    rec->rip = regs->rip;
+
+    smp_wmb();
+    write_atomic(&ring->prod, prod + 1);
+}
+
+/* Called from the PMU interrupt; returns whether the sampler owns the PMU. */
+bool pmu_sample_interrupt(const struct cpu_user_regs *regs)
+{
+    struct pmu_sample_ring *ring;
+    uint64_t val;
+
+    if ( !pmu_sampling )
+        return false;
+
+    ring = this_cpu(pmu_sample_ring);
+    if ( !ring )
+        return true;
+
+    /* The counter is loaded with -period: bit 31 clears on overflow. */
+    rdmsrl(pmu_sample_ctr_msr, val);
+    if ( !(val & (1ULL << 31)) )
+    {
+        pmu_sample_record(ring, regs);
+        wrmsrl(pmu_sample_ctr_msr, -pmu_sample_period);
+    }
+
+    if ( pmu_sample_global_ctrl )
+        wrmsrl(MSR_CORE_PERF_GLOBAL_OVF_CTRL, 1);
+
+    /* Intel masks LVTPC on each PMI. */
+    apic_write(APIC_LVTPC, PMU_APIC_VECTOR);
+
+    return true;
+}
+
+static void pmu_sample_enable(void *unused)
+{
+    struct pmu_sample_ring *ring = this_cpu(pmu_sample_ring);
+
+    ring->saved_lvtpc = apic_read(APIC_LVTPC);
+
+    wrmsrl(pmu_sample_evntsel_msr, 0);
+    wrmsrl(pmu_sample_ctr_msr, -pmu_sample_period);
+    if ( pmu_sample_global_ctrl )
+    {
+        rdmsrl(MSR_CORE_PERF_GLOBAL_CTRL, ring->saved_global_ctrl);
+        wrmsrl(MSR_CORE_PERF_GLOBAL_CTRL, ring->saved_global_ctrl | 1);
+    }
+    apic_write(APIC_LVTPC, PMU_APIC_VECTOR);
+    wrmsrl(pmu_sample_evntsel_msr, pmu_sample_evntsel);
+}
+
+static void pmu_sample_disable(void *unused)
+{
+    struct pmu_sample_ring *ring = this_cpu(pmu_sample_ring);
+
+    wrmsrl(pmu_sample_evntsel_msr, 0);
+    wrmsrl(pmu_sample_ctr_msr, 0);
+    if ( pmu_sample_global_ctrl )
+    {
+        wrmsrl(MSR_CORE_PERF_GLOBAL_OVF_CTRL, 1);
+        wrmsrl(MSR_CORE_PERF_GLOBAL_CTRL, ring->saved_global_ctrl);
+    }
+    apic_write(APIC_LVTPC, ring->saved_lvtpc);
+}
+
+static void pmu_sample_free_rings(void)
+{
+    unsigned int cpu;
+
+    for_each_cpu ( cpu, &pmu_sample_cpus )
+    {
+        xfree(per_cpu(pmu_sample_ring, cpu));
+        per_cpu(pmu_sample_ring, cpu) = NULL;
+    }
+    cpumask_clear(&pmu_sample_cpus);
+}
+
+static int pmu_sample_start(uint64_t event, uint64_t period)
+{
+    unsigned int cpu;
+    int rc;
+
+    if ( pmu_sampling )
+        return -EBUSY;
+
+    if ( !period || period >= (1ULL << 31) || (event & ~0xffffULL) )
+        return -EINVAL;
+
+    switch ( boot_cpu_data.x86_vendor )
+    {
+    case X86_VENDOR_INTEL:
+        if ( !cpu_has_arch_perfmon )
+            return -EOPNOTSUPP;
+        pmu_sample_evntsel_msr = MSR_P6_EVNTSEL(0);
+        pmu_sample_ctr_msr = MSR_P6_PERFCTR(0);
+        pmu_sample_global_ctrl = (cpuid_eax(0xa) & 0xff) >= 2;
+        if ( !event )
+            event = INTEL_EVENT_CYCLES;
+        break;
+
+    case X86_VENDOR_AMD:
+        pmu_sample_evntsel_msr = MSR_K7_EVNTSEL0;
+        pmu_sample_ctr_msr = MSR_K7_PERFCTR0;
+        pmu_sample_global_ctrl = false;
+        if ( !event )
+            event = AMD_EVENT_CYCLES;
+        break;
+
+    default:
+        return -EOPNOTSUPP;
+    }
+
+    cpumask_copy(&pmu_sample_cpus, &cpu_online_map);
+    for_each_cpu ( cpu, &pmu_sample_cpus )
+    {
+        per_cpu(pmu_sample_ring, cpu) = xzalloc(struct pmu_sample_ring);
+        if ( !per_cpu(pmu_sample_ring, cpu) )
+        {
+            rc = -ENOMEM;
+            goto fail;
+        }
+    }
+
+    rc = vpmu_claim_hw();
+    if ( rc )
+        goto fail;
+
+    /* Also stops the NMI watchdog, and fails while xenoprof is active. */
+    if ( reserve_lapic_nmi() )
+    {
+        vpmu_release_hw();
+        rc = -EBUSY;
+        goto fail;
+    }
+
+    pmu_sample_evntsel = event | EVNTSEL_USR | EVNTSEL_OS | EVNTSEL_INT |
+                         EVNTSEL_EN;
+    pmu_sample_period = period;
+    pmu_sampling = true;
+
+    on_selected_cpus(&pmu_sample_cpus, pmu_sample_enable, NULL, 1);
+
+    return 0;
+
+ fail:
+    pmu_sample_free_rings();
+    return rc;
+}
+
+static int pmu_sample_stop(void)
+{
+    cpumask_t cpus;
+
+    if ( !pmu_sampling )
+        return -EINVAL;
+
+    /*
+     * Once every pCPU has run pmu_sample_disable(), no PMU interrupt is
+     * in progress and later ones see !pmu_sampling: the rings can go.
+     */
+    pmu_sampling = false;
+    cpumask_and(&cpus, &pmu_sample_cpus, &cpu_online_map);
+    on_selected_cpus(&cpus, pmu_sample_disable, NULL, 1);
+
+    release_lapic_nmi();
+    vpmu_release_hw();
+    pmu_sample_free_rings();
+
+    return 0;
+}
+
+static int pmu_sample_read(struct xen_sysctl_pmu_sample *op)
+{
+    struct pmu_sample_ring *ring;
+    unsigned int cons, prod, nr, done, idx, n, lost;
+
+    if ( !pmu_sampling )
+        return -EINVAL;
+
+    if ( op->cpu >= nr_cpu_ids || !cpumask_test_cpu(op->cpu, &pmu_sample_cpus) )
+        return -EINVAL;
+
+    ring = per_cpu(pmu_sample_ring, op->cpu);
+    cons = ring->cons;
+    prod = read_atomic(&ring->prod);
+    smp_rmb();
+
+    nr = min(prod - cons, op->nr_samples);
+    for ( done = 0; done < nr; done += n )
+    {
+        idx = (cons + done) & (PMU_SAMPLE_RING_SIZE - 1);
+        n = min(nr - done, PMU_SAMPLE_RING_SIZE - idx);
+        if ( copy_to_guest_offset(op->samples, done, &ring->rec[idx], n) )
+            return -EFAULT;
+    }
+
+    /* Records must be read before their slots are handed back. */
+    smp_mb();
+    write_atomic(&ring->cons, cons + nr);
+
+    lost = read_atomic(&ring->lost);
+    op->lost = lost - ring->lost_read;
+    ring->lost_read = lost;
+    op->nr_samples = nr;
+
+    return 0;
+}
+
+int pmu_sample_op(struct xen_sysctl_pmu_sample *op)
+{
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_PMU_SAMPLE_start:
+        return pmu_sample_start(op->event, op->period);
+
+    case XEN_SYSCTL_PMU_SAMPLE_stop:
+        return pmu_sample_stop();
+
+    case XEN_SYSCTL_PMU_SAMPLE_read:
+        return pmu_sample_read(op);
+    }
+
+    return -EOPNOTSUPP;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -58,6 +58,7 @@ custom_param("vpmu", parse_vpmu_params);
 
 static DEFINE_SPINLOCK(vpmu_lock);
 static unsigned vpmu_count;
+static bool vpmu_hw_claimed;
 
 static DEFINE_PER_CPU(struct vcpu *, last_vcpu);
 
@@ -490,6 +491,9 @@ static int vpmu_arch_initialise(struct vcpu *v)
 
     vpmu->hw_lapic_lvtpc = PMU_APIC_VECTOR | APIC_LVT_MASKED;
 
+    /* CPUID leaves 0x1 and 0xa reflect the vPMU's capabilities. */
+    cpuid_cache_flush(v);
+
     if ( ret )
         printk(XENLOG_G_WARNING "VPMU: Initialization failed for %pv\n", v);
 
@@ -536,6 +540,8 @@ static void put_vpmu(struct vcpu *v)
               (vpmu_mode != XENPMU_MODE_OFF) )
         vpmu_reset(vcpu_vpmu(v), VPMU_AVAILABLE);
 
+    cpuid_cache_flush(v);
+
  out:
     spin_unlock(&vpmu_lock);
 }
@@ -552,6 +558,34 @@ void vpmu_initialise(struct vcpu *v)
         put_vpmu(v);
 }
 
+/*
+ * Xen's own use of the PMU hardware (see pmu_sample.c) excludes the vPMU:
+ * it can only be claimed while the vPMU is off, and the vPMU cannot be
+ * turned back on until it is released.
+ */
+int vpmu_claim_hw(void)
+{
+    int ret = 0;
+
+    spin_lock(&vpmu_lock);
+
+    if ( vpmu_mode != XENPMU_MODE_OFF || vpmu_count || vpmu_hw_claimed )
+        ret = -EBUSY;
+    else
+        vpmu_hw_claimed = true;
+
+    spin_unlock(&vpmu_lock);
+
+    return ret;
+}
+
+void vpmu_release_hw(void)
+{
+    spin_lock(&vpmu_lock);
+    vpmu_hw_claimed = false;
+    spin_unlock(&vpmu_lock);
+}
+
 static void vpmu_clear_last(void *arg)
 {
     if ( this_cpu(last_vcpu) == arg )
@@ -742,9 +776,15 @@ long do_xenpmu_op(unsigned int op, XEN_GUEST_HANDLE_PARAM(xen_pmu_params_t) arg)
          * We can always safely switch between XENPMU_MODE_SELF and
          * XENPMU_MODE_HV while other VPMUs are active.
          */
-        if ( (vpmu_count == 0) ||
-             ((vpmu_mode ^ pmu_params.val) ==
-              (XENPMU_MODE_SELF | XENPMU_MODE_HV)) )
+        if ( vpmu_hw_claimed && pmu_params.val != XENPMU_MODE_OFF )
+        {
+            gprintk(XENLOG_WARNING,
+                    "VPMU: Cannot change mode while Xen is sampling\n");
+            ret = -EBUSY;
+        }
+        else if ( (vpmu_count == 0) ||
+                  ((vpmu_mode ^ pmu_params.val) ==
+                   (XENPMU_MODE_SELF | XENPMU_MODE_HV)) )
             vpmu_mode = pmu_params.val;
         else if ( vpmu_mode != pmu_params.val )
         {
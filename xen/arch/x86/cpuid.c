@@ -1,6 +1,7 @@
 #include <xen/init.h>
 #include <xen/lib.h>
 #include <xen/sched.h>
+#include <xen/perfc.h>
 #include <asm/cpuid.h>
 #include <asm/hvm/hvm.h>
 #include <asm/hvm/nestedhvm.h>
@@ -454,8 +455,12 @@ void recalculate_cpuid_policy(struct domain *d)
     const struct cpuid_policy *max =
         is_pv_domain(d) ? &pv_max_cpuid_policy : &hvm_max_cpuid_policy;
     uint32_t fs[FSCAPINTS], max_fs[FSCAPINTS];
+    struct vcpu *v;
     unsigned int i;
 
+    for_each_vcpu ( d, v )
+        cpuid_cache_flush(v);
+
     p->x86_vendor = get_cpu_vendor(p->basic.vendor_ebx, p->basic.vendor_ecx,
                                    p->basic.vendor_edx, gcv_guest);
 
@@ -593,8 +598,83 @@ int init_domain_cpuid_policy(struct domain *d)
     return 0;
 }
 
-void guest_cpuid(const struct vcpu *v, uint32_t leaf,
-                 uint32_t subleaf, struct cpuid_leaf *res)
+int init_vcpu_cpuid_cache(struct vcpu *v)
+{
+    struct cpuid_cache *c = xzalloc(struct cpuid_cache);
+
+    if ( !c )
+        return -ENOMEM;
+
+    /* Entries start out with generation 0, i.e. invalid. */
+    c->gen = 1;
+    v->arch.cpuid_cache = c;
+
+    return 0;
+}
+
+void cpuid_cache_flush(struct vcpu *v)
+{
+    struct cpuid_cache *c = v->arch.cpuid_cache;
+
+    if ( c && unlikely(!++c->gen) )
+    {
+        /* Wrapped.  Scrub the entries so none can match generation 0. */
+        memset(c->ent, 0, sizeof(c->ent));
+        c->gen = 1;
+    }
+}
+
+/*
+ * Whether the result for @leaf, once dynamically adjusted, depends only on
+ * state which invalidates the cache when it changes.  Hypervisor leaves are
+ * cheap to generate but contain time-varying data, and a number of the PV
+ * adjustments depend on the trap currently being serviced.
+ */
+static bool cpuid_cacheable(const struct domain *d, uint32_t leaf)
+{
+    if ( leaf >= CPUID_GUEST_NR_BASIC &&
+         (leaf < 0x80000000 || leaf >= 0x80000000 + CPUID_GUEST_NR_EXTD) )
+        return false;
+
+    switch ( leaf )
+    {
+    case 0x1:
+        return is_hvm_domain(d);
+
+    case 0x5:
+    case 0x80000001:
+        return is_hvm_domain(d) || !is_hardware_domain(d);
+
+    case 0x8000001c: /* Depends on LWP_CFG. */
+        return false;
+    }
+
+    return true;
+}
+
+static struct cpuid_cache_entry *cpuid_cache_slot(
+    struct cpuid_cache *c, uint32_t leaf, uint32_t *subleaf)
+{
+    /* Only these leaves have subleaves; ignore ECX for all others. */
+    switch ( leaf )
+    {
+    case 0x4:
+    case 0x7:
+    case 0xb:
+    case XSTATE_CPUID:
+        break;
+
+    default:
+        *subleaf = 0;
+        break;
+    }
+
+    return &c->ent[(leaf + (leaf >> 28) + *subleaf) &
+                   (CPUID_CACHE_ENTRIES - 1)];
+}
+
+static void cpuid_uncached(const struct vcpu *v, uint32_t leaf,
+                           uint32_t subleaf, struct cpuid_leaf *res)
 {
     const struct domain *d = v->domain;
     const struct cpuid_policy *p = d->arch.cpuid;
@@ -960,6 +1040,38 @@ void guest_cpuid(const struct vcpu *v, uint32_t leaf,
     }
 }
 
+void guest_cpuid(const struct vcpu *v, uint32_t leaf,
+                 uint32_t subleaf, struct cpuid_leaf *res)
+{
+    struct vcpu *curr = current;
+    struct cpuid_cache *c = curr->arch.cpuid_cache;
+    struct cpuid_cache_entry *ent;
+    uint32_t key = subleaf;
+
+    /*
+     * Results are only cached in the context of the vcpu itself, as no
+     * dynamic adjustments are made otherwise.
+     */
+    if ( v != curr || !c || !cpuid_cacheable(v->domain, leaf) )
+        return cpuid_uncached(v, leaf, subleaf, res);
+
+    ent = cpuid_cache_slot(c, leaf, &key);
+    if ( ent->gen == c->gen && ent->leaf == leaf && ent->subleaf == key )
+    {
+        perfc_incr(cpuid_cache_hit);
+        *res = ent->res;
+        return;
+    }
+
+    perfc_incr(cpuid_cache_miss);
+    cpuid_uncached(v, leaf, subleaf, res);
+
+    ent->leaf = leaf;
+    ent->subleaf = key;
+    ent->res = *res;
+    ent->gen = c->gen;
+}
+
 static void __init __maybe_unused build_assertions(void)
 {
     BUILD_BUG_ON(ARRAY_SIZE(known_features) != FSCAPINTS);
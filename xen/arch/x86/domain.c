@@ -57,6 +57,7 @@
 #include <asm/msr.h>
 #include <asm/traps.h>
 #include <asm/nmi.h>
+#include <asm/numa_balance.h>
 #include <asm/mce.h>
 #include <asm/amd.h>
 #include <xen/numa.h>
@@ -363,6 +364,9 @@ int vcpu_initialise(struct vcpu *v)
 
         if ( (rc = init_vcpu_msr_policy(v)) )
             goto fail;
+
+        if ( (rc = init_vcpu_cpuid_cache(v)) )
+            goto fail;
     }
 
     return rc;
@@ -371,6 +375,8 @@ int vcpu_initialise(struct vcpu *v)
     vcpu_destroy_fpu(v);
     xfree(v->arch.msr);
     v->arch.msr = NULL;
+    xfree(v->arch.cpuid_cache);
+    v->arch.cpuid_cache = NULL;
 
     return rc;
 }
@@ -380,6 +386,9 @@ void vcpu_destroy(struct vcpu *v)
     xfree(v->arch.vm_event);
     v->arch.vm_event = NULL;
 
+    xfree(v->arch.cpuid_cache);
+    v->arch.cpuid_cache = NULL;
+
     vcpu_destroy_fpu(v);
 
     if ( !is_idle_domain(v->domain) )
@@ -956,6 +965,7 @@ int arch_set_info_guest(
     cr4 = v->arch.pv_vcpu.ctrlreg[4];
     v->arch.pv_vcpu.ctrlreg[4] = cr4 ? pv_guest_cr4_fixup(v, cr4) :
         real_cr4_to_pv_guest_cr4(mmu_cr4_features);
+    cpuid_cache_flush(v);
 
     memset(v->arch.debugreg, 0, sizeof(v->arch.debugreg));
     for ( i = 0; i < 8; i++ )
@@ -1792,12 +1802,71 @@ void sync_vcpu_execstate(struct vcpu *v)
     flush_tlb_mask(v->vcpu_dirty_cpumask);
 }
 
+/*
+ * A run of pages with contiguous MFNs on one node, which relinquish_memory()
+ * dropped the last reference to.  Freeing them in as large chunks as their
+ * alignment allows takes the heap lock and merges buddies once per chunk
+ * rather than once per page, which for large guests dominates teardown.
+ */
+struct relmem_run {
+    struct page_info *pg;
+    unsigned long nr;
+};
+
+/* Bound the time spent freeing without a preemption check. */
+#define RELMEM_RUN_MAX (1UL << PAGE_ORDER_2M)
+
+static void relmem_run_flush(struct relmem_run *run)
+{
+    while ( run->nr )
+    {
+        unsigned long mfn = page_to_mfn(run->pg);
+        unsigned int order = flsl(run->nr) - 1;
+
+        if ( mfn )
+            order = min(order, find_first_set_bit(mfn));
+        free_domheap_pages(run->pg, order);
+        run->pg += 1UL << order;
+        run->nr -= 1UL << order;
+    }
+}
+
+/*
+ * Drop relinquish_memory()'s reference to @page, which must already be on
+ * d->arch.relmem_list.  If it was the last one, the page is queued on @run
+ * rather than freed right away; put_page() would free it the same way.
+ */
+static void relmem_put_page(struct relmem_run *run, struct page_info *page)
+{
+    unsigned long x = page->count_info;
+
+    if ( is_xen_heap_page(page) || (x & PGC_count_mask) != 1 ||
+         (x & PGC_cacheattr_mask) || cmpxchg(&page->count_info, x, x - 1) != x )
+    {
+        put_page(page);
+        return;
+    }
+
+    if ( run->nr &&
+         (page != run->pg + run->nr ||
+          page_to_mfn(page) != page_to_mfn(run->pg) + run->nr ||
+          phys_to_nid(page_to_maddr(page)) !=
+          phys_to_nid(page_to_maddr(run->pg))) )
+        relmem_run_flush(run);
+
+    if ( !run->nr )
+        run->pg = page;
+    if ( ++run->nr == RELMEM_RUN_MAX )
+        relmem_run_flush(run);
+}
+
 static int relinquish_memory(
     struct domain *d, struct page_list_head *list, unsigned long type)
 {
     struct page_info  *page;
     unsigned long     x, y;
     int               ret = 0;
+    struct relmem_run run = { .nr = 0 };
 
     /* Use a recursive lock, as we may enter 'free_domheap_page'. */
     spin_lock_recursive(&d->page_alloc_lock);
@@ -1885,7 +1954,7 @@ static int relinquish_memory(
 
         /* Put the page on the list and /then/ potentially free it. */
         page_list_add_tail(page, &d->arch.relmem_list);
-        put_page(page);
+        relmem_put_page(&run, page);
 
         if ( hypercall_preempt_check() )
         {
@@ -1894,10 +1963,14 @@ static int relinquish_memory(
         }
     }
 
+    /* The queued pages must be off relmem_list before it gets moved. */
+    relmem_run_flush(&run);
+
     /* list is empty at this point. */
     page_list_move(list, &d->arch.relmem_list);
 
  out:
+    relmem_run_flush(&run);
     spin_unlock_recursive(&d->page_alloc_lock);
     return ret;
 }
@@ -1912,6 +1985,8 @@ int domain_relinquish_resources(struct domain *d)
     switch ( d->arch.relmem )
     {
     case RELMEM_not_started:
+        numa_balance_disable(d);
+
         ret = pci_release_devices(d);
         if ( ret )
             return ret;
@@ -1962,6 +2037,9 @@ int domain_relinquish_resources(struct domain *d)
             ret = relinquish_shared_pages(d);
             if ( ret )
                 return ret;
+
+            /* A fork no longer needs its parent's memory. */
+            mem_sharing_fork_release(d);
         }
 
         d->arch.relmem = RELMEM_xen;
@@ -62,17 +62,71 @@ void __init mapcache_override_current(struct vcpu *v)
     this_cpu(override) = v;
 }
 
-#define mapcache_l2_entry(e) ((e) >> PAGETABLE_ORDER)
-#define MAPCACHE_L2_ENTRIES (mapcache_l2_entry(MAPCACHE_ENTRIES - 1) + 1)
 #define MAPCACHE_L1ENT(idx) \
     __linear_l1_table[l1_linear_offset(MAPCACHE_VIRT_START + pfn_to_paddr(idx))]
 
+/*
+ * Each vCPU owns MAPCACHE_VCPU_ENTRIES slots of its domain's mapcache, so
+ * slots never need a lock, and stale TLB entries for them can only exist on
+ * the pCPU the vCPU runs on: moving it to another pCPU involves a CR3 load
+ * there (or a flush of the pCPU which lazily kept its state).
+ *
+ * Unmapped slots are left mapped as garbage, so that mapping the same page
+ * again soon doesn't need a new PTE.  Only once all slots are in use or
+ * garbage, the latter get zapped together and followed by a single flush.
+ */
+#define MAPCACHE_VCPU_FIRST(v) ((v)->vcpu_id * MAPCACHE_VCPU_ENTRIES)
+#define MAPCACHE_VCPU_MASK     ((1UL << MAPCACHE_VCPU_ENTRIES) - 1)
+
+static unsigned int mapcache_reap(struct mapcache_vcpu *vcache,
+                                  unsigned int first, unsigned long mfn)
+{
+    unsigned long avail;
+    unsigned int i;
+
+    if ( !vcache->garbage )
+    {
+        /* Replace a hash entry instead. */
+        i = MAPHASH_HASHFN(mfn);
+        do {
+            struct vcpu_maphash_entry *hashent = &vcache->hash[i];
+
+            if ( hashent->idx != MAPHASHENT_NOTINUSE && !hashent->refcnt )
+            {
+                ASSERT(l1e_get_pfn(MAPCACHE_L1ENT(hashent->idx)) ==
+                       hashent->mfn);
+                __clear_bit(hashent->idx - first, &vcache->inuse);
+                __set_bit(hashent->idx - first, &vcache->garbage);
+                hashent->idx = MAPHASHENT_NOTINUSE;
+                hashent->mfn = ~0UL;
+                break;
+            }
+            if ( ++i == MAPHASH_ENTRIES )
+                i = 0;
+        } while ( i != MAPHASH_HASHFN(mfn) );
+    }
+    BUG_ON(!vcache->garbage);
+
+    /* /First/, zap the PTEs. */
+    for ( avail = vcache->garbage; avail; avail &= avail - 1 )
+        l1e_write(&MAPCACHE_L1ENT(first + find_first_set_bit(avail)),
+                  l1e_empty());
+
+    /* /Second/, flush TLBs. */
+    perfc_incr(domain_page_tlb_flush);
+    flush_tlb_local();
+
+    avail = vcache->garbage;
+    vcache->garbage = 0;
+
+    return find_first_set_bit(avail);
+}
+
 void *map_domain_page(mfn_t mfn)
 {
-    unsigned long flags;
-    unsigned int idx, i;
+    unsigned long flags, avail;
+    unsigned int idx, first, i;
     struct vcpu *v;
-    struct mapcache_domain *dcache;
     struct mapcache_vcpu *vcache;
     struct vcpu_maphash_entry *hashent;
 
@@ -85,11 +139,12 @@ void *map_domain_page(mfn_t mfn)
     if ( !v || !is_pv_vcpu(v) )
         return mfn_to_virt(mfn_x(mfn));
 
-    dcache = &v->domain->arch.pv_domain.mapcache;
-    vcache = &v->arch.pv_vcpu.mapcache;
-    if ( !dcache->inuse )
+    if ( !v->domain->arch.pv_domain.mapcache.enabled )
         return mfn_to_virt(mfn_x(mfn));
 
+    vcache = &v->arch.pv_vcpu.mapcache;
+    first = MAPCACHE_VCPU_FIRST(v);
+
     perfc_incr(map_domain_page_count);
 
     local_irq_save(flags);
@@ -98,75 +153,38 @@ void *map_domain_page(mfn_t mfn)
     if ( hashent->mfn == mfn_x(mfn) )
     {
         idx = hashent->idx;
-        ASSERT(idx < dcache->entries);
+        ASSERT(idx - first < MAPCACHE_VCPU_ENTRIES);
         hashent->refcnt++;
         ASSERT(hashent->refcnt);
         ASSERT(l1e_get_pfn(MAPCACHE_L1ENT(idx)) == mfn_x(mfn));
+        perfc_incr(map_domain_page_hit);
         goto out;
     }
 
-    spin_lock(&dcache->lock);
-
-    /* Has some other CPU caused a wrap? We must flush if so. */
-    if ( unlikely(dcache->epoch != vcache->shadow_epoch) )
+    /* A garbage slot may still map the page. */
+    for ( avail = vcache->garbage; avail; avail &= avail - 1 )
     {
-        vcache->shadow_epoch = dcache->epoch;
-        if ( NEED_FLUSH(this_cpu(tlbflush_time), dcache->tlbflush_timestamp) )
+        i = find_first_set_bit(avail);
+        if ( l1e_get_pfn(MAPCACHE_L1ENT(first + i)) == mfn_x(mfn) )
         {
-            perfc_incr(domain_page_tlb_flush);
-            flush_tlb_local();
+            __clear_bit(i, &vcache->garbage);
+            perfc_incr(map_domain_page_hit);
+            goto claim;
         }
     }
 
-    idx = find_next_zero_bit(dcache->inuse, dcache->entries, dcache->cursor);
-    if ( unlikely(idx >= dcache->entries) )
-    {
-        unsigned long accum = 0, prev = 0;
-
-        /* /First/, clean the garbage map and update the inuse list. */
-        for ( i = 0; i < BITS_TO_LONGS(dcache->entries); i++ )
-        {
-            accum |= prev;
-            dcache->inuse[i] &= ~xchg(&dcache->garbage[i], 0);
-            prev = ~dcache->inuse[i];
-        }
-
-        if ( accum | (prev & BITMAP_LAST_WORD_MASK(dcache->entries)) )
-            idx = find_first_zero_bit(dcache->inuse, dcache->entries);
-        else
-        {
-            /* Replace a hash entry instead. */
-            i = MAPHASH_HASHFN(mfn_x(mfn));
-            do {
-                hashent = &vcache->hash[i];
-                if ( hashent->idx != MAPHASHENT_NOTINUSE && !hashent->refcnt )
-                {
-                    idx = hashent->idx;
-                    ASSERT(l1e_get_pfn(MAPCACHE_L1ENT(idx)) == hashent->mfn);
-                    l1e_write(&MAPCACHE_L1ENT(idx), l1e_empty());
-                    hashent->idx = MAPHASHENT_NOTINUSE;
-                    hashent->mfn = ~0UL;
-                    break;
-                }
-                if ( ++i == MAPHASH_ENTRIES )
-                    i = 0;
-            } while ( i != MAPHASH_HASHFN(mfn_x(mfn)) );
-        }
-        BUG_ON(idx >= dcache->entries);
-
-        /* /Second/, flush TLBs. */
-        perfc_incr(domain_page_tlb_flush);
-        flush_tlb_local();
-        vcache->shadow_epoch = ++dcache->epoch;
-        dcache->tlbflush_timestamp = tlbflush_current_time();
-    }
+    perfc_incr(map_domain_page_miss);
 
-    set_bit(idx, dcache->inuse);
-    dcache->cursor = idx + 1;
+    avail = ~(vcache->inuse | vcache->garbage) & MAPCACHE_VCPU_MASK;
+    i = avail ? find_first_set_bit(avail)
+              : mapcache_reap(vcache, first, mfn_x(mfn));
 
-    spin_unlock(&dcache->lock);
+    l1e_write(&MAPCACHE_L1ENT(first + i),
+              l1e_from_mfn(mfn, __PAGE_HYPERVISOR_RW));
 
-    l1e_write(&MAPCACHE_L1ENT(idx), l1e_from_mfn(mfn, __PAGE_HYPERVISOR_RW));
+ claim:
+    __set_bit(i, &vcache->inuse);
+    idx = first + i;
 
  out:
     local_irq_restore(flags);
@@ -175,9 +193,9 @@ void *map_domain_page(mfn_t mfn)
 
 void unmap_domain_page(const void *ptr)
 {
-    unsigned int idx;
+    unsigned int idx, first;
     struct vcpu *v;
-    struct mapcache_domain *dcache;
+    struct mapcache_vcpu *vcache;
     unsigned long va = (unsigned long)ptr, mfn, flags;
     struct vcpu_maphash_entry *hashent;
 
@@ -188,13 +206,15 @@ void unmap_domain_page(const void *ptr)
 
     v = mapcache_current_vcpu();
     ASSERT(v && is_pv_vcpu(v));
+    ASSERT(v->domain->arch.pv_domain.mapcache.enabled);
 
-    dcache = &v->domain->arch.pv_domain.mapcache;
-    ASSERT(dcache->inuse);
-
+    vcache = &v->arch.pv_vcpu.mapcache;
+    first = MAPCACHE_VCPU_FIRST(v);
     idx = PFN_DOWN(va - MAPCACHE_VIRT_START);
+    ASSERT(idx - first < MAPCACHE_VCPU_ENTRIES);
+    ASSERT(test_bit(idx - first, &vcache->inuse));
     mfn = l1e_get_pfn(MAPCACHE_L1ENT(idx));
-    hashent = &v->arch.pv_vcpu.mapcache.hash[MAPHASH_HASHFN(mfn)];
+    hashent = &vcache->hash[MAPHASH_HASHFN(mfn)];
 
     local_irq_save(flags);
 
@@ -208,12 +228,11 @@ void unmap_domain_page(const void *ptr)
     {
         if ( hashent->idx != MAPHASHENT_NOTINUSE )
         {
-            /* /First/, zap the PTE. */
+            /* Retire the previous entry to garbage. */
             ASSERT(l1e_get_pfn(MAPCACHE_L1ENT(hashent->idx)) ==
                    hashent->mfn);
-            l1e_write(&MAPCACHE_L1ENT(hashent->idx), l1e_empty());
-            /* /Second/, mark as garbage. */
-            set_bit(hashent->idx, dcache->garbage);
+            __clear_bit(hashent->idx - first, &vcache->inuse);
+            __set_bit(hashent->idx - first, &vcache->garbage);
         }
 
         /* Add newly-freed mapping to the maphash. */
@@ -222,10 +241,8 @@ void unmap_domain_page(const void *ptr)
     }
     else
     {
-        /* /First/, zap the PTE. */
-        l1e_write(&MAPCACHE_L1ENT(idx), l1e_empty());
-        /* /Second/, mark as garbage. */
-        set_bit(idx, dcache->garbage);
+        __clear_bit(idx - first, &vcache->inuse);
+        __set_bit(idx - first, &vcache->garbage);
     }
 
     local_irq_restore(flags);
@@ -234,7 +251,6 @@ void unmap_domain_page(const void *ptr)
 int mapcache_domain_init(struct domain *d)
 {
     struct mapcache_domain *dcache = &d->arch.pv_domain.mapcache;
-    unsigned int bitmap_pages;
 
     if ( !is_pv_domain(d) || is_idle_domain(d) )
         return 0;
@@ -244,30 +260,24 @@ int mapcache_domain_init(struct domain *d)
         return 0;
 #endif
 
-    BUILD_BUG_ON(MAPCACHE_VIRT_END + PAGE_SIZE * (3 +
-                 2 * PFN_UP(BITS_TO_LONGS(MAPCACHE_ENTRIES) * sizeof(long))) >
+    BUILD_BUG_ON(MAPCACHE_VIRT_END >
                  MAPCACHE_VIRT_START + (PERDOMAIN_SLOT_MBYTES << 20));
-    bitmap_pages = PFN_UP(BITS_TO_LONGS(MAPCACHE_ENTRIES) * sizeof(long));
-    dcache->inuse = (void *)MAPCACHE_VIRT_END + PAGE_SIZE;
-    dcache->garbage = dcache->inuse +
-                      (bitmap_pages + 1) * PAGE_SIZE / sizeof(long);
+    BUILD_BUG_ON(MAPCACHE_VCPU_ENTRIES >= BITS_PER_LONG);
 
-    spin_lock_init(&dcache->lock);
+    dcache->enabled = true;
 
-    return create_perdomain_mapping(d, (unsigned long)dcache->inuse,
-                                    2 * bitmap_pages + 1,
-                                    NIL(l1_pgentry_t *), NULL);
+    return 0;
 }
 
 int mapcache_vcpu_init(struct vcpu *v)
 {
     struct domain *d = v->domain;
     struct mapcache_domain *dcache = &d->arch.pv_domain.mapcache;
+    struct mapcache_vcpu *vcache = &v->arch.pv_vcpu.mapcache;
     unsigned long i;
     unsigned int ents = d->max_vcpus * MAPCACHE_VCPU_ENTRIES;
-    unsigned int nr = PFN_UP(BITS_TO_LONGS(ents) * sizeof(long));
 
-    if ( !is_pv_vcpu(v) || !dcache->inuse )
+    if ( !is_pv_vcpu(v) || !dcache->enabled )
         return 0;
 
     if ( ents > dcache->entries )
@@ -276,25 +286,20 @@ int mapcache_vcpu_init(struct vcpu *v)
         int rc = create_perdomain_mapping(d, MAPCACHE_VIRT_START, ents,
                                           NIL(l1_pgentry_t *), NULL);
 
-        /* Populate bit maps. */
-        if ( !rc )
-            rc = create_perdomain_mapping(d, (unsigned long)dcache->inuse,
-                                          nr, NULL, NIL(struct page_info *));
-        if ( !rc )
-            rc = create_perdomain_mapping(d, (unsigned long)dcache->garbage,
-                                          nr, NULL, NIL(struct page_info *));
-
         if ( rc )
             return rc;
 
         dcache->entries = ents;
     }
 
+    vcache->inuse = 0;
+    vcache->garbage = 0;
+
     /* Mark all maphash entries as not in use. */
     BUILD_BUG_ON(MAPHASHENT_NOTINUSE < MAPCACHE_ENTRIES);
     for ( i = 0; i < MAPHASH_ENTRIES; i++ )
     {
-        struct vcpu_maphash_entry *hashent = &v->arch.pv_vcpu.mapcache.hash[i];
+        struct vcpu_maphash_entry *hashent = &vcache->hash[i];
 
         hashent->mfn = ~0UL; /* never valid to map */
         hashent->idx = MAPHASHENT_NOTINUSE;
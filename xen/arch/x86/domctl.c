@@ -32,6 +32,7 @@
 #include <xen/vm_event.h>
 #include <public/vm_event.h>
 #include <asm/mem_sharing.h>
+#include <asm/numa_balance.h>
 #include <asm/xstate.h>
 #include <asm/debugger.h>
 #include <asm/psr.h>
@@ -125,6 +126,15 @@ static int update_domain_cpuid_info(struct domain *d,
 
     recalculate_cpuid_policy(d);
 
+    if ( is_hvm_domain(d) )
+    {
+        struct vcpu *v;
+
+        /* MSR passthrough depends on the features offered. */
+        for_each_vcpu( d, v )
+            hvm_update_msr_passthrough(v);
+    }
+
     switch ( ctl->input[0] )
     {
     case 0:
@@ -1227,6 +1237,7 @@ long arch_do_domctl(
                 vcpu_pause(v);
                 v->arch.xcr0 = _xcr0;
                 v->arch.xcr0_accum = _xcr0_accum;
+                cpuid_cache_flush(v);
                 if ( _xcr0_accum & XSTATE_NONLAZY )
                     v->arch.nonlazy_xstate_used = 1;
                 compress_xsave_states(v, _xsave_area,
@@ -1506,6 +1517,16 @@ long arch_do_domctl(
         recalculate_cpuid_policy(d);
         break;
 
+    case XEN_DOMCTL_get_exit_stats:
+        ret = hvm_get_exit_stats(d, &domctl->u.exit_stats);
+        copyback = !ret;
+        break;
+
+    case XEN_DOMCTL_numa_balance:
+        ret = numa_balance_domctl(d, &domctl->u.numa_balance);
+        copyback = !ret;
+        break;
+
     default:
         ret = iommu_do_domctl(domctl, d, u_domctl);
         break;
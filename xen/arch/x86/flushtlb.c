@@ -90,6 +90,12 @@ void write_cr3(unsigned long cr3)
     local_irq_restore(flags);
 }
 
+/*
+ * Up to this many pages get flushed by INVLPG each, rather than by a full
+ * flush: beyond it, refilling the whole TLB becomes the cheaper option.
+ */
+#define FLUSH_INVLPG_MAX_ORDER 5
+
 /*
  * The return value of this function is the passed in "flags" argument with
  * bits cleared that have been fully (i.e. system-wide) taken care of, i.e.
@@ -105,16 +111,19 @@ unsigned int flush_area_local(const void *va, unsigned int flags)
 
     if ( flags & (FLUSH_TLB|FLUSH_TLB_GLOBAL) )
     {
-        if ( order == 0 )
+        if ( order <= FLUSH_INVLPG_MAX_ORDER )
         {
             /*
-             * We don't INVLPG multi-page regions because the 2M/4M/1G
-             * region may not have been mapped with a superpage. Also there
-             * are various errata surrounding INVLPG usage on superpages, and
-             * a full flush is in any case not *that* expensive.
+             * We don't INVLPG multi-page regions as a whole because the
+             * 2M/4M/1G region may not have been mapped with a superpage.
+             * Also there are various errata surrounding INVLPG usage on
+             * superpages.  Small regions are flushed page by page instead.
              */
-            asm volatile ( "invlpg %0"
-                           : : "m" (*(const char *)(va)) : "memory" );
+            const char *p = (const char *)((unsigned long)va & PAGE_MASK);
+            unsigned long i;
+
+            for ( i = 0; i < (1UL << order); i++, p += PAGE_SIZE )
+                asm volatile ( "invlpg %0" : : "m" (*p) : "memory" );
         }
         else
         {
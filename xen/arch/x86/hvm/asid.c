@@ -89,6 +89,7 @@ void hvm_asid_flush_vcpu(struct vcpu *v)
 {
     hvm_asid_flush_vcpu_asid(&v->arch.hvm_vcpu.n1asid);
     hvm_asid_flush_vcpu_asid(&vcpu_nestedhvm(v).nv_n2asid);
+    hvm_vcpu_io_flush_insn_fetch(&v->arch.hvm_vcpu.hvm_io);
 }
 
 void hvm_asid_flush_core(void)
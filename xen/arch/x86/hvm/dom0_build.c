@@ -85,22 +85,28 @@ static int __init modify_identity_mmio(struct domain *d, unsigned long pfn,
     return rc;
 }
 
-/* Populate a HVM memory range using the biggest possible order. */
+/*
+ * Populate a HVM memory range using the biggest possible order.  Chunks are
+ * kept aligned to their order within the guest physical address space, so
+ * that the p2m (and with it the IOMMU, when they share page tables) can map
+ * them with superpages.
+ */
 static int __init pvh_populate_memory_range(struct domain *d,
                                             unsigned long start,
                                             unsigned long nr_pages)
 {
-    unsigned int order, i = 0;
+    unsigned int max_order = MAX_ORDER, i = 0;
     struct page_info *page;
     int rc;
 #define MAP_MAX_ITER 64
 
-    order = MAX_ORDER;
     while ( nr_pages != 0 )
     {
         unsigned int range_order = get_order_from_pages(nr_pages + 1);
+        unsigned int order = min(range_order ? range_order - 1 : 0, max_order);
 
-        order = min(range_order ? range_order - 1 : 0, order);
+        if ( start )
+            order = min(order, find_first_set_bit(start));
         page = alloc_domheap_pages(d, order, dom0_memflags);
         if ( page == NULL )
         {
@@ -108,7 +114,7 @@ static int __init pvh_populate_memory_range(struct domain *d,
             {
                 /* Try again without any dom0_memflags. */
                 dom0_memflags = 0;
-                order = MAX_ORDER;
+                max_order = MAX_ORDER;
                 continue;
             }
             if ( order == 0 )
@@ -116,7 +122,7 @@ static int __init pvh_populate_memory_range(struct domain *d,
                 printk("Unable to allocate memory with order 0!\n");
                 return -ENOMEM;
             }
-            order--;
+            max_order = order - 1;
             continue;
         }
 
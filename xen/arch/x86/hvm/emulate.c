@@ -22,6 +22,7 @@
 #include <asm/hvm/hvm.h>
 #include <asm/hvm/ioreq.h>
 #include <asm/hvm/monitor.h>
+#include <asm/hvm/nestedhvm.h>
 #include <asm/hvm/trace.h>
 #include <asm/hvm/support.h>
 #include <asm/hvm/svm/svm.h>
@@ -54,6 +55,36 @@ static void hvmtrace_io_assist(const ioreq_t *p)
     trace_var(event, 0/*!cycles*/, size, buffer);
 }
 
+/*
+ * Record the bytes of an emulated instruction, with enough of the mode to
+ * decode them again, so that emulation can be replayed outside of a guest
+ * (see tools/tests/x86_emulator/bench_x86_emulator.c).
+ */
+static void hvmtrace_emulate(const struct hvm_emulate_ctxt *hvmemul_ctxt)
+{
+    struct {
+        uint8_t len, addr_size, sp_size, lma;
+        uint8_t insn[16];
+        uint64_t rip;
+    } __packed d;
+
+    if ( likely(!tb_init_done) )
+        return;
+
+    BUILD_BUG_ON(sizeof(d.insn) < sizeof(hvmemul_ctxt->insn_buf));
+    BUILD_BUG_ON(sizeof(d) > 7 * sizeof(uint32_t));
+
+    d.len = hvmemul_ctxt->insn_buf_bytes;
+    d.addr_size = hvmemul_ctxt->ctxt.addr_size;
+    d.sp_size = hvmemul_ctxt->ctxt.sp_size;
+    d.lma = hvmemul_ctxt->ctxt.lma;
+    memcpy(d.insn, hvmemul_ctxt->insn_buf, d.len);
+    memset(d.insn + d.len, 0, sizeof(d.insn) - d.len);
+    d.rip = hvmemul_ctxt->insn_buf_eip;
+
+    trace_var(TRC_HVM_EMULATE_INSN, 0/*!cycles*/, sizeof(d), &d);
+}
+
 static int null_read(const struct hvm_io_handler *io_handler,
                      uint64_t addr,
                      uint32_t size,
@@ -279,6 +310,9 @@ static int hvmemul_do_io(
         else
         {
             rc = hvm_send_ioreq(s, &p, 0);
+            /* A posted rep write may have been cut short by the ring. */
+            if ( rc == X86EMUL_OKAY )
+                *reps = vio->io_req.count = p.count;
             if ( rc != X86EMUL_RETRY || currd->is_shutting_down )
                 vio->io_req.state = STATE_IOREQ_NONE;
             else if ( data_is_addr )
@@ -369,6 +403,46 @@ static inline void hvmemul_release_page(struct page_info *page)
     put_page(page);
 }
 
+/*
+ * Pages of guest RAM one rep I/O may cover.  hvmemul_linear_to_phys() only
+ * hands out physically contiguous ranges, so the handler (or the device
+ * model) can be given several pages worth of repetitions in one request
+ * rather than a round trip per page.  4096 repetitions of 8 bytes need 8.
+ */
+#define HVMEMUL_IO_ADDR_PAGES 8
+
+/*
+ * Take a reference to a further page of a batch, if it is plain RAM.  Unlike
+ * hvmemul_acquire_page(), anything else (MMIO, paged out or shared pages)
+ * simply ends the batch early.
+ */
+static bool hvmemul_acquire_next_page(unsigned long gmfn,
+                                      struct page_info **page)
+{
+    p2m_type_t p2mt;
+
+    *page = get_page_from_gfn(current->domain, gmfn, &p2mt, P2M_ALLOC);
+    if ( !*page )
+        return false;
+
+    if ( p2m_is_ram(p2mt) && !p2m_is_paging(p2mt) && !p2m_is_shared(p2mt) )
+        return true;
+
+    put_page(*page);
+    return false;
+}
+
+/* Repetitions which fit within the first @nr_pages pages of the range. */
+static unsigned long hvmemul_io_addr_reps(unsigned int page_off,
+                                          unsigned int size, bool_t df,
+                                          unsigned int nr_pages)
+{
+    unsigned long span = (unsigned long)(nr_pages - 1) << PAGE_SHIFT;
+
+    return df ? (((page_off + size - 1) & ~PAGE_MASK) + span) / size
+              : (PAGE_SIZE - page_off + span) / size;
+}
+
 static int hvmemul_do_io_addr(
     bool_t is_mmio, paddr_t addr, unsigned long *reps,
     unsigned int size, uint8_t dir, bool_t df, paddr_t ram_gpa)
@@ -376,11 +450,13 @@ static int hvmemul_do_io_addr(
     struct vcpu *v = current;
     unsigned long ram_gmfn = paddr_to_pfn(ram_gpa);
     unsigned int page_off = ram_gpa & (PAGE_SIZE - 1);
-    struct page_info *ram_page[2];
+    struct page_info *ram_page[HVMEMUL_IO_ADDR_PAGES];
     unsigned int nr_pages = 0;
     unsigned long count;
     int rc;
 
+    BUILD_BUG_ON(HVMEMUL_IO_ADDR_PAGES < 2);
+
     rc = hvmemul_acquire_page(ram_gmfn, &ram_page[nr_pages]);
     if ( rc != X86EMUL_OKAY )
         goto out;
@@ -388,11 +464,7 @@ static int hvmemul_do_io_addr(
     nr_pages++;
 
     /* Detemine how many reps will fit within this page */
-    count = min_t(unsigned long,
-                  *reps,
-                  df ?
-                  ((page_off + size - 1) & ~PAGE_MASK) / size :
-                  (PAGE_SIZE - page_off) / size);
+    count = min(*reps, hvmemul_io_addr_reps(page_off, size, df, nr_pages));
 
     if ( count == 0 )
     {
@@ -411,6 +483,23 @@ static int hvmemul_do_io_addr(
         nr_pages++;
         count = 1;
     }
+    else
+    {
+        /*
+         * Extend the batch over the following pages.  Should one of them
+         * not be plain RAM, stop short, and let the emulator come back for
+         * the rest: that pass will deal with whatever is wrong with it.
+         */
+        while ( count < *reps && nr_pages < HVMEMUL_IO_ADDR_PAGES &&
+                hvmemul_acquire_next_page(df ? ram_gmfn - nr_pages
+                                             : ram_gmfn + nr_pages,
+                                          &ram_page[nr_pages]) )
+        {
+            nr_pages++;
+            count = min(*reps,
+                        hvmemul_io_addr_reps(page_off, size, df, nr_pages));
+        }
+    }
 
     rc = hvmemul_do_io(is_mmio, addr, &count, size, dir, df, 1,
                        ram_gpa);
@@ -2102,6 +2191,8 @@ static int _hvm_emulate_one(struct hvm_emulate_ctxt *hvmemul_ctxt,
     struct vcpu *curr = current;
     uint32_t new_intr_shadow;
     struct hvm_vcpu_io *vio = &curr->arch.hvm_vcpu.hvm_io;
+    struct hvm_exit_stats *stats = curr->arch.hvm_vcpu.exit_stats;
+    s_time_t start;
     int rc;
 
     hvm_emulate_init_per_insn(hvmemul_ctxt, vio->mmio_insn,
@@ -2109,10 +2200,18 @@ static int _hvm_emulate_one(struct hvm_emulate_ctxt *hvmemul_ctxt,
 
     vio->mmio_retry = 0;
 
+    start = NOW();
     rc = x86_emulate(&hvmemul_ctxt->ctxt, ops);
+    stats->emulation_ns += NOW() - start;
 
     if ( rc == X86EMUL_OKAY && vio->mmio_retry )
         rc = X86EMUL_RETRY;
+    /* Count instructions, not the passes needed to complete them. */
+    if ( rc != X86EMUL_RETRY )
+    {
+        stats->emulations++;
+        hvmtrace_emulate(hvmemul_ctxt);
+    }
     if ( rc != X86EMUL_RETRY )
     {
         vio->mmio_cache_count = 0;
@@ -2296,6 +2395,62 @@ void hvm_emulate_init_once(
     hvmemul_ctxt->ctxt.force_writeback = true;
 }
 
+/*
+ * Fetch the instruction at linear @addr, returning the number of bytes
+ * read.  Device drivers trap on the same few instructions over and over,
+ * so the translation of the last fetch is remembered and, while the guest
+ * has not flushed its TLB since, reused to read the bytes straight from
+ * guest physical memory.  The bytes themselves are always re-read, so
+ * modified code is seen.  Only shadowed guests use the cache: with HAP,
+ * guest TLB flushes are not visible to Xen.
+ */
+static unsigned int hvmemul_fetch_insn(
+    uint8_t *buf, unsigned long addr, unsigned int bytes, uint32_t pfec)
+{
+    struct vcpu *curr = current;
+    struct hvm_vcpu_io *vio = &curr->arch.hvm_vcpu.hvm_io;
+    unsigned long cr3 = curr->arch.hvm_vcpu.guest_cr[3];
+    unsigned int gen = read_atomic(&vio->insn_fetch_flushes);
+    bool cacheable = !paging_mode_hap(curr->domain) &&
+                     !nestedhvm_vcpu_in_guestmode(curr);
+    uint32_t walk_pfec = PFEC_page_present | PFEC_insn_fetch | pfec;
+    unsigned long gfn;
+
+    if ( cacheable && vio->insn_fetch.gen == gen &&
+         vio->insn_fetch.cr3 == cr3 && vio->insn_fetch.addr == addr &&
+         vio->insn_fetch.pfec == walk_pfec )
+    {
+        unsigned int len = min_t(unsigned int, bytes,
+                                 PAGE_SIZE - (addr & ~PAGE_MASK));
+
+        if ( hvm_copy_from_guest_phys(buf, vio->insn_fetch.gpa,
+                                      len) == HVMTRANS_okay )
+        {
+            perfc_incr(hvm_insn_fetch_hit);
+            return len;
+        }
+    }
+
+    if ( hvm_fetch_from_guest_linear(buf, addr, bytes, pfec,
+                                     NULL) != HVMTRANS_okay )
+        return 0;
+
+    if ( cacheable )
+    {
+        gfn = paging_gva_to_gfn(curr, addr, &walk_pfec);
+        if ( gfn != gfn_x(INVALID_GFN) )
+        {
+            vio->insn_fetch.cr3 = cr3;
+            vio->insn_fetch.addr = addr;
+            vio->insn_fetch.gpa = pfn_to_paddr(gfn) | (addr & ~PAGE_MASK);
+            vio->insn_fetch.pfec = PFEC_page_present | PFEC_insn_fetch | pfec;
+            vio->insn_fetch.gen = gen;
+        }
+    }
+
+    return bytes;
+}
+
 void hvm_emulate_init_per_insn(
     struct hvm_emulate_ctxt *hvmemul_ctxt,
     const unsigned char *insn_buf,
@@ -2332,11 +2487,9 @@ void hvm_emulate_init_per_insn(
                                         sizeof(hvmemul_ctxt->insn_buf),
                                         hvm_access_insn_fetch,
                                         &hvmemul_ctxt->seg_reg[x86_seg_cs],
-                                        &addr) &&
-             hvm_fetch_from_guest_linear(hvmemul_ctxt->insn_buf, addr,
-                                         sizeof(hvmemul_ctxt->insn_buf),
-                                         pfec, NULL) == HVMTRANS_okay) ?
-            sizeof(hvmemul_ctxt->insn_buf) : 0;
+                                        &addr) ?
+             hvmemul_fetch_insn(hvmemul_ctxt->insn_buf, addr,
+                                sizeof(hvmemul_ctxt->insn_buf), pfec) : 0);
     }
     else
     {
@@ -36,6 +36,7 @@
 #include <xen/rangeset.h>
 #include <xen/monitor.h>
 #include <xen/warning.h>
+#include <xen/lat_hist.h>
 #include <asm/shadow.h>
 #include <asm/hap.h>
 #include <asm/current.h>
@@ -269,7 +270,54 @@ void hvm_set_rdtsc_exiting(struct domain *d, bool_t enable)
     struct vcpu *v;
 
     for_each_vcpu ( d, v )
+    {
         hvm_funcs.set_rdtsc_exiting(v, enable);
+        /* TSC reads may be passed through exactly when RDTSC is. */
+        hvm_update_msr_passthrough(v);
+    }
+}
+
+/*
+ * MSRs which a guest may access without a VMEXIT, where hardware handles
+ * the access as the intercept would.  Whether that holds depends on the
+ * domain's CPUID policy and TSC mode, so hvm_update_msr_passthrough() is
+ * re-run whenever either changes.  Vendor code may still intercept an
+ * access it cannot pass through safely (e.g. lacking the VMCS controls to
+ * context switch the MSR), and always intercepts monitored MSRs.
+ */
+static bool msr_pt_tsc(const struct domain *d)
+{
+    /* Hardware applies the TSC offset and scaling to RDMSR too. */
+    return !d->arch.vtsc && !nestedhvm_enabled(d);
+}
+
+static bool msr_pt_mpx(const struct domain *d)
+{
+    return d->arch.cpuid->feat.mpx;
+}
+
+static const struct {
+    uint32_t msr;
+    unsigned int access;
+    bool (*allowed)(const struct domain *d);
+} hvm_msr_passthrough[] = {
+    { MSR_IA32_TSC,     HVM_MSR_PT_R,  msr_pt_tsc },
+    { MSR_IA32_BNDCFGS, HVM_MSR_PT_RW, msr_pt_mpx },
+};
+
+void hvm_update_msr_passthrough(struct vcpu *v)
+{
+    const struct domain *d = v->domain;
+    unsigned int i;
+
+    if ( !hvm_funcs.set_msr_passthrough )
+        return;
+
+    for ( i = 0; i < ARRAY_SIZE(hvm_msr_passthrough); i++ )
+        hvm_funcs.set_msr_passthrough(
+            v, hvm_msr_passthrough[i].msr,
+            hvm_msr_passthrough[i].allowed(d) ? hvm_msr_passthrough[i].access
+                                              : 0);
 }
 
 void hvm_get_guest_pat(struct vcpu *v, u64 *guest_pat)
@@ -496,6 +544,29 @@ void hvm_migrate_pirqs(struct vcpu *v)
     spin_unlock(&d->event_lock);
 }
 
+/*
+ * A vCPU which bounces between pCPUs would have its MSIs retargeted, and
+ * their IRTEs rewritten, on every move.  Within this window of the last
+ * retarget, leave it to hvm_do_IRQ_dpci(), which only moves an MSI once it
+ * keeps arriving on the wrong pCPU.
+ */
+#define PIRQ_FOLLOW_HOLDOFF MILLISECS(2)
+
+/* Called when @v starts running on a different pCPU. */
+void hvm_follow_pirqs(struct vcpu *v)
+{
+    s_time_t now = NOW();
+
+    if ( now - v->arch.hvm_vcpu.pirq_follow_time < PIRQ_FOLLOW_HOLDOFF )
+    {
+        perfc_incr(pirq_follow_holdoff);
+        return;
+    }
+
+    v->arch.hvm_vcpu.pirq_follow_time = now;
+    hvm_migrate_pirqs(v);
+}
+
 static bool hvm_get_pending_event(struct vcpu *v, struct x86_event *info)
 {
     info->cr2 = v->arch.hvm_vcpu.guest_cr[2];
@@ -508,6 +579,13 @@ void hvm_do_resume(struct vcpu *v)
 
     pt_restore_timer(v);
 
+    /*
+     * FPU state restored when the vcpu was scheduled in (see
+     * vcpu_restore_fpu_eager()): don't make the guest exit on #NM for it.
+     */
+    if ( v->fpu_dirtied && !nestedhvm_vcpu_in_guestmode(v) )
+        hvm_funcs.fpu_dirty_intercept();
+
     if ( !handle_hvm_io_completion(v) )
         return;
 
@@ -1313,6 +1391,7 @@ static int hvm_load_cpu_xsave_states(struct domain *d, hvm_domain_context_t *h)
 
     v->arch.xcr0 = ctxt->xcr0;
     v->arch.xcr0_accum = ctxt->xcr0_accum;
+    cpuid_cache_flush(v);
     if ( ctxt->xcr0_accum & XSTATE_NONLAZY )
         v->arch.nonlazy_xstate_used = 1;
     compress_xsave_states(v, &ctxt->save_area,
@@ -1464,6 +1543,15 @@ int hvm_vcpu_initialise(struct vcpu *v)
     int rc;
     struct domain *d = v->domain;
 
+    v->arch.hvm_vcpu.exit_stats = xzalloc(struct hvm_exit_stats);
+    v->arch.hvm_vcpu.gla_cache = xzalloc(struct hvm_gla_cache);
+    if ( !v->arch.hvm_vcpu.exit_stats || /* teardown: xfree */
+         !v->arch.hvm_vcpu.gla_cache )   /* teardown: xfree */
+    {
+        rc = -ENOMEM;
+        goto fail1;
+    }
+
     hvm_asid_flush_vcpu(v);
 
     spin_lock_init(&v->arch.hvm_vcpu.tm_lock);
@@ -1510,10 +1598,17 @@ int hvm_vcpu_initialise(struct vcpu *v)
         hvm_set_guest_tsc(v, 0);
     }
 
+    rc = viridian_vcpu_init(v);
+    if ( rc != 0 )
+        goto fail7;
+
     hvm_update_guest_vendor(v);
+    hvm_update_msr_passthrough(v);
 
     return 0;
 
+ fail7:
+    hvm_all_ioreq_servers_remove_vcpu(d, v);
  fail6:
     nestedhvm_vcpu_destroy(v);
  fail5:
@@ -1525,6 +1620,10 @@ int hvm_vcpu_initialise(struct vcpu *v)
  fail2:
     hvm_vcpu_cacheattr_destroy(v);
  fail1:
+    xfree(v->arch.hvm_vcpu.exit_stats);
+    v->arch.hvm_vcpu.exit_stats = NULL;
+    xfree(v->arch.hvm_vcpu.gla_cache);
+    v->arch.hvm_vcpu.gla_cache = NULL;
     return rc;
 }
 
@@ -1547,6 +1646,171 @@ void hvm_vcpu_destroy(struct vcpu *v)
     vlapic_destroy(v);
 
     hvm_vcpu_cacheattr_destroy(v);
+
+    xfree(v->arch.hvm_vcpu.exit_stats);
+    v->arch.hvm_vcpu.exit_stats = NULL;
+    xfree(v->arch.hvm_vcpu.gla_cache);
+    v->arch.hvm_vcpu.gla_cache = NULL;
+}
+
+/*
+ * Account a VM exit of current, handled since start, by exit reason (see
+ * XEN_DOMCTL_get_exit_stats), and in the lat-hist histograms.
+ */
+void hvm_vmexit_account(unsigned int reason, s_time_t start)
+{
+    struct hvm_exit_stats *stats = current->arch.hvm_vcpu.exit_stats;
+    s_time_t delta = NOW() - start;
+
+    stats->exits++;
+    stats->exit_ns += delta;
+    if ( reason < XEN_DOMCTL_EXIT_STATS_REASONS )
+    {
+        stats->reason[reason].count++;
+        stats->reason[reason].ns += delta;
+    }
+
+    if ( opt_lat_hist )
+        lat_hist_add(XEN_SYSCTL_LAT_HIST_vmexit, reason, delta);
+}
+
+/*
+ * Account an RDMSR/WRMSR intercept of current.  The table is keyed by
+ * MSR and probed linearly from a hash of it.
+ */
+void hvm_msr_exit_account(uint32_t msr, bool write)
+{
+    struct hvm_exit_stats *stats = current->arch.hvm_vcpu.exit_stats;
+    unsigned int i, slot = (msr * 0x9e3779b1u) >> 27;
+
+    BUILD_BUG_ON(HVM_EXIT_STATS_MSRS != 1u << (32 - 27));
+
+    for ( i = 0; msr && i < ARRAY_SIZE(stats->msr); i++ )
+    {
+        typeof(stats->msr[0]) *e =
+            &stats->msr[(slot + i) % ARRAY_SIZE(stats->msr)];
+
+        if ( !e->msr )
+            e->msr = msr;
+        if ( e->msr == msr )
+        {
+            if ( write )
+                e->writes++;
+            else
+                e->reads++;
+            return;
+        }
+    }
+
+    stats->msr_other++;
+}
+
+/* Sum the per-vCPU MSR exit counts of @d into the caller's buffer. */
+static int hvm_get_msr_exit_stats(struct domain *d,
+                                  struct xen_domctl_exit_stats *op)
+{
+    xen_domctl_exit_msr_t *msrs;
+    const struct hvm_exit_stats *stats;
+    const struct vcpu *v;
+    unsigned int i, j, nr = 0;
+    int rc = 0;
+
+    op->msr_other = 0;
+
+    msrs = xzalloc_array(xen_domctl_exit_msr_t, XEN_DOMCTL_EXIT_STATS_MSRS);
+    if ( !msrs )
+        return -ENOMEM;
+
+    for_each_vcpu ( d, v )
+    {
+        if ( !(stats = v->arch.hvm_vcpu.exit_stats) )
+            continue;
+
+        op->msr_other += stats->msr_other;
+
+        for ( i = 0; i < ARRAY_SIZE(stats->msr); i++ )
+        {
+            if ( !stats->msr[i].msr )
+                continue;
+
+            for ( j = 0; j < nr; j++ )
+                if ( msrs[j].msr == stats->msr[i].msr )
+                    break;
+
+            if ( j == nr )
+            {
+                if ( nr == XEN_DOMCTL_EXIT_STATS_MSRS )
+                {
+                    op->msr_other += stats->msr[i].reads +
+                                     stats->msr[i].writes;
+                    continue;
+                }
+                msrs[nr++].msr = stats->msr[i].msr;
+            }
+
+            msrs[j].reads += stats->msr[i].reads;
+            msrs[j].writes += stats->msr[i].writes;
+        }
+    }
+
+    if ( !guest_handle_is_null(op->msrs) &&
+         copy_to_guest(op->msrs, msrs, min(op->nr_msrs, nr)) )
+        rc = -EFAULT;
+
+    op->nr_msrs = nr;
+    xfree(msrs);
+
+    return rc;
+}
+
+int hvm_get_exit_stats(struct domain *d, struct xen_domctl_exit_stats *op)
+{
+    xen_domctl_exit_reason_t r;
+    const struct hvm_exit_stats *stats;
+    const struct vcpu *v;
+    unsigned int i;
+
+    if ( !is_hvm_domain(d) )
+        return -EOPNOTSUPP;
+
+    op->exits = op->exit_ns = 0;
+    op->emulations = op->emulation_ns = 0;
+    op->ioreqs = op->ioreq_ns = 0;
+
+    for_each_vcpu ( d, v )
+    {
+        if ( !(stats = v->arch.hvm_vcpu.exit_stats) )
+            continue;
+        op->exits += stats->exits;
+        op->exit_ns += stats->exit_ns;
+        op->emulations += stats->emulations;
+        op->emulation_ns += stats->emulation_ns;
+        op->ioreqs += stats->ioreqs;
+        op->ioreq_ns += stats->ioreq_ns;
+    }
+
+    if ( !guest_handle_is_null(op->reasons) )
+    {
+        for ( i = 0; i < min_t(unsigned int, op->nr_reasons,
+                               XEN_DOMCTL_EXIT_STATS_REASONS); i++ )
+        {
+            r.count = r.ns = 0;
+            for_each_vcpu ( d, v )
+            {
+                if ( !(stats = v->arch.hvm_vcpu.exit_stats) )
+                    continue;
+                r.count += stats->reason[i].count;
+                r.ns += stats->reason[i].ns;
+            }
+
+            if ( copy_to_guest_offset(op->reasons, i, &r, 1) )
+                return -EFAULT;
+        }
+    }
+
+    op->nr_reasons = XEN_DOMCTL_EXIT_STATS_REASONS;
+
+    return hvm_get_msr_exit_stats(d, op);
 }
 
 void hvm_vcpu_down(struct vcpu *v)
@@ -1719,6 +1983,42 @@ int hvm_hap_nested_page_fault(paddr_t gpa, unsigned long gla,
 
     ap2m_active = altp2m_active(currd);
 
+    /*
+     * Faults that leave the p2m alone (emulated MMIO, and spurious faults
+     * another vCPU already resolved) only need a snapshot of the entry,
+     * taken under the p2m read lock, so that vCPUs faulting in parallel
+     * don't serialise on the p2m write lock below.  Anything involving
+     * access restrictions, altp2m, nested p2ms, or populating the entry
+     * (PoD, paging, sharing, forks, log-dirty) takes the slow path.
+     */
+    if ( !ap2m_active && !nestedhvm_vcpu_in_guestmode(curr) &&
+         !mem_sharing_is_fork(currd) )
+    {
+        hostp2m = p2m_get_hostp2m(currd);
+        mfn = p2m_get_gfn_type_access_shared(hostp2m, _gfn(gfn), &p2mt, &p2ma);
+
+        if ( mfn_eq(mfn, INVALID_MFN) || p2ma == p2m_access_rwx )
+        {
+            if ( (p2mt == p2m_mmio_dm) ||
+                 (npfec.write_access &&
+                  (p2m_is_discard_write(p2mt) || (p2mt == p2m_ioreq_server))) )
+            {
+                if ( !handle_mmio_with_translation(gla, gpa >> PAGE_SHIFT,
+                                                  npfec) )
+                    hvm_inject_hw_exception(TRAP_gp_fault, 0);
+                rc = 1;
+                goto out;
+            }
+
+            if ( p2mt == p2m_ram_rw &&
+                 (!npfec.write_access || !paging_mode_log_dirty(currd)) )
+            {
+                rc = 1;
+                goto out;
+            }
+        }
+    }
+
     /*
      * Take a lock on the host p2m speculatively, to avoid potential
      * locking order problems later and to handle unshare etc.
@@ -3146,10 +3446,91 @@ enum hvm_translation_result hvm_translate_get_page(
     return HVMTRANS_okay;
 }
 
+/*
+ * Linear to guest frame translations made by hypercall buffer copies.
+ *
+ * Hypercalls which walk guest arrays (populate_physmap extents, log-dirty
+ * bitmaps, getmemlist, ...) copy a few bytes at a time from the same few
+ * guest pages, and each copy used to walk the guest page tables again.
+ * While a hypercall is in progress the vCPU is not running, so it cannot
+ * have flushed its TLB: reusing a translation for the rest of the
+ * hypercall is no different from a stale TLB entry. The entries are
+ * dropped when the hypercall ends and on paging mode / CR3 changes. Only
+ * the gla -> gfn step is cached; the p2m lookup is done for every copy.
+ */
+static unsigned int gla_cache_new_gen(struct hvm_gla_cache *c)
+{
+    if ( unlikely(!++c->next_gen) )
+    {
+        memset(c->ent, 0, sizeof(c->ent));
+        c->next_gen = 1;
+    }
+
+    return c->next_gen;
+}
+
+void hvm_gla_cache_begin(struct vcpu *v)
+{
+    struct hvm_gla_cache *c = v->arch.hvm_vcpu.gla_cache;
+
+    c->gen = gla_cache_new_gen(c);
+}
+
+void hvm_gla_cache_end(struct vcpu *v)
+{
+    v->arch.hvm_vcpu.gla_cache->gen = 0;
+}
+
+void hvm_gla_cache_flush(struct vcpu *v)
+{
+    struct hvm_gla_cache *c = v->arch.hvm_vcpu.gla_cache;
+
+    if ( c && c->gen )
+        c->gen = gla_cache_new_gen(c);
+}
+
+static enum hvm_translation_result hvm_translate_get_page_cached(
+    struct vcpu *v, unsigned long addr, uint32_t pfec,
+    struct page_info **page_p, gfn_t *gfn_p, p2m_type_t *p2mt_p)
+{
+    struct hvm_gla_cache *c = v->arch.hvm_vcpu.gla_cache;
+    struct hvm_gla_cache_entry *e;
+    unsigned long gla_pfn = addr >> PAGE_SHIFT;
+    bool write = pfec & PFEC_write_access;
+    enum hvm_translation_result res;
+
+    if ( !c->gen || nestedhvm_vcpu_in_guestmode(v) )
+        return hvm_translate_get_page(v, addr, true, pfec, NULL,
+                                      page_p, gfn_p, p2mt_p);
+
+    e = &c->ent[gla_pfn % HVM_GLA_CACHE_ENTRIES];
+    if ( e->gen == c->gen && e->gla_pfn == gla_pfn && (e->write || !write) )
+    {
+        perfc_incr(hvm_gla_cache_hit);
+        return hvm_translate_get_page(v, gfn_to_gaddr(e->gfn) |
+                                         (addr & ~PAGE_MASK),
+                                      false, 0, NULL, page_p, gfn_p, p2mt_p);
+    }
+
+    perfc_incr(hvm_gla_cache_miss);
+    res = hvm_translate_get_page(v, addr, true, pfec, NULL,
+                                 page_p, gfn_p, p2mt_p);
+    if ( res == HVMTRANS_okay )
+    {
+        e->gla_pfn = gla_pfn;
+        e->gfn = *gfn_p;
+        e->gen = c->gen;
+        e->write = write;
+    }
+
+    return res;
+}
+
 #define HVMCOPY_from_guest (0u<<0)
 #define HVMCOPY_to_guest   (1u<<0)
 #define HVMCOPY_phys       (0u<<2)
 #define HVMCOPY_linear     (1u<<2)
+#define HVMCOPY_cached     (1u<<3)
 static enum hvm_translation_result __hvm_copy(
     void *buf, paddr_t addr, int size, struct vcpu *v, unsigned int flags,
     uint32_t pfec, pagefault_info_t *pfinfo)
@@ -3185,8 +3566,12 @@ static enum hvm_translation_result __hvm_copy(
 
         count = min_t(int, PAGE_SIZE - gpa, todo);
 
-        res = hvm_translate_get_page(v, addr, flags & HVMCOPY_linear,
-                                     pfec, pfinfo, &page, &gfn, &p2mt);
+        if ( flags & HVMCOPY_cached )
+            res = hvm_translate_get_page_cached(v, addr, pfec,
+                                                &page, &gfn, &p2mt);
+        else
+            res = hvm_translate_get_page(v, addr, flags & HVMCOPY_linear,
+                                         pfec, pfinfo, &page, &gfn, &p2mt);
         if ( res != HVMTRANS_okay )
             return res;
 
@@ -3280,7 +3665,9 @@ unsigned long copy_to_user_hvm(void *to, const void *from, unsigned int len)
         return 0;
     }
 
-    rc = hvm_copy_to_guest_linear((unsigned long)to, (void *)from, len, 0, NULL);
+    rc = __hvm_copy((void *)from, (unsigned long)to, len, current,
+                    HVMCOPY_to_guest | HVMCOPY_linear | HVMCOPY_cached,
+                    PFEC_page_present | PFEC_write_access, NULL);
     return rc ? len : 0; /* fake a copy_to_user() return code */
 }
 
@@ -3294,7 +3681,9 @@ unsigned long clear_user_hvm(void *to, unsigned int len)
         return 0;
     }
 
-    rc = hvm_copy_to_guest_linear((unsigned long)to, NULL, len, 0, NULL);
+    rc = __hvm_copy(NULL, (unsigned long)to, len, current,
+                    HVMCOPY_to_guest | HVMCOPY_linear | HVMCOPY_cached,
+                    PFEC_page_present | PFEC_write_access, NULL);
     return rc ? len : 0; /* fake a copy_to_user() return code */
 }
 
@@ -3308,7 +3697,9 @@ unsigned long copy_from_user_hvm(void *to, const void *from, unsigned len)
         return 0;
     }
 
-    rc = hvm_copy_from_guest_linear(to, (unsigned long)from, len, 0, NULL);
+    rc = __hvm_copy(to, (unsigned long)from, len, current,
+                    HVMCOPY_from_guest | HVMCOPY_linear | HVMCOPY_cached,
+                    PFEC_page_present, NULL);
     return rc ? len : 0; /* fake a copy_from_user() return code */
 }
 
@@ -3511,6 +3902,18 @@ int hvm_msr_write_intercept(unsigned int msr, uint64_t msr_content,
         return X86EMUL_OKAY;
     }
 
+    /* IPIs are frequent enough to bypass everything below where possible. */
+    if ( msr == MSR_IA32_APICBASE_MSR + (APIC_ICR >> 4) &&
+         vlapic_x2apic_ipi_fast(v, msr_content) )
+        return X86EMUL_OKAY;
+
+    /* As are timer re-arms by tickless guests. */
+    if ( msr == MSR_IA32_TSC_DEADLINE )
+    {
+        vlapic_tdt_msr_set(vcpu_vlapic(v), msr_content);
+        return X86EMUL_OKAY;
+    }
+
     if ( (ret = guest_wrmsr(v, msr, msr_content)) != X86EMUL_UNHANDLEABLE )
         return ret;
 
@@ -4002,6 +4405,68 @@ static int hvmop_flush_tlb_all(void)
     return 0;
 }
 
+static DEFINE_PER_CPU(cpumask_t, flush_cpumask);
+
+/*
+ * Flush the guest TLBs of the current domain's vCPUs set in @vcpu_mask
+ * (@nr bits).  Each is given a fresh ASID on its next VM entry, which is
+ * all a descheduled vCPU needs, so it isn't woken up.  Only the pCPUs
+ * currently running target vCPUs are interrupted, to force them through a
+ * VM entry.  It is possible that re-scheduling has taken place so we may
+ * unnecessarily IPI some CPUs.
+ */
+void hvm_flush_vcpu_tlbs(const unsigned long *vcpu_mask, unsigned int nr)
+{
+    struct vcpu *curr = current, *v;
+    cpumask_t *pcpu_mask = &this_cpu(flush_cpumask);
+
+    cpumask_clear(pcpu_mask);
+
+    for_each_vcpu ( curr->domain, v )
+    {
+        if ( v->vcpu_id >= nr )
+            break;
+
+        if ( !test_bit(v->vcpu_id, vcpu_mask) )
+            continue;
+
+        hvm_asid_flush_vcpu(v);
+        if ( v != curr && v->is_running )
+            __cpumask_set_cpu(v->processor, pcpu_mask);
+    }
+
+    if ( !cpumask_empty(pcpu_mask) )
+        smp_send_event_check_mask(pcpu_mask);
+}
+
+static int hvmop_flush_vcpu_tlbs(
+    XEN_GUEST_HANDLE_PARAM(xen_hvm_flush_vcpu_tlbs_t) uop)
+{
+    struct domain *d = current->domain;
+    struct xen_hvm_flush_vcpu_tlbs op;
+    unsigned int nr;
+
+    if ( !is_hvm_domain(d) )
+        return -EINVAL;
+
+    if ( copy_from_guest(&op, uop, 1) )
+        return -EFAULT;
+
+    if ( op.pad )
+        return -EINVAL;
+
+    nr = min_t(unsigned int, op.nr_vcpus, d->max_vcpus);
+    nr = min_t(unsigned int, nr, HVM_MAX_VCPUS);
+    if ( !nr )
+        return 0;
+
+    /* uint64_t is unsigned long here, so the words are bitmap words. */
+    perfc_incr(hvmop_flush_vcpu_tlbs);
+    hvm_flush_vcpu_tlbs((unsigned long *)op.vcpu_mask, nr);
+
+    return 0;
+}
+
 static int hvmop_set_evtchn_upcall_vector(
     XEN_GUEST_HANDLE_PARAM(xen_hvm_evtchn_upcall_vector_t) uop)
 {
@@ -4125,6 +4590,10 @@ static int hvmop_set_param(
         if ( (a.value & ~HVMPV_feature_mask) ||
              !(a.value & HVMPV_base_freq) )
             rc = -EINVAL;
+        /* Synthetic timers are delivered via SynIC and run off the TRC. */
+        else if ( (a.value & HVMPV_stimer) &&
+                  (~a.value & (HVMPV_synic | HVMPV_time_ref_count)) )
+            rc = -EINVAL;
         break;
     case HVM_PARAM_IDENT_PT:
         /*
@@ -4673,6 +5142,11 @@ long do_hvm_op(unsigned long op, XEN_GUEST_HANDLE_PARAM(void) arg)
         rc = guest_handle_is_null(arg) ? hvmop_flush_tlb_all() : -EINVAL;
         break;
 
+    case HVMOP_flush_vcpu_tlbs:
+        rc = hvmop_flush_vcpu_tlbs(
+            guest_handle_cast(arg, xen_hvm_flush_vcpu_tlbs_t));
+        break;
+
     case HVMOP_get_mem_type:
         rc = hvmop_get_mem_type(
             guest_handle_cast(arg, xen_hvm_get_mem_type_t));
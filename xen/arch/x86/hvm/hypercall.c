@@ -20,6 +20,7 @@
  */
 #include <xen/lib.h>
 #include <xen/hypercall.h>
+#include <xen/lat_hist.h>
 
 #include <asm/hvm/support.h>
 
@@ -147,6 +148,7 @@ int hvm_hypercall(struct cpu_user_regs *regs)
     struct domain *currd = curr->domain;
     int mode = hvm_guest_x86_mode(curr);
     unsigned long eax = regs->eax;
+    s_time_t start;
 
     switch ( mode )
     {
@@ -184,6 +186,8 @@ int hvm_hypercall(struct cpu_user_regs *regs)
     }
 
     curr->hcall_preempted = false;
+    start = lat_hist_start();
+    hvm_gla_cache_begin(curr);
 
     if ( mode == 8 )
     {
@@ -276,6 +280,9 @@ int hvm_hypercall(struct cpu_user_regs *regs)
 #endif
     }
 
+    hvm_gla_cache_end(curr);
+    lat_hist_end(XEN_SYSCTL_LAT_HIST_hypercall, eax, start);
+
     HVM_DBG_LOG(DBG_LEVEL_HCALL, "hcall%lu -> %lx", eax, regs->rax);
 
     if ( curr->hcall_preempted )
@@ -211,25 +211,110 @@ int hvm_process_io_intercept(const struct hvm_io_handler *handler,
     return rc;
 }
 
+static uint64_t hvm_io_handler_key(const ioreq_t *p)
+{
+    return (p->type == IOREQ_TYPE_COPY) ?
+           hvm_mmio_first_byte(p) >> PAGE_SHIFT : p->addr;
+}
+
+/*
+ * The internal handlers claim disjoint ranges, so the handler that last
+ * accepted an access to the same port or gpa frame is the only one that
+ * can accept this one.  Its accept() is still run, both because most of
+ * the ranges follow guest-programmed state and because some handlers
+ * take locks there.
+ */
+static const struct hvm_io_handler *hvm_hinted_io_handler(const ioreq_t *p,
+                                                          uint64_t key)
+{
+    struct vcpu *curr = current;
+    struct domain *curr_d = curr->domain;
+    struct hvm_vcpu_io *vio = &curr->arch.hvm_vcpu.hvm_io;
+    unsigned int i, gen = read_atomic(&curr_d->arch.hvm_domain.io_handler_gen);
+
+    if ( vio->io_handler_hint_gen != gen )
+    {
+        memset(vio->io_handler_hint, 0, sizeof(vio->io_handler_hint));
+        vio->io_handler_hint_gen = gen;
+        return NULL;
+    }
+
+    for ( i = 0; i < NR_IO_HANDLER_HINTS; i++ )
+    {
+        const struct hvm_io_handler_hint *hint = &vio->io_handler_hint[i];
+        const struct hvm_io_handler *handler;
+
+        if ( !hint->slot || hint->type != p->type || hint->key != key )
+            continue;
+
+        handler = &curr_d->arch.hvm_domain.io_handler[hint->slot - 1];
+        if ( handler->ops->accept(handler, p) )
+            return handler;
+
+        break;
+    }
+
+    return NULL;
+}
+
+static void hvm_hint_io_handler(const ioreq_t *p, uint64_t key,
+                                unsigned int idx)
+{
+    struct hvm_vcpu_io *vio = &current->arch.hvm_vcpu.hvm_io;
+    struct hvm_io_handler_hint *hint;
+    unsigned int i;
+
+    for ( i = 0; i < NR_IO_HANDLER_HINTS; i++ )
+    {
+        hint = &vio->io_handler_hint[i];
+        if ( hint->slot && hint->type == p->type && hint->key == key )
+            goto fill;
+    }
+
+    hint = &vio->io_handler_hint[vio->io_handler_hint_next++ %
+                                 NR_IO_HANDLER_HINTS];
+
+ fill:
+    hint->key = key;
+    hint->type = p->type;
+    hint->slot = idx + 1;
+}
+
 static const struct hvm_io_handler *hvm_find_io_handler(const ioreq_t *p)
 {
     struct domain *curr_d = current->domain;
+    const struct hvm_io_handler *handler;
+    uint64_t key;
     unsigned int i;
 
     BUG_ON((p->type != IOREQ_TYPE_PIO) &&
            (p->type != IOREQ_TYPE_COPY));
 
+    key = hvm_io_handler_key(p);
+    handler = hvm_hinted_io_handler(p, key);
+    if ( handler )
+    {
+        perfc_incr(hvm_io_handler_hit);
+        return handler;
+    }
+
+    perfc_incr(hvm_io_handler_scan);
+
     for ( i = 0; i < curr_d->arch.hvm_domain.io_handler_count; i++ )
     {
-        const struct hvm_io_handler *handler =
-            &curr_d->arch.hvm_domain.io_handler[i];
-        const struct hvm_io_ops *ops = handler->ops;
+        const struct hvm_io_ops *ops;
+
+        handler = &curr_d->arch.hvm_domain.io_handler[i];
+        ops = handler->ops;
 
         if ( handler->type != p->type )
             continue;
 
         if ( ops->accept(handler, p) )
+        {
+            hvm_hint_io_handler(p, key, i);
             return handler;
+        }
     }
 
     return NULL;
@@ -267,6 +352,9 @@ struct hvm_io_handler *hvm_next_io_handler(struct domain *d)
         return NULL;
     }
 
+    write_atomic(&d->arch.hvm_domain.io_handler_gen,
+                 d->arch.hvm_domain.io_handler_gen + 1);
+
     return &d->arch.hvm_domain.io_handler[i];
 }
 
@@ -315,6 +403,8 @@ void relocate_portio_handler(struct domain *d, unsigned int old_port,
              (handler->portio.size = size) )
         {
             handler->portio.port = new_port;
+            write_atomic(&d->arch.hvm_domain.io_handler_gen,
+                         d->arch.hvm_domain.io_handler_gen + 1);
             break;
         }
     }
@@ -29,6 +29,7 @@
 
 #include <asm/hvm/hvm.h>
 #include <asm/hvm/ioreq.h>
+#include <asm/hvm/support.h>
 #include <asm/hvm/vmx/vmx.h>
 
 #include <public/hvm/ioreq.h>
@@ -82,6 +83,13 @@ static void hvm_io_assist(struct hvm_ioreq_vcpu *sv, uint64_t data)
     msix_write_completion(v);
     vcpu_end_shutdown_deferral(v);
 
+    if ( v->arch.hvm_vcpu.exit_stats->ioreq_start )
+    {
+        v->arch.hvm_vcpu.exit_stats->ioreq_ns +=
+            NOW() - v->arch.hvm_vcpu.exit_stats->ioreq_start;
+        v->arch.hvm_vcpu.exit_stats->ioreq_start = 0;
+    }
+
     sv->pending = false;
 }
 
@@ -620,6 +628,8 @@ static int hvm_ioreq_server_init(struct hvm_ioreq_server *s,
 
     if ( bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_ATOMIC )
         s->bufioreq_atomic = true;
+    else if ( bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_RING )
+        s->bufioreq_ring = true;
 
     rc = hvm_ioreq_server_setup_pages(
              s, is_default, bufioreq_handling != HVM_IOREQSRV_BUFIOREQ_OFF);
@@ -654,6 +664,13 @@ static void hvm_ioreq_server_deinit(struct hvm_ioreq_server *s,
     hvm_ioreq_server_free_rangesets(s, is_default);
 }
 
+/* Server selection may have changed; drop every vCPU's selection hint. */
+static void hvm_ioreq_server_invalidate_hints(struct domain *d)
+{
+    write_atomic(&d->arch.hvm_domain.ioreq_server.gen,
+                 d->arch.hvm_domain.ioreq_server.gen + 1);
+}
+
 static ioservid_t next_ioservid(struct domain *d)
 {
     struct hvm_ioreq_server *s;
@@ -687,7 +704,11 @@ int hvm_create_ioreq_server(struct domain *d, domid_t domid,
     struct hvm_ioreq_server *s;
     int rc;
 
-    if ( bufioreq_handling > HVM_IOREQSRV_BUFIOREQ_ATOMIC )
+    if ( bufioreq_handling > HVM_IOREQSRV_BUFIOREQ_RING )
+        return -EINVAL;
+
+    /* The default server's buffered page layout is fixed. */
+    if ( is_default && bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_RING )
         return -EINVAL;
 
     rc = -ENOMEM;
@@ -709,6 +730,7 @@ int hvm_create_ioreq_server(struct domain *d, domid_t domid,
 
     list_add(&s->list_entry,
              &d->arch.hvm_domain.ioreq_server.list);
+    hvm_ioreq_server_invalidate_hints(d);
 
     if ( is_default )
     {
@@ -759,6 +781,7 @@ int hvm_destroy_ioreq_server(struct domain *d, ioservid_t id)
         hvm_ioreq_server_disable(s, false);
 
         list_del(&s->list_entry);
+        hvm_ioreq_server_invalidate_hints(d);
 
         hvm_ioreq_server_deinit(s, false);
 
@@ -859,6 +882,8 @@ int hvm_map_io_range_to_ioreq_server(struct domain *d, ioservid_t id,
                 break;
 
             rc = rangeset_add_range(r, start, end);
+            if ( !rc )
+                hvm_ioreq_server_invalidate_hints(d);
             break;
         }
     }
@@ -914,6 +939,8 @@ int hvm_unmap_io_range_from_ioreq_server(struct domain *d, ioservid_t id,
                 break;
 
             rc = rangeset_remove_range(r, start, end);
+            if ( !rc )
+                hvm_ioreq_server_invalidate_hints(d);
             break;
         }
     }
@@ -1002,6 +1029,8 @@ int hvm_set_ioreq_server_state(struct domain *d, ioservid_t id,
         else
             hvm_ioreq_server_disable(s, false);
 
+        hvm_ioreq_server_invalidate_hints(d);
+
         domain_unpause(d);
 
         rc = 0;
@@ -1080,6 +1109,7 @@ void hvm_destroy_all_ioreq_servers(struct domain *d)
             d->arch.hvm_domain.default_ioreq_server = NULL;
 
         list_del(&s->list_entry);
+        hvm_ioreq_server_invalidate_hints(d);
 
         hvm_ioreq_server_deinit(s, is_default);
 
@@ -1163,10 +1193,51 @@ int hvm_set_dm_domain(struct domain *d, domid_t domid)
     return rc;
 }
 
+/*
+ * Does enabled, non-default server @s claim the access at @addr of @type?
+ * A claimed PCI config cycle is rewritten for delivery to @s.
+ */
+static bool hvm_ioreq_server_claims(struct hvm_ioreq_server *s, uint8_t type,
+                                    uint64_t addr, ioreq_t *p)
+{
+    struct rangeset *r;
+
+    if ( !s->enabled )
+        return false;
+
+    r = s->range[type];
+
+    switch ( type )
+    {
+        unsigned long end;
+
+    case XEN_DMOP_IO_RANGE_PORT:
+        end = addr + p->size - 1;
+        return rangeset_contains_range(r, addr, end);
+
+    case XEN_DMOP_IO_RANGE_MEMORY:
+        end = addr + (p->size * p->count) - 1;
+        return rangeset_contains_range(r, addr, end);
+
+    case XEN_DMOP_IO_RANGE_PCI:
+        if ( !rangeset_contains_singleton(r, addr >> 32) )
+            return false;
+
+        p->type = IOREQ_TYPE_PCI_CONFIG;
+        p->addr = addr;
+        return true;
+    }
+
+    return false;
+}
+
 struct hvm_ioreq_server *hvm_select_ioreq_server(struct domain *d,
                                                  ioreq_t *p)
 {
+    struct vcpu *v = current;
+    struct hvm_vcpu_io *vio = &v->arch.hvm_vcpu.hvm_io;
     struct hvm_ioreq_server *s;
+    unsigned int gen;
     uint32_t cf8;
     uint8_t type;
     uint64_t addr;
@@ -1174,6 +1245,8 @@ struct hvm_ioreq_server *hvm_select_ioreq_server(struct domain *d,
     if ( list_empty(&d->arch.hvm_domain.ioreq_server.list) )
         return NULL;
 
+    gen = read_atomic(&d->arch.hvm_domain.ioreq_server.gen);
+
     if ( p->type != IOREQ_TYPE_COPY && p->type != IOREQ_TYPE_PIO )
         return d->arch.hvm_domain.default_ioreq_server;
 
@@ -1215,49 +1288,151 @@ struct hvm_ioreq_server *hvm_select_ioreq_server(struct domain *d,
         addr = p->addr;
     }
 
+    /*
+     * Devices are usually accessed in bursts, so try the server this vCPU
+     * hit last before walking the list.  Server creation, destruction and
+     * state changes all pause the domain, so a hint whose generation still
+     * matches cannot point at a freed server.
+     */
+    if ( v->domain == d &&
+         vio->ioreq_server_gen == gen &&
+         (s = vio->ioreq_server_hint) != NULL &&
+         hvm_ioreq_server_claims(s, type, addr, p) )
+        return s;
+
     list_for_each_entry ( s,
                           &d->arch.hvm_domain.ioreq_server.list,
                           list_entry )
     {
-        struct rangeset *r;
-
         if ( s == d->arch.hvm_domain.default_ioreq_server )
             continue;
 
-        if ( !s->enabled )
-            continue;
+        if ( hvm_ioreq_server_claims(s, type, addr, p) )
+        {
+            if ( v->domain == d )
+            {
+                vio->ioreq_server_hint = s;
+                vio->ioreq_server_gen = gen;
+            }
+            return s;
+        }
+    }
 
-        r = s->range[type];
+    return d->arch.hvm_domain.default_ioreq_server;
+}
 
-        switch ( type )
-        {
-            unsigned long end;
+/*
+ * Post @p to the ioreq ring of @s without waiting for a response.  A
+ * rep write from guest memory is posted as one slot per element, with
+ * the data read now.  If the ring hasn't room for all of them, as many
+ * as fit are posted and p->count is reduced to match; the emulator
+ * comes back for the rest.
+ */
+static int hvm_send_ring_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
+{
+    struct domain *d = current->domain;
+    ioreq_ring_page_t *pg = s->bufioreq.va;
+    unsigned int i, n = p->data_is_ptr ? p->count : 1;
+    uint64_t data[IOREQ_RING_SLOT_NUM];
+    uint32_t prod, cons;
+    ioreq_t *slot;
 
-        case XEN_DMOP_IO_RANGE_PORT:
-            end = addr + p->size - 1;
-            if ( rangeset_contains_range(r, addr, end) )
-                return s;
+    BUILD_BUG_ON(sizeof(ioreq_ring_page_t) > PAGE_SIZE);
+    BUILD_BUG_ON(IOREQ_RING_SLOT_NUM & (IOREQ_RING_SLOT_NUM - 1));
 
-            break;
-        case XEN_DMOP_IO_RANGE_MEMORY:
-            end = addr + (p->size * p->count) - 1;
-            if ( rangeset_contains_range(r, addr, end) )
-                return s;
+    if ( !pg || !n || p->size > sizeof(p->data) )
+        return X86EMUL_UNHANDLEABLE;
 
-            break;
-        case XEN_DMOP_IO_RANGE_PCI:
-            if ( rangeset_contains_singleton(r, addr >> 32) )
-            {
-                p->type = IOREQ_TYPE_PCI_CONFIG;
-                p->addr = addr;
-                return s;
-            }
+    n = min_t(unsigned int, n, IOREQ_RING_SLOT_NUM);
 
-            break;
+    for ( i = 0; p->data_is_ptr && i < n; i++ )
+    {
+        paddr_t off = (paddr_t)i * p->size;
+
+        data[i] = 0;
+        if ( hvm_copy_from_guest_phys(&data[i],
+                                      p->df ? p->data - off : p->data + off,
+                                      p->size) != HVMTRANS_okay )
+            return X86EMUL_UNHANDLEABLE;
+    }
+
+    spin_lock(&s->bufioreq_lock);
+
+    prod = pg->req_prod;
+    cons = ACCESS_ONCE(pg->req_cons);
+
+    if ( prod - cons > IOREQ_RING_SLOT_NUM - n )
+    {
+        if ( !p->data_is_ptr || prod - cons >= IOREQ_RING_SLOT_NUM )
+        {
+            /* Not enough room: send it through the synchronous path. */
+            spin_unlock(&s->bufioreq_lock);
+            return X86EMUL_UNHANDLEABLE;
         }
+        n = IOREQ_RING_SLOT_NUM - (prod - cons);
     }
 
-    return d->arch.hvm_domain.default_ioreq_server;
+    for ( i = 0; i < n; i++ )
+    {
+        slot = &pg->ring[(prod + i) & (IOREQ_RING_SLOT_NUM - 1)];
+        *slot = *p;
+        slot->count = 1;
+        slot->data_is_ptr = 0;
+        slot->state = STATE_IOREQ_READY;
+
+        if ( p->data_is_ptr )
+        {
+            paddr_t off = (paddr_t)i * p->size;
+
+            slot->addr = p->df ? p->addr - off : p->addr + off;
+            slot->data = data[i];
+        }
+    }
+
+    /* Make the ioreqs visible /before/ req_prod. */
+    smp_wmb();
+    pg->req_prod = prod + n;
+
+    /* Publish req_prod /before/ checking req_event. */
+    smp_mb();
+    if ( (uint32_t)(prod + n - pg->req_event) < n )
+        notify_via_xen_event_channel(d, s->bufioreq_evtchn);
+
+    spin_unlock(&s->bufioreq_lock);
+
+    if ( p->data_is_ptr )
+        p->count = n;
+
+    return X86EMUL_OKAY;
+}
+
+/*
+ * Only MMIO writes to ranges the server claimed may be posted.  Writes
+ * to p2m_ioreq_server pages are excluded, since reads of those pages
+ * go straight to memory and could overtake the posted write.
+ */
+static bool hvm_ioreq_postable(struct hvm_ioreq_server *s, const ioreq_t *p)
+{
+    paddr_t first, last;
+
+    if ( !s->bufioreq_ring || p->type != IOREQ_TYPE_COPY ||
+         p->dir != IOREQ_WRITE || !p->count || !p->size )
+        return false;
+
+    if ( !p->data_is_ptr && p->count != 1 )
+        return false;
+
+    first = p->addr;
+    last = p->addr + (paddr_t)p->count * p->size - 1;
+    if ( p->df )
+    {
+        last = p->addr + p->size - 1;
+        first = p->addr - (paddr_t)(p->count - 1) * p->size;
+    }
+
+    return s->range[XEN_DMOP_IO_RANGE_MEMORY] &&
+           rangeset_contains_range(s->range[XEN_DMOP_IO_RANGE_MEMORY],
+                                   first, last);
 }
 
 static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
@@ -1281,6 +1456,9 @@ static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
     if ( !pg )
         return X86EMUL_UNHANDLEABLE;
 
+    if ( s->bufioreq_ring )
+        return hvm_send_ring_ioreq(s, p);
+
     /*
      * Return 0 for the cases we can't deal with:
      *  - 'addr' is only a 20-bit field, so we cannot address beyond 1MB
@@ -1364,6 +1542,10 @@ int hvm_send_ioreq(struct hvm_ioreq_server *s, ioreq_t *proto_p,
     if ( buffered )
         return hvm_send_buffered_ioreq(s, proto_p);
 
+    if ( hvm_ioreq_postable(s, proto_p) &&
+         hvm_send_ring_ioreq(s, proto_p) == X86EMUL_OKAY )
+        return X86EMUL_OKAY;
+
     if ( unlikely(!vcpu_start_shutdown_deferral(curr)) )
         return X86EMUL_RETRY;
 
@@ -1404,6 +1586,9 @@ int hvm_send_ioreq(struct hvm_ioreq_server *s, ioreq_t *proto_p,
             p->state = STATE_IOREQ_READY;
             notify_via_xen_event_channel(d, port);
 
+            curr->arch.hvm_vcpu.exit_stats->ioreqs++;
+            curr->arch.hvm_vcpu.exit_stats->ioreq_start = NOW();
+
             sv->pending = true;
             return X86EMUL_RETRY;
         }
@@ -79,6 +79,8 @@ static struct hvm_function_table svm_function_table;
  */
 static DEFINE_PER_CPU_READ_MOSTLY(paddr_t, hsa);
 static DEFINE_PER_CPU_READ_MOSTLY(paddr_t, host_vmcb);
+/* VMCB most recently entered on this pCPU, whose state it may cache. */
+static DEFINE_PER_CPU(const struct vmcb_struct *, last_vmcb);
 
 static bool_t amd_erratum383_found __read_mostly;
 
@@ -882,6 +884,19 @@ static void svm_set_rdtsc_exiting(struct vcpu *v, bool_t enable)
     vmcb_set_general2_intercepts(vmcb, general2_intercepts);
 }
 
+static void svm_set_msr_passthrough(struct vcpu *v, uint32_t msr,
+                                    unsigned int access)
+{
+    int flags = MSR_INTERCEPT_RW;
+
+    if ( access & HVM_MSR_PT_R )
+        flags &= ~MSR_INTERCEPT_READ;
+    if ( access & HVM_MSR_PT_W )
+        flags &= ~MSR_INTERCEPT_WRITE;
+
+    svm_intercept_msr(v, msr, flags);
+}
+
 static void svm_set_descriptor_access_exiting(struct vcpu *v, bool enable)
 {
     struct vmcb_struct *vmcb = v->arch.hvm_svm.vmcb;
@@ -1067,7 +1082,20 @@ static void svm_ctxt_switch_to(struct vcpu *v)
 
     svm_vmsave_pa(per_cpu(host_vmcb, cpu));
     svm_vmload(vmcb);
-    vmcb->cleanbits.bytes = 0;
+
+    /*
+     * The processor's cached copy of this VMCB is only usable if it was
+     * last run on this pCPU and no other VMCB has been run here since.
+     * Nested guests swap VMCBs behind our back, so always reload those.
+     */
+    if ( nestedhvm_enabled(v->domain) ||
+         v->arch.hvm_svm.launch_core != cpu ||
+         per_cpu(last_vmcb, cpu) != vmcb )
+        vmcb->cleanbits.bytes = 0;
+    else
+        perfc_incr(svm_vmcb_clean_switch);
+    per_cpu(last_vmcb, cpu) = vmcb;
+
     svm_lwp_load(v);
     svm_tsc_ratio_load(v);
 
@@ -1100,7 +1128,7 @@ static void noreturn svm_do_resume(struct vcpu *v)
     {
         v->arch.hvm_svm.launch_core = smp_processor_id();
         hvm_migrate_timers(v);
-        hvm_migrate_pirqs(v);
+        hvm_follow_pirqs(v);
         /* Migrating to another ASID domain.  Request a new ASID. */
         hvm_asid_flush_vcpu(v);
     }
@@ -1606,6 +1634,9 @@ static int _svm_cpu_up(bool bsp)
     /* Initialize core's ASID handling. */
     svm_asid_init(c);
 
+    /* Nothing is cached on a freshly brought up core. */
+    per_cpu(last_vmcb, cpu) = NULL;
+
     /*
      * Check whether EFER.LMSLE can be written.
      * Unfortunately there's no feature bit defined for this.
@@ -2122,6 +2153,8 @@ static void svm_do_msr_access(struct cpu_user_regs *regs)
     if ( inst_len == 0 )
         return;
 
+    hvm_msr_exit_account(regs->ecx, !rdmsr);
+
     if ( rdmsr )
     {
         uint64_t msr_content = 0;
@@ -2172,10 +2205,10 @@ static void svm_vmexit_do_pause(struct cpu_user_regs *regs)
 
     /*
      * The guest is running a contended spinlock and we've detected it.
-     * Do something useful, like reschedule the guest
+     * Do something useful, like trying to run the lock holder.
      */
     perfc_incr(pauseloop_exits);
-    do_sched_op(SCHEDOP_yield, guest_handle_from_ptr(NULL, void));
+    vcpu_yield_directed();
 }
 
 static void
@@ -2438,6 +2471,7 @@ static struct hvm_function_table __initdata svm_function_table = {
     .msr_write_intercept  = svm_msr_write_intercept,
     .set_rdtsc_exiting    = svm_set_rdtsc_exiting,
     .set_descriptor_access_exiting = svm_set_descriptor_access_exiting,
+    .set_msr_passthrough  = svm_set_msr_passthrough,
     .get_insn_bytes       = svm_get_insn_bytes,
 
     .nhvm_vcpu_initialise = nsvm_vcpu_initialise,
@@ -2455,6 +2489,26 @@ static struct hvm_function_table __initdata svm_function_table = {
     },
 };
 
+#ifdef CONFIG_PERF_COUNTERS
+/* Account which categories of VMCB state the last VMRUN had to reload. */
+static void svm_count_vmcb_reloads(vmcbcleanbits_t cleanbits)
+{
+    unsigned int dirty = ~cleanbits.bytes &
+                         ((1u << SVM_PERF_CLEANBITS_SIZE) - 1);
+
+    if ( dirty == (1u << SVM_PERF_CLEANBITS_SIZE) - 1 )
+        perfc_incr(svm_vmcb_reload_full);
+
+    while ( dirty )
+    {
+        perfc_incra(svm_vmcb_reload, find_first_set_bit(dirty));
+        dirty &= dirty - 1;
+    }
+}
+#else
+static inline void svm_count_vmcb_reloads(vmcbcleanbits_t cleanbits) {}
+#endif
+
 void svm_vmexit_handler(struct cpu_user_regs *regs)
 {
     uint64_t exit_reason;
@@ -2465,6 +2519,7 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
     vintr_t intr;
     bool_t vcpu_guestmode = 0;
     struct vlapic *vlapic = vcpu_vlapic(v);
+    s_time_t start = NOW();
 
     hvm_invalidate_regs_fields(regs);
 
@@ -2576,6 +2631,8 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
 
     hvm_maybe_deassert_evtchn_irq();
 
+    if ( cpu_has_svm_cleanbits )
+        svm_count_vmcb_reloads(vmcb->cleanbits);
     vmcb->cleanbits.bytes = cpu_has_svm_cleanbits ? ~0u : 0u;
 
     /* Event delivery caused this intercept? Queue for redelivery. */
@@ -2891,14 +2948,18 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
     }
 
   out:
-    if ( vcpu_guestmode || vlapic_hw_disabled(vlapic) )
-        return;
+    if ( !vcpu_guestmode && !vlapic_hw_disabled(vlapic) )
+    {
+        /* The exit may have updated the TPR: reflect this in the hardware vtpr */
+        intr = vmcb_get_vintr(vmcb);
+        intr.fields.tpr =
+            (vlapic_get_reg(vlapic, APIC_TASKPRI) & 0xFF) >> 4;
+        vmcb_set_vintr(vmcb, intr);
+    }
 
-    /* The exit may have updated the TPR: reflect this in the hardware vtpr */
-    intr = vmcb_get_vintr(vmcb);
-    intr.fields.tpr =
-        (vlapic_get_reg(vlapic, APIC_TASKPRI) & 0xFF) >> 4;
-    vmcb_set_vintr(vmcb, intr);
+    hvm_vmexit_account(exit_reason == VMEXIT_NPF ? XEN_DOMCTL_EXIT_STATS_NPF
+                                                 : exit_reason,
+                       start);
 }
 
 void svm_trace_vmentry(void)
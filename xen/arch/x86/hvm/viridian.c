@@ -18,6 +18,7 @@
 #include <asm/paging.h>
 #include <asm/p2m.h>
 #include <asm/apic.h>
+#include <asm/event.h>
 #include <asm/hvm/support.h>
 #include <public/sched.h>
 #include <public/hvm/hvm_op.h>
@@ -100,12 +101,18 @@
 #define HvFlushVirtualAddressSpace 0x0002
 #define HvFlushVirtualAddressList  0x0003
 #define HvNotifyLongSpinWait       0x0008
+#define HvFlushVirtualAddressSpaceEx 0x0013
+#define HvFlushVirtualAddressListEx  0x0014
 #define HvGetPartitionId           0x0046
 #define HvExtCallQueryCapabilities 0x8001
 
 /* Viridian Hypercall Flags. */
 #define HV_FLUSH_ALL_PROCESSORS 1
 
+/* Viridian generic processor set formats. */
+#define HV_GENERIC_SET_SPARSE_4K 0
+#define HV_GENERIC_SET_ALL       1
+
 /*
  * Viridian Partition Privilege Flags.
  *
@@ -164,13 +171,45 @@ typedef union _HV_CRASH_CTL_REG_CONTENTS
     } u;
 } HV_CRASH_CTL_REG_CONTENTS;
 
+/*
+ * Synthetic interrupt controller message slots, as described in section
+ * 11.9 of the specification. The SIM page holds one slot per SINT.
+ */
+#define HVMSG_NONE          0x00000000
+#define HVMSG_TIMER_EXPIRED 0x80000010
+
+#define HV_MESSAGE_FLAG_PENDING 0x1
+
+typedef struct {
+    uint32_t MessageType;
+    uint8_t  PayloadSize;
+    uint8_t  MessageFlags;
+    uint16_t Reserved;
+    uint64_t OriginationId;
+} HV_MESSAGE_HEADER;
+
+typedef struct {
+    HV_MESSAGE_HEADER Header;
+    uint64_t Payload[30];
+} HV_MESSAGE;
+
+typedef struct {
+    uint32_t TimerIndex;
+    uint32_t Reserved;
+    uint64_t ExpirationTime;
+    uint64_t DeliveryTime;
+} HV_TIMER_MESSAGE_PAYLOAD;
+
 /* Viridian CPUID leaf 3, Hypervisor Feature Indication */
-#define CPUID3D_CRASH_MSRS (1 << 10)
+#define CPUID3D_CRASH_MSRS           (1 << 10)
+#define CPUID3D_DIRECT_SYNTH_TIMERS  (1 << 19)
 
 /* Viridian CPUID leaf 4: Implementation Recommendations. */
 #define CPUID4A_HCALL_REMOTE_TLB_FLUSH (1 << 2)
 #define CPUID4A_MSR_BASED_APIC         (1 << 3)
 #define CPUID4A_RELAX_TIMER_INT        (1 << 5)
+#define CPUID4A_DEPRECATE_AUTOEOI      (1 << 9)
+#define CPUID4A_EX_PROCESSOR_MASKS     (1 << 11)
 
 /* Viridian CPUID leaf 6: Implementation HW features detected and in use. */
 #define CPUID6A_APIC_OVERLAY    (1 << 0)
@@ -254,6 +293,10 @@ void cpuid_viridian_leaves(const struct vcpu *v, uint32_t leaf,
             mask.AccessPartitionReferenceCounter = 1;
         if ( viridian_feature_mask(d) & HVMPV_reference_tsc )
             mask.AccessPartitionReferenceTsc = 1;
+        if ( has_viridian_synic(d) )
+            mask.AccessSynicRegs = 1;
+        if ( has_viridian_stimer(d) )
+            mask.AccessSyntheticTimerRegs = 1;
 
         u.mask = mask;
 
@@ -262,6 +305,8 @@ void cpuid_viridian_leaves(const struct vcpu *v, uint32_t leaf,
 
         if ( viridian_feature_mask(d) & HVMPV_crash_ctl )
             res->d = CPUID3D_CRASH_MSRS;
+        if ( has_viridian_stimer(d) )
+            res->d |= CPUID3D_DIRECT_SYNTH_TIMERS;
 
         break;
     }
@@ -273,9 +318,16 @@ void cpuid_viridian_leaves(const struct vcpu *v, uint32_t leaf,
             break;
         res->a = CPUID4A_RELAX_TIMER_INT;
         if ( viridian_feature_mask(d) & HVMPV_hcall_remote_tlb_flush )
-            res->a |= CPUID4A_HCALL_REMOTE_TLB_FLUSH;
+            res->a |= CPUID4A_HCALL_REMOTE_TLB_FLUSH |
+                      CPUID4A_EX_PROCESSOR_MASKS;
         if ( !cpu_has_vmx_apic_reg_virt )
             res->a |= CPUID4A_MSR_BASED_APIC;
+        /*
+         * AutoEOI SINTs cannot be honoured when interrupts are delivered
+         * by hardware, so steer guests away from them.
+         */
+        if ( has_viridian_synic(d) )
+            res->a |= CPUID4A_DEPRECATE_AUTOEOI;
 
         /*
          * This value is the recommended number of attempts to try to
@@ -332,6 +384,16 @@ static void dump_vp_assist(const struct vcpu *v)
            v, va->fields.enabled, (unsigned long)va->fields.pfn);
 }
 
+static void dump_simp(const struct vcpu *v)
+{
+    const union viridian_vp_assist *simp;
+
+    simp = &v->arch.hvm_vcpu.viridian.simp.msr;
+
+    printk(XENLOG_G_INFO "%pv: VIRIDIAN SIMP: enabled: %x pfn: %lx\n",
+           v, simp->fields.enabled, (unsigned long)simp->fields.pfn);
+}
+
 static void dump_reference_tsc(const struct domain *d)
 {
     const union viridian_reference_tsc *rt;
@@ -483,6 +545,135 @@ void viridian_abort_apic_assist(struct vcpu *v)
     v->arch.hvm_vcpu.viridian.vp_assist.vector = 0;
 }
 
+static void initialize_simp(struct vcpu *v, bool initialize)
+{
+    struct domain *d = v->domain;
+    unsigned long gmfn = v->arch.hvm_vcpu.viridian.simp.msr.fields.pfn;
+    struct page_info *page = get_page_from_gfn(d, gmfn, NULL, P2M_ALLOC);
+    void *va;
+
+    ASSERT(!v->arch.hvm_vcpu.viridian.simp.va);
+
+    /*
+     * See section 11.8.2 of the specification. The page is accessed from
+     * timer delivery on any pCPU, hence the global mapping.
+     */
+
+    if ( !page )
+        goto fail;
+
+    if ( !get_page_type(page, PGT_writable_page) )
+    {
+        put_page(page);
+        goto fail;
+    }
+
+    va = __map_domain_page_global(page);
+    if ( !va )
+    {
+        put_page_and_type(page);
+        goto fail;
+    }
+
+    if ( initialize )
+        clear_page(va);
+
+    v->arch.hvm_vcpu.viridian.simp.va = va;
+    return;
+
+ fail:
+    gdprintk(XENLOG_WARNING, "Bad GMFN %#"PRI_gfn" (MFN %#"PRI_mfn")\n", gmfn,
+             page ? page_to_mfn(page) : mfn_x(INVALID_MFN));
+}
+
+static void teardown_simp(struct vcpu *v)
+{
+    void *va = v->arch.hvm_vcpu.viridian.simp.va;
+    struct page_info *page;
+
+    if ( !va )
+        return;
+
+    v->arch.hvm_vcpu.viridian.simp.va = NULL;
+
+    page = mfn_to_page(domain_page_map_to_mfn(va));
+
+    unmap_domain_page_global(va);
+    put_page_and_type(page);
+}
+
+/*
+ * Post a timer expiry message into the SIM slot of the given SINT and
+ * assert the SINT. Returns false if the slot is still occupied by an
+ * unconsumed message, in which case the guest is asked to write EOM
+ * once it has processed the slot and delivery is retried then.
+ */
+static bool synic_deliver_timer_msg(struct vcpu *v, unsigned int sintx,
+                                    unsigned int index, uint64_t expiration,
+                                    uint64_t delivery)
+{
+    struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
+    const union viridian_sint_msr *vs = &vv->sint[sintx];
+    HV_MESSAGE *msg = vv->simp.va;
+    HV_TIMER_MESSAGE_PAYLOAD payload = {
+        .TimerIndex = index,
+        .ExpirationTime = expiration,
+        .DeliveryTime = delivery,
+    };
+
+    BUILD_BUG_ON(sizeof(*msg) * VIRIDIAN_SINT_COUNT != PAGE_SIZE);
+    BUILD_BUG_ON(sizeof(payload) > sizeof(msg->Payload));
+
+    /* Without a message page there is nowhere to post; drop the expiry. */
+    if ( !msg )
+        return true;
+
+    msg += sintx;
+
+    if ( test_bit(sintx, &vv->msg_pending) )
+        return false;
+
+    if ( ACCESS_ONCE(msg->Header.MessageType) != HVMSG_NONE )
+    {
+        msg->Header.MessageFlags |= HV_MESSAGE_FLAG_PENDING;
+        set_bit(sintx, &vv->msg_pending);
+        return false;
+    }
+
+    msg->Header.PayloadSize = sizeof(payload);
+    msg->Header.MessageFlags = 0;
+    msg->Header.Reserved = 0;
+    msg->Header.OriginationId = 0;
+    memcpy(msg->Payload, &payload, sizeof(payload));
+
+    /* The type must become visible last; it marks the slot as full. */
+    smp_wmb();
+    msg->Header.MessageType = HVMSG_TIMER_EXPIRED;
+
+    if ( !vs->fields.mask && vs->fields.vector >= 0x10 )
+        vlapic_set_irq(vcpu_vlapic(v), vs->fields.vector, 0);
+
+    return true;
+}
+
+bool viridian_synic_is_auto_eoi_sint(const struct vcpu *v,
+                                     unsigned int vector)
+{
+    const struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(vv->sint); i++ )
+    {
+        const union viridian_sint_msr *vs = &vv->sint[i];
+
+        if ( vs->fields.vector == vector && !vs->fields.mask &&
+             vs->fields.auto_eoi )
+            return true;
+    }
+
+    return false;
+}
+
 static void update_reference_tsc(struct domain *d, bool_t initialize)
 {
     unsigned long gmfn = d->arch.hvm_domain.viridian.reference_tsc.fields.pfn;
@@ -556,6 +747,211 @@ static void update_reference_tsc(struct domain *d, bool_t initialize)
     put_page_and_type(page);
 }
 
+static int64_t raw_trc_val(struct domain *d)
+{
+    uint64_t tsc;
+    struct time_scale tsc_to_ns;
+
+    tsc = hvm_get_guest_tsc(pt_global_vcpu_target(d));
+
+    /* convert tsc to count of 100ns periods */
+    set_time_scale(&tsc_to_ns, d->arch.tsc_khz * 1000ul);
+    return scale_delta(tsc, &tsc_to_ns) / 100ul;
+}
+
+static uint64_t time_ref_count_now(struct domain *d)
+{
+    const struct viridian_time_ref_count *trc;
+
+    trc = &d->arch.hvm_domain.viridian.time_ref_count;
+
+    return raw_trc_val(d) + trc->off;
+}
+
+/*
+ * Synthetic timers, see section 15.3 of the specification. Times are in
+ * units of the partition reference counter (100ns). Expiry merely marks
+ * the timer pending and kicks the vCPU; the message or interrupt is
+ * delivered from viridian_synic_poll() in the context of that vCPU.
+ */
+static void stimer_expire(void *data)
+{
+    struct viridian_stimer *vs = data;
+    struct vcpu *v = vs->v;
+    unsigned int stimerx = vs - &v->arch.hvm_vcpu.viridian.stimer[0];
+
+    perfc_incr(mshv_stimer_expire);
+    set_bit(stimerx, &v->arch.hvm_vcpu.viridian.stimer_pending);
+    vcpu_kick(v);
+}
+
+/* Program the Xen timer; a no-op while the reference counter is frozen. */
+static void stimer_arm(struct vcpu *v, unsigned int stimerx)
+{
+    struct domain *d = v->domain;
+    struct viridian_stimer *vs = &v->arch.hvm_vcpu.viridian.stimer[stimerx];
+    uint64_t now;
+
+    if ( !test_bit(_TRC_running,
+                   &d->arch.hvm_domain.viridian.time_ref_count.flags) )
+        return;
+
+    now = time_ref_count_now(d);
+
+    /* A periodic timer's first expiry is one period after it is started. */
+    if ( !vs->expiration )
+        vs->expiration = now + vs->count;
+
+    set_timer(&vs->timer,
+              NOW() + (vs->expiration > now ?
+                       (vs->expiration - now) * 100ul : 0));
+}
+
+static void stimer_stop(struct vcpu *v, unsigned int stimerx)
+{
+    struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
+
+    stop_timer(&vv->stimer[stimerx].timer);
+    clear_bit(stimerx, &vv->stimer_pending);
+}
+
+static void stimer_start(struct vcpu *v, unsigned int stimerx)
+{
+    struct viridian_stimer *vs = &v->arch.hvm_vcpu.viridian.stimer[stimerx];
+
+    /*
+     * A zero count disables the timer, as does a SINT of zero unless the
+     * timer is in direct mode.
+     */
+    if ( !vs->count ||
+         (!vs->config.fields.sintx && !vs->config.fields.direct_mode) )
+    {
+        vs->config.fields.enabled = 0;
+        return;
+    }
+
+    /* One-shot counts are absolute; periodic ones are relative. */
+    vs->expiration = vs->config.fields.periodic ? 0 : vs->count;
+    stimer_arm(v, stimerx);
+}
+
+static bool stimer_deliver(struct vcpu *v, unsigned int stimerx, uint64_t now)
+{
+    struct viridian_stimer *vs = &v->arch.hvm_vcpu.viridian.stimer[stimerx];
+
+    if ( vs->config.fields.direct_mode )
+    {
+        if ( vs->config.fields.apic_vector >= 0x10 )
+            vlapic_set_irq(vcpu_vlapic(v), vs->config.fields.apic_vector, 0);
+        return true;
+    }
+
+    return synic_deliver_timer_msg(v, vs->config.fields.sintx, stimerx,
+                                   vs->expiration, now);
+}
+
+static void stimer_freeze(struct domain *d)
+{
+    struct vcpu *v;
+    unsigned int i;
+
+    if ( !has_viridian_stimer(d) )
+        return;
+
+    for_each_vcpu ( d, v )
+        for ( i = 0; i < VIRIDIAN_STIMER_COUNT; i++ )
+            stop_timer(&v->arch.hvm_vcpu.viridian.stimer[i].timer);
+}
+
+static void stimer_thaw(struct domain *d)
+{
+    struct vcpu *v;
+    unsigned int i;
+
+    if ( !has_viridian_stimer(d) )
+        return;
+
+    for_each_vcpu ( d, v )
+        for ( i = 0; i < VIRIDIAN_STIMER_COUNT; i++ )
+            if ( v->arch.hvm_vcpu.viridian.stimer[i].config.fields.enabled )
+                stimer_arm(v, i);
+}
+
+void viridian_synic_poll(struct vcpu *v)
+{
+    struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
+    unsigned int i;
+    uint64_t now;
+
+    if ( !vv->stimer_pending )
+        return;
+
+    now = time_ref_count_now(v->domain);
+
+    for ( i = 0; i < VIRIDIAN_STIMER_COUNT; i++ )
+    {
+        struct viridian_stimer *vs = &vv->stimer[i];
+
+        if ( !test_bit(i, &vv->stimer_pending) )
+            continue;
+
+        /*
+         * Discard expiries which raced with the timer being stopped or
+         * reprogrammed; the Xen timer will fire again if still needed.
+         */
+        if ( !vs->config.fields.enabled || now < vs->expiration )
+        {
+            clear_bit(i, &vv->stimer_pending);
+            continue;
+        }
+
+        if ( !stimer_deliver(v, i, now) )
+        {
+            perfc_incr(mshv_stimer_msg_busy);
+            continue;
+        }
+
+        clear_bit(i, &vv->stimer_pending);
+
+        if ( vs->config.fields.periodic )
+        {
+            /* Skip any periods missed while the vCPU was not running. */
+            vs->expiration += ((now - vs->expiration) / vs->count + 1) *
+                              vs->count;
+            stimer_arm(v, i);
+        }
+        else
+            vs->config.fields.enabled = 0;
+    }
+}
+
+void viridian_time_ref_count_freeze(struct domain *d)
+{
+    struct viridian_time_ref_count *trc;
+
+    trc = &d->arch.hvm_domain.viridian.time_ref_count;
+
+    if ( test_and_clear_bit(_TRC_running, &trc->flags) )
+    {
+        trc->val = raw_trc_val(d) + trc->off;
+        stimer_freeze(d);
+    }
+}
+
+void viridian_time_ref_count_thaw(struct domain *d)
+{
+    struct viridian_time_ref_count *trc;
+
+    trc = &d->arch.hvm_domain.viridian.time_ref_count;
+
+    if ( !d->is_shutting_down &&
+         !test_and_set_bit(_TRC_running, &trc->flags) )
+    {
+        trc->off = (int64_t)trc->val - raw_trc_val(d);
+        stimer_thaw(d);
+    }
+}
+
 int wrmsr_viridian_regs(uint32_t idx, uint64_t val)
 {
     struct vcpu *v = current;
@@ -626,6 +1022,107 @@ int wrmsr_viridian_regs(uint32_t idx, uint64_t val)
             update_reference_tsc(d, 1);
         break;
 
+    case HV_X64_MSR_SCONTROL:
+        if ( !has_viridian_synic(d) )
+            return 0;
+
+        perfc_incr(mshv_wrmsr_synic);
+        v->arch.hvm_vcpu.viridian.scontrol = val;
+        break;
+
+    case HV_X64_MSR_SVERSION:
+        if ( !has_viridian_synic(d) )
+            return 0;
+        /* Read-only */
+        break;
+
+    case HV_X64_MSR_SIEFP:
+        if ( !has_viridian_synic(d) )
+            return 0;
+
+        perfc_incr(mshv_wrmsr_synic);
+        v->arch.hvm_vcpu.viridian.siefp = val;
+        break;
+
+    case HV_X64_MSR_SIMP:
+        if ( !has_viridian_synic(d) )
+            return 0;
+
+        perfc_incr(mshv_wrmsr_synic);
+        teardown_simp(v); /* release any previous mapping */
+        v->arch.hvm_vcpu.viridian.simp.msr.raw = val;
+        v->arch.hvm_vcpu.viridian.msg_pending = 0;
+        dump_simp(v);
+        if ( v->arch.hvm_vcpu.viridian.simp.msr.fields.enabled )
+            initialize_simp(v, true);
+        break;
+
+    case HV_X64_MSR_EOM:
+        if ( !has_viridian_synic(d) )
+            return 0;
+
+        /*
+         * The guest has consumed a message slot it was told had a further
+         * message pending. Delivery of blocked expiries is retried on the
+         * next poll, which happens before re-entering the guest.
+         */
+        perfc_incr(mshv_wrmsr_eom);
+        v->arch.hvm_vcpu.viridian.msg_pending = 0;
+        break;
+
+    case HV_X64_MSR_SINT0 ... HV_X64_MSR_SINT15:
+        if ( !has_viridian_synic(d) )
+            return 0;
+
+        perfc_incr(mshv_wrmsr_synic);
+        idx -= HV_X64_MSR_SINT0;
+        v->arch.hvm_vcpu.viridian.sint[idx].raw = val;
+        break;
+
+    case HV_X64_MSR_STIMER0_CONFIG:
+    case HV_X64_MSR_STIMER1_CONFIG:
+    case HV_X64_MSR_STIMER2_CONFIG:
+    case HV_X64_MSR_STIMER3_CONFIG:
+    {
+        unsigned int stimerx = (idx - HV_X64_MSR_STIMER0_CONFIG) / 2;
+        struct viridian_stimer *vs =
+            &v->arch.hvm_vcpu.viridian.stimer[stimerx];
+
+        if ( !has_viridian_stimer(d) )
+            return 0;
+
+        perfc_incr(mshv_wrmsr_stimer);
+        stimer_stop(v, stimerx);
+        vs->config.raw = val;
+        if ( vs->config.fields.enabled )
+            stimer_start(v, stimerx);
+        break;
+    }
+
+    case HV_X64_MSR_STIMER0_COUNT:
+    case HV_X64_MSR_STIMER1_COUNT:
+    case HV_X64_MSR_STIMER2_COUNT:
+    case HV_X64_MSR_STIMER3_COUNT:
+    {
+        unsigned int stimerx = (idx - HV_X64_MSR_STIMER0_COUNT) / 2;
+        struct viridian_stimer *vs =
+            &v->arch.hvm_vcpu.viridian.stimer[stimerx];
+
+        if ( !has_viridian_stimer(d) )
+            return 0;
+
+        perfc_incr(mshv_wrmsr_stimer);
+        stimer_stop(v, stimerx);
+        vs->count = val;
+        if ( !vs->count )
+            vs->config.fields.enabled = 0;
+        else if ( vs->config.fields.auto_enable )
+            vs->config.fields.enabled = 1;
+        if ( vs->config.fields.enabled )
+            stimer_start(v, stimerx);
+        break;
+    }
+
     case HV_X64_MSR_CRASH_P0:
     case HV_X64_MSR_CRASH_P1:
     case HV_X64_MSR_CRASH_P2:
@@ -667,39 +1164,6 @@ int wrmsr_viridian_regs(uint32_t idx, uint64_t val)
     return 1;
 }
 
-static int64_t raw_trc_val(struct domain *d)
-{
-    uint64_t tsc;
-    struct time_scale tsc_to_ns;
-
-    tsc = hvm_get_guest_tsc(pt_global_vcpu_target(d));
-
-    /* convert tsc to count of 100ns periods */
-    set_time_scale(&tsc_to_ns, d->arch.tsc_khz * 1000ul);
-    return scale_delta(tsc, &tsc_to_ns) / 100ul;
-}
-
-void viridian_time_ref_count_freeze(struct domain *d)
-{
-    struct viridian_time_ref_count *trc;
-
-    trc = &d->arch.hvm_domain.viridian.time_ref_count;
-
-    if ( test_and_clear_bit(_TRC_running, &trc->flags) )
-        trc->val = raw_trc_val(d) + trc->off;
-}
-
-void viridian_time_ref_count_thaw(struct domain *d)
-{
-    struct viridian_time_ref_count *trc;
-
-    trc = &d->arch.hvm_domain.viridian.time_ref_count;
-
-    if ( !d->is_shutting_down &&
-         !test_and_set_bit(_TRC_running, &trc->flags) )
-        trc->off = (int64_t)trc->val - raw_trc_val(d);
-}
-
 int rdmsr_viridian_regs(uint32_t idx, uint64_t *val)
 {
     struct vcpu *v = current;
@@ -795,6 +1259,80 @@ int rdmsr_viridian_regs(uint32_t idx, uint64_t *val)
         *val = v->arch.hvm_vcpu.viridian.crash_param[idx];
         break;
 
+    case HV_X64_MSR_SCONTROL:
+        if ( !has_viridian_synic(d) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_synic);
+        *val = v->arch.hvm_vcpu.viridian.scontrol;
+        break;
+
+    case HV_X64_MSR_SVERSION:
+        if ( !has_viridian_synic(d) )
+            return 0;
+
+        /* The only version defined by the specification. */
+        perfc_incr(mshv_rdmsr_synic);
+        *val = 1;
+        break;
+
+    case HV_X64_MSR_SIEFP:
+        if ( !has_viridian_synic(d) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_synic);
+        *val = v->arch.hvm_vcpu.viridian.siefp;
+        break;
+
+    case HV_X64_MSR_SIMP:
+        if ( !has_viridian_synic(d) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_synic);
+        *val = v->arch.hvm_vcpu.viridian.simp.msr.raw;
+        break;
+
+    case HV_X64_MSR_EOM:
+        if ( !has_viridian_synic(d) )
+            return 0;
+
+        /* Write-only */
+        *val = 0;
+        break;
+
+    case HV_X64_MSR_SINT0 ... HV_X64_MSR_SINT15:
+        if ( !has_viridian_synic(d) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_synic);
+        idx -= HV_X64_MSR_SINT0;
+        *val = v->arch.hvm_vcpu.viridian.sint[idx].raw;
+        break;
+
+    case HV_X64_MSR_STIMER0_CONFIG:
+    case HV_X64_MSR_STIMER1_CONFIG:
+    case HV_X64_MSR_STIMER2_CONFIG:
+    case HV_X64_MSR_STIMER3_CONFIG:
+        if ( !has_viridian_stimer(d) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_stimer);
+        idx = (idx - HV_X64_MSR_STIMER0_CONFIG) / 2;
+        *val = v->arch.hvm_vcpu.viridian.stimer[idx].config.raw;
+        break;
+
+    case HV_X64_MSR_STIMER0_COUNT:
+    case HV_X64_MSR_STIMER1_COUNT:
+    case HV_X64_MSR_STIMER2_COUNT:
+    case HV_X64_MSR_STIMER3_COUNT:
+        if ( !has_viridian_stimer(d) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_stimer);
+        idx = (idx - HV_X64_MSR_STIMER0_COUNT) / 2;
+        *val = v->arch.hvm_vcpu.viridian.stimer[idx].count;
+        break;
+
     case HV_X64_MSR_CRASH_CTL:
     {
         HV_CRASH_CTL_REG_CONTENTS ctl = {
@@ -816,20 +1354,62 @@ int rdmsr_viridian_regs(uint32_t idx, uint64_t *val)
     return 1;
 }
 
+int viridian_vcpu_init(struct vcpu *v)
+{
+    unsigned int i;
+
+    /* Kept out of line: struct vcpu has to fit in a page. */
+    v->arch.hvm_vcpu.viridian.stimer =
+        xzalloc_array(struct viridian_stimer, VIRIDIAN_STIMER_COUNT);
+    if ( !v->arch.hvm_vcpu.viridian.stimer )
+        return -ENOMEM;
+
+    for ( i = 0; i < VIRIDIAN_STIMER_COUNT; i++ )
+    {
+        struct viridian_stimer *vs = &v->arch.hvm_vcpu.viridian.stimer[i];
+
+        vs->v = v;
+        init_timer(&vs->timer, stimer_expire, vs, v->processor);
+    }
+
+    /* SINTs come out of reset masked (section 11.8.4). */
+    for ( i = 0; i < ARRAY_SIZE(v->arch.hvm_vcpu.viridian.sint); i++ )
+        v->arch.hvm_vcpu.viridian.sint[i].fields.mask = 1;
+
+    return 0;
+}
+
 void viridian_vcpu_deinit(struct vcpu *v)
 {
+    unsigned int i;
+
+    if ( v->arch.hvm_vcpu.viridian.stimer )
+    {
+        for ( i = 0; i < VIRIDIAN_STIMER_COUNT; i++ )
+            kill_timer(&v->arch.hvm_vcpu.viridian.stimer[i].timer);
+        xfree(v->arch.hvm_vcpu.viridian.stimer);
+        v->arch.hvm_vcpu.viridian.stimer = NULL;
+    }
+
     teardown_vp_assist(v);
+    teardown_simp(v);
 }
 
 void viridian_domain_deinit(struct domain *d)
 {
     struct vcpu *v;
+    unsigned int i;
 
     for_each_vcpu ( d, v )
+    {
+        for ( i = 0; i < VIRIDIAN_STIMER_COUNT; i++ )
+            stop_timer(&v->arch.hvm_vcpu.viridian.stimer[i].timer);
+
         teardown_vp_assist(v);
+        teardown_simp(v);
+    }
 }
 
-static DEFINE_PER_CPU(cpumask_t, ipi_cpumask);
 
 int viridian_hypercall(struct cpu_user_regs *regs)
 {
@@ -894,8 +1474,6 @@ int viridian_hypercall(struct cpu_user_regs *regs)
     case HvFlushVirtualAddressSpace:
     case HvFlushVirtualAddressList:
     {
-        cpumask_t *pcpu_mask;
-        struct vcpu *v;
         struct {
             uint64_t address_space;
             uint64_t flags;
@@ -925,36 +1503,70 @@ int viridian_hypercall(struct cpu_user_regs *regs)
         if ( input_params.flags & HV_FLUSH_ALL_PROCESSORS )
             input_params.vcpu_mask = ~0ul;
 
-        pcpu_mask = &this_cpu(ipi_cpumask);
-        cpumask_clear(pcpu_mask);
+        hvm_flush_vcpu_tlbs((unsigned long *)&input_params.vcpu_mask,
+                            sizeof(input_params.vcpu_mask) * 8);
+
+        output.rep_complete = input.rep_count;
+
+        status = HV_STATUS_SUCCESS;
+        break;
+    }
+
+    case HvFlushVirtualAddressSpaceEx:
+    case HvFlushVirtualAddressListEx:
+    {
+        DECLARE_BITMAP(vcpu_mask, HVM_MAX_VCPUS);
+        struct {
+            uint64_t address_space;
+            uint64_t flags;
+            uint64_t format;
+            uint64_t valid_bank_mask;
+        } input_params;
+        uint64_t bank_contents;
+        unsigned int bank, nr_banks = 0;
 
         /*
-         * For each specified virtual CPU flush all ASIDs to invalidate
-         * TLB entries the next time it is scheduled and then, if it
-         * is currently running, add its physical CPU to a mask of
-         * those which need to be interrupted to force a flush.
+         * As above, but with the vCPUs given as a generic processor set:
+         * banks of 64 vCPUs, only those in valid_bank_mask being present.
          */
-        for_each_vcpu ( currd, v )
-        {
-            if ( v->vcpu_id >= (sizeof(input_params.vcpu_mask) * 8) )
-                break;
+        perfc_incr(mshv_call_flush);
 
-            if ( !(input_params.vcpu_mask & (1ul << v->vcpu_id)) )
-                continue;
+        status = HV_STATUS_INVALID_PARAMETER;
+        if ( input.fast )
+            break;
+
+        if ( hvm_copy_from_guest_phys(&input_params, input_params_gpa,
+                                      sizeof(input_params)) != HVMTRANS_okay )
+            break;
 
-            hvm_asid_flush_vcpu(v);
-            if ( v != curr && v->is_running )
-                __cpumask_set_cpu(v->processor, pcpu_mask);
+        if ( (input_params.flags & HV_FLUSH_ALL_PROCESSORS) ||
+             input_params.format == HV_GENERIC_SET_ALL )
+            bitmap_fill(vcpu_mask, HVM_MAX_VCPUS);
+        else if ( input_params.format == HV_GENERIC_SET_SPARSE_4K )
+        {
+            bitmap_zero(vcpu_mask, HVM_MAX_VCPUS);
+
+            for ( bank = 0; bank < 64; bank++ )
+            {
+                if ( !(input_params.valid_bank_mask & (1ul << bank)) )
+                    continue;
+
+                /* Bank contents are packed, in order of the valid banks. */
+                if ( hvm_copy_from_guest_phys(
+                         &bank_contents,
+                         input_params_gpa + sizeof(input_params) +
+                         nr_banks++ * sizeof(bank_contents),
+                         sizeof(bank_contents)) != HVMTRANS_okay )
+                    goto out;
+
+                if ( bank < BITS_TO_LONGS(HVM_MAX_VCPUS) )
+                    vcpu_mask[bank] = bank_contents;
+            }
         }
+        else
+            break;
 
-        /*
-         * Since ASIDs have now been flushed it just remains to
-         * force any CPUs currently running target vCPUs out of non-
-         * root mode. It's possible that re-scheduling has taken place
-         * so we may unnecessarily IPI some CPUs.
-         */
-        if ( !cpumask_empty(pcpu_mask) )
-            smp_send_event_check_mask(pcpu_mask);
+        hvm_flush_vcpu_tlbs(vcpu_mask, HVM_MAX_VCPUS);
 
         output.rep_complete = input.rep_count;
 
@@ -1038,10 +1650,29 @@ static int viridian_save_vcpu_ctxt(struct domain *d, hvm_domain_context_t *h)
         return 0;
 
     for_each_vcpu( d, v ) {
+        const struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
         struct hvm_viridian_vcpu_context ctxt = {
-            .vp_assist_msr = v->arch.hvm_vcpu.viridian.vp_assist.msr.raw,
-            .vp_assist_vector = v->arch.hvm_vcpu.viridian.vp_assist.vector,
+            .vp_assist_msr = vv->vp_assist.msr.raw,
+            .vp_assist_vector = vv->vp_assist.vector,
+            .scontrol_msr = vv->scontrol,
+            .siefp_msr = vv->siefp,
+            .simp_msr = vv->simp.msr.raw,
+            .stimer_pending = vv->stimer_pending,
         };
+        unsigned int i;
+
+        BUILD_BUG_ON(ARRAY_SIZE(ctxt.sint_msr) != ARRAY_SIZE(vv->sint));
+        BUILD_BUG_ON(ARRAY_SIZE(ctxt.stimer_config_msr) !=
+                     VIRIDIAN_STIMER_COUNT);
+
+        for ( i = 0; i < ARRAY_SIZE(vv->sint); i++ )
+            ctxt.sint_msr[i] = vv->sint[i].raw;
+
+        for ( i = 0; i < VIRIDIAN_STIMER_COUNT; i++ )
+        {
+            ctxt.stimer_config_msr[i] = vv->stimer[i].config.raw;
+            ctxt.stimer_count_msr[i] = vv->stimer[i].count;
+        }
 
         if ( hvm_save_entry(VIRIDIAN_VCPU, v->vcpu_id, h, &ctxt) != 0 )
             return 1;
@@ -1054,7 +1685,9 @@ static int viridian_load_vcpu_ctxt(struct domain *d, hvm_domain_context_t *h)
 {
     int vcpuid;
     struct vcpu *v;
+    struct viridian_vcpu *vv;
     struct hvm_viridian_vcpu_context ctxt;
+    unsigned int i;
 
     vcpuid = hvm_load_instance(h);
     if ( vcpuid >= d->max_vcpus || (v = d->vcpu[vcpuid]) == NULL )
@@ -1067,7 +1700,8 @@ static int viridian_load_vcpu_ctxt(struct domain *d, hvm_domain_context_t *h)
     if ( hvm_load_entry_zeroextend(VIRIDIAN_VCPU, h, &ctxt) != 0 )
         return -EINVAL;
 
-    if ( memcmp(&ctxt._pad, zero_page, sizeof(ctxt._pad)) )
+    if ( memcmp(&ctxt._pad, zero_page, sizeof(ctxt._pad)) ||
+         memcmp(&ctxt._pad1, zero_page, sizeof(ctxt._pad1)) )
         return -EINVAL;
 
     v->arch.hvm_vcpu.viridian.vp_assist.msr.raw = ctxt.vp_assist_msr;
@@ -1077,6 +1711,40 @@ static int viridian_load_vcpu_ctxt(struct domain *d, hvm_domain_context_t *h)
 
     v->arch.hvm_vcpu.viridian.vp_assist.vector = ctxt.vp_assist_vector;
 
+    vv = &v->arch.hvm_vcpu.viridian;
+    vv->scontrol = ctxt.scontrol_msr;
+    vv->siefp = ctxt.siefp_msr;
+
+    /* Don't clear the page: it may hold messages the guest has yet to see. */
+    vv->simp.msr.raw = ctxt.simp_msr;
+    if ( vv->simp.msr.fields.enabled && !vv->simp.va )
+        initialize_simp(v, false);
+
+    /*
+     * Streams from before SynIC support carry zero here, which would leave
+     * the SINTs unmasked; restore the reset state instead.
+     */
+    for ( i = 0; i < ARRAY_SIZE(vv->sint); i++ )
+    {
+        vv->sint[i].raw = ctxt.sint_msr[i];
+        if ( !ctxt.sint_msr[i] )
+            vv->sint[i].fields.mask = 1;
+    }
+
+    for ( i = 0; i < VIRIDIAN_STIMER_COUNT; i++ )
+    {
+        struct viridian_stimer *vs = &vv->stimer[i];
+
+        stimer_stop(v, i);
+        vs->config.raw = ctxt.stimer_config_msr[i];
+        vs->count = ctxt.stimer_count_msr[i];
+        if ( vs->config.fields.enabled )
+            stimer_start(v, i);
+    }
+
+    /* Restored after starting the timers, which clears them. */
+    vv->stimer_pending = ctxt.stimer_pending;
+
     return 0;
 }
 
@@ -523,6 +523,115 @@ void vlapic_ipi(
     }
 }
 
+/*
+ * In x2APIC mode the APIC ID and LDR are read-only, and derived from the
+ * vcpu_id by set_x2apic_id().  The vCPU a destination refers to can thus
+ * be worked out directly, rather than by matching it against every vCPU.
+ * Only if a candidate's ID or LDR isn't what set_x2apic_id() would have
+ * given it (which lapic_load_fixup() allows for) is that not conclusive.
+ */
+static struct vcpu *x2apic_phys_dest_vcpu(const struct domain *d,
+                                          uint32_t dest)
+{
+    struct vcpu *v;
+
+    if ( (dest & 1) || dest / 2 >= d->max_vcpus ||
+         !(v = d->vcpu[dest / 2]) ||
+         vlapic_get_reg(vcpu_vlapic(v), APIC_ID) != dest )
+        return NULL;
+
+    return v;
+}
+
+static bool x2apic_logical_dest_ok(const struct domain *d, uint32_t dest)
+{
+    unsigned int base = (dest >> 16) * 16, bit;
+    const struct vcpu *v;
+
+    for ( bit = 0; bit < 16; bit++ )
+    {
+        if ( !(dest & (1u << bit)) )
+            continue;
+
+        if ( base + bit >= d->max_vcpus || !(v = d->vcpu[base + bit]) ||
+             vlapic_get_reg(vcpu_vlapic(v), APIC_LDR) !=
+             ((dest & 0xffff0000) | (1u << bit)) )
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Fast path for an x2APIC ICR write of a fixed interrupt, the bulk of
+ * guest IPIs: it is delivered to the vCPUs it's destined for without
+ * going through vlapic_reg_write() and matching the destination against
+ * every vCPU.  Returns false, having done nothing, if the write needs the
+ * full emulation.
+ */
+bool vlapic_x2apic_ipi_fast(struct vcpu *v, uint64_t msr_content)
+{
+    struct vlapic *vlapic = vcpu_vlapic(v);
+    struct domain *d = v->domain;
+    uint32_t icr_low = msr_content, dest = msr_content >> 32;
+    unsigned int short_hand = icr_low & APIC_SHORT_MASK;
+    struct vcpu *target;
+    bool batch;
+
+    if ( !vlapic_x2apic_mode(vlapic) ||
+         (icr_low & ~(APIC_VECTOR_MASK | APIC_MODE_MASK | APIC_DEST_MASK |
+                      APIC_INT_ASSERT | APIC_INT_LEVELTRIG |
+                      APIC_SHORT_MASK)) ||
+         (icr_low & APIC_MODE_MASK) != APIC_DM_FIXED ||
+         (icr_low & APIC_VECTOR_MASK) < 16 )
+        return false;
+
+    if ( short_hand == APIC_DEST_NOSHORT && dest != 0xffffffff )
+    {
+        if ( !(icr_low & APIC_DEST_MASK) )
+        {
+            if ( !(target = x2apic_phys_dest_vcpu(d, dest)) )
+                return false;
+            vlapic_accept_irq(target, icr_low);
+        }
+        else
+        {
+            unsigned int base = (dest >> 16) * 16, bit;
+
+            if ( !x2apic_logical_dest_ok(d, dest) )
+                return false;
+
+            batch = hweight16(dest) > 1;
+            if ( batch )
+                cpu_raise_softirq_batch_begin();
+            for ( bit = 0; bit < 16; bit++ )
+                if ( dest & (1u << bit) )
+                    vlapic_accept_irq(d->vcpu[base + bit], icr_low);
+            if ( batch )
+                cpu_raise_softirq_batch_finish();
+        }
+    }
+    else if ( short_hand == APIC_DEST_SELF )
+        vlapic_accept_irq(v, icr_low);
+    else
+    {
+        /* Broadcast, with or without self. */
+        batch = d->max_vcpus > 2;
+        if ( batch )
+            cpu_raise_softirq_batch_begin();
+        for_each_vcpu ( d, target )
+            if ( target != v || short_hand != APIC_DEST_ALLBUT )
+                vlapic_accept_irq(target, icr_low);
+        if ( batch )
+            cpu_raise_softirq_batch_finish();
+    }
+
+    vlapic_set_reg(vlapic, APIC_ICR2, dest);
+    vlapic_set_reg(vlapic, APIC_ICR, icr_low & ~(1 << 12));
+
+    return true;
+}
+
 static uint32_t vlapic_get_tmcct(struct vlapic *vlapic)
 {
     struct vcpu *v = current;
@@ -1088,6 +1197,9 @@ bool_t vlapic_msr_set(struct vlapic *vlapic, uint64_t value)
     vlapic->hw.apic_base_msr = value;
     memset(&vlapic->loaded, 0, sizeof(vlapic->loaded));
 
+    /* CPUID's APIC feature bit follows APIC_BASE.EN. */
+    cpuid_cache_flush(vlapic_vcpu(vlapic));
+
     if ( vlapic_x2apic_mode(vlapic) )
         set_x2apic_id(vlapic);
 
@@ -1244,6 +1356,13 @@ int vlapic_has_pending_irq(struct vcpu *v)
     if ( !vlapic_enabled(vlapic) )
         return -1;
 
+    /*
+     * Deliver any expired synthetic timers first, since doing so may
+     * assert a synthetic interrupt.
+     */
+    if ( has_viridian_synic(v->domain) )
+        viridian_synic_poll(v);
+
     irr = vlapic_find_highest_irr(vlapic);
     if ( irr == -1 )
         return -1;
@@ -1284,6 +1403,14 @@ int vlapic_ack_pending_irq(struct vcpu *v, int vector, bool_t force_ack)
          vlapic_virtual_intr_delivery_enabled() )
         return 1;
 
+    /* AutoEOI SINTs are acked and EOIed in one go: leave the ISR alone. */
+    if ( has_viridian_synic(v->domain) &&
+         viridian_synic_is_auto_eoi_sint(v, vector) )
+    {
+        vlapic_clear_irr(vector, vlapic);
+        return 1;
+    }
+
     /* If there's no chance of using APIC assist then bail now. */
     if ( !has_viridian_apic_assist(v->domain) ||
          vlapic_test_vector(vector, &vlapic->regs->data[APIC_TMR]) )
@@ -1500,6 +1627,7 @@ static int lapic_load_hidden(struct domain *d, hvm_domain_context_t *h)
         return -EINVAL;
 
     vmx_vlapic_msr_changed(v);
+    cpuid_cache_flush(v);
 
     return 0;
 }
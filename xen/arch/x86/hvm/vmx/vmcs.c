@@ -66,6 +66,7 @@ integer_param("ple_window", ple_window);
 
 static bool_t __read_mostly opt_pml_enabled = 1;
 static s8 __read_mostly opt_ept_ad = -1;
+static bool __read_mostly opt_ept_spp = true;
 
 /*
  * The 'ept' parameter controls functionalities that depend on, or impact the
@@ -73,6 +74,7 @@ static s8 __read_mostly opt_ept_ad = -1;
  *
  *  pml                 Enable PML
  *  ad                  Use A/D bits
+ *  spp                 Use sub-page write permissions for mem_access
  */
 static int __init parse_ept_param(const char *s)
 {
@@ -93,6 +95,8 @@ static int __init parse_ept_param(const char *s)
             opt_pml_enabled = val;
         else if ( !strncmp(s, "ad", ss - s) )
             opt_ept_ad = val;
+        else if ( !strncmp(s, "spp", ss - s) )
+            opt_ept_spp = val;
         else
             rc = -EINVAL;
 
@@ -143,6 +147,7 @@ static void __init vmx_display_features(void)
     P(cpu_has_vmx_virt_exceptions, "Virtualisation Exceptions");
     P(cpu_has_vmx_pml, "Page Modification Logging");
     P(cpu_has_vmx_tsc_scaling, "TSC Scaling");
+    P(cpu_has_vmx_spp, "Sub-Page Write Permissions");
 #undef P
 
     if ( !printed )
@@ -248,6 +253,8 @@ static int vmx_init_vmcs_config(void)
             opt |= SECONDARY_EXEC_UNRESTRICTED_GUEST;
         if ( opt_pml_enabled )
             opt |= SECONDARY_EXEC_ENABLE_PML;
+        if ( opt_ept_spp )
+            opt |= SECONDARY_EXEC_ENABLE_SPP;
 
         /*
          * "APIC Register Virtualization" and "Virtual Interrupt Delivery"
@@ -325,9 +332,10 @@ static int vmx_init_vmcs_config(void)
                   SECONDARY_EXEC_UNRESTRICTED_GUEST);
     }
 
-    /* PML cannot be supported if EPT is not used */
+    /* PML and SPP cannot be supported if EPT is not used */
     if ( !(_vmx_secondary_exec_control & SECONDARY_EXEC_ENABLE_EPT) )
-        _vmx_secondary_exec_control &= ~SECONDARY_EXEC_ENABLE_PML;
+        _vmx_secondary_exec_control &= ~(SECONDARY_EXEC_ENABLE_PML |
+                                         SECONDARY_EXEC_ENABLE_SPP);
 
     /* Turn off opt_pml_enabled if PML feature is not present */
     if ( !(_vmx_secondary_exec_control & SECONDARY_EXEC_ENABLE_PML) )
@@ -1102,9 +1110,7 @@ static int construct_vmcs(struct vcpu *v)
         vmx_clear_msr_intercept(v, MSR_IA32_SYSENTER_EIP, VMX_MSR_RW);
         if ( paging_mode_hap(d) && (!iommu_enabled || iommu_snoop) )
             vmx_clear_msr_intercept(v, MSR_IA32_CR_PAT, VMX_MSR_RW);
-        if ( (vmexit_ctl & VM_EXIT_CLEAR_BNDCFGS) &&
-             (vmentry_ctl & VM_ENTRY_LOAD_BNDCFGS) )
-            vmx_clear_msr_intercept(v, MSR_IA32_BNDCFGS, VMX_MSR_RW);
+        /* Policy-driven passthrough: see hvm_update_msr_passthrough(). */
     }
 
     /* I/O access bitmap. */
@@ -1136,6 +1142,9 @@ static int construct_vmcs(struct vcpu *v)
     /* Disable PML anyway here as it will only be enabled in log dirty mode */
     v->arch.hvm_vmx.secondary_exec_control &= ~SECONDARY_EXEC_ENABLE_PML;
 
+    /* Likewise SPP, enabled once sub-page permissions are first set. */
+    v->arch.hvm_vmx.secondary_exec_control &= ~SECONDARY_EXEC_ENABLE_SPP;
+
     /* Host data selectors. */
     __vmwrite(HOST_SS_SELECTOR, __HYPERVISOR_DS);
     __vmwrite(HOST_DS_SELECTOR, __HYPERVISOR_DS);
@@ -1521,10 +1530,62 @@ void vmx_vcpu_flush_pml_buffer(struct vcpu *v)
     /* Reset PML index */
     __vmwrite(GUEST_PML_INDEX, NR_PML_ENTRIES - 1);
 
+    /* Keep the dirty rate estimate current while the guest is running. */
+    paging_log_dirty_sample(v->domain);
+
  out:
     vmx_vmcs_exit(v);
 }
 
+int vmx_vcpu_enable_spp(struct vcpu *v)
+{
+    mfn_t sppt = p2m_get_hostp2m(v->domain)->ept.sppt;
+
+    if ( mfn_eq(sppt, INVALID_MFN) )
+        return -EINVAL;
+
+    vmx_vmcs_enter(v);
+
+    __vmwrite(SPPT_POINTER, mfn_to_maddr(sppt));
+
+    v->arch.hvm_vmx.secondary_exec_control |= SECONDARY_EXEC_ENABLE_SPP;
+    __vmwrite(SECONDARY_VM_EXEC_CONTROL,
+              v->arch.hvm_vmx.secondary_exec_control);
+
+    vmx_vmcs_exit(v);
+
+    return 0;
+}
+
+bool vmx_domain_spp_enabled(const struct domain *d)
+{
+    return d->arch.hvm_domain.vmx.status & VMX_DOMAIN_SPP_ENABLED;
+}
+
+/*
+ * Enable SPP for all vCPUs of a domain, once the host p2m has a sub-page
+ * permission table.  Called with the domain paused.  There's no disabling:
+ * entries without the EPT SPP bit are unaffected by it.
+ */
+int vmx_domain_enable_spp(struct domain *d)
+{
+    struct vcpu *v;
+    int rc;
+
+    ASSERT(atomic_read(&d->pause_count));
+
+    if ( vmx_domain_spp_enabled(d) )
+        return 0;
+
+    for_each_vcpu ( d, v )
+        if ( (rc = vmx_vcpu_enable_spp(v)) != 0 )
+            return rc;
+
+    d->arch.hvm_domain.vmx.status |= VMX_DOMAIN_SPP_ENABLED;
+
+    return 0;
+}
+
 bool_t vmx_domain_pml_enabled(const struct domain *d)
 {
     return !!(d->arch.hvm_domain.vmx.status & VMX_DOMAIN_PML_ENABLED);
@@ -1705,7 +1766,7 @@ void vmx_do_resume(struct vcpu *v)
         vmx_clear_vmcs(v);
         vmx_load_vmcs(v);
         hvm_migrate_timers(v);
-        hvm_migrate_pirqs(v);
+        hvm_follow_pirqs(v);
         vmx_set_host_env(v);
         /*
          * Both n1 VMCS and n2 VMCS need to update the host environment after 
@@ -83,13 +83,22 @@ static int vmx_vmfunc_intercept(struct cpu_user_regs *regs);
 struct vmx_pi_blocking_vcpu {
     struct list_head     list;
     spinlock_t           lock;
+    unsigned int         count;
 };
 
 /*
  * We maintain a per-CPU linked-list of vCPUs, so in PI wakeup
  * handler we can find which vCPU should be woken up.
+ *
+ * The wakeup handler has to scan the whole list, so a blocking vCPU is
+ * parked on another pCPU's list (with NDST pointing there) once its own
+ * pCPU holds more than PI_LIST_FIXED_LIMIT entries above the average.
  */
 static DEFINE_PER_CPU(struct vmx_pi_blocking_vcpu, vmx_pi_blocking);
+static atomic_t vmx_pi_blocked = ATOMIC_INIT(0);
+#define PI_LIST_FIXED_LIMIT 16
+
+#define pi_blocking_of(l) container_of(l, struct vmx_pi_blocking_vcpu, lock)
 
 uint8_t __read_mostly posted_intr_vector;
 static uint8_t __read_mostly pi_wakeup_vector;
@@ -100,13 +109,39 @@ void vmx_pi_per_cpu_init(unsigned int cpu)
     spin_lock_init(&per_cpu(vmx_pi_blocking, cpu).lock);
 }
 
+static unsigned int vmx_pi_block_cpu(unsigned int cpu)
+{
+    unsigned int limit = PI_LIST_FIXED_LIMIT +
+                         atomic_read(&vmx_pi_blocked) / num_online_cpus();
+    unsigned int i = cpu;
+
+    do {
+        if ( read_atomic(&per_cpu(vmx_pi_blocking, i).count) < limit )
+            return i;
+        i = cpumask_cycle(i, &cpu_online_map);
+    } while ( i != cpu );
+
+    return cpu;
+}
+
+static void vmx_pi_list_del(struct arch_vmx_struct *vmx)
+{
+    struct vmx_pi_blocking_vcpu *pi_blocking =
+        pi_blocking_of(vmx->pi_blocking.lock);
+
+    list_del(&vmx->pi_blocking.list);
+    vmx->pi_blocking.lock = NULL;
+    write_atomic(&pi_blocking->count, pi_blocking->count - 1);
+    atomic_dec(&vmx_pi_blocked);
+}
+
 static void vmx_vcpu_block(struct vcpu *v)
 {
     unsigned long flags;
-    unsigned int dest;
+    unsigned int dest, pi_cpu = vmx_pi_block_cpu(v->processor);
     spinlock_t *old_lock;
     spinlock_t *pi_blocking_list_lock =
-		&per_cpu(vmx_pi_blocking, v->processor).lock;
+		&per_cpu(vmx_pi_blocking, pi_cpu).lock;
     struct pi_desc *pi_desc = &v->arch.hvm_vmx.pi_desc;
 
     spin_lock_irqsave(pi_blocking_list_lock, flags);
@@ -121,7 +156,10 @@ static void vmx_vcpu_block(struct vcpu *v)
     ASSERT(old_lock == NULL);
 
     list_add_tail(&v->arch.hvm_vmx.pi_blocking.list,
-                  &per_cpu(vmx_pi_blocking, v->processor).list);
+                  &per_cpu(vmx_pi_blocking, pi_cpu).list);
+    write_atomic(&per_cpu(vmx_pi_blocking, pi_cpu).count,
+                 per_cpu(vmx_pi_blocking, pi_cpu).count + 1);
+    atomic_inc(&vmx_pi_blocked);
     spin_unlock_irqrestore(pi_blocking_list_lock, flags);
 
     ASSERT(!pi_test_sn(pi_desc));
@@ -131,6 +169,19 @@ static void vmx_vcpu_block(struct vcpu *v)
     ASSERT(pi_desc->ndst ==
            (x2apic_enabled ? dest : MASK_INSR(dest, PI_xAPIC_NDST_MASK)));
 
+    /*
+     * Redirect NDST before switching to the wakeup vector; a notification
+     * sent in between is caught by vcpu_block()'s recheck for events.
+     * vmx_pi_unblock_vcpu() points NDST back before the next VM entry.
+     */
+    if ( pi_cpu != v->processor )
+    {
+        perfc_incr(pi_block_remote);
+        dest = cpu_physical_id(pi_cpu);
+        write_atomic(&pi_desc->ndst,
+                     x2apic_enabled ? dest : MASK_INSR(dest, PI_xAPIC_NDST_MASK));
+    }
+
     write_atomic(&pi_desc->nv, pi_wakeup_vector);
 }
 
@@ -160,6 +211,12 @@ static void vmx_pi_unblock_vcpu(struct vcpu *v)
     unsigned long flags;
     spinlock_t *pi_blocking_list_lock;
     struct pi_desc *pi_desc = &v->arch.hvm_vmx.pi_desc;
+    unsigned int dest = cpu_physical_id(v->processor);
+
+    /* Undo any redirection done by vmx_vcpu_block(). */
+    dest = x2apic_enabled ? dest : MASK_INSR(dest, PI_xAPIC_NDST_MASK);
+    if ( read_atomic(&pi_desc->ndst) != dest )
+        write_atomic(&pi_desc->ndst, dest);
 
     /*
      * Set 'NV' field back to posted_intr_vector, so the
@@ -186,8 +243,7 @@ static void vmx_pi_unblock_vcpu(struct vcpu *v)
     if ( v->arch.hvm_vmx.pi_blocking.lock != NULL )
     {
         ASSERT(v->arch.hvm_vmx.pi_blocking.lock == pi_blocking_list_lock);
-        list_del(&v->arch.hvm_vmx.pi_blocking.list);
-        v->arch.hvm_vmx.pi_blocking.lock = NULL;
+        vmx_pi_list_del(&v->arch.hvm_vmx);
     }
 
     spin_unlock_irqrestore(pi_blocking_list_lock, flags);
@@ -234,8 +290,7 @@ void vmx_pi_desc_fixup(unsigned int cpu)
          */
         if ( pi_test_on(&vmx->pi_desc) )
         {
-            list_del(&vmx->pi_blocking.list);
-            vmx->pi_blocking.lock = NULL;
+            vmx_pi_list_del(vmx);
             vcpu_unblock(container_of(vmx, struct vcpu, arch.hvm_vmx));
         }
         else
@@ -260,6 +315,10 @@ void vmx_pi_desc_fixup(unsigned int cpu)
             list_move(&vmx->pi_blocking.list,
                       &per_cpu(vmx_pi_blocking, new_cpu).list);
             vmx->pi_blocking.lock = new_lock;
+            write_atomic(&pi_blocking_of(old_lock)->count,
+                         pi_blocking_of(old_lock)->count - 1);
+            write_atomic(&pi_blocking_of(new_lock)->count,
+                         pi_blocking_of(new_lock)->count + 1);
 
             spin_unlock(new_lock);
         }
@@ -462,6 +521,13 @@ static int vmx_vcpu_initialise(struct vcpu *v)
         }
     }
 
+    if ( vmx_domain_spp_enabled(v->domain) &&
+         (rc = vmx_vcpu_enable_spp(v)) != 0 )
+    {
+        vmx_destroy_vmcs(v);
+        return rc;
+    }
+
     vmx_install_vlapic_mapping(v);
 
     /* %eax == 1 signals full real-mode support to the guest loader. */
@@ -1417,6 +1483,24 @@ static void vmx_set_rdtsc_exiting(struct vcpu *v, bool_t enable)
     vmx_vmcs_exit(v);
 }
 
+static void vmx_set_msr_passthrough(struct vcpu *v, uint32_t msr,
+                                    unsigned int access)
+{
+    /* Without the VMCS controls, BNDCFGS isn't context switched for us. */
+    if ( msr == MSR_IA32_BNDCFGS && !cpu_has_vmx_mpx )
+        access = 0;
+
+    if ( access & HVM_MSR_PT_R )
+        vmx_clear_msr_intercept(v, msr, VMX_MSR_R);
+    else
+        vmx_set_msr_intercept(v, msr, VMX_MSR_R);
+
+    if ( access & HVM_MSR_PT_W )
+        vmx_clear_msr_intercept(v, msr, VMX_MSR_W);
+    else
+        vmx_set_msr_intercept(v, msr, VMX_MSR_W);
+}
+
 static void vmx_set_descriptor_access_exiting(struct vcpu *v, bool enable)
 {
     if ( enable )
@@ -2343,6 +2427,7 @@ static struct hvm_function_table __initdata vmx_function_table = {
     .handle_cd            = vmx_handle_cd,
     .set_info_guest       = vmx_set_info_guest,
     .set_rdtsc_exiting    = vmx_set_rdtsc_exiting,
+    .set_msr_passthrough  = vmx_set_msr_passthrough,
     .nhvm_vcpu_initialise = nvmx_vcpu_initialise,
     .nhvm_vcpu_destroy    = nvmx_vcpu_destroy,
     .nhvm_vcpu_reset      = nvmx_vcpu_reset,
@@ -2383,21 +2468,23 @@ static void pi_wakeup_interrupt(struct cpu_user_regs *regs)
 
     ack_APIC_irq();
     this_cpu(irq_count)++;
+    perfc_incr(pi_wakeup);
 
     spin_lock(lock);
 
     /*
-     * XXX: The length of the list depends on how many vCPU is current
-     * blocked on this specific pCPU. This may hurt the interrupt latency
-     * if the list grows to too many entries.
+     * The length of the list depends on how many vCPUs are currently
+     * blocked on this specific pCPU; vmx_vcpu_block() keeps it bounded
+     * by spreading blocked vCPUs over other pCPUs.
      */
     list_for_each_entry_safe(vmx, tmp, blocked_vcpus, pi_blocking.list)
     {
+        perfc_incr(pi_wakeup_scanned);
         if ( pi_test_on(&vmx->pi_desc) )
         {
-            list_del(&vmx->pi_blocking.list);
             ASSERT(vmx->pi_blocking.lock == lock);
-            vmx->pi_blocking.lock = NULL;
+            vmx_pi_list_del(vmx);
+            perfc_incr(pi_wakeup_woken);
             vcpu_unblock(container_of(vmx, struct vcpu, arch.hvm_vmx));
         }
     }
@@ -3514,6 +3601,7 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
     unsigned long exit_qualification, exit_reason, idtv_info, intr_info = 0;
     unsigned int vector = 0, mode;
     struct vcpu *v = current;
+    s_time_t start = NOW();
 
     __vmread(GUEST_RIP,    &regs->rip);
     __vmread(GUEST_RSP,    &regs->rsp);
@@ -3903,6 +3991,7 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
     {
         uint64_t msr_content = 0;
 
+        hvm_msr_exit_account(regs->ecx, false);
         switch ( hvm_msr_read_intercept(regs->ecx, &msr_content) )
         {
         case X86EMUL_OKAY:
@@ -3918,6 +4007,7 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
     }
 
     case EXIT_REASON_MSR_WRITE:
+        hvm_msr_exit_account(regs->ecx, true);
         switch ( hvm_msr_write_intercept(regs->ecx, msr_fold(regs), 1) )
         {
         case X86EMUL_OKAY:
@@ -4084,7 +4174,7 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
 
     case EXIT_REASON_PAUSE_INSTRUCTION:
         perfc_incr(pauseloop_exits);
-        do_sched_op(SCHEDOP_yield, guest_handle_from_ptr(NULL, void));
+        vcpu_yield_directed();
         break;
 
     case EXIT_REASON_XSETBV:
@@ -4100,6 +4190,18 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
         vmx_vcpu_flush_pml_buffer(v);
         break;
 
+    case EXIT_REASON_SPP:
+        /*
+         * The sub-page permission table is filled in before any EPT entry
+         * gets its SPP bit set, so neither a miss nor a misconfiguration
+         * should happen.
+         */
+        __vmread(EXIT_QUALIFICATION, &exit_qualification);
+        gprintk(XENLOG_ERR, "SPP %s, qualification %#lx\n",
+                exit_qualification & (1u << 11) ? "misconfiguration" : "miss",
+                exit_qualification);
+        goto exit_and_crash;
+
     case EXIT_REASON_XSAVES:
         vmx_handle_xsaves();
         break;
@@ -4163,6 +4265,8 @@ out:
         else
             domain_crash(v->domain);
     }
+
+    hvm_vmexit_account((uint16_t)exit_reason, start);
 }
 
 static void lbr_tsx_fixup(void)
@@ -177,6 +177,8 @@ void nvmx_domain_relinquish_resources(struct domain *d)
 
 int nvmx_vcpu_reset(struct vcpu *v)
 {
+    vcpu_2_nvmx(v).gstate_synced = false;
+
     return 0;
 }
 
@@ -813,6 +815,7 @@ static void nvmx_purge_vvmcs(struct vcpu *v)
     nvcpu->nv_vvmcx = NULL;
     nvcpu->nv_vvmcxaddr = INVALID_PADDR;
     v->arch.hvm_vmx.vmcs_shadow_maddr = 0;
+    nvmx->gstate_synced = false;
     for (i=0; i<2; i++) {
         if ( nvmx->iobitmap[i] ) {
             hvm_unmap_guest_frame(nvmx->iobitmap[i], 1);
@@ -951,6 +954,25 @@ static void vvmcs_to_shadow(const struct vcpu *v, unsigned int field)
     __vmwrite(field, get_vvmcs(v, field));
 }
 
+/* Record an emulated VMWRITE to one of vmcs_gstate_field[]. */
+static void nvmx_gstate_written(struct vcpu *v, u32 encoding)
+{
+    struct nestedvmx *nvmx = &vcpu_2_nvmx(v);
+    unsigned int i;
+
+    if ( !nvmx->gstate_synced )
+        return;
+
+    /* Writes to the high half of 64-bit fields dirty the whole field. */
+    encoding &= ~VMCS_HIGH(0);
+    for ( i = 0; i < ARRAY_SIZE(vmcs_gstate_field); i++ )
+        if ( vmcs_gstate_field[i] == encoding )
+        {
+            nvmx->gstate_dirty |= 1ULL << i;
+            break;
+        }
+}
+
 static void vvmcs_to_shadow_bulk(struct vcpu *v, unsigned int n,
                                  const u16 *field)
 {
@@ -1045,6 +1067,7 @@ static void load_shadow_control(struct vcpu *v)
 static void load_shadow_guest_state(struct vcpu *v)
 {
     struct nestedvcpu *nvcpu = &vcpu_nestedhvm(v);
+    struct nestedvmx *nvmx = &vcpu_2_nvmx(v);
     u32 control;
     u64 cr_gh_mask, cr_read_shadow;
     int rc;
@@ -1055,9 +1078,21 @@ static void load_shadow_guest_state(struct vcpu *v)
         VM_ENTRY_INSTRUCTION_LEN,
     };
 
-    /* vvmcs.gstate to shadow vmcs.gstate */
-    vvmcs_to_shadow_bulk(v, ARRAY_SIZE(vmcs_gstate_field),
-                         vmcs_gstate_field);
+    /*
+     * vvmcs.gstate to shadow vmcs.gstate: the shadow VMCS still holds what
+     * was copied back on the last virtual VM exit, unless L1 changed it.
+     */
+    if ( nvmx->gstate_synced )
+    {
+        uint64_t dirty = nvmx->gstate_dirty;
+
+        for ( ; dirty; dirty &= dirty - 1 )
+            vvmcs_to_shadow(v, vmcs_gstate_field[find_first_set_bit(dirty)]);
+        nvmx->gstate_synced = false;
+    }
+    else
+        vvmcs_to_shadow_bulk(v, ARRAY_SIZE(vmcs_gstate_field),
+                             vmcs_gstate_field);
 
     nvcpu->guest_cr[0] = get_vvmcs(v, CR0_READ_SHADOW);
     nvcpu->guest_cr[4] = get_vvmcs(v, CR4_READ_SHADOW);
@@ -1223,9 +1258,14 @@ static void virtual_vmentry(struct cpu_user_regs *regs)
 
 static void sync_vvmcs_guest_state(struct vcpu *v, struct cpu_user_regs *regs)
 {
+    struct nestedvmx *nvmx = &vcpu_2_nvmx(v);
+
     /* copy shadow vmcs.gstate back to vvmcs.gstate */
     shadow_to_vvmcs_bulk(v, ARRAY_SIZE(vmcs_gstate_field),
                          vmcs_gstate_field);
+    BUILD_BUG_ON(ARRAY_SIZE(vmcs_gstate_field) > 64);
+    nvmx->gstate_synced = !cpu_has_vmx_vmcs_shadowing;
+    nvmx->gstate_dirty = 0;
     /* RIP, RSP are in user regs */
     set_vvmcs(v, GUEST_RIP, regs->rip);
     set_vvmcs(v, GUEST_RSP, regs->rsp);
@@ -1901,6 +1941,8 @@ int nvmx_handle_vmwrite(struct cpu_user_regs *regs)
         return X86EMUL_OKAY;
     }
 
+    nvmx_gstate_written(v, vmcs_encoding);
+
     switch ( vmcs_encoding & ~VMCS_HIGH(0) )
     {
     case IO_BITMAP_A:
@@ -26,6 +26,14 @@
 #define mode_is(d, name) \
     ((d)->arch.hvm_domain.params[HVM_PARAM_TIMER_MODE] == HVMPTM_##name)
 
+/*
+ * Periodic timer deadlines are rounded up to a multiple of this, so that
+ * the ticks of all the time sources of all the vCPUs on a pCPU which fall
+ * into the same window expire together, taking a single wakeup.
+ */
+static unsigned int __read_mostly vpt_slop = 50000; /* 50 us */
+integer_param("vpt_slop", vpt_slop);
+
 void hvm_init_guest_time(struct domain *d)
 {
     struct pl_time *pl = d->arch.hvm_domain.pl_time;
@@ -166,12 +174,30 @@ static void pt_process_missed_ticks(struct periodic_time *pt)
 
     missed_ticks = missed_ticks / (s_time_t) pt->period + 1;
     if ( mode_is(pt->vcpu->domain, no_missed_ticks_pending) )
-        pt->do_not_freeze = !pt->pending_intr_nr;
+    {
+        /*
+         * Only the one tick is delivered, however many were missed.  Its
+         * timer was stopped while the vCPU was descheduled, so account it
+         * here rather than having the timer fire for a vCPU not running.
+         */
+        if ( !pt->pending_intr_nr )
+            pt->pending_intr_nr = 1;
+    }
     else
         pt->pending_intr_nr += missed_ticks;
     pt->scheduled += missed_ticks * pt->period;
 }
 
+static void pt_set_timer(struct periodic_time *pt)
+{
+    s_time_t expires = pt->scheduled;
+
+    if ( vpt_slop && !pt->one_shot )
+        expires = align_timer(expires, vpt_slop);
+
+    set_timer(&pt->timer, expires);
+}
+
 static void pt_freeze_time(struct vcpu *v)
 {
     if ( !mode_is(v->domain, delay_for_missed_ticks) )
@@ -203,8 +229,7 @@ void pt_save_timer(struct vcpu *v)
     spin_lock(&v->arch.hvm_vcpu.tm_lock);
 
     list_for_each_entry ( pt, head, list )
-        if ( !pt->do_not_freeze )
-            stop_timer(&pt->timer);
+        stop_timer(&pt->timer);
 
     pt_freeze_time(v);
 
@@ -223,7 +248,7 @@ void pt_restore_timer(struct vcpu *v)
         if ( pt->pending_intr_nr == 0 )
         {
             pt_process_missed_ticks(pt);
-            set_timer(&pt->timer, pt->scheduled);
+            pt_set_timer(pt);
         }
     }
 
@@ -240,7 +265,6 @@ static void pt_timer_fn(void *data)
 
     pt->pending_intr_nr++;
     pt->scheduled += pt->period;
-    pt->do_not_freeze = 0;
 
     vcpu_kick(pt->vcpu);
 
@@ -375,7 +399,7 @@ void pt_intr_post(struct vcpu *v, struct hvm_intack intack)
         pt->last_plt_gtime = hvm_get_guest_time(v);
         pt_process_missed_ticks(pt);
         pt->pending_intr_nr = 0; /* 'collapse' all missed ticks */
-        set_timer(&pt->timer, pt->scheduled);
+        pt_set_timer(pt);
     }
     else
     {
@@ -384,7 +408,7 @@ void pt_intr_post(struct vcpu *v, struct hvm_intack intack)
         {
             pt_process_missed_ticks(pt);
             if ( pt->pending_intr_nr == 0 )
-                set_timer(&pt->timer, pt->scheduled);
+                pt_set_timer(pt);
         }
     }
 
@@ -425,7 +449,6 @@ void create_periodic_time(
     spin_lock(&v->arch.hvm_vcpu.tm_lock);
 
     pt->pending_intr_nr = 0;
-    pt->do_not_freeze = 0;
     pt->irq_issued = 0;
 
     /* Periodic timer must be at least 0.1ms. */
@@ -469,7 +492,7 @@ void create_periodic_time(
     list_add(&pt->list, &v->arch.hvm_vcpu.tm_list);
 
     init_timer(&pt->timer, pt_timer_fn, pt, v->processor);
-    set_timer(&pt->timer, pt->scheduled);
+    pt_set_timer(pt);
 
     spin_unlock(&v->arch.hvm_vcpu.tm_lock);
 }
@@ -15,6 +15,14 @@
 #include <asm/i387.h>
 #include <asm/xstate.h>
 #include <asm/asm_defns.h>
+#include <xen/perfc.h>
+
+/*
+ * A vcpu which used the FPU in this many consecutive timeslices is assumed
+ * to use it in the next as well: the #NM it would take (a VM exit, for HVM
+ * guests) is avoided by restoring its state at context switch instead.
+ */
+#define FPU_PRELOAD_THRESHOLD 5
 
 /*******************************/
 /*     FPU Restore Functions   */
@@ -204,14 +212,35 @@ static inline void fpu_fxsave(struct vcpu *v)
 /*******************************/
 /*       VCPU FPU Functions    */
 /*******************************/
+static bool fpu_preload(const struct vcpu *v)
+{
+    unsigned long cr0 = is_hvm_vcpu(v) ? v->arch.hvm_vcpu.guest_cr[0]
+                                       : v->arch.pv_vcpu.ctrlreg[0];
+
+    /* A guest with CR0.TS set wants to see the #NM itself. */
+    return v->fpu_initialised && !(cr0 & X86_CR0_TS) &&
+           v->arch.fpu_counter > FPU_PRELOAD_THRESHOLD;
+}
+
 /* Restore FPU state whenever VCPU is schduled in. */
 void vcpu_restore_fpu_eager(struct vcpu *v)
 {
+    bool preload;
+
     ASSERT(!is_idle_vcpu(v));
-    
+
+    preload = fpu_preload(v);
+
     /* Restore nonlazy extended state (i.e. parts not tracked by CR0.TS). */
     if ( !v->arch.nonlazy_xstate_used )
+    {
+        if ( preload )
+        {
+            vcpu_restore_fpu_lazy(v);
+            perfc_incr(fpu_preload);
+        }
         return;
+    }
 
     /* Avoid recursion */
     clts();
@@ -221,11 +250,16 @@ void vcpu_restore_fpu_eager(struct vcpu *v)
      * above) we also need to restore full state, to prevent subsequently
      * saving state belonging to another vCPU.
      */
-    if ( xstate_all(v) )
+    if ( preload || xstate_all(v) )
     {
         fpu_xrstor(v, XSTATE_ALL);
         v->fpu_initialised = 1;
         v->fpu_dirtied = 1;
+        if ( preload )
+        {
+            v->arch.fpu_counter++;
+            perfc_incr(fpu_preload);
+        }
     }
     else
     {
@@ -254,6 +288,8 @@ void vcpu_restore_fpu_lazy(struct vcpu *v)
 
     v->fpu_initialised = 1;
     v->fpu_dirtied = 1;
+    v->arch.fpu_counter++;
+    perfc_incr(fpu_restore);
 }
 
 /* 
@@ -262,6 +298,10 @@ void vcpu_restore_fpu_lazy(struct vcpu *v)
  */
 static bool _vcpu_save_fpu(struct vcpu *v)
 {
+    /* The FPU wasn't used during this timeslice. */
+    if ( !v->fpu_dirtied )
+        v->arch.fpu_counter = 0;
+
     if ( !v->fpu_dirtied && !v->arch.nonlazy_xstate_used )
         return false;
 
@@ -276,6 +316,7 @@ static bool _vcpu_save_fpu(struct vcpu *v)
         fpu_fxsave(v);
 
     v->fpu_dirtied = 0;
+    perfc_incr(fpu_save);
 
     return true;
 }
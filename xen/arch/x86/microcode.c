@@ -30,6 +30,7 @@
 #include <xen/smp.h>
 #include <xen/softirq.h>
 #include <xen/spinlock.h>
+#include <xen/stop_machine.h>
 #include <xen/tasklet.h>
 #include <xen/guest_access.h>
 #include <xen/earlycpio.h>
@@ -39,6 +40,8 @@
 #include <asm/setup.h>
 #include <asm/microcode.h>
 
+#include <public/platform.h>
+
 static module_t __initdata ucode_mod;
 static void *(*__initdata ucode_mod_map)(const module_t *);
 static signed int __initdata ucode_mod_idx;
@@ -266,20 +269,27 @@ int microcode_resume_cpu(unsigned int cpu)
     return err;
 }
 
-static int microcode_update_cpu(const void *buf, size_t size)
+static int __microcode_update_cpu(const void *buf, size_t size)
 {
     int err;
     unsigned int cpu = smp_processor_id();
     struct ucode_cpu_info *uci = &per_cpu(ucode_cpu_info, cpu);
 
-    spin_lock(&microcode_mutex);
-
     err = microcode_ops->collect_cpu_info(cpu, &uci->cpu_sig);
     if ( likely(!err) )
         err = microcode_ops->cpu_request_microcode(cpu, buf, size);
     else
         __microcode_fini_cpu(cpu);
 
+    return err;
+}
+
+static int microcode_update_cpu(const void *buf, size_t size)
+{
+    int err;
+
+    spin_lock(&microcode_mutex);
+    err = __microcode_update_cpu(buf, size);
     spin_unlock(&microcode_mutex);
 
     return err;
@@ -344,6 +354,136 @@ int microcode_update(XEN_GUEST_HANDLE_PARAM(const_void) buf, unsigned long len)
     return continue_hypercall_on_cpu(info->cpu, do_microcode_update, info);
 }
 
+/*
+ * Upper bound on how long a thread waits for its core's loader during a
+ * parallel update, and hence on how long a stuck load can hold the machine.
+ */
+#define MICROCODE_SIBLING_TIMEOUT MILLISECS(1000)
+
+struct microcode_par_info {
+    const void *buffer;
+    size_t buffer_size;
+    cpumask_t loaded;                    /* Loaders which have finished. */
+    struct xenpf_ucode_cpu_stat *stats;  /* nr_cpu_ids entries. */
+};
+
+/* Runs on every online CPU, with interrupts disabled. */
+static int do_microcode_update_parallel(void *data)
+{
+    struct microcode_par_info *info = data;
+    unsigned int cpu = smp_processor_id();
+    unsigned int loader = cpumask_first(per_cpu(cpu_sibling_mask, cpu));
+    struct ucode_cpu_info *uci = &per_cpu(ucode_cpu_info, cpu);
+    struct xenpf_ucode_cpu_stat *st = &info->stats[cpu];
+    s_time_t start = NOW();
+    int rc;
+
+    if ( loader >= nr_cpu_ids )
+        loader = cpu;
+
+    if ( cpu == loader )
+    {
+        /*
+         * Hyperthreads share their core's microcode: only the first thread
+         * loads, while every core loads at the same time.
+         */
+        rc = __microcode_update_cpu(info->buffer, info->buffer_size);
+        st->flags |= XENPF_UCODE_CPU_LOADER;
+        cpumask_set_cpu(cpu, &info->loaded);
+    }
+    else
+    {
+        rc = 0;
+        while ( !cpumask_test_cpu(loader, &info->loaded) )
+        {
+            if ( NOW() - start > MICROCODE_SIBLING_TIMEOUT )
+            {
+                rc = -ETIMEDOUT;
+                break;
+            }
+            cpu_relax();
+        }
+
+        /* Pick up the revision the loader installed. */
+        if ( !rc )
+            rc = microcode_ops->collect_cpu_info(cpu, &uci->cpu_sig);
+    }
+
+    st->flags |= XENPF_UCODE_CPU_ONLINE;
+    st->rc = rc;
+    st->rev = uci->cpu_sig.rev;
+    st->ns = NOW() - start;
+
+    return rc;
+}
+
+int microcode_update_parallel(XEN_GUEST_HANDLE_PARAM(const_void) buf,
+                              unsigned long len,
+                              struct xenpf_ucode_cpu_stat *stats,
+                              unsigned int nr_stats, uint64_t *total_ns)
+{
+    struct microcode_par_info *info;
+    unsigned int cpu, loaders = 0;
+    s_time_t start;
+    void *buffer;
+    int ret;
+
+    if ( len != (uint32_t)len )
+        return -E2BIG;
+
+    if ( microcode_ops == NULL )
+        return -EINVAL;
+
+    info = xzalloc(struct microcode_par_info);
+    buffer = xmalloc_bytes(len);
+    if ( info )
+        info->stats = xzalloc_array(struct xenpf_ucode_cpu_stat, nr_cpu_ids);
+    if ( !info || !buffer || !info->stats )
+    {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = copy_from_guest(buffer, buf, len);
+    if ( ret != 0 )
+        goto out;
+
+    info->buffer = buffer;
+    info->buffer_size = len;
+
+    if ( microcode_ops->start_update )
+    {
+        ret = microcode_ops->start_update();
+        if ( ret != 0 )
+            goto out;
+    }
+
+    /* Keeps microcode_resume_cpu() and CPU teardown out of the way. */
+    spin_lock(&microcode_mutex);
+    start = NOW();
+    ret = stop_machine_run(do_microcode_update_parallel, info, NR_CPUS);
+    *total_ns = NOW() - start;
+    spin_unlock(&microcode_mutex);
+
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        if ( info->stats[cpu].flags & XENPF_UCODE_CPU_LOADER )
+            loaders++;
+
+    printk(XENLOG_INFO "microcode: parallel update on %u cores took %"
+           PRIu64"us: %d\n", loaders, *total_ns / 1000, ret);
+
+    memcpy(stats, info->stats,
+           min(nr_stats, nr_cpu_ids) * sizeof(*stats));
+
+ out:
+    if ( info )
+        xfree(info->stats);
+    xfree(info);
+    xfree(buffer);
+
+    return ret;
+}
+
 static int __init microcode_init(void)
 {
     /*
@@ -3035,7 +3035,8 @@ long do_mmuext_op(
 
     for ( i = 0; i < count; i++ )
     {
-        if ( curr->arch.old_guest_table || (i && hypercall_preempt_check()) )
+        if ( curr->arch.old_guest_table ||
+             (i && hypercall_preempt_check_inplace()) )
         {
             rc = -ERESTART;
             break;
@@ -3511,8 +3512,8 @@ long do_mmu_update(
 {
     struct mmu_update req;
     void *va = NULL;
-    unsigned long gpfn, gmfn, mfn;
-    struct page_info *page;
+    unsigned long gpfn, gmfn, mfn, pt_gmfn = 0;
+    struct page_info *page, *pt_page = NULL;
     unsigned int cmd, i = 0, done = 0, pt_dom;
     struct vcpu *curr = current, *v = curr;
     struct domain *d = v->domain, *pt_owner = d, *pg_owner;
@@ -3575,7 +3576,8 @@ long do_mmu_update(
 
     for ( i = 0; i < count; i++ )
     {
-        if ( curr->arch.old_guest_table || (i && hypercall_preempt_check()) )
+        if ( curr->arch.old_guest_table ||
+             (i && hypercall_preempt_check_inplace()) )
         {
             rc = -ERESTART;
             break;
@@ -3623,21 +3625,40 @@ long do_mmu_update(
 
             req.ptr -= cmd;
             gmfn = req.ptr >> PAGE_SHIFT;
-            page = get_page_from_gfn(pt_owner, gmfn, &p2mt, P2M_ALLOC);
 
-            if ( p2m_is_paged(p2mt) )
+            /*
+             * Batches tend to update many entries of one page table in a
+             * row: keep the reference to it until a different one comes.
+             */
+            if ( pt_page && gmfn == pt_gmfn )
+                page = pt_page;
+            else
             {
-                ASSERT(!page);
-                p2m_mem_paging_populate(pt_owner, gmfn);
-                rc = -ENOENT;
-                break;
-            }
+                if ( pt_page )
+                {
+                    put_page(pt_page);
+                    pt_page = NULL;
+                }
 
-            if ( unlikely(!page) )
-            {
-                gdprintk(XENLOG_WARNING,
-                         "Could not get page for normal update\n");
-                break;
+                page = get_page_from_gfn(pt_owner, gmfn, &p2mt, P2M_ALLOC);
+
+                if ( p2m_is_paged(p2mt) )
+                {
+                    ASSERT(!page);
+                    p2m_mem_paging_populate(pt_owner, gmfn);
+                    rc = -ENOENT;
+                    break;
+                }
+
+                if ( unlikely(!page) )
+                {
+                    gdprintk(XENLOG_WARNING,
+                             "Could not get page for normal update\n");
+                    break;
+                }
+
+                pt_page = page;
+                pt_gmfn = gmfn;
             }
 
             mfn = mfn_x(page_to_mfn(page));
@@ -3689,8 +3710,6 @@ long do_mmu_update(
                     rc = 0;
                 put_page_type(page);
             }
-
-            put_page(page);
         }
         break;
 
@@ -3745,6 +3764,9 @@ long do_mmu_update(
         guest_handle_add_offset(ureqs, 1);
     }
 
+    if ( pt_page )
+        put_page(pt_page);
+
     if ( rc == -ERESTART )
     {
         ASSERT(i < count);
@@ -4593,6 +4615,14 @@ int map_pages_to_xen(
     l2_pgentry_t *pl2e, ol2e;
     l1_pgentry_t *pl1e, ol1e;
     unsigned int  i;
+    /*
+     * TLB flushes for replaced 4k mappings are gathered over a contiguous
+     * range, so that e.g. tearing down a multi-page vmap() area costs one
+     * flush (IPI) rather than one per page.
+     */
+    unsigned long flush_va = 0, flush_nr = 0;
+    unsigned int flush_pending = 0;
+    int rc = 0;
 
 #define flush_flags(oldf) do {                 \
     unsigned int o_ = (oldf);                  \
@@ -4613,7 +4643,10 @@ int map_pages_to_xen(
         l3_pgentry_t ol3e, *pl3e = virt_to_xen_l3e(virt);
 
         if ( !pl3e )
-            return -ENOMEM;
+        {
+            rc = -ENOMEM;
+            goto out;
+        }
         ol3e = *pl3e;
 
         if ( cpu_has_page1gb &&
@@ -4699,7 +4732,10 @@ int map_pages_to_xen(
 
             pl2e = alloc_xen_pagetable();
             if ( pl2e == NULL )
-                return -ENOMEM;
+            {
+                rc = -ENOMEM;
+                goto out;
+            }
 
             for ( i = 0; i < L2_PAGETABLE_ENTRIES; i++ )
                 l2e_write(pl2e + i,
@@ -4728,7 +4764,10 @@ int map_pages_to_xen(
 
         pl2e = virt_to_xen_l2e(virt);
         if ( !pl2e )
-            return -ENOMEM;
+        {
+            rc = -ENOMEM;
+            goto out;
+        }
 
         if ( ((((virt >> PAGE_SHIFT) | mfn) &
                ((1u << PAGETABLE_ORDER) - 1)) == 0) &&
@@ -4770,7 +4809,10 @@ int map_pages_to_xen(
             {
                 pl1e = virt_to_xen_l1e(virt);
                 if ( pl1e == NULL )
-                    return -ENOMEM;
+                {
+                    rc = -ENOMEM;
+                    goto out;
+                }
             }
             else if ( l2e_get_flags(*pl2e) & _PAGE_PSE )
             {
@@ -4796,7 +4838,10 @@ int map_pages_to_xen(
 
                 pl1e = alloc_xen_pagetable();
                 if ( pl1e == NULL )
-                    return -ENOMEM;
+                {
+                    rc = -ENOMEM;
+                    goto out;
+                }
 
                 for ( i = 0; i < L1_PAGETABLE_ENTRIES; i++ )
                     l1e_write(&pl1e[i],
@@ -4827,10 +4872,29 @@ int map_pages_to_xen(
             l1e_write_atomic(pl1e, l1e_from_pfn(mfn, flags));
             if ( (l1e_get_flags(ol1e) & _PAGE_PRESENT) )
             {
-                unsigned int flush_flags = FLUSH_TLB | FLUSH_ORDER(0);
+                unsigned int flush_flags = FLUSH_TLB;
 
                 flush_flags(l1e_get_flags(ol1e));
-                flush_area(virt, flush_flags);
+                if ( flush_nr &&
+                     ((flush_flags & FLUSH_CACHE) ||
+                      virt != flush_va + (flush_nr << PAGE_SHIFT)) )
+                {
+                    flush_area(flush_va, flush_pending |
+                               FLUSH_ORDER(get_order_from_pages(flush_nr)));
+                    flush_nr = 0;
+                }
+                if ( flush_flags & FLUSH_CACHE )
+                    flush_area(virt, flush_flags | FLUSH_ORDER(0));
+                else
+                {
+                    if ( !flush_nr )
+                    {
+                        flush_va = virt;
+                        flush_pending = 0;
+                    }
+                    flush_pending |= flush_flags;
+                    flush_nr++;
+                }
             }
 
             virt    += 1UL << L1_PAGETABLE_SHIFT;
@@ -4907,7 +4971,12 @@ int map_pages_to_xen(
 
 #undef flush_flags
 
-    return 0;
+ out:
+    if ( flush_nr )
+        flush_area(flush_va, flush_pending |
+                   FLUSH_ORDER(get_order_from_pages(flush_nr)));
+
+    return rc;
 }
 
 int populate_pt_range(unsigned long virt, unsigned long mfn,
@@ -5112,7 +5181,8 @@ int modify_xen_mappings(unsigned long s, unsigned long e, unsigned int nf)
         }
     }
 
-    flush_area(NULL, FLUSH_TLB_GLOBAL);
+    /* Small ranges (e.g. most vunmap()s) can avoid a full flush. */
+    flush_area(s, FLUSH_TLB_GLOBAL | FLUSH_ORDER(get_order_from_bytes(e - s)));
 
 #undef FLAGS_MASK
     return 0;
@@ -5462,6 +5532,10 @@ void paging_invlpg(struct vcpu *v, unsigned long va)
     if ( !is_canonical_address(va) )
         return;
 
+    /* The shadow code may skip the flush, but the fetch cache must not. */
+    if ( is_hvm_vcpu(v) )
+        hvm_vcpu_io_flush_insn_fetch(&v->arch.hvm_vcpu.hvm_io);
+
     if ( paging_mode_enabled(v->domain) &&
          !paging_get_hostmode(v)->invlpg(v, va) )
         return;
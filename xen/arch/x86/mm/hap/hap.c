@@ -57,11 +57,44 @@
  * Create the domain's dv_dirty_vram struct on demand.
  * Create a dirty vram range on demand when some [begin_pfn:begin_pfn+nr] is
  * first encountered.
- * Collect the guest_dirty bitmask, a bit mask of the dirty vram pages, by
- * calling paging_log_dirty_range(), which interrogates each vram
- * page's p2m type looking for pages that have been made writable.
+ * Collect the guest_dirty bitmask, a bit mask of the dirty vram pages.
+ * paging_mark_pfn_dirty() accumulates it in dirty_vram->dirty_bitmap as the
+ * guest's writes fault (or are logged by PML), so that a refresh only costs
+ * in proportion to the pages written: only those need switching back to
+ * log dirty mode, rather than the p2m type of every vram page being
+ * interrogated.
  */
 
+/* Switch the pages written since the last call back to log dirty mode. */
+static void hap_rearm_dirty_vram(struct domain *d, unsigned long begin_pfn,
+                                 unsigned long nr, const uint8_t *bitmap)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long i;
+    bool rearmed = false;
+
+    p2m_lock(p2m);
+
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( !bitmap[i >> 3] )
+        {
+            i |= 7;
+            continue;
+        }
+        /* Pages written by Xen itself never left log dirty mode. */
+        if ( (bitmap[i >> 3] & (1 << (i & 7))) &&
+             !p2m_change_type_one(d, begin_pfn + i, p2m_ram_rw,
+                                  p2m_ram_logdirty) )
+            rearmed = true;
+    }
+
+    p2m_unlock(p2m);
+
+    if ( rearmed )
+        flush_tlb_mask(d->domain_dirty_cpumask);
+}
+
 int hap_track_dirty_vram(struct domain *d,
                          unsigned long begin_pfn,
                          unsigned long nr,
@@ -74,6 +107,8 @@ int hap_track_dirty_vram(struct domain *d,
     if ( nr )
     {
         int size = (nr + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+        struct p2m_domain *p2m = p2m_get_hostp2m(d);
+        uint8_t *fresh, *logged;
 
         if ( !paging_mode_log_dirty(d) )
         {
@@ -84,8 +119,25 @@ int hap_track_dirty_vram(struct domain *d,
 
         rc = -ENOMEM;
         dirty_bitmap = vzalloc(size);
-        if ( !dirty_bitmap )
+        /* Replaces dirty_vram->dirty_bitmap, to log the next interval. */
+        fresh = vzalloc(size);
+        if ( !dirty_bitmap || !fresh )
+        {
+            vfree(fresh);
             goto out;
+        }
+
+        /*
+         * Flush dirty GFNs potentially cached by hardware into the bitmap.
+         * This needs the domain paused; without PML there is nothing to
+         * flush, and the guest can keep running.
+         */
+        if ( p2m->flush_hardware_cached_dirty )
+        {
+            domain_pause(d);
+            p2m_flush_hardware_cached_dirty(d);
+            domain_unpause(d);
+        }
 
         paging_lock(d);
 
@@ -96,12 +148,17 @@ int hap_track_dirty_vram(struct domain *d,
             if ( (dirty_vram = xzalloc(struct sh_dirty_vram)) == NULL )
             {
                 paging_unlock(d);
+                vfree(fresh);
                 goto out;
             }
 
             d->arch.hvm_domain.dirty_vram = dirty_vram;
         }
 
+        /* Collect what was logged since the last call, and start afresh. */
+        logged = dirty_vram->dirty_bitmap;
+        dirty_vram->dirty_bitmap = fresh;
+
         if ( begin_pfn != dirty_vram->begin_pfn ||
              begin_pfn + nr != dirty_vram->end_pfn )
         {
@@ -132,23 +189,23 @@ int hap_track_dirty_vram(struct domain *d,
         {
             paging_unlock(d);
 
-            domain_pause(d);
-
-            /* Flush dirty GFNs potentially cached by hardware. */
-            p2m_flush_hardware_cached_dirty(d);
-
-            /* get the bitmap */
-            paging_log_dirty_range(d, begin_pfn, nr, dirty_bitmap);
-
-            domain_unpause(d);
+            if ( logged )
+            {
+                hap_rearm_dirty_vram(d, begin_pfn, nr, logged);
+                memcpy(dirty_bitmap, logged, size);
+            }
         }
 
+        vfree(logged);
+
         rc = -EFAULT;
         if ( copy_to_guest(guest_dirty_bitmap, dirty_bitmap, size) == 0 )
             rc = 0;
     }
     else
     {
+        uint8_t *logged = NULL;
+
         paging_lock(d);
 
         dirty_vram = d->arch.hvm_domain.dirty_vram;
@@ -160,11 +217,13 @@ int hap_track_dirty_vram(struct domain *d,
              */
             begin_pfn = dirty_vram->begin_pfn;
             nr = dirty_vram->end_pfn - dirty_vram->begin_pfn;
+            logged = dirty_vram->dirty_bitmap;
             xfree(dirty_vram);
             d->arch.hvm_domain.dirty_vram = NULL;
         }
 
         paging_unlock(d);
+        vfree(logged);
         if ( nr )
             p2m_change_type_range(d, begin_pfn, begin_pfn + nr,
                                   p2m_ram_logdirty, p2m_ram_rw);
@@ -584,8 +643,12 @@ void hap_teardown(struct domain *d, bool *preempted)
 
     d->arch.paging.mode &= ~PG_log_dirty;
 
-    xfree(d->arch.hvm_domain.dirty_vram);
-    d->arch.hvm_domain.dirty_vram = NULL;
+    if ( d->arch.hvm_domain.dirty_vram )
+    {
+        vfree(d->arch.hvm_domain.dirty_vram->dirty_bitmap);
+        xfree(d->arch.hvm_domain.dirty_vram);
+        d->arch.hvm_domain.dirty_vram = NULL;
+    }
 
 out:
     paging_unlock(d);
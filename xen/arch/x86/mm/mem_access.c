@@ -28,6 +28,7 @@
 #include <public/vm_event.h>
 #include <asm/p2m.h>
 #include <asm/altp2m.h>
+#include <asm/monitor.h>
 #include <asm/vm_event.h>
 
 #include "mm-locks.h"
@@ -209,6 +210,33 @@ bool p2m_mem_access_check(paddr_t gpa, unsigned long gla,
     }
 
     *req_ptr = NULL;
+
+    /*
+     * Emulate violations the monitor has set up a filter for right away,
+     * rather than pausing the vCPU until a reply comes through the ring.
+     * With p2m_access_n2rwx the rights have been promoted above already.
+     */
+    if ( p2ma != p2m_access_n2rwx && v->arch.vm_event )
+    {
+        unsigned int access = (npfec.read_access ? MEM_ACCESS_R : 0) |
+                              (npfec.write_access ? MEM_ACCESS_W : 0) |
+                              (npfec.insn_fetch ? MEM_ACCESS_X : 0);
+
+        switch ( monitor_access_filter(d, gfn_x(gfn), access) )
+        {
+        case XEN_DOMCTL_MONITOR_FILTER_EMULATE_NOWRITE:
+            v->arch.vm_event->emulate_flags = VM_EVENT_FLAG_EMULATE |
+                                              VM_EVENT_FLAG_EMULATE_NOWRITE;
+            perfc_incr(mem_access_filtered);
+            return true;
+
+        case XEN_DOMCTL_MONITOR_FILTER_EMULATE:
+            v->arch.vm_event->emulate_flags = VM_EVENT_FLAG_EMULATE;
+            perfc_incr(mem_access_filtered);
+            return true;
+        }
+    }
+
     req = xzalloc(vm_event_request_t);
     if ( req )
     {
@@ -458,6 +486,17 @@ long p2m_set_mem_access_multi(struct domain *d,
     return rc;
 }
 
+int p2m_set_mem_access_subpage(struct domain *d, gfn_t gfn, uint32_t write)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+    /* altp2m views don't carry sub-page permissions. */
+    if ( !p2m->set_subpage_write || altp2m_active(d) )
+        return -EOPNOTSUPP;
+
+    return p2m->set_subpage_write(p2m, gfn, write);
+}
+
 int p2m_get_mem_access(struct domain *d, gfn_t gfn, xenmem_access_t *access)
 {
     struct p2m_domain *p2m = p2m_get_hostp2m(d);
@@ -63,6 +63,10 @@ int mem_paging_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_paging_op_t) arg)
             copyback = 1;
         break;
 
+    case XENMEM_paging_op_harvest_accessed:
+        rc = p2m_mem_paging_harvest_accessed(d, mpo.gfn, mpo.nr, mpo.buffer);
+        break;
+
     default:
         rc = -ENOSYS;
         break;
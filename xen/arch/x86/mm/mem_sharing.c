@@ -21,6 +21,7 @@
  */
 
 #include <xen/types.h>
+#include <xen/domain.h>
 #include <xen/domain_page.h>
 #include <xen/spinlock.h>
 #include <xen/rwlock.h>
@@ -36,6 +37,8 @@
 #include <asm/altp2m.h>
 #include <asm/atomic.h>
 #include <asm/event.h>
+#include <asm/hvm/irq.h>
+#include <asm/hvm/save.h>
 #include <xsm/xsm.h>
 
 #include "mm-locks.h"
@@ -1293,6 +1296,16 @@ static int range_share(struct domain *d, struct domain *cd,
                 rc = share_pages(d, _gfn(start), sh, cd, _gfn(start), ch);
                 ASSERT(!rc);
             }
+            else if ( range->flags & XENMEM_SHARING_RANGE_POPULATE )
+            {
+                /* Fails unless the client gfn is a hole. */
+                rc = mem_sharing_add_to_physmap(d, start, sh, cd, start);
+                if ( rc == -ENOMEM )
+                    break;
+                /* Otherwise skip the page like an unsharable one. */
+                if ( rc )
+                    rc = -EINVAL;
+            }
         }
 
         /* Check for continuation if it's not the last iteration. */
@@ -1315,6 +1328,352 @@ static int range_share(struct domain *d, struct domain *cd,
     return rc;
 }
 
+/* Entries of a batch op handled per p2m lock hold. */
+#define BATCH_CHUNK 32
+
+/*
+ * Nominate (cd == NULL) or share the pages of a batch, a chunk at a time.
+ * The entries of a chunk are copied in before taking the p2m lock(s) of the
+ * domain(s) once for the whole chunk, nominate_page() and share_pages()
+ * then only nest in them, and the outcomes are copied out after dropping
+ * them.  Returns 1 if preempted, with batch->opaque the next entry.
+ */
+static int batch_op(struct domain *d, struct domain *cd,
+                    struct mem_sharing_op_batch *batch)
+{
+    xen_mem_sharing_batch_entry_t e[BATCH_CHUNK];
+    struct p2m_domain *first, *second = NULL;
+    unsigned int i, n;
+
+    first = p2m_get_hostp2m(d);
+    if ( cd && cd != d )
+    {
+        second = p2m_get_hostp2m(cd);
+        /* In the order get_two_gfns() takes them. */
+        if ( cd->domain_id < d->domain_id )
+        {
+            first = second;
+            second = p2m_get_hostp2m(d);
+        }
+    }
+
+    while ( batch->opaque < batch->nr )
+    {
+        n = min(batch->nr - batch->opaque, (uint32_t)BATCH_CHUNK);
+        if ( copy_from_guest_offset(e, batch->entries, batch->opaque, n) )
+            return -EFAULT;
+
+        p2m_lock(first);
+        if ( second )
+            p2m_lock(second);
+
+        for ( i = 0; i < n; i++ )
+        {
+            shr_handle_t h;
+
+            if ( !cd )
+            {
+                e[i].status = nominate_page(d, _gfn(e[i].source_gfn), 0, &h);
+                e[i].source_handle = h;
+            }
+            else if ( XENMEM_SHARING_OP_FIELD_IS_GREF(e[i].source_gfn) ||
+                      XENMEM_SHARING_OP_FIELD_IS_GREF(e[i].client_gfn) )
+                e[i].status = -EINVAL;
+            else
+                e[i].status = share_pages(d, _gfn(e[i].source_gfn),
+                                          e[i].source_handle,
+                                          cd, _gfn(e[i].client_gfn),
+                                          e[i].client_handle);
+        }
+
+        if ( second )
+            p2m_unlock(second);
+        p2m_unlock(first);
+
+        if ( copy_to_guest_offset(batch->entries, batch->opaque, e, n) )
+            return -EFAULT;
+        batch->opaque += n;
+
+        if ( batch->opaque < batch->nr && hypercall_preempt_check() )
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * VM forking: a fork starts out with the vCPU and platform state of its
+ * paused parent but no memory.  Its holes are filled in on first access by
+ * mem_sharing_fork_page(), sharing the parent's page on reads and copying
+ * it on writes, so no page is touched before the fork needs it.
+ */
+int mem_sharing_fork_page(struct domain *d, gfn_t gfn, bool unsharing)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    struct domain *parent;
+    struct page_info *page;
+    shr_handle_t handle;
+    p2m_type_t p2mt;
+    mfn_t mfn = INVALID_MFN;
+    int rc;
+
+    ASSERT(p2m_locked_by_me(p2m));
+
+    /* Forks of forks: the closest ancestor with the gfn populated has it. */
+    for ( parent = d->arch.hvm_domain.fork_parent; parent;
+          parent = parent->arch.hvm_domain.fork_parent )
+    {
+        if ( parent->is_dying )
+            return -ENOENT;
+
+        mfn = get_gfn_query(parent, gfn_x(gfn), &p2mt);
+        if ( p2mt != p2m_invalid && p2mt != p2m_mmio_dm )
+            break;
+        put_gfn(parent, gfn_x(gfn));
+    }
+
+    if ( !parent )
+        return -ENOENT;
+
+    rc = -ENOENT;
+    if ( !mfn_valid(mfn) || !p2m_is_ram(p2mt) )
+        goto out;
+
+    /* Pages the parent cannot share, e.g. special ones, get copied. */
+    if ( !unsharing && !nominate_page(parent, gfn, 0, &handle) )
+    {
+        rc = mem_sharing_add_to_physmap(parent, gfn_x(gfn), handle,
+                                        d, gfn_x(gfn));
+        if ( !rc )
+            goto out;
+    }
+
+    rc = -ENOMEM;
+    page = alloc_domheap_page(d, 0);
+    if ( !page )
+        goto out;
+
+    copy_domain_page(page_to_mfn(page), mfn);
+
+    rc = p2m_set_entry(p2m, gfn, page_to_mfn(page), PAGE_ORDER_4K,
+                       p2m_ram_rw, p2m->default_access);
+    if ( rc )
+    {
+        if ( test_and_clear_bit(_PGC_allocated, &page->count_info) )
+            put_page(page);
+        goto out;
+    }
+
+    set_gpfn_from_mfn(mfn_x(page_to_mfn(page)), gfn_x(gfn));
+    paging_mark_dirty(d, page_to_mfn(page));
+
+out:
+    put_gfn(parent, gfn_x(gfn));
+    return rc;
+}
+
+void mem_sharing_fork_release(struct domain *d)
+{
+    struct domain *parent = d->arch.hvm_domain.fork_parent;
+
+    if ( !parent )
+        return;
+
+    d->arch.hvm_domain.fork_parent = NULL;
+    domain_unpause(parent);
+    put_domain(parent);
+}
+
+static void fork_params(struct domain *cd, struct domain *d)
+{
+    unsigned int i;
+
+    for ( i = 0; i < HVM_NR_PARAMS; i++ )
+    {
+        switch ( i )
+        {
+        /* Event channels, rings and device models are the fork's own. */
+        case HVM_PARAM_STORE_EVTCHN:
+        case HVM_PARAM_CONSOLE_EVTCHN:
+        case HVM_PARAM_BUFIOREQ_EVTCHN:
+        case HVM_PARAM_DM_DOMAIN:
+        case HVM_PARAM_IOREQ_PFN:
+        case HVM_PARAM_BUFIOREQ_PFN:
+        case HVM_PARAM_PAGING_RING_PFN:
+        case HVM_PARAM_MONITOR_RING_PFN:
+        case HVM_PARAM_SHARING_RING_PFN:
+            break;
+
+        case HVM_PARAM_CALLBACK_IRQ:
+            hvm_set_callback_via(cd, d->arch.hvm_domain.params[i]);
+            /* fallthrough */
+        default:
+            cd->arch.hvm_domain.params[i] = d->arch.hvm_domain.params[i];
+            break;
+        }
+    }
+}
+
+static int fork_shared_info(struct domain *cd, struct domain *d)
+{
+    mfn_t mfn = _mfn(virt_to_mfn(d->shared_info));
+    mfn_t cmfn = _mfn(virt_to_mfn(cd->shared_info));
+    unsigned long gfn = get_gpfn_from_mfn(mfn_x(mfn));
+    unsigned long old_gfn = get_gpfn_from_mfn(mfn_x(cmfn));
+    int rc;
+
+    copy_domain_page(cmfn, mfn);
+    cd->arch.has_32bit_shinfo = d->arch.has_32bit_shinfo;
+
+    /* Map it where the parent has its own, if anywhere. */
+    if ( !VALID_M2P(gfn) || gfn == old_gfn )
+        return 0;
+
+    if ( VALID_M2P(old_gfn) )
+    {
+        rc = guest_physmap_remove_page(cd, _gfn(old_gfn), cmfn,
+                                       PAGE_ORDER_4K);
+        if ( rc )
+            return rc;
+    }
+
+    return guest_physmap_add_page(cd, _gfn(gfn), cmfn, PAGE_ORDER_4K);
+}
+
+static int fork_vcpu_info(struct domain *cd, struct domain *d)
+{
+    struct vcpu *v, *cv;
+    unsigned long gfn;
+    p2m_type_t p2mt;
+    int rc;
+
+    for_each_vcpu ( d, v )
+    {
+        if ( mfn_eq(v->vcpu_info_mfn, INVALID_MFN) )
+            continue;
+
+        gfn = get_gpfn_from_mfn(mfn_x(v->vcpu_info_mfn));
+        if ( !VALID_M2P(gfn) )
+            return -EINVAL;
+
+        /* map_vcpu_info() wants the page private and writable. */
+        get_gfn_unshare(cd, gfn, &p2mt);
+        put_gfn(cd, gfn);
+
+        cv = cd->vcpu[v->vcpu_id];
+        rc = map_vcpu_info(cv, gfn, (unsigned long)v->vcpu_info & ~PAGE_MASK);
+        if ( rc )
+            return rc;
+
+        memcpy(cv->vcpu_info, v->vcpu_info, sizeof(vcpu_info_t));
+    }
+
+    return 0;
+}
+
+static int fork_hvm_context(struct domain *cd, struct domain *d)
+{
+    struct hvm_domain_context c = { .size = hvm_save_size(d) };
+    int rc;
+
+    if ( (c.data = xmalloc_bytes(c.size)) == NULL )
+        return -ENOMEM;
+
+    rc = hvm_save(d, &c);
+    if ( !rc )
+    {
+        c.size = c.cur;
+        c.cur = 0;
+        rc = hvm_load(cd, &c);
+    }
+
+    xfree(c.data);
+    return rc;
+}
+
+static int fork_memory_map(struct domain *cd, struct domain *d)
+{
+    struct e820entry *e820 = NULL;
+    unsigned int nr;
+
+    spin_lock(&d->arch.e820_lock);
+    nr = d->arch.nr_e820;
+    if ( nr && (e820 = xmalloc_array(struct e820entry, nr)) != NULL )
+        memcpy(e820, d->arch.e820, nr * sizeof(*e820));
+    spin_unlock(&d->arch.e820_lock);
+
+    if ( !nr )
+        return 0;
+    if ( !e820 )
+        return -ENOMEM;
+
+    spin_lock(&cd->arch.e820_lock);
+    xfree(cd->arch.e820);
+    cd->arch.e820 = e820;
+    cd->arch.nr_e820 = nr;
+    spin_unlock(&cd->arch.e820_lock);
+
+    return 0;
+}
+
+static int mem_sharing_fork(struct domain *d, struct domain *cd)
+{
+    /* Backends map these, so they are copied rather than shared. */
+    static const unsigned int special_params[] = {
+        HVM_PARAM_STORE_PFN,
+        HVM_PARAM_CONSOLE_PFN,
+    };
+    struct vcpu *v;
+    p2m_type_t p2mt;
+    unsigned long gfn;
+    unsigned int i;
+    int rc;
+
+    if ( d == cd || !mem_sharing_enabled(d) || mem_sharing_is_fork(cd) )
+        return -EINVAL;
+
+    /* The fork has to be paused, like for range sharing. */
+    if ( !atomic_read(&cd->pause_count) )
+        return -EINVAL;
+
+    for_each_vcpu ( d, v )
+        if ( v->vcpu_id >= cd->max_vcpus || !cd->vcpu[v->vcpu_id] )
+            return -EINVAL;
+
+    /* The parent must not change while its memory backs the fork. */
+    domain_pause(d);
+    get_knownalive_domain(d);
+    cd->arch.hvm_domain.fork_parent = d;
+
+    fork_params(cd, d);
+
+    rc = fork_shared_info(cd, d);
+    if ( !rc )
+        rc = fork_vcpu_info(cd, d);
+    if ( !rc )
+        rc = fork_memory_map(cd, d);
+    /* Last, as loading the vCPU state brings the vCPUs up. */
+    if ( !rc )
+        rc = fork_hvm_context(cd, d);
+    if ( rc )
+    {
+        mem_sharing_fork_release(cd);
+        return rc;
+    }
+
+    for ( i = 0; i < ARRAY_SIZE(special_params); i++ )
+    {
+        gfn = cd->arch.hvm_domain.params[special_params[i]];
+        if ( !gfn )
+            continue;
+
+        get_gfn_unshare(cd, gfn, &p2mt);
+        put_gfn(cd, gfn);
+    }
+
+    return 0;
+}
+
 int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
 {
     int rc;
@@ -1497,8 +1856,8 @@ int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
             struct domain *cd;
 
             rc = -EINVAL;
-            if ( mso.u.range._pad[0] || mso.u.range._pad[1] ||
-                 mso.u.range._pad[2] )
+            if ( (mso.u.range.flags & ~XENMEM_SHARING_RANGE_POPULATE) ||
+                 mso.u.range._pad[0] || mso.u.range._pad[1] )
                  goto out;
 
             /*
@@ -1554,10 +1913,12 @@ int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
             max_sgfn = domain_get_maximum_gpfn(d);
             max_cgfn = domain_get_maximum_gpfn(cd);
 
+            /* A client being populated may not have the range yet. */
             if ( max_sgfn < mso.u.range.first_gfn ||
                  max_sgfn < mso.u.range.last_gfn ||
-                 max_cgfn < mso.u.range.first_gfn ||
-                 max_cgfn < mso.u.range.last_gfn )
+                 (!(mso.u.range.flags & XENMEM_SHARING_RANGE_POPULATE) &&
+                  (max_cgfn < mso.u.range.first_gfn ||
+                   max_cgfn < mso.u.range.last_gfn)) )
             {
                 rcu_unlock_domain(cd);
                 rc = -EINVAL;
@@ -1581,6 +1942,78 @@ int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
         }
         break;
 
+        case XENMEM_sharing_op_nominate_batch:
+        case XENMEM_sharing_op_share_batch:
+        {
+            struct domain *cd = NULL;
+
+            rc = -EINVAL;
+            if ( mso.u.batch._pad[0] || mso.u.batch._pad[1] ||
+                 mso.u.batch._pad[2] || mso.u.batch.opaque > mso.u.batch.nr )
+                goto out;
+
+            if ( !mem_sharing_enabled(d) )
+                goto out;
+
+            if ( mso.op == XENMEM_sharing_op_share_batch )
+            {
+                rc = rcu_lock_live_remote_domain_by_id(
+                         mso.u.batch.client_domain, &cd);
+                if ( rc )
+                    goto out;
+
+                /* As for range sharing, the same as sharing page by page. */
+                rc = xsm_mem_sharing_op(XSM_DM_PRIV, d, cd,
+                                        XENMEM_sharing_op_share);
+                if ( !rc && !mem_sharing_enabled(cd) )
+                    rc = -EINVAL;
+                if ( rc )
+                {
+                    rcu_unlock_domain(cd);
+                    goto out;
+                }
+            }
+
+            rc = batch_op(d, cd, &mso.u.batch);
+            if ( cd )
+                rcu_unlock_domain(cd);
+
+            if ( rc > 0 )
+            {
+                if ( __copy_to_guest(arg, &mso, 1) )
+                    rc = -EFAULT;
+                else
+                    rc = hypercall_create_continuation(__HYPERVISOR_memory_op,
+                                                       "lh", XENMEM_sharing_op,
+                                                       arg);
+            }
+            else
+                mso.u.batch.opaque = 0;
+        }
+        break;
+
+        case XENMEM_sharing_op_fork:
+        {
+            struct domain *pd;
+
+            rc = -EINVAL;
+            if ( mso.u.fork._pad[0] || mso.u.fork._pad[1] ||
+                 mso.u.fork._pad[2] )
+                goto out;
+
+            rc = rcu_lock_live_remote_domain_by_id(mso.u.fork.parent_domain,
+                                                   &pd);
+            if ( rc )
+                goto out;
+
+            rc = xsm_mem_sharing_op(XSM_DM_PRIV, pd, d, mso.op);
+            if ( !rc )
+                rc = mem_sharing_fork(pd, d);
+
+            rcu_unlock_domain(pd);
+        }
+        break;
+
         case XENMEM_sharing_op_debug_gfn:
             rc = debug_gfn(d, _gfn(mso.u.debug.u.gfn));
             break;
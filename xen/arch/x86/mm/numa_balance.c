@@ -0,0 +1,368 @@
+/******************************************************************************
+ * arch/x86/mm/numa_balance.c
+ *
+ * Automatic NUMA balancing of HVM guest memory.
+ *
+ * A domain's node affinity only steers new allocations, so memory that
+ * ended up on the wrong node (ballooned back in while the domain ran
+ * elsewhere, or before it was moved to another cpupool) stays there.  For
+ * domains that opt in, a periodic scan tests and clears the EPT accessed
+ * bits of part of the p2m, and the pages found accessed that are not on
+ * the node most of the domain's vCPUs run on are copied to that node, with
+ * the domain paused, at most 'rate' pages per second.
+ *
+ * Only pages nobody else holds a reference to (foreign mappings, grants,
+ * Xen's own mappings) are moved, and domains whose memory devices may DMA
+ * to, or whose p2m is being tracked otherwise, are not balanced at all.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <xen/domain_page.h>
+#include <xen/guest_access.h>
+#include <xen/iommu.h>
+#include <xen/sched.h>
+#include <xen/softirq.h>
+#include <xen/tasklet.h>
+#include <xen/timer.h>
+#include <asm/altp2m.h>
+#include <asm/numa_balance.h>
+#include <asm/p2m.h>
+
+#include "mm-locks.h"
+
+/* Override macros from asm/page.h to make them work with mfn_t */
+#undef mfn_to_page
+#define mfn_to_page(_m) __mfn_to_page(mfn_x(_m))
+#undef page_to_mfn
+#define page_to_mfn(_pg) _mfn(__page_to_mfn(_pg))
+
+#define NUMA_BALANCE_PERIOD     SECONDS(1)
+#define NUMA_BALANCE_SCAN       65536   /* gfns sampled per period */
+#define NUMA_BALANCE_CHUNK      512     /* gfns sampled per p2m lock hold */
+#define NUMA_BALANCE_MAX_RATE   16384
+
+struct numa_balance {
+    struct timer timer;
+    struct tasklet tasklet;
+    unsigned int rate;
+    unsigned long cursor;           /* Next gfn to sample */
+    unsigned long *hot;             /* Up to rate gfns to move */
+    uint64_t scanned, accessed, remote, migrated, failed;
+    uint64_t node_pages[MAX_NUMNODES];  /* Last complete pass */
+    uint64_t pass_pages[MAX_NUMNODES];  /* Current pass */
+};
+
+/* The node most vCPUs run on, if more than half of them do. */
+static nodeid_t target_node(const struct domain *d)
+{
+    unsigned int count[MAX_NUMNODES] = { 0 }, nr = 0;
+    nodeid_t node, best = NUMA_NO_NODE;
+    const struct vcpu *v;
+
+    for_each_vcpu ( d, v )
+    {
+        if ( test_bit(_VPF_down, &v->pause_flags) )
+            continue;
+        count[cpu_to_node(v->processor)]++;
+        nr++;
+    }
+
+    for_each_online_node ( node )
+        if ( best == NUMA_NO_NODE || count[node] > count[best] )
+            best = node;
+
+    return best != NUMA_NO_NODE && count[best] * 2 > nr ? best : NUMA_NO_NODE;
+}
+
+/*
+ * Move the page at @gfn to @node.  The domain is paused, so the copy can't
+ * race with the guest, and the p2m lock keeps anyone from looking the old
+ * page up while it is being replaced.  Pages anybody else has a reference
+ * to are left where they are.
+ */
+static int migrate_page(struct domain *d, unsigned long gfn, nodeid_t node)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    struct page_info *page, *new;
+    unsigned int order;
+    p2m_type_t t;
+    p2m_access_t a;
+    mfn_t mfn;
+    int rc = -EBUSY;
+
+    gfn_lock(p2m, _gfn(gfn), 0);
+
+    mfn = p2m->get_entry(p2m, _gfn(gfn), &t, &a, 0, &order, NULL);
+    if ( !mfn_valid(mfn) || t != p2m_ram_rw || order != PAGE_ORDER_4K )
+        goto out;
+
+    page = mfn_to_page(mfn);
+    if ( !get_page(page, d) )
+        goto out;
+
+    /* Only the allocation reference and ours. */
+    if ( (page->count_info & (PGC_count_mask | PGC_allocated)) !=
+         (2 | PGC_allocated) ||
+         (page->u.inuse.type_info & PGT_count_mask) )
+        goto out_put;
+
+    new = alloc_domheap_page(d, MEMF_no_owner | MEMF_node(node) |
+                                MEMF_exact_node);
+    if ( !new )
+    {
+        rc = -ENOMEM;
+        goto out_put;
+    }
+    copy_domain_page(page_to_mfn(new), mfn);
+
+    /*
+     * As in memory_exchange(), assign the new page without accounting it,
+     * then account it by hand: it takes the place of the old one, which
+     * gets freed below, so max_pages doesn't apply.
+     */
+    rc = assign_pages(d, new, 0, MEMF_no_refcount);
+    if ( rc )
+    {
+        free_domheap_page(new);
+        goto out_put;
+    }
+    spin_lock(&d->page_alloc_lock);
+    domain_adjust_tot_pages(d, 1);
+    spin_unlock(&d->page_alloc_lock);
+
+    /* This also updates the IOMMU mappings if they aren't shared. */
+    rc = p2m_set_entry(p2m, _gfn(gfn), page_to_mfn(new), PAGE_ORDER_4K,
+                       p2m_ram_rw, a);
+    if ( rc )
+    {
+        if ( test_and_clear_bit(_PGC_allocated, &new->count_info) )
+            put_page(new);
+        goto out_put;
+    }
+    set_gpfn_from_mfn(mfn_x(page_to_mfn(new)), gfn);
+    set_gpfn_from_mfn(mfn_x(mfn), INVALID_M2P_ENTRY);
+
+    if ( test_and_clear_bit(_PGC_allocated, &page->count_info) )
+        put_page(page);
+
+ out_put:
+    put_page(page);
+ out:
+    gfn_unlock(p2m, _gfn(gfn), 0);
+    return rc;
+}
+
+static void numa_balance_work(unsigned long data)
+{
+    struct domain *d = (struct domain *)data;
+    struct numa_balance *nb = d->arch.numa_balance;
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    nodeid_t target = target_node(d);
+    unsigned int done, i, nr_hot = 0;
+
+    if ( d->is_dying )
+        return;
+
+    /* Only collect statistics for domains whose pages can't be moved. */
+    if ( need_iommu(d) || paging_mode_log_dirty(d) || altp2m_active(d) ||
+         (target != NUMA_NO_NODE && !node_isset(target, d->node_affinity)) )
+        target = NUMA_NO_NODE;
+
+    for ( done = 0; done < NUMA_BALANCE_SCAN; done += NUMA_BALANCE_CHUNK )
+    {
+        unsigned long accessed[BITS_TO_LONGS(NUMA_BALANCE_CHUNK)] = { 0 };
+        unsigned long gfn = nb->cursor;
+
+        if ( gfn > p2m->max_mapped_pfn )
+        {
+            memcpy(nb->node_pages, nb->pass_pages, sizeof(nb->node_pages));
+            memset(nb->pass_pages, 0, sizeof(nb->pass_pages));
+            nb->cursor = 0;
+            break;
+        }
+
+        p2m_lock(p2m);
+
+        p2m->test_clear_accessed(p2m, gfn, NUMA_BALANCE_CHUNK, accessed);
+
+        for ( i = 0; i < NUMA_BALANCE_CHUNK; i++ )
+        {
+            p2m_type_t t;
+            p2m_access_t a;
+            mfn_t mfn = p2m->get_entry(p2m, _gfn(gfn + i), &t, &a, 0,
+                                       NULL, NULL);
+            nodeid_t node;
+
+            if ( !p2m_is_ram(t) || !mfn_valid(mfn) )
+                continue;
+
+            node = phys_to_nid(mfn_to_maddr(mfn));
+            nb->pass_pages[node]++;
+            nb->scanned++;
+
+            if ( !test_bit(i, accessed) )
+                continue;
+            nb->accessed++;
+
+            if ( target == NUMA_NO_NODE || node == target )
+                continue;
+            nb->remote++;
+
+            if ( nr_hot < nb->rate )
+                nb->hot[nr_hot++] = gfn + i;
+        }
+
+        p2m_unlock(p2m);
+
+        nb->cursor = gfn + NUMA_BALANCE_CHUNK;
+        process_pending_softirqs();
+    }
+
+    if ( nr_hot )
+    {
+        domain_pause(d);
+
+        for ( i = 0; i < nr_hot; i++ )
+        {
+            if ( migrate_page(d, nb->hot[i], target) )
+                nb->failed++;
+            else
+                nb->migrated++;
+
+            if ( !(i & 63) )
+                process_pending_softirqs();
+        }
+
+        domain_unpause(d);
+    }
+
+    set_timer(&nb->timer, NOW() + NUMA_BALANCE_PERIOD);
+}
+
+static void numa_balance_tick(void *data)
+{
+    struct domain *d = data;
+
+    tasklet_schedule(&d->arch.numa_balance->tasklet);
+}
+
+void numa_balance_disable(struct domain *d)
+{
+    struct numa_balance *nb = d->arch.numa_balance;
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+    if ( !nb )
+        return;
+
+    kill_timer(&nb->timer);
+    tasklet_kill(&nb->tasklet);
+    d->arch.numa_balance = NULL;
+
+    domain_pause(d);
+    p2m->track_accessed(p2m, false);
+    domain_unpause(d);
+
+    xfree(nb->hot);
+    xfree(nb);
+}
+
+static int numa_balance_enable(struct domain *d, unsigned int rate)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    struct numa_balance *nb;
+    int rc;
+
+    if ( !is_hvm_domain(d) || !hap_enabled(d) || !p2m->track_accessed )
+        return -EOPNOTSUPP;
+    if ( rate > NUMA_BALANCE_MAX_RATE )
+        return -EINVAL;
+    if ( d->is_dying )
+        return -EINVAL;
+
+    numa_balance_disable(d);
+    if ( !rate )
+        return 0;
+
+    nb = xzalloc(struct numa_balance);
+    if ( !nb )
+        return -ENOMEM;
+    nb->hot = xmalloc_array(unsigned long, rate);
+    if ( !nb->hot )
+    {
+        xfree(nb);
+        return -ENOMEM;
+    }
+    nb->rate = rate;
+
+    domain_pause(d);
+    rc = p2m->track_accessed(p2m, true);
+    domain_unpause(d);
+    if ( rc )
+    {
+        xfree(nb->hot);
+        xfree(nb);
+        return rc;
+    }
+
+    init_timer(&nb->timer, numa_balance_tick, d, smp_processor_id());
+    tasklet_init(&nb->tasklet, numa_balance_work, (unsigned long)d);
+    d->arch.numa_balance = nb;
+    set_timer(&nb->timer, NOW() + NUMA_BALANCE_PERIOD);
+
+    return 0;
+}
+
+int numa_balance_domctl(struct domain *d, struct xen_domctl_numa_balance *op)
+{
+    const struct numa_balance *nb = d->arch.numa_balance;
+    unsigned int nr_nodes = 0;
+    nodeid_t node;
+
+    switch ( op->op )
+    {
+    case XEN_DOMCTL_NUMA_BALANCE_SET:
+        return numa_balance_enable(d, op->rate);
+
+    case XEN_DOMCTL_NUMA_BALANCE_GET:
+        for_each_online_node ( node )
+            nr_nodes = node + 1;
+
+        op->rate = nb ? nb->rate : 0;
+        op->scanned = nb ? nb->scanned : 0;
+        op->accessed = nb ? nb->accessed : 0;
+        op->remote = nb ? nb->remote : 0;
+        op->migrated = nb ? nb->migrated : 0;
+        op->failed = nb ? nb->failed : 0;
+
+        if ( nb && !guest_handle_is_null(op->node_pages) &&
+             copy_to_guest(op->node_pages, nb->node_pages,
+                           min(op->num_nodes, nr_nodes)) )
+            return -EFAULT;
+        op->num_nodes = nr_nodes;
+
+        return 0;
+    }
+
+    return -EOPNOTSUPP;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
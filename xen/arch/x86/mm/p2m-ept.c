@@ -33,6 +33,24 @@
 
 #include "mm-locks.h"
 
+/*
+ * Order of the naturally aligned block whose invalidated entries are
+ * resolved on each EPT misconfiguration exit.  Resolving larger blocks at
+ * once trades latency of a single exit for fewer exits after a global
+ * type or memory type change.
+ */
+static unsigned int __read_mostly opt_ept_misconfig_order = PAGE_ORDER_2M;
+integer_param("ept_misconfig_order", opt_ept_misconfig_order);
+
+/*
+ * Interval (ms) of the background sweep resolving invalidated entries
+ * ahead of the guest touching them; 0 disables it.
+ */
+static unsigned int __read_mostly opt_ept_sweep;
+integer_param("ept_sweep", opt_ept_sweep);
+
+#define EPT_SWEEP_BUDGET 1024 /* 2M blocks per run */
+
 #define atomic_read_ept_entry(__pepte)                              \
     ( (ept_entry_t) { .epte = read_atomic(&(__pepte)->epte) } )
 
@@ -649,6 +667,91 @@ static int resolve_misconfig(struct p2m_domain *p2m, unsigned long gfn)
     return rc;
 }
 
+static struct timer ept_sweep_timer;
+static struct tasklet ept_sweep_tasklet;
+
+/* Called with the p2m lock held, after invalidating entries. */
+static void ept_sweep_start(struct p2m_domain *p2m)
+{
+    if ( !opt_ept_sweep || !p2m_is_hostp2m(p2m) )
+        return;
+
+    p2m->ept.sweep_gfn = 0;
+    p2m->ept.sweep = true;
+}
+
+/* Returns the number of 2M blocks handled. */
+static unsigned int ept_sweep_domain(struct domain *d, unsigned int budget)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned int done = 0;
+
+    for ( ; done < budget; done++ )
+    {
+        p2m_lock(p2m);
+
+        if ( d->is_dying || !p2m->ept.sweep ||
+             p2m->ept.sweep_gfn > p2m->max_mapped_pfn )
+        {
+            p2m->ept.sweep = false;
+            p2m_unlock(p2m);
+            break;
+        }
+
+        /* On failure retry on the next run, or leave it to the fault. */
+        if ( resolve_misconfig(p2m, p2m->ept.sweep_gfn) < 0 )
+        {
+            p2m_unlock(p2m);
+            break;
+        }
+        p2m->ept.sweep_gfn += 1UL << PAGE_ORDER_2M;
+
+        p2m_unlock(p2m);
+    }
+
+    return done;
+}
+
+static void ept_sweep_work(unsigned long unused)
+{
+    struct domain *d;
+    unsigned int budget = EPT_SWEEP_BUDGET;
+
+    rcu_read_lock(&domlist_read_lock);
+
+    for_each_domain ( d )
+    {
+        if ( !budget )
+            break;
+        if ( !is_hvm_domain(d) || !paging_mode_hap(d) ||
+             !read_atomic(&p2m_get_hostp2m(d)->ept.sweep) )
+            continue;
+
+        budget -= ept_sweep_domain(d, budget);
+    }
+
+    rcu_read_unlock(&domlist_read_lock);
+}
+
+static void ept_sweep_tick(void *unused)
+{
+    tasklet_schedule(&ept_sweep_tasklet);
+    set_timer(&ept_sweep_timer, NOW() + MILLISECS(opt_ept_sweep));
+}
+
+static int __init ept_sweep_init(void)
+{
+    if ( !opt_ept_sweep || !hvm_enabled || !cpu_has_vmx_ept )
+        return 0;
+
+    tasklet_init(&ept_sweep_tasklet, ept_sweep_work, 0);
+    init_timer(&ept_sweep_timer, ept_sweep_tick, NULL, 0);
+    set_timer(&ept_sweep_timer, NOW() + MILLISECS(opt_ept_sweep));
+
+    return 0;
+}
+__initcall(ept_sweep_init);
+
 bool_t ept_handle_misconfig(uint64_t gpa)
 {
     struct vcpu *curr = current;
@@ -662,6 +765,22 @@ bool_t ept_handle_misconfig(uint64_t gpa)
     rc = resolve_misconfig(p2m, PFN_DOWN(gpa));
     curr->arch.hvm_vmx.ept_spurious_misconfig = 0;
 
+    /* resolve_misconfig() handles (at least) one 2M block at a time. */
+    if ( rc > 0 && opt_ept_misconfig_order > PAGE_ORDER_2M )
+    {
+        unsigned int order = min_t(unsigned int, opt_ept_misconfig_order,
+                                   PAGE_ORDER_1G);
+        unsigned long gfn = PFN_DOWN(gpa);
+        unsigned long start = gfn & ~((1UL << order) - 1);
+        unsigned long end = min(start + (1UL << order) - 1,
+                                p2m->max_mapped_pfn);
+
+        for ( ; start <= end; start += 1UL << PAGE_ORDER_2M )
+            if ( ((start ^ gfn) >> PAGE_ORDER_2M) &&
+                 resolve_misconfig(p2m, start) < 0 )
+                break;
+    }
+
     p2m_unlock(p2m);
 
     return spurious ? (rc >= 0) : (rc > 0);
@@ -828,6 +947,11 @@ ept_set_entry(struct p2m_domain *p2m, gfn_t gfn_, mfn_t mfn,
         new_entry.suppress_ve = is_epte_valid(&old_entry) ?
                                     old_entry.suppress_ve : 1;
 
+    /* Sub-page write permissions stay with the page they were set for. */
+    if ( !i && is_epte_valid(&old_entry) && old_entry.spp &&
+         old_entry.mfn == new_entry.mfn && is_epte_present(&new_entry) )
+        new_entry.spp = 1;
+
     /*
      * p2m_ioreq_server is only used for 4K pages, so the
      * count is only done on ept page table entries.
@@ -856,6 +980,10 @@ ept_set_entry(struct p2m_domain *p2m, gfn_t gfn_, mfn_t mfn,
              (gfn + (1UL << order) - 1 > p2m->max_mapped_pfn) )
             /* Track the highest gfn for which we have ever had a valid mapping */
             p2m->max_mapped_pfn = gfn + (1UL << order) - 1;
+
+        if ( p2mt != p2m_invalid && p2m_is_altp2m(p2m) &&
+             gfn < p2m->min_mapped_pfn )
+            p2m->min_mapped_pfn = gfn;
     }
 
 out:
@@ -868,30 +996,10 @@ out:
     {
         if ( iommu_hap_pt_share )
             rc = iommu_pte_flush(d, gfn, &ept_entry->epte, order, vtd_pte_present);
+        else if ( iommu_flags )
+            rc = iommu_map_pages(d, gfn, mfn_x(mfn), order, iommu_flags);
         else
-        {
-            if ( iommu_flags )
-                for ( i = 0; i < (1 << order); i++ )
-                {
-                    rc = iommu_map_page(d, gfn + i, mfn_x(mfn) + i, iommu_flags);
-                    if ( unlikely(rc) )
-                    {
-                        while ( i-- )
-                            /* If statement to satisfy __must_check. */
-                            if ( iommu_unmap_page(p2m->domain, gfn + i) )
-                                continue;
-
-                        break;
-                    }
-                }
-            else
-                for ( i = 0; i < (1 << order); i++ )
-                {
-                    ret = iommu_unmap_page(d, gfn + i);
-                    if ( !rc )
-                        rc = ret;
-                }
-        }
+            rc = iommu_unmap_pages(d, gfn, order);
     }
 
     unmap_domain_page(table);
@@ -1083,6 +1191,8 @@ static void ept_change_entry_type_global(struct p2m_domain *p2m,
 
     if ( ept_invalidate_emt(_mfn(mfn), 1, p2m->ept.wl) )
         ept_sync_domain(p2m);
+
+    ept_sweep_start(p2m);
 }
 
 static int ept_change_entry_type_range(struct p2m_domain *p2m,
@@ -1129,6 +1239,9 @@ static int ept_change_entry_type_range(struct p2m_domain *p2m,
     if ( sync )
         ept_sync_domain(p2m);
 
+    if ( sync > 0 )
+        ept_sweep_start(p2m);
+
     return rc < 0 ? rc : 0;
 }
 
@@ -1141,6 +1254,8 @@ static void ept_memory_type_changed(struct p2m_domain *p2m)
 
     if ( ept_invalidate_emt(_mfn(mfn), 0, p2m->ept.wl) )
         ept_sync_domain(p2m);
+
+    ept_sweep_start(p2m);
 }
 
 static void __ept_sync_domain(void *info)
@@ -1228,8 +1343,8 @@ static void ept_disable_pml(struct p2m_domain *p2m)
 
     vmx_domain_disable_pml(p2m->domain);
 
-    /* Disable EPT A/D bit */
-    p2m->ept.ad = 0;
+    /* Disable EPT A/D bit, unless the A bits are still being sampled */
+    p2m->ept.ad = !!p2m->ept.track_accessed;
     vmx_domain_update_eptp(p2m->domain);
 }
 
@@ -1241,6 +1356,213 @@ static void ept_flush_pml_buffers(struct p2m_domain *p2m)
     vmx_domain_flush_pml_buffers(p2m->domain);
 }
 
+static int ept_track_accessed(struct p2m_domain *p2m, bool enable)
+{
+    /* Domain must have been paused */
+    ASSERT(atomic_read(&p2m->domain->pause_count));
+
+    if ( !cpu_has_vmx_ept_ad )
+        return -EOPNOTSUPP;
+
+    if ( enable )
+        p2m->ept.track_accessed++;
+    else
+    {
+        ASSERT(p2m->ept.track_accessed);
+        p2m->ept.track_accessed--;
+    }
+    p2m->ept.ad = p2m->ept.track_accessed ||
+                  vmx_domain_pml_enabled(p2m->domain);
+    vmx_domain_update_eptp(p2m->domain);
+
+    return 0;
+}
+
+/*
+ * Test and clear the A bits of the 4k RAM mappings of [gfn, gfn + nr),
+ * setting the bits of the accessed ones in @accessed.  Superpages and
+ * entries of other types are skipped.  p2m lock held.
+ */
+static unsigned int ept_test_clear_accessed(struct p2m_domain *p2m,
+                                            unsigned long gfn, unsigned int nr,
+                                            unsigned long *accessed)
+{
+    unsigned int i, n = 0;
+    int level;
+
+    ASSERT(p2m_locked_by_me(p2m));
+
+    for ( i = 0; i < nr && gfn + i <= p2m->max_mapped_pfn; i++ )
+    {
+        unsigned long gfn_remainder = gfn + i;
+        ept_entry_t *table =
+            map_domain_page(pagetable_get_mfn(p2m_get_pagetable(p2m)));
+        ept_entry_t *ept_entry = NULL;
+
+        for ( level = p2m->ept.wl; level > 0; level-- )
+            if ( ept_next_level(p2m, 1, &table, &gfn_remainder, level) !=
+                 GUEST_TABLE_NORMAL_PAGE )
+                break;
+
+        if ( !level )
+            ept_entry = table + gfn_remainder;
+        if ( ept_entry && is_epte_valid(ept_entry) && !ept_entry->recalc &&
+             ept_entry->sa_p2mt == p2m_ram_rw &&
+             test_and_clear_bit(8 /* a */, &ept_entry->epte) )
+        {
+            __set_bit(i, accessed);
+            n++;
+        }
+
+        unmap_domain_page(table);
+    }
+
+    /* Drop cached translations, so that the A bits get set again. */
+    if ( n )
+        ept_sync_domain(p2m);
+
+    return n;
+}
+
+/*
+ * Sub-page write permissions.  The SPP table mirrors the upper three EPT
+ * levels; its leaves hold a write-permission vector per 4k page, bit 2n
+ * allowing writes to bytes [128n, 128n + 127].  They only apply to EPT
+ * leaves with the SPP bit set and write permission clear.
+ */
+#define SPPT_VALID  1ul
+
+static uint64_t sppt_vector(uint32_t write)
+{
+    uint64_t vector = 0;
+    unsigned int i;
+
+    for ( i = 0; i < 32; i++ )
+        if ( write & (1u << i) )
+            vector |= 1ull << (2 * i);
+
+    return vector;
+}
+
+/* Install @vector for @gfn, filling in the table as needed. */
+static int sppt_set_vector(struct p2m_domain *p2m, unsigned long gfn,
+                           uint64_t vector)
+{
+    uint64_t *table;
+    unsigned int level;
+    mfn_t mfn;
+
+    ASSERT(p2m_locked_by_me(p2m));
+
+    if ( mfn_eq(p2m->ept.sppt, INVALID_MFN) )
+    {
+        mfn = p2m_alloc_ptp(p2m, 0);
+        if ( mfn_eq(mfn, INVALID_MFN) )
+            return -ENOMEM;
+        p2m->ept.sppt = mfn;
+    }
+
+    table = map_domain_page(p2m->ept.sppt);
+
+    for ( level = 3; level > 0; level-- )
+    {
+        uint64_t *e = &table[(gfn >> (level * EPT_TABLE_ORDER)) &
+                             (EPT_PAGETABLE_ENTRIES - 1)];
+
+        if ( !(*e & SPPT_VALID) )
+        {
+            mfn = p2m_alloc_ptp(p2m, 0);
+            if ( mfn_eq(mfn, INVALID_MFN) )
+            {
+                unmap_domain_page(table);
+                return -ENOMEM;
+            }
+            write_atomic(e, mfn_to_maddr(mfn) | SPPT_VALID);
+        }
+        else
+            mfn = maddr_to_mfn(*e & PADDR_MASK & PAGE_MASK);
+
+        unmap_domain_page(table);
+        table = map_domain_page(mfn);
+    }
+
+    write_atomic(&table[gfn & (EPT_PAGETABLE_ENTRIES - 1)], vector);
+    unmap_domain_page(table);
+
+    return 0;
+}
+
+static int ept_set_subpage_write(struct p2m_domain *p2m, gfn_t gfn,
+                                 uint32_t write)
+{
+    struct domain *d = p2m->domain;
+    unsigned long gfn_remainder = gfn_x(gfn);
+    ept_entry_t *table, *ept_entry, e;
+    unsigned int i, order;
+    p2m_type_t t;
+    p2m_access_t a;
+    mfn_t mfn;
+    int rc = 0;
+
+    if ( !p2m_is_hostp2m(p2m) )
+        return -EOPNOTSUPP;
+
+    p2m_lock(p2m);
+
+    mfn = p2m->get_entry(p2m, gfn, &t, &a, 0, &order, NULL);
+    if ( !mfn_valid(mfn) || !p2m_is_ram(t) )
+    {
+        rc = -ESRCH;
+        goto out;
+    }
+
+    /* Nothing was ever set up, so there is nothing to remove. */
+    if ( write == ~0u && mfn_eq(p2m->ept.sppt, INVALID_MFN) )
+        goto out;
+
+    /* SPP applies to 4k mappings only. */
+    if ( order != PAGE_ORDER_4K )
+    {
+        rc = p2m->set_entry(p2m, gfn, mfn, PAGE_ORDER_4K, t, a, -1);
+        if ( rc )
+            goto out;
+    }
+
+    rc = sppt_set_vector(p2m, gfn_x(gfn), sppt_vector(write));
+    if ( rc )
+        goto out;
+
+    table = map_domain_page(pagetable_get_mfn(p2m_get_pagetable(p2m)));
+    for ( i = p2m->ept.wl; i > 0; i-- )
+        if ( ept_next_level(p2m, 1, &table, &gfn_remainder, i) !=
+             GUEST_TABLE_NORMAL_PAGE )
+        {
+            unmap_domain_page(table);
+            rc = -ESRCH;
+            goto out;
+        }
+
+    ept_entry = table + gfn_remainder;
+    e = atomic_read_ept_entry(ept_entry);
+    e.spp = write != ~0u;
+    rc = atomic_write_ept_entry(ept_entry, e, 0);
+    unmap_domain_page(table);
+
+    ept_sync_domain(p2m);
+
+ out:
+    p2m_unlock(p2m);
+
+    if ( !rc && write != ~0u && !vmx_domain_spp_enabled(d) )
+    {
+        domain_pause(d);
+        rc = vmx_domain_enable_spp(d);
+        domain_unpause(d);
+    }
+
+    return rc;
+}
+
 int ept_p2m_init(struct p2m_domain *p2m)
 {
     struct ept_data *ept = &p2m->ept;
@@ -1267,6 +1589,16 @@ int ept_p2m_init(struct p2m_domain *p2m)
         p2m->flush_hardware_cached_dirty = ept_flush_pml_buffers;
     }
 
+    if ( cpu_has_vmx_ept_ad )
+    {
+        p2m->track_accessed = ept_track_accessed;
+        p2m->test_clear_accessed = ept_test_clear_accessed;
+    }
+
+    ept->sppt = INVALID_MFN;
+    if ( cpu_has_vmx_spp )
+        p2m->set_subpage_write = ept_set_subpage_write;
+
     if ( !zalloc_cpumask_var(&ept->invalidate) )
         return -ENOMEM;
 
@@ -1375,6 +1707,8 @@ void p2m_init_altp2m_ept(struct domain *d, unsigned int i)
 
     p2m->min_remapped_gfn = gfn_x(INVALID_GFN);
     p2m->max_remapped_gfn = 0;
+    p2m->min_mapped_pfn = gfn_x(INVALID_GFN);
+    p2m->max_mapped_pfn = 0;
     ept = &p2m->ept;
     ept->mfn = pagetable_get_pfn(p2m_get_pagetable(p2m));
     d->arch.altp2m_eptp[i] = ept->eptp;
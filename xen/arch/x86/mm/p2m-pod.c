@@ -21,6 +21,7 @@
 
 #include <xen/event.h>
 #include <xen/mm.h>
+#include <xen/perfc.h>
 #include <xen/sched.h>
 #include <xen/trace.h>
 #include <asm/page.h>
@@ -37,6 +38,14 @@
 
 #define superpage_aligned(_x)  (((_x)&(SUPERPAGE_PAGES-1))==0)
 
+/*
+ * Order of the aligned window populated from singleton pages around a
+ * faulting gfn when a 2M PoD entry can't be backed by a superpage.  The
+ * rest of the 2M range is left for later faults.
+ */
+static unsigned int __read_mostly opt_pod_prefault_order = PAGE_ORDER_2M;
+integer_param("pod_prefault_order", opt_pod_prefault_order);
+
 /* Enforce lock ordering when grabbing the "external" page_alloc lock */
 static inline void lock_page_alloc(struct p2m_domain *p2m)
 {
@@ -674,6 +683,29 @@ void p2m_pod_dump_data(struct domain *d)
 }
 
 
+/*
+ * Check whether the first @words longs at @map are all zero.  Several words
+ * are OR-ed together per iteration so the common all-zero case runs without
+ * a branch per word; a guest page which isn't zero is normally detected
+ * within the first cache line.
+ */
+#define POD_ZERO_UNROLL 8
+static bool pod_words_are_zero(const unsigned long *map, unsigned int words)
+{
+    unsigned int i;
+
+    ASSERT(!(words % POD_ZERO_UNROLL));
+
+    for ( i = 0; i < words; i += POD_ZERO_UNROLL )
+        if ( map[i] | map[i + 1] | map[i + 2] | map[i + 3] |
+             map[i + 4] | map[i + 5] | map[i + 6] | map[i + 7] )
+            return false;
+
+    return true;
+}
+#define POD_QUICK_CHECK_WORDS 16
+#define POD_PAGE_WORDS        (PAGE_SIZE / sizeof(unsigned long))
+
 /*
  * Search for all-zero superpages to be reclaimed as superpages for the
  * PoD cache. Must be called w/ pod lock held, must lock the superpage
@@ -687,7 +719,7 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, gfn_t gfn)
     unsigned long * map = NULL;
     int ret=0, reset = 0;
     unsigned long i, n;
-    unsigned int j;
+    bool zero;
     int max_ref = 1;
     struct domain *d = p2m->domain;
 
@@ -753,21 +785,18 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, gfn_t gfn)
                 goto out;
     }
 
+    perfc_add(pod_zero_checked, SUPERPAGE_PAGES);
+
     /* Now, do a quick check to see if it may be zero before unmapping. */
     for ( i = 0; i < SUPERPAGE_PAGES; i++ )
     {
         /* Quick zero-check */
         map = map_domain_page(mfn_add(mfn0, i));
-
-        for ( j = 0; j < 16; j++ )
-            if ( *(map + j) != 0 )
-                break;
-
+        zero = pod_words_are_zero(map, POD_QUICK_CHECK_WORDS);
         unmap_domain_page(map);
 
-        if ( j < 16 )
+        if ( !zero )
             goto out;
-
     }
 
     /* Try to remove the page, restoring old mapping if it fails. */
@@ -794,18 +823,14 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, gfn_t gfn)
     for ( i = 0; i < SUPERPAGE_PAGES; i++ )
     {
         map = map_domain_page(mfn_add(mfn0, i));
-
-        for ( j = 0; j < (PAGE_SIZE / sizeof(*map)); j++ )
-            if ( *(map+j) != 0 )
-            {
-                reset = 1;
-                break;
-            }
-
+        zero = pod_words_are_zero(map, POD_PAGE_WORDS);
         unmap_domain_page(map);
 
-        if ( reset )
+        if ( !zero )
+        {
+            reset = 1;
             goto out_reset;
+        }
     }
 
     if ( tb_init_done )
@@ -829,6 +854,7 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, gfn_t gfn)
      */
     p2m_pod_cache_add(p2m, mfn_to_page(mfn0), PAGE_ORDER_2M);
     p2m->pod.entry_count += SUPERPAGE_PAGES;
+    perfc_add(pod_zero_reclaimed, SUPERPAGE_PAGES);
 
     ret = SUPERPAGE_PAGES;
 
@@ -849,7 +875,7 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, int count)
     unsigned long *map[count];
     struct domain *d = p2m->domain;
 
-    int i, j;
+    int i;
     int max_ref = 1;
 
     /* Allow an extra refcount for one shadow pt mapping in shadowed domains */
@@ -887,12 +913,10 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, int count)
         if ( !map[i] )
             continue;
 
-        /* Quick zero-check */
-        for ( j = 0; j < 16; j++ )
-            if ( *(map[i] + j) != 0 )
-                break;
+        perfc_incr(pod_zero_checked);
 
-        if ( j < 16 )
+        /* Quick zero-check */
+        if ( !pod_words_are_zero(map[i], POD_QUICK_CHECK_WORDS) )
         {
             unmap_domain_page(map[i]);
             map[i] = NULL;
@@ -924,20 +948,19 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, int count)
     /* Now check each page for real */
     for ( i = 0; i < count; i++ )
     {
+        bool zero;
+
         if ( !map[i] )
             continue;
 
-        for ( j = 0; j < (PAGE_SIZE / sizeof(*map[i])); j++ )
-            if ( *(map[i] + j) != 0 )
-                break;
-
+        zero = pod_words_are_zero(map[i], POD_PAGE_WORDS);
         unmap_domain_page(map[i]);
 
         /*
          * See comment in p2m_pod_zero_check_superpage() re gnttab
          * check timing.
          */
-        if ( j < (PAGE_SIZE / sizeof(*map[i])) )
+        if ( !zero )
         {
             p2m_set_entry(p2m, gfns[i], mfns[i], PAGE_ORDER_4K,
                           types[i], p2m->default_access);
@@ -962,6 +985,7 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, int count)
             /* Add to cache, and account for the new p2m PoD entry */
             p2m_pod_cache_add(p2m, mfn_to_page(mfns[i]), PAGE_ORDER_4K);
             p2m->pod.entry_count++;
+            perfc_incr(pod_zero_reclaimed);
         }
     }
 
@@ -973,7 +997,7 @@ static void
 p2m_pod_emergency_sweep(struct p2m_domain *p2m)
 {
     gfn_t gfns[POD_SWEEP_STRIDE];
-    unsigned long i, j = 0, start, limit;
+    unsigned long i, j = 0, start, limit, base = ~0UL;
     p2m_type_t t;
 
 
@@ -983,7 +1007,8 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
     start = gfn_x(p2m->pod.reclaim_single);
     limit = (start > POD_SWEEP_LIMIT) ? (start - POD_SWEEP_LIMIT) : 0;
 
-    /* FIXME: Figure out how to avoid superpages */
+    perfc_incr(pod_sweep);
+
     /*
      * NOTE: Promote to globally locking the p2m. This will get complicated
      * in a fine-grained scenario. If we lock each gfn individually we must be
@@ -993,7 +1018,31 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
     for ( i = gfn_x(p2m->pod.reclaim_single); i > 0 ; i-- )
     {
         p2m_access_t a;
-        (void)p2m->get_entry(p2m, _gfn(i), &t, &a, 0, NULL, NULL);
+        unsigned int order;
+
+        (void)p2m->get_entry(p2m, _gfn(i), &t, &a, 0, &order, NULL);
+        perfc_incr(pod_sweep_scanned);
+
+        if ( order >= PAGE_ORDER_2M && base != (i & ~(SUPERPAGE_PAGES - 1)) )
+        {
+            /*
+             * Deal with a 2M range in one go where possible: non-RAM ranges
+             * (holes, PoD entries) have nothing to reclaim, and an all-zero
+             * RAM superpage is reclaimed whole rather than being shattered
+             * into 4k candidates.  Otherwise fall back to checking its 4k
+             * pages individually.
+             */
+            base = i & ~(SUPERPAGE_PAGES - 1);
+            if ( !p2m_is_ram(t) ||
+                 p2m_pod_zero_check_superpage(p2m, _gfn(base)) )
+            {
+                i = base;
+                if ( !i )
+                    break;
+                t = p2m_invalid;
+            }
+        }
+
         if ( p2m_is_ram(t) )
         {
             gfns[j] = _gfn(i);
@@ -1191,16 +1240,50 @@ out_fail:
     return false;
 remap_and_retry:
     BUG_ON(order != PAGE_ORDER_2M);
-    pod_unlock(p2m);
 
-    /* Remap this 2-meg region in singleton chunks */
+    /*
+     * Remap this 2-meg region in singleton chunks, populating the prefault
+     * window around the faulting gfn right away, as far as the cache (which
+     * holds no superpages at this point) allows.
+     */
     /*
      * NOTE: In a p2m fine-grained lock scenario this might
      * need promoting the gfn lock from gfn->2M superpage.
      */
-    for ( i = 0; i < (1UL << order); i++ )
-        p2m_set_entry(p2m, gfn_add(gfn_aligned, i), INVALID_MFN, PAGE_ORDER_4K,
-                      p2m_populate_on_demand, p2m->default_access);
+    {
+        unsigned int w = min_t(unsigned int, opt_pod_prefault_order, order);
+        unsigned long first, last;
+
+        while ( w && p2m->pod.count < (1UL << w) )
+            w--;
+        first = (gfn_x(gfn) & ((1UL << order) - 1)) & ~((1UL << w) - 1);
+        last = first + (1UL << w);
+
+        for ( i = 0; i < (1UL << order); i++ )
+        {
+            gfn_t gfn_i = gfn_add(gfn_aligned, i);
+
+            if ( i < first || i >= last )
+            {
+                p2m_set_entry(p2m, gfn_i, INVALID_MFN, PAGE_ORDER_4K,
+                              p2m_populate_on_demand, p2m->default_access);
+                continue;
+            }
+
+            p = p2m_pod_cache_get(p2m, PAGE_ORDER_4K);
+            mfn = page_to_mfn(p);
+            p2m_set_entry(p2m, gfn_i, mfn, PAGE_ORDER_4K, p2m_ram_rw,
+                          p2m->default_access);
+            set_gpfn_from_mfn(mfn_x(mfn), gfn_x(gfn_i));
+            paging_mark_dirty(d, mfn);
+            p2m->pod.entry_count--;
+        }
+        BUG_ON(p2m->pod.entry_count < 0);
+
+        pod_eager_record(p2m, gfn, PAGE_ORDER_4K);
+    }
+    pod_unlock(p2m);
+
     if ( tb_init_done )
     {
         struct {
@@ -38,6 +38,7 @@
 #include <asm/altp2m.h>
 #include <asm/hvm/svm/amd-iommu-proto.h>
 #include <asm/vm_event.h>
+#include <asm/mtrr.h>
 #include <xsm/xsm.h>
 
 #include "mm-locks.h"
@@ -441,6 +442,13 @@ mfn_t __get_gfn_type_access(struct p2m_domain *p2m, unsigned long gfn_l,
 
     mfn = p2m->get_entry(p2m, gfn, t, a, q, page_order, NULL);
 
+    /* A fork populates its holes from its parent on first use. */
+    if ( locked && (q & P2M_ALLOC) && p2m_is_hostp2m(p2m) &&
+         unlikely(mem_sharing_is_fork(p2m->domain)) &&
+         (*t == p2m_invalid || *t == p2m_mmio_dm) &&
+         !mem_sharing_fork_page(p2m->domain, gfn, !!(q & P2M_UNSHARE)) )
+        mfn = p2m->get_entry(p2m, gfn, t, a, q, page_order, NULL);
+
     if ( (q & P2M_UNSHARE) && p2m_is_shared(*t) )
     {
         ASSERT(p2m_is_hostp2m(p2m));
@@ -473,6 +481,21 @@ void __put_gfn(struct p2m_domain *p2m, unsigned long gfn)
     gfn_unlock(p2m, gfn, 0);
 }
 
+mfn_t p2m_get_gfn_type_access_shared(struct p2m_domain *p2m, gfn_t gfn,
+                                     p2m_type_t *t, p2m_access_t *a)
+{
+    mfn_t mfn;
+
+    if ( unlikely(p2m_locked_by_me(p2m)) )
+        return p2m->get_entry(p2m, gfn, t, a, 0, NULL, NULL);
+
+    p2m_read_lock(p2m);
+    mfn = p2m->get_entry(p2m, gfn, t, a, 0, NULL, NULL);
+    p2m_read_unlock(p2m);
+
+    return mfn;
+}
+
 /* Atomically look up a GFN and take a reference count on the backing page. */
 struct page_info *p2m_get_page_from_gfn(
     struct p2m_domain *p2m, gfn_t gfn,
@@ -515,7 +538,8 @@ struct page_info *p2m_get_page_from_gfn(
             return page;
 
         /* Error path: not a suitable GFN at all */
-        if ( !p2m_is_ram(*t) && !p2m_is_paging(*t) && !p2m_is_pod(*t) )
+        if ( !p2m_is_ram(*t) && !p2m_is_paging(*t) && !p2m_is_pod(*t) &&
+             !((q & P2M_ALLOC) && mem_sharing_is_fork(p2m->domain)) )
             return NULL;
     }
 
@@ -524,7 +548,9 @@ struct page_info *p2m_get_page_from_gfn(
     if ( p2m_is_ram(*t) && mfn_valid(mfn) )
     {
         page = mfn_to_page(mfn);
-        if ( !get_page(page, p2m->domain) )
+        if ( !get_page(page, p2m->domain) &&
+             /* A fork may just have had the page shared in */
+             (!p2m_is_shared(*t) || !get_page(page, dom_cow)) )
             page = NULL;
     }
     put_gfn(p2m->domain, gfn_x(gfn));
@@ -719,15 +745,7 @@ p2m_remove_page(struct p2m_domain *p2m, unsigned long gfn_l, unsigned long mfn,
         int rc = 0;
 
         if ( need_iommu(p2m->domain) )
-        {
-            for ( i = 0; i < (1 << page_order); i++ )
-            {
-                int ret = iommu_unmap_page(p2m->domain, mfn + i);
-
-                if ( !rc )
-                    rc = ret;
-            }
-        }
+            rc = iommu_unmap_pages(p2m->domain, mfn, page_order);
 
         return rc;
     }
@@ -778,23 +796,8 @@ guest_physmap_add_entry(struct domain *d, gfn_t gfn, mfn_t mfn,
     if ( !paging_mode_translate(d) )
     {
         if ( need_iommu(d) && t == p2m_ram_rw )
-        {
-            for ( i = 0; i < (1 << page_order); i++ )
-            {
-                rc = iommu_map_page(d, mfn_x(mfn_add(mfn, i)),
-                                    mfn_x(mfn_add(mfn, i)),
-                                    IOMMUF_readable|IOMMUF_writable);
-                if ( rc != 0 )
-                {
-                    while ( i-- > 0 )
-                        /* If statement to satisfy __must_check. */
-                        if ( iommu_unmap_page(d, mfn_x(mfn_add(mfn, i))) )
-                            continue;
-
-                    return rc;
-                }
-            }
-        }
+            return iommu_map_pages(d, mfn_x(mfn), mfn_x(mfn), page_order,
+                                   IOMMUF_readable|IOMMUF_writable);
         return 0;
     }
 
@@ -1709,6 +1712,71 @@ void p2m_mem_paging_resume(struct domain *d, vm_event_response_t *rsp)
     }
 }
 
+/**
+ * p2m_mem_paging_harvest_accessed - Sample guest accesses for the pager
+ * @d: guest domain
+ * @gfn: first guest page
+ * @nr: number of guest pages
+ * @buffer: userspace bitmap of @nr bits
+ *
+ * Tests and clears the accessed bits of the 4k RAM mappings of
+ * [gfn, gfn + nr), setting the bits of the accessed ones in @buffer, so that
+ * the pager can evict the pages that went unused since the previous call
+ * instead of guessing.  The first call turns sampling on (it stays on until
+ * the pager goes away) and so finds nothing accessed.
+ */
+int p2m_mem_paging_harvest_accessed(struct domain *d, unsigned long gfn,
+                                    unsigned int nr, uint64_t buffer)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    void *user_ptr = (void *)buffer;
+    unsigned int done;
+    int rc;
+
+    if ( !p2m->test_clear_accessed )
+        return -EOPNOTSUPP;
+    if ( !nr || nr > XENMEM_PAGING_HARVEST_MAX || gfn + nr < gfn ||
+         !access_ok(user_ptr, DIV_ROUND_UP(nr, 8)) )
+        return -EINVAL;
+
+    if ( !test_and_set_bool(p2m->paging_accessed) )
+    {
+        domain_pause(d);
+        rc = p2m->track_accessed(p2m, true);
+        domain_unpause(d);
+        if ( rc )
+        {
+            p2m->paging_accessed = false;
+            return rc;
+        }
+    }
+
+    for ( done = 0; done < nr; done += 512 )
+    {
+        unsigned long accessed[BITS_TO_LONGS(512)] = { 0 };
+        unsigned int n = min(nr - done, 512u);
+
+        p2m_lock(p2m);
+        p2m->test_clear_accessed(p2m, gfn + done, n, accessed);
+        p2m_unlock(p2m);
+
+        if ( copy_to_user(user_ptr + done / 8, accessed, DIV_ROUND_UP(n, 8)) )
+            return -EFAULT;
+    }
+
+    return 0;
+}
+
+void p2m_mem_paging_disable(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+    ASSERT(atomic_read(&d->pause_count));
+
+    if ( test_and_clear_bool(p2m->paging_accessed) )
+        p2m->track_accessed(p2m, false);
+}
+
 void p2m_altp2m_check(struct vcpu *v, uint16_t idx)
 {
     if ( altp2m_active(v->domain) )
@@ -2461,6 +2529,8 @@ static void p2m_reset_altp2m(struct p2m_domain *p2m)
     ept_p2m_init(p2m);
     p2m->min_remapped_gfn = gfn_x(INVALID_GFN);
     p2m->max_remapped_gfn = 0;
+    p2m->min_mapped_pfn = gfn_x(INVALID_GFN);
+    p2m->max_mapped_pfn = 0;
 }
 
 void p2m_altp2m_propagate_change(struct domain *d, gfn_t gfn,
@@ -2486,6 +2556,16 @@ void p2m_altp2m_propagate_change(struct domain *d, gfn_t gfn,
             continue;
 
         p2m = d->arch.altp2m_p2m[i];
+
+        /*
+         * Views are filled lazily from the host p2m, so most of them hold
+         * only a fraction of its entries.  Don't bother walking one that
+         * has never mapped anything in the changed range.
+         */
+        if ( gfn_x(gfn) + (1UL << page_order) - 1 < p2m->min_mapped_pfn ||
+             gfn_x(gfn) > p2m->max_mapped_pfn )
+            continue;
+
         m = get_gfn_type_access(p2m, gfn_x(gfn), &t, &a, 0, NULL);
 
         /* Check for a dropped page that may impact this altp2m */
@@ -2519,7 +2599,13 @@ void p2m_altp2m_propagate_change(struct domain *d, gfn_t gfn,
             }
         }
         else if ( !mfn_eq(m, INVALID_MFN) )
-            p2m_set_entry(p2m, gfn, mfn, page_order, p2mt, p2ma);
+            /*
+             * Drop the stale entry rather than copying the new one in:
+             * p2m_altp2m_lazy_copy() fetches it again if the view still
+             * needs it, and views don't accumulate entries they don't use.
+             */
+            p2m_set_entry(p2m, gfn, INVALID_MFN, page_order, p2m_invalid,
+                          p2m->default_access);
 
         __put_gfn(p2m, gfn_x(gfn));
     }
@@ -2736,6 +2822,149 @@ out:
         rcu_unlock_domain(fdom);
     return rc;
 }
+
+/*
+ * Superpage recoalescing.  Log-dirty, mem_access and PoD sweeps shatter
+ * superpages, and nothing merges them back once the reason is gone.  When
+ * enabled, a tasklet run every p2m_recoalesce milliseconds walks one HAP
+ * domain at a time, looking for naturally aligned ranges of contiguous,
+ * identically typed RAM and replacing them by a single 2M or 1G entry.
+ * Each run examines at most RECOALESCE_BUDGET entries.
+ */
+static unsigned int __read_mostly opt_p2m_recoalesce;
+integer_param("p2m_recoalesce", opt_p2m_recoalesce);
+
+#define RECOALESCE_BUDGET 4096
+
+static struct timer p2m_recoalesce_timer;
+static struct tasklet p2m_recoalesce_tasklet;
+static domid_t p2m_recoalesce_domid;
+
+/*
+ * Can [gfn, gfn + 2^order) be mapped by a single entry?  Every entry must
+ * be an order - PAGE_ORDER_2M sized mapping of default-access RAM, the
+ * frames contiguous and aligned, and the range of uniform memory type.
+ */
+static bool p2m_recoalesce_check(struct p2m_domain *p2m, unsigned long gfn,
+                                 unsigned int order, mfn_t *mfn,
+                                 unsigned int *examined)
+{
+    unsigned int sub = order - PAGE_ORDER_2M, cur;
+    unsigned long i;
+    p2m_type_t t;
+    p2m_access_t a;
+    uint8_t ipat;
+
+    for ( i = 0; i < (1UL << order); i += 1UL << sub )
+    {
+        mfn_t m = p2m->get_entry(p2m, _gfn(gfn + i), &t, &a, 0, &cur, NULL);
+
+        ++*examined;
+        if ( !i )
+        {
+            *mfn = m;
+            if ( !mfn_valid(m) || (mfn_x(m) & ((1UL << order) - 1)) )
+                return false;
+        }
+        if ( cur != sub || t != p2m_ram_rw || a != p2m->default_access ||
+             !mfn_eq(m, mfn_add(*mfn, i)) )
+            return false;
+    }
+
+    return !cpu_has_vmx ||
+           epte_get_entry_emt(p2m->domain, gfn, *mfn, order, &ipat, 0) >= 0;
+}
+
+/* Returns the number of entries examined, stopping once gfn wraps. */
+static unsigned int p2m_recoalesce_domain(struct domain *d,
+                                          unsigned int budget)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long gfn = p2m->recoalesce.next_gfn;
+    unsigned int examined = 0;
+    mfn_t mfn;
+
+    while ( examined < budget )
+    {
+        p2m_lock(p2m);
+
+        if ( d->is_dying || gfn > p2m->max_mapped_pfn ||
+             paging_mode_log_dirty(d) )
+        {
+            p2m_unlock(p2m);
+            gfn = 0;
+            break;
+        }
+
+        if ( p2m_recoalesce_check(p2m, gfn, PAGE_ORDER_2M, &mfn, &examined) &&
+             !p2m_set_entry(p2m, _gfn(gfn), mfn, PAGE_ORDER_2M, p2m_ram_rw,
+                            p2m->default_access) )
+            p2m->recoalesce.merged_2m++;
+
+        gfn += 1UL << PAGE_ORDER_2M;
+
+        if ( hap_has_1gb && !(gfn & ((1UL << PAGE_ORDER_1G) - 1)) &&
+             p2m_recoalesce_check(p2m, gfn - (1UL << PAGE_ORDER_1G),
+                                  PAGE_ORDER_1G, &mfn, &examined) &&
+             !p2m_set_entry(p2m, _gfn(gfn - (1UL << PAGE_ORDER_1G)), mfn,
+                            PAGE_ORDER_1G, p2m_ram_rw, p2m->default_access) )
+            p2m->recoalesce.merged_1g++;
+
+        p2m_unlock(p2m);
+    }
+
+    p2m->recoalesce.next_gfn = gfn;
+
+    return examined;
+}
+
+static void p2m_recoalesce_work(unsigned long unused)
+{
+    struct domain *d;
+    unsigned int budget = RECOALESCE_BUDGET;
+
+    rcu_read_lock(&domlist_read_lock);
+
+    for_each_domain ( d )
+    {
+        if ( d->domain_id < p2m_recoalesce_domid || d->is_dying ||
+             !paging_mode_hap(d) || altp2m_active(d) )
+            continue;
+
+        budget -= min(budget, p2m_recoalesce_domain(d, budget));
+        if ( !budget )
+            break;
+
+        /* Domain completed; move on to the next one. */
+        p2m_recoalesce_domid = d->domain_id + 1;
+    }
+
+    if ( !d )
+        p2m_recoalesce_domid = 0;
+
+    rcu_read_unlock(&domlist_read_lock);
+}
+
+static void p2m_recoalesce_tick(void *unused)
+{
+    tasklet_schedule(&p2m_recoalesce_tasklet);
+    set_timer(&p2m_recoalesce_timer,
+              NOW() + MILLISECS(opt_p2m_recoalesce));
+}
+
+static int __init p2m_recoalesce_init(void)
+{
+    if ( !opt_p2m_recoalesce || !hvm_enabled || !hap_has_2mb )
+        return 0;
+
+    tasklet_init(&p2m_recoalesce_tasklet, p2m_recoalesce_work, 0);
+    init_timer(&p2m_recoalesce_timer, p2m_recoalesce_tick, NULL, 0);
+    set_timer(&p2m_recoalesce_timer, NOW() + MILLISECS(opt_p2m_recoalesce));
+
+    return 0;
+}
+__initcall(p2m_recoalesce_init);
+
 /*
  * Local variables:
  * mode: C
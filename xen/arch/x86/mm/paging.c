@@ -233,6 +233,14 @@ int paging_log_dirty_enable(struct domain *d, bool_t log_global)
 
     domain_pause(d);
     ret = d->arch.paging.log_dirty.ops->enable(d, log_global);
+    if ( !ret )
+    {
+        paging_lock(d);
+        d->arch.paging.log_dirty.rate_pages = 0;
+        d->arch.paging.log_dirty.rate_stamp = NOW();
+        d->arch.paging.log_dirty.dirty_rate = 0;
+        paging_unlock(d);
+    }
     domain_unpause(d);
 
     return ret;
@@ -292,6 +300,17 @@ void paging_mark_pfn_dirty(struct domain *d, pfn_t pfn)
     /* Recursive: this is called from inside the shadow code */
     paging_lock_recursive(d);
 
+    /* With HAP, writes to tracked VRAM are also logged for the display. */
+    if ( hap_enabled(d) && d->arch.hvm_domain.dirty_vram )
+    {
+        struct sh_dirty_vram *dirty_vram = d->arch.hvm_domain.dirty_vram;
+        unsigned long i = pfn_x(pfn) - dirty_vram->begin_pfn;
+
+        if ( dirty_vram->dirty_bitmap && pfn_x(pfn) >= dirty_vram->begin_pfn &&
+             pfn_x(pfn) < dirty_vram->end_pfn )
+            dirty_vram->dirty_bitmap[i >> 3] |= 1 << (i & 7);
+    }
+
     if ( unlikely(!mfn_valid(d->arch.paging.log_dirty.top)) ) 
     {
          d->arch.paging.log_dirty.top = paging_new_log_dirty_node(d);
@@ -332,6 +351,7 @@ void paging_mark_pfn_dirty(struct domain *d, pfn_t pfn)
                      "d%d: marked mfn %" PRI_mfn " (pfn %" PRI_pfn ")\n",
                      d->domain_id, mfn_x(mfn), pfn_x(pfn));
         d->arch.paging.log_dirty.dirty_count++;
+        d->arch.paging.log_dirty.rate_pages++;
     }
 
 out:
@@ -340,6 +360,41 @@ out:
     return;
 }
 
+/*
+ * Shortest interval over which a dirty rate sample is taken.  Shorter
+ * intervals are folded into the next sample, to keep the estimate from
+ * being dominated by individual PML buffer flushes.
+ */
+#define LOGDIRTY_RATE_PERIOD MILLISECS(100)
+
+/*
+ * Update the smoothed dirty rate.  The rate counts pages changing from
+ * clean to dirty in the log-dirty bitmap, i.e. the rate at which work is
+ * created for the next round of a live migration.  Samples are combined
+ * with an exponentially weighted moving average giving the newest sample a
+ * weight of 1/4.
+ */
+void paging_log_dirty_sample(struct domain *d)
+{
+    struct log_dirty_domain *ld = &d->arch.paging.log_dirty;
+    s_time_t now = NOW(), elapsed;
+    unsigned long rate;
+
+    paging_lock_recursive(d);
+
+    elapsed = now - ld->rate_stamp;
+    if ( elapsed >= LOGDIRTY_RATE_PERIOD )
+    {
+        rate = (ld->rate_pages * SECONDS(1)) / elapsed;
+        ld->dirty_rate = ld->dirty_rate ? (3 * ld->dirty_rate + rate) / 4
+                                        : rate;
+        ld->rate_pages = 0;
+        ld->rate_stamp = now;
+    }
+
+    paging_unlock(d);
+}
+
 /* Mark a page as dirty */
 void paging_mark_dirty(struct domain *d, mfn_t gmfn)
 {
@@ -402,6 +457,129 @@ int paging_mfn_is_dirty(struct domain *d, mfn_t gmfn)
 }
 
 
+/* Leaves (chunks) of the log-dirty trie: pfns per leaf, leaves per l4 slot. */
+#define LOGDIRTY_LEAF_BITS (PAGE_SIZE * 8)
+#define LOGDIRTY_L4_SHIFT (PAGETABLE_ORDER * 2)
+
+/*
+ * Copy the leaves of the log-dirty trie with dirty pages in the range
+ * [sc->start_pfn, sc->start_pfn + sc->pages) to the caller, as chunks, and
+ * clear the range in each one if cleaning.  Missing interior nodes are
+ * skipped without visiting the leaves below them.  Called with the paging
+ * lock held; progress for a continuation is kept in the preempt state.
+ */
+static int paging_log_dirty_sparse(struct domain *d,
+                                   struct xen_domctl_shadow_op *sc,
+                                   bool clean, unsigned long *covered)
+{
+    unsigned long start = sc->start_pfn, end = sc->start_pfn + sc->pages;
+    unsigned long first = start / LOGDIRTY_LEAF_BITS;
+    unsigned long last = (end - 1) / LOGDIRTY_LEAF_BITS;
+    unsigned long leaf, chunks = d->arch.paging.preempt.log_dirty.done;
+    unsigned int i2, lo, hi;
+    mfn_t *l4, *l3, *l2, mfn;
+    unsigned long *l1;
+    int rv = 0;
+
+    *covered = sc->pages;
+
+    l4 = paging_map_log_dirty_bitmap(d);
+    if ( !l4 )
+        goto out;
+
+    leaf = max(first,
+               ((unsigned long)d->arch.paging.preempt.log_dirty.i4 <<
+                LOGDIRTY_L4_SHIFT) |
+               ((unsigned long)d->arch.paging.preempt.log_dirty.i3 <<
+                PAGETABLE_ORDER));
+
+    while ( leaf <= last )
+    {
+        mfn = l4[leaf >> LOGDIRTY_L4_SHIFT];
+        if ( !mfn_valid(mfn) )
+        {
+            leaf = ((leaf >> LOGDIRTY_L4_SHIFT) + 1) << LOGDIRTY_L4_SHIFT;
+            continue;
+        }
+
+        l3 = map_domain_page(mfn);
+        mfn = l3[(leaf >> PAGETABLE_ORDER) & (LOGDIRTY_NODE_ENTRIES - 1)];
+        unmap_domain_page(l3);
+        if ( !mfn_valid(mfn) )
+        {
+            leaf = ((leaf >> PAGETABLE_ORDER) + 1) << PAGETABLE_ORDER;
+            continue;
+        }
+
+        l2 = map_domain_page(mfn);
+        for ( i2 = leaf & (LOGDIRTY_NODE_ENTRIES - 1);
+              i2 < LOGDIRTY_NODE_ENTRIES && leaf <= last;
+              i2++, leaf++ )
+        {
+            if ( !mfn_valid(l2[i2]) )
+                continue;
+
+            lo = leaf == first ? start % LOGDIRTY_LEAF_BITS : 0;
+            hi = leaf == last ? (end - 1) % LOGDIRTY_LEAF_BITS + 1
+                              : LOGDIRTY_LEAF_BITS;
+
+            l1 = map_domain_page(l2[i2]);
+            if ( find_next_bit(l1, hi, lo) < hi )
+            {
+                uint64_t pfn = (uint64_t)leaf * LOGDIRTY_LEAF_BITS;
+                unsigned long off = chunks * PAGE_SIZE;
+
+                if ( chunks == sc->nr_chunks )
+                {
+                    /* Out of buffer space: report the range up to here. */
+                    unmap_domain_page(l1);
+                    *covered = pfn + lo - start;
+                    leaf = last + 1;
+                    break;
+                }
+
+                if ( copy_to_guest_offset(sc->chunk_pfns, chunks, &pfn, 1) ||
+                     clear_guest_offset(sc->dirty_bitmap, off, lo / 8) ||
+                     copy_to_guest_offset(sc->dirty_bitmap, off + lo / 8,
+                                          (uint8_t *)l1 + lo / 8,
+                                          (hi - lo) / 8) ||
+                     clear_guest_offset(sc->dirty_bitmap, off + hi / 8,
+                                        PAGE_SIZE - hi / 8) )
+                {
+                    unmap_domain_page(l1);
+                    unmap_domain_page(l2);
+                    rv = -EFAULT;
+                    goto out;
+                }
+                chunks++;
+
+                if ( clean )
+                    memset((uint8_t *)l1 + lo / 8, 0, (hi - lo) / 8);
+            }
+            unmap_domain_page(l1);
+        }
+        unmap_domain_page(l2);
+
+        if ( leaf <= last && hypercall_preempt_check() )
+        {
+            d->arch.paging.preempt.log_dirty.i4 = leaf >> LOGDIRTY_L4_SHIFT;
+            d->arch.paging.preempt.log_dirty.i3 =
+                (leaf >> PAGETABLE_ORDER) & (LOGDIRTY_NODE_ENTRIES - 1);
+            rv = -ERESTART;
+            break;
+        }
+    }
+
+ out:
+    if ( l4 )
+        unmap_domain_page(l4);
+
+    d->arch.paging.preempt.log_dirty.done = chunks;
+    sc->nr_chunks = chunks;
+
+    return rv;
+}
+
 /* Read a domain's log-dirty bitmap and stats.  If the operation is a CLEAN,
  * clear the bitmap and stats as well. */
 static int paging_log_dirty_op(struct domain *d,
@@ -409,6 +587,8 @@ static int paging_log_dirty_op(struct domain *d,
                                bool_t resuming)
 {
     int rv = 0, clean = 0, peek = 1;
+    bool sparse = (sc->op == XEN_DOMCTL_SHADOW_OP_PEEK_SPARSE ||
+                   sc->op == XEN_DOMCTL_SHADOW_OP_CLEAN_SPARSE);
     unsigned long pages = 0;
     mfn_t *l4 = NULL, *l3 = NULL, *l2 = NULL;
     unsigned long *l1 = NULL;
@@ -448,7 +628,8 @@ static int paging_log_dirty_op(struct domain *d,
         return -EBUSY;
     }
 
-    clean = (sc->op == XEN_DOMCTL_SHADOW_OP_CLEAN);
+    clean = (sc->op == XEN_DOMCTL_SHADOW_OP_CLEAN ||
+             sc->op == XEN_DOMCTL_SHADOW_OP_CLEAN_SPARSE);
 
     PAGING_DEBUG(LOGDIRTY, "log-dirty %s: dom %u faults=%u dirty=%u\n",
                  (clean) ? "clean" : "peek",
@@ -471,6 +652,14 @@ static int paging_log_dirty_op(struct domain *d,
         goto out;
     }
 
+    if ( sparse )
+    {
+        rv = paging_log_dirty_sparse(d, sc, clean, &pages);
+        if ( rv && rv != -ERESTART )
+            goto out;
+        goto done;
+    }
+
     l4 = paging_map_log_dirty_bitmap(d);
     i4 = d->arch.paging.preempt.log_dirty.i4;
     i3 = d->arch.paging.preempt.log_dirty.i3;
@@ -539,6 +728,7 @@ static int paging_log_dirty_op(struct domain *d,
     if ( l4 )
         unmap_domain_page(l4);
 
+ done:
     if ( !rv )
     {
         d->arch.paging.preempt.dom = NULL;
@@ -552,7 +742,8 @@ static int paging_log_dirty_op(struct domain *d,
     {
         d->arch.paging.preempt.dom = current->domain;
         d->arch.paging.preempt.op = sc->op;
-        d->arch.paging.preempt.log_dirty.done = pages;
+        if ( !sparse )
+            d->arch.paging.preempt.log_dirty.done = pages;
     }
 
     paging_unlock(d);
@@ -566,7 +757,18 @@ static int paging_log_dirty_op(struct domain *d,
 
     if ( pages < sc->pages )
         sc->pages = pages;
-    if ( clean )
+    if ( clean && sparse && hap_enabled(d) )
+    {
+        /* Only the range cleaned needs write-protecting again. */
+        if ( sc->pages )
+        {
+            p2m_change_type_range(d, sc->start_pfn,
+                                  sc->start_pfn + sc->pages,
+                                  p2m_ram_rw, p2m_ram_logdirty);
+            flush_tlb_mask(d->domain_dirty_cpumask);
+        }
+    }
+    else if ( clean )
     {
         /* We need to further call clean_dirty_bitmap() functions of specific
          * paging modes (shadow or hap).  Safe because the domain is paused. */
@@ -592,36 +794,6 @@ static int paging_log_dirty_op(struct domain *d,
     return rv;
 }
 
-void paging_log_dirty_range(struct domain *d,
-                           unsigned long begin_pfn,
-                           unsigned long nr,
-                           uint8_t *dirty_bitmap)
-{
-    struct p2m_domain *p2m = p2m_get_hostp2m(d);
-    int i;
-    unsigned long pfn;
-
-    /*
-     * Set l1e entries of P2M table to be read-only.
-     *
-     * On first write, it page faults, its entry is changed to read-write,
-     * and on retry the write succeeds.
-     *
-     * We populate dirty_bitmap by looking for entries that have been
-     * switched to read-write.
-     */
-
-    p2m_lock(p2m);
-
-    for ( i = 0, pfn = begin_pfn; pfn < begin_pfn + nr; i++, pfn++ )
-        if ( !p2m_change_type_one(d, pfn, p2m_ram_rw, p2m_ram_logdirty) )
-            dirty_bitmap[i >> 3] |= (1 << (i & 7));
-
-    p2m_unlock(p2m);
-
-    flush_tlb_mask(d->domain_dirty_cpumask);
-}
-
 /*
  * Callers must supply log_dirty_ops for the log dirty code to call. This
  * function usually is invoked when paging is enabled. Check shadow_enable()
@@ -704,7 +876,8 @@ int paging_domctl(struct domain *d, struct xen_domctl_shadow_op *sc,
          ? (d->arch.paging.preempt.dom != current->domain ||
             d->arch.paging.preempt.op != sc->op)
          : (d->arch.paging.preempt.dom &&
-            sc->op != XEN_DOMCTL_SHADOW_OP_GET_ALLOCATION) )
+            sc->op != XEN_DOMCTL_SHADOW_OP_GET_ALLOCATION &&
+            sc->op != XEN_DOMCTL_SHADOW_OP_GET_DIRTY_RATE) )
     {
         printk(XENLOG_G_DEBUG
                "%pv: Paging op %#x on Dom%u with unfinished prior op %#x by Dom%u\n",
@@ -745,6 +918,27 @@ int paging_domctl(struct domain *d, struct xen_domctl_shadow_op *sc,
         if ( sc->mode & ~XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL )
             return -EINVAL;
         return paging_log_dirty_op(d, sc, resuming);
+
+    case XEN_DOMCTL_SHADOW_OP_PEEK_SPARSE:
+    case XEN_DOMCTL_SHADOW_OP_CLEAN_SPARSE:
+        if ( (sc->mode & ~XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL) ||
+             !sc->pages || (sc->start_pfn | sc->pages) % 8 ||
+             sc->start_pfn + sc->pages < sc->start_pfn ||
+             sc->start_pfn + sc->pages >
+             ((uint64_t)LOGDIRTY_LEAF_BITS << (PAGETABLE_ORDER * 3)) )
+            return -EINVAL;
+        return paging_log_dirty_op(d, sc, resuming);
+
+    case XEN_DOMCTL_SHADOW_OP_GET_DIRTY_RATE:
+        if ( !paging_mode_log_dirty(d) )
+            return -EINVAL;
+        paging_log_dirty_sample(d);
+        paging_lock(d);
+        sc->pages = d->arch.paging.log_dirty.dirty_rate;
+        sc->stats.fault_count = d->arch.paging.log_dirty.fault_count;
+        sc->stats.dirty_count = d->arch.paging.log_dirty.dirty_count;
+        paging_unlock(d);
+        return 0;
     }
 
     /* Here, dispatch domctl to the appropriate paging code */
@@ -890,6 +1084,14 @@ void paging_dump_domain_info(struct domain *d)
         if ( paging_mode_external(d) )
             printk("external ");
         printk("\n");
+
+        if ( paging_mode_hap(d) )
+        {
+            const struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+            printk("    p2m superpages recoalesced: %lu 2M, %lu 1G\n",
+                   p2m->recoalesce.merged_2m, p2m->recoalesce.merged_1g);
+        }
     }
 }
 
@@ -43,6 +43,7 @@ DEFINE_PER_CPU(uint32_t,trace_shadow_path_flags);
 static int sh_enable_log_dirty(struct domain *, bool log_global);
 static int sh_disable_log_dirty(struct domain *);
 static void sh_clean_dirty_bitmap(struct domain *);
+static void shadow_hash_resize(struct domain *);
 
 /* Set up the shadow-specific parts of a domain struct at start of day.
  * Called for every domain from arch_domain_create() */
@@ -608,8 +609,10 @@ void oos_fixup_add(struct domain *d, mfn_t gmfn,
     BUG();
 }
 
+/* If @flush is non-NULL, the TLB flush needed is left to the caller, who
+ * must do it before relying on the page having no writable mappings. */
 static int oos_remove_write_access(struct vcpu *v, mfn_t gmfn,
-                                   struct oos_fixup *fixup)
+                                   struct oos_fixup *fixup, bool *flush)
 {
     struct domain *d = v->domain;
     int ftlb = 0;
@@ -637,7 +640,12 @@ static int oos_remove_write_access(struct vcpu *v, mfn_t gmfn,
     }
 
     if ( ftlb )
-        flush_tlb_mask(d->domain_dirty_cpumask);
+    {
+        if ( flush )
+            *flush = true;
+        else
+            flush_tlb_mask(d->domain_dirty_cpumask);
+    }
 
     return 0;
 }
@@ -653,12 +661,11 @@ static inline void trace_resync(int event, mfn_t gmfn)
     }
 }
 
-/* Pull all the entries on an out-of-sync page back into sync. */
-static void _sh_resync(struct vcpu *v, mfn_t gmfn,
-                       struct oos_fixup *fixup, mfn_t snp)
+/* Pull write access to an out-of-sync page, so that it can be resynced and
+ * *stay* in sync.  Returns non-zero if the page got unshadowed instead. */
+static int _sh_resync_write_protect(struct vcpu *v, mfn_t gmfn,
+                                    struct oos_fixup *fixup, bool *flush)
 {
-    struct page_info *pg = mfn_to_page(gmfn);
-
     ASSERT(paging_locked_by_me(v->domain));
     ASSERT(mfn_is_out_of_sync(gmfn));
     /* Guest page must be shadowed *only* as L1 when out of sync. */
@@ -668,25 +675,67 @@ static void _sh_resync(struct vcpu *v, mfn_t gmfn,
 
     SHADOW_PRINTK("%pv gmfn=%"PRI_mfn"\n", v, mfn_x(gmfn));
 
-    /* Need to pull write access so the page *stays* in sync. */
-    if ( oos_remove_write_access(v, gmfn, fixup) )
+    if ( oos_remove_write_access(v, gmfn, fixup, flush) )
     {
         /* Page has been unshadowed. */
-        return;
+        return 1;
     }
 
     /* No more writable mappings of this page, please */
-    pg->shadow_flags &= ~SHF_oos_may_write;
+    mfn_to_page(gmfn)->shadow_flags &= ~SHF_oos_may_write;
 
+    return 0;
+}
+
+/* Update the shadows of a write-protected out-of-sync page. */
+static void _sh_resync_contents(struct vcpu *v, mfn_t gmfn, mfn_t snp)
+{
     /* Update the shadows with current guest entries. */
     _sh_resync_l1(v, gmfn, snp);
 
     /* Now we know all the entries are synced, and will stay that way */
-    pg->shadow_flags &= ~SHF_out_of_sync;
+    mfn_to_page(gmfn)->shadow_flags &= ~SHF_out_of_sync;
     perfc_incr(shadow_resync);
     trace_resync(TRC_SHADOW_RESYNC_FULL, gmfn);
 }
 
+/* Pull all the entries on an out-of-sync page back into sync. */
+static void _sh_resync(struct vcpu *v, mfn_t gmfn,
+                       struct oos_fixup *fixup, mfn_t snp)
+{
+    if ( !_sh_resync_write_protect(v, gmfn, fixup, NULL) )
+        _sh_resync_contents(v, gmfn, snp);
+}
+
+/* Resyncing many pages at once is done in two passes: write access is
+ * pulled from all of them first, so that a single TLB flush, done by the
+ * caller in between, covers the lot. */
+static void _sh_resync_batch_protect(struct vcpu *v, bool *flush)
+{
+    mfn_t *oos = v->arch.paging.shadow.oos;
+    struct oos_fixup *oos_fixup = v->arch.paging.shadow.oos_fixup;
+    int idx;
+
+    for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
+        if ( mfn_valid(oos[idx]) &&
+             _sh_resync_write_protect(v, oos[idx], &oos_fixup[idx], flush) )
+            oos[idx] = INVALID_MFN;
+}
+
+static void _sh_resync_batch_contents(struct vcpu *v)
+{
+    mfn_t *oos = v->arch.paging.shadow.oos;
+    mfn_t *oos_snapshot = v->arch.paging.shadow.oos_snapshot;
+    int idx;
+
+    for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
+        if ( mfn_valid(oos[idx]) )
+        {
+            _sh_resync_contents(v, oos[idx], oos_snapshot[idx]);
+            oos[idx] = INVALID_MFN;
+        }
+}
+
 
 /* Add an MFN to the list of out-of-sync guest pagetables */
 static void oos_hash_add(struct vcpu *v, mfn_t gmfn)
@@ -838,38 +887,47 @@ void sh_resync_all(struct vcpu *v, int skip, int this, int others)
 {
     int idx;
     struct vcpu *other;
-    mfn_t *oos = v->arch.paging.shadow.oos;
-    mfn_t *oos_snapshot = v->arch.paging.shadow.oos_snapshot;
-    struct oos_fixup *oos_fixup = v->arch.paging.shadow.oos_fixup;
+    mfn_t *oos;
+    mfn_t *oos_snapshot;
+    bool flush = false;
 
     SHADOW_PRINTK("%pv\n", v);
 
     ASSERT(paging_locked_by_me(v->domain));
 
-    if ( !this )
-        goto resync_others;
+    /* Write-protect all the pages to be brought back into sync... */
+    if ( this )
+        _sh_resync_batch_protect(v, &flush);
+    if ( others && !skip )
+        for_each_vcpu(v->domain, other)
+            if ( other != v )
+                _sh_resync_batch_protect(other, &flush);
 
-    /* First: resync all of this vcpu's oos pages */
-    for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
-        if ( mfn_valid(oos[idx]) )
-        {
-            /* Write-protect and sync contents */
-            _sh_resync(v, oos[idx], &oos_fixup[idx], oos_snapshot[idx]);
-            oos[idx] = INVALID_MFN;
-        }
+    if ( flush )
+    {
+        flush_tlb_mask(v->domain->domain_dirty_cpumask);
+        perfc_incr(shadow_resync_batch_flush);
+    }
 
- resync_others:
+    /* ... and then sync their contents. */
+    if ( this )
+        _sh_resync_batch_contents(v);
     if ( !others )
         return;
 
-    /* Second: make all *other* vcpus' oos pages safe. */
+    /* Make all *other* vcpus' oos pages safe. */
     for_each_vcpu(v->domain, other)
     {
         if ( v == other )
             continue;
 
+        if ( !skip )
+        {
+            _sh_resync_batch_contents(other);
+            continue;
+        }
+
         oos = other->arch.paging.shadow.oos;
-        oos_fixup = other->arch.paging.shadow.oos_fixup;
         oos_snapshot = other->arch.paging.shadow.oos_snapshot;
 
         for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
@@ -877,20 +935,11 @@ void sh_resync_all(struct vcpu *v, int skip, int this, int others)
             if ( !mfn_valid(oos[idx]) )
                 continue;
 
-            if ( skip )
-            {
-                /* Update the shadows and leave the page OOS. */
-                if ( sh_skip_sync(v, oos[idx]) )
-                    continue;
-                trace_resync(TRC_SHADOW_RESYNC_ONLY, oos[idx]);
-                _sh_resync_l1(other, oos[idx], oos_snapshot[idx]);
-            }
-            else
-            {
-                /* Write-protect and sync contents */
-                _sh_resync(other, oos[idx], &oos_fixup[idx], oos_snapshot[idx]);
-                oos[idx] = INVALID_MFN;
-            }
+            /* Update the shadows and leave the page OOS. */
+            if ( sh_skip_sync(v, oos[idx]) )
+                continue;
+            trace_resync(TRC_SHADOW_RESYNC_ONLY, oos[idx]);
+            _sh_resync_l1(other, oos[idx], oos_snapshot[idx]);
         }
     }
 }
@@ -1612,6 +1661,8 @@ int shadow_set_allocation(struct domain *d, unsigned int pages, bool *preempted)
         }
     }
 
+    shadow_hash_resize(d);
+
     return 0;
 }
 
@@ -1847,18 +1898,34 @@ void sh_emulate_unmap_dest(struct vcpu *v, void *addr, unsigned int bytes,
  * The table itself is an array of pointers to shadows; the shadows are then
  * threaded on a singly-linked list of shadows with the same hash value */
 
-#define SHADOW_HASH_BUCKETS 251
-/* Other possibly useful primes are 509, 1021, 2039, 4093, 8191, 16381 */
+/* The number of buckets follows the size of the shadow pool, so that the
+ * chains stay short however many shadows the domain may have. */
+static const unsigned int sh_hash_sizes[] = {
+    251, 509, 1021, 2039, 4093, 8191, 16381
+};
+
+static unsigned int shadow_hash_buckets(const struct domain *d)
+{
+    unsigned int i;
+
+    /* About one bucket per four pages of pool. */
+    for ( i = 0; i < ARRAY_SIZE(sh_hash_sizes) - 1; i++ )
+        if ( sh_hash_sizes[i] * 4 >= d->arch.paging.shadow.total_pages )
+            break;
+
+    return sh_hash_sizes[i];
+}
 
 /* Hash function that takes a gfn or mfn, plus another byte of type info */
 typedef u32 key_t;
-static inline key_t sh_hash(unsigned long n, unsigned int t)
+static inline key_t sh_hash(const struct domain *d, unsigned long n,
+                            unsigned int t)
 {
     unsigned char *p = (unsigned char *)&n;
     key_t k = t;
     int i;
     for ( i = 0; i < sizeof(n) ; i++ ) k = (u32)p[i] + (k<<6) + (k<<16) - k;
-    return k % SHADOW_HASH_BUCKETS;
+    return k % d->arch.paging.shadow.hash_buckets;
 }
 
 #if SHADOW_AUDIT & (SHADOW_AUDIT_HASH|SHADOW_AUDIT_HASH_FULL)
@@ -1884,7 +1951,7 @@ static void sh_hash_audit_bucket(struct domain *d, int bucket)
         /* Wrong page of a multi-page shadow? */
         BUG_ON( !sp->u.sh.head );
         /* Wrong bucket? */
-        BUG_ON( sh_hash(__backpointer(sp), sp->u.sh.type) != bucket );
+        BUG_ON( sh_hash(d, __backpointer(sp), sp->u.sh.type) != bucket );
         /* Duplicate entry? */
         for ( x = next_shadow(sp); x; x = next_shadow(x) )
             BUG_ON( x->v.sh.back == sp->v.sh.back &&
@@ -1949,7 +2016,7 @@ static void sh_hash_audit(struct domain *d)
     if ( !(SHADOW_AUDIT_ENABLE) )
         return;
 
-    for ( i = 0; i < SHADOW_HASH_BUCKETS; i++ )
+    for ( i = 0; i < d->arch.paging.shadow.hash_buckets; i++ )
     {
         sh_hash_audit_bucket(d, i);
     }
@@ -1964,16 +2031,55 @@ static void sh_hash_audit(struct domain *d)
 static int shadow_hash_alloc(struct domain *d)
 {
     struct page_info **table;
+    unsigned int buckets;
 
     ASSERT(paging_locked_by_me(d));
     ASSERT(!d->arch.paging.shadow.hash_table);
 
-    table = xzalloc_array(struct page_info *, SHADOW_HASH_BUCKETS);
+    buckets = shadow_hash_buckets(d);
+    table = xzalloc_array(struct page_info *, buckets);
     if ( !table ) return 1;
     d->arch.paging.shadow.hash_table = table;
+    d->arch.paging.shadow.hash_buckets = buckets;
     return 0;
 }
 
+/* Move the shadows to a table sized for the current pool.  Best effort:
+ * if the new table can't be allocated, the old one is kept. */
+static void shadow_hash_resize(struct domain *d)
+{
+    struct page_info **table, **old = d->arch.paging.shadow.hash_table;
+    struct page_info *sp, *next;
+    unsigned int i, buckets, old_buckets = d->arch.paging.shadow.hash_buckets;
+    key_t key;
+
+    ASSERT(paging_locked_by_me(d));
+
+    if ( !old || d->arch.paging.shadow.hash_walking )
+        return;
+
+    buckets = shadow_hash_buckets(d);
+    if ( buckets == old_buckets )
+        return;
+
+    table = xzalloc_array(struct page_info *, buckets);
+    if ( !table )
+        return;
+
+    d->arch.paging.shadow.hash_buckets = buckets;
+    for ( i = 0; i < old_buckets; i++ )
+        for ( sp = old[i]; sp; sp = next )
+        {
+            next = next_shadow(sp);
+            key = sh_hash(d, __backpointer(sp), sp->u.sh.type);
+            set_next_shadow(sp, table[key]);
+            table[key] = sp;
+        }
+
+    d->arch.paging.shadow.hash_table = table;
+    xfree(old);
+}
+
 /* Tear down the hash table and return all memory to Xen.
  * This function does not care whether the table is populated. */
 static void shadow_hash_teardown(struct domain *d)
@@ -2000,7 +2106,7 @@ mfn_t shadow_hash_lookup(struct domain *d, unsigned long n, unsigned int t)
     sh_hash_audit(d);
 
     perfc_incr(shadow_hash_lookups);
-    key = sh_hash(n, t);
+    key = sh_hash(d, n, t);
     sh_hash_audit_bucket(d, key);
 
     sp = d->arch.paging.shadow.hash_table[key];
@@ -2053,7 +2159,7 @@ void shadow_hash_insert(struct domain *d, unsigned long n, unsigned int t,
     sh_hash_audit(d);
 
     perfc_incr(shadow_hash_inserts);
-    key = sh_hash(n, t);
+    key = sh_hash(d, n, t);
     sh_hash_audit_bucket(d, key);
 
     /* Insert this shadow at the top of the bucket */
@@ -2078,7 +2184,7 @@ void shadow_hash_delete(struct domain *d, unsigned long n, unsigned int t,
     sh_hash_audit(d);
 
     perfc_incr(shadow_hash_deletes);
-    key = sh_hash(n, t);
+    key = sh_hash(d, n, t);
     sh_hash_audit_bucket(d, key);
 
     sp = mfn_to_page(smfn);
@@ -2135,7 +2241,7 @@ static void hash_vcpu_foreach(struct vcpu *v, unsigned int callback_mask,
     ASSERT(d->arch.paging.shadow.hash_walking == 0);
     d->arch.paging.shadow.hash_walking = 1;
 
-    for ( i = 0; i < SHADOW_HASH_BUCKETS; i++ )
+    for ( i = 0; i < d->arch.paging.shadow.hash_buckets; i++ )
     {
         /* WARNING: This is not safe against changes to the hash table.
          * The callback *must* return non-zero if it has inserted or
@@ -2182,7 +2288,7 @@ static void hash_domain_foreach(struct domain *d,
     ASSERT(d->arch.paging.shadow.hash_walking == 0);
     d->arch.paging.shadow.hash_walking = 1;
 
-    for ( i = 0; i < SHADOW_HASH_BUCKETS; i++ )
+    for ( i = 0; i < d->arch.paging.shadow.hash_buckets; i++ )
     {
         /* WARNING: This is not safe against changes to the hash table.
          * The callback *must* return non-zero if it has inserted or
@@ -119,6 +119,54 @@ bool monitored_msr(const struct domain *d, u32 msr)
     return test_bit(msr, bitmap);
 }
 
+int arch_monitor_set_access_filter(struct domain *d,
+                                   const struct xen_domctl_monitor_op *mop)
+{
+    struct monitor_access_filter *f;
+
+    BUILD_BUG_ON(MONITOR_ACCESS_FILTERS != XEN_DOMCTL_MONITOR_ACCESS_FILTERS);
+
+    if ( mop->event >= MONITOR_ACCESS_FILTERS ||
+         (mop->u.access_filter.access & ~MEM_ACCESS_RWX) ||
+         mop->u.access_filter.action > XEN_DOMCTL_MONITOR_FILTER_EMULATE_NOWRITE ||
+         mop->u.access_filter.gfn_start > mop->u.access_filter.gfn_end )
+        return -EINVAL;
+
+    /* Emulation is done on the vm_event resume path. */
+    if ( mop->u.access_filter.action != XEN_DOMCTL_MONITOR_FILTER_SEND &&
+         !(d->max_vcpus && d->vcpu[0] && d->vcpu[0]->arch.vm_event) )
+        return -EINVAL;
+
+    f = &d->arch.monitor.access_filter[mop->event];
+
+    domain_pause(d);
+    f->access = mop->u.access_filter.access;
+    f->action = mop->u.access_filter.action;
+    f->gfn_start = mop->u.access_filter.gfn_start;
+    f->gfn_end = mop->u.access_filter.gfn_end;
+    domain_unpause(d);
+
+    return 0;
+}
+
+/*
+ * What to do with a mem_access violation of type @access (MEM_ACCESS_*) on
+ * @gfn: the XEN_DOMCTL_MONITOR_FILTER_* action of the first filter matching.
+ */
+int monitor_access_filter(const struct domain *d, unsigned long gfn,
+                          unsigned int access)
+{
+    const struct monitor_access_filter *f = d->arch.monitor.access_filter;
+    unsigned int i;
+
+    for ( i = 0; i < MONITOR_ACCESS_FILTERS; i++, f++ )
+        if ( f->access && !(access & ~f->access) &&
+             gfn >= f->gfn_start && gfn <= f->gfn_end )
+            return f->action;
+
+    return XEN_DOMCTL_MONITOR_FILTER_SEND;
+}
+
 int arch_monitor_domctl_event(struct domain *d,
                               struct xen_domctl_monitor_op *mop)
 {
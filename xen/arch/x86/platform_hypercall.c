@@ -301,6 +301,54 @@ ret_t do_platform_op(XEN_GUEST_HANDLE_PARAM(xen_platform_op_t) u_xenpf_op)
     }
     break;
 
+    case XENPF_microcode_update2:
+    {
+        XEN_GUEST_HANDLE(const_void) data;
+        XEN_GUEST_HANDLE(xenpf_ucode_cpu_stat_t) stats;
+        struct xenpf_ucode_cpu_stat *st = NULL;
+        uint64_t total_ns = 0;
+        unsigned int nr = min_t(unsigned int, op->u.microcode2.nr_cpus,
+                                nr_cpu_ids);
+
+        ret = -EINVAL;
+        if ( op->u.microcode2.flags || op->u.microcode2.pad )
+            break;
+
+        guest_from_compat_handle(data, op->u.microcode2.data);
+        guest_from_compat_handle(stats, op->u.microcode2.stats);
+
+        ret = -ENOMEM;
+        if ( nr && !(st = xzalloc_array(struct xenpf_ucode_cpu_stat, nr)) )
+            break;
+
+        /* See XENPF_microcode_update. */
+        while ( !spin_trylock(&vcpu_alloc_lock) )
+        {
+            if ( hypercall_preempt_check() )
+            {
+                xfree(st);
+                ret = hypercall_create_continuation(
+                    __HYPERVISOR_platform_op, "h", u_xenpf_op);
+                goto out;
+            }
+        }
+
+        ret = microcode_update_parallel(
+                guest_handle_to_param(data, const_void),
+                op->u.microcode2.length, st, nr, &total_ns);
+        spin_unlock(&vcpu_alloc_lock);
+
+        /* Per-CPU results are returned even if the update failed. */
+        op->u.microcode2.nr_cpus = nr_cpu_ids;
+        op->u.microcode2.total_ns = total_ns;
+        if ( (nr && copy_to_guest(stats, st, nr)) ||
+             __copy_field_to_guest(u_xenpf_op, op, u.microcode2) )
+            ret = -EFAULT;
+
+        xfree(st);
+    }
+    break;
+
     case XENPF_platform_quirk:
     {
         int quirk_id = op->u.platform_quirk.quirk_id;
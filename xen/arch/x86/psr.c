@@ -18,6 +18,7 @@
 #include <xen/init.h>
 #include <xen/sched.h>
 #include <asm/psr.h>
+#include <public/sysctl.h>
 
 /*
  * Terminology:
@@ -580,6 +581,97 @@ void psr_free_rmid(struct domain *d)
     d->arch.psr_rmid = 0;
 }
 
+struct cmt_samples_info
+{
+    unsigned int nr;
+    const unsigned int *rmids;
+    struct xen_sysctl_psr_cmt_sample *samples;
+    uint64_t tsc;
+};
+
+static void do_read_cmt_samples(void *data)
+{
+    struct cmt_samples_info *info = data;
+    unsigned int i, evt;
+
+    for ( i = 0; i < info->nr; i++ )
+    {
+        uint64_t *val[] = {
+            &info->samples[i].l3_occupancy,
+            &info->samples[i].total_mem_count,
+            &info->samples[i].local_mem_count,
+        };
+
+        /* Event IDs are the bit positions in the feature mask plus one. */
+        for ( evt = 0; evt < ARRAY_SIZE(val); evt++ )
+        {
+            uint64_t ctr;
+
+            *val[evt] = XEN_SYSCTL_PSR_CMT_SAMPLE_INVALID;
+            if ( !(psr_cmt->l3.features & (1u << evt)) )
+                continue;
+
+            wrmsrl(MSR_IA32_CMT_EVTSEL,
+                   ((uint64_t)info->rmids[i] << 32) | (evt + 1));
+            rdmsrl(MSR_IA32_CMT_CTR, ctr);
+            /* Bit 63: error, bit 62: data unavailable. */
+            if ( !(ctr >> 62) )
+                *val[evt] = ctr * psr_cmt->l3.upscaling_factor;
+        }
+    }
+
+    info->tsc = rdtsc();
+}
+
+/*
+ * Read the monitoring data of up to *nr of the domains with an RMID on
+ * @socket, with a single IPI.  *nr is updated to the number of them.
+ */
+int psr_cmt_get_samples(unsigned int socket,
+                        struct xen_sysctl_psr_cmt_sample *samples,
+                        unsigned int *nr, uint64_t *tsc)
+{
+    struct cmt_samples_info info = { .samples = samples };
+    unsigned int *rmids, rmid, cpu, total = 0;
+
+    if ( socket >= nr_sockets || !socket_cpumask[socket] ||
+         (cpu = cpumask_any(socket_cpumask[socket])) >= nr_cpu_ids )
+        return -ENODEV;
+
+    rmids = xmalloc_array(unsigned int, *nr ?: 1);
+    if ( !rmids )
+        return -ENOMEM;
+
+    for ( rmid = 1; rmid <= psr_cmt->rmid_max; rmid++ )
+    {
+        domid_t domid = psr_cmt->rmid_to_dom[rmid];
+
+        if ( domid == DOMID_INVALID )
+            continue;
+
+        if ( total < *nr )
+        {
+            memset(&samples[total], 0, sizeof(samples[total]));
+            samples[total].domid = domid;
+            rmids[total] = rmid;
+        }
+        total++;
+    }
+
+    info.nr = min(total, *nr);
+    info.rmids = rmids;
+    if ( cpu == smp_processor_id() )
+        do_read_cmt_samples(&info);
+    else
+        on_selected_cpus(cpumask_of(cpu), do_read_cmt_samples, &info, 1);
+
+    xfree(rmids);
+    *nr = total;
+    *tsc = info.tsc;
+
+    return 0;
+}
+
 static unsigned int get_max_cos_max(const struct psr_socket_info *info)
 {
     unsigned int cos_max = 0, i;
@@ -790,6 +790,7 @@ static int write_cr(unsigned int reg, unsigned long val,
 
     case 4: /* Write CR4 */
         curr->arch.pv_vcpu.ctrlreg[4] = pv_guest_cr4_fixup(curr, val);
+        cpuid_cache_flush(curr);
         write_cr4(pv_guest_cr4_to_real_cr4(curr));
         ctxt_switch_levelling(curr);
         return X86EMUL_OKAY;
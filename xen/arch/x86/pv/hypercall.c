@@ -21,6 +21,7 @@
 
 #include <xen/compiler.h>
 #include <xen/hypercall.h>
+#include <xen/lat_hist.h>
 #include <xen/trace.h>
 
 #define HYPERCALL(x)                                                \
@@ -91,6 +92,7 @@ void pv_hypercall(struct cpu_user_regs *regs)
 {
     struct vcpu *curr = current;
     unsigned long eax;
+    s_time_t start;
 
     ASSERT(guest_kernel_mode(curr, regs));
 
@@ -107,6 +109,7 @@ void pv_hypercall(struct cpu_user_regs *regs)
     }
 
     curr->hcall_preempted = false;
+    start = lat_hist_start();
 
     if ( !is_pv_32bit_vcpu(curr) )
     {
@@ -212,6 +215,8 @@ void pv_hypercall(struct cpu_user_regs *regs)
     if ( curr->hcall_preempted )
         regs->rip -= 2;
 
+    lat_hist_end(XEN_SYSCTL_LAT_HIST_hypercall, eax, start);
+
     perfc_incr(hypercalls);
 }
 
@@ -0,0 +1,234 @@
+/*
+ * stack_sample.c: timer driven sampling of Xen's call stacks.
+ *
+ * With "stack_sample=<hz>" on the command line, each pCPU keeps a timer
+ * which makes sure its local APIC timer interrupt fires at least that often.
+ * When the interrupt arrives after the sample deadline, it records what was
+ * running: the current domain and vCPU, and either the guest's instruction
+ * pointer or, when Xen was interrupted, Xen's call stack.  Samples go into
+ * the per-pCPU trace buffers, so they are collected with xentrace and turned
+ * into flame graphs with xen-stack-fold and xen-syms.
+ *
+ * With CONFIG_FRAME_POINTER the stack is walked the same way as
+ * _show_trace() does; without it only the interrupted address is recorded.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <xen/cpu.h>
+#include <xen/init.h>
+#include <xen/kernel.h>
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <xen/timer.h>
+#include <xen/trace.h>
+#include <asm/current.h>
+#include <asm/regs.h>
+#include <asm/stack_sample.h>
+
+/* Frames recorded per sample, including the interrupted address. */
+#define STACK_SAMPLE_MAX_DEPTH  32
+
+/* Faster than this, the samples mostly measure the sampling. */
+#define STACK_SAMPLE_MAX_HZ     10000
+
+static unsigned int __initdata opt_stack_sample;
+integer_param("stack_sample", opt_stack_sample);
+
+s_time_t __read_mostly stack_sample_period;
+
+static DEFINE_PER_CPU(struct timer, stack_sample_timer);
+static DEFINE_PER_CPU(s_time_t, stack_sample_next);
+
+static unsigned int stack_sample_walk(const struct cpu_user_regs *regs,
+                                      uint64_t *pc, unsigned int *flags)
+{
+    unsigned int depth = 0;
+#ifdef CONFIG_FRAME_POINTER
+    unsigned long *frame, next, addr;
+    unsigned long low = regs->rsp, high = get_stack_trace_bottom(regs->rsp);
+#endif
+
+    pc[depth++] = regs->rip;
+
+#ifdef CONFIG_FRAME_POINTER
+    for ( next = regs->rbp; ; )
+    {
+        /* Valid frame pointer?  See _show_trace(). */
+        if ( (next < low) || (next >= high) )
+        {
+            next = ~next;
+            if ( (next < low) || (next >= high) )
+                break;
+            frame = (unsigned long *)next;
+            next  = frame[0];
+            addr  = frame[(offsetof(struct cpu_user_regs, rip) -
+                           offsetof(struct cpu_user_regs, rbp))
+                         / BYTES_PER_LONG];
+        }
+        else
+        {
+            frame = (unsigned long *)next;
+            next  = frame[0];
+            addr  = frame[1];
+        }
+
+        /* A stale frame pointer in a prologue or epilogue ends the walk. */
+        if ( !is_active_kernel_text(addr) )
+            break;
+
+        if ( depth == STACK_SAMPLE_MAX_DEPTH )
+        {
+            *flags |= TRC_HW_PROF_TRUNCATED;
+            break;
+        }
+
+        pc[depth++] = addr;
+        low = (unsigned long)&frame[2];
+    }
+#endif
+
+    return depth;
+}
+
+static void stack_sample_emit(const struct cpu_user_regs *regs)
+{
+    const struct vcpu *curr = current;
+    uint64_t pc[STACK_SAMPLE_MAX_DEPTH];
+    struct {
+        uint32_t vcpu;              /* domid << 16 | vcpu_id */
+        uint32_t info;              /* flags << 16 | depth */
+        uint64_t pc[2];
+    } hdr;
+    unsigned int depth = 0, flags = 0, i, n;
+
+    if ( !regs )
+        flags |= TRC_HW_PROF_MISSED;
+    else if ( guest_mode(regs) )
+    {
+        flags |= TRC_HW_PROF_GUEST;
+        pc[depth++] = regs->rip;
+    }
+    else
+        depth = stack_sample_walk(regs, pc, &flags);
+
+    hdr.vcpu = (curr->domain->domain_id << 16) | (uint16_t)curr->vcpu_id;
+    hdr.info = (flags << 16) | depth;
+    hdr.pc[0] = depth > 0 ? pc[0] : 0;
+    hdr.pc[1] = depth > 1 ? pc[1] : 0;
+    __trace_var(TRC_HW_PROF_SAMPLE, 1, sizeof(hdr), &hdr);
+
+    /*
+     * The rest of the stack follows in untimestamped records.  Interrupts
+     * are off, so nothing else gets into this pCPU's buffer in between.
+     */
+    for ( i = 2; i < depth; i += n )
+    {
+        n = min(depth - i, 3u);
+        __trace_var(TRC_HW_PROF_FRAMES, 0, n * sizeof(*pc), &pc[i]);
+    }
+}
+
+void stack_sample_record(const struct cpu_user_regs *regs)
+{
+    s_time_t now = NOW();
+
+    if ( now < this_cpu(stack_sample_next) )
+        return;
+
+    this_cpu(stack_sample_next) = now + stack_sample_period;
+
+    if ( tb_init_done )
+        stack_sample_emit(regs);
+}
+
+static void stack_sample_timer_fn(void *unused)
+{
+    unsigned long flags;
+
+    local_irq_save(flags);
+
+    /*
+     * No timer interrupt took the sample, so this pCPU was woken by some
+     * other means, typically the HPET broadcast out of a deep C state.
+     * Record that without a stack, to keep idle time in proportion.
+     */
+    if ( NOW() >= this_cpu(stack_sample_next) )
+        stack_sample_record(NULL);
+
+    set_timer(&this_cpu(stack_sample_timer), this_cpu(stack_sample_next));
+
+    local_irq_restore(flags);
+}
+
+static int cpu_stack_sample_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        per_cpu(stack_sample_next, cpu) = NOW() + stack_sample_period;
+        init_timer(&per_cpu(stack_sample_timer, cpu), stack_sample_timer_fn,
+                   NULL, cpu);
+        set_timer(&per_cpu(stack_sample_timer, cpu),
+                  per_cpu(stack_sample_next, cpu));
+        break;
+    case CPU_UP_CANCELED:
+    case CPU_DEAD:
+        kill_timer(&per_cpu(stack_sample_timer, cpu));
+        break;
+    default:
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_stack_sample_nfb = {
+    .notifier_call = cpu_stack_sample_callback
+};
+
+static int __init stack_sample_init(void)
+{
+    unsigned int cpu;
+
+    if ( !opt_stack_sample )
+        return 0;
+
+    if ( opt_stack_sample > STACK_SAMPLE_MAX_HZ )
+        opt_stack_sample = STACK_SAMPLE_MAX_HZ;
+
+    stack_sample_period = SECONDS(1) / opt_stack_sample;
+
+    for_each_online_cpu ( cpu )
+        cpu_stack_sample_callback(&cpu_stack_sample_nfb, CPU_UP_PREPARE,
+                                  (void *)(long)cpu);
+    register_cpu_notifier(&cpu_stack_sample_nfb);
+
+    printk(XENLOG_INFO "Sampling Xen stacks at %uHz%s\n", opt_stack_sample,
+           IS_ENABLED(CONFIG_FRAME_POINTER) ? "" : " (no frame pointers)");
+
+    return 0;
+}
+__initcall(stack_sample_init);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -30,6 +30,7 @@
 #include <xsm/xsm.h>
 #include <asm/psr.h>
 #include <asm/cpuid.h>
+#include <asm/pmu_sample.h>
 
 struct l3_cache_info {
     int ret;
@@ -160,6 +161,35 @@ long arch_do_sysctl(
         case XEN_SYSCTL_PSR_CMT_get_l3_event_mask:
             sysctl->u.psr_cmt_op.u.data = psr_cmt->l3.features;
             break;
+        case XEN_SYSCTL_PSR_CMT_get_samples:
+        {
+            struct xen_sysctl_psr_cmt_sample *samples = NULL;
+            unsigned int nr = sysctl->u.psr_cmt_op.u.samples.num;
+            uint64_t tsc;
+
+            if ( guest_handle_is_null(sysctl->u.psr_cmt_op.u.samples.samples) )
+                nr = 0;
+            nr = min(nr, psr_cmt->rmid_max);
+            if ( nr && !(samples = xmalloc_array(typeof(*samples), nr)) )
+            {
+                ret = -ENOMEM;
+                break;
+            }
+
+            ret = psr_cmt_get_samples(sysctl->u.psr_cmt_op.u.samples.socket,
+                                      samples, &nr, &tsc);
+            if ( !ret && samples &&
+                 copy_to_guest(sysctl->u.psr_cmt_op.u.samples.samples, samples,
+                               min(nr, sysctl->u.psr_cmt_op.u.samples.num)) )
+                ret = -EFAULT;
+            xfree(samples);
+            if ( ret )
+                break;
+
+            sysctl->u.psr_cmt_op.u.samples.num = nr;
+            sysctl->u.psr_cmt_op.u.samples.tsc = tsc;
+            break;
+        }
         default:
             sysctl->u.psr_cmt_op.u.data = 0;
             ret = -ENOSYS;
@@ -280,6 +310,12 @@ long arch_do_sysctl(
         break;
     }
 
+    case XEN_SYSCTL_pmu_sample:
+        ret = pmu_sample_op(&sysctl->u.pmu_sample);
+        if ( !ret && __copy_to_guest(u_sysctl, sysctl, 1) )
+            ret = -EFAULT;
+        break;
+
     default:
         ret = -ENOSYS;
         break;
@@ -1444,11 +1444,32 @@ static void time_calibration_nop_rendezvous(void *rv)
 static void (*time_calibration_rendezvous_fn)(void *) =
     time_calibration_std_rendezvous;
 
+/* Set when per-CPU stamps need syncing even if no rendezvous is needed. */
+static bool calibration_resync;
+
 static void time_calibration(void *unused)
 {
     struct calibration_rendezvous r = {
         .semaphore = ATOMIC_INIT(0)
     };
+    s_time_t start;
+
+    /*
+     * With TSC as the platform timer all CPUs share the scale the platform
+     * time uses, so once their stamps agree, extrapolating from them keeps
+     * giving platform time and there is nothing to calibrate.  Only keep
+     * the platform stamp fresh, and leave the other CPUs, and the guests'
+     * time info, alone.
+     */
+    if ( time_calibration_rendezvous_fn == time_calibration_nop_rendezvous &&
+         !calibration_resync )
+    {
+        perfc_incr(time_calibration_skipped);
+        set_timer(&calibration_timer, NOW() + EPOCH);
+        platform_time_calibration();
+        return;
+    }
+    calibration_resync = false;
 
     if ( clocksource_is_tsc() )
     {
@@ -1459,10 +1480,14 @@ static void time_calibration(void *unused)
 
     cpumask_copy(&r.cpu_calibration_map, &cpu_online_map);
 
+    start = NOW();
     /* @wait=1 because we must wait for all cpus before freeing @r. */
     on_selected_cpus(&r.cpu_calibration_map,
                      time_calibration_rendezvous_fn,
                      &r, 1);
+
+    perfc_incr(time_calibration_rendezvous);
+    perfc_add(time_calibration_us, (NOW() - start) / MICROSECS(1));
 }
 
 static struct cpu_time_stamp ap_bringup_ref;
@@ -1629,7 +1654,8 @@ static int __init verify_tsc_reliability(void)
             /*
              * We won't do CPU Hotplug and TSC clocksource is being used which
              * means we have a reliable TSC, plus we don't sync with any other
-             * clocksource so no need for rendezvous.
+             * clocksource so no need for rendezvous.  The stamps just set
+             * all agree, so time_calibration() won't even send IPIs.
              */
             time_calibration_rendezvous_fn = time_calibration_nop_rendezvous;
 
@@ -1805,6 +1831,8 @@ int time_resume(void)
 
     init_percpu_time();
 
+    /* The CPUs' stamps were taken one by one while they came back up. */
+    calibration_resync = true;
     set_timer(&calibration_timer, NOW() + EPOCH);
 
     do_settime(get_cmos_time() + cmos_utc_offset, 0, NOW());
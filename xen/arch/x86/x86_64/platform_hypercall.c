@@ -37,6 +37,10 @@ CHECK_pf_enter_acpi_sleep;
 CHECK_pf_resource_entry;
 #undef xen_pf_resource_entry
 
+#define xen_pf_ucode_cpu_stat xenpf_ucode_cpu_stat
+CHECK_pf_ucode_cpu_stat;
+#undef xen_pf_ucode_cpu_stat
+
 #define COMPAT
 #define _XEN_GUEST_HANDLE(t) XEN_GUEST_HANDLE(t)
 #define _XEN_GUEST_HANDLE_PARAM(t) XEN_GUEST_HANDLE_PARAM(t)
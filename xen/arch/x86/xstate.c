@@ -712,6 +712,7 @@ int handle_xsetbv(u32 index, u64 new_bv)
     mask = new_bv & ~curr->arch.xcr0_accum;
     curr->arch.xcr0 = new_bv;
     curr->arch.xcr0_accum |= new_bv;
+    cpuid_cache_flush(curr);
 
     /* LWP sets nonlazy_xstate_used independently. */
     if ( new_bv & (XSTATE_NONLAZY & ~XSTATE_LWP) )
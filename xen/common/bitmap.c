@@ -52,10 +52,17 @@ static void clamp_last_byte(uint8_t *bp, unsigned int nbits)
 		bp[nbits/8] &= (1U << remainder) - 1;
 }
 
+/*
+ * Large masks (cpumasks on big hosts) are mostly all-clear or all-set,
+ * so the whole-word loops below look at four words per iteration.
+ */
 int __bitmap_empty(const unsigned long *bitmap, int bits)
 {
-	int k, lim = bits/BITS_PER_LONG;
-	for (k = 0; k < lim; ++k)
+	int k = 0, lim = bits/BITS_PER_LONG;
+	for (; k + 4 <= lim; k += 4)
+		if (bitmap[k] | bitmap[k+1] | bitmap[k+2] | bitmap[k+3])
+			return 0;
+	for (; k < lim; ++k)
 		if (bitmap[k])
 			return 0;
 
@@ -69,8 +76,11 @@ EXPORT_SYMBOL(__bitmap_empty);
 
 int __bitmap_full(const unsigned long *bitmap, int bits)
 {
-	int k, lim = bits/BITS_PER_LONG;
-	for (k = 0; k < lim; ++k)
+	int k = 0, lim = bits/BITS_PER_LONG;
+	for (; k + 4 <= lim; k += 4)
+		if (~(bitmap[k] & bitmap[k+1] & bitmap[k+2] & bitmap[k+3]))
+			return 0;
+	for (; k < lim; ++k)
 		if (~bitmap[k])
 			return 0;
 
@@ -228,7 +228,8 @@ static int cpupool_destroy(struct cpupool *c)
 /*
  * Move domain to another cpupool
  */
-static int cpupool_move_domain_locked(struct domain *d, struct cpupool *c)
+static int cpupool_move_domain_locked(struct domain *d, struct cpupool *c,
+                                      struct sched_move_data *md)
 {
     int ret;
 
@@ -236,7 +237,7 @@ static int cpupool_move_domain_locked(struct domain *d, struct cpupool *c)
         return 0;
 
     d->cpupool->n_dom--;
-    ret = sched_move_domain(d, c);
+    ret = sched_move_domain(d, c, md);
     if ( ret )
         d->cpupool->n_dom++;
     else
@@ -246,14 +247,25 @@ static int cpupool_move_domain_locked(struct domain *d, struct cpupool *c)
 }
 int cpupool_move_domain(struct domain *d, struct cpupool *c)
 {
+    struct sched_move_data *md;
     int ret;
 
+    if ( d->cpupool == c )
+        return 0;
+
+    /* Allocate the new scheduler's data without holding cpupool_lock. */
+    md = sched_alloc_move_data(d, c);
+    if ( md == NULL )
+        return -ENOMEM;
+
     spin_lock(&cpupool_lock);
 
-    ret = cpupool_move_domain_locked(d, c);
+    ret = cpupool_move_domain_locked(d, c, md);
 
     spin_unlock(&cpupool_lock);
 
+    sched_free_move_data(md);
+
     return ret;
 }
 
@@ -390,7 +402,7 @@ static int cpupool_unassign_cpu(struct cpupool *c, unsigned int cpu)
                 ret = -EBUSY;
                 break;
             }
-            ret = cpupool_move_domain_locked(d, cpupool0);
+            ret = cpupool_move_domain_locked(d, cpupool0, NULL);
             if ( ret )
                 break;
         }
@@ -684,6 +696,7 @@ int cpupool_do_sysctl(struct xen_sysctl_cpupool_op *op)
     case XEN_SYSCTL_CPUPOOL_OP_MOVEDOMAIN:
     {
         struct domain *d;
+        struct sched_move_data *md;
 
         ret = rcu_lock_remote_domain_by_id(op->domid, &d);
         if ( ret )
@@ -703,13 +716,30 @@ int cpupool_do_sysctl(struct xen_sysctl_cpupool_op *op)
         cpupool_dprintk("cpupool move_domain(dom=%d)->pool=%d\n",
                         d->domain_id, op->cpupool_id);
         ret = -ENOENT;
-        spin_lock(&cpupool_lock);
+        c = cpupool_get_by_id(op->cpupool_id);
+        if ( c == NULL )
+        {
+            rcu_unlock_domain(d);
+            break;
+        }
 
-        c = cpupool_find_by_id(op->cpupool_id);
-        if ( (c != NULL) && cpumask_weight(c->cpu_valid) )
-            ret = cpupool_move_domain_locked(d, c);
+        /*
+         * Allocate the new scheduler's data up front: the cpupool lock is
+         * global, and this takes a while for domains with many vCPUs.
+         */
+        md = sched_alloc_move_data(d, c);
+        if ( md == NULL )
+            ret = -ENOMEM;
+        else
+        {
+            spin_lock(&cpupool_lock);
+            if ( cpumask_weight(c->cpu_valid) )
+                ret = cpupool_move_domain_locked(d, c, md);
+            spin_unlock(&cpupool_lock);
+            sched_free_move_data(md);
+        }
+        cpupool_put(c);
 
-        spin_unlock(&cpupool_lock);
         cpupool_dprintk("cpupool move_domain(dom=%d)->pool=%d ret %d\n",
                         d->domain_id, op->cpupool_id, ret);
         rcu_unlock_domain(d);
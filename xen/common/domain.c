@@ -882,6 +882,7 @@ void domain_destroy(struct domain *d)
 
     /* Schedule RCU asynchronous completion of domain destroy. */
     call_rcu(&d->rcu, complete_domain_destroy);
+    rcu_expedite();
 }
 
 void vcpu_pause(struct vcpu *v)
@@ -13,6 +13,31 @@
 #include <xen/sched.h>
 #include <xen/event.h>
 
+/*
+ * Record @port in @v's pending hint ring, if it has one.  Must happen
+ * before the selector bit is set, so that a guest that finds the bit
+ * clear after its own scan finds the port in the ring.
+ */
+static void evtchn_2l_hint(const struct vcpu *v, evtchn_port_t port)
+{
+    struct evtchn_2l_hint **hints = v->domain->evtchn_2l_hint;
+    struct evtchn_2l_hint *hint;
+    uint32_t idx;
+
+    if ( likely(!hints) || !(hint = read_atomic(&hints[v->vcpu_id])) )
+        return;
+
+    idx = arch_fetch_and_add(&hint->prod, 1);
+
+    /* A full ring is reported to the guest by prod running past cons. */
+    if ( idx - read_atomic(&hint->cons) >= EVTCHN_2L_HINT_SLOTS )
+        return;
+
+    write_atomic(&hint->ring[idx % EVTCHN_2L_HINT_SLOTS].port, port);
+    smp_wmb();
+    write_atomic(&hint->ring[idx % EVTCHN_2L_HINT_SLOTS].seq, idx);
+}
+
 static void evtchn_2l_set_pending(struct vcpu *v, struct evtchn *evtchn)
 {
     struct domain *d = v->domain;
@@ -28,11 +53,12 @@ static void evtchn_2l_set_pending(struct vcpu *v, struct evtchn *evtchn)
     if ( test_and_set_bit(port, &shared_info(d, evtchn_pending)) )
         return;
 
-    if ( !test_bit        (port, &shared_info(d, evtchn_mask)) &&
-         !test_and_set_bit(port / BITS_PER_EVTCHN_WORD(d),
-                           &vcpu_info(v, evtchn_pending_sel)) )
+    if ( !test_bit(port, &shared_info(d, evtchn_mask)) )
     {
-        vcpu_mark_events_pending(v);
+        evtchn_2l_hint(v, port);
+        if ( !test_and_set_bit(port / BITS_PER_EVTCHN_WORD(d),
+                               &vcpu_info(v, evtchn_pending_sel)) )
+            evtchn_notify_vcpu(v, evtchn);
     }
 
     evtchn_check_pollers(d, port);
@@ -53,11 +79,12 @@ static void evtchn_2l_unmask(struct domain *d, struct evtchn *evtchn)
      * evtchn_2l_set_pending() above.
      */
     if ( test_and_clear_bit(port, &shared_info(d, evtchn_mask)) &&
-         test_bit          (port, &shared_info(d, evtchn_pending)) &&
-         !test_and_set_bit (port / BITS_PER_EVTCHN_WORD(d),
-                            &vcpu_info(v, evtchn_pending_sel)) )
+         test_bit          (port, &shared_info(d, evtchn_pending)) )
     {
-        vcpu_mark_events_pending(v);
+        evtchn_2l_hint(v, port);
+        if ( !test_and_set_bit(port / BITS_PER_EVTCHN_WORD(d),
+                               &vcpu_info(v, evtchn_pending_sel)) )
+            vcpu_mark_events_pending(v);
     }
 }
 
@@ -102,6 +129,70 @@ void evtchn_2l_init(struct domain *d)
     d->max_evtchns = BITS_PER_EVTCHN_WORD(d) * BITS_PER_EVTCHN_WORD(d);
 }
 
+int evtchn_2l_register_hint(const struct evtchn_register_2l_hint *reg)
+{
+    struct domain *d = current->domain;
+    struct evtchn_2l_hint **hints;
+    struct vcpu *v;
+    void *virt;
+    int rc;
+
+    if ( reg->vcpu >= d->max_vcpus || !(v = d->vcpu[reg->vcpu]) )
+        return -ENOENT;
+
+    if ( (reg->offset & 7) ||
+         reg->offset > PAGE_SIZE - sizeof(struct evtchn_2l_hint) )
+        return -EINVAL;
+
+    spin_lock(&d->event_lock);
+
+    rc = -EINVAL;
+    if ( d->evtchn_fifo )
+        goto out;
+
+    hints = d->evtchn_2l_hint;
+    if ( !hints )
+    {
+        rc = -ENOMEM;
+        hints = xzalloc_array(struct evtchn_2l_hint *, d->max_vcpus);
+        if ( !hints )
+            goto out;
+        d->evtchn_2l_hint = hints;
+    }
+
+    rc = -EBUSY;
+    if ( hints[v->vcpu_id] )
+        goto out;
+
+    rc = evtchn_map_guest_page(d, reg->hint_gfn, &virt);
+    if ( rc )
+        goto out;
+
+    /* The ring only ever records ports from here on. */
+    memset(virt + reg->offset, 0, sizeof(struct evtchn_2l_hint));
+    smp_wmb();
+    write_atomic(&hints[v->vcpu_id],
+                 (struct evtchn_2l_hint *)(virt + reg->offset));
+
+ out:
+    spin_unlock(&d->event_lock);
+
+    return rc;
+}
+
+void evtchn_2l_destroy(struct domain *d)
+{
+    unsigned int i;
+
+    if ( !d->evtchn_2l_hint )
+        return;
+
+    for ( i = 0; i < d->max_vcpus; i++ )
+        evtchn_unmap_guest_page(d->evtchn_2l_hint[i]);
+    xfree(d->evtchn_2l_hint);
+    d->evtchn_2l_hint = NULL;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -25,6 +25,9 @@
 #include <xen/guest_access.h>
 #include <xen/keyhandler.h>
 #include <xen/event_fifo.h>
+#include <xen/lat_hist.h>
+#include <xen/paging.h>
+#include <xen/domain_page.h>
 #include <asm/current.h>
 
 #include <public/xen.h>
@@ -204,6 +207,7 @@ static void free_evtchn(struct domain *d, struct evtchn *chn)
     chn->state          = ECS_FREE;
     chn->notify_vcpu_id = 0;
     chn->xen_consumer   = 0;
+    chn->holdoff        = 0;
 
     xsm_evtchn_close_post(chn);
 }
@@ -654,10 +658,12 @@ int evtchn_send(struct domain *ld, unsigned int lport)
     struct evtchn *lchn, *rchn;
     struct domain *rd;
     int            rport, ret = 0;
+    s_time_t       start;
 
     if ( !port_is_valid(ld, lport) )
         return -EINVAL;
 
+    start = lat_hist_start();
     lchn = evtchn_from_port(ld, lport);
 
     spin_lock(&lchn->lock);
@@ -697,9 +703,44 @@ int evtchn_send(struct domain *ld, unsigned int lport)
 out:
     spin_unlock(&lchn->lock);
 
+    lat_hist_end(XEN_SYSCTL_LAT_HIST_evtchn_send, 0, start);
+
     return ret;
 }
 
+void evtchn_notify_vcpu(struct vcpu *v, const struct evtchn *evtchn)
+{
+    s_time_t now, notify_at;
+
+    if ( likely(!evtchn->holdoff) )
+    {
+        vcpu_mark_events_pending(v);
+        return;
+    }
+
+    now = NOW();
+    notify_at = v->evtchn_notified + evtchn->holdoff;
+    if ( now >= notify_at )
+    {
+        v->evtchn_notified = now;
+        vcpu_mark_events_pending(v);
+    }
+    /*
+     * Defer the upcall. Racing senders may push the timer out, delaying the
+     * notification by at most one further holdoff period.
+     */
+    else if ( !timer_expires_before(&v->evtchn_holdoff_timer, notify_at) )
+        set_timer(&v->evtchn_holdoff_timer, notify_at);
+}
+
+void evtchn_holdoff_timer_fn(void *data)
+{
+    struct vcpu *v = data;
+
+    v->evtchn_notified = NOW();
+    vcpu_mark_events_pending(v);
+}
+
 int guest_enabled_event(struct vcpu *v, uint32_t virq)
 {
     return ((v != NULL) && (v->virq_to_evtchn[virq] != 0));
@@ -1026,6 +1067,39 @@ static long evtchn_set_priority(const struct evtchn_set_priority *set_priority)
     return ret;
 }
 
+static long evtchn_set_holdoff(const struct evtchn_set_holdoff *set_holdoff)
+{
+    struct domain *d = current->domain;
+    unsigned int port = set_holdoff->port;
+    struct evtchn *chn;
+    long ret = 0;
+
+    if ( set_holdoff->holdoff_us > EVTCHN_HOLDOFF_MAX_US )
+        return -EINVAL;
+
+    spin_lock(&d->event_lock);
+
+    if ( !port_is_valid(d, port) )
+    {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    chn = evtchn_from_port(d, port);
+    if ( chn->state != ECS_INTERDOMAIN || consumer_is_xen(chn) )
+    {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    write_atomic(&chn->holdoff, MICROSECS(set_holdoff->holdoff_us));
+
+ out:
+    spin_unlock(&d->event_lock);
+
+    return ret;
+}
+
 long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
 {
     long rc;
@@ -1098,6 +1172,36 @@ long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
         break;
     }
 
+    case EVTCHNOP_send_batch: {
+        struct evtchn_send_batch batch;
+        unsigned int i;
+
+        if ( copy_from_guest(&batch, arg, 1) != 0 )
+            return -EFAULT;
+        if ( batch.nr_ports > EVTCHN_SEND_BATCH_MAX )
+            return -EINVAL;
+
+        /*
+         * Repeated sends to the same vCPU collapse on evtchn_upcall_pending;
+         * batching the kick softirqs turns the remaining per-vCPU kicks into
+         * at most one IPI per target pCPU.
+         */
+        rc = 0;
+        cpu_raise_softirq_batch_begin();
+        for ( i = 0; i < batch.nr_ports; i++ )
+        {
+            rc = evtchn_send(current->domain, batch.ports[i]);
+            if ( rc )
+                break;
+        }
+        cpu_raise_softirq_batch_finish();
+
+        batch.nr_sent = i;
+        if ( __copy_to_guest(arg, &batch, 1) )
+            rc = -EFAULT;
+        break;
+    }
+
     case EVTCHNOP_status: {
         struct evtchn_status status;
         if ( copy_from_guest(&status, arg, 1) != 0 )
@@ -1169,6 +1273,22 @@ long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
         break;
     }
 
+    case EVTCHNOP_set_holdoff: {
+        struct evtchn_set_holdoff set_holdoff;
+        if ( copy_from_guest(&set_holdoff, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_set_holdoff(&set_holdoff);
+        break;
+    }
+
+    case EVTCHNOP_register_2l_hint: {
+        struct evtchn_register_2l_hint register_2l_hint;
+        if ( copy_from_guest(&register_2l_hint, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_2l_register_hint(&register_2l_hint);
+        break;
+    }
+
     default:
         rc = -ENOSYS;
         break;
@@ -1265,6 +1385,43 @@ void evtchn_check_pollers(struct domain *d, unsigned int port)
     }
 }
 
+int evtchn_map_guest_page(struct domain *d, uint64_t gfn, void **virt)
+{
+    struct page_info *p;
+
+    p = get_page_from_gfn(d, gfn, NULL, P2M_ALLOC);
+    if ( !p )
+        return -EINVAL;
+
+    if ( !get_page_type(p, PGT_writable_page) )
+    {
+        put_page(p);
+        return -EINVAL;
+    }
+
+    *virt = __map_domain_page_global(p);
+    if ( !*virt )
+    {
+        put_page_and_type(p);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void evtchn_unmap_guest_page(void *virt)
+{
+    struct page_info *page;
+
+    if ( !virt )
+        return;
+
+    virt = (void *)((unsigned long)virt & PAGE_MASK);
+    page = mfn_to_page(domain_page_map_to_mfn(virt));
+
+    unmap_domain_page_global(virt);
+    put_page_and_type(page);
+}
+
 int evtchn_init(struct domain *d)
 {
     evtchn_2l_init(d);
@@ -1312,6 +1469,7 @@ void evtchn_destroy(struct domain *d)
     clear_global_virq_handlers(d);
 
     evtchn_fifo_destroy(d);
+    evtchn_2l_destroy(d);
 }
 
 
@@ -44,6 +44,7 @@ static void evtchn_fifo_init(struct domain *d, struct evtchn *evtchn)
     event_word_t *word;
 
     evtchn->priority = EVTCHN_FIFO_PRIORITY_DEFAULT;
+    evtchn->fifo_staged = false;
 
     /*
      * If this event is still linked, the first event may be delivered
@@ -149,6 +150,172 @@ static bool_t evtchn_fifo_set_link(const struct domain *d, event_word_t *word,
     return 1;
 }
 
+/*
+ * Link @evtchn, whose LINKED bit the caller has just set, at the tail of @q.
+ * The caller holds q's lock. Returns true if the guest must be notified, i.e.
+ * the queue was empty and its ready bit was clear.
+ */
+static bool evtchn_fifo_link(const struct domain *d, struct vcpu *v,
+                             struct evtchn_fifo_queue *q,
+                             struct evtchn *evtchn)
+{
+    unsigned int port = evtchn->port;
+    event_word_t *tail_word;
+    bool_t linked = 0;
+
+    /*
+     * If this event was a tail, the queue is now empty and its tail must be
+     * invalidated so that the event is not linked to itself.
+     */
+    if ( q->tail == port )
+        q->tail = 0;
+
+    /*
+     * Atomically link the tail to port iff the tail is linked.
+     * If the tail is unlinked the queue is empty.
+     *
+     * If the queue is empty (i.e., we haven't linked to the new
+     * event), head must be updated.
+     */
+    if ( q->tail )
+    {
+        tail_word = evtchn_fifo_word_from_port(d, q->tail);
+        linked = evtchn_fifo_set_link(d, tail_word, port);
+    }
+    if ( !linked )
+        write_atomic(q->head, port);
+    q->tail = port;
+
+    return !linked &&
+           !test_and_set_bit(q->priority, &v->evtchn_fifo->control_block->ready);
+}
+
+static void evtchn_fifo_link_slow(struct vcpu *v, struct evtchn *evtchn);
+
+/*
+ * Link every event staged on @q, then drop its lock and notify @v if needed,
+ * @notify being an event the caller has already linked and must notify for.
+ *
+ * Producers which find the queue lock busy leave their event on q->staged
+ * for the holder rather than spinning. After releasing the lock, check for
+ * events staged meanwhile and take the lock back if there are any, so that
+ * none is left behind.
+ */
+static void evtchn_fifo_unlock_queue(struct vcpu *v,
+                                     struct evtchn_fifo_queue *q,
+                                     unsigned long flags,
+                                     struct evtchn *notify)
+{
+    struct domain *d = v->domain;
+    struct evtchn *evtchn;
+    event_word_t *word;
+    uint32_t port, next, fifo, moved = 0;
+
+    do {
+        while ( (port = xchg(&q->staged, 0)) != 0 )
+        {
+            /* Reverse the LIFO so events are linked in arrival order. */
+            fifo = 0;
+            for ( ; port; port = next )
+            {
+                evtchn = evtchn_from_port(d, port);
+                next = evtchn->fifo_staged_next;
+                evtchn->fifo_staged_next = fifo;
+                fifo = port;
+            }
+
+            for ( port = fifo; port; port = next )
+            {
+                evtchn = evtchn_from_port(d, port);
+                next = evtchn->fifo_staged_next;
+
+                /* Requeued elsewhere since being staged?  Handle below. */
+                if ( unlikely(q != &d->vcpu[evtchn->last_vcpu_id]->
+                                     evtchn_fifo->queue[evtchn->last_priority]) )
+                {
+                    evtchn->fifo_staged_next = moved;
+                    moved = port;
+                    continue;
+                }
+
+                write_atomic(&evtchn->fifo_staged, false);
+                word = evtchn_fifo_word_from_port(d, port);
+                if ( !test_and_set_bit(EVTCHN_FIFO_LINKED, word) &&
+                     evtchn_fifo_link(d, v, q, evtchn) &&
+                     (!notify || (notify->holdoff && !evtchn->holdoff)) )
+                    notify = evtchn;
+            }
+        }
+
+        spin_unlock_irqrestore(&q->lock, flags);
+
+        /* Order the unlock before the check; pairs with staging's cmpxchg. */
+        smp_mb();
+    } while ( read_atomic(&q->staged) && spin_trylock_irqsave(&q->lock, flags) );
+
+    if ( notify )
+        evtchn_notify_vcpu(v, notify);
+
+    for ( port = moved; port; port = next )
+    {
+        evtchn = evtchn_from_port(d, port);
+        next = evtchn->fifo_staged_next;
+        write_atomic(&evtchn->fifo_staged, false);
+        evtchn_fifo_link_slow(v, evtchn);
+    }
+}
+
+/* Link an event whose queue may have changed since it was last linked. */
+static void evtchn_fifo_link_slow(struct vcpu *v, struct evtchn *evtchn)
+{
+    struct domain *d = v->domain;
+    unsigned int port = evtchn->port;
+    event_word_t *word = evtchn_fifo_word_from_port(d, port);
+    struct evtchn_fifo_queue *q, *old_q;
+    unsigned long flags;
+
+    /*
+     * No locking around getting the queue. This may race with
+     * changing the priority but we are allowed to signal the
+     * event once on the old priority.
+     */
+    q = &v->evtchn_fifo->queue[evtchn->priority];
+
+    old_q = lock_old_queue(d, evtchn, &flags);
+    if ( !old_q )
+        return;
+
+    if ( test_and_set_bit(EVTCHN_FIFO_LINKED, word) )
+    {
+        evtchn_fifo_unlock_queue(d->vcpu[evtchn->last_vcpu_id], old_q, flags,
+                                 NULL);
+        return;
+    }
+
+    /*
+     * If this event was a tail, the old queue is now empty and
+     * its tail must be invalidated to prevent adding an event to
+     * the old queue from corrupting the new queue.
+     */
+    if ( old_q->tail == port )
+        old_q->tail = 0;
+
+    /* Moved to a different queue? */
+    if ( old_q != q )
+    {
+        struct vcpu *old_v = d->vcpu[evtchn->last_vcpu_id];
+
+        evtchn->last_vcpu_id = evtchn->notify_vcpu_id;
+        evtchn->last_priority = evtchn->priority;
+
+        evtchn_fifo_unlock_queue(old_v, old_q, flags, NULL);
+        spin_lock_irqsave(&q->lock, flags);
+    }
+
+    evtchn_fifo_unlock_queue(v, q, flags,
+                             evtchn_fifo_link(d, v, q, evtchn) ? evtchn : NULL);
+}
+
 static void evtchn_fifo_set_pending(struct vcpu *v, struct evtchn *evtchn)
 {
     struct domain *d = v->domain;
@@ -178,9 +345,8 @@ static void evtchn_fifo_set_pending(struct vcpu *v, struct evtchn *evtchn)
     if ( !test_bit(EVTCHN_FIFO_MASKED, word)
          && !test_bit(EVTCHN_FIFO_LINKED, word) )
     {
-        struct evtchn_fifo_queue *q, *old_q;
-        event_word_t *tail_word;
-        bool_t linked = 0;
+        struct evtchn_fifo_queue *q;
+        uint32_t staged;
 
         /*
          * Control block not mapped.  The guest must not unmask an
@@ -194,66 +360,33 @@ static void evtchn_fifo_set_pending(struct vcpu *v, struct evtchn *evtchn)
             goto done;
         }
 
-        /*
-         * No locking around getting the queue. This may race with
-         * changing the priority but we are allowed to signal the
-         * event once on the old priority.
-         */
         q = &v->evtchn_fifo->queue[evtchn->priority];
 
-        old_q = lock_old_queue(d, evtchn, &flags);
-        if ( !old_q )
-            goto done;
-
-        if ( test_and_set_bit(EVTCHN_FIFO_LINKED, word) )
+        if ( unlikely(evtchn->last_vcpu_id != v->vcpu_id ||
+                      evtchn->last_priority != evtchn->priority) )
         {
-            spin_unlock_irqrestore(&old_q->lock, flags);
+            evtchn_fifo_link_slow(v, evtchn);
             goto done;
         }
 
         /*
-         * If this event was a tail, the old queue is now empty and
-         * its tail must be invalidated to prevent adding an event to
-         * the old queue from corrupting the new queue.
-         */
-        if ( old_q->tail == port )
-            old_q->tail = 0;
-
-        /* Moved to a different queue? */
-        if ( old_q != q )
-        {
-            evtchn->last_vcpu_id = evtchn->notify_vcpu_id;
-            evtchn->last_priority = evtchn->priority;
-
-            spin_unlock_irqrestore(&old_q->lock, flags);
-            spin_lock_irqsave(&q->lock, flags);
-        }
-
-        /*
-         * Atomically link the tail to port iff the tail is linked.
-         * If the tail is unlinked the queue is empty.
-         *
-         * If port is the same as tail, the queue is empty but q->tail
-         * will appear linked as we just set LINKED above.
-         *
-         * If the queue is empty (i.e., we haven't linked to the new
-         * event), head must be updated.
+         * The event stays on the queue it was last linked on. Rather than
+         * serialising on the queue lock, stage it and let whoever holds the
+         * lock link it. LINKED is only ever set under the queue lock, which
+         * keeps a stale q->tail from being linked to behind our back.
          */
-        if ( q->tail )
-        {
-            tail_word = evtchn_fifo_word_from_port(d, q->tail);
-            linked = evtchn_fifo_set_link(d, tail_word, port);
-        }
-        if ( !linked )
-            write_atomic(q->head, port);
-        q->tail = port;
+        if ( test_and_set_bool(evtchn->fifo_staged) )
+            goto done;
 
-        spin_unlock_irqrestore(&q->lock, flags);
+        do {
+            staged = read_atomic(&q->staged);
+            evtchn->fifo_staged_next = staged;
+        } while ( cmpxchg(&q->staged, staged, port) != staged );
 
-        if ( !linked
-             && !test_and_set_bit(q->priority,
-                                  &v->evtchn_fifo->control_block->ready) )
-            vcpu_mark_events_pending(v);
+        if ( spin_trylock_irqsave(&q->lock, flags) )
+            evtchn_fifo_unlock_queue(v, q, flags, NULL);
+        else
+            perfc_incr(evtchn_fifo_staged);
     }
  done:
     if ( !was_pending )
@@ -358,43 +491,6 @@ static const struct evtchn_port_ops evtchn_port_ops_fifo =
     .print_state   = evtchn_fifo_print_state,
 };
 
-static int map_guest_page(struct domain *d, uint64_t gfn, void **virt)
-{
-    struct page_info *p;
-
-    p = get_page_from_gfn(d, gfn, NULL, P2M_ALLOC);
-    if ( !p )
-        return -EINVAL;
-
-    if ( !get_page_type(p, PGT_writable_page) )
-    {
-        put_page(p);
-        return -EINVAL;
-    }
-
-    *virt = __map_domain_page_global(p);
-    if ( !*virt )
-    {
-        put_page_and_type(p);
-        return -ENOMEM;
-    }
-    return 0;
-}
-
-static void unmap_guest_page(void *virt)
-{
-    struct page_info *page;
-
-    if ( !virt )
-        return;
-
-    virt = (void *)((unsigned long)virt & PAGE_MASK);
-    page = mfn_to_page(domain_page_map_to_mfn(virt));
-
-    unmap_domain_page_global(virt);
-    put_page_and_type(page);
-}
-
 static void init_queue(struct vcpu *v, struct evtchn_fifo_queue *q,
                        unsigned int i)
 {
@@ -428,7 +524,7 @@ static int map_control_block(struct vcpu *v, uint64_t gfn, uint32_t offset)
     if ( v->evtchn_fifo->control_block )
         return -EINVAL;
 
-    rc = map_guest_page(v->domain, gfn, &virt);
+    rc = evtchn_map_guest_page(v->domain, gfn, &virt);
     if ( rc < 0 )
         return rc;
 
@@ -445,7 +541,7 @@ static void cleanup_control_block(struct vcpu *v)
     if ( !v->evtchn_fifo )
         return;
 
-    unmap_guest_page(v->evtchn_fifo->control_block);
+    evtchn_unmap_guest_page(v->evtchn_fifo->control_block);
     xfree(v->evtchn_fifo);
     v->evtchn_fifo = NULL;
 }
@@ -470,7 +566,7 @@ static void cleanup_event_array(struct domain *d)
         return;
 
     for ( i = 0; i < EVTCHN_FIFO_MAX_EVENT_ARRAY_PAGES; i++ )
-        unmap_guest_page(d->evtchn_fifo->event_array[i]);
+        evtchn_unmap_guest_page(d->evtchn_fifo->event_array[i]);
     xfree(d->evtchn_fifo);
     d->evtchn_fifo = NULL;
 }
@@ -580,7 +676,7 @@ static int add_page_to_event_array(struct domain *d, unsigned long gfn)
     if ( slot >= EVTCHN_FIFO_MAX_EVENT_ARRAY_PAGES )
         return -ENOSPC;
 
-    rc = map_guest_page(d, gfn, &virt);
+    rc = evtchn_map_guest_page(d, gfn, &virt);
     if ( rc < 0 )
         return rc;
 
@@ -37,6 +37,8 @@
 #include <xen/paging.h>
 #include <xen/keyhandler.h>
 #include <xen/vmap.h>
+#include <xen/lat_hist.h>
+#include <xen/perfc.h>
 #include <xsm/xsm.h>
 #include <asm/flushtlb.h>
 
@@ -140,6 +142,21 @@ struct gnttab_unmap_common {
 /* Number of unmap operations that are done between each tlb flush */
 #define GNTTAB_UNMAP_BATCH_SIZE 32
 
+/*
+ * Unmaps carried out by GNTTABOP_unmap_grant_ref_batch whose TLB flush and
+ * completion are still outstanding. Multicalls don't reschedule between
+ * sub-calls, so this can be tracked per physical CPU; it is always empty
+ * outside of hypercall context.
+ */
+#define GNTTAB_UNMAP_DEFER_MAX (4 * GNTTAB_UNMAP_BATCH_SIZE)
+
+struct gnttab_unmap_deferred {
+    unsigned int nr;
+    struct gnttab_unmap_common common[GNTTAB_UNMAP_DEFER_MAX];
+};
+
+static DEFINE_PER_CPU(struct gnttab_unmap_deferred, gnttab_unmap_deferred);
+
 
 #define PIN_FAIL(_lbl, _rc, _f, _a...)          \
     do {                                        \
@@ -405,21 +422,27 @@ double_gt_unlock(struct grant_table *lgt, struct grant_table *rgt)
 
 #define INVALID_MAPTRACK_HANDLE UINT_MAX
 
-static inline grant_handle_t
-_get_maptrack_handle(struct grant_table *t, struct vcpu *v)
+/* Maximum number of free entries moved from one VCPU to another at once. */
+#define MAPTRACK_STEAL_BATCH 16
+
+/*
+ * Take up to @nr entries off @v's free list, returning how many were
+ * obtained.
+ */
+static unsigned int
+_get_maptrack_handles(struct grant_table *t, struct vcpu *v,
+                      grant_handle_t *handles, unsigned int nr)
 {
-    unsigned int head, next, prev_head;
+    unsigned int head, next, prev_head, got = 0;
 
     spin_lock(&v->maptrack_freelist_lock);
 
-    do {
+    while ( got < nr )
+    {
         /* No maptrack pages allocated for this VCPU yet? */
         head = read_atomic(&v->maptrack_head);
         if ( unlikely(head == MAPTRACK_TAIL) )
-        {
-            spin_unlock(&v->maptrack_freelist_lock);
-            return INVALID_MAPTRACK_HANDLE;
-        }
+            break;
 
         /*
          * Always keep one entry in the free list to make it easier to
@@ -427,35 +450,68 @@ _get_maptrack_handle(struct grant_table *t, struct vcpu *v)
          */
         next = read_atomic(&maptrack_entry(t, head).ref);
         if ( unlikely(next == MAPTRACK_TAIL) )
-        {
-            spin_unlock(&v->maptrack_freelist_lock);
-            return INVALID_MAPTRACK_HANDLE;
-        }
+            break;
 
         prev_head = head;
         head = cmpxchg(&v->maptrack_head, prev_head, next);
-    } while ( head != prev_head );
+        if ( head == prev_head )
+            handles[got++] = head;
+    }
 
     spin_unlock(&v->maptrack_freelist_lock);
 
-    return head;
+    return got;
+}
+
+static inline grant_handle_t
+_get_maptrack_handle(struct grant_table *t, struct vcpu *v)
+{
+    grant_handle_t handle;
+
+    return _get_maptrack_handles(t, v, &handle, 1) ? handle
+                                                   : INVALID_MAPTRACK_HANDLE;
+}
+
+/* Append a free entry to @v's free list.  Caller holds the free list lock. */
+static void
+_put_maptrack_handle(struct grant_table *t, struct vcpu *v,
+                     grant_handle_t handle)
+{
+    unsigned int prev_tail, cur_tail;
+
+    /* 1. Set entry to be a tail. */
+    maptrack_entry(t, handle).ref = MAPTRACK_TAIL;
+
+    /* 2. Add entry to the tail of the list. */
+    cur_tail = read_atomic(&v->maptrack_tail);
+    do {
+        prev_tail = cur_tail;
+        cur_tail = cmpxchg(&v->maptrack_tail, prev_tail, handle);
+    } while ( cur_tail != prev_tail );
+
+    /* 3. Update the old tail entry to point to the new entry. */
+    write_atomic(&maptrack_entry(t, prev_tail).ref, handle);
 }
 
 /*
- * Try to "steal" a free maptrack entry from another VCPU.
+ * Try to "steal" free maptrack entries from another VCPU.
  *
- * A stolen entry is transferred to the thief, so the number of
- * entries for each VCPU should tend to the usage pattern.
+ * Stolen entries are transferred to the thief, so the number of
+ * entries for each VCPU should tend to the usage pattern.  Entries are
+ * taken in batches: one is returned, the rest go onto the thief's own
+ * free list, so a VCPU that has run dry doesn't have to come back here
+ * (and contend on another VCPU's free list lock) for every new mapping.
  *
  * To avoid having to atomically count the number of free entries on
  * each VCPU and to avoid two VCPU repeatedly stealing entries from
  * each other, the initial victim VCPU is selected randomly.
  */
 static grant_handle_t steal_maptrack_handle(struct grant_table *t,
-                                            const struct vcpu *curr)
+                                            struct vcpu *curr)
 {
     const struct domain *currd = curr->domain;
-    unsigned int first, i;
+    grant_handle_t handles[MAPTRACK_STEAL_BATCH];
+    unsigned int first, i, j, nr;
 
     /* Find an initial victim. */
     first = i = get_random() % currd->max_vcpus;
@@ -463,13 +519,41 @@ static grant_handle_t steal_maptrack_handle(struct grant_table *t,
     do {
         if ( currd->vcpu[i] )
         {
-            grant_handle_t handle;
-
-            handle = _get_maptrack_handle(t, currd->vcpu[i]);
-            if ( handle != INVALID_MAPTRACK_HANDLE )
+            nr = _get_maptrack_handles(t, currd->vcpu[i], handles,
+                                       currd->vcpu[i] == curr
+                                       ? 1 : ARRAY_SIZE(handles));
+            if ( nr )
             {
-                maptrack_entry(t, handle).vcpu = curr->vcpu_id;
-                return handle;
+                perfc_add(maptrack_steal, nr);
+
+                for ( j = 0; j < nr; j++ )
+                    maptrack_entry(t, handles[j]).vcpu = curr->vcpu_id;
+
+                if ( nr == 1 )
+                    return handles[0];
+
+                spin_lock(&curr->maptrack_freelist_lock);
+
+                j = 1;
+                if ( curr->maptrack_tail == MAPTRACK_TAIL )
+                {
+                    /*
+                     * Uninitialized free list? Use an extra entry for the
+                     * tail sentinel.
+                     */
+                    maptrack_entry(t, handles[j]).ref = MAPTRACK_TAIL;
+                    curr->maptrack_tail = handles[j];
+                    if ( curr->maptrack_head == MAPTRACK_TAIL )
+                        write_atomic(&curr->maptrack_head, handles[j]);
+                    j++;
+                }
+
+                for ( ; j < nr; j++ )
+                    _put_maptrack_handle(t, curr, handles[j]);
+
+                spin_unlock(&curr->maptrack_freelist_lock);
+
+                return handles[0];
             }
         }
 
@@ -479,6 +563,7 @@ static grant_handle_t steal_maptrack_handle(struct grant_table *t,
     } while ( i != first );
 
     /* No free handles on any VCPU. */
+    perfc_incr(maptrack_steal_failed);
     return INVALID_MAPTRACK_HANDLE;
 }
 
@@ -488,25 +573,12 @@ put_maptrack_handle(
 {
     struct domain *currd = current->domain;
     struct vcpu *v;
-    unsigned int prev_tail, cur_tail;
 
-    /* 1. Set entry to be a tail. */
-    maptrack_entry(t, handle).ref = MAPTRACK_TAIL;
-
-    /* 2. Add entry to the tail of the list on the original VCPU. */
+    /* Return the entry to the free list of its original VCPU. */
     v = currd->vcpu[maptrack_entry(t, handle).vcpu];
 
     spin_lock(&v->maptrack_freelist_lock);
-
-    cur_tail = read_atomic(&v->maptrack_tail);
-    do {
-        prev_tail = cur_tail;
-        cur_tail = cmpxchg(&v->maptrack_tail, prev_tail, handle);
-    } while ( cur_tail != prev_tail );
-
-    /* 3. Update the old tail entry to point to the new entry. */
-    write_atomic(&maptrack_entry(t, prev_tail).ref, handle);
-
+    _put_maptrack_handle(t, v, handle);
     spin_unlock(&v->maptrack_freelist_lock);
 }
 
@@ -523,41 +595,39 @@ get_maptrack_handle(
     if ( likely(handle != INVALID_MAPTRACK_HANDLE) )
         return handle;
 
-    spin_lock(&lgt->maptrack_lock);
-
     /*
      * If we've run out of handles and still have frame headroom, try
      * allocating a new maptrack frame.  If there is no headroom, or we're
-     * out of memory, try stealing an entry from another VCPU (in case the
+     * out of memory, try stealing entries from other VCPUs (in case the
      * guest isn't mapping across its VCPUs evenly).
+     *
+     * The frame is allocated and initialised before taking the maptrack
+     * lock, so that VCPUs growing the table concurrently only serialise
+     * on publishing their frames.  The headroom check done here is a hint
+     * only; it gets repeated with the lock held.
      */
     if ( nr_maptrack_frames(lgt) < lgt->max_maptrack_frames )
         new_mt = alloc_xenheap_page();
 
-    if ( !new_mt )
+    if ( new_mt )
     {
-        spin_unlock(&lgt->maptrack_lock);
+        clear_page(new_mt);
+        for ( i = 0; i < MAPTRACK_PER_PAGE; i++ )
+            new_mt[i].vcpu = curr->vcpu_id;
 
-        /*
-         * Uninitialized free list? Steal an extra entry for the tail
-         * sentinel.
-         */
-        if ( curr->maptrack_tail == MAPTRACK_TAIL )
-        {
-            handle = steal_maptrack_handle(lgt, curr);
-            if ( handle == INVALID_MAPTRACK_HANDLE )
-                return handle;
-            spin_lock(&curr->maptrack_freelist_lock);
-            maptrack_entry(lgt, handle).ref = MAPTRACK_TAIL;
-            curr->maptrack_tail = handle;
-            if ( curr->maptrack_head == MAPTRACK_TAIL )
-                write_atomic(&curr->maptrack_head, handle);
-            spin_unlock(&curr->maptrack_freelist_lock);
+        spin_lock(&lgt->maptrack_lock);
+
+        if ( unlikely(nr_maptrack_frames(lgt) >= lgt->max_maptrack_frames) )
+        {
+            spin_unlock(&lgt->maptrack_lock);
+            free_xenheap_page(new_mt);
+            new_mt = NULL;
+            perfc_incr(maptrack_grow_raced);
         }
-        return steal_maptrack_handle(lgt, curr);
     }
 
-    clear_page(new_mt);
+    if ( !new_mt )
+        return steal_maptrack_handle(lgt, curr);
 
     /*
      * Use the first new entry and add the remaining entries to the
@@ -569,7 +639,6 @@ get_maptrack_handle(
     {
         BUILD_BUG_ON(sizeof(new_mt->ref) < sizeof(handle));
         new_mt[i].ref = handle + i + 1;
-        new_mt[i].vcpu = curr->vcpu_id;
     }
 
     /* Set tail directly if this is the first page for this VCPU. */
@@ -581,6 +650,8 @@ get_maptrack_handle(
     lgt->maptrack_limit += MAPTRACK_PER_PAGE;
 
     spin_unlock(&lgt->maptrack_lock);
+    perfc_incr(maptrack_grow);
+
     spin_lock(&curr->maptrack_freelist_lock);
 
     do {
@@ -1506,7 +1577,7 @@ static long
 gnttab_unmap_grant_ref(
     XEN_GUEST_HANDLE_PARAM(gnttab_unmap_grant_ref_t) uop, unsigned int count)
 {
-    int i, c, partial_done, done = 0;
+    int i, c, partial_done, done = 0, rc;
     struct gnttab_unmap_grant_ref op;
     struct gnttab_unmap_common common[GNTTAB_UNMAP_BATCH_SIZE];
 
@@ -1515,6 +1586,7 @@ gnttab_unmap_grant_ref(
         c = min(count, (unsigned int)GNTTAB_UNMAP_BATCH_SIZE);
         partial_done = 0;
 
+        iommu_iotlb_batch_start();
         for ( i = 0; i < c; i++ )
         {
             if ( unlikely(__copy_from_guest(&op, uop, 1)) )
@@ -1526,11 +1598,15 @@ gnttab_unmap_grant_ref(
             guest_handle_add_offset(uop, 1);
         }
 
+        rc = iommu_iotlb_batch_end(current->domain);
         gnttab_flush_tlb(current->domain);
 
         for ( i = 0; i < partial_done; i++ )
             unmap_common_complete(&common[i]);
 
+        if ( unlikely(rc) )
+            return rc;
+
         count -= c;
         done += c;
 
@@ -1541,6 +1617,8 @@ gnttab_unmap_grant_ref(
     return 0;
 
 fault:
+    /* A flush failure has already been reported against the domain. */
+    rc = iommu_iotlb_batch_end(current->domain);
     gnttab_flush_tlb(current->domain);
 
     for ( i = 0; i < partial_done; i++ )
@@ -1548,6 +1626,117 @@ fault:
     return -EFAULT;
 }
 
+void gnttab_flush_deferred_unmaps(void)
+{
+    struct gnttab_unmap_deferred *def = &this_cpu(gnttab_unmap_deferred);
+    unsigned int i;
+
+    if ( likely(!def->nr) )
+        return;
+
+    gnttab_flush_tlb(current->domain);
+
+    for ( i = 0; i < def->nr; i++ )
+    {
+        struct domain *rd = def->common[i].rd;
+
+        unmap_common_complete(&def->common[i]);
+        put_domain(rd);
+    }
+
+    def->nr = 0;
+}
+
+static long
+gnttab_unmap_grant_ref_batch(
+    XEN_GUEST_HANDLE_PARAM(gnttab_unmap_grant_ref_t) uop, unsigned int count,
+    unsigned int policy)
+{
+    struct vcpu *curr = current;
+    struct gnttab_unmap_deferred *def = &this_cpu(gnttab_unmap_deferred);
+    struct gnttab_unmap_grant_ref op;
+    struct gnttab_unmap_common *common;
+    bool no_flush = false;
+    long rc = 0;
+    unsigned int done = 0;
+
+    switch ( policy )
+    {
+    case GNTUNMAP_flush_call:
+        break;
+
+    case GNTUNMAP_flush_multicall:
+        if ( curr->mc_state.flags & MCSF_in_multicall )
+            break;
+        policy = GNTUNMAP_flush_call;
+        break;
+
+    case GNTUNMAP_flush_none:
+        no_flush = true;
+        break;
+
+    default:
+        return -EINVAL;
+    }
+
+    while ( count != 0 )
+    {
+        if ( def->nr == ARRAY_SIZE(def->common) )
+            gnttab_flush_deferred_unmaps();
+
+        if ( unlikely(__copy_from_guest(&op, uop, 1)) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+
+        common = &def->common[def->nr];
+        if ( no_flush && op.host_addr && !paging_mode_external(curr->domain) )
+            op.status = GNTST_general_error;
+        else
+        {
+            unmap_grant_ref(&op, common);
+
+            if ( !common->done )
+                /* Nothing to complete. */;
+            else if ( no_flush )
+                unmap_common_complete(common);
+            else if ( likely(get_domain(common->rd)) )
+                ++def->nr;
+            else
+            {
+                /* The granting domain is going away: don't hold it up. */
+                gnttab_flush_tlb(curr->domain);
+                unmap_common_complete(common);
+            }
+        }
+
+        if ( unlikely(__copy_field_to_guest(uop, &op, status)) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+        guest_handle_add_offset(uop, 1);
+
+        --count;
+        if ( (++done % GNTTAB_UNMAP_BATCH_SIZE) == 0 && count &&
+             hypercall_preempt_check() )
+        {
+            rc = done;
+            break;
+        }
+    }
+
+    /*
+     * A multicall settles deferred unmaps once it finishes or gets
+     * preempted; see do_multicall().
+     */
+    if ( policy != GNTUNMAP_flush_multicall )
+        gnttab_flush_deferred_unmaps();
+
+    return rc;
+}
+
 static void
 unmap_and_replace(
     struct gnttab_unmap_and_replace *op,
@@ -2583,6 +2772,20 @@ struct gnttab_copy_buf {
     bool_t have_type;
 };
 
+/*
+ * Buffers claimed for one side (source or destination) of a batch of
+ * copies.  Backends typically split data into many small segments
+ * against a handful of pages, so keeping more than one buffer per side
+ * lets those segments share a single grant acquisition and mapping.
+ * buf[0] holds the lock on the domain all of the buffers belong to.
+ */
+#define GNTTAB_COPY_CACHE_SIZE 4
+
+struct gnttab_copy_cache {
+    struct gnttab_copy_buf buf[GNTTAB_COPY_CACHE_SIZE];
+    unsigned int victim;
+};
+
 static int gnttab_copy_lock_domain(domid_t domid, bool is_gref,
                                    struct gnttab_copy_buf *buf)
 {
@@ -2729,7 +2932,7 @@ static bool_t gnttab_copy_buf_valid(const struct gnttab_copy_ptr *p,
         return 0;
     if ( has_gref )
         return b->have_grant && p->u.ref == b->ptr.u.ref;
-    return p->u.gmfn == b->ptr.u.gmfn;
+    return !b->have_grant && p->u.gmfn == b->ptr.u.gmfn;
 }
 
 static int gnttab_copy_buf(const struct gnttab_copy *op,
@@ -2764,43 +2967,98 @@ static int gnttab_copy_buf(const struct gnttab_copy *op,
     return rc;
 }
 
+static void gnttab_copy_release_cache(struct gnttab_copy_cache *cache)
+{
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(cache->buf); i++ )
+        gnttab_copy_release_buf(&cache->buf[i]);
+    cache->victim = 0;
+}
+
+/*
+ * Find the buffer for @p in @cache, claiming it (in place of a free or
+ * the least recently claimed entry) if it isn't there yet.
+ */
+static int gnttab_copy_lookup_buf(const struct gnttab_copy *op,
+                                  const struct gnttab_copy_ptr *p,
+                                  struct gnttab_copy_cache *cache,
+                                  unsigned int gref_flag,
+                                  struct gnttab_copy_buf **bufp)
+{
+    struct gnttab_copy_buf *buf = NULL;
+    unsigned int i;
+    int rc;
+
+    for ( i = 0; i < ARRAY_SIZE(cache->buf); i++ )
+    {
+        if ( gnttab_copy_buf_valid(p, &cache->buf[i], op->flags & gref_flag) )
+        {
+            perfc_incr(gnttab_copy_buf_hit);
+            *bufp = &cache->buf[i];
+            return GNTST_okay;
+        }
+        if ( !buf && !cache->buf[i].virt )
+            buf = &cache->buf[i];
+    }
+
+    perfc_incr(gnttab_copy_buf_miss);
+
+    if ( !buf )
+    {
+        buf = &cache->buf[cache->victim];
+        if ( ++cache->victim == ARRAY_SIZE(cache->buf) )
+            cache->victim = 0;
+        gnttab_copy_release_buf(buf);
+    }
+
+    rc = gnttab_copy_claim_buf(op, p, buf, gref_flag);
+    if ( rc == GNTST_okay )
+        *bufp = buf;
+    else
+        gnttab_copy_release_buf(buf);
+
+    return rc;
+}
+
 static int gnttab_copy_one(const struct gnttab_copy *op,
-                           struct gnttab_copy_buf *dest,
-                           struct gnttab_copy_buf *src)
+                           struct gnttab_copy_cache *dest_cache,
+                           struct gnttab_copy_cache *src_cache)
 {
+    struct gnttab_copy_buf *dest = &dest_cache->buf[0];
+    struct gnttab_copy_buf *src = &src_cache->buf[0];
+    unsigned int i;
     int rc;
 
     if ( !src->domain || op->source.domid != src->ptr.domid ||
          !dest->domain || op->dest.domid != dest->ptr.domid )
     {
-        gnttab_copy_release_buf(src);
-        gnttab_copy_release_buf(dest);
+        gnttab_copy_release_cache(src_cache);
+        gnttab_copy_release_cache(dest_cache);
         gnttab_copy_unlock_domains(src, dest);
 
         rc = gnttab_copy_lock_domains(op, src, dest);
         if ( rc < 0 )
             goto out;
-    }
 
-    /* Different source? */
-    if ( !gnttab_copy_buf_valid(&op->source, src,
-                                op->flags & GNTCOPY_source_gref) )
-    {
-        gnttab_copy_release_buf(src);
-        rc = gnttab_copy_claim_buf(op, &op->source, src, GNTCOPY_source_gref);
-        if ( rc )
-            goto out;
+        for ( i = 1; i < GNTTAB_COPY_CACHE_SIZE; i++ )
+        {
+            src_cache->buf[i].domain = src->domain;
+            src_cache->buf[i].ptr.domid = src->ptr.domid;
+            dest_cache->buf[i].domain = dest->domain;
+            dest_cache->buf[i].ptr.domid = dest->ptr.domid;
+        }
     }
 
-    /* Different dest? */
-    if ( !gnttab_copy_buf_valid(&op->dest, dest,
-                                op->flags & GNTCOPY_dest_gref) )
-    {
-        gnttab_copy_release_buf(dest);
-        rc = gnttab_copy_claim_buf(op, &op->dest, dest, GNTCOPY_dest_gref);
-        if ( rc )
-            goto out;
-    }
+    rc = gnttab_copy_lookup_buf(op, &op->source, src_cache,
+                                GNTCOPY_source_gref, &src);
+    if ( rc )
+        goto out;
+
+    rc = gnttab_copy_lookup_buf(op, &op->dest, dest_cache,
+                                GNTCOPY_dest_gref, &dest);
+    if ( rc )
+        goto out;
 
     rc = gnttab_copy_buf(op, dest, src);
  out:
@@ -2820,8 +3078,8 @@ static long gnttab_copy(
 {
     unsigned int i;
     struct gnttab_copy op;
-    struct gnttab_copy_buf src = {};
-    struct gnttab_copy_buf dest = {};
+    struct gnttab_copy_cache src = {};
+    struct gnttab_copy_cache dest = {};
     long rc = 0;
 
     for ( i = 0; i < count; i++ )
@@ -2846,8 +3104,8 @@ static long gnttab_copy(
         }
         if ( rc != GNTST_okay )
         {
-            gnttab_copy_release_buf(&src);
-            gnttab_copy_release_buf(&dest);
+            gnttab_copy_release_cache(&src);
+            gnttab_copy_release_cache(&dest);
         }
 
         op.status = rc;
@@ -2860,9 +3118,9 @@ static long gnttab_copy(
         guest_handle_add_offset(uop, 1);
     }
 
-    gnttab_copy_release_buf(&src);
-    gnttab_copy_release_buf(&dest);
-    gnttab_copy_unlock_domains(&src, &dest);
+    gnttab_copy_release_cache(&src);
+    gnttab_copy_release_cache(&dest);
+    gnttab_copy_unlock_domains(&src.buf[0], &dest.buf[0]);
 
     return rc;
 }
@@ -3319,12 +3577,32 @@ do_grant_table_op(
 {
     long rc;
     unsigned int opaque_in = cmd & GNTTABOP_ARG_MASK, opaque_out = 0;
+    s_time_t start;
 
     if ( (int)count < 0 )
         return -EINVAL;
 
-    if ( (cmd &= GNTTABOP_CMD_MASK) != GNTTABOP_cache_flush && opaque_in )
-        return -EINVAL;
+    BUILD_BUG_ON(GNTUNMAP_flush_shift != GNTTABOP_CONTINUATION_ARG_SHIFT);
+
+    switch ( cmd &= GNTTABOP_CMD_MASK )
+    {
+    case GNTTABOP_cache_flush:
+        break;
+
+    case GNTTABOP_unmap_grant_ref_batch:
+        if ( opaque_in & ~GNTUNMAP_flush_mask )
+            return -EINVAL;
+        break;
+
+    default:
+        if ( opaque_in )
+            return -EINVAL;
+        /* Earlier deferred unmaps must look complete to any other op. */
+        gnttab_flush_deferred_unmaps();
+        break;
+    }
+
+    start = lat_hist_start();
 
     rc = -EFAULT;
     switch ( cmd )
@@ -3361,6 +3639,23 @@ do_grant_table_op(
         break;
     }
 
+    case GNTTABOP_unmap_grant_ref_batch:
+    {
+        XEN_GUEST_HANDLE_PARAM(gnttab_unmap_grant_ref_t) unmap =
+            guest_handle_cast(uop, gnttab_unmap_grant_ref_t);
+
+        if ( unlikely(!guest_handle_okay(unmap, count)) )
+            goto out;
+        rc = gnttab_unmap_grant_ref_batch(unmap, count, opaque_in);
+        if ( rc > 0 )
+        {
+            guest_handle_add_offset(unmap, rc);
+            uop = guest_handle_cast(unmap, void);
+            opaque_out = opaque_in;
+        }
+        break;
+    }
+
     case GNTTABOP_unmap_and_replace:
     {
         XEN_GUEST_HANDLE_PARAM(gnttab_unmap_and_replace_t) unmap =
@@ -3478,6 +3773,8 @@ do_grant_table_op(
     }
 
   out:
+    lat_hist_end(XEN_SYSCTL_LAT_HIST_grant_op, cmd, start);
+
     if ( rc > 0 || opaque_out != 0 )
     {
         ASSERT(rc < count);
@@ -0,0 +1,99 @@
+/******************************************************************************
+ * lat_hist.c
+ *
+ * Per-CPU, log2-bucketed latency histograms of hypervisor hot paths: VM
+ * exit handling, hypercall dispatch, grant table operations and event
+ * channel notification.
+ */
+
+#include <xen/cpumask.h>
+#include <xen/errno.h>
+#include <xen/guest_access.h>
+#include <xen/init.h>
+#include <xen/lat_hist.h>
+#include <xen/lib.h>
+
+bool __read_mostly opt_lat_hist = true;
+boolean_param("lat-hist", opt_lat_hist);
+
+DEFINE_PER_CPU(struct lat_hist, lat_hist);
+
+static const struct {
+    unsigned int base, nr;
+} lat_hist_sets[XEN_SYSCTL_LAT_HIST_NR] = {
+    [XEN_SYSCTL_LAT_HIST_vmexit] =
+        { LAT_HIST_VMEXIT_BASE, LAT_HIST_VMEXIT_NR },
+    [XEN_SYSCTL_LAT_HIST_hypercall] =
+        { LAT_HIST_HYPERCALL_BASE, LAT_HIST_HYPERCALL_NR },
+    [XEN_SYSCTL_LAT_HIST_grant_op] =
+        { LAT_HIST_GRANT_OP_BASE, LAT_HIST_GRANT_OP_NR },
+    [XEN_SYSCTL_LAT_HIST_evtchn_send] =
+        { LAT_HIST_EVTCHN_BASE, LAT_HIST_EVTCHN_NR },
+};
+
+int lat_hist_op(struct xen_sysctl_lat_hist *op)
+{
+    uint64_t sum[XEN_SYSCTL_LAT_HIST_BUCKETS];
+    const cpumask_t *cpus;
+    unsigned int cpu, h, b, base, nr;
+
+    if ( !opt_lat_hist )
+        return -EOPNOTSUPP;
+
+    if ( op->flags & ~XEN_SYSCTL_LAT_HIST_RESET )
+        return -EINVAL;
+
+    if ( op->set >= XEN_SYSCTL_LAT_HIST_NR )
+        return -EINVAL;
+
+    if ( op->cpu == XEN_SYSCTL_LAT_HIST_ALL_CPUS )
+        cpus = &cpu_online_map;
+    else if ( op->cpu < nr_cpu_ids && cpu_online(op->cpu) )
+        cpus = cpumask_of(op->cpu);
+    else
+        return -EINVAL;
+
+    base = lat_hist_sets[op->set].base;
+    nr = lat_hist_sets[op->set].nr;
+
+    if ( !guest_handle_is_null(op->data) )
+    {
+        if ( op->nr_hists < nr )
+        {
+            op->nr_hists = nr;
+            return -ENOBUFS;
+        }
+
+        for ( h = 0; h < nr; h++ )
+        {
+            memset(sum, 0, sizeof(sum));
+            for_each_cpu ( cpu, cpus )
+                for ( b = 0; b < XEN_SYSCTL_LAT_HIST_BUCKETS; b++ )
+                    sum[b] += per_cpu(lat_hist, cpu).count[base + h][b];
+
+            if ( copy_to_guest_offset(op->data,
+                                      h * XEN_SYSCTL_LAT_HIST_BUCKETS,
+                                      sum, XEN_SYSCTL_LAT_HIST_BUCKETS) )
+                return -EFAULT;
+        }
+    }
+
+    op->nr_hists = nr;
+
+    if ( op->flags & XEN_SYSCTL_LAT_HIST_RESET )
+        for_each_cpu ( cpu, cpus )
+            memset(per_cpu(lat_hist, cpu).count[base], 0,
+                   nr * sizeof(per_cpu(lat_hist, cpu).count[0]));
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -131,6 +131,14 @@ void elf_set_log(struct elf_binary *elf, elf_log_callback *log_callback,
     elf->verbose = verbose;
 }
 
+void elf_set_load_segment(struct elf_binary *elf,
+                          elf_load_segment_callback *load_segment,
+                          void *caller_data)
+{
+    elf->load_segment = load_segment;
+    elf->load_segment_data = caller_data;
+}
+
 static elf_errorstatus elf_load_image(struct elf_binary *elf,
                           elf_ptrval dst, elf_ptrval src,
                           uint64_t filesz, uint64_t memsz)
@@ -139,6 +147,22 @@ static elf_errorstatus elf_load_image(struct elf_binary *elf,
     elf_memset_safe(elf, dst + filesz, 0, memsz - filesz);
     return 0;
 }
+
+static elf_errorstatus elf_load_segment(struct elf_binary *elf,
+                                        elf_ptrval dst, elf_ptrval src,
+                                        uint64_t filesz, uint64_t memsz)
+{
+    if ( !elf->load_segment )
+        return elf_load_image(elf, dst, src, filesz, memsz);
+
+    /* The same checks as elf_memcpy_safe() and elf_memset_safe(). */
+    if ( elf_access_ok(elf, dst, filesz) &&
+         elf_access_ok(elf, src, filesz) &&
+         elf_access_ok(elf, dst + filesz, memsz - filesz) )
+        elf->load_segment(elf, elf->load_segment_data, ELF_UNSAFE_PTR(dst),
+                          ELF_UNSAFE_PTR(src), filesz, memsz);
+    return 0;
+}
 #else
 
 void elf_set_verbose(struct elf_binary *elf)
@@ -184,6 +208,8 @@ static elf_errorstatus elf_load_image(struct elf_binary *elf, elf_ptrval dst, el
         return -1;
     return 0;
 }
+
+#define elf_load_segment elf_load_image
 #endif
 
 /* Calculate the required additional kernel space for the elf image */
@@ -538,7 +564,7 @@ elf_errorstatus elf_load_binary(struct elf_binary *elf)
         elf_msg(elf,
                 "ELF: phdr %u at %#"ELF_PRPTRVAL" -> %#"ELF_PRPTRVAL"\n",
                 i, dest, (elf_ptrval)(dest + filesz));
-        if ( elf_load_image(elf, dest, ELF_IMAGE_BASE(elf) + offset, filesz, memsz) != 0 )
+        if ( elf_load_segment(elf, dest, ELF_IMAGE_BASE(elf) + offset, filesz, memsz) != 0 )
             return -1;
     }
 
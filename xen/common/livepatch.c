@@ -1310,6 +1310,8 @@ void check_for_livepatch_work(void)
     {
         struct payload *p;
         unsigned int cpus;
+        /* When we got here, all CPUs did, all had IRQs off, and we were done. */
+        s_time_t start = NOW(), rendezvous = 0, quiesced = 0, done = 0;
 
         p = livepatch_work.data;
         if ( !get_cpu_maps() )
@@ -1344,6 +1346,7 @@ void check_for_livepatch_work(void)
         timeout = livepatch_work.timeout + NOW();
         if ( livepatch_spin(&livepatch_work.semaphore, timeout, cpus, "CPU") )
             goto abort;
+        rendezvous = NOW();
 
         /* All CPUs are waiting, now signal to disable IRQs. */
         atomic_set(&livepatch_work.semaphore, 0);
@@ -1357,12 +1360,14 @@ void check_for_livepatch_work(void)
 
         if ( !livepatch_spin(&livepatch_work.semaphore, timeout, cpus, "IRQ") )
         {
+            quiesced = NOW();
             local_irq_save(flags);
             /* Do the patching. */
             livepatch_do_action();
             /* Serialize and flush out the CPU via CPUID instruction (on x86). */
             arch_livepatch_post_action();
             local_irq_restore(flags);
+            done = NOW();
         }
 
  abort:
@@ -1376,6 +1381,18 @@ void check_for_livepatch_work(void)
 
         printk(XENLOG_INFO LIVEPATCH "%s finished %s with rc=%d\n",
                p->name, names[livepatch_work.cmd], p->rc);
+        /*
+         * How long it took for the other CPUs to show up, how long all of
+         * them had IRQs off for the patching, and for how long the first
+         * CPU to show up was kept from doing anything else.
+         */
+        if ( done )
+            printk(XENLOG_INFO LIVEPATCH
+                   "%s: rendezvous %"PRI_stime"us, patching %"PRI_stime"us,"
+                   " stall %"PRI_stime"us\n", p->name,
+                   (rendezvous - start) / MICROSECS(1),
+                   (done - quiesced) / MICROSECS(1),
+                   (done - start) / MICROSECS(1));
     }
     else
     {
@@ -87,6 +87,18 @@ int mem_access_memop(unsigned long cmd,
         }
         break;
 
+    case XENMEM_access_op_set_subpage_write:
+        rc = -ENOSYS;
+        if ( unlikely(start_iter) )
+            break;
+
+        rc = -EINVAL;
+        if ( mao.pfn > domain_get_maximum_gpfn(d) )
+            break;
+
+        rc = p2m_set_mem_access_subpage(d, _gfn(mao.pfn), mao.nr);
+        break;
+
     case XENMEM_access_op_get_access:
     {
         xenmem_access_t access;
@@ -108,7 +108,7 @@ static void increase_reservation(struct memop_args *a)
 
     for ( i = a->nr_done; i < a->nr_extents; i++ )
     {
-        if ( i != a->nr_done && hypercall_preempt_check() )
+        if ( i != a->nr_done && hypercall_preempt_check_inplace() )
         {
             a->preempted = 1;
             goto out;
@@ -178,7 +178,7 @@ static void populate_physmap(struct memop_args *a)
 
     for ( i = a->nr_done; i < a->nr_extents; i++ )
     {
-        if ( i != a->nr_done && hypercall_preempt_check() )
+        if ( i != a->nr_done && hypercall_preempt_check_inplace() )
         {
             a->preempted = 1;
             goto out;
@@ -392,7 +392,7 @@ static void decrease_reservation(struct memop_args *a)
 
     for ( i = a->nr_done; i < a->nr_extents; i++ )
     {
-        if ( i != a->nr_done && hypercall_preempt_check() )
+        if ( i != a->nr_done && hypercall_preempt_check_inplace() )
         {
             a->preempted = 1;
             goto out;
@@ -9,6 +9,7 @@
 #include <xen/event.h>
 #include <xen/multicall.h>
 #include <xen/guest_access.h>
+#include <xen/grant_table.h>
 #include <xen/perfc.h>
 #include <xen/trace.h>
 #include <asm/current.h>
@@ -53,7 +54,7 @@ do_multicall(
 
     for ( i = 0; !rc && disp == mc_continue && i < nr_calls; i++ )
     {
-        if ( i && hypercall_preempt_check() )
+        if ( i && hypercall_preempt_check_inplace() )
             goto preempted;
 
         if ( unlikely(__copy_from_guest(&mcs->call, call_list, 1)) )
@@ -106,12 +107,14 @@ do_multicall(
     if ( unlikely(disp == mc_preempt) && i < nr_calls )
         goto preempted;
 
+    gnttab_flush_deferred_unmaps();
     perfc_incr(calls_to_multicall);
     perfc_add(calls_from_multicall, i);
     mcs->flags = 0;
     return rc;
 
  preempted:
+    gnttab_flush_deferred_unmaps();
     perfc_add(calls_from_multicall, i);
     mcs->flags = 0;
     return hypercall_create_continuation(
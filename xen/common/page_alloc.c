@@ -128,6 +128,7 @@
 #include <xen/mm.h>
 #include <xen/irq.h>
 #include <xen/softirq.h>
+#include <xen/cpu.h>
 #include <xen/domain_page.h>
 #include <xen/keyhandler.h>
 #include <xen/perfc.h>
@@ -158,10 +159,44 @@ static char __initdata opt_badpage[100] = "";
 string_param("badpage", opt_badpage);
 
 /*
+ * bootscrub -> Free pages are zeroed during boot.
  * no-bootscrub -> Free pages are not zeroed during boot.
+ * bootscrub=idle -> Free pages are marked as needing scrubbing, and get
+ *                   scrubbed by idle CPUs, or when allocated, after boot.
  */
-static bool_t opt_bootscrub __initdata = 1;
-boolean_param("bootscrub", opt_bootscrub);
+enum bootscrub_mode {
+    BOOTSCRUB_OFF,
+    BOOTSCRUB_ON,
+    BOOTSCRUB_IDLE,
+};
+static enum bootscrub_mode __initdata opt_bootscrub = BOOTSCRUB_IDLE;
+static int __init parse_bootscrub_param(const char *s)
+{
+    /* Interpret 'bootscrub' alone in its positive boolean form. */
+    if ( !*s )
+    {
+        opt_bootscrub = BOOTSCRUB_ON;
+        return 0;
+    }
+
+    switch ( parse_bool(s, NULL) )
+    {
+    case 0:
+        opt_bootscrub = BOOTSCRUB_OFF;
+        return 0;
+    case 1:
+        opt_bootscrub = BOOTSCRUB_ON;
+        return 0;
+    }
+
+    if ( !strcmp(s, "idle") )
+        opt_bootscrub = BOOTSCRUB_IDLE;
+    else
+        return -EINVAL;
+
+    return 0;
+}
+custom_param("bootscrub", parse_bootscrub_param);
 
 /*
  * bootscrub_chunk -> Amount of bytes to scrub lockstep on non-SMT CPUs
@@ -390,6 +425,10 @@ static heap_by_zone_and_order_t *_heap[MAX_NUMNODES];
 
 static unsigned long node_need_scrub[MAX_NUMNODES];
 
+/* Pages held in the per-CPU caches, see pcp_alloc(). */
+static atomic_t pcp_cached_pages;
+static void pcp_drain_all(void);
+
 static unsigned long *avail[MAX_NUMNODES];
 static long total_avail_pages;
 
@@ -397,7 +436,7 @@ static long total_avail_pages;
 static long midsize_alloc_zone_pages;
 #define MIDSIZE_ALLOC_FRAC 128
 
-static DEFINE_SPINLOCK(heap_lock);
+static DEFINE_QUEUED_SPINLOCK(heap_lock);
 static long outstanding_claims; /* total outstanding claims by all domains */
 
 unsigned long domain_adjust_tot_pages(struct domain *d, long pages)
@@ -438,6 +477,10 @@ int domain_set_outstanding_pages(struct domain *d, unsigned long pages)
     int ret = -ENOMEM;
     unsigned long claim, avail_pages;
 
+    /* Cached pages aren't in total_avail_pages: make them count. */
+    if ( pages )
+        pcp_drain_all();
+
     /*
      * take the domain's page_alloc_lock, else all d->tot_page adjustments
      * must always take the global heap_lock rather than only in the much
@@ -507,7 +550,7 @@ void get_outstanding_claims(uint64_t *free_pages, uint64_t *outstanding_pages)
 {
     spin_lock(&heap_lock);
     *outstanding_pages = outstanding_claims;
-    *free_pages =  avail_domheap_pages();
+    *free_pages =  avail_domheap_pages() + atomic_read(&pcp_cached_pages);
     spin_unlock(&heap_lock);
 }
 
@@ -854,6 +897,351 @@ static struct page_info *get_free_buddy(unsigned int zone_lo,
     }
 }
 
+/*
+ * Per-CPU page caches.
+ *
+ * Each CPU keeps a small cache of clean order-0 and superpage-sized free
+ * pages from its local node, in front of the heap lock.  Frees of such
+ * pages go to the cache, and allocations which any of them would satisfy
+ * come from it, without taking the heap lock.  Overflowing the cache
+ * returns a batch of pages to the heap under a single acquisition of the
+ * heap lock, and a miss on an empty order-0 cache refills it with one
+ * higher order allocation.
+ *
+ * As far as the heap is concerned, cached pages are allocated: they are in
+ * state inuse, and not counted in avail[] or total_avail_pages.  Allocating
+ * from the cache therefore never eats into memory claimed by a domain.
+ * Pages which became offlining or broken while cached are handed back to
+ * the heap rather than given out.  The caches are drained before a claim is
+ * staked, so claims can use all free memory, and before a page is
+ * offlined, so a cached page can be offlined at once.
+ */
+static bool_t __read_mostly opt_pcp_cache = 1;
+boolean_param("pcp_page_cache", opt_pcp_cache);
+
+#define PCP_ORDER_LARGE  9    /* 2M with 4k pages. */
+#define PCP_NR_ORDERS    2
+#define PCP_REFILL_ORDER 4    /* Order-0 pages fetched together on a miss. */
+
+static const unsigned int pcp_high[PCP_NR_ORDERS] = { 64, 2 };
+static const unsigned int pcp_batch[PCP_NR_ORDERS] = { 16, 1 };
+
+struct pcp_cache {
+    spinlock_t lock;
+    struct page_list_head list[PCP_NR_ORDERS];
+    unsigned int count[PCP_NR_ORDERS];
+    /* Statistics. */
+    unsigned long hits, misses, frees, overflows;
+};
+
+static DEFINE_PER_CPU(struct pcp_cache, pcp_cache);
+static bool __read_mostly pcp_initialised;
+
+static void __free_heap_pages(
+    struct page_info *pg, unsigned int order, bool need_scrub);
+
+static int pcp_index(unsigned int order)
+{
+    switch ( order )
+    {
+    case 0:
+        return 0;
+    case PCP_ORDER_LARGE:
+        return 1;
+    }
+
+    return -1;
+}
+
+static bool pcp_active(void)
+{
+    return opt_pcp_cache && pcp_initialised &&
+           system_state >= SYS_STATE_active && !scrub_debug &&
+           !tmem_enabled();
+}
+
+static nodeid_t pcp_local_node(void)
+{
+    nodeid_t node = cpu_to_node(smp_processor_id());
+
+    return node == NUMA_NO_NODE ? 0 : node;
+}
+
+/* Return a list of cached pages to the heap. */
+static void pcp_release(struct page_list_head *list, unsigned int order)
+{
+    struct page_info *pg;
+    bool need_tlbflush = false;
+    uint32_t tlbflush_timestamp = 0;
+    unsigned int i;
+
+    if ( page_list_empty(list) )
+        return;
+
+    /*
+     * The heap would lose track of the TLB flush still owed, as the pages
+     * have no owner any more.  Settle it now.
+     */
+    page_list_for_each ( pg, list )
+        for ( i = 0; i < (1U << order); i++ )
+            accumulate_tlbflush(&need_tlbflush, &pg[i], &tlbflush_timestamp);
+    if ( need_tlbflush )
+        filtered_flush_tlb_mask(tlbflush_timestamp);
+
+    spin_lock(&heap_lock);
+    while ( (pg = page_list_remove_head(list)) != NULL )
+        __free_heap_pages(pg, order, false);
+    spin_unlock(&heap_lock);
+}
+
+static void pcp_drain_cpu(unsigned int cpu)
+{
+    struct pcp_cache *pc = &per_cpu(pcp_cache, cpu);
+    struct page_info *pg;
+    unsigned int idx;
+
+    for ( idx = 0; idx < PCP_NR_ORDERS; idx++ )
+    {
+        unsigned int order = idx ? PCP_ORDER_LARGE : 0;
+        PAGE_LIST_HEAD(list);
+
+        spin_lock(&pc->lock);
+        while ( (pg = page_list_remove_head(&pc->list[idx])) != NULL )
+            page_list_add_tail(pg, &list);
+        atomic_sub(pc->count[idx] << order, &pcp_cached_pages);
+        pc->count[idx] = 0;
+        spin_unlock(&pc->lock);
+
+        pcp_release(&list, order);
+    }
+}
+
+/* Return the pages in every CPU's cache to the heap. */
+static void pcp_drain_all(void)
+{
+    unsigned int cpu;
+
+    if ( !pcp_initialised )
+        return;
+
+    for_each_online_cpu ( cpu )
+        pcp_drain_cpu(cpu);
+}
+
+/* Put the pages of a refill, other than the first, in the cache. */
+static void pcp_refill(struct pcp_cache *pc, struct page_info *pg)
+{
+    unsigned int i;
+
+    spin_lock(&pc->lock);
+    for ( i = 1; i < (1U << PCP_REFILL_ORDER); i++ )
+    {
+        /* Already flushed by alloc_heap_pages(). */
+        pg[i].u.free.need_tlbflush = 0;
+        page_list_add_tail(&pg[i], &pc->list[0]);
+    }
+    pc->count[0] += (1U << PCP_REFILL_ORDER) - 1;
+    spin_unlock(&pc->lock);
+
+    atomic_add((1U << PCP_REFILL_ORDER) - 1, &pcp_cached_pages);
+}
+
+static struct page_info *alloc_heap_pages(
+    unsigned int zone_lo, unsigned int zone_hi,
+    unsigned int order, unsigned int memflags,
+    struct domain *d);
+
+static struct page_info *pcp_alloc(
+    unsigned int zone_lo, unsigned int zone_hi,
+    unsigned int order, unsigned int memflags,
+    struct domain *d)
+{
+    struct pcp_cache *pc = &this_cpu(pcp_cache);
+    nodeid_t node = pcp_local_node(), req_node = MEMF_get_node(memflags);
+    int idx = pcp_index(order);
+    struct page_info *pg;
+    PAGE_LIST_HEAD(stale);
+    bool need_tlbflush = false;
+    uint32_t tlbflush_timestamp = 0;
+    unsigned int i, zone;
+
+    if ( idx < 0 || !pcp_active() )
+        return NULL;
+
+    /* Only serve requests which would have been satisfied locally anyway. */
+    if ( req_node != NUMA_NO_NODE ? req_node != node
+                                  : d && !node_isset(node, d->node_affinity) )
+        return NULL;
+
+    spin_lock(&pc->lock);
+    while ( (pg = page_list_remove_head(&pc->list[idx])) != NULL )
+    {
+        pc->count[idx]--;
+
+        if ( unlikely((pg->count_info & PGC_broken) ||
+                      !page_state_is(pg, inuse)) )
+        {
+            page_list_add_tail(pg, &stale);
+            atomic_sub(1 << order, &pcp_cached_pages);
+            continue;
+        }
+
+        zone = page_to_zone(pg);
+        if ( zone < zone_lo || zone > zone_hi )
+        {
+            page_list_add(pg, &pc->list[idx]);
+            pc->count[idx]++;
+            pg = NULL;
+        }
+        break;
+    }
+
+    if ( pg )
+        pc->hits++;
+    else
+        pc->misses++;
+    spin_unlock(&pc->lock);
+
+    pcp_release(&stale, order);
+
+    if ( !pg )
+    {
+        if ( order || pc->count[0] )
+            return NULL;
+
+        /* Refill an empty order-0 cache with one allocation. */
+        pg = alloc_heap_pages(zone_lo, zone_hi, PCP_REFILL_ORDER,
+                              MEMF_node(node) | MEMF_exact_node, NULL);
+        if ( !pg )
+            return NULL;
+        pcp_refill(pc, pg);
+    }
+    else
+    {
+        atomic_sub(1 << order, &pcp_cached_pages);
+
+        for ( i = 0; i < (1U << order); i++ )
+        {
+            if ( !(memflags & MEMF_no_tlbflush) )
+                accumulate_tlbflush(&need_tlbflush, &pg[i],
+                                    &tlbflush_timestamp);
+
+            pg[i].u.inuse.type_info = 0;
+            flush_page_to_ram(page_to_mfn(&pg[i]),
+                              !(memflags & MEMF_no_icache_flush));
+        }
+
+        if ( need_tlbflush )
+            filtered_flush_tlb_mask(tlbflush_timestamp);
+    }
+
+    if ( d != NULL )
+        d->last_alloc_node = node;
+
+    return pg;
+}
+
+/* Try to free 2^@order pages to the local cache. */
+static bool pcp_free(struct page_info *pg, unsigned int order)
+{
+    struct pcp_cache *pc = &this_cpu(pcp_cache);
+    int idx = pcp_index(order);
+    unsigned long mfn = page_to_mfn(pg);
+    struct page_info *old;
+    PAGE_LIST_HEAD(overflow);
+    unsigned int i;
+
+    if ( idx < 0 || !pcp_active() ||
+         phys_to_nid(page_to_maddr(pg)) != pcp_local_node() )
+        return false;
+
+    for ( i = 0; i < (1U << order); i++ )
+        if ( (pg[i].count_info & PGC_broken) || !page_state_is(&pg[i], inuse) )
+            return false;
+
+    /* As done by free_heap_pages(), apart from the state change. */
+    for ( i = 0; i < (1U << order); i++ )
+    {
+        pg[i].count_info = PGC_state_inuse;
+
+        pg[i].u.free.need_tlbflush = (page_get_owner(&pg[i]) != NULL);
+        if ( pg[i].u.free.need_tlbflush )
+            page_set_tlbflush_timestamp(&pg[i]);
+
+        page_set_owner(&pg[i], NULL);
+        set_gpfn_from_mfn(mfn + i, INVALID_M2P_ENTRY);
+    }
+
+    spin_lock(&pc->lock);
+    if ( pc->count[idx] >= pcp_high[idx] )
+    {
+        /* Return the coldest pages to the heap. */
+        for ( i = 0; i < pcp_batch[idx]; i++ )
+        {
+            old = page_list_last(&pc->list[idx]);
+            page_list_del(old, &pc->list[idx]);
+            page_list_add(old, &overflow);
+        }
+        pc->count[idx] -= pcp_batch[idx];
+        pc->overflows++;
+    }
+    page_list_add(pg, &pc->list[idx]);
+    pc->count[idx]++;
+    pc->frees++;
+    spin_unlock(&pc->lock);
+
+    atomic_add(1 << order, &pcp_cached_pages);
+    if ( !page_list_empty(&overflow) )
+        atomic_sub(pcp_batch[idx] << order, &pcp_cached_pages);
+
+    pcp_release(&overflow, order);
+
+    return true;
+}
+
+static int cpu_pcp_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu, idx;
+    struct pcp_cache *pc = &per_cpu(pcp_cache, cpu);
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        spin_lock_init(&pc->lock);
+        for ( idx = 0; idx < PCP_NR_ORDERS; idx++ )
+        {
+            INIT_PAGE_LIST_HEAD(&pc->list[idx]);
+            pc->count[idx] = 0;
+        }
+        break;
+    case CPU_UP_CANCELED:
+    case CPU_DEAD:
+        pcp_drain_cpu(cpu);
+        break;
+    default:
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_pcp_nfb = {
+    .notifier_call = cpu_pcp_callback
+};
+
+static int __init pcp_cache_init(void)
+{
+    void *hcpu = (void *)(long)smp_processor_id();
+
+    cpu_pcp_callback(&cpu_pcp_nfb, CPU_UP_PREPARE, hcpu);
+    register_cpu_notifier(&cpu_pcp_nfb);
+    pcp_initialised = true;
+
+    return 0;
+}
+presmp_initcall(pcp_cache_init);
+
 /* Allocate 2^@order contiguous pages. */
 static struct page_info *alloc_heap_pages(
     unsigned int zone_lo, unsigned int zone_hi,
@@ -877,6 +1265,10 @@ static struct page_info *alloc_heap_pages(
     if ( unlikely(order > MAX_ORDER) )
         return NULL;
 
+    pg = pcp_alloc(zone_lo, zone_hi, order, memflags, d);
+    if ( pg )
+        return pg;
+
     spin_lock(&heap_lock);
 
     /*
@@ -1113,13 +1505,65 @@ static int reserve_offlined_page(struct page_info *head)
     return count;
 }
 
-static nodemask_t node_scrubbing;
+/*
+ * scrub_cpus_per_node -> Maximum number of CPUs scrubbing one node's free
+ * memory at a time.  0 means no limit.
+ */
+static unsigned int __read_mostly opt_scrub_cpus_per_node;
+integer_param("scrub_cpus_per_node", opt_scrub_cpus_per_node);
+
+/* Number of CPUs currently scrubbing each node. */
+static atomic_t node_scrubbers[MAX_NUMNODES];
+/* Nodes whose CPUs have been woken to scrub, and none has started yet. */
+static nodemask_t node_scrub_kicked;
+
+/* Become one of the CPUs scrubbing @node, unless there are enough already. */
+static bool node_claim_scrub(nodeid_t node)
+{
+    unsigned int scrubbers = atomic_inc_return(&node_scrubbers[node]);
+
+    if ( opt_scrub_cpus_per_node && scrubbers > opt_scrub_cpus_per_node )
+    {
+        atomic_dec(&node_scrubbers[node]);
+        return false;
+    }
+
+    node_clear(node, node_scrub_kicked);
+
+    return true;
+}
+
+static void node_release_scrub(nodeid_t node)
+{
+    atomic_dec(&node_scrubbers[node]);
+}
+
+/*
+ * Pages freed by a dying domain need scrubbing.  Rather than leaving them
+ * until CPUs happen to go idle, wake the CPUs local to the node (or all of
+ * them for a memory-only node) so that their idle loops start scrubbing in
+ * parallel straight away.  Only one wakeup is sent until scrubbing starts.
+ */
+static void scrub_kick(nodeid_t node)
+{
+    const cpumask_t *mask = &node_to_cpumask(node);
+
+    if ( system_state < SYS_STATE_active ||
+         atomic_read(&node_scrubbers[node]) ||
+         node_test_and_set(node, node_scrub_kicked) )
+        return;
+
+    if ( cpumask_empty(mask) )
+        mask = &cpu_online_map;
+
+    smp_send_event_check_mask(mask);
+}
 
 /*
  * If get_node is true this will return closest node that needs to be scrubbed,
- * with appropriate bit in node_scrubbing set.
+ * with the caller counted as one of its scrubbers.
  * If get_node is not set, this will return *a* node that needs to be scrubbed.
- * node_scrubbing bitmask will no be updated.
+ * The caller will not be counted as a scrubber.
  * If no node needs scrubbing then NUMA_NO_NODE is returned.
  */
 static unsigned int node_to_scrub(bool get_node)
@@ -1131,8 +1575,7 @@ static unsigned int node_to_scrub(bool get_node)
     if ( node == NUMA_NO_NODE )
         node = 0;
 
-    if ( node_need_scrub[node] &&
-         (!get_node || !node_test_and_set(node, node_scrubbing)) )
+    if ( node_need_scrub[node] && (!get_node || node_claim_scrub(node)) )
         return node;
 
     /*
@@ -1166,10 +1609,10 @@ static unsigned int node_to_scrub(bool get_node)
              * then we'd need to take this lock every time we come in here.
              */
             if ( (dist < shortest || closest == NUMA_NO_NODE) &&
-                 !node_test_and_set(node, node_scrubbing) )
+                 node_claim_scrub(node) )
             {
                 if ( closest != NUMA_NO_NODE )
-                    node_clear(closest, node_scrubbing);
+                    node_release_scrub(closest);
                 shortest = dist;
                 closest = node;
             }
@@ -1179,6 +1622,27 @@ static unsigned int node_to_scrub(bool get_node)
     return closest;
 }
 
+/*
+ * Find the last buddy on @list which needs scrubbing and which no other CPU
+ * is scrubbing.  Unscrubbed buddies are always at the end of the list.
+ */
+static struct page_info *scrub_candidate(struct page_list_head *list)
+{
+    struct page_info *pg;
+
+    ASSERT(spin_is_locked(&heap_lock));
+
+    for ( pg = page_list_last(list); pg; pg = page_list_prev(pg, list) )
+    {
+        if ( pg->u.free.first_dirty == INVALID_DIRTY_IDX )
+            return NULL;
+        if ( pg->u.free.scrub_state == BUDDY_NOT_SCRUBBING )
+            return pg;
+    }
+
+    return NULL;
+}
+
 struct scrub_wait_state {
     struct page_info *pg;
     unsigned int first_dirty;
@@ -1222,17 +1686,11 @@ bool scrub_free_pages(void)
         unsigned int order = MAX_ORDER;
 
         do {
-            while ( !page_list_empty(&heap(node, zone, order)) )
+            while ( (pg = scrub_candidate(&heap(node, zone, order))) != NULL )
             {
                 unsigned int i, dirty_cnt;
                 struct scrub_wait_state st;
 
-                /* Unscrubbed pages are always at the end of the list. */
-                pg = page_list_last(&heap(node, zone, order));
-                if ( pg->u.free.first_dirty == INVALID_DIRTY_IDX )
-                    break;
-
-                ASSERT(pg->u.free.scrub_state == BUDDY_NOT_SCRUBBING);
                 pg->u.free.scrub_state = BUDDY_SCRUBBING;
 
                 spin_unlock(&heap_lock);
@@ -1321,12 +1779,12 @@ bool scrub_free_pages(void)
     spin_unlock(&heap_lock);
 
  out_nolock:
-    node_clear(node, node_scrubbing);
+    node_release_scrub(node);
     return node_to_scrub(false) != NUMA_NO_NODE;
 }
 
-/* Free 2^@order set of pages. */
-static void free_heap_pages(
+/* Free 2^@order set of pages to the heap.  Called with the heap lock held. */
+static void __free_heap_pages(
     struct page_info *pg, unsigned int order, bool need_scrub)
 {
     unsigned long mask, mfn = page_to_mfn(pg);
@@ -1335,8 +1793,7 @@ static void free_heap_pages(
 
     ASSERT(order <= MAX_ORDER);
     ASSERT(node >= 0);
-
-    spin_lock(&heap_lock);
+    ASSERT(spin_is_locked(&heap_lock));
 
     for ( i = 0; i < (1 << order); i++ )
     {
@@ -1440,8 +1897,23 @@ static void free_heap_pages(
 
     if ( tainted )
         reserve_offlined_page(pg);
+}
+
+/* Free 2^@order set of pages. */
+static void free_heap_pages(
+    struct page_info *pg, unsigned int order, bool need_scrub)
+{
+    nodeid_t node = phys_to_nid(page_to_maddr(pg));
+
+    if ( !need_scrub && pcp_free(pg, order) )
+        return;
 
+    spin_lock(&heap_lock);
+    __free_heap_pages(pg, order, need_scrub);
     spin_unlock(&heap_lock);
+
+    if ( need_scrub )
+        scrub_kick(node);
 }
 
 
@@ -1479,7 +1951,12 @@ static unsigned long mark_page_offline(struct page_info *pg, int broken)
     return y;
 }
 
-static int reserve_heap_page(struct page_info *pg)
+/*
+ * Take the free chunk containing @pg off the heap.  If @end is not NULL it
+ * is set to the end of that chunk: any page before it which was offlined
+ * at the same time has been reserved as well.
+ */
+static int reserve_heap_page(struct page_info *pg, struct page_info **end)
 {
     struct page_info *head = NULL;
     unsigned int i, node = phys_to_nid(page_to_maddr(pg));
@@ -1496,7 +1973,11 @@ static int reserve_heap_page(struct page_info *pg)
         {
             if ( (head <= pg) &&
                  (head + (1UL << i) > pg) )
+            {
+                if ( end )
+                    *end = head + (1UL << i);
                 return reserve_offlined_page(head);
+            }
         }
     }
 
@@ -1504,9 +1985,13 @@ static int reserve_heap_page(struct page_info *pg)
 
 }
 
-int offline_page(unsigned long mfn, int broken, uint32_t *status)
+/*
+ * Checks of offline_pages() which need no locking.  Returns < 0 if the page
+ * can't be offlined at all, 1 if *status is final, and 0 if the page is to
+ * be offlined.
+ */
+static int offline_page_check(unsigned long mfn, uint32_t *status)
 {
-    unsigned long old_info = 0;
     struct domain *owner;
     struct page_info *pg;
 
@@ -1547,65 +2032,126 @@ int offline_page(unsigned long mfn, int broken, uint32_t *status)
     {
         *status = PG_OFFLINE_AGAIN;
         domain_shutdown(owner, SHUTDOWN_crash);
-        return 0;
+        return 1;
     }
 
-    spin_lock(&heap_lock);
+    return 0;
+}
 
-    old_info = mark_page_offline(pg, broken);
+/*
+ * Offline the @nr pages from @mfn on, setting status[] for each.  The
+ * per-CPU caches are drained and heap_lock is taken once for the whole
+ * range, and free pages sharing a buddy are taken off the heap together.
+ * The range ends at the first page which can't be offlined at all: its
+ * error is returned and the pages after it are left alone.
+ */
+static int offline_pages(unsigned long mfn, unsigned long nr, int broken,
+                         uint32_t *status)
+{
+    unsigned long i, n;
+    struct page_info *pg, *reserved_end = NULL;
+    struct domain *owner;
+    int rc = 0;
 
-    if ( page_state_is(pg, offlined) )
+    /* Pages still to be dealt with below are left with a status of 0. */
+    for ( n = 0; n < nr; n++ )
     {
-        reserve_heap_page(pg);
+        rc = offline_page_check(mfn + n, &status[n]);
+        if ( rc < 0 )
+            break;
+        rc = 0;
+    }
 
-        spin_unlock(&heap_lock);
+    if ( !n )
+        return rc;
 
-        *status = broken ? PG_OFFLINE_OFFLINED | PG_OFFLINE_BROKEN
-                         : PG_OFFLINE_OFFLINED;
-        return 0;
+    /* A cached page looks in use; return it to the heap to offline it now. */
+    pcp_drain_all();
+
+    spin_lock(&heap_lock);
+
+    for ( i = 0, pg = mfn_to_page(mfn); i < n; i++, pg++ )
+    {
+        unsigned long old_info;
+
+        if ( status[i] )
+            continue;
+
+        old_info = mark_page_offline(pg, broken);
+
+        if ( page_state_is(pg, offlined) )
+            status[i] = broken ? PG_OFFLINE_OFFLINED | PG_OFFLINE_BROKEN
+                               : PG_OFFLINE_OFFLINED;
+        else if ( old_info & PGC_xen_heap )
+            /* Only a hint for the owner check below. */
+            status[i] = PG_OFFLINE_XENPAGE;
     }
 
+    /*
+     * With all of the range marked, taking one of its free pages off the
+     * heap takes its offlined buddies along.
+     */
+    for ( i = 0, pg = mfn_to_page(mfn); i < n; i++, pg++ )
+        if ( (status[i] & PG_OFFLINE_OFFLINED) && pg >= reserved_end )
+            reserve_heap_page(pg, &reserved_end);
+
     spin_unlock(&heap_lock);
 
-    if ( (owner = page_get_owner_and_reference(pg)) )
+    for ( i = 0, pg = mfn_to_page(mfn); i < n; i++, pg++ )
     {
-        if ( p2m_pod_offline_or_broken_hit(pg) )
+        if ( status[i] && status[i] != PG_OFFLINE_XENPAGE )
+            continue;
+
+        if ( (owner = page_get_owner_and_reference(pg)) )
+        {
+            if ( p2m_pod_offline_or_broken_hit(pg) )
+            {
+                put_page(pg);
+                p2m_pod_offline_or_broken_replace(pg);
+                status[i] = PG_OFFLINE_OFFLINED;
+            }
+            else
+            {
+                status[i] = PG_OFFLINE_OWNED | PG_OFFLINE_PENDING |
+                            (owner->domain_id << PG_OFFLINE_OWNER_SHIFT);
+                /* Release the reference since it will not be allocated anymore */
+                put_page(pg);
+            }
+        }
+        else if ( status[i] == PG_OFFLINE_XENPAGE )
         {
-            put_page(pg);
-            p2m_pod_offline_or_broken_replace(pg);
-            *status = PG_OFFLINE_OFFLINED;
+            status[i] = PG_OFFLINE_XENPAGE | PG_OFFLINE_PENDING |
+                        (DOMID_XEN << PG_OFFLINE_OWNER_SHIFT);
         }
         else
         {
-            *status = PG_OFFLINE_OWNED | PG_OFFLINE_PENDING |
-                      (owner->domain_id << PG_OFFLINE_OWNER_SHIFT);
-            /* Release the reference since it will not be allocated anymore */
-            put_page(pg);
+            /*
+             * assign_pages does not hold heap_lock, so small window that the owner
+             * may be set later, but please notice owner will only change from
+             * NULL to be set, not verse, since page is offlining now.
+             * No windows If called from #MC handler, since all CPU are in softirq
+             * If called from user space like CE handling, tools can wait some time
+             * before call again.
+             */
+            status[i] = PG_OFFLINE_ANONYMOUS | PG_OFFLINE_FAILED |
+                        (DOMID_INVALID << PG_OFFLINE_OWNER_SHIFT );
         }
-    }
-    else if ( old_info & PGC_xen_heap )
-    {
-        *status = PG_OFFLINE_XENPAGE | PG_OFFLINE_PENDING |
-                  (DOMID_XEN << PG_OFFLINE_OWNER_SHIFT);
-    }
-    else
-    {
-        /*
-         * assign_pages does not hold heap_lock, so small window that the owner
-         * may be set later, but please notice owner will only change from
-         * NULL to be set, not verse, since page is offlining now.
-         * No windows If called from #MC handler, since all CPU are in softirq
-         * If called from user space like CE handling, tools can wait some time
-         * before call again.
-         */
-        *status = PG_OFFLINE_ANONYMOUS | PG_OFFLINE_FAILED |
-                  (DOMID_INVALID << PG_OFFLINE_OWNER_SHIFT );
+
+        if ( broken )
+            status[i] |= PG_OFFLINE_BROKEN;
     }
 
-    if ( broken )
-        *status |= PG_OFFLINE_BROKEN;
+    return rc;
+}
 
-    return 0;
+int offline_page(unsigned long mfn, int broken, uint32_t *status)
+{
+    return offline_pages(mfn, 1, broken, status);
+}
+
+int offline_page_range(unsigned long mfn, unsigned long nr, uint32_t *status)
+{
+    return offline_pages(mfn, nr, 0, status);
 }
 
 /*
@@ -1694,15 +2240,36 @@ int query_page_offline(unsigned long mfn, uint32_t *status)
 }
 
 /*
- * Hand the specified arbitrary page range to the specified heap zone
- * checking the node_id of the previous page.  If they differ and the
- * latter is not on a MAX_ORDER boundary, then we reserve the page by
- * not freeing it to the buddy allocator.
+ * Free a range of pages on a single node to the heap in the largest
+ * naturally aligned chunks possible, rather than one page at a time and
+ * have each merged with its buddies on the way.
+ */
+static void _init_heap_pages(
+    struct page_info *pg, unsigned long nr_pages, bool need_scrub)
+{
+    unsigned long s = page_to_mfn(pg), e = s + nr_pages;
+
+    while ( s < e )
+    {
+        unsigned int order = min(MAX_ORDER, flsl(e - s) - 1);
+
+        /* MFN 0 goes on its own, as a larger chunk would span zones. */
+        order = s ? min(order, find_first_set_bit(s)) : 0;
+        free_heap_pages(mfn_to_page(s), order, need_scrub);
+        s += 1UL << order;
+    }
+}
+
+/*
+ * Hand the specified arbitrary page range to the heap, setting up the heap
+ * of any node it is the first memory of along the way.  During boot, the
+ * pages may be left for the idle scrubber (bootscrub=idle).
  */
 static void init_heap_pages(
     struct page_info *pg, unsigned long nr_pages)
 {
-    unsigned long i;
+    unsigned long i, n;
+    bool need_scrub = scrub_debug;
 
     /*
      * Some pages may not go through the boot allocator (e.g reserved
@@ -1714,7 +2281,10 @@ static void init_heap_pages(
     first_valid_mfn = min_t(unsigned long, page_to_mfn(pg), first_valid_mfn);
     spin_unlock(&heap_lock);
 
-    for ( i = 0; i < nr_pages; i++ )
+    if ( system_state < SYS_STATE_active && opt_bootscrub == BOOTSCRUB_IDLE )
+        need_scrub = true;
+
+    for ( i = 0; i < nr_pages; i += n )
     {
         unsigned int nid = phys_to_nid(page_to_maddr(pg+i));
 
@@ -1725,22 +2295,23 @@ static void init_heap_pages(
             bool_t use_tail = (nid == phys_to_nid(pfn_to_paddr(e - 1))) &&
                               !(s & ((1UL << MAX_ORDER) - 1)) &&
                               (find_first_set_bit(e) <= find_first_set_bit(s));
-            unsigned long n;
 
             n = init_node_heap(nid, page_to_mfn(pg+i), nr_pages - i,
                                &use_tail);
             BUG_ON(i + n > nr_pages);
             if ( n && !use_tail )
-            {
-                i += n - 1;
                 continue;
-            }
             if ( i + n == nr_pages )
                 break;
             nr_pages -= n;
         }
 
-        free_heap_pages(pg + i, 0, scrub_debug);
+        /* The pages from here on which are on the same node. */
+        for ( n = 1; i + n < nr_pages; n++ )
+            if ( phys_to_nid(page_to_maddr(pg + i + n)) != nid )
+                break;
+
+        _init_heap_pages(pg + i, n, need_scrub);
     }
 }
 
@@ -1880,6 +2451,7 @@ static int __init find_non_smt(unsigned int node, cpumask_t *dest)
  */
 static void __init scrub_heap_pages(void)
 {
+    s_time_t start_time = NOW();
     cpumask_t node_cpus, all_worker_cpus;
     unsigned int i, j;
     unsigned long offset, max_per_cpu_sz = 0;
@@ -2001,7 +2573,7 @@ static void __init scrub_heap_pages(void)
         }
     }
 
-    printk("done.\n");
+    printk("done (%"PRI_stime"ms).\n", (NOW() - start_time) / MILLISECS(1));
 
 #ifdef CONFIG_SCRUB_DEBUG
     scrub_debug = true;
@@ -2016,8 +2588,19 @@ void __init heap_init_late(void)
      */
     setup_low_mem_virq();
 
-    if ( opt_bootscrub )
+    switch ( opt_bootscrub )
+    {
+    case BOOTSCRUB_ON:
         scrub_heap_pages();
+        break;
+
+    case BOOTSCRUB_IDLE:
+        printk("Scrubbing Free RAM in the background\n");
+        break;
+
+    case BOOTSCRUB_OFF:
+        break;
+    }
 }
 
 
@@ -2341,6 +2924,12 @@ unsigned long avail_node_heap_pages(unsigned int nodeid)
     return avail_heap_pages(MEMZONE_XEN, NR_ZONES -1, nodeid);
 }
 
+/* Free pages on @node still to be scrubbed.  Racy, but good enough. */
+unsigned long node_scrub_pending(unsigned int node)
+{
+    return ACCESS_ONCE(node_need_scrub[node]);
+}
+
 
 static void pagealloc_info(unsigned char key)
 {
@@ -2367,6 +2956,30 @@ static void pagealloc_info(unsigned char key)
     }
 
     printk("    Dom heap: %lukB free\n", total << (PAGE_SHIFT-10));
+
+    if ( pcp_initialised )
+    {
+        unsigned long hits = 0, misses = 0, frees = 0, overflows = 0;
+        unsigned int cpu;
+
+        for_each_online_cpu ( cpu )
+        {
+            const struct pcp_cache *pc = &per_cpu(pcp_cache, cpu);
+
+            hits += pc->hits;
+            misses += pc->misses;
+            frees += pc->frees;
+            overflows += pc->overflows;
+        }
+
+        printk("    Per-CPU caches: %ukB cached, %lu/%lu allocation hits, "
+               "%lu frees, %lu overflows\n",
+               atomic_read(&pcp_cached_pages) << (PAGE_SHIFT-10),
+               hits, hits + misses, frees, overflows);
+    }
+
+    xmalloc_cache_info();
+    xmem_cache_info();
 }
 
 static __init int pagealloc_keyhandler_init(void)
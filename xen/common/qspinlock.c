@@ -0,0 +1,139 @@
+/******************************************************************************
+ * qspinlock.c
+ *
+ * Queued spinlocks.  A queued lock keeps the 32-bit word of the ticket lock,
+ * read as a locked byte and a 16-bit tail naming the last queued waiter.
+ * Waiters queue up MCS-style on per-CPU nodes, each spinning on its own
+ * node, so that only the head of the queue polls the lock word: a release
+ * moves one cache line to one CPU, rather than to every waiter as with
+ * tickets.  A CPU can be queued on one lock per nesting level (normal,
+ * IRQ, NMI/#MC context); deeper nesting falls back to polling the word.
+ *
+ * The uncontended paths, a cmpxchg to lock and a byte store to unlock, are
+ * in spinlock.c.
+ */
+
+#include <xen/percpu.h>
+#include <xen/smp.h>
+#include <xen/spinlock.h>
+#include <asm/atomic.h>
+#include <asm/processor.h>
+
+#define QSPIN_LOCKED        1U
+#define QSPIN_NODES         4
+
+struct qspin_node {
+    struct qspin_node *next;
+    unsigned int locked;        /* set by the previous waiter: we are head */
+};
+
+static DEFINE_PER_CPU(struct qspin_node[QSPIN_NODES], qspin_nodes);
+static DEFINE_PER_CPU(unsigned int, qspin_depth);
+
+/* Tail 0 means "no waiters", hence cpu + 1. */
+static inline uint16_t qspin_encode_tail(unsigned int cpu, unsigned int idx)
+{
+    return ((cpu + 1) << 2) | idx;
+}
+
+static inline struct qspin_node *qspin_decode_tail(uint16_t tail)
+{
+    return &per_cpu(qspin_nodes, (tail >> 2) - 1)[tail & 3];
+}
+
+/* Swap in a new tail, keeping the locked byte; returns the old tail. */
+static uint16_t qspin_xchg_tail(spinlock_tickets_t *t, uint16_t tail)
+{
+    uint32_t val = read_atomic(&t->head_tail), old;
+
+    for ( ; ; )
+    {
+        old = cmpxchg(&t->head_tail, val,
+                      (val & 0xffff) | ((uint32_t)tail << 16));
+        if ( old == val )
+            return old >> 16;
+        val = old;
+    }
+}
+
+static bool qspin_trylock(spinlock_tickets_t *t)
+{
+    return !read_atomic(&t->head_tail) &&
+           cmpxchg(&t->head_tail, 0, QSPIN_LOCKED) == 0;
+}
+
+void queued_spin_lock_slowpath(spinlock_tickets_t *t,
+                               void (*cb)(void *), void *data)
+{
+    struct qspin_node *node, *next;
+    unsigned int idx = this_cpu(qspin_depth)++;
+    uint16_t tail, prev;
+    uint32_t val;
+
+    if ( unlikely(idx >= QSPIN_NODES) )
+    {
+        while ( !qspin_trylock(t) )
+        {
+            if ( unlikely(cb) )
+                cb(data);
+            arch_lock_relax();
+        }
+        goto out;
+    }
+
+    node = &this_cpu(qspin_nodes)[idx];
+    node->next = NULL;
+    node->locked = 0;
+    tail = qspin_encode_tail(smp_processor_id(), idx);
+
+    /* The node must be initialised before it becomes visible in the tail. */
+    smp_wmb();
+    prev = qspin_xchg_tail(t, tail);
+    if ( prev )
+    {
+        write_atomic(&qspin_decode_tail(prev)->next, node);
+        while ( !read_atomic(&node->locked) )
+        {
+            if ( unlikely(cb) )
+                cb(data);
+            arch_lock_relax();
+        }
+        smp_mb();
+    }
+
+    /* Head of the queue: wait for the owner to release the lock. */
+    while ( (val = read_atomic(&t->head_tail)) & 0xff )
+    {
+        if ( unlikely(cb) )
+            cb(data);
+        arch_lock_relax();
+    }
+
+    /*
+     * If nobody queued behind us, take the lock and empty the queue in one
+     * go.  Otherwise only the head may set the locked byte (the fast path
+     * needs a zero word), and the next waiter becomes head.
+     */
+    if ( (val >> 16) == tail &&
+         cmpxchg(&t->head_tail, val, QSPIN_LOCKED) == val )
+        goto out;
+
+    write_atomic(&t->locked, QSPIN_LOCKED);
+
+    while ( !(next = read_atomic(&node->next)) )
+        cpu_relax();
+    write_atomic(&next->locked, 1);
+
+ out:
+    this_cpu(qspin_depth)--;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -51,13 +51,18 @@ static struct rcu_ctrlblk {
     long completed;     /* Number of the last completed batch         */
     int  next_pending;  /* Is the next batch already waiting?         */
 
+    long expedite;      /* Last batch to be expedited                 */
+    s_time_t gp_start;  /* When the current batch started             */
+
     spinlock_t  lock __cacheline_aligned;
     cpumask_t   cpumask; /* CPUs that need to switch in order ... */
     cpumask_t   idle_cpumask; /* ... unless they are already idle */
     /* for current batch to proceed.        */
+    cpumask_t   expedite_cpumask; /* CPUs waiting for expedited batches */
 } __cacheline_aligned rcu_ctrlblk = {
     .cur = -300,
     .completed = -300,
+    .expedite = -300,
     .lock = SPIN_LOCK_UNLOCKED,
 };
 
@@ -84,6 +89,7 @@ struct rcu_data {
     int cpu;
     struct rcu_head barrier;
     long            last_rs_qlen;     /* qlen during the last resched */
+    bool            expedite;         /* expedite nxtlist's batch */
 
     /* 3) idle CPUs handling */
     struct timer idle_timer;
@@ -235,6 +241,43 @@ void call_rcu(struct rcu_head *head,
     local_irq_restore(flags);
 }
 
+/*
+ * Expedite all batches up to rdp's current one.  Instead of waiting for the
+ * CPUs a batch needs a quiescent state from to get to RCU_SOFTIRQ on their
+ * own, they get it raised as soon as the batch starts.  Since Xen never
+ * processes softirqs inside an RCU read-side critical section, handling it
+ * is enough for them to pass through a quiescent state.  Caller must hold
+ * rcu_ctrlblk.lock.
+ */
+static void rcu_expedite_batch(struct rcu_ctrlblk *rcp, struct rcu_data *rdp)
+{
+    cpumask_set_cpu(rdp->cpu, &rcp->expedite_cpumask);
+    if (!rcu_batch_before(rcp->expedite, rdp->batch))
+        return;
+
+    perfc_incr(rcu_expedited);
+    rcp->expedite = rdp->batch;
+    /* Any batch in progress has to complete before ours can start. */
+    if (rcp->cur != rcp->completed)
+        cpumask_raise_softirq(&rcp->cpumask, RCU_SOFTIRQ);
+}
+
+/**
+ * rcu_expedite - Complete the grace periods for the callbacks this CPU
+ * queued so far as soon as possible.
+ *
+ * This costs an IPI to every non-idle CPU per grace period, so it is meant
+ * for paths like domain destruction, where callbacks waiting for CPUs to
+ * get around to a quiescent state (or idle CPUs for their idle timer) hold
+ * up something the toolstack is waiting for.
+ */
+void rcu_expedite(void)
+{
+    /* The rest is up to __rcu_process_callbacks(). */
+    this_cpu(rcu_data).expedite = true;
+    raise_softirq(RCU_SOFTIRQ);
+}
+
 /*
  * Invoke the completed RCU callbacks. They are expected to be in
  * a per-cpu list.
@@ -306,6 +349,10 @@ static void rcu_start_batch(struct rcu_ctrlblk *rcp)
         */
         smp_mb();
         cpumask_andnot(&rcp->cpumask, &cpu_online_map, &rcp->idle_cpumask);
+        rcp->gp_start = NOW();
+
+        if (!rcu_batch_before(rcp->expedite, rcp->cur))
+            cpumask_raise_softirq(&rcp->cpumask, RCU_SOFTIRQ);
     }
 }
 
@@ -320,6 +367,16 @@ static void cpu_quiet(int cpu, struct rcu_ctrlblk *rcp)
     if (cpumask_empty(&rcp->cpumask)) {
         /* batch completed ! */
         rcp->completed = rcp->cur;
+        perfc_incr(rcu_grace_periods);
+        perfc_add(rcu_grace_period_us, (NOW() - rcp->gp_start) / MICROSECS(1));
+
+        /* Have whoever expedited it invoke their callbacks right away. */
+        if (!cpumask_empty(&rcp->expedite_cpumask)) {
+            cpumask_raise_softirq(&rcp->expedite_cpumask, RCU_SOFTIRQ);
+            if (!rcu_batch_before(rcp->completed, rcp->expedite))
+                cpumask_clear(&rcp->expedite_cpumask);
+        }
+
         rcu_start_batch(rcp);
     }
 }
@@ -392,6 +449,13 @@ static void __rcu_process_callbacks(struct rcu_ctrlblk *rcp,
          */
         smp_rmb();
 
+        if (unlikely(rdp->expedite)) {
+            rdp->expedite = false;
+            spin_lock(&rcp->lock);
+            rcu_expedite_batch(rcp, rdp);
+            spin_unlock(&rcp->lock);
+        }
+
         if (!rcp->next_pending) {
             /* and start it/schedule start if it's a new batch */
             spin_lock(&rcp->lock);
@@ -401,6 +465,16 @@ static void __rcu_process_callbacks(struct rcu_ctrlblk *rcp,
         }
     } else {
         local_irq_enable();
+
+        if (unlikely(rdp->expedite)) {
+            /* nxtlist's batch gets expedited once it is known. */
+            rdp->expedite = rdp->nxtlist;
+            if (rdp->curlist) {
+                spin_lock(&rcp->lock);
+                rcu_expedite_batch(rcp, rdp);
+                spin_unlock(&rcp->lock);
+            }
+        }
     }
     rcu_check_quiescent_state(rcp, rdp);
     if (rdp->donelist)
@@ -541,6 +615,7 @@ static void rcu_offline_cpu(struct rcu_data *this_rdp,
     spin_lock(&rcp->lock);
     if (rcp->cur != rcp->completed)
         cpu_quiet(rdp->cpu, rcp);
+    cpumask_clear_cpu(rdp->cpu, &rcp->expedite_cpumask);
     spin_unlock(&rcp->lock);
 
     rcu_move_batch(this_rdp, rdp->donelist, rdp->donetail);
@@ -1,5 +1,6 @@
 #include <xen/rwlock.h>
 #include <xen/irq.h>
+#include <public/sysctl.h>
 
 /*
  * rspin_until_writer_unlock - spin until writer is gone.
@@ -26,6 +27,7 @@ static inline void rspin_until_writer_unlock(rwlock_t *lock, u32 cnts)
 void queue_read_lock_slowpath(rwlock_t *lock)
 {
     u32 cnts;
+    s64 wait = lock_cont_start();
 
     /*
      * Readers come here when they cannot get the lock without waiting.
@@ -54,6 +56,8 @@ void queue_read_lock_slowpath(rwlock_t *lock)
      * Signal the next one in queue to become queue head.
      */
     spin_unlock(&lock->lock);
+
+    lock_cont_wait(LOCKCONT_TYPE_READ_WAIT, __builtin_return_address(0), wait);
 }
 
 /*
@@ -63,6 +67,7 @@ void queue_read_lock_slowpath(rwlock_t *lock)
 void queue_write_lock_slowpath(rwlock_t *lock)
 {
     u32 cnts;
+    s64 wait = lock_cont_start();
 
     /* Put the writer into the wait queue. */
     spin_lock(&lock->lock);
@@ -100,6 +105,8 @@ void queue_write_lock_slowpath(rwlock_t *lock)
     }
  unlock:
     spin_unlock(&lock->lock);
+
+    lock_cont_wait(LOCKCONT_TYPE_WRITE_WAIT, __builtin_return_address(0), wait);
 }
 
 
@@ -25,6 +25,7 @@
 #include <xen/trace.h>
 #include <xen/cpu.h>
 #include <xen/keyhandler.h>
+#include <xen/rbtree.h>
 
 /* Meant only for helping developers during debugging. */
 /* #define d2printk printk */
@@ -303,6 +304,25 @@
 static unsigned int __read_mostly opt_migrate_resist = 500;
 integer_param("sched_credit2_migrate_resist", opt_migrate_resist);
 
+/*
+ * Cache affinity.
+ *
+ * A vcpu that last ran less than opt_cache_stickiness_us ago is considered
+ * to still have its working set in the last level cache (LLC) of the pcpu
+ * it ran on. On wakeup, such a vcpu is steered toward pcpus sharing that
+ * LLC, and preempting a busy pcpu outside of it must overcome an extra
+ * CSCHED2_MIGRATE_RESIST worth of credit, to model the cost of re-fetching
+ * the working set.
+ *
+ * A vcpu whose cache footprint has gone cold instead prefers pcpus sharing
+ * the LLC of the pcpu doing the wakeup, so that tightly coupled pairs (e.g.,
+ * a frontend and its backend) end up running close to each other.
+ *
+ * Zero disables cache-aware placement.
+ */
+static unsigned int __read_mostly opt_cache_stickiness_us = 1000;
+integer_param("credit2_cache_stickiness_us", opt_cache_stickiness_us);
+
 /*
  * Load tracking and load balancing
  *
@@ -459,13 +479,57 @@ static int parse_credit2_runqueue(const char *s)
 }
 custom_param("credit2_runqueue", parse_credit2_runqueue);
 
+/*
+ * Idle work stealing: when a pcpu is about to go idle, and nothing in its
+ * own runqueue can run on it, it looks for the runqueue with the largest
+ * backlog among the ones within the distance specified here, and pulls a
+ * vcpu from there, rather than waiting for the next balance_load().
+ * Distances are expressed in terms of the same topology levels used for
+ * arranging runqueues ('none' disables stealing).
+ */
+static const char *const opt_idle_steal_str[] = {
+    [OPT_RUNQUEUE_CPU] = "none",
+    [OPT_RUNQUEUE_CORE] = "core",
+    [OPT_RUNQUEUE_SOCKET] = "socket",
+    [OPT_RUNQUEUE_NODE] = "node",
+    [OPT_RUNQUEUE_ALL] = "all"
+};
+static int __read_mostly opt_idle_steal = OPT_RUNQUEUE_NODE;
+
+static int parse_credit2_idle_steal(const char *s)
+{
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(opt_idle_steal_str); i++ )
+    {
+        if ( !strcmp(s, opt_idle_steal_str[i]) )
+        {
+            opt_idle_steal = i;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+custom_param("credit2_idle_steal", parse_credit2_idle_steal);
+
+/*
+ * Runqueue lock hold time, as accounted by the scheduling and wakeup hooks
+ * (which are where the runqueue lock is held the longest and most often).
+ */
+struct csched2_lock_stats {
+    unsigned long nr;          /* Number of accounted lock holds             */
+    s_time_t total;            /* Total time held                            */
+    s_time_t max;              /* Longest single hold                        */
+};
+
 /*
  * Per-runqueue data
  */
 struct csched2_runqueue_data {
     spinlock_t lock;           /* Lock for this runqueue                     */
 
-    struct list_head runq;     /* Ordered list of runnable vms               */
+    struct rb_root runq;       /* Runnable vcpus, sorted by credit           */
     int id;                    /* ID of this runqueue (-1 if invalid)        */
 
     int load;                  /* Instantaneous load (num of non-idle vcpus) */
@@ -481,6 +545,9 @@ struct csched2_runqueue_data {
     struct list_head svc;      /* List of all vcpus assigned to the runqueue */
     unsigned int max_weight;   /* Max weight of the vcpus in this runqueue   */
     unsigned int pick_bias;    /* Last picked pcpu. Start from it next time  */
+
+    struct csched2_lock_stats sched_hold; /* Lock held in csched2_schedule() */
+    struct csched2_lock_stats wake_hold;  /* Lock held in csched2_vcpu_wake() */
 };
 
 /*
@@ -525,12 +592,13 @@ struct csched2_vcpu {
     s_time_t budget_quota;             /* Budget to which vCPU is entitled    */
 
     s_time_t start_time;               /* Time we were scheduled (for credit) */
+    s_time_t last_ran;                 /* Time we were last descheduled       */
 
     /* Individual contribution to load                                        */
     s_time_t load_last_update;         /* Last time average was updated       */
     s_time_t avgload;                  /* Decaying queue load                 */
 
-    struct list_head runq_elem;        /* On the runqueue (rqd->runq)         */
+    struct rb_node runq_elem;          /* On the runqueue (rqd->runq)         */
     struct list_head parked_elem;      /* On the parked_vcpus list            */
     struct list_head rqd_elem;         /* On csched2_runqueue_data's svc list */
     struct csched2_runqueue_data *migrate_rqd; /* Pre-determined migr. target */
@@ -788,12 +856,23 @@ static s_time_t c2t(struct csched2_runqueue_data *rqd, s_time_t credit, struct c
 
 static inline int vcpu_on_runq(struct csched2_vcpu *svc)
 {
-    return !list_empty(&svc->runq_elem);
+    return !RB_EMPTY_NODE(&svc->runq_elem);
 }
 
-static inline struct csched2_vcpu * runq_elem(struct list_head *elem)
+static inline struct csched2_vcpu * runq_elem(struct rb_node *elem)
 {
-    return list_entry(elem, struct csched2_vcpu, runq_elem);
+    return rb_entry(elem, struct csched2_vcpu, runq_elem);
+}
+
+static inline void lock_stats_account(struct csched2_lock_stats *stats,
+                                      s_time_t start)
+{
+    s_time_t held = NOW() - start;
+
+    stats->nr++;
+    stats->total += held;
+    if ( held > stats->max )
+        stats->max = held;
 }
 
 static void activate_runqueue(struct csched2_private *prv, int rqi)
@@ -807,8 +886,10 @@ static void activate_runqueue(struct csched2_private *prv, int rqi)
     rqd->max_weight = 1;
     rqd->id = rqi;
     INIT_LIST_HEAD(&rqd->svc);
-    INIT_LIST_HEAD(&rqd->runq);
+    rqd->runq = RB_ROOT;
     spin_lock_init(&rqd->lock);
+    memset(&rqd->sched_hold, 0, sizeof(rqd->sched_hold));
+    memset(&rqd->wake_hold, 0, sizeof(rqd->wake_hold));
 
     __cpumask_set_cpu(rqi, &prv->active_queues);
 }
@@ -842,6 +923,12 @@ static inline bool same_core(unsigned int cpua, unsigned int cpub)
            cpu_to_core(cpua) == cpu_to_core(cpub);
 }
 
+static inline bool same_llc(unsigned int cpua, unsigned int cpub)
+{
+    return same_socket(cpua, cpub) &&
+           cpu_to_llc(cpua) == cpu_to_llc(cpub);
+}
+
 static unsigned int
 cpu_to_runqueue(struct csched2_private *prv, unsigned int cpu)
 {
@@ -1264,12 +1351,19 @@ update_load(const struct scheduler *ops,
         update_svc_load(ops, svc, change, now);
 }
 
+/*
+ * The runqueue is a tree sorted by decreasing credit, vcpus with the same
+ * credit being kept in FIFO order.  Note that the credit of vcpus already
+ * in the runqueue is, in a few occasions (e.g., reset_credit()), updated in
+ * place. That may leave the tree not strictly sorted, in the same way as
+ * it would have left a sorted list, but never breaks its structure.
+ */
 static void
 runq_insert(const struct scheduler *ops, struct csched2_vcpu *svc)
 {
-    struct list_head *iter;
     unsigned int cpu = svc->vcpu->processor;
-    struct list_head * runq = &c2rqd(ops, cpu)->runq;
+    struct rb_root *runq = &c2rqd(ops, cpu)->runq;
+    struct rb_node **link = &runq->rb_node, *parent = NULL;
     int pos = 0;
 
     ASSERT(spin_is_locked(per_cpu(schedule_data, cpu).schedule_lock));
@@ -1282,16 +1376,19 @@ runq_insert(const struct scheduler *ops, struct csched2_vcpu *svc)
     ASSERT(!svc->vcpu->is_running);
     ASSERT(!(svc->flags & CSFLAG_scheduled));
 
-    list_for_each( iter, runq )
+    /* pos is the depth at which svc is inserted, for tracing. */
+    while ( *link )
     {
-        struct csched2_vcpu * iter_svc = runq_elem(iter);
-
-        if ( svc->credit > iter_svc->credit )
-            break;
+        parent = *link;
+        if ( svc->credit > runq_elem(parent)->credit )
+            link = &parent->rb_left;
+        else
+            link = &parent->rb_right;
 
         pos++;
     }
-    list_add_tail(&svc->runq_elem, iter);
+    rb_link_node(&svc->runq_elem, parent, link);
+    rb_insert_color(&svc->runq_elem, runq);
 
     if ( unlikely(tb_init_done) )
     {
@@ -1311,7 +1408,8 @@ runq_insert(const struct scheduler *ops, struct csched2_vcpu *svc)
 static inline void runq_remove(struct csched2_vcpu *svc)
 {
     ASSERT(vcpu_on_runq(svc));
-    list_del_init(&svc->runq_elem);
+    rb_erase(&svc->runq_elem, &svc->rqd->runq);
+    RB_CLEAR_NODE(&svc->runq_elem);
 }
 
 void burn_credits(struct csched2_runqueue_data *rqd, struct csched2_vcpu *, s_time_t);
@@ -1355,6 +1453,43 @@ static inline bool is_preemptable(const struct csched2_vcpu *svc,
  *
  * Within the same class, the highest difference of credit.
  */
+static inline bool cache_hot(const struct csched2_vcpu *svc, s_time_t now)
+{
+    return opt_cache_stickiness_us &&
+           now - svc->last_ran < MICROSECS(opt_cache_stickiness_us);
+}
+
+/*
+ * Pick a pcpu from mask for a vcpu that was running on cpu, preferring cpu
+ * itself, and then the pcpus sharing a last level cache with llc_cpu.
+ */
+static unsigned int pick_cache_affine(unsigned int cpu, unsigned int llc_cpu,
+                                      const cpumask_t *mask)
+{
+    unsigned int first, i;
+
+    if ( !opt_cache_stickiness_us )
+        return cpumask_test_or_cycle(cpu, mask);
+
+    if ( cpumask_test_cpu(cpu, mask) && same_llc(cpu, llc_cpu) )
+        return cpu;
+
+    first = i = cpumask_cycle(cpu, mask);
+    if ( first >= nr_cpu_ids )
+        return first;
+
+    do {
+        if ( same_llc(i, llc_cpu) )
+        {
+            SCHED_STAT_CRANK(tickled_llc_cpu);
+            return i;
+        }
+        i = cpumask_cycle(i, mask);
+    } while ( i != first );
+
+    return cpumask_test_or_cycle(cpu, mask);
+}
+
 static s_time_t tickle_score(const struct scheduler *ops, s_time_t now,
                              struct csched2_vcpu *new, unsigned int cpu)
 {
@@ -1376,7 +1511,11 @@ static s_time_t tickle_score(const struct scheduler *ops, s_time_t now,
 
     score = new->credit - cur->credit;
     if ( new->vcpu->processor != cpu )
+    {
         score -= CSCHED2_MIGRATE_RESIST;
+        if ( cache_hot(new, now) && !same_llc(new->vcpu->processor, cpu) )
+            score -= CSCHED2_MIGRATE_RESIST;
+    }
 
     /*
      * If score is positive, it means new has enough credits (i.e.,
@@ -1432,7 +1571,7 @@ runq_tickle(const struct scheduler *ops, struct csched2_vcpu *new, s_time_t now)
 {
     int i, ipid = -1;
     s_time_t max = 0;
-    unsigned int bs, cpu = new->vcpu->processor;
+    unsigned int bs, cpu = new->vcpu->processor, llc_cpu;
     struct csched2_runqueue_data *rqd = c2rqd(ops, cpu);
     cpumask_t *online = cpupool_domain_cpumask(new->vcpu->domain);
     cpumask_t mask;
@@ -1455,6 +1594,13 @@ runq_tickle(const struct scheduler *ops, struct csched2_vcpu *new, s_time_t now)
                     (unsigned char *)&d);
     }
 
+    /*
+     * If new's working set is likely still in the cache of where it ran
+     * last, stay close to it. If not, go close to whoever is waking it up
+     * (which is the pcpu we are running on).
+     */
+    llc_cpu = cache_hot(new, now) ? cpu : smp_processor_id();
+
     for_each_affinity_balance_step( bs )
     {
         /* Just skip first step, if we don't have a soft affinity */
@@ -1480,7 +1626,7 @@ runq_tickle(const struct scheduler *ops, struct csched2_vcpu *new, s_time_t now)
         else
             cpumask_and(&mask, &rqd->smt_idle, online);
         cpumask_and(&mask, &mask, cpumask_scratch_cpu(cpu));
-        i = cpumask_test_or_cycle(cpu, &mask);
+        i = pick_cache_affine(cpu, llc_cpu, &mask);
         if ( i < nr_cpu_ids )
         {
             SCHED_STAT_CRANK(tickled_idle_cpu);
@@ -1496,7 +1642,7 @@ runq_tickle(const struct scheduler *ops, struct csched2_vcpu *new, s_time_t now)
         cpumask_andnot(&mask, &rqd->idle, &rqd->tickled);
         cpumask_and(cpumask_scratch_cpu(cpu), cpumask_scratch_cpu(cpu), online);
         cpumask_and(&mask, &mask, cpumask_scratch_cpu(cpu));
-        i = cpumask_test_or_cycle(cpu, &mask);
+        i = pick_cache_affine(cpu, llc_cpu, &mask);
         if ( i < nr_cpu_ids )
         {
             SCHED_STAT_CRANK(tickled_idle_cpu);
@@ -2013,7 +2159,7 @@ csched2_alloc_vdata(const struct scheduler *ops, struct vcpu *vc, void *dd)
         return NULL;
 
     INIT_LIST_HEAD(&svc->rqd_elem);
-    INIT_LIST_HEAD(&svc->runq_elem);
+    RB_CLEAR_NODE(&svc->runq_elem);
 
     svc->sdom = dd;
     svc->vcpu = vc;
@@ -2118,6 +2264,8 @@ csched2_vcpu_wake(const struct scheduler *ops, struct vcpu *vc)
     runq_insert(ops, svc);
     runq_tickle(ops, svc, now);
 
+    lock_stats_account(&svc->rqd->wake_hold, now);
+
 out:
     return;
 }
@@ -2130,6 +2278,50 @@ csched2_vcpu_yield(const struct scheduler *ops, struct vcpu *v)
     __set_bit(__CSFLAG_vcpu_yield, &svc->flags);
 }
 
+/*
+ * v is spinning, and target, which is runnable but not running, may be
+ * what it is waiting for. If target has less credit than v, hand it the
+ * difference, so it moves up in its runqueue (and possibly preempts
+ * someone), while v, which is about to yield anyway, pays for that.
+ */
+static bool
+csched2_vcpu_yield_to(const struct scheduler *ops, struct vcpu *v,
+                      struct vcpu *target)
+{
+    struct csched2_vcpu * const svc = csched2_vcpu(v);
+    struct csched2_vcpu * const stgt = csched2_vcpu(target);
+    spinlock_t *lock;
+    int credit, boost = 0;
+
+    ASSERT(v->domain == target->domain);
+
+    lock = vcpu_schedule_lock_irq(v);
+    credit = svc->credit;
+    vcpu_schedule_unlock_irq(lock, v);
+
+    lock = vcpu_schedule_lock_irq(target);
+    if ( vcpu_on_runq(stgt) && !target->is_running && credit > stgt->credit )
+    {
+        boost = credit - stgt->credit;
+        runq_remove(stgt);
+        stgt->credit += boost;
+        runq_insert(ops, stgt);
+        runq_tickle(ops, stgt, NOW());
+    }
+    vcpu_schedule_unlock_irq(lock, target);
+
+    if ( boost == 0 )
+        return false;
+
+    lock = vcpu_schedule_lock_irq(v);
+    svc->credit -= boost;
+    vcpu_schedule_unlock_irq(lock, v);
+
+    SCHED_STAT_CRANK(yield_to_boost);
+
+    return true;
+}
+
 static void
 csched2_context_saved(const struct scheduler *ops, struct vcpu *vc)
 {
@@ -2143,6 +2335,7 @@ csched2_context_saved(const struct scheduler *ops, struct vcpu *vc)
 
     /* This vcpu is now eligible to be put on the runqueue again */
     __clear_bit(__CSFLAG_scheduled, &svc->flags);
+    svc->last_ran = now;
 
     if ( unlikely(has_cap(svc) && svc->budget > 0) )
         vcpu_return_budget(svc, &were_parked);
@@ -2708,6 +2901,141 @@ retry:
     return;
 }
 
+static bool idle_steal_in_range(unsigned int cpu,
+                                const struct csched2_runqueue_data *rqd)
+{
+    unsigned int peer = cpumask_first(&rqd->active);
+
+    if ( peer >= nr_cpu_ids )
+        return false;
+
+    switch ( opt_idle_steal )
+    {
+    case OPT_RUNQUEUE_CORE:
+        return same_core(peer, cpu);
+    case OPT_RUNQUEUE_SOCKET:
+        return same_socket(peer, cpu);
+    case OPT_RUNQUEUE_NODE:
+        return same_node(peer, cpu);
+    case OPT_RUNQUEUE_ALL:
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Number of vcpus waiting in rqd's runqueue, i.e., the ones that contribute
+ * to its load without running. Can be called without holding rqd's lock,
+ * in which case the result is only a hint.
+ */
+static int runq_backlog(const struct csched2_runqueue_data *rqd)
+{
+    return rqd->load - (cpumask_weight(&rqd->active) -
+                        cpumask_weight(&rqd->idle));
+}
+
+/*
+ * Called by csched2_schedule(), with the lock of cpu's runqueue held, when
+ * cpu is about to go idle. Tries to pull, onto cpu, a vcpu waiting in the
+ * busiest runqueue within opt_idle_steal distance. Returns whether one such
+ * vcpu has been put in cpu's runqueue.
+ */
+static bool idle_steal(const struct scheduler *ops, unsigned int cpu,
+                       s_time_t now)
+{
+    struct csched2_private *prv = csched2_priv(ops);
+    struct csched2_runqueue_data *lrqd = c2rqd(ops, cpu), *orqd = NULL;
+    struct rb_node *iter;
+    int i, backlog, max_backlog = 0;
+    bool stolen = false;
+
+    ASSERT(spin_is_locked(per_cpu(schedule_data, cpu).schedule_lock));
+
+    if ( opt_idle_steal == OPT_RUNQUEUE_CPU )
+        return false;
+
+    if ( !read_trylock(&prv->lock) )
+        return false;
+
+    /* Lockless scan, for finding the most promising victim. */
+    for_each_cpu(i, &prv->active_queues)
+    {
+        struct csched2_runqueue_data *rqd = prv->rqd + i;
+
+        if ( rqd == lrqd || !idle_steal_in_range(cpu, rqd) )
+            continue;
+
+        backlog = runq_backlog(rqd);
+        if ( backlog > max_backlog )
+        {
+            max_backlog = backlog;
+            orqd = rqd;
+        }
+    }
+
+    read_unlock(&prv->lock);
+
+    /* Same as in balance_load(), we can only trylock another runqueue. */
+    if ( !orqd || !spin_trylock(&orqd->lock) )
+        return false;
+
+    if ( unlikely(orqd->id < 0) || runq_backlog(orqd) <= 0 )
+        goto out;
+
+    for ( iter = rb_first(&orqd->runq); iter; iter = rb_next(iter) )
+    {
+        struct csched2_vcpu *svc = runq_elem(iter);
+
+        if ( !cpumask_test_cpu(cpu, svc->vcpu->cpu_hard_affinity) ||
+             !vcpu_is_migrateable(svc, lrqd) )
+            continue;
+
+        /* Leave alone vcpus that a pcpu over there is about to pick up. */
+        if ( svc->tickled_cpu != -1 &&
+             cpumask_test_cpu(svc->tickled_cpu, &orqd->tickled) )
+            continue;
+
+        if ( unlikely(tb_init_done) )
+        {
+            struct {
+                unsigned vcpu:16, dom:16;
+                unsigned rqi:16, trqi:16;
+            } d;
+            d.dom = svc->vcpu->domain->domain_id;
+            d.vcpu = svc->vcpu->vcpu_id;
+            d.rqi = orqd->id;
+            d.trqi = lrqd->id;
+            __trace_var(TRC_CSCHED2_MIGRATE, 1,
+                        sizeof(d),
+                        (unsigned char *)&d);
+        }
+
+        /* Safe, as we hold the locks of both the runqueues. */
+        runq_remove(svc);
+        update_load(ops, orqd, NULL, -1, now);
+        _runq_deassign(svc);
+
+        svc->vcpu->processor = cpu;
+        _runq_assign(svc, lrqd);
+        update_load(ops, lrqd, NULL, 1, now);
+        runq_insert(ops, svc);
+
+        stolen = true;
+        break;
+    }
+
+ out:
+    spin_unlock(&orqd->lock);
+
+    if ( stolen )
+        SCHED_STAT_CRANK(idle_steal);
+    else
+        SCHED_STAT_CRANK(idle_steal_failed);
+
+    return stolen;
+}
+
 static void
 csched2_vcpu_migrate(
     const struct scheduler *ops, struct vcpu *vc, unsigned int new_cpu)
@@ -3094,7 +3422,7 @@ csched2_vcpu_insert(const struct scheduler *ops, struct vcpu *vc)
     spinlock_t *lock;
 
     ASSERT(!is_idle_vcpu(vc));
-    ASSERT(list_empty(&svc->runq_elem));
+    ASSERT(!vcpu_on_runq(svc));
 
     /* csched2_cpu_pick() expects the pcpu lock to be held */
     lock = vcpu_schedule_lock_irq(vc);
@@ -3132,7 +3460,7 @@ csched2_vcpu_remove(const struct scheduler *ops, struct vcpu *vc)
     spinlock_t *lock;
 
     ASSERT(!is_idle_vcpu(vc));
-    ASSERT(list_empty(&svc->runq_elem));
+    ASSERT(!vcpu_on_runq(svc));
 
     SCHED_STAT_CRANK(vcpu_remove);
 
@@ -3154,7 +3482,7 @@ csched2_runtime(const struct scheduler *ops, int cpu,
     s_time_t time, min_time;
     int rt_credit; /* Proposed runtime measured in credits */
     struct csched2_runqueue_data *rqd = c2rqd(ops, cpu);
-    struct list_head *runq = &rqd->runq;
+    struct rb_node *first = rb_first(&rqd->runq);
     struct csched2_private *prv = csched2_priv(ops);
 
     /*
@@ -3192,9 +3520,9 @@ csched2_runtime(const struct scheduler *ops, int cpu,
      * 2) If there's someone waiting whose credit is positive,
      *    run until your credit ~= his.
      */
-    if ( ! list_empty(runq) )
+    if ( first )
     {
-        struct csched2_vcpu *swait = runq_elem(runq->next);
+        struct csched2_vcpu *swait = runq_elem(first);
 
         if ( ! is_idle_vcpu(swait->vcpu)
              && swait->credit > 0 )
@@ -3251,7 +3579,7 @@ runq_candidate(struct csched2_runqueue_data *rqd,
                int cpu, s_time_t now,
                unsigned int *skipped)
 {
-    struct list_head *iter, *temp;
+    struct rb_node *iter;
     struct csched2_vcpu *snext = NULL;
     struct csched2_private *prv = csched2_priv(per_cpu(scheduler, cpu));
     bool yield = false, soft_aff_preempt = false;
@@ -3277,7 +3605,8 @@ runq_candidate(struct csched2_runqueue_data *rqd,
      */
     if ( !yield && prv->ratelimit_us && vcpu_runnable(scurr->vcpu) &&
          (now - scurr->vcpu->runstate.state_entry_time) <
-          MICROSECS(prv->ratelimit_us) )
+          MICROSECS(prv->ratelimit_us) &&
+         sched_unit_allows(cpu, scurr->vcpu) )
     {
         if ( unlikely(tb_init_done) )
         {
@@ -3328,17 +3657,20 @@ runq_candidate(struct csched2_runqueue_data *rqd,
      * continue to run here (in fact, soft_aff_preempt will still be false,
      * in this case).
      *
-     * Of course, we also default to idle also if scurr is not runnable.
+     * Of course, we also default to idle also if scurr is not runnable, or
+     * if it can't run because of the scheduling granularity (i.e., a sibling
+     * of cpu is running another domain).
      */
-    if ( vcpu_runnable(scurr->vcpu) && !soft_aff_preempt )
+    if ( vcpu_runnable(scurr->vcpu) && !soft_aff_preempt &&
+         sched_unit_allows(cpu, scurr->vcpu) )
         snext = scurr;
     else
         snext = csched2_vcpu(idle_vcpu[cpu]);
 
  check_runq:
-    list_for_each_safe( iter, temp, &rqd->runq )
+    for ( iter = rb_first(&rqd->runq); iter; iter = rb_next(iter) )
     {
-        struct csched2_vcpu * svc = list_entry(iter, struct csched2_vcpu, runq_elem);
+        struct csched2_vcpu * svc = runq_elem(iter);
 
         if ( unlikely(tb_init_done) )
         {
@@ -3383,6 +3715,19 @@ runq_candidate(struct csched2_runqueue_data *rqd,
             continue;
         }
 
+        /*
+         * If we would pick it, but a sibling of cpu is running a vcpu of
+         * another domain, and the scheduling granularity does not allow the
+         * two to run together, look further.
+         */
+        if ( (yield || svc->credit > snext->credit) &&
+             !sched_unit_allows(cpu, svc->vcpu) )
+        {
+            (*skipped)++;
+            SCHED_STAT_CRANK(sched_unit_denied);
+            continue;
+        }
+
         /*
          * If the one in the runqueue has more credit than current (or idle,
          * if current is not runnable), or if current is yielding, and also
@@ -3517,8 +3862,19 @@ csched2_schedule(
         snext = csched2_vcpu(idle_vcpu[cpu]);
     }
     else
+    {
         snext = runq_candidate(rqd, scurr, cpu, now, &skipped_vcpus);
 
+        /*
+         * If we are going idle (and not because of scurr wanting to run on
+         * another pcpu), see whether we can grab some work from elsewhere.
+         */
+        if ( is_idle_vcpu(snext->vcpu) &&
+             (is_idle_vcpu(scurr->vcpu) || !vcpu_runnable(scurr->vcpu)) &&
+             idle_steal(ops, cpu, now) )
+            snext = runq_candidate(rqd, scurr, cpu, now, &skipped_vcpus);
+    }
+
     /* If switching from a non-idle runnable vcpu, put it
      * back on the runqueue. */
     if ( snext != scurr
@@ -3611,6 +3967,8 @@ csched2_schedule(
     ret.time = csched2_runtime(ops, cpu, snext, now);
     ret.task = snext->vcpu;
 
+    lock_stats_account(&rqd->sched_hold, now);
+
     CSCHED2_VCPU_CHECK(ret.task);
     return ret;
 }
@@ -3740,7 +4098,7 @@ csched2_dump(const struct scheduler *ops)
     for_each_cpu(i, &prv->active_queues)
     {
         struct csched2_runqueue_data *rqd = prv->rqd + i;
-        struct list_head *iter, *runq = &rqd->runq;
+        struct rb_node *iter;
         int loop = 0;
 
         /* We need the lock to scan the runqueue. */
@@ -3748,11 +4106,22 @@ csched2_dump(const struct scheduler *ops)
 
         printk("Runqueue %d:\n", i);
 
+        printk("\tlock held in schedule: %lu times, avg %"PRI_stime"ns,"
+               " max %"PRI_stime"ns\n", rqd->sched_hold.nr,
+               rqd->sched_hold.nr ? rqd->sched_hold.total / rqd->sched_hold.nr
+                                  : 0,
+               rqd->sched_hold.max);
+        printk("\tlock held in wake: %lu times, avg %"PRI_stime"ns,"
+               " max %"PRI_stime"ns\n", rqd->wake_hold.nr,
+               rqd->wake_hold.nr ? rqd->wake_hold.total / rqd->wake_hold.nr
+                                 : 0,
+               rqd->wake_hold.max);
+
         for_each_cpu(j, &rqd->active)
             dump_pcpu(ops, j);
 
         printk("RUNQ:\n");
-        list_for_each( iter, runq )
+        for ( iter = rb_first(&rqd->runq); iter; iter = rb_next(iter) )
         {
             struct csched2_vcpu *svc = runq_elem(iter);
 
@@ -4021,6 +4390,7 @@ static const struct scheduler sched_credit2_def = {
     .opt_name       = "credit2",
     .sched_id       = XEN_SCHEDULER_CREDIT2,
     .sched_data     = NULL,
+    .gran_aware     = true,
 
     .init_domain    = csched2_dom_init,
     .destroy_domain = csched2_dom_destroy,
@@ -4031,6 +4401,7 @@ static const struct scheduler sched_credit2_def = {
     .sleep          = csched2_vcpu_sleep,
     .wake           = csched2_vcpu_wake,
     .yield          = csched2_vcpu_yield,
+    .yield_to       = csched2_vcpu_yield_to,
 
     .adjust         = csched2_dom_cntl,
     .adjust_global  = csched2_sys_cntl,
@@ -97,6 +97,8 @@ DEFINE_PER_CPU(struct null_pcpu, npc);
 struct null_vcpu {
     struct list_head waitq_elem;
     struct vcpu *vcpu;
+    s_time_t waitq_since;   /* when it was last put in the waitqueue   */
+    unsigned int nr_waits;  /* times it has been put in the waitqueue  */
 };
 
 /*
@@ -135,6 +137,12 @@ static inline bool vcpu_check_affinity(struct vcpu *v, unsigned int cpu,
     return cpumask_test_cpu(cpu, cpumask_scratch_cpu(cpu));
 }
 
+static inline bool cpu_in_node_affinity(unsigned int cpu,
+                                        const struct domain *d)
+{
+    return node_isset(cpu_to_node(cpu), d->node_affinity);
+}
+
 static int null_init(struct scheduler *ops)
 {
     struct null_private *prv;
@@ -289,6 +297,54 @@ static void null_dom_destroy(const struct scheduler *ops, struct domain *d)
  *
  * So this is not part of any hot path.
  */
+
+/*
+ * Among the free pCPUs in mask, go for the one that suits v best. In order
+ * of importance, we like:
+ *  - pCPUs in the NUMA nodes the domain has affinity with;
+ *  - pCPUs sharing the LLC with pCPUs where other vCPUs of the domain are;
+ *  - pCPUs whose SMT siblings are free as well.
+ */
+static unsigned int pick_free_cpu(const struct null_private *prv,
+                                  const struct vcpu *v, const cpumask_t *mask)
+{
+    const struct domain *d = v->domain;
+    const struct vcpu *w;
+    unsigned int cpu, best_cpu = nr_cpu_ids, score, best_score = 0;
+
+    for_each_cpu ( cpu, mask )
+    {
+        score = 1;
+
+        if ( cpu_in_node_affinity(cpu, d) )
+            score += 4;
+
+        for_each_vcpu ( d, w )
+        {
+            if ( w != v && per_cpu(npc, w->processor).vcpu == w &&
+                 cpu_to_llc(w->processor) == cpu_to_llc(cpu) )
+            {
+                score += 2;
+                break;
+            }
+        }
+
+        if ( cpumask_subset(per_cpu(cpu_sibling_mask, cpu), &prv->cpus_free) )
+            score += 1;
+
+        if ( score > best_score )
+        {
+            best_cpu = cpu;
+            best_score = score;
+            /* Can't do better than this. */
+            if ( best_score == 8 )
+                break;
+        }
+    }
+
+    return best_cpu;
+}
+
 static unsigned int pick_cpu(struct null_private *prv, struct vcpu *v)
 {
     unsigned int bs;
@@ -307,23 +363,26 @@ static unsigned int pick_cpu(struct null_private *prv, struct vcpu *v)
         cpumask_and(cpumask_scratch_cpu(cpu), cpumask_scratch_cpu(cpu), cpus);
 
         /*
-         * If our processor is free, or we are assigned to it, and it is also
-         * still valid and part of our affinity, just go for it.
+         * If we are assigned to our processor, or if it is free and in one
+         * of our domain's NUMA nodes, and it is also still valid and part of
+         * our affinity, just go for it.
          * (Note that we may call vcpu_check_affinity(), but we deliberately
          * don't, so we get to keep in the scratch cpumask what we have just
          * put in it.)
          */
-        if ( likely((per_cpu(npc, cpu).vcpu == NULL || per_cpu(npc, cpu).vcpu == v)
+        if ( likely((per_cpu(npc, cpu).vcpu == v ||
+                     (per_cpu(npc, cpu).vcpu == NULL &&
+                      cpu_in_node_affinity(cpu, v->domain)))
                     && cpumask_test_cpu(cpu, cpumask_scratch_cpu(cpu))) )
         {
             new_cpu = cpu;
             goto out;
         }
 
-        /* If not, just go for a free pCPU, within our affinity, if any */
+        /* If not, go for the best free pCPU, within our affinity, if any */
         cpumask_and(cpumask_scratch_cpu(cpu), cpumask_scratch_cpu(cpu),
                     &prv->cpus_free);
-        new_cpu = cpumask_first(cpumask_scratch_cpu(cpu));
+        new_cpu = pick_free_cpu(prv, v, cpumask_scratch_cpu(cpu));
 
         if ( likely(new_cpu != nr_cpu_ids) )
             goto out;
@@ -366,6 +425,11 @@ static void vcpu_assign(struct null_private *prv, struct vcpu *v,
     v->processor = cpu;
     cpumask_clear_cpu(cpu, &prv->cpus_free);
 
+    if ( cpu_in_node_affinity(cpu, v->domain) )
+        SCHED_STAT_CRANK(assign_node_local);
+    else
+        SCHED_STAT_CRANK(assign_node_remote);
+
     dprintk(XENLOG_G_INFO, "%d <-- d%dv%d\n", cpu, v->domain->domain_id, v->vcpu_id);
 
     if ( unlikely(tb_init_done) )
@@ -402,6 +466,63 @@ static void vcpu_deassign(struct null_private *prv, struct vcpu *v,
     }
 }
 
+/* Park nvc in the waitqueue. Must be called with the waitqueue lock held. */
+static void waitq_add(struct null_private *prv, struct null_vcpu *nvc)
+{
+    ASSERT(spin_is_locked(&prv->waitq_lock));
+
+    list_add_tail(&nvc->waitq_elem, &prv->waitq);
+    nvc->waitq_since = NOW();
+    nvc->nr_waits++;
+    SCHED_STAT_CRANK(waitq_enqueue);
+
+    dprintk(XENLOG_G_WARNING, "WARNING: d%dv%d not assigned to any CPU!\n",
+            nvc->vcpu->domain->domain_id, nvc->vcpu->vcpu_id);
+}
+
+/*
+ * Find the vCPU in the waitqueue that it is best to assign to cpu, which
+ * has just become free. vCPUs with soft-affinity with cpu come first and,
+ * within each affinity balancing step, we prefer the vCPUs of a domain
+ * with affinity with cpu's NUMA node (in waitqueue order).
+ *
+ * Must be called with the waitqueue lock held.
+ */
+static struct null_vcpu *waitq_pick(struct null_private *prv,
+                                    unsigned int cpu)
+{
+    struct null_vcpu *wvc, *fallback;
+    unsigned int bs;
+
+    ASSERT(spin_is_locked(&prv->waitq_lock));
+
+    for_each_affinity_balance_step( bs )
+    {
+        fallback = NULL;
+
+        list_for_each_entry( wvc, &prv->waitq, waitq_elem )
+        {
+            if ( bs == BALANCE_SOFT_AFFINITY &&
+                 !has_soft_affinity(wvc->vcpu, wvc->vcpu->cpu_hard_affinity) )
+                continue;
+
+            if ( !vcpu_check_affinity(wvc->vcpu, cpu, bs) )
+                continue;
+
+            if ( cpu_in_node_affinity(cpu, wvc->vcpu->domain) )
+                return wvc;
+
+            if ( fallback == NULL )
+                fallback = wvc;
+        }
+
+        if ( fallback != NULL )
+            return fallback;
+    }
+
+    return NULL;
+}
+
 /* Change the scheduler of cpu to us (null). */
 static void null_switch_sched(struct scheduler *new_ops, unsigned int cpu,
                               void *pdata, void *vdata)
@@ -481,9 +602,7 @@ static void null_vcpu_insert(const struct scheduler *ops, struct vcpu *v)
          * we have no alternatives than to go into the waitqueue.
          */
         spin_lock(&prv->waitq_lock);
-        list_add_tail(&nvc->waitq_elem, &prv->waitq);
-        dprintk(XENLOG_G_WARNING, "WARNING: d%dv%d not assigned to any CPU!\n",
-                v->domain->domain_id, v->vcpu_id);
+        waitq_add(prv, nvc);
         spin_unlock(&prv->waitq_lock);
     }
     spin_unlock_irq(lock);
@@ -493,7 +612,6 @@ static void null_vcpu_insert(const struct scheduler *ops, struct vcpu *v)
 
 static void _vcpu_remove(struct null_private *prv, struct vcpu *v)
 {
-    unsigned int bs;
     unsigned int cpu = v->processor;
     struct null_vcpu *wvc;
 
@@ -505,27 +623,17 @@ static void _vcpu_remove(struct null_private *prv, struct vcpu *v)
 
     /*
      * If v is assigned to a pCPU, let's see if there is someone waiting,
-     * suitable to be assigned to it (prioritizing vcpus that have
-     * soft-affinity with cpu).
+     * suitable to be assigned to it (see waitq_pick()).
      */
-    for_each_affinity_balance_step( bs )
+    wvc = waitq_pick(prv, cpu);
+    if ( wvc != NULL )
     {
-        list_for_each_entry( wvc, &prv->waitq, waitq_elem )
-        {
-            if ( bs == BALANCE_SOFT_AFFINITY &&
-                 !has_soft_affinity(wvc->vcpu, wvc->vcpu->cpu_hard_affinity) )
-                continue;
-
-            if ( vcpu_check_affinity(wvc->vcpu, cpu, bs) )
-            {
-                list_del_init(&wvc->waitq_elem);
-                vcpu_assign(prv, wvc->vcpu, cpu);
-                cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
-                spin_unlock(&prv->waitq_lock);
-                return;
-            }
-        }
+        list_del_init(&wvc->waitq_elem);
+        vcpu_assign(prv, wvc->vcpu, cpu);
+        SCHED_STAT_CRANK(waitq_assign);
+        cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
     }
+
     spin_unlock(&prv->waitq_lock);
 }
 
@@ -597,6 +705,14 @@ static void null_vcpu_sleep(const struct scheduler *ops, struct vcpu *v)
     SCHED_STAT_CRANK(vcpu_sleep);
 }
 
+static bool null_vcpu_is_waiting(const struct scheduler *ops,
+                                 const struct vcpu *v)
+{
+    ASSERT(!is_idle_vcpu(v));
+
+    return !list_empty(&null_vcpu(v)->waitq_elem);
+}
+
 static int null_cpu_pick(const struct scheduler *ops, struct vcpu *v)
 {
     ASSERT(!is_idle_vcpu(v));
@@ -670,11 +786,7 @@ static void null_vcpu_migrate(const struct scheduler *ops, struct vcpu *v,
         /* Put v in the waitqueue, if it wasn't there already */
         spin_lock(&prv->waitq_lock);
         if ( list_empty(&nvc->waitq_elem) )
-        {
-            list_add_tail(&nvc->waitq_elem, &prv->waitq);
-            dprintk(XENLOG_G_WARNING, "WARNING: d%dv%d not assigned to any CPU!\n",
-                    v->domain->domain_id, v->vcpu_id);
-        }
+            waitq_add(prv, nvc);
         spin_unlock(&prv->waitq_lock);
     }
 
@@ -719,7 +831,6 @@ static struct task_slice null_schedule(const struct scheduler *ops,
                                        s_time_t now,
                                        bool_t tasklet_work_scheduled)
 {
-    unsigned int bs;
     const unsigned int cpu = smp_processor_id();
     struct null_private *prv = null_priv(ops);
     struct null_vcpu *wvc;
@@ -767,38 +878,31 @@ static struct task_slice null_schedule(const struct scheduler *ops,
     {
         spin_lock(&prv->waitq_lock);
 
-        if ( list_empty(&prv->waitq) )
-            goto unlock;
-
         /*
-         * We scan the waitqueue twice, for prioritizing vcpus that have
+         * We may scan the waitqueue twice, for prioritizing vcpus that have
          * soft-affinity with cpu. This may look like something expensive to
          * do here in null_schedule(), but it's actually fine, beceuse we do
          * it only in cases where a pcpu has no vcpu associated (e.g., as
          * said above, the cpu has just joined a cpupool).
          */
-        for_each_affinity_balance_step( bs )
+        wvc = waitq_pick(prv, cpu);
+        if ( wvc != NULL )
         {
-            list_for_each_entry( wvc, &prv->waitq, waitq_elem )
-            {
-                if ( bs == BALANCE_SOFT_AFFINITY &&
-                     !has_soft_affinity(wvc->vcpu, wvc->vcpu->cpu_hard_affinity) )
-                    continue;
-
-                if ( vcpu_check_affinity(wvc->vcpu, cpu, bs) )
-                {
-                    vcpu_assign(prv, wvc->vcpu, cpu);
-                    list_del_init(&wvc->waitq_elem);
-                    ret.task = wvc->vcpu;
-                    goto unlock;
-                }
-            }
+            vcpu_assign(prv, wvc->vcpu, cpu);
+            list_del_init(&wvc->waitq_elem);
+            SCHED_STAT_CRANK(waitq_assign);
+            ret.task = wvc->vcpu;
         }
- unlock:
+
         spin_unlock(&prv->waitq_lock);
     }
 
-    if ( unlikely(ret.task == NULL || !vcpu_runnable(ret.task)) )
+    /*
+     * With a scheduling granularity coarser than cpu, our vcpu can't run
+     * while some other pcpu in our unit runs a vcpu from another domain.
+     */
+    if ( unlikely(ret.task == NULL || !vcpu_runnable(ret.task) ||
+                  !sched_unit_allows(cpu, ret.task)) )
         ret.task = idle_vcpu[cpu];
 
     NULL_VCPU_CHECK(ret.task);
@@ -810,6 +914,14 @@ static inline void dump_vcpu(struct null_private *prv, struct null_vcpu *nvc)
     printk("[%i.%i] pcpu=%d", nvc->vcpu->domain->domain_id,
             nvc->vcpu->vcpu_id, list_empty(&nvc->waitq_elem) ?
                                 nvc->vcpu->processor : -1);
+
+    /* Say why we are waiting, or whether we could not be placed well. */
+    if ( !list_empty(&nvc->waitq_elem) )
+        printk(" waiting: no free pcpu in hard affinity for %"PRI_stime"us",
+               (NOW() - nvc->waitq_since) / MICROSECS(1));
+    else if ( !cpu_in_node_affinity(nvc->vcpu->processor, nvc->vcpu->domain) )
+        printk(" (outside node-affinity)");
+    printk(" waits=%u", nvc->nr_waits);
 }
 
 static void null_dump_pcpu(const struct scheduler *ops, int cpu)
@@ -907,6 +1019,7 @@ const struct scheduler sched_null_def = {
     .opt_name       = "null",
     .sched_id       = XEN_SCHEDULER_NULL,
     .sched_data     = NULL,
+    .gran_aware     = true,
 
     .init           = null_init,
     .deinit         = null_deinit,
@@ -927,6 +1040,7 @@ const struct scheduler sched_null_def = {
 
     .wake           = null_vcpu_wake,
     .sleep          = null_vcpu_sleep,
+    .is_waiting     = null_vcpu_is_waiting,
     .pick_cpu       = null_cpu_pick,
     .migrate        = null_vcpu_migrate,
     .do_schedule    = null_schedule,
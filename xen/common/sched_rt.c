@@ -30,6 +30,7 @@
 #include <xen/trace.h>
 #include <xen/err.h>
 #include <xen/guest_access.h>
+#include <xen/rbtree.h>
 
 /*
  * TODO:
@@ -66,8 +67,10 @@
  * Queue scheme:
  * A global runqueue and a global depletedqueue for each CPU pool.
  * The runqueue holds all runnable VCPUs with budget,
- * sorted by priority_level and deadline;
+ * sorted by priority_level and deadline (in an rbtree);
  * The depletedqueue holds all VCPUs without budget, unsorted;
+ * The replenishment queue holds all the VCPUs that need a replenishment
+ * event, sorted like the runqueue (in an rbtree too);
  *
  * Note: cpumask and cpupool is supported.
  */
@@ -183,11 +186,11 @@ struct rt_private {
     spinlock_t lock;            /* the global coarse-grained lock */
     struct list_head sdom;      /* list of availalbe domains, used for dump */
 
-    struct list_head runq;      /* ordered list of runnable vcpus */
+    struct rb_root runq;        /* ordered tree of runnable vcpus */
     struct list_head depletedq; /* unordered list of depleted vcpus */
 
     struct timer *repl_timer;   /* replenishment timer */
-    struct list_head replq;     /* ordered list of vcpus that need replenishment */
+    struct rb_root replq;       /* ordered tree of vcpus that need replenishment */
 
     cpumask_t tickled;          /* cpus been tickled */
 };
@@ -196,8 +199,10 @@ struct rt_private {
  * Virtual CPU
  */
 struct rt_vcpu {
-    struct list_head q_elem;     /* on the runq/depletedq list */
-    struct list_head replq_elem; /* on the replenishment events list */
+    struct rb_node runq_elem;    /* on the runq tree */
+    struct list_head q_elem;     /* on the depletedq list */
+    struct rb_node replq_elem;   /* on the replenishment events tree */
+    struct list_head repl_elem;  /* on repl_timer_handler()'s local list */
 
     /* VCPU parameters, in nanoseconds */
     s_time_t period;
@@ -243,7 +248,7 @@ static inline struct rt_dom *rt_dom(const struct domain *dom)
     return dom->sched_priv;
 }
 
-static inline struct list_head *rt_runq(const struct scheduler *ops)
+static inline struct rb_root *rt_runq(const struct scheduler *ops)
 {
     return &rt_priv(ops)->runq;
 }
@@ -253,7 +258,7 @@ static inline struct list_head *rt_depletedq(const struct scheduler *ops)
     return &rt_priv(ops)->depletedq;
 }
 
-static inline struct list_head *rt_replq(const struct scheduler *ops)
+static inline struct rb_root *rt_replq(const struct scheduler *ops)
 {
     return &rt_priv(ops)->replq;
 }
@@ -267,10 +272,16 @@ static inline bool has_extratime(const struct rt_vcpu *svc)
  * Helper functions for manipulating the runqueue, the depleted queue,
  * and the replenishment events queue.
  */
+static int
+vcpu_on_runq(const struct rt_vcpu *svc)
+{
+   return !RB_EMPTY_NODE(&svc->runq_elem);
+}
+
 static int
 vcpu_on_q(const struct rt_vcpu *svc)
 {
-   return !list_empty(&svc->q_elem);
+   return vcpu_on_runq(svc) || !list_empty(&svc->q_elem);
 }
 
 static struct rt_vcpu *
@@ -280,15 +291,21 @@ q_elem(struct list_head *elem)
 }
 
 static struct rt_vcpu *
-replq_elem(struct list_head *elem)
+runq_elem(struct rb_node *elem)
 {
-    return list_entry(elem, struct rt_vcpu, replq_elem);
+    return rb_entry(elem, struct rt_vcpu, runq_elem);
+}
+
+static struct rt_vcpu *
+replq_elem(struct rb_node *elem)
+{
+    return rb_entry(elem, struct rt_vcpu, replq_elem);
 }
 
 static int
 vcpu_on_replq(const struct rt_vcpu *svc)
 {
-    return !list_empty(&svc->replq_elem);
+    return !RB_EMPTY_NODE(&svc->replq_elem);
 }
 
 /*
@@ -375,7 +392,9 @@ rt_dump_pcpu(const struct scheduler *ops, int cpu)
 static void
 rt_dump(const struct scheduler *ops)
 {
-    struct list_head *runq, *depletedq, *replq, *iter;
+    struct list_head *depletedq, *iter;
+    struct rb_root *runq, *replq;
+    struct rb_node *node;
     struct rt_private *prv = rt_priv(ops);
     struct rt_vcpu *svc;
     struct rt_dom *sdom;
@@ -391,9 +410,9 @@ rt_dump(const struct scheduler *ops)
     replq = rt_replq(ops);
 
     printk("Global RunQueue info:\n");
-    list_for_each ( iter, runq )
+    for ( node = rb_first(runq); node; node = rb_next(node) )
     {
-        svc = q_elem(iter);
+        svc = runq_elem(node);
         rt_dump_vcpu(ops, svc);
     }
 
@@ -405,9 +424,9 @@ rt_dump(const struct scheduler *ops)
     }
 
     printk("Global Replenishment Events info:\n");
-    list_for_each ( iter, replq )
+    for ( node = rb_first(replq); node; node = rb_next(node) )
     {
-        svc = replq_elem(iter);
+        svc = replq_elem(node);
         rt_dump_vcpu(ops, svc);
     }
 
@@ -492,54 +511,65 @@ rt_update_deadline(s_time_t now, struct rt_vcpu *svc)
  * inserted ended at the front of the queue (i.e., in both
  * cases, if the vcpu with the earliest deadline is what we
  * are dealing with).
+ *
+ * The queues are rbtrees, so both operations are O(log n). vcpus with
+ * the same priority are kept in insertion order (i.e., a vcpu goes to
+ * the right of the ones with its same priority).
  */
 static inline bool
-deadline_queue_remove(struct list_head *queue, struct list_head *elem)
+deadline_queue_remove(struct rb_root *queue, struct rb_node *elem)
 {
-    int pos = 0;
-
-    if ( queue->next != elem )
-        pos = 1;
+    bool first = rb_first(queue) == elem;
 
-    list_del_init(elem);
-    return !pos;
+    rb_erase(elem, queue);
+    RB_CLEAR_NODE(elem);
+    return first;
 }
 
 static inline bool
-deadline_queue_insert(struct rt_vcpu * (*qelem)(struct list_head *),
-                      struct rt_vcpu *svc, struct list_head *elem,
-                      struct list_head *queue)
+deadline_queue_insert(struct rt_vcpu * (*qelem)(struct rb_node *),
+                      struct rt_vcpu *svc, struct rb_node *elem,
+                      struct rb_root *queue)
 {
-    struct list_head *iter;
-    int pos = 0;
+    struct rb_node **node = &queue->rb_node, *parent = NULL;
+    bool first = true;
 
-    list_for_each ( iter, queue )
+    while ( *node )
     {
-        struct rt_vcpu * iter_svc = (*qelem)(iter);
-        if ( compare_vcpu_priority(svc, iter_svc) > 0 )
-            break;
-        pos++;
+        parent = *node;
+        if ( compare_vcpu_priority(svc, (*qelem)(parent)) > 0 )
+            node = &parent->rb_left;
+        else
+        {
+            node = &parent->rb_right;
+            first = false;
+        }
     }
-    list_add_tail(elem, iter);
-    return !pos;
+    rb_link_node(elem, parent, node);
+    rb_insert_color(elem, queue);
+    return first;
 }
 #define deadline_runq_insert(...) \
-  deadline_queue_insert(&q_elem, ##__VA_ARGS__)
+  deadline_queue_insert(&runq_elem, ##__VA_ARGS__)
 #define deadline_replq_insert(...) \
   deadline_queue_insert(&replq_elem, ##__VA_ARGS__)
 
 static inline void
-q_remove(struct rt_vcpu *svc)
+q_remove(const struct scheduler *ops, struct rt_vcpu *svc)
 {
     ASSERT( vcpu_on_q(svc) );
-    list_del_init(&svc->q_elem);
+
+    if ( vcpu_on_runq(svc) )
+        deadline_queue_remove(rt_runq(ops), &svc->runq_elem);
+    else
+        list_del_init(&svc->q_elem);
 }
 
 static inline void
 replq_remove(const struct scheduler *ops, struct rt_vcpu *svc)
 {
     struct rt_private *prv = rt_priv(ops);
-    struct list_head *replq = rt_replq(ops);
+    struct rb_root *replq = rt_replq(ops);
 
     ASSERT( vcpu_on_replq(svc) );
 
@@ -551,9 +581,9 @@ replq_remove(const struct scheduler *ops, struct rt_vcpu *svc)
          * queue is due. If it is such vcpu that we just removed, we may
          * need to reprogram the timer.
          */
-        if ( !list_empty(replq) )
+        if ( !RB_EMPTY_ROOT(replq) )
         {
-            struct rt_vcpu *svc_next = replq_elem(replq->next);
+            struct rt_vcpu *svc_next = replq_elem(rb_first(replq));
             set_timer(prv->repl_timer, svc_next->cur_deadline);
         }
         else
@@ -570,7 +600,7 @@ static void
 runq_insert(const struct scheduler *ops, struct rt_vcpu *svc)
 {
     struct rt_private *prv = rt_priv(ops);
-    struct list_head *runq = rt_runq(ops);
+    struct rb_root *runq = rt_runq(ops);
 
     ASSERT( spin_is_locked(&prv->lock) );
     ASSERT( !vcpu_on_q(svc) );
@@ -579,7 +609,7 @@ runq_insert(const struct scheduler *ops, struct rt_vcpu *svc)
     /* add svc to runq if svc still has budget or its extratime is set */
     if ( svc->cur_budget > 0 ||
          has_extratime(svc) )
-        deadline_runq_insert(svc, &svc->q_elem, runq);
+        deadline_runq_insert(svc, &svc->runq_elem, runq);
     else
         list_add(&svc->q_elem, &prv->depletedq);
 }
@@ -587,7 +617,7 @@ runq_insert(const struct scheduler *ops, struct rt_vcpu *svc)
 static void
 replq_insert(const struct scheduler *ops, struct rt_vcpu *svc)
 {
-    struct list_head *replq = rt_replq(ops);
+    struct rb_root *replq = rt_replq(ops);
     struct rt_private *prv = rt_priv(ops);
 
     ASSERT( !vcpu_on_replq(svc) );
@@ -609,7 +639,7 @@ replq_insert(const struct scheduler *ops, struct rt_vcpu *svc)
 static void
 replq_reinsert(const struct scheduler *ops, struct rt_vcpu *svc)
 {
-    struct list_head *replq = rt_replq(ops);
+    struct rb_root *replq = rt_replq(ops);
     struct rt_vcpu *rearm_svc = svc;
     bool_t rearm = 0;
 
@@ -627,7 +657,7 @@ replq_reinsert(const struct scheduler *ops, struct rt_vcpu *svc)
     if ( deadline_queue_remove(replq, &svc->replq_elem) )
     {
         deadline_replq_insert(svc, &svc->replq_elem, replq);
-        rearm_svc = replq_elem(replq->next);
+        rearm_svc = replq_elem(rb_first(replq));
         rearm = 1;
     }
     else
@@ -682,9 +712,9 @@ rt_init(struct scheduler *ops)
 
     spin_lock_init(&prv->lock);
     INIT_LIST_HEAD(&prv->sdom);
-    INIT_LIST_HEAD(&prv->runq);
+    prv->runq = RB_ROOT;
     INIT_LIST_HEAD(&prv->depletedq);
-    INIT_LIST_HEAD(&prv->replq);
+    prv->replq = RB_ROOT;
 
     cpumask_clear(&prv->tickled);
 
@@ -890,8 +920,10 @@ rt_alloc_vdata(const struct scheduler *ops, struct vcpu *vc, void *dd)
     if ( svc == NULL )
         return NULL;
 
+    RB_CLEAR_NODE(&svc->runq_elem);
     INIT_LIST_HEAD(&svc->q_elem);
-    INIT_LIST_HEAD(&svc->replq_elem);
+    RB_CLEAR_NODE(&svc->replq_elem);
+    INIT_LIST_HEAD(&svc->repl_elem);
     svc->flags = 0U;
     svc->sdom = dd;
     svc->vcpu = vc;
@@ -969,7 +1001,7 @@ rt_vcpu_remove(const struct scheduler *ops, struct vcpu *vc)
 
     lock = vcpu_schedule_lock_irq(vc);
     if ( vcpu_on_q(svc) )
-        q_remove(svc);
+        q_remove(ops, svc);
 
     if ( vcpu_on_replq(svc) )
         replq_remove(ops,svc);
@@ -1048,16 +1080,16 @@ burn_budget(const struct scheduler *ops, struct rt_vcpu *svc, s_time_t now)
 static struct rt_vcpu *
 runq_pick(const struct scheduler *ops, const cpumask_t *mask)
 {
-    struct list_head *runq = rt_runq(ops);
-    struct list_head *iter;
+    struct rb_root *runq = rt_runq(ops);
+    struct rb_node *iter;
     struct rt_vcpu *svc = NULL;
     struct rt_vcpu *iter_svc = NULL;
     cpumask_t cpu_common;
     cpumask_t *online;
 
-    list_for_each ( iter, runq )
+    for ( iter = rb_first(runq); iter; iter = rb_next(iter) )
     {
-        iter_svc = q_elem(iter);
+        iter_svc = runq_elem(iter);
 
         /* mask cpu_hard_affinity & cpupool & mask */
         online = cpupool_domain_cpumask(iter_svc->vcpu->domain);
@@ -1157,7 +1189,7 @@ rt_schedule(const struct scheduler *ops, s_time_t now, bool_t tasklet_work_sched
     {
         if ( snext != scurr )
         {
-            q_remove(snext);
+            q_remove(ops, snext);
             __set_bit(__RTDS_scheduled, &snext->flags);
         }
         if ( snext->vcpu->processor != cpu )
@@ -1188,7 +1220,7 @@ rt_vcpu_sleep(const struct scheduler *ops, struct vcpu *vc)
         cpu_raise_softirq(vc->processor, SCHEDULE_SOFTIRQ);
     else if ( vcpu_on_q(svc) )
     {
-        q_remove(svc);
+        q_remove(ops, svc);
         replq_remove(ops, svc);
     }
     else if ( svc->flags & RTDS_delayed_runq_add )
@@ -1503,9 +1535,10 @@ static void repl_timer_handler(void *data){
     s_time_t now;
     struct scheduler *ops = data;
     struct rt_private *prv = rt_priv(ops);
-    struct list_head *replq = rt_replq(ops);
-    struct list_head *runq = rt_runq(ops);
+    struct rb_root *replq = rt_replq(ops);
+    struct rb_root *runq = rt_runq(ops);
     struct timer *repl_timer = prv->repl_timer;
+    struct rb_node *node;
     struct list_head *iter, *tmp;
     struct rt_vcpu *svc;
     LIST_HEAD(tmp_replq);
@@ -1520,20 +1553,20 @@ static void repl_timer_handler(void *data){
      * If svc is on run queue, we need to put it at
      * the correct place since its deadline changes.
      */
-    list_for_each_safe ( iter, tmp, replq )
+    while ( (node = rb_first(replq)) != NULL )
     {
-        svc = replq_elem(iter);
+        svc = replq_elem(node);
 
         if ( now < svc->cur_deadline )
             break;
 
-        list_del(&svc->replq_elem);
+        deadline_queue_remove(replq, &svc->replq_elem);
         rt_update_deadline(now, svc);
-        list_add(&svc->replq_elem, &tmp_replq);
+        list_add(&svc->repl_elem, &tmp_replq);
 
         if ( vcpu_on_q(svc) )
         {
-            q_remove(svc);
+            q_remove(ops, svc);
             runq_insert(ops, svc);
         }
     }
@@ -1547,12 +1580,12 @@ static void repl_timer_handler(void *data){
      */
     list_for_each_safe ( iter, tmp, &tmp_replq )
     {
-        svc = replq_elem(iter);
+        svc = list_entry(iter, struct rt_vcpu, repl_elem);
 
         if ( curr_on_cpu(svc->vcpu->processor) == svc->vcpu &&
-             !list_empty(runq) )
+             !RB_EMPTY_ROOT(runq) )
         {
-            struct rt_vcpu *next_on_runq = q_elem(runq->next);
+            struct rt_vcpu *next_on_runq = runq_elem(rb_first(runq));
 
             if ( compare_vcpu_priority(svc, next_on_runq) < 0 )
                 runq_tickle(ops, next_on_runq);
@@ -1561,7 +1594,7 @@ static void repl_timer_handler(void *data){
                   vcpu_on_q(svc) )
             runq_tickle(ops, svc);
 
-        list_del(&svc->replq_elem);
+        list_del_init(&svc->repl_elem);
         deadline_replq_insert(svc, &svc->replq_elem, replq);
     }
 
@@ -1570,8 +1603,8 @@ static void repl_timer_handler(void *data){
      * set the next replenishment to happen at the deadline of
      * the one in the front.
      */
-    if ( !list_empty(replq) )
-        set_timer(repl_timer, replq_elem(replq->next)->cur_deadline);
+    if ( !RB_EMPTY_ROOT(replq) )
+        set_timer(repl_timer, replq_elem(rb_first(replq))->cur_deadline);
 
     spin_unlock_irq(&prv->lock);
 }
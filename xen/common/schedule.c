@@ -35,6 +35,7 @@
 #include <xen/preempt.h>
 #include <xen/event.h>
 #include <public/sched.h>
+#include <public/sysctl.h>
 #include <xsm/xsm.h>
 #include <xen/err.h>
 
@@ -54,6 +55,63 @@ boolean_param("sched_smt_power_savings", sched_smt_power_savings);
  * */
 int sched_ratelimit_us = SCHED_DEFAULT_RATELIMIT_US;
 integer_param("sched_ratelimit_us", sched_ratelimit_us);
+
+/* Scheduling granularity: cpu (default), core or socket. */
+#define SCHED_GRAN_CPU      0
+#define SCHED_GRAN_CORE     1
+#define SCHED_GRAN_SOCKET   2
+static unsigned int __read_mostly opt_sched_gran = SCHED_GRAN_CPU;
+
+static int __init parse_sched_gran(const char *s)
+{
+    if ( !strcmp(s, "cpu") )
+        opt_sched_gran = SCHED_GRAN_CPU;
+    else if ( !strcmp(s, "core") )
+        opt_sched_gran = SCHED_GRAN_CORE;
+    else if ( !strcmp(s, "socket") )
+        opt_sched_gran = SCHED_GRAN_SOCKET;
+    else
+        return -EINVAL;
+
+    return 0;
+}
+custom_param("sched-gran", parse_sched_gran);
+
+/*
+ * How long a pcpu that found its unit busy with another domain can reserve
+ * the unit for the domain it wants to run, before someone else can do the
+ * same. When the reservation is made, the siblings running other domains
+ * are asked to reschedule, and won't pick anything but the reserving
+ * domain's vcpus until the reservation is satisfied or expires.
+ */
+#define SCHED_UNIT_HANDOVER MILLISECS(2)
+
+struct sched_unit_state {
+    spinlock_t lock;
+    const struct domain *wanted;
+    s_time_t wanted_until;
+};
+
+/* Only the instance belonging to the first cpu of each unit is used. */
+static DEFINE_PER_CPU(struct sched_unit_state, sched_unit_state);
+/* Domain each pcpu is (about to start) running, NULL if idle. */
+static DEFINE_PER_CPU(const struct domain *, sched_unit_dom);
+/* Domain each pcpu has last switched to, NULL if idle. */
+static DEFINE_PER_CPU(const struct domain *, sched_unit_cur);
+
+/* Scheduler latency histograms (see XEN_SYSCTL_sched_hist). */
+static bool __read_mostly opt_sched_hist = true;
+boolean_param("sched-hist", opt_sched_hist);
+
+struct sched_hist {
+    uint64_t count[XEN_SYSCTL_SCHED_HIST_NR][XEN_SYSCTL_SCHED_HIST_BUCKETS];
+};
+static DEFINE_PER_CPU(struct sched_hist, sched_hist);
+/* When the current context switch started, 0 if none is in progress. */
+static DEFINE_PER_CPU(s_time_t, sched_switch_start);
+/* When the current slice started, and how long it was meant to be. */
+static DEFINE_PER_CPU(s_time_t, sched_slice_start);
+static DEFINE_PER_CPU(s_time_t, sched_slice_req);
 /* Various timer handlers. */
 static void s_timer_fn(void *unused);
 static void vcpu_periodic_timer_fn(void *data);
@@ -193,7 +251,28 @@ static inline void vcpu_runstate_change(
         v->runstate.state_entry_time = new_entry_time;
     }
 
+    switch ( new_state )
+    {
+    case RUNSTATE_running:
+        v->sched_switches++;
+        break;
+    case RUNSTATE_runnable:
+        if ( v->runstate.state == RUNSTATE_running )
+            v->sched_preempts++;
+        else if ( v->runstate.state == RUNSTATE_blocked )
+            v->sched_wakeups++;
+        break;
+    case RUNSTATE_blocked:
+        if ( v->runstate.state == RUNSTATE_running )
+            v->sched_blocks++;
+        break;
+    }
+
     v->runstate.state = new_state;
+
+    /* Let the guest know whether v is runnable, but not running. */
+    if ( !is_idle_vcpu(v) )
+        write_atomic(&vcpu_info(v, preempted), new_state == RUNSTATE_runnable);
 }
 
 void vcpu_runstate_get(struct vcpu *v, struct vcpu_runstate_info *runstate)
@@ -210,6 +289,77 @@ void vcpu_runstate_get(struct vcpu *v, struct vcpu_runstate_info *runstate)
         vcpu_schedule_unlock_irq(lock, v);
 }
 
+/*
+ * Whether v would run, if only its scheduler had a pCPU to give it (e.g.,
+ * it is in the null scheduler's waitqueue). Only informative, for tools.
+ */
+bool vcpu_is_waiting(const struct vcpu *v)
+{
+    return SCHED_OP(vcpu_scheduler(v), is_waiting, v);
+}
+
+/*
+ * Account a sample in one of this pCPU's histograms. Only the pCPU itself
+ * updates its histograms, and always from within the scheduler, so no
+ * locking is necessary.
+ */
+static inline void sched_hist_add(unsigned int hist, s_time_t delta)
+{
+    unsigned int bucket = 0;
+
+    if ( delta >= MICROSECS(1) )
+    {
+        uint64_t us = delta / MICROSECS(1);
+
+        bucket = us >= (1U << (XEN_SYSCTL_SCHED_HIST_BUCKETS - 2))
+                 ? XEN_SYSCTL_SCHED_HIST_BUCKETS - 1 : fls(us);
+    }
+
+    this_cpu(sched_hist).count[hist][bucket]++;
+}
+
+int sched_hist_op(struct xen_sysctl_sched_hist *op)
+{
+    uint64_t sum[XEN_SYSCTL_SCHED_HIST_BUCKETS];
+    const cpumask_t *cpus;
+    unsigned int cpu, h, b;
+
+    if ( !opt_sched_hist )
+        return -EOPNOTSUPP;
+
+    if ( op->flags & ~XEN_SYSCTL_SCHED_HIST_RESET )
+        return -EINVAL;
+
+    if ( op->cpu == XEN_SYSCTL_SCHED_HIST_ALL_CPUS )
+        cpus = &cpu_online_map;
+    else if ( op->cpu < nr_cpu_ids && cpu_online(op->cpu) )
+        cpus = cpumask_of(op->cpu);
+    else
+        return -EINVAL;
+
+    if ( !guest_handle_is_null(op->data) )
+    {
+        for ( h = 0; h < XEN_SYSCTL_SCHED_HIST_NR; h++ )
+        {
+            memset(sum, 0, sizeof(sum));
+            for_each_cpu ( cpu, cpus )
+                for ( b = 0; b < XEN_SYSCTL_SCHED_HIST_BUCKETS; b++ )
+                    sum[b] += per_cpu(sched_hist, cpu).count[h][b];
+
+            if ( copy_to_guest_offset(op->data,
+                                      h * XEN_SYSCTL_SCHED_HIST_BUCKETS,
+                                      sum, XEN_SYSCTL_SCHED_HIST_BUCKETS) )
+                return -EFAULT;
+        }
+    }
+
+    if ( op->flags & XEN_SYSCTL_SCHED_HIST_RESET )
+        for_each_cpu ( cpu, cpus )
+            memset(&per_cpu(sched_hist, cpu), 0, sizeof(struct sched_hist));
+
+    return 0;
+}
+
 uint64_t get_cpu_idle_time(unsigned int cpu)
 {
     struct vcpu_runstate_info state = { 0 };
@@ -276,6 +426,8 @@ int sched_init_vcpu(struct vcpu *v, unsigned int processor)
                v, v->processor);
     init_timer(&v->poll_timer, poll_timer_fn,
                v, v->processor);
+    init_timer(&v->evtchn_holdoff_timer, evtchn_holdoff_timer_fn,
+               v, v->processor);
 
     v->sched_priv = SCHED_OP(dom_scheduler(d), alloc_vdata, v,
 		             d->sched_priv);
@@ -302,15 +454,81 @@ static void sched_move_irqs(struct vcpu *v)
     evtchn_move_pirqs(v);
 }
 
-int sched_move_domain(struct domain *d, struct cpupool *c)
+/*
+ * Scheduler data for moving a domain between cpupools.  Before the move it
+ * holds the data for the new scheduler, afterwards the one the domain used
+ * with the old scheduler, so that neither allocating nor freeing has to
+ * happen with the domain paused or the cpupool lock held.
+ */
+struct sched_move_data {
+    struct scheduler *ops;
+    void *domdata;
+    unsigned int nr_vcpus;
+    void *vcpu_priv[];
+};
+
+void sched_free_move_data(struct sched_move_data *md)
+{
+    unsigned int i;
+
+    if ( md == NULL )
+        return;
+
+    for ( i = 0; i < md->nr_vcpus; i++ )
+        if ( md->vcpu_priv[i] != NULL )
+            SCHED_OP(md->ops, free_vdata, md->vcpu_priv[i]);
+    if ( md->domdata != NULL )
+        SCHED_OP(md->ops, free_domdata, md->domdata);
+
+    xfree(md);
+}
+
+struct sched_move_data *sched_alloc_move_data(struct domain *d,
+                                              struct cpupool *c)
 {
+    struct sched_move_data *md;
+    struct vcpu *v;
+
+    md = xzalloc_bytes(sizeof(*md) + d->max_vcpus * sizeof(*md->vcpu_priv));
+    if ( md == NULL )
+        return NULL;
+
+    md->ops = c->sched;
+    md->nr_vcpus = d->max_vcpus;
+    md->domdata = SCHED_OP(c->sched, alloc_domdata, d);
+    if ( md->domdata == NULL )
+        goto fail;
+
+    for_each_vcpu ( d, v )
+    {
+        md->vcpu_priv[v->vcpu_id] = SCHED_OP(c->sched, alloc_vdata, v,
+                                             md->domdata);
+        if ( md->vcpu_priv[v->vcpu_id] == NULL )
+            goto fail;
+    }
+
+    return md;
+
+ fail:
+    sched_free_move_data(md);
+    return NULL;
+}
+
+/*
+ * Move @d to @c, using the scheduler data in @md if it was preallocated by
+ * sched_alloc_move_data().  On success @md is left holding the domain's old
+ * scheduler data, for the caller to free once it has dropped its locks.
+ */
+int sched_move_domain(struct domain *d, struct cpupool *c,
+                      struct sched_move_data *md)
+{
+    struct sched_move_data *own = NULL;
     struct vcpu *v;
     unsigned int new_p;
-    void **vcpu_priv;
-    void *domdata;
     void *vcpudata;
     struct scheduler *old_ops;
     void *old_domdata;
+    int ret = 0;
 
     for_each_vcpu ( d, v )
     {
@@ -318,30 +536,33 @@ int sched_move_domain(struct domain *d, struct cpupool *c)
             return -EBUSY;
     }
 
-    domdata = SCHED_OP(c->sched, alloc_domdata, d);
-    if ( domdata == NULL )
-        return -ENOMEM;
-
-    vcpu_priv = xzalloc_array(void *, d->max_vcpus);
-    if ( vcpu_priv == NULL )
+    if ( md == NULL )
     {
-        SCHED_OP(c->sched, free_domdata, domdata);
-        return -ENOMEM;
+        md = own = sched_alloc_move_data(d, c);
+        if ( md == NULL )
+            return -ENOMEM;
     }
+    ASSERT(md->ops == c->sched && md->nr_vcpus == d->max_vcpus);
 
+    /* vCPUs may have been brought up since @md was allocated. */
     for_each_vcpu ( d, v )
     {
-        vcpu_priv[v->vcpu_id] = SCHED_OP(c->sched, alloc_vdata, v, domdata);
-        if ( vcpu_priv[v->vcpu_id] == NULL )
+        if ( md->vcpu_priv[v->vcpu_id] != NULL )
+            continue;
+        md->vcpu_priv[v->vcpu_id] = SCHED_OP(c->sched, alloc_vdata, v,
+                                             md->domdata);
+        if ( md->vcpu_priv[v->vcpu_id] == NULL )
         {
-            for_each_vcpu ( d, v )
-                xfree(vcpu_priv[v->vcpu_id]);
-            xfree(vcpu_priv);
-            SCHED_OP(c->sched, free_domdata, domdata);
-            return -ENOMEM;
+            ret = -ENOMEM;
+            goto out;
         }
     }
 
+    /*
+     * dom_scheduler() is derived from d->cpupool, so all vCPUs have to
+     * change schedulers at once.  Keep the paused window to the hand over
+     * itself.
+     */
     domain_pause(d);
 
     old_ops = dom_scheduler(d);
@@ -353,7 +574,7 @@ int sched_move_domain(struct domain *d, struct cpupool *c)
     }
 
     d->cpupool = c;
-    d->sched_priv = domdata;
+    d->sched_priv = md->domdata;
 
     new_p = cpumask_first(c->cpu_valid);
     for_each_vcpu ( d, v )
@@ -365,6 +586,7 @@ int sched_move_domain(struct domain *d, struct cpupool *c)
         migrate_timer(&v->periodic_timer, new_p);
         migrate_timer(&v->singleshot_timer, new_p);
         migrate_timer(&v->poll_timer, new_p);
+        migrate_timer(&v->evtchn_holdoff_timer, new_p);
 
         cpumask_setall(v->cpu_hard_affinity);
         cpumask_setall(v->cpu_soft_affinity);
@@ -378,7 +600,7 @@ int sched_move_domain(struct domain *d, struct cpupool *c)
          */
         spin_unlock_irq(lock);
 
-        v->sched_priv = vcpu_priv[v->vcpu_id];
+        v->sched_priv = md->vcpu_priv[v->vcpu_id];
         if ( !d->is_dying )
             sched_move_irqs(v);
 
@@ -386,18 +608,20 @@ int sched_move_domain(struct domain *d, struct cpupool *c)
 
         SCHED_OP(c->sched, insert_vcpu, v);
 
-        SCHED_OP(old_ops, free_vdata, vcpudata);
+        md->vcpu_priv[v->vcpu_id] = vcpudata;
     }
 
-    domain_update_node_affinity(d);
-
     domain_unpause(d);
 
-    SCHED_OP(old_ops, free_domdata, old_domdata);
+    md->ops = old_ops;
+    md->domdata = old_domdata;
+
+    domain_update_node_affinity(d);
 
-    xfree(vcpu_priv);
+ out:
+    sched_free_move_data(own);
 
-    return 0;
+    return ret;
 }
 
 void sched_destroy_vcpu(struct vcpu *v)
@@ -405,6 +629,7 @@ void sched_destroy_vcpu(struct vcpu *v)
     kill_timer(&v->periodic_timer);
     kill_timer(&v->singleshot_timer);
     kill_timer(&v->poll_timer);
+    kill_timer(&v->evtchn_holdoff_timer);
     if ( test_and_clear_bool(v->is_urgent) )
         atomic_dec(&per_cpu(schedule_data, v->processor).urgent_count);
     SCHED_OP(vcpu_scheduler(v), remove_vcpu, v);
@@ -478,7 +703,10 @@ void vcpu_wake(struct vcpu *v)
     if ( likely(vcpu_runnable(v)) )
     {
         if ( v->runstate.state >= RUNSTATE_blocked )
+        {
             vcpu_runstate_change(v, RUNSTATE_runnable, NOW());
+            v->sched_woken = true;
+        }
         SCHED_OP(vcpu_scheduler(v), wake, v);
     }
     else if ( !(v->pause_flags & VPF_blocked) )
@@ -1003,6 +1231,47 @@ long vcpu_yield(void)
     return 0;
 }
 
+/*
+ * Directed yield, for when current is known to be spinning (e.g., on a
+ * pause loop exit). Look for a vcpu of the same domain that is runnable but
+ * not running, as it may well be the one holding the lock, and ask the
+ * scheduler to let it run in place of current. Candidates are scanned round
+ * robin, starting after the last one picked, so that a pack of spinners does
+ * not keep boosting the same vcpu. Current yields in any case.
+ */
+void vcpu_yield_directed(void)
+{
+    struct vcpu *curr = current, *v;
+    struct domain *d = curr->domain;
+    struct scheduler *sched = vcpu_scheduler(curr);
+    unsigned int i, id;
+
+    if ( sched->yield_to != NULL )
+    {
+        for ( i = 1; i <= d->max_vcpus; i++ )
+        {
+            id = (d->directed_yield_last + i) % d->max_vcpus;
+            v = d->vcpu[id];
+
+            if ( v == NULL || v == curr || v->is_running ||
+                 v->runstate.state != RUNSTATE_runnable )
+                continue;
+
+            if ( sched->yield_to(sched, curr, v) )
+            {
+                d->directed_yield_last = id;
+                SCHED_STAT_CRANK(directed_yield);
+                break;
+            }
+        }
+
+        if ( i > d->max_vcpus )
+            SCHED_STAT_CRANK(directed_yield_failed);
+    }
+
+    vcpu_yield();
+}
+
 static void domain_watchdog_timeout(void *data)
 {
     struct domain *d = data;
@@ -1374,6 +1643,105 @@ static void vcpu_periodic_timer_work(struct vcpu *v)
     set_timer(&v->periodic_timer, periodic_next_event);
 }
 
+static inline const cpumask_t *sched_unit_mask(unsigned int cpu)
+{
+    return opt_sched_gran == SCHED_GRAN_CORE ? per_cpu(cpu_sibling_mask, cpu)
+                                             : per_cpu(cpu_core_mask, cpu);
+}
+
+static struct sched_unit_state *sched_unit_state(unsigned int cpu)
+{
+    unsigned int master = cpumask_first(sched_unit_mask(cpu));
+
+    /* Topology information may not be there yet, for a cpu coming up. */
+    return &per_cpu(sched_unit_state, master < nr_cpu_ids ? master : cpu);
+}
+
+bool sched_unit_allows(unsigned int cpu, const struct vcpu *v)
+{
+    struct sched_unit_state *unit;
+    const struct domain *d = v->domain, *sd;
+    unsigned int sibling;
+    bool conflict = false, ok = false;
+    s_time_t now;
+
+    if ( opt_sched_gran == SCHED_GRAN_CPU || is_idle_vcpu(v) )
+        return true;
+
+    unit = sched_unit_state(cpu);
+    now = NOW();
+
+    spin_lock(&unit->lock);
+
+    for_each_cpu ( sibling, sched_unit_mask(cpu) )
+    {
+        sd = per_cpu(sched_unit_dom, sibling);
+        if ( sibling != cpu && sd && sd != d )
+        {
+            conflict = true;
+            break;
+        }
+    }
+
+    if ( conflict )
+    {
+        /* Reserve the unit for d, unless someone else already did. */
+        if ( !unit->wanted || now >= unit->wanted_until )
+        {
+            unit->wanted = d;
+            unit->wanted_until = now + SCHED_UNIT_HANDOVER;
+
+            for_each_cpu ( sibling, sched_unit_mask(cpu) )
+            {
+                sd = per_cpu(sched_unit_dom, sibling);
+                if ( sibling != cpu && sd && sd != d )
+                    cpu_raise_softirq(sibling, SCHEDULE_SOFTIRQ);
+            }
+        }
+    }
+    else if ( !unit->wanted || unit->wanted == d ||
+              now >= unit->wanted_until )
+    {
+        unit->wanted = NULL;
+        /*
+         * Tentatively claim the unit for d, so that siblings scheduling at
+         * the same time see it. The actual choice is recorded in schedule().
+         */
+        per_cpu(sched_unit_dom, cpu) = d;
+        ok = true;
+    }
+
+    spin_unlock(&unit->lock);
+
+    return ok;
+}
+
+/* Record what cpu has picked, letting idle siblings know if that changed. */
+static void sched_unit_commit(unsigned int cpu, const struct vcpu *next)
+{
+    struct sched_unit_state *unit;
+    const struct domain *d = is_idle_vcpu(next) ? NULL : next->domain;
+    unsigned int sibling;
+
+    if ( opt_sched_gran == SCHED_GRAN_CPU )
+        return;
+
+    unit = sched_unit_state(cpu);
+
+    spin_lock(&unit->lock);
+
+    per_cpu(sched_unit_dom, cpu) = d;
+    if ( per_cpu(sched_unit_cur, cpu) != d )
+    {
+        per_cpu(sched_unit_cur, cpu) = d;
+        for_each_cpu ( sibling, sched_unit_mask(cpu) )
+            if ( sibling != cpu && !per_cpu(sched_unit_dom, sibling) )
+                cpu_raise_softirq(sibling, SCHEDULE_SOFTIRQ);
+    }
+
+    spin_unlock(&unit->lock);
+}
+
 /* 
  * The main function
  * - deschedule the current domain (scheduler independent).
@@ -1427,11 +1795,28 @@ static void schedule(void)
 
     next = next_slice.task;
 
+    sched_unit_commit(cpu, next);
+
     sd->curr = next;
 
     if ( next_slice.time >= 0 ) /* -ve means no limit */
         set_timer(&sd->s_timer, now + next_slice.time);
 
+    if ( opt_sched_hist )
+    {
+        /* Account the slice that is ending, and start the new one. */
+        if ( !is_idle_vcpu(prev) && this_cpu(sched_slice_start) )
+        {
+            sched_hist_add(XEN_SYSCTL_SCHED_HIST_slice_run,
+                           now - this_cpu(sched_slice_start));
+            if ( this_cpu(sched_slice_req) >= 0 )
+                sched_hist_add(XEN_SYSCTL_SCHED_HIST_slice_req,
+                               this_cpu(sched_slice_req));
+        }
+        this_cpu(sched_slice_start) = now;
+        this_cpu(sched_slice_req) = next_slice.time;
+    }
+
     if ( unlikely(prev == next) )
     {
         pcpu_schedule_unlock_irq(lock, cpu);
@@ -1466,6 +1851,19 @@ static void schedule(void)
     prev->last_run_time = now;
 
     ASSERT(next->runstate.state != RUNSTATE_running);
+    if ( opt_sched_hist && !is_idle_vcpu(next) )
+    {
+        if ( next->runstate.state == RUNSTATE_runnable )
+        {
+            s_time_t wait = now - next->runstate.state_entry_time;
+
+            sched_hist_add(XEN_SYSCTL_SCHED_HIST_runq_wait, wait);
+            if ( next->sched_woken )
+                sched_hist_add(XEN_SYSCTL_SCHED_HIST_wakeup, wait);
+        }
+        this_cpu(sched_switch_start) = now;
+    }
+    next->sched_woken = false;
     vcpu_runstate_change(next, RUNSTATE_running, now);
 
     /*
@@ -1497,6 +1895,13 @@ void context_saved(struct vcpu *prev)
 
     prev->is_running = 0;
 
+    if ( this_cpu(sched_switch_start) )
+    {
+        sched_hist_add(XEN_SYSCTL_SCHED_HIST_ctxsw,
+                       NOW() - this_cpu(sched_switch_start));
+        this_cpu(sched_switch_start) = 0;
+    }
+
     /* Check for migration request /after/ clearing running flag. */
     smp_mb();
 
@@ -1548,6 +1953,11 @@ static int cpu_schedule_up(unsigned int cpu)
     init_timer(&sd->s_timer, s_timer_fn, NULL, cpu);
     atomic_set(&sd->urgent_count, 0);
 
+    spin_lock_init(&per_cpu(sched_unit_state, cpu).lock);
+    per_cpu(sched_unit_state, cpu).wanted = NULL;
+    per_cpu(sched_unit_dom, cpu) = NULL;
+    per_cpu(sched_unit_cur, cpu) = NULL;
+
     /* Boot CPU is dealt with later in schedule_init(). */
     if ( cpu == 0 )
         return 0;
@@ -1706,6 +2116,16 @@ void __init scheduler_init(void)
     register_cpu_notifier(&cpu_schedule_nfb);
 
     printk("Using scheduler: %s (%s)\n", ops.name, ops.opt_name);
+
+    if ( opt_sched_gran != SCHED_GRAN_CPU && !ops.gran_aware )
+    {
+        printk("WARNING: %s scheduler does not support sched-gran, ignoring\n",
+               ops.opt_name);
+        opt_sched_gran = SCHED_GRAN_CPU;
+    }
+    else if ( opt_sched_gran != SCHED_GRAN_CPU )
+        printk("Scheduling granularity: %s\n",
+               opt_sched_gran == SCHED_GRAN_CORE ? "core" : "socket");
     if ( SCHED_OP(&ops, init) )
         panic("scheduler returned error on init");
 
@@ -10,12 +10,16 @@
  */
 
 #include <xen/init.h>
+#include <xen/keyhandler.h>
 #include <xen/mm.h>
+#include <xen/perfc.h>
 #include <xen/preempt.h>
 #include <xen/sched.h>
 #include <xen/rcupdate.h>
 #include <xen/softirq.h>
 
+#include <asm/event.h>
+
 #ifndef __ARCH_IRQ_STAT
 irq_cpustat_t irq_stat[NR_CPUS];
 #endif
@@ -25,10 +29,19 @@ static softirq_handler softirq_handlers[NR_SOFTIRQS];
 static DEFINE_PER_CPU(cpumask_t, batch_mask);
 static DEFINE_PER_CPU(unsigned int, batching);
 
+struct softirq_stats {
+    unsigned long count;
+    s_time_t time, max;
+};
+
+static DEFINE_PER_CPU(struct softirq_stats, softirq_stats[NR_SOFTIRQS]);
+
 static void __do_softirq(unsigned long ignore_mask)
 {
     unsigned int i, cpu;
     unsigned long pending;
+    struct softirq_stats *st;
+    s_time_t start, delta;
 
     for ( ; ; )
     {
@@ -47,7 +60,25 @@ static void __do_softirq(unsigned long ignore_mask)
 
         i = find_first_set_bit(pending);
         clear_bit(i, &softirq_pending(cpu));
+        st = &per_cpu(softirq_stats, cpu)[i];
+        st->count++;
+
+        /*
+         * The scheduler may not come back here until the vCPU it switched
+         * away from runs again, so only count it.
+         */
+        if ( i == SCHEDULE_SOFTIRQ )
+        {
+            (*softirq_handlers[i])();
+            continue;
+        }
+
+        start = NOW();
         (*softirq_handlers[i])();
+        delta = NOW() - start;
+        st->time += delta;
+        if ( delta > st->max )
+            st->max = delta;
     }
 }
 
@@ -58,6 +89,29 @@ void process_pending_softirqs(void)
     __do_softirq(1ul<<SCHEDULE_SOFTIRQ);
 }
 
+bool hypercall_preempt_check_inplace(void)
+{
+    unsigned int cpu = smp_processor_id();
+
+    if ( likely(!hypercall_preempt_check()) )
+        return false;
+
+    if ( in_atomic() || local_events_need_delivery() ||
+         (softirq_pending(cpu) & (1ul << SCHEDULE_SOFTIRQ)) )
+        goto exit;
+
+    perfc_incr(hypercall_preempt_inplace);
+    process_pending_softirqs();
+
+    /* Softirq handlers may have raised a reschedule or sent an event. */
+    if ( !hypercall_preempt_check() )
+        return false;
+
+ exit:
+    perfc_incr(hypercall_preempt_exit);
+    return true;
+}
+
 void do_softirq(void)
 {
     ASSERT_NOT_IN_ATOMIC();
@@ -132,8 +186,32 @@ void raise_softirq(unsigned int nr)
     set_bit(nr, &softirq_pending(smp_processor_id()));
 }
 
+static void dump_softirq_stats(unsigned char key)
+{
+    unsigned int cpu, i;
+
+    printk("Softirq work per CPU (count, total/max us):\n");
+    for_each_online_cpu ( cpu )
+    {
+        printk("CPU%u:\n", cpu);
+        for ( i = 0; i < NR_SOFTIRQS; i++ )
+        {
+            const struct softirq_stats *st = &per_cpu(softirq_stats, cpu)[i];
+
+            if ( !st->count )
+                continue;
+            printk("  %2u %ps: %lu", i, softirq_handlers[i], st->count);
+            if ( i != SCHEDULE_SOFTIRQ )
+                printk(", %"PRI_stime"/%"PRI_stime, st->time / MICROSECS(1),
+                       st->max / MICROSECS(1));
+            printk("\n");
+        }
+    }
+}
+
 void __init softirq_init(void)
 {
+    register_keyhandler('k', dump_softirq_stats, "dump softirq stats", 1);
 }
 
 /*
@@ -4,7 +4,11 @@
 #include <xen/time.h>
 #include <xen/spinlock.h>
 #include <xen/guest_access.h>
+#include <xen/init.h>
+#include <xen/lat_hist.h>
 #include <xen/preempt.h>
+#include <xen/symbols.h>
+#include <xen/xmalloc.h>
 #include <public/sysctl.h>
 #include <asm/processor.h>
 #include <asm/atomic.h>
@@ -123,42 +127,83 @@ static always_inline spinlock_tickets_t observe_lock(spinlock_tickets_t *t)
     return v;
 }
 
+static unsigned int __read_mostly lock_cont_sample;
+static void lock_cont_release(spinlock_t *lock, const void *site);
+
+#define LOCK_CONT_VAR       s_time_t wait = 0
+#define LOCK_CONT_BLOCK     wait = wait ? : lock_cont_start()
+#define LOCK_CONT_GOT(type)                                                  \
+    if ( unlikely(wait > 0) )                                                \
+        lock_cont_wait(type, site, wait)
+#define LOCK_CONT_REL                                                        \
+    if ( unlikely(lock_cont_sample) )                                        \
+        lock_cont_release(lock, site)
+
 static always_inline u16 observe_head(spinlock_tickets_t *t)
 {
     smp_rmb();
     return read_atomic(&t->head);
 }
 
-void inline _spin_lock_cb(spinlock_t *lock, void (*cb)(void *), void *data)
+/* Queued locks are free only with an empty queue, see qspinlock.c. */
+static always_inline bool queued_trylock(spinlock_tickets_t *t)
+{
+    return !read_atomic(&t->head_tail) &&
+           cmpxchg(&t->head_tail, 0, 1) == 0;
+}
+
+static always_inline void spin_lock_common(spinlock_t *lock,
+                                           void (*cb)(void *), void *data,
+                                           const void *site)
 {
     spinlock_tickets_t tickets = SPINLOCK_TICKET_INC;
+    LOCK_CONT_VAR;
     LOCK_PROFILE_VAR;
 
     check_lock(&lock->debug);
-    tickets.head_tail = arch_fetch_and_add(&lock->tickets.head_tail,
-                                           tickets.head_tail);
-    while ( tickets.tail != observe_head(&lock->tickets) )
+    if ( spin_lock_is_queued(lock) )
+    {
+        if ( unlikely(!queued_trylock(&lock->tickets)) )
+        {
+            LOCK_PROFILE_BLOCK;
+            LOCK_CONT_BLOCK;
+            queued_spin_lock_slowpath(&lock->tickets, cb, data);
+        }
+    }
+    else
     {
-        LOCK_PROFILE_BLOCK;
-        if ( unlikely(cb) )
-            cb(data);
-        arch_lock_relax();
+        tickets.head_tail = arch_fetch_and_add(&lock->tickets.head_tail,
+                                               tickets.head_tail);
+        while ( tickets.tail != observe_head(&lock->tickets) )
+        {
+            LOCK_PROFILE_BLOCK;
+            LOCK_CONT_BLOCK;
+            if ( unlikely(cb) )
+                cb(data);
+            arch_lock_relax();
+        }
     }
     LOCK_PROFILE_GOT;
+    LOCK_CONT_GOT(LOCKCONT_TYPE_SPIN_WAIT);
     preempt_disable();
     arch_lock_acquire_barrier();
 }
 
+void _spin_lock_cb(spinlock_t *lock, void (*cb)(void *), void *data)
+{
+    spin_lock_common(lock, cb, data, __builtin_return_address(0));
+}
+
 void _spin_lock(spinlock_t *lock)
 {
-     _spin_lock_cb(lock, NULL, NULL);
+    spin_lock_common(lock, NULL, NULL, __builtin_return_address(0));
 }
 
 void _spin_lock_irq(spinlock_t *lock)
 {
     ASSERT(local_irq_is_enabled());
     local_irq_disable();
-    _spin_lock(lock);
+    spin_lock_common(lock, NULL, NULL, __builtin_return_address(0));
 }
 
 unsigned long _spin_lock_irqsave(spinlock_t *lock)
@@ -166,28 +211,38 @@ unsigned long _spin_lock_irqsave(spinlock_t *lock)
     unsigned long flags;
 
     local_irq_save(flags);
-    _spin_lock(lock);
+    spin_lock_common(lock, NULL, NULL, __builtin_return_address(0));
     return flags;
 }
 
-void _spin_unlock(spinlock_t *lock)
+static always_inline void spin_unlock_common(spinlock_t *lock,
+                                             const void *site)
 {
     arch_lock_release_barrier();
     preempt_enable();
     LOCK_PROFILE_REL;
-    add_sized(&lock->tickets.head, 1);
+    LOCK_CONT_REL;
+    if ( spin_lock_is_queued(lock) )
+        write_atomic(&lock->tickets.locked, 0);
+    else
+        add_sized(&lock->tickets.head, 1);
     arch_lock_signal();
 }
 
+void _spin_unlock(spinlock_t *lock)
+{
+    spin_unlock_common(lock, __builtin_return_address(0));
+}
+
 void _spin_unlock_irq(spinlock_t *lock)
 {
-    _spin_unlock(lock);
+    spin_unlock_common(lock, __builtin_return_address(0));
     local_irq_enable();
 }
 
 void _spin_unlock_irqrestore(spinlock_t *lock, unsigned long flags)
 {
-    _spin_unlock(lock);
+    spin_unlock_common(lock, __builtin_return_address(0));
     local_irq_restore(flags);
 }
 
@@ -200,9 +255,11 @@ int _spin_is_locked(spinlock_t *lock)
      * "false" here, making this function suitable only for use in
      * ASSERT()s and alike.
      */
-    return lock->recurse_cpu == SPINLOCK_NO_CPU
-           ? lock->tickets.head != lock->tickets.tail
-           : lock->recurse_cpu == smp_processor_id();
+    if ( lock->recurse_cpu != SPINLOCK_NO_CPU )
+        return lock->recurse_cpu == smp_processor_id();
+
+    return spin_lock_is_queued(lock) ? lock->tickets.locked
+                                     : lock->tickets.head != lock->tickets.tail;
 }
 
 int _spin_trylock(spinlock_t *lock)
@@ -210,14 +267,22 @@ int _spin_trylock(spinlock_t *lock)
     spinlock_tickets_t old, new;
 
     check_lock(&lock->debug);
-    old = observe_lock(&lock->tickets);
-    if ( old.head != old.tail )
-        return 0;
-    new = old;
-    new.tail++;
-    if ( cmpxchg(&lock->tickets.head_tail,
-                 old.head_tail, new.head_tail) != old.head_tail )
-        return 0;
+    if ( spin_lock_is_queued(lock) )
+    {
+        if ( !queued_trylock(&lock->tickets) )
+            return 0;
+    }
+    else
+    {
+        old = observe_lock(&lock->tickets);
+        if ( old.head != old.tail )
+            return 0;
+        new = old;
+        new.tail++;
+        if ( cmpxchg(&lock->tickets.head_tail,
+                     old.head_tail, new.head_tail) != old.head_tail )
+            return 0;
+    }
 #ifdef CONFIG_LOCK_PROFILE
     if (lock->profile)
         lock->profile->time_locked = NOW();
@@ -240,7 +305,16 @@ void _spin_barrier(spinlock_t *lock)
     check_barrier(&lock->debug);
     smp_mb();
     sample = observe_lock(&lock->tickets);
-    if ( sample.head != sample.tail )
+    if ( spin_lock_is_queued(lock) )
+    {
+        /* No owner identity to wait for: wait for any release. */
+        while ( sample.locked )
+        {
+            arch_lock_relax();
+            sample = observe_lock(&lock->tickets);
+        }
+    }
+    else if ( sample.head != sample.tail )
     {
         while ( observe_head(&lock->tickets) == sample.head )
             arch_lock_relax();
@@ -284,7 +358,7 @@ void _spin_lock_recursive(spinlock_t *lock)
 
     if ( likely(lock->recurse_cpu != cpu) )
     {
-        _spin_lock(lock);
+        spin_lock_common(lock, NULL, NULL, __builtin_return_address(0));
         lock->recurse_cpu = cpu;
     }
 
@@ -298,8 +372,244 @@ void _spin_unlock_recursive(spinlock_t *lock)
     if ( likely(--lock->recurse_cnt == 0) )
     {
         lock->recurse_cpu = SPINLOCK_NO_CPU;
-        spin_unlock(lock);
+        spin_unlock_common(lock, __builtin_return_address(0));
+    }
+}
+
+/*
+ * Contention profiling.  With lock_cont_sample zero, the only cost is a
+ * test on the release path and on the first spin of a contended
+ * acquisition.  Each pCPU accounts its samples in its own table of call
+ * sites, with interrupts off, so neither locks nor atomics are needed.
+ * The tables are allocated when profiling is first enabled and are
+ * indexed by CPU number rather than per-CPU, to survive CPU hotplug.
+ */
+#define LOCK_CONT_SITES     256
+#define LOCK_CONT_PROBES    8
+
+struct lock_cont_site {
+    const void *site;
+    unsigned int type;
+    uint64_t count, total, max;
+    uint64_t hist[XEN_SYSCTL_LAT_HIST_BUCKETS];
+};
+
+struct lock_cont_table {
+    unsigned int skip;      /* contended acquisitions since last sample */
+    unsigned int dropped;
+    struct lock_cont_site sites[LOCK_CONT_SITES];
+};
+
+static struct lock_cont_table *lock_cont_tables[NR_CPUS];
+static s_time_t lock_cont_since;
+
+static int __init parse_lock_contention(const char *s)
+{
+    lock_cont_sample = simple_strtoul(s, &s, 0);
+
+    return *s ? -EINVAL : 0;
+}
+custom_param("lock-contention", parse_lock_contention);
+
+static void lock_cont_record(unsigned int type, const void *site,
+                             uint64_t val, bool wait)
+{
+    struct lock_cont_table *t = lock_cont_tables[smp_processor_id()];
+    struct lock_cont_site *e;
+    unsigned int i, n;
+    unsigned long flags;
+
+    if ( !t )
+        return;
+
+    local_irq_save(flags);
+
+    /* Multiplicative hash, top 8 bits. */
+    BUILD_BUG_ON(LOCK_CONT_SITES != 256);
+    i = ((uint32_t)(unsigned long)site * 0x9e3779b1u) >> 24;
+    for ( n = 0; n < LOCK_CONT_PROBES; n++, i++ )
+    {
+        e = &t->sites[i % LOCK_CONT_SITES];
+        if ( e->site == site && e->type == type )
+            break;
+        if ( !e->site )
+        {
+            e->site = site;
+            e->type = type;
+            break;
+        }
     }
+
+    if ( n == LOCK_CONT_PROBES )
+        t->dropped++;
+    else
+    {
+        e->count++;
+        e->total += val;
+        if ( val > e->max )
+            e->max = val;
+        if ( wait )
+            e->hist[lat_hist_bucket(val)]++;
+    }
+
+    local_irq_restore(flags);
+}
+
+s64 lock_cont_start(void)
+{
+    struct lock_cont_table *t;
+
+    if ( likely(!lock_cont_sample) )
+        return -1;
+
+    t = lock_cont_tables[smp_processor_id()];
+    if ( !t || ++t->skip < lock_cont_sample )
+        return -1;
+    t->skip = 0;
+
+    return NOW();
+}
+
+void lock_cont_wait(unsigned int type, const void *site, s64 start)
+{
+    if ( start > 0 )
+        lock_cont_record(type, site, NOW() - start, true);
+}
+
+static void lock_cont_release(spinlock_t *lock, const void *site)
+{
+    spinlock_tickets_t t = observe_lock(&lock->tickets);
+    /* Queued locks only tell whether there are waiters, not how many. */
+    u16 waiters = spin_lock_is_queued(lock) ? !!t.qtail
+                                            : t.tail - t.head - 1;
+
+    if ( waiters )
+        lock_cont_record(LOCKCONT_TYPE_SPIN_HOLDER, site, waiters, false);
+}
+
+static int lock_cont_alloc(void)
+{
+    unsigned int cpu;
+
+    for_each_possible_cpu ( cpu )
+    {
+        if ( lock_cont_tables[cpu] )
+            continue;
+        lock_cont_tables[cpu] = xzalloc(struct lock_cont_table);
+        if ( !lock_cont_tables[cpu] )
+            return -ENOMEM;
+    }
+
+    return 0;
+}
+
+static int __init lock_cont_init(void)
+{
+    lock_cont_since = NOW();
+
+    if ( lock_cont_sample && lock_cont_alloc() )
+    {
+        printk(XENLOG_WARNING "Lock contention profiling disabled: no memory\n");
+        lock_cont_sample = 0;
+    }
+
+    return 0;
+}
+__initcall(lock_cont_init);
+
+static void lock_cont_reset_cpu(void *unused)
+{
+    struct lock_cont_table *t = lock_cont_tables[smp_processor_id()];
+
+    if ( t )
+        memset(t, 0, sizeof(*t));
+}
+
+static int lock_cont_query(struct xen_sysctl_lockcont_op *op)
+{
+    struct xen_sysctl_lockcont_data data;
+    char namebuf[KSYM_NAME_LEN + 1];
+    unsigned int cpu, i, n = 0;
+    unsigned long size, offset;
+    const char *name;
+
+    op->dropped = 0;
+
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+    {
+        const struct lock_cont_table *t = lock_cont_tables[cpu];
+
+        if ( !t )
+            continue;
+
+        op->dropped += t->dropped;
+
+        for ( i = 0; i < LOCK_CONT_SITES; i++ )
+        {
+            const struct lock_cont_site *e = &t->sites[i];
+
+            if ( !e->site )
+                continue;
+
+            if ( n < op->max_elem && !guest_handle_is_null(op->data) )
+            {
+                name = symbols_lookup((unsigned long)e->site, &size, &offset,
+                                      namebuf);
+                if ( name )
+                    snprintf(data.site, sizeof(data.site), "%s+%#lx",
+                             name, offset);
+                else
+                    snprintf(data.site, sizeof(data.site), "%p", e->site);
+                data.addr = (unsigned long)e->site;
+                data.type = e->type;
+                data.cpu = cpu;
+                data.count = e->count;
+                data.total = e->total;
+                data.max = e->max;
+                memcpy(data.hist, e->hist, sizeof(data.hist));
+
+                if ( copy_to_guest_offset(op->data, n, &data, 1) )
+                    return -EFAULT;
+            }
+            n++;
+        }
+    }
+
+    op->nr_elem = n;
+    op->sample = lock_cont_sample;
+    op->time = NOW() - lock_cont_since;
+
+    return 0;
+}
+
+/* Serialised by the sysctl lock. */
+int lock_cont_control(struct xen_sysctl_lockcont_op *op)
+{
+    unsigned int cpu;
+    int rc;
+
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_LOCKCONT_enable:
+        if ( op->sample && (rc = lock_cont_alloc()) != 0 )
+            return rc;
+        lock_cont_sample = op->sample;
+        return 0;
+
+    case XEN_SYSCTL_LOCKCONT_query:
+        return lock_cont_query(op);
+
+    case XEN_SYSCTL_LOCKCONT_reset:
+        /* Online pCPUs clear their own tables, to not race with updates. */
+        for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+            if ( lock_cont_tables[cpu] && !cpu_online(cpu) )
+                memset(lock_cont_tables[cpu], 0, sizeof(**lock_cont_tables));
+        on_each_cpu(lock_cont_reset_cpu, NULL, 1);
+        lock_cont_since = NOW();
+        return 0;
+    }
+
+    return -EINVAL;
 }
 
 #ifdef CONFIG_LOCK_PROFILE
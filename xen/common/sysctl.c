@@ -28,6 +28,10 @@
 #include <xen/pmstat.h>
 #include <xen/livepatch.h>
 #include <xen/gcov.h>
+#include <xen/lat_hist.h>
+
+/* Pages handled by XEN_SYSCTL_page_offline_op between preemption checks. */
+#define PAGE_OFFLINE_CHUNK 1024
 
 long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
 {
@@ -114,12 +118,146 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
     }
     break;
 
+    case XEN_SYSCTL_vcpuinfolist:
+    {
+        struct xen_sysctl_vcpuinfolist *vl = &op->u.vcpuinfolist;
+        struct xen_sysctl_vcpuinfo info = { 0 };
+        struct vcpu_runstate_info runstate;
+        struct domain *d;
+        struct vcpu *v;
+        u32 num_vcpus = 0;
+
+        rcu_read_lock(&domlist_read_lock);
+
+        for_each_domain ( d )
+        {
+            if ( d->domain_id < vl->first_domain )
+                continue;
+            if ( num_vcpus == vl->max_vcpus )
+                break;
+
+            if ( xsm_getdomaininfo(XSM_HOOK, d) )
+                continue;
+
+            for_each_vcpu ( d, v )
+            {
+                if ( d->domain_id == vl->first_domain &&
+                     v->vcpu_id < vl->first_vcpu )
+                    continue;
+                if ( num_vcpus == vl->max_vcpus )
+                    break;
+
+                vcpu_runstate_get(v, &runstate);
+
+                info.domid    = d->domain_id;
+                info.vcpu     = v->vcpu_id;
+                info.online   = !(v->pause_flags & VPF_down);
+                info.blocked  = !!(v->pause_flags & VPF_blocked);
+                info.running  = v->is_running;
+                info.waiting  = vcpu_is_waiting(v);
+                info.cpu_time = runstate.time[RUNSTATE_running];
+                info.cpu      = v->processor;
+
+                if ( copy_to_guest_offset(vl->buffer, num_vcpus, &info, 1) )
+                {
+                    ret = -EFAULT;
+                    break;
+                }
+
+                num_vcpus++;
+            }
+
+            if ( ret )
+                break;
+        }
+
+        rcu_read_unlock(&domlist_read_lock);
+
+        if ( ret != 0 )
+            break;
+
+        vl->num_vcpus = num_vcpus;
+    }
+    break;
+
+    case XEN_SYSCTL_domschedstats:
+    {
+        struct xen_sysctl_domschedstatslist *sl = &op->u.domschedstats;
+        struct xen_sysctl_domschedstats stats;
+        struct vcpu_runstate_info runstate;
+        struct domain *d;
+        struct vcpu *v;
+        unsigned int i;
+        u32 num_domains = 0;
+
+        sl->now = NOW();
+
+        rcu_read_lock(&domlist_read_lock);
+
+        for_each_domain ( d )
+        {
+            if ( d->domain_id < sl->first_domain )
+                continue;
+            if ( num_domains == sl->max_domains )
+                break;
+
+            if ( xsm_getdomaininfo(XSM_HOOK, d) )
+                continue;
+
+            memset(&stats, 0, sizeof(stats));
+            stats.domid = d->domain_id;
+
+            for_each_vcpu ( d, v )
+            {
+                vcpu_runstate_get(v, &runstate);
+                for ( i = 0; i < ARRAY_SIZE(stats.time); i++ )
+                    stats.time[i] += runstate.time[i];
+
+                stats.switches    += v->sched_switches;
+                stats.preemptions += v->sched_preempts;
+                stats.blocks      += v->sched_blocks;
+                stats.wakeups     += v->sched_wakeups;
+                stats.nr_vcpus++;
+            }
+
+            if ( copy_to_guest_offset(sl->buffer, num_domains, &stats, 1) )
+            {
+                ret = -EFAULT;
+                break;
+            }
+
+            num_domains++;
+        }
+
+        rcu_read_unlock(&domlist_read_lock);
+
+        if ( ret != 0 )
+            break;
+
+        sl->num_domains = num_domains;
+    }
+    break;
+
 #ifdef CONFIG_PERF_COUNTERS
     case XEN_SYSCTL_perfc_op:
         ret = perfc_control(&op->u.perfc_op);
         break;
 #endif
 
+    case XEN_SYSCTL_sched_hist:
+        ret = sched_hist_op(&op->u.sched_hist);
+        break;
+
+    case XEN_SYSCTL_lat_hist:
+        ret = lat_hist_op(&op->u.lat_hist);
+        if ( ret == -ENOBUFS )
+            copyback = 1; /* let the caller learn the set size */
+        break;
+
+    case XEN_SYSCTL_lockcont_op:
+        ret = lock_cont_control(&op->u.lockcont_op);
+        break;
+
 #ifdef CONFIG_LOCK_PROFILE
     case XEN_SYSCTL_lockprof_op:
         ret = spinlock_profile_control(&op->u.lockprof_op);
@@ -185,16 +323,22 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
 
     case XEN_SYSCTL_page_offline_op:
     {
-        uint32_t *status, *ptr;
-        unsigned long pfn;
+        struct xen_sysctl_page_offline_op *po = &op->u.page_offline;
+        uint32_t *status;
+        unsigned long pfn, done = 0;
+        unsigned int i, nr = 0;
 
-        ret = xsm_page_offline(XSM_HOOK, op->u.page_offline.cmd);
+        ret = xsm_page_offline(XSM_HOOK, po->cmd);
         if ( ret )
             break;
 
-        ptr = status = xmalloc_bytes( sizeof(uint32_t) *
-                                (op->u.page_offline.end -
-                                  op->u.page_offline.start + 1));
+        if ( po->end < po->start )
+        {
+            ret = -EINVAL;
+            break;
+        }
+
+        status = xmalloc_array(uint32_t, PAGE_OFFLINE_CHUNK);
         if ( !status )
         {
             dprintk(XENLOG_WARNING, "Out of memory for page offline op\n");
@@ -202,41 +346,52 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
             break;
         }
 
-        memset(status, PG_OFFLINE_INVALID, sizeof(uint32_t) *
-                      (op->u.page_offline.end - op->u.page_offline.start + 1));
+        copyback = 0;
 
-        for ( pfn = op->u.page_offline.start;
-              pfn <= op->u.page_offline.end;
-              pfn ++ )
+        for ( pfn = po->start; pfn <= po->end; pfn += nr, done += nr )
         {
-            switch ( op->u.page_offline.cmd )
+            if ( done && hypercall_preempt_check() )
+            {
+                /* Continue from pfn, with status[] advanced to match. */
+                po->start = pfn;
+                guest_handle_add_offset(po->status, done);
+                copyback = 1;
+                ret = hypercall_create_continuation(
+                    __HYPERVISOR_sysctl, "h", u_sysctl);
+                break;
+            }
+
+            nr = min_t(unsigned long, po->end - pfn + 1, PAGE_OFFLINE_CHUNK);
+            for ( i = 0; i < nr; i++ )
+                status[i] = PG_OFFLINE_INVALID;
+
+            switch ( po->cmd )
             {
                 /* Shall revert her if failed, or leave caller do it? */
                 case sysctl_page_offline:
-                    ret = offline_page(pfn, 0, ptr++);
+                    ret = offline_page_range(pfn, nr, status);
                     break;
                 case sysctl_page_online:
-                    ret = online_page(pfn, ptr++);
+                    for ( i = 0; !ret && i < nr; i++ )
+                        ret = online_page(pfn + i, &status[i]);
                     break;
                 case sysctl_query_page_offline:
-                    ret = query_page_offline(pfn, ptr++);
+                    for ( i = 0; !ret && i < nr; i++ )
+                        ret = query_page_offline(pfn + i, &status[i]);
                     break;
                 default:
                     ret = -EINVAL;
                     break;
             }
 
-            if (ret)
+            if ( copy_to_guest_offset(po->status, done, status, nr) )
+                ret = -EFAULT;
+
+            if ( ret )
                 break;
         }
 
-        if ( copy_to_guest(
-                 op->u.page_offline.status, status,
-                 op->u.page_offline.end - op->u.page_offline.start + 1) )
-            ret = -EFAULT;
-
         xfree(status);
-        copyback = 0;
     }
     break;
 
@@ -344,6 +499,42 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
     }
     break;
 
+    case XEN_SYSCTL_scrubinfo:
+    {
+        unsigned int i, num_nodes = last_node(node_online_map) + 1;
+        struct xen_sysctl_scrubinfo *si = &op->u.scrubinfo;
+
+        if ( !guest_handle_is_null(si->pending) )
+        {
+            if ( num_nodes > si->num_nodes )
+                num_nodes = si->num_nodes;
+            for ( i = 0; i < num_nodes; ++i )
+            {
+                uint64_t pending = node_online(i) ? node_scrub_pending(i) : 0;
+
+                if ( copy_to_guest_offset(si->pending, i, &pending, 1) )
+                {
+                    ret = -EFAULT;
+                    break;
+                }
+            }
+        }
+        else
+            i = num_nodes;
+
+        if ( !ret && (si->num_nodes != i) )
+        {
+            si->num_nodes = i;
+            if ( __copy_field_to_guest(u_sysctl, op,
+                                       u.scrubinfo.num_nodes) )
+            {
+                ret = -EFAULT;
+                break;
+            }
+        }
+    }
+    break;
+
     case XEN_SYSCTL_cputopoinfo:
     {
         unsigned int i, num_cpus;
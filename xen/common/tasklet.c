@@ -14,10 +14,12 @@
  */
 
 #include <xen/init.h>
+#include <xen/keyhandler.h>
 #include <xen/sched.h>
 #include <xen/softirq.h>
 #include <xen/tasklet.h>
 #include <xen/cpu.h>
+#include <xen/timer.h>
 
 /* Some subsystems call into us before we are initialised. We ignore them. */
 static bool_t tasklets_initialised;
@@ -30,25 +32,126 @@ static DEFINE_PER_CPU(struct list_head, softirq_tasklet_list);
 /* Protects all lists and tasklet structures. */
 static DEFINE_SPINLOCK(tasklet_lock);
 
+/*
+ * Microseconds of tasklet work a CPU may do per TASKLET_BUDGET_PERIOD
+ * before the rest of its queues waits for the next period, letting guest
+ * vCPUs run in between.  0 means no limit.
+ */
+static unsigned int __read_mostly opt_tasklet_budget;
+integer_param("tasklet-budget", opt_tasklet_budget);
+
+#define TASKLET_BUDGET_PERIOD MILLISECS(10)
+
+/* Number of callbacks accounted separately on each CPU. */
+#define TASKLET_STATS_FUNCS 8
+
+struct tasklet_stats {
+    void (*func)(unsigned long);  /* NULL for all others */
+    unsigned long count;
+    s_time_t time, max;
+};
+
+struct tasklet_cpu {
+    struct tasklet_stats stats[TASKLET_STATS_FUNCS + 1];
+    s_time_t period_end, used;
+    bool deferred[2];             /* Indexed by is_softirq */
+    struct timer resume_timer;
+};
+
+static DEFINE_PER_CPU(struct tasklet_cpu, tasklet_cpu);
+
 static void tasklet_enqueue(struct tasklet *t)
 {
     unsigned int cpu = t->scheduled_on;
+    const struct tasklet_cpu *tc = &per_cpu(tasklet_cpu, cpu);
 
     if ( t->is_softirq )
     {
         struct list_head *list = &per_cpu(softirq_tasklet_list, cpu);
         bool_t was_empty = list_empty(list);
         list_add_tail(&t->list, list);
-        if ( was_empty )
+        if ( was_empty && !tc->deferred[1] )
             cpu_raise_softirq(cpu, TASKLET_SOFTIRQ);
     }
     else
     {
         unsigned long *work_to_do = &per_cpu(tasklet_work_to_do, cpu);
         list_add_tail(&t->list, &per_cpu(tasklet_list, cpu));
-        if ( !test_and_set_bit(_TASKLET_enqueued, work_to_do) )
+        if ( !tc->deferred[0] && !test_and_set_bit(_TASKLET_enqueued,
+                                                   work_to_do) )
+            cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
+    }
+}
+
+static void tasklet_account(unsigned int cpu, void (*func)(unsigned long),
+                            s_time_t start)
+{
+    struct tasklet_cpu *tc = &per_cpu(tasklet_cpu, cpu);
+    struct tasklet_stats *st = tc->stats;
+    s_time_t delta = NOW() - start;
+
+    while ( st < &tc->stats[TASKLET_STATS_FUNCS] &&
+            st->func && st->func != func )
+        st++;
+    if ( st < &tc->stats[TASKLET_STATS_FUNCS] )
+        st->func = func;
+
+    st->count++;
+    st->time += delta;
+    if ( delta > st->max )
+        st->max = delta;
+
+    if ( start >= tc->period_end )
+    {
+        tc->period_end = start + TASKLET_BUDGET_PERIOD;
+        tc->used = 0;
+    }
+    tc->used += delta;
+}
+
+/*
+ * Whether the tasklets left on this CPU's list of the given kind should wait
+ * for the next budget period.  If so, tasklet_resume() will kick them off.
+ */
+static bool tasklet_defer(unsigned int cpu, bool softirq)
+{
+    struct tasklet_cpu *tc = &per_cpu(tasklet_cpu, cpu);
+
+    if ( !opt_tasklet_budget || !tc->resume_timer.function ||
+         tc->used < MICROSECS(opt_tasklet_budget) )
+        return false;
+
+    tc->deferred[softirq] = true;
+    set_timer(&tc->resume_timer, tc->period_end);
+
+    return true;
+}
+
+static void tasklet_resume(void *data)
+{
+    unsigned int cpu = (unsigned long)data;
+    struct tasklet_cpu *tc = &per_cpu(tasklet_cpu, cpu);
+    unsigned long flags;
+
+    spin_lock_irqsave(&tasklet_lock, flags);
+
+    if ( tc->deferred[0] )
+    {
+        tc->deferred[0] = false;
+        if ( !list_empty(&per_cpu(tasklet_list, cpu)) &&
+             !test_and_set_bit(_TASKLET_enqueued,
+                               &per_cpu(tasklet_work_to_do, cpu)) )
             cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
     }
+
+    if ( tc->deferred[1] )
+    {
+        tc->deferred[1] = false;
+        if ( !list_empty(&per_cpu(softirq_tasklet_list, cpu)) )
+            cpu_raise_softirq(cpu, TASKLET_SOFTIRQ);
+    }
+
+    spin_unlock_irqrestore(&tasklet_lock, flags);
 }
 
 void tasklet_schedule_on_cpu(struct tasklet *t, unsigned int cpu)
@@ -78,6 +181,8 @@ void tasklet_schedule(struct tasklet *t)
 static void do_tasklet_work(unsigned int cpu, struct list_head *list)
 {
     struct tasklet *t;
+    void (*func)(unsigned long);
+    s_time_t start;
 
     if ( unlikely(list_empty(list) || cpu_is_offline(cpu)) )
         return;
@@ -91,9 +196,13 @@ static void do_tasklet_work(unsigned int cpu, struct list_head *list)
 
     spin_unlock_irq(&tasklet_lock);
     sync_local_execstate();
-    t->func(t->data);
+    func = t->func;
+    start = NOW();
+    func(t->data);
     spin_lock_irq(&tasklet_lock);
 
+    tasklet_account(cpu, func, start);
+
     t->is_running = 0;
 
     if ( t->scheduled_on >= 0 )
@@ -125,7 +234,7 @@ void do_tasklet(void)
 
     do_tasklet_work(cpu, list);
 
-    if ( list_empty(list) )
+    if ( list_empty(list) || tasklet_defer(cpu, false) )
     {
         clear_bit(_TASKLET_enqueued, work_to_do);        
         raise_softirq(SCHEDULE_SOFTIRQ);
@@ -144,7 +253,8 @@ static void tasklet_softirq_action(void)
 
     do_tasklet_work(cpu, list);
 
-    if ( !list_empty(list) && !cpu_is_offline(cpu) )
+    if ( !list_empty(list) && !cpu_is_offline(cpu) &&
+         !tasklet_defer(cpu, true) )
         raise_softirq(TASKLET_SOFTIRQ);
 
     spin_unlock_irq(&tasklet_lock);
@@ -211,19 +321,34 @@ void softirq_tasklet_init(
     t->is_softirq = 1;
 }
 
+static void tasklet_budget_init(unsigned int cpu)
+{
+    if ( opt_tasklet_budget )
+        init_timer(&per_cpu(tasklet_cpu, cpu).resume_timer, tasklet_resume,
+                   (void *)(unsigned long)cpu, cpu);
+}
+
 static int cpu_callback(
     struct notifier_block *nfb, unsigned long action, void *hcpu)
 {
     unsigned int cpu = (unsigned long)hcpu;
+    struct tasklet_cpu *tc = &per_cpu(tasklet_cpu, cpu);
 
     switch ( action )
     {
     case CPU_UP_PREPARE:
         INIT_LIST_HEAD(&per_cpu(tasklet_list, cpu));
         INIT_LIST_HEAD(&per_cpu(softirq_tasklet_list, cpu));
+        memset(tc->stats, 0, sizeof(tc->stats));
+        break;
+    case CPU_ONLINE:
+        tasklet_budget_init(cpu);
         break;
     case CPU_UP_CANCELED:
     case CPU_DEAD:
+        if ( tc->resume_timer.function )
+            kill_timer(&tc->resume_timer);
+        tc->deferred[0] = tc->deferred[1] = false;
         migrate_tasklets_from_cpu(cpu, &per_cpu(tasklet_list, cpu));
         migrate_tasklets_from_cpu(cpu, &per_cpu(softirq_tasklet_list, cpu));
         break;
@@ -239,6 +364,41 @@ static struct notifier_block cpu_nfb = {
     .priority = 99
 };
 
+static void dump_tasklet_stats(unsigned char key)
+{
+    unsigned int cpu, i;
+
+    printk("Tasklet work per CPU and callback (count, total/max us):\n");
+    for_each_online_cpu ( cpu )
+    {
+        const struct tasklet_cpu *tc = &per_cpu(tasklet_cpu, cpu);
+
+        printk("CPU%u:%s\n", cpu,
+               tc->deferred[0] || tc->deferred[1] ? " (deferred)" : "");
+        for ( i = 0; i <= TASKLET_STATS_FUNCS; i++ )
+        {
+            const struct tasklet_stats *st = &tc->stats[i];
+
+            if ( !st->count )
+                continue;
+            if ( st->func )
+                printk("  %ps", st->func);
+            else
+                printk("  others");
+            printk(": %lu, %"PRI_stime"/%"PRI_stime"\n", st->count,
+                   st->time / MICROSECS(1), st->max / MICROSECS(1));
+        }
+    }
+}
+
+static int __init tasklet_late_init(void)
+{
+    tasklet_budget_init(smp_processor_id());
+    register_keyhandler('j', dump_tasklet_stats, "dump tasklet stats", 1);
+    return 0;
+}
+__initcall(tasklet_late_init);
+
 void __init tasklet_subsys_init(void)
 {
     void *hcpu = (void *)(long)smp_processor_id();
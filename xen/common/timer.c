@@ -28,12 +28,33 @@
 static unsigned int timer_slop __read_mostly = 50000; /* 50 us */
 integer_param("timer_slop", timer_slop);
 
+/*
+ * Near-term timers live on a timer wheel of TIMER_WHEEL_SLOTS slots, each
+ * covering 2^TIMER_WHEEL_SHIFT ns (~1ms), i.e. a span of ~268ms. Insertion
+ * and removal are O(1). Timers further out than that go on the heap, which
+ * only has to absorb the comparatively rare long-lived timers.
+ */
+#define TIMER_WHEEL_SHIFT 20
+#define TIMER_WHEEL_SLOTS 256
+#define TIMER_WHEEL_MASK  (TIMER_WHEEL_SLOTS - 1)
+
 struct timers {
     spinlock_t     lock;
     struct timer **heap;
     struct timer  *list;
     struct timer  *running;
     struct list_head inactive;
+
+    /*
+     * Slot (tick & TIMER_WHEEL_MASK) holds timers whose expiry falls within
+     * that tick, for ticks in [wheel_base, wheel_base + TIMER_WHEEL_SLOTS).
+     * The slot for wheel_base may additionally hold timers which expired
+     * before it.
+     */
+    uint64_t       wheel_base;
+    unsigned int   wheel_count;
+    DECLARE_BITMAP(wheel_map, TIMER_WHEEL_SLOTS);
+    struct list_head wheel[TIMER_WHEEL_SLOTS];
 } __cacheline_aligned;
 
 static DEFINE_PER_CPU(struct timers, timers);
@@ -166,6 +187,132 @@ static int add_to_list(struct timer **pprev, struct timer *t)
 }
 
 
+/****************************************************************************
+ * TIMER WHEEL OPERATIONS.
+ */
+
+static inline uint64_t wheel_tick(s_time_t t)
+{
+    return t > 0 ? (uint64_t)t >> TIMER_WHEEL_SHIFT : 0;
+}
+
+/* Tick of the first non-empty slot. The wheel must not be empty. */
+static uint64_t wheel_next_tick(const struct timers *ts)
+{
+    unsigned int base = ts->wheel_base & TIMER_WHEEL_MASK;
+    unsigned int idx = find_next_bit(ts->wheel_map, TIMER_WHEEL_SLOTS, base);
+
+    if ( idx >= TIMER_WHEEL_SLOTS )
+        idx = find_first_bit(ts->wheel_map, TIMER_WHEEL_SLOTS);
+    ASSERT(idx < TIMER_WHEEL_SLOTS);
+
+    return ts->wheel_base + ((idx - base) & TIMER_WHEEL_MASK);
+}
+
+/* Earliest expiry in the slot for @tick, or STIME_MAX if it is empty. */
+static s_time_t wheel_slot_min(const struct timers *ts, uint64_t tick)
+{
+    const struct timer *t;
+    s_time_t min = STIME_MAX;
+
+    list_for_each_entry ( t, &ts->wheel[tick & TIMER_WHEEL_MASK], wheel )
+        if ( t->expires < min )
+            min = t->expires;
+
+    return min;
+}
+
+static void remove_from_wheel(struct timers *ts, struct timer *t)
+{
+    struct list_head *slot = t->wheel.next;
+
+    /* Our successor is the slot head iff we were the last entry. */
+    list_del(&t->wheel);
+    if ( slot >= ts->wheel && slot < ts->wheel + TIMER_WHEEL_SLOTS &&
+         list_empty(slot) )
+        __clear_bit(slot - ts->wheel, ts->wheel_map);
+    ts->wheel_count--;
+}
+
+/*
+ * Add @t to the wheel if it expires within the wheel's span. Returns FALSE if
+ * the timer is too far out and must go elsewhere.
+ */
+static bool add_to_wheel(struct timers *ts, struct timer *t)
+{
+    uint64_t tick = wheel_tick(t->expires);
+    unsigned int idx;
+
+    /* An empty wheel can be rebased, so that its span starts now. */
+    if ( ts->wheel_count == 0 )
+        ts->wheel_base = wheel_tick(NOW());
+
+    if ( (int64_t)(tick - ts->wheel_base) >= TIMER_WHEEL_SLOTS )
+        return false;
+    if ( (int64_t)(tick - ts->wheel_base) < 0 )
+        tick = ts->wheel_base;
+
+    idx = tick & TIMER_WHEEL_MASK;
+    list_add_tail(&t->wheel, &ts->wheel[idx]);
+    __set_bit(idx, ts->wheel_map);
+    ts->wheel_count++;
+
+    return true;
+}
+
+/* First timer in the slot for @tick which expired before @now. */
+static struct timer *wheel_slot_expired(struct timers *ts, uint64_t tick,
+                                        s_time_t now)
+{
+    struct timer *t;
+
+    list_for_each_entry ( t, &ts->wheel[tick & TIMER_WHEEL_MASK], wheel )
+        if ( t->expires < now )
+            return t;
+
+    return NULL;
+}
+
+static void execute_timer(struct timers *ts, struct timer *t);
+
+/*
+ * Run all wheel timers which expired before @now, advancing wheel_base. The
+ * lock is dropped around each callback, so the slot being processed is
+ * rescanned after every execution. wheel_base is moved to the slot before
+ * running it, so timers added meanwhile with an earlier expiry land in that
+ * same slot rather than behind the base.
+ */
+static void wheel_run(struct timers *ts, s_time_t now)
+{
+    uint64_t now_tick = wheel_tick(now), tick;
+    struct timer *t;
+
+    while ( ts->wheel_count != 0 )
+    {
+        tick = wheel_next_tick(ts);
+        if ( tick > now_tick && tick != ts->wheel_base )
+            break;
+
+        ts->wheel_base = tick;
+        while ( (t = wheel_slot_expired(ts, tick, now)) != NULL )
+        {
+            remove_from_wheel(ts, t);
+            execute_timer(ts, t);
+        }
+
+        if ( tick >= now_tick )
+            break;
+
+        /* Everything in a slot strictly in the past has been run. */
+        ASSERT(list_empty(&ts->wheel[tick & TIMER_WHEEL_MASK]));
+        ts->wheel_base = tick + 1;
+    }
+
+    if ( (int64_t)(now_tick - ts->wheel_base) > 0 )
+        ts->wheel_base = now_tick;
+}
+
+
 /****************************************************************************
  * TIMER OPERATIONS.
  */
@@ -175,6 +322,8 @@ static int remove_entry(struct timer *t)
     struct timers *timers = &per_cpu(timers, t->cpu);
     int rc;
 
+    perfc_incr(timer_remove);
+
     switch ( t->status )
     {
     case TIMER_STATUS_in_heap:
@@ -183,6 +332,15 @@ static int remove_entry(struct timer *t)
     case TIMER_STATUS_in_list:
         rc = remove_from_list(&timers->list, t);
         break;
+    case TIMER_STATUS_in_wheel:
+        /*
+         * Finding out whether this was the earliest timer would need a slot
+         * scan. Leaving the hardware programmed costs at most one early
+         * softirq, which reprograms it.
+         */
+        remove_from_wheel(timers, t);
+        rc = 0;
+        break;
     default:
         rc = 0;
         BUG();
@@ -199,14 +357,28 @@ static int add_entry(struct timer *t)
 
     ASSERT(t->status == TIMER_STATUS_invalid);
 
+    /* Near-term timers go on the wheel. */
+    if ( add_to_wheel(timers, t) )
+    {
+        s_time_t deadline = per_cpu(timer_deadline, t->cpu);
+
+        perfc_incr(timer_add_wheel);
+        t->status = TIMER_STATUS_in_wheel;
+        return (deadline == 0) || (t->expires < deadline);
+    }
+
     /* Try to add to heap. t->heap_offset indicates whether we succeed. */
     t->heap_offset = 0;
     t->status = TIMER_STATUS_in_heap;
     rc = add_to_heap(timers->heap, t);
     if ( t->heap_offset != 0 )
+    {
+        perfc_incr(timer_add_heap);
         return rc;
+    }
 
     /* Fall back to adding to the slower linked list. */
+    perfc_incr(timer_add_list);
     t->status = TIMER_STATUS_in_list;
     return add_to_list(&timers->list, t);
 }
@@ -276,7 +448,7 @@ static inline void timer_unlock(struct timer *timer)
 static bool_t active_timer(struct timer *timer)
 {
     ASSERT(timer->status >= TIMER_STATUS_inactive);
-    ASSERT(timer->status <= TIMER_STATUS_in_list);
+    ASSERT(timer->status <= TIMER_STATUS_in_wheel);
     return (timer->status >= TIMER_STATUS_in_heap);
 }
 
@@ -430,6 +602,8 @@ static void execute_timer(struct timers *ts, struct timer *t)
     void (*fn)(void *) = t->function;
     void *data = t->data;
 
+    perfc_incr(timer_execute);
+
     t->status = TIMER_STATUS_inactive;
     list_add(&t->inactive, &ts->inactive);
 
@@ -447,6 +621,8 @@ static void timer_softirq_action(void)
     struct timers *ts;
     s_time_t       now, deadline;
 
+    perfc_incr(timer_softirq);
+
     ts = &this_cpu(timers);
     heap = ts->heap;
 
@@ -482,6 +658,9 @@ static void timer_softirq_action(void)
         execute_timer(ts, t);
     }
 
+    /* Execute ready wheel timers. */
+    wheel_run(ts, now);
+
     /* Execute ready list timers. */
     while ( ((t = ts->list) != NULL) && (t->expires < now) )
     {
@@ -499,12 +678,17 @@ static void timer_softirq_action(void)
         add_entry(t);
     }
 
-    /* Find earliest deadline from head of linked list and top of heap. */
+    /*
+     * Find earliest deadline from head of linked list, top of heap and first
+     * non-empty wheel slot.
+     */
     deadline = STIME_MAX;
     if ( GET_HEAP_SIZE(heap) != 0 )
         deadline = heap[1]->expires;
     if ( (ts->list != NULL) && (ts->list->expires < deadline) )
         deadline = ts->list->expires;
+    if ( ts->wheel_count != 0 )
+        deadline = min(deadline, wheel_slot_min(ts, wheel_next_tick(ts)));
     now = NOW();
     this_cpu(timer_deadline) =
         (deadline == STIME_MAX) ? 0 : MAX(deadline, now + timer_slop);
@@ -535,7 +719,7 @@ static void dump_timerq(unsigned char key)
     struct timers *ts;
     unsigned long  flags;
     s_time_t       now = NOW();
-    int            i, j;
+    int            i, j, k;
 
     printk("Dumping timer queues:\n");
 
@@ -549,6 +733,9 @@ static void dump_timerq(unsigned char key)
             dump_timer(ts->heap[j], now);
         for ( t = ts->list, j = 0; t != NULL; t = t->list_next, j++ )
             dump_timer(t, now);
+        for ( k = 0; k < TIMER_WHEEL_SLOTS; k++ )
+            list_for_each_entry ( t, &ts->wheel[k], wheel )
+                dump_timer(t, now);
         spin_unlock_irqrestore(&ts->lock, flags);
     }
 }
@@ -584,6 +771,16 @@ static void migrate_timers_from_cpu(unsigned int old_cpu)
         notify |= add_entry(t);
     }
 
+    while ( old_ts->wheel_count != 0 )
+    {
+        t = list_first_entry(&old_ts->wheel[wheel_next_tick(old_ts) &
+                                            TIMER_WHEEL_MASK],
+                             struct timer, wheel);
+        remove_entry(t);
+        write_atomic(&t->cpu, new_cpu);
+        notify |= add_entry(t);
+    }
+
     while ( !list_empty(&old_ts->inactive) )
     {
         t = list_entry(old_ts->inactive.next, struct timer, inactive);
@@ -606,6 +803,7 @@ static int cpu_callback(
 {
     unsigned int cpu = (unsigned long)hcpu;
     struct timers *ts = &per_cpu(timers, cpu);
+    unsigned int i;
 
     switch ( action )
     {
@@ -613,6 +811,10 @@ static int cpu_callback(
         INIT_LIST_HEAD(&ts->inactive);
         spin_lock_init(&ts->lock);
         ts->heap = &dummy_heap;
+        for ( i = 0; i < TIMER_WHEEL_SLOTS; i++ )
+            INIT_LIST_HEAD(&ts->wheel[i]);
+        bitmap_zero(ts->wheel_map, TIMER_WHEEL_SLOTS);
+        ts->wheel_count = 0;
         break;
     case CPU_UP_CANCELED:
     case CPU_DEAD:
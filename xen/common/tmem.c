@@ -39,7 +39,7 @@ struct tmem_statistics tmem_stats = {
 
 struct tmem_object_root {
     struct xen_tmem_oid oid;
-    struct rb_node rb_tree_node; /* Protected by pool->pool_rwlock. */
+    struct rb_node rb_tree_node; /* Protected by pool->obj_rb_lock. */
     unsigned long objnode_count; /* Atomicity depends on obj_spinlock. */
     long pgp_count; /* Atomicity depends on obj_spinlock. */
     struct radix_tree_root tree_root; /* Tree of pages within object. */
@@ -69,6 +69,7 @@ struct tmem_page_descriptor {
         struct xen_tmem_oid inv_oid;  /* Used for invalid list only. */
     };
     pagesize_t size; /* 0 == PAGE_SIZE (pfp), -1 == data invalid,
+                    PGP_SIZE_ZERO == all-zero page (no data),
                     else compressed data (cdata). */
     uint32_t index;
     bool eviction_attempted;  /* CHANGE TO lifetimes? (settable). */
@@ -83,6 +84,9 @@ struct tmem_page_descriptor {
     };
 };
 
+/* Compressed data is always smaller than a page, so this is free. */
+#define PGP_SIZE_ZERO ((pagesize_t)PAGE_SIZE)
+
 #define PCD_TZE_MAX_SIZE (PAGE_SIZE - (PAGE_SIZE/64))
 
 struct tmem_page_content_descriptor {
@@ -307,6 +311,16 @@ static void pgp_free_data(struct tmem_page_descriptor *pgp, struct tmem_pool *po
     pgp->size = -1;
 }
 
+/* The data just copied into pgp->pfp was all zeroes; don't keep the page. */
+static void pgp_drop_zero_page(struct tmem_page_descriptor *pgp,
+                               struct tmem_pool *pool)
+{
+    ASSERT(pgp->pfp != NULL && pgp->size == 0);
+    tmem_free_page(pool, pgp->pfp);
+    pgp->pfp = NULL;
+    pgp->size = PGP_SIZE_ZERO;
+}
+
 static void __pgp_free(struct tmem_page_descriptor *pgp, struct tmem_pool *pool)
 {
     pgp->us.obj = NULL;
@@ -506,16 +520,25 @@ static unsigned oid_hash(struct xen_tmem_oid *oidp)
                      BITS_PER_LONG) & OBJ_HASH_BUCKETS_MASK);
 }
 
+/* The lock protecting the hash bucket (and rbtree) that oid lives in. */
+static rwlock_t *obj_bucket_lock(struct tmem_pool *pool,
+                                 struct xen_tmem_oid *oidp)
+{
+    return &pool->obj_rb_lock[oid_hash(oidp)];
+}
+
 /* Searches for object==oid in pool, returns locked object if found. */
 static struct tmem_object_root * obj_find(struct tmem_pool *pool,
                                           struct xen_tmem_oid *oidp)
 {
     struct rb_node *node;
     struct tmem_object_root *obj;
+    unsigned int bucket = oid_hash(oidp);
+    rwlock_t *lock = &pool->obj_rb_lock[bucket];
 
 restart_find:
-    read_lock(&pool->pool_rwlock);
-    node = pool->obj_rb_root[oid_hash(oidp)].rb_node;
+    read_lock(lock);
+    node = pool->obj_rb_root[bucket].rb_node;
     while ( node )
     {
         obj = container_of(node, struct tmem_object_root, rb_tree_node);
@@ -524,10 +547,10 @@ restart_find:
             case 0: /* Equal. */
                 if ( !spin_trylock(&obj->obj_spinlock) )
                 {
-                    read_unlock(&pool->pool_rwlock);
+                    read_unlock(lock);
                     goto restart_find;
                 }
-                read_unlock(&pool->pool_rwlock);
+                read_unlock(lock);
                 return obj;
             case -1:
                 node = node->rb_left;
@@ -536,7 +559,7 @@ restart_find:
                 node = node->rb_right;
         }
     }
-    read_unlock(&pool->pool_rwlock);
+    read_unlock(lock);
     return NULL;
 }
 
@@ -552,13 +575,13 @@ static void obj_free(struct tmem_object_root *obj)
     pool = obj->pool;
     ASSERT(pool != NULL);
     ASSERT(pool->client != NULL);
-    ASSERT_WRITELOCK(&pool->pool_rwlock);
+    ASSERT_WRITELOCK(obj_bucket_lock(pool, &obj->oid));
     if ( obj->tree_root.rnode != NULL ) /* May be a "stump" with no leaves. */
         radix_tree_destroy(&obj->tree_root, pgp_destroy);
     ASSERT((long)obj->objnode_count == 0);
     ASSERT(obj->tree_root.rnode == NULL);
-    pool->obj_count--;
-    ASSERT(pool->obj_count >= 0);
+    atomic_dec(&pool->obj_count);
+    ASSERT(_atomic_read(pool->obj_count) >= 0);
     obj->pool = NULL;
     old_oid = obj->oid;
     oid_set_invalid(&obj->oid);
@@ -575,7 +598,7 @@ static int obj_rb_insert(struct rb_root *root, struct tmem_object_root *obj)
     struct tmem_object_root *this;
 
     ASSERT(obj->pool);
-    ASSERT_WRITELOCK(&obj->pool->pool_rwlock);
+    ASSERT_WRITELOCK(obj_bucket_lock(obj->pool, &obj->oid));
 
     new = &(root->rb_node);
     while ( *new )
@@ -611,9 +634,9 @@ static struct tmem_object_root * obj_alloc(struct tmem_pool *pool,
     ASSERT(pool != NULL);
     if ( (obj = tmem_malloc(sizeof(struct tmem_object_root), pool)) == NULL )
         return NULL;
-    pool->obj_count++;
-    if (pool->obj_count > pool->obj_count_max)
-        pool->obj_count_max = pool->obj_count;
+    atomic_inc(&pool->obj_count);
+    if ( _atomic_read(pool->obj_count) > pool->obj_count_max )
+        pool->obj_count_max = _atomic_read(pool->obj_count);
     atomic_inc_and_max(global_obj_count);
     radix_tree_init(&obj->tree_root);
     radix_tree_set_alloc_callbacks(&obj->tree_root, rtn_alloc, rtn_free, obj);
@@ -629,7 +652,7 @@ static struct tmem_object_root * obj_alloc(struct tmem_pool *pool,
 /* Free an object after destroying any pgps in it. */
 static void obj_destroy(struct tmem_object_root *obj)
 {
-    ASSERT_WRITELOCK(&obj->pool->pool_rwlock);
+    ASSERT_WRITELOCK(obj_bucket_lock(obj->pool, &obj->oid));
     radix_tree_destroy(&obj->tree_root, pgp_destroy);
     obj_free(obj);
 }
@@ -641,10 +664,10 @@ static void pool_destroy_objs(struct tmem_pool *pool, domid_t cli_id)
     struct tmem_object_root *obj;
     int i;
 
-    write_lock(&pool->pool_rwlock);
     pool->is_dying = 1;
     for (i = 0; i < OBJ_HASH_BUCKETS; i++)
     {
+        write_lock(&pool->obj_rb_lock[i]);
         node = rb_first(&pool->obj_rb_root[i]);
         while ( node != NULL )
         {
@@ -656,8 +679,8 @@ static void pool_destroy_objs(struct tmem_pool *pool, domid_t cli_id)
             else
                 spin_unlock(&obj->obj_spinlock);
         }
+        write_unlock(&pool->obj_rb_lock[i]);
     }
-    write_unlock(&pool->pool_rwlock);
 }
 
 
@@ -671,9 +694,11 @@ static struct tmem_pool * pool_alloc(void)
     if ( (pool = xzalloc(struct tmem_pool)) == NULL )
         return NULL;
     for (i = 0; i < OBJ_HASH_BUCKETS; i++)
+    {
         pool->obj_rb_root[i] = RB_ROOT;
+        rwlock_init(&pool->obj_rb_lock[i]);
+    }
     INIT_LIST_HEAD(&pool->persistent_page_list);
-    rwlock_init(&pool->pool_rwlock);
     return pool;
 }
 
@@ -900,10 +925,11 @@ static bool client_over_quota(const struct client *client)
 /************ MEMORY REVOCATION ROUTINES *******************************/
 
 static bool tmem_try_to_evict_pgp(struct tmem_page_descriptor *pgp,
-                                  bool *hold_pool_rwlock)
+                                  rwlock_t **held_lock)
 {
     struct tmem_object_root *obj = pgp->us.obj;
     struct tmem_pool *pool = obj->pool;
+    rwlock_t *lock;
 
     if ( pool->is_dying )
         return false;
@@ -911,9 +937,10 @@ static bool tmem_try_to_evict_pgp(struct tmem_page_descriptor *pgp,
     {
         if ( obj->pgp_count > 1 )
             return true;
-        if ( write_trylock(&pool->pool_rwlock) )
+        lock = obj_bucket_lock(pool, &obj->oid);
+        if ( write_trylock(lock) )
         {
-            *hold_pool_rwlock = 1;
+            *held_lock = lock;
             return true;
         }
         spin_unlock(&obj->obj_spinlock);
@@ -928,7 +955,7 @@ int tmem_evict(void)
     struct tmem_object_root *obj;
     struct tmem_pool *pool;
     int ret = 0;
-    bool hold_pool_rwlock = false;
+    rwlock_t *held_lock = NULL;
 
     tmem_stats.evict_attempts++;
     spin_lock(&eph_lists_spinlock);
@@ -936,13 +963,13 @@ int tmem_evict(void)
          !list_empty(&client->ephemeral_page_list) )
     {
         list_for_each_entry(pgp, &client->ephemeral_page_list, us.client_eph_pages)
-            if ( tmem_try_to_evict_pgp(pgp, &hold_pool_rwlock) )
+            if ( tmem_try_to_evict_pgp(pgp, &held_lock) )
                 goto found;
     }
     else if ( !list_empty(&tmem_global.ephemeral_page_list) )
     {
         list_for_each_entry(pgp, &tmem_global.ephemeral_page_list, global_eph_pages)
-            if ( tmem_try_to_evict_pgp(pgp, &hold_pool_rwlock) )
+            if ( tmem_try_to_evict_pgp(pgp, &held_lock) )
             {
                 client = pgp->us.obj->pool->client;
                 goto found;
@@ -976,13 +1003,13 @@ found:
     pgp_free(pgp);
     if ( obj->pgp_count == 0 )
     {
-        ASSERT_WRITELOCK(&pool->pool_rwlock);
+        ASSERT(held_lock != NULL);
         obj_free(obj);
     }
     else
         spin_unlock(&obj->obj_spinlock);
-    if ( hold_pool_rwlock )
-        write_unlock(&pool->pool_rwlock);
+    if ( held_lock )
+        write_unlock(held_lock);
     tmem_stats.evicted_pgs++;
     ret = 1;
 out:
@@ -1034,7 +1061,12 @@ static int do_tmem_put_compress(struct tmem_page_descriptor *pgp, xen_pfn_t cmfn
     ret = tmem_compress_from_client(cmfn, &dst, &size, clibuf);
     if ( ret <= 0 )
         goto out;
-    else if ( (size == 0) || (size >= tmem_mempool_maxalloc) ) {
+    else if ( size == 0 ) {
+        /* All-zero page: nothing to store. */
+        ASSERT(pgp->pfp == NULL);
+        pgp->size = PGP_SIZE_ZERO;
+        goto out;
+    } else if ( size >= tmem_mempool_maxalloc ) {
         ret = 0;
         goto out;
     } else if ( (p = tmem_malloc(size,pgp->us.obj->pool)) == NULL ) {
@@ -1063,7 +1095,7 @@ static int do_tmem_dup_put(struct tmem_page_descriptor *pgp, xen_pfn_t cmfn,
     int ret;
 
     ASSERT(pgp != NULL);
-    ASSERT(pgp->pfp != NULL);
+    ASSERT(pgp->pfp != NULL || pgp->size == PGP_SIZE_ZERO);
     ASSERT(pgp->size != -1);
     obj = pgp->us.obj;
     ASSERT_SPINLOCK(&obj->obj_spinlock);
@@ -1096,6 +1128,8 @@ copy_uncompressed:
     ret = tmem_copy_from_client(pgp->pfp, cmfn, tmem_cli_buf_null);
     if ( ret < 0 )
         goto bad_copy;
+    if ( ret == 2 )
+        pgp_drop_zero_page(pgp, pool);
 
 done:
     /* Successfully replaced data, clean up and return success. */
@@ -1124,9 +1158,11 @@ cleanup:
     pgp_delist_free(pgpfound);
     if ( obj->pgp_count == 0 )
     {
-        write_lock(&pool->pool_rwlock);
+        rwlock_t *lock = obj_bucket_lock(pool, &obj->oid);
+
+        write_lock(lock);
         obj_free(obj);
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(lock);
     } else {
         spin_unlock(&obj->obj_spinlock);
     }
@@ -1141,9 +1177,11 @@ static int do_tmem_put(struct tmem_pool *pool,
     struct tmem_object_root *obj = NULL;
     struct tmem_page_descriptor *pgp = NULL;
     struct client *client;
+    rwlock_t *lock;
     int ret, newobj = 0;
 
     ASSERT(pool != NULL);
+    lock = obj_bucket_lock(pool, oidp);
     client = pool->client;
     ASSERT(client != NULL);
     ret = client->info.flags.u.frozen  ? -EFROZEN : -ENOMEM;
@@ -1172,7 +1210,7 @@ refind:
         if ( (obj = obj_alloc(pool, oidp)) == NULL )
             return -ENOMEM;
 
-        write_lock(&pool->pool_rwlock);
+        write_lock(lock);
         /*
          * Parallel callers may already allocated obj and inserted to obj_rb_root
          * before us.
@@ -1180,13 +1218,13 @@ refind:
         if ( !obj_rb_insert(&pool->obj_rb_root[oid_hash(oidp)], obj) )
         {
             tmem_free(obj, pool);
-            write_unlock(&pool->pool_rwlock);
+            write_unlock(lock);
             goto refind;
         }
 
         spin_lock(&obj->obj_spinlock);
         newobj = 1;
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(lock);
     }
 
     /* When arrive here, we have a spinlocked obj for use. */
@@ -1231,6 +1269,8 @@ copy_uncompressed:
     ret = tmem_copy_from_client(pgp->pfp, cmfn, clibuf);
     if ( ret < 0 )
         goto bad_copy;
+    if ( ret == 2 )
+        pgp_drop_zero_page(pgp, pool);
 
 insert_page:
     if ( !is_persistent(pool) )
@@ -1278,9 +1318,9 @@ free_pgp:
 unlock_obj:
     if ( newobj )
     {
-        write_lock(&pool->pool_rwlock);
+        write_lock(lock);
         obj_free(obj);
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(lock);
     }
     else
     {
@@ -1318,7 +1358,9 @@ static int do_tmem_get(struct tmem_pool *pool,
         return 0;
     }
     ASSERT(pgp->size != -1);
-    if ( pgp->size != 0 )
+    if ( pgp->size == PGP_SIZE_ZERO )
+        rc = tmem_zero_to_client(cmfn, clibuf);
+    else if ( pgp->size != 0 )
     {
         rc = tmem_decompress_to_client(cmfn, pgp->cdata, pgp->size, clibuf);
     }
@@ -1334,10 +1376,10 @@ static int do_tmem_get(struct tmem_pool *pool,
             pgp_delist_free(pgp);
             if ( obj->pgp_count == 0 )
             {
-                write_lock(&pool->pool_rwlock);
+                write_lock(obj_bucket_lock(pool, oidp));
                 obj_free(obj);
                 obj = NULL;
-                write_unlock(&pool->pool_rwlock);
+                write_unlock(obj_bucket_lock(pool, oidp));
             }
         } else {
             spin_lock(&eph_lists_spinlock);
@@ -1385,9 +1427,9 @@ static int do_tmem_flush_page(struct tmem_pool *pool,
     pgp_delist_free(pgp);
     if ( obj->pgp_count == 0 )
     {
-        write_lock(&pool->pool_rwlock);
+        write_lock(obj_bucket_lock(pool, oidp));
         obj_free(obj);
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(obj_bucket_lock(pool, oidp));
     } else {
         spin_unlock(&obj->obj_spinlock);
     }
@@ -1409,10 +1451,10 @@ static int do_tmem_flush_object(struct tmem_pool *pool,
     obj = obj_find(pool,oidp);
     if ( obj == NULL )
         goto out;
-    write_lock(&pool->pool_rwlock);
+    write_lock(obj_bucket_lock(pool, oidp));
     obj_destroy(obj);
     pool->flush_objs_found++;
-    write_unlock(&pool->pool_rwlock);
+    write_unlock(obj_bucket_lock(pool, oidp));
 
 out:
     if ( pool->client->info.flags.u.frozen )
@@ -1903,9 +1945,6 @@ long do_tmem_op(tmem_cli_op_t uops)
         return -EFAULT;
     }
 
-    /* Acquire write lock for all commands at first. */
-    write_lock(&tmem_rwlock);
-
     switch ( op.cmd )
     {
     case TMEM_CONTROL:
@@ -1914,11 +1953,14 @@ long do_tmem_op(tmem_cli_op_t uops)
         rc = -EOPNOTSUPP;
         break;
 
-    default:
-    /*
-	 * For other commands, create per-client tmem structure dynamically on
-	 * first use by client.
-	 */
+    case TMEM_NEW_POOL:
+    case TMEM_DESTROY_POOL:
+        write_lock(&tmem_rwlock);
+        client = current->domain->tmem_client;
+        /*
+         * Create per-client tmem structure dynamically on first use by
+         * client.
+         */
         if ( client == NULL )
         {
             if ( (client = client_create(current->domain->domain_id)) == NULL )
@@ -1926,70 +1968,66 @@ long do_tmem_op(tmem_cli_op_t uops)
                 tmem_client_err("tmem: can't create tmem structure for %s\n",
                                tmem_client_str);
                 rc = -ENOMEM;
-                goto out;
+                write_unlock(&tmem_rwlock);
+                break;
             }
         }
 
-        if ( op.cmd == TMEM_NEW_POOL || op.cmd == TMEM_DESTROY_POOL )
-        {
-            if ( op.cmd == TMEM_NEW_POOL )
-                rc = do_tmem_new_pool(TMEM_CLI_ID_NULL, 0, op.u.creat.flags,
-                                op.u.creat.uuid[0], op.u.creat.uuid[1]);
-	        else
-                rc = do_tmem_destroy_pool(op.pool_id);
-        }
+        if ( op.cmd == TMEM_NEW_POOL )
+            rc = do_tmem_new_pool(TMEM_CLI_ID_NULL, 0, op.u.creat.flags,
+                            op.u.creat.uuid[0], op.u.creat.uuid[1]);
         else
-        {
-            if ( ((uint32_t)op.pool_id >= MAX_POOLS_PER_DOMAIN) ||
-                 ((pool = client->pools[op.pool_id]) == NULL) )
-            {
-                tmem_client_err("tmem: operation requested on uncreated pool\n");
-                rc = -ENODEV;
-                goto out;
-            }
-            /* Commands that only need read lock. */
-            write_unlock(&tmem_rwlock);
-            read_lock(&tmem_rwlock);
+            rc = do_tmem_destroy_pool(op.pool_id);
+        write_unlock(&tmem_rwlock);
+        break;
 
-            oidp = &op.u.gen.oid;
-            switch ( op.cmd )
-            {
-            case TMEM_NEW_POOL:
-            case TMEM_DESTROY_POOL:
-                BUG(); /* Done earlier. */
-                break;
-            case TMEM_PUT_PAGE:
-                if (tmem_ensure_avail_pages())
-                    rc = do_tmem_put(pool, oidp, op.u.gen.index, op.u.gen.cmfn,
-                                tmem_cli_buf_null);
-                else
-                    rc = -ENOMEM;
-                break;
-            case TMEM_GET_PAGE:
-                rc = do_tmem_get(pool, oidp, op.u.gen.index, op.u.gen.cmfn,
-                                tmem_cli_buf_null);
-                break;
-            case TMEM_FLUSH_PAGE:
-                rc = do_tmem_flush_page(pool, oidp, op.u.gen.index);
-                break;
-            case TMEM_FLUSH_OBJECT:
-                rc = do_tmem_flush_object(pool, oidp);
-                break;
-            default:
-                tmem_client_warn("tmem: op %d not implemented\n", op.cmd);
-                rc = -ENOSYS;
-                break;
-            }
+    default:
+        /*
+         * Page operations only need the global lock for reading: it keeps
+         * the pool alive, and the per-bucket object locks do the rest.  A
+         * client without pools cannot name a valid pool, so there is no
+         * need to create one here.
+         */
+        read_lock(&tmem_rwlock);
+        if ( client == NULL ||
+             ((uint32_t)op.pool_id >= MAX_POOLS_PER_DOMAIN) ||
+             ((pool = client->pools[op.pool_id]) == NULL) )
+        {
             read_unlock(&tmem_rwlock);
-            if ( rc < 0 )
-                tmem_stats.errored_tmem_ops++;
-            return rc;
+            tmem_client_err("tmem: operation requested on uncreated pool\n");
+            rc = -ENODEV;
+            break;
         }
-        break;
 
+        oidp = &op.u.gen.oid;
+        switch ( op.cmd )
+        {
+        case TMEM_PUT_PAGE:
+            if (tmem_ensure_avail_pages())
+                rc = do_tmem_put(pool, oidp, op.u.gen.index, op.u.gen.cmfn,
+                            tmem_cli_buf_null);
+            else
+                rc = -ENOMEM;
+            break;
+        case TMEM_GET_PAGE:
+            rc = do_tmem_get(pool, oidp, op.u.gen.index, op.u.gen.cmfn,
+                            tmem_cli_buf_null);
+            break;
+        case TMEM_FLUSH_PAGE:
+            rc = do_tmem_flush_page(pool, oidp, op.u.gen.index);
+            break;
+        case TMEM_FLUSH_OBJECT:
+            rc = do_tmem_flush_object(pool, oidp);
+            break;
+        default:
+            tmem_client_warn("tmem: op %d not implemented\n", op.cmd);
+            rc = -ENOSYS;
+            break;
+        }
+        read_unlock(&tmem_rwlock);
+        break;
     }
-out:
-    write_unlock(&tmem_rwlock);
+
     if ( rc < 0 )
         tmem_stats.errored_tmem_ops++;
     return rc;
@@ -130,11 +130,11 @@ static int tmemc_list_client(struct client *c, tmem_cli_va_param_t buf,
                       use_long ? ',' : '\n');
         if (use_long)
             n += scnprintf(info+n,BSIZE-n,
-             "Pc:%d,Pm:%d,Oc:%ld,Om:%ld,Nc:%lu,Nm:%lu,"
+             "Pc:%d,Pm:%d,Oc:%d,Om:%d,Nc:%lu,Nm:%lu,"
              "ps:%lu,pt:%lu,pd:%lu,pr:%lu,px:%lu,gs:%lu,gt:%lu,"
              "fs:%lu,ft:%lu,os:%lu,ot:%lu\n",
              _atomic_read(p->pgp_count), p->pgp_count_max,
-             p->obj_count, p->obj_count_max,
+             _atomic_read(p->obj_count), p->obj_count_max,
              p->objnode_count, p->objnode_count_max,
              p->good_puts, p->puts,p->dup_puts_flushed, p->dup_puts_replaced,
              p->no_mem_puts,
@@ -169,11 +169,11 @@ static int tmemc_list_shared(tmem_cli_va_param_t buf, int off, uint32_t len,
         n += scnprintf(info+n,BSIZE-n,"%c", use_long ? ',' : '\n');
         if (use_long)
             n += scnprintf(info+n,BSIZE-n,
-             "Pc:%d,Pm:%d,Oc:%ld,Om:%ld,Nc:%lu,Nm:%lu,"
+             "Pc:%d,Pm:%d,Oc:%d,Om:%d,Nc:%lu,Nm:%lu,"
              "ps:%lu,pt:%lu,pd:%lu,pr:%lu,px:%lu,gs:%lu,gt:%lu,"
              "fs:%lu,ft:%lu,os:%lu,ot:%lu\n",
              _atomic_read(p->pgp_count), p->pgp_count_max,
-             p->obj_count, p->obj_count_max,
+             _atomic_read(p->obj_count), p->obj_count_max,
              p->objnode_count, p->objnode_count_max,
              p->good_puts, p->puts,p->dup_puts_flushed, p->dup_puts_replaced,
              p->no_mem_puts,
@@ -110,6 +110,9 @@ int tmem_copy_from_client(struct page_info *pfp,
     {
         memcpy(tmem_va, cli_va, PAGE_SIZE);
         cli_put_page(cli_va, cli_pfp, cli_mfn, 0);
+        /* Let the caller drop the page; the copy is still cache-hot. */
+        if ( tmem_page_is_zero(tmem_va) )
+            rc = 2;
     }
     else
         rc = -EINVAL;
@@ -141,8 +144,15 @@ int tmem_compress_from_client(xen_pfn_t cmfn,
     else if ( copy_from_guest(scratch, clibuf, PAGE_SIZE) )
         return -EFAULT;
     smp_mb();
-    ret = lzo1x_1_compress(cli_va ?: scratch, PAGE_SIZE, dmem, out_len, wmem);
-    ASSERT(ret == LZO_E_OK);
+    /* A zero page needs no compressor, and no storage: report size 0. */
+    if ( tmem_page_is_zero(cli_va ?: scratch) )
+        *out_len = 0;
+    else
+    {
+        ret = lzo1x_1_compress(cli_va ?: scratch, PAGE_SIZE, dmem, out_len,
+                               wmem);
+        ASSERT(ret == LZO_E_OK);
+    }
     *out_va = dmem;
     if ( cli_va )
         cli_put_page(cli_va, cli_pfp, cli_mfn, 0);
@@ -207,6 +217,33 @@ int tmem_decompress_to_client(xen_pfn_t cmfn, void *tmem_va,
     return 1;
 }
 
+int tmem_zero_to_client(xen_pfn_t cmfn, tmem_cli_va_param_t clibuf)
+{
+    unsigned long cli_mfn = 0;
+    struct page_info *cli_pfp = NULL;
+    void *cli_va = NULL;
+    char *scratch = this_cpu(scratch_page);
+
+    if ( guest_handle_is_null(clibuf) )
+    {
+        cli_va = cli_get_page(cmfn, &cli_mfn, &cli_pfp, 1);
+        if ( cli_va == NULL )
+            return -EFAULT;
+        clear_page(cli_va);
+        cli_put_page(cli_va, cli_pfp, cli_mfn, 1);
+    }
+    else if ( !scratch )
+        return 0;
+    else
+    {
+        clear_page(scratch);
+        if ( copy_to_guest(clibuf, scratch, PAGE_SIZE) )
+            return -EFAULT;
+    }
+    smp_mb();
+    return 1;
+}
+
 /******************  XEN-SPECIFIC HOST INITIALIZATION ********************/
 static int dstmem_order, workmem_order;
 
@@ -52,8 +52,12 @@ integer_param("tevt_mask", opt_tevt_mask);
 static struct t_info *t_info;
 static unsigned int t_info_pages;
 
+/*
+ * Each CPU's buffer has a single writer: __trace_var() on that CPU, with
+ * interrupts disabled while it reserves and fills a record.  No lock is
+ * needed, and the consumer only ever advances cons.
+ */
 static DEFINE_PER_CPU_READ_MOSTLY(struct t_buf *, t_bufs);
-static DEFINE_PER_CPU_READ_MOSTLY(spinlock_t, t_lock);
 static u32 data_size __read_mostly;
 
 /* High water mark for trace buffers; */
@@ -64,6 +68,14 @@ static u32 t_buf_highwater;
 static DEFINE_PER_CPU(unsigned long, lost_records);
 static DEFINE_PER_CPU(unsigned long, lost_records_first_tsc);
 
+/*
+ * Bumped when tracing is disabled.  Each CPU drops its lost-record count
+ * when it next sees a new epoch, so that the count is never written
+ * remotely.
+ */
+static unsigned int lost_records_epoch;
+static DEFINE_PER_CPU(unsigned int, lost_records_seen);
+
 /* a flag recording whether initialization has been done */
 /* or more properly, if the tbuf subsystem is enabled right now */
 int tb_init_done __read_mostly;
@@ -74,25 +86,16 @@ static cpumask_t tb_cpu_mask;
 /* which tracing events are enabled */
 static u32 tb_event_mask = TRC_ALL;
 
+/* finer grained filters: (event, mask) pairs and the running domain */
+static unsigned int tb_nr_evt_filters;
+static u32 tb_evt_filter_event[XEN_SYSCTL_TBUF_NR_EVT_FILTERS];
+static u32 tb_evt_filter_mask[XEN_SYSCTL_TBUF_NR_EVT_FILTERS];
+static domid_t tb_domid = DOMID_INVALID;
+
 /* Return the number of elements _type necessary to store at least _x bytes of data
  * i.e., sizeof(_type) * ans >= _x. */
 #define fit_to_type(_type, _x) (((_x)+sizeof(_type)-1) / sizeof(_type))
 
-static int cpu_callback(
-    struct notifier_block *nfb, unsigned long action, void *hcpu)
-{
-    unsigned int cpu = (unsigned long)hcpu;
-
-    if ( action == CPU_UP_PREPARE )
-        spin_lock_init(&per_cpu(t_lock, cpu));
-
-    return NOTIFY_DONE;
-}
-
-static struct notifier_block cpu_nfb = {
-    .notifier_call = cpu_callback
-};
-
 static uint32_t calc_tinfo_first_offset(void)
 {
     int offset_in_bytes = offsetof(struct t_info, mfn_offset[NR_CPUS]);
@@ -229,8 +232,6 @@ static int alloc_trace_bufs(unsigned int pages)
         struct t_buf *buf;
         struct page_info *pg;
 
-        spin_lock_init(&per_cpu(t_lock, cpu));
-
         offset = t_info->mfn_offset[cpu];
 
         /* Initialize the buffer metadata */
@@ -309,14 +310,14 @@ static int tb_set_size(unsigned int pages)
     return alloc_trace_bufs(pages);
 }
 
-int trace_will_trace_event(u32 event)
+/*
+ * Would @event be recorded on this CPU right now?  All of the filtering
+ * happens here, before __trace_var() touches a buffer.
+ */
+static bool_t tb_event_wanted(u32 event)
 {
-    if ( !tb_init_done )
-        return 0;
+    unsigned int i, nr;
 
-    /*
-     * Copied from __trace_var()
-     */
     if ( (tb_event_mask & event) == 0 )
         return 0;
 
@@ -332,7 +333,28 @@ int trace_will_trace_event(u32 event)
     if ( !cpumask_test_cpu(smp_processor_id(), &tb_cpu_mask) )
         return 0;
 
-    return 1;
+    if ( tb_domid != DOMID_INVALID && current->domain->domain_id != tb_domid )
+        return 0;
+
+    nr = read_atomic(&tb_nr_evt_filters);
+    if ( !nr )
+        return 1;
+
+    smp_rmb(); /* read tb_nr_evt_filters /before/ the filters */
+
+    for ( i = 0; i < nr; i++ )
+        if ( (event & tb_evt_filter_mask[i]) == tb_evt_filter_event[i] )
+            return 1;
+
+    return 0;
+}
+
+int trace_will_trace_event(u32 event)
+{
+    if ( !tb_init_done )
+        return 0;
+
+    return tb_event_wanted(event);
 }
 
 /**
@@ -345,7 +367,6 @@ int trace_will_trace_event(u32 event)
 void __init init_trace_bufs(void)
 {
     cpumask_setall(&tb_cpu_mask);
-    register_cpu_notifier(&cpu_nfb);
 
     if ( opt_tbuf_size )
     {
@@ -398,6 +419,34 @@ int tb_control(struct xen_sysctl_tbuf_op *tbc)
     case XEN_SYSCTL_TBUFOP_set_evt_mask:
         tb_event_mask = tbc->evt_mask;
         break;
+    case XEN_SYSCTL_TBUFOP_set_evt_filter:
+    {
+        unsigned int i;
+
+        if ( tbc->nr_evt_filters > XEN_SYSCTL_TBUF_NR_EVT_FILTERS )
+        {
+            rc = -EINVAL;
+            break;
+        }
+
+        /*
+         * Drop the filters while rewriting them.  Concurrent tracers may
+         * briefly see none, but never a half-written pair.
+         */
+        write_atomic(&tb_nr_evt_filters, 0);
+        smp_wmb();
+        for ( i = 0; i < tbc->nr_evt_filters; i++ )
+        {
+            tb_evt_filter_event[i] = tbc->filter_event[i] & tbc->filter_mask[i];
+            tb_evt_filter_mask[i] = tbc->filter_mask[i];
+        }
+        smp_wmb();
+        write_atomic(&tb_nr_evt_filters, tbc->nr_evt_filters);
+        break;
+    }
+    case XEN_SYSCTL_TBUFOP_set_dom_filter:
+        write_atomic(&tb_domid, tbc->domid);
+        break;
     case XEN_SYSCTL_TBUFOP_set_size:
         rc = tb_set_size(tbc->size);
         break;
@@ -409,26 +458,15 @@ int tb_control(struct xen_sysctl_tbuf_op *tbc)
             tb_init_done = 1;
         break;
     case XEN_SYSCTL_TBUFOP_disable:
-    {
         /*
          * Disable trace buffers. Just stops new records from being written,
          * does not deallocate any memory.
          */
-        int i;
-
         tb_init_done = 0;
         smp_wmb();
-        /* Clear any lost-record info so we don't get phantom lost records next time we
-         * start tracing.  Grab the lock to make sure we're not racing anyone.  After this
-         * hypercall returns, no more records should be placed into the buffers. */
-        for_each_online_cpu(i)
-        {
-            unsigned long flags;
-            spin_lock_irqsave(&per_cpu(t_lock, i), flags);
-            per_cpu(lost_records, i)=0;
-            spin_unlock_irqrestore(&per_cpu(t_lock, i), flags);
-        }
-    }
+        /* Clear any lost-record info so we don't get phantom lost records
+         * next time we start tracing.  Each CPU clears its own count. */
+        write_atomic(&lost_records_epoch, lost_records_epoch + 1);
         break;
     default:
         rc = -EINVAL;
@@ -694,6 +732,9 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
     if( !tb_init_done )
         return;
 
+    if ( !tb_event_wanted(event) )
+        return;
+
     /* Convert byte count into word count, rounding up */
     extra_word = (extra / sizeof(u32));
     if ( (extra % sizeof(u32)) != 0 )
@@ -705,25 +746,11 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
     /* Round size up to nearest word */
     extra = extra_word * sizeof(u32);
 
-    if ( (tb_event_mask & event) == 0 )
-        return;
-
-    /* match class */
-    if ( ((tb_event_mask >> TRC_CLS_SHIFT) & (event >> TRC_CLS_SHIFT)) == 0 )
-        return;
-
-    /* then match subclass */
-    if ( (((tb_event_mask >> TRC_SUBCLS_SHIFT) & 0xf )
-                & ((event >> TRC_SUBCLS_SHIFT) & 0xf )) == 0 )
-        return;
-
-    if ( !cpumask_test_cpu(smp_processor_id(), &tb_cpu_mask) )
-        return;
-
     /* Read tb_init_done /before/ t_bufs. */
     smp_rmb();
 
-    spin_lock_irqsave(&this_cpu(t_lock), flags);
+    /* This CPU is the only writer; with interrupts off it owns the ring. */
+    local_irq_save(flags);
 
     buf = this_cpu(t_bufs);
 
@@ -734,6 +761,13 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
         goto unlock;
     }
 
+    if ( unlikely(this_cpu(lost_records_seen) !=
+                  read_atomic(&lost_records_epoch)) )
+    {
+        this_cpu(lost_records_seen) = read_atomic(&lost_records_epoch);
+        this_cpu(lost_records) = 0;
+    }
+
     started_below_highwater = (calc_unconsumed_bytes(buf) < t_buf_highwater);
 
     /* Calculate the record size */
@@ -810,7 +844,7 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
     __insert_record(buf, event, extra, cycles, rec_size, extra_data);
 
 unlock:
-    spin_unlock_irqrestore(&this_cpu(t_lock), flags);
+    local_irq_restore(flags);
 
     /* Notify trace buffer consumer that we've crossed the high water mark. */
     if ( likely(buf!=NULL)
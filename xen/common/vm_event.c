@@ -22,6 +22,7 @@
 
 #include <xen/sched.h>
 #include <xen/event.h>
+#include <xen/guest_access.h>
 #include <xen/wait.h>
 #include <xen/vm_event.h>
 #include <xen/mem_access.h>
@@ -35,9 +36,9 @@
 #define xen_rmb()  smp_rmb()
 #define xen_wmb()  smp_wmb()
 
-#define vm_event_ring_lock_init(_ved)  spin_lock_init(&(_ved)->ring_lock)
-#define vm_event_ring_lock(_ved)       spin_lock(&(_ved)->ring_lock)
-#define vm_event_ring_unlock(_ved)     spin_unlock(&(_ved)->ring_lock)
+#define vm_event_ring_lock_init(_ring) spin_lock_init(&(_ring)->ring_lock)
+#define vm_event_ring_lock(_ring)      spin_lock(&(_ring)->ring_lock)
+#define vm_event_ring_unlock(_ring)    spin_unlock(&(_ring)->ring_lock)
 
 static int vm_event_enable(
     struct domain *d,
@@ -49,76 +50,132 @@ static int vm_event_enable(
 {
     int rc;
     unsigned long ring_gfn = d->arch.hvm_domain.params[param];
-
-    if ( !*ved )
-        *ved = xzalloc(struct vm_event_domain);
-    if ( !*ved )
-        return -ENOMEM;
+    unsigned int i, nr_rings = vec->nr_rings ?: 1;
+    struct vm_event_domain *new;
 
     /* Only one helper at a time. If the helper crashed,
      * the ring is in an undefined state and so is the guest.
      */
-    if ( (*ved)->ring_page )
-        return -EBUSY;;
+    if ( *ved )
+        return -EBUSY;
+
+    if ( nr_rings > d->max_vcpus )
+        return -EINVAL;
 
     /* The parameter defaults to zero, and it should be
      * set to something */
-    if ( ring_gfn == 0 )
+    if ( nr_rings == 1 && ring_gfn == 0 )
         return -ENOSYS;
 
-    vm_event_ring_lock_init(*ved);
-    vm_event_ring_lock(*ved);
+    new = xzalloc(struct vm_event_domain);
+    if ( !new )
+        return -ENOMEM;
+
+    new->rings = xzalloc_array(struct vm_event_ring, nr_rings);
+    if ( !new->rings )
+    {
+        xfree(new);
+        return -ENOMEM;
+    }
+    new->nr_rings = nr_rings;
+    new->ring_vcpus = DIV_ROUND_UP(d->max_vcpus, nr_rings);
+
+    /* Save the pause flag for this particular ring. */
+    new->pause_flag = pause_flag;
 
     rc = vm_event_init_domain(d);
 
     if ( rc < 0 )
         goto err;
 
-    rc = prepare_ring_for_helper(d, ring_gfn, &(*ved)->ring_pg_struct,
-                                 &(*ved)->ring_page);
-    if ( rc < 0 )
-        goto err;
+    for ( i = 0; i < nr_rings; i++ )
+    {
+        struct vm_event_ring *ring = &new->rings[i];
+        uint32_t port;
 
-    /* Set the number of currently blocked vCPUs to 0. */
-    (*ved)->blocked = 0;
+        if ( nr_rings > 1 )
+        {
+            xen_pfn_t gfn;
 
-    /* Allocate event channel */
-    rc = alloc_unbound_xen_event_channel(d, 0, current->domain->domain_id,
-                                         notification_fn);
-    if ( rc < 0 )
-        goto err;
+            rc = -EFAULT;
+            if ( copy_from_guest_offset(&gfn, vec->ring_gfns, i, 1) )
+                goto err;
+            ring_gfn = gfn;
+        }
 
-    (*ved)->xen_port = vec->port = rc;
+        vm_event_ring_lock_init(ring);
 
-    /* Prepare ring buffer */
-    FRONT_RING_INIT(&(*ved)->front_ring,
-                    (vm_event_sring_t *)(*ved)->ring_page,
-                    PAGE_SIZE);
+        rc = prepare_ring_for_helper(d, ring_gfn, &ring->ring_pg_struct,
+                                     &ring->ring_page);
+        if ( rc < 0 )
+            goto err;
 
-    /* Save the pause flag for this particular ring. */
-    (*ved)->pause_flag = pause_flag;
+        /* Allocate event channel */
+        rc = alloc_unbound_xen_event_channel(d, 0, current->domain->domain_id,
+                                             notification_fn);
+        if ( rc < 0 )
+            goto err;
+
+        ring->xen_port = port = rc;
+
+        rc = -EFAULT;
+        if ( nr_rings > 1 && copy_to_guest_offset(vec->ports, i, &port, 1) )
+            goto err;
+
+        /* Prepare ring buffer */
+        FRONT_RING_INIT(&ring->front_ring,
+                        (vm_event_sring_t *)ring->ring_page,
+                        PAGE_SIZE);
+
+        /* Initialize the last-chance wait queue. */
+        init_waitqueue_head(&ring->wq);
+    }
+
+    vec->port = new->rings[0].xen_port;
 
-    /* Initialize the last-chance wait queue. */
-    init_waitqueue_head(&(*ved)->wq);
+    /* The rings must be set up before vCPUs can find them. */
+    smp_wmb();
+    *ved = new;
 
-    vm_event_ring_unlock(*ved);
     return 0;
 
  err:
-    destroy_ring_for_helper(&(*ved)->ring_page,
-                            (*ved)->ring_pg_struct);
-    vm_event_ring_unlock(*ved);
-    xfree(*ved);
-    *ved = NULL;
+    for ( i = 0; i < nr_rings; i++ )
+    {
+        struct vm_event_ring *ring = &new->rings[i];
+
+        if ( ring->xen_port )
+            free_xen_event_channel(d, ring->xen_port);
+        destroy_ring_for_helper(&ring->ring_page, ring->ring_pg_struct);
+    }
+    xfree(new->rings);
+    xfree(new);
 
     return rc;
 }
 
-static unsigned int vm_event_ring_available(struct vm_event_domain *ved)
+/*
+ * The ring a request is put on and its slot claimed from: that of the
+ * current vCPU if it belongs to @d, ring 0 otherwise.  Claiming a slot and
+ * using it always happen in the same context, so both end up on the same
+ * ring.
+ */
+static struct vm_event_ring *vm_event_ring_of(struct domain *d,
+                                              struct vm_event_domain *ved)
 {
-    int avail_req = RING_FREE_REQUESTS(&ved->front_ring);
-    avail_req -= ved->target_producers;
-    avail_req -= ved->foreign_producers;
+    const struct vcpu *curr = current;
+
+    if ( curr->domain != d )
+        return &ved->rings[0];
+
+    return &ved->rings[curr->vcpu_id % ved->nr_rings];
+}
+
+static unsigned int vm_event_ring_available(struct vm_event_ring *ring)
+{
+    int avail_req = RING_FREE_REQUESTS(&ring->front_ring);
+    avail_req -= ring->target_producers;
+    avail_req -= ring->foreign_producers;
 
     BUG_ON(avail_req < 0);
 
@@ -131,12 +188,14 @@ static unsigned int vm_event_ring_available(struct vm_event_domain *ved)
  * but need to be resumed where the ring is capable of processing at least
  * one event from them.
  */
-static void vm_event_wake_blocked(struct domain *d, struct vm_event_domain *ved)
+static void vm_event_wake_blocked(struct domain *d, struct vm_event_domain *ved,
+                                  struct vm_event_ring *ring)
 {
     struct vcpu *v;
-    unsigned int avail_req = vm_event_ring_available(ved);
+    unsigned int avail_req = vm_event_ring_available(ring);
+    unsigned int idx = ring - ved->rings;
 
-    if ( avail_req == 0 || ved->blocked == 0 )
+    if ( avail_req == 0 || ring->blocked == 0 )
         return;
 
     /* We remember which vcpu last woke up to avoid scanning always linearly
@@ -145,22 +204,26 @@ static void vm_event_wake_blocked(struct domain *d, struct vm_event_domain *ved)
     {
         int i, j, k;
 
-        for (i = ved->last_vcpu_wake_up + 1, j = 0; j < d->max_vcpus; i++, j++)
+        for (i = ring->last_vcpu_wake_up + 1, j = 0; j < d->max_vcpus; i++, j++)
         {
             k = i % d->max_vcpus;
             v = d->vcpu[k];
             if ( !v )
                 continue;
 
-            if ( !(ved->blocked) || avail_req == 0 )
+            /* Only this ring's vCPUs can be blocked on it. */
+            if ( k % ved->nr_rings != idx )
+                continue;
+
+            if ( !(ring->blocked) || avail_req == 0 )
                break;
 
             if ( test_and_clear_bit(ved->pause_flag, &v->pause_flags) )
             {
                 vcpu_unpause(v);
                 avail_req--;
-                ved->blocked--;
-                ved->last_vcpu_wake_up = k;
+                ring->blocked--;
+                ring->last_vcpu_wake_up = k;
             }
         }
     }
@@ -171,12 +234,12 @@ static void vm_event_wake_blocked(struct domain *d, struct vm_event_domain *ved)
  * was unable to do so, it is queued on a wait queue.  These are woken as
  * needed, and take precedence over the blocked vCPUs.
  */
-static void vm_event_wake_queued(struct domain *d, struct vm_event_domain *ved)
+static void vm_event_wake_queued(struct vm_event_ring *ring)
 {
-    unsigned int avail_req = vm_event_ring_available(ved);
+    unsigned int avail_req = vm_event_ring_available(ring);
 
     if ( avail_req > 0 )
-        wake_up_nr(&ved->wq, avail_req);
+        wake_up_nr(&ring->wq, avail_req);
 }
 
 /*
@@ -186,12 +249,13 @@ static void vm_event_wake_queued(struct domain *d, struct vm_event_domain *ved)
  * call vm_event_wake() again, ensuring that any blocked vCPUs will get
  * unpaused once all the queued vCPUs have made it through.
  */
-void vm_event_wake(struct domain *d, struct vm_event_domain *ved)
+static void vm_event_wake(struct domain *d, struct vm_event_domain *ved,
+                          struct vm_event_ring *ring)
 {
-    if (!list_empty(&ved->wq.list))
-        vm_event_wake_queued(d, ved);
+    if (!list_empty(&ring->wq.list))
+        vm_event_wake_queued(ring);
     else
-        vm_event_wake_blocked(d, ved);
+        vm_event_wake_blocked(d, ved, ring);
 }
 
 static int vm_event_disable(struct domain *d, struct vm_event_domain **ved)
@@ -199,34 +263,50 @@ static int vm_event_disable(struct domain *d, struct vm_event_domain **ved)
     if ( vm_event_check_ring(*ved) )
     {
         struct vcpu *v;
+        unsigned int i;
 
-        vm_event_ring_lock(*ved);
-
-        if ( !list_empty(&(*ved)->wq.list) )
+        /*
+         * The domain is paused or dying, so no vCPU can start waiting for
+         * room once all the wait queues were found empty.
+         */
+        for ( i = 0; i < (*ved)->nr_rings; i++ )
         {
-            vm_event_ring_unlock(*ved);
-            return -EBUSY;
+            struct vm_event_ring *ring = &(*ved)->rings[i];
+            bool busy;
+
+            vm_event_ring_lock(ring);
+            busy = !list_empty(&ring->wq.list);
+            vm_event_ring_unlock(ring);
+
+            if ( busy )
+                return -EBUSY;
         }
 
-        /* Free domU's event channel and leave the other one unbound */
-        free_xen_event_channel(d, (*ved)->xen_port);
+        for ( i = 0; i < (*ved)->nr_rings; i++ )
+        {
+            struct vm_event_ring *ring = &(*ved)->rings[i];
+
+            vm_event_ring_lock(ring);
+
+            /* Free domU's event channel and leave the other one unbound */
+            free_xen_event_channel(d, ring->xen_port);
+
+            destroy_ring_for_helper(&ring->ring_page,
+                                    ring->ring_pg_struct);
+
+            vm_event_ring_unlock(ring);
+        }
 
         /* Unblock all vCPUs */
         for_each_vcpu ( d, v )
         {
             if ( test_and_clear_bit((*ved)->pause_flag, &v->pause_flags) )
-            {
                 vcpu_unpause(v);
-                (*ved)->blocked--;
-            }
         }
 
-        destroy_ring_for_helper(&(*ved)->ring_page,
-                                (*ved)->ring_pg_struct);
-
         vm_event_cleanup_domain(d);
 
-        vm_event_ring_unlock(*ved);
+        xfree((*ved)->rings);
     }
 
     xfree(*ved);
@@ -236,28 +316,30 @@ static int vm_event_disable(struct domain *d, struct vm_event_domain **ved)
 }
 
 static inline void vm_event_release_slot(struct domain *d,
-                                         struct vm_event_domain *ved)
+                                         struct vm_event_domain *ved,
+                                         struct vm_event_ring *ring)
 {
     /* Update the accounting */
     if ( current->domain == d )
-        ved->target_producers--;
+        ring->target_producers--;
     else
-        ved->foreign_producers--;
+        ring->foreign_producers--;
 
     /* Kick any waiters */
-    vm_event_wake(d, ved);
+    vm_event_wake(d, ved, ring);
 }
 
 /*
  * vm_event_mark_and_pause() tags vcpu and put it to sleep.
  * The vcpu will resume execution in vm_event_wake_blocked().
  */
-void vm_event_mark_and_pause(struct vcpu *v, struct vm_event_domain *ved)
+static void vm_event_mark_and_pause(struct vcpu *v, struct vm_event_domain *ved,
+                                    struct vm_event_ring *ring)
 {
     if ( !test_and_set_bit(ved->pause_flag, &v->pause_flags) )
     {
         vcpu_pause_nosync(v);
-        ved->blocked++;
+        ring->blocked++;
     }
 }
 
@@ -271,6 +353,7 @@ void vm_event_put_request(struct domain *d,
                           struct vm_event_domain *ved,
                           vm_event_request_t *req)
 {
+    struct vm_event_ring *ring;
     vm_event_front_ring_t *front_ring;
     int free_req;
     unsigned int avail_req;
@@ -292,10 +375,11 @@ void vm_event_put_request(struct domain *d,
 
     req->version = VM_EVENT_INTERFACE_VERSION;
 
-    vm_event_ring_lock(ved);
+    ring = vm_event_ring_of(d, ved);
+    vm_event_ring_lock(ring);
 
     /* Due to the reservations, this step must succeed. */
-    front_ring = &ved->front_ring;
+    front_ring = &ring->front_ring;
     free_req = RING_FREE_REQUESTS(front_ring);
     ASSERT(free_req > 0);
 
@@ -309,35 +393,36 @@ void vm_event_put_request(struct domain *d,
     RING_PUSH_REQUESTS(front_ring);
 
     /* We've actually *used* our reservation, so release the slot. */
-    vm_event_release_slot(d, ved);
+    vm_event_release_slot(d, ved, ring);
 
     /* Give this vCPU a black eye if necessary, on the way out.
      * See the comments above wake_blocked() for more information
      * on how this mechanism works to avoid waiting. */
-    avail_req = vm_event_ring_available(ved);
-    if( curr->domain == d && avail_req < d->max_vcpus &&
+    avail_req = vm_event_ring_available(ring);
+    if( curr->domain == d && avail_req < ved->ring_vcpus &&
         !atomic_read(&curr->vm_event_pause_count) )
-        vm_event_mark_and_pause(curr, ved);
+        vm_event_mark_and_pause(curr, ved, ring);
 
-    vm_event_ring_unlock(ved);
+    vm_event_ring_unlock(ring);
 
-    notify_via_xen_event_channel(d, ved->xen_port);
+    notify_via_xen_event_channel(d, ring->xen_port);
 }
 
-int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
-                          vm_event_response_t *rsp)
+static int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
+                                 struct vm_event_ring *ring,
+                                 vm_event_response_t *rsp)
 {
     vm_event_front_ring_t *front_ring;
     RING_IDX rsp_cons;
 
-    vm_event_ring_lock(ved);
+    vm_event_ring_lock(ring);
 
-    front_ring = &ved->front_ring;
+    front_ring = &ring->front_ring;
     rsp_cons = front_ring->rsp_cons;
 
     if ( !RING_HAS_UNCONSUMED_RESPONSES(front_ring) )
     {
-        vm_event_ring_unlock(ved);
+        vm_event_ring_unlock(ring);
         return 0;
     }
 
@@ -351,9 +436,9 @@ int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
 
     /* Kick any waiters -- since we've just consumed an event,
      * there may be additional space available in the ring. */
-    vm_event_wake(d, ved);
+    vm_event_wake(d, ved, ring);
 
-    vm_event_ring_unlock(ved);
+    vm_event_ring_unlock(ring);
 
     return 1;
 }
@@ -366,7 +451,8 @@ int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
  * Note: responses are handled the same way regardless of which ring they
  * arrive on.
  */
-void vm_event_resume(struct domain *d, struct vm_event_domain *ved)
+static void vm_event_resume_ring(struct domain *d, struct vm_event_domain *ved,
+                                 struct vm_event_ring *ring)
 {
     vm_event_response_t rsp;
 
@@ -381,7 +467,7 @@ void vm_event_resume(struct domain *d, struct vm_event_domain *ved)
     ASSERT(d != current->domain);
 
     /* Pull all responses off the ring. */
-    while ( vm_event_get_response(d, ved, &rsp) )
+    while ( vm_event_get_response(d, ved, ring, &rsp) )
     {
         struct vcpu *v;
 
@@ -445,60 +531,85 @@ void vm_event_resume(struct domain *d, struct vm_event_domain *ved)
     }
 }
 
+void vm_event_resume(struct domain *d, struct vm_event_domain *ved)
+{
+    unsigned int i;
+
+    for ( i = 0; i < ved->nr_rings; i++ )
+        vm_event_resume_ring(d, ved, &ved->rings[i]);
+}
+
+/* Pull the responses from the ring notifications on @port are for. */
+static void vm_event_resume_port(struct domain *d, struct vm_event_domain *ved,
+                                 unsigned int port)
+{
+    unsigned int i;
+
+    for ( i = 0; i < ved->nr_rings; i++ )
+        if ( ved->rings[i].xen_port == port )
+        {
+            vm_event_resume_ring(d, ved, &ved->rings[i]);
+            break;
+        }
+}
+
 void vm_event_cancel_slot(struct domain *d, struct vm_event_domain *ved)
 {
+    struct vm_event_ring *ring;
+
     if( !vm_event_check_ring(ved) )
         return;
 
-    vm_event_ring_lock(ved);
-    vm_event_release_slot(d, ved);
-    vm_event_ring_unlock(ved);
+    ring = vm_event_ring_of(d, ved);
+    vm_event_ring_lock(ring);
+    vm_event_release_slot(d, ved, ring);
+    vm_event_ring_unlock(ring);
 }
 
-static int vm_event_grab_slot(struct vm_event_domain *ved, int foreign)
+static int vm_event_grab_slot(struct vm_event_ring *ring, int foreign)
 {
     unsigned int avail_req;
 
-    if ( !ved->ring_page )
+    if ( !ring->ring_page )
         return -ENOSYS;
 
-    vm_event_ring_lock(ved);
+    vm_event_ring_lock(ring);
 
-    avail_req = vm_event_ring_available(ved);
+    avail_req = vm_event_ring_available(ring);
     if ( avail_req == 0 )
     {
-        vm_event_ring_unlock(ved);
+        vm_event_ring_unlock(ring);
         return -EBUSY;
     }
 
     if ( !foreign )
-        ved->target_producers++;
+        ring->target_producers++;
     else
-        ved->foreign_producers++;
+        ring->foreign_producers++;
 
-    vm_event_ring_unlock(ved);
+    vm_event_ring_unlock(ring);
 
     return 0;
 }
 
 /* Simple try_grab wrapper for use in the wait_event() macro. */
-static int vm_event_wait_try_grab(struct vm_event_domain *ved, int *rc)
+static int vm_event_wait_try_grab(struct vm_event_ring *ring, int *rc)
 {
-    *rc = vm_event_grab_slot(ved, 0);
+    *rc = vm_event_grab_slot(ring, 0);
     return *rc;
 }
 
 /* Call vm_event_grab_slot() until the ring doesn't exist, or is available. */
-static int vm_event_wait_slot(struct vm_event_domain *ved)
+static int vm_event_wait_slot(struct vm_event_ring *ring)
 {
     int rc = -EBUSY;
-    wait_event(ved->wq, vm_event_wait_try_grab(ved, &rc) != -EBUSY);
+    wait_event(ring->wq, vm_event_wait_try_grab(ring, &rc) != -EBUSY);
     return rc;
 }
 
 bool_t vm_event_check_ring(struct vm_event_domain *ved)
 {
-    return (ved && ved->ring_page);
+    return (ved && ved->nr_rings);
 }
 
 /*
@@ -516,13 +627,17 @@ bool_t vm_event_check_ring(struct vm_event_domain *ved)
 int __vm_event_claim_slot(struct domain *d, struct vm_event_domain *ved,
                           bool_t allow_sleep)
 {
+    struct vm_event_ring *ring;
+
     if ( !vm_event_check_ring(ved) )
         return -EOPNOTSUPP;
 
+    ring = vm_event_ring_of(d, ved);
+
     if ( (current->domain == d) && allow_sleep )
-        return vm_event_wait_slot(ved);
+        return vm_event_wait_slot(ring);
     else
-        return vm_event_grab_slot(ved, (current->domain != d));
+        return vm_event_grab_slot(ring, (current->domain != d));
 }
 
 #ifdef CONFIG_HAS_MEM_PAGING
@@ -532,7 +647,7 @@ static void mem_paging_notification(struct vcpu *v, unsigned int port)
     struct domain *domain = v->domain;
 
     if ( likely(vm_event_check_ring(domain->vm_event_paging)) )
-        vm_event_resume(domain, domain->vm_event_paging);
+        vm_event_resume_port(domain, domain->vm_event_paging, port);
 }
 #endif
 
@@ -542,7 +657,7 @@ static void monitor_notification(struct vcpu *v, unsigned int port)
     struct domain *domain = v->domain;
 
     if ( likely(vm_event_check_ring(domain->vm_event_monitor)) )
-        vm_event_resume(domain, domain->vm_event_monitor);
+        vm_event_resume_port(domain, domain->vm_event_monitor, port);
 }
 
 #ifdef CONFIG_HAS_MEM_SHARING
@@ -552,10 +667,18 @@ static void mem_sharing_notification(struct vcpu *v, unsigned int port)
     struct domain *domain = v->domain;
 
     if ( likely(vm_event_check_ring(domain->vm_event_share)) )
-        vm_event_resume(domain, domain->vm_event_share);
+        vm_event_resume_port(domain, domain->vm_event_share, port);
 }
 #endif
 
+static void vm_event_destroy_waitqueues(struct vm_event_domain *ved)
+{
+    unsigned int i;
+
+    for ( i = 0; i < ved->nr_rings; i++ )
+        destroy_waitqueue_head(&ved->rings[i].wq);
+}
+
 /* Clean up on domain destruction */
 void vm_event_cleanup(struct domain *d)
 {
@@ -569,19 +692,19 @@ void vm_event_cleanup(struct domain *d)
          * Finally, because this code path involves previously
          * pausing the domain (domain_kill), unpausing the
          * vcpus causes no harm. */
-        destroy_waitqueue_head(&d->vm_event_paging->wq);
+        vm_event_destroy_waitqueues(d->vm_event_paging);
         (void)vm_event_disable(d, &d->vm_event_paging);
     }
 #endif
     if ( vm_event_check_ring(d->vm_event_monitor) )
     {
-        destroy_waitqueue_head(&d->vm_event_monitor->wq);
+        vm_event_destroy_waitqueues(d->vm_event_monitor);
         (void)vm_event_disable(d, &d->vm_event_monitor);
     }
 #ifdef CONFIG_HAS_MEM_SHARING
     if ( vm_event_check_ring(d->vm_event_share) )
     {
-        destroy_waitqueue_head(&d->vm_event_share->wq);
+        vm_event_destroy_waitqueues(d->vm_event_share);
         (void)vm_event_disable(d, &d->vm_event_share);
     }
 #endif
@@ -664,6 +787,7 @@ int vm_event_domctl(struct domain *d, struct xen_domctl_vm_event_op *vec,
             {
                 domain_pause(d);
                 rc = vm_event_disable(d, &d->vm_event_paging);
+                p2m_mem_paging_disable(d);
                 domain_unpause(d);
             }
             break;
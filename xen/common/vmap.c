@@ -18,6 +18,8 @@ static unsigned int __read_mostly vm_top[VMAP_REGION_NR];
 static unsigned int __read_mostly vm_end[VMAP_REGION_NR];
 /* lowest known clear bit in the bitmap */
 static unsigned int vm_low[VMAP_REGION_NR];
+/* end of the latest allocation, where the next search starts */
+static unsigned int vm_next[VMAP_REGION_NR];
 
 void __init vm_init_type(enum vmap_region type, void *start, void *end)
 {
@@ -45,6 +47,42 @@ void __init vm_init_type(enum vmap_region type, void *start, void *end)
     populate_pt_range(va, 0, vm_low[type] - nr);
 }
 
+/*
+ * Look for @nr clear bits, suitably aligned and preceded by a clear (guard)
+ * bit, from the clear bit @start on.  Returns vm_top[t] if there are none.
+ */
+static unsigned int vm_search(enum vmap_region t, unsigned int start,
+                              unsigned int nr, unsigned int align)
+{
+    unsigned int bit;
+
+    while ( start < vm_top[t] )
+    {
+        bit = find_next_bit(vm_bitmap(t), vm_top[t], start + 1);
+        if ( bit > vm_top[t] )
+            bit = vm_top[t];
+        /*
+         * Note that this skips the first bit, making the
+         * corresponding page a guard one.
+         */
+        start = (start + align) & ~(align - 1);
+        if ( bit < vm_top[t] )
+        {
+            if ( start + nr < bit )
+                break;
+            start = find_next_zero_bit(vm_bitmap(t), vm_top[t], bit + 1);
+        }
+        else
+        {
+            if ( start + nr <= bit )
+                break;
+            start = bit;
+        }
+    }
+
+    return min(start, vm_top[t]);
+}
+
 static void *vm_alloc(unsigned int nr, unsigned int align,
                       enum vmap_region t)
 {
@@ -65,29 +103,19 @@ static void *vm_alloc(unsigned int nr, unsigned int align,
         struct page_info *pg;
 
         ASSERT(vm_low[t] == vm_top[t] || !test_bit(vm_low[t], vm_bitmap(t)));
-        for ( start = vm_low[t]; start < vm_top[t]; )
-        {
-            bit = find_next_bit(vm_bitmap(t), vm_top[t], start + 1);
-            if ( bit > vm_top[t] )
-                bit = vm_top[t];
-            /*
-             * Note that this skips the first bit, making the
-             * corresponding page a guard one.
-             */
-            start = (start + align) & ~(align - 1);
-            if ( bit < vm_top[t] )
-            {
-                if ( start + nr < bit )
-                    break;
-                start = find_next_zero_bit(vm_bitmap(t), vm_top[t], bit + 1);
-            }
-            else
-            {
-                if ( start + nr <= bit )
-                    break;
-                start = bit;
-            }
-        }
+
+        /*
+         * Search next-fit from the end of the latest allocation, so as to
+         * not rescan the (mostly full) bottom of the bitmap each time, and
+         * fall back to a search from the bottom to fill holes.
+         */
+        start = vm_top[t];
+        if ( vm_next[t] > vm_low[t] && vm_next[t] < vm_top[t] )
+            start = vm_search(t, find_next_zero_bit(vm_bitmap(t), vm_top[t],
+                                                    vm_next[t]),
+                              nr, align);
+        if ( start >= vm_top[t] )
+            start = vm_search(t, vm_low[t], nr, align);
 
         if ( start < vm_top[t] )
             break;
@@ -134,6 +162,7 @@ static void *vm_alloc(unsigned int nr, unsigned int align,
         ASSERT(bit == vm_top[t]);
     if ( start <= vm_low[t] + 2 )
         vm_low[t] = bit;
+    vm_next[t] = bit;
     spin_unlock(&vm_lock);
 
     return vm_base[t] + start * PAGE_SIZE;
@@ -23,8 +23,11 @@
  * Adapted for Xen by Dan Magenheimer (dan.magenheimer@oracle.com)
  */
 
+#include <xen/cpu.h>
+#include <xen/init.h>
 #include <xen/irq.h>
 #include <xen/mm.h>
+#include <xen/percpu.h>
 #include <xen/pfn.h>
 #include <asm/time.h>
 
@@ -559,6 +562,181 @@ static void tlsf_init(void)
     BUG_ON(!xenpool);
 }
 
+/*
+ * Per-CPU caches of small blocks in front of xenpool, so that short-lived
+ * allocations don't contend on the pool lock.  Cached blocks stay allocated
+ * as far as the pool is concerned and are chained through their first word.
+ * A block is cached by the CPU freeing it, whichever CPU allocated it: the
+ * blocks aren't tied to a CPU, so no remote free queues are needed.
+ */
+#define XMC_MIN_SHIFT   5       /* Smallest class: 32 bytes. */
+#define XMC_NR_CLASSES  5       /* Largest class: 512 bytes. */
+#define XMC_HIGH        32      /* Blocks kept per class and CPU. */
+
+struct xmalloc_cache {
+    void *head[XMC_NR_CLASSES];
+    unsigned int count[XMC_NR_CLASSES];
+    /* Statistics. */
+    unsigned long hits[XMC_NR_CLASSES], misses[XMC_NR_CLASSES];
+    unsigned long frees[XMC_NR_CLASSES];
+};
+
+static DEFINE_PER_CPU(struct xmalloc_cache, xmalloc_cache);
+static bool __read_mostly xmc_initialised;
+
+/* Class an allocation of @size bytes is served from, or -1. */
+static int xmc_alloc_class(unsigned long size)
+{
+    if ( size > (1UL << (XMC_MIN_SHIFT + XMC_NR_CLASSES - 1)) )
+        return -1;
+
+    return size <= (1UL << XMC_MIN_SHIFT) ? 0 : fls(size - 1) - XMC_MIN_SHIFT;
+}
+
+/* Class a block of @size bytes can be cached for, or -1. */
+static int xmc_free_class(unsigned long size)
+{
+    if ( size < (1UL << XMC_MIN_SHIFT) ||
+         size >= (1UL << (XMC_MIN_SHIFT + XMC_NR_CLASSES)) )
+        return -1;
+
+    return fls(size) - 1 - XMC_MIN_SHIFT;
+}
+
+/*
+ * Take a block for @size bytes from this CPU's cache.  On a miss, round
+ * @size up to the size of its class so the block can be cached when freed.
+ */
+static void *xmc_get(unsigned long *size)
+{
+    struct xmalloc_cache *xmc;
+    int idx = xmc_alloc_class(*size);
+    void *p;
+
+    if ( idx < 0 || !xmc_initialised )
+        return NULL;
+
+    xmc = &this_cpu(xmalloc_cache);
+    p = xmc->head[idx];
+    if ( !p )
+    {
+        xmc->misses[idx]++;
+        *size = 1UL << (idx + XMC_MIN_SHIFT);
+        return NULL;
+    }
+
+    xmc->head[idx] = *(void **)p;
+    xmc->count[idx]--;
+    xmc->hits[idx]++;
+
+    return p;
+}
+
+static bool xmc_put(void *p, unsigned long size)
+{
+    struct xmalloc_cache *xmc;
+    int idx = xmc_free_class(size);
+
+    if ( idx < 0 || !xmc_initialised )
+        return false;
+
+    xmc = &this_cpu(xmalloc_cache);
+    if ( xmc->count[idx] >= XMC_HIGH )
+        return false;
+
+    *(void **)p = xmc->head[idx];
+    xmc->head[idx] = p;
+    xmc->count[idx]++;
+    xmc->frees[idx]++;
+
+    return true;
+}
+
+static void xmc_drain_cpu(unsigned int cpu)
+{
+    struct xmalloc_cache *xmc = &per_cpu(xmalloc_cache, cpu);
+    unsigned int idx;
+    void *p;
+
+    for ( idx = 0; idx < XMC_NR_CLASSES; idx++ )
+    {
+        while ( (p = xmc->head[idx]) != NULL )
+        {
+            xmc->head[idx] = *(void **)p;
+            xmem_pool_free(p, xenpool);
+        }
+        xmc->count[idx] = 0;
+    }
+}
+
+void xmalloc_cache_info(void)
+{
+    unsigned int cpu, idx;
+
+    if ( !xmc_initialised )
+        return;
+
+    printk("    xmalloc per-CPU caches:\n");
+    for ( idx = 0; idx < XMC_NR_CLASSES; idx++ )
+    {
+        unsigned long count = 0, hits = 0, misses = 0, frees = 0;
+
+        for_each_online_cpu ( cpu )
+        {
+            const struct xmalloc_cache *xmc = &per_cpu(xmalloc_cache, cpu);
+
+            count += xmc->count[idx];
+            hits += xmc->hits[idx];
+            misses += xmc->misses[idx];
+            frees += xmc->frees[idx];
+        }
+
+        printk("      %4lu bytes: %lu cached, %lu/%lu allocation hits, "
+               "%lu frees\n", 1UL << (idx + XMC_MIN_SHIFT),
+               count, hits, hits + misses, frees);
+    }
+}
+
+static int cpu_xmc_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        memset(&per_cpu(xmalloc_cache, cpu), 0, sizeof(struct xmalloc_cache));
+        break;
+    case CPU_UP_CANCELED:
+    case CPU_DEAD:
+        xmc_drain_cpu(cpu);
+        break;
+    default:
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_xmc_nfb = {
+    .notifier_call = cpu_xmc_callback
+};
+
+static int __init xmalloc_cache_init(void)
+{
+    void *hcpu = (void *)(long)smp_processor_id();
+
+    if ( !xenpool )
+        tlsf_init();
+
+    cpu_xmc_callback(&cpu_xmc_nfb, CPU_UP_PREPARE, hcpu);
+    register_cpu_notifier(&cpu_xmc_nfb);
+    xmc_initialised = true;
+
+    return 0;
+}
+presmp_initcall(xmalloc_cache_init);
+
 /*
  * xmalloc()
  */
@@ -586,6 +764,10 @@ void *_xmalloc(unsigned long size, unsigned long align)
     if ( !xenpool )
         tlsf_init();
 
+    /* Cached blocks need no alignment padding beyond MEM_ALIGN. */
+    if ( align == MEM_ALIGN && (p = xmc_get(&size)) != NULL )
+        return p;
+
     if ( size < PAGE_SIZE )
         p = xmem_pool_alloc(size, xenpool);
     if ( p == NULL )
@@ -648,5 +830,8 @@ void xfree(void *p)
         ASSERT(!(b->size & 1));
     }
 
+    if ( xmc_put(p, b->size & BLOCK_SIZE_MASK) )
+        return;
+
     xmem_pool_free(p, xenpool);
 }
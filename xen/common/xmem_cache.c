@@ -0,0 +1,337 @@
+/******************************************************************************
+ * xmem_cache.c
+ *
+ * Caches of fixed-size objects, carved out of xenheap pages.
+ *
+ * Each page ("slab") starts with a header and holds as many objects as fit
+ * behind it.  Objects are constructed once, when their slab is set up, and
+ * are expected to be handed back in constructed state.  Every CPU keeps a
+ * short list of free objects per cache, refilled from and flushed to the
+ * slabs in batches under the cache lock.  A slab whose objects are all free
+ * is given back to the heap, unless it is the only one with free objects.
+ */
+
+#include <xen/cpu.h>
+#include <xen/init.h>
+#include <xen/irq.h>
+#include <xen/lib.h>
+#include <xen/list.h>
+#include <xen/mm.h>
+#include <xen/numa.h>
+#include <xen/spinlock.h>
+#include <xen/xmalloc.h>
+
+#define XMEM_CACHE_BATCH 16     /* Objects moved at once to/from a CPU. */
+#define XMEM_CACHE_HIGH  32     /* Objects a CPU keeps per cache. */
+
+struct xmem_cache_cpu {
+    void *head;
+    unsigned int count;
+} __cacheline_aligned;
+
+struct xmem_cache {
+    struct list_head list;
+    const char *name;
+    unsigned int size;          /* Object size requested. */
+    unsigned int link;          /* Offset of the free list link. */
+    unsigned int slot;          /* Object size including the link. */
+    unsigned int nr_per_slab;
+    unsigned int offset;        /* Of the first object in a slab. */
+    void (*ctor)(void *);
+
+    spinlock_t lock;
+    struct list_head partial;   /* Slabs with free objects. */
+    struct list_head full;      /* Slabs without. */
+    unsigned long nr_slabs, nr_inuse;
+
+    struct xmem_cache_cpu *cpu;
+};
+
+struct xmem_slab {
+    struct list_head list;
+    void *free;
+    unsigned int inuse;
+};
+
+static LIST_HEAD(cache_list);
+static DEFINE_SPINLOCK(cache_list_lock);
+
+/*
+ * The link is kept behind the object rather than in it, so that a free
+ * object stays in constructed state.
+ */
+static void **obj_link(const struct xmem_cache *cache, void *obj)
+{
+    return obj + cache->link;
+}
+
+static struct xmem_slab *obj_slab(void *obj)
+{
+    return (void *)((unsigned long)obj & PAGE_MASK);
+}
+
+struct xmem_cache *xmem_cache_create(const char *name, unsigned int size,
+                                     unsigned int align, void (*ctor)(void *))
+{
+    struct xmem_cache *cache;
+
+    if ( align < sizeof(void *) )
+        align = sizeof(void *);
+    ASSERT(!(align & (align - 1)));
+
+    cache = xzalloc(struct xmem_cache);
+    if ( !cache )
+        return NULL;
+
+    cache->name = name;
+    cache->size = size;
+    cache->link = ROUNDUP(size, sizeof(void *));
+    cache->slot = ROUNDUP(cache->link + sizeof(void *), align);
+    cache->offset = ROUNDUP(sizeof(struct xmem_slab), align);
+    cache->ctor = ctor;
+
+    /* Larger objects are better off with xmalloc() or whole pages. */
+    if ( cache->offset + 4 * cache->slot > PAGE_SIZE )
+    {
+        xfree(cache);
+        return NULL;
+    }
+    cache->nr_per_slab = (PAGE_SIZE - cache->offset) / cache->slot;
+
+    cache->cpu = xzalloc_array(struct xmem_cache_cpu, nr_cpu_ids);
+    if ( !cache->cpu )
+    {
+        xfree(cache);
+        return NULL;
+    }
+
+    spin_lock_init(&cache->lock);
+    INIT_LIST_HEAD(&cache->partial);
+    INIT_LIST_HEAD(&cache->full);
+
+    spin_lock(&cache_list_lock);
+    list_add(&cache->list, &cache_list);
+    spin_unlock(&cache_list_lock);
+
+    return cache;
+}
+
+/* Set up a new slab and put it on the partial list.  Cache lock held. */
+static bool slab_grow(struct xmem_cache *cache)
+{
+    struct xmem_slab *slab;
+    unsigned int i;
+    void *obj;
+
+    slab = alloc_xenheap_pages(0, MEMF_node(cpu_to_node(smp_processor_id())));
+    if ( !slab )
+        return false;
+
+    slab->free = NULL;
+    slab->inuse = 0;
+    obj = (void *)slab + cache->offset + (cache->nr_per_slab - 1) * cache->slot;
+    for ( i = 0; i < cache->nr_per_slab; i++, obj -= cache->slot )
+    {
+        if ( cache->ctor )
+            cache->ctor(obj);
+        *obj_link(cache, obj) = slab->free;
+        slab->free = obj;
+    }
+
+    list_add(&slab->list, &cache->partial);
+    cache->nr_slabs++;
+
+    return true;
+}
+
+/* Return an object to its slab.  Cache lock held. */
+static void slab_put(struct xmem_cache *cache, void *obj)
+{
+    struct xmem_slab *slab = obj_slab(obj);
+
+    ASSERT(slab->inuse);
+
+    if ( !slab->free )
+        list_move(&slab->list, &cache->partial);
+    *obj_link(cache, obj) = slab->free;
+    slab->free = obj;
+    slab->inuse--;
+    cache->nr_inuse--;
+
+    if ( !slab->inuse &&
+         (cache->partial.next != &slab->list ||
+          cache->partial.prev != &slab->list) )
+    {
+        list_del(&slab->list);
+        cache->nr_slabs--;
+        free_xenheap_page(slab);
+    }
+}
+
+/* Move a batch of objects from the slabs to @pc.  Cache lock held. */
+static void cpu_refill(struct xmem_cache *cache, struct xmem_cache_cpu *pc)
+{
+    while ( pc->count < XMEM_CACHE_BATCH )
+    {
+        struct xmem_slab *slab;
+        void *obj;
+
+        if ( list_empty(&cache->partial) && !slab_grow(cache) )
+            break;
+
+        slab = list_first_entry(&cache->partial, struct xmem_slab, list);
+        obj = slab->free;
+        slab->free = *obj_link(cache, obj);
+        if ( !slab->free )
+            list_move(&slab->list, &cache->full);
+        slab->inuse++;
+        cache->nr_inuse++;
+
+        *obj_link(cache, obj) = pc->head;
+        pc->head = obj;
+        pc->count++;
+    }
+}
+
+/* Return up to @nr objects from @pc to their slabs.  Cache lock held. */
+static void cpu_flush(struct xmem_cache *cache, struct xmem_cache_cpu *pc,
+                      unsigned int nr)
+{
+    while ( nr-- && pc->head )
+    {
+        void *obj = pc->head;
+
+        pc->head = *obj_link(cache, obj);
+        pc->count--;
+        slab_put(cache, obj);
+    }
+}
+
+void *xmem_cache_alloc(struct xmem_cache *cache)
+{
+    struct xmem_cache_cpu *pc;
+    void *obj;
+
+    ASSERT(!in_irq());
+
+    pc = &cache->cpu[smp_processor_id()];
+    if ( !pc->head )
+    {
+        spin_lock(&cache->lock);
+        cpu_refill(cache, pc);
+        spin_unlock(&cache->lock);
+
+        if ( !pc->head )
+            return NULL;
+    }
+
+    obj = pc->head;
+    pc->head = *obj_link(cache, obj);
+    pc->count--;
+
+    return obj;
+}
+
+void xmem_cache_free(struct xmem_cache *cache, void *obj)
+{
+    struct xmem_cache_cpu *pc;
+
+    if ( !obj )
+        return;
+
+    ASSERT(!in_irq());
+
+    pc = &cache->cpu[smp_processor_id()];
+    if ( pc->count >= XMEM_CACHE_HIGH )
+    {
+        spin_lock(&cache->lock);
+        cpu_flush(cache, pc, XMEM_CACHE_BATCH);
+        spin_unlock(&cache->lock);
+    }
+
+    *obj_link(cache, obj) = pc->head;
+    pc->head = obj;
+    pc->count++;
+}
+
+void xmem_cache_destroy(struct xmem_cache *cache)
+{
+    struct xmem_slab *slab, *tmp;
+    unsigned int cpu;
+
+    if ( !cache )
+        return;
+
+    spin_lock(&cache_list_lock);
+    list_del(&cache->list);
+    spin_unlock(&cache_list_lock);
+
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        cpu_flush(cache, &cache->cpu[cpu], UINT_MAX);
+
+    /* All objects must have been freed, so there are no full slabs left. */
+    WARN_ON(cache->nr_inuse || !list_empty(&cache->full));
+    list_for_each_entry_safe ( slab, tmp, &cache->partial, list )
+        free_xenheap_page(slab);
+
+    xfree(cache->cpu);
+    xfree(cache);
+}
+
+void xmem_cache_info(void)
+{
+    const struct xmem_cache *cache;
+
+    spin_lock(&cache_list_lock);
+    list_for_each_entry ( cache, &cache_list, list )
+        printk("    %s cache: %u byte objects, %lu allocated, %lu slabs\n",
+               cache->name, cache->size, cache->nr_inuse, cache->nr_slabs);
+    spin_unlock(&cache_list_lock);
+}
+
+static int cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+    struct xmem_cache *cache;
+
+    switch ( action )
+    {
+    case CPU_UP_CANCELED:
+    case CPU_DEAD:
+        spin_lock(&cache_list_lock);
+        list_for_each_entry ( cache, &cache_list, list )
+        {
+            spin_lock(&cache->lock);
+            cpu_flush(cache, &cache->cpu[cpu], UINT_MAX);
+            spin_unlock(&cache->lock);
+        }
+        spin_unlock(&cache_list_lock);
+        break;
+    default:
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_nfb = {
+    .notifier_call = cpu_callback
+};
+
+static int __init xmem_cache_init(void)
+{
+    register_cpu_notifier(&cpu_nfb);
+    return 0;
+}
+presmp_initcall(xmem_cache_init);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -473,6 +473,18 @@ int do_pm_op(struct xen_sysctl_pm_op *op)
         break;
     }
 
+    case XEN_SYSCTL_pm_op_get_max_latency:
+    {
+        op->u.get_max_latency = acpi_get_cstate_latency_limit(op->cpuid);
+        break;
+    }
+
+    case XEN_SYSCTL_pm_op_set_max_latency:
+    {
+        acpi_set_cstate_latency_limit(op->cpuid, op->u.set_max_latency);
+        break;
+    }
+
     case XEN_SYSCTL_pm_op_enable_turbo:
     {
         ret = cpufreq_update_turbo(op->cpuid, CPUFREQ_TURBO_ENABLED);
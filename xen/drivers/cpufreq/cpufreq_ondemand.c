@@ -34,6 +34,9 @@
 #define MAX_SAMPLING_RATE                       (500 * def_sampling_rate)
 #define DEF_SAMPLING_RATE_LATENCY_MULTIPLIER    (1000)
 #define TRANSITION_LATENCY_LIMIT                (10 * 1000 )
+/* Fraction of the sampling rate to take the first sample after idle. */
+#define WAKEUP_SAMPLING_RATE_RATIO              (4)
+#define MIN_WAKEUP_SAMPLING_RATE                (MILLISECS(1))
 
 static uint64_t def_sampling_rate;
 static uint64_t usr_sampling_rate;
@@ -377,11 +380,27 @@ void cpufreq_dbs_timer_resume(void)
 
     if ( per_cpu(cpu_dbs_info,cpu).stoppable )
     {
+        struct cpu_dbs_info_s *dbs_info = &per_cpu(cpu_dbs_info, cpu);
+
         now = NOW();
         t = &per_cpu(dbs_timer, cpu);
         if (t->expires <= now)
         {
-            t->function(t->data);
+            s_time_t delay = dbs_tuners_ins.sampling_rate /
+                             WAKEUP_SAMPLING_RATE_RATIO;
+
+            /*
+             * The timer was stopped for at least a whole period, so the
+             * load over it is mostly idle time and evaluating it now would
+             * lower the frequency just as work arrives.  Start a new, short
+             * window instead, so that a busy CPU gets ramped up well within
+             * a sampling period of waking up.
+             */
+            dbs_info->prev_cpu_wall = now;
+            dbs_info->prev_cpu_idle = get_cpu_idle_time(cpu);
+            if (delay < MIN_WAKEUP_SAMPLING_RATE)
+                delay = MIN_WAKEUP_SAMPLING_RATE;
+            set_timer(t, now + delay);
         }
         else
         {
@@ -18,10 +18,24 @@
  */
 
 #include <xen/sched.h>
+#include <xen/perfc.h>
 #include <asm/amd-iommu.h>
 #include <asm/hvm/svm/amd-iommu-proto.h>
 #include "../ats.h"
 
+/*
+ * Page flushes requested while an IOTLB batch is open on this CPU are
+ * collected into a single span of gfns of one domain, which is sent as one
+ * size-encoded INVALIDATE_IOMMU_PAGES command once a non-adjacent flush
+ * arrives or the batch ends.
+ */
+struct amd_iommu_batch {
+    struct domain *d;
+    unsigned long gfn;
+    unsigned long count;
+};
+static DEFINE_PER_CPU(struct amd_iommu_batch, amd_iommu_batch);
+
 static int queue_iommu_command(struct amd_iommu *iommu, u32 cmd[])
 {
     u32 tail, head, *cmd_buffer;
@@ -73,6 +87,10 @@ static void flush_command_buffer(struct amd_iommu *iommu)
     u32 cmd[4], status;
     int loop_count, comp_wait;
 
+    /* The wait below also covers everything posted so far. */
+    iommu->cmd_pending = 0;
+    perfc_incr(amd_iommu_comp_wait);
+
     /* RW1C 'ComWaitInt' in status register */
     writel(IOMMU_STATUS_COMP_WAIT_INT_MASK,
            iommu->mmio_base + IOMMU_STATUS_MMIO_OFFSET);
@@ -107,6 +125,27 @@ static void flush_command_buffer(struct amd_iommu *iommu)
     AMD_IOMMU_DEBUG("Warning: ComWaitInt bit did not assert!\n");
 }
 
+/*
+ * Account for a command sent without waiting for its completion. Waiting
+ * once the buffer is half full keeps the posted commands from overrunning
+ * it, as queue_iommu_command() drops commands when there is no room.
+ */
+static void post_command(struct amd_iommu *iommu)
+{
+    perfc_incr(amd_iommu_inv_posted);
+    if ( ++iommu->cmd_pending >= iommu->cmd_buffer.entries / 2 )
+        flush_command_buffer(iommu);
+}
+
+/* Wait for all commands posted to this IOMMU to complete. */
+void amd_iommu_sync(struct amd_iommu *iommu)
+{
+    ASSERT( spin_is_locked(&iommu->lock) );
+
+    if ( iommu->cmd_pending )
+        flush_command_buffer(iommu);
+}
+
 /* Build low level iommu command messages */
 static void invalidate_iommu_pages(struct amd_iommu *iommu,
                                    u64 io_addr, u16 domain_id, u16 order)
@@ -115,7 +154,7 @@ static void invalidate_iommu_pages(struct amd_iommu *iommu,
     u32 cmd[4], entry;
     int sflag = 0, pde = 0;
 
-    ASSERT ( order == 0 || order == 9 || order == 18 );
+    ASSERT ( order <= INV_IOMMU_MAX_ORDER );
 
     /* All pages associated with the domainID are invalidated */
     if ( order || (io_addr == INV_IOMMU_ALL_PAGES_ADDRESS ) )
@@ -172,7 +211,7 @@ static void invalidate_iotlb_pages(struct amd_iommu *iommu,
     u32 cmd[4], entry;
     int sflag = 0;
 
-    ASSERT ( order == 0 || order == 9 || order == 18 );
+    ASSERT ( order <= INV_IOMMU_MAX_ORDER );
 
     if ( order || (io_addr == INV_IOMMU_ALL_PAGES_ADDRESS ) )
         sflag = 1;
@@ -341,8 +380,8 @@ static void amd_iommu_flush_all_iotlbs(struct domain *d, uint64_t gaddr,
 }
 
 /* Flush iommu cache after p2m changes. */
-static void _amd_iommu_flush_pages(struct domain *d,
-                                   uint64_t gaddr, unsigned int order)
+static void _amd_iommu_flush_pages(struct domain *d, uint64_t gaddr,
+                                   unsigned int order, bool_t wait)
 {
     unsigned long flags;
     struct amd_iommu *iommu;
@@ -353,23 +392,93 @@ static void _amd_iommu_flush_pages(struct domain *d,
     {
         spin_lock_irqsave(&iommu->lock, flags);
         invalidate_iommu_pages(iommu, gaddr, dom_id, order);
-        flush_command_buffer(iommu);
+        if ( wait )
+            flush_command_buffer(iommu);
+        else
+            post_command(iommu);
         spin_unlock_irqrestore(&iommu->lock, flags);
     }
 
+    /* Device IOTLB invalidations wait for the above and for themselves. */
     if ( ats_enabled )
         amd_iommu_flush_all_iotlbs(d, gaddr, order);
 }
 
+/* Order of the smallest naturally aligned block covering the span. */
+static unsigned int span_order(unsigned long gfn, unsigned long count)
+{
+    return flsl(gfn ^ (gfn + count - 1));
+}
+
+static void batch_emit(struct amd_iommu_batch *b)
+{
+    unsigned int order = span_order(b->gfn, b->count);
+
+    _amd_iommu_flush_pages(b->d, (uint64_t)(b->gfn & ~((1UL << order) - 1))
+                                 << PAGE_SHIFT, order, 0);
+    b->d = NULL;
+}
+
+static void batch_add(struct domain *d, unsigned long gfn,
+                      unsigned long count)
+{
+    struct amd_iommu_batch *b = &this_cpu(amd_iommu_batch);
+
+    if ( b->d == d && gfn >= b->gfn && gfn <= b->gfn + b->count )
+    {
+        unsigned long end = max(b->gfn + b->count, gfn + count);
+
+        if ( span_order(b->gfn, end - b->gfn) <= INV_IOMMU_MAX_ORDER )
+        {
+            perfc_incr(amd_iommu_inv_merged);
+            b->count = end - b->gfn;
+            return;
+        }
+    }
+
+    if ( b->d )
+        batch_emit(b);
+
+    b->d = d;
+    b->gfn = gfn;
+    b->count = count;
+}
+
+/*
+ * iotlb_batch_end hook: send the pending span and wait once per IOMMU for
+ * everything posted during the batch.
+ */
+int amd_iommu_batch_sync(void)
+{
+    struct amd_iommu_batch *b = &this_cpu(amd_iommu_batch);
+    struct amd_iommu *iommu;
+    unsigned long flags;
+
+    if ( b->d )
+        batch_emit(b);
+
+    for_each_amd_iommu ( iommu )
+    {
+        spin_lock_irqsave(&iommu->lock, flags);
+        amd_iommu_sync(iommu);
+        spin_unlock_irqrestore(&iommu->lock, flags);
+    }
+
+    return 0;
+}
+
 void amd_iommu_flush_all_pages(struct domain *d)
 {
-    _amd_iommu_flush_pages(d, INV_IOMMU_ALL_PAGES_ADDRESS, 0);
+    _amd_iommu_flush_pages(d, INV_IOMMU_ALL_PAGES_ADDRESS, 0, 1);
 }
 
 void amd_iommu_flush_pages(struct domain *d,
                            unsigned long gfn, unsigned int order)
 {
-    _amd_iommu_flush_pages(d, (uint64_t) gfn << PAGE_SHIFT, order);
+    if ( this_cpu(iommu_iotlb_batch) )
+        batch_add(d, gfn, 1UL << order);
+    else
+        _amd_iommu_flush_pages(d, (uint64_t) gfn << PAGE_SHIFT, order, 1);
 }
 
 void amd_iommu_flush_device(struct amd_iommu *iommu, uint16_t bdf)
@@ -380,6 +489,20 @@ void amd_iommu_flush_device(struct amd_iommu *iommu, uint16_t bdf)
     flush_command_buffer(iommu);
 }
 
+/*
+ * Invalidate the device table and interrupt remapping table entries of a
+ * device without waiting; amd_iommu_sync() completes them.
+ */
+void amd_iommu_queue_flush_device(struct amd_iommu *iommu, uint16_t bdf)
+{
+    ASSERT( spin_is_locked(&iommu->lock) );
+
+    invalidate_dev_table_entry(iommu, bdf);
+    post_command(iommu);
+    invalidate_interrupt_table(iommu, bdf);
+    post_command(iommu);
+}
+
 void amd_iommu_flush_intremap(struct amd_iommu *iommu, uint16_t bdf)
 {
     ASSERT( spin_is_locked(&iommu->lock) );
@@ -1347,12 +1347,21 @@ static int _invalidate_all_devices(
         if ( iommu )
         {
             spin_lock_irqsave(&iommu->lock, flags);
-            amd_iommu_flush_device(iommu, req_id);
-            amd_iommu_flush_intremap(iommu, req_id);
+            amd_iommu_queue_flush_device(iommu, req_id);
             spin_unlock_irqrestore(&iommu->lock, flags);
         }
     }
 
+    /* One completion wait per IOMMU covers all of the above. */
+    for_each_amd_iommu ( iommu )
+    {
+        if ( iommu->seg != seg )
+            continue;
+        spin_lock_irqsave(&iommu->lock, flags);
+        amd_iommu_sync(iommu);
+        spin_unlock_irqrestore(&iommu->lock, flags);
+    }
+
     return 0;
 }
 
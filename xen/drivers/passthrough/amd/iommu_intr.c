@@ -428,10 +428,12 @@ static int update_intremap_entry_from_msi_msg(
 {
     unsigned long flags;
     u32* entry;
+    u32 old_entry;
     u16 req_id, alias_id;
     u8 delivery_mode, dest, vector, dest_mode;
     spinlock_t *lock;
     unsigned int offset, i;
+    bool fresh = false, unchanged;
 
     req_id = get_dma_requestor_id(iommu->seg, bdf);
     alias_id = get_intremap_requestor_id(iommu->seg, bdf);
@@ -464,14 +466,24 @@ static int update_intremap_entry_from_msi_msg(
             return -ENOSPC;
         }
         *remap_index = offset;
+        fresh = true;
     }
 
     entry = get_intremap_entry(iommu->seg, req_id, offset);
+    old_entry = *entry;
     update_intremap_entry(entry, vector, delivery_mode, dest_mode, dest);
+    unchanged = !fresh && *entry == old_entry;
     spin_unlock_irqrestore(lock, flags);
 
     *data = (msg->data & ~(INTREMAP_ENTRIES - 1)) | offset;
 
+    /* An unchanged entry (e.g. a no-op affinity change) needs no flush. */
+    if ( unchanged )
+    {
+        perfc_incr(irte_update_skipped);
+        return 0;
+    }
+
     /*
      * In some special cases, a pci-e device(e.g SATA controller in IDE mode)
      * will use alias id to index interrupt remapping table.
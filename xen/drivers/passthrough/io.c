@@ -25,6 +25,13 @@
 #include <asm/hvm/support.h>
 #include <asm/io_apic.h>
 
+/*
+ * pirq_tree tag of the pIRQs which had a dpci binding set up, so that
+ * pt_pirq_iterate() doesn't have to visit every pIRQ of the domain.  It is
+ * cleared lazily once the binding is gone.
+ */
+#define PIRQ_TAG_DPCI 0
+
 static DEFINE_PER_CPU(struct list_head, dpci_list);
 
 /*
@@ -350,6 +357,7 @@ int pt_irq_create_bind(
         {
             pirq_dpci->flags = HVM_IRQ_DPCI_MAPPED | HVM_IRQ_DPCI_MACH_MSI |
                                HVM_IRQ_DPCI_GUEST_MSI;
+            radix_tree_tag_set(&d->pirq_tree, pirq, PIRQ_TAG_DPCI);
             pirq_dpci->gmsi.gvec = pt_irq_bind->u.msi.gvec;
             pirq_dpci->gmsi.gflags = gflags;
             /*
@@ -422,6 +430,7 @@ int pt_irq_create_bind(
 
         dest_vcpu_id = hvm_girq_dest_2_vcpu_id(d, dest, dest_mode);
         pirq_dpci->gmsi.dest_vcpu_id = dest_vcpu_id;
+        pirq_dpci->gmsi.remote = 0;
         spin_unlock(&d->event_lock);
 
         pirq_dpci->gmsi.posted = false;
@@ -523,6 +532,7 @@ int pt_irq_create_bind(
 
             /* MUST be set, as the pirq_dpci can be re-used. */
             pirq_dpci->dom = d;
+            radix_tree_tag_set(&d->pirq_tree, pirq, PIRQ_TAG_DPCI);
             if ( pt_irq_bind->irq_type == PT_IRQ_TYPE_MSI_TRANSLATE )
             {
                 pirq_dpci->flags = HVM_IRQ_DPCI_MAPPED |
@@ -780,8 +790,8 @@ int pt_pirq_iterate(struct domain *d,
     ASSERT(spin_is_locked(&d->event_lock));
 
     do {
-        n = radix_tree_gang_lookup(&d->pirq_tree, (void **)pirqs, pirq,
-                                   ARRAY_SIZE(pirqs));
+        n = radix_tree_gang_lookup_tag(&d->pirq_tree, (void **)pirqs, pirq,
+                                       ARRAY_SIZE(pirqs), PIRQ_TAG_DPCI);
         for ( i = 0; i < n; ++i )
         {
             struct hvm_pirq_dpci *pirq_dpci = pirq_dpci(pirqs[i]);
@@ -789,12 +799,48 @@ int pt_pirq_iterate(struct domain *d,
             pirq = pirqs[i]->pirq;
             if ( (pirq_dpci->flags & HVM_IRQ_DPCI_MAPPED) )
                 rc = cb(d, pirq_dpci, arg);
+            else
+                radix_tree_tag_clear(&d->pirq_tree, pirq, PIRQ_TAG_DPCI);
         }
     } while ( !rc && ++pirq < d->nr_pirqs && n == ARRAY_SIZE(pirqs) );
 
     return rc;
 }
 
+/* Consecutive deliveries to the wrong pCPU before an MSI is moved. */
+#define MSI_FOLLOW_THRESHOLD 8
+
+/*
+ * Without posted interrupts, an MSI arriving on a pCPU other than the one
+ * its destination vCPU runs on costs an extra IPI.  Move it over once this
+ * keeps happening.  Called with the IRQ descriptor lock held.
+ */
+static void msi_follow_vcpu(const struct domain *d, const struct pirq *pirq,
+                            struct hvm_pirq_dpci *pirq_dpci)
+{
+    int id = read_atomic(&pirq_dpci->gmsi.dest_vcpu_id);
+    const struct vcpu *v;
+    unsigned int cpu;
+
+    if ( id < 0 || id >= d->max_vcpus || !(v = d->vcpu[id]) )
+        return;
+
+    cpu = read_atomic(&v->processor);
+    if ( cpu == smp_processor_id() )
+    {
+        pirq_dpci->gmsi.remote = 0;
+        return;
+    }
+
+    perfc_incr(dpci_msi_remote);
+    if ( ++pirq_dpci->gmsi.remote < MSI_FOLLOW_THRESHOLD )
+        return;
+
+    pirq_dpci->gmsi.remote = 0;
+    perfc_incr(dpci_msi_follow);
+    irq_set_affinity(irq_to_desc(pirq->arch.irq), cpumask_of(cpu));
+}
+
 int hvm_do_IRQ_dpci(struct domain *d, struct pirq *pirq)
 {
     struct hvm_irq_dpci *dpci = domain_get_irq_dpci(d);
@@ -806,6 +852,10 @@ int hvm_do_IRQ_dpci(struct domain *d, struct pirq *pirq)
          !pirq_dpci || !(pirq_dpci->flags & HVM_IRQ_DPCI_MAPPED) )
         return 0;
 
+    if ( (pirq_dpci->flags & HVM_IRQ_DPCI_MACH_MSI) &&
+         !pirq_dpci->gmsi.posted )
+        msi_follow_vcpu(d, pirq, pirq_dpci);
+
     pirq_dpci->masked = 1;
     raise_softirq_for(pirq_dpci);
     return 1;
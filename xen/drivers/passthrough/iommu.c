@@ -73,6 +73,7 @@ bool_t __read_mostly iommu_debug;
 bool_t __read_mostly amd_iommu_perdev_intremap = 1;
 
 DEFINE_PER_CPU(bool_t, iommu_dont_flush_iotlb);
+DEFINE_PER_CPU(unsigned int, iommu_iotlb_batch);
 
 DEFINE_SPINLOCK(iommu_pt_cleanup_lock);
 PAGE_LIST_HEAD(iommu_pt_cleanup_list);
@@ -179,9 +180,16 @@ void __hwdom_init iommu_hwdom_init(struct domain *d)
     if ( need_iommu(d) && !iommu_use_hap_pt(d) )
     {
         struct page_info *page;
-        unsigned int i = 0;
+        unsigned int i = 0, run_flags = 0;
+        unsigned long run_gfn = 0, run_mfn = 0, run_nr = 0;
         int rc = 0;
 
+        /*
+         * Mappings are established in runs of contiguous pages, with a
+         * single flush once the hardware domain's tables are complete.
+         */
+        this_cpu(iommu_dont_flush_iotlb) = 1;
+
         page_list_for_each ( page, &d->page_list )
         {
             unsigned long mfn = page_to_mfn(page);
@@ -194,14 +202,41 @@ void __hwdom_init iommu_hwdom_init(struct domain *d)
                   == PGT_writable_page) )
                 mapping |= IOMMUF_writable;
 
-            ret = hd->platform_ops->map_page(d, gfn, mfn, mapping);
+            if ( run_nr && gfn == run_gfn + run_nr &&
+                 mfn == run_mfn + run_nr && mapping == run_flags &&
+                 run_nr < (1UL << IOMMU_MAP_RANGE_MAX_ORDER) )
+            {
+                run_nr++;
+                continue;
+            }
+
+            if ( run_nr )
+            {
+                ret = iommu_map_range(d, run_gfn, run_mfn, run_nr, run_flags);
+                if ( !rc )
+                    rc = ret;
+            }
+            run_gfn = gfn;
+            run_mfn = mfn;
+            run_nr = 1;
+            run_flags = mapping;
+
+            if ( !(i++ & 0xff) )
+                process_pending_softirqs();
+        }
+
+        if ( run_nr )
+        {
+            int ret = iommu_map_range(d, run_gfn, run_mfn, run_nr, run_flags);
+
             if ( !rc )
                 rc = ret;
-
-            if ( !(i++ & 0xfffff) )
-                process_pending_softirqs();
         }
 
+        this_cpu(iommu_dont_flush_iotlb) = 0;
+        if ( !rc )
+            rc = iommu_iotlb_flush_all(d);
+
         if ( rc )
             printk(XENLOG_WARNING "d%d: IOMMU mapping failed: %d\n",
                    d->domain_id, rc);
@@ -302,6 +337,121 @@ int iommu_unmap_page(struct domain *d, unsigned long gfn)
     return rc;
 }
 
+int iommu_map_pages(struct domain *d, unsigned long gfn, unsigned long mfn,
+                    unsigned int order, unsigned int flags)
+{
+    const struct domain_iommu *hd = dom_iommu(d);
+    unsigned long i;
+    int rc = 0, ret;
+
+    if ( !iommu_enabled || !hd->platform_ops )
+        return 0;
+
+    if ( !order )
+        return iommu_map_page(d, gfn, mfn, flags);
+
+    iommu_iotlb_batch_start();
+
+    if ( hd->platform_ops->map_pages )
+    {
+        rc = hd->platform_ops->map_pages(d, gfn, mfn, order, flags);
+        if ( unlikely(rc) )
+        {
+            if ( !d->is_shutting_down && printk_ratelimit() )
+                printk(XENLOG_ERR
+                       "d%d: IOMMU mapping gfn %#lx to mfn %#lx order %u failed: %d\n",
+                       d->domain_id, gfn, mfn, order, rc);
+
+            if ( !is_hardware_domain(d) )
+                domain_crash(d);
+        }
+    }
+    else
+        for ( i = 0; i < (1UL << order); i++ )
+        {
+            rc = iommu_map_page(d, gfn + i, mfn + i, flags);
+            if ( unlikely(rc) )
+            {
+                while ( i-- )
+                    /* If statement to satisfy __must_check. */
+                    if ( iommu_unmap_page(d, gfn + i) )
+                        continue;
+
+                break;
+            }
+        }
+
+    ret = iommu_iotlb_batch_end(d);
+
+    return rc ?: ret;
+}
+
+int iommu_unmap_pages(struct domain *d, unsigned long gfn, unsigned int order)
+{
+    const struct domain_iommu *hd = dom_iommu(d);
+    unsigned long i;
+    int rc = 0, ret;
+
+    if ( !iommu_enabled || !hd->platform_ops )
+        return 0;
+
+    if ( !order )
+        return iommu_unmap_page(d, gfn);
+
+    iommu_iotlb_batch_start();
+
+    if ( hd->platform_ops->unmap_pages )
+    {
+        rc = hd->platform_ops->unmap_pages(d, gfn, order);
+        if ( unlikely(rc) )
+        {
+            if ( !d->is_shutting_down && printk_ratelimit() )
+                printk(XENLOG_ERR
+                       "d%d: IOMMU unmapping gfn %#lx order %u failed: %d\n",
+                       d->domain_id, gfn, order, rc);
+
+            if ( !is_hardware_domain(d) )
+                domain_crash(d);
+        }
+    }
+    else
+        for ( i = 0; i < (1UL << order); i++ )
+        {
+            ret = iommu_unmap_page(d, gfn + i);
+            if ( !rc )
+                rc = ret;
+        }
+
+    ret = iommu_iotlb_batch_end(d);
+
+    return rc ?: ret;
+}
+
+int iommu_map_range(struct domain *d, unsigned long gfn, unsigned long mfn,
+                    unsigned long nr, unsigned int flags)
+{
+    int rc = 0;
+
+    while ( nr )
+    {
+        unsigned int order = min_t(unsigned int, flsl(nr) - 1,
+                                   IOMMU_MAP_RANGE_MAX_ORDER);
+
+        if ( gfn | mfn )
+            order = min(order, find_first_set_bit(gfn | mfn));
+
+        rc = iommu_map_pages(d, gfn, mfn, order, flags);
+        if ( rc )
+            break;
+
+        gfn += 1UL << order;
+        mfn += 1UL << order;
+        nr -= 1UL << order;
+    }
+
+    return rc;
+}
+
 static void iommu_free_pagetables(unsigned long unused)
 {
     do {
@@ -366,6 +516,39 @@ int iommu_iotlb_flush_all(struct domain *d)
     return rc;
 }
 
+void iommu_iotlb_batch_start(void)
+{
+    this_cpu(iommu_iotlb_batch)++;
+}
+
+int iommu_iotlb_batch_end(struct domain *d)
+{
+    const struct iommu_ops *ops;
+    int rc;
+
+    ASSERT(this_cpu(iommu_iotlb_batch));
+    if ( --this_cpu(iommu_iotlb_batch) || !iommu_enabled )
+        return 0;
+
+    ops = iommu_get_ops();
+    if ( !ops || !ops->iotlb_batch_end )
+        return 0;
+
+    rc = ops->iotlb_batch_end();
+    if ( unlikely(rc) )
+    {
+        if ( !d->is_shutting_down && printk_ratelimit() )
+            printk(XENLOG_ERR
+                   "d%d: IOMMU IOTLB batch flush failed: %d\n",
+                   d->domain_id, rc);
+
+        if ( !is_hardware_domain(d) )
+            domain_crash(d);
+    }
+
+    return rc;
+}
+
 int __init iommu_setup(void)
 {
     int rc = -ENODEV;
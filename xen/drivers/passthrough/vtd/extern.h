@@ -34,6 +34,7 @@ keyhandler_fn_t vtd_dump_iommu_info;
 
 int enable_qinval(struct iommu *iommu);
 void disable_qinval(struct iommu *iommu);
+int __must_check qinval_batch_sync(void);
 int enable_intremap(struct iommu *iommu, int eim);
 void disable_intremap(struct iommu *iommu);
 
@@ -691,11 +691,22 @@ static int msi_msg_to_remap_entry(
     remap_rte->address_hi = 0;
     remap_rte->data = index - i;
 
-    update_irte(iommu, iremap_entry, &new_ire, msi_desc->irte_initialized);
-    msi_desc->irte_initialized = true;
+    /*
+     * Affinity changes often end up producing an identical entry (e.g. an
+     * IRQ following its vCPU back and forth), so spare the IEC flush.
+     */
+    if ( msi_desc->irte_initialized &&
+         iremap_entry->lo == new_ire.lo && iremap_entry->hi == new_ire.hi )
+        perfc_incr(irte_update_skipped);
+    else
+    {
+        update_irte(iommu, iremap_entry, &new_ire,
+                    msi_desc->irte_initialized);
+        msi_desc->irte_initialized = true;
 
-    iommu_flush_cache_entry(iremap_entry, sizeof(*iremap_entry));
-    iommu_flush_iec_index(iommu, 0, index);
+        iommu_flush_cache_entry(iremap_entry, sizeof(*iremap_entry));
+        iommu_flush_iec_index(iommu, 0, index);
+    }
 
     unmap_vtd_domain_page(iremap_entries);
     spin_unlock_irqrestore(&ir_ctrl->iremap_lock, flags);
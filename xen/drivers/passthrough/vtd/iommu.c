@@ -54,6 +54,9 @@ int nr_iommus;
 
 static struct tasklet vtd_fault_tasklet;
 
+/* Number of superpage levels (2M, 1G) usable on all VT-d engines. */
+static unsigned int __read_mostly vtd_sp_levels = 2;
+
 static int setup_hwdom_device(u8 devfn, struct pci_dev *);
 static void setup_hwdom_rmrr(struct domain *d);
 
@@ -249,17 +252,43 @@ static u64 bus_to_context_maddr(struct iommu *iommu, u8 bus)
     return maddr;
 }
 
-static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr, int alloc)
+/* Fill a new level @level table with the entries equivalent to superpage @sp. */
+static void dma_pte_split(u64 pt_maddr, unsigned int level, struct dma_pte sp)
+{
+    struct dma_pte *pt = map_vtd_domain_page(pt_maddr);
+    u64 inc = (u64)1 << level_to_offset_bits(level);
+    unsigned int i;
+
+    if ( level == 1 )
+        sp.val &= ~DMA_PTE_SP;
+
+    for ( i = 0; i < PTE_NUM; i++, sp.val += inc )
+        pt[i] = sp;
+
+    iommu_flush_cache_page(pt, 1);
+    unmap_vtd_domain_page(pt);
+}
+
+/*
+ * Return the machine address of the level @target page table covering
+ * @addr, allocating intermediate tables if @alloc. A superpage met above
+ * @target is split into next level entries. Returns 0 if nothing is
+ * mapped (only possible without @alloc), or a value below PAGE_SIZE_4K if
+ * a page table could not be allocated.
+ */
+static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr,
+                                  unsigned int target, int alloc)
 {
     struct acpi_drhd_unit *drhd;
     struct pci_dev *pdev;
     struct domain_iommu *hd = dom_iommu(domain);
     int addr_width = agaw_to_width(hd->arch.agaw);
     struct dma_pte *parent, *pte = NULL;
-    int level = agaw_to_level(hd->arch.agaw);
+    unsigned int level = agaw_to_level(hd->arch.agaw);
     int offset;
     u64 pte_maddr = 0;
 
+    ASSERT(target && target <= level);
     addr &= (((u64)1) << addr_width) - 1;
     ASSERT(spin_is_locked(&hd->arch.mapping_lock));
     if ( hd->arch.pgd_maddr == 0 )
@@ -270,12 +299,18 @@ static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr, int alloc)
          */
         pdev = pci_get_pdev_by_domain(domain, -1, -1, -1);
         drhd = acpi_find_matched_drhd_unit(pdev);
-        if ( !alloc || ((hd->arch.pgd_maddr = alloc_pgtable_maddr(drhd, 1)) == 0) )
+        if ( !alloc )
+            goto out;
+        if ( (hd->arch.pgd_maddr = alloc_pgtable_maddr(drhd, 1)) == 0 )
+        {
+            pte_maddr = 1;
             goto out;
+        }
     }
 
+    pte_maddr = hd->arch.pgd_maddr;
     parent = (struct dma_pte *)map_vtd_domain_page(hd->arch.pgd_maddr);
-    while ( level > 1 )
+    while ( level > target )
     {
         offset = address_level_offset(addr, level);
         pte = &parent[offset];
@@ -290,7 +325,10 @@ static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr, int alloc)
             drhd = acpi_find_matched_drhd_unit(pdev);
             pte_maddr = alloc_pgtable_maddr(drhd, 1);
             if ( !pte_maddr )
+            {
+                pte_maddr = 1;
                 break;
+            }
 
             dma_set_pte_addr(*pte, pte_maddr);
 
@@ -302,8 +340,30 @@ static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr, int alloc)
             dma_set_pte_writable(*pte);
             iommu_flush_cache_entry(pte, sizeof(struct dma_pte));
         }
+        else if ( dma_pte_superpage(*pte) )
+        {
+            /*
+             * The split table translates exactly as the superpage did, so
+             * no IOTLB flush is needed until one of its entries changes.
+             */
+            pdev = pci_get_pdev_by_domain(domain, -1, -1, -1);
+            drhd = acpi_find_matched_drhd_unit(pdev);
+            pte_maddr = alloc_pgtable_maddr(drhd, 1);
+            if ( !pte_maddr )
+            {
+                pte_maddr = 1;
+                break;
+            }
+
+            dma_pte_split(pte_maddr, level - 1, *pte);
+            pte->val = 0;
+            dma_set_pte_addr(*pte, pte_maddr);
+            dma_set_pte_readable(*pte);
+            dma_set_pte_writable(*pte);
+            iommu_flush_cache_entry(pte, sizeof(struct dma_pte));
+        }
 
-        if ( level == 2 )
+        if ( level == target + 1 )
             break;
 
         unmap_vtd_domain_page(parent);
@@ -612,13 +672,14 @@ static int __must_check iommu_flush_iotlb(struct domain *d,
         if ( iommu_domid == -1 )
             continue;
 
-        if ( page_count != 1 || gfn == gfn_x(INVALID_GFN) )
+        if ( (page_count & (page_count - 1)) || (gfn & (page_count - 1)) ||
+             gfn == gfn_x(INVALID_GFN) )
             rc = iommu_flush_iotlb_dsi(iommu, iommu_domid,
                                        0, flush_dev_iotlb);
         else
             rc = iommu_flush_iotlb_psi(iommu, iommu_domid,
                                        (paddr_t)gfn << PAGE_SHIFT_4K,
-                                       PAGE_ORDER_4K,
+                                       get_order_from_pages(page_count),
                                        !dma_old_pte_present,
                                        flush_dev_iotlb);
 
@@ -644,25 +705,67 @@ static int __must_check iommu_flush_iotlb_all(struct domain *d)
     return iommu_flush_iotlb(d, gfn_x(INVALID_GFN), 0, 0);
 }
 
-/* clear one page's page table */
-static int __must_check dma_pte_clear_one(struct domain *domain, u64 addr)
+/* Synchronously free a page table detached from a domain's tables. */
+static void dma_pte_free_table(u64 pt_maddr, unsigned int level)
+{
+    struct dma_pte *pt;
+    unsigned int i;
+
+    if ( level > 1 )
+    {
+        pt = map_vtd_domain_page(pt_maddr);
+        for ( i = 0; i < PTE_NUM; i++ )
+            if ( dma_pte_present(pt[i]) && !dma_pte_superpage(pt[i]) )
+                dma_pte_free_table(dma_pte_addr(pt[i]), level - 1);
+        unmap_vtd_domain_page(pt);
+    }
+
+    free_pgtable_maddr(pt_maddr);
+}
+
+/*
+ * Complete the IOTLB flush for a change which detached the level @level
+ * page table at @pt_maddr, then free it. The flush cannot be deferred
+ * (by the caller or an IOTLB batch) as the table is reused immediately.
+ */
+static int __must_check dma_pte_flush_free(struct domain *domain,
+                                           unsigned long gfn,
+                                           unsigned int order,
+                                           u64 pt_maddr, unsigned int level)
+{
+    int rc = iommu_flush_iotlb(domain, gfn, 1, 1u << order);
+
+    if ( !rc && this_cpu(iommu_iotlb_batch) )
+        rc = qinval_batch_sync();
+
+    /* Leak the table rather than risk DMA through a stale walk. */
+    if ( !rc )
+        dma_pte_free_table(pt_maddr, level);
+
+    return rc;
+}
+
+/* clear the level @level entry covering @addr */
+static int __must_check dma_pte_clear(struct domain *domain, u64 addr,
+                                      unsigned int level)
 {
     struct domain_iommu *hd = dom_iommu(domain);
-    struct dma_pte *page = NULL, *pte = NULL;
+    struct dma_pte *page = NULL, *pte = NULL, old;
+    unsigned int order = (level - 1) * LEVEL_STRIDE;
     u64 pg_maddr;
     int rc = 0;
 
     spin_lock(&hd->arch.mapping_lock);
-    /* get last level pte */
-    pg_maddr = addr_to_dma_page_maddr(domain, addr, 0);
-    if ( pg_maddr == 0 )
+    /* get target level pte */
+    pg_maddr = addr_to_dma_page_maddr(domain, addr, level, 0);
+    if ( pg_maddr < PAGE_SIZE_4K )
     {
         spin_unlock(&hd->arch.mapping_lock);
-        return 0;
+        return pg_maddr ? -ENOMEM : 0;
     }
 
     page = (struct dma_pte *)map_vtd_domain_page(pg_maddr);
-    pte = page + address_level_offset(addr, 1);
+    pte = page + address_level_offset(addr, level);
 
     if ( !dma_pte_present(*pte) )
     {
@@ -671,15 +774,19 @@ static int __must_check dma_pte_clear_one(struct domain *domain, u64 addr)
         return 0;
     }
 
+    old = *pte;
     dma_clear_pte(*pte);
     spin_unlock(&hd->arch.mapping_lock);
     iommu_flush_cache_entry(pte, sizeof(struct dma_pte));
-
-    if ( !this_cpu(iommu_dont_flush_iotlb) )
-        rc = iommu_flush_iotlb_pages(domain, addr >> PAGE_SHIFT_4K, 1);
-
     unmap_vtd_domain_page(page);
 
+    if ( level > 1 && !dma_pte_superpage(old) )
+        rc = dma_pte_flush_free(domain, addr >> PAGE_SHIFT_4K, order,
+                                dma_pte_addr(old), level - 1);
+    else if ( !this_cpu(iommu_dont_flush_iotlb) )
+        rc = iommu_flush_iotlb_pages(domain, addr >> PAGE_SHIFT_4K,
+                                     1u << order);
+
     return rc;
 }
 
@@ -711,7 +818,7 @@ static void iommu_free_page_table(struct page_info *pg)
         if ( !dma_pte_present(*pte) )
             continue;
 
-        if ( next_level >= 1 )
+        if ( next_level >= 1 && !dma_pte_superpage(*pte) )
             iommu_free_pagetable(dma_pte_addr(*pte), next_level);
 
         dma_clear_pte(*pte);
@@ -1397,7 +1504,7 @@ int domain_context_mapping_one(
         /* Ensure we have pagetables allocated down to leaf PTE. */
         if ( hd->arch.pgd_maddr == 0 )
         {
-            addr_to_dma_page_maddr(domain, 0, 1);
+            addr_to_dma_page_maddr(domain, 0, 1, 1);
             if ( hd->arch.pgd_maddr == 0 )
             {
             nomem:
@@ -1760,39 +1867,35 @@ static void iommu_domain_teardown(struct domain *d)
     spin_unlock(&hd->arch.mapping_lock);
 }
 
-static int __must_check intel_iommu_map_page(struct domain *d,
-                                             unsigned long gfn,
-                                             unsigned long mfn,
-                                             unsigned int flags)
+/* Install a level @level entry mapping @gfn to @mfn. */
+static int __must_check dma_pte_set(struct domain *d, unsigned long gfn,
+                                    unsigned long mfn, unsigned int level,
+                                    unsigned int flags)
 {
     struct domain_iommu *hd = dom_iommu(d);
     struct dma_pte *page = NULL, *pte = NULL, old, new = { 0 };
+    unsigned int order = (level - 1) * LEVEL_STRIDE;
     u64 pg_maddr;
     int rc = 0;
 
-    /* Do nothing if VT-d shares EPT page table */
-    if ( iommu_use_hap_pt(d) )
-        return 0;
-
-    /* Do nothing if hardware domain and iommu supports pass thru. */
-    if ( iommu_passthrough && is_hardware_domain(d) )
-        return 0;
-
     spin_lock(&hd->arch.mapping_lock);
 
-    pg_maddr = addr_to_dma_page_maddr(d, (paddr_t)gfn << PAGE_SHIFT_4K, 1);
-    if ( pg_maddr == 0 )
+    pg_maddr = addr_to_dma_page_maddr(d, (paddr_t)gfn << PAGE_SHIFT_4K,
+                                      level, 1);
+    if ( pg_maddr < PAGE_SIZE_4K )
     {
         spin_unlock(&hd->arch.mapping_lock);
         return -ENOMEM;
     }
     page = (struct dma_pte *)map_vtd_domain_page(pg_maddr);
-    pte = page + (gfn & LEVEL_MASK);
+    pte = page + address_level_offset((paddr_t)gfn << PAGE_SHIFT_4K, level);
     old = *pte;
     dma_set_pte_addr(new, (paddr_t)mfn << PAGE_SHIFT_4K);
     dma_set_pte_prot(new,
                      ((flags & IOMMUF_readable) ? DMA_PTE_READ  : 0) |
                      ((flags & IOMMUF_writable) ? DMA_PTE_WRITE : 0));
+    if ( level > 1 )
+        dma_set_pte_superpage(new);
 
     /* Set the SNP on leaf page table if Snoop Control available */
     if ( iommu_snoop )
@@ -1810,12 +1913,46 @@ static int __must_check intel_iommu_map_page(struct domain *d,
     spin_unlock(&hd->arch.mapping_lock);
     unmap_vtd_domain_page(page);
 
-    if ( !this_cpu(iommu_dont_flush_iotlb) )
-        rc = iommu_flush_iotlb(d, gfn, dma_pte_present(old), 1);
+    /* Mapping a superpage over a page table merges the range. */
+    if ( level > 1 && dma_pte_present(old) && !dma_pte_superpage(old) )
+        rc = dma_pte_flush_free(d, gfn, order, dma_pte_addr(old), level - 1);
+    else if ( !this_cpu(iommu_dont_flush_iotlb) )
+        rc = iommu_flush_iotlb(d, gfn, dma_pte_present(old), 1u << order);
 
     return rc;
 }
 
+/* Largest page order usable for a mapping of @order at @gfn/@mfn. */
+static unsigned int vtd_map_order(const struct domain *d, unsigned long gfn,
+                                  unsigned long mfn, unsigned int order)
+{
+    unsigned int levels = min(vtd_sp_levels,
+                              agaw_to_level(dom_iommu(d)->arch.agaw) - 1u);
+    unsigned int sp_order = levels * LEVEL_STRIDE;
+
+    for ( ; sp_order; sp_order -= LEVEL_STRIDE )
+        if ( sp_order <= order && !((gfn | mfn) & ((1UL << sp_order) - 1)) )
+            break;
+
+    return sp_order;
+}
+
+static int __must_check intel_iommu_map_page(struct domain *d,
+                                             unsigned long gfn,
+                                             unsigned long mfn,
+                                             unsigned int flags)
+{
+    /* Do nothing if VT-d shares EPT page table */
+    if ( iommu_use_hap_pt(d) )
+        return 0;
+
+    /* Do nothing if hardware domain and iommu supports pass thru. */
+    if ( iommu_passthrough && is_hardware_domain(d) )
+        return 0;
+
+    return dma_pte_set(d, gfn, mfn, 1, flags);
+}
+
 static int __must_check intel_iommu_unmap_page(struct domain *d,
                                                unsigned long gfn)
 {
@@ -1823,7 +1960,76 @@ static int __must_check intel_iommu_unmap_page(struct domain *d,
     if ( iommu_passthrough && is_hardware_domain(d) )
         return 0;
 
-    return dma_pte_clear_one(d, (paddr_t)gfn << PAGE_SHIFT_4K);
+    return dma_pte_clear(d, (paddr_t)gfn << PAGE_SHIFT_4K, 1);
+}
+
+static int __must_check intel_iommu_unmap_pages(struct domain *d,
+                                                unsigned long gfn,
+                                                unsigned int order)
+{
+    unsigned long i;
+    unsigned int sub;
+    int rc = 0, ret;
+
+    /* Do nothing if hardware domain and iommu supports pass thru. */
+    if ( iommu_passthrough && is_hardware_domain(d) )
+        return 0;
+
+    /*
+     * Clearing a higher level entry unmaps whatever lies beneath it. The
+     * superpage limits also keep the freed tables clear of the roots used
+     * by engines with fewer page table levels.
+     */
+    sub = vtd_map_order(d, gfn, 0, order);
+
+    for ( i = 0; i < (1UL << order); i += 1UL << sub )
+    {
+        ret = dma_pte_clear(d, (paddr_t)(gfn + i) << PAGE_SHIFT_4K,
+                            sub / LEVEL_STRIDE + 1);
+        if ( !rc )
+            rc = ret;
+    }
+
+    return rc;
+}
+
+static int __must_check intel_iommu_map_pages(struct domain *d,
+                                              unsigned long gfn,
+                                              unsigned long mfn,
+                                              unsigned int order,
+                                              unsigned int flags)
+{
+    unsigned long i;
+    unsigned int sub;
+    int rc = 0;
+
+    /* Do nothing if VT-d shares EPT page table */
+    if ( iommu_use_hap_pt(d) )
+        return 0;
+
+    /* Do nothing if hardware domain and iommu supports pass thru. */
+    if ( iommu_passthrough && is_hardware_domain(d) )
+        return 0;
+
+    sub = vtd_map_order(d, gfn, mfn, order);
+    for ( i = 0; i < (1UL << order); i += 1UL << sub )
+    {
+        rc = dma_pte_set(d, gfn + i, mfn + i, sub / LEVEL_STRIDE + 1, flags);
+        if ( unlikely(rc) )
+        {
+            while ( i )
+            {
+                i -= 1UL << sub;
+                /* If statement to satisfy __must_check. */
+                if ( dma_pte_clear(d, (paddr_t)(gfn + i) << PAGE_SHIFT_4K,
+                                   sub / LEVEL_STRIDE + 1) )
+                    continue;
+            }
+            break;
+        }
+    }
+
+    return rc;
 }
 
 int iommu_pte_flush(struct domain *d, u64 gfn, u64 *pte,
@@ -2260,6 +2466,11 @@ int __init intel_vtd_setup(void)
 
         printk(".\n");
 
+        if ( !cap_sps_2mb(iommu->cap) )
+            vtd_sp_levels = 0;
+        else if ( !cap_sps_1gb(iommu->cap) || iommu->nr_pt_levels < 3 )
+            vtd_sp_levels = min(vtd_sp_levels, 1u);
+
         if ( iommu_snoop && !ecap_snp_ctl(iommu->ecap) )
             iommu_snoop = 0;
 
@@ -2616,7 +2827,7 @@ static void vtd_dump_p2m_table_level(paddr_t pt_maddr, int level, paddr_t gpa,
             continue;
 
         address = gpa + offset_level_address(i, level);
-        if ( next_level >= 1 ) 
+        if ( next_level >= 1 && !dma_pte_superpage(*pte) )
             vtd_dump_p2m_table_level(dma_pte_addr(*pte), next_level, 
                                      address, indent + 1);
         else
@@ -2651,6 +2862,8 @@ const struct iommu_ops intel_iommu_ops = {
     .teardown = iommu_domain_teardown,
     .map_page = intel_iommu_map_page,
     .unmap_page = intel_iommu_unmap_page,
+    .map_pages = intel_iommu_map_pages,
+    .unmap_pages = intel_iommu_unmap_pages,
     .free_page_table = iommu_free_page_table,
     .reassign_device = reassign_device_ownership,
     .get_device_group_id = intel_iommu_group_id,
@@ -2665,6 +2878,7 @@ const struct iommu_ops intel_iommu_ops = {
     .crash_shutdown = vtd_crash_shutdown,
     .iotlb_flush = iommu_flush_iotlb_pages,
     .iotlb_flush_all = iommu_flush_iotlb_all,
+    .iotlb_batch_end = qinval_batch_sync,
     .get_reserved_device_memory = intel_iommu_get_reserved_device_memory,
     .dump_p2m_table = vtd_dump_p2m_table,
 };
@@ -31,6 +31,12 @@
 
 #define VTD_QI_TIMEOUT	1
 
+/*
+ * IOMMUs (by index) which were sent IOTLB invalidations without a wait
+ * descriptor while an IOTLB batch was open on this CPU.
+ */
+static DEFINE_PER_CPU(unsigned long, qinval_batch_pending);
+
 static int __must_check invalidate_sync(struct iommu *iommu);
 
 static void print_qi_regs(struct iommu *iommu)
@@ -140,9 +146,40 @@ static int __must_check queue_invalidate_iotlb_sync(struct iommu *iommu,
     qinval_update_qtail(iommu, index);
     spin_unlock_irqrestore(&iommu->register_lock, flags);
 
+    /* Descriptors complete in order: one wait at the end covers them all. */
+    if ( this_cpu(iommu_iotlb_batch) )
+    {
+        __set_bit(iommu->index, &this_cpu(qinval_batch_pending));
+        return 0;
+    }
+
     return invalidate_sync(iommu);
 }
 
+int __must_check qinval_batch_sync(void)
+{
+    unsigned long *pending = &this_cpu(qinval_batch_pending);
+    struct acpi_drhd_unit *drhd;
+    int rc = 0, ret;
+
+    BUILD_BUG_ON(MAX_IOMMUS > BITS_PER_LONG);
+
+    if ( !*pending )
+        return 0;
+
+    for_each_drhd_unit ( drhd )
+    {
+        if ( !__test_and_clear_bit(drhd->iommu->index, pending) )
+            continue;
+
+        ret = invalidate_sync(drhd->iommu);
+        if ( !rc )
+            rc = ret;
+    }
+
+    return rc;
+}
+
 static int __must_check queue_invalidate_wait(struct iommu *iommu,
                                               u8 iflag, u8 sw, u8 fn,
                                               bool_t flush_dev_iotlb)
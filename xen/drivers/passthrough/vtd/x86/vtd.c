@@ -110,16 +110,22 @@ void hvm_dpci_isairq_eoi(struct domain *d, unsigned int isairq)
 
 void __hwdom_init vtd_set_hwdom_mapping(struct domain *d)
 {
-    unsigned long i, j, tmp, top;
+    unsigned long i, tmp, top, run_start = 0, run_nr = 0;
+    int rc;
 
     BUG_ON(!is_hardware_domain(d));
 
     top = max(max_pdx, pfn_to_pdx(0xffffffffUL >> PAGE_SHIFT) + 1);
+    tmp = 1 << (PAGE_SHIFT - PAGE_SHIFT_4K);
+
+    /*
+     * Contiguous ranges are mapped in one go, allowing superpages, with
+     * a single flush at the end.
+     */
+    this_cpu(iommu_dont_flush_iotlb) = 1;
 
     for ( i = 0; i < top; i++ )
     {
-        int rc = 0;
-
         /*
          * Set up 1:1 mapping for dom0. Default to use only conventional RAM
          * areas and let RMRRs include needed reserved regions. When set, the
@@ -140,22 +146,40 @@ void __hwdom_init vtd_set_hwdom_mapping(struct domain *d)
         if ( xen_in_range(pfn) )
             continue;
 
-        tmp = 1 << (PAGE_SHIFT - PAGE_SHIFT_4K);
-        for ( j = 0; j < tmp; j++ )
+        if ( run_nr && pfn * tmp == run_start + run_nr &&
+             run_nr < (1UL << IOMMU_MAP_RANGE_MAX_ORDER) )
         {
-            int ret = iommu_map_page(d, pfn * tmp + j, pfn * tmp + j,
-                                     IOMMUF_readable|IOMMUF_writable);
+            run_nr += tmp;
+            continue;
+        }
 
-            if ( !rc )
-               rc = ret;
+        if ( run_nr )
+        {
+            rc = iommu_map_range(d, run_start, run_start, run_nr,
+                                 IOMMUF_readable|IOMMUF_writable);
+            if ( rc )
+               printk(XENLOG_WARNING VTDPREFIX " d%d: IOMMU mapping failed: %d\n",
+                      d->domain_id, rc);
         }
+        run_start = pfn * tmp;
+        run_nr = tmp;
 
+        process_pending_softirqs();
+    }
+
+    if ( run_nr )
+    {
+        rc = iommu_map_range(d, run_start, run_start, run_nr,
+                             IOMMUF_readable|IOMMUF_writable);
         if ( rc )
            printk(XENLOG_WARNING VTDPREFIX " d%d: IOMMU mapping failed: %d\n",
                   d->domain_id, rc);
-
-        if (!(i & (0xfffff >> (PAGE_SHIFT - PAGE_SHIFT_4K))))
-            process_pending_softirqs();
     }
+
+    this_cpu(iommu_dont_flush_iotlb) = 0;
+    rc = iommu_iotlb_flush_all(d);
+    if ( rc )
+       printk(XENLOG_WARNING VTDPREFIX " d%d: IOMMU flush failed: %d\n",
+              d->domain_id, rc);
 }
 
@@ -41,8 +41,8 @@ int __init iommu_setup_hpet_msi(struct msi_desc *msi)
 
 int arch_iommu_populate_page_table(struct domain *d)
 {
-    const struct domain_iommu *hd = dom_iommu(d);
     struct page_info *page;
+    unsigned long run_gfn = 0, run_mfn = 0, run_nr = 0;
     int rc = 0, n = 0;
 
     d->need_iommu = -1;
@@ -65,9 +65,20 @@ int arch_iommu_populate_page_table(struct domain *d)
             {
                 ASSERT(!(gfn >> DEFAULT_DOMAIN_ADDRESS_WIDTH));
                 BUG_ON(SHARED_M2P(gfn));
-                rc = hd->platform_ops->map_page(d, gfn, mfn,
-                                                IOMMUF_readable |
-                                                IOMMUF_writable);
+
+                /* Accumulate physically and guest contiguous runs. */
+                if ( !run_nr || gfn != run_gfn + run_nr ||
+                     mfn != run_mfn + run_nr )
+                {
+                    if ( run_nr )
+                        rc = iommu_map_range(d, run_gfn, run_mfn, run_nr,
+                                             IOMMUF_readable |
+                                             IOMMUF_writable);
+                    run_gfn = gfn;
+                    run_mfn = mfn;
+                    run_nr = 0;
+                }
+                run_nr++;
             }
             if ( rc )
             {
@@ -81,6 +92,15 @@ int arch_iommu_populate_page_table(struct domain *d)
             rc = -ERESTART;
     }
 
+    if ( run_nr && (!rc || rc == -ERESTART) )
+    {
+        int ret = iommu_map_range(d, run_gfn, run_mfn, run_nr,
+                                  IOMMUF_readable | IOMMUF_writable);
+
+        if ( ret )
+            rc = ret;
+    }
+
     if ( !rc )
     {
         /*
@@ -12,6 +12,15 @@ static inline void flush_tlb_local(void)
     isb();
 }
 
+/*
+ * Flush local stage 1 TLBs, current VMID only. From Hyp mode there is no
+ * way to leave the stage 2 entries alone.
+ */
+static inline void flush_tlb_s1_local(void)
+{
+    flush_tlb_local();
+}
+
 /* Flush inner shareable TLBs, current VMID only */
 static inline void flush_tlb(void)
 {
@@ -23,6 +32,16 @@ static inline void flush_tlb(void)
     isb();
 }
 
+/*
+ * Flush inner shareable TLBs for a range of IPAs, current VMID only.
+ * There is no stage 1 only invalidation from Hyp mode, which a stage 2
+ * invalidation by IPA would have to be paired with: flush the VMID.
+ */
+static inline void flush_tlb_ipa_range(paddr_t ipa, unsigned long size)
+{
+    flush_tlb();
+}
+
 /* Flush local TLBs, all VMIDs, non-hypervisor mode */
 static inline void flush_tlb_all_local(void)
 {
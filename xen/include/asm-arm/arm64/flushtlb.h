@@ -12,6 +12,17 @@ static inline void flush_tlb_local(void)
         : : : "memory");
 }
 
+/* Flush local stage 1 TLBs, current VMID only */
+static inline void flush_tlb_s1_local(void)
+{
+    asm volatile(
+        "dsb sy;"
+        "tlbi vmalle1;"
+        "dsb sy;"
+        "isb;"
+        : : : "memory");
+}
+
 /* Flush innershareable TLBs, current VMID only */
 static inline void flush_tlb(void)
 {
@@ -23,6 +34,27 @@ static inline void flush_tlb(void)
         : : : "memory");
 }
 
+/*
+ * Flush innershareable TLBs for the IPAs [ipa, ipa + size), current VMID
+ * only. Stage 2 entries are invalidated by address, but combined stage
+ * 1+2 entries can't be, so all stage 1 entries of the VMID go as well.
+ */
+static inline void flush_tlb_ipa_range(paddr_t ipa, unsigned long size)
+{
+    paddr_t end = ipa + size;
+
+    asm volatile("dsb sy;" : : : "memory");
+    for ( ; ipa < end; ipa += PAGE_SIZE )
+        asm volatile("tlbi ipas2e1is, %0;" : : "r" (ipa >> PAGE_SHIFT)
+                     : "memory");
+    asm volatile(
+        "dsb sy;"
+        "tlbi vmalle1is;"
+        "dsb sy;"
+        "isb;"
+        : : : "memory");
+}
+
 /* Flush local TLBs, all VMIDs, non-hypervisor mode */
 static inline void flush_tlb_all_local(void)
 {
@@ -270,6 +270,12 @@ struct arch_vcpu
          * list and write it to the LR register.
          * lr_pending is a subset of vgic.inflight_irqs. */
         struct list_head lr_pending;
+        /*
+         * An interrupt held in an LR got raised again or removed while the
+         * vCPU wasn't running: all LRs need syncing on the next exit, not
+         * just the ones the guest emptied.
+         */
+        bool lr_resync;
         spinlock_t lock;
 
         /* GICv3: redistributor base and flags for this vCPU */
@@ -352,6 +352,8 @@ struct gic_hw_operations {
     void (*read_lr)(int lr, struct gic_lr *);
     /* Write LR register from gic_lr structure */
     void (*write_lr)(int lr, const struct gic_lr *);
+    /* Read the mask of LRs holding no valid interrupt */
+    uint64_t (*read_elrsr)(void);
     /* Read VMCR priority */
     unsigned int (*read_vmcr_priority)(void);
     /* Read APRn register */
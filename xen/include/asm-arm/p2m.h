@@ -66,8 +66,12 @@ struct p2m_domain {
      *
      * If an immediate flush is required (e.g, if a super page is
      * shattered), call p2m_tlb_flush_sync().
+     *
+     * [flush_start, flush_end) covers the GFNs the pending flush is for,
+     * small ranges are invalidated by IPA rather than for the whole VMID.
      */
     bool need_flush;
+    gfn_t flush_start, flush_end;
 
     /* Gather some statistics for information purposes only */
     struct {
@@ -73,6 +73,10 @@ PERFCOUNTER(phys_timer_irqs,  "Physical timer interrupts")
 PERFCOUNTER(virt_timer_irqs,  "Virtual timer interrupts")
 PERFCOUNTER(maintenance_irqs, "Maintenance interrupts")
 
+PERFCOUNTER(gic_lr_syncs,      "gic: LRs synced on exit")
+PERFCOUNTER(gic_lr_sync_skips, "gic: LRs left alone on exit")
+PERFCOUNTER(gic_lr_resyncs,    "gic: full LR resyncs")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
 
 /*
@@ -265,6 +265,27 @@ void recalculate_cpuid_policy(struct domain *d);
 void guest_cpuid(const struct vcpu *v, uint32_t leaf,
                  uint32_t subleaf, struct cpuid_leaf *res);
 
+/*
+ * Per-vCPU cache of guest_cpuid() results, including the dynamic
+ * adjustments.  Entries are tagged with a generation number, so that the
+ * whole cache can be invalidated with a single increment whenever state
+ * feeding into the dynamic adjustments (CR0/CR4, EFER, XCR0, APIC_BASE,
+ * vPMU availability, or the domain's policy) changes.
+ */
+#define CPUID_CACHE_ENTRIES 16
+
+struct cpuid_cache {
+    unsigned int gen;
+    struct cpuid_cache_entry {
+        uint32_t leaf, subleaf;
+        unsigned int gen;
+        struct cpuid_leaf res;
+    } ent[CPUID_CACHE_ENTRIES];
+};
+
+int init_vcpu_cpuid_cache(struct vcpu *v);
+void cpuid_cache_flush(struct vcpu *v);
+
 #endif /* __ASSEMBLY__ */
 #endif /* !__X86_CPUID_H__ */
 
@@ -42,8 +42,12 @@ struct trap_bounce {
 #define MAPHASH_HASHFN(pfn) ((pfn) & (MAPHASH_ENTRIES-1))
 #define MAPHASHENT_NOTINUSE ((u32)~0U)
 struct mapcache_vcpu {
-    /* Shadow of mapcache_domain.epoch. */
-    unsigned int shadow_epoch;
+    /*
+     * Which of this vCPU's MAPCACHE_VCPU_ENTRIES slots are in use, and which
+     * are garbage: unmapped, but with the PTE left in place until reaped.
+     */
+    unsigned long inuse;
+    unsigned long garbage;
 
     /* Lock-free per-VCPU hash of recently-used mappings. */
     struct vcpu_maphash_entry {
@@ -54,20 +58,11 @@ struct mapcache_vcpu {
 };
 
 struct mapcache_domain {
-    /* The number of array entries, and a cursor into the array. */
+    /* The number of slots with page tables populated. */
     unsigned int entries;
-    unsigned int cursor;
-
-    /* Protects map_domain_page(). */
-    spinlock_t lock;
 
-    /* Garbage mappings are flushed from TLBs in batches called 'epochs'. */
-    unsigned int epoch;
-    u32 tlbflush_timestamp;
-
-    /* Which mappings are in use, and which are garbage to reap next epoch? */
-    unsigned long *inuse;
-    unsigned long *garbage;
+    /* Whether map_domain_page() needs to use the mapcache at all. */
+    bool enabled;
 };
 
 int mapcache_domain_init(struct domain *);
@@ -108,6 +103,7 @@ struct shadow_domain {
 
     /* Shadow hashtable */
     struct page_info **hash_table;
+    unsigned int hash_buckets;
     bool_t hash_walking;  /* Some function is walking the hash table */
 
     /* Fast MMIO path heuristic */
@@ -175,6 +171,11 @@ struct log_dirty_domain {
     unsigned int   fault_count;
     unsigned int   dirty_count;
 
+    /* dirty page rate estimation (pages newly marked dirty per second) */
+    unsigned long  rate_pages;       /* pages marked since rate_stamp */
+    s_time_t       rate_stamp;       /* start of the current sample */
+    unsigned long  dirty_rate;       /* smoothed rate, pages/s */
+
     /* functions which are paging mode specific */
     const struct log_dirty_ops {
         int        (*enable  )(struct domain *d, bool log_global);
@@ -257,6 +258,9 @@ struct pv_domain
     struct cpuidmasks *cpuidmasks;
 };
 
+/* XEN_DOMCTL_MONITOR_ACCESS_FILTERS, which is not visible here. */
+#define MONITOR_ACCESS_FILTERS 8
+
 struct monitor_write_data {
     struct {
         unsigned int msr : 1;
@@ -412,11 +416,19 @@ struct arch_domain
         unsigned int emul_unimplemented_enabled                            : 1;
         struct monitor_msr_bitmap *msr_bitmap;
         uint64_t write_ctrlreg_mask[4];
+        struct monitor_access_filter {
+            uint8_t access;
+            uint8_t action;
+            unsigned long gfn_start, gfn_end;
+        } access_filter[MONITOR_ACCESS_FILTERS];
     } monitor;
 
     /* Mem_access emulation control */
     bool_t mem_access_emulate_each_rep;
 
+    /* Automatic NUMA balancing state, if enabled */
+    struct numa_balance *numa_balance;
+
     /* Emulated devices enabled bitmap. */
     uint32_t emulation_flags;
 } __cacheline_aligned;
@@ -561,6 +573,12 @@ struct arch_vcpu
     /* This variable determines whether nonlazy extended state has been used,
      * and thus should be saved/restored. */
     bool_t nonlazy_xstate_used;
+    /*
+     * Number of consecutive times this vcpu used the FPU after being
+     * scheduled in.  Above FPU_PRELOAD_THRESHOLD, its state is restored
+     * eagerly on context switch.  Wraps, to re-evaluate now and then.
+     */
+    uint8_t fpu_counter;
 
     /*
      * The SMAP check policy when updating runstate_guest(v) and the
@@ -580,6 +598,7 @@ struct arch_vcpu
     struct arch_vm_event *vm_event;
 
     struct msr_vcpu_policy *msr;
+    struct cpuid_cache *cpuid_cache;
 
     struct {
         bool next_interrupt_enabled;
@@ -125,6 +125,10 @@ void flush_area_mask(const cpumask_t *, const void *va, unsigned int flags);
     flush_mask(mask, FLUSH_TLB)
 #define flush_tlb_one_mask(mask,v)              \
     flush_area_mask(mask, (const void *)(v), FLUSH_TLB|FLUSH_ORDER(0))
+/* Flush specified CPUs' TLBs for @nr pages from @v: by page if few of them. */
+#define flush_tlb_range_mask(mask, v, nr)                               \
+    flush_area_mask(mask, (const void *)(v),                            \
+                    FLUSH_TLB|FLUSH_ORDER(get_order_from_pages(nr)))
 
 /* Flush all CPUs' TLBs */
 #define flush_tlb_all()                         \
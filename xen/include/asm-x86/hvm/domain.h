@@ -71,6 +71,7 @@ struct hvm_ioreq_server {
     struct rangeset        *range[NR_IO_RANGE_TYPES];
     bool                   enabled;
     bool                   bufioreq_atomic;
+    bool                   bufioreq_ring;
 };
 
 /*
@@ -107,10 +108,15 @@ struct hvm_domain {
         unsigned long mask;
     } ioreq_gfn;
 
-    /* Lock protects all other values in the sub-struct and the default */
+    /*
+     * Lock protects all other values in the sub-struct and the default.
+     * gen is bumped whenever server selection may change, and is read
+     * without the lock to validate the per-vCPU selection hints.
+     */
     struct {
         spinlock_t       lock;
         ioservid_t       id;
+        unsigned int     gen;
         struct list_head list;
     } ioreq_server;
     struct hvm_ioreq_server *default_ioreq_server;
@@ -122,6 +128,8 @@ struct hvm_domain {
 
     struct hvm_io_handler *io_handler;
     unsigned int          io_handler_count;
+    /* Bumped when handlers are added or moved, invalidating vCPU hints. */
+    unsigned int          io_handler_gen;
 
     /* Lock protects access to irq, vpic and vioapic. */
     spinlock_t             irq_lock;
@@ -168,6 +176,8 @@ struct hvm_domain {
 
     bool_t                 hap_enabled;
     bool_t                 mem_sharing_enabled;
+    /* Paused domain this one was forked from (XENMEM_sharing_op_fork). */
+    struct domain         *fork_parent;
     bool_t                 qemu_mapcache_invalidate;
     bool_t                 is_s3_suspended;
 
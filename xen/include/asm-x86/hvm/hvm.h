@@ -21,11 +21,13 @@
 #define __ASM_X86_HVM_HVM_H__
 
 #include <asm/current.h>
+#include <asm/cpuid.h>
 #include <asm/x86_emulate.h>
 #include <asm/hvm/asid.h>
 #include <public/domctl.h>
 #include <public/hvm/save.h>
 #include <xen/mm.h>
+#include <xen/time.h>
 
 #ifdef CONFIG_HVM_FEP
 /* Permit use of the Forced Emulation Prefix in HVM guests */
@@ -174,6 +176,9 @@ struct hvm_function_table {
     void (*set_info_guest)(struct vcpu *v);
     void (*set_rdtsc_exiting)(struct vcpu *v, bool_t);
     void (*set_descriptor_access_exiting)(struct vcpu *v, bool);
+    /* Let the guest make @access (HVM_MSR_PT_*) to @msr without exiting. */
+    void (*set_msr_passthrough)(struct vcpu *v, uint32_t msr,
+                                unsigned int access);
 
     /* Nested HVM */
     int (*nhvm_vcpu_initialise)(struct vcpu *v);
@@ -245,6 +250,9 @@ void hvm_domain_soft_reset(struct domain *d);
 
 int hvm_vcpu_initialise(struct vcpu *v);
 void hvm_vcpu_destroy(struct vcpu *v);
+void hvm_vmexit_account(unsigned int reason, s_time_t start);
+void hvm_msr_exit_account(uint32_t msr, bool write);
+int hvm_get_exit_stats(struct domain *d, struct xen_domctl_exit_stats *op);
 void hvm_vcpu_down(struct vcpu *v);
 int hvm_vcpu_cacheattr_init(struct vcpu *v);
 void hvm_vcpu_cacheattr_destroy(struct vcpu *v);
@@ -324,13 +332,25 @@ hvm_update_host_cr3(struct vcpu *v)
         hvm_funcs.update_host_cr3(v);
 }
 
+/*
+ * Guest CR0/CR4/EFER feed into the dynamic parts of CPUID (OSXSAVE, OSPKE,
+ * PSE36 and SYSCALL), so invalidate the cached results on any change.
+ */
+void hvm_gla_cache_begin(struct vcpu *v);
+void hvm_gla_cache_end(struct vcpu *v);
+void hvm_gla_cache_flush(struct vcpu *v);
+
 static inline void hvm_update_guest_cr(struct vcpu *v, unsigned int cr)
 {
+    cpuid_cache_flush(v);
+    hvm_gla_cache_flush(v);
     hvm_funcs.update_guest_cr(v, cr);
 }
 
 static inline void hvm_update_guest_efer(struct vcpu *v)
 {
+    cpuid_cache_flush(v);
+    hvm_gla_cache_flush(v);
     hvm_funcs.update_guest_efer(v);
 }
 
@@ -350,6 +370,8 @@ static inline void hvm_flush_guest_tlbs(void)
         hvm_asid_flush_core();
 }
 
+void hvm_flush_vcpu_tlbs(const unsigned long *vcpu_mask, unsigned int nr);
+
 void hvm_hypercall_page_initialise(struct domain *d,
                                    void *hypercall_page);
 
@@ -392,10 +414,17 @@ bool hvm_set_guest_bndcfgs(struct vcpu *v, u64 val);
 #define has_viridian_apic_assist(d) \
     (is_viridian_domain(d) && (viridian_feature_mask(d) & HVMPV_apic_assist))
 
+#define has_viridian_synic(d) \
+    (is_viridian_domain(d) && (viridian_feature_mask(d) & HVMPV_synic))
+
+#define has_viridian_stimer(d) \
+    (has_viridian_synic(d) && (viridian_feature_mask(d) & HVMPV_stimer))
+
 bool hvm_check_cpuid_faulting(struct vcpu *v);
 void hvm_migrate_timers(struct vcpu *v);
 void hvm_do_resume(struct vcpu *v);
 void hvm_migrate_pirqs(struct vcpu *v);
+void hvm_follow_pirqs(struct vcpu *v);
 
 void hvm_inject_event(const struct x86_event *event);
 
@@ -442,6 +471,11 @@ uint8_t hvm_combine_hw_exceptions(uint8_t vec1, uint8_t vec2);
 
 void hvm_set_rdtsc_exiting(struct domain *d, bool_t enable);
 
+#define HVM_MSR_PT_R  (1u << 0)
+#define HVM_MSR_PT_W  (1u << 1)
+#define HVM_MSR_PT_RW (HVM_MSR_PT_R | HVM_MSR_PT_W)
+void hvm_update_msr_passthrough(struct vcpu *v);
+
 static inline int hvm_cpu_up(void)
 {
     return (hvm_funcs.cpu_up ? hvm_funcs.cpu_up() : 0);
@@ -27,6 +27,19 @@
 
 #define NR_IO_HANDLERS 32
 
+/*
+ * Recently used intercept handlers of a vCPU, keyed by port or by gpa
+ * frame.  A slot of 0 marks an unused entry; otherwise the handler is
+ * io_handler[slot - 1].
+ */
+#define NR_IO_HANDLER_HINTS 4
+
+struct hvm_io_handler_hint {
+    uint64_t key;
+    uint8_t  type;
+    uint8_t  slot;
+};
+
 typedef int (*hvm_mmio_read_t)(struct vcpu *v,
                                unsigned long addr,
                                unsigned int length,
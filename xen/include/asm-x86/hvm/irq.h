@@ -136,6 +136,7 @@ struct hvm_gmsi_info {
     uint32_t gflags;
     int dest_vcpu_id; /* -1 :multi-dest, non-negative: dest_vcpu_id */
     bool posted; /* directly deliver to guest via VT-d PI? */
+    uint8_t remote; /* consecutive deliveries away from dest_vcpu_id */
 };
 
 struct hvm_girq_dpci_mapping {
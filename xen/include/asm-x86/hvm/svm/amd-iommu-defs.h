@@ -480,6 +480,7 @@
 #define INT_REMAP_ENTRY_VECTOR_SHIFT    16
 
 #define INV_IOMMU_ALL_PAGES_ADDRESS      ((1ULL << 63) - 1)
+#define INV_IOMMU_MAX_ORDER              18
 
 #define IOMMU_RING_BUFFER_PTR_MASK                  0x0007FFF0
 #define IOMMU_RING_BUFFER_PTR_SHIFT                 4
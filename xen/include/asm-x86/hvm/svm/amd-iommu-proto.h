@@ -84,6 +84,9 @@ void amd_iommu_flush_iotlb(u8 devfn, const struct pci_dev *pdev,
 void amd_iommu_flush_device(struct amd_iommu *iommu, uint16_t bdf);
 void amd_iommu_flush_intremap(struct amd_iommu *iommu, uint16_t bdf);
 void amd_iommu_flush_all_caches(struct amd_iommu *iommu);
+void amd_iommu_queue_flush_device(struct amd_iommu *iommu, uint16_t bdf);
+void amd_iommu_sync(struct amd_iommu *iommu);
+int __must_check amd_iommu_batch_sync(void);
 
 /* find iommu for bdf */
 struct amd_iommu *find_iommu_for_device(int seg, int bdf);
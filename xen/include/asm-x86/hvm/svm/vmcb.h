@@ -20,6 +20,7 @@
 #define __ASM_X86_HVM_SVM_VMCB_H__
 
 #include <xen/types.h>
+#include <xen/string.h>
 #include <asm/hvm/emulate.h>
 
 
@@ -543,6 +544,10 @@ void svm_intercept_msr(struct vcpu *v, uint32_t msr, int enable);
 
 /*
  * VMCB accessor functions.
+ *
+ * Setters only clear the field's clean bit if the value really changes, so
+ * that rewriting unchanged state (e.g. the TPR on every resume) doesn't
+ * force the processor to reload the whole category on the next VMRUN.
  */
 
 #define VMCB_ACCESSORS(name, cleanbit)            \
@@ -550,6 +555,9 @@ static inline void                                \
 vmcb_set_ ## name(struct vmcb_struct *vmcb,       \
                   typeof(vmcb->_ ## name) value)  \
 {                                                 \
+    if ( !memcmp(&vmcb->_ ## name, &value,        \
+                 sizeof(value)) )                 \
+        return;                                   \
     vmcb->_ ## name = value;                      \
     vmcb->cleanbits.fields.cleanbit = 0;          \
 }                                                 \
@@ -28,6 +28,7 @@
 #include <asm/hvm/svm/vmcb.h>
 #include <asm/hvm/svm/nestedsvm.h>
 #include <asm/mtrr.h>
+#include <public/domctl.h>
 
 enum hvm_io_completion {
     HVMIO_no_completion,
@@ -53,6 +54,45 @@ struct hvm_mmio_cache {
     uint8_t buffer[32];
 };
 
+/*
+ * VM exit cost accounting (see XEN_DOMCTL_get_exit_stats).  Only updated
+ * by the vCPU itself, so no locking is needed; readers sum the vCPUs of
+ * a domain and tolerate a slightly stale view.
+ */
+struct hvm_exit_stats {
+    uint64_t exits, exit_ns;
+    uint64_t emulations, emulation_ns;
+    uint64_t ioreqs, ioreq_ns;
+    s_time_t ioreq_start;       /* synchronous ioreq in flight, or 0 */
+    struct {
+        uint64_t count, ns;
+    } reason[XEN_DOMCTL_EXIT_STATS_REASONS];
+    /*
+     * MSR intercepts, by MSR, in an open-addressed table filled on first
+     * use.  Exits for MSRs which find it full only count in msr_other.
+     */
+#define HVM_EXIT_STATS_MSRS 32
+    struct {
+        uint32_t msr;           /* 0 for a free slot */
+        uint64_t reads, writes;
+    } msr[HVM_EXIT_STATS_MSRS];
+    uint64_t msr_other;
+};
+
+/* See hvm_translate_get_page_cached(). */
+#define HVM_GLA_CACHE_ENTRIES 16
+
+struct hvm_gla_cache {
+    unsigned int gen;       /* Current hypercall; 0 when not in one. */
+    unsigned int next_gen;
+    struct hvm_gla_cache_entry {
+        unsigned long gla_pfn;
+        gfn_t gfn;
+        unsigned int gen;
+        bool write;         /* Walked with PFEC_write_access. */
+    } ent[HVM_GLA_CACHE_ENTRIES];
+};
+
 struct hvm_vcpu_io {
     /* I/O request in flight to device model. */
     enum hvm_io_completion io_completion;
@@ -89,6 +129,32 @@ struct hvm_vcpu_io {
     unsigned long msix_snoop_gpa;
 
     const struct g2m_ioport *g2m_ioport;
+
+    /* Valid while io_handler_hint_gen matches the domain's io_handler_gen. */
+    struct hvm_io_handler_hint io_handler_hint[NR_IO_HANDLER_HINTS];
+    unsigned int io_handler_hint_gen;
+    unsigned int io_handler_hint_next;
+
+    /*
+     * Last ioreq server selected for this vCPU, valid while ioreq_server_gen
+     * matches the domain's ioreq server generation.
+     */
+    struct hvm_ioreq_server *ioreq_server_hint;
+    unsigned int ioreq_server_gen;
+
+    /*
+     * Translation of the last emulated instruction's fetch address, used
+     * in place of a guest page walk when the same instruction traps again.
+     * Like a TLB entry, it is dropped by any guest TLB flush: that bumps
+     * insn_fetch_flushes, and the entry is valid only while gen matches.
+     */
+    struct {
+        unsigned long cr3, addr;
+        paddr_t gpa;
+        uint32_t pfec;
+        unsigned int gen;
+    } insn_fetch;
+    unsigned int insn_fetch_flushes;
 };
 
 static inline bool_t hvm_vcpu_io_need_completion(const struct hvm_vcpu_io *vio)
@@ -97,6 +163,11 @@ static inline bool_t hvm_vcpu_io_need_completion(const struct hvm_vcpu_io *vio)
            !vio->io_req.data_is_ptr;
 }
 
+static inline void hvm_vcpu_io_flush_insn_fetch(struct hvm_vcpu_io *vio)
+{
+    write_atomic(&vio->insn_fetch_flushes, vio->insn_fetch_flushes + 1);
+}
+
 struct nestedvcpu {
     bool_t nv_guestmode; /* vcpu in guestmode? */
     void *nv_vvmcx; /* l1 guest virtual VMCB/VMCS */
@@ -164,6 +235,9 @@ struct hvm_vcpu {
     spinlock_t          tm_lock;
     struct list_head    tm_list;
 
+    /* When passthrough MSIs last followed this vCPU to a new pCPU. */
+    s_time_t            pirq_follow_time;
+
     bool                flag_dr_dirty;
     bool                debug_state_latch;
     bool                single_step;
@@ -174,6 +248,9 @@ struct hvm_vcpu {
     u64                 msr_tsc_adjust;
     u64                 msr_xss;
 
+    /* Guest linear translations reused by hypercall buffer copies. */
+    struct hvm_gla_cache *gla_cache;
+
     union {
         struct arch_vmx_struct vmx;
         struct arch_svm_struct svm;
@@ -198,6 +275,8 @@ struct hvm_vcpu {
 
     struct hvm_vcpu_io  hvm_io;
 
+    struct hvm_exit_stats *exit_stats;
+
     /* Callback into x86_emulate when emulating FPU/MMX/XMM instructions. */
     void (*fpu_exception_callback)(void *, struct cpu_user_regs *);
     void *fpu_exception_callback_arg;
@@ -134,6 +134,7 @@ void vlapic_EOI_set(struct vlapic *vlapic);
 void vlapic_handle_EOI(struct vlapic *vlapic, u8 vector);
 
 void vlapic_ipi(struct vlapic *vlapic, uint32_t icr_low, uint32_t icr_high);
+bool vlapic_x2apic_ipi_fast(struct vcpu *v, uint64_t msr_content);
 
 int vlapic_apicv_write(struct vcpu *v, unsigned int offset);
 
@@ -55,10 +55,19 @@ struct ept_data {
     };
     /* Set of PCPUs needing an INVEPT before a VMENTER. */
     cpumask_var_t invalidate;
+    /* Host p2m: background resolution of invalidated entries. */
+    unsigned long sweep_gfn;
+    bool sweep;
+    /* Host p2m: root of the sub-page permission table, if any. */
+    mfn_t sppt;
+    /* Host p2m: users sampling A bits (NUMA balancing, paging). */
+    unsigned int track_accessed;
 };
 
 #define _VMX_DOMAIN_PML_ENABLED    0
 #define VMX_DOMAIN_PML_ENABLED     (1ul << _VMX_DOMAIN_PML_ENABLED)
+#define _VMX_DOMAIN_SPP_ENABLED    1
+#define VMX_DOMAIN_SPP_ENABLED     (1ul << _VMX_DOMAIN_SPP_ENABLED)
 struct vmx_domain {
     unsigned long apic_access_mfn;
     /* VMX_DOMAIN_* */
@@ -248,6 +257,7 @@ extern u32 vmx_vmentry_control;
 #define SECONDARY_EXEC_ENABLE_PML               0x00020000
 #define SECONDARY_EXEC_ENABLE_VIRT_EXCEPTIONS   0x00040000
 #define SECONDARY_EXEC_XSAVES                   0x00100000
+#define SECONDARY_EXEC_ENABLE_SPP               0x00800000
 #define SECONDARY_EXEC_TSC_SCALING              0x02000000
 extern u32 vmx_secondary_exec_control;
 
@@ -325,6 +335,8 @@ extern u64 vmx_ept_vpid_cap;
     (vmx_secondary_exec_control & SECONDARY_EXEC_XSAVES)
 #define cpu_has_vmx_tsc_scaling \
     (vmx_secondary_exec_control & SECONDARY_EXEC_TSC_SCALING)
+#define cpu_has_vmx_spp \
+    (vmx_secondary_exec_control & SECONDARY_EXEC_ENABLE_SPP)
 
 #define VMCS_RID_TYPE_MASK              0x80000000
 
@@ -401,6 +413,7 @@ enum vmcs_field {
     VMWRITE_BITMAP                  = 0x00002028,
     VIRT_EXCEPTION_INFO             = 0x0000202a,
     XSS_EXIT_BITMAP                 = 0x0000202c,
+    SPPT_POINTER                    = 0x00002030,
     TSC_MULTIPLIER                  = 0x00002032,
     GUEST_PHYSICAL_ADDRESS          = 0x00002400,
     VMCS_LINK_POINTER               = 0x00002800,
@@ -579,6 +592,10 @@ int vmx_domain_enable_pml(struct domain *d);
 void vmx_domain_disable_pml(struct domain *d);
 void vmx_domain_flush_pml_buffers(struct domain *d);
 
+int vmx_vcpu_enable_spp(struct vcpu *v);
+bool vmx_domain_spp_enabled(const struct domain *d);
+int vmx_domain_enable_spp(struct domain *d);
+
 void vmx_domain_update_eptp(struct domain *d);
 
 #endif /* ASM_X86_HVM_VMX_VMCS_H__ */
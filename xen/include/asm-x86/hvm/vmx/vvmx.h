@@ -51,6 +51,13 @@ struct nestedvmx {
     } ept;
     uint32_t guest_vpid;
     struct list_head launched_list;
+    /*
+     * Without VMCS shadowing every VMWRITE of L1 gets emulated, so we can
+     * tell which guest state fields it changed since they were copied back
+     * from the shadow VMCS, and only load those on the next VM entry.
+     */
+    bool     gstate_synced;
+    uint64_t gstate_dirty;
 };
 
 #define vcpu_2_nvmx(v)	(vcpu_nestedhvm(v).u.nvmx)
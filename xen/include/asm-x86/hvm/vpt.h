@@ -39,7 +39,6 @@ struct periodic_time {
     struct list_head list;
     bool_t on_list;
     bool_t one_shot;
-    bool_t do_not_freeze;
     bool_t irq_issued;
     bool_t warned_timeout_too_short;
 #define PTSRC_isa    1 /* ISA time source */
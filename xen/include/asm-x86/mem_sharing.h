@@ -54,6 +54,9 @@ struct page_sharing_info
 #define sharing_supported(_d) \
     (is_hvm_domain(_d) && paging_mode_hap(_d)) 
 
+#define mem_sharing_is_fork(_d) \
+    (is_hvm_domain(_d) && (_d)->arch.hvm_domain.fork_parent != NULL)
+
 unsigned int mem_sharing_get_nr_saved_mfns(void);
 unsigned int mem_sharing_get_nr_shared_mfns(void);
 
@@ -85,6 +88,15 @@ static inline int mem_sharing_unshare_page(struct domain *d,
  */
 int mem_sharing_notify_enomem(struct domain *d, unsigned long gfn,
                                 bool_t allow_sleep);
+
+/* Populate a hole of a fork from its parent, with the p2m of the fork
+ * locked.  Reads share the parent's page, writes get a private copy.
+ * Fails with -ENOENT if the parent has no RAM at the gfn either.
+ */
+int mem_sharing_fork_page(struct domain *d, gfn_t gfn, bool unsharing);
+/* Drop the reference a fork holds on its parent, unpausing it. */
+void mem_sharing_fork_release(struct domain *d);
+
 int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg);
 int mem_sharing_domctl(struct domain *d, 
                        struct xen_domctl_mem_sharing_op *mec);
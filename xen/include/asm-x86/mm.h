@@ -278,7 +278,7 @@ struct page_info
 #define PRtype_info "016lx"/* should only be used for printk's */
 
 /* The number of out-of-sync shadows we allow per vcpu (prime, please) */
-#define SHADOW_OOS_PAGES 3
+#define SHADOW_OOS_PAGES 7
 
 /* OOS fixup entries */
 #define SHADOW_OOS_FIXUPS 2
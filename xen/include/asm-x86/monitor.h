@@ -38,6 +38,9 @@ void arch_monitor_allow_userspace(struct domain *d, bool allow_userspace)
     d->arch.monitor.guest_request_userspace_enabled = allow_userspace;
 }
 
+int arch_monitor_set_access_filter(struct domain *d,
+                                   const struct xen_domctl_monitor_op *mop);
+
 static inline
 int arch_monitor_domctl_op(struct domain *d, struct xen_domctl_monitor_op *mop)
 {
@@ -59,6 +62,10 @@ int arch_monitor_domctl_op(struct domain *d, struct xen_domctl_monitor_op *mop)
         domain_unpause(d);
         break;
 
+    case XEN_DOMCTL_MONITOR_OP_SET_ACCESS_FILTER:
+        rc = arch_monitor_set_access_filter(d, mop);
+        break;
+
     default:
         rc = -EOPNOTSUPP;
     }
@@ -105,4 +112,7 @@ void arch_monitor_cleanup_domain(struct domain *d);
 
 bool monitored_msr(const struct domain *d, u32 msr);
 
+int monitor_access_filter(const struct domain *d, unsigned long gfn,
+                          unsigned int access);
+
 #endif /* __ASM_X86_MONITOR_H__ */
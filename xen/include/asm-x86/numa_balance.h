@@ -0,0 +1,37 @@
+/******************************************************************************
+ * include/asm-x86/numa_balance.h
+ *
+ * Automatic NUMA balancing of HVM guest memory.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ASM_X86_NUMA_BALANCE_H__
+#define __ASM_X86_NUMA_BALANCE_H__
+
+#include <public/domctl.h>
+
+int numa_balance_domctl(struct domain *d, struct xen_domctl_numa_balance *op);
+void numa_balance_disable(struct domain *d);
+
+#endif /*__ASM_X86_NUMA_BALANCE_H__ */
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -252,6 +252,13 @@ struct p2m_domain {
     void               (*enable_hardware_log_dirty)(struct p2m_domain *p2m);
     void               (*disable_hardware_log_dirty)(struct p2m_domain *p2m);
     void               (*flush_hardware_cached_dirty)(struct p2m_domain *p2m);
+    int                (*set_subpage_write)(struct p2m_domain *p2m,
+                                            gfn_t gfn, uint32_t write);
+    int                (*track_accessed)(struct p2m_domain *p2m, bool enable);
+    unsigned int       (*test_clear_accessed)(struct p2m_domain *p2m,
+                                              unsigned long gfn,
+                                              unsigned int nr,
+                                              unsigned long *accessed);
     void               (*change_entry_type_global)(struct p2m_domain *p2m,
                                                    p2m_type_t ot,
                                                    p2m_type_t nt);
@@ -294,6 +301,15 @@ struct p2m_domain {
     /* Highest guest frame that's ever been mapped in the p2m */
     unsigned long max_mapped_pfn;
 
+    /* Host p2m: the pager samples the A bits. */
+    bool paging_accessed;
+
+    /* Host p2m: superpage recoalescing progress and statistics. */
+    struct {
+        unsigned long next_gfn;
+        unsigned long merged_2m, merged_1g;
+    } recoalesce;
+
     /*
      * Alternate p2m's only: range of gfn's for which underlying
      * mfn may have duplicate mappings
@@ -301,6 +317,12 @@ struct p2m_domain {
     unsigned long min_remapped_gfn;
     unsigned long max_remapped_gfn;
 
+    /*
+     * Alternate p2m's only: lowest gfn ever given a valid mapping.  Along
+     * with max_mapped_pfn this bounds the entries a view may hold.
+     */
+    unsigned long min_mapped_pfn;
+
     /* When releasing shared gfn's in a preemptible manner, recall where
      * to resume the search */
     unsigned long next_shared_gfn_to_relinquish;
@@ -467,6 +489,13 @@ static inline mfn_t get_gfn_query_unlocked(struct domain *d,
     return __get_gfn_type_access(p2m_get_hostp2m(d), gfn, t, &a, 0, NULL, 0);
 }
 
+/* Query a GFN under the p2m read lock, so concurrent queries don't
+ * serialise.  The result is a snapshot: the entry may change as soon as
+ * this returns, and no page reference is taken.  For callers that only
+ * decide on the entry's type and access, like the page fault fast path. */
+mfn_t __nonnull(3, 4) p2m_get_gfn_type_access_shared(
+    struct p2m_domain *p2m, gfn_t gfn, p2m_type_t *t, p2m_access_t *a);
+
 /* Atomically look up a GFN and take a reference count on the backing page.
  * This makes sure the page doesn't get freed (or shared) underfoot,
  * and should be used by any path that intends to write to the backing page.
@@ -679,6 +708,11 @@ void p2m_mem_paging_populate(struct domain *d, unsigned long gfn);
 int p2m_mem_paging_prep(struct domain *d, unsigned long gfn, uint64_t buffer);
 /* Resume normal operation (in case a domain was paused) */
 void p2m_mem_paging_resume(struct domain *d, vm_event_response_t *rsp);
+/* Report and clear the A bits of a range of gfns */
+int p2m_mem_paging_harvest_accessed(struct domain *d, unsigned long gfn,
+                                    unsigned int nr, uint64_t buffer);
+/* Stop sampling A bits for the pager; domain paused */
+void p2m_mem_paging_disable(struct domain *d);
 
 /* 
  * Internal functions, only called by other p2m code
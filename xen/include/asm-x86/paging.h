@@ -140,12 +140,6 @@ struct paging_mode {
 /*****************************************************************************
  * Log dirty code */
 
-/* get the dirty bitmap for a specific range of pfns */
-void paging_log_dirty_range(struct domain *d,
-                            unsigned long begin_pfn,
-                            unsigned long nr,
-                            uint8_t *dirty_bitmap);
-
 /* enable log dirty */
 int paging_log_dirty_enable(struct domain *d, bool_t log_global);
 
@@ -157,6 +151,9 @@ void paging_mark_dirty(struct domain *d, mfn_t gmfn);
 /* mark a page as dirty with taking guest pfn as parameter */
 void paging_mark_pfn_dirty(struct domain *d, pfn_t pfn);
 
+/* Fold the pages marked dirty since the last sample into the dirty rate. */
+void paging_log_dirty_sample(struct domain *d);
+
 /* is this guest page dirty? 
  * This is called from inside paging code, with the paging lock held. */
 int paging_mfn_is_dirty(struct domain *d, mfn_t gmfn);
@@ -12,11 +12,19 @@ PERFCOUNTER_ARRAY(cause_vector,         "cause vector", VMX_PERF_VECTOR_SIZE)
 #define VMEXIT_NPF_PERFC 141
 #define SVM_PERF_EXIT_REASON_SIZE (1+141)
 PERFCOUNTER_ARRAY(svmexits,             "SVMexits", SVM_PERF_EXIT_REASON_SIZE)
+#define SVM_PERF_CLEANBITS_SIZE 11
+PERFCOUNTER_ARRAY(svm_vmcb_reload,      "SVM VMCB reloads", SVM_PERF_CLEANBITS_SIZE)
+PERFCOUNTER(svm_vmcb_reload_full,       "SVM VMCB full reloads")
+PERFCOUNTER(svm_vmcb_clean_switch,      "SVM VMCB clean across ctxt switch")
 
 PERFCOUNTER(seg_fixups,             "segmentation fixups")
 
 PERFCOUNTER(apic_timer,             "apic timer interrupts")
 
+PERFCOUNTER(fpu_save,               "FPU state saves")
+PERFCOUNTER(fpu_restore,            "FPU state restores")
+PERFCOUNTER(fpu_preload,            "FPU state preloads")
+
 PERFCOUNTER(domain_page_tlb_flush,  "domain page tlb flushes")
 
 PERFCOUNTER(calls_to_mmuext_op,         "calls to mmuext_op")
@@ -29,6 +37,8 @@ PERFCOUNTER(page_faults,            "page faults")
 PERFCOUNTER(copy_user_faults,       "copy_user faults")
 
 PERFCOUNTER(map_domain_page_count,  "map_domain_page count")
+PERFCOUNTER(map_domain_page_hit,    "map_domain_page hits")
+PERFCOUNTER(map_domain_page_miss,   "map_domain_page misses")
 PERFCOUNTER(ptwr_emulations,        "writable pt emulations")
 PERFCOUNTER(mmio_ro_emulations,     "mmio ro emulations")
 
@@ -111,6 +121,7 @@ PERFCOUNTER(shadow_oos_fixup_evict,"shadow OOS fixup evictions")
 PERFCOUNTER(shadow_unsync,         "shadow OOS unsyncs")
 PERFCOUNTER(shadow_unsync_evict,   "shadow OOS evictions")
 PERFCOUNTER(shadow_resync,         "shadow OOS resyncs")
+PERFCOUNTER(shadow_resync_batch_flush, "shadow OOS batched resync flushes")
 
 PERFCOUNTER(mshv_call_sw_addr_space,    "MS Hv Switch Address Space")
 PERFCOUNTER(mshv_call_flush_tlb_list,   "MS Hv Flush TLB list")
@@ -137,10 +148,53 @@ PERFCOUNTER(mshv_wrmsr_eoi,             "MS Hv wrmsr eoi")
 PERFCOUNTER(mshv_wrmsr_apic_assist,     "MS Hv wrmsr APIC assist")
 PERFCOUNTER(mshv_wrmsr_apic_msr,        "MS Hv wrmsr APIC msr")
 PERFCOUNTER(mshv_wrmsr_tsc_msr,         "MS Hv wrmsr TSC msr")
+PERFCOUNTER(mshv_rdmsr_synic,           "MS Hv rdmsr SynIC")
+PERFCOUNTER(mshv_wrmsr_synic,           "MS Hv wrmsr SynIC")
+PERFCOUNTER(mshv_wrmsr_eom,             "MS Hv wrmsr EOM")
+PERFCOUNTER(mshv_rdmsr_stimer,          "MS Hv rdmsr stimer")
+PERFCOUNTER(mshv_wrmsr_stimer,          "MS Hv wrmsr stimer")
+PERFCOUNTER(mshv_stimer_expire,         "MS Hv stimer expired")
+PERFCOUNTER(mshv_stimer_msg_busy,       "MS Hv stimer message slot busy")
 
 PERFCOUNTER(realmode_emulations, "realmode instructions emulated")
 PERFCOUNTER(realmode_exits,      "vmexits from realmode")
 
 PERFCOUNTER(pauseloop_exits, "vmexits from Pause-Loop Detection")
 
+PERFCOUNTER(hvm_io_handler_hit,  "hvm io handler lookups avoided")
+PERFCOUNTER(hvm_io_handler_scan, "hvm io handler lookups scanned")
+PERFCOUNTER(hvm_insn_fetch_hit,  "hvm insn fetches without page walk")
+PERFCOUNTER(hvmop_flush_vcpu_tlbs, "HVMOP flush vcpu TLBs")
+
+PERFCOUNTER(pi_wakeup,         "PI wakeup interrupts")
+PERFCOUNTER(pi_wakeup_scanned, "PI wakeup blocked vCPUs scanned")
+PERFCOUNTER(pi_wakeup_woken,   "PI wakeup vCPUs woken")
+PERFCOUNTER(pi_block_remote,   "PI blocked vCPUs parked on another pCPU")
+
+PERFCOUNTER(pod_sweep,          "PoD emergency sweeps")
+PERFCOUNTER(pod_sweep_scanned,  "PoD sweep p2m entries scanned")
+PERFCOUNTER(pod_zero_checked,   "PoD pages zero-checked")
+PERFCOUNTER(pod_zero_reclaimed, "PoD zero pages reclaimed")
+
+PERFCOUNTER(mem_access_filtered, "mem_access violations emulated by filter")
+
+PERFCOUNTER(time_calibration_rendezvous, "time calibration rendezvous")
+PERFCOUNTER(time_calibration_us,         "time calibration rendezvous us")
+PERFCOUNTER(time_calibration_skipped,    "time calibrations without rendezvous")
+
+PERFCOUNTER(dpci_msi_remote,             "dpci MSIs on a remote pCPU")
+PERFCOUNTER(dpci_msi_follow,             "dpci MSIs moved to their vCPU")
+PERFCOUNTER(pirq_follow_holdoff,         "pirq follow skipped (holdoff)")
+PERFCOUNTER(irte_update_skipped,         "unchanged IRTE updates skipped")
+
+PERFCOUNTER(amd_iommu_comp_wait,         "AMD IOMMU completion waits")
+PERFCOUNTER(amd_iommu_inv_posted,        "AMD IOMMU invalidations posted")
+PERFCOUNTER(amd_iommu_inv_merged,        "AMD IOMMU page flushes merged")
+
+PERFCOUNTER(cpuid_cache_hit,             "guest cpuid cache hits")
+PERFCOUNTER(cpuid_cache_miss,            "guest cpuid cache misses")
+
+PERFCOUNTER(hvm_gla_cache_hit,           "hypercall copy gla cache hits")
+PERFCOUNTER(hvm_gla_cache_miss,          "hypercall copy gla cache misses")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
@@ -0,0 +1,24 @@
+/*
+ * pmu_sample.h: host-wide sampling profiler on the hardware PMU.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+#ifndef __ASM_X86_PMU_SAMPLE_H__
+#define __ASM_X86_PMU_SAMPLE_H__
+
+#include <xen/types.h>
+
+struct cpu_user_regs;
+struct xen_sysctl_pmu_sample;
+
+bool pmu_sample_interrupt(const struct cpu_user_regs *regs);
+int pmu_sample_op(struct xen_sysctl_pmu_sample *op);
+
+#endif /* __ASM_X86_PMU_SAMPLE_H__ */
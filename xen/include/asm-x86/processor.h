@@ -139,6 +139,7 @@ struct cpuinfo_x86 {
     __u32 phys_proc_id;    /* package ID of each logical CPU */
     __u32 cpu_core_id;     /* core ID of each logical CPU*/
     __u32 compute_unit_id; /* AMD compute unit ID of each logical CPU */
+    __u32 cpu_llc_id;      /* last level cache ID of each logical CPU */
     unsigned short x86_clflush_size;
 } __cacheline_aligned;
 
@@ -179,6 +180,7 @@ extern void detect_ht(struct cpuinfo_x86 *c);
 
 #define cpu_to_core(_cpu)   (cpu_data[_cpu].cpu_core_id)
 #define cpu_to_socket(_cpu) (cpu_data[_cpu].phys_proc_id)
+#define cpu_to_llc(_cpu)    (cpu_data[_cpu].cpu_llc_id)
 
 unsigned int apicid_to_socket(unsigned int);
 
@@ -551,6 +553,11 @@ int wrmsr_hypervisor_regs(uint32_t idx, uint64_t val);
 
 void microcode_set_module(unsigned int);
 int microcode_update(XEN_GUEST_HANDLE_PARAM(const_void), unsigned long len);
+struct xenpf_ucode_cpu_stat;
+int microcode_update_parallel(XEN_GUEST_HANDLE_PARAM(const_void),
+                              unsigned long len,
+                              struct xenpf_ucode_cpu_stat *stats,
+                              unsigned int nr_stats, uint64_t *total_ns);
 int microcode_resume_cpu(unsigned int cpu);
 int early_microcode_update_cpu(bool start_update);
 int early_microcode_init(void);
@@ -68,8 +68,13 @@ static inline bool_t psr_cmt_enabled(void)
     return !!psr_cmt;
 }
 
+struct xen_sysctl_psr_cmt_sample;
+
 int psr_alloc_rmid(struct domain *d);
 void psr_free_rmid(struct domain *d);
+int psr_cmt_get_samples(unsigned int socket,
+                        struct xen_sysctl_psr_cmt_sample *samples,
+                        unsigned int *nr, uint64_t *tsc);
 void psr_ctxt_switch_to(struct domain *d);
 
 int psr_get_info(unsigned int socket, enum cbm_type type,
@@ -0,0 +1,31 @@
+/*
+ * stack_sample.h: timer driven sampling of Xen's call stacks.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+#ifndef __ASM_X86_STACK_SAMPLE_H__
+#define __ASM_X86_STACK_SAMPLE_H__
+
+#include <xen/time.h>
+
+struct cpu_user_regs;
+
+extern s_time_t stack_sample_period;
+
+void stack_sample_record(const struct cpu_user_regs *regs);
+
+/* Called from the local APIC timer interrupt. */
+static inline void stack_sample_tick(const struct cpu_user_regs *regs)
+{
+    if ( unlikely(stack_sample_period) )
+        stack_sample_record(regs);
+}
+
+#endif /* __ASM_X86_STACK_SAMPLE_H__ */
@@ -112,6 +112,8 @@ void vpmu_destroy(struct vcpu *v);
 void vpmu_save(struct vcpu *v);
 int vpmu_load(struct vcpu *v, bool_t from_guest);
 void vpmu_dump(struct vcpu *v);
+int vpmu_claim_hw(void);
+void vpmu_release_hw(void);
 
 static inline int vpmu_do_wrmsr(unsigned int msr, uint64_t msr_content,
                                 uint64_t supported)
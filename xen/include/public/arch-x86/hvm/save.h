@@ -602,6 +602,14 @@ struct hvm_viridian_vcpu_context {
     uint64_t vp_assist_msr;
     uint8_t  vp_assist_vector;
     uint8_t  _pad[7];
+    uint64_t scontrol_msr;
+    uint64_t siefp_msr;
+    uint64_t simp_msr;
+    uint64_t sint_msr[16];
+    uint64_t stimer_config_msr[4];
+    uint64_t stimer_count_msr[4];
+    uint8_t  stimer_pending;
+    uint8_t  _pad1[7];
 };
 
 DECLARE_HVM_SAVE_TYPE(VIRIDIAN_VCPU, 17, struct hvm_viridian_vcpu_context);
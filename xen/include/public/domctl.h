@@ -174,6 +174,25 @@ struct xen_domctl_getpageframeinfo3 {
 #define XEN_DOMCTL_SHADOW_OP_CLEAN       11
  /* Return the bitmap but do not modify internal copy. */
 #define XEN_DOMCTL_SHADOW_OP_PEEK        12
+ /*
+  * Return the estimated rate, in pages per second, at which the domain is
+  * dirtying memory in @pages.  Log-dirty mode must be enabled.  Does not
+  * modify the bitmap.
+  */
+#define XEN_DOMCTL_SHADOW_OP_GET_DIRTY_RATE 13
+ /*
+  * Sparse variants of PEEK and CLEAN, restricted to the @pages pfns starting
+  * at @start_pfn (both multiples of 8).  Rather than the whole bitmap, only
+  * the chunks of XEN_DOMCTL_SHADOW_CHUNK_PAGES pfns with a dirty page in the
+  * range are returned: chunk i has its first pfn in @chunk_pfns[i] and its
+  * bitmap at offset i * XEN_DOMCTL_SHADOW_CHUNK_BYTES of @dirty_bitmap, with
+  * bits outside the range clear.  On return @nr_chunks is the number of
+  * chunks written and @pages the number of pfns covered, which is less than
+  * requested if the chunk buffers filled up.  CLEAN_SPARSE cleans only the
+  * pfns covered.
+  */
+#define XEN_DOMCTL_SHADOW_OP_PEEK_SPARSE  14
+#define XEN_DOMCTL_SHADOW_OP_CLEAN_SPARSE 15
 
 /* Memory allocation accessors. */
 #define XEN_DOMCTL_SHADOW_OP_GET_ALLOCATION   30
@@ -238,7 +257,14 @@ struct xen_domctl_shadow_op {
     XEN_GUEST_HANDLE_64(uint8) dirty_bitmap;
     uint64_aligned_t pages; /* Size of buffer. Updated with actual size. */
     struct xen_domctl_shadow_op_stats stats;
+
+    /* OP_PEEK_SPARSE / OP_CLEAN_SPARSE */
+    uint64_aligned_t start_pfn;
+    XEN_GUEST_HANDLE_64(uint64) chunk_pfns;
+    uint32_t       nr_chunks; /* Size of buffers.  Updated with chunks used. */
 };
+#define XEN_DOMCTL_SHADOW_CHUNK_BYTES 4096
+#define XEN_DOMCTL_SHADOW_CHUNK_PAGES (XEN_DOMCTL_SHADOW_CHUNK_BYTES * 8)
 
 
 /* XEN_DOMCTL_max_mem */
@@ -264,6 +290,7 @@ struct xen_domctl_getvcpuinfo {
     uint8_t  online;                  /* currently online (not hotplugged)? */
     uint8_t  blocked;                 /* blocked waiting for an event? */
     uint8_t  running;                 /* currently scheduled on its CPU? */
+    uint8_t  waiting;                 /* waiting for a CPU to be assigned? */
     uint64_aligned_t cpu_time;        /* total cpu time consumed (ns) */
     uint32_t cpu;                     /* current mapping   */
 };
@@ -827,6 +854,24 @@ struct xen_domctl_vm_event_op {
     uint32_t       mode;         /* XEN_DOMCTL_VM_EVENT_OP_* */
 
     uint32_t port;              /* OUT: event channel for ring */
+
+    /*
+     * XEN_VM_EVENT_ENABLE only: the number of rings to set up, at most one
+     * per vCPU.  0 or 1 set up the single ring at the gfn held in the
+     * HVM_PARAM_*_RING_PFN of the mode, and 'ring_gfns' and 'ports' are
+     * ignored.
+     *
+     * With more rings, vCPU n posts its events to ring (n % nr_rings) and
+     * events raised from outside the domain go to ring 0.  'ring_gfns'
+     * gives the gfn of each ring page and 'ports' receives the event
+     * channel of each ring, 'port' being that of ring 0.  A notification
+     * on a ring's event channel only pulls responses from that ring, so
+     * that the rings can be consumed independently.  XEN_VM_EVENT_RESUME
+     * pulls responses from all of them.
+     */
+    uint32_t nr_rings;                          /* IN */
+    XEN_GUEST_HANDLE_64(xen_pfn_t) ring_gfns;   /* IN */
+    XEN_GUEST_HANDLE_64(uint32) ports;          /* OUT */
 };
 
 /*
@@ -1002,6 +1047,21 @@ struct xen_domctl_psr_cmt_op {
 #define XEN_DOMCTL_MONITOR_OP_DISABLE           1
 #define XEN_DOMCTL_MONITOR_OP_GET_CAPABILITIES  2
 #define XEN_DOMCTL_MONITOR_OP_EMULATE_EACH_REP  3
+/*
+ * Set up mem_access filter number @event: what to do with mem_access
+ * violations in [gfn_start, gfn_end] whose access type is in @access.
+ * Filters are tried in ascending order and the first match wins; a
+ * violation no filter matches is sent to the monitor.  Violations a
+ * filter emulates are handled in the hypervisor, without a request on
+ * the ring.  An @access of 0 disables the filter.
+ */
+#define XEN_DOMCTL_MONITOR_OP_SET_ACCESS_FILTER 4
+
+#define XEN_DOMCTL_MONITOR_ACCESS_FILTERS       8
+
+#define XEN_DOMCTL_MONITOR_FILTER_SEND            0
+#define XEN_DOMCTL_MONITOR_FILTER_EMULATE         1
+#define XEN_DOMCTL_MONITOR_FILTER_EMULATE_NOWRITE 2
 
 #define XEN_DOMCTL_MONITOR_EVENT_WRITE_CTRLREG         0
 #define XEN_DOMCTL_MONITOR_EVENT_MOV_TO_MSR            1
@@ -1062,6 +1122,17 @@ struct xen_domctl_monitor_op {
             /* Pause vCPU until response */
             uint8_t sync;
         } debug_exception;
+
+        struct {
+            /* MEM_ACCESS_R/W/X, from public/vm_event.h */
+            uint8_t access;
+            /* XEN_DOMCTL_MONITOR_FILTER_* */
+            uint8_t action;
+            uint16_t pad1;
+            uint32_t pad2;
+            uint64_aligned_t gfn_start;
+            uint64_aligned_t gfn_end;
+        } access_filter;
     } u;
 };
 
@@ -1105,6 +1176,100 @@ struct xen_domctl_vuart_op {
                                  */
 };
 
+/*
+ * XEN_DOMCTL_get_exit_stats
+ *
+ * Return the VM exit cost accounting of an HVM domain, summed over its
+ * vCPUs: exits and the time spent handling them, per exit reason and in
+ * total, instructions emulated and the time spent in the emulator, and
+ * synchronous ioreqs sent to device models with the time the vCPU waited
+ * for their completion.  Times are in ns.
+ *
+ * 'reasons' is indexed by VMX basic exit reason, or by SVM exit code with
+ * VMEXIT_NPF at XEN_DOMCTL_EXIT_STATS_NPF.  On input 'nr_reasons' is the
+ * number of entries 'reasons' has room for; on output it is the number
+ * of reasons tracked.  'reasons' may be null to fetch only the totals.
+ *
+ * 'msrs' likewise receives up to 'nr_msrs' entries of RDMSR/WRMSR exit
+ * counts by MSR, in no particular order; on output 'nr_msrs' is the
+ * number of distinct MSRs recorded.  Exits for MSRs beyond what Xen
+ * tracks are summed in 'msr_other'.  'msrs' may be null.
+ */
+#define XEN_DOMCTL_EXIT_STATS_NPF      142
+#define XEN_DOMCTL_EXIT_STATS_REASONS  (XEN_DOMCTL_EXIT_STATS_NPF + 1)
+struct xen_domctl_exit_reason {
+    uint64_aligned_t count;
+    uint64_aligned_t ns;
+};
+typedef struct xen_domctl_exit_reason xen_domctl_exit_reason_t;
+DEFINE_XEN_GUEST_HANDLE(xen_domctl_exit_reason_t);
+
+#define XEN_DOMCTL_EXIT_STATS_MSRS     64
+struct xen_domctl_exit_msr {
+    uint32_t msr;
+    uint32_t pad;
+    uint64_aligned_t reads;
+    uint64_aligned_t writes;
+};
+typedef struct xen_domctl_exit_msr xen_domctl_exit_msr_t;
+DEFINE_XEN_GUEST_HANDLE(xen_domctl_exit_msr_t);
+
+struct xen_domctl_exit_stats {
+    uint32_t nr_reasons;               /* IN/OUT */
+    uint32_t pad;
+    uint64_aligned_t exits;            /* OUT */
+    uint64_aligned_t exit_ns;          /* OUT */
+    uint64_aligned_t emulations;       /* OUT */
+    uint64_aligned_t emulation_ns;     /* OUT */
+    uint64_aligned_t ioreqs;           /* OUT */
+    uint64_aligned_t ioreq_ns;         /* OUT */
+    XEN_GUEST_HANDLE_64(xen_domctl_exit_reason_t) reasons; /* OUT */
+    uint32_t nr_msrs;                  /* IN/OUT */
+    uint32_t pad2;
+    uint64_aligned_t msr_other;        /* OUT */
+    XEN_GUEST_HANDLE_64(xen_domctl_exit_msr_t) msrs;       /* OUT */
+};
+
+/*
+ * XEN_DOMCTL_numa_balance
+ *
+ * Automatic NUMA balancing of an HVM domain's memory (x86 with EPT A/D
+ * bits only).  Every second, Xen tests and clears the accessed bits of
+ * part of the domain's p2m, and moves the pages found accessed to the
+ * node most of the domain's vCPUs run on, if that node is in the domain's
+ * node affinity.  Domains with passthrough devices, in log-dirty mode or
+ * using altp2m are left alone.
+ *
+ * XEN_DOMCTL_NUMA_BALANCE_SET: 'rate' is the maximum number of pages moved
+ * per second, 0 to stop balancing.  Setting a rate resets the statistics.
+ *
+ * XEN_DOMCTL_NUMA_BALANCE_GET: returns the current rate and statistics:
+ *  - scanned: p2m entries whose accessed bit was sampled,
+ *  - accessed: of those, the ones found accessed,
+ *  - remote: of those, the ones not on the node the vCPUs run on,
+ *  - migrated: pages moved,
+ *  - failed: pages that could not be moved (e.g. mapped by a device model
+ *    or granted), or for which memory on the target node ran out.
+ *   'node_pages', if not null, receives the number of pages of the domain
+ *   on each node, as seen by the last complete pass over its p2m.  On input
+ *   'num_nodes' is the number of entries it has room for, on output the
+ *   number of nodes of the host.
+ */
+#define XEN_DOMCTL_NUMA_BALANCE_SET    0
+#define XEN_DOMCTL_NUMA_BALANCE_GET    1
+struct xen_domctl_numa_balance {
+    uint32_t op;                       /* IN: XEN_DOMCTL_NUMA_BALANCE_* */
+    uint32_t rate;                     /* SET: IN, GET: OUT */
+    uint32_t num_nodes;                /* GET: IN/OUT */
+    uint32_t pad;
+    uint64_aligned_t scanned;          /* GET: OUT */
+    uint64_aligned_t accessed;         /* GET: OUT */
+    uint64_aligned_t remote;           /* GET: OUT */
+    uint64_aligned_t migrated;         /* GET: OUT */
+    uint64_aligned_t failed;           /* GET: OUT */
+    XEN_GUEST_HANDLE_64(uint64) node_pages; /* GET: OUT */
+};
+
 struct xen_domctl {
     uint32_t cmd;
 #define XEN_DOMCTL_createdomain                   1
@@ -1184,6 +1349,8 @@ struct xen_domctl {
 #define XEN_DOMCTL_soft_reset                    79
 #define XEN_DOMCTL_set_gnttab_limits             80
 #define XEN_DOMCTL_vuart_op                      81
+#define XEN_DOMCTL_get_exit_stats                82
+#define XEN_DOMCTL_numa_balance                  83
 #define XEN_DOMCTL_gdbsx_guestmemio            1000
 #define XEN_DOMCTL_gdbsx_pausevcpu             1001
 #define XEN_DOMCTL_gdbsx_unpausevcpu           1002
@@ -1248,6 +1415,8 @@ struct xen_domctl {
         struct xen_domctl_psr_cat_op        psr_cat_op;
         struct xen_domctl_set_gnttab_limits set_gnttab_limits;
         struct xen_domctl_vuart_op          vuart_op;
+        struct xen_domctl_exit_stats        exit_stats;
+        struct xen_domctl_numa_balance      numa_balance;
         uint8_t                             pad[128];
     } u;
 };
@@ -74,6 +74,9 @@
 #define EVTCHNOP_init_control    11
 #define EVTCHNOP_expand_array    12
 #define EVTCHNOP_set_priority    13
+#define EVTCHNOP_send_batch      14
+#define EVTCHNOP_set_holdoff     15
+#define EVTCHNOP_register_2l_hint 16
 /* ` } */
 
 typedef uint32_t evtchn_port_t;
@@ -312,6 +315,55 @@ struct evtchn_set_priority {
 };
 typedef struct evtchn_set_priority evtchn_set_priority_t;
 
+/*
+ * EVTCHNOP_send_batch: Send an event on each of the local ports
+ * <ports[0 .. nr_ports-1]>, with the same semantics as EVTCHNOP_send.
+ * Notifications for the same target vCPU are coalesced. Processing stops at
+ * the first port that cannot be sent on; <nr_sent> returns the number of
+ * ports successfully processed, and the return value is the error for the
+ * failing port.
+ */
+#define EVTCHN_SEND_BATCH_MAX 64
+struct evtchn_send_batch {
+    /* IN parameters. */
+    uint32_t nr_ports;
+    evtchn_port_t ports[EVTCHN_SEND_BATCH_MAX];
+    /* OUT parameters. */
+    uint32_t nr_sent;
+};
+typedef struct evtchn_send_batch evtchn_send_batch_t;
+
+/*
+ * EVTCHNOP_set_holdoff: moderate notifications raised by events on the local
+ * interdomain port <port>. After an upcall to the port's notify vCPU, further
+ * events on the port are still marked pending and queued, but the upcall they
+ * would trigger is held off for <holdoff_us> microseconds. Events on
+ * unmoderated ports, including those on other FIFO priority queues, still
+ * notify immediately. A holdoff of 0 disables moderation.
+ */
+#define EVTCHN_HOLDOFF_MAX_US 10000
+struct evtchn_set_holdoff {
+    /* IN parameters. */
+    evtchn_port_t port;
+    uint32_t holdoff_us;
+};
+typedef struct evtchn_set_holdoff evtchn_set_holdoff_t;
+
+/*
+ * EVTCHNOP_register_2l_hint: register a pending hint ring (struct
+ * evtchn_2l_hint, below) for <vcpu>, at byte <offset> of the page at
+ * <hint_gfn>.  The ring must be 8-byte aligned and must not cross the
+ * page boundary.  Only available with the 2-level ABI; a vCPU's ring
+ * cannot be moved once registered, and is released with the domain.
+ */
+struct evtchn_register_2l_hint {
+    /* IN parameters. */
+    uint64_t hint_gfn;
+    uint32_t offset;
+    uint32_t vcpu;
+};
+typedef struct evtchn_register_2l_hint evtchn_register_2l_hint_t;
+
 /*
  * ` enum neg_errnoval
  * ` HYPERVISOR_event_channel_op_compat(struct evtchn_op *op)
@@ -342,6 +394,37 @@ DEFINE_XEN_GUEST_HANDLE(evtchn_op_t);
 
 #define EVTCHN_2L_NR_CHANNELS (sizeof(xen_ulong_t) * sizeof(xen_ulong_t) * 64)
 
+/*
+ * Pending hint ring, see EVTCHNOP_register_2l_hint.
+ *
+ * Before Xen sets a port's bit in the notified vCPU's evtchn_pending_sel
+ * (whether from sending an event or from unmasking a pending port), it
+ * records the port in the vCPU's ring: it takes slot number
+ * idx = prod++, then writes ring[idx % EVTCHN_2L_HINT_SLOTS].port and,
+ * after a write barrier, .seq = idx.  Only ports that became pending
+ * while unmasked are recorded.
+ *
+ * On an upcall, after clearing evtchn_pending_sel as usual, a guest may
+ * handle the ports in slots cons .. prod-1 instead of scanning the
+ * selector and pending bitmaps, provided that prod - cons does not
+ * exceed EVTCHN_2L_HINT_SLOTS and every slot's seq matches its number
+ * (read seq, then port, with a read barrier in between).  Otherwise
+ * some ports were not recorded and it must do the full scan.  Either
+ * way it then sets cons = prod.  The pending and mask bits remain
+ * authoritative; a recorded port may already have been handled.
+ */
+#define EVTCHN_2L_HINT_SLOTS 32
+struct evtchn_2l_hint_slot {
+    uint32_t seq;
+    evtchn_port_t port;
+};
+struct evtchn_2l_hint {
+    uint32_t prod;      /* Written by Xen. */
+    uint32_t cons;      /* Written by the guest. */
+    struct evtchn_2l_hint_slot ring[EVTCHN_2L_HINT_SLOTS];
+};
+typedef struct evtchn_2l_hint evtchn_2l_hint_t;
+
 /*
  * FIFO ABI
  */
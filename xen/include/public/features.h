@@ -105,6 +105,9 @@
 /* arm: Hypervisor supports ARM SMC calling convention. */
 #define XENFEAT_ARM_SMCCC_supported       14
 
+/* Xen maintains vcpu_info.preempted for all the VCPUs of the guest. */
+#define XENFEAT_vcpu_preempted            15
+
 #define XENFEAT_NR_SUBMAPS 1
 
 #endif /* __XEN_PUBLIC_FEATURES_H__ */
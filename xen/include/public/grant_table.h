@@ -312,6 +312,7 @@ typedef uint16_t grant_status_t;
 #define GNTTABOP_get_version          10
 #define GNTTABOP_swap_grant_ref	      11
 #define GNTTABOP_cache_flush	      12
+#define GNTTABOP_unmap_grant_ref_batch 13
 #endif /* __XEN_INTERFACE_VERSION__ */
 /* ` } */
 
@@ -373,6 +374,38 @@ struct gnttab_unmap_grant_ref {
 typedef struct gnttab_unmap_grant_ref gnttab_unmap_grant_ref_t;
 DEFINE_XEN_GUEST_HANDLE(gnttab_unmap_grant_ref_t);
 
+#if __XEN_INTERFACE_VERSION__ >= 0x0003020a
+/*
+ * GNTTABOP_unmap_grant_ref_batch: As GNTTABOP_unmap_grant_ref, taking the
+ * same array of struct gnttab_unmap_grant_ref, but with the TLB flush policy
+ * chosen by the caller. The policy is or-ed into the hypercall's command:
+ *  GNTUNMAP_flush_call:      A single flush once all of <count> operations
+ *                            have been carried out, instead of one per
+ *                            internal batch.
+ *  GNTUNMAP_flush_multicall: When issued from within a multicall, the flush
+ *                            (and the release of the granted pages back to
+ *                            their owners) is deferred until the multicall
+ *                            completes or is preempted, so consecutive
+ *                            unmap calls share one flush. Outside of a
+ *                            multicall this behaves as GNTUNMAP_flush_call.
+ *  GNTUNMAP_flush_none:      No flush at all. The caller guarantees that the
+ *                            unmaps leave no stale CPU mappings behind: only
+ *                            device mappings may be torn down (<host_addr>
+ *                            must be zero), unless the caller's host
+ *                            mappings are maintained by Xen in the second
+ *                            stage page tables (HVM). Operations violating
+ *                            this fail with GNTST_general_error.
+ * NOTES:
+ *  1. Any other grant table operation issued by the same vCPU later in a
+ *     multicall observes all deferred unmaps as fully completed.
+ */
+#define GNTUNMAP_flush_shift      12
+#define GNTUNMAP_flush_mask       (0xfU << GNTUNMAP_flush_shift)
+#define GNTUNMAP_flush_call       (0U << GNTUNMAP_flush_shift)
+#define GNTUNMAP_flush_multicall  (1U << GNTUNMAP_flush_shift)
+#define GNTUNMAP_flush_none       (2U << GNTUNMAP_flush_shift)
+#endif
+
 /*
  * GNTTABOP_setup_table: Set up a grant table for <dom> comprising at least
  * <nr_frames> pages. The frame addresses are written to the <frame_list>.
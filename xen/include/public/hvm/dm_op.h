@@ -63,7 +63,9 @@ typedef uint16_t ioservid_t;
  * <handle_bufioreq> should be one of HVM_IOREQSRV_BUFIOREQ_* defined in
  * hvm_op.h. If the value is HVM_IOREQSRV_BUFIOREQ_OFF then  the buffered
  * ioreq ring will not be allocated and hence all emulation requests to
- * this server will be synchronous.
+ * this server will be synchronous. With HVM_IOREQSRV_BUFIOREQ_RING the
+ * buffered page is an ioreq_ring_page_t which also carries posted MMIO
+ * writes, several of which can be delivered per notification.
  */
 #define XEN_DMOP_create_ioreq_server 1
 
@@ -26,6 +26,7 @@
 #include "../xen.h"
 #include "../trace.h"
 #include "../event_channel.h"
+#include "hvm_info_table.h"
 
 /* Get/set subcommands: extra argument == pointer to xen_hvm_param struct. */
 #define HVMOP_set_param           0
@@ -170,6 +171,14 @@ DEFINE_XEN_GUEST_HANDLE(xen_hvm_get_mem_type_t);
  * the pointer pair gets read atomically:
  */
 #define HVM_IOREQSRV_BUFIOREQ_ATOMIC 2
+/*
+ * Use this to have the buffered ioreq page hold an ioreq_ring_page_t
+ * (see ioreq.h) instead of the buffered_iopage_t.  Besides what would
+ * have gone into the buffered ring, Xen posts to it all MMIO writes
+ * that need no response, so a vCPU can issue several of them without
+ * waiting for the emulator.
+ */
+#define HVM_IOREQSRV_BUFIOREQ_RING   3
 
 #endif /* defined(__XEN__) || defined(__XEN_TOOLS__) */
 
@@ -194,6 +203,22 @@ DEFINE_XEN_GUEST_HANDLE(xen_hvm_evtchn_upcall_vector_t);
 
 #define HVMOP_guest_request_vm_event 24
 
+/*
+ * HVMOP_flush_vcpu_tlbs: Flush the TLBs of those of the calling domain's
+ * vCPUs which are set in <vcpu_mask>: bit N % 64 of word N / 64 for vCPU N,
+ * for the first <nr_vcpus> vCPUs.  vCPUs which aren't running are not woken;
+ * they flush when next scheduled.  Cheaper than interrupting every vCPU in
+ * the mask, and than HVMOP_flush_tlbs, which pauses the whole domain.
+ */
+#define HVMOP_flush_vcpu_tlbs 26
+struct xen_hvm_flush_vcpu_tlbs {
+    uint32_t nr_vcpus;
+    uint32_t pad;
+    uint64_t vcpu_mask[(HVM_MAX_VCPUS + 63) / 64];
+};
+typedef struct xen_hvm_flush_vcpu_tlbs xen_hvm_flush_vcpu_tlbs_t;
+DEFINE_XEN_GUEST_HANDLE(xen_hvm_flush_vcpu_tlbs_t);
+
 /* HVMOP_altp2m: perform altp2m state operations */
 #define HVMOP_altp2m 25
 
@@ -98,6 +98,38 @@ struct buffered_iopage {
 }; /* NB. Size of this structure must be no greater than one page. */
 typedef struct buffered_iopage buffered_iopage_t;
 
+/*
+ * Layout of the buffered ioreq page of servers created with
+ * HVM_IOREQSRV_BUFIOREQ_RING.
+ *
+ * Each slot holds a complete ioreq_t for a request that needs no
+ * response: MMIO writes to ranges mapped to the server (a rep write
+ * whose data comes from guest memory is posted as one slot per
+ * element, with the data inline), plus what other servers get in
+ * their buffered ring.  vp_eport identifies the vCPU that issued the
+ * request, and state is always STATE_IOREQ_READY.
+ *
+ * Xen fills slots and advances req_prod.  The emulator consumes them
+ * in order and advances req_cons.  Xen notifies the buffered ioreq
+ * event channel only when req_prod moves past req_event, so an
+ * emulator that is still draining the ring is not sent more events.
+ * Before waiting for events again it should set req_event to
+ * req_cons + 1 and then recheck req_prod, as with the rings in
+ * io/ring.h.
+ *
+ * To keep the accesses of a vCPU in order, the emulator must drain
+ * this ring before it handles any synchronous ioreq.
+ */
+#define IOREQ_RING_SLOT_NUM       64 /* power of 2 */
+struct ioreq_ring_page {
+    uint32_t req_prod;      /* written by Xen */
+    uint32_t req_cons;      /* written by the emulator */
+    uint32_t req_event;     /* written by the emulator */
+    uint32_t _pad[13];
+    struct ioreq ring[IOREQ_RING_SLOT_NUM];
+};
+typedef struct ioreq_ring_page ioreq_ring_page_t;
+
 /*
  * ACPI Control/Event register locations. Location is controlled by a 
  * version number in HVM_PARAM_ACPI_IOPORTS_LOCATION.
@@ -391,15 +391,26 @@ typedef struct xen_pod_target xen_pod_target_t;
 #define XENMEM_paging_op_nominate           0
 #define XENMEM_paging_op_evict              1
 #define XENMEM_paging_op_prep               2
+/*
+ * Test and clear the accessed bits of the RAM pages [gfn, gfn + nr), setting
+ * the bits of the accessed ones in the bitmap at buffer.  The first call
+ * starts tracking accesses, so reports none.  Bits of gfns that aren't
+ * ordinary 4k RAM mappings (paged out, superpages, ...) are left clear.
+ */
+#define XENMEM_paging_op_harvest_accessed   3
+#define XENMEM_PAGING_HARVEST_MAX           (1u << 15)
 
 struct xen_mem_paging_op {
     uint8_t     op;         /* XENMEM_paging_op_* */
     domid_t     domain;
 
     /* PAGING_PREP IN: buffer to immediately fill page in */
+    /* HARVEST_ACCESSED OUT: bitmap of nr bits */
     uint64_aligned_t    buffer;
     /* Other OPs */
     uint64_aligned_t    gfn;           /* IN:  gfn of page being operated on */
+    /* HARVEST_ACCESSED IN: number of gfns, at most XENMEM_PAGING_HARVEST_MAX */
+    uint32_t    nr;
 };
 typedef struct xen_mem_paging_op xen_mem_paging_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_mem_paging_op_t);
@@ -415,6 +426,14 @@ DEFINE_XEN_GUEST_HANDLE(xen_mem_paging_op_t);
  * #define XENMEM_access_op_disable_emulate    3
  */
 #define XENMEM_access_op_set_access_multi   4
+/*
+ * Allow writes to parts of a page whose access type denies them, at 128-byte
+ * granularity: bit n of @nr makes bytes [128n, 128n + 127] of @pfn writable.
+ * Writes elsewhere on the page still raise mem_access events.  An @nr of ~0
+ * removes the sub-page permissions.  Needs EPT sub-page permission support;
+ * not available while altp2m is active.
+ */
+#define XENMEM_access_op_set_subpage_write  5
 
 typedef enum {
     XENMEM_access_n,
@@ -482,10 +501,20 @@ DEFINE_XEN_GUEST_HANDLE(xen_mem_access_op_t);
 #define XENMEM_sharing_op_add_physmap       6
 #define XENMEM_sharing_op_audit             7
 #define XENMEM_sharing_op_range_share       8
+#define XENMEM_sharing_op_fork              9
+#define XENMEM_sharing_op_nominate_batch    10
+#define XENMEM_sharing_op_share_batch       11
 
 #define XENMEM_SHARING_OP_S_HANDLE_INVALID  (-10)
 #define XENMEM_SHARING_OP_C_HANDLE_INVALID  (-9)
 
+/*
+ * OP_RANGE_SHARE flag: source pages at gfns which are holes in the client
+ * are added to the client's physmap, so a client with no memory populated
+ * in the range ends up a copy-on-write clone of the source.
+ */
+#define XENMEM_SHARING_RANGE_POPULATE       (1u << 0)
+
 /* The following allows sharing of grant refs. This is useful
  * for sharing utilities sitting as "filters" in IO backends
  * (e.g. memshr + blktap(2)). The IO backend is only exposed 
@@ -499,6 +528,23 @@ DEFINE_XEN_GUEST_HANDLE(xen_mem_access_op_t);
 #define XENMEM_SHARING_OP_FIELD_GET_GREF(field)        \
     ((field) & (~XENMEM_SHARING_OP_FIELD_IS_GREF_FLAG))
 
+/*
+ * An entry of OP_NOMINATE_BATCH, which nominates source_gfn and returns its
+ * handle in source_handle, or of OP_SHARE_BATCH, which shares the pages like
+ * OP_SHARE.  Grant references aren't supported.  status is set to what the
+ * single-page op would have returned.
+ */
+struct xen_mem_sharing_batch_entry {
+    uint64_aligned_t source_gfn;    /* IN */
+    uint64_aligned_t source_handle; /* IN: OP_SHARE_BATCH, OUT: OP_NOMINATE */
+    uint64_aligned_t client_gfn;    /* IN: OP_SHARE_BATCH */
+    uint64_aligned_t client_handle; /* IN: OP_SHARE_BATCH */
+    int32_t status;                 /* OUT */
+    uint32_t _pad;
+};
+typedef struct xen_mem_sharing_batch_entry xen_mem_sharing_batch_entry_t;
+DEFINE_XEN_GUEST_HANDLE(xen_mem_sharing_batch_entry_t);
+
 struct xen_mem_sharing_op {
     uint8_t     op;     /* XENMEM_sharing_op_* */
     domid_t     domain;
@@ -523,8 +569,34 @@ struct xen_mem_sharing_op {
             uint64_aligned_t last_gfn;       /* IN: the last gfn */
             uint64_aligned_t opaque;         /* Must be set to 0 */
             domid_t client_domain;           /* IN: the client domain id */
-            uint16_t _pad[3];                /* Must be set to 0 */
+            uint16_t flags;                  /* IN: XENMEM_SHARING_RANGE_* */
+            uint16_t _pad[2];                /* Must be set to 0 */
         } range;
+        /*
+         * OP_NOMINATE_BATCH/OP_SHARE_BATCH: the op on each of a list of
+         * pages of the domain (the sources) and, to share, of the client.
+         * The call fails only if the list can't be accessed; the outcome
+         * for each page is in its entry.
+         */
+        struct mem_sharing_op_batch {
+            XEN_GUEST_HANDLE_64(xen_mem_sharing_batch_entry_t) entries;
+            uint32_t nr;                     /* IN: number of entries */
+            uint32_t opaque;                 /* Must be set to 0 */
+            domid_t client_domain;           /* IN: OP_SHARE_BATCH only */
+            uint16_t _pad[3];                /* Must be set to 0 */
+        } batch;
+        /*
+         * OP_FORK: make the paused domain a fork of the parent.  The fork
+         * gets the parent's vCPU and platform state; its memory starts out
+         * empty and is populated from the parent on first access, reads
+         * sharing the parent's pages and writes copying them.  The parent
+         * stays paused for as long as the fork exists.  Both domains need
+         * the same number of vCPUs, and the fork its own event channels.
+         */
+        struct mem_sharing_op_fork {      /* OP_FORK */
+            domid_t parent_domain;        /* IN: parent's domain id */
+            uint16_t _pad[3];             /* Must be set to 0 */
+        } fork;
         struct mem_sharing_op_debug {     /* OP_DEBUG_xxx */
             union {
                 uint64_aligned_t gfn;      /* IN: gfn to debug          */
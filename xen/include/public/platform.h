@@ -614,6 +614,44 @@ struct xenpf_symdata {
 typedef struct xenpf_symdata xenpf_symdata_t;
 DEFINE_XEN_GUEST_HANDLE(xenpf_symdata_t);
 
+/*
+ * Late microcode update in a single rendezvous of all online CPUs.  One
+ * thread per core loads the update, all cores in parallel, while its
+ * siblings wait (for a bounded time) and then refresh their revision.
+ * XENPF_microcode_update, in contrast, visits each CPU in turn.
+ */
+#define XENPF_microcode_update2   64
+struct xenpf_ucode_cpu_stat {
+    uint32_t flags;
+#define XENPF_UCODE_CPU_ONLINE  (1u << 0) /* CPU took part in the update. */
+#define XENPF_UCODE_CPU_LOADER  (1u << 1) /* CPU loaded for its core.     */
+    int32_t  rc;                          /* 0 or -XEN_Exxx.              */
+    uint32_t rev;                         /* Revision after the update.   */
+    uint32_t pad;
+    uint64_t ns;                          /* Time spent in the update.    */
+};
+typedef struct xenpf_ucode_cpu_stat xenpf_ucode_cpu_stat_t;
+DEFINE_XEN_GUEST_HANDLE(xenpf_ucode_cpu_stat_t);
+
+struct xenpf_microcode_update2 {
+    /* IN variables. */
+    XEN_GUEST_HANDLE(const_void) data;    /* Pointer to microcode data.   */
+    uint32_t length;                      /* Length of microcode data.    */
+    uint32_t flags;                       /* Must be zero.                */
+    /*
+     * IN:  Number of entries in stats (may be 0).
+     * OUT: Number of entries Xen would like to return, i.e. the number of
+     *      CPU ids; stats[] is indexed by CPU id.
+     */
+    uint32_t nr_cpus;
+    uint32_t pad;
+    XEN_GUEST_HANDLE(xenpf_ucode_cpu_stat_t) stats;
+    /* OUT variables. */
+    uint64_t total_ns;                    /* Duration of the rendezvous.  */
+};
+typedef struct xenpf_microcode_update2 xenpf_microcode_update2_t;
+DEFINE_XEN_GUEST_HANDLE(xenpf_microcode_update2_t);
+
 /*
  * ` enum neg_errnoval
  * ` HYPERVISOR_platform_op(const struct xen_platform_op*);
@@ -644,6 +682,7 @@ struct xen_platform_op {
         struct xenpf_core_parking      core_parking;
         struct xenpf_resource_op       resource_op;
         struct xenpf_symdata           symdata;
+        struct xenpf_microcode_update2 microcode2;
         uint8_t                        pad[128];
     } u;
 };
@@ -69,6 +69,14 @@ struct xen_sysctl_tbuf_op {
 #define XEN_SYSCTL_TBUFOP_set_size     3
 #define XEN_SYSCTL_TBUFOP_enable       4
 #define XEN_SYSCTL_TBUFOP_disable      5
+/*
+ * Restrict tracing to events matching one of nr_evt_filters (event, mask)
+ * pairs, i.e. (id & filter_mask[i]) == filter_event[i].  Zero filters lifts
+ * the restriction.  Applied on top of evt_mask.
+ */
+#define XEN_SYSCTL_TBUFOP_set_evt_filter 6
+/* Restrict tracing to events raised while domid runs; DOMID_INVALID: all. */
+#define XEN_SYSCTL_TBUFOP_set_dom_filter 7
     uint32_t cmd;
     /* IN/OUT variables */
     struct xenctl_bitmap cpu_mask;
@@ -76,6 +84,12 @@ struct xen_sysctl_tbuf_op {
     /* OUT variables */
     uint64_aligned_t buffer_mfn;
     uint32_t size;  /* Also an IN variable! */
+    /* IN variables (set_evt_filter / set_dom_filter) */
+#define XEN_SYSCTL_TBUF_NR_EVT_FILTERS 8
+    uint32_t nr_evt_filters;
+    uint32_t filter_event[XEN_SYSCTL_TBUF_NR_EVT_FILTERS];
+    uint32_t filter_mask[XEN_SYSCTL_TBUF_NR_EVT_FILTERS];
+    domid_t  domid;
 };
 
 /*
@@ -150,6 +164,73 @@ struct xen_sysctl_getdomaininfolist {
     uint32_t              num_domains;
 };
 
+/*
+ * XEN_SYSCTL_vcpuinfolist
+ *
+ * The runtime state of all vCPUs of all domains, from vCPU first_vcpu of
+ * domain first_domain on, in domain then vCPU order.  This is what a
+ * XEN_DOMCTL_getvcpuinfo per vCPU would return, in one call.  To continue
+ * a listing which filled the buffer, pass the last entry's domid and
+ * vcpu + 1.
+ */
+struct xen_sysctl_vcpuinfo {
+    domid_t  domid;
+    uint16_t vcpu;
+    uint8_t  online;                  /* currently online (not hotplugged)? */
+    uint8_t  blocked;                 /* blocked waiting for an event? */
+    uint8_t  running;                 /* currently scheduled on its CPU? */
+    uint8_t  waiting;                 /* runnable, but not running? */
+    uint64_aligned_t cpu_time;        /* total cpu time consumed (ns) */
+    uint32_t cpu;                     /* current mapping */
+    uint32_t pad;
+};
+typedef struct xen_sysctl_vcpuinfo xen_sysctl_vcpuinfo_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_vcpuinfo_t);
+struct xen_sysctl_vcpuinfolist {
+    /* IN variables. */
+    domid_t               first_domain;
+    uint16_t              first_vcpu;
+    uint32_t              max_vcpus;
+    XEN_GUEST_HANDLE_64(xen_sysctl_vcpuinfo_t) buffer;
+    /* OUT variables. */
+    uint32_t              num_vcpus;
+};
+
+/*
+ * XEN_SYSCTL_domschedstats
+ *
+ * Scheduling aggregates of the domains from first_domain on, in domain
+ * order, each summed over the domain's vCPUs: the time spent in every
+ * runstate, and how often its vCPUs were scheduled in, preempted, blocked
+ * and woken up.  Xen maintains these on every runstate change, so the
+ * difference between two snapshots gives what xenbaked otherwise derives
+ * from a full scheduler trace.  'now' is the system time the snapshot was
+ * taken at.  To continue a listing which filled the buffer, pass the last
+ * entry's domid + 1.
+ */
+struct xen_sysctl_domschedstats {
+    domid_t  domid;
+    uint16_t nr_vcpus;
+    uint32_t pad;
+    uint64_aligned_t time[4];         /* ns in each RUNSTATE_* state */
+    uint64_aligned_t switches;        /* vCPUs scheduled in */
+    uint64_aligned_t preemptions;     /* running -> runnable */
+    uint64_aligned_t blocks;          /* running -> blocked */
+    uint64_aligned_t wakeups;         /* blocked -> runnable */
+};
+typedef struct xen_sysctl_domschedstats xen_sysctl_domschedstats_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_domschedstats_t);
+struct xen_sysctl_domschedstatslist {
+    /* IN variables. */
+    domid_t               first_domain;
+    uint16_t              pad;
+    uint32_t              max_domains;
+    XEN_GUEST_HANDLE_64(xen_sysctl_domschedstats_t) buffer;
+    /* OUT variables. */
+    uint64_aligned_t      now;
+    uint32_t              num_domains;
+};
+
 /* Inject debug keys into Xen. */
 /* XEN_SYSCTL_debug_keys */
 struct xen_sysctl_debug_keys {
@@ -341,6 +422,10 @@ struct xen_sysctl_pm_op {
     #define XEN_SYSCTL_pm_op_enable_turbo               0x26
     #define XEN_SYSCTL_pm_op_disable_turbo              0x27
 
+    /* cpuidle exit latency limit of a CPU, in us (0: no limit) */
+    #define XEN_SYSCTL_pm_op_get_max_latency            0x28
+    #define XEN_SYSCTL_pm_op_set_max_latency            0x29
+
     uint32_t cmd;
     uint32_t cpuid;
     union {
@@ -353,10 +438,20 @@ struct xen_sysctl_pm_op {
         uint32_t                    set_max_cstate;
         uint32_t                    get_vcpu_migration_delay;
         uint32_t                    set_vcpu_migration_delay;
+        uint32_t                    get_max_latency;
+        uint32_t                    set_max_latency;
     } u;
 };
 
-/* XEN_SYSCTL_page_offline_op */
+/*
+ * XEN_SYSCTL_page_offline_op
+ *
+ * Ranges of any size may be passed: Xen works through them in chunks and
+ * may preempt itself in between, in which case it continues the hypercall
+ * with start and status advanced past the pages already done.  If a page
+ * can't be handled at all the operation stops there, with that page's
+ * status set; the pages after it are left alone.
+ */
 struct xen_sysctl_page_offline_op {
     /* IN: range of page to be offlined */
 #define sysctl_page_offline     1
@@ -662,6 +757,26 @@ struct xen_sysctl_gcov_op {
 #define XEN_SYSCTL_PSR_CMT_get_l3_cache_size         2
 #define XEN_SYSCTL_PSR_CMT_enabled                   3
 #define XEN_SYSCTL_PSR_CMT_get_l3_event_mask         4
+/*
+ * Read the monitoring data of all the domains attached to CMT on one
+ * socket at once.  On input 'num' is the number of entries 'samples' has
+ * room for, on output the number of attached domains.  Values are in
+ * bytes (the MBM ones are free running counters), or
+ * XEN_SYSCTL_PSR_CMT_SAMPLE_INVALID for events not supported or not
+ * available.
+ */
+#define XEN_SYSCTL_PSR_CMT_get_samples               5
+#define XEN_SYSCTL_PSR_CMT_SAMPLE_INVALID (~(uint64_t)0)
+struct xen_sysctl_psr_cmt_sample {
+    domid_t domid;
+    uint16_t pad[3];
+    uint64_aligned_t l3_occupancy;
+    uint64_aligned_t total_mem_count;
+    uint64_aligned_t local_mem_count;
+};
+typedef struct xen_sysctl_psr_cmt_sample xen_sysctl_psr_cmt_sample_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_psr_cmt_sample_t);
+
 struct xen_sysctl_psr_cmt_op {
     uint32_t cmd;       /* IN: XEN_SYSCTL_PSR_CMT_* */
     uint32_t flags;     /* padding variable, may be extended for future use */
@@ -671,6 +786,12 @@ struct xen_sysctl_psr_cmt_op {
             uint32_t cpu;   /* IN */
             uint32_t rsvd;
         } l3_cache;
+        struct {
+            uint32_t socket;            /* IN */
+            uint32_t num;               /* IN/OUT */
+            uint64_aligned_t tsc;       /* OUT: when the samples were read */
+            XEN_GUEST_HANDLE_64(xen_sysctl_psr_cmt_sample_t) samples; /* OUT */
+        } samples;
     } u;
 };
 
@@ -1045,6 +1166,177 @@ struct xen_sysctl_set_parameter {
     uint16_t pad[3];                        /* IN: MUST be zero. */
 };
 
+/*
+ * XEN_SYSCTL_scrubinfo
+ *
+ * Return the number of free pages still waiting to be scrubbed on each node.
+ * 'num_nodes' follows the same IN/OUT rules as for XEN_SYSCTL_numainfo; a
+ * null 'pending' handle requests the number of nodes.
+ */
+struct xen_sysctl_scrubinfo {
+    uint32_t num_nodes;
+    XEN_GUEST_HANDLE_64(uint64) pending;
+};
+
+/*
+ * XEN_SYSCTL_sched_hist
+ *
+ * Return the scheduler latency histograms of a pCPU, or the sum of the
+ * ones of all online pCPUs, and optionally reset them.
+ *
+ * 'data' receives XEN_SYSCTL_SCHED_HIST_NR histograms, one after the other,
+ * of XEN_SYSCTL_SCHED_HIST_BUCKETS counters each. Bucket 0 counts samples
+ * below 1us; bucket i counts samples in [2^(i-1), 2^i) us; the last bucket
+ * counts everything above. It may be null, if 'flags' only asks for a reset.
+ *
+ * Counters are updated locklessly by each pCPU, so a snapshot (and a reset)
+ * is only approximate while the system is running.
+ */
+#define XEN_SYSCTL_SCHED_HIST_wakeup     0 /* wakeup to running */
+#define XEN_SYSCTL_SCHED_HIST_runq_wait  1 /* runnable to running */
+#define XEN_SYSCTL_SCHED_HIST_ctxsw      2 /* context switch cost */
+#define XEN_SYSCTL_SCHED_HIST_slice_req  3 /* time slice requested */
+#define XEN_SYSCTL_SCHED_HIST_slice_run  4 /* time slice actually run */
+#define XEN_SYSCTL_SCHED_HIST_NR         5
+#define XEN_SYSCTL_SCHED_HIST_BUCKETS   24
+#define XEN_SYSCTL_SCHED_HIST_ALL_CPUS  (~0U)
+struct xen_sysctl_sched_hist {
+    uint32_t cpu;                          /* IN: pCPU, or _ALL_CPUS */
+#define XEN_SYSCTL_SCHED_HIST_RESET     (1U << 0) /* reset after reading */
+    uint32_t flags;                        /* IN */
+    XEN_GUEST_HANDLE_64(uint64) data;      /* OUT */
+};
+
+/*
+ * XEN_SYSCTL_lat_hist
+ *
+ * Return the hot path latency histograms of one set, for a pCPU or summed
+ * over all online pCPUs, and optionally reset them.
+ *
+ * A set holds one histogram per index: the VMX basic exit reason or SVM
+ * exit code (with VMEXIT_NPF at XEN_SYSCTL_LAT_HIST_VMEXIT_NPF), the
+ * hypercall number, or the GNTTABOP_* command. 'nr_hists' is set to the
+ * size of the set; on input it is how many histograms 'data' has room
+ * for, each of XEN_SYSCTL_LAT_HIST_BUCKETS counters. Bucket 0 counts
+ * samples below 64ns; bucket i counts samples in [2^(i+5), 2^(i+6)) ns;
+ * the last bucket counts everything above. 'data' may be null, to learn
+ * the set size or only reset.
+ *
+ * As with XEN_SYSCTL_sched_hist, counters are updated locklessly by each
+ * pCPU, so a snapshot (and a reset) is only approximate.
+ */
+#define XEN_SYSCTL_LAT_HIST_vmexit       0 /* VM exit handling */
+#define XEN_SYSCTL_LAT_HIST_hypercall    1 /* hypercall dispatch */
+#define XEN_SYSCTL_LAT_HIST_grant_op     2 /* grant table operations */
+#define XEN_SYSCTL_LAT_HIST_evtchn_send  3 /* event channel notification */
+#define XEN_SYSCTL_LAT_HIST_NR           4
+#define XEN_SYSCTL_LAT_HIST_BUCKETS     24
+#define XEN_SYSCTL_LAT_HIST_VMEXIT_NPF  142
+#define XEN_SYSCTL_LAT_HIST_ALL_CPUS    (~0U)
+struct xen_sysctl_lat_hist {
+    uint32_t set;                          /* IN: XEN_SYSCTL_LAT_HIST_* */
+    uint32_t cpu;                          /* IN: pCPU, or _ALL_CPUS */
+#define XEN_SYSCTL_LAT_HIST_RESET       (1U << 0) /* reset after reading */
+    uint32_t flags;                        /* IN */
+    uint32_t nr_hists;                     /* IN/OUT */
+    XEN_GUEST_HANDLE_64(uint64) data;      /* OUT */
+};
+
+/*
+ * XEN_SYSCTL_pmu_sample (x86 only)
+ *
+ * Host-wide sampling profiler on the hardware PMU.  'start' programs one
+ * counter on every online pCPU to count 'event' (a raw event select: event
+ * code in bits 0-7 and unit mask in bits 8-15, or 0 for unhalted core
+ * cycles) and to interrupt every 'period' events.  Each interrupt records
+ * what the pCPU was running into a per-pCPU ring.  'read' drains up to
+ * 'nr_samples' records of the ring of 'cpu' into 'samples', sets
+ * 'nr_samples' to the number copied and 'lost' to the number dropped on a
+ * full ring since the previous read.  'stop' turns sampling off and frees
+ * the rings, discarding unread samples.
+ *
+ * The PMU is shared with the vPMU, xenoprof and the NMI watchdog: 'start'
+ * fails with -EBUSY while guests or dom0 use the vPMU or xenoprof is
+ * active, and stops the NMI watchdog until 'stop'.
+ */
+#define XEN_SYSCTL_PMU_SAMPLE_xen         0 /* in Xen */
+#define XEN_SYSCTL_PMU_SAMPLE_kernel      1 /* in guest kernel mode */
+#define XEN_SYSCTL_PMU_SAMPLE_user        2 /* in guest user mode */
+struct xen_sysctl_pmu_sample_rec {
+    uint64_aligned_t time;     /* system time, ns */
+    uint64_aligned_t rip;
+    uint16_t domid;            /* DOMID_IDLE when idle */
+    uint16_t vcpu;
+    uint8_t mode;              /* XEN_SYSCTL_PMU_SAMPLE_{xen,kernel,user} */
+    uint8_t pad[3];
+};
+typedef struct xen_sysctl_pmu_sample_rec xen_sysctl_pmu_sample_rec_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_pmu_sample_rec_t);
+
+struct xen_sysctl_pmu_sample {
+#define XEN_SYSCTL_PMU_SAMPLE_start       0
+#define XEN_SYSCTL_PMU_SAMPLE_stop        1
+#define XEN_SYSCTL_PMU_SAMPLE_read        2
+    uint32_t cmd;                          /* IN */
+    uint32_t cpu;                          /* IN: read */
+    uint64_aligned_t event;                /* IN: start */
+    uint64_aligned_t period;               /* IN: start */
+    uint32_t nr_samples;                   /* IN/OUT: read */
+    uint32_t lost;                         /* OUT: read */
+    XEN_GUEST_HANDLE_64(xen_sysctl_pmu_sample_rec_t) samples; /* OUT */
+};
+
+/*
+ * XEN_SYSCTL_lockcont_op
+ *
+ * Spinlock and rwlock contention profile, available in all builds (unlike
+ * XEN_SYSCTL_lockprof_op).  While enabled, every 'sample'th contended
+ * acquisition on each pCPU is timed, and accounted to the call site which
+ * waited.  Releases of a spinlock with CPUs queued behind it are accounted
+ * to the call site which released it, i.e. the holder the waiters were
+ * stuck behind.  rwlock waiters queue on the lock's internal spinlock,
+ * whose contention is accounted to queue_{read,write}_lock_slowpath.
+ * Each pCPU keeps its own table of call sites; 'query' returns every
+ * pCPU's entries, so a call site can appear once per pCPU.
+ */
+#define XEN_SYSCTL_LOCKCONT_enable  0   /* Set 'sample'; 0 disables. */
+#define XEN_SYSCTL_LOCKCONT_query   1   /* Get the call site records. */
+#define XEN_SYSCTL_LOCKCONT_reset   2   /* Reset all records. */
+/* Record-type: */
+#define LOCKCONT_TYPE_SPIN_WAIT     0   /* waited for a spinlock */
+#define LOCKCONT_TYPE_SPIN_HOLDER   1   /* released a spinlock with waiters */
+#define LOCKCONT_TYPE_READ_WAIT     2   /* waited for a read lock */
+#define LOCKCONT_TYPE_WRITE_WAIT    3   /* waited for a write lock */
+struct xen_sysctl_lockcont_data {
+    char     site[64];     /* call site, as symbol+offset */
+    uint64_aligned_t addr; /* call site address */
+    uint32_t type;         /* LOCKCONT_TYPE_??? */
+    uint32_t cpu;          /* pCPU the record is from */
+    /*
+     * For _WAIT records: sampled contended acquisitions, and the total and
+     * longest time waited in ns.  'hist' buckets the waits as described at
+     * XEN_SYSCTL_lat_hist.  For _HOLDER records: contended releases, and
+     * the total and largest number of waiters found; 'hist' is unused.
+     */
+    uint64_aligned_t count;
+    uint64_aligned_t total;
+    uint64_aligned_t max;
+    uint64_aligned_t hist[XEN_SYSCTL_LAT_HIST_BUCKETS];
+};
+typedef struct xen_sysctl_lockcont_data xen_sysctl_lockcont_data_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_lockcont_data_t);
+struct xen_sysctl_lockcont_op {
+    uint32_t       cmd;               /* IN: XEN_SYSCTL_LOCKCONT_??? */
+    uint32_t       sample;            /* IN: enable; OUT: query */
+    uint32_t       max_elem;          /* IN: size of output buffer */
+    uint32_t       nr_elem;           /* OUT: number of records available */
+    uint32_t       dropped;           /* OUT: events lost to full tables */
+    uint32_t       pad;
+    uint64_aligned_t time;            /* OUT: nsecs since the last reset */
+    /* records (or NULL) */
+    XEN_GUEST_HANDLE_64(xen_sysctl_lockcont_data_t) data;
+};
+
 struct xen_sysctl {
     uint32_t cmd;
 #define XEN_SYSCTL_readconsole                    1
@@ -1074,6 +1366,13 @@ struct xen_sysctl {
 #define XEN_SYSCTL_get_cpu_featureset            26
 #define XEN_SYSCTL_livepatch_op                  27
 #define XEN_SYSCTL_set_parameter                 28
+#define XEN_SYSCTL_scrubinfo                     29
+#define XEN_SYSCTL_sched_hist                    30
+#define XEN_SYSCTL_lat_hist                      31
+#define XEN_SYSCTL_pmu_sample                    32
+#define XEN_SYSCTL_lockcont_op                   33
+#define XEN_SYSCTL_vcpuinfolist                  34
+#define XEN_SYSCTL_domschedstats                 35
     uint32_t interface_version; /* XEN_SYSCTL_INTERFACE_VERSION */
     union {
         struct xen_sysctl_readconsole       readconsole;
@@ -1103,6 +1402,13 @@ struct xen_sysctl {
         struct xen_sysctl_cpu_featureset    cpu_featureset;
         struct xen_sysctl_livepatch_op      livepatch;
         struct xen_sysctl_set_parameter     set_parameter;
+        struct xen_sysctl_scrubinfo         scrubinfo;
+        struct xen_sysctl_sched_hist        sched_hist;
+        struct xen_sysctl_lat_hist          lat_hist;
+        struct xen_sysctl_pmu_sample        pmu_sample;
+        struct xen_sysctl_lockcont_op       lockcont_op;
+        struct xen_sysctl_vcpuinfolist      vcpuinfolist;
+        struct xen_sysctl_domschedstatslist domschedstats;
         uint8_t                             pad[128];
     } u;
 };
@@ -92,6 +92,7 @@
 /* Trace classes for Hardware */
 #define TRC_HW_PM           0x00801000   /* Power management traces */
 #define TRC_HW_IRQ          0x00802000   /* Traces relating to the handling of IRQs */
+#define TRC_HW_PROF         0x00804000   /* Stack samples ("stack_sample=") */
 
 /* Trace events per class */
 #define TRC_LOST_RECORDS        (TRC_GEN + 1)
@@ -235,6 +236,7 @@
 #define TRC_HVM_TRAP             (TRC_HVM_HANDLER + 0x23)
 #define TRC_HVM_TRAP_DEBUG       (TRC_HVM_HANDLER + 0x24)
 #define TRC_HVM_VLAPIC           (TRC_HVM_HANDLER + 0x25)
+#define TRC_HVM_EMULATE_INSN     (TRC_HVM_HANDLER + 0x26)
 
 #define TRC_HVM_IOPORT_WRITE    (TRC_HVM_HANDLER + 0x216)
 #define TRC_HVM_IOMEM_WRITE     (TRC_HVM_HANDLER + 0x217)
@@ -273,6 +275,22 @@
 #define TRC_HW_IRQ_UNMAPPED_VECTOR    (TRC_HW_IRQ + 0x7)
 #define TRC_HW_IRQ_HANDLED            (TRC_HW_IRQ + 0x8)
 
+/*
+ * Trace events for stack samples.  A sample is one TRC_HW_PROF_SAMPLE record
+ *   uint32_t domid << 16 | vcpu_id;
+ *   uint32_t flags << 16 | depth;
+ *   uint64_t pc[2];
+ * followed by as many TRC_HW_PROF_FRAMES records, each carrying up to three
+ * uint64_t return addresses, as it takes to make up 'depth' addresses,
+ * innermost first.
+ */
+#define TRC_HW_PROF_SAMPLE            (TRC_HW_PROF + 0x1)
+#define TRC_HW_PROF_FRAMES            (TRC_HW_PROF + 0x2)
+
+#define TRC_HW_PROF_GUEST      0x1 /* pc[0] is a guest address */
+#define TRC_HW_PROF_MISSED     0x2 /* Woken other than by the timer; no pc */
+#define TRC_HW_PROF_TRUNCATED  0x4 /* Stack deeper than recorded */
+
 /*
  * Event Flags
  *
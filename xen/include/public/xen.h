@@ -684,6 +684,14 @@ struct vcpu_info {
 #else /* XEN_HAVE_PV_UPCALL_MASK */
     uint8_t pad0;
 #endif /* XEN_HAVE_PV_UPCALL_MASK */
+    /*
+     * 'preempted' is written by Xen (if XENFEAT_vcpu_preempted is set), and
+     * is non-zero while the VCPU is runnable but not running, i.e., it has
+     * been descheduled, or woken up but not yet run. Other VCPUs of the
+     * guest can check it to avoid spinning on locks held by, or handing
+     * work to, a VCPU that is not running. The guest must not write it.
+     */
+    uint8_t preempted;
     xen_ulong_t evtchn_pending_sel;
     struct arch_vcpu_info arch;
     struct vcpu_time_info time;
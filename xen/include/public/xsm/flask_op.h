@@ -130,6 +130,18 @@ struct xen_flask_cache_stats {
     uint32_t allocations;
     uint32_t reclaims;
     uint32_t frees;
+    uint32_t pcpu_hits;     /* of hits, those served by the per-CPU cache */
+};
+
+struct xen_flask_class_stats {
+    /* IN */
+    uint32_t cpu;
+    uint32_t tclass;
+    /* OUT */
+    uint32_t lookups;
+    uint32_t hits;
+    uint32_t pcpu_hits;
+    uint32_t misses;
 };
 
 struct xen_flask_ocontext {
@@ -186,6 +198,7 @@ struct xen_flask_op {
 #define FLASK_GET_PEER_SID      23
 #define FLASK_RELABEL_DOMAIN    24
 #define FLASK_DEVICETREE_LABEL  25
+#define FLASK_AVC_CLASSSTATS    26
     uint32_t interface_version; /* XEN_FLASK_INTERFACE_VERSION */
     union {
         struct xen_flask_load load;
@@ -203,6 +216,7 @@ struct xen_flask_op {
         struct xen_flask_setavc_threshold setavc_threshold;
         struct xen_flask_hash_stats hash_stats;
         struct xen_flask_cache_stats cache_stats;
+        struct xen_flask_class_stats class_stats;
         /* FLASK_ADD_OCONTEXT, FLASK_DEL_OCONTEXT */
         struct xen_flask_ocontext ocontext;
         struct xen_flask_peersid peersid;
@@ -156,9 +156,22 @@ static inline void acpi_set_cstate_limit(unsigned int new_limit)
 	max_cstate = new_limit;
 	return;
 }
+
+/*
+ * Highest exit latency (in us) of the C-states a CPU may enter,
+ * 0 for no limit.
+ */
+unsigned int acpi_get_cstate_latency_limit(unsigned int cpu);
+void acpi_set_cstate_latency_limit(unsigned int cpu, unsigned int us);
 #else
 static inline unsigned int acpi_get_cstate_limit(void) { return 0; }
 static inline void acpi_set_cstate_limit(unsigned int new_limit) { return; }
+static inline unsigned int acpi_get_cstate_latency_limit(unsigned int cpu)
+{
+	return 0;
+}
+static inline void acpi_set_cstate_latency_limit(unsigned int cpu,
+						 unsigned int us) { return; }
 #endif
 
 #ifdef XEN_GUEST_HANDLE_PARAM
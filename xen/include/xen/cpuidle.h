@@ -27,6 +27,7 @@
 #define _XEN_CPUIDLE_H
 
 #include <xen/cpumask.h>
+#include <xen/percpu.h>
 #include <xen/spinlock.h>
 
 #define ACPI_PROCESSOR_MAX_POWER        8
@@ -87,6 +88,9 @@ struct cpuidle_governor
 extern s8 xen_cpuidle;
 extern struct cpuidle_governor *cpuidle_current_governor;
 
+/* Highest exit latency (in us) a governor may choose, 0 for no limit. */
+DECLARE_PER_CPU(unsigned int, cpuidle_latency_limit);
+
 bool cpuidle_using_deep_cstate(void);
 void cpuidle_disable_deep_cstate(void);
 
@@ -124,7 +124,17 @@ static inline struct evtchn *evtchn_from_port(struct domain *d, unsigned int p)
 
 void evtchn_check_pollers(struct domain *d, unsigned int port);
 
+/* Raise an upcall on @v for @evtchn, subject to the port's holdoff. */
+void evtchn_notify_vcpu(struct vcpu *v, const struct evtchn *evtchn);
+void evtchn_holdoff_timer_fn(void *data);
+
+/* Map a guest page, e.g. for a control block, writable into Xen. */
+int evtchn_map_guest_page(struct domain *d, uint64_t gfn, void **virt);
+void evtchn_unmap_guest_page(void *virt);
+
 void evtchn_2l_init(struct domain *d);
+int evtchn_2l_register_hint(const struct evtchn_register_2l_hint *reg);
+void evtchn_2l_destroy(struct domain *d);
 
 /* Close all event channels and reset to 2-level ABI. */
 int evtchn_reset(struct domain *d);
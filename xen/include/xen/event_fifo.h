@@ -14,6 +14,7 @@ struct evtchn_fifo_queue {
     uint32_t tail;
     uint8_t priority;
     spinlock_t lock;
+    uint32_t staged; /* LIFO of ports waiting for the lock holder to link */
 };
 
 struct evtchn_fifo_vcpu {
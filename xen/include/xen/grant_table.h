@@ -50,6 +50,9 @@ void
 gnttab_release_mappings(
     struct domain *d);
 
+/* Settle unmaps deferred by GNTUNMAP_flush_multicall on this CPU. */
+void gnttab_flush_deferred_unmaps(void);
+
 int mem_sharing_gref_to_gfn(struct grant_table *gt, grant_ref_t ref,
                             gfn_t *gfn, uint16_t *status);
 
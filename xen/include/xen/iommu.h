@@ -63,6 +63,24 @@ void iommu_teardown(struct domain *d);
 int __must_check iommu_map_page(struct domain *d, unsigned long gfn,
                                 unsigned long mfn, unsigned int flags);
 int __must_check iommu_unmap_page(struct domain *d, unsigned long gfn);
+/*
+ * As above, for 2^order contiguous pages. Back ends may use superpages
+ * where gfn and mfn are suitably aligned; otherwise the range is handled
+ * page by page.
+ */
+int __must_check iommu_map_pages(struct domain *d, unsigned long gfn,
+                                 unsigned long mfn, unsigned int order,
+                                 unsigned int flags);
+int __must_check iommu_unmap_pages(struct domain *d, unsigned long gfn,
+                                   unsigned int order);
+/*
+ * Map nr contiguous pages, in the largest chunks the alignment of gfn and
+ * mfn permits. Callers bound nr to keep the time spent here reasonable.
+ */
+#define IOMMU_MAP_RANGE_MAX_ORDER 18
+int __must_check iommu_map_range(struct domain *d, unsigned long gfn,
+                                 unsigned long mfn, unsigned long nr,
+                                 unsigned int flags);
 
 enum iommu_feature
 {
@@ -155,6 +173,11 @@ struct iommu_ops {
     int __must_check (*map_page)(struct domain *d, unsigned long gfn,
                                  unsigned long mfn, unsigned int flags);
     int __must_check (*unmap_page)(struct domain *d, unsigned long gfn);
+    int __must_check (*map_pages)(struct domain *d, unsigned long gfn,
+                                  unsigned long mfn, unsigned int order,
+                                  unsigned int flags);
+    int __must_check (*unmap_pages)(struct domain *d, unsigned long gfn,
+                                    unsigned int order);
     void (*free_page_table)(struct page_info *);
 #ifdef CONFIG_X86
     void (*update_ire_from_apic)(unsigned int apic, unsigned int reg, unsigned int value);
@@ -168,6 +191,7 @@ struct iommu_ops {
     int __must_check (*iotlb_flush)(struct domain *d, unsigned long gfn,
                                     unsigned int page_count);
     int __must_check (*iotlb_flush_all)(struct domain *d);
+    int __must_check (*iotlb_batch_end)(void);
     int (*get_reserved_device_memory)(iommu_grdm_t *, void *);
     void (*dump_p2m_table)(struct domain *d);
 };
@@ -205,6 +229,20 @@ void iommu_dev_iotlb_flush_timeout(struct domain *d, struct pci_dev *pdev);
  */
 DECLARE_PER_CPU(bool_t, iommu_dont_flush_iotlb);
 
+/*
+ * iommu_iotlb_batch_start()/iommu_iotlb_batch_end() bracket a series of
+ * iommu_map_page()/iommu_unmap_page() calls on the current CPU. Within the
+ * batch the low level IOMMU code may post the IOTLB invalidations without
+ * waiting for each to complete; all of them have completed once the
+ * outermost iommu_iotlb_batch_end() returns. Pages unmapped inside a batch
+ * must not be freed before that, and a batch must not span a preemption
+ * point. Batches nest.
+ */
+DECLARE_PER_CPU(unsigned int, iommu_iotlb_batch);
+
+void iommu_iotlb_batch_start(void);
+int __must_check iommu_iotlb_batch_end(struct domain *d);
+
 extern struct spinlock iommu_pt_cleanup_lock;
 extern struct page_list_head iommu_pt_cleanup_list;
 
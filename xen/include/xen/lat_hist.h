@@ -0,0 +1,102 @@
+#ifndef __XEN_LAT_HIST_H__
+#define __XEN_LAT_HIST_H__
+
+#include <xen/bitops.h>
+#include <xen/percpu.h>
+#include <xen/time.h>
+#include <public/sysctl.h>
+
+/*
+ * Hot path latency histograms (see XEN_SYSCTL_lat_hist).  A timed section
+ * is bracketed with
+ *
+ *     s_time_t t = lat_hist_start();
+ *     ...
+ *     lat_hist_end(XEN_SYSCTL_LAT_HIST_hypercall, nr, t);
+ *
+ * Each pCPU only updates its own counters, and none of the sections runs
+ * in interrupt context, so neither locks nor atomics are needed.  With
+ * lat-hist=false, lat_hist_start() returns 0 and nothing is recorded.
+ * Callers which time a section anyway can feed lat_hist_add() directly,
+ * after checking opt_lat_hist themselves.
+ */
+
+#define LAT_HIST_VMEXIT_NR     (XEN_SYSCTL_LAT_HIST_VMEXIT_NPF + 1)
+#define LAT_HIST_HYPERCALL_NR  NR_hypercalls
+#define LAT_HIST_GRANT_OP_NR   16
+#define LAT_HIST_EVTCHN_NR     1
+
+/* Sets are laid out one after the other in each pCPU's counters. */
+#define LAT_HIST_VMEXIT_BASE     0
+#define LAT_HIST_HYPERCALL_BASE  (LAT_HIST_VMEXIT_BASE + LAT_HIST_VMEXIT_NR)
+#define LAT_HIST_GRANT_OP_BASE   (LAT_HIST_HYPERCALL_BASE + \
+                                  LAT_HIST_HYPERCALL_NR)
+#define LAT_HIST_EVTCHN_BASE     (LAT_HIST_GRANT_OP_BASE + LAT_HIST_GRANT_OP_NR)
+#define LAT_HIST_TOTAL           (LAT_HIST_EVTCHN_BASE + LAT_HIST_EVTCHN_NR)
+
+struct lat_hist {
+    uint64_t count[LAT_HIST_TOTAL][XEN_SYSCTL_LAT_HIST_BUCKETS];
+};
+DECLARE_PER_CPU(struct lat_hist, lat_hist);
+
+extern bool opt_lat_hist;
+
+static inline s_time_t lat_hist_start(void)
+{
+    return opt_lat_hist ? NOW() : 0;
+}
+
+/* Bucket 0 is below 64ns, bucket i is [2^(i+5), 2^(i+6)) ns. */
+static inline unsigned int lat_hist_bucket(s_time_t delta)
+{
+    if ( delta >= (1L << (XEN_SYSCTL_LAT_HIST_BUCKETS + 5)) )
+        return XEN_SYSCTL_LAT_HIST_BUCKETS - 1;
+    if ( delta >= 64 )
+        return flsl(delta) - 6;
+    return 0;
+}
+
+static inline void lat_hist_add(unsigned int set, unsigned int idx,
+                                s_time_t delta)
+{
+    unsigned int base, nr;
+
+    switch ( set )
+    {
+    case XEN_SYSCTL_LAT_HIST_vmexit:
+        base = LAT_HIST_VMEXIT_BASE;
+        nr = LAT_HIST_VMEXIT_NR;
+        break;
+    case XEN_SYSCTL_LAT_HIST_hypercall:
+        base = LAT_HIST_HYPERCALL_BASE;
+        nr = LAT_HIST_HYPERCALL_NR;
+        break;
+    case XEN_SYSCTL_LAT_HIST_grant_op:
+        base = LAT_HIST_GRANT_OP_BASE;
+        nr = LAT_HIST_GRANT_OP_NR;
+        break;
+    case XEN_SYSCTL_LAT_HIST_evtchn_send:
+        base = LAT_HIST_EVTCHN_BASE;
+        nr = LAT_HIST_EVTCHN_NR;
+        break;
+    default:
+        return;
+    }
+
+    if ( idx >= nr )
+        return;
+
+    this_cpu(lat_hist).count[base + idx][lat_hist_bucket(delta)]++;
+}
+
+static inline void lat_hist_end(unsigned int set, unsigned int idx,
+                                s_time_t start)
+{
+    if ( start )
+        lat_hist_add(set, idx, NOW() - start);
+}
+
+struct xen_sysctl_lat_hist;
+int lat_hist_op(struct xen_sysctl_lat_hist *op);
+
+#endif /* __XEN_LAT_HIST_H__ */
@@ -50,6 +50,9 @@ typedef int elf_negerrnoval; /* 0: ok; -EFOO: error */
 struct elf_binary;
 typedef void elf_log_callback(struct elf_binary*, void *caller_data,
                               bool iserr, const char *fmt, va_list al);
+typedef void elf_load_segment_callback(struct elf_binary*, void *caller_data,
+                                       void *dst, const void *src,
+                                       uint64_t filesz, uint64_t memsz);
 
 #endif
 
@@ -212,6 +215,9 @@ struct elf_binary {
     /* misc */
     elf_log_callback *log_callback;
     void *log_caller_data;
+    /* If set, loadable segments are handed here rather than copied. */
+    elf_load_segment_callback *load_segment;
+    void *load_segment_data;
 #else
     struct vcpu *vcpu;
 #endif
@@ -360,6 +366,14 @@ static inline void elf_set_vcpu(struct elf_binary *elf, struct vcpu *v)
 #else
 void elf_set_log(struct elf_binary *elf, elf_log_callback*,
                  void *log_caller_pointer, bool verbose);
+  /*
+   * Have elf_load_binary() pass each loadable segment, after its bounds
+   * have been checked, to the callback instead of copying it.  The
+   * caller must then copy filesz bytes from src to dst and zero the
+   * remaining memsz - filesz bytes itself.
+   */
+void elf_set_load_segment(struct elf_binary *elf, elf_load_segment_callback*,
+                          void *caller_data);
 #endif
 
 void elf_parse_binary(struct elf_binary *elf);
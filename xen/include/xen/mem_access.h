@@ -78,6 +78,13 @@ long p2m_set_mem_access_multi(struct domain *d,
  */
 int p2m_get_mem_access(struct domain *d, gfn_t gfn, xenmem_access_t *access);
 
+/*
+ * Set which 128-byte sub-pages of a gfn may be written, bit n of @write
+ * covering bytes [128n, 128n + 127].  Only takes effect while the gfn's
+ * access type denies writes; ~0 removes the sub-page permissions.
+ */
+int p2m_set_mem_access_subpage(struct domain *d, gfn_t gfn, uint32_t write);
+
 #ifdef CONFIG_HAS_MEM_ACCESS
 int mem_access_memop(unsigned long cmd,
                      XEN_GUEST_HANDLE_PARAM(xen_mem_access_op_t) arg);
@@ -8,11 +8,25 @@ PERFCOUNTER_ARRAY(hypercalls,           "hypercalls", NR_hypercalls)
 
 PERFCOUNTER(calls_to_multicall,         "calls to multicall")
 PERFCOUNTER(calls_from_multicall,       "calls from multicall")
+PERFCOUNTER(hypercall_preempt_inplace,  "hypercall preemption: softirqs run in place")
+PERFCOUNTER(hypercall_preempt_exit,     "hypercall preemption: continuations")
 
 PERFCOUNTER(irqs,                   "#interrupts")
 PERFCOUNTER(ipis,                   "#IPIs")
 
 PERFCOUNTER(rcu_idle_timer,         "RCU: idle_timer")
+PERFCOUNTER(rcu_grace_periods,      "RCU: grace periods")
+PERFCOUNTER(rcu_grace_period_us,    "RCU: grace period us")
+PERFCOUNTER(rcu_expedited,          "RCU: expedited batches")
+
+PERFCOUNTER(timer_add_wheel,        "timer: added to wheel")
+PERFCOUNTER(timer_add_heap,         "timer: added to heap")
+PERFCOUNTER(timer_add_list,         "timer: added to overflow list")
+PERFCOUNTER(timer_remove,           "timer: removed before expiry")
+PERFCOUNTER(timer_execute,          "timer: executed")
+PERFCOUNTER(timer_softirq,          "timer: softirq runs")
+
+PERFCOUNTER(evtchn_fifo_staged,     "evtchn: FIFO link left to lock holder")
 
 /* Generic scheduler counters (applicable to all schedulers) */
 PERFCOUNTER(sched_irq,              "sched: timer")
@@ -26,6 +40,8 @@ PERFCOUNTER(vcpu_insert,            "sched: vcpu_insert")
 PERFCOUNTER(vcpu_remove,            "sched: vcpu_remove")
 PERFCOUNTER(vcpu_sleep,             "sched: vcpu_sleep")
 PERFCOUNTER(vcpu_yield,             "sched: vcpu_yield")
+PERFCOUNTER(directed_yield,         "sched: directed_yield")
+PERFCOUNTER(directed_yield_failed,  "sched: directed_yield_failed")
 PERFCOUNTER(vcpu_wake_running,      "sched: vcpu_wake_running")
 PERFCOUNTER(vcpu_wake_onrunq,       "sched: vcpu_wake_onrunq")
 PERFCOUNTER(vcpu_wake_runnable,     "sched: vcpu_wake_runnable")
@@ -33,6 +49,7 @@ PERFCOUNTER(vcpu_wake_not_runnable, "sched: vcpu_wake_not_runnable")
 PERFCOUNTER(tickled_no_cpu,         "sched: tickled_no_cpu")
 PERFCOUNTER(tickled_idle_cpu,       "sched: tickled_idle_cpu")
 PERFCOUNTER(tickled_busy_cpu,       "sched: tickled_busy_cpu")
+PERFCOUNTER(tickled_llc_cpu,        "sched: tickled_llc_cpu")
 PERFCOUNTER(vcpu_check,             "sched: vcpu_check")
 
 /* credit specific counters */
@@ -58,6 +75,12 @@ PERFCOUNTER(migrate_running,        "csched: migrate_running")
 PERFCOUNTER(migrate_kicked_away,    "csched: migrate_kicked_away")
 PERFCOUNTER(vcpu_hot,               "csched: vcpu_hot")
 
+/* null specific counters */
+PERFCOUNTER(assign_node_local,      "snull: assign_node_local")
+PERFCOUNTER(assign_node_remote,     "snull: assign_node_remote")
+PERFCOUNTER(waitq_enqueue,          "snull: waitq_enqueue")
+PERFCOUNTER(waitq_assign,           "snull: waitq_assign")
+
 /* credit2 specific counters */
 PERFCOUNTER(burn_credits_t2c,       "csched2: burn_credits_t2c")
 PERFCOUNTER(acct_load_balance,      "csched2: acct_load_balance")
@@ -65,6 +88,8 @@ PERFCOUNTER(upd_max_weight_quick,   "csched2: update_max_weight_quick")
 PERFCOUNTER(upd_max_weight_full,    "csched2: update_max_weight_full")
 PERFCOUNTER(migrate_requested,      "csched2: migrate_requested")
 PERFCOUNTER(migrate_on_runq,        "csched2: migrate_on_runq")
+PERFCOUNTER(idle_steal,             "csched2: idle_steal")
+PERFCOUNTER(idle_steal_failed,      "csched2: idle_steal_failed")
 PERFCOUNTER(migrate_no_runq,        "csched2: migrate_no_runq")
 PERFCOUNTER(runtime_min_timer,      "csched2: runtime_min_timer")
 PERFCOUNTER(runtime_max_timer,      "csched2: runtime_max_timer")
@@ -76,7 +101,17 @@ PERFCOUNTER(credit_reset,           "csched2: credit_reset")
 PERFCOUNTER(deferred_to_tickled_cpu,"csched2: deferred_to_tickled_cpu")
 PERFCOUNTER(tickled_cpu_overwritten,"csched2: tickled_cpu_overwritten")
 PERFCOUNTER(tickled_cpu_overridden, "csched2: tickled_cpu_overridden")
+PERFCOUNTER(sched_unit_denied,      "csched2: sched_unit_denied")
+PERFCOUNTER(yield_to_boost,         "csched2: yield_to_boost")
 
 PERFCOUNTER(need_flush_tlb_flush,   "PG_need_flush tlb flushes")
 
+/* grant table counters */
+PERFCOUNTER(maptrack_grow,          "gnttab: maptrack frames added")
+PERFCOUNTER(maptrack_grow_raced,    "gnttab: maptrack growth raced")
+PERFCOUNTER(maptrack_steal,         "gnttab: maptrack entries stolen")
+PERFCOUNTER(maptrack_steal_failed,  "gnttab: maptrack steals failed")
+PERFCOUNTER(gnttab_copy_buf_hit,    "gnttab: copy buffer reused")
+PERFCOUNTER(gnttab_copy_buf_miss,   "gnttab: copy buffer claimed")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
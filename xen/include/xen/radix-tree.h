@@ -54,10 +54,14 @@ static inline int radix_tree_is_indirect_ptr(void *ptr)
 #define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
 #define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE-1)
 
+#define RADIX_TREE_MAX_TAGS	1
+#define RADIX_TREE_TAG_LONGS	BITS_TO_LONGS(RADIX_TREE_MAP_SIZE)
+
 struct radix_tree_node {
 	unsigned int	height;		/* Height from the bottom */
 	unsigned int	count;
 	void __rcu	*slots[RADIX_TREE_MAP_SIZE];
+	unsigned long	tags[RADIX_TREE_MAX_TAGS][RADIX_TREE_TAG_LONGS];
 };
 
 typedef struct radix_tree_node *radix_tree_alloc_fn_t(void *);
@@ -65,6 +69,7 @@ typedef void radix_tree_free_fn_t(struct radix_tree_node *, void *);
 
 struct radix_tree_root {
 	unsigned int		height;
+	unsigned int		tags;	/* Tags set anywhere in the tree */
 	struct radix_tree_node	__rcu *rnode;
 
 	/* Allow to specify custom node alloc/dealloc routines. */
@@ -108,8 +113,10 @@ void radix_tree_destroy(
  * radix_tree_lookup_slot
  * radix_tree_gang_lookup
  * radix_tree_gang_lookup_slot
+ * radix_tree_tag_get
+ * radix_tree_gang_lookup_tag
  *
- * The first 7 functions are able to be called locklessly, using RCU. The
+ * These functions are able to be called locklessly, using RCU. The
  * caller must ensure calls to these functions are made within rcu_read_lock()
  * regions. Other readers (lock-free or otherwise) and modifications may be
  * running concurrently.
@@ -204,5 +211,15 @@ unsigned long radix_tree_next_hole(struct radix_tree_root *root,
 				unsigned long index, unsigned long max_scan);
 unsigned long radix_tree_prev_hole(struct radix_tree_root *root,
 				unsigned long index, unsigned long max_scan);
+void *radix_tree_tag_set(struct radix_tree_root *root,
+			unsigned long index, unsigned int tag);
+void *radix_tree_tag_clear(struct radix_tree_root *root,
+			unsigned long index, unsigned int tag);
+int radix_tree_tag_get(struct radix_tree_root *root,
+			unsigned long index, unsigned int tag);
+unsigned int
+radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
+		unsigned long first_index, unsigned int max_items,
+		unsigned int tag);
 
 #endif /* _XEN_RADIX_TREE_H */
@@ -13,7 +13,7 @@ typedef struct {
 
 #define    RW_LOCK_UNLOCKED {           \
     .cnts = ATOMIC_INIT(0),             \
-    .lock = SPIN_LOCK_UNLOCKED          \
+    .lock = QUEUED_SPIN_LOCK_UNLOCKED   \
 }
 
 #define DEFINE_RWLOCK(l) rwlock_t l = RW_LOCK_UNLOCKED
@@ -128,11 +128,23 @@ struct task_slice {
     bool_t       migrated;
 };
 
+/*
+ * Scheduling granularity coarser than a thread (core scheduling).
+ *
+ * With sched-gran=core (or socket), vcpus of different domains never get to
+ * run at the same time on the pcpus of a unit (i.e., the sibling threads of
+ * a core, or all the threads of a socket). Schedulers that support this
+ * (the ones with gran_aware set) call sched_unit_allows() on the candidates
+ * they are about to pick; the generic code then records the actual choice.
+ */
+bool sched_unit_allows(unsigned int cpu, const struct vcpu *v);
+
 struct scheduler {
     char *name;             /* full name for this scheduler      */
     char *opt_name;         /* option name for this scheduler    */
     unsigned int sched_id;  /* ID for this scheduler             */
     void *sched_data;       /* global data pointer               */
+    bool gran_aware;        /* honours sched_unit_allows()       */
 
     int          (*global_init)    (void);
 
@@ -162,7 +174,11 @@ struct scheduler {
     void         (*sleep)          (const struct scheduler *, struct vcpu *);
     void         (*wake)           (const struct scheduler *, struct vcpu *);
     void         (*yield)          (const struct scheduler *, struct vcpu *);
+    bool         (*yield_to)       (const struct scheduler *, struct vcpu *,
+                                    struct vcpu *);
     void         (*context_saved)  (const struct scheduler *, struct vcpu *);
+    bool         (*is_waiting)     (const struct scheduler *,
+                                    const struct vcpu *);
 
     struct task_slice (*do_schedule) (const struct scheduler *, s_time_t,
                                       bool_t tasklet_work_scheduled);
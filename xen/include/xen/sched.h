@@ -112,6 +112,9 @@ struct evtchn
     u8 priority;
     u8 last_priority;
     u16 last_vcpu_id;
+    u32 holdoff;           /* Notification holdoff (ns), 0 if unmoderated */
+    u32 fifo_staged_next;  /* Next port on evtchn_fifo_queue's staged list */
+    bool fifo_staged;      /* On a staged list, awaiting linking */
 #ifdef CONFIG_XSM
     union {
 #ifdef XSM_NEED_GENERIC_EVTCHN_SSID
@@ -158,6 +161,10 @@ struct vcpu
 
     struct timer     poll_timer;    /* timeout for SCHEDOP_poll */
 
+    /* Deferred upcall for moderated event channels (EVTCHNOP_set_holdoff). */
+    struct timer     evtchn_holdoff_timer;
+    s_time_t         evtchn_notified;
+
     void            *sched_priv;    /* scheduler-specific data */
 
     struct vcpu_runstate_info runstate;
@@ -183,6 +190,8 @@ struct vcpu
     bool             is_initialised;
     /* Currently running on a CPU? */
     bool             is_running;
+    /* Woken up, and not run since then (for the wakeup latency histogram). */
+    bool             sched_woken;
     /* VCPU should wake fast (do not deep sleep the CPU). */
     bool             is_urgent;
 
@@ -264,6 +273,12 @@ struct vcpu
 
     struct evtchn_fifo_vcpu *evtchn_fifo;
 
+    /* Scheduling event counts, updated on runstate changes. */
+    uint64_t         sched_switches;   /* scheduled in */
+    uint64_t         sched_preempts;   /* running -> runnable */
+    uint64_t         sched_blocks;     /* running -> blocked */
+    uint64_t         sched_wakeups;    /* blocked -> runnable */
+
     struct arch_vcpu arch;
 };
 
@@ -272,7 +287,7 @@ struct vcpu
 #define domain_unlock(d) spin_unlock_recursive(&(d)->domain_lock)
 
 /* VM event */
-struct vm_event_domain
+struct vm_event_ring
 {
     /* ring lock */
     spinlock_t ring_lock;
@@ -286,8 +301,6 @@ struct vm_event_domain
     vm_event_front_ring_t front_ring;
     /* event channel port (vcpu0 only) */
     int xen_port;
-    /* vm_event bit for vcpu->pause_flags */
-    int pause_flag;
     /* list of vcpus waiting for room in the ring */
     struct waitqueue_head wq;
     /* the number of vCPUs blocked */
@@ -296,6 +309,20 @@ struct vm_event_domain
     unsigned int last_vcpu_wake_up;
 };
 
+struct vm_event_domain
+{
+    /* vm_event bit for vcpu->pause_flags */
+    int pause_flag;
+    /*
+     * vCPU n posts to rings[n % nr_rings]; requests from outside the
+     * domain go to rings[0].
+     */
+    unsigned int nr_rings;
+    /* the most vCPUs posting to a single ring */
+    unsigned int ring_vcpus;
+    struct vm_event_ring *rings;
+};
+
 struct evtchn_port_ops;
 
 enum guest_type {
@@ -308,6 +335,7 @@ struct domain
 
     unsigned int     max_vcpus;
     struct vcpu    **vcpu;
+    unsigned int     directed_yield_last; /* last vcpu_yield_directed() target */
 
     shared_info_t   *shared_info;     /* shared data area */
 
@@ -342,6 +370,7 @@ struct domain
     spinlock_t       event_lock;
     const struct evtchn_port_ops *evtchn_port_ops;
     struct evtchn_fifo_domain *evtchn_fifo;
+    struct evtchn_2l_hint **evtchn_2l_hint; /* per vCPU, may be NULL */
 
     struct grant_table *grant_table;
 
@@ -646,7 +675,12 @@ int  sched_init_vcpu(struct vcpu *v, unsigned int processor);
 void sched_destroy_vcpu(struct vcpu *v);
 int  sched_init_domain(struct domain *d, int poolid);
 void sched_destroy_domain(struct domain *d);
-int sched_move_domain(struct domain *d, struct cpupool *c);
+struct sched_move_data;
+struct sched_move_data *sched_alloc_move_data(struct domain *d,
+                                              struct cpupool *c);
+void sched_free_move_data(struct sched_move_data *md);
+int sched_move_domain(struct domain *d, struct cpupool *c,
+                      struct sched_move_data *md);
 long sched_adjust(struct domain *, struct xen_domctl_scheduler_op *);
 long sched_adjust_global(struct xen_sysctl_scheduler_op *);
 int  sched_id(void);
@@ -654,6 +688,7 @@ void sched_tick_suspend(void);
 void sched_tick_resume(void);
 void vcpu_wake(struct vcpu *v);
 long vcpu_yield(void);
+void vcpu_yield_directed(void);
 void vcpu_sleep_nosync(struct vcpu *v);
 void vcpu_sleep_sync(struct vcpu *v);
 
@@ -722,6 +757,17 @@ static inline void hypercall_cancel_continuation(struct vcpu *v)
         local_events_need_delivery()            \
     ))
 
+/*
+ * As hypercall_preempt_check(), but cheaper for loops whose restart is
+ * expensive.  When called with no locks held and outside any RCU
+ * read-side section, softirq work which does not involve switching
+ * away from the current vcpu is run in place and the loop may carry
+ * on; true is only returned when guest events are pending or another
+ * vcpu is waiting for this CPU.  Callers must leave nothing cached
+ * across the call that a softirq could invalidate.
+ */
+bool hypercall_preempt_check_inplace(void);
+
 /*
  * For long-running operations that may be in hypercall context or on
  * the idle vcpu (e.g. during dom0 construction), check if there is
@@ -846,6 +892,9 @@ void restore_vcpu_affinity(struct domain *d);
 int vcpu_pin_override(struct vcpu *v, int cpu);
 
 void vcpu_runstate_get(struct vcpu *v, struct vcpu_runstate_info *runstate);
+bool vcpu_is_waiting(const struct vcpu *v);
+struct xen_sysctl_sched_hist;
+int sched_hist_op(struct xen_sysctl_sched_hist *op);
 uint64_t get_cpu_idle_time(unsigned int cpu);
 
 /*
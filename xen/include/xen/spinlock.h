@@ -82,10 +82,15 @@ struct lock_profile_qhead {
     static struct lock_profile * const __lock_profile_##name                  \
     __used_section(".lockprofile.data") =                                     \
     &__lock_profile_data_##name
-#define _SPIN_LOCK_UNLOCKED(x) { { 0 }, SPINLOCK_NO_CPU, 0, _LOCK_DEBUG, x }
-#define SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(NULL)
+#define _SPIN_LOCK_UNLOCKED(x, q) { { 0 }, SPINLOCK_NO_CPU, 0, q, _LOCK_DEBUG, x }
+#define SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(NULL, 0)
+#define QUEUED_SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(NULL, 1)
 #define DEFINE_SPINLOCK(l)                                                    \
-    spinlock_t l = _SPIN_LOCK_UNLOCKED(NULL);                                 \
+    spinlock_t l = _SPIN_LOCK_UNLOCKED(NULL, 0);                              \
+    static struct lock_profile __lock_profile_data_##l = _LOCK_PROFILE(l);    \
+    _LOCK_PROFILE_PTR(l)
+#define DEFINE_QUEUED_SPINLOCK(l)                                             \
+    spinlock_t l = _SPIN_LOCK_UNLOCKED(NULL, 1);                              \
     static struct lock_profile __lock_profile_data_##l = _LOCK_PROFILE(l);    \
     _LOCK_PROFILE_PTR(l)
 
@@ -96,7 +101,7 @@ struct lock_profile_qhead {
         if (!prof) break;                                                     \
         prof->name = #l;                                                      \
         prof->lock = &(s)->l;                                                 \
-        (s)->l = (spinlock_t)_SPIN_LOCK_UNLOCKED(prof);                       \
+        (s)->l = (spinlock_t)_SPIN_LOCK_UNLOCKED(prof, 0);                     \
         prof->next = (s)->profile_head.elem_q;                                \
         (s)->profile_head.elem_q = prof;                                      \
     } while(0)
@@ -118,8 +123,10 @@ extern void spinlock_profile_reset(unsigned char key);
 
 struct lock_profile_qhead { };
 
-#define SPIN_LOCK_UNLOCKED { { 0 }, SPINLOCK_NO_CPU, 0, _LOCK_DEBUG }
+#define SPIN_LOCK_UNLOCKED { { 0 }, SPINLOCK_NO_CPU, 0, 0, _LOCK_DEBUG }
+#define QUEUED_SPIN_LOCK_UNLOCKED { { 0 }, SPINLOCK_NO_CPU, 0, 1, _LOCK_DEBUG }
 #define DEFINE_SPINLOCK(l) spinlock_t l = SPIN_LOCK_UNLOCKED
+#define DEFINE_QUEUED_SPINLOCK(l) spinlock_t l = QUEUED_SPIN_LOCK_UNLOCKED
 
 #define spin_lock_init_prof(s, l) spin_lock_init(&((s)->l))
 #define lock_profile_register_struct(type, ptr, idx, print)
@@ -133,6 +140,11 @@ typedef union {
         u16 head;
         u16 tail;
     };
+    struct {            /* queued locks, see qspinlock.c */
+        u8 locked;
+        u8 pad;
+        u16 qtail;
+    };
 } spinlock_tickets_t;
 
 #define SPINLOCK_TICKET_INC { .head_tail = 0x10000, }
@@ -143,6 +155,7 @@ typedef struct spinlock {
 #define SPINLOCK_NO_CPU 0xfffu
     u16 recurse_cnt:4;
 #define SPINLOCK_MAX_RECURSE 0xfu
+    bool queued;
     struct lock_debug debug;
 #ifdef CONFIG_LOCK_PROFILE
     struct lock_profile *profile;
@@ -151,6 +164,21 @@ typedef struct spinlock {
 
 
 #define spin_lock_init(l) (*(l) = (spinlock_t)SPIN_LOCK_UNLOCKED)
+#define spin_lock_init_queued(l) (*(l) = (spinlock_t)QUEUED_SPIN_LOCK_UNLOCKED)
+
+/*
+ * Queued locks make each waiter spin on its own cache line instead of all
+ * of them on the lock, which pays off for locks contended across sockets.
+ * They are chosen per lock with DEFINE_QUEUED_SPINLOCK() or
+ * spin_lock_init_queued(), or for all locks with CONFIG_QUEUED_SPINLOCKS.
+ */
+static always_inline bool spin_lock_is_queued(const spinlock_t *lock)
+{
+    return IS_ENABLED(CONFIG_QUEUED_SPINLOCKS) || lock->queued;
+}
+
+void queued_spin_lock_slowpath(spinlock_tickets_t *t,
+                               void (*cb)(void *), void *data);
 
 void _spin_lock(spinlock_t *lock);
 void _spin_lock_cb(spinlock_t *lock, void (*cond)(void *), void *data);
@@ -208,4 +236,15 @@ void _spin_unlock_recursive(spinlock_t *lock);
 #define spin_lock_recursive(l)        _spin_lock_recursive(l)
 #define spin_unlock_recursive(l)      _spin_unlock_recursive(l)
 
+/*
+ * Contention profiling (XEN_SYSCTL_lockcont_op).  lock_cont_start() is
+ * called once a lock turned out to be contended, and returns a start time
+ * if this acquisition is to be sampled or a negative value otherwise;
+ * lock_cont_wait() accounts a sampled wait to the call site.
+ */
+struct xen_sysctl_lockcont_op;
+s64 lock_cont_start(void);
+void lock_cont_wait(unsigned int type, const void *site, s64 start);
+int lock_cont_control(struct xen_sysctl_lockcont_op *op);
+
 #endif /* __SPINLOCK_H__ */
@@ -26,6 +26,8 @@ struct timer {
         struct timer *list_next;
         /* Linked list of inactive timers (TIMER_STATUS_inactive). */
         struct list_head inactive;
+        /* Timer-wheel slot (TIMER_STATUS_in_wheel). */
+        struct list_head wheel;
     };
 
     /* On expiry, '(*function)(data)' will be executed in softirq context. */
@@ -42,6 +44,7 @@ struct timer {
 #define TIMER_STATUS_killed   2 /* Not in use; cannot be activated. */
 #define TIMER_STATUS_in_heap  3 /* In use; on timer heap.           */
 #define TIMER_STATUS_in_list  4 /* In use; on overflow linked list. */
+#define TIMER_STATUS_in_wheel 5 /* In use; on near-term timer wheel. */
     uint8_t status;
 };
 
@@ -213,6 +213,18 @@ int tmem_compress_from_client(xen_pfn_t, void **, size_t *,
 
 int tmem_copy_from_client(struct page_info *, xen_pfn_t, tmem_cli_va_param_t);
 int tmem_copy_to_client(xen_pfn_t, struct page_info *, tmem_cli_va_param_t);
+int tmem_zero_to_client(xen_pfn_t, tmem_cli_va_param_t);
+
+static inline bool tmem_page_is_zero(const void *va)
+{
+    const unsigned long *p = va;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); i++ )
+        if ( p[i] )
+            return false;
+    return true;
+}
 
 #define tmem_client_err(fmt, args...)  printk(XENLOG_G_ERR fmt, ##args)
 #define tmem_client_warn(fmt, args...) printk(XENLOG_G_WARNING fmt, ##args)
@@ -313,8 +325,12 @@ struct tmem_pool {
     struct client *client;
     uint64_t uuid[2]; /* 0 for private, non-zero for shared. */
     uint32_t pool_id;
-    rwlock_t pool_rwlock;
-    struct rb_root obj_rb_root[OBJ_HASH_BUCKETS]; /* Protected by pool_rwlock. */
+    /*
+     * Each object hash bucket has its own lock, so puts and gets on
+     * different objects of the same pool do not serialise.
+     */
+    rwlock_t obj_rb_lock[OBJ_HASH_BUCKETS];
+    struct rb_root obj_rb_root[OBJ_HASH_BUCKETS]; /* Protected by obj_rb_lock. */
     struct list_head share_list; /* Valid if shared. */
     int shared_count; /* Valid if shared. */
     /* For save/restore/migration. */
@@ -323,8 +339,8 @@ struct tmem_pool {
     /* Statistics collection. */
     atomic_t pgp_count;
     int pgp_count_max;
-    long obj_count;  /* Atomicity depends on pool_rwlock held for write. */
-    long obj_count_max;
+    atomic_t obj_count;
+    int obj_count_max;
     unsigned long objnode_count, objnode_count_max;
     uint64_t sum_life_cycles;
     uint64_t sum_evicted_cycles;
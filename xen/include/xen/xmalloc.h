@@ -30,6 +30,9 @@ extern void xfree(void *);
 extern void *_xmalloc(unsigned long size, unsigned long align);
 extern void *_xzalloc(unsigned long size, unsigned long align);
 
+/* Print statistics of the per-CPU caches in front of the xmalloc pool. */
+extern void xmalloc_cache_info(void);
+
 static inline void *_xmalloc_array(
     unsigned long size, unsigned long align, unsigned long num)
 {
@@ -48,6 +51,24 @@ static inline void *_xzalloc_array(
     return _xzalloc(size * num, align);
 }
 
+/*
+ * Caches of fixed-size objects, see common/xmem_cache.c.  @ctor, if given,
+ * is run once per object when it first enters the cache; objects have to
+ * be freed in constructed state.  Objects can't be larger than a quarter
+ * of a page.
+ */
+
+struct xmem_cache;
+
+struct xmem_cache *xmem_cache_create(const char *name, unsigned int size,
+                                     unsigned int align, void (*ctor)(void *));
+void xmem_cache_destroy(struct xmem_cache *cache);
+void *xmem_cache_alloc(struct xmem_cache *cache);
+void xmem_cache_free(struct xmem_cache *cache, void *obj);
+
+/* Print statistics of all object caches. */
+void xmem_cache_info(void);
+
 /*
  * Pooled allocator interface.
  */
@@ -26,6 +26,7 @@
 #include <xen/sched.h>
 #include <xen/init.h>
 #include <xen/rcupdate.h>
+#include <asm/hardirq.h>
 #include <asm/atomic.h>
 #include <asm/current.h>
 #include <public/xsm/flask_op.h>
@@ -52,17 +53,25 @@ const struct selinux_class_perm selinux_class_perm = {
     .cts_len = ARRAY_SIZE(class_to_string),
 };
 
-#define AVC_CACHE_SLOTS            512
+#define AVC_DEF_CACHE_SLOTS        512
+#define AVC_MAX_CACHE_SLOTS        (1u << 16)
 #define AVC_DEF_CACHE_THRESHOLD        512
 #define AVC_CACHE_RECLAIM        16
+#define AVC_PCPU_SLOTS            64
 
 #ifdef CONFIG_FLASK_AVC_STATS
 #define avc_cache_stats_incr(field)                 \
 do {                                \
     __get_cpu_var(avc_cache_stats).field++;        \
 } while (0)
+#define avc_class_stats_incr(tclass, field)                     \
+do {                                                            \
+    if ( (tclass) < ARRAY_SIZE(class_to_string) )               \
+        __get_cpu_var(avc_class_stats)[tclass].field++;         \
+} while (0)
 #else
 #define avc_cache_stats_incr(field)    do {} while (0)
+#define avc_class_stats_incr(tclass, field)    do {} while (0)
 #endif
 
 struct avc_entry {
@@ -79,27 +88,53 @@ struct avc_node {
 };
 
 struct avc_cache {
-    struct hlist_head    slots[AVC_CACHE_SLOTS]; /* head for avc_node->list */
-    spinlock_t        slots_lock[AVC_CACHE_SLOTS]; /* lock for writes */
+    struct hlist_head    *slots; /* head for avc_node->list */
+    spinlock_t        *slots_lock; /* lock for writes */
+    unsigned int        nr_slots; /* power of two */
     atomic_t        lru_hint;    /* LRU hint for reclaim scan */
     atomic_t        active_nodes;
     u32            latest_notif;    /* latest revocation notification */
 };
 
+/*
+ * Per-CPU front cache, holding copies of recently used decisions so that
+ * the hottest (ssid, tsid, tclass) triples are answered without touching
+ * the shared hash.  An entry is only trusted while its sequence number is
+ * not older than the latest revocation notification, so a policy reset
+ * invalidates every CPU's copy without any cross-CPU work.  Entries are
+ * only read and written outside of interrupt context, and Xen does not
+ * preempt, so no locking is needed.
+ */
+struct avc_pcpu_cache {
+    struct avc_entry    ent[AVC_PCPU_SLOTS];
+};
+
 /* Exported via Flask hypercall */
 unsigned int avc_cache_threshold = AVC_DEF_CACHE_THRESHOLD;
 
 #ifdef CONFIG_FLASK_AVC_STATS
 DEFINE_PER_CPU(struct avc_cache_stats, avc_cache_stats);
+DEFINE_PER_CPU(struct avc_class_stats[ARRAY_SIZE(class_to_string)],
+               avc_class_stats);
 #endif
 
 static struct avc_cache avc_cache;
+static DEFINE_PER_CPU(struct avc_pcpu_cache, avc_pcpu_cache);
+
+/* Number of hash buckets, rounded up to a power of two. */
+static unsigned int __initdata opt_avc_slots = AVC_DEF_CACHE_SLOTS;
+integer_param("flask_avc_slots", opt_avc_slots);
 
 static DEFINE_RCU_READ_LOCK(avc_rcu_lock);
 
+static inline int avc_raw_hash(u32 ssid, u32 tsid, u16 tclass)
+{
+    return ssid ^ (tsid<<2) ^ (tclass<<4);
+}
+
 static inline int avc_hash(u32 ssid, u32 tsid, u16 tclass)
 {
-    return (ssid ^ (tsid<<2) ^ (tclass<<4)) & (AVC_CACHE_SLOTS - 1);
+    return avc_raw_hash(ssid, tsid, tclass) & (avc_cache.nr_slots - 1);
 }
 
 /* no use making this larger than the printk buffer */
@@ -230,8 +265,22 @@ static void avc_dump_query(struct avc_dump_buf *buf, u32 ssid, u32 tsid, u16 tcl
 void __init avc_init(void)
 {
     int i;
+    unsigned int nr = AVC_MAX_CACHE_SLOTS;
+
+    if ( opt_avc_slots < AVC_MAX_CACHE_SLOTS )
+        nr = 1u << fls(max(opt_avc_slots, 2u) - 1);
+
+    avc_cache.slots = xmalloc_array(struct hlist_head, nr);
+    avc_cache.slots_lock = xmalloc_array(spinlock_t, nr);
+    if ( !avc_cache.slots || !avc_cache.slots_lock )
+        panic("Flask: Unable to allocate %u AVC slots\n", nr);
+    avc_cache.nr_slots = nr;
 
-    for ( i = 0; i < AVC_CACHE_SLOTS; i++ )
+    /* Keep roughly one entry per bucket, as with the default sizing. */
+    if ( nr > AVC_DEF_CACHE_SLOTS )
+        avc_cache_threshold = nr;
+
+    for ( i = 0; i < nr; i++ )
     {
         INIT_HLIST_HEAD(&avc_cache.slots[i]);
         spin_lock_init(&avc_cache.slots_lock[i]);
@@ -250,7 +299,7 @@ int avc_get_hash_stats(struct xen_flask_hash_stats *arg)
 
     slots_used = 0;
     max_chain_len = 0;
-    for ( i = 0; i < AVC_CACHE_SLOTS; i++ )
+    for ( i = 0; i < avc_cache.nr_slots; i++ )
     {
         head = &avc_cache.slots[i];
         if ( !hlist_empty(head) )
@@ -270,12 +319,19 @@ int avc_get_hash_stats(struct xen_flask_hash_stats *arg)
     
     arg->entries = atomic_read(&avc_cache.active_nodes);
     arg->buckets_used = slots_used;
-    arg->buckets_total = AVC_CACHE_SLOTS;
+    arg->buckets_total = avc_cache.nr_slots;
     arg->max_chain_len = max_chain_len;
 
     return 0;
 }
 
+#ifdef CONFIG_FLASK_AVC_STATS
+unsigned int avc_nr_classes(void)
+{
+    return ARRAY_SIZE(class_to_string);
+}
+#endif
+
 static void avc_node_free(struct rcu_head *rhead)
 {
     struct avc_node *node = container_of(rhead, struct avc_node, rhead);
@@ -313,10 +369,10 @@ static inline int avc_reclaim_node(void)
     struct hlist_node *next;
     spinlock_t *lock;
 
-    for ( try = 0, ecx = 0; try < AVC_CACHE_SLOTS; try++ )
+    for ( try = 0, ecx = 0; try < avc_cache.nr_slots; try++ )
     {
         atomic_inc(&avc_cache.lru_hint);
-        hvalue =  atomic_read(&avc_cache.lru_hint) & (AVC_CACHE_SLOTS - 1);
+        hvalue =  atomic_read(&avc_cache.lru_hint) & (avc_cache.nr_slots - 1);
         head = &avc_cache.slots[hvalue];
         lock = &avc_cache.slots_lock[hvalue];
 
@@ -422,6 +478,47 @@ static struct avc_node *avc_lookup(u32 ssid, u32 tsid, u16 tclass)
     return node;
 }
 
+static struct avc_entry *avc_pcpu_slot(u32 ssid, u32 tsid, u16 tclass)
+{
+    return &this_cpu(avc_pcpu_cache).ent[avc_raw_hash(ssid, tsid, tclass) &
+                                         (AVC_PCPU_SLOTS - 1)];
+}
+
+/*
+ * Look up a decision in this CPU's front cache, returning NULL if there is
+ * none or it predates the latest policy reset.
+ */
+static const struct av_decision *avc_pcpu_lookup(u32 ssid, u32 tsid,
+                                                 u16 tclass)
+{
+    const struct avc_entry *ent;
+
+    if ( in_irq() )
+        return NULL;
+
+    ent = avc_pcpu_slot(ssid, tsid, tclass);
+    if ( ent->ssid != ssid || ent->tsid != tsid || ent->tclass != tclass ||
+         ent->avd.seqno < read_atomic(&avc_cache.latest_notif) )
+        return NULL;
+
+    return &ent->avd;
+}
+
+static void avc_pcpu_insert(u32 ssid, u32 tsid, u16 tclass,
+                            const struct av_decision *avd)
+{
+    struct avc_entry *ent;
+
+    if ( in_irq() )
+        return;
+
+    ent = avc_pcpu_slot(ssid, tsid, tclass);
+    ent->ssid = ssid;
+    ent->tsid = tsid;
+    ent->tclass = tclass;
+    ent->avd = *avd;
+}
+
 static int avc_latest_notif_update(int seqno, int is_insert)
 {
     int ret = 0;
@@ -683,7 +780,7 @@ int avc_ss_reset(u32 seqno)
     struct hlist_node *next;
     spinlock_t *lock;
 
-    for ( i = 0; i < AVC_CACHE_SLOTS; i++ )
+    for ( i = 0; i < avc_cache.nr_slots; i++ )
     {
         head = &avc_cache.slots[i];
         lock = &avc_cache.slots_lock[i];
@@ -723,18 +820,39 @@ int avc_has_perm_noaudit(u32 ssid, u32 tsid, u16 tclass, u32 requested,
                          struct av_decision *in_avd)
 {
     struct avc_node *node;
+    const struct av_decision *pavd;
     struct av_decision avd_entry, *avd;
     int rc = 0;
     u32 denied;
 
     BUG_ON(!requested);
 
+    avc_class_stats_incr(tclass, lookups);
+
+    /*
+     * Only grants are answered from the front cache: denials need the shared
+     * node for the permissive-mode update below, so fall through to it.
+     */
+    pavd = avc_pcpu_lookup(ssid, tsid, tclass);
+    if ( pavd && !(requested & ~pavd->allowed) )
+    {
+        avc_cache_stats_incr(lookups);
+        avc_cache_stats_incr(hits);
+        avc_cache_stats_incr(pcpu_hits);
+        avc_class_stats_incr(tclass, hits);
+        avc_class_stats_incr(tclass, pcpu_hits);
+        if ( in_avd )
+            *in_avd = *pavd;
+        return 0;
+    }
+
     rcu_read_lock(&avc_rcu_lock);
 
     node = avc_lookup(ssid, tsid, tclass);
     if ( !node )
     {
         rcu_read_unlock(&avc_rcu_lock);
+        avc_class_stats_incr(tclass, misses);
 
         if ( in_avd )
             avd = in_avd;
@@ -746,10 +864,14 @@ int avc_has_perm_noaudit(u32 ssid, u32 tsid, u16 tclass, u32 requested,
             goto out;
         rcu_read_lock(&avc_rcu_lock);
         node = avc_insert(ssid,tsid,tclass,avd);
+        if ( node )
+            avc_pcpu_insert(ssid, tsid, tclass, avd);
     } else {
+        avc_class_stats_incr(tclass, hits);
         if ( in_avd )
             memcpy(in_avd, &node->ae.avd, sizeof(*in_avd));
         avd = &node->ae.avd;
+        avc_pcpu_insert(ssid, tsid, tclass, avd);
     }
 
     denied = requested & ~(avd->allowed);
@@ -45,6 +45,7 @@ bool __read_mostly flask_enforcing = true;
         1UL<<FLASK_SETBOOL | \
         1UL<<FLASK_AVC_HASHSTATS | \
         1UL<<FLASK_AVC_CACHESTATS | \
+        1UL<<FLASK_AVC_CLASSSTATS | \
         1UL<<FLASK_MEMBER | \
         1UL<<FLASK_GET_PEER_SID | \
    0)
@@ -444,6 +445,26 @@ static int flask_security_avc_cachestats(struct xen_flask_cache_stats *arg)
     arg->allocations = st->allocations;
     arg->reclaims = st->reclaims;
     arg->frees = st->frees;
+    arg->pcpu_hits = st->pcpu_hits;
+
+    return 0;
+}
+
+static int flask_security_avc_classstats(struct xen_flask_class_stats *arg)
+{
+    struct avc_class_stats *st;
+
+    if ( arg->cpu >= nr_cpu_ids || !cpu_online(arg->cpu) )
+        return -ENOENT;
+    if ( !arg->tclass || arg->tclass >= avc_nr_classes() )
+        return -ENOENT;
+
+    st = &per_cpu(avc_class_stats, arg->cpu)[arg->tclass];
+
+    arg->lookups = st->lookups;
+    arg->hits = st->hits;
+    arg->pcpu_hits = st->pcpu_hits;
+    arg->misses = st->misses;
 
     return 0;
 }
@@ -717,6 +738,10 @@ ret_t do_flask_op(XEN_GUEST_HANDLE_PARAM(xsm_op_t) u_flask_op)
     case FLASK_AVC_CACHESTATS:
         rv = flask_security_avc_cachestats(&op.u.cache_stats);
         break;
+
+    case FLASK_AVC_CLASSSTATS:
+        rv = flask_security_avc_classstats(&op.u.class_stats);
+        break;
 #endif
 
     case FLASK_MEMBER:
@@ -771,6 +796,7 @@ ret_t do_flask_op(XEN_GUEST_HANDLE_PARAM(xsm_op_t) u_flask_op)
 
 CHECK_flask_access;
 CHECK_flask_cache_stats;
+CHECK_flask_class_stats;
 CHECK_flask_hash_stats;
 CHECK_flask_ocontext;
 CHECK_flask_peersid;
@@ -627,6 +627,7 @@ static int flask_domctl(struct domain *d, int cmd)
 
     case XEN_DOMCTL_setvcpuaffinity:
     case XEN_DOMCTL_setnodeaffinity:
+    case XEN_DOMCTL_numa_balance:
         return current_has_perm(d, SECCLASS_DOMAIN, DOMAIN__SETAFFINITY);
 
     case XEN_DOMCTL_getvcpuaffinity:
@@ -658,6 +659,7 @@ static int flask_domctl(struct domain *d, int cmd)
         return current_has_perm(d, SECCLASS_DOMAIN, DOMAIN__GETVCPUCONTEXT);
 
     case XEN_DOMCTL_getvcpuinfo:
+    case XEN_DOMCTL_get_exit_stats:
         return current_has_perm(d, SECCLASS_DOMAIN, DOMAIN__GETVCPUINFO);
 
     case XEN_DOMCTL_settimeoffset:
@@ -764,6 +766,8 @@ static int flask_sysctl(int cmd)
     /* These have individual XSM hooks */
     case XEN_SYSCTL_readconsole:
     case XEN_SYSCTL_getdomaininfolist:
+    case XEN_SYSCTL_vcpuinfolist:
+    case XEN_SYSCTL_domschedstats:
     case XEN_SYSCTL_page_offline_op:
     case XEN_SYSCTL_scheduler_op:
 #ifdef CONFIG_X86
@@ -778,6 +782,8 @@ static int flask_sysctl(int cmd)
         return domain_has_xen(current->domain, XEN__GETSCHEDULER);
 
     case XEN_SYSCTL_perfc_op:
+    case XEN_SYSCTL_sched_hist:
+    case XEN_SYSCTL_lat_hist:
         return domain_has_xen(current->domain, XEN__PERFCONTROL);
 
     case XEN_SYSCTL_debug_keys:
@@ -796,6 +802,7 @@ static int flask_sysctl(int cmd)
         return domain_has_xen(current->domain, XEN__PM_OP);
 
     case XEN_SYSCTL_lockprof_op:
+    case XEN_SYSCTL_lockcont_op:
         return domain_has_xen(current->domain, XEN__LOCKPROF);
 
     case XEN_SYSCTL_cpupool_op:
@@ -805,6 +812,7 @@ static int flask_sysctl(int cmd)
     case XEN_SYSCTL_cputopoinfo:
     case XEN_SYSCTL_numainfo:
     case XEN_SYSCTL_pcitopoinfo:
+    case XEN_SYSCTL_scrubinfo:
         return domain_has_xen(current->domain, XEN__PHYSINFO);
 
     case XEN_SYSCTL_psr_cmt_op:
@@ -814,6 +822,10 @@ static int flask_sysctl(int cmd)
         return avc_current_has_perm(SECINITSID_XEN, SECCLASS_XEN2,
                                     XEN2__PSR_CAT_OP, NULL);
 
+    case XEN_SYSCTL_pmu_sample:
+        return avc_current_has_perm(SECINITSID_XEN, SECCLASS_XEN2,
+                                    XEN2__PMU_CTRL, NULL);
+
     case XEN_SYSCTL_tmem_op:
         return domain_has_xen(current->domain, XEN__TMEM_CONTROL);
 
@@ -1438,6 +1450,7 @@ static int flask_platform_op(uint32_t op)
         return domain_has_xen(current->domain, XEN__MTRR_READ);
 
     case XENPF_microcode_update:
+    case XENPF_microcode_update2:
         return domain_has_xen(current->domain, XEN__MICROCODE);
 
     case XENPF_platform_quirk:
@@ -1503,6 +1516,9 @@ static int flask_shadow_control(struct domain *d, uint32_t op)
     case XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY:
     case XEN_DOMCTL_SHADOW_OP_PEEK:
     case XEN_DOMCTL_SHADOW_OP_CLEAN:
+    case XEN_DOMCTL_SHADOW_OP_GET_DIRTY_RATE:
+    case XEN_DOMCTL_SHADOW_OP_PEEK_SPARSE:
+    case XEN_DOMCTL_SHADOW_OP_CLEAN_SPARSE:
         perm = SHADOW__LOGDIRTY;
         break;
     default:
@@ -73,6 +73,16 @@ struct avc_cache_stats
     unsigned int allocations;
     unsigned int reclaims;
     unsigned int frees;
+    unsigned int pcpu_hits;
+};
+
+/* Per security class counters, indexed by tclass. */
+struct avc_class_stats
+{
+    unsigned int lookups;
+    unsigned int hits;
+    unsigned int pcpu_hits;
+    unsigned int misses;
 };
 
 /*
@@ -97,6 +107,8 @@ extern unsigned int avc_cache_threshold;
 
 #ifdef CONFIG_FLASK_AVC_STATS
 DECLARE_PER_CPU(struct avc_cache_stats, avc_cache_stats);
+DECLARE_PER_CPU(struct avc_class_stats[], avc_class_stats);
+unsigned int avc_nr_classes(void);
 #endif
 
 #endif /* _FLASK_AVC_H_ */
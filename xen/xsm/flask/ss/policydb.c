@@ -683,6 +683,7 @@ void policydb_destroy(struct policydb *p)
         p->ocontexts[i] = NULL;
     }
 
+    te_table_destroy(p);
     cond_policydb_destroy(p);
 
     for ( tr = p->role_tr; tr; tr = tr->next )
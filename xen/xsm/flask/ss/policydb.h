@@ -31,6 +31,7 @@
 #include "sidtab.h"
 #include "context.h"
 #include "constraint.h"
+#include "tetable.h"
 
 /*
  * A datum type is defined for each kind of symbol
@@ -240,6 +241,9 @@ struct policydb {
     /* type -> attribute reverse mapping */
     struct ebitmap *type_attr_map;
 
+    /* flattened type enforcement access vectors */
+    struct te_table te_table;
+
     struct ebitmap policycaps;
 
     struct ebitmap permissive_map;
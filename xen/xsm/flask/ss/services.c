@@ -457,12 +457,8 @@ static int context_struct_compute_av(struct context *scontext,
 {
     struct constraint_node *constraint;
     struct role_allow *ra;
-    struct avtab_key avkey;
-    struct avtab_node *node;
     struct class_datum *tclass_datum;
-    struct ebitmap *sattr, *tattr;
-    struct ebitmap_node *snode, *tnode;
-    unsigned int i, j;
+    const struct te_av *te;
 
     /*
      * Initialize the access vectors to the default values.
@@ -483,35 +479,18 @@ static int context_struct_compute_av(struct context *scontext,
 
     /*
      * If a specific type enforcement rule was defined for
-     * this permission check, then use it.
+     * this permission check, then use it: from the flattened
+     * table when the policy has one, else from the avtabs.
      */
-    avkey.target_class = tclass;
-    avkey.specified = AVTAB_AV;
-    sattr = &policydb.type_attr_map[scontext->type - 1];
-    tattr = &policydb.type_attr_map[tcontext->type - 1];
-    ebitmap_for_each_positive_bit(sattr, snode, i)
+    te = te_table_lookup(&policydb, scontext->type, tcontext->type, tclass);
+    if ( te )
     {
-        ebitmap_for_each_positive_bit(tattr, tnode, j)
-        {
-            avkey.source_type = i + 1;
-            avkey.target_type = j + 1;
-            for ( node = avtab_search_node(&policydb.te_avtab, &avkey);
-                 node != NULL;
-                 node = avtab_search_node_next(node, avkey.specified) )
-            {
-                if ( node->key.specified == AVTAB_ALLOWED )
-                    avd->allowed |= node->datum.data;
-                else if ( node->key.specified == AVTAB_AUDITALLOW )
-                    avd->auditallow |= node->datum.data;
-                else if ( node->key.specified == AVTAB_AUDITDENY )
-                    avd->auditdeny &= node->datum.data;
-            }
-
-            /* Check conditional av table for additional permissions */
-            cond_compute_av(&policydb.te_cond_avtab, &avkey, avd);
-
-        }
+        avd->allowed = te->allowed;
+        avd->auditallow = te->auditallow;
+        avd->auditdeny = te->auditdeny;
     }
+    else
+        te_compute_av(&policydb, scontext->type, tcontext->type, tclass, avd);
 
     /*
      * Remove any permissions prohibited by a constraint (this includes
@@ -1386,6 +1365,13 @@ int security_load_policy(const void *data, size_t len)
             policydb_destroy(&policydb);
             return -EINVAL;
         }
+        if ( te_table_build(&policydb) )
+        {
+            LOAD_UNLOCK;
+            sidtab_destroy(&sidtab);
+            policydb_destroy(&policydb);
+            return -ENOMEM;
+        }
         policydb_loaded_version = policydb.policyvers;
         ss_initialized = 1;
         seqno = ++latest_granting;
@@ -1422,6 +1408,11 @@ int security_load_policy(const void *data, size_t len)
         goto err;
     }
 
+    /* Flatten the type enforcement rules, with the booleans applied. */
+    rc = te_table_build(&newpolicydb);
+    if ( rc )
+        goto err;
+
     /* Clone the SID table. */
     sidtab_shutdown(&sidtab);
     if ( sidtab_map(&sidtab, clone_sid, &newsidtab) )
@@ -1872,9 +1863,13 @@ int security_set_bools(int len, int *values)
 
     for ( cur = policydb.cond_list; cur != NULL; cur = cur->next )
     {
+        int old_state = cur->cur_state;
+
         rc = evaluate_cond_node(&policydb, cur);
         if ( rc )
             goto out;
+        if ( cur->cur_state != old_state )
+            te_table_update_cond(&policydb, cur);
     }
 
     seqno = ++latest_granting;
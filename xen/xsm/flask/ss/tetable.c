@@ -0,0 +1,208 @@
+/*
+ * Implementation of the type enforcement table.
+ *
+ * The table is built when a policy is loaded, for every non-attribute
+ * type, and entries are recomputed when a boolean change toggles the
+ * conditional rules that feed them.  Policies too large for a dense
+ * table are left without one, and decisions are then computed from the
+ * avtabs as before.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License version 2,
+ *      as published by the Free Software Foundation.
+ */
+
+#include <xen/lib.h>
+#include <xen/types.h>
+#include <xen/xmalloc.h>
+#include <xen/vmap.h>
+#include <xen/errno.h>
+
+#include "security.h"
+#include "policydb.h"
+#include "conditional.h"
+#include "tetable.h"
+
+/* Upper bound on the size of the table, above which it is not built. */
+#define TE_TABLE_MAX_BYTES    (16u << 20)
+
+/*
+ * Compute the type enforcement access vectors for a type pair into @avd,
+ * from every rule on any attribute of either type.
+ */
+void te_compute_av(struct policydb *p, u32 stype, u32 ttype, u16 tclass,
+                   struct av_decision *avd)
+{
+    struct avtab_key avkey;
+    struct avtab_node *node;
+    struct ebitmap *sattr, *tattr;
+    struct ebitmap_node *snode, *tnode;
+    unsigned int i, j;
+
+    avkey.target_class = tclass;
+    avkey.specified = AVTAB_AV;
+    sattr = &p->type_attr_map[stype - 1];
+    tattr = &p->type_attr_map[ttype - 1];
+    ebitmap_for_each_positive_bit(sattr, snode, i)
+    {
+        ebitmap_for_each_positive_bit(tattr, tnode, j)
+        {
+            avkey.source_type = i + 1;
+            avkey.target_type = j + 1;
+            for ( node = avtab_search_node(&p->te_avtab, &avkey);
+                 node != NULL;
+                 node = avtab_search_node_next(node, avkey.specified) )
+            {
+                if ( node->key.specified == AVTAB_ALLOWED )
+                    avd->allowed |= node->datum.data;
+                else if ( node->key.specified == AVTAB_AUDITALLOW )
+                    avd->auditallow |= node->datum.data;
+                else if ( node->key.specified == AVTAB_AUDITDENY )
+                    avd->auditdeny &= node->datum.data;
+            }
+
+            /* Check conditional av table for additional permissions */
+            cond_compute_av(&p->te_cond_avtab, &avkey, avd);
+        }
+    }
+}
+
+static struct te_av *te_table_entry(struct te_table *t, u32 sidx, u32 tidx,
+                                    u16 tclass)
+{
+    return &t->av[((size_t)sidx * t->ntypes + tidx) * t->nclasses +
+                  tclass - 1];
+}
+
+static void te_table_fill(struct policydb *p, u32 stype, u32 ttype, u16 tclass)
+{
+    struct te_table *t = &p->te_table;
+    struct te_av *av = te_table_entry(t, t->type_index[stype - 1] - 1,
+                                      t->type_index[ttype - 1] - 1, tclass);
+    struct av_decision avd = { .auditdeny = 0xffffffff };
+
+    te_compute_av(p, stype, ttype, tclass, &avd);
+
+    av->allowed = avd.allowed;
+    av->auditallow = avd.auditallow;
+    av->auditdeny = avd.auditdeny;
+}
+
+int te_table_build(struct policydb *p)
+{
+    struct te_table *t = &p->te_table;
+    u32 i, s, tt, ntypes = 0, nclasses = p->p_classes.nprim;
+    u16 c;
+
+    t->type_index = xzalloc_array(u32, p->p_types.nprim);
+    if ( !t->type_index )
+        return -ENOMEM;
+
+    for ( i = 0; i < p->p_types.nprim; i++ )
+    {
+        struct type_datum *type = p->type_val_to_struct[i];
+
+        if ( type && !type->attribute )
+            t->type_index[i] = ++ntypes;
+    }
+
+    if ( !ntypes || !nclasses ||
+         (u64)ntypes * ntypes * nclasses >
+         TE_TABLE_MAX_BYTES / sizeof(*t->av) )
+    {
+        printk(KERN_INFO "Flask:  %u types, %u classes: "
+               "computing decisions from the avtab\n", ntypes, nclasses);
+        te_table_destroy(p);
+        return 0;
+    }
+
+    t->av = vzalloc((size_t)ntypes * ntypes * nclasses * sizeof(*t->av));
+    if ( !t->av )
+    {
+        te_table_destroy(p);
+        return -ENOMEM;
+    }
+    t->ntypes = ntypes;
+    t->nclasses = nclasses;
+
+    for ( s = 1; s <= p->p_types.nprim; s++ )
+    {
+        if ( !t->type_index[s - 1] )
+            continue;
+        for ( tt = 1; tt <= p->p_types.nprim; tt++ )
+        {
+            if ( !t->type_index[tt - 1] )
+                continue;
+            for ( c = 1; c <= nclasses; c++ )
+                te_table_fill(p, s, tt, c);
+        }
+    }
+
+    return 0;
+}
+
+void te_table_destroy(struct policydb *p)
+{
+    struct te_table *t = &p->te_table;
+
+    vfree(t->av);
+    xfree(t->type_index);
+    memset(t, 0, sizeof(*t));
+}
+
+static void te_table_update_rules(struct policydb *p, struct cond_av_list *list)
+{
+    struct te_table *t = &p->te_table;
+    u32 s, tt;
+
+    for ( ; list; list = list->next )
+    {
+        struct avtab_key *key = &list->node->key;
+
+        if ( !(key->specified & AVTAB_AV) )
+            continue;
+
+        for ( s = 1; s <= p->p_types.nprim; s++ )
+        {
+            if ( !t->type_index[s - 1] ||
+                 !ebitmap_get_bit(&p->type_attr_map[s - 1],
+                                  key->source_type - 1) )
+                continue;
+            for ( tt = 1; tt <= p->p_types.nprim; tt++ )
+                if ( t->type_index[tt - 1] &&
+                     ebitmap_get_bit(&p->type_attr_map[tt - 1],
+                                     key->target_type - 1) )
+                    te_table_fill(p, s, tt, key->target_class);
+        }
+    }
+}
+
+/*
+ * Recompute the entries covered by the rules of a conditional whose state
+ * has just changed.
+ */
+void te_table_update_cond(struct policydb *p, struct cond_node *node)
+{
+    if ( !p->te_table.av )
+        return;
+
+    te_table_update_rules(p, node->true_list);
+    te_table_update_rules(p, node->false_list);
+}
+
+const struct te_av *te_table_lookup(struct policydb *p, u32 stype, u32 ttype,
+                                    u16 tclass)
+{
+    struct te_table *t = &p->te_table;
+    u32 sidx, tidx;
+
+    if ( !t->av || tclass > t->nclasses )
+        return NULL;
+
+    sidx = t->type_index[stype - 1];
+    tidx = t->type_index[ttype - 1];
+    if ( !sidx || !tidx )
+        return NULL;
+
+    return te_table_entry(t, sidx - 1, tidx - 1, tclass);
+}
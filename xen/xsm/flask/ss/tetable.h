@@ -0,0 +1,42 @@
+/*
+ * A type enforcement table (tetable) holds the access vectors of the
+ * type enforcement rules flattened into a dense array indexed by
+ * (source type, target type, class), so that computing the type
+ * enforcement part of a decision does not require walking the
+ * attributes of both types through the avtabs.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License version 2,
+ *      as published by the Free Software Foundation.
+ */
+
+#ifndef _SS_TETABLE_H_
+#define _SS_TETABLE_H_
+
+struct policydb;
+struct cond_node;
+struct av_decision;
+
+struct te_av {
+    u32 allowed;
+    u32 auditallow;
+    u32 auditdeny;
+};
+
+struct te_table {
+    u32 *type_index;    /* type value - 1 -> table index + 1, 0 if absent */
+    u32 ntypes;         /* number of types in the table */
+    u32 nclasses;
+    struct te_av *av;   /* [source][target][class - 1] */
+};
+
+void te_compute_av(struct policydb *p, u32 stype, u32 ttype, u16 tclass,
+                   struct av_decision *avd);
+
+int te_table_build(struct policydb *p);
+void te_table_destroy(struct policydb *p);
+void te_table_update_cond(struct policydb *p, struct cond_node *node);
+const struct te_av *te_table_lookup(struct policydb *p, u32 stype, u32 ttype,
+                                    u16 tclass);
+
+#endif    /* _SS_TETABLE_H_ */